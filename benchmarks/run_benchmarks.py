@@ -0,0 +1,426 @@
+#!/usr/bin/env python3
+# __BEGIN_LICENSE__
+#  Copyright (c) 2009-2013, United States Government as represented by the
+#  Administrator of the National Aeronautics and Space Administration. All
+#  rights reserved.
+#
+#  The NGT platform is licensed under the Apache License, Version 2.0 (the
+#  "License"); you may not use this file except in compliance with the
+#  License. You may obtain a copy of the License at
+#  http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+# __END_LICENSE__
+
+'''
+Run pinned datasets through the ASP tools, and record for each stage the
+wall and CPU time, the peak memory, and how far the outputs are from
+golden outputs. The results are appended to a JSON history, and runs for
+different commits can be compared. See README.rst in this directory.
+'''
+
+import argparse, datetime, hashlib, json, os, platform, re, shutil
+import subprocess, sys, time
+import os.path as P
+
+BENCH_DIR = P.dirname(P.abspath(__file__))
+REPO_DIR  = P.dirname(BENCH_DIR)
+
+FLOAT_RE = re.compile(r'[-+]?(?:\d+\.\d*|\.\d+|\d+)(?:[eE][-+]?\d+)?')
+
+def die(msg, code=1):
+    print(msg, file=sys.stderr)
+    sys.exit(code)
+
+def load_json(path):
+    with open(path, 'r') as f:
+        return json.load(f)
+
+def save_json(path, data):
+    '''Write to a temporary file first, so an interrupted run does not
+    leave behind a truncated file.'''
+    tmp = path + '.tmp' + str(os.getpid())
+    with open(tmp, 'w') as f:
+        json.dump(data, f, indent=2, sort_keys=True)
+        f.write('\n')
+    os.replace(tmp, path)
+
+def sha256(path):
+    h = hashlib.sha256()
+    with open(path, 'rb') as f:
+        for chunk in iter(lambda: f.read(1 << 20), b''):
+            h.update(chunk)
+    return h.hexdigest()
+
+def git_commit():
+    '''The commit being benchmarked, with a mark if there are local changes'''
+    try:
+        commit = subprocess.check_output(['git', '-C', REPO_DIR, 'rev-parse', 'HEAD'],
+                                         universal_newlines=True).strip()
+        dirty = subprocess.call(['git', '-C', REPO_DIR, 'diff', '--quiet', 'HEAD']) != 0
+        return commit + ('-dirty' if dirty else '')
+    except Exception:
+        return ''
+
+def parse_data_dirs(values):
+    '''Parse the name=dir values of --data-dir'''
+    dirs = {}
+    for val in values:
+        if '=' not in val:
+            die('Expecting --data-dir in the form <dataset>=<directory>, got: ' + val)
+        name, path = val.split('=', 1)
+        dirs[name] = P.abspath(path)
+    return dirs
+
+def dataset_dir(name, dataset, data_dirs):
+    '''Where the files of a dataset are, or None if not known'''
+    if name in data_dirs:
+        return data_dirs[name]
+    if dataset.get('data_dir', ''):
+        return P.join(REPO_DIR, dataset['data_dir'])
+    return None
+
+def check_files(name, dataset, data_dir):
+    '''Make sure the data files are there and match their checksums.
+    Return an error message, or an empty string.'''
+    for fname, checksum in sorted(dataset['files'].items()):
+        path = P.join(data_dir, fname)
+        if not P.exists(path):
+            return 'Missing: ' + path
+        if not checksum:
+            return ('The files of dataset ' + name + ' are not pinned. Run: ' +
+                    'run_benchmarks.py pin ' + name + ' --data-dir ' + name + '=' + data_dir)
+        if sha256(path) != checksum:
+            return 'Checksum mismatch, so the data is not the one pinned: ' + path
+    return ''
+
+def fill(arg, data_dir, out_dir):
+    return arg.replace('{data}', data_dir).replace('{out}', out_dir)
+
+def run_stage(stage, data_dir, out_dir, env):
+    '''Run the command of a stage. Measure its wall time, and from the
+    resources used by it and the processes it waited for, its CPU time
+    and peak memory.'''
+    cmd = [fill(arg, data_dir, out_dir) for arg in stage['command']]
+    log_dir = P.join(out_dir, 'logs')
+    os.makedirs(log_dir, exist_ok=True)
+    log_file = P.join(log_dir, stage['name'] + '.log')
+    print('Running: ' + ' '.join(cmd))
+
+    beg = time.time()
+    with open(log_file, 'w') as log:
+        try:
+            proc = subprocess.Popen(cmd, stdout=log, stderr=subprocess.STDOUT, env=env)
+        except OSError as e:
+            return {'name': stage['name'], 'status': 'failed to start: ' + str(e)}
+        _, status, usage = os.wait4(proc.pid, 0)
+        proc.returncode = os.waitstatus_to_exitcode(status) \
+                          if hasattr(os, 'waitstatus_to_exitcode') else (status >> 8)
+    wall = time.time() - beg
+
+    # ru_maxrss is in kilobytes on Linux and in bytes on macOS
+    rss_mb = usage.ru_maxrss / 1024.0
+    if sys.platform == 'darwin':
+        rss_mb /= 1024.0
+
+    result = {'name': stage['name'],
+              'status': 'ok' if proc.returncode == 0 else
+                        'exit code ' + str(proc.returncode) + ', see ' + log_file,
+              'wall_sec': round(wall, 3),
+              'cpu_sec': round(usage.ru_utime + usage.ru_stime, 3),
+              'peak_rss_mb': round(rss_mb, 1)}
+    print('  %s: %.1f s wall, %.1f s CPU, %.0f MB peak' %
+          (result['status'], result['wall_sec'], result['cpu_sec'], result['peak_rss_mb']))
+    return result
+
+def image_stats(path, env):
+    '''The minimum, maximum, mean, and standard deviation of each band'''
+    out = subprocess.check_output(['gdalinfo', '-json', '-stats', path],
+                                  universal_newlines=True, env=env)
+    info = json.loads(out)
+    stats = []
+    for band in info.get('bands', []):
+        stats.append([band.get('minimum'), band.get('maximum'),
+                      band.get('mean'), band.get('stdDev')])
+    return stats
+
+def compare_image_stats(out_file, golden_file, env):
+    '''How much the band statistics differ, relative to the golden spread'''
+    out  = image_stats(out_file, env)
+    gold = image_stats(golden_file, env)
+    if len(out) != len(gold):
+        return {'error': 'different number of bands'}
+    max_mean_diff = 0.0
+    max_stddev_ratio_diff = 0.0
+    for o, g in zip(out, gold):
+        if None in o or None in g:
+            return {'error': 'missing statistics'}
+        scale = max(g[3], 1e-12)
+        max_mean_diff = max(max_mean_diff, abs(o[2] - g[2]) / scale)
+        max_stddev_ratio_diff = max(max_stddev_ratio_diff, abs(o[3] / scale - 1.0))
+    return {'mean_diff_in_stddevs': max_mean_diff,
+            'stddev_rel_diff': max_stddev_ratio_diff}
+
+def compare_dem(out_file, golden_file, work_dir, env):
+    '''The statistics of the absolute difference of two DEMs, from geodiff'''
+    prefix = P.join(work_dir, 'geodiff', P.basename(out_file))
+    os.makedirs(P.dirname(prefix), exist_ok=True)
+    subprocess.check_call(['geodiff', '--absolute', '--stats-only', out_file, golden_file,
+                           '-o', prefix], stdout=subprocess.DEVNULL, env=env)
+    result = {}
+    keys = {'Number of differences': 'count', 'Max difference': 'max_abs_diff',
+            'Mean difference': 'mean_abs_diff', 'Median difference': 'median_abs_diff',
+            'NMAD of difference': 'nmad'}
+    with open(prefix + '-diff-stats.txt', 'r') as f:
+        for line in f:
+            name, _, val = line.partition(':')
+            if name.strip() in keys:
+                nums = FLOAT_RE.findall(val)
+                if nums:
+                    result[keys[name.strip()]] = float(nums[0])
+    return result
+
+def compare_numbers(out_file, golden_file):
+    '''The largest difference among the numbers in two text files'''
+    with open(out_file, 'r') as f:
+        out = [float(v) for v in FLOAT_RE.findall(f.read())]
+    with open(golden_file, 'r') as f:
+        gold = [float(v) for v in FLOAT_RE.findall(f.read())]
+    if len(out) != len(gold):
+        return {'error': 'found %d numbers, expected %d' % (len(out), len(gold))}
+    max_diff = 0.0
+    for o, g in zip(out, gold):
+        max_diff = max(max_diff, abs(o - g))
+    return {'max_abs_diff': max_diff}
+
+def check_outputs(stage, out_dir, golden_dir, update_golden, env):
+    '''Compare the outputs of a stage with the golden ones, or make
+    them the golden ones'''
+    results = []
+    for output in stage.get('outputs', []):
+        out_file = P.join(out_dir, output['file'])
+        golden_file = P.join(golden_dir, output['file'])
+        result = {'file': output['file'], 'compare': output['compare']}
+        try:
+            if not P.exists(out_file):
+                result['error'] = 'missing output'
+            elif update_golden:
+                os.makedirs(P.dirname(golden_file), exist_ok=True)
+                shutil.copyfile(out_file, golden_file)
+                result['golden'] = 'updated'
+            elif not P.exists(golden_file):
+                result['error'] = 'no golden output, run with --update-golden'
+            elif output['compare'] == 'image_stats':
+                result.update(compare_image_stats(out_file, golden_file, env))
+            elif output['compare'] == 'dem':
+                result.update(compare_dem(out_file, golden_file, out_dir, env))
+            elif output['compare'] == 'numbers':
+                result.update(compare_numbers(out_file, golden_file))
+            else:
+                result['error'] = 'unknown comparison: ' + output['compare']
+        except Exception as e:
+            result['error'] = str(e)
+        results.append(result)
+    return results
+
+def run_dataset(name, dataset, data_dir, opt, env):
+    out_dir = P.join(P.abspath(opt.work_dir), name)
+    if P.exists(out_dir):
+        shutil.rmtree(out_dir) # start clean, so no outputs are reused
+    os.makedirs(out_dir)
+    golden_dir = P.join(P.abspath(opt.golden_dir), name)
+
+    record = {'dataset': name,
+              'commit': git_commit(),
+              'date': datetime.datetime.now().isoformat(timespec='seconds'),
+              'host': platform.node(),
+              'num_cpus': os.cpu_count(),
+              'stages': []}
+    for stage in dataset['stages']:
+        if opt.stages and stage['name'] not in opt.stages:
+            continue
+        result = run_stage(stage, data_dir, out_dir, env)
+        if result['status'] == 'ok':
+            result['accuracy'] = check_outputs(stage, out_dir, golden_dir,
+                                               opt.update_golden, env)
+        record['stages'].append(result)
+        if result['status'] != 'ok':
+            break # the later stages need the outputs of this one
+    record['total_wall_sec'] = round(sum(s.get('wall_sec', 0.0)
+                                         for s in record['stages']), 3)
+    return record
+
+def do_run(opt):
+    datasets = load_json(opt.datasets_file)
+    data_dirs = parse_data_dirs(opt.data_dir)
+    names = opt.datasets.split(',') if opt.datasets else sorted(datasets.keys())
+
+    env = dict(os.environ)
+    if opt.bin_dir:
+        env['PATH'] = P.abspath(opt.bin_dir) + os.pathsep + env.get('PATH', '')
+
+    history = {'runs': []}
+    if P.exists(opt.history):
+        history = load_json(opt.history)
+
+    os.makedirs(opt.work_dir, exist_ok=True)
+    for name in names:
+        if name not in datasets:
+            die('Unknown dataset: ' + name)
+        dataset = datasets[name]
+        data_dir = dataset_dir(name, dataset, data_dirs)
+        if data_dir is None:
+            print('Skipping dataset ' + name + ', as its data was not given with --data-dir.')
+            continue
+        msg = check_files(name, dataset, data_dir)
+        if msg:
+            if opt.datasets:
+                die(msg)
+            print('Skipping dataset ' + name + '. ' + msg)
+            continue
+        print('Dataset: ' + name)
+        record = run_dataset(name, dataset, data_dir, opt, env)
+        if not opt.update_golden:
+            history['runs'].append(record)
+            save_json(opt.history, history) # save as we go
+    print('History: ' + opt.history)
+
+def ratio_str(new, old):
+    if old is None or new is None or old <= 0:
+        return '   n/a'
+    return '%+5.0f%%' % (100.0 * (new / old - 1.0))
+
+def do_compare(opt):
+    '''Compare the latest run of each dataset with an earlier run. Return
+    the number of regressions.'''
+    runs = load_json(opt.history)['runs']
+    num_regressions = 0
+    for name in sorted(set(r['dataset'] for r in runs)):
+        ds_runs = [r for r in runs if r['dataset'] == name]
+        if opt.commit:
+            ds_runs_new = [r for r in ds_runs if r['commit'].startswith(opt.commit)]
+        else:
+            ds_runs_new = ds_runs
+        if not ds_runs_new:
+            continue
+        new = ds_runs_new[-1]
+
+        # Timings are only comparable on the same host
+        cands = [r for r in ds_runs if r is not new and r['host'] == new['host']]
+        if opt.base:
+            cands = [r for r in cands if r['commit'].startswith(opt.base)]
+        else:
+            cands = [r for r in cands if ds_runs.index(r) < ds_runs.index(new)]
+        if not cands:
+            print(name + ': no earlier run on ' + new['host'] + ' to compare with.')
+            continue
+        old = cands[-1]
+
+        print('%s: %s (%s) vs %s (%s), on %s' % (name, new['commit'][:12], new['date'],
+                                                 old['commit'][:12], old['date'], new['host']))
+        print('  %-15s %10s %7s %10s %7s' % ('stage', 'wall (s)', 'change', 'peak (MB)', 'change'))
+        old_stages = dict((s['name'], s) for s in old['stages'])
+        for s in new['stages']:
+            o = old_stages.get(s['name'], {})
+            flags = []
+            for key in ['wall_sec', 'peak_rss_mb']:
+                if o.get(key) and s.get(key) and s[key] > (1.0 + opt.threshold) * o[key]:
+                    flags.append('slower' if key == 'wall_sec' else 'more memory')
+            if s['status'] != 'ok':
+                flags.append(s['status'])
+            num_regressions += len(flags)
+            print('  %-15s %10.1f %7s %10.0f %7s  %s' %
+                  (s['name'], s.get('wall_sec', 0.0), ratio_str(s.get('wall_sec'), o.get('wall_sec')),
+                   s.get('peak_rss_mb', 0.0),
+                   ratio_str(s.get('peak_rss_mb'), o.get('peak_rss_mb')), ', '.join(flags)))
+            for acc in s.get('accuracy', []):
+                vals = ', '.join('%s: %.6g' % (k, v) for k, v in sorted(acc.items())
+                                 if isinstance(v, float))
+                if 'error' in acc:
+                    vals = 'error: ' + acc['error']
+                print('    %s (%s) %s' % (acc['file'], acc['compare'], vals))
+    return num_regressions
+
+def do_pin(opt):
+    '''Record the checksums of the files of a dataset'''
+    datasets = load_json(opt.datasets_file)
+    if opt.dataset not in datasets:
+        die('Unknown dataset: ' + opt.dataset)
+    dataset = datasets[opt.dataset]
+    data_dir = dataset_dir(opt.dataset, dataset, parse_data_dirs(opt.data_dir))
+    if data_dir is None:
+        die('Set the data directory with --data-dir ' + opt.dataset + '=<directory>.')
+    for fname in sorted(dataset['files'].keys()):
+        path = P.join(data_dir, fname)
+        if not P.exists(path):
+            die('Missing: ' + path)
+        dataset['files'][fname] = sha256(path)
+        print(fname + ': ' + dataset['files'][fname])
+    save_json(opt.datasets_file, datasets)
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawTextHelpFormatter)
+    parser.add_argument('--datasets-file', default=P.join(BENCH_DIR, 'datasets.json'),
+                        help='The definitions of the datasets and their stages.')
+    parser.add_argument('--data-dir', action='append', default=[],
+                        help='Where the files of a dataset not in the repository are, ' +
+                        'as <dataset>=<directory>. Can be repeated.')
+    sub = parser.add_subparsers(dest='command')
+
+    run = sub.add_parser('run', help='Run the datasets and append the results to the history.')
+    run.add_argument('--datasets', default='',
+                     help='Comma-separated datasets to run. Default: all those with data.')
+    run.add_argument('--stages', default='',
+                     help='Comma-separated stages to run. Default: all.')
+    run.add_argument('--bin-dir', default='',
+                     help='The directory with the ASP tools to benchmark. Default: use the PATH.')
+    run.add_argument('--work-dir', default='benchmark_runs',
+                     help='Where to write the outputs. Each dataset is run from scratch.')
+    run.add_argument('--golden-dir', default='',
+                     help='Where the golden outputs are. Default: <work dir>/golden.')
+    run.add_argument('--history', default='',
+                     help='The JSON history to append to. Default: <work dir>/history.json.')
+    run.add_argument('--update-golden', action='store_true',
+                     help='Save the outputs as the golden ones, rather than comparing ' +
+                     'with them. The history is not changed.')
+
+    comp = sub.add_parser('compare', help='Compare the latest runs with earlier ones.')
+    comp.add_argument('--history', default=P.join('benchmark_runs', 'history.json'))
+    comp.add_argument('--commit', default='',
+                      help='Compare the latest run of this commit. Default: the latest run.')
+    comp.add_argument('--base', default='',
+                      help='Compare with the latest run of this commit. ' +
+                      'Default: the run before, on the same host.')
+    comp.add_argument('--threshold', type=float, default=0.1,
+                      help='Flag the stages which take this much more time or memory.')
+    comp.add_argument('--fail-on-regression', action='store_true',
+                      help='Exit with a nonzero status if any stage is flagged.')
+
+    pin = sub.add_parser('pin', help='Record the checksums of the files of a dataset.')
+    pin.add_argument('dataset')
+
+    opt = parser.parse_args()
+    if opt.command == 'run':
+        opt.stages = [s for s in opt.stages.split(',') if s]
+        if not opt.golden_dir:
+            opt.golden_dir = P.join(opt.work_dir, 'golden')
+        if not opt.history:
+            opt.history = P.join(opt.work_dir, 'history.json')
+        do_run(opt)
+    elif opt.command == 'compare':
+        num_regressions = do_compare(opt)
+        if num_regressions > 0 and opt.fail_on_regression:
+            sys.exit(1)
+    elif opt.command == 'pin':
+        do_pin(opt)
+    else:
+        parser.print_help()
+        sys.exit(1)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,253 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file ApproxCameraModel.cc
+///
+
+#include <asp/Camera/ApproxCameraModel.h>
+#include <vw/Core/Exception.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace vw;
+
+namespace {
+
+  // The DEM is split into tiles of this size in pixels, each of which
+  // may be split further down to the minimum size.
+  const int    APPROX_TILE_SIZE     = 256;
+  const double APPROX_MIN_NODE_SIZE = 4.0;
+
+  // Heights this far outside the given range, as a fraction of half the
+  // range, still use the approximation.
+  const double APPROX_HEIGHT_MARGIN = 0.1;
+
+  bool is_good(Vector2 const& pix) {
+    return std::isfinite(pix[0]) && std::isfinite(pix[1]);
+  }
+
+} // end anonymous namespace
+
+namespace asp {
+
+ApproxCameraModel::ApproxCameraModel(boost::shared_ptr<vw::camera::CameraModel> exact_camera,
+                                     vw::cartography::GeoReference const& dem_georef,
+                                     vw::Vector2i const& dem_size,
+                                     double min_height, double max_height,
+                                     double max_error):
+  m_exact_camera(exact_camera), m_dem_georef(dem_georef), m_dem_size(dem_size),
+  m_max_error(max_error) {
+
+  if (!m_exact_camera)
+    vw_throw(ArgumentErr() << "ApproxCameraModel: No camera to approximate.\n");
+  if (dem_size[0] <= 0 || dem_size[1] <= 0)
+    vw_throw(ArgumentErr() << "ApproxCameraModel: The DEM is empty.\n");
+  if (!(min_height <= max_height))
+    vw_throw(ArgumentErr() << "ApproxCameraModel: Invalid height range: "
+             << min_height << ' ' << max_height << ".\n");
+  if (!(max_error > 0))
+    vw_throw(ArgumentErr() << "ApproxCameraModel: The error bound must be positive.\n");
+
+  // A flat DEM still gets a height range, so the fit is well-posed
+  m_mid_height        = 0.5 * (min_height + max_height);
+  m_half_height_range = std::max(0.5 * (max_height - min_height), 1.0);
+
+  m_num_tile_cols = (dem_size[0] + APPROX_TILE_SIZE - 1) / APPROX_TILE_SIZE;
+  m_num_tile_rows = (dem_size[1] + APPROX_TILE_SIZE - 1) / APPROX_TILE_SIZE;
+  int num_tiles = m_num_tile_cols * m_num_tile_rows;
+  m_tiles.resize(num_tiles);
+  m_tile_once.reset(new std::once_flag[num_tiles]);
+}
+
+Vector3 ApproxCameraModel::dem_to_xyz(Vector2 const& dem_pix, double height) const {
+  Vector2 lonlat = m_dem_georef.pixel_to_lonlat(dem_pix);
+  return m_dem_georef.datum().geodetic_to_cartesian(Vector3(lonlat[0], lonlat[1], height));
+}
+
+Vector2 ApproxCameraModel::apply_fit(Node const& node, Vector2 const& dem_pix,
+                                     double height) const {
+  Vector2 half = node.box.size() / 2.0;
+  Vector2 ctr  = node.box.min() + half;
+  double u = (dem_pix[0] - ctr[0]) / half[0];
+  double v = (dem_pix[1] - ctr[1]) / half[1];
+  double s = (height - m_mid_height) / m_half_height_range;
+  Matrix<double, 2, 4> const& A = node.fit;
+  return Vector2(A(0, 0) + A(0, 1) * u + A(0, 2) * v + A(0, 3) * s,
+                 A(1, 0) + A(1, 1) * u + A(1, 2) * v + A(1, 3) * s);
+}
+
+void ApproxCameraModel::fit_node(std::vector<Node> & nodes, int index) const {
+
+  BBox2 box = nodes[index].box;
+  Vector2 half = box.size() / 2.0;
+  Vector2 ctr  = box.min() + half;
+
+  // Sample the camera on a 3x3 grid over the box, at the lowest and
+  // highest heights. These samples are symmetric about the center, so
+  // the normal equations of the least squares fit are diagonal, and each
+  // coefficient is a weighted sum of the samples.
+  Matrix<double, 2, 4> fit;
+  for (int r = 0; r < 2; r++)
+    for (int c = 0; c < 4; c++)
+      fit(r, c) = 0.0;
+  std::vector<Vector2> pixels;
+  std::vector<Vector3> coords; // u, v, s
+  int num_good = 0;
+  for (int k = -1; k <= 1; k += 2) {
+    for (int j = -1; j <= 1; j++) {
+      for (int i = -1; i <= 1; i++) {
+        Vector2 dem_pix(ctr[0] + i * half[0], ctr[1] + j * half[1]);
+        Vector2 cam_pix(std::numeric_limits<double>::quiet_NaN(),
+                        std::numeric_limits<double>::quiet_NaN());
+        try {
+          cam_pix = m_exact_camera->point_to_pixel
+            (dem_to_xyz(dem_pix, m_mid_height + k * m_half_height_range));
+        } catch (...) {}
+        if (is_good(cam_pix))
+          num_good++;
+        pixels.push_back(cam_pix);
+        coords.push_back(Vector3(i, j, k));
+      }
+    }
+  }
+
+  bool can_split = (half[0] >= APPROX_MIN_NODE_SIZE && half[1] >= APPROX_MIN_NODE_SIZE);
+  bool need_split = false;
+  if (num_good == 0) {
+    // The camera does not see this part of the DEM at all
+    nodes[index].valid = false;
+    return;
+  } else if (num_good < int(pixels.size())) {
+    // Part of the box is seen. Smaller boxes may be seen in full.
+    need_split = true;
+  } else {
+    for (size_t n = 0; n < pixels.size(); n++) {
+      Vector3 const& c = coords[n];
+      for (int r = 0; r < 2; r++) {
+        fit(r, 0) += pixels[n][r] / 18.0;
+        fit(r, 1) += c[0] * pixels[n][r] / 12.0;
+        fit(r, 2) += c[1] * pixels[n][r] / 12.0;
+        fit(r, 3) += c[2] * pixels[n][r] / 18.0;
+      }
+    }
+    nodes[index].fit = fit;
+
+    // The error at the samples, and at points halfway between them at
+    // the middle height, where it is the largest for a smooth camera.
+    double max_err = 0.0;
+    for (size_t n = 0; n < pixels.size(); n++) {
+      Vector3 const& c = coords[n];
+      Vector2 dem_pix(ctr[0] + c[0] * half[0], ctr[1] + c[1] * half[1]);
+      double height = m_mid_height + c[2] * m_half_height_range;
+      max_err = std::max(max_err, norm_2(apply_fit(nodes[index], dem_pix, height)
+                                         - pixels[n]));
+    }
+    for (int j = -1; j <= 1 && max_err <= m_max_error; j += 2) {
+      for (int i = -1; i <= 1 && max_err <= m_max_error; i += 2) {
+        Vector2 dem_pix(ctr[0] + 0.5 * i * half[0], ctr[1] + 0.5 * j * half[1]);
+        Vector2 cam_pix;
+        try {
+          cam_pix = m_exact_camera->point_to_pixel(dem_to_xyz(dem_pix, m_mid_height));
+        } catch (...) {
+          max_err = std::numeric_limits<double>::max();
+          break;
+        }
+        if (!is_good(cam_pix)) {
+          max_err = std::numeric_limits<double>::max();
+          break;
+        }
+        max_err = std::max(max_err,
+                           norm_2(apply_fit(nodes[index], dem_pix, m_mid_height) - cam_pix));
+      }
+    }
+
+    if (max_err <= m_max_error) {
+      nodes[index].valid = true;
+      return;
+    }
+    need_split = true;
+  }
+
+  if (!need_split || !can_split) {
+    // Cannot do better than the exact camera here
+    nodes[index].valid = false;
+    return;
+  }
+
+  // Split into four. Child i + 2*j is in half i of the box along the
+  // columns and half j along the rows.
+  int first_child = nodes.size();
+  nodes[index].child = first_child;
+  for (int j = 0; j < 2; j++) {
+    for (int i = 0; i < 2; i++) {
+      Node child;
+      child.child = -1;
+      child.valid = false;
+      Vector2 corner(box.min()[0] + i * half[0], box.min()[1] + j * half[1]);
+      child.box = BBox2(corner, corner + half);
+      nodes.push_back(child);
+    }
+  }
+  for (int c = 0; c < 4; c++)
+    fit_node(nodes, first_child + c);
+}
+
+Vector2 ApproxCameraModel::point_to_pixel(Vector3 const& point) const {
+
+  Vector3 llh = m_dem_georef.datum().cartesian_to_geodetic(point);
+  double height = llh[2];
+  if (std::abs(height - m_mid_height) > (1.0 + APPROX_HEIGHT_MARGIN) * m_half_height_range)
+    return m_exact_camera->point_to_pixel(point);
+
+  Vector2 dem_pix = m_dem_georef.lonlat_to_pixel(Vector2(llh[0], llh[1]));
+  int tile_col = std::floor(dem_pix[0] / APPROX_TILE_SIZE);
+  int tile_row = std::floor(dem_pix[1] / APPROX_TILE_SIZE);
+  if (!(dem_pix[0] >= 0 && dem_pix[1] >= 0 && dem_pix[0] < m_dem_size[0] &&
+        dem_pix[1] < m_dem_size[1]) ||
+      tile_col < 0 || tile_col >= m_num_tile_cols ||
+      tile_row < 0 || tile_row >= m_num_tile_rows)
+    return m_exact_camera->point_to_pixel(point);
+
+  // Fit the tile on first use
+  int tile_index = tile_row * m_num_tile_cols + tile_col;
+  std::vector<Node> & nodes = m_tiles[tile_index];
+  std::call_once(m_tile_once[tile_index], [&]() {
+      Node root;
+      root.child = -1;
+      root.valid = false;
+      Vector2 corner(tile_col * APPROX_TILE_SIZE, tile_row * APPROX_TILE_SIZE);
+      root.box = BBox2(corner, corner + Vector2(APPROX_TILE_SIZE, APPROX_TILE_SIZE));
+      nodes.push_back(root);
+      this->fit_node(nodes, 0);
+    });
+
+  // Go down the quadtree to the leaf with this point
+  int index = 0;
+  while (nodes[index].child >= 0) {
+    Vector2 mid = nodes[index].box.min() + nodes[index].box.size() / 2.0;
+    index = nodes[index].child + (dem_pix[0] >= mid[0]) + 2 * (dem_pix[1] >= mid[1]);
+  }
+
+  if (!nodes[index].valid)
+    return m_exact_camera->point_to_pixel(point);
+
+  return apply_fit(nodes[index], dem_pix, height);
+}
+
+} // end namespace asp
@@ -0,0 +1,111 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file ApproxCameraModel.h
+///
+/// A camera model which approximates point_to_pixel() of another camera,
+/// for ground points over a DEM. The DEM pixel domain is split into tiles,
+/// and in each tile the camera pixel is fit as an affine function of the
+/// DEM column, row, and height, over the given height range. A tile whose
+/// fit differs from the camera by more than the error bound is split into
+/// four, down to a minimum size. Tiles are fit the first time a point
+/// projects into them, so only the part of the DEM seen by the camera is
+/// ever sampled. Points outside the DEM or the height range, and in tiles
+/// where the camera could not be fit, are projected with the exact
+/// camera. The other camera functions always use the exact camera.
+
+#ifndef __ASP_CAMERA_APPROX_CAMERA_MODEL_H__
+#define __ASP_CAMERA_APPROX_CAMERA_MODEL_H__
+
+#include <vw/Camera/CameraModel.h>
+#include <vw/Cartography/GeoReference.h>
+#include <vw/Math/BBox.h>
+#include <vw/Math/Matrix.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace asp {
+
+  class ApproxCameraModel: public vw::camera::CameraModel {
+  public:
+
+    /// The DEM has the given georeference and size in pixels. Its heights,
+    /// above the datum, are expected to be between min_height and
+    /// max_height. The approximation will differ from the exact camera by
+    /// no more than max_error pixels, other than in tiles of the minimum
+    /// size.
+    ApproxCameraModel(boost::shared_ptr<vw::camera::CameraModel> exact_camera,
+                      vw::cartography::GeoReference const& dem_georef,
+                      vw::Vector2i const& dem_size,
+                      double min_height, double max_height,
+                      double max_error);
+
+    virtual ~ApproxCameraModel() {}
+    virtual std::string type() const { return "Approx"; }
+
+    virtual vw::Vector2 point_to_pixel (vw::Vector3 const& point) const;
+    virtual vw::Vector3 pixel_to_vector(vw::Vector2 const& pix) const {
+      return m_exact_camera->pixel_to_vector(pix);
+    }
+    virtual vw::Vector3 camera_center(vw::Vector2 const& pix) const {
+      return m_exact_camera->camera_center(pix);
+    }
+    virtual vw::Quat camera_pose(vw::Vector2 const& pix) const {
+      return m_exact_camera->camera_pose(pix);
+    }
+
+    boost::shared_ptr<vw::camera::CameraModel> exact_camera() const {
+      return m_exact_camera;
+    }
+
+  private:
+
+    // A node of the quadtree of a tile. The fit maps (1, u, v, s) to the
+    // camera pixel, with u, v, s the DEM column, row, and height,
+    // normalized to [-1, 1] over the node box and the height range.
+    struct Node {
+      vw::BBox2 box;
+      int  child; // index of the first of the four children, or -1 if a leaf
+      bool valid; // if false, the exact camera must be used
+      vw::Matrix<double, 2, 4> fit;
+    };
+
+    // Fit the node with given index, and split it if needed
+    void fit_node(std::vector<Node> & nodes, int index) const;
+
+    vw::Vector2 apply_fit(Node const& node, vw::Vector2 const& dem_pix, double height) const;
+    vw::Vector3 dem_to_xyz(vw::Vector2 const& dem_pix, double height) const;
+
+    boost::shared_ptr<vw::camera::CameraModel> m_exact_camera;
+    vw::cartography::GeoReference m_dem_georef;
+    vw::Vector2i m_dem_size;
+    double m_mid_height, m_half_height_range, m_max_error;
+    int m_num_tile_cols, m_num_tile_rows;
+
+    // Each tile is fit once, on first use
+    mutable std::vector<std::vector<Node>> m_tiles;
+    std::unique_ptr<std::once_flag[]> m_tile_once;
+  };
+
+} // end namespace asp
+
+#endif // __ASP_CAMERA_APPROX_CAMERA_MODEL_H__
@@ -0,0 +1,277 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file BatchProjection.cc
+///
+
+#include <asp/Camera/BatchProjection.h>
+#include <asp/Camera/RPCModel.h>
+#include <asp/Camera/LinescanDGModel.h>
+#include <asp/Camera/LinescanSpotModel.h>
+#include <asp/Camera/LinescanASTERModel.h>
+#include <asp/Camera/LinescanPeruSatModel.h>
+#include <asp/Core/StereoSettings.h>
+
+#include <vw/Camera/LinescanModel.h>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace vw;
+
+namespace asp {
+
+namespace {
+
+  // Project the points one at a time with a camera having a
+  // point_to_pixel(point, starty) function, seeding each point with the
+  // line of the last one which projected.
+  template <class CamT>
+  void warm_started_points_to_pixels(CamT const* camera,
+                                     std::vector<Vector3> const& points,
+                                     std::vector<Vector2>      & pixels,
+                                     std::vector<unsigned char>& valid) {
+    double starty = -1; // no guess
+    for (size_t i = 0; i < points.size(); i++) {
+      try {
+        pixels[i] = camera->point_to_pixel(points[i], starty);
+        valid[i]  = 1;
+        starty    = pixels[i].y();
+      } catch (...) {
+        // A bad guess must not spoil the next point
+        starty = -1;
+      }
+    }
+  }
+
+} // end anonymous namespace
+
+void points_to_pixels(vw::camera::CameraModel const* camera,
+                      std::vector<vw::Vector3> const& points,
+                      std::vector<vw::Vector2>      & pixels,
+                      std::vector<unsigned char>    & valid) {
+
+  if (camera == NULL)
+    vw_throw(ArgumentErr() << "points_to_pixels: Expecting a valid camera.\n");
+
+  pixels.assign(points.size(), Vector2());
+  valid.assign(points.size(), 0);
+
+  RPCModel const* rpc = dynamic_cast<RPCModel const*>(camera);
+  if (rpc != NULL) {
+    rpc->points_to_pixels(points, pixels, valid);
+    return;
+  }
+
+  // The DG model has no use for a guess when the CSM model does the work
+  DGCameraModel const* dg = dynamic_cast<DGCameraModel const*>(camera);
+  if (dg != NULL && !stereo_settings().dg_use_csm) {
+    warm_started_points_to_pixels(dg, points, pixels, valid);
+    return;
+  }
+
+  SPOTCameraModel const* spot = dynamic_cast<SPOTCameraModel const*>(camera);
+  if (spot != NULL) {
+    warm_started_points_to_pixels(spot, points, pixels, valid);
+    return;
+  }
+
+  ASTERCameraModel const* aster = dynamic_cast<ASTERCameraModel const*>(camera);
+  if (aster != NULL) {
+    warm_started_points_to_pixels(aster, points, pixels, valid);
+    return;
+  }
+
+  PeruSatCameraModel const* perusat = dynamic_cast<PeruSatCameraModel const*>(camera);
+  if (perusat != NULL) {
+    warm_started_points_to_pixels(perusat, points, pixels, valid);
+    return;
+  }
+
+  // Any other camera, including adjusted ones, projects one point at a time
+  for (size_t i = 0; i < points.size(); i++) {
+    try {
+      pixels[i] = camera->point_to_pixel(points[i]);
+      valid[i]  = 1;
+    } catch (...) {}
+  }
+}
+
+void pixels_to_vectors(vw::camera::CameraModel const* camera,
+                       std::vector<vw::Vector2> const& pixels,
+                       std::vector<vw::Vector3>      & vectors,
+                       std::vector<unsigned char>    & valid) {
+
+  if (camera == NULL)
+    vw_throw(ArgumentErr() << "pixels_to_vectors: Expecting a valid camera.\n");
+
+  vectors.assign(pixels.size(), Vector3());
+  valid.assign(pixels.size(), 0);
+
+  for (size_t i = 0; i < pixels.size(); i++) {
+    try {
+      vectors[i] = camera->pixel_to_vector(pixels[i]);
+      valid[i]   = 1;
+    } catch (...) {}
+  }
+}
+
+void pixels_to_rays(vw::camera::CameraModel const* camera,
+                    std::vector<vw::Vector2> const& pixels,
+                    std::vector<vw::Vector3>      & centers,
+                    std::vector<vw::Vector3>      & vectors,
+                    std::vector<unsigned char>    & valid) {
+
+  if (camera == NULL)
+    vw_throw(ArgumentErr() << "pixels_to_rays: Expecting a valid camera.\n");
+
+  centers.assign(pixels.size(), Vector3());
+  vectors.assign(pixels.size(), Vector3());
+  valid.assign(pixels.size(), 0);
+
+  // For a linescan camera the center and the pose depend only on the
+  // line. Without the velocity aberration and refraction corrections the
+  // ray is the pose applied to the ray in the camera frame, so the pose
+  // can be found once per line. The DG model in CSM mode has no ray in
+  // the camera frame, but its center still depends only on the line.
+  vw::camera::LinescanModel const* ls
+    = dynamic_cast<vw::camera::LinescanModel const*>(camera);
+  bool reuse_pose = (ls != NULL &&
+                     !stereo_settings().enable_correct_velocity_aberration &&
+                     !stereo_settings().enable_correct_atmospheric_refraction);
+  if (dynamic_cast<DGCameraModel const*>(camera) != NULL && stereo_settings().dg_use_csm)
+    reuse_pose = false;
+
+  bool have_line = false;
+  double line = 0.0;
+  Vector3 line_center;
+  vw::Quat line_pose;
+  for (size_t i = 0; i < pixels.size(); i++) {
+    Vector2 const& pix = pixels[i];
+    try {
+      if (ls == NULL) {
+        centers[i] = camera->camera_center(pix);
+        vectors[i] = camera->pixel_to_vector(pix);
+        valid[i]   = 1;
+        continue;
+      }
+
+      if (!have_line || pix.y() != line) {
+        have_line = false; // in case this throws
+        line = pix.y();
+        if (reuse_pose) {
+          double t = ls->get_time_at_line(line);
+          line_center = ls->get_camera_center_at_time(t);
+          line_pose   = ls->get_camera_pose_at_time(t);
+        } else {
+          line_center = camera->camera_center(pix);
+        }
+        have_line = true;
+      }
+
+      centers[i] = line_center;
+      if (reuse_pose)
+        vectors[i] = normalize(line_pose.rotate(ls->get_local_pixel_vector(pix)));
+      else
+        vectors[i] = camera->pixel_to_vector(pix);
+      valid[i] = 1;
+    } catch (...) {}
+  }
+}
+
+void RayLattice::build(vw::camera::CameraModel const* camera, vw::BBox2 const& box,
+                       int spacing) {
+
+  if (spacing < 1)
+    vw_throw(ArgumentErr() << "RayLattice: The spacing must be positive.\n");
+
+  m_spacing = spacing;
+  m_cols = 0;
+  m_rows = 0;
+  m_centers.clear();
+  m_vectors.clear();
+  m_valid.clear();
+  if (box.empty())
+    return;
+
+  // Nodes at multiples of the spacing, so that the lattices of
+  // neighboring tiles agree where they overlap
+  m_origin = Vector2(spacing * std::floor(box.min().x() / spacing),
+                     spacing * std::floor(box.min().y() / spacing));
+  // A pixel must be strictly inside the lattice, so there is a node past the box
+  m_cols = int(std::floor((box.max().x() - m_origin.x()) / spacing)) + 2;
+  m_rows = int(std::floor((box.max().y() - m_origin.y()) / spacing)) + 2;
+
+  // Row by row, so a linescan camera finds the pose once per row
+  std::vector<Vector2> nodes(size_t(m_cols) * m_rows);
+  for (int row = 0; row < m_rows; row++)
+    for (int col = 0; col < m_cols; col++)
+      nodes[size_t(row) * m_cols + col]
+        = m_origin + Vector2(double(col) * spacing, double(row) * spacing);
+  pixels_to_rays(camera, nodes, m_centers, m_vectors, m_valid);
+}
+
+bool RayLattice::cell(vw::Vector2 const& pix, int & col, int & row,
+                      double & wx, double & wy) const {
+  double x = (pix.x() - m_origin.x()) / m_spacing;
+  double y = (pix.y() - m_origin.y()) / m_spacing;
+  // This also fails for NaN
+  if (!(x >= 0.0 && y >= 0.0 && x < m_cols - 1 && y < m_rows - 1))
+    return false;
+  col = int(x);
+  row = int(y);
+  wx  = x - col;
+  wy  = y - row;
+  size_t k = size_t(row) * m_cols + col;
+  return m_valid[k] && m_valid[k + 1] && m_valid[k + m_cols] && m_valid[k + m_cols + 1];
+}
+
+bool RayLattice::ray(vw::Vector2 const& pix, vw::Vector3 & center,
+                     vw::Vector3 & vector) const {
+  int col = 0, row = 0;
+  double wx = 0.0, wy = 0.0;
+  if (!cell(pix, col, row, wx, wy))
+    return false;
+
+  size_t k = size_t(row) * m_cols + col;
+  double w00 = (1.0 - wx) * (1.0 - wy), w01 = wx * (1.0 - wy);
+  double w10 = (1.0 - wx) * wy,         w11 = wx * wy;
+  center = w00 * m_centers[k]          + w01 * m_centers[k + 1]
+         + w10 * m_centers[k + m_cols] + w11 * m_centers[k + m_cols + 1];
+  vector = w00 * m_vectors[k]          + w01 * m_vectors[k + 1]
+         + w10 * m_vectors[k + m_cols] + w11 * m_vectors[k + m_cols + 1];
+  double len = norm_2(vector);
+  if (!(len > 0.0))
+    return false;
+  vector /= len;
+  return true;
+}
+
+double RayLattice::pixel_angle(vw::Vector2 const& pix) const {
+  int col = 0, row = 0;
+  double wx = 0.0, wy = 0.0;
+  if (!cell(pix, col, row, wx, wy))
+    return 0.0;
+  size_t k = size_t(row) * m_cols + col;
+  // For unit vectors the chord is very close to the angle
+  double dx = norm_2(m_vectors[k + 1] - m_vectors[k]);
+  double dy = norm_2(m_vectors[k + m_cols] - m_vectors[k]);
+  return std::max(dx, dy) / m_spacing;
+}
+
+} // end namespace asp
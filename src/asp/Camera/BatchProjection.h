@@ -0,0 +1,94 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file BatchProjection.h
+///
+/// Project many points into a camera, or find the rays through many
+/// pixels, with one call. The work which does not depend on the
+/// individual point is done once, and for the linescan models the line
+/// found for a point is the initial guess for the next one. Hence the
+/// points should be passed in the order they occur, such as along a row
+/// or column of a DEM. A point which fails to project is flagged as
+/// invalid rather than throwing.
+
+#ifndef __ASP_CAMERA_BATCH_PROJECTION_H__
+#define __ASP_CAMERA_BATCH_PROJECTION_H__
+
+#include <vw/Camera/CameraModel.h>
+#include <vw/Math/BBox.h>
+#include <vw/Math/Vector.h>
+
+#include <vector>
+
+namespace asp {
+
+  /// Project the given points into the camera. On output, valid[i] is 1 if
+  /// pixels[i] was found, and 0 otherwise.
+  void points_to_pixels(vw::camera::CameraModel const* camera,
+                        std::vector<vw::Vector3> const& points,
+                        std::vector<vw::Vector2>      & pixels,
+                        std::vector<unsigned char>    & valid);
+
+  /// Find the camera rays through the given pixels. On output, valid[i] is
+  /// 1 if vectors[i] was found, and 0 otherwise.
+  void pixels_to_vectors(vw::camera::CameraModel const* camera,
+                         std::vector<vw::Vector2> const& pixels,
+                         std::vector<vw::Vector3>      & vectors,
+                         std::vector<unsigned char>    & valid);
+
+  /// Find the camera centers and the rays through the given pixels. For
+  /// the linescan models the pose is found once for each image line, so
+  /// pixels on the same line should be passed one after another.
+  void pixels_to_rays(vw::camera::CameraModel const* camera,
+                      std::vector<vw::Vector2> const& pixels,
+                      std::vector<vw::Vector3>      & centers,
+                      std::vector<vw::Vector3>      & vectors,
+                      std::vector<unsigned char>    & valid);
+
+  /// Camera rays found exactly on a square lattice of pixels, and
+  /// interpolated bilinearly in between. Much faster than finding each
+  /// ray for cameras which are costly to evaluate, such as linescan ones.
+  class RayLattice {
+  public:
+    RayLattice(): m_spacing(0), m_cols(0), m_rows(0) {}
+
+    /// Cover the given box of pixels with nodes this many pixels apart
+    void build(vw::camera::CameraModel const* camera, vw::BBox2 const& box, int spacing);
+
+    bool empty() const { return m_cols == 0; }
+
+    /// The interpolated ray, with a unit vector. Return false outside
+    /// the lattice, or if there is no ray at one of the neighboring nodes.
+    bool ray(vw::Vector2 const& pix, vw::Vector3 & center, vw::Vector3 & vector) const;
+
+    /// The angle, in radians, between the rays through neighboring pixels
+    /// close to this one. Zero if not known.
+    double pixel_angle(vw::Vector2 const& pix) const;
+
+  private:
+    bool cell(vw::Vector2 const& pix, int & col, int & row, double & wx, double & wy) const;
+
+    vw::Vector2 m_origin;
+    int m_spacing, m_cols, m_rows;
+    std::vector<vw::Vector3> m_centers, m_vectors;
+    std::vector<unsigned char> m_valid;
+  };
+
+} // end namespace asp
+
+#endif // __ASP_CAMERA_BATCH_PROJECTION_H__
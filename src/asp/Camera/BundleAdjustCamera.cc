@@ -23,8 +23,12 @@
 
 #include <asp/Camera/BundleAdjustCamera.h>
 #include <asp/Core/IpMatchingAlgs.h>         // Lightweight header
+#include <asp/Core/MatchDatabase.h>
+#include <asp/Core/MatchSet.h>
 
 #include <vw/Cartography/CameraBBox.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/InterestPoint/Matcher.h>
 #include <vw/FileIO/KML.h>
 #include <asp/Camera/CameraResectioning.h>
@@ -35,6 +39,33 @@ using namespace vw;
 using namespace vw::camera;
 using namespace vw::ba;
 
+// Fill the flat arrays of observations
+void asp::BaObservations::build(CameraRelationNetwork<JFeature> const& crn) {
+
+  cam_index.clear();
+  point_index.clear();
+  pixel.clear();
+  sigma.clear();
+  cam_begin.assign(1, 0);
+
+  for (size_t icam = 0; icam < crn.size(); icam++) {
+    for (auto fiter = crn[icam].begin(); fiter != crn[icam].end(); fiter++) {
+      Vector2 pix = (**fiter).m_location;
+      Vector2 pix_sigma = (**fiter).m_scale;
+      if (pix_sigma != pix_sigma) // nan check
+        pix_sigma = Vector2(1, 1);
+
+      cam_index.push_back(icam);
+      point_index.push_back((**fiter).m_point_id);
+      for (int k = 0; k < 2; k++) {
+        pixel.push_back(pix[k]);
+        sigma.push_back(pix_sigma[k]);
+      }
+    }
+    cam_begin.push_back(cam_index.size());
+  }
+}
+
 void asp::BAParams::record_points_to_kml(const std::string &kml_path,
                                          const vw::cartography::Datum& datum,
                                          size_t skip, const std::string name,
@@ -202,66 +233,241 @@ void apply_rigid_transform(vw::Matrix3x3 const & rotation,
 } // End function ApplyRigidTransform
 
 
+namespace {
+
+  // Find the rays of a range of measures. A measure whose camera fails
+  // gets a zero direction.
+  class MeasureRaysTask: public vw::Task, private boost::noncopyable {
+    std::vector<asp::CameraModelPtr> const& m_cams;
+    std::vector<int>     const& m_meas_cam;
+    std::vector<Vector2> const& m_meas_pix;
+    size_t m_begin, m_end;
+    std::vector<Vector3> & m_centers, & m_dirs;
+  public:
+    MeasureRaysTask(std::vector<asp::CameraModelPtr> const& cams,
+                    std::vector<int> const& meas_cam, std::vector<Vector2> const& meas_pix,
+                    size_t begin, size_t end,
+                    std::vector<Vector3> & centers, std::vector<Vector3> & dirs):
+      m_cams(cams), m_meas_cam(meas_cam), m_meas_pix(meas_pix), m_begin(begin), m_end(end),
+      m_centers(centers), m_dirs(dirs) {}
+
+    void operator()() {
+      for (size_t m = m_begin; m < m_end; m++) {
+        try {
+          vw::camera::CameraModel const* cam = m_cams[m_meas_cam[m]].get();
+          m_centers[m] = cam->camera_center(m_meas_pix[m]);
+          m_dirs[m]    = cam->pixel_to_vector(m_meas_pix[m]);
+        } catch (...) {
+          m_centers[m] = Vector3();
+          m_dirs[m]    = Vector3();
+        }
+      }
+    }
+  };
+
+  // Triangulate from given rays, in the same way as
+  // vw::ba::triangulate_control_point(). Each pair of rays with a
+  // large enough angle, meeting in front of both cameras, gives the
+  // midpoint of their closest approach, and those are averaged. If no
+  // pair qualifies, use the forced distance along the first ray, if
+  // positive. Return (0, 0, 0) on failure.
+  Vector3 triangulateRays(std::vector<Vector3> const& centers,
+                          std::vector<Vector3> const& dirs,
+                          size_t begin, size_t end,
+                          double min_angle_radians, double forced_triangulation_distance) {
+    double min_cos = cos(min_angle_radians);
+    Vector3 sum;
+    int count = 0;
+    for (size_t j = begin; j < end; j++) {
+      if (dirs[j] == Vector3())
+        continue;
+      for (size_t k = j + 1; k < end; k++) {
+        if (dirs[k] == Vector3())
+          continue;
+        double c = dot_prod(dirs[j], dirs[k]);
+        if (c > min_cos || c >= 1.0 - 1e-12)
+          continue; // too close to parallel
+        // Solve for the ray parameters of the closest points
+        Vector3 w = centers[j] - centers[k];
+        double d = dot_prod(dirs[j], w), e = dot_prod(dirs[k], w);
+        double den = 1.0 - c * c;
+        double sj = (c * e - d) / den, sk = (e - c * d) / den;
+        if (sj <= 0 || sk <= 0)
+          continue; // behind a camera
+        sum += 0.5 * ((centers[j] + sj * dirs[j]) + (centers[k] + sk * dirs[k]));
+        count++;
+      }
+    }
+    if (count > 0)
+      return sum / count;
+
+    if (forced_triangulation_distance > 0 && end > begin && dirs[begin] != Vector3())
+      return centers[begin] + forced_triangulation_distance * dirs[begin];
+
+    return Vector3();
+  }
+
+  // Triangulate a range of control points from the rays of their measures
+  class TriangulateTask: public vw::Task, private boost::noncopyable {
+    std::vector<size_t>  const& m_point_begin;
+    std::vector<Vector3> const& m_centers, & m_dirs;
+    std::vector<int>     const& m_points;
+    size_t m_begin, m_end;
+    double m_min_angle, m_forced_dist;
+    std::vector<Vector3> & m_positions;
+  public:
+    TriangulateTask(std::vector<size_t> const& point_begin,
+                    std::vector<Vector3> const& centers, std::vector<Vector3> const& dirs,
+                    std::vector<int> const& points, size_t begin, size_t end,
+                    double min_angle, double forced_dist,
+                    std::vector<Vector3> & positions):
+      m_point_begin(point_begin), m_centers(centers), m_dirs(dirs), m_points(points),
+      m_begin(begin), m_end(end), m_min_angle(min_angle), m_forced_dist(forced_dist),
+      m_positions(positions) {}
+
+    void operator()() {
+      for (size_t it = m_begin; it < m_end; it++) {
+        int ipt = m_points[it];
+        m_positions[ipt] = triangulateRays(m_centers, m_dirs, m_point_begin[it],
+                                           m_point_begin[it + 1], m_min_angle, m_forced_dist);
+      }
+    }
+  };
+
+} // end anonymous namespace
+
+// Triangulate the tie points of a control network using multiple threads.
+void asp::triangulateControlPoints(ControlNetwork const& cnet,
+                                   std::vector<asp::CameraModelPtr> const& camera_models,
+                                   double min_angle_radians,
+                                   double forced_triangulation_distance,
+                                   int num_threads,
+                                   std::vector<Vector3> & positions) {
+
+  // Flatten the measures of the tie points, so that the ray of each is
+  // found just once, and the rays can be found in parallel
+  int num_points = cnet.size();
+  positions.resize(num_points);
+  std::vector<int> points, meas_cam;
+  std::vector<size_t> point_begin;
+  std::vector<Vector2> meas_pix;
+  for (int ipt = 0; ipt < num_points; ipt++) {
+    positions[ipt] = cnet[ipt].position();
+    if (cnet[ipt].type() == ControlPoint::GroundControlPoint)
+      continue;
+    points.push_back(ipt);
+    point_begin.push_back(meas_cam.size());
+    for (ControlPoint::const_iterator measure = cnet[ipt].begin();
+         measure != cnet[ipt].end(); measure++) {
+      meas_cam.push_back(measure->image_id());
+      meas_pix.push_back(measure->position());
+    }
+  }
+  point_begin.push_back(meas_cam.size());
+
+  if (num_threads <= 0)
+    num_threads = vw_settings().default_num_threads();
+
+  // Each task does about this many measures or points, so that the
+  // tasks are few enough to not cost much, and many enough to balance.
+  size_t num_meas = meas_cam.size();
+  size_t chunk = std::max(size_t(1), std::min(size_t(1000), num_meas / (20 * num_threads) + 1));
+
+  std::vector<Vector3> centers(num_meas), dirs(num_meas);
+  {
+    FifoWorkQueue queue(num_threads);
+    for (size_t begin = 0; begin < num_meas; begin += chunk) {
+      boost::shared_ptr<MeasureRaysTask>
+        task(new MeasureRaysTask(camera_models, meas_cam, meas_pix, begin,
+                                 std::min(begin + chunk, num_meas), centers, dirs));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+  {
+    FifoWorkQueue queue(num_threads);
+    for (size_t begin = 0; begin < points.size(); begin += chunk) {
+      boost::shared_ptr<TriangulateTask>
+        task(new TriangulateTask(point_begin, centers, dirs, points, begin,
+                                 std::min(begin + chunk, points.size()),
+                                 min_angle_radians, forced_triangulation_distance,
+                                 positions));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+}
+
+// Triangulate the tie points of a control network using multiple
+// threads. Keep only those which succeed, and the GCP.
+void asp::triangulateControlNetwork(ControlNetwork & cnet,
+                                    std::vector<asp::CameraModelPtr> const& camera_models,
+                                    double min_angle_radians,
+                                    double forced_triangulation_distance,
+                                    int num_threads) {
+  std::vector<Vector3> positions;
+  asp::triangulateControlPoints(cnet, camera_models, min_angle_radians,
+                                forced_triangulation_distance, num_threads, positions);
+
+  ControlNetwork good_cnet("BundleAdjust");
+  good_cnet.get_image_list() = cnet.get_image_list();
+  int num_failed = 0;
+  for (size_t ipt = 0; ipt < cnet.size(); ipt++) {
+    if (cnet[ipt].type() != ControlPoint::GroundControlPoint &&
+        (positions[ipt] == Vector3() || cnet[ipt].size() <= 1)) {
+      num_failed++;
+      continue;
+    }
+    ControlPoint cpoint = cnet[ipt];
+    cpoint.set_position(positions[ipt]);
+    good_cnet.add_control_point(cpoint);
+  }
+  if (num_failed > 0)
+    vw_out() << "Removed " << num_failed << " points which could not be triangulated.\n";
+
+  cnet = good_cnet;
+}
+
 /// Generate a warning if the GCP's are really far from the IP points
 /// - This is intended to help catch the common lat/lon swap in GCP files.
 void check_gcp_dists(std::vector<asp::CameraModelPtr> const& camera_models,
                      boost::shared_ptr<ControlNetwork> const& cnet_ptr,
-                     double forced_triangulation_distance) {
+                     double forced_triangulation_distance, int num_threads) {
 
-  // Make one iteration just to count the points.
   const ControlNetwork & cnet = *cnet_ptr.get(); // Helper alias
-  const int num_cnet_points = static_cast<int>(cnet.size());
-  double gcp_count=0, ip_count=0;
-  for (int ipt = 0; ipt < num_cnet_points; ipt++){
+  int num_cnet_points = cnet.size();
 
-    if (cnet[ipt].position() == Vector3() || cnet[ipt].size() <= 1)
-      continue;
-    
-    if (cnet[ipt].type() == ControlPoint::GroundControlPoint)
-      gcp_count += 1.0;
-    else {
-      // Use triangulation to estimate the position of this control point using
-      //   the current set of camera models.
-      ControlPoint cp_new = cnet[ipt];
-      double minimum_angle = 0;
-      double ans = vw::ba::triangulate_control_point(cp_new, camera_models, minimum_angle,
-						     forced_triangulation_distance);
-      if (ans < 0 || cp_new.position() == Vector3())
-        continue; // Skip points that fail to triangulate
-
-      ip_count += 1.0;
-    }
-  } // End loop through control network points
-  if (ip_count == 0 || gcp_count == 0)
-    return; // Can't do this check if we don't have both point types.
+  // Use triangulation to estimate the position of the points with the
+  // current set of camera models. This is done once for all points.
+  std::vector<Vector3> positions;
+  double minimum_angle = 0;
+  asp::triangulateControlPoints(cnet, camera_models, minimum_angle,
+                                forced_triangulation_distance, num_threads, positions);
 
-  // Make another iteration to compute the mean.
   Vector3 mean_gcp(0,0,0);
   Vector3 mean_ip (0,0,0);
-  for (int ipt = 0; ipt < num_cnet_points; ipt++){
+  double gcp_count = 0, ip_count = 0;
+  for (int ipt = 0; ipt < num_cnet_points; ipt++) {
 
     if (cnet[ipt].position() == Vector3() || cnet[ipt].size() <= 1)
       continue;
-    
-    if (cnet[ipt].type() == ControlPoint::GroundControlPoint) {
 
-      mean_gcp += (cnet[ipt].position() / gcp_count);
-      ++gcp_count;
-    }else {
-      // Use triangulation to estimate the position of this control point using
-      //   the current set of camera models.
-      ControlPoint cp_new = cnet[ipt];
-      double minimum_angle = 0;
-      double ans = vw::ba::triangulate_control_point(cp_new, camera_models, minimum_angle,
-						     forced_triangulation_distance);
+    if (cnet[ipt].type() == ControlPoint::GroundControlPoint) {
+      mean_gcp += cnet[ipt].position();
+      gcp_count += 1.0;
+    } else {
       // Skip points for which triangulation failed
-      if (cp_new.position() == Vector3() || ans < 0)
-	continue;
-
-      mean_ip += (cp_new.position() / ip_count);
+      if (positions[ipt] == Vector3())
+        continue;
+      mean_ip += positions[ipt];
+      ip_count += 1.0;
     }
   } // End loop through control network points
+  if (ip_count == 0 || gcp_count == 0)
+    return; // Can't do this check if we don't have both point types.
 
+  mean_gcp /= gcp_count;
+  mean_ip  /= ip_count;
   double dist = norm_2(mean_ip - mean_gcp);
   if (dist > 100000)
     vw_out() << "WARNING: GCPs are over 100 km from the other points. Are your lat/lon GCP coordinates swapped?\n";
@@ -332,6 +538,65 @@ bool asp::init_pinhole_model_with_camera_positions
   return true;
 }
 
+namespace {
+
+  // Collect in one pass over the control network the GCP seen in each
+  // camera, with their pixels in that camera
+  void gcp_per_camera(ControlNetwork const& cnet, int num_cams,
+                      std::vector<std::vector<Vector3>> & xyz,
+                      std::vector<std::vector<Vector2>> & pix) {
+    xyz.clear();
+    pix.clear();
+    xyz.resize(num_cams);
+    pix.resize(num_cams);
+
+    for (size_t ipt = 0; ipt < cnet.size(); ipt++) {
+
+      // Keep only gcp
+      if (cnet[ipt].type() != ControlPoint::GroundControlPoint)
+        continue;
+
+      for (auto measure = cnet[ipt].begin(); measure != cnet[ipt].end(); measure++) {
+        int cam_it = measure->image_id();
+        if (cam_it < 0 || cam_it >= num_cams)
+          vw_throw(ArgumentErr() << "Error: cnet index out of range.\n");
+
+        Vector2 pixel(measure->position()[0], measure->position()[1]);
+        pix[cam_it].push_back(pixel);
+        xyz[cam_it].push_back(cnet[ipt].position());
+      }
+    }
+  }
+
+  // Fit one camera to its GCP, on its own
+  class FitCameraTask: public vw::Task, private boost::noncopyable {
+    std::vector<Vector3> const& m_xyz;
+    std::vector<Vector2> const& m_pix;
+    PinholeModel & m_cam;
+
+  public:
+    FitCameraTask(std::vector<Vector3> const& xyz, std::vector<Vector2> const& pix,
+                  PinholeModel & cam): m_xyz(xyz), m_pix(pix), m_cam(cam) {}
+
+    void operator()() {
+      // Export to the format used by the API
+      std::vector<double> pixel_values;
+      for (size_t c = 0; c < m_pix.size(); c++) {
+        pixel_values.push_back(m_pix[c][0]);
+        pixel_values.push_back(m_pix[c][1]);
+      }
+
+      std::string camera_type = "pinhole";
+      bool refine_camera = true;
+      bool verbose = false;
+      asp::CameraModelPtr out_cam(new PinholeModel(m_cam));
+      fit_camera_to_xyz(camera_type, refine_camera, m_xyz, pixel_values, verbose, out_cam);
+      m_cam = *((PinholeModel*)out_cam.get());
+    }
+  };
+
+} // end anonymous namespace
+
 // Given at least two images, each having at least 3 GCP that are not seen in other
 // images, find and apply a transform to the camera system based on them.
 void asp::transform_cameras_with_indiv_image_gcp
@@ -356,29 +621,7 @@ void asp::transform_cameras_with_indiv_image_gcp
   // with its xyz.
   std::vector<std::vector<Vector3>> xyz;
   std::vector<std::vector<Vector2>> pix;
-  xyz.resize(num_cams);
-  pix.resize(num_cams);
-  const ControlNetwork & cnet = *cnet_ptr.get(); // Helper alias
-
-  int ipt = - 1;
-  for (auto iter = cnet.begin(); iter != cnet.end(); iter++) {
-    ipt++;
-    
-    // Keep only gcp
-    if (cnet[ipt].type() != ControlPoint::GroundControlPoint) {
-      continue;
-    }
-        
-    for (auto measure = (*iter).begin(); measure != (*iter).end(); measure++) {
-      int cam_it = measure->image_id();
-      if (cam_it < 0 || cam_it >= num_cams) 
-	vw_throw(ArgumentErr() << "Error: cnet index out of range.\n");
-
-      Vector2 pixel( measure->position()[0],  measure->position()[1]);
-      pix[cam_it].push_back(pixel);
-      xyz[cam_it].push_back(cnet[ipt].position());
-    }
-  }  
+  gcp_per_camera(*cnet_ptr.get(), num_cams, xyz, pix);
 
   Matrix3x3 rotation;
   Vector3   translation;
@@ -481,53 +724,43 @@ void asp::transform_cameras_with_shared_gcp(boost::shared_ptr<ControlNetwork> co
   return;
 } // End function transform_cameras_with_shared_gcp
 
-/// Initialize the position and orientation of a pinhole camera model using
-/// GCP. It invokes OpenCV's PnP functionality.
+/// Initialize the position and orientation of each pinhole camera model using
+/// the GCP seen in it. It invokes OpenCV's PnP functionality, for all cameras
+/// in parallel.
 void asp::init_camera_using_gcp(boost::shared_ptr<vw::ba::ControlNetwork> const& cnet_ptr,
                                 std::vector<asp::CameraModelPtr> & camera_models) {
   
-  // Sanity check
-  if (camera_models.size() != 1) 
-    vw::vw_throw(vw::ArgumentErr() << "Cannot initialize more than a camera at a time using GCP. "
-                 << "Consider using --transform-cameras-with-shared-gcp or "
-                 << "--transform-cameras-using-gcp.\n");
-  
-  vw_out() << "Initializing a Pinhole camera using GCP.\n";
+  int num_cams = camera_models.size();
+  vw_out() << "Initializing " << num_cams << " Pinhole camera(s) using GCP.\n";
 
-  int icam = 0;
-  vw::camera::PinholeModel * pincam
-    = dynamic_cast<vw::camera::PinholeModel*>(camera_models[icam].get());
-  VW_ASSERT(pincam != NULL, vw::ArgumentErr() << "A pinhole camera expected.\n");
-  
-  std::vector<vw::Vector2> pixel_observations;
-  std::vector<vw::Vector3> ground_points;
-  const ControlNetwork & cnet = *cnet_ptr.get(); // Helper alias
-  for (int ipt = 0; ipt < cnet.size(); ipt++){
+  std::vector<vw::camera::PinholeModel*> pincams(num_cams);
+  for (int icam = 0; icam < num_cams; icam++) {
+    pincams[icam] = dynamic_cast<vw::camera::PinholeModel*>(camera_models[icam].get());
+    VW_ASSERT(pincams[icam] != NULL, vw::ArgumentErr() << "A pinhole camera expected.\n");
+  }
 
-    // Loop through all the ground control points only
-    if (cnet[ipt].type() != ControlPoint::GroundControlPoint)
+  // The GCP seen in each camera
+  std::vector<std::vector<Vector3>> ground_points;
+  std::vector<std::vector<Vector2>> pixel_observations;
+  gcp_per_camera(*cnet_ptr.get(), num_cams, ground_points, pixel_observations);
+
+  // Update the camera poses with given observations and intrinsics
+  std::vector<std::string> errors;
+  asp::findCameraPoses(ground_points, pixel_observations, pincams, errors);
+
+  int num_failed = 0, first_failed = -1;
+  for (int icam = 0; icam < num_cams; icam++) {
+    if (errors[icam].empty())
       continue;
-    ground_points.push_back(cnet[ipt].position());
-    
-    int num_meas = 0;
-    for (ControlPoint::const_iterator measure = cnet[ipt].begin();
-         measure != cnet[ipt].end(); measure++) {
-      
-      int cam_it = measure->image_id();
-      if (cam_it != 0) 
-        vw_throw(ArgumentErr() << "Error: Expecting GCP for a single camera.\n");
-      
-      Vector2 pixel(measure->position()[0], measure->position()[1]);
-      num_meas++;
-      if (num_meas > 1)
-        vw::vw_throw(vw::ArgumentErr() << "Expecting a single camera pixel per gcp.\n");
-      
-      pixel_observations.push_back(pixel);
-    }
+    num_failed++;
+    if (first_failed < 0)
+      first_failed = icam;
   }
-
-  // Update the camera pose with given observations and intrinsics
-  asp::findCameraPose(ground_points, pixel_observations, *pincam);
+  if (num_failed > 0)
+    vw::vw_throw(vw::ArgumentErr() << "Failed to initialize " << num_failed
+                 << " camera(s) using GCP. For camera " << first_failed << ", with "
+                 << ground_points[first_failed].size() << " GCP: "
+                 << errors[first_failed]);
 
   return;
   
@@ -586,33 +819,22 @@ void asp::align_cameras_to_ground(std::vector< std::vector<Vector3> > const& xyz
                                   Vector3 & translation,
                                   double & scale){
   
-  std::string camera_type = "pinhole";
-  bool refine_camera = true;
-  bool verbose = false; 
-
   // Cameras individually aligned to ground using GCP. They may not be
   // self-consistent, and are only used to give an idea of the
-  // transform to apply to the unaligned cameras.
-  std::vector<PinholeModel> aux_cams;
+  // transform to apply to the unaligned cameras. They are independent,
+  // so are found in parallel.
+  std::vector<PinholeModel> aux_cams = sfm_cams;
 
   int num_cams = sfm_cams.size();
+  FifoWorkQueue queue(vw_settings().default_num_threads());
   for (int it = 0; it < num_cams; it++) {
-    // Export to the format used by the API
-    std::vector<double> pixel_values;
-    for (size_t c = 0; c < pix[it].size(); c++) {
-      pixel_values.push_back(pix[it][c][0]);
-      pixel_values.push_back(pix[it][c][1]);
-    }
-
-    asp::CameraModelPtr out_cam(new PinholeModel(sfm_cams[it]));
-
     bool is_good = (xyz[it].size() >= 3);
-    if (is_good) 
-      fit_camera_to_xyz(camera_type, refine_camera,  
-			xyz[it], pixel_values, verbose, out_cam);
-    
-    aux_cams.push_back(*((PinholeModel*)out_cam.get()));
+    if (!is_good)
+      continue;
+    boost::shared_ptr<FitCameraTask> task(new FitCameraTask(xyz[it], pix[it], aux_cams[it]));
+    queue.add_task(task);
   }
+  queue.join_all();
 
   double world_scale = asp::find_median_scale_change(sfm_cams, aux_cams, xyz);
   vw_out() << "Initial guess scale to apply when converting to world coordinates using GCP: "
@@ -1003,15 +1225,224 @@ void asp::saveMapprojOffsets(std::string const& mapproj_offsets_stats_file,
   return;
 }
 
+namespace {
+
+  // The inputs shared by the processing of all image pairs
+  struct MatchPairContext {
+    vw::ba::ControlNetwork const& cnet;
+    asp::BaBaseOptions const& opt;
+    std::vector<asp::CameraModelPtr> const& optimized_cams;
+    bool remove_outliers, save_pair_stats;
+    std::set<int> const& outliers;
+    asp::MatchDatabase const* match_db;
+    std::string clean_match_db;
+    bool save_mapproj_match_points_offsets;
+    vw::cartography::GeoReference mapproj_dem_georef;
+    ImageViewRef<PixelMask<double>> interp_mapproj_dem;
+    MatchPairContext(vw::ba::ControlNetwork const& cnet_in,
+                     asp::BaBaseOptions const& opt_in,
+                     std::vector<asp::CameraModelPtr> const& cams_in,
+                     std::set<int> const& outliers_in):
+      cnet(cnet_in), opt(opt_in), optimized_cams(cams_in), remove_outliers(false),
+      save_pair_stats(true), outliers(outliers_in), match_db(NULL),
+      save_mapproj_match_points_offsets(false) {}
+  };
+
+  // What is found for one image pair
+  struct MatchPairResult {
+    bool has_matches;
+    asp::MatchPairStats convAngle, mapprojOffset;
+    std::vector<vw::Vector<double, 4>> mapprojPoints;
+    std::vector<double> mapproj_offsets;
+    MatchPairResult(): has_matches(false) {}
+  };
+
+  // Process the matches of one image pair. See matchFilesProcessing().
+  void processMatchPair(MatchPairContext const& ctx,
+                        int left_index, int right_index, std::string const& match_file,
+                        std::vector<int> const& pair_points, MatchPairResult & result) {
+
+    asp::BaBaseOptions const& opt = ctx.opt; // alias
+    vw::ba::ControlNetwork const& cnet = ctx.cnet; // alias
+    bool use_db = (ctx.match_db != NULL);
+
+    // Just skip over match files that don't exist.
+    if (!use_db && !boost::filesystem::exists(match_file)) {
+      vw_out() << "Skipping non-existent match file: " << match_file << std::endl;
+      return;
+    }
+    if (use_db && !ctx.match_db->has_pair(opt.image_files[left_index],
+                                          opt.image_files[right_index]))
+      return;
+    result.has_matches = true;
+
+    // Read the original IP, to ensure later we write to disk only
+    // the subset of the IP from the control network which
+    // are part of these original ones. 
+    std::vector<ip::InterestPoint> orig_left_ip, orig_right_ip;
+    if (use_db)
+      ctx.match_db->read_pair(opt.image_files[left_index], opt.image_files[right_index],
+                              orig_left_ip, orig_right_ip);
+    else
+      ip::read_binary_match_file(match_file, orig_left_ip, orig_right_ip);
+
+    // IP from the control network, for which we flagged outliers
+    std::vector<vw::ip::InterestPoint> left_ip, right_ip;
+    if (!ctx.remove_outliers) {
+      // Since no outliers are removed, use the original ones
+      left_ip.swap(orig_left_ip);
+      right_ip.swap(orig_right_ip);
+    } else {
+      typedef std::tuple<double, double, double> Triplet;
+      std::map<Triplet, Triplet> lookup;
+      for (size_t ip_iter = 0; ip_iter < orig_left_ip.size(); ip_iter++) {
+        // Note how we store both the camera index and the ip coordinates
+        Triplet left_set(left_index, orig_left_ip[ip_iter].x, orig_left_ip[ip_iter].y); 
+        Triplet right_set(right_index, orig_right_ip[ip_iter].x, orig_right_ip[ip_iter].y); 
+        lookup[left_set] = right_set;
+      }
+
+      // Look only at the control points seeing both images, and their
+      // measures for left_index and right_index
+      for (size_t it = 0; it < pair_points.size(); it++) {
+        int ipt = pair_points[it];
+        if (ctx.outliers.find(ipt) != ctx.outliers.end())
+          continue; // skip outliers
+
+        ip::InterestPoint cnet_left_ip, cnet_right_ip;
+        for (ControlPoint::const_iterator measure = cnet[ipt].begin();
+             measure != cnet[ipt].end(); ++measure) {
+          if (measure->image_id() == left_index)
+            cnet_left_ip = ip::InterestPoint(measure->position()[0], measure->position()[1],
+                                             measure->sigma()[0]);
+          else if (measure->image_id() == right_index)
+            cnet_right_ip = ip::InterestPoint(measure->position()[0], measure->position()[1],
+                                              measure->sigma()[0]);
+        }
+
+        // Only add ip that were there originally
+        Triplet left_set(left_index, cnet_left_ip.x, cnet_left_ip.y); 
+        Triplet right_set(right_index, cnet_right_ip.x, cnet_right_ip.y); 
+        auto lookup_it = lookup.find(left_set);
+        if (lookup_it == lookup.end() || lookup_it->second != right_set)
+          continue;
+      
+        left_ip.push_back (cnet_left_ip);
+        right_ip.push_back(cnet_right_ip);
+      }
+    
+      // Filter by disparity, find the coverage, and save, all on the
+      // matches in memory.
+      // TODO(oalexan1): Remove this param. Use instead --outlier-removal-params.
+      // Not sure this code should be here to start with. Note that it
+      // does not update the outliers set.
+      asp::MatchSet clean_matches;
+      clean_matches.set_matches(left_ip, right_ip);
+      if (opt.remove_outliers_params[0] > 0 && opt.remove_outliers_params[1] > 0.0) {
+        // The typical value of 75 for opt.remove_outliers_params[1] may be too low.
+        // Adjust it. pct = 75 becomes pct = 90. pct = 100 becomes pct = 100. So,
+        // if starting under 100, it gets closer to 100 but stays under it.
+        double pct = opt.remove_outliers_params[0];
+        pct = 100.0 * (pct + 150.0) / 250.0;
+        clean_matches.filter_by_disparity(pct, opt.remove_outliers_params[1]);
+      }
+
+      if (opt.image_files.size() == 2) {
+        // Compute the coverage fraction
+        Vector2i right_image_size = file_image_size(opt.image_files[1]);
+        int right_ip_width = right_image_size[0]*
+          static_cast<double>(100.0 - std::max(opt.ip_edge_buffer_percent, 0))/100.0;
+        Vector2i ip_size(right_ip_width, right_image_size[1]);
+        double ip_coverage = clean_matches.coverage_fraction(ip_size);
+        // Careful with the line below, it gets used in process_icebridge_batch.py.
+        vw_out() << "IP coverage fraction after cleaning = " << ip_coverage << "\n";
+      }
+
+      vw_out() << "Saving " << clean_matches.size() << " filtered interest points.\n";
+      if (use_db) {
+        clean_matches.append_to_database(ctx.clean_match_db, opt.image_files[left_index],
+                                         opt.image_files[right_index]);
+      } else {
+        // Make a clean copy of the file
+        std::string clean_match_file = ip::clean_match_filename(match_file);
+        if (opt.clean_match_files_prefix != "") {
+          // Avoid saving clean-clean.match.
+          clean_match_file = match_file;
+          // Write the clean match file in the current dir, not where it was read from
+          clean_match_file.replace(0, opt.clean_match_files_prefix.size(), opt.out_prefix);
+        }
+        else if (opt.match_files_prefix != "") {
+          // Write the clean match file in the current dir, not where it was read from
+          clean_match_file.replace(0, opt.match_files_prefix.size(), opt.out_prefix);
+        }
+    
+        vw_out() << "Writing: " << clean_match_file << std::endl;
+        clean_matches.write(clean_match_file);
+      }
+
+      if (ctx.save_pair_stats)
+        clean_matches.get_matches(left_ip, right_ip);
+    }
+
+    if (!ctx.save_pair_stats)
+      return;
+
+    // Find convergence angles based on clean ip
+    std::vector<double> sorted_angles;
+    asp::convergence_angles(ctx.optimized_cams[left_index].get(),
+                            ctx.optimized_cams[right_index].get(),
+                            left_ip, right_ip, sorted_angles);
+    result.convAngle.populate(left_index, right_index, sorted_angles);
+
+    if (ctx.save_mapproj_match_points_offsets) {
+      asp::calcPairMapprojOffsets(ctx.optimized_cams,
+                                  left_index, right_index,
+                                  left_ip, right_ip,
+                                  ctx.mapproj_dem_georef, ctx.interp_mapproj_dem,  
+                                  result.mapprojPoints, // will append here
+                                  result.mapproj_offsets);
+      std::vector<double> offsets = result.mapproj_offsets; // populate() sorts
+      result.mapprojOffset.populate(left_index, right_index, offsets);
+    }
+  }
+
+  // A task to process several image pairs
+  class MatchPairsTask: public vw::Task, private boost::noncopyable {
+    MatchPairContext const& m_ctx;
+    std::vector<std::pair<int, int>> const& m_pairs;
+    std::vector<std::string> const& m_files;
+    std::vector<std::vector<int>> const& m_pair_points;
+    size_t m_begin, m_end;
+    std::vector<MatchPairResult> & m_results;
+  public:
+    MatchPairsTask(MatchPairContext const& ctx,
+                   std::vector<std::pair<int, int>> const& pairs,
+                   std::vector<std::string> const& files,
+                   std::vector<std::vector<int>> const& pair_points,
+                   size_t begin, size_t end, std::vector<MatchPairResult> & results):
+      m_ctx(ctx), m_pairs(pairs), m_files(files), m_pair_points(pair_points),
+      m_begin(begin), m_end(end), m_results(results) {}
+
+    void operator()() {
+      for (size_t k = m_begin; k < m_end; k++)
+        processMatchPair(m_ctx, m_pairs[k].first, m_pairs[k].second, m_files[k],
+                         m_pair_points[k], m_results[k]);
+    }
+  };
+
+} // end anonymous namespace
+
 // Calculate convergence angles. Remove the outliers flagged earlier,
 // if remove_outliers is true. Compute offsets of mapprojected matches,
 // if a DEM is given. These are done together as they rely on
 // reloading interest point matches, which is expensive so the matches
-// are used for both operations.
+// are used for both operations. The pairs are processed in parallel,
+// and the results are put together in the order of the pairs.
 void asp::matchFilesProcessing(vw::ba::ControlNetwork const& cnet,
                                asp::BaBaseOptions const& opt,
                                std::vector<asp::CameraModelPtr> const& optimized_cams,
                                bool remove_outliers, std::set<int> const& outliers,
+                               bool save_pair_stats, int num_threads,
                                std::vector<asp::MatchPairStats> & convAngles,
                                std::string const& mapproj_dem,
                                std::vector<vw::Vector<double, 4>> & mapprojPoints,
@@ -1023,189 +1454,213 @@ void asp::matchFilesProcessing(vw::ba::ControlNetwork const& cnet,
   mapprojOffsets.clear();
   mapprojOffsetsPerCam.clear();
 
-  bool save_mapproj_match_points_offsets = (!mapproj_dem.empty());
-  vw::cartography::GeoReference mapproj_dem_georef;
-  ImageViewRef<PixelMask<double>> interp_mapproj_dem;
-  if (save_mapproj_match_points_offsets)
-    asp::create_interp_dem(mapproj_dem, mapproj_dem_georef, interp_mapproj_dem);
-  
   int num_cameras = opt.image_files.size();
   mapprojOffsetsPerCam.resize(num_cameras);
-  
-  // Work on individual image pairs
-  for (auto match_it = opt.match_files.begin(); match_it != opt.match_files.end(); match_it++) {
 
-    std::vector<double> mapproj_offsets;
-
-    // IP from the control network, for which we flagged outliers
-    std::vector<vw::ip::InterestPoint> left_ip, right_ip;
+  if (!remove_outliers && !save_pair_stats)
+    return; // nothing to do
+
+  MatchPairContext ctx(cnet, opt, optimized_cams, outliers);
+  ctx.remove_outliers = remove_outliers;
+  ctx.save_pair_stats = save_pair_stats;
+  ctx.save_mapproj_match_points_offsets = (save_pair_stats && !mapproj_dem.empty());
+  if (ctx.save_mapproj_match_points_offsets)
+    asp::create_interp_dem(mapproj_dem, ctx.mapproj_dem_georef, ctx.interp_mapproj_dem);
+
+  // With a match database, the matches are read from it, and the clean
+  // matches are appended to a new database rather than written to files.
+  bool use_db = !opt.match_database.empty();
+  boost::shared_ptr<asp::MatchDatabase> match_db;
+  ctx.clean_match_db = opt.out_prefix + "-clean-matches" + asp::MATCH_DATABASE_EXT;
+  if (use_db) {
+    match_db.reset(new asp::MatchDatabase(opt.match_database));
+    ctx.match_db = match_db.get();
+    if (remove_outliers && boost::filesystem::exists(ctx.clean_match_db))
+      boost::filesystem::remove(ctx.clean_match_db); // will append to it below
+  }
 
-    std::pair<int, int> cam_pair   = match_it->first;
-    std::string         match_file = match_it->second;
-    size_t left_index  = cam_pair.first;
-    size_t right_index = cam_pair.second;
+  std::vector<std::pair<int, int>> pairs;
+  std::vector<std::string> files;
+  std::map<std::pair<int, int>, int> pair_ids;
+  for (auto match_it = opt.match_files.begin(); match_it != opt.match_files.end(); match_it++) {
+    pair_ids[match_it->first] = pairs.size();
+    pairs.push_back(match_it->first);
+    files.push_back(match_it->second);
+  }
 
-    // Just skip over match files that don't exist.
-    if (!boost::filesystem::exists(match_file)) {
-      vw_out() << "Skipping non-existent match file: " << match_file << std::endl;
-      continue;
+  // Find the control points seeing each pair, in one pass over the
+  // control network, rather than one pass per pair
+  std::vector<std::vector<int>> pair_points(pairs.size());
+  if (remove_outliers) {
+    for (size_t ipt = 0; ipt < cnet.size(); ipt++) {
+      // Skip gcp
+      if (cnet[ipt].type() == ControlPoint::GroundControlPoint)
+        continue;
+      std::vector<int> cams;
+      for (ControlPoint::const_iterator measure = cnet[ipt].begin();
+           measure != cnet[ipt].end(); ++measure)
+        cams.push_back(measure->image_id());
+      std::vector<int> found; // a point seeing an image twice must be added once
+      for (size_t a = 0; a < cams.size(); a++) {
+        for (size_t b = 0; b < cams.size(); b++) {
+          auto it = pair_ids.find(std::make_pair(cams[a], cams[b]));
+          if (a == b || it == pair_ids.end() ||
+              std::find(found.begin(), found.end(), it->second) != found.end())
+            continue;
+          found.push_back(it->second);
+          pair_points[it->second].push_back(ipt);
+        }
+      }
     }
+  }
 
-    // Read the original IP, to ensure later we write to disk only
-    // the subset of the IP from the control network which
-    // are part of these original ones. 
-    std::vector<ip::InterestPoint> orig_left_ip, orig_right_ip;
-    ip::read_binary_match_file(match_file, orig_left_ip, orig_right_ip);
-
-    // Create a new convergence angle storage struct
-    convAngles.push_back(asp::MatchPairStats()); // add an element, will populate it soon
-    asp::MatchPairStats & convAngle = convAngles.back(); // alias
-    std::vector<double> sorted_angles;
+  // Work on individual image pairs
+  if (num_threads <= 0)
+    num_threads = vw_settings().default_num_threads();
+  std::vector<MatchPairResult> results(pairs.size());
+  size_t chunk = std::max(size_t(1), pairs.size() / (10 * num_threads));
+  FifoWorkQueue queue(num_threads);
+  for (size_t begin = 0; begin < pairs.size(); begin += chunk) {
+    boost::shared_ptr<MatchPairsTask>
+      task(new MatchPairsTask(ctx, pairs, files, pair_points, begin,
+                              std::min(begin + chunk, pairs.size()), results));
+    queue.add_task(task);
+  }
+  queue.join_all();
 
-    asp::MatchPairStats * mapprojOffset = NULL; // may not always exist
-    if (save_mapproj_match_points_offsets) {
-      mapprojOffsets.push_back(asp::MatchPairStats()); // add an elem
-      mapprojOffset = &mapprojOffsets.back(); // pointer
-    }
-    
-    if (!remove_outliers) {
-      asp::convergence_angles(optimized_cams[left_index].get(), optimized_cams[right_index].get(),
-                              orig_left_ip, orig_right_ip, sorted_angles);
-      convAngle.populate(left_index, right_index, sorted_angles);
-
-      if (mapprojOffset != NULL) {
-        asp::calcPairMapprojOffsets(optimized_cams,
-                                    left_index, right_index,
-                                    orig_left_ip, orig_right_ip,
-                                    mapproj_dem_georef, interp_mapproj_dem,  
-                                    mapprojPoints, // will append here
-                                    mapproj_offsets);
-        mapprojOffset->populate(left_index, right_index, mapproj_offsets);
-        for (size_t map_it = 0; map_it < mapproj_offsets.size(); map_it++) {
-          mapprojOffsetsPerCam[left_index].push_back(mapproj_offsets[map_it]);
-          mapprojOffsetsPerCam[right_index].push_back(mapproj_offsets[map_it]);
-        }
-      }
-      
-      // Since no outliers are removed, nothing else to do
+  for (size_t k = 0; k < results.size(); k++) {
+    MatchPairResult const& result = results[k];
+    if (!result.has_matches || !save_pair_stats)
       continue;
+    convAngles.push_back(result.convAngle);
+    if (!ctx.save_mapproj_match_points_offsets)
+      continue;
+    mapprojOffsets.push_back(result.mapprojOffset);
+    mapprojPoints.insert(mapprojPoints.end(), result.mapprojPoints.begin(),
+                         result.mapprojPoints.end());
+    for (size_t map_it = 0; map_it < result.mapproj_offsets.size(); map_it++) {
+      mapprojOffsetsPerCam[pairs[k].first].push_back(result.mapproj_offsets[map_it]);
+      mapprojOffsetsPerCam[pairs[k].second].push_back(result.mapproj_offsets[map_it]);
     }
-    
-    typedef std::tuple<double, double, double> Triplet;
-    std::map<Triplet, Triplet> lookup;
-    for (size_t ip_iter = 0; ip_iter < orig_left_ip.size(); ip_iter++) {
-      // Note how we store both the camera index and the ip coordinates
-      Triplet left_set(left_index, orig_left_ip[ip_iter].x, orig_left_ip[ip_iter].y); 
-      Triplet right_set(right_index, orig_right_ip[ip_iter].x, orig_right_ip[ip_iter].y); 
-      lookup[left_set] = right_set;
-    }
+  }
 
-    // Iterate over the control network, and, for each control point,
-    // look only at the measure for left_index and right_index
-    int ipt = -1;
-    for (ControlNetwork::const_iterator iter = cnet.begin(); iter != cnet.end(); iter++) {
+  if (use_db && remove_outliers)
+    vw_out() << "Wrote: " << ctx.clean_match_db << std::endl;
+}
 
-      ipt++; // control point index
+namespace {
 
-      // Skip gcp
-      if (cnet[ipt].type() == ControlPoint::GroundControlPoint) {
-        continue;
-      }
-        
-      bool has_left = true, has_right = false;
-      ip::InterestPoint cnet_left_ip, cnet_right_ip;
-      for (ControlPoint::const_iterator measure = (*iter).begin();
-            measure != (*iter).end(); ++measure) {
-        if (measure->image_id() == left_index) {
-          has_left = true;
-          cnet_left_ip = ip::InterestPoint(measure->position()[0], measure->position()[1],
-                                   measure->sigma()[0]);
-        }else if (measure->image_id() == right_index) {
-          has_right = true;
-          cnet_right_ip = ip::InterestPoint(measure->position()[0], measure->position()[1],
-                                   measure->sigma()[0]);
-        }
-      }
+  // Union-find with path halving, to merge matches into tracks
+  int findRoot(std::vector<int> & parent, int node) {
+    while (parent[node] != node) {
+      parent[node] = parent[parent[node]];
+      node = parent[node];
+    }
+    return node;
+  }
 
-      // Keep only ip for these two images
-      if (!has_left || !has_right)
-        continue;
+}
 
-      if (outliers.find(ipt) != outliers.end())
-        continue; // skip outliers
+// Build the control network from the matches in the match database,
+// for the given pairs.
+bool asp::buildControlNetworkFromDb(std::string const& match_database,
+                                    std::vector<asp::CameraModelPtr> const& camera_models,
+                                    std::vector<std::string> const& image_files,
+                                    std::map<std::pair<int, int>, std::string>
+                                    const& match_files,
+                                    int min_matches, double min_angle_radians,
+                                    double forced_triangulation_distance,
+                                    int max_pairwise_matches, int num_threads,
+                                    vw::ba::ControlNetwork & cnet) {
+
+  cnet.get_image_list() = image_files;
+
+  asp::MatchDatabase match_db(match_database);
+  vw_out() << "Reading the matches of " << match_files.size() << " pairs from: "
+           << match_database << std::endl;
+
+  // Each distinct (image, pixel) is a node. Matches join nodes.
+  typedef std::tuple<int, double, double> NodeKey;
+  std::map<NodeKey, int> node_ids;
+  std::vector<int> parent, node_cam;
+  std::vector<ip::InterestPoint> node_ip;
+  auto get_node = [&](int cam, ip::InterestPoint const& p) {
+    NodeKey key(cam, p.x, p.y);
+    auto it = node_ids.find(key);
+    if (it != node_ids.end())
+      return it->second;
+    int id = parent.size();
+    node_ids[key] = id;
+    parent.push_back(id);
+    node_cam.push_back(cam);
+    node_ip.push_back(p);
+    return id;
+  };
+
+  for (auto it = match_files.begin(); it != match_files.end(); it++) {
+    int left_index = it->first.first, right_index = it->first.second;
+    std::string const& image1 = image_files[left_index];
+    std::string const& image2 = image_files[right_index];
+    if (!match_db.has_pair(image1, image2))
+      continue;
 
-      // Only add ip that were there originally
-      Triplet left_set(left_index, cnet_left_ip.x, cnet_left_ip.y); 
-      Triplet right_set(right_index, cnet_right_ip.x, cnet_right_ip.y); 
-      if (lookup.find(left_set) == lookup.end() || lookup[left_set] != right_set)
-        continue;
-      
-      left_ip.push_back (cnet_left_ip);
-      right_ip.push_back(cnet_right_ip);
-    }
-    
-    // Filter by disparity
-    // TODO(oalexan1): Remove this param. Use instead --outlier-removal-params.
-    // Not sure this code should be here to start with. Note that it
-    // does not update the outliers set.
-    bool quiet = true; // Otherwise too many messages are printed
-    if (opt.remove_outliers_params[0] > 0 && opt.remove_outliers_params[1] > 0.0) {
-      // The typical value of 75 for opt.remove_outliers_params[1] may be too low.
-      // Adjust it. pct = 75 becomes pct = 90. pct = 100 becomes pct = 100. So,
-      // if starting under 100, it gets closer to 100 but stays under it.
-      double pct = opt.remove_outliers_params[0];
-      pct = 100.0 * (pct + 150.0) / 250.0;
-      asp::filter_ip_by_disparity(pct, opt.remove_outliers_params[1],
-                                  quiet, left_ip, right_ip);
+    std::vector<ip::InterestPoint> left_ip, right_ip;
+    match_db.read_pair(image1, image2, left_ip, right_ip);
+    if (int(left_ip.size()) < min_matches) {
+      vw_out() << "Skipping images " << image1 << " and " << image2 << " with only "
+               << left_ip.size() << " matches.\n";
+      continue;
     }
-    
-    if (num_cameras == 2){
-      // Compute the coverage fraction
-      Vector2i right_image_size = file_image_size(opt.image_files[1]);
-      int right_ip_width = right_image_size[0]*
-        static_cast<double>(100.0 - std::max(opt.ip_edge_buffer_percent, 0))/100.0;
-      Vector2i ip_size(right_ip_width, right_image_size[1]);
-      double ip_coverage = asp::calc_ip_coverage_fraction(right_ip, ip_size);
-      // Careful with the line below, it gets used in process_icebridge_batch.py.
-      vw_out() << "IP coverage fraction after cleaning = " << ip_coverage << "\n";
+
+    // Keep an evenly spaced subset if there are too many matches
+    size_t num = left_ip.size();
+    size_t num_keep = num;
+    if (max_pairwise_matches > 0 && num > size_t(max_pairwise_matches))
+      num_keep = max_pairwise_matches;
+    for (size_t k = 0; k < num_keep; k++) {
+      size_t m = (num_keep == num) ? k : (k * num) / num_keep;
+      int a = findRoot(parent, get_node(left_index, left_ip[m]));
+      int b = findRoot(parent, get_node(right_index, right_ip[m]));
+      if (a != b)
+        parent[b] = a;
     }
+  }
+
+  // Group the nodes into tracks
+  std::map<int, std::vector<int>> tracks;
+  for (size_t node = 0; node < parent.size(); node++)
+    tracks[findRoot(parent, node)].push_back(node);
 
-    // Make a clean copy of the file
-    std::string clean_match_file = ip::clean_match_filename(match_file);
-    if (opt.clean_match_files_prefix != "") {
-      // Avoid saving clean-clean.match.
-      clean_match_file = match_file;
-      // Write the clean match file in the current dir, not where it was read from
-      clean_match_file.replace(0, opt.clean_match_files_prefix.size(), opt.out_prefix);
+  int num_inconsistent = 0;
+  for (auto it = tracks.begin(); it != tracks.end(); it++) {
+    std::vector<int> const& track = it->second;
+    if (track.size() < 2)
+      continue;
+
+    // A track seeing an image more than once has inconsistent matches
+    std::set<int> cams;
+    for (size_t k = 0; k < track.size(); k++)
+      cams.insert(node_cam[track[k]]);
+    if (cams.size() != track.size()) {
+      num_inconsistent++;
+      continue;
     }
-    else if (opt.match_files_prefix != "") {
-      // Write the clean match file in the current dir, not where it was read from
-      clean_match_file.replace(0, opt.match_files_prefix.size(), opt.out_prefix);
+
+    ControlPoint cpoint(ControlPoint::TiePoint);
+    for (size_t k = 0; k < track.size(); k++) {
+      ip::InterestPoint const& p = node_ip[track[k]];
+      cpoint.add_measure(ControlMeasure(p.x, p.y, p.scale, p.scale, node_cam[track[k]]));
     }
-    
-    vw_out() << "Saving " << left_ip.size() << " filtered interest points.\n";
+    cnet.add_control_point(cpoint);
+  }
 
-    vw_out() << "Writing: " << clean_match_file << std::endl;
-    ip::write_binary_match_file(clean_match_file, left_ip, right_ip);
+  if (num_inconsistent > 0)
+    vw_out() << "Dropped " << num_inconsistent
+             << " tracks which see the same image more than once.\n";
 
-    // Find convergence angles based on clean ip
-    asp::convergence_angles(optimized_cams[left_index].get(), optimized_cams[right_index].get(),
-                            left_ip, right_ip, sorted_angles);
-    convAngle.populate(left_index, right_index, sorted_angles);
+  asp::triangulateControlNetwork(cnet, camera_models, min_angle_radians,
+                                 forced_triangulation_distance, num_threads);
+  vw_out() << "Built a control network with " << cnet.size() << " points.\n";
 
-    if (mapprojOffset != NULL) {
-      asp::calcPairMapprojOffsets(optimized_cams,
-                                  left_index, right_index,
-                                  left_ip, right_ip,
-                                  mapproj_dem_georef, interp_mapproj_dem,  
-                                  mapprojPoints, // will append here
-                                  mapproj_offsets);
-      mapprojOffset->populate(left_index, right_index, mapproj_offsets);
-      for (size_t map_it = 0; map_it < mapproj_offsets.size(); map_it++) {
-        mapprojOffsetsPerCam[left_index].push_back(mapproj_offsets[map_it]);
-        mapprojOffsetsPerCam[right_index].push_back(mapproj_offsets[map_it]);
-      }
-    }
-    
-  } // End loop through the match files
+  return (cnet.size() > 0);
 }
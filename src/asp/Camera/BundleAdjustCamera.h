@@ -56,7 +56,7 @@ typedef boost::shared_ptr<vw::camera::CameraModel> CameraModelPtr;
 // Options shared by bundle_adjust and jitter_solve
 struct BaBaseOptions: public vw::GdalWriteOptions {
   std::string out_prefix, stereo_session, input_prefix, match_files_prefix,
-    clean_match_files_prefix, ref_dem, heights_from_dem, mapproj_dem;
+    clean_match_files_prefix, match_database, ref_dem, heights_from_dem, mapproj_dem;
   int overlap_limit, min_matches, max_pairwise_matches, num_iterations,
     ip_edge_buffer_percent;
   bool match_first_to_last, single_threaded_cameras;
@@ -486,6 +486,26 @@ private: // Functions
   }
 }; // End class BAParams
 
+/// All the pixel observations of the triangulated points, in flat arrays,
+/// ordered by camera and then as in the camera relation network. This is
+/// the order in which the reprojection residuals are added, so the
+/// residuals, outlier removal, and residual maps can stream over it
+/// rather than walking the network, which is slow for many observations.
+struct BaObservations {
+  std::vector<int>    cam_index, point_index;
+  std::vector<double> pixel, sigma; // two values per observation
+  std::vector<size_t> cam_begin;    // camera i has observations cam_begin[i] to cam_begin[i+1]
+
+  /// Fill the arrays. A sigma which is NaN is replaced with 1.
+  void build(vw::ba::CameraRelationNetwork<vw::ba::JFeature> const& crn);
+
+  size_t size() const { return cam_index.size(); }
+  int num_cameras() const { return cam_begin.empty() ? 0 : int(cam_begin.size()) - 1; }
+
+  vw::Vector2 pixel_at(size_t i) const { return vw::Vector2(pixel[2*i], pixel[2*i + 1]); }
+  vw::Vector2 sigma_at(size_t i) const { return vw::Vector2(sigma[2*i], sigma[2*i + 1]); }
+};
+
 } // end namespace asp
 
 /// Simple class to manage position/rotation information.
@@ -646,9 +666,10 @@ void apply_rigid_transform(vw::Matrix3x3 const & rotation,
 
 /// Generate a warning if the GCP's are really far from the IP points
 /// - This is intended to help catch the common lat/lon swap in GCP files.
+/// - The points are triangulated with the given number of threads.
 void check_gcp_dists(std::vector<asp::CameraModelPtr> const& camera_models,
                      boost::shared_ptr<vw::ba::ControlNetwork> const& cnet_ptr,
-                     double forced_triangulation_distance);
+                     double forced_triangulation_distance, int num_threads);
 
 namespace asp {
 
@@ -661,8 +682,9 @@ bool init_pinhole_model_with_camera_positions
  std::vector<std::string> const& image_files,
  std::vector<vw::Vector3> const & estimated_camera_gcc);
 
-/// Initialize the position and orientation of a pinhole camera model using
-/// GCP. It invokes OpenCV's PnP functionality.
+/// Initialize the position and orientation of each pinhole camera model using
+/// the GCP seen in it, of which there must be at least four. It invokes
+/// OpenCV's PnP functionality, for all cameras in parallel.
 void init_camera_using_gcp(boost::shared_ptr<vw::ba::ControlNetwork> const& cnet_ptr,
                            std::vector<asp::CameraModelPtr> & camera_models);
   
@@ -735,16 +757,55 @@ void saveMapprojOffsets(std::string const& mapproj_offsets_stats_file,
 // if remove_outliers is true. Compute offsets of mapprojected matches,
 // if a DEM is given. These are done together as they rely on
 // reloading interest point matches, which is expensive so the matches
-// are used for both operations.
+// are used for both operations. If save_pair_stats is false, only
+// the outliers are removed. The pairs are processed with the given
+// number of threads.
 void matchFilesProcessing(vw::ba::ControlNetwork const& cnet,
                           asp::BaBaseOptions const& opt,
                           std::vector<asp::CameraModelPtr> const& optimized_cams,
                           bool remove_outliers, std::set<int> const& outliers,
+                          bool save_pair_stats, int num_threads,
                           std::vector<asp::MatchPairStats> & convAngles,
                           std::string const& mapproj_dem,
                           std::vector<vw::Vector<double, 4>> & mapprojPoints,
                           std::vector<asp::MatchPairStats> & mapprojOffsets,
                           std::vector<std::vector<double>> & mapprojOffsetsPerCam);
+
+/// Triangulate the tie points of a control network using multiple
+/// threads, in the same way as vw::ba::triangulate_control_point().
+/// The rays of all measures are found first, in parallel, so each is
+/// found once. The GCP keep their positions. A point which fails to
+/// triangulate gets the position (0, 0, 0). The cameras must be safe to
+/// use from several threads, unless num_threads is 1.
+void triangulateControlPoints(vw::ba::ControlNetwork const& cnet,
+                              std::vector<asp::CameraModelPtr> const& camera_models,
+                              double min_angle_radians,
+                              double forced_triangulation_distance,
+                              int num_threads,
+                              std::vector<vw::Vector3> & positions);
+
+/// Triangulate the tie points as above, set their positions, and keep
+/// only the ones which succeed, and the GCP.
+void triangulateControlNetwork(vw::ba::ControlNetwork & cnet,
+                               std::vector<asp::CameraModelPtr> const& camera_models,
+                               double min_angle_radians,
+                               double forced_triangulation_distance,
+                               int num_threads);
+
+// Build the control network from the matches in the match database,
+// for the given pairs. Matches of different pairs which share an
+// interest point are merged into one track, tracks which see an image
+// more than once are dropped, and the rest are triangulated. This is
+// the counterpart of vw::ba::build_control_network() for .match files.
+// The control network is expected to be empty.
+bool buildControlNetworkFromDb(std::string const& match_database,
+                               std::vector<asp::CameraModelPtr> const& camera_models,
+                               std::vector<std::string> const& image_files,
+                               std::map<std::pair<int, int>, std::string> const& match_files,
+                               int min_matches, double min_angle_radians,
+                               double forced_triangulation_distance,
+                               int max_pairwise_matches, int num_threads,
+                               vw::ba::ControlNetwork & cnet);
   
 }
 #endif // __BUNDLE_ADJUST_CAMERA_H__
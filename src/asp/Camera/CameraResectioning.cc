@@ -19,8 +19,12 @@
 
 #include <asp/Camera/CameraResectioning.h>
 
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
+
 #include <opencv2/calib3d/calib3d.hpp>
 #include <Eigen/Dense>
+#include <boost/noncopyable.hpp>
 
 #include <string>
 
@@ -121,5 +125,52 @@ void findCameraPose(std::vector<vw::Vector3> const& ground_points,
 
   return;
 }
+
+// Find the pose of one camera among many
+class FindCameraPoseTask: public vw::Task, private boost::noncopyable {
+  std::vector<vw::Vector3> const& m_ground_points;
+  std::vector<vw::Vector2> const& m_pixel_observations;
+  vw::camera::PinholeModel & m_cam;
+  std::string & m_error;
+
+public:
+  FindCameraPoseTask(std::vector<vw::Vector3> const& ground_points,
+                     std::vector<vw::Vector2> const& pixel_observations,
+                     vw::camera::PinholeModel & cam, std::string & error):
+    m_ground_points(ground_points), m_pixel_observations(pixel_observations),
+    m_cam(cam), m_error(error) {}
+
+  void operator()() {
+    try {
+      // Work on a copy, so a camera which fails is not changed
+      vw::camera::PinholeModel cam = m_cam;
+      findCameraPose(m_ground_points, m_pixel_observations, cam);
+      m_cam = cam;
+    } catch (std::exception const& e) {
+      m_error = e.what();
+    }
+  }
+};
+
+void findCameraPoses(std::vector<std::vector<vw::Vector3>> const& ground_points,
+                     std::vector<std::vector<vw::Vector2>> const& pixel_observations,
+                     std::vector<vw::camera::PinholeModel*> const& cams,
+                     std::vector<std::string> & errors) {
+
+  if (ground_points.size() != cams.size() || pixel_observations.size() != cams.size())
+    vw::vw_throw(vw::ArgumentErr()
+                 << "There must be as many sets of ground points and pixels as cameras.\n");
+
+  errors.clear();
+  errors.resize(cams.size());
+  vw::FifoWorkQueue queue(vw::vw_settings().default_num_threads());
+  for (size_t icam = 0; icam < cams.size(); icam++) {
+    boost::shared_ptr<FindCameraPoseTask>
+      task(new FindCameraPoseTask(ground_points[icam], pixel_observations[icam],
+                                  *cams[icam], errors[icam]));
+    queue.add_task(task);
+  }
+  queue.join_all();
+}
   
 } // end namespace asp
@@ -23,6 +23,7 @@
 #define __ASP_CAMERA_CAMERA_RESECTIONING_H__
 
 #include <vw/Camera/PinholeModel.h>
+#include <string>
 #include <vector>
 
 namespace asp {
@@ -33,6 +34,15 @@ namespace asp {
 void findCameraPose(std::vector<vw::Vector3> const& ground_points, 
                     std::vector<vw::Vector2> const& pixel_observations,
                     vw::camera::PinholeModel & cam);
+
+/// Find the positions and orientations of many Pinhole cameras in
+/// parallel, as findCameraPose() does for one, with the ground points
+/// and pixels of each camera. The error for each camera is empty if
+/// its pose was found, and otherwise that camera is not changed.
+void findCameraPoses(std::vector<std::vector<vw::Vector3>> const& ground_points,
+                     std::vector<std::vector<vw::Vector2>> const& pixel_observations,
+                     std::vector<vw::camera::PinholeModel*> const& cams,
+                     std::vector<std::string> & errors);
 }
 
 #endif // __ASP_CAMERA_CAMERA_RESECTIONING_H__
@@ -18,6 +18,7 @@
 #include <vw/FileIO/FileUtils.h>
 
 #include <asp/Core/StereoSettings.h>
+#include <asp/Core/Tracing.h>
 #include <asp/Camera/CsmModel.h>
 
 #include <boost/dll.hpp>
@@ -245,6 +246,21 @@ const csm::Plugin* find_plugin_for_isd(csm::Isd const& support_data,
                                        std::string   & model_family,
                                        bool            show_warnings) {
 
+  // Cameras loaded together are almost always of the same kind, so first
+  // try the plugin and model which worked last time.
+  static vw::Mutex last_match_mutex;
+  static const csm::Plugin* last_plugin = NULL;
+  static std::string last_model_name, last_model_family;
+  {
+    vw::Mutex::Lock lock(last_match_mutex);
+    if (last_plugin != NULL &&
+        last_plugin->canModelBeConstructedFromISD(support_data, last_model_name, NULL)) {
+      model_name   = last_model_name;
+      model_family = last_model_family;
+      return last_plugin;
+    }
+  }
+
   // Loop through the available plugins.
   csm::PluginList::iterator iter;
   csm::PluginList plugins = csm::Plugin::getList();
@@ -263,6 +279,10 @@ const csm::Plugin* find_plugin_for_isd(csm::Isd const& support_data,
       if (csm_plugin->canModelBeConstructedFromISD(support_data, this_model_name, &warnings)) {
         model_name   = this_model_name;
         model_family = csm_plugin->getModelFamily(i);
+        vw::Mutex::Lock lock(last_match_mutex);
+        last_plugin       = csm_plugin;
+        last_model_name   = model_name;
+        last_model_family = model_family;
         return csm_plugin; // Found a plugin that will work!
       }
       // Optionally print the reasons why we could not load it.
@@ -387,6 +407,18 @@ void CsmModel::load_model(std::string const& isd_path) {
   // TODO(oalexan1): Study how important is to compute sun position
   // at every single time. Likely given that a camera shot takes a
   // 1-3 seconds, the Sun can't move that much. 
+  // For linescan models, which can be large, read the Sun position
+  // directly rather than writing the state and parsing it back.
+  UsgsAstroLsSensorModel * ls_model
+    = dynamic_cast<UsgsAstroLsSensorModel*>(m_gm_model.get());
+  if (ls_model != NULL) {
+    if (ls_model->m_sunPosition.size() < 3)
+      vw::vw_throw(vw::ArgumentErr() << "The Sun position must be a vector of size >= 3.\n");
+    for (size_t it = 0; it < 3; it++) 
+      m_sun_position[it] = ls_model->m_sunPosition[it];
+    return;
+  }
+  
   std::string modelState = m_gm_model->getModelState();
   nlohmann::json j = stateAsJson(modelState);
   if (j.find("m_sunPosition") != j.end()) {
@@ -573,6 +605,7 @@ vw::Vector3 CsmModel::target_radii() const {
 }
 
 Vector2 CsmModel::point_to_pixel(Vector3 const& point) const {
+  TraceSpan span("csm_point_to_pixel", TraceSpan::MERGE, "camera");
   throw_if_not_init();
 
   csm::EcefCoord  ecef = vectorToEcefCoord(point);
@@ -0,0 +1,72 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file DenseEphemerisTable.cc
+///
+
+#include <asp/Camera/DenseEphemerisTable.h>
+
+#include <cmath>
+
+namespace asp {
+
+bool DenseEphemerisTable::contains(double t) const {
+  if (m_samples.empty())
+    return false;
+  // Cubic interpolation needs a sample before and two after the given time
+  double k = (t - m_t0) / m_dt;
+  return k >= 1.0 && k <= m_samples.size() - 2.0;
+}
+
+vw::Vector3 DenseEphemerisTable::position(double t) const {
+  double k = (t - m_t0) / m_dt;
+  int    i = std::floor(k);
+  i = std::max(1, std::min(i, int(m_samples.size()) - 3));
+  double u = k - i;
+
+  // Cubic Lagrange weights for the samples at i-1, i, i+1, and i+2
+  double w0 = -u * (u - 1.0) * (u - 2.0) / 6.0;
+  double w1 = (u + 1.0) * (u - 1.0) * (u - 2.0) / 2.0;
+  double w2 = -(u + 1.0) * u * (u - 2.0) / 2.0;
+  double w3 = (u + 1.0) * u * (u - 1.0) / 6.0;
+
+  double const* p0 = m_samples[i-1].position;
+  double const* p1 = m_samples[i  ].position;
+  double const* p2 = m_samples[i+1].position;
+  double const* p3 = m_samples[i+2].position;
+  return vw::Vector3(w0*p0[0] + w1*p1[0] + w2*p2[0] + w3*p3[0],
+                     w0*p0[1] + w1*p1[1] + w2*p2[1] + w3*p3[1],
+                     w0*p0[2] + w1*p1[2] + w2*p2[2] + w3*p3[2]);
+}
+
+vw::Quat DenseEphemerisTable::pose(double t) const {
+  double k = (t - m_t0) / m_dt;
+  int    i = std::floor(k);
+  i = std::max(0, std::min(i, int(m_samples.size()) - 2));
+  double u = k - i;
+
+  double const* q0 = m_samples[i  ].quat;
+  double const* q1 = m_samples[i+1].quat;
+  double q[4];
+  for (int c = 0; c < 4; c++)
+    q[c] = (1.0 - u) * q0[c] + u * q1[c];
+  double len = std::sqrt(q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+  return vw::Quat(q[0]/len, q[1]/len, q[2]/len, q[3]/len);
+}
+
+} // end namespace asp
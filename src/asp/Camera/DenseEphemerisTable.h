@@ -0,0 +1,133 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file DenseEphemerisTable.h
+///
+/// Camera positions and orientations of a linescan camera, sampled at
+/// uniform and fine time steps. Looking these up is much cheaper than
+/// evaluating the interpolation functors of the camera models, which find
+/// Lagrange weights or normalize quaternions on each call. Positions are
+/// found with cubic Lagrange interpolation and orientations with
+/// normalized linear interpolation between the two nearest samples.
+
+#ifndef __ASP_CAMERA_DENSE_EPHEMERIS_TABLE_H__
+#define __ASP_CAMERA_DENSE_EPHEMERIS_TABLE_H__
+
+#include <vw/Math/Vector.h>
+#include <vw/Math/Quaternion.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace asp {
+
+  class DenseEphemerisTable {
+  public:
+    DenseEphemerisTable(): m_t0(0.0), m_dt(0.0) {}
+
+    /// Sample the given position and pose functors at num_samples uniform
+    /// times from t0 to t1.
+    template <class PositionFuncT, class PoseFuncT>
+    void build(PositionFuncT const& position_func, PoseFuncT const& pose_func,
+               double t0, double t1, int num_samples);
+
+    /// Wipe the table. The camera will then use its own functors.
+    void clear() { m_samples.clear(); }
+
+    bool empty() const { return m_samples.empty(); }
+
+    /// If the interpolation at the given time uses only samples in the table
+    bool contains(double t) const;
+
+    vw::Vector3 position(double t) const;
+    vw::Quat    pose    (double t) const;
+
+    /// Largest differences between the table and the functors, at the
+    /// midpoints between samples, where interpolation is least accurate.
+    /// The angle is in radians.
+    template <class PositionFuncT, class PoseFuncT>
+    void max_errors(PositionFuncT const& position_func, PoseFuncT const& pose_func,
+                    double & position_err, double & angle_err) const;
+
+  private:
+    // Exactly 64 bytes, so that a sample does not straddle two cache lines
+    // when the storage is aligned.
+    struct Sample {
+      double position[3];
+      double quat[4]; // w, x, y, z
+      double padding;
+    };
+
+    double m_t0, m_dt;
+    std::vector<Sample> m_samples;
+  };
+
+  template <class PositionFuncT, class PoseFuncT>
+  void DenseEphemerisTable::build(PositionFuncT const& position_func,
+                                  PoseFuncT const& pose_func,
+                                  double t0, double t1, int num_samples) {
+    m_samples.clear();
+    if (num_samples < 4 || !(t1 > t0))
+      return;
+
+    m_t0 = t0;
+    m_dt = (t1 - t0) / (num_samples - 1.0);
+    m_samples.resize(num_samples);
+    for (int i = 0; i < num_samples; i++) {
+      double t = m_t0 + i * m_dt;
+      vw::Vector3 P = position_func(t);
+      vw::Quat    Q = pose_func(t);
+
+      // Keep neighboring quaternions in the same hemisphere, so that linear
+      // interpolation between them is meaningful.
+      if (i > 0) {
+        double const* q = m_samples[i-1].quat;
+        if (q[0] * Q.w() + q[1] * Q.x() + q[2] * Q.y() + q[3] * Q.z() < 0)
+          Q = vw::Quat(-Q.w(), -Q.x(), -Q.y(), -Q.z());
+      }
+
+      Sample & s = m_samples[i];
+      s.position[0] = P[0]; s.position[1] = P[1]; s.position[2] = P[2];
+      s.quat[0] = Q.w(); s.quat[1] = Q.x(); s.quat[2] = Q.y(); s.quat[3] = Q.z();
+      s.padding = 0.0;
+    }
+  }
+
+  template <class PositionFuncT, class PoseFuncT>
+  void DenseEphemerisTable::max_errors(PositionFuncT const& position_func,
+                                       PoseFuncT const& pose_func,
+                                       double & position_err, double & angle_err) const {
+    position_err = 0.0;
+    angle_err    = 0.0;
+    for (size_t i = 0; i + 1 < m_samples.size(); i++) {
+      double t = m_t0 + (i + 0.5) * m_dt;
+      if (!contains(t))
+        continue;
+      position_err = std::max(position_err, norm_2(position(t) - position_func(t)));
+
+      // The angle of the rotation taking one orientation to the other
+      vw::Quat dq = inverse(pose_func(t)) * pose(t);
+      double s = std::min(1.0, norm_2(vw::Vector3(dq.x(), dq.y(), dq.z())));
+      angle_err = std::max(angle_err, 2.0 * std::asin(s));
+    }
+  }
+
+} // end namespace asp
+
+#endif // __ASP_CAMERA_DENSE_EPHEMERIS_TABLE_H__
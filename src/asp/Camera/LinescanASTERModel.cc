@@ -19,6 +19,7 @@
 #include <asp/Camera/ASTER_XML.h>
 #include <vw/Camera/CameraSolve.h>
 #include <asp/Camera/LinescanASTERModel.h>
+#include <asp/Camera/LinescanProjection.h>
 namespace asp {
 
 using namespace vw;
@@ -109,6 +110,19 @@ ASTERCameraModel::ASTERCameraModel(std::vector< std::vector<vw::Vector2> > const
 // model is beneficial.  
 vw::Vector2 ASTERCameraModel::point_to_pixel(Vector3 const& point, Vector2 const& start_in) const {
 
+  // Without a guess, start from the last line solved for in this thread,
+  // which avoids the search for a guess below. If that fails, do the search.
+  if (start_in[0] < 0 && start_in[1] < 0) {
+    double last_line = LinescanProjectionContext::last_line(this);
+    if (last_line >= 0) {
+      try {
+        return point_to_pixel(point, Vector2(-1.0, last_line));
+      } catch (...) {
+        LinescanProjectionContext::clear(this);
+      }
+    }
+  }
+
   // - This method will be slower but works for more complicated geometries
   vw::camera::CameraGenericLMA model( this, point );
   int status;
@@ -213,6 +227,9 @@ vw::Vector2 ASTERCameraModel::point_to_pixel(Vector3 const& point, Vector2 const
   // stuck at the edge of the image.
   VW_ASSERT( (status > 0) && (error < MAX_ERROR),
              vw::camera::PointToPixelErr() << "Unable to project point into LinescanASTER model" );
+
+  if (solution.y() >= 0 && solution.y() < m_image_size[1])
+    LinescanProjectionContext::set_last_line(this, solution.y());
   
   return solution;
 }
@@ -0,0 +1,47 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file LinescanCorrectionTable.cc
+///
+
+#include <asp/Camera/LinescanCorrectionTable.h>
+
+namespace asp {
+
+bool LinescanCorrectionTable::contains(vw::Vector2 const& pix) const {
+  if (m_deltas.empty())
+    return false;
+  double l = (pix[1] - m_line0) / m_line_step;
+  double c = pix[0] / m_col_step;
+  return l >= 0.0 && l <= m_num_lines - 1.0 && c >= 0.0 && c <= m_num_cols - 1.0;
+}
+
+vw::Vector3 LinescanCorrectionTable::correction(vw::Vector2 const& pix) const {
+  double l = (pix[1] - m_line0) / m_line_step;
+  double c = pix[0] / m_col_step;
+  int li = std::max(0, std::min(int(std::floor(l)), m_num_lines - 2));
+  int ci = std::max(0, std::min(int(std::floor(c)), m_num_cols  - 2));
+  double wl = l - li, wc = c - ci;
+
+  vw::Vector3 const& d00 = m_deltas[li       * m_num_cols + ci    ];
+  vw::Vector3 const& d01 = m_deltas[li       * m_num_cols + ci + 1];
+  vw::Vector3 const& d10 = m_deltas[(li + 1) * m_num_cols + ci    ];
+  vw::Vector3 const& d11 = m_deltas[(li + 1) * m_num_cols + ci + 1];
+  return (1.0 - wl) * ((1.0 - wc) * d00 + wc * d01) + wl * ((1.0 - wc) * d10 + wc * d11);
+}
+
+} // end namespace asp
@@ -0,0 +1,134 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file LinescanCorrectionTable.h
+///
+/// The velocity aberration and atmospheric refraction corrections of a
+/// linescan camera, tabulated on a grid of image lines and columns. The
+/// corrections vary slowly, as velocity aberration depends on the time,
+/// so the line, and refraction on the view angle, so mostly the column.
+/// Each grid node holds the difference, in the camera frame, between the
+/// corrected and uncorrected pixel ray. A corrected ray is then found
+/// from the uncorrected one and a bilinear lookup, with no iterations or
+/// trigonometry. The table is built once and only read afterwards, so it
+/// is shared by all threads.
+
+#ifndef __ASP_CAMERA_LINESCAN_CORRECTION_TABLE_H__
+#define __ASP_CAMERA_LINESCAN_CORRECTION_TABLE_H__
+
+#include <vw/Math/Vector.h>
+#include <vw/Math/Quaternion.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace asp {
+
+  class LinescanCorrectionTable {
+  public:
+    LinescanCorrectionTable(): m_line0(0.0), m_line_step(0.0), m_col_step(0.0),
+                               m_num_lines(0), m_num_cols(0) {}
+
+    /// Tabulate the corrections for lines line0, line0 + line_step, ...,
+    /// up to line1, and for num_cols columns from 0 to max_col.
+    /// corrected_func(pix) must return the corrected ray in world
+    /// coordinates, local_func(pix) the uncorrected ray in the camera
+    /// frame, and pose_func(pix) the camera orientation at that pixel.
+    template <class CorrectedFuncT, class LocalFuncT, class PoseFuncT>
+    void build(CorrectedFuncT const& corrected_func, LocalFuncT const& local_func,
+               PoseFuncT const& pose_func, double line0, double line1,
+               double line_step, double max_col, int num_cols);
+
+    /// Wipe the table. The camera will then find the corrections itself.
+    void clear() { m_deltas.clear(); }
+
+    bool empty() const { return m_deltas.empty(); }
+
+    /// If the pixel is within the tabulated lines and columns
+    bool contains(vw::Vector2 const& pix) const;
+
+    /// The difference between the corrected and uncorrected ray in the
+    /// camera frame. Add it to the uncorrected ray, normalize, and rotate
+    /// to world coordinates.
+    vw::Vector3 correction(vw::Vector2 const& pix) const;
+
+    /// The largest angle, in radians, between the rays from the table and
+    /// from corrected_func, at the centers of the grid cells, where
+    /// interpolation is least accurate.
+    template <class CorrectedFuncT, class LocalFuncT, class PoseFuncT>
+    double max_error(CorrectedFuncT const& corrected_func, LocalFuncT const& local_func,
+                     PoseFuncT const& pose_func) const;
+
+  private:
+    vw::Vector2 node_pixel(int line_index, int col_index) const {
+      return vw::Vector2(col_index * m_col_step, m_line0 + line_index * m_line_step);
+    }
+
+    double m_line0, m_line_step, m_col_step;
+    int m_num_lines, m_num_cols;
+    std::vector<vw::Vector3> m_deltas; // row-major, a row for each line
+  };
+
+  template <class CorrectedFuncT, class LocalFuncT, class PoseFuncT>
+  void LinescanCorrectionTable::build(CorrectedFuncT const& corrected_func,
+                                      LocalFuncT const& local_func,
+                                      PoseFuncT const& pose_func,
+                                      double line0, double line1, double line_step,
+                                      double max_col, int num_cols) {
+    m_deltas.clear();
+    if (!(line1 > line0) || !(line_step > 0) || !(max_col > 0) || num_cols < 2)
+      return;
+
+    m_line0     = line0;
+    m_num_lines = std::max(2, int(std::ceil((line1 - line0) / line_step)) + 1);
+    m_line_step = (line1 - line0) / (m_num_lines - 1);
+    m_num_cols  = num_cols;
+    m_col_step  = max_col / (num_cols - 1);
+
+    m_deltas.resize(m_num_lines * m_num_cols);
+    for (int l = 0; l < m_num_lines; l++) {
+      for (int c = 0; c < m_num_cols; c++) {
+        vw::Vector2 pix = node_pixel(l, c);
+        vw::Vector3 corrected = inverse(pose_func(pix)).rotate(corrected_func(pix));
+        m_deltas[l * m_num_cols + c] = corrected - local_func(pix);
+      }
+    }
+  }
+
+  template <class CorrectedFuncT, class LocalFuncT, class PoseFuncT>
+  double LinescanCorrectionTable::max_error(CorrectedFuncT const& corrected_func,
+                                            LocalFuncT const& local_func,
+                                            PoseFuncT const& pose_func) const {
+    double max_err = 0.0;
+    for (int l = 0; l + 1 < m_num_lines; l++) {
+      for (int c = 0; c + 1 < m_num_cols; c++) {
+        vw::Vector2 pix = 0.5 * (node_pixel(l, c) + node_pixel(l + 1, c + 1));
+        vw::Vector3 exact = normalize(corrected_func(pix));
+        vw::Vector3 table
+          = normalize(pose_func(pix).rotate(local_func(pix) + correction(pix)));
+        // The angle between two unit vectors, accurate for small angles
+        max_err = std::max(max_err, 2.0 * std::asin(std::min(1.0, 0.5 * norm_2(exact - table))));
+      }
+    }
+    return max_err;
+  }
+
+} // end namespace asp
+
+#endif // __ASP_CAMERA_LINESCAN_CORRECTION_TABLE_H__
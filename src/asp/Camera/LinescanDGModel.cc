@@ -18,11 +18,14 @@
 #include <asp/Camera/RPC_XML.h>
 #include <asp/Camera/LinescanDGModel.h>
 #include <asp/Core/StereoSettings.h>
+#include <asp/Core/Tracing.h>
 #include <asp/Camera/CsmModel.h>
 
 #include <usgscsm/UsgsAstroLsSensorModel.h>
 #include <usgscsm/Utilities.h>
 
+#include <cmath>
+
 using namespace vw;
 
 namespace asp {
@@ -50,10 +53,10 @@ boost::shared_ptr<vw::camera::CameraModel> load_dg_camera_model_from_xml(std::st
   AttitudeXML  att;
   EphemerisXML eph;
   ImageXML     img;
-  RPCXML       rpc;
+  vw::BBox3    bbox;
 
   try {
-    read_xml(path, geo, att, eph, img, rpc);
+    read_dg_camera_xml(path, geo, att, eph, img, bbox);
   } catch (const std::exception& e){
     vw::vw_throw(vw::ArgumentErr() << "Invalid Digital Globe XML file: " << path << ". "
                  << "If you are not using Digital Globe images, you may "
@@ -65,7 +68,6 @@ boost::shared_ptr<vw::camera::CameraModel> load_dg_camera_model_from_xml(std::st
   // Get an estimate of the surface elevation from the corners specified in the file.
   // - Not every file has this information, in which case we will just use zero.
   double mean_ground_elevation = 0.0;
-  vw::BBox3 bbox = rpc.get_lon_lat_height_box();
   if (!bbox.empty())
     mean_ground_elevation = (bbox.min()[2] + bbox.max()[2]) / 2.0;
   
@@ -181,6 +183,83 @@ DGCameraModel::DGCameraModel
   // It is convenient to have the CSM model exist even if it is not used.
   // The cam_test.cc and jitter_solve.cc tools uses this assumption.
   populateCsmModel();
+
+  if (stereo_settings().dense_ephemeris_tables && !stereo_settings().dg_use_csm)
+    buildDenseTable();
+
+  if ((correct_velocity || correct_atmosphere) && !stereo_settings().dg_use_csm)
+    buildCorrectionTable();
+}
+
+void DGCameraModel::buildCorrectionTable() {
+
+  auto corrected_func = [this](vw::Vector2 const& pix) {
+    return this->vw::camera::LinescanModel::pixel_to_vector(pix);
+  };
+  auto local_func = [this](vw::Vector2 const& pix) {
+    return this->get_local_pixel_vector(pix);
+  };
+  auto pose_func = [this](vw::Vector2 const& pix) {
+    return this->get_camera_pose_at_time(this->get_time_at_line(pix[1]));
+  };
+
+  // Tabulate a little beyond the image, as solvers may go there
+  int num_lines = m_image_size[1];
+  double margin = 0.05 * num_lines + 10;
+  double line_step = 64.0;
+  int num_cols = 9;
+  const double MAX_PIXEL_ERR = 1e-3;
+  try {
+    for (int attempt = 0; attempt < 3; attempt++) {
+      m_correction_table.build(corrected_func, local_func, pose_func,
+                               -margin, num_lines - 1 + margin, line_step,
+                               m_image_size[0] - 1, num_cols);
+      double angle_err = m_correction_table.max_error(corrected_func, local_func, pose_func);
+      if (m_focal_length * angle_err <= MAX_PIXEL_ERR)
+        return;
+
+      line_step /= 4.0;
+      num_cols = 2 * num_cols - 1;
+    }
+  } catch (...) {}
+
+  vw_out(WarningMessage) << "Not tabulating the velocity aberration and atmospheric "
+                         << "refraction corrections for the DigitalGlobe camera, "
+                         << "as that would not be accurate enough.\n";
+  m_correction_table.clear();
+}
+
+void DGCameraModel::buildDenseTable() {
+
+  // Sample a little beyond the image, as solvers may go there
+  int num_lines = m_image_size[1];
+  double margin = 0.05 * num_lines + 10;
+  double t0 = m_time_func(-margin), t1 = m_time_func(num_lines - 1 + margin);
+  if (t1 < t0)
+    std::swap(t0, t1);
+
+  // This sensor is used for Earth only, so the distance to the ground is
+  // about the height above the datum.
+  vw::cartography::Datum datum("WGS84");
+  double lines_per_sample = 4.0;
+  const double MAX_PIXEL_ERR = 0.01;
+  for (int attempt = 0; attempt < 4; attempt++) {
+    int num_samples = std::round((num_lines + 2 * margin) / lines_per_sample) + 1;
+    m_dense_table.build(m_position_func, m_pose_func, t0, t1, num_samples);
+
+    double pos_err = 0.0, angle_err = 0.0;
+    m_dense_table.max_errors(m_position_func, m_pose_func, pos_err, angle_err);
+    double range = norm_2(m_position_func(0.5 * (t0 + t1))) - datum.semi_major_axis();
+    double pixel_err = m_focal_length * (angle_err + pos_err / std::max(range, 1.0));
+    if (pixel_err <= MAX_PIXEL_ERR)
+      return;
+
+    lines_per_sample /= 4.0;
+  }
+
+  vw_out(WarningMessage) << "Not using a dense ephemeris table for the DigitalGlobe "
+                         << "camera, as it would not be accurate enough.\n";
+  m_dense_table.clear();
 }
   
 // This is a lengthy function that does many initializations  
@@ -360,6 +439,9 @@ vw::Vector3 DGCameraModel::get_camera_center_at_time(double time) const {
     return vw::Vector3(ecef.x, ecef.y, ecef.z);
   }
   
+  if (m_dense_table.contains(time))
+    return m_dense_table.position(time);
+  
   return m_position_func(time);
 }
 
@@ -400,6 +482,9 @@ vw::Quat DGCameraModel::get_camera_pose_at_time(double time) const {
     getQuaternions(time, q);
     return vw::Quat(q[3], q[0], q[1], q[2]); // go from (x, y, z, w) to (w, x, y, z)
   }
+
+  if (m_dense_table.contains(time))
+    return m_dense_table.pose(time);
   
   return m_pose_func(time);
 }
@@ -413,6 +498,12 @@ vw::Vector3 DGCameraModel::pixel_to_vector(vw::Vector2 const& pix) const {
     csm::EcefLocus locus = m_ls_model->imageToRemoteImagingLocus(csm_pix);
     return vw::Vector3(locus.direction.x, locus.direction.y, locus.direction.z);
   }
+
+  // Look up the corrections rather than computing them
+  if (m_correction_table.contains(pix)) {
+    vw::Quat q = get_camera_pose_at_time(get_time_at_line(pix[1]));
+    return normalize(q.rotate(get_local_pixel_vector(pix) + m_correction_table.correction(pix)));
+  }
   
   return vw::camera::LinescanModel::pixel_to_vector(pix);
 }
@@ -439,6 +530,7 @@ double DGCameraModel::errorFunc(double y, vw::Vector3 const& point) const {
   
 // Point to pixel with no initial guess
 vw::Vector2 DGCameraModel::point_to_pixel(vw::Vector3 const& point) const {
+  TraceSpan span("dg_point_to_pixel", TraceSpan::MERGE, "camera");
   if (stereo_settings().dg_use_csm) {
 
     csm::EcefCoord ecef(point[0], point[1], point[2]);
@@ -521,6 +613,10 @@ vw::Vector2 DGCameraModel::point_to_pixel(vw::Vector3 const& point, double start
   if (stereo_settings().dg_use_csm)
     vw::vw_throw(vw::ArgumentErr()
                  << "point_to_pixel(point, starty): Cannot be called in CSM mode.\n");
+
+  // Without a guess, start from the last line solved for in this thread
+  if (starty < 0)
+    starty = LinescanProjectionContext::last_line(this);
     
   // Use the uncorrected function to get a fast but good starting seed.
   vw::camera::CameraGenericLMA model(this, point);
@@ -537,6 +633,7 @@ vw::Vector2 DGCameraModel::point_to_pixel(vw::Vector3 const& point, double start
      ABS_TOL, REL_TOL, MAX_ITERATIONS);
   VW_ASSERT(status > 0,
             vw::camera::PointToPixelErr() << "Unable to project point into LinescanDG model.");
+  remember_line(solution.y());
   return solution;
 }
   
@@ -25,6 +25,9 @@
 #define __STEREO_CAMERA_LINESCAN_DG_MODEL_H__
 
 #include <asp/Camera/TimeProcessing.h>
+#include <asp/Camera/LinescanProjection.h>
+#include <asp/Camera/DenseEphemerisTable.h>
+#include <asp/Camera/LinescanCorrectionTable.h>
 
 #include <vw/Camera/CameraSolve.h>
 #include <vw/Camera/LinescanModel.h>
@@ -110,6 +113,10 @@ namespace asp {
     
     // Override this implementation with a faster, more specialized implementation.
     virtual vw::Vector2 point_to_pixel(vw::Vector3 const& point, double starty) const {
+      // Without a guess, start from the last line solved for in this thread
+      if (starty < 0)
+        starty = LinescanProjectionContext::last_line(this);
+
       // Use the uncorrected function to get a fast but good starting seed.
       vw::camera::CameraGenericLMA model(this, point);
       int status;
@@ -125,6 +132,7 @@ namespace asp {
          ABS_TOL, REL_TOL, MAX_ITERATIONS);
       VW_ASSERT(status > 0,
                 vw::camera::PointToPixelErr() << "Unable to project point into LinescanDG model.");
+      remember_line(solution.y());
       return solution;
     }
     
@@ -171,35 +179,48 @@ namespace asp {
     const& get_time_func() const {return m_time_func;} 
 
   protected: // Functions
+
+    /// Keep the line just found as the guess for the next point, if it is
+    /// within the image.
+    void remember_line(double line) const {
+      if (line >= 0 && line < m_image_size.y())
+        LinescanProjectionContext::set_last_line(this, line);
+    }
   
     /// Low accuracy function used by point_to_pixel to get a good solver starting seed.
     vw::Vector2 point_to_pixel_uncorrected(vw::Vector3 const& point, double starty) const {
       // Solve for the correct line number to use
       LinescanLMA model(this, point);
-      int status;
       vw::Vector<double> objective(1), start(1);
       start[0] = m_image_size.y()/2; 
       // Use a refined guess, if available, otherwise the center line.
       if (starty >= 0)
         start[0] = starty;
 
-      // Run the solver
-      const double ABS_TOL = 1e-16;
-      const double REL_TOL = 1e-16;
-      const int    MAX_ITERATIONS = 1e+5;
-      vw::Vector<double> solution = vw::math::levenberg_marquardt(model, start, objective, status,
-                                                                  ABS_TOL, REL_TOL, MAX_ITERATIONS);
-
-      VW_ASSERT(status > 0, vw::camera::PointToPixelErr()
-                << "Unable to project point into LinescanDG model.");
+      // The problem is one-dimensional and smooth, so the secant method
+      // converges in a few steps, particularly with a good guess. Use the
+      // generic solver only if that fails.
+      double line = 0.0;
+      if (!secant_line_solve(model, start[0], line)) {
+        const double ABS_TOL = 1e-16;
+        const double REL_TOL = 1e-16;
+        const int    MAX_ITERATIONS = 1e+5;
+        int status;
+        vw::Vector<double> solution
+          = vw::math::levenberg_marquardt(model, start, objective, status,
+                                          ABS_TOL, REL_TOL, MAX_ITERATIONS);
+        VW_ASSERT(status > 0, vw::camera::PointToPixelErr()
+                  << "Unable to project point into LinescanDG model.");
+        line = solution[0];
+      }
 
       // Solve for sample location now that we know the correct line
-      double t = m_time_func(solution[0]);
+      double t = m_time_func(line);
       // TODO(oalexan1): Replace inverse with transpose if it is a rotation matrix?
-      vw::Vector3 pt = inverse(m_pose_func(t)).rotate(point - m_position_func(t));
+      vw::Vector3 pt = inverse(get_camera_pose_at_time(t)).rotate(point - get_camera_center_at_time(t));
       pt *= m_focal_length / pt.z();
 
-      return vw::Vector2(pt.x() - m_detector_origin[0], solution[0]);
+      return vw::Vector2(pt.x() - m_detector_origin[0], line);
     }
 
   protected: // Variables
@@ -238,18 +259,21 @@ namespace asp {
         m_model(model), m_point(pt) {}
 
         inline result_type operator()(domain_type const& y) const {
-          double       t        = m_model->get_time_at_line(y[0]);
+          result_type result(1);
+          result[0] = (*this)(y[0]);
+          return result;
+        }
+
+        // Error against the location of the detector for the given line
+        inline double operator()(double line) const {
+          double       t        = m_model->get_time_at_line(line);
           vw::Quat     pose     = m_model->get_camera_pose_at_time(t);
-          vw::Vector3  position = m_model->m_position_func(t);
+          vw::Vector3  position = m_model->get_camera_center_at_time(t);
           
           // Get point in camera's frame and rescale to pixel units
           vw::Vector3 pt = vw::camera::point_to_camera_coord(position, pose, m_point);
           pt *= m_model->m_focal_length / pt.z();
-          result_type result(1);
-
-          // Error against the location of the detector
-          result[0] = pt.y() - m_model->m_detector_origin[1]; 
-          return result;
+          return pt.y() - m_model->m_detector_origin[1]; 
         }
     };
     
@@ -332,6 +356,18 @@ namespace asp {
     // atmospheric refraction correction. That needs to be rectified
     // before removing the older approach.
     void populateCsmModel();
+
+    // Sample the positions and orientations densely, if enabled with
+    // --dense-ephemeris-tables. The table is dropped if it cannot
+    // reproduce the camera to a small fraction of a pixel.
+    void buildDenseTable();
+    DenseEphemerisTable m_dense_table;
+
+    // Tabulate the velocity aberration and atmospheric refraction
+    // corrections, if any of them is enabled. The table is dropped if it
+    // cannot reproduce the corrected rays to a small fraction of a pixel.
+    void buildCorrectionTable();
+    LinescanCorrectionTable m_correction_table;
   };
 
   /// Load a DG camera model from an XML file. This function does not
@@ -19,6 +19,10 @@
 #include <asp/Core/StereoSettings.h>
 #include <asp/Camera/PeruSatXML.h>
 #include <asp/Camera/LinescanPeruSatModel.h>
+#include <asp/Camera/LinescanProjection.h>
+#include <vw/Cartography/Datum.h>
+
+#include <cmath>
 
 namespace asp {
 
@@ -34,6 +38,19 @@ using vw::Matrix3x3;
 
 vw::Vector2 PeruSatCameraModel::point_to_pixel(Vector3 const& point, double starty) const {
 
+  // Without a guess, start from the last line solved for in this thread.
+  // If that fails, try again from the image center.
+  if (starty < 0) {
+    double last_line = LinescanProjectionContext::last_line(this);
+    if (last_line >= 0) {
+      try {
+        return point_to_pixel(point, last_line);
+      } catch (...) {
+        LinescanProjectionContext::clear(this);
+      }
+    }
+  }
+
   // Use the generic solver to find the pixel 
   // - This method will be slower but works for more complicated geometries
   vw::camera::CameraGenericLMA model(this, point);
@@ -58,6 +75,9 @@ vw::Vector2 PeruSatCameraModel::point_to_pixel(Vector3 const& point, double star
              vw::camera::PointToPixelErr()
              << "Unable to project point into LinescanPeruSat model" );
 
+  if (solution.y() >= 0 && solution.y() < m_image_size[1])
+    LinescanProjectionContext::set_last_line(this, solution.y());
+
   return solution;
 }
 
@@ -68,8 +88,46 @@ void PeruSatCameraModel::check_time(double time, std::string const& location) co
                  << m_min_time << " <-> "<<m_max_time<<")\n");
 }
 
+void PeruSatCameraModel::buildDenseTable() {
+
+  if (!stereo_settings().dense_ephemeris_tables)
+    return;
+
+  // The angle subtended by a pixel, to convert errors to pixels. PeruSat
+  // is an Earth sensor, so the distance to the ground is about the height
+  // above the datum.
+  double pixel_angle = std::abs(m_tan_psi_x[0]);
+  vw::cartography::Datum datum("WGS84");
+  double range = norm_2(m_position_func(0.5 * (m_min_time + m_max_time)))
+    - datum.semi_major_axis();
+  if (pixel_angle <= 0.0 || range <= 0.0)
+    return;
+
+  const double MAX_PIXEL_ERR = 0.01;
+  double line_dt = std::abs(m_time_func(1.0) - m_time_func(0.0));
+  double num_lines = line_dt > 0 ? (m_max_time - m_min_time) / line_dt : 0.0;
+  double lines_per_sample = 4.0;
+  for (int attempt = 0; attempt < 4 && num_lines > 0; attempt++) {
+    int num_samples = std::min(std::round(num_lines / lines_per_sample) + 1, 1.0e+7);
+    m_dense_table.build(m_position_func, m_pose_func, m_min_time, m_max_time, num_samples);
+
+    double pos_err = 0.0, angle_err = 0.0;
+    m_dense_table.max_errors(m_position_func, m_pose_func, pos_err, angle_err);
+    if ((angle_err + pos_err / range) / pixel_angle <= MAX_PIXEL_ERR)
+      return;
+
+    lines_per_sample /= 4.0;
+  }
+
+  vw::vw_out(vw::WarningMessage) << "Not using a dense ephemeris table for the PeruSat "
+                                 << "camera, as it would not be accurate enough.\n";
+  m_dense_table.clear();
+}
+
 vw::Vector3 PeruSatCameraModel::get_camera_center_at_time(double time) const {
   check_time(time, "get_camera_center_at_time");
+  if (m_dense_table.contains(time))
+    return m_dense_table.position(time);
   return m_position_func(time);
 }
 vw::Vector3 PeruSatCameraModel::get_camera_velocity_at_time(double time) const { 
@@ -78,7 +136,9 @@ vw::Vector3 PeruSatCameraModel::get_camera_velocity_at_time(double time) const {
 }
 vw::Quat PeruSatCameraModel::get_camera_pose_at_time(double time) const {
   check_time(time, "get_camera_pose_at_time");
- return m_pose_func(time); 
+  if (m_dense_table.contains(time))
+    return m_dense_table.pose(time);
+  return m_pose_func(time); 
 }
 
 double PeruSatCameraModel::get_time_at_line(double line) const {
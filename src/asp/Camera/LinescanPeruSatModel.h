@@ -29,6 +29,7 @@
 #include <vw/Camera/LinescanModel.h>
 #include <vw/Camera/PinholeModel.h>
 #include <vw/Camera/Extrinsics.h>
+#include <asp/Camera/DenseEphemerisTable.h>
 
 namespace asp {
 
@@ -54,7 +55,9 @@ namespace asp {
       m_pose_func(pose), m_time_func(time),
       m_tan_psi_x(tan_psi_x), m_tan_psi_y(tan_psi_y),
       m_inverse_instrument_biases(inverse(instrument_biases)),
-      m_min_time(min_time), m_max_time(max_time) {}
+      m_min_time(min_time), m_max_time(max_time) {
+      buildDenseTable();
+    }
     
     virtual ~PeruSatCameraModel() {}
     virtual std::string type() const { return "LinescanPeruSat"; }
@@ -94,6 +97,11 @@ namespace asp {
     /// - Pass the caller location in to get a nice error message.
     void check_time(double time, std::string const& location) const;
 
+    // Sample the positions and orientations densely, if enabled with
+    // --dense-ephemeris-tables.
+    void buildDenseTable();
+    DenseEphemerisTable m_dense_table;
+
   }; // End class PeruSatCameraModel
 
 
@@ -17,6 +17,7 @@
 
 #include <vw/Camera/CameraSolve.h>
 #include <asp/Core/StereoSettings.h>
+#include <asp/Core/Tracing.h>
 #include <asp/Camera/PleiadesXML.h>
 #include <asp/Camera/LinescanPleiadesModel.h>
 #include <asp/Camera/CsmModel.h>
@@ -191,6 +192,7 @@ vw::Vector3 PleiadesCameraModel::pixel_to_vector(vw::Vector2 const& pix) const {
   
 vw::Vector2 PleiadesCameraModel::point_to_pixel(vw::Vector3 const& point) const {
 
+  TraceSpan span("pleiades_point_to_pixel", TraceSpan::MERGE, "camera");
   csm::EcefCoord ecef(point[0], point[1], point[2]);
   
   // Do not show warnings, it becomes too verbose
@@ -0,0 +1,60 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file LinescanProjection.cc
+///
+
+#include <asp/Camera/LinescanProjection.h>
+
+#include <map>
+
+namespace asp {
+
+namespace {
+
+  // Few cameras are in use by a thread at a time. Past this, start over,
+  // as the entries may be for cameras which no longer exist.
+  const size_t MAX_CAMERAS_PER_THREAD = 64;
+
+  std::map<const void*, double> & thread_last_lines() {
+    thread_local std::map<const void*, double> last_lines;
+    return last_lines;
+  }
+
+}
+
+double LinescanProjectionContext::last_line(const void* camera) {
+  std::map<const void*, double> const& last_lines = thread_last_lines();
+  auto it = last_lines.find(camera);
+  if (it == last_lines.end())
+    return -1.0;
+  return it->second;
+}
+
+void LinescanProjectionContext::set_last_line(const void* camera, double line) {
+  std::map<const void*, double> & last_lines = thread_last_lines();
+  if (last_lines.size() >= MAX_CAMERAS_PER_THREAD && last_lines.find(camera) == last_lines.end())
+    last_lines.clear();
+  last_lines[camera] = line;
+}
+
+void LinescanProjectionContext::clear(const void* camera) {
+  thread_last_lines().erase(camera);
+}
+
+} // end namespace asp
@@ -0,0 +1,83 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file LinescanProjection.h
+///
+/// Helpers for projecting points into linescan cameras. Points are
+/// usually projected in raster order, so the line a point lands on is an
+/// excellent initial guess for the next point. The projection context
+/// remembers, for each thread and camera, the last line solved for.
+
+#ifndef __ASP_CAMERA_LINESCAN_PROJECTION_H__
+#define __ASP_CAMERA_LINESCAN_PROJECTION_H__
+
+#include <cmath>
+
+namespace asp {
+
+  class LinescanProjectionContext {
+  public:
+    /// The last line solved for with this camera in the current thread,
+    /// or -1 if there is none.
+    static double last_line(const void* camera);
+
+    /// Record the line just solved for with this camera in the current thread
+    static void set_last_line(const void* camera, double line);
+
+    /// Forget the line for this camera in the current thread, such as when
+    /// starting from it made the solver fail.
+    static void clear(const void* camera);
+  };
+
+  /// Find the line where the function f, such as the distance from a
+  /// projected point to the detector, is zero, using the secant method
+  /// starting at the given line. Returns false if there is no convergence,
+  /// so that the caller can fall back to a more robust solver.
+  template <class FuncT>
+  bool secant_line_solve(FuncT const& f, double start_line, double & line) {
+
+    const int    MAX_ITERATIONS = 50;
+    const double STEP_TOL       = 1e-10; // in lines
+    const double DELTA          = 1.0;   // the second starting point
+
+    double y0 = start_line, y1 = start_line + DELTA;
+    double f0 = f(y0), f1 = f(y1);
+    for (int iter = 0; iter < MAX_ITERATIONS; iter++) {
+      if (f1 == 0.0) {
+        line = y1;
+        return true;
+      }
+      double df = f1 - f0;
+      if (df == 0.0 || df != df)
+        return false;
+      double y2 = y1 - f1 * (y1 - y0) / df;
+      if (y2 != y2 || std::abs(y2) > 1e+12)
+        return false;
+      if (std::abs(y2 - y1) < STEP_TOL) {
+        line = y2;
+        return true;
+      }
+      y0 = y1; f0 = f1;
+      y1 = y2; f1 = f(y1);
+    }
+    return false;
+  }
+
+} // end namespace asp
+
+#endif // __ASP_CAMERA_LINESCAN_PROJECTION_H__
@@ -19,6 +19,7 @@
 #include <asp/Core/StereoSettings.h>
 #include <asp/Camera/SPOT_XML.h>
 #include <asp/Camera/LinescanSpotModel.h>
+#include <asp/Camera/LinescanProjection.h>
 
 namespace asp {
 
@@ -29,6 +30,19 @@ using vw::Matrix3x3;
 
 vw::Vector2 SPOTCameraModel::point_to_pixel(Vector3 const& point, double starty) const {
 
+  // Without a guess, start from the last line solved for in this thread.
+  // If that fails, try again from the image center.
+  if (starty < 0) {
+    double last_line = LinescanProjectionContext::last_line(this);
+    if (last_line >= 0) {
+      try {
+        return point_to_pixel(point, last_line);
+      } catch (...) {
+        LinescanProjectionContext::clear(this);
+      }
+    }
+  }
+
   // Use the generic solver to find the pixel 
   // - This method will be slower but works for more complicated geometries
   vw::camera::CameraGenericLMA model( this, point );
@@ -51,10 +65,67 @@ vw::Vector2 SPOTCameraModel::point_to_pixel(Vector3 const& point, double starty)
   VW_ASSERT( (status > 0) && (error < MAX_ERROR),
 	           vw::camera::PointToPixelErr() << "Unable to project point into LinescanSPOT model" );
 
+  if (solution.y() >= 0 && solution.y() < m_image_size[1])
+    LinescanProjectionContext::set_last_line(this, solution.y());
+
   return solution;
 }
 
 
+vw::Vector3 SPOTCameraModel::pixel_to_vector(vw::Vector2 const& pix) const {
+
+  // Look up the corrections rather than computing them
+  if (m_correction_table.contains(pix)) {
+    vw::Quat q = get_camera_pose_at_time(get_time_at_line(pix[1]));
+    return normalize(q.rotate(get_local_pixel_vector(pix) + m_correction_table.correction(pix)));
+  }
+
+  return vw::camera::LinescanModel::pixel_to_vector(pix);
+}
+
+void SPOTCameraModel::buildCorrectionTable() {
+
+  auto corrected_func = [this](vw::Vector2 const& pix) {
+    return this->vw::camera::LinescanModel::pixel_to_vector(pix);
+  };
+  auto local_func = [this](vw::Vector2 const& pix) {
+    return this->get_local_pixel_vector(pix);
+  };
+  auto pose_func = [this](vw::Vector2 const& pix) {
+    return this->get_camera_pose_at_time(this->get_time_at_line(pix[1]));
+  };
+
+  // The camera is defined only within the image
+  double max_line = m_image_size[1] - 1, max_col = double(m_look_angles.size()) - 1.0;
+  if (max_line <= 0 || max_col <= 0)
+    return;
+
+  // The angle between the rays of adjacent pixels
+  double pixel_angle = norm_2(get_local_pixel_vector(vw::Vector2(1, 0)) -
+                              get_local_pixel_vector(vw::Vector2(0, 0)));
+
+  double line_step = 64.0;
+  int num_cols = 9;
+  const double MAX_PIXEL_ERR = 1e-3;
+  try {
+    for (int attempt = 0; attempt < 3; attempt++) {
+      m_correction_table.build(corrected_func, local_func, pose_func,
+                               0, max_line, line_step, max_col, num_cols);
+      double angle_err = m_correction_table.max_error(corrected_func, local_func, pose_func);
+      if (angle_err <= MAX_PIXEL_ERR * pixel_angle)
+        return;
+
+      line_step /= 4.0;
+      num_cols = 2 * num_cols - 1;
+    }
+  } catch (...) {}
+
+  vw::vw_out(vw::WarningMessage) << "Not tabulating the velocity aberration and "
+                                 << "atmospheric refraction corrections for the "
+                                 << "SPOT camera, as that would not be accurate enough.\n";
+  m_correction_table.clear();
+}
+
 void SPOTCameraModel::check_time(double time, std::string const& location) const {
   if ((time < m_min_time) || (time > m_max_time))
     vw::vw_throw(vw::ArgumentErr() << "SPOTCameraModel::"<<location
@@ -29,6 +29,8 @@
 #include <vw/Camera/PinholeModel.h>
 #include <vw/Camera/Extrinsics.h>
 
+#include <asp/Camera/LinescanCorrectionTable.h>
+
 
 namespace asp {
 
@@ -110,7 +112,10 @@ namespace asp {
       m_position_func(position), m_velocity_func(velocity),
       m_pose_func(pose),         m_time_func(time),
       m_look_angles(look_angles),
-      m_min_time(min_time), m_max_time(max_time) {}
+      m_min_time(min_time), m_max_time(max_time) {
+      if (correct_velocity || correct_atmosphere)
+        buildCorrectionTable();
+    }
 		    
     virtual ~SPOTCameraModel() {}
     virtual std::string type() const { return "LinescanSPOT"; }
@@ -126,6 +131,9 @@ namespace asp {
     /// As pixel_to_vector, but in the local camera frame.
     virtual vw::Vector3 get_local_pixel_vector(vw::Vector2 const& pix) const;
 
+    /// Gives a pointing vector in the world coordinates
+    virtual vw::Vector3 pixel_to_vector(vw::Vector2 const& pix) const;
+
     // TODO: See if we can port these local changes to the parent class
     virtual vw::Vector2 point_to_pixel(vw::Vector3 const& point, double starty) const;
     virtual vw::Vector2 point_to_pixel(vw::Vector3 const& point) const {
@@ -174,6 +182,11 @@ namespace asp {
     /// - Pass the caller location in to get a nice error message.
     void check_time(double time, std::string const& location) const;
 
+    /// Tabulate the velocity aberration and atmospheric refraction
+    /// corrections. The table is dropped if it is not accurate enough.
+    void buildCorrectionTable();
+    LinescanCorrectionTable m_correction_table;
+
   }; // End class SPOTCameraModel
 
 
@@ -179,18 +179,12 @@ void PleiadesXML::read_ephemeris(xercesc::DOMElement* ephemeris) {
   xercesc::DOMElement* point_list = get_node<DOMElement>(ephemeris, "Point_List");
 
   // Pick out the "Point" nodes
-  DOMNodeList* children = point_list->getChildNodes();
-
-  for (XMLSize_t i = 0; i < children->getLength(); i++) {
-    
-    // Check child node type
-    DOMNode* child = children->item(i);
-    if (child->getNodeType() != DOMNode::ELEMENT_NODE)
-      continue;
+  for (DOMElement* curr_element = point_list->getFirstElementChild();
+       curr_element != NULL; curr_element = curr_element->getNextElementSibling()) {
 
     // Check the node name
-    DOMElement* curr_element = dynamic_cast<DOMElement*>(child);
-    std::string tag(XMLString::transcode(curr_element->getTagName()));
+    std::string tag;
+    cast_xmlch(curr_element->getTagName(), tag);
     if (tag.find("Point") == std::string::npos)
       continue;
 
@@ -22,6 +22,7 @@
 #include <vw/Cartography/GeoReference.h>
 #include <asp/Camera/RPCModel.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/Tracing.h>
 
 #include <gdal.h>
 #include <gdal_priv.h>
@@ -29,8 +30,46 @@
 #include <boost/smart_ptr/scoped_ptr.hpp>
 #include <boost/smart_ptr/shared_ptr.hpp>
 
+#include <cmath>
+
 using namespace vw;
 
+namespace {
+
+  const int NUM_TERMS = 20;
+
+  // The terms of the cubic RPC polynomials and their partial derivatives,
+  // in the order of RPCModel::calculate_terms().
+  inline void rpc_terms_and_derivatives(double x, double y, double z,
+                                        double t[NUM_TERMS], double tx[NUM_TERMS],
+                                        double ty[NUM_TERMS], double tz[NUM_TERMS]) {
+    double xx = x*x, yy = y*y, zz = z*z;
+    double xy = x*y, xz = x*z, yz = y*z;
+
+    t[ 0] = 1.0;    tx[ 0] = 0.0;    ty[ 0] = 0.0;    tz[ 0] = 0.0;
+    t[ 1] = x;      tx[ 1] = 1.0;    ty[ 1] = 0.0;    tz[ 1] = 0.0;
+    t[ 2] = y;      tx[ 2] = 0.0;    ty[ 2] = 1.0;    tz[ 2] = 0.0;
+    t[ 3] = z;      tx[ 3] = 0.0;    ty[ 3] = 0.0;    tz[ 3] = 1.0;
+    t[ 4] = xy;     tx[ 4] = y;      ty[ 4] = x;      tz[ 4] = 0.0;
+    t[ 5] = xz;     tx[ 5] = z;      ty[ 5] = 0.0;    tz[ 5] = x;
+    t[ 6] = yz;     tx[ 6] = 0.0;    ty[ 6] = z;      tz[ 6] = y;
+    t[ 7] = xx;     tx[ 7] = 2.0*x;  ty[ 7] = 0.0;    tz[ 7] = 0.0;
+    t[ 8] = yy;     tx[ 8] = 0.0;    ty[ 8] = 2.0*y;  tz[ 8] = 0.0;
+    t[ 9] = zz;     tx[ 9] = 0.0;    ty[ 9] = 0.0;    tz[ 9] = 2.0*z;
+    t[10] = xy*z;   tx[10] = yz;     ty[10] = xz;     tz[10] = xy;
+    t[11] = xx*x;   tx[11] = 3.0*xx; ty[11] = 0.0;    tz[11] = 0.0;
+    t[12] = x*yy;   tx[12] = yy;     ty[12] = 2.0*xy; tz[12] = 0.0;
+    t[13] = x*zz;   tx[13] = zz;     ty[13] = 0.0;    tz[13] = 2.0*xz;
+    t[14] = xx*y;   tx[14] = 2.0*xy; ty[14] = xx;     tz[14] = 0.0;
+    t[15] = yy*y;   tx[15] = 0.0;    ty[15] = 3.0*yy; tz[15] = 0.0;
+    t[16] = y*zz;   tx[16] = 0.0;    ty[16] = zz;     tz[16] = 2.0*yz;
+    t[17] = xx*z;   tx[17] = 2.0*xz; ty[17] = 0.0;    tz[17] = xx;
+    t[18] = yy*z;   tx[18] = 0.0;    ty[18] = 2.0*yz; tz[18] = yy;
+    t[19] = zz*z;   tx[19] = 0.0;    ty[19] = 0.0;    tz[19] = 3.0*zz;
+  }
+
+} // end anonymous namespace
+
 namespace asp {
 
   void RPCModel::initialize(DiskImageResourceGDAL* resource) {
@@ -206,6 +245,7 @@ namespace asp {
   // make that part of the API available. However I believe this is a
   // safe reinterpretation that is safe to distribute.
   Vector2 RPCModel::point_to_pixel(Vector3 const& point) const {
+    TraceSpan span("rpc_point_to_pixel", TraceSpan::MERGE, "camera");
     return geodetic_to_pixel(m_datum.cartesian_to_geodetic(point));
   }
 
@@ -221,6 +261,36 @@ namespace asp {
     return elem_prod(normalized_pixel, m_xy_scale) + m_xy_offset;
   }
 
+  void RPCModel::points_to_pixels(std::vector<Vector3> const& points,
+                                  std::vector<Vector2>      & pixels,
+                                  std::vector<unsigned char>    & valid) const {
+
+    pixels.resize(points.size());
+    valid.assign(points.size(), 0);
+
+    // Multiplying by the inverse scale is cheaper than dividing each time
+    Vector3 inv_scale(1.0/m_lonlatheight_scale[0], 1.0/m_lonlatheight_scale[1],
+                      1.0/m_lonlatheight_scale[2]);
+
+    for (size_t i = 0; i < points.size(); i++) {
+      Vector3 normalized_geodetic
+        = elem_prod(m_datum.cartesian_to_geodetic(points[i]) - m_lonlatheight_offset,
+                    inv_scale);
+
+      // The terms are shared by all four polynomials
+      Vector2 normalized_pixel;
+      normalized_geodetic_to_normalized_pixel_and_Jacobian(normalized_geodetic,
+                                                           m_line_num_coeff, m_line_den_coeff,
+                                                           m_sample_num_coeff, m_sample_den_coeff,
+                                                           normalized_pixel, NULL);
+      Vector2 pix = elem_prod(normalized_pixel, m_xy_scale) + m_xy_offset;
+
+      pixels[i] = pix;
+      if (std::isfinite(pix[0]) && std::isfinite(pix[1]))
+        valid[i] = 1;
+    }
+  }
+
   Vector2 RPCModel::normalized_geodetic_to_normalized_pixel
   (Vector3 const& normalized_geodetic,
    RPCModel::CoeffVec const& line_num_coeff,
@@ -228,15 +298,87 @@ namespace asp {
    RPCModel::CoeffVec const& sample_num_coeff,
    RPCModel::CoeffVec const& sample_den_coeff){
 
-    CoeffVec term = calculate_terms(normalized_geodetic);
-    Vector2 normalized_pixel(dot_prod(term,sample_num_coeff) /
-                             dot_prod(term,sample_den_coeff),
-                             dot_prod(term,line_num_coeff) /
-                             dot_prod(term,line_den_coeff));
-
+    Vector2 normalized_pixel;
+    normalized_geodetic_to_normalized_pixel_and_Jacobian(normalized_geodetic,
+                                                         line_num_coeff, line_den_coeff,
+                                                         sample_num_coeff, sample_den_coeff,
+                                                         normalized_pixel, NULL);
     return normalized_pixel;
   }
 
+  void RPCModel::normalized_geodetic_to_normalized_pixel_and_Jacobian
+  (Vector3 const& normalized_geodetic,
+   RPCModel::CoeffVec const& line_num_coeff,
+   RPCModel::CoeffVec const& line_den_coeff,
+   RPCModel::CoeffVec const& sample_num_coeff,
+   RPCModel::CoeffVec const& sample_den_coeff,
+   Vector2 & normalized_pixel, Matrix<double, 2, 3> * jacobian) {
+
+    double t[NUM_TERMS], tx[NUM_TERMS], ty[NUM_TERMS], tz[NUM_TERMS];
+    rpc_terms_and_derivatives(normalized_geodetic[0], normalized_geodetic[1],
+                              normalized_geodetic[2], t, tx, ty, tz);
+
+    const double * sn = &sample_num_coeff[0];
+    const double * sd = &sample_den_coeff[0];
+    const double * ln = &line_num_coeff[0];
+    const double * ld = &line_den_coeff[0];
+
+    if (jacobian == NULL) {
+      // The four dot products share one pass over the terms
+      double SN = 0.0, SD = 0.0, LN = 0.0, LD = 0.0;
+      for (int k = 0; k < NUM_TERMS; k++) {
+        SN += sn[k] * t[k]; SD += sd[k] * t[k];
+        LN += ln[k] * t[k]; LD += ld[k] * t[k];
+      }
+      normalized_pixel = Vector2(SN/SD, LN/LD);
+      return;
+    }
+
+    // Each polynomial and its gradient. Index 0 is the value, and 1 to 3
+    // are the partial derivatives.
+    double SN[4] = {0, 0, 0, 0}, SD[4] = {0, 0, 0, 0},
+      LN[4] = {0, 0, 0, 0}, LD[4] = {0, 0, 0, 0};
+    for (int k = 0; k < NUM_TERMS; k++) {
+      SN[0] += sn[k] * t[k];  SN[1] += sn[k] * tx[k];
+      SN[2] += sn[k] * ty[k]; SN[3] += sn[k] * tz[k];
+      SD[0] += sd[k] * t[k];  SD[1] += sd[k] * tx[k];
+      SD[2] += sd[k] * ty[k]; SD[3] += sd[k] * tz[k];
+      LN[0] += ln[k] * t[k];  LN[1] += ln[k] * tx[k];
+      LN[2] += ln[k] * ty[k]; LN[3] += ln[k] * tz[k];
+      LD[0] += ld[k] * t[k];  LD[1] += ld[k] * tx[k];
+      LD[2] += ld[k] * ty[k]; LD[3] += ld[k] * tz[k];
+    }
+
+    normalized_pixel = Vector2(SN[0]/SD[0], LN[0]/LD[0]);
+
+    // The quotient rule
+    double s_den = SD[0]*SD[0], l_den = LD[0]*LD[0];
+    for (int c = 0; c < 3; c++) {
+      (*jacobian)(0, c) = (SN[c+1]*SD[0] - SN[0]*SD[c+1]) / s_den;
+      (*jacobian)(1, c) = (LN[c+1]*LD[0] - LN[0]*LD[c+1]) / l_den;
+    }
+  }
+
+  void RPCModel::geodetic_to_pixel_and_Jacobian(Vector3 const& geodetic,
+                                                Vector2 & pixel,
+                                                Matrix<double, 2, 3> & jacobian) const {
+
+    Vector3 normalized_geodetic = elem_quot(geodetic - m_lonlatheight_offset,
+                                            m_lonlatheight_scale);
+    Vector2 normalized_pixel;
+    normalized_geodetic_to_normalized_pixel_and_Jacobian(normalized_geodetic,
+                                                         m_line_num_coeff, m_line_den_coeff,
+                                                         m_sample_num_coeff, m_sample_den_coeff,
+                                                         normalized_pixel, &jacobian);
+    pixel = elem_prod(normalized_pixel, m_xy_scale) + m_xy_offset;
+
+    // Undo the normalization of the input and output
+    for (int r = 0; r < 2; r++) {
+      for (int c = 0; c < 3; c++)
+        jacobian(r, c) *= m_xy_scale[r] / m_lonlatheight_scale[c];
+    }
+  }
+
   Vector2 RPCModel::normalized_geodetic_to_normalized_pixel
   (Vector3 const& normalized_geodetic) const {
 
@@ -384,19 +526,9 @@ namespace asp {
 
   Matrix<double, 2, 3> RPCModel::geodetic_to_pixel_Jacobian(Vector3 const& geodetic) const {
 
-    Vector3 normalized_geodetic = elem_quot(geodetic - m_lonlatheight_offset, m_lonlatheight_scale);
-
-    CoeffVec term = calculate_terms(normalized_geodetic);
-
-    CoeffVec Qs = quotient_Jacobian(sample_num_coeff(), sample_den_coeff(), term);
-    CoeffVec Ql = quotient_Jacobian(line_num_coeff(),   line_den_coeff(),   term);
-    Matrix<double, 20, 3> MN = terms_Jacobian3(normalized_geodetic) *
-      normalization_Jacobian(m_lonlatheight_scale);
-
+    Vector2 pixel;
     Matrix<double, 2, 3> J;
-    select_row(J, 0) = m_xy_scale[0] * transpose(Qs) * MN;
-    select_row(J, 1) = m_xy_scale[1] * transpose(Ql) * MN;
-
+    geodetic_to_pixel_and_Jacobian(geodetic, pixel, J);
     return J;
   }
 
@@ -412,16 +544,15 @@ namespace asp {
 
     // 3. The output is in normalized pixels (see m_xy_scale and m_xy_offset).
 
-    CoeffVec term = calculate_terms(normalized_geodetic);
-
-    CoeffVec Qs = quotient_Jacobian(sample_num_coeff(), sample_den_coeff(), term);
-    CoeffVec Ql = quotient_Jacobian(line_num_coeff(),   line_den_coeff(),   term);
-
-    Matrix<double, 20, 2> Jt = terms_Jacobian2(normalized_geodetic);
-
+    Vector2 normalized_pixel;
+    Matrix<double, 2, 3> J3;
+    normalized_geodetic_to_normalized_pixel_and_Jacobian(normalized_geodetic,
+                                                         m_line_num_coeff, m_line_den_coeff,
+                                                         m_sample_num_coeff, m_sample_den_coeff,
+                                                         normalized_pixel, &J3);
     Matrix<double, 2, 2> J;
-    select_row(J, 0) = transpose(Qs) * Jt;
-    select_row(J, 1) = transpose(Ql) * Jt;
+    J(0, 0) = J3(0, 0); J(0, 1) = J3(0, 1);
+    J(1, 0) = J3(1, 0); J(1, 1) = J3(1, 1);
 
     return J;
   }
@@ -474,8 +605,14 @@ namespace asp {
       normalized_geodetic[1] = normalized_lonlat[1];
       normalized_geodetic[2] = (height - m_lonlatheight_offset[2])/m_lonlatheight_scale[2];
 
-      Vector2              p = normalized_geodetic_to_normalized_pixel(normalized_geodetic);
-      Matrix<double, 2, 2> J = normalized_geodetic_to_pixel_Jacobian(normalized_geodetic);
+      // The pixel and the Jacobian are found together. Only the first two
+      // columns of the Jacobian are needed, as the height is fixed.
+      Vector2              p;
+      Matrix<double, 2, 3> J;
+      normalized_geodetic_to_normalized_pixel_and_Jacobian(normalized_geodetic,
+                                                           m_line_num_coeff, m_line_den_coeff,
+                                                           m_sample_num_coeff, m_sample_den_coeff,
+                                                           p, &J);
 
       // The inverse matrix computed analytically
       double det = J[0][0]*J[1][1] - J[0][1]*J[1][0];
@@ -37,6 +37,7 @@
 
 #include <string>
 #include <ostream>
+#include <vector>
 
 namespace vw {
   class DiskImageResourceGDAL;
@@ -93,6 +94,26 @@ namespace asp {
 
     vw::Vector2 geodetic_to_pixel( vw::Vector3 const& geodetic ) const;
 
+    /// Evaluate the numerators and denominators, and optionally their
+    /// Jacobian in respect to the normalized geodetic, in one pass over the
+    /// terms. This is much faster than calling the functions below separately.
+    static void normalized_geodetic_to_normalized_pixel_and_Jacobian
+      (vw::Vector3 const& normalized_geodetic,
+       CoeffVec    const& line_num_coeff,   CoeffVec const& line_den_coeff,
+       CoeffVec    const& sample_num_coeff, CoeffVec const& sample_den_coeff,
+       vw::Vector2 & normalized_pixel, vw::Matrix<double, 2, 3> * jacobian);
+
+    /// The pixel and its Jacobian in respect to the geodetic, found together
+    void geodetic_to_pixel_and_Jacobian(vw::Vector3 const& geodetic,
+                                        vw::Vector2 & pixel,
+                                        vw::Matrix<double, 2, 3> & jacobian) const;
+
+    /// Project many points at once. The normalization is set up only once.
+    /// On output, valid[i] is 1 if pixels[i] is finite, and 0 otherwise.
+    void points_to_pixels(std::vector<vw::Vector3> const& points,
+                          std::vector<vw::Vector2>      & pixels,
+                          std::vector<unsigned char>    & valid) const;
+
     // Access to constants
     vw::cartography::Datum const& datum   () const { return m_datum;               }
     CoeffVec    const& line_num_coeff     () const { return m_line_num_coeff;      }
@@ -20,8 +20,166 @@
 #include <asp/Camera/RPCModel.h>
 #include <vw/Math/Geometry.h>
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
 using namespace vw;
 
+namespace {
+
+  // A numerator for one of the pixel coordinates has 20 coefficients,
+  // and the denominator has 19, as its constant term is 1.
+  const int NUM_FRACTION_COEFFS = 39;
+
+  // Solve the symmetric positive definite system A*x = b with the
+  // Cholesky decomposition. A is overwritten. Return false if A is not
+  // positive definite.
+  bool cholesky_solve(std::vector<double> & A, std::vector<double> const& b,
+                      std::vector<double> & x, int n) {
+    for (int j = 0; j < n; j++) {
+      double d = A[j*n + j];
+      for (int k = 0; k < j; k++)
+        d -= A[j*n + k] * A[j*n + k];
+      if (!(d > 0.0))
+        return false;
+      d = std::sqrt(d);
+      A[j*n + j] = d;
+      for (int i = j + 1; i < n; i++) {
+        double v = A[i*n + j];
+        for (int k = 0; k < j; k++)
+          v -= A[i*n + k] * A[j*n + k];
+        A[i*n + j] = v / d;
+      }
+    }
+    x = b;
+    for (int i = 0; i < n; i++) {
+      for (int k = 0; k < i; k++)
+        x[i] -= A[i*n + k] * x[k];
+      x[i] /= A[i*n + i];
+    }
+    for (int i = n - 1; i >= 0; i--) {
+      for (int k = i + 1; k < n; k++)
+        x[i] -= A[k*n + i] * x[k];
+      x[i] /= A[i*n + i];
+    }
+    return true;
+  }
+
+  // The penalty weight of each of the 39 coefficients of a fraction, in
+  // the same way as RpcSolveLMA::operator().
+  void fraction_penalties(double wt, std::vector<double> & penalty) {
+    vw::Vector<int, 20> order = asp::RPCModel::get_coeff_order();
+    penalty.assign(NUM_FRACTION_COEFFS, 0.0);
+    for (int i = 4; i < 20; i++) {
+      penalty[i]      = wt * (order[i] - 1); // numerator
+      penalty[19 + i] = wt * (order[i] - 1); // denominator
+    }
+  }
+
+  // The sum of squares of the residuals of the fraction num/den, with the
+  // coefficients packed in p, and of the penalty terms.
+  double fraction_cost(std::vector<asp::RPCModel::CoeffVec> const& terms,
+                       std::vector<double> const& obs,
+                       std::vector<double> const& penalty,
+                       std::vector<double> const& p) {
+    double cost = 0.0;
+    for (size_t n = 0; n < terms.size(); n++) {
+      asp::RPCModel::CoeffVec const& t = terms[n];
+      double num = 0.0, den = 1.0;
+      for (int k = 0; k < 20; k++)
+        num += p[k] * t[k];
+      for (int k = 1; k < 20; k++)
+        den += p[19 + k] * t[k];
+      double r = obs[n] - num / den;
+      cost += r * r;
+    }
+    for (int k = 0; k < NUM_FRACTION_COEFFS; k++) {
+      double r = penalty[k] * p[k];
+      cost += r * r;
+    }
+    return cost;
+  }
+
+  // Fit one fraction with Levenberg-Marquardt. Return true on convergence.
+  bool fit_fraction(std::vector<asp::RPCModel::CoeffVec> const& terms,
+                    std::vector<double> const& obs, double wt,
+                    std::vector<double> & p) {
+
+    const int    n              = NUM_FRACTION_COEFFS;
+    const int    max_iterations = 200;
+    const double rel_tolerance  = 1e-14;
+
+    std::vector<double> penalty;
+    fraction_penalties(wt, penalty);
+
+    double lambda = 1e-3;
+    double cost = fraction_cost(terms, obs, penalty, p);
+    std::vector<double> H(n*n), A(n*n), g(n), delta(n), J(n), p_new(n);
+
+    for (int iter = 0; iter < max_iterations; iter++) {
+
+      // Accumulate the normal equations J^T J * delta = J^T r. Only the
+      // lower triangle of J^T J is needed.
+      std::fill(H.begin(), H.end(), 0.0);
+      std::fill(g.begin(), g.end(), 0.0);
+      for (size_t m = 0; m < terms.size(); m++) {
+        asp::RPCModel::CoeffVec const& t = terms[m];
+        double num = 0.0, den = 1.0;
+        for (int k = 0; k < 20; k++)
+          num += p[k] * t[k];
+        for (int k = 1; k < 20; k++)
+          den += p[19 + k] * t[k];
+        double q = num / den, r = obs[m] - q;
+        for (int k = 0; k < 20; k++)
+          J[k] = t[k] / den;
+        for (int k = 1; k < 20; k++)
+          J[19 + k] = -q * t[k] / den;
+        for (int i = 0; i < n; i++) {
+          g[i] += J[i] * r;
+          for (int j = 0; j <= i; j++)
+            H[i*n + j] += J[i] * J[j];
+        }
+      }
+      for (int k = 0; k < n; k++) {
+        H[k*n + k] += penalty[k] * penalty[k];
+        g[k]       -= penalty[k] * penalty[k] * p[k];
+      }
+
+      // Increase the damping until the cost goes down
+      bool improved = false;
+      double new_cost = cost;
+      while (lambda < 1e16) {
+        A = H;
+        for (int k = 0; k < n; k++)
+          A[k*n + k] *= (1.0 + lambda);
+        if (cholesky_solve(A, g, delta, n)) {
+          for (int k = 0; k < n; k++)
+            p_new[k] = p[k] + delta[k];
+          new_cost = fraction_cost(terms, obs, penalty, p_new);
+          if (new_cost < cost) {
+            improved = true;
+            break;
+          }
+        }
+        lambda *= 10.0;
+      }
+      if (!improved)
+        return true; // Cannot do better than this
+
+      double decrease = cost - new_cost;
+      p = p_new;
+      cost = new_cost;
+      lambda = std::max(lambda / 10.0, 1e-12);
+      if (decrease <= rel_tolerance * cost)
+        return true;
+    }
+
+    return false;
+  }
+
+} // end anonymous namespace
+
 namespace asp {
 
   void unpackCoeffs(Vector<double> const& C,
@@ -156,6 +314,105 @@ namespace asp {
     return status;
   }
 
+  RpcSolveLMA::jacobian_type RpcSolveLMA::jacobian(domain_type const& C) const {
+
+    RPCModel::CoeffVec lineNum, lineDen, sampNum, sampDen;
+    unpackCoeffs(C, lineNum, lineDen, sampNum, sampDen);
+
+    int numPts = m_normalizedGeodetics.size()/RPCModel::GEODETIC_COORD_SIZE;
+    jacobian_type J(m_normalizedPixels.size(), C.size());
+    for (size_t row = 0; row < J.rows(); row++)
+      for (size_t col = 0; col < J.cols(); col++)
+        J(row, col) = 0.0;
+
+    // The columns of the coefficients in C, as packed by packCoeffs()
+    const int LINE_NUM = 0, LINE_DEN = 19, SAMP_NUM = 39, SAMP_DEN = 58;
+
+    for (int i = 0; i < numPts; i++) {
+      vw::Vector3 G = subvector(m_normalizedGeodetics, RPCModel::GEODETIC_COORD_SIZE*i,
+                                RPCModel::GEODETIC_COORD_SIZE);
+      RPCModel::CoeffVec t = RPCModel::calculate_terms(G);
+
+      // The pixel is (sample, line), with each a quotient num/den
+      double samp_n = dot_prod(sampNum, t), samp_d = dot_prod(sampDen, t);
+      double line_n = dot_prod(lineNum, t), line_d = dot_prod(lineDen, t);
+      double samp_q = samp_n / samp_d, line_q = line_n / line_d;
+      int samp_row = RPCModel::IMAGE_COORD_SIZE*i, line_row = samp_row + 1;
+      for (int k = 0; k < 20; k++) {
+        J(samp_row, SAMP_NUM + k) = t[k] / samp_d;
+        J(line_row, LINE_NUM + k) = t[k] / line_d;
+      }
+      for (int k = 1; k < 20; k++) {
+        J(samp_row, SAMP_DEN + k) = -samp_q * t[k] / samp_d;
+        J(line_row, LINE_DEN + k) = -line_q * t[k] / line_d;
+      }
+    }
+
+    // The penalty terms, in the same order as in operator()
+    int count = RPCModel::IMAGE_COORD_SIZE*numPts;
+    vw::Vector<int,20> coeff_order = RPCModel::get_coeff_order();
+    for (int i = 4; i < 20; i++) J(count++, LINE_NUM + i) = m_wt * (coeff_order[i]-1);
+    for (int i = 4; i < 20; i++) J(count++, LINE_DEN + i) = m_wt * (coeff_order[i]-1);
+    for (int i = 4; i < 20; i++) J(count++, SAMP_NUM + i) = m_wt * (coeff_order[i]-1);
+    for (int i = 4; i < 20; i++) J(count++, SAMP_DEN + i) = m_wt * (coeff_order[i]-1);
+
+    return J;
+  }
+
+  int find_solution_normal_equations(RpcSolveLMA    const& lma_model,
+                                     Vector<double> const& seed_params,
+                                     Vector<double> const& actual_observations,
+                                     Vector<double>      & final_params,
+                                     double              & norm_error) {
+
+    Vector<double> const& geodetics = lma_model.normalized_geodetics();
+    int numPts = geodetics.size()/RPCModel::GEODETIC_COORD_SIZE;
+
+    // The terms are shared by the line and sample fits
+    std::vector<RPCModel::CoeffVec> terms(numPts);
+    std::vector<double> samp_obs(numPts), line_obs(numPts);
+    for (int i = 0; i < numPts; i++) {
+      terms[i] = RPCModel::calculate_terms
+        (subvector(geodetics, RPCModel::GEODETIC_COORD_SIZE*i, RPCModel::GEODETIC_COORD_SIZE));
+      samp_obs[i] = actual_observations[RPCModel::IMAGE_COORD_SIZE*i];
+      line_obs[i] = actual_observations[RPCModel::IMAGE_COORD_SIZE*i + 1];
+    }
+
+    RPCModel::CoeffVec lineNum, lineDen, sampNum, sampDen;
+    unpackCoeffs(seed_params, lineNum, lineDen, sampNum, sampDen);
+    std::vector<double> line_p(NUM_FRACTION_COEFFS), samp_p(NUM_FRACTION_COEFFS);
+    for (int k = 0; k < 20; k++) {
+      line_p[k] = lineNum[k];
+      samp_p[k] = sampNum[k];
+    }
+    for (int k = 1; k < 20; k++) {
+      line_p[19 + k] = lineDen[k];
+      samp_p[19 + k] = sampDen[k];
+    }
+
+    bool line_ok = fit_fraction(terms, line_obs, lma_model.penalty_weight(), line_p);
+    bool samp_ok = fit_fraction(terms, samp_obs, lma_model.penalty_weight(), samp_p);
+
+    for (int k = 0; k < 20; k++) {
+      lineNum[k] = line_p[k];
+      sampNum[k] = samp_p[k];
+    }
+    for (int k = 1; k < 20; k++) {
+      lineDen[k] = line_p[19 + k];
+      sampDen[k] = samp_p[19 + k];
+    }
+    packCoeffs(lineNum, lineDen, sampNum, sampDen, final_params);
+
+    int status = (line_ok && samp_ok) ? 1 : 0;
+    if (status < 1)
+      VW_OUT(DebugMessage, "asp") << "rpc_gen: WARNING --> The RPC solver did not converge.\n";
+
+    Vector<double> final_projected = lma_model(final_params);
+    Vector<double> final_error     = lma_model.difference(final_projected, actual_observations);
+    norm_error = norm_2(final_error);
+    return status;
+  }
+
   void gen_rpc(// Inputs
                double penalty_weight,
                std::string    const& output_prefix,
@@ -242,8 +499,8 @@ namespace asp {
     VW_OUT(DebugMessage, "asp") << "Initial guess for RPC coeffs: " << startGuess << std::endl;
     
     // Use the L-M solver to optimize the RPC model coefficient values.
-    int status = find_solution_from_seed(lma_model, startGuess, normalized_pixels,
-                                         solution, norm_error);
+    int status = find_solution_normal_equations(lma_model, startGuess, normalized_pixels,
+                                                solution, norm_error);
     VW_OUT(DebugMessage, "asp") << "Solved RPC coeffs: " << solution << std::endl;
     VW_OUT(DebugMessage, "asp") << "rpc_gen: norm_error = " << norm_error << std::endl;
 
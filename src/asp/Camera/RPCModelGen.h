@@ -115,6 +115,13 @@ namespace asp {
       return result;
     }
 
+    /// The derivatives of operator() in respect to the RPC coefficients,
+    /// found analytically. Each pixel row depends only on the 39
+    /// coefficients of its own coordinate.
+    jacobian_type jacobian( domain_type const& C ) const;
+
+    vw::Vector<double> const& normalized_geodetics() const { return m_normalizedGeodetics; }
+    double penalty_weight() const { return m_wt; }
   };
 
   /// Print out a name followed by the vector of values
@@ -135,6 +142,17 @@ namespace asp {
                               vw::Vector<double>      & final_params,
                               double              & norm_error);
   
+  /// Same as find_solution_from_seed(), but exploit that the line and
+  /// sample coefficients are independent of each other. Each set of 39 is
+  /// found with Levenberg-Marquardt iterations on its own 39 x 39 normal
+  /// equations, which are accumulated one point at a time instead of
+  /// forming the full Jacobian.
+  int find_solution_normal_equations(RpcSolveLMA    const& lma_model,
+                                     vw::Vector<double> const& seed_params,
+                                     vw::Vector<double> const& actual_observations,
+                                     vw::Vector<double>      & final_params,
+                                     double              & norm_error);
+
   void gen_rpc(// Inputs
                double penalty_weight,
                std::string    const& output_prefix,
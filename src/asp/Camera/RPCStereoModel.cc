@@ -34,24 +34,44 @@ namespace asp {
 
   namespace detail {
     class RPCTriangulateLMA : public math::LeastSquaresModelBase<RPCTriangulateLMA> {
-      const RPCModel *m_rpc_model1, *m_rpc_model2;
     public:
       typedef Vector<double, 4>    result_type;
       typedef Vector<double, 3>    domain_type;
       typedef Matrix<double, 4, 3> jacobian_type;
 
+    private:
+      const RPCModel *m_rpc_model1, *m_rpc_model2;
+
+      // The Jacobian costs little more once the terms are found, so it is
+      // computed with each residual and kept for the solver's next call.
+      mutable domain_type   m_cached_x;
+      mutable jacobian_type m_cached_J;
+      mutable bool          m_has_cache;
+
+    public:
+
       RPCTriangulateLMA( RPCModel const* rpc_model1,
                          RPCModel const* rpc_model2 ) :
-        m_rpc_model1(rpc_model1), m_rpc_model2(rpc_model2) {}
+        m_rpc_model1(rpc_model1), m_rpc_model2(rpc_model2), m_has_cache(false) {}
 
       inline result_type operator()( domain_type const& x ) const {
         result_type output;
-        subvector(output, 0, 2) = m_rpc_model1->geodetic_to_pixel(x);
-        subvector(output, 2, 2) = m_rpc_model2->geodetic_to_pixel(x);
+        Vector2 pix1, pix2;
+        Matrix<double, 2, 3> J1, J2;
+        m_rpc_model1->geodetic_to_pixel_and_Jacobian(x, pix1, J1);
+        m_rpc_model2->geodetic_to_pixel_and_Jacobian(x, pix2, J2);
+        subvector(output, 0, 2) = pix1;
+        subvector(output, 2, 2) = pix2;
+        submatrix(m_cached_J, 0, 0, 2, 3) = J1;
+        submatrix(m_cached_J, 2, 0, 2, 3) = J2;
+        m_cached_x  = x;
+        m_has_cache = true;
         return output;
       }
 
       inline jacobian_type jacobian( domain_type const& x ) const {
+        if (m_has_cache && m_cached_x == x)
+          return m_cached_J;
         jacobian_type J;
         submatrix(J, 0, 0, 2, 3) = m_rpc_model1->geodetic_to_pixel_Jacobian(x);
         submatrix(J, 2, 0, 2, 3) = m_rpc_model2->geodetic_to_pixel_Jacobian(x);
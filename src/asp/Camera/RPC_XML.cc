@@ -26,6 +26,7 @@
 #include <asp/Camera/RPCModel.h>
 #include <asp/Camera/XMLBase.h>
 #include <asp/Core/StereoSettings.h>
+#include <asp/Core/Hash.h>
 
 #include <xercesc/parsers/XercesDOMParser.hpp>
 #include <xercesc/sax/HandlerBase.hpp>
@@ -35,6 +36,11 @@
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
 
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <unistd.h>
+
 using namespace vw;
 using namespace vw::cartography;
 using namespace xercesc;
@@ -66,20 +72,19 @@ void asp::ImageXML::parse_band_tdi(xercesc::DOMElement* node, int & out_tdi) {
 }
 
 void asp::ImageXML::parse_tlc_list(xercesc::DOMElement* node) {
-  DOMNodeList* children = node->getChildNodes();
   size_t count = 0;
 
-  for (XMLSize_t i = 0; i < children->getLength(); i++) {
-    if (children->item(i)->getNodeType() == DOMNode::ELEMENT_NODE) {
-      DOMElement* element = dynamic_cast<DOMElement*>(children->item(i));
-      std::string buffer;
-      cast_xmlch(element->getTextContent(), buffer);
+  // Walk the siblings, as DOMNodeList::item() and getLength() walk
+  // the list from its start on each call. The lists here are long.
+  for (DOMElement* element = node->getFirstElementChild(); element != NULL;
+       element = element->getNextElementSibling()) {
+    std::string buffer;
+    cast_xmlch(element->getTextContent(), buffer);
 
-      std::istringstream istr(buffer);
-      istr >> tlc_vec[count].first >> tlc_vec[count].second;
+    std::istringstream istr(buffer);
+    istr >> tlc_vec[count].first >> tlc_vec[count].second;
 
-      count++;
-    }
+    count++;
   }
 
   VW_ASSERT(count == tlc_vec.size(),
@@ -322,34 +327,31 @@ void asp::EphemerisXML::parse_meta(xercesc::DOMElement* node) {
 }
 
 void asp::EphemerisXML::parse_eph_list(xercesc::DOMElement* node) {
-  DOMNodeList* children = node->getChildNodes();
   size_t count = 0;
 
-  for (XMLSize_t i = 0; i < children->getLength(); i++) {
-    if (children->item(i)->getNodeType() == DOMNode::ELEMENT_NODE) {
-      DOMElement* element = dynamic_cast<DOMElement*>(children->item(i));
-      std::string buffer;
-      cast_xmlch(element->getTextContent(), buffer);
-
-      std::istringstream istr(buffer);
-      std::string index_b;
-      istr >> index_b;
-      size_t index;
-      try{
-        index = size_t(boost::lexical_cast<float>(index_b) + 0.5) - 1;
-      } catch (boost::bad_lexical_cast const& e) {
-        vw_throw(ArgumentErr() << "Failed to parse string: " << index_b << "\n");
-      }
+  for (DOMElement* element = node->getFirstElementChild(); element != NULL;
+       element = element->getNextElementSibling()) {
+    std::string buffer;
+    cast_xmlch(element->getTextContent(), buffer);
+
+    std::istringstream istr(buffer);
+    std::string index_b;
+    istr >> index_b;
+    size_t index;
+    try{
+      index = size_t(boost::lexical_cast<float>(index_b) + 0.5) - 1;
+    } catch (boost::bad_lexical_cast const& e) {
+      vw_throw(ArgumentErr() << "Failed to parse string: " << index_b << "\n");
+    }
 
-      istr >> position_vec  [index][0] >> position_vec  [index][1]
-           >> position_vec  [index][2] >> velocity_vec  [index][0]
-           >> velocity_vec  [index][1] >> velocity_vec  [index][2];
-      istr >> covariance_vec[index][0] >> covariance_vec[index][1]
-           >> covariance_vec[index][2] >> covariance_vec[index][3]
-           >> covariance_vec[index][4] >> covariance_vec[index][5];
+    istr >> position_vec  [index][0] >> position_vec  [index][1]
+         >> position_vec  [index][2] >> velocity_vec  [index][0]
+         >> velocity_vec  [index][1] >> velocity_vec  [index][2];
+    istr >> covariance_vec[index][0] >> covariance_vec[index][1]
+         >> covariance_vec[index][2] >> covariance_vec[index][3]
+         >> covariance_vec[index][4] >> covariance_vec[index][5];
 
-      count++;
-    }
+    count++;
   }
 
   VW_ASSERT(count == position_vec.size(),
@@ -379,36 +381,33 @@ void asp::AttitudeXML::parse_meta(xercesc::DOMElement* node) {
 }
 
 void asp::AttitudeXML::parse_att_list(xercesc::DOMElement* node) {
-  DOMNodeList* children = node->getChildNodes();
   size_t count = 0;
   Vector4 qbuf;
 
-  for (XMLSize_t i = 0; i < children->getLength(); i++) {
-    if (children->item(i)->getNodeType() == DOMNode::ELEMENT_NODE) {
-      DOMElement* element = dynamic_cast<DOMElement*>(children->item(i));
-      std::string buffer;
-      cast_xmlch(element->getTextContent(), buffer);
-
-      std::istringstream istr(buffer);
-      std::string index_b;
-      istr >> index_b;
-      size_t index;
-      try {
-        index = size_t(boost::lexical_cast<float>(index_b) + 0.5) - 1;
-      } catch (boost::bad_lexical_cast const& e) {
-        vw_throw(ArgumentErr() << "Failed to parse string: " << index_b << "\n");
-      }
+  for (DOMElement* element = node->getFirstElementChild(); element != NULL;
+       element = element->getNextElementSibling()) {
+    std::string buffer;
+    cast_xmlch(element->getTextContent(), buffer);
+
+    std::istringstream istr(buffer);
+    std::string index_b;
+    istr >> index_b;
+    size_t index;
+    try {
+      index = size_t(boost::lexical_cast<float>(index_b) + 0.5) - 1;
+    } catch (boost::bad_lexical_cast const& e) {
+      vw_throw(ArgumentErr() << "Failed to parse string: " << index_b << "\n");
+    }
 
-      istr >> qbuf[0] >> qbuf[1] >> qbuf[2] >> qbuf[3];
-      quat_vec[index] = Quat(qbuf[3], qbuf[0], qbuf[1], qbuf[2]);
-      istr >> covariance_vec[index][0] >> covariance_vec[index][1]
-           >> covariance_vec[index][2] >> covariance_vec[index][3]
-           >> covariance_vec[index][4] >> covariance_vec[index][5]
-           >> covariance_vec[index][6] >> covariance_vec[index][7]
-           >> covariance_vec[index][8] >> covariance_vec[index][9];
+    istr >> qbuf[0] >> qbuf[1] >> qbuf[2] >> qbuf[3];
+    quat_vec[index] = Quat(qbuf[3], qbuf[0], qbuf[1], qbuf[2]);
+    istr >> covariance_vec[index][0] >> covariance_vec[index][1]
+         >> covariance_vec[index][2] >> covariance_vec[index][3]
+         >> covariance_vec[index][4] >> covariance_vec[index][5]
+         >> covariance_vec[index][6] >> covariance_vec[index][7]
+         >> covariance_vec[index][8] >> covariance_vec[index][9];
 
-      count++;
-    }
+    count++;
   }
 
   VW_ASSERT(count == quat_vec.size(),
@@ -724,26 +723,22 @@ void asp::read_xml(std::string const& filename,
       rpc.parse_bbox(elementRoot); // Load the bounding box information.
     } catch(...){}
 
-    DOMNodeList* children = elementRoot->getChildNodes();
-    for (XMLSize_t i = 0; i < children->getLength(); ++i) {
-      DOMNode* curr_node = children->item(i);
-      if (curr_node->getNodeType() == DOMNode::ELEMENT_NODE) {
-        DOMElement* curr_element =
-          dynamic_cast<DOMElement*>(curr_node);
-
-        std::string tag(XMLString::transcode(curr_element->getTagName()));
-
-        if (tag == "GEO")
-          geo.parse(curr_element);
-        else if (tag == "EPH")
-          eph.parse(curr_element);
-        else if (tag == "ATT")
-          att.parse(curr_element);
-        else if (tag == "IMD")
-          img.parse(curr_element);
-        else if (tag == "RPB")
-          rpc.parse(curr_element);
-      }
+    for (DOMElement* curr_element = elementRoot->getFirstElementChild();
+         curr_element != NULL; curr_element = curr_element->getNextElementSibling()) {
+
+      std::string tag;
+      cast_xmlch(curr_element->getTagName(), tag);
+
+      if (tag == "GEO")
+        geo.parse(curr_element);
+      else if (tag == "EPH")
+        eph.parse(curr_element);
+      else if (tag == "ATT")
+        att.parse(curr_element);
+      else if (tag == "IMD")
+        img.parse(curr_element);
+      else if (tag == "RPB")
+        rpc.parse(curr_element);
     }
   } catch (const std::exception& e) {                
     vw_throw(ArgumentErr() << e.what() << " XML file \"" << filename << "\" is invalid.\n");
@@ -751,6 +746,230 @@ void asp::read_xml(std::string const& filename,
 
 }
 
+// The binary cache of the camera data in a Digital Globe XML file
+namespace {
+
+  // Must change when what is saved changes
+  const std::string DG_CACHE_MAGIC = "ASP_DG_XML_CACHE_1";
+
+  // Values are appended in native byte order, as the cache is not
+  // meant to be moved across machines. If it is, the hash will not
+  // match and the XML will be parsed again.
+  class DgCacheWriter {
+    std::string m_buf;
+  public:
+    void add(const void* data, size_t len) {
+      m_buf.append(static_cast<const char*>(data), len);
+    }
+    void add(double val) { add(&val, sizeof(val)); }
+    void add(vw::uint64 val) { add(&val, sizeof(val)); }
+    void add(std::string const& str) {
+      add(vw::uint64(str.size()));
+      add(str.data(), str.size());
+    }
+    template <class VecT>
+    void add_vec(VecT const& vec, int len) {
+      for (int i = 0; i < len; i++)
+        add(double(vec[i]));
+    }
+    template <class VecT>
+    void add_vecs(std::vector<VecT> const& vecs, int len) {
+      add(vw::uint64(vecs.size()));
+      for (size_t i = 0; i < vecs.size(); i++)
+        add_vec(vecs[i], len);
+    }
+    std::string const& buf() const { return m_buf; }
+  };
+
+  // Read the values in the order they were written. Throws if the
+  // buffer is too short.
+  class DgCacheReader {
+    std::string const& m_buf;
+    size_t m_pos;
+  public:
+    DgCacheReader(std::string const& buf, size_t pos): m_buf(buf), m_pos(pos) {}
+    void get(void* data, size_t len) {
+      if (len > m_buf.size() - m_pos)
+        vw_throw(IOErr() << "Truncated camera cache.\n");
+      memcpy(data, m_buf.data() + m_pos, len);
+      m_pos += len;
+    }
+    double get_double() { double val; get(&val, sizeof(val)); return val; }
+    vw::uint64 get_uint64() { vw::uint64 val; get(&val, sizeof(val)); return val; }
+    std::string get_string() {
+      vw::uint64 len = get_uint64();
+      if (len > m_buf.size() - m_pos)
+        vw_throw(IOErr() << "Truncated camera cache.\n");
+      std::string str = m_buf.substr(m_pos, len);
+      m_pos += len;
+      return str;
+    }
+    template <class VecT>
+    void get_vec(VecT & vec, int len) {
+      for (int i = 0; i < len; i++)
+        vec[i] = get_double();
+    }
+    template <class VecT>
+    void get_vecs(std::vector<VecT> & vecs, int len) {
+      vw::uint64 num = get_uint64();
+      if (num > (m_buf.size() - m_pos) / (len * sizeof(double)))
+        vw_throw(IOErr() << "Truncated camera cache.\n");
+      vecs.resize(num);
+      for (size_t i = 0; i < vecs.size(); i++)
+        get_vec(vecs[i], len);
+    }
+  };
+
+  void write_dg_cache(DgCacheWriter & w, asp::GeometricXML const& geo,
+                      asp::AttitudeXML const& att, asp::EphemerisXML const& eph,
+                      asp::ImageXML const& img, vw::BBox3 const& box) {
+    w.add(geo.principal_distance);
+    w.add_vec(geo.perspective_center, 3);
+    w.add(geo.camera_attitude.w()); w.add(geo.camera_attitude.x());
+    w.add(geo.camera_attitude.y()); w.add(geo.camera_attitude.z());
+    w.add_vec(geo.detector_origin, 2);
+    w.add(geo.detector_rotation);
+    w.add(geo.detector_pixel_pitch);
+
+    w.add(att.start_time);
+    w.add(att.time_interval);
+    w.add(vw::uint64(att.quat_vec.size()));
+    for (size_t i = 0; i < att.quat_vec.size(); i++) {
+      vw::Quat const& q = att.quat_vec[i];
+      w.add(q.w()); w.add(q.x()); w.add(q.y()); w.add(q.z());
+    }
+
+    w.add(eph.start_time);
+    w.add(eph.time_interval);
+    w.add_vecs(eph.position_vec, 3);
+    w.add_vecs(eph.velocity_vec, 3);
+
+    w.add(img.tlc_start_time);
+    w.add(img.first_line_start_time);
+    w.add(vw::uint64(img.tlc_vec.size()));
+    for (size_t i = 0; i < img.tlc_vec.size(); i++) {
+      w.add(img.tlc_vec[i].first);
+      w.add(img.tlc_vec[i].second);
+    }
+    w.add(img.scan_direction);
+    w.add(img.avg_line_rate);
+    w.add_vec(img.image_size, 2);
+
+    w.add(vw::uint64(box.empty() ? 0 : 1));
+    if (!box.empty()) {
+      w.add_vec(box.min(), 3);
+      w.add_vec(box.max(), 3);
+    }
+  }
+
+  void read_dg_cache(DgCacheReader & r, asp::GeometricXML & geo,
+                     asp::AttitudeXML & att, asp::EphemerisXML & eph,
+                     asp::ImageXML & img, vw::BBox3 & box) {
+    geo.principal_distance = r.get_double();
+    r.get_vec(geo.perspective_center, 3);
+    double qw = r.get_double(), qx = r.get_double(), qy = r.get_double(), qz = r.get_double();
+    geo.camera_attitude = vw::Quat(qw, qx, qy, qz);
+    r.get_vec(geo.detector_origin, 2);
+    geo.detector_rotation    = r.get_double();
+    geo.detector_pixel_pitch = r.get_double();
+
+    att.start_time    = r.get_string();
+    att.time_interval = r.get_double();
+    vw::uint64 num = r.get_uint64();
+    att.quat_vec.clear();
+    for (vw::uint64 i = 0; i < num; i++) {
+      double w = r.get_double(), x = r.get_double(), y = r.get_double(), z = r.get_double();
+      att.quat_vec.push_back(vw::Quat(w, x, y, z));
+    }
+
+    eph.start_time    = r.get_string();
+    eph.time_interval = r.get_double();
+    r.get_vecs(eph.position_vec, 3);
+    r.get_vecs(eph.velocity_vec, 3);
+
+    img.tlc_start_time        = r.get_string();
+    img.first_line_start_time = r.get_string();
+    num = r.get_uint64();
+    img.tlc_vec.clear();
+    for (vw::uint64 i = 0; i < num; i++) {
+      double line = r.get_double(), time = r.get_double();
+      img.tlc_vec.push_back(std::make_pair(line, time));
+    }
+    img.scan_direction = r.get_string();
+    img.avg_line_rate  = r.get_double();
+    r.get_vec(img.image_size, 2);
+
+    box = vw::BBox3();
+    if (r.get_uint64() != 0) {
+      vw::Vector3 min_pt, max_pt;
+      r.get_vec(min_pt, 3);
+      r.get_vec(max_pt, 3);
+      box = vw::BBox3(min_pt, max_pt);
+    }
+  }
+
+} // end anonymous namespace
+
+std::string asp::dg_cache_file(std::string const& filename) {
+  return filename + ".cache";
+}
+
+void asp::read_dg_camera_xml(std::string const& filename,
+                             GeometricXML& geo, AttitudeXML& att,
+                             EphemerisXML& eph, ImageXML& img,
+                             vw::BBox3 & lon_lat_height_box) {
+
+  std::string cache_file = dg_cache_file(filename);
+  std::uint64_t hash = 0;
+  bool has_hash = asp::hash_file(filename, hash);
+  std::ostringstream key;
+  key << DG_CACHE_MAGIC << " " << hash << "\n";
+
+  // Use the cache if it was made from the same contents of the XML file
+  if (has_hash && fs::exists(cache_file)) {
+    std::ifstream ifs(cache_file.c_str(), std::ios::binary);
+    std::string buf((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    if (buf.compare(0, key.str().size(), key.str()) == 0) {
+      try {
+        DgCacheReader r(buf, key.str().size());
+        read_dg_cache(r, geo, att, eph, img, lon_lat_height_box);
+        return;
+      } catch (...) {
+        vw_out(vw::WarningMessage) << "Ignoring invalid camera cache: " << cache_file << ".\n";
+      }
+    }
+  }
+
+  RPCXML rpc;
+  read_xml(filename, geo, att, eph, img, rpc);
+  lon_lat_height_box = rpc.get_lon_lat_height_box();
+  if (!has_hash)
+    return;
+
+  // Save the cache under another name first, so that another process
+  // reading it never sees it partially written. It is fine if this
+  // fails, such as if the directory is not writable.
+  DgCacheWriter w;
+  w.add(key.str().data(), key.str().size());
+  write_dg_cache(w, geo, att, eph, img, lon_lat_height_box);
+  std::ostringstream tmp;
+  tmp << cache_file << ".tmp" << getpid();
+  try {
+    {
+      std::ofstream ofs(tmp.str().c_str(), std::ios::binary);
+      if (!ofs)
+        return;
+      ofs.write(w.buf().data(), w.buf().size());
+      if (!ofs)
+        vw_throw(IOErr() << "Failed to write: " << tmp.str() << "\n");
+    }
+    fs::rename(tmp.str(), cache_file);
+  } catch (...) {
+    boost::system::error_code ec;
+    fs::remove(tmp.str(), ec);
+  }
+}
+
 vw::Vector2i asp::xml_image_size(std::string const& filename){
   GeometricXML geo;
   AttitudeXML att;
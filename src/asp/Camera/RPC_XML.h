@@ -174,6 +174,21 @@ namespace asp {
                  RPCXML      & rpc );
   vw::Vector2i xml_image_size( std::string const& filename );
 
+  /// The binary cache of the camera data of a Digital Globe XML file
+  std::string dg_cache_file(std::string const& filename);
+
+  /// Read from a Digital Globe XML file what its linescan camera model
+  /// needs, as read_xml() does, other than the covariances and the RPC
+  /// model. That is read from the cache file next to it if that was
+  /// made from a file with the same contents. Else the XML is parsed and
+  /// the cache is saved, if possible. Loading a camera from the cache
+  /// is just copying the arrays, which matters for long strips loaded
+  /// by many tools and processes.
+  void read_dg_camera_xml(std::string const& filename,
+                          GeometricXML& geo, AttitudeXML& att,
+                          EphemerisXML& eph, ImageXML& img,
+                          vw::BBox3 & lon_lat_height_box);
+
 
   /// Function to extract the four corners from the first band
   ///  of a Worldview XML file.
@@ -152,9 +152,7 @@ void SpotXML::parse_xml(xercesc::DOMElement* node) {
   boost::posix_time::ptime earliest_time = boost::posix_time::time_from_string("2016-05-04 00:00:00.00");
   std::list<std::pair<std::string, vw::Vector3> >::const_iterator iter;
   for (iter=position_logs.begin(); iter!=position_logs.end(); ++iter) {
-    std::string s = iter->first;
-    boost::replace_all(s, "T", " ");
-    boost::posix_time::ptime this_time = boost::posix_time::time_from_string(s);
+    boost::posix_time::ptime this_time = asp::parse_time(iter->first);
     if (this_time < earliest_time){
       earliest_time = this_time;
       //std::cout << "Using reference time " << iter->first << std::endl;
@@ -180,33 +178,23 @@ void SpotXML::read_look_angles(xercesc::DOMElement* look_angles_node) {
     = get_node<DOMElement>(look_angle_node, "Look_Angles_List");
 
   // Pick out the "Angles" nodes
-  DOMNodeList* children = look_angle_list_node->getChildNodes();
-
+  // - Walk the siblings, as DOMNodeList::item() walks the list from
+  //   its start on each call, which is slow for this long list.
   size_t index = 0;
-  const XMLSize_t num_children = children->getLength();
-  for ( XMLSize_t i = 0; i < num_children; ++i ) {
-    // Check child node type
-    DOMNode* curr_node = children->item(i);
-    if ( curr_node->getNodeType() != DOMNode::ELEMENT_NODE )
-      continue;
-
-    // Check the node name
-    DOMElement* curr_element = dynamic_cast<DOMElement*>( curr_node );
+  for (DOMElement* curr_element = look_angle_list_node->getFirstElementChild();
+       curr_element != NULL; curr_element = curr_element->getNextElementSibling()) {
 
     if (index >= num_cols)
       vw_throw(ArgumentErr() << "More look angles than rows in SPOT XML file!\n");
 
     // Look through the three nodes and assign each of them
     // - In this function we do this a little more by hand to try and speed things up
-    DOMNodeList* sub_children = curr_element->getChildNodes();
-    for ( XMLSize_t j = 0; j < sub_children->getLength(); ++j ) {
+    for (DOMElement* child_element = curr_element->getFirstElementChild();
+         child_element != NULL; child_element = child_element->getNextElementSibling()) {
 
-      DOMNode* child_node = sub_children->item(j);
-      if ( child_node->getNodeType() != DOMNode::ELEMENT_NODE )
-        continue;
-      DOMElement* child_element = dynamic_cast<DOMElement*>( child_node );
-      std::string tag2( XMLString::transcode(child_element->getTagName()) );
-      std::string text( XMLString::transcode(child_element->getTextContent()) );
+      std::string tag2, text;
+      cast_xmlch(child_element->getTagName(),     tag2);
+      cast_xmlch(child_element->getTextContent(), text);
 
       if (tag2 == "DETECTOR_ID")
         look_angles[index].first = atoi(text.c_str());
@@ -232,16 +220,12 @@ void SpotXML::read_ephemeris(xercesc::DOMElement* ephemeris_node) {
   xercesc::DOMElement* points_node = get_node<DOMElement>(ephemeris_node, "Points");
 
   // Pick out the "Point" nodes
-  DOMNodeList* children = points_node->getChildNodes();
-  for ( XMLSize_t i = 0; i < children->getLength(); ++i ) {
-    // Check child node type
-    DOMNode* curr_node = children->item(i);
-    if ( curr_node->getNodeType() != DOMNode::ELEMENT_NODE )
-      continue;
+  for (DOMElement* curr_element = points_node->getFirstElementChild();
+       curr_element != NULL; curr_element = curr_element->getNextElementSibling()) {
 
     // Check the node name
-    DOMElement* curr_element = dynamic_cast<DOMElement*>( curr_node );
-    std::string tag( XMLString::transcode(curr_element->getTagName()) );
+    std::string tag;
+    cast_xmlch(curr_element->getTagName(), tag);
     if (tag.find("Point") == std::string::npos)
       continue;
 
@@ -278,16 +262,12 @@ void SpotXML::read_attitude(xercesc::DOMElement* corrected_attitudes_node) {
     = get_node<DOMElement>(corrected_attitudes_node, "Corrected_Attitude");
 
   // Pick out the "Angles" nodes
-  DOMNodeList* children = corrected_attitude_node->getChildNodes();
-  for ( XMLSize_t i = 0; i < children->getLength(); ++i ) {
-    // Check child node type
-    DOMNode* curr_node = children->item(i);
-    if ( curr_node->getNodeType() != DOMNode::ELEMENT_NODE )
-      continue;
+  for (DOMElement* curr_element = corrected_attitude_node->getFirstElementChild();
+       curr_element != NULL; curr_element = curr_element->getNextElementSibling()) {
 
     // Check the node time
-    DOMElement* curr_element = dynamic_cast<DOMElement*>( curr_node );
-    std::string tag( XMLString::transcode(curr_element->getTagName()) );
+    std::string tag;
+    cast_xmlch(curr_element->getTagName(), tag);
     if (tag.find("Angles") == std::string::npos)
       continue;
   
@@ -354,10 +334,7 @@ void SpotXML::read_line_times(xercesc::DOMElement* sensor_config_node) {
 // Input strings look like this: 2008-03-04T12:31:03.081912
 double SpotXML::convert_time(std::string const& s) const {
   try{
-    // Replace the T with a space so the default Boost function can parse the time.
-    std::string s2 = s;
-    boost::replace_all(s2, "T", " ");
-    boost::posix_time::ptime time = boost::posix_time::time_from_string(s2);
+    boost::posix_time::ptime time = asp::parse_time(s);
     return this->m_time_ref_functor(time);
   }catch(...){
     vw::vw_throw(vw::ArgumentErr() << "Failed to parse time from string: " << s << "\n");
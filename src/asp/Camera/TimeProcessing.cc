@@ -17,6 +17,13 @@
 
 #include <asp/Camera/TimeProcessing.h>
 
+#include <vw/Core/Exception.h>
+
+#include <boost/algorithm/string.hpp>
+
+#include <algorithm>
+#include <cstdint>
+
 namespace asp {
 
 // Boost does not like a time string such as "2017-12-07 15:36:40.90795Z"
@@ -84,8 +91,71 @@ std::string fix_millisecond(std::string const& in_str) {
   return out_str;
 }
 
+// Read num_digits digits at the given position, and move past them
+bool read_digits(std::string const& s, size_t & pos, int num_digits, int & val) {
+  val = 0;
+  for (int it = 0; it < num_digits; it++, pos++) {
+    if (pos >= s.size() || s[pos] < '0' || s[pos] > '9')
+      return false;
+    val = 10 * val + (s[pos] - '0');
+  }
+  return true;
+}
+
+// Parse a time such as 2022-04-13T22:46:31.4540000Z without building
+// new strings. The fraction of a second is truncated to microseconds,
+// as by fix_millisecond(). Return false if the time is not in this form.
+bool parse_iso_time(std::string const& s, boost::posix_time::ptime & time) {
+
+  int year = 0, month = 0, day = 0, hour = 0, minute = 0, second = 0;
+  size_t pos = 0;
+  if (!read_digits(s, pos, 4, year)   || pos >= s.size() || s[pos++] != '-' ||
+      !read_digits(s, pos, 2, month)  || pos >= s.size() || s[pos++] != '-' ||
+      !read_digits(s, pos, 2, day)    || pos >= s.size() ||
+      (s[pos] != 'T' && s[pos] != ' ') ||
+      !read_digits(s, ++pos, 2, hour) || pos >= s.size() || s[pos++] != ':' ||
+      !read_digits(s, pos, 2, minute) || pos >= s.size() || s[pos++] != ':' ||
+      !read_digits(s, pos, 2, second))
+    return false;
+
+  std::int64_t micro = 0;
+  int num_digits = 0;
+  if (pos < s.size() && s[pos] == '.') {
+    pos++;
+    for (; pos < s.size() && s[pos] >= '0' && s[pos] <= '9'; pos++) {
+      if (num_digits < 6) {
+        micro = 10 * micro + (s[pos] - '0');
+        num_digits++;
+      }
+    }
+  }
+  for (; num_digits < 6; num_digits++)
+    micro *= 10;
+
+  if (pos < s.size() && s[pos] == 'Z')
+    pos++;
+  if (pos != s.size())
+    return false;
+
+  try {
+    time = boost::posix_time::ptime(boost::gregorian::date(year, month, day),
+                                    boost::posix_time::hours(hour) +
+                                    boost::posix_time::minutes(minute) +
+                                    boost::posix_time::seconds(second) +
+                                    boost::posix_time::microseconds(micro));
+  } catch (...) {
+    return false; // such as an invalid date
+  }
+  return true;
+}
+
 boost::posix_time::ptime parse_time(std::string const& s) {
 
+  // This is called for each tabulated sample, so go the fast way if possible
+  boost::posix_time::ptime fast_time;
+  if (parse_iso_time(s, fast_time))
+    return fast_time;
+
   // Replace the T with a space so the default Boost function can
   // parse the time.
   std::string s2 = s;
@@ -99,5 +169,54 @@ boost::posix_time::ptime parse_time(std::string const& s) {
   
   return time;
 }
-  
+
+TimeIndex::TimeIndex(std::vector<double> const& times): m_times(times) {
+  for (size_t it = 1; it < m_times.size(); it++) {
+    if (m_times[it] < m_times[it - 1])
+      vw::vw_throw(vw::ArgumentErr() << "TimeIndex: The times must be sorted.\n");
+  }
+}
+
+size_t TimeIndex::find(double t) const {
+
+  size_t n = m_times.size();
+  if (n < 2)
+    vw::vw_throw(vw::ArgumentErr() << "TimeIndex: Need at least two times.\n");
+  if (t < m_times[0])
+    return 0;
+  if (t >= m_times[n - 1])
+    return n - 2;
+
+  // Keep m_times[lo] <= t < m_times[hi]. Alternate guessing the position
+  // as if the times in the range were uniform with halving the range, so
+  // that uneven times do not make this slow.
+  size_t lo = 0, hi = n - 1;
+  bool guess = true;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (guess) {
+      double frac = (t - m_times[lo]) / (m_times[hi] - m_times[lo]);
+      mid = lo + size_t(frac * (hi - lo));
+      mid = std::max(lo + 1, std::min(mid, hi - 1));
+      // With uniform times the guess is just before t, so check the next one
+      if (m_times[mid] <= t && t < m_times[mid + 1])
+        return mid;
+    }
+    if (m_times[mid] <= t)
+      lo = mid;
+    else
+      hi = mid;
+    guess = !guess;
+  }
+
+  return lo;
+}
+
+size_t TimeIndex::find(double t, double & frac) const {
+  size_t i = find(t);
+  double span = m_times[i + 1] - m_times[i];
+  frac = (span > 0) ? (t - m_times[i]) / span : 0.0;
+  return i;
+}
+
 } // end namespace asp
@@ -15,8 +15,12 @@
 //  limitations under the License.
 // __END_LICENSE__
 
+#ifndef __ASP_CAMERA_TIME_PROCESSING_H__
+#define __ASP_CAMERA_TIME_PROCESSING_H__
+
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <string>
+#include <vector>
 
 namespace asp {
 
@@ -40,5 +44,37 @@ namespace asp {
   // Fix that. PeruSat has this problem.
   std::string fix_millisecond(std::string const& in_str);
 
+  // Parse a time such as 2022-04-13T22:46:31.4540000Z. Times in this
+  // form are read directly, and others are passed to Boost.
   boost::posix_time::ptime parse_time(std::string const& s);  
+
+  /// Sorted times, such as of tabulated positions or orientations, in
+  /// contiguous storage, for finding the interval a time is in. The
+  /// search starts where the time would be if the samples were uniform,
+  /// so for nearly uniform samples a lookup costs O(1), and never more
+  /// than O(log n).
+  class TimeIndex {
+  public:
+    TimeIndex() {}
+    /// The times must not decrease
+    explicit TimeIndex(std::vector<double> const& times);
+
+    size_t size() const { return m_times.size(); }
+    double operator[](size_t i) const { return m_times[i]; }
+
+    /// The index i such that times[i] <= t < times[i+1], with times
+    /// before the first or after the last using the nearest interval.
+    /// Needs at least two times.
+    size_t find(double t) const;
+
+    /// As above, also finding how far t is from times[i] to times[i+1],
+    /// as a fraction, for interpolation. It is outside [0, 1] for times
+    /// out of range.
+    size_t find(double t, double & frac) const;
+
+  private:
+    std::vector<double> m_times;
+  };
 }
+
+#endif // __ASP_CAMERA_TIME_PROCESSING_H__
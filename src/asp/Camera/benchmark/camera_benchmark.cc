@@ -0,0 +1,268 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file camera_benchmark.cc
+///
+/// Time point_to_pixel(), pixel_to_vector(), and camera_center() of the
+/// camera models, to catch performance regressions. With no arguments,
+/// the sample cameras next to the unit tests are used. Other cameras can
+/// be given as pairs of a type (rpc, dg, spot, aster, pleiades, perusat,
+/// csm, pinhole) and a camera file.
+///
+/// For each camera, ground points are made by intersecting with the
+/// WGS84 ellipsoid the rays through a grid of pixels. Reported are the
+/// calls per second of each function, the cost of point_to_pixel() in
+/// units of pixel_to_vector() calls, which is about the number of
+/// function evaluations of its solver, and the pixel error when going
+/// from a pixel to the ground and back.
+
+#include <asp/Sessions/CameraModelLoader.h>
+#include <asp/Camera/RPCModel.h>
+#include <asp/Camera/CsmModel.h>
+#include <vw/Camera/LinescanModel.h>
+#include <vw/Camera/PinholeModel.h>
+#include <vw/Cartography/Datum.h>
+#include <vw/Core/Exception.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifndef TEST_SRCDIR
+#define TEST_SRCDIR "."
+#endif
+
+using namespace vw;
+typedef boost::shared_ptr<vw::camera::CameraModel> CameraModelPtr;
+
+namespace {
+
+  // Intersect a ray with the WGS84 ellipsoid. Return false if it misses.
+  bool ellipsoid_intersection(Vector3 const& ctr, Vector3 const& dir, Vector3 & xyz) {
+    vw::cartography::Datum datum("WGS84");
+    double a = datum.semi_major_axis(), b = datum.semi_minor_axis();
+    Vector3 c(ctr[0] / a, ctr[1] / a, ctr[2] / b), d(dir[0] / a, dir[1] / a, dir[2] / b);
+    double A = dot_prod(d, d), B = 2.0 * dot_prod(c, d), C = dot_prod(c, c) - 1.0;
+    double disc = B * B - 4.0 * A * C;
+    if (disc < 0 || A == 0)
+      return false;
+    double t = (-B - std::sqrt(disc)) / (2.0 * A); // the nearer intersection
+    if (t < 0)
+      return false;
+    xyz = ctr + t * dir;
+    return true;
+  }
+
+  // A pinhole camera 500 km above the equator, looking down
+  CameraModelPtr synthetic_pinhole(Vector2 & image_size) {
+    vw::cartography::Datum datum("WGS84");
+    Vector3 ctr(datum.semi_major_axis() + 500000.0, 0, 0);
+    // Camera x goes to world y, y to -z, and z, the view direction, to -x
+    Matrix3x3 rotation(0, 0, -1,
+                       1, 0,  0,
+                       0, -1, 0);
+    image_size = Vector2(1000, 1000);
+    return CameraModelPtr(new vw::camera::PinholeModel(ctr, rotation, 10000, 10000,
+                                                       500, 500));
+  }
+
+  // Find the box of pixels to sample. Return false if not known.
+  bool find_image_size(std::string const& type, std::string const& file,
+                       CameraModelPtr cam, asp::CameraModelLoader const& loader,
+                       Vector2 & image_size) {
+    vw::camera::LinescanModel * ls = dynamic_cast<vw::camera::LinescanModel*>(cam.get());
+    if (ls != NULL) {
+      image_size = ls->get_image_size();
+      return true;
+    }
+    asp::CsmModel * csm = dynamic_cast<asp::CsmModel*>(cam.get());
+    if (csm != NULL) {
+      image_size = csm->get_image_size();
+      return true;
+    }
+    // ASTER files also have an RPC model, which gives the image extent
+    CameraModelPtr rpc_cam = cam;
+    if (type == "aster")
+      rpc_cam = loader.load_rpc_camera_model(file);
+    asp::RPCModel * rpc = dynamic_cast<asp::RPCModel*>(rpc_cam.get());
+    if (rpc != NULL) {
+      image_size = rpc->xy_offset() + rpc->xy_scale();
+      return true;
+    }
+    vw::camera::PinholeModel * pin = dynamic_cast<vw::camera::PinholeModel*>(cam.get());
+    if (pin != NULL) {
+      image_size = 2.0 * elem_quot(pin->point_offset(), Vector2(pin->pixel_pitch(),
+                                                                pin->pixel_pitch()));
+      return true;
+    }
+    return false;
+  }
+
+  CameraModelPtr load_camera(std::string const& type, std::string const& file,
+                             asp::CameraModelLoader const& loader) {
+    if (type == "rpc")      return loader.load_rpc_camera_model(file);
+    if (type == "dg")       return loader.load_dg_camera_model(file);
+    if (type == "spot")     return loader.load_spot5_camera_model(file);
+    if (type == "aster")    return loader.load_ASTER_camera_model(file);
+    if (type == "pleiades") return loader.load_pleiades_camera_model(file);
+    if (type == "perusat")  return loader.load_perusat_camera_model(file);
+    if (type == "csm")      return loader.load_csm_camera_model(file);
+    if (type == "pinhole")  return loader.load_pinhole_camera_model(file);
+    vw_throw(ArgumentErr() << "Unknown camera type: " << type << ".\n");
+    return CameraModelPtr();
+  }
+
+  // Call the function repeatedly on all inputs for at least the given
+  // time, and return the calls per second.
+  template <class FuncT>
+  double calls_per_second(FuncT const& func, size_t num_inputs, double min_seconds) {
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    double elapsed = 0.0;
+    size_t num_calls = 0;
+    do {
+      for (size_t i = 0; i < num_inputs; i++)
+        func(i);
+      num_calls += num_inputs;
+      elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < min_seconds);
+    return num_calls / elapsed;
+  }
+
+  void benchmark_camera(std::string const& name, CameraModelPtr cam,
+                        Vector2 const& image_size, double min_seconds) {
+
+    // Pixels on a grid inside the image, and ground points seen at them
+    const int num = 10;
+    std::vector<Vector2> pixels;
+    std::vector<Vector3> points;
+    for (int r = 0; r < num; r++) {
+      for (int c = 0; c < num; c++) {
+        Vector2 pix((c + 0.5) * image_size[0] / num, (r + 0.5) * image_size[1] / num);
+        Vector3 xyz;
+        try {
+          if (!ellipsoid_intersection(cam->camera_center(pix), cam->pixel_to_vector(pix), xyz))
+            continue;
+        } catch (...) {
+          continue;
+        }
+        pixels.push_back(pix);
+        points.push_back(xyz);
+      }
+    }
+    if (points.empty()) {
+      std::cout << std::setw(10) << name << "  no pixels see the ground\n";
+      return;
+    }
+
+    // The accuracy of the round trip
+    double max_err = 0.0, mean_err = 0.0;
+    int num_failed = 0;
+    for (size_t i = 0; i < points.size(); i++) {
+      try {
+        double err = norm_2(cam->point_to_pixel(points[i]) - pixels[i]);
+        max_err = std::max(max_err, err);
+        mean_err += err;
+      } catch (...) {
+        num_failed++;
+      }
+    }
+    if (num_failed < int(points.size()))
+      mean_err /= (points.size() - num_failed);
+
+    // Failures are ignored when timing, they were counted above
+    double p2p = calls_per_second([&](size_t i) {
+        try { cam->point_to_pixel(points[i]); } catch (...) {}
+      }, points.size(), min_seconds);
+    double p2v = calls_per_second([&](size_t i) {
+        try { cam->pixel_to_vector(pixels[i]); } catch (...) {}
+      }, pixels.size(), min_seconds);
+    double ctr = calls_per_second([&](size_t i) {
+        try { cam->camera_center(pixels[i]); } catch (...) {}
+      }, pixels.size(), min_seconds);
+
+    std::cout << std::setw(10) << name
+              << std::scientific << std::setprecision(3)
+              << std::setw(12) << p2p << std::setw(12) << p2v << std::setw(12) << ctr
+              << std::fixed << std::setprecision(1) << std::setw(10) << p2v / p2p
+              << std::scientific << std::setprecision(2)
+              << std::setw(11) << mean_err << std::setw(11) << max_err
+              << std::setw(8) << num_failed << "\n";
+  }
+
+} // end anonymous namespace
+
+int main(int argc, char *argv[]) {
+
+  double min_seconds = 1.0;
+  std::vector<std::string> types, files;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--seconds" && i + 1 < argc) {
+      min_seconds = atof(argv[++i]);
+    } else if (arg == "-h" || arg == "--help" || i + 1 >= argc) {
+      std::cout << "Usage: " << argv[0] << " [--seconds <min time per function>] "
+                << "[<type> <camera file>] ...\n"
+                << "Types: rpc, dg, spot, aster, pleiades, perusat, csm, pinhole.\n"
+                << "With no cameras, the samples in " << TEST_SRCDIR << " are used.\n";
+      return (arg == "-h" || arg == "--help") ? 0 : 1;
+    } else {
+      types.push_back(arg);
+      files.push_back(argv[++i]);
+    }
+  }
+
+  bool use_samples = types.empty();
+  if (use_samples) {
+    std::string dir = TEST_SRCDIR;
+    types.push_back("rpc");  files.push_back(dir + "/dg_example1.xml");
+    types.push_back("dg");   files.push_back(dir + "/dg_example1.xml");
+    types.push_back("spot"); files.push_back(dir + "/spot_example1.xml");
+  }
+
+  std::cout << std::setw(10) << "camera" << std::setw(12) << "p2p/s" << std::setw(12) << "p2v/s"
+            << std::setw(12) << "center/s" << std::setw(10) << "p2v/p2p"
+            << std::setw(11) << "mean err" << std::setw(11) << "max err"
+            << std::setw(8) << "failed" << "\n";
+
+  asp::CameraModelLoader loader; // also sets up the XML reader
+  int status = 0;
+  for (size_t i = 0; i < types.size(); i++) {
+    try {
+      CameraModelPtr cam = load_camera(types[i], files[i], loader);
+      Vector2 image_size;
+      if (!find_image_size(types[i], files[i], cam, loader, image_size))
+        vw_throw(ArgumentErr() << "Cannot find the image size of: " << files[i] << ".\n");
+      benchmark_camera(types[i], cam, image_size, min_seconds);
+    } catch (std::exception const& e) {
+      std::cout << std::setw(10) << types[i] << "  failed: " << e.what() << "\n";
+      status = 1;
+    }
+  }
+
+  if (use_samples) {
+    Vector2 image_size;
+    CameraModelPtr cam = synthetic_pinhole(image_size);
+    benchmark_camera("pinhole", cam, image_size, min_seconds);
+  }
+
+  return status;
+}
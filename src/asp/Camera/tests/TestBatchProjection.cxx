@@ -0,0 +1,68 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Camera/BatchProjection.h>
+#include <vw/Camera/PinholeModel.h>
+
+using namespace vw;
+
+TEST(BatchProjection, RayLattice) {
+
+  // A camera looking down, with a focal length of 1000 pixels, and the
+  // optical center in the box, so all its pixels see about the same angle
+  Vector3 ctr(1.0, 2.0, 100.0);
+  Matrix3x3 rot(1, 0, 0, 0, -1, 0, 0, 0, -1);
+  camera::PinholeModel cam(ctr, rot, 1000.0, 1000.0, 100.0, 80.0);
+
+  asp::RayLattice lattice;
+  lattice.build(&cam, BBox2(3.5, 7.2, 200.0, 150.0), 16);
+  EXPECT_FALSE(lattice.empty());
+
+  // The interpolated rays are a small fraction of a pixel from the exact ones
+  double pixel_angle = 1.0 / 1000.0;
+  for (double y = 7.2; y < 157.2; y += 9.7) {
+    for (double x = 3.5; x < 203.5; x += 13.1) {
+      Vector2 pix(x, y);
+      Vector3 c, v;
+      ASSERT_TRUE(lattice.ray(pix, c, v)) << pix;
+      EXPECT_NEAR(0.0, norm_2(c - ctr), 1e-10);
+      EXPECT_LT(norm_2(v - cam.pixel_to_vector(pix)), 0.02 * pixel_angle) << pix;
+      EXPECT_NEAR(pixel_angle, lattice.pixel_angle(pix), 0.1 * pixel_angle);
+    }
+  }
+
+  // Far outside the box there are no nodes
+  Vector3 c, v;
+  EXPECT_FALSE(lattice.ray(Vector2(-50.0, 10.0), c, v));
+  EXPECT_FALSE(lattice.ray(Vector2(10.0, 500.0), c, v));
+
+  // The batch rays agree with the camera
+  std::vector<Vector2> pixels;
+  pixels.push_back(Vector2(10.0, 20.0));
+  pixels.push_back(Vector2(11.0, 20.0));
+  std::vector<Vector3> centers, vectors;
+  std::vector<unsigned char> valid;
+  asp::pixels_to_rays(&cam, pixels, centers, vectors, valid);
+  ASSERT_EQ(2u, valid.size());
+  for (size_t i = 0; i < pixels.size(); i++) {
+    EXPECT_TRUE(valid[i]);
+    EXPECT_NEAR(0.0, norm_2(centers[i] - ctr), 1e-10);
+    EXPECT_NEAR(0.0, norm_2(vectors[i] - cam.pixel_to_vector(pixels[i])), 1e-12);
+  }
+}
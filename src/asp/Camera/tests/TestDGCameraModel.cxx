@@ -21,6 +21,7 @@
 #include <asp/Camera/XMLBase.h>
 #include <asp/Camera/RPCModel.h>
 #include <boost/scoped_ptr.hpp>
+#include <boost/filesystem.hpp>
 #include <test/Helpers.h>
 
 #include <vw/Stereo/StereoModel.h>
@@ -107,6 +108,46 @@ TEST(StereoSessionDG, XMLReading) {
   XMLPlatformUtils::Terminate();
 }
 
+TEST(StereoSessionDG, XMLCache) {
+  XMLPlatformUtils::Initialize();
+
+  std::string xml = "dg_example1.xml";
+  std::string cache = dg_cache_file(xml);
+  boost::filesystem::remove(cache);
+
+  // The first read parses the XML and saves the cache, the second reads the cache
+  GeometricXML geo1, geo2;
+  AttitudeXML  att1, att2;
+  EphemerisXML eph1, eph2;
+  ImageXML     img1, img2;
+  vw::BBox3    box1, box2;
+  read_dg_camera_xml(xml, geo1, att1, eph1, img1, box1);
+  EXPECT_TRUE(boost::filesystem::exists(cache));
+  read_dg_camera_xml(xml, geo2, att2, eph2, img2, box2);
+
+  EXPECT_EQ(geo1.principal_distance, geo2.principal_distance);
+  EXPECT_EQ(geo1.detector_origin, geo2.detector_origin);
+  EXPECT_EQ(geo1.camera_attitude.w(), geo2.camera_attitude.w());
+  EXPECT_EQ(att1.start_time, att2.start_time);
+  ASSERT_EQ(att1.quat_vec.size(), att2.quat_vec.size());
+  for (size_t i = 0; i < att1.quat_vec.size(); i++)
+    EXPECT_EQ(att1.quat_vec[i].x(), att2.quat_vec[i].x());
+  ASSERT_EQ(eph1.position_vec.size(), eph2.position_vec.size());
+  for (size_t i = 0; i < eph1.position_vec.size(); i++) {
+    EXPECT_EQ(eph1.position_vec[i], eph2.position_vec[i]);
+    EXPECT_EQ(eph1.velocity_vec[i], eph2.velocity_vec[i]);
+  }
+  ASSERT_EQ(img1.tlc_vec.size(), img2.tlc_vec.size());
+  EXPECT_EQ(img1.tlc_vec[1].second, img2.tlc_vec[1].second);
+  EXPECT_EQ(img1.image_size, img2.image_size);
+  EXPECT_EQ(img1.scan_direction, img2.scan_direction);
+  EXPECT_EQ(box1.min(), box2.min());
+  EXPECT_EQ(box1.max(), box2.max());
+
+  boost::filesystem::remove(cache);
+  XMLPlatformUtils::Terminate();
+}
+
 TEST(DGCameraModel, CreateCamera) {
 
   xercesc::XMLPlatformUtils::Initialize();
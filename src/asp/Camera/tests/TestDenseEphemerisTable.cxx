@@ -0,0 +1,61 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Camera/DenseEphemerisTable.h>
+
+using namespace vw;
+
+namespace {
+  // A satellite on a circular orbit, slowly rotating about its along-track axis
+  struct OrbitPosition {
+    Vector3 operator()(double t) const {
+      double R = 7.0e+6, w = 1.1e-3;
+      return Vector3(R * cos(w * t), R * sin(w * t), 1000.0 * t);
+    }
+  };
+  struct OrbitPose {
+    Quat operator()(double t) const {
+      double a = 0.5 * 0.01 * t;
+      return Quat(cos(a), sin(a), 0, 0);
+    }
+  };
+}
+
+TEST(DenseEphemerisTable, Lookup) {
+  asp::DenseEphemerisTable table;
+  EXPECT_TRUE(table.empty());
+  EXPECT_FALSE(table.contains(0.0));
+
+  table.build(OrbitPosition(), OrbitPose(), 0.0, 10.0, 1001);
+  EXPECT_FALSE(table.empty());
+  EXPECT_TRUE(table.contains(5.0));
+  EXPECT_FALSE(table.contains(-1.0));
+  EXPECT_FALSE(table.contains(10.0));
+
+  double t = 3.14159;
+  EXPECT_VECTOR_NEAR(OrbitPosition()(t), table.position(t), 1e-4);
+  Quat q1 = OrbitPose()(t), q2 = table.pose(t);
+  EXPECT_NEAR(q1.w(), q2.w(), 1e-9);
+  EXPECT_NEAR(q1.x(), q2.x(), 1e-9);
+
+  double pos_err = 0, angle_err = 0;
+  table.max_errors(OrbitPosition(), OrbitPose(), pos_err, angle_err);
+  EXPECT_LT(pos_err, 1e-4);
+  EXPECT_LT(angle_err, 1e-9);
+}
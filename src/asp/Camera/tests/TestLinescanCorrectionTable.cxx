@@ -0,0 +1,62 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+#include <asp/Camera/LinescanCorrectionTable.h>
+
+using namespace vw;
+
+namespace {
+  // A camera with a slowly rotating pose, whose corrections are a small
+  // offset varying smoothly with the line and column.
+  struct LocalRay {
+    Vector3 operator()(Vector2 const& pix) const {
+      return normalize(Vector3(1e-4 * (pix[0] - 500.0), 0.0, 1.0));
+    }
+  };
+  struct RayPose {
+    Quat operator()(Vector2 const& pix) const {
+      double a = 0.5 * 1e-5 * pix[1];
+      return Quat(cos(a), sin(a), 0, 0);
+    }
+  };
+  struct CorrectedRay {
+    Vector3 operator()(Vector2 const& pix) const {
+      Vector3 delta(2e-5 * sin(1e-3 * pix[1]), 1e-5 + 1e-9 * pix[0], 0.0);
+      return RayPose()(pix).rotate(normalize(LocalRay()(pix) + delta));
+    }
+  };
+}
+
+TEST(LinescanCorrectionTable, Lookup) {
+  asp::LinescanCorrectionTable table;
+  EXPECT_TRUE(table.empty());
+  EXPECT_FALSE(table.contains(Vector2(0, 0)));
+
+  table.build(CorrectedRay(), LocalRay(), RayPose(), 0.0, 2000.0, 16.0, 1000.0, 9);
+  EXPECT_FALSE(table.empty());
+  EXPECT_TRUE(table.contains(Vector2(500.0, 1000.0)));
+  EXPECT_FALSE(table.contains(Vector2(500.0, 2001.0)));
+  EXPECT_FALSE(table.contains(Vector2(-1.0, 1000.0)));
+
+  // At a node the table is exact
+  Vector2 pix(125.0, 16.0);
+  Vector3 ray = normalize(RayPose()(pix).rotate(LocalRay()(pix) + table.correction(pix)));
+  EXPECT_VECTOR_NEAR(CorrectedRay()(pix), ray, 1e-14);
+
+  EXPECT_LT(table.max_error(CorrectedRay(), LocalRay(), RayPose()), 1e-10);
+}
@@ -0,0 +1,61 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Camera/LinescanProjection.h>
+
+#include <thread>
+
+using namespace asp;
+
+namespace {
+  // A smooth, monotonic function with a zero at line 1234.5
+  struct LineOffset {
+    double operator()(double line) const {
+      return 0.01 * (line - 1234.5) + 1e-7 * (line - 1234.5) * (line - 1234.5);
+    }
+  };
+}
+
+TEST(LinescanProjection, SecantLineSolve) {
+  double line = -1;
+  EXPECT_TRUE(secant_line_solve(LineOffset(), 0.0, line));
+  EXPECT_NEAR(1234.5, line, 1e-8);
+
+  EXPECT_TRUE(secant_line_solve(LineOffset(), 1230.0, line));
+  EXPECT_NEAR(1234.5, line, 1e-8);
+}
+
+TEST(LinescanProjection, Context) {
+  int camera1 = 0, camera2 = 0;
+  EXPECT_EQ(-1.0, LinescanProjectionContext::last_line(&camera1));
+
+  LinescanProjectionContext::set_last_line(&camera1, 10.0);
+  LinescanProjectionContext::set_last_line(&camera2, 20.0);
+  EXPECT_EQ(10.0, LinescanProjectionContext::last_line(&camera1));
+  EXPECT_EQ(20.0, LinescanProjectionContext::last_line(&camera2));
+
+  // Each thread has its own lines
+  double other_line = 0.0;
+  std::thread t([&]() { other_line = LinescanProjectionContext::last_line(&camera1); });
+  t.join();
+  EXPECT_EQ(-1.0, other_line);
+
+  LinescanProjectionContext::clear(&camera1);
+  EXPECT_EQ(-1.0, LinescanProjectionContext::last_line(&camera1));
+}
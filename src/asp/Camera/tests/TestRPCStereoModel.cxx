@@ -28,7 +28,10 @@
 #include <asp/Camera/RPC_XML.h>
 #include <asp/Camera/LinescanDGModel.h>
 #include <asp/Camera/RPCModel.h>
+#include <asp/Camera/RPCModelGen.h>
 #include <asp/Camera/RPCStereoModel.h>
+#include <asp/Camera/BatchProjection.h>
+#include <asp/Camera/ApproxCameraModel.h>
 #include <asp/Core/StereoSettings.h>
 #include <xercesc/util/PlatformUtils.hpp>
 
@@ -132,6 +135,152 @@ TEST(RPCXML, ReadRPC) {
   xercesc::XMLPlatformUtils::Terminate();
 }
 
+TEST(RPCModel, FusedJacobian) {
+  xercesc::XMLPlatformUtils::Initialize();
+
+  RPCXML xml;
+  xml.read_from_file( "dg_example1.xml" );
+  RPCModel const& rpc = *xml.rpc_ptr();
+
+  Vector3 llh = rpc.lonlatheight_offset() + Vector3(0.02, -0.03, 50.0);
+  Vector2 pix;
+  Matrix<double, 2, 3> J;
+  rpc.geodetic_to_pixel_and_Jacobian(llh, pix, J);
+
+  EXPECT_VECTOR_NEAR(rpc.geodetic_to_pixel(llh), pix, 1e-8);
+  Matrix<double, 2, 3> N = rpc.geodetic_to_pixel_numerical_Jacobian(llh, 1e-7);
+  for (int r = 0; r < 2; r++) {
+    for (int c = 0; c < 3; c++)
+      EXPECT_NEAR(N(r, c), J(r, c), 1e-3 * (1.0 + std::abs(N(r, c))));
+  }
+
+  xercesc::XMLPlatformUtils::Terminate();
+}
+
+TEST(RPCModel, BatchProjection) {
+  xercesc::XMLPlatformUtils::Initialize();
+
+  RPCXML xml;
+  xml.read_from_file( "dg_example1.xml" );
+  RPCModel const& rpc = *xml.rpc_ptr();
+
+  // Points on a small grid around the center of the RPC domain
+  std::vector<Vector3> points;
+  Vector3 llh0 = rpc.lonlatheight_offset();
+  for (int r = -2; r <= 2; r++) {
+    for (int c = -2; c <= 2; c++) {
+      Vector3 llh = llh0 + Vector3(0.01 * c, 0.01 * r, 10.0 * c);
+      points.push_back(rpc.datum().geodetic_to_cartesian(llh));
+    }
+  }
+
+  // The batch agrees with projecting one point at a time
+  std::vector<Vector2> pixels;
+  std::vector<unsigned char> valid;
+  asp::points_to_pixels(&rpc, points, pixels, valid);
+  ASSERT_EQ(points.size(), pixels.size());
+  for (size_t i = 0; i < points.size(); i++) {
+    EXPECT_EQ(1, valid[i]);
+    EXPECT_VECTOR_NEAR(rpc.point_to_pixel(points[i]), pixels[i], 1e-8);
+  }
+
+  std::vector<Vector3> vectors;
+  asp::pixels_to_vectors(&rpc, pixels, vectors, valid);
+  for (size_t i = 0; i < pixels.size(); i++) {
+    EXPECT_EQ(1, valid[i]);
+    EXPECT_VECTOR_NEAR(rpc.pixel_to_vector(pixels[i]), vectors[i], 1e-8);
+  }
+
+  xercesc::XMLPlatformUtils::Terminate();
+}
+
+TEST(RPCModelGen, FitJacobianAndSolver) {
+  xercesc::XMLPlatformUtils::Initialize();
+
+  RPCXML xml;
+  xml.read_from_file( "dg_example1.xml" );
+  RPCModel const& rpc = *xml.rpc_ptr();
+
+  // Sample the normalized RPC model on a grid
+  int n = 6, num_pts = n * n * n;
+  Vector<double> geodetics(RPCModel::GEODETIC_COORD_SIZE * num_pts);
+  Vector<double> pixels(RPCModel::IMAGE_COORD_SIZE * num_pts + RpcSolveLMA::NUM_PENALTY_TERMS);
+  for (size_t i = 0; i < pixels.size(); i++)
+    pixels[i] = 0.0;
+  int count = 0;
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      for (int k = 0; k < n; k++) {
+        Vector3 G(-1.0 + 0.4 * i, -1.0 + 0.4 * j, -1.0 + 0.4 * k);
+        subvector(geodetics, 3 * count, 3) = G;
+        subvector(pixels, 2 * count, 2) = rpc.normalized_geodetic_to_normalized_pixel(G);
+        count++;
+      }
+    }
+  }
+
+  // The analytic Jacobian agrees with finite differences
+  Vector<double> C;
+  packCoeffs(rpc.line_num_coeff(), rpc.line_den_coeff(),
+             rpc.sample_num_coeff(), rpc.sample_den_coeff(), C);
+  RpcSolveLMA lma_model(geodetics, pixels, 1e-4);
+  Matrix<double> J = lma_model.jacobian(C);
+  double eps = 1e-7;
+  for (int c = 0; c < int(C.size()); c += 7) {
+    Vector<double> Cp = C, Cm = C;
+    Cp[c] += eps;
+    Cm[c] -= eps;
+    Vector<double> diff = (lma_model(Cp) - lma_model(Cm)) / (2.0 * eps);
+    for (int r = 0; r < int(diff.size()); r += 5)
+      EXPECT_NEAR(diff[r], J(r, c), 1e-5);
+  }
+
+  // The solver recovers the samples from the linear initial guess
+  RPCModel::CoeffVec line_num, line_den, samp_num, samp_den;
+  line_num = line_den = samp_num = samp_den = RPCModel::CoeffVec();
+  line_num[2] = 1.0; line_den[0] = 1.0; samp_num[1] = 1.0; samp_den[0] = 1.0;
+  Vector<double> seed, solution;
+  packCoeffs(line_num, line_den, samp_num, samp_den, seed);
+  double norm_error = 0.0;
+  find_solution_normal_equations(lma_model, seed, pixels, solution, norm_error);
+  EXPECT_LT(norm_error, 1e-3);
+
+  xercesc::XMLPlatformUtils::Terminate();
+}
+
+TEST(RPCModel, ApproxCameraModel) {
+  xercesc::XMLPlatformUtils::Initialize();
+
+  RPCXML xml;
+  xml.read_from_file( "dg_example1.xml" );
+  boost::shared_ptr<CameraModel> rpc(new RPCModel(*xml.rpc_ptr()));
+  RPCModel const& exact = dynamic_cast<RPCModel const&>(*rpc);
+
+  // A DEM of 1000 x 1000 pixels around the center of the RPC domain
+  Vector3 llh0 = exact.lonlatheight_offset();
+  double step = 1e-4;
+  vw::cartography::GeoReference georef
+    (exact.datum(), Matrix3x3(step, 0, llh0[0] - 0.05, 0, -step, llh0[1] + 0.05, 0, 0, 1));
+  double max_error = 0.05;
+  asp::ApproxCameraModel approx(rpc, georef, Vector2i(1000, 1000),
+                                llh0[2] - 100.0, llh0[2] + 100.0, max_error);
+
+  for (int r = 0; r < 10; r++) {
+    for (int c = 0; c < 10; c++) {
+      Vector2 lonlat = georef.pixel_to_lonlat(Vector2(97.3 * c + 11.0, 99.1 * r + 3.0));
+      Vector3 xyz = exact.datum().geodetic_to_cartesian
+        (Vector3(lonlat[0], lonlat[1], llh0[2] + 15.0 * (c - r)));
+      EXPECT_VECTOR_NEAR(exact.point_to_pixel(xyz), approx.point_to_pixel(xyz), max_error);
+    }
+  }
+
+  // Away from the DEM the exact camera is used
+  Vector3 far = exact.datum().geodetic_to_cartesian(llh0 + Vector3(0.2, 0, 0));
+  EXPECT_VECTOR_NEAR(exact.point_to_pixel(far), approx.point_to_pixel(far), 1e-8);
+
+  xercesc::XMLPlatformUtils::Terminate();
+}
+
 
 
 TEST( RPCStereoModel, mvpMatchTest ) {
@@ -0,0 +1,65 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Camera/TimeProcessing.h>
+
+#include <boost/algorithm/string.hpp>
+
+using namespace vw;
+
+TEST(TimeProcessing, ParseTime) {
+  // The fast parsing agrees with Boost
+  std::vector<std::string> times = {"2022-04-13T22:46:31.4540000Z",
+                                    "2017-12-07 15:36:40.90795Z",
+                                    "2008-03-04T12:31:03.081912",
+                                    "2016-05-04 00:00:00"};
+  for (size_t it = 0; it < times.size(); it++) {
+    std::string s = times[it];
+    boost::replace_all(s, "T", " ");
+    s = asp::fix_millisecond(s);
+    EXPECT_EQ(boost::posix_time::time_from_string(s), asp::parse_time(times[it]));
+  }
+}
+
+TEST(TimeProcessing, TimeIndex) {
+  // Uniform and uneven times give the same intervals
+  std::vector<double> uniform, uneven;
+  for (int it = 0; it < 100; it++) {
+    uniform.push_back(0.5 * it);
+    uneven.push_back(0.5 * it * it);
+  }
+  asp::TimeIndex a(uniform), b(uneven);
+  for (int it = 0; it < 99; it++) {
+    EXPECT_EQ(size_t(it), a.find(uniform[it]));
+    EXPECT_EQ(size_t(it), a.find(0.5 * (uniform[it] + uniform[it + 1])));
+    EXPECT_EQ(size_t(it), b.find(uneven[it]));
+    EXPECT_EQ(size_t(it), b.find(0.5 * (uneven[it] + uneven[it + 1])));
+  }
+
+  // Out of range times use the nearest interval
+  double frac = 0.0;
+  EXPECT_EQ(0u, a.find(-1.0, frac));
+  EXPECT_NEAR(-2.0, frac, 1e-12);
+  EXPECT_EQ(98u, a.find(100.0, frac));
+  EXPECT_EQ(10u, a.find(5.25, frac));
+  EXPECT_NEAR(0.5, frac, 1e-12);
+
+  std::vector<double> unsorted = {0.0, 2.0, 1.0};
+  EXPECT_THROW(asp::TimeIndex bad(unsorted), ArgumentErr);
+}
@@ -20,6 +20,7 @@
 #include <asp/Core/StereoSettings.h>
 #include <asp/Core/InterestPointMatching.h>  // Slow-to-compile header
 #include <asp/Core/IpMatchingAlgs.h>         // Lightweight header
+#include <asp/Core/ParallelRansac.h>
 #include <vw/Math/Vector.h>
 #include <vw/Math/Matrix.h>
 #include <vw/Math/RANSAC.h>
@@ -312,10 +313,11 @@ namespace asp {
     BestFitEpipolarAlignment func(left_image_dims, right_image_dims, crop_to_shared_area);
     EpipolarAlignmentError error_metric;
     std::vector<size_t> inlier_indices;
-    RandomSampleConsensus<BestFitEpipolarAlignment, EpipolarAlignmentError> 
+    ParallelRansac<BestFitEpipolarAlignment, EpipolarAlignmentError> 
       ransac(func, error_metric,
              num_ransac_iterations, inlier_threshold,
-             min_num_output_inliers, reduce_min_num_output_inliers_if_no_fit);
+             min_num_output_inliers, reduce_min_num_output_inliers_if_no_fit,
+             0.999, stereo_settings().ip_num_ransac_threads);
     
     T = ransac(ip1, ip2);
     inlier_indices = ransac.inlier_indices(T, ip1, ip2);
@@ -467,10 +467,6 @@ namespace asp {
     did_bathy = false;
     errorVec = Vector3();
     
-    // It was verified beforehand that both bathy planes have the same
-    // value for use_curved_water_surface.
-    bool use_curved_water_surface = m_bathy_set[0].use_curved_water_surface;
-    
     int num_cams = m_cameras.size();
     VW_ASSERT((int)pixVec.size() == num_cams,
               vw::ArgumentErr() << "the number of rays must match "
@@ -493,120 +489,127 @@ namespace asp {
         camCtrs.push_back(m_cameras[p]->camera_center(pix));
       }
 
-      // Not enough valid rays
-      if (camDirs.size() < 2) 
-        return Vector3();
-
-      if (are_nearly_parallel(m_least_squares, m_angle_tol, camDirs)) 
-        return Vector3();
-
-      // Determine range by triangulation
-      Vector3 uncorr_tri_pt = triangulate_point(camDirs, camCtrs, errorVec);
-      if ( m_least_squares ){
-        if (num_cams == 2)
-          refine_point(pixVec[0], pixVec[1], uncorr_tri_pt);
-        else
-          vw::vw_throw(vw::NoImplErr() << "Least squares refinement is not "
-                       << "implemented for multi-view stereo.");
-      }
-    
-      // Reflect points that fall behind one of the two cameras.  Do
-      // not do this when bathymetry mode is on, as then we surely
-      // have satellite images and there is no way a point would be
-      // behind the camera.
-      if (!m_bathy_correct) {
-        bool reflect = false;
-        for (int p = 0; p < (int)camCtrs.size(); p++)
-          if (dot_prod(uncorr_tri_pt - camCtrs[p], camDirs[p]) < 0)
-            reflect = true;
-        if (reflect)
-          uncorr_tri_pt = -uncorr_tri_pt + 2*camCtrs[0];
-      }
+      return triangulate_valid_rays(pixVec, camDirs, camCtrs, errorVec, do_bathy, did_bathy);
+      
+    } catch (const camera::PixelToRayErr& /*e*/) {}
+
+    did_bathy = false;
+    errorVec = vw::Vector3();
+    return vw::Vector3();
+  }
+
+  Vector3 BathyStereoModel::triangulate_rays(std::vector<Vector3> const& camDirs,
+                                             std::vector<Vector3> const& camCtrs,
+                                             Vector3& errorVec, bool do_bathy,
+                                             bool & did_bathy) const {
+    did_bathy = false;
+    errorVec = Vector3();
+    if (m_least_squares)
+      vw::vw_throw(vw::NoImplErr() << "Least squares refinement needs the pixels.\n");
 
-      if (!do_bathy || camDirs.size() != 2) 
-        return uncorr_tri_pt;
+    try {
+      return triangulate_valid_rays(std::vector<Vector2>(), camDirs, camCtrs, errorVec,
+                                    do_bathy, did_bathy);
+    } catch (const camera::PixelToRayErr& /*e*/) {}
+
+    did_bathy = false;
+    errorVec = vw::Vector3();
+    return vw::Vector3();
+  }
+
+  // Triangulate the valid rays, then bend them at the water surface and
+  // triangulate again if needed
+  Vector3 BathyStereoModel::triangulate_valid_rays(std::vector<Vector2> const& pixVec,
+                                                   std::vector<Vector3> const& camDirs,
+                                                   std::vector<Vector3> const& camCtrs,
+                                                   Vector3& errorVec, bool do_bathy,
+                                                   bool & did_bathy) const {
+
+    // It was verified beforehand that both bathy planes have the same
+    // value for use_curved_water_surface.
+    bool use_curved_water_surface = m_bathy_set[0].use_curved_water_surface;
+    int num_cams = m_cameras.size();
+
+    // Not enough valid rays
+    if (camDirs.size() < 2) 
+      return Vector3();
+
+    if (are_nearly_parallel(m_least_squares, m_angle_tol, camDirs)) 
+      return Vector3();
+
+    // Determine range by triangulation
+    Vector3 uncorr_tri_pt = triangulate_point(camDirs, camCtrs, errorVec);
+    if ( m_least_squares ){
+      if (num_cams == 2)
+        refine_point(pixVec[0], pixVec[1], uncorr_tri_pt);
+      else
+        vw::vw_throw(vw::NoImplErr() << "Least squares refinement is not "
+                     << "implemented for multi-view stereo.");
+    }
+  
+    // Reflect points that fall behind one of the two cameras.  Do
+    // not do this when bathymetry mode is on, as then we surely
+    // have satellite images and there is no way a point would be
+    // behind the camera.
+    if (!m_bathy_correct) {
+      bool reflect = false;
+      for (int p = 0; p < (int)camCtrs.size(); p++)
+        if (dot_prod(uncorr_tri_pt - camCtrs[p], camDirs[p]) < 0)
+          reflect = true;
+      if (reflect)
+        uncorr_tri_pt = -uncorr_tri_pt + 2*camCtrs[0];
+    }
+
+    if (!do_bathy || camDirs.size() != 2) 
+      return uncorr_tri_pt;
+  
+    // Continue with bathymetry correction
     
-      // Continue with bathymetry correction
-      
-      if (!m_bathy_correct) 
-        vw::vw_throw(vw::ArgumentErr()
-                     << "Requested to do bathymetry correction while "
-                     << "this mode was not set up.");
+    if (!m_bathy_correct) 
+      vw::vw_throw(vw::ArgumentErr()
+                   << "Requested to do bathymetry correction while "
+                   << "this mode was not set up.");
 
-      // Find the rays after bending, according to Snell's law.
-      std::vector<Vector3> waterDirs(2), waterCtrs(2);
+    // Find the rays after bending, according to Snell's law.
+    std::vector<Vector3> waterDirs(2), waterCtrs(2);
 
-      // When there's a single plane, things are simple.
-      // Rays get bent or not, then they intersect, and done.
-      if (m_single_bathy_plane) {
-      
-        if (!use_curved_water_surface) {
-          
-          double ht_val = signed_dist_to_plane(m_bathy_set[0].bathy_plane, uncorr_tri_pt);
-          if (ht_val >= 0) {
-            // the rays intersect above the water surface, no need to go on
-            did_bathy = false;
-            return uncorr_tri_pt;
-          }
-          
-          // The simple case, when the water surface is a plane in ECEF
-          for (size_t it = 0; it < 2; it++) {
-            bool ans = snells_law(camCtrs[it], camDirs[it], m_bathy_set[it].bathy_plane,
-                                  m_refraction_index, 
-                                  waterCtrs[it], waterDirs[it]);
-            // If Snell's law failed to work, return the result before it
-            if (!ans) {
-              did_bathy = false;
-              return uncorr_tri_pt;
-            }
-          }
-          
-        } else{
-          
-          // The more complex case, the water surface is curved. It is
-          // however flat (a plane) if we switch to proj coordinates.
-          Vector3 proj_pt = proj_point(m_bathy_set[0].water_surface_projection, uncorr_tri_pt);
-          double ht_val = signed_dist_to_plane(m_bathy_set[0].bathy_plane, proj_pt);
-          if (ht_val >= 0) {
-            // the rays intersect above the water surface
+    // When there's a single plane, things are simple.
+    // Rays get bent or not, then they intersect, and done.
+    if (m_single_bathy_plane) {
+    
+      if (!use_curved_water_surface) {
+        
+        double ht_val = signed_dist_to_plane(m_bathy_set[0].bathy_plane, uncorr_tri_pt);
+        if (ht_val >= 0) {
+          // the rays intersect above the water surface, no need to go on
+          did_bathy = false;
+          return uncorr_tri_pt;
+        }
+        
+        // The simple case, when the water surface is a plane in ECEF
+        for (size_t it = 0; it < 2; it++) {
+          bool ans = snells_law(camCtrs[it], camDirs[it], m_bathy_set[it].bathy_plane,
+                                m_refraction_index, 
+                                waterCtrs[it], waterDirs[it]);
+          // If Snell's law failed to work, return the result before it
+          if (!ans) {
             did_bathy = false;
             return uncorr_tri_pt;
           }
-          
-          for (size_t it = 0; it < 2; it++) {
-            // Bend each ray at the surface according to Snell's law.
-            bool ans = snells_law_curved(camCtrs[it], camDirs[it],
-                                         m_bathy_set[it].bathy_plane,  
-                                         m_bathy_set[it].water_surface_projection,
-                                         m_refraction_index,
-                                         waterCtrs[it], waterDirs[it]);
-            if (!ans) {
-              did_bathy = false;
-              return uncorr_tri_pt;
-            }
-          }
         }
         
-        // Re-triangulate with the new rays
-        Vector3 corr_tri_pt = triangulate_point(waterDirs, waterCtrs, errorVec);
+      } else{
         
-        did_bathy = true;
-        return corr_tri_pt;
-      }
-
-      // The case of left and right images having their own bathy planes
-      
-      // Bend the rays
-      if (!use_curved_water_surface) {
-        for (size_t it = 0; it < 2; it++) {
-          bool ans = snells_law(camCtrs[it], camDirs[it],
-                                m_bathy_set[it].bathy_plane,  
-                                m_refraction_index,
-                                waterCtrs[it], waterDirs[it]);
-          if (!ans)
-            return uncorr_tri_pt;
+        // The more complex case, the water surface is curved. It is
+        // however flat (a plane) if we switch to proj coordinates.
+        Vector3 proj_pt = proj_point(m_bathy_set[0].water_surface_projection, uncorr_tri_pt);
+        double ht_val = signed_dist_to_plane(m_bathy_set[0].bathy_plane, proj_pt);
+        if (ht_val >= 0) {
+          // the rays intersect above the water surface
+          did_bathy = false;
+          return uncorr_tri_pt;
         }
-      } else {
+        
         for (size_t it = 0; it < 2; it++) {
           // Bend each ray at the surface according to Snell's law.
           bool ans = snells_law_curved(camCtrs[it], camDirs[it],
@@ -614,59 +617,91 @@ namespace asp {
                                        m_bathy_set[it].water_surface_projection,
                                        m_refraction_index,
                                        waterCtrs[it], waterDirs[it]);
-          if (!ans)
+          if (!ans) {
+            did_bathy = false;
             return uncorr_tri_pt;
+          }
         }
       }
       
-      // Each ray has two parts: before bending and after it. Two
-      // bent rays can intersect on their unbent parts, the bent part
-      // of one ray with unbent part of another ray, unbent part of
-      // one ray with bent part of another ray, and bent parts of both
-      // rays. Handle all these with much care. 
-
-      Vector3 err, tri_pt;
-      std::vector<double> signed_dists;
-
-      // See if the unbent portions intersect above their planes
-      tri_pt = triangulate_pair(camDirs[0], camCtrs[0], camDirs[1], camCtrs[1], err);
-      signed_distances_to_planes(use_curved_water_surface, m_bathy_set, tri_pt, signed_dists);
-      if (signed_dists[0] >= 0 && signed_dists[1] >= 0) {
-        did_bathy = false; // since the rays did not reach the bathy plane
-        errorVec = err;
-        return tri_pt;
-      }
+      // Re-triangulate with the new rays
+      Vector3 corr_tri_pt = triangulate_point(waterDirs, waterCtrs, errorVec);
       
-      // See if the bent portions intersect below their planes
-      tri_pt = triangulate_pair(waterDirs[0], waterCtrs[0], waterDirs[1], waterCtrs[1], err);
-      signed_distances_to_planes(use_curved_water_surface, m_bathy_set, tri_pt, signed_dists);
-      if (signed_dists[0] <= 0 && signed_dists[1] <= 0) {
-        did_bathy = true; // the resulting point is at least under one plane
-        errorVec = err;
-        return tri_pt;
-      }
+      did_bathy = true;
+      return corr_tri_pt;
+    }
 
-      // See if the left unbent portion intersects the right bent portion,
-      // above left's water plane and below right's water plane
-      tri_pt = triangulate_pair(camDirs[0], camCtrs[0], waterDirs[1], waterCtrs[1], err);
-      signed_distances_to_planes(use_curved_water_surface, m_bathy_set, tri_pt, signed_dists);
-      if (signed_dists[0] >= 0 && signed_dists[1] <= 0) {
-        did_bathy = true; // the resulting point is at least under one plane
-        errorVec = err;
-        return tri_pt;
+    // The case of left and right images having their own bathy planes
+    
+    // Bend the rays
+    if (!use_curved_water_surface) {
+      for (size_t it = 0; it < 2; it++) {
+        bool ans = snells_law(camCtrs[it], camDirs[it],
+                              m_bathy_set[it].bathy_plane,  
+                              m_refraction_index,
+                              waterCtrs[it], waterDirs[it]);
+        if (!ans)
+          return uncorr_tri_pt;
       }
-      
-      // See if the left bent portion intersects the right unbent portion,
-      // below left's water plane and above right's water plane
-      tri_pt = triangulate_pair(waterDirs[0], waterCtrs[0], camDirs[1], camCtrs[1], err);
-      signed_distances_to_planes(use_curved_water_surface, m_bathy_set, tri_pt, signed_dists);
-      if (signed_dists[0] <= 0 && signed_dists[1] >= 0) {
-        did_bathy = true; // the resulting point is at least under one plane
-        errorVec = err;
-        return tri_pt;
+    } else {
+      for (size_t it = 0; it < 2; it++) {
+        // Bend each ray at the surface according to Snell's law.
+        bool ans = snells_law_curved(camCtrs[it], camDirs[it],
+                                     m_bathy_set[it].bathy_plane,  
+                                     m_bathy_set[it].water_surface_projection,
+                                     m_refraction_index,
+                                     waterCtrs[it], waterDirs[it]);
+        if (!ans)
+          return uncorr_tri_pt;
       }
-      
-    } catch (const camera::PixelToRayErr& /*e*/) {}
+    }
+    
+    // Each ray has two parts: before bending and after it. Two
+    // bent rays can intersect on their unbent parts, the bent part
+    // of one ray with unbent part of another ray, unbent part of
+    // one ray with bent part of another ray, and bent parts of both
+    // rays. Handle all these with much care. 
+
+    Vector3 err, tri_pt;
+    std::vector<double> signed_dists;
+
+    // See if the unbent portions intersect above their planes
+    tri_pt = triangulate_pair(camDirs[0], camCtrs[0], camDirs[1], camCtrs[1], err);
+    signed_distances_to_planes(use_curved_water_surface, m_bathy_set, tri_pt, signed_dists);
+    if (signed_dists[0] >= 0 && signed_dists[1] >= 0) {
+      did_bathy = false; // since the rays did not reach the bathy plane
+      errorVec = err;
+      return tri_pt;
+    }
+    
+    // See if the bent portions intersect below their planes
+    tri_pt = triangulate_pair(waterDirs[0], waterCtrs[0], waterDirs[1], waterCtrs[1], err);
+    signed_distances_to_planes(use_curved_water_surface, m_bathy_set, tri_pt, signed_dists);
+    if (signed_dists[0] <= 0 && signed_dists[1] <= 0) {
+      did_bathy = true; // the resulting point is at least under one plane
+      errorVec = err;
+      return tri_pt;
+    }
+
+    // See if the left unbent portion intersects the right bent portion,
+    // above left's water plane and below right's water plane
+    tri_pt = triangulate_pair(camDirs[0], camCtrs[0], waterDirs[1], waterCtrs[1], err);
+    signed_distances_to_planes(use_curved_water_surface, m_bathy_set, tri_pt, signed_dists);
+    if (signed_dists[0] >= 0 && signed_dists[1] <= 0) {
+      did_bathy = true; // the resulting point is at least under one plane
+      errorVec = err;
+      return tri_pt;
+    }
+    
+    // See if the left bent portion intersects the right unbent portion,
+    // below left's water plane and above right's water plane
+    tri_pt = triangulate_pair(waterDirs[0], waterCtrs[0], camDirs[1], camCtrs[1], err);
+    signed_distances_to_planes(use_curved_water_surface, m_bathy_set, tri_pt, signed_dists);
+    if (signed_dists[0] <= 0 && signed_dists[1] >= 0) {
+      did_bathy = true; // the resulting point is at least under one plane
+      errorVec = err;
+      return tri_pt;
+    }
 
     // We arrive here only when there's bad luck
     did_bathy = false;
@@ -92,8 +92,23 @@ namespace asp {
     // get individual bathy plane settings, but they may be identical.
     void set_bathy(double refraction_index,
                    std::vector<BathyPlaneSettings> const& bathy_set);
+
+    /// As the first operator(), but with the camera centers and rays
+    /// already found for the valid pixels, such as a tile at a time. Not
+    /// for least squares refinement, which needs the pixels.
+    vw::Vector3 triangulate_rays(std::vector<vw::Vector3> const& camDirs,
+                                 std::vector<vw::Vector3> const& camCtrs,
+                                 vw::Vector3& errorVec, bool do_bathy, bool & did_bathy) const;
+
+    bool least_squares() const { return m_least_squares; }
     
   private:
+    vw::Vector3 triangulate_valid_rays(std::vector<vw::Vector2> const& pixVec,
+                                       std::vector<vw::Vector3> const& camDirs,
+                                       std::vector<vw::Vector3> const& camCtrs,
+                                       vw::Vector3& errorVec, bool do_bathy,
+                                       bool & did_bathy) const;
+
     // Used for bathymetry
     bool m_bathy_correct;                        // If to do bathy correction
     bool m_single_bathy_plane;                   // if the left and right images use same plane 
@@ -0,0 +1,607 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file BlockMatching.cc
+///
+
+#include <asp/Core/BlockMatching.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+
+#include <vector>
+#include <limits>
+#include <cmath>
+#include <cstdint>
+
+using namespace vw;
+
+namespace {
+
+  const float g_big_cost = std::numeric_limits<float>::max();
+  const int   g_census_half = 2; // census is computed in 5x5 windows
+
+  // Sum the values in (2*half+1) x (2*half+1) windows of a row-major
+  // image. Only pixels at least 'half' away from the boundary get a
+  // meaningful sum, the others are set to 0. The vertical pass keeps a
+  // running sum over rows, and the horizontal one adds shifted copies of
+  // each row, so both inner loops go over contiguous memory.
+  void box_sum(std::vector<float> const& in, int cols, int rows, int half,
+               std::vector<float> & vert, std::vector<float> & out) {
+
+    size_t num = size_t(cols) * rows;
+    vert.assign(num, 0.0f);
+    out.assign(num, 0.0f);
+    if (cols < 2*half + 1 || rows < 2*half + 1)
+      return;
+
+    float * first = &vert[size_t(half) * cols];
+    for (int r = 0; r <= 2*half; r++) {
+      const float * src = &in[size_t(r) * cols];
+      for (int x = 0; x < cols; x++)
+        first[x] += src[x];
+    }
+    for (int y = half + 1; y < rows - half; y++) {
+      float       * dst  = &vert[size_t(y) * cols];
+      const float * prev = &vert[size_t(y - 1) * cols];
+      const float * add  = &in[size_t(y + half) * cols];
+      const float * sub  = &in[size_t(y - half - 1) * cols];
+      for (int x = 0; x < cols; x++)
+        dst[x] = prev[x] + add[x] - sub[x];
+    }
+
+    for (int y = half; y < rows - half; y++) {
+      const float * src = &vert[size_t(y) * cols];
+      float       * dst = &out[size_t(y) * cols];
+      for (int k = -half; k <= half; k++) {
+        for (int x = half; x < cols - half; x++)
+          dst[x] += src[x + k];
+      }
+    }
+  }
+
+  // Census transform in 5x5 windows. A pixel whose window goes beyond the
+  // image or has no-data is marked as invalid.
+  void census_transform(std::vector<float> const& val, std::vector<float> const& ok,
+                        int cols, int rows,
+                        std::vector<std::uint32_t> & code, std::vector<float> & code_ok) {
+
+    size_t num = size_t(cols) * rows;
+    code.assign(num, 0);
+    code_ok.assign(num, 0.0f);
+    int h = g_census_half;
+    for (int y = h; y < rows - h; y++) {
+      for (int x = h; x < cols - h; x++) {
+        size_t i = size_t(y) * cols + x;
+        float center = val[i];
+        bool good = true;
+        std::uint32_t c = 0;
+        for (int dy = -h; dy <= h; dy++) {
+          for (int dx = -h; dx <= h; dx++) {
+            if (dx == 0 && dy == 0)
+              continue;
+            size_t j = i + ptrdiff_t(dy) * cols + dx;
+            good = good && (ok[j] > 0.0f);
+            c = (c << 1) | (val[j] < center ? 1 : 0);
+          }
+        }
+        if (good && ok[i] > 0.0f) {
+          code[i] = c;
+          code_ok[i] = 1.0f;
+        }
+      }
+    }
+  }
+
+
+  // The images prepared for matching, from which the aggregated cost of
+  // each pixel of the reference image is produced one disparity at a time.
+  class CostSlicer {
+  public:
+    CostSlicer(ImageView<float> const& ref_image, ImageView<float> const& oth_image,
+               int half, asp::BlockMatchCost cost_type):
+      m_cols(ref_image.cols()), m_rows(ref_image.rows()), m_half(half),
+      m_cost_type(cost_type) {
+
+      int cols = m_cols, rows = m_rows;
+      size_t num = size_t(cols) * rows;
+
+      // Copy the images to row-major arrays, with no-data replaced by 0,
+      // and record which pixels are valid.
+      std::vector<float> ref_ok(num), oth_ok(num);
+      m_ref_val.resize(num);
+      m_oth_val.resize(num);
+      for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++) {
+          size_t i = size_t(row) * cols + col;
+          float r = ref_image(col, row), o = oth_image(col, row);
+          ref_ok[i] = std::isnan(r) ? 0.0f : 1.0f;
+          oth_ok[i] = std::isnan(o) ? 0.0f : 1.0f;
+          m_ref_val[i] = std::isnan(r) ? 0.0f : r;
+          m_oth_val[i] = std::isnan(o) ? 0.0f : o;
+        }
+      }
+
+      if (cost_type == asp::BM_COST_CENSUS) {
+        std::vector<float> ref_code_ok, oth_code_ok;
+        census_transform(m_ref_val, ref_ok, cols, rows, m_ref_code, ref_code_ok);
+        census_transform(m_oth_val, oth_ok, cols, rows, m_oth_code, oth_code_ok);
+        ref_ok.swap(ref_code_ok);
+        oth_ok.swap(oth_code_ok);
+      }
+
+      // A window is valid if all its pixels are
+      box_sum(ref_ok, cols, rows, half, m_scratch, m_ref_win_ok);
+      box_sum(oth_ok, cols, rows, half, m_scratch, m_oth_win_ok);
+      m_full = float(2*half + 1) * float(2*half + 1);
+
+      // For NCC, the window sums not depending on the disparity are found
+      // once. The sums for the other image at the shifted location are the
+      // sums at the unshifted one, read with an offset.
+      if (cost_type == asp::BM_COST_NCC) {
+        std::vector<float> sq(num);
+        box_sum(m_ref_val, cols, rows, half, m_scratch, m_ref_sum);
+        for (size_t i = 0; i < num; i++) sq[i] = m_ref_val[i] * m_ref_val[i];
+        box_sum(sq, cols, rows, half, m_scratch, m_ref_sum2);
+        box_sum(m_oth_val, cols, rows, half, m_scratch, m_oth_sum);
+        for (size_t i = 0; i < num; i++) sq[i] = m_oth_val[i] * m_oth_val[i];
+        box_sum(sq, cols, rows, half, m_scratch, m_oth_sum2);
+      }
+
+      m_cost.resize(num);
+    }
+
+    // The per-window cost of matching each reference pixel to the pixel
+    // at offset d in the other image. It is g_big_cost where the windows
+    // do not fit fully in both images or have no-data. For NCC this is the
+    // negated correlation, so lower is always better.
+    void slice(int d, std::vector<float> & out) {
+
+      int cols = m_cols, rows = m_rows, half = m_half;
+
+      // Columns for which x + d is in the other image
+      int x_beg = std::max(0, -d), x_end = std::min(cols, cols - d);
+
+      // The per-pixel cost of this hypothesis
+      std::fill(m_cost.begin(), m_cost.end(), 0.0f);
+      for (int y = 0; y < rows; y++) {
+        const float * r = &m_ref_val[size_t(y) * cols];
+        const float * o = &m_oth_val[size_t(y) * cols];
+        float * c = &m_cost[size_t(y) * cols];
+        switch (m_cost_type) {
+        case asp::BM_COST_ABSOLUTE_DIFFERENCE:
+          for (int x = x_beg; x < x_end; x++)
+            c[x] = std::abs(r[x] - o[x + d]);
+          break;
+        case asp::BM_COST_SQUARED_DIFFERENCE:
+          for (int x = x_beg; x < x_end; x++)
+            c[x] = (r[x] - o[x + d]) * (r[x] - o[x + d]);
+          break;
+        case asp::BM_COST_NCC:
+          for (int x = x_beg; x < x_end; x++)
+            c[x] = r[x] * o[x + d];
+          break;
+        case asp::BM_COST_CENSUS: {
+          const std::uint32_t * rc = &m_ref_code[size_t(y) * cols];
+          const std::uint32_t * oc = &m_oth_code[size_t(y) * cols];
+          for (int x = x_beg; x < x_end; x++)
+            c[x] = __builtin_popcount(rc[x] ^ oc[x + d]);
+          break;
+        }
+        default:
+          vw_throw(ArgumentErr() << "Unknown block-matching cost: " << m_cost_type << ".\n");
+        }
+      }
+
+      box_sum(m_cost, cols, rows, half, m_scratch, out);
+
+      // Only pixels whose windows fit fully in both images are valid
+      float full = m_full;
+      int w_beg = std::max(half, half - d), w_end = std::min(cols - half, cols - half - d);
+      for (int y = 0; y < rows; y++) {
+        float * c = &out[size_t(y) * cols];
+        if (y < half || y >= rows - half) {
+          std::fill(c, c + cols, g_big_cost);
+          continue;
+        }
+        for (int x = 0; x < std::min(w_beg, cols); x++)
+          c[x] = g_big_cost;
+        for (int x = std::max(w_end, 0); x < cols; x++)
+          c[x] = g_big_cost;
+        for (int x = w_beg; x < w_end; x++) {
+          size_t i = size_t(y) * cols + x;
+          size_t j = i + d;
+          if (m_ref_win_ok[i] < full || m_oth_win_ok[j] < full) {
+            c[x] = g_big_cost;
+            continue;
+          }
+          if (m_cost_type == asp::BM_COST_NCC) {
+            float cov  = c[x]          - m_ref_sum[i] * m_oth_sum[j] / full;
+            float var1 = m_ref_sum2[i] - m_ref_sum[i] * m_ref_sum[i] / full;
+            float var2 = m_oth_sum2[j] - m_oth_sum[j] * m_oth_sum[j] / full;
+            float prod = var1 * var2;
+            c[x] = (prod > 1e-12f) ? -cov / std::sqrt(prod) : g_big_cost; // textureless
+          }
+        }
+      }
+    }
+
+    // The number of pixels in a window
+    float full() const { return m_full; }
+
+  private:
+    int m_cols, m_rows, m_half;
+    asp::BlockMatchCost m_cost_type;
+    float m_full;
+    std::vector<float> m_ref_val, m_oth_val, m_ref_win_ok, m_oth_win_ok;
+    std::vector<float> m_ref_sum, m_ref_sum2, m_oth_sum, m_oth_sum2;
+    std::vector<std::uint32_t> m_ref_code, m_oth_code;
+    std::vector<float> m_cost, m_scratch;
+  };
+
+  // The subpixel offset of the minimum of the parabola through the cost at
+  // the best disparity and at its two neighbors, in [-0.5, 0.5].
+  double parabola_offset(double cm, double c0, double cp) {
+    double denom = cm - 2.0 * c0 + cp;
+    if (denom <= 0.0)
+      return 0.0;
+    return std::max(-0.5, std::min(0.5, 0.5 * (cm - cp) / denom));
+  }
+
+  // Find the disparity from the reference to the other image, searching
+  // in [min_disp, max_disp], with a subpixel parabola fit.
+  void block_match_one_way(ImageView<float> const& ref_image,
+                           ImageView<float> const& oth_image,
+                           int min_disp, int max_disp, int half,
+                           asp::BlockMatchCost cost_type,
+                           ImageView<float> & disparity) {
+
+    int cols = ref_image.cols(), rows = ref_image.rows();
+    size_t num = size_t(cols) * rows;
+    float nan = std::numeric_limits<float>::quiet_NaN();
+    disparity.set_size(cols, rows);
+
+    CostSlicer slicer(ref_image, oth_image, half, cost_type);
+
+    // For each pixel keep the best cost, the disparity giving it, and the
+    // costs at the disparities right before and after, for the subpixel fit.
+    std::vector<float> curr(num), prev(num, g_big_cost);
+    std::vector<float> best_cost(num, g_big_cost), cost_before(num, g_big_cost),
+      cost_after(num, g_big_cost);
+    std::vector<int> best_disp(num, min_disp - 2);
+
+    for (int d = min_disp; d <= max_disp; d++) {
+      slicer.slice(d, curr);
+      for (size_t i = 0; i < num; i++) {
+        float c = curr[i];
+        if (c == g_big_cost)
+          continue;
+        if (c < best_cost[i]) {
+          cost_before[i] = prev[i];
+          best_cost[i]   = c;
+          best_disp[i]   = d;
+          cost_after[i]  = g_big_cost;
+        } else if (best_disp[i] == d - 1) {
+          cost_after[i] = c;
+        }
+      }
+      prev.swap(curr);
+    }
+
+    // Parabola fit around the best disparity
+    for (int y = 0; y < rows; y++) {
+      for (int x = 0; x < cols; x++) {
+        size_t i = size_t(y) * cols + x;
+        if (best_cost[i] == g_big_cost) {
+          disparity(x, y) = nan;
+          continue;
+        }
+        double offset = 0.0;
+        if (cost_before[i] != g_big_cost && cost_after[i] != g_big_cost)
+          offset = parabola_offset(cost_before[i], best_cost[i], cost_after[i]);
+        disparity(x, y) = best_disp[i] + offset;
+      }
+    }
+  }
+
+  // Costs are quantized to integers below this value for semi-global
+  // matching. The value itself marks an invalid cost. With the penalty P2
+  // bounded by g_sgm_max_p2, the sum of the costs along 8 paths fits in 16 bits.
+  const int g_sgm_invalid_cost = 4095;
+  const int g_sgm_max_p2       = 4096;
+  const int g_sgm_num_paths    = 8;
+
+  // Map the window costs of a slice to integers, so that all cost types
+  // have about the same range and the same smoothness penalties work for
+  // all. Absolute and squared differences become 4 times the mean (or RMS)
+  // difference in 8-bit gray levels, the negated NCC in [-1, 1] becomes
+  // [0, 1024], and census becomes 32 times the mean number of differing
+  // bits per pixel.
+  void sgm_quantize(std::vector<float> const& slice, float full,
+                    asp::BlockMatchCost cost_type, std::uint16_t * out) {
+    float scale = 1.0f, shift = 0.0f;
+    switch (cost_type) {
+    case asp::BM_COST_ABSOLUTE_DIFFERENCE: scale = 1020.0f / full; break;
+    case asp::BM_COST_SQUARED_DIFFERENCE:  scale = 1.0f / full;    break;
+    case asp::BM_COST_NCC:                 scale = 512.0f; shift = 512.0f; break;
+    case asp::BM_COST_CENSUS:              scale = 32.0f / full;   break;
+    default:                               break;
+    }
+    float max_q = g_sgm_invalid_cost - 1;
+    for (size_t i = 0; i < slice.size(); i++) {
+      float c = slice[i];
+      if (c == g_big_cost) {
+        out[i] = g_sgm_invalid_cost;
+        continue;
+      }
+      float q = scale * c + shift;
+      if (cost_type == asp::BM_COST_SQUARED_DIFFERENCE)
+        q = 1020.0f * std::sqrt(std::max(q, 0.0f));
+      out[i] = std::uint16_t(std::max(0.0f, std::min(max_q, q)) + 0.5f);
+    }
+  }
+
+  // Add to the aggregated cost volume the costs along the path going in
+  // direction (dx, dy). The volume is stored pixel by pixel, with the
+  // disparities of each pixel contiguous. The pixels are visited so that
+  // the previous pixel on the path is always done. Its costs are in the
+  // current row if dy is 0, and in the previous row otherwise.
+  void sgm_aggregate_path(std::vector<std::uint16_t> const& cost, int cols, int rows,
+                          int num_disp, int dx, int dy, int P1, int P2,
+                          std::vector<std::uint16_t> & sum) {
+
+    size_t row_len = size_t(cols) * num_disp;
+    std::vector<std::int16_t> prev_row(row_len), curr_row(row_len);
+    std::vector<std::int16_t> prev_min(cols), curr_min(cols);
+
+    for (int iy = 0; iy < rows; iy++) {
+      int y = (dy >= 0) ? iy : rows - 1 - iy;
+      for (int ix = 0; ix < cols; ix++) {
+        int x = (dx >= 0) ? ix : cols - 1 - ix;
+        int px = x - dx, py = y - dy;
+        size_t i = size_t(y) * cols + x;
+        const std::uint16_t * c = &cost[i * num_disp];
+        std::int16_t * L = &curr_row[size_t(x) * num_disp];
+        std::uint16_t * S = &sum[i * num_disp];
+
+        if (px < 0 || px >= cols || py < 0 || py >= rows) {
+          // The path starts here
+          for (int k = 0; k < num_disp; k++)
+            L[k] = c[k];
+        } else {
+          // Set the first and last disparity separately, so the loop over
+          // the others has no branches and vectorizes.
+          const std::int16_t * Lp = (dy == 0) ? &curr_row[size_t(px) * num_disp]
+                                              : &prev_row[size_t(px) * num_disp];
+          std::int16_t min_p = (dy == 0) ? curr_min[px] : prev_min[px];
+          std::int16_t jump  = min_p + P2, p1 = P1;
+          int last = num_disp - 1;
+          for (int k = 1; k < last; k++) {
+            std::int16_t a = std::min(Lp[k], jump);
+            std::int16_t b = std::min(Lp[k - 1], Lp[k + 1]) + p1;
+            L[k] = std::int16_t(c[k] + std::min(a, b) - min_p);
+          }
+          std::int16_t v0 = std::min(Lp[0], jump);
+          if (last > 0)
+            v0 = std::min(v0, std::int16_t(Lp[1] + p1));
+          std::int16_t v1 = std::min(Lp[last], jump);
+          if (last > 0)
+            v1 = std::min(v1, std::int16_t(Lp[last - 1] + p1));
+          L[0]    = std::int16_t(c[0]    + v0 - min_p);
+          L[last] = std::int16_t(c[last] + v1 - min_p);
+        }
+        std::int16_t min_L = L[0];
+        for (int k = 1; k < num_disp; k++)
+          min_L = std::min(min_L, L[k]);
+        curr_min[x] = min_L;
+        for (int k = 0; k < num_disp; k++)
+          S[k] += L[k];
+      }
+      prev_row.swap(curr_row);
+      prev_min.swap(curr_min);
+    }
+  }
+
+} // end anonymous namespace
+
+namespace asp {
+
+  void block_match_1d(vw::ImageView<float> const& left_image,
+                      vw::ImageView<float> const& right_image,
+                      int min_disp, int max_disp, int kernel_size,
+                      BlockMatchCost cost_type, double lr_threshold,
+                      // Output
+                      vw::ImageView<float> & disparity) {
+
+    if (left_image.cols() != right_image.cols() || left_image.rows() != right_image.rows())
+      vw_throw(ArgumentErr() << "Block matching expects images of the same dimensions.\n");
+    if (kernel_size < 1 || kernel_size % 2 == 0)
+      vw_throw(ArgumentErr() << "The block-matching kernel size must be odd and positive.\n");
+    if (cost_type < BM_COST_ABSOLUTE_DIFFERENCE || cost_type > BM_COST_CENSUS)
+      vw_throw(ArgumentErr() << "Unknown block-matching cost: " << cost_type << ".\n");
+    if (min_disp > max_disp)
+      vw_throw(ArgumentErr() << "The block-matching search range is empty.\n");
+
+    int half = kernel_size / 2;
+    block_match_one_way(left_image, right_image, min_disp, max_disp, half, cost_type,
+                        disparity);
+    if (lr_threshold < 0)
+      return;
+
+    // The right-to-left disparity must be the negative of the left-to-right one
+    ImageView<float> rl_disparity;
+    block_match_one_way(right_image, left_image, -max_disp, -min_disp, half, cost_type,
+                        rl_disparity);
+
+    float nan = std::numeric_limits<float>::quiet_NaN();
+    int num_rejected = 0;
+    for (int row = 0; row < disparity.rows(); row++) {
+      for (int col = 0; col < disparity.cols(); col++) {
+        float d = disparity(col, row);
+        if (std::isnan(d))
+          continue;
+        int right_col = (int)round(col + d);
+        bool good = (right_col >= 0 && right_col < rl_disparity.cols());
+        if (good) {
+          float rd = rl_disparity(right_col, row);
+          good = (!std::isnan(rd) && std::abs(d + rd) <= lr_threshold);
+        }
+        if (!good) {
+          disparity(col, row) = nan;
+          num_rejected++;
+        }
+      }
+    }
+    vw_out(DebugMessage, "asp") << "Block matching L-R check rejected "
+                                << num_rejected << " pixels.\n";
+  }
+
+  double sgm_1d_memory_mb(int cols, int rows, int min_disp, int max_disp) {
+    // The cost volume and the aggregated volume, each with 16-bit values
+    double num_disp = std::max(0, max_disp - min_disp + 1);
+    return 2.0 * 2.0 * double(cols) * double(rows) * num_disp / (1024.0 * 1024.0);
+  }
+
+  void sgm_1d(vw::ImageView<float> const& left_image,
+              vw::ImageView<float> const& right_image,
+              int min_disp, int max_disp, int kernel_size,
+              BlockMatchCost cost_type, int P1, int P2,
+              bool subpixel, double lr_threshold, double memory_limit_mb,
+              // Output
+              vw::ImageView<float> & disparity) {
+
+    if (left_image.cols() != right_image.cols() || left_image.rows() != right_image.rows())
+      vw_throw(ArgumentErr() << "Semi-global matching expects images of the same dimensions.\n");
+    if (kernel_size < 1 || kernel_size % 2 == 0)
+      vw_throw(ArgumentErr() << "The semi-global matching kernel size must be odd and positive.\n");
+    if (cost_type < BM_COST_ABSOLUTE_DIFFERENCE || cost_type > BM_COST_CENSUS)
+      vw_throw(ArgumentErr() << "Unknown semi-global matching cost: " << cost_type << ".\n");
+    if (min_disp > max_disp)
+      vw_throw(ArgumentErr() << "The semi-global matching search range is empty.\n");
+    if (P1 < 0 || P2 < P1 || P2 > g_sgm_max_p2)
+      vw_throw(ArgumentErr() << "The semi-global matching penalties must satisfy "
+               << "0 <= P1 <= P2 <= " << g_sgm_max_p2 << ".\n");
+
+    int cols = left_image.cols(), rows = left_image.rows();
+    double mem_mb = sgm_1d_memory_mb(cols, rows, min_disp, max_disp);
+    if (mem_mb > memory_limit_mb)
+      vw_throw(ArgumentErr() << "Semi-global matching would need " << mem_mb
+               << " MB, which is more than the limit of " << memory_limit_mb
+               << " MB. Use smaller tiles or increase --corr-memory-limit-mb.\n");
+
+    // Quantize the cost of each pixel and disparity
+    int num_disp = max_disp - min_disp + 1;
+    size_t num = size_t(cols) * rows;
+    std::vector<std::uint16_t> cost(num * num_disp), sum(num * num_disp, 0);
+    {
+      // The slices are produced one disparity at a time, but the volume
+      // has the disparities of each pixel contiguous. Transpose a block of
+      // slices at a time, so that the writes are not all to different
+      // cache lines.
+      const int block = 16;
+      CostSlicer slicer(left_image, right_image, kernel_size / 2, cost_type);
+      std::vector<float> slice;
+      std::vector<std::uint16_t> block_cost(num * block);
+      for (int k0 = 0; k0 < num_disp; k0 += block) {
+        int len = std::min(block, num_disp - k0);
+        for (int k = 0; k < len; k++) {
+          slicer.slice(min_disp + k0 + k, slice);
+          sgm_quantize(slice, slicer.full(), cost_type, &block_cost[k * num]);
+        }
+        for (size_t i = 0; i < num; i++) {
+          std::uint16_t * c = &cost[i * num_disp + k0];
+          for (int k = 0; k < len; k++)
+            c[k] = block_cost[k * num + i];
+        }
+      }
+    }
+
+    // Aggregate along the horizontal, vertical, and diagonal paths
+    int dirs[g_sgm_num_paths][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1},
+                                    {1, 1}, {-1, -1}, {1, -1}, {-1, 1}};
+    for (int p = 0; p < g_sgm_num_paths; p++)
+      sgm_aggregate_path(cost, cols, rows, num_disp, dirs[p][0], dirs[p][1], P1, P2, sum);
+
+    // Winner-take-all. A pixel is valid only if the raw cost at the winning
+    // disparity is valid. The subpixel fit uses the raw costs, as the
+    // aggregated ones are flattened by the smoothness penalty.
+    float nan = std::numeric_limits<float>::quiet_NaN();
+    disparity.set_size(cols, rows);
+    std::vector<int> best_k(num, -1);
+    for (int y = 0; y < rows; y++) {
+      for (int x = 0; x < cols; x++) {
+        size_t i = size_t(y) * cols + x;
+        const std::uint16_t * S = &sum[i * num_disp];
+        int k0 = 0;
+        for (int k = 1; k < num_disp; k++)
+          if (S[k] < S[k0])
+            k0 = k;
+        if (cost[i * num_disp + k0] == g_sgm_invalid_cost) {
+          disparity(x, y) = nan;
+          continue;
+        }
+        best_k[i] = k0;
+        double offset = 0.0;
+        const std::uint16_t * C = &cost[i * num_disp];
+        if (subpixel && k0 > 0 && k0 + 1 < num_disp &&
+            C[k0 - 1] != g_sgm_invalid_cost && C[k0 + 1] != g_sgm_invalid_cost)
+          offset = parabola_offset(C[k0 - 1], C[k0], C[k0 + 1]);
+        disparity(x, y) = min_disp + k0 + offset;
+      }
+    }
+
+    if (lr_threshold < 0)
+      return;
+
+    // The right-to-left disparity is read from the same aggregated volume,
+    // as the cost of right pixel x at disparity d is that of left pixel x - d.
+    int num_rejected = 0;
+    std::vector<int> rl_best(cols);
+    std::vector<std::uint32_t> rl_cost(cols);
+    for (int y = 0; y < rows; y++) {
+      std::fill(rl_best.begin(), rl_best.end(), -1);
+      std::fill(rl_cost.begin(), rl_cost.end(), std::numeric_limits<std::uint32_t>::max());
+      for (int x = 0; x < cols; x++) {
+        size_t i = size_t(y) * cols + x;
+        for (int k = 0; k < num_disp; k++) {
+          int xr = x + min_disp + k;
+          if (xr < 0 || xr >= cols || cost[i * num_disp + k] == g_sgm_invalid_cost)
+            continue;
+          if (sum[i * num_disp + k] < rl_cost[xr]) {
+            rl_cost[xr] = sum[i * num_disp + k];
+            rl_best[xr] = k;
+          }
+        }
+      }
+      for (int x = 0; x < cols; x++) {
+        size_t i = size_t(y) * cols + x;
+        if (best_k[i] < 0)
+          continue;
+        float d = disparity(x, y);
+        int xr = (int)round(x + d);
+        bool good = (xr >= 0 && xr < cols && rl_best[xr] >= 0 &&
+                     std::abs(d - (min_disp + rl_best[xr])) <= lr_threshold);
+        if (!good) {
+          disparity(x, y) = nan;
+          num_rejected++;
+        }
+      }
+    }
+    vw_out(DebugMessage, "asp") << "Semi-global matching L-R check rejected "
+                                << num_rejected << " pixels.\n";
+  }
+
+} // end namespace asp
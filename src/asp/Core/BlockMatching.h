@@ -0,0 +1,79 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file BlockMatching.h
+///
+/// Native correlators for pairs of epipolar-aligned tiles, invoked as the
+/// asp_fast_bm and asp_fast_sgm algorithms with local_epipolar alignment.
+/// For each disparity hypothesis the per-pixel cost is formed for a whole
+/// row-major image slice and aggregated with a separable box filter, so all
+/// inner loops run over contiguous memory and vectorize. Block matching
+/// never stores the full cost volume. Semi-global matching stores it with
+/// 16-bit values, then aggregates it along 8 paths.
+
+#ifndef __ASP_CORE_BLOCK_MATCHING_H__
+#define __ASP_CORE_BLOCK_MATCHING_H__
+
+#include <vw/Image/ImageView.h>
+
+namespace asp {
+
+  /// The matching costs. The values are the same as for --cost-mode.
+  enum BlockMatchCost {
+    BM_COST_ABSOLUTE_DIFFERENCE = 0,
+    BM_COST_SQUARED_DIFFERENCE  = 1,
+    BM_COST_NCC                 = 2,
+    BM_COST_CENSUS              = 3
+  };
+
+  /// Find the horizontal disparity from the left to the right image, which
+  /// must have the same dimensions and use NaN as no-data. The search range
+  /// is [min_disp, max_disp]. Pixels whose window has no-data or is too
+  /// close to the image boundary get a NaN disparity. The result is refined
+  /// to subpixel precision with a parabola fit. If lr_threshold is
+  /// non-negative, the right-to-left disparity is computed as well, and
+  /// pixels where the two disagree by more than that are invalidated.
+  void block_match_1d(vw::ImageView<float> const& left_image,
+                      vw::ImageView<float> const& right_image,
+                      int min_disp, int max_disp, int kernel_size,
+                      BlockMatchCost cost_type, double lr_threshold,
+                      // Output
+                      vw::ImageView<float> & disparity);
+
+  /// The memory in MB used by sgm_1d() for the given tile and search range
+  double sgm_1d_memory_mb(int cols, int rows, int min_disp, int max_disp);
+
+  /// Semi-global matching with the same inputs and conventions as
+  /// block_match_1d(). The window costs are quantized so that all cost
+  /// types have a range of about [0, 1024], with P1 and P2 being the
+  /// penalties, in these units, for disparity changes of one and of more
+  /// than one between neighbors. Must have 0 <= P1 <= P2 <= 4096. The
+  /// right-to-left disparity for the L-R check is read from the same
+  /// aggregated costs, so it comes almost for free. If subpixel is true,
+  /// fit a parabola. This runs on the CPU. Throw if more than
+  /// memory_limit_mb would be needed.
+  void sgm_1d(vw::ImageView<float> const& left_image,
+              vw::ImageView<float> const& right_image,
+              int min_disp, int max_disp, int kernel_size,
+              BlockMatchCost cost_type, int P1, int P2,
+              bool subpixel, double lr_threshold, double memory_limit_mb,
+              // Output
+              vw::ImageView<float> & disparity);
+
+} // end namespace asp
+
+#endif//__ASP_CORE_BLOCK_MATCHING_H__
@@ -28,6 +28,9 @@
 #include <vw/BundleAdjustment/CameraRelation.h>
 #include <asp/Core/BundleAdjustUtils.h>
 
+#include <boost/geometry.hpp>
+#include <boost/geometry/index/rtree.hpp>
+
 #include <string>
 
 using namespace vw;
@@ -36,6 +39,8 @@ using namespace vw::stereo;
 using namespace vw::ba;
 
 namespace fs = boost::filesystem;
+namespace bg = boost::geometry;
+namespace bgi = boost::geometry::index;
 
 std::string g_piecewise_adj_str = "PIECEWISE_ADJUSTMENTS";
 std::string g_session_str = "SESSION";
@@ -173,6 +178,7 @@ void asp::compute_stereo_residuals(std::vector<boost::shared_ptr<CameraModel>> c
 
 // See the .h file for documentation
 vw::BBox2 asp::camera_bbox_with_cache(std::string const& dem_file,
+                                      vw::cartography::Datum const& datum,
                                       std::string const& image_file,
                                       boost::shared_ptr<vw::camera::CameraModel> const&
                                       camera_model,
@@ -184,7 +190,8 @@ vw::BBox2 asp::camera_bbox_with_cache(std::string const& dem_file,
 
   vw::BBox2 box;
   
-  std::string box_path = out_prefix + '-' + fs::path(image_file).stem().string() + "-bbox.txt";
+  std::string box_path = out_prefix + '-' + fs::path(image_file).stem().string()
+    + (dem_file.empty() ? "-datum-bbox.txt" : "-bbox.txt");
   if (fs::exists(box_path)) {
     double min_x, min_y, max_x, max_y;
     std::ifstream ifs(box_path);
@@ -196,6 +203,20 @@ vw::BBox2 asp::camera_bbox_with_cache(std::string const& dem_file,
     }
   }
 
+  if (dem_file.empty()) {
+    // Intersect with the datum, in lon-lat
+    vw::cartography::GeoReference georef;
+    georef.set_datum(datum);
+    try {
+      DiskImageView<float> img(image_file);
+      box = vw::cartography::camera_bbox(georef, camera_model, img.cols(), img.rows());
+    } catch (std::exception const& e) {
+      vw_throw( ArgumentErr() << e.what() << "\n"
+                << "Failed to compute the footprint of camera image: " << image_file
+                << " onto the datum.\n");
+    }
+  } else {
+
   // Read the DEM and supporting data
   vw::cartography::GeoReference dem_georef;
   DiskImageView<float> dem_disk_image(dem_file);
@@ -224,6 +245,8 @@ vw::BBox2 asp::camera_bbox_with_cache(std::string const& dem_file,
               << " onto DEM: " << dem_file << ".\n");
   }
 
+  } // End the DEM case
+
   vw_out() << "Writing: " << box_path << "\n";
   std::ofstream ofs(box_path.c_str());
   ofs.precision(17);
@@ -236,7 +259,8 @@ vw::BBox2 asp::camera_bbox_with_cache(std::string const& dem_file,
 
 // See the .h file for the documentation.
 void asp::build_overlap_list_based_on_dem
-/*        */ (std::string const& out_prefix, std::string const& dem_file, double pct_for_overlap,
+/*        */ (std::string const& out_prefix, std::string const& dem_file,
+              vw::cartography::Datum const& datum, double pct_for_overlap,
               std::vector<std::string> const& image_files,
               std::vector<boost::shared_ptr<vw::camera::CameraModel>> const& camera_models,
               std::set<std::pair<std::string, std::string>> & overlap_list) {
@@ -253,8 +277,8 @@ void asp::build_overlap_list_based_on_dem
   for (int it = 0; it < num_images; it++) {
     // By this stage the camera bboxes are already computed and cached,
     // they just need to be loaded.
-    boxes[it] = asp::camera_bbox_with_cache(dem_file, image_files[it], camera_models[it],  
-                                            out_prefix);
+    boxes[it] = asp::camera_bbox_with_cache(dem_file, datum, image_files[it],
+                                            camera_models[it], out_prefix);
 
     // Expand the box by the given factor
     double factor = pct_for_overlap / 100.0;
@@ -270,17 +294,34 @@ void asp::build_overlap_list_based_on_dem
     boxes[it].max() += Vector2(half_extra_x, half_extra_y);
   }
 
-  // See which boxes overlap. While this is an O(N^2) computation,
-  // likely N is at most a thousand or two, which should be
-  // manageable. A 2D tree of box corners could be used, and two boxes
-  // would then overlap if corners from one box are contained in a
-  // second box. That would be a O(N * log(N)) lookup.
-  // TODO(oalexan1): Use a tree.
-  for (int it1 = 0; it1 < num_images; it1++) {
-    for (int it2 = it1 + 1; it2 < num_images; it2++) {
+  // See which boxes overlap. With an R-tree of the boxes this takes
+  // O(N * log(N)) plus the number of overlapping pairs, rather than
+  // checking all N^2 pairs, which matters for large unordered image
+  // collections.
+  typedef bg::model::point<double, 2, bg::cs::cartesian> IndexPoint;
+  typedef bg::model::box<IndexPoint>                     IndexBox;
+  typedef std::pair<IndexBox, int>                       IndexValue;
+  std::vector<IndexValue> values;
+  for (int it = 0; it < num_images; it++) {
+    if (boxes[it].empty())
+      continue;
+    values.push_back(IndexValue(IndexBox(IndexPoint(boxes[it].min().x(), boxes[it].min().y()),
+                                         IndexPoint(boxes[it].max().x(), boxes[it].max().y())),
+                                it));
+  }
+  bgi::rtree<IndexValue, bgi::rstar<16>> tree(values.begin(), values.end());
+  std::vector<IndexValue> found;
+  for (size_t k = 0; k < values.size(); k++) {
+    int it1 = values[k].second;
+    found.clear();
+    tree.query(bgi::intersects(values[k].first), std::back_inserter(found));
+    for (size_t f = 0; f < found.size(); f++) {
+      int it2 = found[f].second;
+      if (it2 <= it1)
+        continue; // each pair once, and not an image with itself
       BBox2 box = boxes[it1]; // deep copy
       box.crop(boxes[it2]);
-      if (!box.empty())
+      if (!box.empty()) // the tree counts touching boxes as intersecting
         overlap_list.insert(std::make_pair(image_files[it1], image_files[it2]));
     }
   }
@@ -24,6 +24,7 @@
 #include <vw/Math/Vector.h>
 #include <vw/Math/Quaternion.h>
 #include <vw/Math/BBox.h>
+#include <vw/Cartography/Datum.h>
 
 #include <string>
 #include <vector>
@@ -86,8 +87,10 @@ namespace asp{
                                 vw::ba::ControlNetwork const& cnet);
 
   // Compute a camera footprint's bounding box. Used a cached result if available.
-  // Cache the current result if computed.
+  // Cache the current result if computed. If the DEM file is empty, intersect
+  // with the datum instead, and find a lon-lat box.
   vw::BBox2 camera_bbox_with_cache(std::string const& dem_file,
+                                   vw::cartography::Datum const& datum,
                                    std::string const& image_file,
                                    boost::shared_ptr<vw::camera::CameraModel> const&
                                    camera_model,
@@ -97,10 +100,13 @@ namespace asp{
   // bounding boxes of their footprints given the specified DEM, expand
   // them by a given percentage, and see if those intersect. A higher
   // percentage should be used when there is more uncertainty in input
-  // camera poses. Specify as: 'dem.tif 15'.
+  // camera poses. Specify as: 'dem.tif 15'. If the DEM file is empty,
+  // the footprints are on the datum. The boxes are put in an R-tree,
+  // so only the pairs which overlap are visited.
   void build_overlap_list_based_on_dem
   /*        */ (std::string const& out_prefix,
                 std::string const& dem_file,
+                vw::cartography::Datum const& datum,
                 double pct_for_overlap,
                 std::vector<std::string> const& image_files,
                 std::vector<boost::shared_ptr<vw::camera::CameraModel>> const& camera_models,
@@ -0,0 +1,385 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file ChunkedPointCloud.cc
+///
+
+#include <asp/Core/ChunkedPointCloud.h>
+#include <vw/Core/Exception.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/copy.hpp>
+
+#include <cmath>
+#include <cstring>
+
+using namespace vw;
+
+namespace {
+
+  const char CHUNKED_POINT_CLOUD_MAGIC[] = "ASPPCCH3";
+  const int  MAGIC_LEN = 8;
+
+  template <class T>
+  void write_value(std::ostream & os, T const& val) {
+    os.write(reinterpret_cast<const char*>(&val), sizeof(T));
+  }
+
+  template <class T>
+  void read_value(std::istream & is, T & val) {
+    is.read(reinterpret_cast<char*>(&val), sizeof(T));
+  }
+
+  // Group the i-th bytes of all the values together. Nearby points share
+  // their sign, exponent and leading mantissa bytes, so this makes long runs
+  // of similar bytes, which compress much better.
+  void shuffle_bytes(const char * in, size_t num_vals, size_t val_size, char * out) {
+    for (size_t i = 0; i < num_vals; i++)
+      for (size_t b = 0; b < val_size; b++)
+        out[b*num_vals + i] = in[i*val_size + b];
+  }
+
+  void unshuffle_bytes(const char * in, size_t num_vals, size_t val_size, char * out) {
+    for (size_t i = 0; i < num_vals; i++)
+      for (size_t b = 0; b < val_size; b++)
+        out[i*val_size + b] = in[b*num_vals + i];
+  }
+
+  // A point is valid if it is not the zero vector, as in PC.tif files
+  bool is_valid_point(const double * v) {
+    return v[0] != 0 || v[1] != 0 || v[2] != 0;
+  }
+
+  void write_index_entry(std::ostream & os, asp::PointCloudChunk const& chunk) {
+    write_value(os, chunk.file_offset);
+    write_value(os, chunk.num_bytes);
+    write_value(os, chunk.num_valid);
+    std::uint8_t is_double = chunk.is_double;
+    write_value(os, is_double);
+    for (int k = 0; k < 3; k++) write_value(os, chunk.offset[k]);
+    std::int32_t box[4] = {chunk.pixel_box.min().x(), chunk.pixel_box.min().y(),
+                           chunk.pixel_box.width(),   chunk.pixel_box.height()};
+    for (int k = 0; k < 4; k++) write_value(os, box[k]);
+    // An empty box is written as min > max, and read back as empty
+    for (int k = 0; k < 3; k++) write_value(os, chunk.point_box.min()[k]);
+    for (int k = 0; k < 3; k++) write_value(os, chunk.point_box.max()[k]);
+  }
+
+  void read_index_entry(std::istream & is, asp::PointCloudChunk & chunk) {
+    read_value(is, chunk.file_offset);
+    read_value(is, chunk.num_bytes);
+    read_value(is, chunk.num_valid);
+    std::uint8_t is_double = 0;
+    read_value(is, is_double);
+    chunk.is_double = (is_double != 0);
+    for (int k = 0; k < 3; k++) read_value(is, chunk.offset[k]);
+    std::int32_t box[4];
+    for (int k = 0; k < 4; k++) read_value(is, box[k]);
+    chunk.pixel_box = BBox2i(box[0], box[1], box[2], box[3]);
+    for (int k = 0; k < 3; k++) read_value(is, chunk.point_box.min()[k]);
+    for (int k = 0; k < 3; k++) read_value(is, chunk.point_box.max()[k]);
+  }
+
+} // end anonymous namespace
+
+namespace asp {
+
+bool is_chunked_point_cloud(std::string const& file) {
+  return boost::iends_with(file, CHUNKED_POINT_CLOUD_EXT);
+}
+
+void read_chunked_point_cloud_info(std::string const& file, ChunkedPointCloudInfo & info) {
+
+  std::ifstream ifs(file.c_str(), std::ios::binary);
+  if (!ifs.good())
+    vw_throw(IOErr() << "Cannot open point cloud: " << file << ".\n");
+
+  char magic[MAGIC_LEN];
+  ifs.read(magic, MAGIC_LEN);
+  if (!ifs.good() || std::memcmp(magic, CHUNKED_POINT_CLOUD_MAGIC, MAGIC_LEN) != 0)
+    vw_throw(IOErr() << "Not a chunked point cloud, or one written by an older "
+             << "version: " << file << ".\n");
+
+  std::int32_t vals[4];
+  for (int k = 0; k < 4; k++) read_value(ifs, vals[k]);
+  info.cols = vals[0]; info.rows = vals[1]; info.num_channels = vals[2];
+  info.chunk_size = vals[3];
+  for (int k = 0; k < 3; k++) read_value(ifs, info.shift[k]);
+  std::int32_t wkt_len = 0;
+  read_value(ifs, wkt_len);
+  if (!ifs.good() || info.cols < 0 || info.rows < 0 || info.chunk_size <= 0 ||
+      info.num_channels < 3 || wkt_len < 0)
+    vw_throw(IOErr() << "Corrupt chunked point cloud header: " << file << ".\n");
+  info.wkt.resize(wkt_len);
+  if (wkt_len > 0)
+    ifs.read(&info.wkt[0], wkt_len);
+
+  std::int64_t index_pos = 0;
+  read_value(ifs, index_pos);
+  if (!ifs.good() || index_pos <= 0)
+    vw_throw(IOErr() << "Incomplete chunked point cloud: " << file << ".\n");
+
+  int num_chunk_rows = (info.rows + info.chunk_size - 1) / info.chunk_size;
+  size_t num_chunks = size_t(num_chunk_rows) * info.num_chunk_cols();
+  ifs.seekg(index_pos);
+  info.chunks.resize(num_chunks);
+  for (size_t c = 0; c < num_chunks; c++)
+    read_index_entry(ifs, info.chunks[c]);
+  if (!ifs.good())
+    vw_throw(IOErr() << "Corrupt chunked point cloud index: " << file << ".\n");
+}
+
+void encode_point_cloud_chunk(std::vector<double> const& values, int num_channels,
+                              Vector3 const& shift, PointCloudChunk & chunk,
+                              std::string & data) {
+
+  size_t num_pixels = values.size() / num_channels;
+  std::vector<char> mask((num_pixels + 7) / 8, 0);
+
+  // Collect the valid values per channel, with the shift subtracted, as
+  // they would be stored in a PC.tif file.
+  std::vector<std::vector<double>> vals(num_channels);
+  chunk.num_valid = 0;
+  chunk.point_box = BBox3();
+  for (size_t i = 0; i < num_pixels; i++) {
+    const double * v = &values[i*num_channels];
+    if (!is_valid_point(v))
+      continue;
+    mask[i/8] |= (1 << (i % 8));
+    chunk.num_valid++;
+    chunk.point_box.grow(Vector3(v[0], v[1], v[2]));
+    for (int k = 0; k < num_channels; k++)
+      vals[k].push_back(k < 3 ? v[k] - shift[k] : v[k]);
+  }
+
+  chunk.is_double = false;
+  chunk.offset = Vector3();
+  chunk.num_bytes = 0;
+  data.clear();
+  if (chunk.num_valid == 0)
+    return;
+
+  // The offset is a whole number of meters near the first point, so that
+  // the values relative to it are small.
+  for (int k = 0; k < 3; k++)
+    chunk.offset[k] = std::floor(vals[k][0]);
+
+  // Store floats only if each value is recovered exactly
+  for (int k = 0; k < num_channels && !chunk.is_double; k++) {
+    double off = (k < 3) ? chunk.offset[k] : 0.0;
+    for (size_t i = 0; i < vals[k].size(); i++) {
+      float f = float(vals[k][i] - off);
+      if (double(f) + off != vals[k][i]) {
+        chunk.is_double = true;
+        break;
+      }
+    }
+  }
+
+  size_t val_size = chunk.is_double ? sizeof(double) : sizeof(float);
+  size_t n = chunk.num_valid;
+  std::string raw(mask.begin(), mask.end());
+  std::vector<char> buf(n * val_size), shuffled(n * val_size);
+  for (int k = 0; k < num_channels; k++) {
+    double off = (k < 3 && !chunk.is_double) ? chunk.offset[k] : 0.0;
+    for (size_t i = 0; i < n; i++) {
+      if (chunk.is_double) {
+        double d = vals[k][i];
+        std::memcpy(&buf[i*val_size], &d, val_size);
+      } else {
+        float f = float(vals[k][i] - off);
+        std::memcpy(&buf[i*val_size], &f, val_size);
+      }
+    }
+    shuffle_bytes(&buf[0], n, val_size, &shuffled[0]);
+    raw.append(shuffled.begin(), shuffled.end());
+  }
+  if (chunk.is_double)
+    chunk.offset = Vector3(); // not used
+
+  namespace io = boost::iostreams;
+  io::filtering_ostream out;
+  out.push(io::zlib_compressor());
+  out.push(io::back_inserter(data));
+  out.write(raw.data(), raw.size());
+  io::close(out);
+  chunk.num_bytes = data.size();
+}
+
+void read_point_cloud_chunk(std::string const& file, ChunkedPointCloudInfo const& info,
+                            int chunk_index, std::vector<double> & values) {
+
+  PointCloudChunk const& chunk = info.chunks[chunk_index];
+  int nc = info.num_channels;
+  size_t num_pixels = size_t(chunk.pixel_box.width()) * chunk.pixel_box.height();
+  values.assign(num_pixels * nc, 0.0);
+  if (chunk.num_valid == 0)
+    return;
+
+  std::string data(chunk.num_bytes, '\0');
+  {
+    std::ifstream ifs(file.c_str(), std::ios::binary);
+    ifs.seekg(chunk.file_offset);
+    ifs.read(&data[0], chunk.num_bytes);
+    if (!ifs.good())
+      vw_throw(IOErr() << "Cannot read chunk " << chunk_index << " of: " << file << ".\n");
+  }
+
+  namespace io = boost::iostreams;
+  std::string raw;
+  io::filtering_istream in;
+  in.push(io::zlib_decompressor());
+  in.push(io::array_source(data.data(), data.size()));
+  io::copy(in, io::back_inserter(raw));
+
+  size_t val_size = chunk.is_double ? sizeof(double) : sizeof(float);
+  size_t n = chunk.num_valid, mask_len = (num_pixels + 7) / 8;
+  if (raw.size() != mask_len + nc * n * val_size)
+    vw_throw(IOErr() << "Corrupt chunk " << chunk_index << " of: " << file << ".\n");
+
+  // The pixel index of each valid point
+  std::vector<size_t> pix;
+  pix.reserve(n);
+  for (size_t i = 0; i < num_pixels; i++)
+    if (raw[i/8] & (1 << (i % 8)))
+      pix.push_back(i);
+  if (pix.size() != n)
+    vw_throw(IOErr() << "Corrupt chunk " << chunk_index << " of: " << file << ".\n");
+
+  std::vector<char> buf(n * val_size);
+  for (int k = 0; k < nc; k++) {
+    unshuffle_bytes(&raw[mask_len + k * n * val_size], n, val_size, &buf[0]);
+    for (size_t i = 0; i < n; i++) {
+      double d;
+      if (chunk.is_double) {
+        std::memcpy(&d, &buf[i*val_size], val_size);
+      } else {
+        float f;
+        std::memcpy(&f, &buf[i*val_size], val_size);
+        // Restore the value relative to the shift first, as stored, then
+        // add the shift, as done for PC.tif files.
+        d = (k < 3) ? (double(f) + chunk.offset[k]) : double(f);
+      }
+      if (k < 3)
+        d += info.shift[k];
+      values[pix[i]*nc + k] = d;
+    }
+  }
+}
+
+ChunkedPointCloudWriter::ChunkedPointCloudWriter(std::string const& file,
+                                                 int cols, int rows, int num_channels,
+                                                 int chunk_size, Vector3 const& shift,
+                                                 std::string const& wkt):
+  m_file(file), m_closed(false) {
+
+  if (num_channels < 3 || num_channels > 6 || chunk_size <= 0)
+    vw_throw(ArgumentErr() << "Cannot write a chunked point cloud with "
+             << num_channels << " channels and chunk size " << chunk_size << ".\n");
+
+  m_info.cols = cols; m_info.rows = rows; m_info.num_channels = num_channels;
+  m_info.chunk_size = chunk_size; m_info.shift = shift; m_info.wkt = wkt;
+
+  m_ofs.open(file.c_str(), std::ios::binary);
+  if (!m_ofs.good())
+    vw_throw(IOErr() << "Cannot write: " << file << ".\n");
+
+  m_ofs.write(CHUNKED_POINT_CLOUD_MAGIC, MAGIC_LEN);
+  std::int32_t vals[4] = {cols, rows, num_channels, chunk_size};
+  for (int k = 0; k < 4; k++) write_value(m_ofs, vals[k]);
+  for (int k = 0; k < 3; k++) write_value(m_ofs, shift[k]);
+  std::int32_t wkt_len = wkt.size();
+  write_value(m_ofs, wkt_len);
+  m_ofs.write(wkt.data(), wkt_len);
+
+  // The position of the index is set on close, so that an interrupted
+  // write is recognized as such.
+  m_index_pos_offset = m_ofs.tellp();
+  std::int64_t index_pos = 0;
+  write_value(m_ofs, index_pos);
+}
+
+ChunkedPointCloudWriter::~ChunkedPointCloudWriter() {
+  if (!m_closed)
+    m_ofs.close();
+}
+
+void ChunkedPointCloudWriter::write_chunk(PointCloudChunk const& chunk,
+                                          std::string const& data) {
+  PointCloudChunk c = chunk;
+  c.file_offset = m_ofs.tellp();
+  c.num_bytes   = data.size();
+  m_ofs.write(data.data(), data.size());
+  m_info.chunks.push_back(c);
+}
+
+void ChunkedPointCloudWriter::close() {
+
+  int num_chunk_rows = (m_info.rows + m_info.chunk_size - 1) / m_info.chunk_size;
+  size_t num_chunks = size_t(num_chunk_rows) * m_info.num_chunk_cols();
+  if (m_info.chunks.size() != num_chunks)
+    vw_throw(ArgumentErr() << "Expecting " << num_chunks << " chunks in " << m_file
+             << ", got " << m_info.chunks.size() << ".\n");
+
+  std::int64_t index_pos = m_ofs.tellp();
+  for (size_t c = 0; c < num_chunks; c++)
+    write_index_entry(m_ofs, m_info.chunks[c]);
+
+  m_ofs.seekp(m_index_pos_offset);
+  write_value(m_ofs, index_pos);
+  m_ofs.close();
+  if (m_ofs.fail())
+    vw_throw(IOErr() << "Failed writing: " << m_file << ".\n");
+  m_closed = true;
+}
+
+PointCloudChunkCache::PointCloudChunkCache(std::string const& file,
+                                           ChunkedPointCloudInfo const& info,
+                                           int max_num_chunks):
+  m_file(file), m_info(info), m_max_num_chunks(max_num_chunks) {}
+
+boost::shared_ptr<const std::vector<double>> PointCloudChunkCache::get(int chunk_index) {
+  {
+    Mutex::Lock lock(m_mutex);
+    auto it = m_chunks.find(chunk_index);
+    if (it != m_chunks.end())
+      return it->second;
+  }
+
+  // Decode outside the lock, so that threads can read different chunks
+  // at the same time.
+  boost::shared_ptr<std::vector<double>> values(new std::vector<double>);
+  read_point_cloud_chunk(m_file, m_info, chunk_index, *values);
+
+  Mutex::Lock lock(m_mutex);
+  auto it = m_chunks.find(chunk_index);
+  if (it != m_chunks.end())
+    return it->second; // another thread was faster
+  m_chunks[chunk_index] = values;
+  m_order.push_back(chunk_index);
+  while (int(m_order.size()) > m_max_num_chunks) {
+    m_chunks.erase(m_order.front());
+    m_order.pop_front();
+  }
+  return values;
+}
+
+} // end namespace asp
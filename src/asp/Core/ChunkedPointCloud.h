@@ -0,0 +1,279 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file ChunkedPointCloud.h
+///
+/// A point cloud format, with the .apc extension, which stores the same
+/// pixels as an ASP PC.tif file, but in square chunks, each compressed
+/// losslessly on its own. Only the valid points of a chunk are stored,
+/// as floats relative to an offset for that chunk if that is exact, and
+/// as doubles otherwise. An index at the end of the file has the
+/// location of each chunk and the bounding box of its points, so a
+/// reader decodes only the chunks under the pixels it needs, and may
+/// skip the chunks whose points are all outside a region of interest.
+/// Empty chunks take no space.
+
+#ifndef __ASP_CORE_CHUNKED_POINT_CLOUD_H__
+#define __ASP_CORE_CHUNKED_POINT_CLOUD_H__
+
+#include <vw/Core/Thread.h>
+#include <vw/Core/ProgressCallback.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/BlockRasterize.h>
+#include <vw/Math/Vector.h>
+#include <vw/Math/BBox.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <list>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace asp {
+
+  /// The extension of chunked point cloud files
+  const std::string CHUNKED_POINT_CLOUD_EXT = ".apc";
+
+  /// Where a chunk is in the file, and what it contains
+  struct PointCloudChunk {
+    std::int64_t file_offset, num_bytes; // num_bytes is 0 for empty chunks
+    std::int32_t num_valid;
+    bool         is_double;   // if the values could not be stored exactly as floats
+    vw::Vector3  offset;      // added to the first 3 channels, on top of the shift
+    vw::BBox2i   pixel_box;   // in the cloud
+    vw::BBox3    point_box;   // of the valid points, with the shift added; empty if none
+  };
+
+  /// Given the bounding box of the points of a chunk, return false if
+  /// none of them can be of interest, so the chunk need not be read.
+  typedef std::function<bool(vw::BBox3 const&)> ChunkFilter;
+
+  /// The header and the index of a chunked point cloud
+  struct ChunkedPointCloudInfo {
+    int cols, rows, num_channels, chunk_size;
+    vw::Vector3 shift;
+    std::string wkt;          // of the georeference, if any
+    std::vector<PointCloudChunk> chunks; // row-major
+    ChunkedPointCloudInfo(): cols(0), rows(0), num_channels(0), chunk_size(0) {}
+
+    int num_chunk_cols() const { return (cols + chunk_size - 1) / chunk_size; }
+  };
+
+  /// If the file has the extension of chunked point clouds
+  bool is_chunked_point_cloud(std::string const& file);
+
+  /// Read the header and the index of a chunked point cloud
+  void read_chunked_point_cloud_info(std::string const& file, ChunkedPointCloudInfo & info);
+
+  /// Read and decode one chunk. The values are stored row-major over the
+  /// pixel box of the chunk, num_channels per pixel, with the shift added
+  /// back and zeros for invalid pixels, as for PC.tif files.
+  void read_point_cloud_chunk(std::string const& file, ChunkedPointCloudInfo const& info,
+                              int chunk_index, std::vector<double> & values);
+
+  /// Encode one chunk given as above. The shift is subtracted from the
+  /// first 3 channels, as when writing PC.tif files. The chunk fields
+  /// other than the file offset are filled in.
+  void encode_point_cloud_chunk(std::vector<double> const& values, int num_channels,
+                                vw::Vector3 const& shift, PointCloudChunk & chunk,
+                                std::string & data);
+
+  /// Write the encoded chunks in order, then the index
+  class ChunkedPointCloudWriter {
+  public:
+    ChunkedPointCloudWriter(std::string const& file, int cols, int rows, int num_channels,
+                            int chunk_size, vw::Vector3 const& shift, std::string const& wkt);
+    ~ChunkedPointCloudWriter();
+
+    void write_chunk(PointCloudChunk const& chunk, std::string const& data);
+
+    /// Write the index. Throws if not all chunks were written.
+    void close();
+
+  private:
+    std::string m_file;
+    std::ofstream m_ofs;
+    ChunkedPointCloudInfo m_info;
+    std::int64_t m_index_pos_offset; // where the position of the index is written
+    bool m_closed;
+  };
+
+  /// A small cache of decoded chunks, shared by copies of a view
+  class PointCloudChunkCache {
+  public:
+    PointCloudChunkCache(std::string const& file, ChunkedPointCloudInfo const& info,
+                         int max_num_chunks);
+    boost::shared_ptr<const std::vector<double>> get(int chunk_index);
+
+  private:
+    std::string m_file;
+    ChunkedPointCloudInfo const& m_info;
+    int m_max_num_chunks;
+    vw::Mutex m_mutex;
+    std::map<int, boost::shared_ptr<const std::vector<double>>> m_chunks;
+    std::list<int> m_order; // oldest first
+  };
+
+  /// A chunked point cloud as an image with the first m channels. If a
+  /// filter is given, the chunks it rejects are not read, and their
+  /// points are returned as invalid. The points of the other chunks are
+  /// returned as they are, even if outside the region of interest.
+  template<int m>
+  class ChunkedPointCloudView: public vw::ImageViewBase<ChunkedPointCloudView<m>> {
+    boost::shared_ptr<ChunkedPointCloudInfo> m_info;
+    boost::shared_ptr<PointCloudChunkCache>  m_cache;
+    ChunkFilter m_filter;
+
+  public:
+    typedef vw::Vector<double, m> pixel_type;
+    typedef pixel_type result_type;
+    typedef vw::ProceduralPixelAccessor<ChunkedPointCloudView> pixel_accessor;
+
+    ChunkedPointCloudView(std::string const& file, ChunkFilter const& filter = ChunkFilter()):
+      m_info(new ChunkedPointCloudInfo), m_filter(filter) {
+      read_chunked_point_cloud_info(file, *m_info);
+      VW_ASSERT(m >= 1 && m <= m_info->num_channels,
+                vw::ArgumentErr() << "Cannot read " << m << " channels from: " << file
+                << ", which has " << m_info->num_channels << ".\n");
+      m_cache = boost::shared_ptr<PointCloudChunkCache>
+        (new PointCloudChunkCache(file, *m_info, 16));
+    }
+
+    inline vw::int32 cols  () const { return m_info->cols; }
+    inline vw::int32 rows  () const { return m_info->rows; }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this); }
+
+    inline result_type operator()(int i, int j, int /*p*/ = 0) const {
+      return prerasterize(vw::BBox2i(i, j, 1, 1))(i, j);
+    }
+
+    ChunkedPointCloudInfo const& info() const { return *m_info; }
+
+    /// \cond INTERNAL
+    typedef vw::CropView<vw::ImageView<pixel_type>> prerasterize_type;
+    prerasterize_type prerasterize(vw::BBox2i const& bbox) const {
+
+      vw::ImageView<pixel_type> tile(bbox.width(), bbox.height());
+      int nc = m_info->num_channels, cs = m_info->chunk_size;
+      int num_chunk_cols = m_info->num_chunk_cols();
+      int c0 = std::max(bbox.min().x(), 0) / cs, c1 = (std::min(bbox.max().x(), cols()) - 1) / cs;
+      int r0 = std::max(bbox.min().y(), 0) / cs, r1 = (std::min(bbox.max().y(), rows()) - 1) / cs;
+      for (int cr = r0; cr <= r1; cr++) {
+        for (int cc = c0; cc <= c1; cc++) {
+          int chunk_index = cr * num_chunk_cols + cc;
+          PointCloudChunk const& chunk = m_info->chunks[chunk_index];
+          vw::BBox2i box = chunk.pixel_box;
+          box.crop(bbox);
+          if (box.empty())
+            continue;
+          if (chunk.num_valid == 0 || (m_filter && !m_filter(chunk.point_box)))
+            continue; // the tile is already zero, which is invalid
+          boost::shared_ptr<const std::vector<double>> values = m_cache->get(chunk_index);
+          for (int row = box.min().y(); row < box.max().y(); row++) {
+            for (int col = box.min().x(); col < box.max().x(); col++) {
+              const double * v = &(*values)[nc*((row - chunk.pixel_box.min().y())
+                                                * chunk.pixel_box.width()
+                                                + col - chunk.pixel_box.min().x())];
+              pixel_type & p = tile(col - bbox.min().x(), row - bbox.min().y());
+              for (int k = 0; k < m; k++)
+                p[k] = v[k];
+            }
+          }
+        }
+      }
+
+      return prerasterize_type(tile, vw::BBox2i(-bbox.min().x(), -bbox.min().y(),
+                                                cols(), rows()));
+    }
+
+    template <class DestT> inline void rasterize(DestT const& dest, vw::BBox2i const& bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+    /// \endcond
+  };
+
+  /// Write a point cloud with 3 to 6 channels in the chunked format. The
+  /// shift is subtracted as when writing PC.tif files. The image is
+  /// rasterized one row of chunks at a time, and the chunks in a row are
+  /// compressed in parallel.
+  template <class ImageT>
+  void write_chunked_point_cloud(std::string const& file,
+                                 vw::ImageViewBase<ImageT> const& image,
+                                 vw::Vector3 const& shift, std::string const& wkt,
+                                 int chunk_size, int num_threads,
+                                 vw::ProgressCallback const& tpc) {
+
+    typedef typename ImageT::pixel_type PixelT;
+    const int nc = vw::math::VectorSize<PixelT>::value;
+    int cols = image.impl().cols(), rows = image.impl().rows();
+    if (num_threads <= 0)
+      num_threads = 1;
+
+    ChunkedPointCloudWriter writer(file, cols, rows, nc, chunk_size, shift, wkt);
+    int num_chunk_cols = (cols + chunk_size - 1) / chunk_size;
+    for (int row = 0; row < rows; row += chunk_size) {
+      tpc.report_fractional_progress(row, rows);
+
+      vw::BBox2i band_box(0, row, cols, std::min(chunk_size, rows - row));
+      vw::ImageView<PixelT> band
+        = vw::block_rasterize(crop(image.impl(), band_box),
+                              vw::Vector2i(chunk_size, chunk_size), num_threads);
+
+      std::vector<PointCloudChunk> chunks(num_chunk_cols);
+      std::vector<std::string> data(num_chunk_cols);
+      std::vector<std::thread> threads;
+      for (int t = 0; t < num_threads; t++) {
+        threads.push_back(std::thread([&, t]() {
+          std::vector<double> values;
+          for (int cc = t; cc < num_chunk_cols; cc += num_threads) {
+            vw::BBox2i box(cc*chunk_size, 0, std::min(chunk_size, cols - cc*chunk_size),
+                           band.rows());
+            values.resize(size_t(nc) * box.width() * box.height());
+            size_t count = 0;
+            for (int r = box.min().y(); r < box.max().y(); r++) {
+              for (int c = box.min().x(); c < box.max().x(); c++) {
+                for (int k = 0; k < nc; k++)
+                  values[count++] = band(c, r)[k];
+              }
+            }
+            encode_point_cloud_chunk(values, nc, shift, chunks[cc], data[cc]);
+            chunks[cc].pixel_box = box + vw::Vector2i(0, row);
+          }
+        }));
+      }
+      for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+
+      for (int cc = 0; cc < num_chunk_cols; cc++)
+        writer.write_chunk(chunks[cc], data[cc]);
+    }
+    writer.close();
+    tpc.report_finished();
+  }
+
+} // end namespace asp
+
+#endif//__ASP_CORE_CHUNKED_POINT_CLOUD_H__
@@ -17,6 +17,7 @@
 
 #include <vw/Core/Log.h>
 #include <vw/Core/System.h>
+#include <vw/Core/StringUtils.h>
 #include <vw/Math/BBox.h>
 #include <vw/FileIO/DiskImageResource.h>
 #include <asp/Core/Common.h>
@@ -45,6 +46,8 @@
 // TODO(oalexan1): Move this to VW in the cartography module.
 #if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
 #include "ogr_spatialref.h"
+#include <gdal.h>
+#include <cpl_string.h>
 #endif
 
 // These variables must never go out of scope or else the
@@ -574,6 +577,29 @@ asp::check_command_line(int argc, char *argv[], vw::GdalWriteOptions& opt,
     opt.gdal_options["BIGTIFF"] = "IF_SAFER";
   }
 
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(2,4,0)
+  // Let GDAL compress the blocks of GeoTIFF outputs on worker threads,
+  // while it writes them to disk from the thread that hands them over.
+  // The blocks are still formed in parallel as before. Only the GeoTIFF
+  // driver, which writes the tool outputs, and the COG driver, for which
+  // write_cog() sets it, know this option. Add it only if the GeoTIFF
+  // driver lists it, as other drivers warn about it.
+  GDALAllRegister();
+  GDALDriverH gtiff_driver = GDALGetDriverByName("GTiff");
+  const char * gtiff_opts = NULL;
+  if (gtiff_driver != NULL)
+    gtiff_opts = GDALGetMetadataItem(gtiff_driver, GDAL_DMD_CREATIONOPTIONLIST, NULL);
+  if (gtiff_opts != NULL && std::string(gtiff_opts).find("NUM_THREADS") != std::string::npos &&
+      opt.gdal_options.find("NUM_THREADS") == opt.gdal_options.end()) {
+    if (opt.num_threads > 0)
+      opt.gdal_options["NUM_THREADS"] = vw::num_to_str(opt.num_threads);
+    else
+      opt.gdal_options["NUM_THREADS"] = "ALL_CPUS";
+  }
+#endif
+#endif
+
   if ( vm.count("help") )
     vw::vw_throw(vw::ArgumentErr() << usage_comment << public_options);
 
@@ -671,6 +697,62 @@ void asp::set_srs_string(std::string srs_string, bool have_user_datum,
 
 }
 
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+// Pass the progress of a GDAL operation to a VW progress callback
+static int CPL_STDCALL gdal_progress(double complete, const char * /*message*/,
+                                     void * data) {
+  static_cast<vw::ProgressCallback const*>(data)->report_progress(complete);
+  return TRUE;
+}
+#endif
+
+void asp::write_cog(std::string const& input_file, std::string const& output_file,
+                    vw::GdalWriteOptions const& opt, vw::ProgressCallback const& tpc) {
+
+#if defined(VW_HAVE_PKG_GDAL) && VW_HAVE_PKG_GDAL==1
+  GDALAllRegister();
+  GDALDriverH driver = GDALGetDriverByName("COG");
+  if (driver == NULL)
+    vw_throw(NoImplErr() << "Cannot write a Cloud Optimized GeoTIFF, as GDAL was built "
+             << "without the COG driver. That needs GDAL 3.1 or later.\n");
+
+  GDALDatasetH src = GDALOpen(input_file.c_str(), GA_ReadOnly);
+  if (src == NULL)
+    vw_throw(IOErr() << "Cannot open: " << input_file << "\n");
+
+  // The COG driver lays out the tiles and the overviews the way COG
+  // readers expect. Of the options used for GeoTIFF files, only the
+  // ones it also understands are passed on.
+  char **options = NULL;
+  options = CSLSetNameValue(options, "BLOCKSIZE",
+                            vw::num_to_str(int(opt.raster_tile_size[0])).c_str());
+  options = CSLSetNameValue(options, "OVERVIEWS", "AUTO");
+  options = CSLSetNameValue(options, "RESAMPLING", "AVERAGE");
+  std::string num_threads = "ALL_CPUS";
+  if (opt.num_threads > 0)
+    num_threads = vw::num_to_str(opt.num_threads);
+  options = CSLSetNameValue(options, "NUM_THREADS", num_threads.c_str());
+  options = CSLSetNameValue(options, "COMPRESS", "LZW");
+  const char * cog_keys[] = {"COMPRESS", "PREDICTOR", "BIGTIFF"};
+  for (size_t i = 0; i < sizeof(cog_keys)/sizeof(cog_keys[0]); i++) {
+    std::map<std::string, std::string>::const_iterator it = opt.gdal_options.find(cog_keys[i]);
+    if (it != opt.gdal_options.end())
+      options = CSLSetNameValue(options, it->first.c_str(), it->second.c_str());
+  }
+
+  GDALDatasetH dst = GDALCreateCopy(driver, output_file.c_str(), src, FALSE, options,
+                                    gdal_progress, const_cast<vw::ProgressCallback*>(&tpc));
+  CSLDestroy(options);
+  GDALClose(src);
+  if (dst == NULL)
+    vw_throw(IOErr() << "Failed to write: " << output_file << "\n");
+  GDALClose(dst);
+  tpc.report_finished();
+#else
+  vw_throw( NoImplErr() << "Writing a Cloud Optimized GeoTIFF is not available without GDAL support. Please rebuild VW and ASP with GDAL." );
+#endif
+}
+
 // Read a vector of strings from a file, with spaces and newlines acting as separators.
 // Throw an exception if the list is empty.
 void asp::read_list(std::string const& file, std::vector<std::string> & list) {
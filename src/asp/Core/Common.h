@@ -29,6 +29,7 @@
 
 #include <vw/config.h> // must come before asp_config.h, defines VW_BOOST_VERSION
 #include <asp/asp_config.h>
+#include <asp/Core/Tracing.h>
 
 #include <vw/Core/StringUtils.h>
 #include <vw/Image/ImageIO.h>
@@ -248,6 +249,8 @@ namespace asp {
 
   /// Often times, we'd like to save an image to disk by using big
   /// blocks, for performance reasons, then re-write it with desired blocks.
+  /// If cog is true, the re-write produces a Cloud Optimized GeoTIFF,
+  /// with overviews, instead.
   template <class ImageT>
   void save_with_temp_big_blocks(int big_block_size,
                                  const std::string &filename,
@@ -256,7 +259,15 @@ namespace asp {
                                  vw::cartography::GeoReference const& georef,
                                  bool has_nodata, double nodata,
                                  vw::GdalWriteOptions & opt,
-                                 vw::ProgressCallback const& tpc);
+                                 vw::ProgressCallback const& tpc,
+                                 bool cog = false);
+
+  /// Copy a GeoTIFF to a Cloud Optimized GeoTIFF, with internal tiles of
+  /// size opt.raster_tile_size and overviews made by averaging. This
+  /// needs the COG driver of GDAL 3.1 or later.
+  void write_cog(std::string const& input_file, std::string const& output_file,
+                 vw::GdalWriteOptions const& opt,
+                 vw::ProgressCallback const& tpc = vw::ProgressCallback::dummy_instance());
 
 
   // TODO: Replace with something else!
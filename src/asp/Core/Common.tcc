@@ -40,6 +40,8 @@ namespace asp {
                                      vw::ProgressCallback const& progress_callback,
                                      std::map<std::string, std::string> const& keywords) {
 
+    // This covers computing the tiles being written as well
+    TraceSpan span("write_image", "io");
 
     if (norm_2(shift) > 0){
 
@@ -76,6 +78,7 @@ namespace asp {
                                vw::ProgressCallback const& progress_callback,
                                std::map<std::string, std::string> const& keywords){
 
+    TraceSpan span("write_image", "io");
     if (norm_2(shift) > 0){
 
       // Add the point shift to keywords
@@ -103,10 +106,26 @@ namespace asp {
                                  vw::cartography::GeoReference const& georef,
                                  bool has_nodata, double nodata,
                                  vw::GdalWriteOptions & opt,
-                                 vw::ProgressCallback const& tpc){
+                                 vw::ProgressCallback const& tpc,
+                                 bool cog){
 
+    TraceSpan span("write_image", "io");
     vw::Vector2 orig_block_size = opt.raster_tile_size;
     opt.raster_tile_size = vw::Vector2(big_block_size, big_block_size);
+
+    if (cog) {
+      // The COG driver can only copy a complete dataset, so that copy
+      // takes the place of the re-write with the desired blocks.
+      std::string tmp_file
+        = boost::filesystem::path(filename).replace_extension(".tmp.tif").string();
+      block_write_gdal_image(tmp_file, img, has_georef, georef, has_nodata, nodata, opt, tpc);
+      opt.raster_tile_size = orig_block_size;
+      vw::vw_out() << "Re-writing as a Cloud Optimized GeoTIFF.\n";
+      write_cog(tmp_file, filename, opt, tpc);
+      boost::filesystem::remove(tmp_file);
+      return;
+    }
+
     block_write_gdal_image(filename, img, has_georef, georef, has_nodata, nodata, opt, tpc);
 
     if (opt.raster_tile_size != orig_block_size){
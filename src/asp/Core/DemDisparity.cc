@@ -30,8 +30,15 @@
 #include <vw/FileIO/MatrixIO.h>
 #include <asp/Core/StereoSettings.h>
 #include <asp/Core/DemDisparity.h>
+#include <asp/Core/Hash.h>
 
 #include <boost/filesystem/operations.hpp>
+
+#include <cstdint>
+#include <iomanip>
+#include <sstream>
+#include <unistd.h>
+
 namespace fs = boost::filesystem;
 
 using namespace vw;
@@ -39,6 +46,10 @@ using namespace vw::cartography;
 
 namespace asp {
 
+  // The spacing, in low-res pixels, of the grid of left camera rays
+  // which are interpolated in between
+  const int RAY_GRID_SPACING = 8;
+
   template <class ImageT, class DEMImageT>
   class DemDisparity : public ImageViewBase<DemDisparity<ImageT, DEMImageT> > {
     ImageT            m_left_image;
@@ -53,6 +64,104 @@ namespace asp {
     int             m_pixel_sample;
     ImageView<PixelMask<Vector2i> > & m_disparity_spread;
 
+    // The left camera ray through a low-res pixel
+    bool left_ray(Vector2 const& left_lowres_pix, Vector3 & ctr, Vector3 & vec) const {
+      Vector2 left_fullres_pix = elem_quot(left_lowres_pix, m_downsample_scale);
+      if (m_do_align){
+        // Need to go to the image pixel in the untransformed image
+        left_fullres_pix = HomographyTransform(m_align_left_matrix).reverse(left_fullres_pix);
+      }
+      try {
+        ctr = m_left_camera_model->camera_center(left_fullres_pix);
+        vec = m_left_camera_model->pixel_to_vector(left_fullres_pix);
+      } catch (...) {
+        return false;
+      }
+      return true;
+    }
+
+    // The left camera rays at the nodes of a grid over a tile, every
+    // RAY_GRID_SPACING low-res pixels. The rays vary slowly, so in
+    // between they are interpolated, which is much cheaper than asking
+    // the camera, particularly for linescan cameras.
+    struct RayGrid {
+      Vector2i origin;
+      int num_cols, num_rows;
+      std::vector<Vector3> ctrs, vecs;
+      std::vector<bool> valid;
+    };
+
+    void build_ray_grid(BBox2i const& bbox, RayGrid & grid) const {
+      grid.origin   = bbox.min();
+      grid.num_cols = (bbox.width()  - 1 + RAY_GRID_SPACING - 1) / RAY_GRID_SPACING + 1;
+      grid.num_rows = (bbox.height() - 1 + RAY_GRID_SPACING - 1) / RAY_GRID_SPACING + 1;
+      int num = grid.num_cols * grid.num_rows;
+      grid.ctrs.resize(num);
+      grid.vecs.resize(num);
+      grid.valid.resize(num);
+      for (int r = 0; r < grid.num_rows; r++) {
+        for (int c = 0; c < grid.num_cols; c++) {
+          int k = r * grid.num_cols + c;
+          Vector2 pix = Vector2(grid.origin) + double(RAY_GRID_SPACING) * Vector2(c, r);
+          grid.valid[k] = left_ray(pix, grid.ctrs[k], grid.vecs[k]);
+        }
+      }
+    }
+
+    // Interpolate the left ray. Return false if a node is invalid.
+    bool interp_ray(RayGrid const& grid, Vector2 const& pix,
+                    Vector3 & ctr, Vector3 & vec) const {
+      if (grid.num_cols < 2 || grid.num_rows < 2)
+        return false;
+      double x = (pix.x() - grid.origin.x()) / RAY_GRID_SPACING;
+      double y = (pix.y() - grid.origin.y()) / RAY_GRID_SPACING;
+      int c = std::min(std::max(int(floor(x)), 0), grid.num_cols - 2);
+      int r = std::min(std::max(int(floor(y)), 0), grid.num_rows - 2);
+      double wx = x - c, wy = y - r;
+      int k00 = r * grid.num_cols + c, k10 = k00 + 1;
+      int k01 = k00 + grid.num_cols,   k11 = k01 + 1;
+      if (!grid.valid[k00] || !grid.valid[k10] || !grid.valid[k01] || !grid.valid[k11])
+        return false;
+      ctr = (1.0 - wy) * ((1.0 - wx) * grid.ctrs[k00] + wx * grid.ctrs[k10])
+        + wy * ((1.0 - wx) * grid.ctrs[k01] + wx * grid.ctrs[k11]);
+      vec = normalize((1.0 - wy) * ((1.0 - wx) * grid.vecs[k00] + wx * grid.vecs[k10])
+                      + wy * ((1.0 - wx) * grid.vecs[k01] + wx * grid.vecs[k11]));
+      return true;
+    }
+
+    // Check if the interpolated rays are within a tenth of a low-res
+    // pixel of the exact ones, where the interpolation is worst, at the
+    // middle of a grid cell near the tile center.
+    bool ray_grid_is_accurate(RayGrid const& grid, ImageView<PixelMask<float>> const& dem_crop,
+                              GeoReference const& georef_crop,
+                              double height_error_tol, double max_abs_tol,
+                              double max_rel_tol, int num_max_iter) const {
+      int c = std::max(grid.num_cols / 2 - 1, 0), r = std::max(grid.num_rows / 2 - 1, 0);
+      Vector2 pix = Vector2(grid.origin)
+        + double(RAY_GRID_SPACING) * (Vector2(c, r) + Vector2(0.5, 0.5));
+      int k = r * grid.num_cols + c;
+      Vector3 interp_ctr, interp_vec, ctr, vec;
+      if (c + 1 >= grid.num_cols || r + 1 >= grid.num_rows || !grid.valid[k] ||
+          !grid.valid[k + 1] || !interp_ray(grid, pix, interp_ctr, interp_vec) ||
+          !left_ray(pix, ctr, vec))
+        return false;
+
+      bool has_intersection = false, treat_nodata_as_zero = false;
+      Vector3 xyz = camera_pixel_to_dem_xyz(ctr, vec, dem_crop, georef_crop,
+                                            treat_nodata_as_zero, has_intersection,
+                                            height_error_tol, max_abs_tol,
+                                            max_rel_tol, num_max_iter, Vector3());
+      if (!has_intersection || xyz == Vector3())
+        return false;
+      double range = norm_2(xyz - ctr);
+
+      // The angle subtended by a low-res pixel, and the error of the
+      // interpolated ray, as an angle seen from the ground point
+      double pixel_angle = norm_2(grid.vecs[k + 1] - grid.vecs[k]) / RAY_GRID_SPACING;
+      double error = norm_2(interp_vec - vec) + norm_2(interp_ctr - ctr) / range;
+      return error < 0.1 * pixel_angle;
+    }
+
   public:
     DemDisparity( ImageViewBase<ImageT> const& left_image,
                   double dem_error, GeoReference dem_georef,
@@ -131,22 +240,10 @@ namespace asp {
       BBox2i dem_box;
       for (unsigned k = 0; k < diagonals.size(); k++){
 
-        Vector2 left_lowres_pix = diagonals[k];
-
-        Vector2 left_fullres_pix = elem_quot(left_lowres_pix, m_downsample_scale);
-        if (m_do_align){
-          // Need to go to the image pixel in the untransformed image
-          left_fullres_pix = HomographyTransform(m_align_left_matrix).reverse(left_fullres_pix);
-        }
-
         bool has_intersection;
         Vector3 left_camera_ctr, left_camera_vec;
-        try {
-          left_camera_ctr = m_left_camera_model->camera_center(left_fullres_pix);
-          left_camera_vec = m_left_camera_model->pixel_to_vector(left_fullres_pix);
-        } catch (...) {
+        if (!left_ray(diagonals[k], left_camera_ctr, left_camera_vec))
           continue;
-        }
         Vector3 xyz = camera_pixel_to_dem_xyz(left_camera_ctr, left_camera_vec,
                                               m_dem, m_dem_georef,
                                               treat_nodata_as_zero,
@@ -173,6 +270,21 @@ namespace asp {
       GeoReference georef_crop = crop(m_dem_georef, dem_box);
       ImageView <PixelMask<float> > dem_crop = crop(m_dem, dem_box);
 
+      // Interpolate the left rays, if accurate enough and if there are
+      // many more sampled pixels than grid nodes
+      RayGrid ray_grid;
+      bool use_ray_grid = false;
+      double num_samples = (double(bbox.width()) / m_pixel_sample)
+        * (double(bbox.height()) / m_pixel_sample);
+      double num_nodes = (double(bbox.width()) / RAY_GRID_SPACING + 2.0)
+        * (double(bbox.height()) / RAY_GRID_SPACING + 2.0);
+      if (num_samples > 2.0 * num_nodes) {
+        build_ray_grid(bbox, ray_grid);
+        use_ray_grid = ray_grid_is_accurate(ray_grid, dem_crop, georef_crop,
+                                            height_error_tol, max_abs_tol, max_rel_tol,
+                                            num_max_iter);
+      }
+
       // Compute the DEM disparity. Use one in every 'm_pixel_sample' pixels.
 
       for (int row = bbox.min().y(); row < bbox.max().y(); row++){
@@ -186,20 +298,12 @@ namespace asp {
 
           Vector2 left_lowres_pix = Vector2(col, row);
 
-          Vector2 left_fullres_pix = elem_quot(left_lowres_pix, m_downsample_scale);
-          if (m_do_align){
-            // Need to go to the image pixel in the untransformed image
-            left_fullres_pix = HomographyTransform(m_align_left_matrix).reverse(left_fullres_pix);
-          }
-
           bool has_intersection;
           Vector3 left_camera_ctr, left_camera_vec;
-          try {
-            left_camera_ctr = m_left_camera_model->camera_center(left_fullres_pix);
-            left_camera_vec = m_left_camera_model->pixel_to_vector(left_fullres_pix);
-          } catch (...) {
+          if (!(use_ray_grid &&
+                interp_ray(ray_grid, left_lowres_pix, left_camera_ctr, left_camera_vec)) &&
+              !left_ray(left_lowres_pix, left_camera_ctr, left_camera_vec))
             continue;
-          }
           Vector3 xyz = camera_pixel_to_dem_xyz(left_camera_ctr, left_camera_vec,
                                                 dem_crop, georef_crop,
                                                 treat_nodata_as_zero,
@@ -285,6 +389,83 @@ namespace asp {
                         );
   }
 
+  // A hash of a description, in hex
+  std::string dem_disparity_key(std::string const& description) {
+    return asp::hash_to_hex(asp::hash_string(description));
+  }
+
+  // Sample a camera on a grid of pixels, to tell it apart from other cameras
+  // without depending on how it is stored
+  void describe_camera(camera::CameraModel const* cam, Vector2i const& image_size,
+                       std::ostringstream & os) {
+    const int NUM_SAMPLES = 5;
+    for (int r = 0; r < NUM_SAMPLES; r++) {
+      for (int c = 0; c < NUM_SAMPLES; c++) {
+        Vector2 pix(double(image_size.x() - 1) * c / (NUM_SAMPLES - 1),
+                    double(image_size.y() - 1) * r / (NUM_SAMPLES - 1));
+        try {
+          os << ' ' << cam->camera_center(pix) << ' ' << cam->pixel_to_vector(pix);
+        } catch (...) {
+          os << " none";
+        }
+      }
+    }
+  }
+
+  // What the low-res disparity from a DEM depends on: the DEM, described
+  // by its georeference and a sample of its heights, the cameras, the
+  // alignment, and the image sizes. Then the key of this description
+  // names the seed in the cache.
+  template <class DEMImageT>
+  std::string dem_disparity_cache_key(Vector2i const& image_size,
+                                      Vector2i const& sub_image_size,
+                                      DEMImageT const& dem, GeoReference const& dem_georef,
+                                      double dem_error, int pixel_sample,
+                                      camera::CameraModel const* left_camera_model,
+                                      camera::CameraModel const* right_camera_model,
+                                      bool do_align,
+                                      Matrix<double> const& align_left_matrix,
+                                      Matrix<double> const& align_right_matrix) {
+    
+    std::ostringstream os;
+    os << std::setprecision(17);
+    os << "dem_disparity " << image_size << ' ' << sub_image_size << ' '
+       << dem_error << ' ' << pixel_sample << ' ' << RAY_GRID_SPACING << ' ' << do_align;
+    if (do_align)
+      os << ' ' << align_left_matrix << ' ' << align_right_matrix;
+
+    os << ' ' << dem_georef << ' ' << dem.cols() << ' ' << dem.rows();
+    const int NUM_SAMPLES = 16;
+    for (int r = 0; r < NUM_SAMPLES; r++) {
+      for (int c = 0; c < NUM_SAMPLES; c++) {
+        PixelMask<float> h = dem(int64(dem.cols() - 1) * c / (NUM_SAMPLES - 1),
+                                 int64(dem.rows() - 1) * r / (NUM_SAMPLES - 1));
+        os << ' ' << is_valid(h) << ' ' << h.child();
+      }
+    }
+
+    describe_camera(left_camera_model,  image_size, os);
+    describe_camera(right_camera_model, image_size, os);
+    
+    return dem_disparity_key(os.str());
+  }
+
+  // The cached low-res disparity and its spread, for a key
+  void dem_disparity_cache_files(std::string const& cache_dir, std::string const& key,
+                                 std::string & disparity_file, std::string & spread_file) {
+    std::string prefix = (fs::path(cache_dir) / ("dem-disparity-" + key)).string();
+    disparity_file = prefix + "-D_sub.tif";
+    spread_file    = prefix + "-D_sub_spread.tif";
+  }
+
+  // Copy a file via a temporary one, so a reader never sees a partial file
+  void copy_file_via_tmp(std::string const& src, std::string const& dst) {
+    std::ostringstream tmp;
+    tmp << dst << ".tmp" << getpid();
+    fs::copy_file(src, tmp.str());
+    fs::rename(tmp.str(), dst);
+  }
+
   void produce_dem_disparity( ASPGlobalOptions & opt,
                               boost::shared_ptr<camera::CameraModel> left_camera_model,
                               boost::shared_ptr<camera::CameraModel> right_camera_model,
@@ -348,6 +529,29 @@ namespace asp {
       vw_out(DebugMessage,"asp") << "Right alignment matrix: " << align_right_matrix << "\n";
     }
 
+    std::string disparity_file = opt.out_prefix + "-D_sub.tif";
+    std::string disp_spread_file = opt.out_prefix + "-D_sub_spread.tif";
+
+    // The seed may be in the cache shared with other runs
+    std::string cache_dir = stereo_settings().dem_disparity_cache_dir;
+    std::string cached_disparity_file, cached_spread_file;
+    if (cache_dir != "") {
+      std::string key
+        = dem_disparity_cache_key(Vector2i(left_image.cols(), left_image.rows()),
+                                  Vector2i(left_image_sub.cols(), left_image_sub.rows()),
+                                  dem, dem_georef, dem_error, pixel_sample,
+                                  left_camera_model.get(), right_camera_model.get(),
+                                  do_align, align_left_matrix, align_right_matrix);
+      dem_disparity_cache_files(cache_dir, key, cached_disparity_file, cached_spread_file);
+      if (fs::exists(cached_disparity_file) && fs::exists(cached_spread_file)) {
+        vw_out() << "Reading low-resolution disparity from cache: "
+                 << cached_disparity_file << "\n";
+        copy_file_via_tmp(cached_disparity_file, disparity_file);
+        copy_file_via_tmp(cached_spread_file, disp_spread_file);
+        return;
+      }
+    }
+
     // Smaller tiles is better
     Vector2 orig_tile_size = opt.raster_tile_size;
     opt.raster_tile_size = Vector2i(64, 64);
@@ -364,7 +568,6 @@ namespace asp {
                                                        align_left_matrix, align_right_matrix,
                                                        pixel_sample, disparity_spread
                                                        ));
-    std::string disparity_file = opt.out_prefix + "-D_sub.tif";
     vw_out() << "Writing low-resolution disparity: " << disparity_file << "\n";
     if ( session_name == "isis" ){
       // ISIS does not support multi-threading
@@ -380,7 +583,6 @@ namespace asp {
                                               ("asp", "\t--> Low-resolution disparity:") );
     }
 
-    std::string disp_spread_file = opt.out_prefix + "-D_sub_spread.tif";
     vw_out() << "Writing low-resolution disparity spread: " << disp_spread_file << "\n";
     vw::cartography::block_write_gdal_image(disp_spread_file,
                                             disparity_spread,
@@ -391,6 +593,13 @@ namespace asp {
     // Go back to the original tile size
     opt.raster_tile_size = orig_tile_size;
 
+    if (cache_dir != "") {
+      vw_out() << "Saving low-resolution disparity to cache: " << cached_disparity_file << "\n";
+      fs::create_directories(cache_dir);
+      copy_file_via_tmp(disp_spread_file, cached_spread_file);
+      copy_file_via_tmp(disparity_file, cached_disparity_file); // last, as it marks completion
+    }
+
 #if 0 // Debug code
     ImageView<PixelMask<Vector2i> > lowres_disparity_disk;
     read_image( lowres_disparity_disk, opt.out_prefix + "-D_sub.tif" );
@@ -19,6 +19,7 @@
 #include <asp/Core/StereoSettings.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/DisparityProcessing.h>
+#include <asp/Core/Hash.h>
 #include <vw/Math/Transform.h>
 #include <vw/Stereo/StereoModel.h>
 #include <vw/FileIO/MatrixIO.h>
@@ -26,6 +27,12 @@
 #include <vw/Core/Stopwatch.h>
 #include <vw/Cartography/Map2CamTrans.h>
 #include <vw/InterestPoint/InterestData.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <algorithm>
 
 using namespace vw;
 using namespace vw::cartography;
@@ -72,7 +79,173 @@ void load_D_sub_and_scale(asp::ASPGlobalOptions                    const & opt,
                            double(Lmask.rows()) / double(sub_disp.rows()));
 }
 
-// Filter D_sub. All alignment methods are supported.
+namespace {
+
+// For map-projected images the transforms are not thread-safe, hence
+// each task needs its own copy.
+vw::TransformPtr task_transform(vw::TransformPtr const& trans, bool is_map_projected) {
+  if (!is_map_projected)
+    return trans;
+  return vw::cartography::mapproj_trans_copy(trans);
+}
+
+// The number of threads to find matches with. The caller must set it
+// to 1 for cameras which do not support multi-threading, such as ISIS.
+int disp_match_num_threads(ASPGlobalOptions const& opt) {
+  int num_threads = opt.num_threads;
+  if (num_threads <= 0)
+    num_threads = vw_settings().default_num_threads();
+  return std::max(num_threads, 1);
+}
+
+// The disparity at a D_sub pixel, scaled to full resolution
+Vector2 full_res_disp(int col, int row, Vector2f const& disp, Vector2 const& upsample_scale) {
+  Vector2 left_pix(col, row);
+  Vector2 right_pix = left_pix + disp;
+  return elem_prod(right_pix, upsample_scale) - elem_prod(left_pix, upsample_scale);
+}
+
+// The median of some values. The values get reordered.
+double destructive_median(std::vector<double> & vals) {
+  std::nth_element(vals.begin(), vals.begin() + vals.size()/2, vals.end());
+  return vals[vals.size()/2];
+}
+
+// The rows of D_sub processed by one task when triangulating it
+const int D_SUB_ROWS_PER_TASK = 16;
+
+// Triangulate a band of rows of D_sub. Each band writes its own rows
+// of the outputs, so no locking is needed for them. Failed or invalid
+// pixels get a high error and height, and a zero point.
+class TriangulateDsubTask: public Task, private boost::noncopyable {
+  ImageView<PixelMask<Vector2f>> const& m_sub_disp;
+  vw::TransformPtr m_tx_left, m_tx_right;
+  boost::shared_ptr<vw::camera::CameraModel> m_left_camera_model, m_right_camera_model;
+  vw::cartography::Datum const& m_datum;
+  Vector2 m_upsample_scale;
+  double m_angle_tol;
+  float m_high_error;
+  int m_beg_row, m_end_row;
+  ImageView<float> & m_tri_err;
+  ImageView<float> & m_height;
+  ImageView<Vector<double, 4>> & m_sub_pc;
+  Mutex & m_mutex;
+  ProgressCallback const& m_progress;
+  double m_inc_amount;
+
+public:
+  TriangulateDsubTask(ImageView<PixelMask<Vector2f>> const& sub_disp,
+                      vw::TransformPtr const& tx_left, vw::TransformPtr const& tx_right,
+                      bool is_map_projected,
+                      boost::shared_ptr<vw::camera::CameraModel> left_camera_model,
+                      boost::shared_ptr<vw::camera::CameraModel> right_camera_model,
+                      vw::cartography::Datum const& datum,
+                      Vector2 const& upsample_scale, double angle_tol, float high_error,
+                      int beg_row, int end_row,
+                      ImageView<float> & tri_err, ImageView<float> & height,
+                      ImageView<Vector<double, 4>> & sub_pc,
+                      Mutex & mutex, ProgressCallback const& progress, double inc_amount):
+    m_sub_disp(sub_disp), m_tx_left(task_transform(tx_left, is_map_projected)),
+    m_tx_right(task_transform(tx_right, is_map_projected)),
+    m_left_camera_model(left_camera_model), m_right_camera_model(right_camera_model),
+    m_datum(datum), m_upsample_scale(upsample_scale), m_angle_tol(angle_tol),
+    m_high_error(high_error), m_beg_row(beg_row), m_end_row(end_row),
+    m_tri_err(tri_err), m_height(height), m_sub_pc(sub_pc),
+    m_mutex(mutex), m_progress(progress), m_inc_amount(inc_amount) {}
+
+  void operator()() {
+
+    stereo::StereoModel model(m_left_camera_model.get(), m_right_camera_model.get(),
+                              stereo_settings().use_least_squares, m_angle_tol);
+
+    for (int row = m_beg_row; row < m_end_row; row++) {
+      for (int col = 0; col < m_sub_disp.cols(); col++) {
+
+        m_tri_err(col, row) = m_high_error;
+        m_height(col, row)  = m_high_error;
+        m_sub_pc(col, row)  = Vector<double, 4>();
+
+        PixelMask<Vector2f> disp = m_sub_disp(col, row);
+        if (!is_valid(disp))
+          continue;
+
+        Vector2 left_pix(col, row);
+        Vector2 right_pix = left_pix + disp.child();
+
+        // Scale to full resolution
+        left_pix  = elem_prod(left_pix, m_upsample_scale);
+        right_pix = elem_prod(right_pix, m_upsample_scale);
+
+        // Undo the alignment transform
+        left_pix  = m_tx_left->reverse(left_pix);
+        right_pix = m_tx_right->reverse(right_pix);
+
+        double err = 0.0;
+        Vector3 xyz;
+        try {
+          xyz = model(left_pix, right_pix, err);
+        } catch(...) {
+          xyz = Vector3();
+        }
+
+        // The call returns the zero error and zero xyz to indicate a
+        // failed ray intersection, so keep the high error in those cases.
+        if (err == 0 || xyz == Vector3())
+          continue;
+
+        m_tri_err(col, row) = err;
+
+        // Save the triangulated point
+        Vector<double, 4> P;
+        subvector(P, 0, 3) = xyz;
+        P[3] = err;
+        m_sub_pc(col, row) = P;
+
+        m_height(col, row) = m_datum.cartesian_to_geodetic(xyz)[2];
+      }
+    }
+
+    Mutex::Lock lock(m_mutex);
+    m_progress.report_incremental_progress(m_inc_amount);
+  }
+};
+
+// Wipe the valid values of an image outside the given range, and the
+// values at the same pixels in the other image. Return how many were wiped.
+int apply_range(ImageView<float> & vals, double b, double e, float high_error,
+                ImageView<float> & other_vals) {
+  int count = 0;
+  for (int row = 0; row < vals.rows(); row++) {
+    for (int col = 0; col < vals.cols(); col++) {
+      float val = vals(col, row);
+      if (val >= high_error) continue; // already invalid
+      if (val < b || val > e) {
+        vals(col, row)       = high_error;
+        other_vals(col, row) = high_error;
+        count++;
+      }
+    }
+  }
+  return count;
+}
+
+// Put the valid values of an image in a vector
+void valid_values(ImageView<float> const& img, float high_error, std::vector<double> & vals) {
+  vals.clear();
+  for (int row = 0; row < img.rows(); row++) {
+    for (int col = 0; col < img.cols(); col++) {
+      if (img(col, row) < high_error)
+        vals.push_back(img(col, row));
+    }
+  }
+}
+
+} // end anonymous namespace
+
+// Filter D_sub. All alignment methods are supported. The values are
+// visited row by row, as stored in memory, and the triangulation,
+// which is the costly part, is done in parallel over bands of rows,
+// unless the cameras do not support multi-threading.
 void filter_D_sub(ASPGlobalOptions const& opt,
                   vw::TransformPtr tx_left, vw::TransformPtr tx_right,
                   boost::shared_ptr<vw::camera::CameraModel> left_camera_model, 
@@ -96,34 +269,19 @@ void filter_D_sub(ASPGlobalOptions const& opt,
 
   // Use ImageView to read D_sub fully in memory so it can be modified
   vw::ImageView<vw::PixelMask<vw::Vector2f>> sub_disp = sub_disp_ref;
+  int cols = sub_disp.cols(), rows = sub_disp.rows();
+  // Careful below to avoid integer overflow
+  double num_pixels = double(cols) * double(rows);
 
-  // Will save the sub PC file, since we compute these anyway
-  // for the purpose of filtering.
-  vw::ImageView<vw::Vector<double, 4>> sub_pc(sub_disp.cols(), sub_disp.rows());
-  for (int col = 0; col < sub_pc.cols(); col++) {
-    for (int row = 0; row < sub_pc.rows(); row++) {
-      for (int coord = 0; coord < 4; coord++) {
-        sub_pc(col, row)[coord] = 0;
-      }
-    }
-  }
-  
   // Find the disparity values in x and y
   std::vector<double> dx, dy;
-  for (int col = 0; col < sub_disp.cols(); col++) {
-    for (int row = 0; row < sub_disp.rows(); row++) {
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
       vw::PixelMask<vw::Vector2f> disp = sub_disp(col, row);
-      
-      if (!is_valid(disp)) 
+      if (!is_valid(disp))
         continue;
-      
-      Vector2 left_pix(col, row);
-      Vector2 right_pix = left_pix + disp.child();
-
-      double diffX = right_pix.x() - left_pix.x();
-      double diffY = right_pix.y() - left_pix.y();
-      dx.push_back(diffX);
-      dy.push_back(diffY);
+      dx.push_back(disp.child().x());
+      dy.push_back(disp.child().y());
     }
   }
   
@@ -140,133 +298,74 @@ void filter_D_sub(ASPGlobalOptions const& opt,
   vw_out() <<"Inlier range based on y coordinate of disparity: " << by << ' ' << ey <<".\n";
 
   int count = 0;
-  for (int col = 0; col < sub_disp.cols(); col++) {
-    for (int row = 0; row < sub_disp.rows(); row++) {
-      vw::PixelMask<vw::Vector2f> disp = sub_disp(col, row);
-      
-      if (!is_valid(disp)) 
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+      vw::PixelMask<vw::Vector2f> & disp = sub_disp(col, row);
+      if (!is_valid(disp))
         continue;
-      
-      Vector2 left_pix(col, row);
-      Vector2 right_pix = left_pix + disp.child();
-
-      double diffX = right_pix.x() - left_pix.x();
-      double diffY = right_pix.y() - left_pix.y();
-
+      double diffX = disp.child().x(), diffY = disp.child().y();
       if (diffX < bx || diffX > ex || diffY < by || diffY > ey) {
-        sub_disp(col, row).invalidate();
+        disp.invalidate();
         count++;
       }
     }
   }
   vw_out() << "Number (and fraction) of removed outliers by disparity values in x and y: "
-           << count << " (" << double(count)/(sub_disp.cols() * sub_disp.rows()) << ").\n";
+           << count << " (" << count/num_pixels << ").\n";
   
-  // Set up the stereo model for doing triangulation
+  // Triangulate. Will save the sub PC file, since we compute these
+  // anyway for the purpose of filtering.
   double angle_tol = vw::stereo::StereoModel
     ::robust_1_minus_cos(stereo_settings().min_triangulation_angle*M_PI/180);
-  stereo::StereoModel model(left_camera_model.get(), right_camera_model.get(),
-                            stereo_settings().use_least_squares, angle_tol);
 
   float HIGH_ERROR = std::numeric_limits<float>::max();
-  ImageView<float> tri_err(sub_disp.cols(), sub_disp.rows());
-  ImageView<float> height(sub_disp.cols(), sub_disp.rows());
-
-  for (int col = 0; col < sub_disp.cols(); col++) {
-    for (int row = 0; row < sub_disp.rows(); row++) {
-      vw::PixelMask<vw::Vector2f> disp = sub_disp(col, row);
-      
-      if (!is_valid(disp)) {
-        tri_err(col, row) = HIGH_ERROR;
-        height(col, row) = HIGH_ERROR;
-        continue;
-      }
-      
-      Vector2 left_pix(col, row);
-      Vector2 right_pix = left_pix + disp.child();
-
-      // Scale to full resolution
-      left_pix  = elem_prod(left_pix, upsample_scale);
-      right_pix = elem_prod(right_pix, upsample_scale);
-
-      // Undo the alignment transform
-      left_pix = tx_left->reverse(left_pix);
-      right_pix = tx_right->reverse(right_pix);
-
-      double err;
-      Vector3 xyz;
-      try {
-        xyz = model(left_pix, right_pix, err);
-      } catch(...) {
-        xyz = Vector3();
-      }
-      
-      // The call returns the zero error and zero xyz to indicate a
-      // failed ray intersection so replace it in those cases with a
-      // very high error.
-      if (err == 0 || xyz == Vector3()) {
-        tri_err(col, row) = HIGH_ERROR;
-        height(col, row) = HIGH_ERROR;
-        continue;
-      }
-        
-      tri_err(col, row) = err;
-
-      // Save the triangulated point
-      Vector<double, 4> P;
-      subvector(P, 0, 3) = xyz;
-      P[3] = err;
-      sub_pc(col, row) = P;
-      
-      Vector3 llh = datum.cartesian_to_geodetic(xyz);
-      height(col, row) = llh[2];
+  ImageView<float> tri_err(cols, rows);
+  ImageView<float> height(cols, rows);
+  vw::ImageView<vw::Vector<double, 4>> sub_pc(cols, rows);
+
+  int num_threads = disp_match_num_threads(opt);
+  if (!opt.session->supports_multi_threading())
+    num_threads = 1;
+  bool is_map_projected = opt.session->isMapProjected();
+
+  {
+    vw::TerminalProgressCallback tpc("asp", "\t--> Triangulating D_sub: ");
+    int num_tasks = (rows + D_SUB_ROWS_PER_TASK - 1) / D_SUB_ROWS_PER_TASK;
+    double inc_amount = 1.0 / std::max(num_tasks, 1);
+    tpc.report_progress(0);
+    Mutex mutex;
+    FifoWorkQueue queue(num_threads);
+    for (int beg_row = 0; beg_row < rows; beg_row += D_SUB_ROWS_PER_TASK) {
+      int end_row = std::min(beg_row + D_SUB_ROWS_PER_TASK, rows);
+      boost::shared_ptr<TriangulateDsubTask>
+        task(new TriangulateDsubTask(sub_disp, tx_left, tx_right, is_map_projected,
+                                     left_camera_model, right_camera_model, datum,
+                                     upsample_scale, angle_tol, HIGH_ERROR,
+                                     beg_row, end_row, tri_err, height, sub_pc,
+                                     mutex, tpc, inc_amount));
+      queue.add_task(task);
     }
+    queue.join_all();
+    tpc.report_finished();
   }
 
-  // Put the valid heights in a vector
+  // Find the outlier brackets of the valid heights
   std::vector<double> vals;
-  // Careful below to avoid integer overflow
-  vals.reserve(std::int64_t(sub_disp.cols()) * std::int64_t(sub_disp.rows()));
-  vals.clear();
-  for (int col = 0; col < sub_disp.cols(); col++) {
-    for (int row = 0; row < sub_disp.rows(); row++) {
-      if (height(col, row) >= HIGH_ERROR) continue; // already invalid
-      vals.push_back(height(col, row));
-    }
-  }
-
-  // Find the outlier brackets
+  vals.reserve(std::int64_t(cols) * std::int64_t(rows));
+  valid_values(height, HIGH_ERROR, vals);
   double b = -1.0, e = -1.0;
   vw::math::find_outlier_brackets(vals, pct_fraction, factor, b, e);
   vw_out() <<"Height above datum inlier range: " << b << ' ' << e <<".\n";
 
   // Apply the outlier threshold
-  count = 0;
-  for (int col = 0; col < sub_disp.cols(); col++) {
-    for (int row = 0; row < sub_disp.rows(); row++) {
-      if (height(col, row) >= HIGH_ERROR) continue; // already invalid
-      if (height(col, row) < b || height(col, row) > e) {
-        height(col, row)  = HIGH_ERROR;
-        tri_err(col, row) = HIGH_ERROR;
-        count++;
-      }
-    }
-  }
+  count = apply_range(height, b, e, HIGH_ERROR, tri_err);
   vw_out() << "Number (and fraction) of removed outliers by the height check: "
-           << count << " (" << double(count)/(sub_disp.cols() * sub_disp.rows()) << ").\n";
+           << count << " (" << count/num_pixels << ").\n";
     
-  // Put the tri errors in a vector
-  vals.clear();
-  for (int col = 0; col < sub_disp.cols(); col++) {
-    for (int row = 0; row < sub_disp.rows(); row++) {
-      if (tri_err(col, row) >= HIGH_ERROR) continue; // already invalid
-      vals.push_back(tri_err(col, row));
-    }
-  }
-
-  // Find the outlier brackets. Since the triangulation errors, unlike
-  // the heights, are usually rather uniform, adjust pct from 95 to
-  // 90.
+  // Find the outlier brackets of the tri errors. Since the
+  // triangulation errors, unlike the heights, are usually rather
+  // uniform, adjust pct from 95 to 90.
+  valid_values(tri_err, HIGH_ERROR, vals);
   double pct2 = std::max((90.0/95.0) * outlier_removal_params[0], 0.5);
   double pct_fraction2 = 1.0 - pct2/100.0;
   // Show some lenience below as due to jitter some errors could be somewhat bigger
@@ -276,33 +375,22 @@ void filter_D_sub(ASPGlobalOptions const& opt,
   vw::math::find_outlier_brackets(vals, pct_fraction2, factor2, b, e);
   vw_out() <<"Triangulation error inlier range: " << b << ' ' << e <<".\n";
     
-  // Apply the outlier threshold
-  count = 0;
-  for (int col = 0; col < sub_disp.cols(); col++) {
-    for (int row = 0; row < sub_disp.rows(); row++) {
-      if (tri_err(col, row) >= HIGH_ERROR) continue; // already invalid
-      // We will ignore b, as the triangulation errors are non-negative.
-      if (tri_err(col, row) > e) {
-        height(col, row) = HIGH_ERROR;
-        tri_err(col, row) = HIGH_ERROR;
-        count++;
-      }
-    }
-  }
+  // Apply the outlier threshold. We will ignore b, as the
+  // triangulation errors are non-negative.
+  count = apply_range(tri_err, -std::numeric_limits<double>::max(), e, HIGH_ERROR, height);
   vw_out() << "Number (and fraction) of removed outliers by the triangulation error check: "
-           << count << " (" << double(count)/(sub_disp.cols() * sub_disp.rows()) << ").\n";
+           << count << " (" << count/num_pixels << ").\n";
 
   // TODO(oalexan1): Filter by user-given height range and max tri error.
     
   // Invalidate the D_sub entries that are outliers
-  for (int col = 0; col < sub_disp.cols(); col++) {
-    for (int row = 0; row < sub_disp.rows(); row++) {
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
       if (tri_err(col, row) >= HIGH_ERROR || height(col, row) >= HIGH_ERROR) {
         sub_disp(col, row).invalidate();
 
         // Invalidate the point in the cloud
-        subvector(sub_pc(col, row), 0, 3) = Vector3(0.0, 0.0, 0.0);
-        sub_pc(col, row)[3] = 0.0;
+        sub_pc(col, row) = Vector<double, 4>();
       }
     }
   }
@@ -318,7 +406,8 @@ void filter_D_sub(ASPGlobalOptions const& opt,
   
 } 
 
-// Filter D_sub by reducing its spread around the median
+// Filter D_sub by reducing its spread around the median. The medians
+// are found with a selection rather than a full sort.
 void filter_D_sub_using_spread(ASPGlobalOptions const& opt, std::string const& d_sub_file,
                                double max_disp_spread) {
   
@@ -335,67 +424,43 @@ void filter_D_sub_using_spread(ASPGlobalOptions const& opt, std::string const& d
   vw::ImageView<vw::PixelMask<vw::Vector2f>> sub_disp = sub_disp_ref;
 
   std::vector<double> dx, dy;
-  for (int col = 0; col < sub_disp.cols(); col++) {
-    for (int row = 0; row < sub_disp.rows(); row++) {
+  for (int row = 0; row < sub_disp.rows(); row++) {
+    for (int col = 0; col < sub_disp.cols(); col++) {
       vw::PixelMask<vw::Vector2f> disp = sub_disp(col, row);
-      
       if (!is_valid(disp)) 
         continue;
-      
-      Vector2 left_pix(col, row);
-      Vector2 right_pix = left_pix + disp.child();
-
-      // Scale to full resolution
-      left_pix  = elem_prod(left_pix, upsample_scale);
-      right_pix = elem_prod(right_pix, upsample_scale);
-
-      double diffX = right_pix.x() - left_pix.x();
-      double diffY = right_pix.y() - left_pix.y();
-      dx.push_back(diffX);
-      dy.push_back(diffY);
+      Vector2 d = full_res_disp(col, row, disp.child(), upsample_scale);
+      dx.push_back(d.x());
+      dy.push_back(d.y());
     }
   }
   
   if (dx.empty())
     vw_throw(ArgumentErr() << "Empty disparity.");
   
-  std::sort(dx.begin(), dx.end());
-  std::sort(dy.begin(), dy.end());
-  double mid_x = dx[dx.size()/2]; // median
-  double mid_y = dy[dy.size()/2];
+  double mid_x = destructive_median(dx);
+  double mid_y = destructive_median(dy);
   
   double half = max_disp_spread / 2.0;
   BBox2 spread_box(mid_x - half, mid_y - half, max_disp_spread, max_disp_spread);
 
   // Wipe offending disparities
   int count = 0;
-  for (int col = 0; col < sub_disp.cols(); col++) {
-    for (int row = 0; row < sub_disp.rows(); row++) {
-      vw::PixelMask<vw::Vector2f> disp = sub_disp(col, row);
-      
+  for (int row = 0; row < sub_disp.rows(); row++) {
+    for (int col = 0; col < sub_disp.cols(); col++) {
+      vw::PixelMask<vw::Vector2f> & disp = sub_disp(col, row);
       if (!is_valid(disp)) 
         continue;
-      
-      Vector2 left_pix(col, row);
-      Vector2 right_pix = left_pix + disp.child();
-
-      // Scale to full resolution
-      left_pix  = elem_prod(left_pix, upsample_scale);
-      right_pix = elem_prod(right_pix, upsample_scale);
-
-      double diffX = right_pix.x() - left_pix.x();
-      double diffY = right_pix.y() - left_pix.y();
-
-      Vector2 d(diffX, diffY);
-      if (!spread_box.contains(d)) {
+      if (!spread_box.contains(full_res_disp(col, row, disp.child(), upsample_scale))) {
         count++;
-        sub_disp(col, row).invalidate();
+        disp.invalidate();
       }
     }
   }
 
   vw_out() << "Number (and fraction) of removed outliers by the disp spread check: "
-           << count << " (" << double(count)/(sub_disp.cols() * sub_disp.rows()) << ").\n";
+           << count << " (" << double(count)/(double(sub_disp.cols()) * sub_disp.rows())
+           << ").\n";
     
   vw_out() << "Writing filtered D_sub: " << d_sub_file << std::endl;
   block_write_gdal_image(d_sub_file, sub_disp, opt,
@@ -704,6 +769,204 @@ void unalign_disparity(bool is_map_projected,
   
 }
 
+namespace {
+
+// A match found from the disparity, at a disparity pixel
+struct DispMatch {
+  int col, row;
+  Vector2 left_pix, right_pix;
+  DispMatch(int c, int r, Vector2 const& lpix, Vector2 const& rpix):
+    col(c), row(r), left_pix(lpix), right_pix(rpix) {}
+};
+
+bool disp_match_col_less(DispMatch const& a, DispMatch const& b) {
+  return a.col < b.col;
+}
+
+// The position of a sample in a bin of the disparity. The first sample
+// is the bin center. The others, used for stratified sampling, are
+// spread over the bin pseudo-randomly, but the same way on each run.
+Vector2i bin_sample(int binx, int biny, int sample, double bin_len) {
+  if (sample == 0)
+    return Vector2i(int(round((binx+0.5)*bin_len)), int(round((biny+0.5)*bin_len)));
+
+  // A hash of the bin and sample index, with a final mix
+  std::uint64_t h = asp::HASH_START;
+  std::int32_t vals[3] = {binx, biny, sample};
+  asp::hash_bytes(vals, sizeof(vals), h);
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+
+  double u = double(h & 0xffffffffULL) / 4294967296.0;
+  double v = double(h >> 32) / 4294967296.0;
+  return Vector2i(int(floor((binx + u)*bin_len)), int(floor((biny + v)*bin_len)));
+}
+
+// Find the matches in a block of bins. Only the part of the disparity
+// having the samples of these bins is read, at once. For each bin the
+// first sample with a valid disparity is kept, and put in the slot of
+// that bin, so the matches end up in the same order as the bins.
+// For map-projected images, the transforms are first asked to cache
+// what is needed for the pixels of this block, so that unaligning the
+// pixels does not go to the DEM and cameras each time.
+class BinBlockMatchTask: public Task, private boost::noncopyable {
+  DispImageType const& m_disp;
+  vw::TransformPtr m_left_trans, m_right_trans;
+  bool m_is_map_projected;
+  int m_beg_binx, m_end_binx, m_beg_biny, m_end_biny, m_leny, m_samples_per_bin;
+  double m_bin_len;
+  std::vector<DispMatch> & m_matches;
+  Mutex & m_mutex;
+  ProgressCallback const& m_progress;
+  double m_inc_amount;
+
+public:
+  BinBlockMatchTask(DispImageType const& disp,
+                    vw::TransformPtr const& left_trans, vw::TransformPtr const& right_trans,
+                    bool is_map_projected, int beg_binx, int end_binx,
+                    int beg_biny, int end_biny, int leny, int samples_per_bin,
+                    double bin_len, std::vector<DispMatch> & matches,
+                    Mutex & mutex, ProgressCallback const& progress, double inc_amount):
+    m_disp(disp), m_left_trans(task_transform(left_trans, is_map_projected)),
+    m_right_trans(task_transform(right_trans, is_map_projected)),
+    m_is_map_projected(is_map_projected),
+    m_beg_binx(beg_binx), m_end_binx(end_binx), m_beg_biny(beg_biny), m_end_biny(end_biny),
+    m_leny(leny), m_samples_per_bin(samples_per_bin), m_bin_len(bin_len),
+    m_matches(matches), m_mutex(mutex), m_progress(progress), m_inc_amount(inc_amount) {}
+
+  void operator()() {
+    typedef typename DispImageType::pixel_type DispPixelT;
+
+    // The box having all samples of these bins
+    BBox2i disp_box = bounding_box(m_disp), box;
+    for (int binx = m_beg_binx; binx < m_end_binx; binx++) {
+      for (int biny = m_beg_biny; biny < m_end_biny; biny++) {
+        for (int s = 0; s < m_samples_per_bin; s++) {
+          Vector2i pix = bin_sample(binx, biny, s, m_bin_len);
+          if (!disp_box.contains(pix))
+            continue;
+          box.grow(pix);
+          box.grow(pix + Vector2i(1, 1));
+        }
+      }
+    }
+
+    if (!box.empty()) {
+      ImageView<DispPixelT> tile = crop(m_disp, box);
+
+      // Pick a sample in each bin, and find the aligned right pixel
+      std::vector<int> bins;
+      std::vector<Vector2> trans_left, trans_right;
+      BBox2 right_box;
+      for (int binx = m_beg_binx; binx < m_end_binx; binx++) {
+        for (int biny = m_beg_biny; biny < m_end_biny; biny++) {
+          for (int s = 0; s < m_samples_per_bin; s++) {
+            Vector2i pix = bin_sample(binx, biny, s, m_bin_len);
+            if (!disp_box.contains(pix))
+              continue;
+            DispPixelT dpix = tile(pix.x() - box.min().x(), pix.y() - box.min().y());
+            if (!is_valid(dpix))
+              continue;
+            bins.push_back(binx * m_leny + biny);
+            trans_left.push_back(Vector2(pix));
+            trans_right.push_back(Vector2(pix) + stereo::DispHelper(dpix));
+            right_box.grow(trans_right.back());
+            break;
+          }
+        }
+      }
+
+      if (m_is_map_projected && !bins.empty()) {
+        m_left_trans->reverse_bbox(box);
+        BBox2i right_ibox = grow_bbox_to_int(right_box);
+        right_ibox.expand(1);
+        m_right_trans->reverse_bbox(right_ibox);
+      }
+
+      // De-warp left and right pixels to be in the camera coordinate system
+      for (size_t i = 0; i < bins.size(); i++) {
+        Vector2 left_pix  = m_left_trans->reverse(trans_left[i]);
+        Vector2 right_pix = m_right_trans->reverse(trans_right[i]);
+        m_matches[bins[i]] = DispMatch(trans_left[i].x(), trans_left[i].y(),
+                                       left_pix, right_pix);
+      }
+    }
+
+    Mutex::Lock lock(m_mutex);
+    m_progress.report_incremental_progress(m_inc_amount);
+  }
+};
+
+// In a band of disparity columns, find the pixels whose match in the
+// unaligned right image rounds to a multiple of the bin length. The
+// band is read a tile at a time, and the matches are put in the same
+// order as when going over the disparity column by column.
+class RightGridMatchTask: public Task, private boost::noncopyable {
+  DispImageType const& m_disp;
+  vw::TransformPtr m_left_trans, m_right_trans;
+  bool m_is_map_projected;
+  int m_beg_col, m_end_col, m_bin_len;
+  std::vector<DispMatch> & m_matches;
+  Mutex & m_mutex;
+  ProgressCallback const& m_progress;
+  double m_inc_amount;
+
+public:
+  RightGridMatchTask(DispImageType const& disp,
+                     vw::TransformPtr const& left_trans, vw::TransformPtr const& right_trans,
+                     bool is_map_projected, int beg_col, int end_col, int bin_len,
+                     std::vector<DispMatch> & matches,
+                     Mutex & mutex, ProgressCallback const& progress, double inc_amount):
+    m_disp(disp), m_left_trans(task_transform(left_trans, is_map_projected)),
+    m_right_trans(task_transform(right_trans, is_map_projected)),
+    m_is_map_projected(is_map_projected),
+    m_beg_col(beg_col), m_end_col(end_col), m_bin_len(bin_len),
+    m_matches(matches), m_mutex(mutex), m_progress(progress), m_inc_amount(inc_amount) {}
+
+  void operator()() {
+    typedef typename DispImageType::pixel_type DispPixelT;
+    int tile_rows = vw_settings().default_tile_size();
+    for (int beg_row = 0; beg_row < m_disp.rows(); beg_row += tile_rows) {
+
+      BBox2i box(m_beg_col, beg_row, m_end_col - m_beg_col,
+                 std::min(tile_rows, m_disp.rows() - beg_row));
+      ImageView<DispPixelT> tile = crop(m_disp, box);
+      if (m_is_map_projected)
+        m_left_trans->reverse_bbox(box); // makes the transform cache what it needs
+
+      for (int col = 0; col < tile.cols(); col++) {
+        for (int row = 0; row < tile.rows(); row++) {
+
+          DispPixelT dpix = tile(col, row);
+          if (!is_valid(dpix))
+            continue;
+
+          // Compute the left and right pixels. 
+          Vector2 trans_left_pix(box.min().x() + col, box.min().y() + row);
+          Vector2 trans_right_pix = trans_left_pix + stereo::DispHelper(dpix);
+          Vector2 right_pix       = round(m_right_trans->reverse(trans_right_pix)); // very important
+
+          // If the right pixel is a multiple of the bin size, keep it
+          if (int(right_pix[0]) % m_bin_len != 0) continue;
+          if (int(right_pix[1]) % m_bin_len != 0) continue;
+
+          Vector2 left_pix = m_left_trans->reverse(trans_left_pix);
+          m_matches.push_back(DispMatch(trans_left_pix.x(), trans_left_pix.y(),
+                                        left_pix, right_pix));
+        }
+      }
+    }
+
+    // The tiles were visited by row, so each column is in order already
+    std::stable_sort(m_matches.begin(), m_matches.end(), disp_match_col_less);
+    Mutex::Lock lock(m_mutex);
+    m_progress.report_incremental_progress(m_inc_amount);
+  }
+};
+
+} // end anonymous namespace
+
 /// Bin the disparities, and from each bin get a disparity value.
 /// This will create a correspondence from the left to right image,
 /// which we save in the match format.
@@ -730,41 +993,51 @@ void compute_matches_from_disp(ASPGlobalOptions const& opt,
     int lenx = round(disp.cols()/bin_len); lenx = std::max(1, lenx);
     int leny = round(disp.rows()/bin_len); leny = std::max(1, leny);
 
-    // Iterate over bins.
+    // Iterate over blocks of bins, in parallel. The matches are put
+    // together in the order of the bins. With more than one sample per
+    // bin, a bin whose center has no valid disparity can still have a
+    // match.
+    int samples_per_bin = std::max(1, stereo_settings().matches_from_disp_samples_per_bin);
 
     vw_out() << "Computing interest point matches based on disparity.\n";
     vw::TerminalProgressCallback tpc("asp", "\t--> ");
-    double inc_amount = 1.0 / double(lenx);
+    int bins_per_block = std::max(1, int(round(vw_settings().default_tile_size() / bin_len)));
+    int num_blocks_x = (lenx + bins_per_block - 1) / bins_per_block;
+    int num_blocks_y = (leny + bins_per_block - 1) / bins_per_block;
+    double inc_amount = 1.0 / (double(num_blocks_x) * double(num_blocks_y));
     tpc.report_progress(0);
 
-    for (int binx = 0; binx < lenx; binx++) {
-
-      // Pick the disparity at the center of the bin
-      int posx = round((binx+0.5)*bin_len);
-
-      for (int biny = 0; biny < leny; biny++) {
-
-        int posy = round((biny+0.5)*bin_len);
-
-        if (posx >= disp.cols() || posy >= disp.rows()) 
-          continue;
-        typedef typename DispImageType::pixel_type DispPixelT;
-        DispPixelT dpix = disp(posx, posy);
-        if (!is_valid(dpix))
-          continue;
-
-        // De-warp left and right pixels to be in the camera coordinate system
-        Vector2 left_pix  = left_trans->reverse (Vector2(posx, posy));
-        Vector2 right_pix = right_trans->reverse(Vector2(posx, posy) + stereo::DispHelper(dpix));
-
-        left_ip.push_back(ip::InterestPoint(left_pix.x(), left_pix.y()));
-        right_ip.push_back(ip::InterestPoint(right_pix.x(), right_pix.y()));
+    // One slot per bin. Those with a negative column have no match.
+    std::vector<DispMatch> matches(std::int64_t(lenx) * std::int64_t(leny),
+                                   DispMatch(-1, -1, Vector2(), Vector2()));
+    Mutex mutex;
+    {
+      FifoWorkQueue queue(disp_match_num_threads(opt));
+      for (int bx = 0; bx < num_blocks_x; bx++) {
+        for (int by = 0; by < num_blocks_y; by++) {
+          int beg_binx = bx * bins_per_block, end_binx = std::min(lenx, beg_binx + bins_per_block);
+          int beg_biny = by * bins_per_block, end_biny = std::min(leny, beg_biny + bins_per_block);
+          boost::shared_ptr<Task>
+            task(new BinBlockMatchTask(disp, left_trans, right_trans, is_map_projected,
+                                       beg_binx, end_binx, beg_biny, end_biny, leny,
+                                       samples_per_bin, bin_len, matches,
+                                       mutex, tpc, inc_amount));
+          queue.add_task(task);
+        }
       }
-
-      tpc.report_incremental_progress(inc_amount);
+      queue.join_all();
     }
     tpc.report_finished();
 
+    for (size_t i = 0; i < matches.size(); i++) {
+      if (matches[i].col < 0)
+        continue;
+      left_ip.push_back(ip::InterestPoint(matches[i].left_pix.x(),
+                                          matches[i].left_pix.y()));
+      right_ip.push_back(ip::InterestPoint(matches[i].right_pix.x(),
+                                           matches[i].right_pix.y()));
+    }
+
   } else{
 
     // First create ip with left_ip being at integer multiple of bin size.
@@ -865,7 +1138,6 @@ void compute_matches_from_disp(ASPGlobalOptions const& opt,
     
     // Now create ip in predictable locations for the right image. This is hard,
     // as the disparity goes from left to right, so we need to examine every disparity.
-    typedef typename DispImageType::pixel_type DispPixelT;
     {
       DiskImageView<float> right_img(opt.in_file2);
     
@@ -873,34 +1145,40 @@ void compute_matches_from_disp(ASPGlobalOptions const& opt,
       int bin_len = round(sqrt(num_pixels/std::min(double(max_num_matches), num_pixels)));
       VW_ASSERT(bin_len >= 1, vw::ArgumentErr() << "Expecting bin_len >= 1.\n");
 
-      // Iterate over disparity.
+      // Iterate over the disparity, in bands of columns which are
+      // done in parallel. The matches are then added in the same order
+      // as going over the disparity column by column, as that decides
+      // which of any repeated matches is kept.
 
-      vw_out() << "Doing a second pass. This will be very slow.\n";
+      vw_out() << "Doing a second pass over the disparity.\n";
       vw::TerminalProgressCallback tpc("asp", "\t--> ");
-      double inc_amount = 1.0 / double(disp.cols());
+      int band_cols = vw_settings().default_tile_size();
+      int num_tasks = (disp.cols() + band_cols - 1) / band_cols;
+      double inc_amount = 1.0 / double(std::max(num_tasks, 1));
       tpc.report_progress(0);
 
-      for (int col = 0; col < disp.cols(); col++) {
-        for (int row = 0; row < disp.rows(); row++) {
-
-          Vector2 trans_left_pix(col, row);
-          Vector2 left_pix, trans_right_pix, right_pix;
-
-          DispPixelT dpix = disp(trans_left_pix[0], trans_left_pix[1]);
-          if (!is_valid(dpix))
-            continue;
-
-          // Compute the left and right pixels. 
-          left_pix        = left_trans->reverse(trans_left_pix);
-          trans_right_pix = trans_left_pix + stereo::DispHelper(dpix);
-          right_pix       = right_trans->reverse(trans_right_pix);
-
-          // If the right pixel is a multiple of the bin size, keep
-          // it.
-          right_pix = round(right_pix); // very important
-          if (int(right_pix[0]) % bin_len != 0) continue;
-          if (int(right_pix[1]) % bin_len != 0) continue;
+      std::vector<std::vector<DispMatch>> matches(num_tasks);
+      Mutex mutex;
+      {
+        FifoWorkQueue queue(disp_match_num_threads(opt));
+        for (int t = 0; t < num_tasks; t++) {
+          int beg_col = t * band_cols;
+          int end_col = std::min(disp.cols(), beg_col + band_cols);
+          boost::shared_ptr<Task>
+            task(new RightGridMatchTask(disp, left_trans, right_trans, is_map_projected,
+                                        beg_col, end_col, bin_len, matches[t],
+                                        mutex, tpc, inc_amount));
+          queue.add_task(task);
+        }
+        queue.join_all();
+      }
+      tpc.report_finished();
 
+      for (int t = 0; t < num_tasks; t++) {
+        for (size_t i = 0; i < matches[t].size(); i++) {
+          Vector2 const& left_pix  = matches[t][i].left_pix;
+          Vector2 const& right_pix = matches[t][i].right_pix;
+          
           // Add this ip unless found already. This is clumsy, but we
           // can't use a set since there is no ordering for pairs.
           std::map<double, double>::iterator it;
@@ -915,10 +1193,8 @@ void compute_matches_from_disp(ASPGlobalOptions const& opt,
           left_ip.push_back(lip); 
           right_ip.push_back(rip);
         }
-        
-        tpc.report_incremental_progress(inc_amount);
+        std::vector<DispMatch>().swap(matches[t]); // free the memory
       }
-      tpc.report_finished();
     }
     
   } // end considering multi-image friendly ip
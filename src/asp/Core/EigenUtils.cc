@@ -20,6 +20,15 @@
 ///
 
 #include <asp/Core/EigenUtils.h>
+#include <asp/Core/PointSampler.h>
+#include <asp/Core/MappedTextFile.h>
+
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <cstring>
 
 using namespace vw;
 using namespace vw::cartography;
@@ -88,144 +97,107 @@ void random_pc_subsample(std::int64_t m, DoubleMatrix& points){
   points.conservativeResize(Eigen::NoChange, m);
 }
 
-std::int64_t load_csv_aux(std::string const& file_name, std::int64_t num_points_to_load,
-                          vw::BBox2 const& lonlat_box,
-                          bool calc_shift, vw::Vector3 & shift,
-                          vw::cartography::GeoReference const& geo, CsvConv const& csv_conv,
-                          bool & is_lola_rdr_format, double & median_longitude,
-                          bool verbose, DoubleMatrix & data) {
-
-  // Note: The input CsvConv object is responsible for parsing out the
-  //       type of information contained in the CSV file.
-
-  is_lola_rdr_format = false;
-
-  std::int64_t num_total_points = csv_file_size(file_name);
-
-  std::string sep_str = csv_separator();
-  const char* sep = sep_str.c_str();
-
-  const std::int64_t bufSize = 1024;
-  char temp[bufSize];
-  std::ifstream file( file_name.c_str() );
-  if (!file)
-    vw_throw(vw::IOErr() << "Unable to open file: " << file_name << "\n");
-
-  // We will randomly pick or not a point with probability load_ratio
-  double load_ratio = (double)num_points_to_load/std::max(1.0, (double)num_total_points);
+void sampled_points_to_matrix(PointSampler & sampler, bool calc_shift,
+                              vw::Vector3 & shift, DoubleMatrix & data,
+                              std::vector<double> * longitudes) {
+  std::vector<PointSampler::Point> points;
+  sampler.get(points);
 
-  data.conservativeResize(DIM+1, std::min(num_points_to_load, num_total_points));
+  if (calc_shift && !points.empty())
+    shift = points[0].xyz;
 
-  // Peek at the first valid line and see how many elements it has
-  std::string line;
-  while ( getline(file, line, '\n') ) {
-    if (is_valid_csv_line(line))
-      break;
-  }
-
-  file.clear(); file.seekg(0, std::ios_base::beg); // go back to start of file
-  strncpy(temp, line.c_str(), bufSize);
-  const char* token = strtok (temp, sep);
-  std::int64_t numTokens = 0;
-  while (token != NULL){
-    numTokens++;
-    token = strtok (NULL, sep);
-  }
-  if (numTokens < 3){
-    vw_throw( vw::IOErr() << "Expecting at least three fields on each "
-                          << "line of file: " << file_name << "\n" );
-  }
-
-  if (!csv_conv.is_configured()){
-    if (numTokens > 20){
-      is_lola_rdr_format = true;
-      if (verbose)
-        vw::vw_out() << "Guessing file " << file_name <<
-	  " to be in LOLA RDR PointPerRow format.\n";
-    }else{
-      is_lola_rdr_format = false;
-      if (verbose)
-        vw::vw_out() << "Guessing file " << file_name
-                     << " to be in latitude,longitude,height above datum (meters) format.\n";
-    }
-  }
-
-  // TODO(oalexan1): We parse these guessed file types manually but we should
-  // use a CsvConv object to do it!
-
-  if (is_lola_rdr_format && geo.datum().semi_major_axis() != geo.datum().semi_minor_axis() ){
-    vw_throw( vw::ArgumentErr() << "The CSV file was detected to be in the"
-              << " LOLA RDR format, yet the datum semi-axes are not equal "
-              << "as expected for the Moon.\n" );
+  data.resize(DIM+1, points.size());
+  if (longitudes != NULL)
+    longitudes->resize(points.size());
+  for (size_t col = 0; col < points.size(); col++) {
+    for (std::int64_t row = 0; row < DIM; row++)
+      data(row, col) = points[col].xyz[row] - shift[row];
+    data(DIM, col) = 1; // Extend to be a homogenous coordinate
+    if (longitudes != NULL)
+      (*longitudes)[col] = points[col].lon;
   }
+}
 
-  bool shift_was_calc = false;
-  bool is_first_line  = true;
-  std::int64_t points_count = 0;
-  std::vector<double> longitudes;
-  line = "";
-  while (getline(file, line, '\n')) {
-
-    if (!is_first_line && !line.empty() && line[0] == '#' && verbose) {
-      vw::vw_out() << "Ignoring line starting with comment: " << line << std::endl;
-      continue;
-    }
-    
-    if (points_count >= num_points_to_load)
-      break;
-
-    if (!is_valid_csv_line(line))
-      continue;
-
-    // Randomly skip a percentage of points
-    double r = (double)std::rand()/(double)RAND_MAX;
-    if (r > load_ratio)
-      continue;
-
-    // We went with C-style file reading instead of C++ in this instance
-    // because we found it to be significantly faster on large files.
+namespace {
 
-    vw::Vector3 xyz;
-    double lon = 0.0, lat = 0.0;
+// Parse a number which starts a token. Return the number of values
+// read, as sscanf() does, but faster, and without any locks.
+int parse_double(const char* token, double & val) {
+  char * end = NULL;
+  val = strtod(token, &end);
+  return (end != token) ? 1 : 0;
+}
 
-    if (csv_conv.is_configured()){
+// Find the points on the lines of a CSV file, in the formats load_csv()
+// supports. This has no state, so it may be shared by threads, as long
+// as the georeference is not used to undo a projection.
+class CsvPointParser {
+  std::string  m_file_name;
+  vw::BBox2    m_lonlat_box;
+  vw::cartography::GeoReference const& m_geo;
+  CsvConv const& m_csv_conv;
+  bool         m_is_lola_rdr_format;
+  std::string  m_sep;
+public:
+  CsvPointParser(std::string const& file_name, vw::BBox2 const& lonlat_box,
+                 vw::cartography::GeoReference const& geo, CsvConv const& csv_conv,
+                 bool is_lola_rdr_format):
+    m_file_name(file_name), m_lonlat_box(lonlat_box), m_geo(geo),
+    m_csv_conv(csv_conv), m_is_lola_rdr_format(is_lola_rdr_format),
+    m_sep(csv_separator()) {}
+
+  // Find the point on a line, and its longitude. Return false if there
+  // is none to use. A line which cannot be read is an error, unless it
+  // is the first one, which may be the header.
+  bool parse(std::string const& line, bool & is_first_line,
+             vw::Vector3 & xyz, double & lon) const {
+
+    const char* sep = m_sep.c_str();
+    const std::int64_t bufSize = 1024;
+    char temp[bufSize];
+    char * saveptr = NULL;
+    double lat = 0.0;
+    lon = 0.0;
+
+    if (m_csv_conv.is_configured()){
 
       // Parse custom CSV file with given format string
       bool success;
-      CsvConv::CsvRecord vals = csv_conv.parse_csv_line(is_first_line, success, line);
+      CsvConv::CsvRecord vals = m_csv_conv.parse_csv_line(is_first_line, success, line);
       if (!success)
-        continue;
+        return false;
 
-      xyz = csv_conv.csv_to_cartesian(vals, geo);
+      xyz = m_csv_conv.csv_to_cartesian(vals, m_geo);
 
       // Decide if the point is in the box. Also save for the future
       // the longitude of the point, we'll use it to compute the mean longitude.
-      vw::Vector2 lonlat = csv_conv.csv_to_lonlat(vals, geo);
+      vw::Vector2 lonlat = m_csv_conv.csv_to_lonlat(vals, m_geo);
       lon = lonlat[0]; // Needed for mean calculation below
       lat = lonlat[1];
 
       // TODO: We really need a lonlat bbox function that handles wraparound!!!!!!
       // Skip points outside the given box
-      if (!lonlat_box.empty() && !lonlat_box.contains(lonlat)
-                              && !lonlat_box.contains(lonlat+vw::Vector2(360,0))
-                              && !lonlat_box.contains(lonlat-vw::Vector2(360,0))) {
-        continue;
+      if (!m_lonlat_box.empty() && !m_lonlat_box.contains(lonlat)
+                                && !m_lonlat_box.contains(lonlat+vw::Vector2(360,0))
+                                && !m_lonlat_box.contains(lonlat-vw::Vector2(360,0))) {
+        return false;
       }
 
-    }else if (!is_lola_rdr_format){
+    }else if (!m_is_lola_rdr_format){
 
       // lat,lon,height format
       double height;
 
       strncpy(temp, line.c_str(), bufSize);
-      const char* token = strtok(temp, sep); null_check(token, line);
-      std::int64_t ret = sscanf(token, "%lg", &lat);
+      temp[bufSize - 1] = '\0';
+      const char* token = strtok_r(temp, sep, &saveptr); null_check(token, line);
+      std::int64_t ret = parse_double(token, lat);
 
-      token = strtok(NULL, sep); null_check(token, line);
-      ret += sscanf(token, "%lg", &lon);
+      token = strtok_r(NULL, sep, &saveptr); null_check(token, line);
+      ret += parse_double(token, lon);
 
-      token = strtok(NULL, sep); null_check(token, line);
-      ret += sscanf(token, "%lg", &height);
+      token = strtok_r(NULL, sep, &saveptr); null_check(token, line);
+      ret += parse_double(token, height);
 
       // Be prepared for the fact that the first line may be the header.
       if (ret != 3){
@@ -233,18 +205,18 @@ std::int64_t load_csv_aux(std::string const& file_name, std::int64_t num_points_
           vw_throw( vw::IOErr() << "Failed to read line: " << line << "\n" );
         }else{
           is_first_line = false;
-          continue;
+          return false;
         }
       }
       is_first_line = false;
 
       // Skip points outside the given box
-      if (!lonlat_box.empty() && !lonlat_box.contains(vw::Vector2(lon, lat)))
-        continue;
+      if (!m_lonlat_box.empty() && !m_lonlat_box.contains(vw::Vector2(lon, lat)))
+        return false;
 
       vw::Vector3 llh( lon, lat, height );
-      xyz = geo.datum().geodetic_to_cartesian( llh );
-      if ( xyz == vw::Vector3() || !(xyz == xyz) ) continue; // invalid and NaN check
+      xyz = m_geo.datum().geodetic_to_cartesian( llh );
+      if ( xyz == vw::Vector3() || !(xyz == xyz) ) return false; // invalid and NaN check
 
     }else{
 
@@ -253,30 +225,31 @@ std::int64_t load_csv_aux(std::string const& file_name, std::int64_t num_points_
       // We will ignore lines which do not start with year (or a value that
       // cannot be converted into an integer greater than zero, specifically).
 
-      std::int64_t year, month, day, hour, min;
-      double lat, rad, sec, is_invalid;
+      int year = 0, month, day, hour, min;
+      double rad, sec, is_invalid;
 
       strncpy(temp, line.c_str(), bufSize);
-      const char* token = strtok(temp, sep); null_check(token, line);
+      temp[bufSize - 1] = '\0';
+      const char* token = strtok_r(temp, sep, &saveptr); null_check(token, line);
 
       std::int64_t ret = sscanf(token, "%d-%d-%dT%d:%d:%lg", &year, &month, &day, &hour,
-                       &min, &sec);
+                                &min, &sec);
       if( year <= 0 )
-        continue;
+        return false;
 
-      token = strtok(NULL, sep); null_check(token, line);
-      ret += sscanf(token, "%lg", &lon);
+      token = strtok_r(NULL, sep, &saveptr); null_check(token, line);
+      ret += parse_double(token, lon);
 
-      token = strtok(NULL, sep); null_check(token, line);
-      ret += sscanf(token, "%lg", &lat);
-      token = strtok(NULL, sep); null_check(token, line);
-      ret += sscanf(token, "%lg", &rad);
+      token = strtok_r(NULL, sep, &saveptr); null_check(token, line);
+      ret += parse_double(token, lat);
+      token = strtok_r(NULL, sep, &saveptr); null_check(token, line);
+      ret += parse_double(token, rad);
       rad *= 1000; // km to m
 
       // Scan 7 more fields, until we get to the is_invalid flag.
       for (std::int64_t i = 0; i < 7; i++)
-        token = strtok(NULL, sep); null_check(token, line);
-      ret += sscanf(token, "%lg", &is_invalid);
+        token = strtok_r(NULL, sep, &saveptr); null_check(token, line);
+      ret += parse_double(token, is_invalid);
 
       // Be prepared for the fact that the first line may be the header.
       if (ret != 10){
@@ -284,105 +257,399 @@ std::int64_t load_csv_aux(std::string const& file_name, std::int64_t num_points_
           vw_throw( vw::IOErr() << "Failed to read line: " << line << "\n" );
         }else{
           is_first_line = false;
-          continue;
+          return false;
         }
       }
       is_first_line = false;
 
       if (is_invalid)
-        continue;
+        return false;
 
       // Skip points outside the given box
-      if (!lonlat_box.empty() && !lonlat_box.contains(vw::Vector2(lon, lat)))
-        continue;
+      if (!m_lonlat_box.empty() && !m_lonlat_box.contains(vw::Vector2(lon, lat)))
+        return false;
 
       vw::Vector3 lonlatrad( lon, lat, 0 );
 
-      xyz = geo.datum().geodetic_to_cartesian( lonlatrad );
+      xyz = m_geo.datum().geodetic_to_cartesian( lonlatrad );
       if ( xyz == vw::Vector3() || !(xyz == xyz) )
-        continue; // invalid and NaN check
+        return false; // invalid and NaN check
 
       // Adjust the point so that it is at the right distance from
       // planet center.
       xyz = rad*(xyz/norm_2(xyz));
     }
 
-    if (calc_shift && !shift_was_calc){
-      shift = xyz;
-      shift_was_calc = true;
-    }
-
-    for (std::int64_t row = 0; row < DIM; row++)
-      data(row, points_count) = xyz[row] - shift[row];
-    data(DIM, points_count) = 1;
-
-    points_count++;
-    longitudes.push_back(lon);
-
     // Throw an error if the lon and lat are not within bounds.
     // Note that we allow some slack for lon, perhaps the point
     // cloud is say from 350 to 370 degrees.
     if (std::abs(lat) > 90.0)
       vw_throw(vw::ArgumentErr() << "Invalid latitude value: "
-               << lat << " in " << file_name << "\n");
+               << lat << " in " << m_file_name << "\n");
     if (lon < -360.0 || lon > 2*360.0)
       vw_throw(vw::ArgumentErr() << "Invalid longitude value: "
-               << lon << " in " << file_name << "\n");
+               << lon << " in " << m_file_name << "\n");
+
+    return true;
   }
-  data.conservativeResize(Eigen::NoChange, points_count);
+};
+
+// Sample the points on the lines of chunks of a CSV file. Called by
+// several threads at once, each with its own chunk.
+class CsvChunkSampler {
+  MappedTextFile const& m_file;
+  CsvPointParser const& m_parser;
+  PointSampler & m_sampler;
+  bool m_verbose;
+  vw::TerminalProgressCallback & m_tpc;
+  double m_total_size;
+  vw::Mutex m_mutex;
+public:
+  CsvChunkSampler(MappedTextFile const& file, CsvPointParser const& parser,
+                  PointSampler & sampler, bool verbose, vw::TerminalProgressCallback & tpc,
+                  size_t start):
+    m_file(file), m_parser(parser), m_sampler(sampler), m_verbose(verbose), m_tpc(tpc),
+    m_total_size(std::max(double(file.size()) - double(start), 1.0)) {}
+
+  void operator()(int chunk, size_t begin, size_t end) {
+    char const* data = m_file.data();
+    std::string line;
+    std::vector<PointSampler::Point> candidates;
+    const size_t batch_size = 4096;
+
+    size_t pos = begin;
+    while (pos < end) {
+      size_t line_pos = pos;
+      char const* nl = static_cast<char const*>(std::memchr(data + pos, '\n', end - pos));
+      size_t line_end = (nl == NULL) ? end : size_t(nl - data);
+      pos = (nl == NULL) ? end : line_end + 1;
+
+      if (line_pos < line_end && data[line_pos] == '#') {
+        if (m_verbose) {
+          vw::Mutex::Lock lock(m_mutex);
+          vw::vw_out() << "Ignoring line starting with comment: "
+                       << std::string(data + line_pos, data + line_end) << std::endl;
+        }
+        continue;
+      }
+
+      // Skip the points which cannot be sampled without parsing them
+      if (PointSampler::key(line_pos) >= m_sampler.threshold())
+        continue;
+
+      line.assign(data + line_pos, data + line_end);
+      if (!is_valid_csv_line(line))
+        continue;
+
+      PointSampler::Point p;
+      p.index = line_pos;
+      bool is_first_line = false;
+      if (!m_parser.parse(line, is_first_line, p.xyz, p.lon))
+        continue;
+      candidates.push_back(p);
+      if (candidates.size() >= batch_size)
+        m_sampler.add(candidates);
+    }
+    m_sampler.add(candidates);
+
+    if (m_verbose) {
+      vw::Mutex::Lock lock(m_mutex);
+      m_tpc.report_incremental_progress(double(end - begin) / m_total_size);
+    }
+  }
+};
+
+} // end anonymous namespace
+
+// Load a csv file. Each valid line is a point, and its position in the
+// file decides if it is sampled. The file is mapped into memory and its
+// chunks are parsed in parallel.
+void load_csv(std::string const& file_name,
+              std::int64_t num_points_to_load,
+              vw::BBox2 const& lonlat_box,
+              bool calc_shift,
+              vw::Vector3 & shift,
+              vw::cartography::GeoReference const& geo,
+              CsvConv const& csv_conv,
+              bool & is_lola_rdr_format,
+              double & median_longitude,
+              bool verbose,
+              DoubleMatrix & data){
+
+  // Note: The input CsvConv object is responsible for parsing out the
+  //       type of information contained in the CSV file.
+
+  is_lola_rdr_format = false;
+
+  std::string sep_str = csv_separator();
+  const char* sep = sep_str.c_str();
+
+  const std::int64_t bufSize = 1024;
+  char temp[bufSize];
+  MappedTextFile file(file_name);
+
+  PointSampler sampler(num_points_to_load);
+
+  // Peek at the first valid line and see how many elements it has
+  std::string line;
+  size_t first_pos = 0, pos = 0;
+  while (pos < file.size()) {
+    first_pos = pos;
+    pos = file.read_line(pos, line);
+    if (is_valid_csv_line(line))
+      break;
+    line = "";
+  }
+
+  strncpy(temp, line.c_str(), bufSize);
+  temp[bufSize - 1] = '\0';
+  char * saveptr = NULL;
+  const char* token = strtok_r(temp, sep, &saveptr);
+  std::int64_t numTokens = 0;
+  while (token != NULL){
+    numTokens++;
+    token = strtok_r(NULL, sep, &saveptr);
+  }
+  if (numTokens < 3){
+    vw_throw( vw::IOErr() << "Expecting at least three fields on each "
+                          << "line of file: " << file_name << "\n" );
+  }
+
+  if (!csv_conv.is_configured()){
+    if (numTokens > 20){
+      is_lola_rdr_format = true;
+      if (verbose)
+        vw::vw_out() << "Guessing file " << file_name <<
+	  " to be in LOLA RDR PointPerRow format.\n";
+    }else{
+      is_lola_rdr_format = false;
+      if (verbose)
+        vw::vw_out() << "Guessing file " << file_name
+                     << " to be in latitude,longitude,height above datum (meters) format.\n";
+    }
+  }
+
+  // TODO(oalexan1): We parse these guessed file types manually but we should
+  // use a CsvConv object to do it!
+
+  if (is_lola_rdr_format && geo.datum().semi_major_axis() != geo.datum().semi_minor_axis() ){
+    vw_throw( vw::ArgumentErr() << "The CSV file was detected to be in the"
+              << " LOLA RDR format, yet the datum semi-axes are not equal "
+              << "as expected for the Moon.\n" );
+  }
+
+  CsvPointParser parser(file_name, lonlat_box, geo, csv_conv, is_lola_rdr_format);
+
+  // The first valid line is parsed on its own, as it may be the header
+  {
+    bool is_first_line = true;
+    vw::Vector3 xyz;
+    double lon = 0.0;
+    if (parser.parse(line, is_first_line, xyz, lon))
+      sampler.add(first_pos, xyz, lon);
+  }
+
+  // Undoing a projection is not thread-safe, so then use one thread
+  int num_threads = 0; // the default
+  if (csv_conv.is_configured() && csv_conv.get_format() == CsvConv::EASTING_HEIGHT_NORTHING)
+    num_threads = 1;
+
+  vw::TerminalProgressCallback tpc("asp", "\t--> ");
+  if (verbose)
+    tpc.report_progress(0);
+  CsvChunkSampler chunk_sampler(file, parser, sampler, verbose, tpc, pos);
+  for_each_text_chunk(file, pos, chunk_sampler, num_threads);
+  if (verbose)
+    tpc.report_finished();
+
+  std::vector<double> longitudes;
+  sampled_points_to_matrix(sampler, calc_shift, shift, data, &longitudes);
 
   median_longitude = 0.0;
   std::sort(longitudes.begin(), longitudes.end());
   if (longitudes.size() > 0) 
     median_longitude = longitudes[longitudes.size()/2];
-
-  return num_total_points;
 }
 
-// Load a csv file
-void load_csv(std::string const& file_name,
-                 std::int64_t num_points_to_load,
-                 vw::BBox2 const& lonlat_box,
-                 bool calc_shift,
-                 vw::Vector3 & shift,
-                 vw::cartography::GeoReference const& geo,
-                 CsvConv const& csv_conv,
-                 bool & is_lola_rdr_format,
-                 double & median_longitude,
-                 bool verbose,
-                 DoubleMatrix & data){
-
-  std::int64_t num_total_points = load_csv_aux(file_name, num_points_to_load,
-                                      lonlat_box,
-                                      calc_shift, shift,
-                                      geo, csv_conv, is_lola_rdr_format,
-                                      median_longitude, verbose, data);
-  
-  std::int64_t num_loaded_points = data.cols();
-  if (!lonlat_box.empty()                    &&
-      num_loaded_points < num_points_to_load &&
-      num_loaded_points < num_total_points){
-    // We loaded too few points. Just load them all, as CSV files are
-    // not too large, we will drop extraneous points later.
-    load_csv_aux(file_name, num_total_points, lonlat_box,
-                 calc_shift, shift,
-                 geo, csv_conv, is_lola_rdr_format,
-                 median_longitude,
-                 false, // Skip repeating same messages
-                 data);
+namespace {
+
+// The rows of an image given to each task when sampling it, and the
+// columns it reads at a time
+const int SAMPLE_BLOCK_ROWS = 256;
+const int SAMPLE_BLOCK_COLS = 256;
+
+// Sample the points of a block of rows of an image. The index of a
+// pixel in the image, in row-major order, decides if it is sampled, and
+// to_point(col, row, pix, xyz) finds its point, or returns false if there
+// is none. Each task owns its to_point, as that may hold a georeference.
+template <class ImageT, class ToPointT>
+class SampleRowsTask: public vw::Task, private boost::noncopyable {
+  ImageT const& m_image;
+  vw::BBox2i    m_box;
+  ToPointT      m_to_point;
+  PointSampler & m_sampler;
+  vw::TerminalProgressCallback * m_tpc; // NULL if not verbose
+  double        m_inc_amount;
+  vw::Mutex   & m_tpc_mutex;
+public:
+  SampleRowsTask(ImageT const& image, vw::BBox2i const& box, ToPointT const& to_point,
+                 PointSampler & sampler, vw::TerminalProgressCallback * tpc,
+                 double inc_amount, vw::Mutex & tpc_mutex):
+    m_image(image), m_box(box), m_to_point(to_point), m_sampler(sampler),
+    m_tpc(tpc), m_inc_amount(inc_amount), m_tpc_mutex(tpc_mutex) {}
+
+  void operator()() {
+    typedef typename ImageT::pixel_type PixelT;
+
+    std::vector<PointSampler::Point> candidates;
+    for (int beg_col = m_box.min().x(); beg_col < m_box.max().x();
+         beg_col += SAMPLE_BLOCK_COLS) {
+      vw::BBox2i sub_box(beg_col, m_box.min().y(), SAMPLE_BLOCK_COLS, m_box.height());
+      sub_box.crop(m_box);
+
+      // The keys are much cheaper to find than the pixels are to read.
+      // Once the sample is full, read only the rows having a pixel
+      // which can still enter it, if any.
+      std::uint64_t threshold = m_sampler.threshold();
+      std::int64_t beg_row = sub_box.max().y(), end_row = sub_box.min().y();
+      for (std::int64_t row = sub_box.min().y(); row < sub_box.max().y(); row++) {
+        std::uint64_t index = std::uint64_t(row) * std::uint64_t(m_image.cols()) + beg_col;
+        for (int c = 0; c < sub_box.width(); c++) {
+          if (PointSampler::key(index + c) < threshold) {
+            beg_row = std::min(beg_row, row);
+            end_row = row + 1;
+            break;
+          }
+        }
+      }
+      if (beg_row >= end_row)
+        continue;
+      sub_box = vw::BBox2i(beg_col, beg_row, sub_box.width(), end_row - beg_row);
+      vw::ImageView<PixelT> block = vw::crop(m_image, sub_box);
+
+      for (int r = 0; r < block.rows(); r++) {
+        // Refreshed once per row. A stale threshold only lets in extra candidates.
+        threshold = m_sampler.threshold();
+        std::int64_t row = sub_box.min().y() + r;
+        for (int c = 0; c < block.cols(); c++) {
+          std::int64_t col = sub_box.min().x() + c;
+          PointSampler::Point p;
+          p.index = std::uint64_t(row) * std::uint64_t(m_image.cols()) + col;
+          if (PointSampler::key(p.index) >= threshold)
+            continue;
+          if (!m_to_point(col, row, block(c, r), p.xyz))
+            continue;
+          p.lon = 0.0;
+          candidates.push_back(p);
+        }
+      }
+      // Add the candidates now, so the threshold drops for the next sub-block
+      m_sampler.add(candidates);
+    }
+
+    if (m_tpc != NULL) {
+      vw::Mutex::Lock lock(m_tpc_mutex);
+      m_tpc->report_incremental_progress(m_inc_amount);
+    }
   }
-  
-  return;
+};
+
+// Sample the points of the pixels of an image in the given box, in
+// parallel over blocks of rows
+template <class ImageT, class ToPointT>
+void sample_image_points(ImageT const& image, vw::BBox2i const& box,
+                         ToPointT const& to_point, bool verbose,
+                         PointSampler & sampler) {
+
+  int num_blocks = (box.height() + SAMPLE_BLOCK_ROWS - 1) / SAMPLE_BLOCK_ROWS;
+  vw::TerminalProgressCallback tpc("asp", "\t--> ");
+  vw::Mutex tpc_mutex;
+  if (verbose)
+    tpc.report_progress(0);
+
+  vw::FifoWorkQueue queue(vw::vw_settings().default_num_threads());
+  for (int b = 0; b < num_blocks; b++) {
+    vw::BBox2i block_box(box.min().x(), box.min().y() + b * SAMPLE_BLOCK_ROWS,
+                         box.width(), SAMPLE_BLOCK_ROWS);
+    block_box.crop(box);
+    boost::shared_ptr<vw::Task> task
+      (new SampleRowsTask<ImageT, ToPointT>(image, block_box, to_point, sampler,
+                                            verbose ? &tpc : NULL,
+                                            1.0 / std::max(num_blocks, 1), tpc_mutex));
+    queue.add_task(task);
+  }
+  queue.join_all();
+
+  if (verbose)
+    tpc.report_finished();
 }
 
+// The point at a DEM pixel, if valid and in the lon-lat box. The
+// georeference is read anew for each copy, so each thread has its own.
+template <typename DemPixelType>
+class DemToPoint {
+  std::string  m_file_name;
+  DemPixelType m_nodata;
+  vw::BBox2    m_lonlat_box;
+  vw::cartography::GeoReference m_geo;
+public:
+  DemToPoint(std::string const& file_name, DemPixelType nodata, vw::BBox2 const& lonlat_box):
+    m_file_name(file_name), m_nodata(nodata), m_lonlat_box(lonlat_box) {
+    if (!vw::cartography::read_georeference(m_geo, m_file_name))
+      vw_throw(vw::ArgumentErr() << "DEM: " << m_file_name
+                                 << " does not have a georeference.\n");
+  }
+  DemToPoint(DemToPoint const& other):
+    DemToPoint(other.m_file_name, other.m_nodata, other.m_lonlat_box) {}
+
+  bool operator()(std::int64_t col, std::int64_t row, DemPixelType h,
+                  vw::Vector3 & xyz) const {
+    if (h == m_nodata || std::isnan(h) || std::isinf(h))
+      return false;
+
+    vw::Vector2 lonlat = m_geo.pixel_to_lonlat(vw::Vector2(col, row));
+
+    // Skip points outside the given box
+    if (!m_lonlat_box.empty() && !m_lonlat_box.contains(lonlat))
+      return false;
+
+    xyz = m_geo.datum().geodetic_to_cartesian(vw::Vector3(lonlat.x(), lonlat.y(), h));
+    return !(xyz == vw::Vector3() || !(xyz == xyz)); // invalid and NaN check
+  }
+};
+
+// The point at a point cloud pixel, if valid and in the lon-lat box
+class PcToPoint {
+  vw::BBox2 m_lonlat_box;
+  vw::cartography::Datum m_datum;
+public:
+  PcToPoint(vw::BBox2 const& lonlat_box, vw::cartography::Datum const& datum):
+    m_lonlat_box(lonlat_box), m_datum(datum) {}
+
+  bool operator()(std::int64_t col, std::int64_t row, vw::Vector3 const& pix,
+                  vw::Vector3 & xyz) const {
+    xyz = pix;
+    if (xyz == vw::Vector3() || !(xyz == xyz))
+      return false; // invalid and NaN check
+
+    // Skip points outside the given box
+    if (!m_lonlat_box.empty()) {
+      vw::Vector3 llh = m_datum.cartesian_to_geodetic(xyz);
+      if (!m_lonlat_box.contains(subvector(llh, 0, 2)))
+        return false;
+    }
+    return true;
+  }
+};
+
+} // end anonymous namespace
+
 // Load a DEM
 template<typename DemPixelType>
 void load_dem_pixel_type(std::string const& file_name,
                          std::int64_t num_points_to_load, vw::BBox2 const& lonlat_box,
                          bool calc_shift, vw::Vector3 & shift,
                          bool verbose, DoubleMatrix & data){
-  
-  data.conservativeResize(DIM+1, num_points_to_load);
 
   vw::cartography::GeoReference dem_geo;
   bool has_georef = vw::cartography::read_georeference( dem_geo, file_name );
@@ -418,64 +685,10 @@ void load_dem_pixel_type(std::string const& file_name,
   if (pix_box.empty())
     pix_box = bounding_box(dem);
 
-  // We will randomly pick or not a point with probability load_ratio.
-  // Use int64_t to avoid integer overflow
-  std::int64_t num_points = std::int64_t(pix_box.width()) * std::int64_t(pix_box.height());
-  double load_ratio = (double)num_points_to_load/std::max(1.0, (double)num_points);
-
-  bool shift_was_calc = false;
-  std::int64_t  points_count   = 0;
-
-  vw::TerminalProgressCallback tpc("asp", "\t--> ");
-  double inc_amount = 1.0 / double(pix_box.width() );
-  if (verbose)
-    tpc.report_progress(0);
-
-  for (std::int64_t i = pix_box.min().x(); i < pix_box.max().x(); i++ ) {
-
-    for (std::int64_t j = pix_box.min().y(); j < pix_box.max().y(); j++ ) {
-      if (points_count >= num_points_to_load)
-        break;
-
-      double r = (double)std::rand()/(double)RAND_MAX;
-      if (r > load_ratio)
-        continue;
-
-      DemPixelType h = dem(i, j);
-      if ( h == nodata || std::isnan(h) || std::isinf(h) )
-        continue;
-      
-      vw::Vector2 lonlat = dem_geo.pixel_to_lonlat( vw::Vector2(i,j) );
-
-      // Skip points outside the given box
-      if (!lonlat_box.empty() && !lonlat_box.contains(lonlat))
-        continue;
-
-      vw::Vector3 llh( lonlat.x(), lonlat.y(), h );
-      vw::Vector3 xyz = dem_geo.datum().geodetic_to_cartesian( llh );
-      if ( xyz == vw::Vector3() || !(xyz == xyz) )
-        continue; // invalid and NaN check
-
-      if (calc_shift && !shift_was_calc){
-        shift = xyz;
-        shift_was_calc = true;
-      }
-
-      for (std::int64_t row = 0; row < DIM; row++)
-        data(row, points_count) = xyz[row] - shift[row];
-      data(DIM, points_count) = 1; // Extend to be a homogenous coordinate
-
-      points_count++;
-    } // end y loop
-
-    if (verbose)
-      tpc.report_incremental_progress( inc_amount );
-  } // end x loop
-  if (verbose)
-    tpc.report_finished();
-
-  data.conservativeResize(Eigen::NoChange, points_count);
-
+  PointSampler sampler(num_points_to_load);
+  sample_image_points(dem, pix_box, DemToPoint<DemPixelType>(file_name, nodata, lonlat_box),
+                      verbose, sampler);
+  sampled_points_to_matrix(sampler, calc_shift, shift, data);
 }
 
 // Load a DEM
@@ -502,73 +715,6 @@ void load_dem(std::string const& file_name,
   }
 }
 
-vw::int64 load_pc_aux(std::string const& file_name,
-                      std::int64_t num_points_to_load,
-                      vw::BBox2 const& lonlat_box,
-                      bool calc_shift,
-                      vw::Vector3 & shift,
-                      vw::cartography::GeoReference const& geo,
-                      bool verbose, DoubleMatrix & data){
-
-  data.conservativeResize(DIM+1, num_points_to_load);
-
-  // To do: Is it faster to to do for_each?
-  vw::ImageViewRef<vw::Vector3> point_cloud = read_asp_point_cloud<DIM>(file_name);
-
-  // We will randomly pick or not a point with probability load_ratio
-  // Use std::int64_t to avoid integer overflow.
-  vw::int64 num_total_points = std::int64_t(point_cloud.cols()) * std::int64_t(point_cloud.rows());
-  double load_ratio = (double)num_points_to_load/std::max(1.0, (double)num_total_points);
-
-  bool shift_was_calc = false;
-  vw::int64 points_count = 0;
-
-  vw::TerminalProgressCallback tpc("asp", "\t--> ");
-  double inc_amount = 1.0 / double(point_cloud.rows() );
-  if (verbose) tpc.report_progress(0);
-
-  for (std::int64_t j = 0; j < point_cloud.rows(); j++ ) {
-
-    for ( std::int64_t i = 0; i < point_cloud.cols(); i++ ) {
-
-      if (points_count >= num_points_to_load)
-        break;
-
-      double r = (double)std::rand()/(double)RAND_MAX;
-      if (r > load_ratio)
-        continue;
-
-      vw::Vector3 xyz = point_cloud(i, j);
-      if ( xyz == vw::Vector3() || !(xyz == xyz) )
-        continue; // invalid and NaN check
-
-      if (calc_shift && !shift_was_calc){
-        shift = xyz;
-        shift_was_calc = true;
-      }
-
-      // Skip points outside the given box
-      if (!lonlat_box.empty()){
-        vw::Vector3 llh = geo.datum().cartesian_to_geodetic(xyz);
-        if ( !lonlat_box.contains(subvector(llh, 0, 2)))
-          continue;
-      }
-
-      for (std::int64_t row = 0; row < DIM; row++)
-        data(row, points_count) = xyz[row] - shift[row];
-      data(DIM, points_count) = 1;
-
-      points_count++;
-    }
-    if (verbose) tpc.report_incremental_progress( inc_amount );
-  }
-  if (verbose) tpc.report_finished();
-
-  data.conservativeResize(Eigen::NoChange, points_count);
-
-  return num_total_points;
-}
-
 void load_pc(std::string const& file_name,
              std::int64_t num_points_to_load,
              vw::BBox2 const& lonlat_box,
@@ -577,24 +723,26 @@ void load_pc(std::string const& file_name,
              vw::cartography::GeoReference const& geo,
              bool verbose, DoubleMatrix & data){
 
-  vw::int64 num_total_points = load_pc_aux(file_name, num_points_to_load,
-                                          lonlat_box, calc_shift, shift,
-                                          geo, verbose, data);
-
-  std::int64_t num_loaded_points = data.cols();
-  if (!lonlat_box.empty()                    &&
-      num_loaded_points < num_points_to_load &&
-      num_loaded_points < num_total_points){
-
-    // We loaded too few points. Try harder. Need some care here as to not run
-    // out of memory.
-    num_points_to_load = std::max(4*num_points_to_load, std::int64_t(10000000));
-    if (verbose)
-      vw::vw_out() << "Too few points were loaded. Trying again." << std::endl;
-    load_pc_aux(file_name, num_points_to_load, lonlat_box,
-                calc_shift, shift, geo, verbose, data);
+  // For chunked clouds, skip the chunks with no points in the box. The
+  // box may use longitudes in a different range than the chunks.
+  asp::ChunkFilter filter;
+  if (!lonlat_box.empty()) {
+    vw::cartography::Datum datum = geo.datum();
+    filter = [lonlat_box, datum](vw::BBox3 const& xyz_box) {
+      vw::BBox2 chunk_box = asp::cartesian_box_to_lonlat_box(xyz_box, datum);
+      for (int k = -1; k <= 1; k++) {
+        if (lonlat_box.intersects(chunk_box + vw::Vector2(360.0 * k, 0.0)))
+          return true;
+      }
+      return false;
+    };
   }
+  vw::ImageViewRef<vw::Vector3> point_cloud = read_asp_point_cloud<DIM>(file_name, filter);
 
+  PointSampler sampler(num_points_to_load);
+  sample_image_points(point_cloud, bounding_box(point_cloud),
+                      PcToPoint(lonlat_box, geo.datum()), verbose, sampler);
+  sampled_points_to_matrix(sampler, calc_shift, shift, data);
 }
 
 // Find the best-fitting plane to a set of points. It will throw an
@@ -29,6 +29,7 @@
 #include <asp/Core/Common.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/PointSampler.h>
 #include <Eigen/Dense>
 
 // A set of routines kept here because they use Eigen, and a set of routine
@@ -46,6 +47,17 @@ const int DIM = 3;
 // Return at most m random points out of the input point cloud.
 void random_pc_subsample(std::int64_t m, DoubleMatrix& points);
   
+// Put the sampled points in the matrix, minus the shift, as homogeneous
+// coordinates, in file order. If calc_shift, the shift is the first of the
+// points. The longitudes the points had in the file are saved if asked.
+void sampled_points_to_matrix(PointSampler & sampler, bool calc_shift,
+                              vw::Vector3 & shift, DoubleMatrix & data,
+                              std::vector<double> * longitudes = NULL);
+
+// The loaders below keep a uniform random sample of at most
+// num_points_to_load of the points in lonlat_box, if not empty, found
+// in one pass over the file. See PointSampler.
+
 // Load a csv file, perhaps sub-sampling it along the way
 void load_csv(std::string const& file_name,
               std::int64_t num_points_to_load,
@@ -0,0 +1,47 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file ExitReport.h
+///
+/// Support for singletons which are never deleted, so that they can
+/// still be used at exit, to report on what they did.
+
+#ifndef __ASP_CORE_EXIT_REPORT_H__
+#define __ASP_CORE_EXIT_REPORT_H__
+
+#include <vw/Core/Log.h>
+
+#include <cstdlib>
+#include <string>
+
+namespace asp {
+
+  /// Log a message, then have a function called at exit, and return the
+  /// given object. Meant to initialize a function-local static pointer
+  /// to a singleton, which C++11 makes thread-safe. The log is made
+  /// first, so that it still exists when the function runs at exit.
+  template <class T>
+  T * report_at_exit(T * obj, std::string const& msg, void (*func)()) {
+    vw::vw_out(vw::DebugMessage, "asp") << msg << "\n";
+    std::atexit(func);
+    return obj;
+  }
+
+} // end namespace asp
+
+#endif//__ASP_CORE_EXIT_REPORT_H__
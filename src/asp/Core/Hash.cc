@@ -0,0 +1,49 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file Hash.cc
+///
+
+#include <asp/Core/Hash.h>
+
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+namespace asp {
+
+bool hash_file(std::string const& file, std::uint64_t & hash) {
+  std::ifstream ifs(file.c_str(), std::ios::binary);
+  if (!ifs)
+    return false;
+  hash = HASH_START;
+  std::vector<char> buf(1 << 16);
+  while (ifs) {
+    ifs.read(&buf[0], buf.size());
+    hash_bytes(&buf[0], ifs.gcount(), hash);
+  }
+  return ifs.eof();
+}
+
+std::string hash_to_hex(std::uint64_t hash) {
+  std::ostringstream os;
+  os << std::hex << std::setw(16) << std::setfill('0') << hash;
+  return os.str();
+}
+
+} // end namespace asp
@@ -0,0 +1,85 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file Hash.h
+///
+/// The 64-bit FNV-1a hash, used to tell if inputs changed since a result
+/// was cached. It is fast and simple, but not meant to resist
+/// deliberate collisions.
+
+#ifndef __ASP_CORE_HASH_H__
+#define __ASP_CORE_HASH_H__
+
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Math/BBox.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace asp {
+
+  /// The starting value of a hash
+  const std::uint64_t HASH_START = 14695981039346656037ULL;
+
+  /// Add some bytes to a hash
+  inline void hash_bytes(const void * data, size_t len, std::uint64_t & hash) {
+    const unsigned char * p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < len; i++) {
+      hash ^= p[i];
+      hash *= 1099511628211ULL;
+    }
+  }
+
+  /// The hash of a string
+  inline std::uint64_t hash_string(std::string const& str) {
+    std::uint64_t hash = HASH_START;
+    hash_bytes(str.data(), str.size(), hash);
+    return hash;
+  }
+
+  /// The hash of the contents of a file. Return false if it cannot be read.
+  bool hash_file(std::string const& file, std::uint64_t & hash);
+
+  /// A hash in hex, with 16 digits
+  std::string hash_to_hex(std::uint64_t hash);
+
+  /// Add to a hash the box and the pixels of an image in it. The image is
+  /// read a band of rows at a time, as the box can be the whole image.
+  template <class ImageT>
+  void hash_image_box(vw::ImageViewBase<ImageT> const& image, vw::BBox2i const& box,
+                      std::uint64_t & hash) {
+    std::int32_t vals[4] = {box.min().x(), box.min().y(), box.width(), box.height()};
+    hash_bytes(vals, sizeof(vals), hash);
+    if (box.empty())
+      return;
+    typedef typename ImageT::pixel_type PixelT;
+    const int band_rows = 256;
+    for (int row = box.min().y(); row < box.max().y(); row += band_rows) {
+      vw::BBox2i band(box.min().x(), row, box.width(),
+                      std::min(band_rows, box.max().y() - row));
+      vw::ImageView<PixelT> pixels = vw::crop(image.impl(), band);
+      hash_bytes(&pixels(0, 0), sizeof(PixelT) * pixels.cols() * pixels.rows(), hash);
+    }
+  }
+
+} // end namespace asp
+
+#endif//__ASP_CORE_HASH_H__
@@ -21,6 +21,8 @@
 #include <asp/Core/ImageNormalization.h>
 #include <asp/Core/StereoSettings.h>
 
+#include <algorithm>
+#include <cmath>
 #include <limits>
 
 using namespace vw;
@@ -58,4 +60,61 @@ namespace asp {
     return;
   }
   
+  StatsSketch::StatsSketch(): m_count(0), m_mean(0.0), m_m2(0.0),
+                               m_min(std::numeric_limits<double>::max()),
+                               m_max(-std::numeric_limits<double>::max()) {}
+
+  void StatsSketch::add(double val) {
+    // Welford's update of the mean and the sum of squared deviations
+    m_count++;
+    double delta = val - m_mean;
+    m_mean += delta / m_count;
+    m_m2   += delta * (val - m_mean);
+    m_min = std::min(m_min, val);
+    m_max = std::max(m_max, val);
+    m_samples.push_back(val);
+  }
+
+  void StatsSketch::merge(StatsSketch const& other) {
+    if (other.m_count == 0)
+      return;
+    if (m_count == 0) {
+      *this = other;
+      return;
+    }
+
+    // The pairwise update of Chan et al.
+    double n1 = m_count, n2 = other.m_count, n = n1 + n2;
+    double delta = other.m_mean - m_mean;
+    m_mean += delta * n2 / n;
+    m_m2   += other.m_m2 + delta * delta * n1 * n2 / n;
+    m_count += other.m_count;
+    m_min = std::min(m_min, other.m_min);
+    m_max = std::max(m_max, other.m_max);
+    m_samples.insert(m_samples.end(), other.m_samples.begin(), other.m_samples.end());
+  }
+
+  Vector6f StatsSketch::stats() const {
+    Vector6f result;
+    if (m_count == 0)
+      return result;
+
+    result[0] = m_min;
+    result[1] = m_max;
+    result[2] = m_mean;
+    result[3] = std::sqrt(m_m2 / m_count);
+
+    // The percentiles are exact for the samples. Finding them does not
+    // depend on the order in which the samples were merged.
+    std::vector<float> samples = m_samples;
+    double pct[2] = {0.02, 0.98};
+    for (int i = 0; i < 2; i++) {
+      size_t k = size_t(std::round(pct[i] * (samples.size() - 1)));
+      std::nth_element(samples.begin(), samples.begin() + k, samples.end());
+      result[4 + i] = samples[k];
+    }
+
+    return result;
+  }
+
 }
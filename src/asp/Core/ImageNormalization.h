@@ -22,10 +22,17 @@
 #ifndef __IMAGE_NORMALIZATION_H__
 #define __IMAGE_NORMALIZATION_H__
 
+#include <vw/Core/ThreadPool.h>
 #include <vw/Image/Algorithms.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Image/PixelTypeInfo.h>
 
 #include <boost/shared_ptr.hpp>
 
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
 namespace vw {
   class DiskImageResource;
 }
@@ -40,6 +47,101 @@ namespace asp {
                          float & left_nodata_value,
                          float & right_nodata_value);
 
+  /// Mergeable statistics of a sample of pixel values. Sketches of
+  /// disjoint parts of an image can be formed in parallel and then
+  /// merged. If merged in a fixed order, the result does not depend
+  /// on the number of threads.
+  class StatsSketch {
+  public:
+    StatsSketch();
+
+    void add(double val);
+    void merge(StatsSketch const& other);
+    std::int64_t count() const { return m_count; }
+
+    /// The min, max, mean, standard deviation, and the 2nd and 98th
+    /// percentiles of the values, in the order gather_stats() returns them.
+    Vector6f stats() const;
+
+  private:
+    std::int64_t m_count;
+    double m_mean, m_m2, m_min, m_max; // m_m2 is the sum of squared deviations
+    std::vector<float> m_samples;       // for the percentiles
+  };
+
+  namespace detail {
+
+    // Add the channels of a pixel to a sketch, skipping invalid pixels
+    template <class PixelT>
+    void add_to_sketch(PixelT const& pix, StatsSketch & sketch) {
+      typedef typename vw::CompoundChannelType<PixelT>::type channel_type;
+      for (int c = 0; c < int(vw::CompoundNumChannels<PixelT>::value); c++)
+        sketch.add(vw::compound_select_channel<channel_type const&>(pix, c));
+    }
+    template <class ChildT>
+    void add_to_sketch(vw::PixelMask<ChildT> const& pix, StatsSketch & sketch) {
+      if (is_valid(pix))
+        add_to_sketch(pix.child(), sketch);
+    }
+
+    // Sample every stat_scale-th pixel of a band of rows of an image
+    template <class ViewT>
+    class StatsSketchTask: public vw::Task, private boost::noncopyable {
+      ViewT const& m_view;
+      int m_scale, m_beg_row, m_end_row;
+      StatsSketch & m_sketch;
+    public:
+      StatsSketchTask(ViewT const& view, int scale, int beg_row, int end_row,
+                      StatsSketch & sketch):
+        m_view(view), m_scale(scale), m_beg_row(beg_row), m_end_row(end_row),
+        m_sketch(sketch) {}
+
+      virtual void operator()() {
+        for (int row = m_beg_row; row < m_end_row; row += m_scale) {
+          for (int col = 0; col < m_view.cols(); col += m_scale)
+            add_to_sketch(m_view(col, row), m_sketch);
+        }
+      }
+    };
+
+  } // end namespace detail
+
+  /// Find the statistics of an image from every stat_scale-th pixel in
+  /// each direction, with bands of rows sampled in parallel. The result
+  /// is the same for any number of threads.
+  template <class ViewT>
+  Vector6f block_sampled_stats(vw::ImageViewBase<ViewT> const& view_base,
+                               int stat_scale, int num_threads) {
+
+    ViewT const& view = view_base.impl();
+    stat_scale  = std::max(stat_scale, 1);
+    num_threads = std::max(num_threads, 1);
+
+    // The bands do not depend on the number of threads, and are
+    // merged in order, so neither does the result.
+    const int SAMPLED_ROWS_PER_BAND = 16;
+    int band_rows = SAMPLED_ROWS_PER_BAND * stat_scale;
+
+    int num_bands = (view.rows() + band_rows - 1) / band_rows;
+    std::vector<StatsSketch> sketches(std::max(num_bands, 0));
+    vw::FifoWorkQueue queue(num_threads);
+    for (int band = 0; band < num_bands; band++) {
+      int beg_row = band * band_rows;
+      int end_row = std::min(beg_row + band_rows, int(view.rows()));
+      boost::shared_ptr<vw::Task>
+        task(new detail::StatsSketchTask<ViewT>(view, stat_scale, beg_row, end_row,
+                                                sketches[band]));
+      queue.add_task(task);
+    }
+    queue.join_all();
+
+    StatsSketch sketch;
+    for (size_t band = 0; band < sketches.size(); band++)
+      sketch.merge(sketches[band]);
+
+    return sketch.stats();
+  }
+
   /// Normalize the intensity of two grayscale images based on input statistics
   template<class ImageT>
   void normalize_images(bool force_use_entire_range,
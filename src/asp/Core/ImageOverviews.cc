@@ -0,0 +1,155 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file ImageOverviews.cc
+///
+
+#include <asp/Core/ImageOverviews.h>
+#include <asp/Core/FileUtils.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/Functors.h>
+#include <vw/Core/Log.h>
+#include <vw/Core/ProgressCallback.h>
+#include <vw/Core/StringUtils.h>
+#include <vw/FileIO/DiskImageResourceGDAL.h>
+#include <vw/FileIO/DiskImageUtils.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <vw/FileIO/FileUtils.h>
+#include <vw/Image/AntiAliasing.h>
+#include <vw/Image/MaskViews.h>
+#include <vw/Image/PerPixelViews.h>
+#include <vw/Cartography/GeoReference.h>
+#include <vw/Cartography/GeoReferenceUtils.h>
+
+#include <boost/filesystem.hpp>
+
+#include <cmath>
+#include <limits>
+#include <map>
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+  // Keywords saved in each overview
+  const std::string KERNEL_TAG = "ASP_OVERVIEW_KERNEL";
+  const std::string NODATA_TAG = "ASP_OVERVIEW_NODATA";
+
+  // Mask the pixels equal to the no-data value, and NaN ones
+  struct MaskNodata: public vw::ReturnFixedType<vw::PixelMask<float>> {
+    float m_nodata;
+    MaskNodata(float nodata): m_nodata(nodata) {}
+    vw::PixelMask<float> operator()(float val) const {
+      if (val == m_nodata || std::isnan(val))
+        return vw::PixelMask<float>();
+      return vw::PixelMask<float>(val);
+    }
+  };
+
+  // The no-data value is recorded as a string, so NaN can be compared
+  std::string nodata_str(double nodata) {
+    return vw::num_to_str(nodata, 17);
+  }
+
+  // If the overview exists, is newer than the image, and was made the
+  // same way
+  bool is_good_overview(std::string const& ovr_file, std::string const& image_file,
+                        double nodata) {
+    if (!fs::exists(ovr_file) || !asp::is_latest_timestamp(ovr_file, image_file))
+      return false;
+    try {
+      vw::DiskImageResourceGDAL rsrc(ovr_file);
+      std::string kernel, ovr_nodata;
+      vw::cartography::read_header_string(rsrc, KERNEL_TAG, kernel);
+      vw::cartography::read_header_string(rsrc, NODATA_TAG, ovr_nodata);
+      return kernel == asp::OVERVIEW_KERNEL && ovr_nodata == nodata_str(nodata);
+    } catch (...) {
+      return false; // such as a partly written file
+    }
+  }
+
+} // end anonymous namespace
+
+std::string asp::overview_file(std::string const& image_file, int level,
+                               std::string const& cache_dir) {
+  fs::path image_path(image_file);
+  std::string name = image_path.stem().string() + "-ovr"
+    + vw::num_to_str(1 << level) + ".tif";
+  fs::path dir = cache_dir.empty() ? image_path.parent_path() : fs::path(cache_dir);
+  return (dir / name).string();
+}
+
+vw::ImageViewRef<vw::PixelMask<float>>
+asp::image_overview(std::string const& image_file, double nodata, int level,
+                    vw::GdalWriteOptions const& opt, std::string const& cache_dir) {
+
+  if (level < 0)
+    vw::vw_throw(vw::ArgumentErr() << "The overview level must be non-negative.\n");
+
+  if (level == 0)
+    return vw::per_pixel_filter(vw::pixel_cast<float>(vw::load_image_as_double(image_file)),
+                                MaskNodata(nodata));
+
+  // The overviews are written with the no-data value of the image, if
+  // it is a number
+  float ovr_nodata = std::isnan(nodata) ? -std::numeric_limits<float>::max() : nodata;
+
+  std::string ovr_file = overview_file(image_file, level, cache_dir);
+  if (!is_good_overview(ovr_file, image_file, nodata)) {
+
+    vw::ImageViewRef<vw::PixelMask<float>> finer
+      = image_overview(image_file, nodata, level - 1, opt, cache_dir);
+    vw::ImageViewRef<vw::PixelMask<float>> coarser = vw::resample_aa(finer, 0.5);
+
+    // The georeference of the image, scaled as the pixels are
+    vw::cartography::GeoReference georef;
+    bool has_georef = vw::cartography::read_georeference(georef, image_file);
+    if (has_georef) {
+      vw::DiskImageResourceGDAL rsrc(image_file);
+      double scale = 0.5 * (double(coarser.cols()) / rsrc.cols() +
+                            double(coarser.rows()) / rsrc.rows());
+      georef = vw::cartography::resample(georef, scale);
+    }
+
+    std::map<std::string, std::string> keywords;
+    keywords[KERNEL_TAG] = OVERVIEW_KERNEL;
+    keywords[NODATA_TAG] = nodata_str(nodata);
+
+    // Write to a temporary file first, so another process never reads
+    // a partly written overview. If it cannot be written, such as in a
+    // read-only directory, use it from memory.
+    std::string tmp_file = fs::path(ovr_file).replace_extension(".tmp.tif").string();
+    try {
+      vw::create_out_dir(ovr_file);
+      vw::vw_out() << "Writing overview: " << ovr_file << "\n";
+      bool has_nodata = true;
+      vw::cartography::block_write_gdal_image
+        (tmp_file, vw::apply_mask(coarser, ovr_nodata),
+         has_georef, georef, has_nodata, ovr_nodata, opt,
+         vw::TerminalProgressCallback("asp", "\t--> Overview: "), keywords);
+      fs::rename(tmp_file, ovr_file);
+    } catch (std::exception const& e) {
+      vw::vw_out(vw::WarningMessage) << "Could not save overview " << ovr_file << ": "
+                                     << e.what() << "\n";
+      boost::system::error_code ec;
+      fs::remove(tmp_file, ec);
+      return coarser;
+    }
+  }
+
+  return vw::per_pixel_filter(vw::DiskImageView<float>(ovr_file), MaskNodata(ovr_nodata));
+}
@@ -0,0 +1,60 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file ImageOverviews.h
+///
+/// Power-of-two overviews of an image, made once and kept on disk, so
+/// that tools which need an image at a lower resolution can share them
+/// instead of each downsampling it anew. The overview at level l has
+/// 1/2^l of the resolution of the image, and is made from the one at
+/// level l - 1 with the kernel recorded in it.
+
+#ifndef __ASP_CORE_IMAGE_OVERVIEWS_H__
+#define __ASP_CORE_IMAGE_OVERVIEWS_H__
+
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/FileIO/GdalWriteOptions.h>
+
+#include <string>
+
+namespace asp {
+
+  /// The kernel used to make the overviews. It is saved in each
+  /// overview, and one made otherwise is made again.
+  const std::string OVERVIEW_KERNEL = "resample_aa";
+
+  /// The file having the overview of an image at given level. It is
+  /// next to the image, or in cache_dir if that is not empty. For
+  /// example, dir/image-ovr4.tif is for dir/image.tif at level 2.
+  std::string overview_file(std::string const& image_file, int level,
+                            std::string const& cache_dir = "");
+
+  /// The first band of an image at 1/2^level of its resolution, with
+  /// the pixels equal to nodata masked. Level 0 is the image itself. An
+  /// overview is read if it is newer than the image and was made with
+  /// the same kernel and no-data value. Otherwise it is made from the
+  /// overview one level finer, found the same way, and saved, so that
+  /// the next tool asking for it can just read it. If it cannot be
+  /// saved, it is returned from memory.
+  vw::ImageViewRef<vw::PixelMask<float>>
+  image_overview(std::string const& image_file, double nodata, int level,
+                 vw::GdalWriteOptions const& opt, std::string const& cache_dir = "");
+
+} // end namespace asp
+
+#endif // __ASP_CORE_IMAGE_OVERVIEWS_H__
@@ -16,11 +16,19 @@
 // __END_LICENSE__
 
 #include <asp/Core/InterestPointMatching.h>
+#include <asp/Core/Hash.h>
+#include <asp/Core/ParallelRansac.h>
 #include <vw/Math/GaussianClustering.h>
 #include <vw/Math/RANSAC.h>
 #include <vw/Cartography/CameraBBox.h>
 #include <vw/Stereo/StereoModel.h>
 
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <bitset>
+#include <fstream>
+
 using namespace vw;
 
 namespace asp {
@@ -109,6 +117,150 @@ double EpipolarLinePointMatcher::distance_point_line(Vector3 const& line,
     norm_2(subvector(line, 0, 2));
 }
 
+// Local helpers -----
+namespace {
+
+  // Matches this much farther than the epipolar threshold from the line
+  // still count when checking that the best match is unique.
+  const double EPIPOLAR_BAND_EXPANSION = 200;
+
+  // The right-image interest points binned into square cells, so that the
+  // ones near an epipolar line can be found without visiting all of them.
+  class IpGrid {
+  public:
+    IpGrid(std::vector<Vector2> const& points, double cell_size);
+
+    /// Append to the output the indices of the points within the given
+    /// distance from the line ax + by + c = 0. Return false, with the output
+    /// empty, if the cells to visit have more than max_num points, when a
+    /// search by descriptor is cheaper.
+    bool points_near_line(Vector3 const& line, double dist, size_t max_num,
+                          std::vector<int> & out) const;
+
+    /// Set the output to the indices of the points within the given
+    /// distance from the given point.
+    void points_near_point(Vector2 const& point, double dist, std::vector<int> & out) const;
+  private:
+    std::vector<Vector2> const& m_points;
+    Vector2 m_origin;
+    double  m_cell_size;
+    int     m_num_cols, m_num_rows;
+    std::vector<std::vector<int>> m_cells; // row-major
+  };
+
+  IpGrid::IpGrid(std::vector<Vector2> const& points, double cell_size): m_points(points) {
+    BBox2 box;
+    for (size_t i = 0; i < points.size(); i++)
+      box.grow(points[i]);
+
+    // Limit the number of cells for very large images
+    const double MAX_CELLS_PER_DIM = 1000.0;
+    m_cell_size = std::max(cell_size, std::max(box.width(), box.height()) / MAX_CELLS_PER_DIM);
+    m_cell_size = std::max(m_cell_size, 1.0);
+    m_origin    = box.min();
+    m_num_cols  = int(box.width()  / m_cell_size) + 1;
+    m_num_rows  = int(box.height() / m_cell_size) + 1;
+    m_cells.resize(m_num_cols * m_num_rows);
+    for (size_t i = 0; i < points.size(); i++) {
+      int col = int((points[i].x() - m_origin.x()) / m_cell_size);
+      int row = int((points[i].y() - m_origin.y()) / m_cell_size);
+      m_cells[row * m_num_cols + col].push_back(i);
+    }
+  }
+
+  bool IpGrid::points_near_line(Vector3 const& line, double dist, size_t max_num,
+                                std::vector<int> & out) const {
+    out.clear();
+    double len = norm_2(subvector(line, 0, 2));
+    if (!(len > 0))
+      return false;
+
+    // Walk along the image axis closest to the line direction. With the
+    // line p*major + q*minor + c = 0, the band of points within dist of it
+    // spans in each column of cells a range of the minor coordinate.
+    bool along_x  = (std::abs(line.y()) >= std::abs(line.x()));
+    double p = (along_x ? line.x() : line.y()) / len;
+    double q = (along_x ? line.y() : line.x()) / len; // |q| >= 1/sqrt(2)
+    double c = line.z() / len;
+    int    num_major = along_x ? m_num_cols   : m_num_rows;
+    int    num_minor = along_x ? m_num_rows   : m_num_cols;
+    double major0    = along_x ? m_origin.x() : m_origin.y();
+    double minor0    = along_x ? m_origin.y() : m_origin.x();
+    double half_band = dist / std::abs(q);
+
+    std::vector<int> cells;
+    size_t num_points = 0;
+    for (int i = 0; i < num_major; i++) {
+      double m0 = major0 + i * m_cell_size, m1 = m0 + m_cell_size;
+      double t0 = (-c - p * m0) / q, t1 = (-c - p * m1) / q;
+      double lo = (std::min(t0, t1) - half_band - minor0) / m_cell_size;
+      double hi = (std::max(t0, t1) + half_band - minor0) / m_cell_size;
+      if (hi < 0 || lo >= num_minor)
+        continue;
+      int j0 = std::max(0, int(std::floor(lo)));
+      int j1 = std::min(num_minor - 1, int(std::floor(hi)));
+      for (int j = j0; j <= j1; j++) {
+        int cell = along_x ? (j * m_num_cols + i) : (i * m_num_cols + j);
+        num_points += m_cells[cell].size();
+        cells.push_back(cell);
+      }
+      if (num_points > max_num)
+        return false;
+    }
+
+    for (size_t k = 0; k < cells.size(); k++) {
+      std::vector<int> const& cell = m_cells[cells[k]];
+      for (size_t n = 0; n < cell.size(); n++) {
+        if (EpipolarLinePointMatcher::distance_point_line(line, m_points[cell[n]]) < dist)
+          out.push_back(cell[n]);
+      }
+    }
+    return true;
+  }
+
+  void IpGrid::points_near_point(Vector2 const& point, double dist,
+                                 std::vector<int> & out) const {
+    out.clear();
+    int col0 = std::max(0, int(std::floor((point.x() - dist - m_origin.x()) / m_cell_size)));
+    int row0 = std::max(0, int(std::floor((point.y() - dist - m_origin.y()) / m_cell_size)));
+    int col1 = std::min(m_num_cols - 1,
+                        int(std::floor((point.x() + dist - m_origin.x()) / m_cell_size)));
+    int row1 = std::min(m_num_rows - 1,
+                        int(std::floor((point.y() + dist - m_origin.y()) / m_cell_size)));
+    for (int row = row0; row <= row1; row++) {
+      for (int col = col0; col <= col1; col++) {
+        std::vector<int> const& cell = m_cells[row * m_num_cols + col];
+        for (size_t n = 0; n < cell.size(); n++) {
+          if (norm_2(m_points[cell[n]] - point) <= dist)
+            out.push_back(cell[n]);
+        }
+      }
+    }
+  }
+
+  // The same distances as the FLANN trees use: squared L2 for float
+  // descriptors, Hamming for binary ones stored one byte per element.
+  float descriptor_distance(ip::InterestPoint const& ip1, ip::InterestPoint const& ip2,
+                            bool use_hamming) {
+    size_t len = std::min(ip1.descriptor.size(), ip2.descriptor.size());
+    float dist = 0;
+    if (use_hamming) {
+      for (size_t i = 0; i < len; i++) {
+        unsigned char diff = static_cast<unsigned char>(ip1.descriptor[i])
+                           ^ static_cast<unsigned char>(ip2.descriptor[i]);
+        dist += std::bitset<8>(diff).count();
+      }
+    } else {
+      for (size_t i = 0; i < len; i++) {
+        float diff = ip1.descriptor[i] - ip2.descriptor[i];
+        dist += diff * diff;
+      }
+    }
+    return dist;
+  }
+
+} // end anonymous namespace
+
 // Local class definition -----
 class EpipolarLineMatchTask : public Task, private boost::noncopyable {
   typedef ip::InterestPointList::const_iterator IPListIter;
@@ -116,8 +268,10 @@ class EpipolarLineMatchTask : public Task, private boost::noncopyable {
   bool                            m_use_uchar_tree;
   math::FLANNTree<float        >& m_tree_float;
   math::FLANNTree<unsigned char>& m_tree_uchar;
+  IpGrid                   const& m_grid;
   IPListIter                      m_start, m_end;
-  ip::InterestPointList const&    m_ip_other;
+  std::vector<ip::InterestPoint const*> const& m_ip_other;
+  std::vector<Vector2>     const& m_ip_other_coords;
   camera::CameraModel            *m_cam1, *m_cam2;
   EpipolarLinePointMatcher const& m_matcher;
   Mutex&                          m_camera_mutex;
@@ -127,9 +281,11 @@ public:
                          bool use_uchar_tree,
                          math::FLANNTree<float        >& tree_float,
                          math::FLANNTree<unsigned char>& tree_uchar,
+                         IpGrid const& grid,
                          ip::InterestPointList::const_iterator start,
                          ip::InterestPointList::const_iterator end,
-                         ip::InterestPointList const& ip2,
+                         std::vector<ip::InterestPoint const*> const& ip2,
+                         std::vector<Vector2> const& ip2_coords,
                          camera::CameraModel* cam1,
                          camera::CameraModel* cam2,
                          EpipolarLinePointMatcher const& matcher,
@@ -137,7 +293,7 @@ public:
                          std::vector<size_t>::iterator output ) :
     m_single_threaded_camera(single_threaded_camera),
     m_use_uchar_tree(use_uchar_tree), m_tree_float(tree_float), m_tree_uchar(tree_uchar),
-    m_start(start), m_end(end), m_ip_other(ip2),
+    m_grid(grid), m_start(start), m_end(end), m_ip_other(ip2), m_ip_other_coords(ip2_coords),
     m_cam1(cam1), m_cam2(cam2),
     m_matcher( matcher ), m_camera_mutex(camera_mutex), m_output(output) {}
 
@@ -147,74 +303,85 @@ public:
     Vector<int   > indices  (NUM_MATCHES_TO_FIND);
     Vector<double> distances(NUM_MATCHES_TO_FIND);
 
-    for ( IPListIter ip = m_start; ip != m_end; ip++ ) {
-      Vector2 ip_org_coord = Vector2( ip->x, ip->y );
-      Vector3 line_eq;
-
-      // Find the equation that describes the epipolar line
-      bool found_epipolar = false;
-      if (m_single_threaded_camera){
-        // ISIS camera is single-threaded
-        Mutex::Lock lock( m_camera_mutex );
-        line_eq = m_matcher.epipolar_line( ip_org_coord, m_matcher.m_datum, m_cam1, m_cam2, found_epipolar);
-      }else{
-        line_eq = m_matcher.epipolar_line( ip_org_coord, m_matcher.m_datum, m_cam1, m_cam2, found_epipolar);
+    // Up to this many points near the epipolar line are compared directly
+    // by descriptor. That is about the work of a FLANN search, and finds
+    // the best matches on the line rather than in the whole image.
+    const size_t MAX_BAND_CANDIDATES = 256;
+
+    double small_epipolar_threshold = m_matcher.m_epipolar_threshold;
+    double large_epipolar_threshold = small_epipolar_threshold + EPIPOLAR_BAND_EXPANSION;
+
+    // Find the equations that describe the epipolar lines, all at once,
+    // so a single-threaded camera is locked only once for this job.
+    std::vector<Vector3> line_eqs;
+    std::vector<char>    found_epipolar;
+    {
+      boost::shared_ptr<Mutex::Lock> lock;
+      if (m_single_threaded_camera) // ISIS camera is single-threaded
+        lock.reset(new Mutex::Lock(m_camera_mutex));
+      for ( IPListIter ip = m_start; ip != m_end; ip++ ) {
+        bool found = false;
+        line_eqs.push_back(m_matcher.epipolar_line(Vector2(ip->x, ip->y), m_matcher.m_datum,
+                                                   m_cam1, m_cam2, found));
+        found_epipolar.push_back(found);
       }
+    }
 
-      if (!found_epipolar) {
+    std::vector<std::pair<float,int> > candidates, kept_indices;
+    std::vector<int> band;
+    size_t ip_count = 0;
+    for ( IPListIter ip = m_start; ip != m_end; ip++, ip_count++ ) {
+      Vector3 const& line_eq = line_eqs[ip_count];
+
+      if (!found_epipolar[ip_count]) {
         *m_output++ = (size_t)(-1); // Failed to find a match, return a flag!
         continue; // Skip to the next IP
       }
 
-      // Use FLANN tree to find the N nearest neighbors according to the IP region descriptor?
-      std::vector<std::pair<float,int> > kept_indices;
-      kept_indices.reserve(NUM_MATCHES_TO_FIND);
-
-      // Call the correct FLANN tree for the matching type
-      size_t num_matches_valid = 0;
-      if (m_use_uchar_tree) {
-        vw::Vector<unsigned char> uchar_descriptor(ip->descriptor.size());
-        for (size_t i=0; i<ip->descriptor.size(); ++i)
-          uchar_descriptor[i] = static_cast<unsigned char>(ip->descriptor[i]);
-        num_matches_valid = m_tree_uchar.knn_search( uchar_descriptor, indices, distances, NUM_MATCHES_TO_FIND );
+      // The N nearest neighbors according to the IP region descriptor,
+      // among the points near the epipolar line if there are few of them,
+      // and else in the whole image, using the FLANN tree.
+      candidates.clear();
+      if (m_grid.points_near_line(line_eq, large_epipolar_threshold,
+                                  MAX_BAND_CANDIDATES, band)) {
+        for (size_t i = 0; i < band.size(); i++)
+          candidates.push_back(std::pair<float,int>
+                               (descriptor_distance(*ip, *m_ip_other[band[i]], m_use_uchar_tree),
+                                band[i]));
+        size_t num_keep = std::min(candidates.size(), NUM_MATCHES_TO_FIND);
+        std::partial_sort(candidates.begin(), candidates.begin() + num_keep, candidates.end());
+        candidates.resize(num_keep);
       } else {
-        num_matches_valid = m_tree_float.knn_search( ip->descriptor, indices, distances, NUM_MATCHES_TO_FIND );
+        // Call the correct FLANN tree for the matching type
+        size_t num_matches_valid = 0;
+        if (m_use_uchar_tree) {
+          vw::Vector<unsigned char> uchar_descriptor(ip->descriptor.size());
+          for (size_t i=0; i<ip->descriptor.size(); ++i)
+            uchar_descriptor[i] = static_cast<unsigned char>(ip->descriptor[i]);
+          num_matches_valid = m_tree_uchar.knn_search( uchar_descriptor, indices, distances, NUM_MATCHES_TO_FIND );
+        } else {
+          num_matches_valid = m_tree_float.knn_search( ip->descriptor, indices, distances, NUM_MATCHES_TO_FIND );
+        }
+        for ( size_t i = 0; i < num_matches_valid; i++ )
+          candidates.push_back(std::pair<float,int>(distances[i], indices[i]));
       }
 
-      if (num_matches_valid < 1) {
+      if (candidates.empty()) {
         *m_output++ = (size_t)(-1); // Failed to find a match, return a flag!
         continue; // Skip to the next IP
       }
 
-      //vw_out() << "For descriptor: " << ip->descriptor << std::endl;
-      //vw_out() << num_matches_valid << " Best match distances: " << distances << std::endl;
-      //vw_out() << "Indices: " << indices << std::endl;
-
       // Loop through the N "nearest" points and keep only the ones within
       //   m_matcher.m_epipolar_threshold pixel distance from the epipolar line
-      const double EPIPOLAR_BAND_EXPANSION = 200;
-      double small_epipolar_threshold = m_matcher.m_epipolar_threshold;
-      double large_epipolar_threshold = small_epipolar_threshold + EPIPOLAR_BAND_EXPANSION;
-      for ( size_t i = 0; i < num_matches_valid; i++ ) {
-        IPListIter ip2_it = m_ip_other.begin();
-        std::advance( ip2_it, indices[i] );
-
-        if (found_epipolar){
-          Vector2 ip2_org_coord = Vector2( ip2_it->x, ip2_it->y );
-          double  line_distance = m_matcher.distance_point_line( line_eq, ip2_org_coord );
-          if ( line_distance < large_epipolar_threshold ) {
-            if ( line_distance < small_epipolar_threshold )
-              kept_indices.push_back( std::pair<float,int>( distances[i], indices[i] ) );
-            else // In between thresholds
-              kept_indices.push_back( std::pair<float,int>( distances[i], -1 ) );
-          }
-          else {
-            Vector2 ip1_coord( ip->x, ip->y );
-            //double normDist = norm_2(ip1_coord - ip2_org_coord);
-            //vw_out() << "Discarding match between " << ip1_coord << " and " << ip2_org_coord
-            //        << " because distance is " << line_distance << " and threshold is "
-            //        << m_matcher.m_epipolar_threshold << " norm dist = " << normDist<<"\n";
-          }
+      kept_indices.clear();
+      for ( size_t i = 0; i < candidates.size(); i++ ) {
+        Vector2 const& ip2_org_coord = m_ip_other_coords[candidates[i].second];
+        double  line_distance = m_matcher.distance_point_line( line_eq, ip2_org_coord );
+        if ( line_distance < large_epipolar_threshold ) {
+          if ( line_distance < small_epipolar_threshold )
+            kept_indices.push_back( candidates[i] );
+          else // In between thresholds
+            kept_indices.push_back( std::pair<float,int>( candidates[i].first, -1 ) );
         }
       } // End loop for match prunining
 
@@ -224,7 +391,6 @@ public:
              (kept_indices[0].first < m_matcher.m_uniqueness_threshold * kept_indices[1].first) )
            || (kept_indices.size() == 1) ){
         *m_output++ = kept_indices[0].second; // Return the first of the matches we found
-        //vw_out() << "Kept distance: " << kept_indices[0].first << std::endl;
       } else { // No matches or no clear winner
         *m_output++ = (size_t)(-1); // Failed to find a match, return a flag!
       }
@@ -272,6 +438,18 @@ void EpipolarLinePointMatcher::operator()( ip::InterestPointList const& ip1,
 
   vw_out(InfoMessage,"interest_point") << "FLANN-Tree created. Searching...\n";
 
+  // Random access to the right image points, and a grid over them to find
+  // the ones near an epipolar line
+  std::vector<ip::InterestPoint const*> ip2_vec;
+  std::vector<Vector2> ip2_coords;
+  ip2_vec.reserve(ip2_size);
+  ip2_coords.reserve(ip2_size);
+  for (IPListIter it = ip2.begin(); it != ip2.end(); it++) {
+    ip2_vec.push_back(&(*it));
+    ip2_coords.push_back(Vector2(it->x, it->y));
+  }
+  IpGrid grid(ip2_coords, m_epipolar_threshold + EPIPOLAR_BAND_EXPANSION);
+
   FifoWorkQueue matching_queue; // Create a thread pool object
   Mutex camera_mutex;
 
@@ -299,9 +477,9 @@ void EpipolarLinePointMatcher::operator()( ip::InterestPointList const& ip1,
     std::advance( end_it, ip1_size / number_of_jobs );
     boost::shared_ptr<Task>
       match_task( new EpipolarLineMatchTask( m_single_threaded_camera,
-                                             use_uchar_FLANN, kd_float, kd_uchar,
+                                             use_uchar_FLANN, kd_float, kd_uchar, grid,
                                              start_it, end_it,
-                                             ip2, cam1, cam2, *this,
+                                             ip2_vec, ip2_coords, cam1, cam2, *this,
                                              camera_mutex, output_it ) );
     matching_queue.add_task( match_task );
     start_it = end_it;
@@ -309,9 +487,9 @@ void EpipolarLinePointMatcher::operator()( ip::InterestPointList const& ip1,
   }
   boost::shared_ptr<Task>
     match_task( new EpipolarLineMatchTask( m_single_threaded_camera,
-                                           use_uchar_FLANN, kd_float, kd_uchar,
+                                           use_uchar_FLANN, kd_float, kd_uchar, grid,
                                            start_it, ip1.end(),
-                                           ip2, cam1, cam2, *this,
+                                           ip2_vec, ip2_coords, cam1, cam2, *this,
                                            camera_mutex, output_it ) );
   matching_queue.add_task( match_task );
   matching_queue.join_all(); // Wait for all the jobs to finish.
@@ -320,6 +498,165 @@ void EpipolarLinePointMatcher::operator()( ip::InterestPointList const& ip1,
 // End class EpipolarLinePointMatcher
 //---------------------------------------------------------------------------------------
 
+void disparity_guided_ip_matching(vw::ip::InterestPointList const& ip1,
+                                   vw::ip::InterestPointList const& ip2,
+                                   vw::ImageViewRef<vw::PixelMask<vw::Vector2f>> const& sub_disp,
+                                   vw::Vector2 const& upsample_scale,
+                                   double search_radius, double uniqueness_threshold,
+                                   bool use_hamming,
+                                   std::vector<vw::ip::InterestPoint> & matched_ip1,
+                                   std::vector<vw::ip::InterestPoint> & matched_ip2) {
+  matched_ip1.clear();
+  matched_ip2.clear();
+  if (ip1.empty() || ip2.empty())
+    return;
+
+  // The disparity is small, so keep it in memory
+  ImageView<PixelMask<Vector2f>> disp = sub_disp;
+
+  std::vector<ip::InterestPoint const*> ip2_vec;
+  std::vector<Vector2> ip2_coords;
+  for (ip::InterestPointList::const_iterator it = ip2.begin(); it != ip2.end(); it++) {
+    ip2_vec.push_back(&(*it));
+    ip2_coords.push_back(Vector2(it->x, it->y));
+  }
+  IpGrid grid(ip2_coords, search_radius);
+
+  std::vector<int> candidates;
+  int num_no_disp = 0;
+  for (ip::InterestPointList::const_iterator it = ip1.begin(); it != ip1.end(); it++) {
+
+    // Where the disparity predicts this point to be in the right image
+    Vector2 left(it->x, it->y);
+    Vector2 sub_pix = elem_quot(left, upsample_scale);
+    int col = int(std::round(sub_pix.x())), row = int(std::round(sub_pix.y()));
+    if (col < 0 || row < 0 || col >= disp.cols() || row >= disp.rows() ||
+        !is_valid(disp(col, row))) {
+      num_no_disp++;
+      continue;
+    }
+    Vector2 right = left + elem_prod(Vector2(disp(col, row).child()), upsample_scale);
+
+    // The two closest descriptors near there
+    grid.points_near_point(right, search_radius, candidates);
+    int best = -1;
+    float dist0 = std::numeric_limits<float>::max(), dist1 = dist0;
+    for (size_t k = 0; k < candidates.size(); k++) {
+      float dist = descriptor_distance(*it, *ip2_vec[candidates[k]], use_hamming);
+      if (dist < dist0) {
+        dist1 = dist0;
+        dist0 = dist;
+        best  = candidates[k];
+      } else if (dist < dist1) {
+        dist1 = dist;
+      }
+    }
+    if (best < 0)
+      continue;
+    if (candidates.size() > 1 && !(dist0 < uniqueness_threshold * dist1))
+      continue;
+
+    matched_ip1.push_back(*it);
+    matched_ip2.push_back(*ip2_vec[best]);
+  }
+
+  if (num_no_disp > 0)
+    vw_out() << "\t    Interest points with no low-resolution disparity: "
+             << num_no_disp << "\n";
+
+  ip::remove_duplicates(matched_ip1, matched_ip2);
+}
+
+BinaryDescriptors::BinaryDescriptors(std::vector<vw::ip::InterestPoint> const& ip) {
+  m_num_words = 0;
+  for (size_t i = 0; i < ip.size(); i++)
+    m_num_words = std::max(m_num_words, (ip[i].descriptor.size() + 7) / 8);
+
+  // Each descriptor element is a byte value stored as a float
+  m_words.resize(ip.size() * m_num_words, 0);
+  for (size_t i = 0; i < ip.size(); i++) {
+    boost::uint64_t * words = &m_words[i * m_num_words];
+    for (size_t j = 0; j < ip[i].descriptor.size(); j++) {
+      boost::uint64_t byte = static_cast<unsigned char>(ip[i].descriptor[j]);
+      words[j / 8] |= byte << (8 * (j % 8));
+    }
+  }
+}
+
+// Local class definition -----
+class BinaryMatchTask: public Task, private boost::noncopyable {
+  BinaryDescriptors const& m_desc1;
+  BinaryDescriptors const& m_desc2;
+  size_t m_start, m_end;
+  double m_uniqueness_threshold;
+  std::vector<int> & m_output;
+public:
+  BinaryMatchTask(BinaryDescriptors const& desc1, BinaryDescriptors const& desc2,
+                  size_t start, size_t end, double uniqueness_threshold,
+                  std::vector<int> & output):
+    m_desc1(desc1), m_desc2(desc2), m_start(start), m_end(end),
+    m_uniqueness_threshold(uniqueness_threshold), m_output(output) {}
+
+  void operator()() {
+    for (size_t i = m_start; i < m_end; i++) {
+      // The two smallest distances, and the index of the closest point
+      int best = -1;
+      size_t dist0 = std::numeric_limits<size_t>::max(), dist1 = dist0;
+      for (size_t j = 0; j < m_desc2.size(); j++) {
+        size_t dist = m_desc1.distance(i, m_desc2, j);
+        if (dist < dist0) {
+          dist1 = dist0;
+          dist0 = dist;
+          best  = j;
+        } else if (dist < dist1) {
+          dist1 = dist;
+        }
+      }
+      // The best match must be sufficiently better than the next one
+      if (best >= 0 && dist1 != std::numeric_limits<size_t>::max() &&
+          dist0 < m_uniqueness_threshold * dist1)
+        m_output[i] = best;
+      else
+        m_output[i] = -1;
+    }
+  }
+}; // End class BinaryMatchTask
+
+void match_binary_ip(std::vector<vw::ip::InterestPoint> const& ip1,
+                     std::vector<vw::ip::InterestPoint> const& ip2,
+                     double uniqueness_threshold,
+                     std::vector<vw::ip::InterestPoint> & matched_ip1,
+                     std::vector<vw::ip::InterestPoint> & matched_ip2) {
+  matched_ip1.clear();
+  matched_ip2.clear();
+  if (ip1.empty() || ip2.empty())
+    return;
+
+  BinaryDescriptors desc1(ip1), desc2(ip2);
+  if (desc1.num_words() != desc2.num_words())
+    vw_throw(ArgumentErr() << "match_binary_ip: The descriptors have different sizes.\n");
+
+  // Split the left points among the jobs
+  std::vector<int> output(ip1.size(), -1);
+  size_t num_threads = vw_settings().default_num_threads();
+  size_t num_jobs = std::min(ip1.size(), 4 * num_threads);
+  FifoWorkQueue queue(num_threads);
+  for (size_t job = 0; job < num_jobs; job++) {
+    size_t start = job * ip1.size() / num_jobs, end = (job + 1) * ip1.size() / num_jobs;
+    boost::shared_ptr<Task> task(new BinaryMatchTask(desc1, desc2, start, end,
+                                                     uniqueness_threshold, output));
+    queue.add_task(task);
+  }
+  queue.join_all();
+
+  for (size_t i = 0; i < ip1.size(); i++) {
+    if (output[i] < 0)
+      continue;
+    matched_ip1.push_back(ip1[i]);
+    matched_ip2.push_back(ip2[output[i]]);
+  }
+}
+
 void check_homography_matrix(Matrix<double>       const& H,
                              std::vector<Vector3> const& left_points,
                              std::vector<Vector3> const& right_points,
@@ -442,12 +779,13 @@ Vector2i homography_rectification(bool adjust_left_image_size,
   double thresh_factor = stereo_settings().ip_inlier_factor; // 1/15 by default
     
   // Use RANSAC to determine a good homography transform between the images
-  math::RandomSampleConsensus<math::HomographyFittingFunctor, math::InterestPointErrorMetric>
+  ParallelRansac<math::HomographyFittingFunctor, math::InterestPointErrorMetric>
     ransac( math::HomographyFittingFunctor(),
             math::InterestPointErrorMetric(),
             stereo_settings().ip_num_ransac_iterations,
             norm_2(Vector2(left_size.x(),left_size.y())) * (1.5*thresh_factor), // inlier thresh
-            left_copy.size()*2/3 // min output inliers
+            left_copy.size()*2/3, // min output inliers
+            false, 0.999, stereo_settings().ip_num_ransac_threads
             );
   Matrix<double> H = ransac(right_copy, left_copy);
   std::vector<size_t> indices = ransac.inlier_indices(H, right_copy, left_copy);
@@ -956,14 +1294,15 @@ size_t filter_ip_homog(std::vector<ip::InterestPoint> const& ip1_in,
     vw_out() << "\t    Inlier threshold:                     " << inlier_threshold << "\n";
     vw_out() << "\t    RANSAC iterations:                    "
              << stereo_settings().ip_num_ransac_iterations << "\n";
-    typedef math::RandomSampleConsensus<math::HomographyFittingFunctor,
+    typedef ParallelRansac<math::HomographyFittingFunctor,
       math::InterestPointErrorMetric> RansacT;
     const int    MIN_NUM_OUTPUT_INLIERS = ransac_ip1.size()/2;
     RansacT ransac( math::HomographyFittingFunctor(),
                     math::InterestPointErrorMetric(),
                     stereo_settings().ip_num_ransac_iterations,
                     inlier_threshold,
-                    MIN_NUM_OUTPUT_INLIERS, true);
+                    MIN_NUM_OUTPUT_INLIERS, true, 0.999,
+                    stereo_settings().ip_num_ransac_threads);
     Matrix<double> H(ransac(ransac_ip2,ransac_ip1)); // 2 then 1 is used here for legacy reasons
     //vw_out() << "\t--> Homography: " << H << "\n";
     indices = ransac.inlier_indices(H,ransac_ip2,ransac_ip1);
@@ -1208,4 +1547,217 @@ vw::Matrix<double> translation_ip_matching(vw::ImageView<vw::PixelGray<float>> c
 
 }
 
+
+std::string ip_detection_key(std::string const& description) {
+  return asp::hash_to_hex(asp::hash_string(description));
+}
+
+bool ip_key_matches(std::string const& ip_file, std::string const& key,
+                    bool accept_no_key) {
+  std::string key_file = ip_file + ".key";
+  if (!boost::filesystem::exists(key_file))
+    return accept_no_key;
+  std::ifstream ifs(key_file.c_str());
+  std::string file_key;
+  ifs >> file_key;
+  return file_key == key;
+}
+
+void write_ip_with_key(std::string const& ip_file, std::string const& key,
+                       vw::ip::InterestPointList const& ip) {
+  ip::write_binary_ip_file(ip_file, ip);
+  write_ip_key(ip_file, key);
+}
+
+void write_ip_key(std::string const& ip_file, std::string const& key) {
+  std::string key_file = ip_file + ".key";
+  std::ofstream ofs(key_file.c_str());
+  ofs << key << "\n";
+}
+
+IpTileWriter::IpTileWriter(std::string const& ip_file, int num_tiles):
+  m_ip_file(ip_file), m_tiles(num_tiles), m_done(num_tiles, false), m_next(0), m_count(0) {
+  if (m_ip_file == "")
+    return;
+  vw::create_out_dir(m_ip_file);
+  m_ofs.open(m_ip_file.c_str(), std::ios::binary | std::ios::out);
+  if (!m_ofs.is_open())
+    vw_throw(IOErr() << "Cannot write: " << m_ip_file << "\n");
+  // The number of points, filled in at the end, as in write_binary_ip_file()
+  m_ofs.write(reinterpret_cast<const char*>(&m_count), sizeof(m_count));
+}
+
+void IpTileWriter::add(int tile_index, vw::ip::InterestPointList & ip) {
+  Mutex::Lock lock(m_mutex);
+  m_tiles[tile_index].splice(m_tiles[tile_index].end(), ip);
+  m_done[tile_index] = true;
+  while (m_next < int(m_tiles.size()) && m_done[m_next]) {
+    ip::InterestPointList & tile_ip = m_tiles[m_next];
+    if (m_ofs.is_open()) {
+      for (ip::InterestPointList::const_iterator it = tile_ip.begin(); it != tile_ip.end(); it++)
+        ip::write_ip_record(m_ofs, *it);
+    }
+    m_count += tile_ip.size();
+    m_ip.splice(m_ip.end(), tile_ip);
+    m_next++;
+  }
+}
+
+void IpTileWriter::finish(vw::ip::InterestPointList & ip) {
+  if (m_ofs.is_open()) {
+    m_ofs.seekp(0);
+    m_ofs.write(reinterpret_cast<const char*>(&m_count), sizeof(m_count));
+    m_ofs.close();
+  }
+  ip.clear();
+  ip.splice(ip.end(), m_ip);
+}
+
+void allocate_ip_per_tile(std::vector<double> const& texture, int points_per_tile,
+                          std::vector<int> & tile_points) {
+
+  double total_texture = 0.0;
+  for (size_t t = 0; t < texture.size(); t++)
+    total_texture += texture[t];
+
+  // With no texture anywhere there is nothing to go by
+  if (!(total_texture > 0.0)) {
+    tile_points.assign(texture.size(), points_per_tile);
+    return;
+  }
+
+  double budget = double(points_per_tile) * texture.size();
+  int min_points = std::max(1, points_per_tile / 10);
+  int max_points = 4 * points_per_tile;
+  tile_points.assign(texture.size(), 0);
+  for (size_t t = 0; t < texture.size(); t++) {
+    if (!(texture[t] > 0.0))
+      continue;
+    int num = int(std::round(budget * texture[t] / total_texture));
+    tile_points[t] = std::max(min_points, std::min(max_points, num));
+  }
+}
+
+bool read_ip_from_cache(std::string const& cache_dir, std::string const& key,
+                        vw::ip::InterestPointList & ip) {
+  std::string cache_file = cache_dir + "/" + key + ".vwip";
+  if (!boost::filesystem::exists(cache_file))
+    return false;
+  vw_out() << "\t    Reading interest points from the cache: " << cache_file << std::endl;
+  ip = ip::read_binary_ip_file_list(cache_file);
+  vw_out() << "\t    Found interest points: " << ip.size() << std::endl;
+  return true;
+}
+
+void write_ip_to_cache(std::string const& cache_dir, std::string const& key,
+                       vw::ip::InterestPointList const& ip) {
+  namespace fs = boost::filesystem;
+  std::string cache_file = cache_dir + "/" + key + ".vwip";
+  try {
+    fs::create_directories(cache_dir);
+    std::string tmp_file = cache_dir + "/" + fs::unique_path(key + "-%%%%%%%%.tmp").string();
+    ip::write_binary_ip_file(tmp_file, ip);
+    fs::rename(tmp_file, cache_file);
+    vw_out() << "\t    Added interest points to the cache: " << cache_file << std::endl;
+  } catch (std::exception const& e) {
+    // The cache only saves time, so do not fail the run
+    vw_out(WarningMessage) << "Could not write to the interest point cache: "
+                           << e.what() << "\n";
+  }
+}
+
+// Maximize the normalized cross-correlation of a patch of the second
+// image over a window in the first one.
+bool refine_match(ImageViewRef<PixelMask<double>> const& img1,
+                  ImageViewRef<PixelMask<double>> const& img2,
+                  Vector2i const& pix2, Vector2 const& pred1,
+                  int half_patch, int search_radius, double min_ncc,
+                  Vector2 & pix1) {
+
+  int h = half_patch, r = search_radius;
+  Vector2i ctr1(round(pred1[0]), round(pred1[1]));
+  BBox2i box2(pix2 - Vector2i(h, h), pix2 + Vector2i(h + 1, h + 1));
+  BBox2i box1(ctr1 - Vector2i(h + r, h + r), ctr1 + Vector2i(h + r + 1, h + r + 1));
+  if (!bounding_box(img2).contains(box2) || !bounding_box(img1).contains(box1))
+    return false;
+
+  // The patch, with zero mean and unit norm
+  ImageView<PixelMask<double>> patch = crop(img2, box2);
+  int len = 2 * h + 1, n = len * len;
+  std::vector<double> tmpl(n);
+  double sum = 0.0;
+  for (int row = 0; row < len; row++) {
+    for (int col = 0; col < len; col++) {
+      if (!is_valid(patch(col, row)))
+        return false;
+      tmpl[row * len + col] = patch(col, row).child();
+      sum += tmpl[row * len + col];
+    }
+  }
+  double mean = sum / n, norm2 = 0.0;
+  for (int k = 0; k < n; k++) {
+    tmpl[k] -= mean;
+    norm2 += tmpl[k] * tmpl[k];
+  }
+  if (norm2 <= 1e-12 * n)
+    return false; // no texture
+  double tmpl_norm = sqrt(norm2);
+  for (int k = 0; k < n; k++)
+    tmpl[k] /= tmpl_norm;
+
+  ImageView<PixelMask<double>> win = crop(img1, box1);
+  int wlen = 2 * (h + r) + 1;
+  std::vector<double> vals(wlen * wlen);
+  std::vector<unsigned char> valid(wlen * wlen);
+  for (int row = 0; row < wlen; row++) {
+    for (int col = 0; col < wlen; col++) {
+      valid[row * wlen + col] = is_valid(win(col, row));
+      vals[row * wlen + col] = win(col, row).child();
+    }
+  }
+
+  // The correlation at each offset, or -2 if it cannot be found
+  int slen = 2 * r + 1;
+  std::vector<double> ncc(slen * slen, -2.0);
+  for (int dy = 0; dy < slen; dy++) {
+    for (int dx = 0; dx < slen; dx++) {
+      double s = 0.0, s2 = 0.0, st = 0.0;
+      bool good = true;
+      for (int row = 0; row < len && good; row++) {
+        int beg = (row + dy) * wlen + dx;
+        for (int col = 0; col < len; col++) {
+          if (!valid[beg + col]) {
+            good = false;
+            break;
+          }
+          double v = vals[beg + col];
+          s  += v;
+          s2 += v * v;
+          st += v * tmpl[row * len + col];
+        }
+      }
+      double var = s2 - s * s / n;
+      if (good && var > 1e-12 * n)
+        ncc[dy * slen + dx] = st / sqrt(var);
+    }
+  }
+
+  int best = std::max_element(ncc.begin(), ncc.end()) - ncc.begin();
+  int bx = best % slen, by = best / slen;
+  if (ncc[best] < min_ncc || bx == 0 || by == 0 || bx == slen - 1 || by == slen - 1)
+    return false;
+
+  // Fit a parabola along each axis through the maximum and its neighbors
+  double sx = 0.0, sy = 0.0;
+  double cx = ncc[best - 1] - 2.0 * ncc[best] + ncc[best + 1];
+  double cy = ncc[best - slen] - 2.0 * ncc[best] + ncc[best + slen];
+  if (cx < 0)
+    sx = 0.5 * (ncc[best - 1] - ncc[best + 1]) / cx;
+  if (cy < 0)
+    sy = 0.5 * (ncc[best - slen] - ncc[best + slen]) / cy;
+
+  pix1 = Vector2(ctr1[0] + bx - r + sx, ctr1[1] + by - r + sy);
+  return true;
+}
+
 }
@@ -23,8 +23,10 @@
 #define __ASP_CORE_INTEREST_POINT_MATCHING_H__
 
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Image/ImageViewBase.h>
 #include <vw/Image/MaskViews.h>
+#include <vw/Image/ImageViewRef.h>
 #include <vw/Camera/CameraModel.h>
 #include <vw/InterestPoint/Matcher.h>
 #include <vw/InterestPoint/InterestData.h>
@@ -38,6 +40,12 @@
 #include <asp/Core/StereoSettings.h>
 #include <boost/foreach.hpp>
 #include <boost/math/special_functions/fpclassify.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <bitset>
+#include <fstream>
+#include <sstream>
 
 // // TODO(oalexan1): This function should live somewhere else.It was
 // pulled from vw->tools->ipmatch.cc. Move it InterestPointUtils.cc
@@ -228,6 +236,17 @@ bool ip_matching_no_align(bool single_threaded_camera,
                          std::vector<vw::ip::InterestPoint>      & ip2_out,
                          int inlier_threshold = 1);
 
+  /// Refine the location in the first image of a pixel of the second
+  /// image, by maximizing the normalized cross-correlation of a patch
+  /// around it over a window around the predicted location. Return false
+  /// if the patch has little texture or has invalid pixels, or the
+  /// maximum is weak or at the window boundary.
+  bool refine_match(vw::ImageViewRef<vw::PixelMask<double>> const& img1,
+                    vw::ImageViewRef<vw::PixelMask<double>> const& img2,
+                    vw::Vector2i const& pix2, vw::Vector2 const& pred1,
+                    int half_patch, int search_radius, double min_ncc,
+                    vw::Vector2 & pix1);
+
   // Filter IP using a given DEM and max height difference.  Assume that
   // the interest points have alignment applied to them (either via a
   // transform or from mapprojection).
@@ -282,6 +301,33 @@ vw::BBox2 search_range_using_spread(double max_disp_spread,
   //-------------------------------------------------------------------------------------------
   // Lower level IP detection functions
 
+  /// A hash, as hex digits, of a description of an image and of the
+  /// options used to detect interest points in it
+  std::string ip_detection_key(std::string const& description);
+
+  /// If the ip file was written with the given key. For a file with no
+  /// key return the value of accept_no_key.
+  bool ip_key_matches(std::string const& ip_file, std::string const& key,
+                      bool accept_no_key);
+
+  /// Write the ip file, and the key next to it
+  void write_ip_with_key(std::string const& ip_file, std::string const& key,
+                         vw::ip::InterestPointList const& ip);
+
+  /// Write only the key of an ip file
+  void write_ip_key(std::string const& ip_file, std::string const& key);
+
+  /// Read the ip with given key from the cache directory. Return false if
+  /// they are not there.
+  bool read_ip_from_cache(std::string const& cache_dir, std::string const& key,
+                          vw::ip::InterestPointList & ip);
+
+  /// Add the ip to the cache directory, under the given key. Other
+  /// processes may be using the cache, so the file is first written
+  /// under a unique name and then renamed.
+  void write_ip_to_cache(std::string const& cache_dir, std::string const& key,
+                         vw::ip::InterestPointList const& ip);
+
   /// Detect interest points
   ///
   /// This is not meant to be used directly. Use ip_matching() or
@@ -366,6 +412,8 @@ vw::BBox2 search_range_using_spread(double max_disp_spread,
   /// filters them by whom are closest to the epipolar line via a
   /// threshold. The first 2 are then selected to be a match if
   /// their descriptor distance is sufficiently far apart.
+  /// If few right image points are near the epipolar line, the nearest
+  /// matches are searched for only among those, else in a FLANN tree.
   class EpipolarLinePointMatcher {
     bool   m_single_threaded_camera;
     double m_uniqueness_threshold, m_epipolar_threshold;
@@ -400,9 +448,275 @@ vw::BBox2 search_range_using_spread(double max_disp_spread,
     friend class EpipolarLineMatchTask;
   };
 
+  /// Match interest points using a low-resolution disparity, such as
+  /// D_sub, to predict where each left point is in the right image. Only
+  /// the right points within search_radius of that location are compared
+  /// by descriptor, with the same uniqueness test as elsewhere. The
+  /// disparity is for images smaller than the full ones by upsample_scale.
+  /// Left points with no valid disparity are not matched.
+  void disparity_guided_ip_matching(vw::ip::InterestPointList const& ip1,
+                                    vw::ip::InterestPointList const& ip2,
+                                    vw::ImageViewRef<vw::PixelMask<vw::Vector2f>> const& sub_disp,
+                                    vw::Vector2 const& upsample_scale,
+                                    double search_radius, double uniqueness_threshold,
+                                    bool use_hamming,
+                                    std::vector<vw::ip::InterestPoint> & matched_ip1,
+                                    std::vector<vw::ip::InterestPoint> & matched_ip2);
+
+  /// Binary descriptors, such as from ORB, packed into 64-bit words, so
+  /// their Hamming distance takes a few popcount instructions and not a
+  /// loop over bytes.
+  class BinaryDescriptors {
+  public:
+    /// Each descriptor element must be a byte value, as ORB makes them
+    BinaryDescriptors(std::vector<vw::ip::InterestPoint> const& ip);
+
+    size_t size     () const { return m_num_words == 0 ? 0 : m_words.size() / m_num_words; }
+    size_t num_words() const { return m_num_words; }
+
+    /// The Hamming distance between descriptor i and descriptor j of the other set
+    size_t distance(size_t i, BinaryDescriptors const& other, size_t j) const {
+      boost::uint64_t const* a = &m_words[i * m_num_words];
+      boost::uint64_t const* b = &other.m_words[j * m_num_words];
+      size_t dist = 0;
+      for (size_t k = 0; k < m_num_words; k++)
+        dist += std::bitset<64>(a[k] ^ b[k]).count();
+      return dist;
+    }
+
+  private:
+    size_t m_num_words;
+    std::vector<boost::uint64_t> m_words; // m_num_words for each descriptor
+  };
+
+  /// Match binary descriptors by exhaustive Hamming distance search, with
+  /// multiple threads. A left point is matched to its nearest right point
+  /// if that is closer than uniqueness_threshold times the next nearest.
+  void match_binary_ip(std::vector<vw::ip::InterestPoint> const& ip1,
+                       std::vector<vw::ip::InterestPoint> const& ip2,
+                       double uniqueness_threshold,
+                       std::vector<vw::ip::InterestPoint> & matched_ip1,
+                       std::vector<vw::ip::InterestPoint> & matched_ip2);
+
   //-------------------------------------------------------------------------------------------
   // Implementations below
 
+/// Collects the interest points of the tiles of an image as they are
+/// found, in any order, and writes them to the ip file in the order of
+/// the tiles, as soon as all earlier tiles are done. The points of a
+/// tile are then no longer kept in a separate list.
+class IpTileWriter: private boost::noncopyable {
+public:
+  /// If the file name is empty, nothing is written
+  IpTileWriter(std::string const& ip_file, int num_tiles);
+
+  /// Take the points of a tile. Can be called from many threads.
+  void add(int tile_index, vw::ip::InterestPointList & ip);
+
+  /// Write the number of points to the file, and return all the points
+  void finish(vw::ip::InterestPointList & ip);
+
+private:
+  std::string m_ip_file;
+  std::ofstream m_ofs;
+  vw::Mutex m_mutex;
+  std::vector<vw::ip::InterestPointList> m_tiles;
+  std::vector<bool> m_done;
+  int m_next;
+  boost::uint64_t m_count;
+  vw::ip::InterestPointList m_ip;
+};
+
+/// Detects, filters, and describes the interest points of one tile
+template <class ImageT, class DetectImageT, class DetectorT>
+class DetectIpTileTask: public vw::Task, private boost::noncopyable {
+  ImageT       const& m_image;
+  DetectImageT const& m_detect_image;
+  DetectorT         & m_detector;
+  vw::BBox2i m_tile;
+  int        m_tile_index, m_points_per_tile;
+  double     m_nodata;
+  bool       m_build_descriptors;
+  IpTileWriter & m_writer;
+public:
+  DetectIpTileTask(ImageT const& image, DetectImageT const& detect_image,
+                   DetectorT & detector, vw::BBox2i const& tile, int tile_index,
+                   int points_per_tile, double nodata, bool build_descriptors,
+                   IpTileWriter & writer):
+    m_image(image), m_detect_image(detect_image), m_detector(detector),
+    m_tile(tile), m_tile_index(tile_index), m_points_per_tile(points_per_tile),
+    m_nodata(nodata), m_build_descriptors(build_descriptors), m_writer(writer) {}
+
+  void operator()() {
+    using namespace vw;
+
+    if (m_points_per_tile <= 0) {
+      ip::InterestPointList empty; // a tile given no points
+      m_writer.add(m_tile_index, empty);
+      return;
+    }
+
+    // Detect with a margin around the tile, so the points near its edges
+    // are found as they would be in its interior. Only the points in the
+    // tile itself are kept, the others belong to the neighboring tiles.
+    const int IP_TILE_MARGIN = 128;
+    BBox2i expanded = m_tile;
+    expanded.expand(IP_TILE_MARGIN);
+    expanded.crop(bounding_box(m_detect_image));
+    int desired_num_ip = double(m_points_per_tile) * expanded.area() / m_tile.area();
+    ip::InterestPointList ip = m_detector(crop(m_detect_image, expanded), desired_num_ip);
+    for (ip::InterestPointList::iterator it = ip.begin(); it != ip.end(); ) {
+      it->x  += expanded.min().x();
+      it->y  += expanded.min().y();
+      it->ix += expanded.min().x();
+      it->iy += expanded.min().y();
+      if (m_tile.contains(Vector2i(it->ix, it->iy)))
+        it++;
+      else
+        it = ip.erase(it);
+    }
+
+    // Keep the points with the largest response
+    ip.sort([](ip::InterestPoint const& a, ip::InterestPoint const& b) {
+        return a.interest > b.interest; });
+    if (int(ip.size()) > m_points_per_tile)
+      ip.resize(m_points_per_tile);
+
+    if (!boost::math::isnan(m_nodata))
+      remove_ip_near_nodata(m_image, m_nodata, ip, stereo_settings().ip_nodata_radius);
+
+    if (m_build_descriptors) {
+      ip::SGradDescriptorGenerator descriptor;
+      describe_interest_points(m_detect_image, descriptor, ip);
+    }
+
+    m_writer.add(m_tile_index, ip);
+  }
+};
+
+/// A cheap measure of the texture of each tile: the mean absolute
+/// difference between neighboring pixels, sampled on a grid of at most
+/// 64 x 64 pixels of the tile. Samples with nodata count as flat, so a
+/// tile with no valid pixels gets zero.
+template <class ImageT>
+void tile_texture(ImageT const& image, double nodata, std::vector<vw::BBox2i> const& tiles,
+                  std::vector<double> & texture) {
+  using namespace vw;
+
+  const int TEXTURE_SAMPLES = 64;
+  bool has_nodata = !boost::math::isnan(nodata);
+  texture.assign(tiles.size(), 0.0);
+  for (size_t t = 0; t < tiles.size(); t++) {
+    BBox2i const& tile = tiles[t];
+    int step_x = std::max(1, tile.width()  / TEXTURE_SAMPLES);
+    int step_y = std::max(1, tile.height() / TEXTURE_SAMPLES);
+    double sum = 0.0;
+    int num_samples = 0;
+    for (int row = tile.min().y(); row + 1 < tile.max().y(); row += step_y) {
+      for (int col = tile.min().x(); col + 1 < tile.max().x(); col += step_x) {
+        num_samples++;
+        double val = image(col, row), val_x = image(col + 1, row), val_y = image(col, row + 1);
+        if (has_nodata && (val <= nodata || val_x <= nodata || val_y <= nodata))
+          continue;
+        sum += std::abs(val_x - val) + std::abs(val_y - val);
+      }
+    }
+    if (num_samples > 0)
+      texture[t] = sum / num_samples;
+  }
+}
+
+/// Split a budget of points_per_tile times the number of tiles among the
+/// tiles in proportion with their texture. A textured tile gets at least
+/// a tenth and at most four times points_per_tile, and a tile with no
+/// texture gets no points.
+void allocate_ip_per_tile(std::vector<double> const& texture, int points_per_tile,
+                          std::vector<int> & tile_points);
+
+/// Detect interest points in tiles of a large image, in parallel. Each
+/// tile is in turn detected, filtered, described, and written to the ip
+/// file if not empty, so there is never more than the final list in
+/// memory. The image is used for removing points near nodata, and the
+/// detect image for detection and descriptors. If tile_points is not
+/// empty, it has the number of points for each tile, in the order of
+/// subdivide_bbox(), in place of points_per_tile.
+template <class ImageT, class DetectImageT, class DetectorT>
+void detect_ip_in_tiles(ImageT const& image, DetectImageT const& detect_image,
+                        DetectorT & detector, int tile_size, int points_per_tile,
+                        double nodata, bool build_descriptors,
+                        std::string const& ip_file, vw::ip::InterestPointList & ip,
+                        std::vector<int> const& tile_points = std::vector<int>()) {
+  using namespace vw;
+
+  std::vector<BBox2i> tiles = subdivide_bbox(detect_image, tile_size, tile_size);
+  if (!tile_points.empty() && tile_points.size() != tiles.size())
+    vw_throw(ArgumentErr() << "detect_ip_in_tiles: Expecting the number of points for "
+             << tiles.size() << " tiles, got " << tile_points.size() << ".\n");
+  IpTileWriter writer(ip_file, tiles.size());
+  FifoWorkQueue queue(vw_settings().default_num_threads());
+  for (size_t i = 0; i < tiles.size(); i++) {
+    boost::shared_ptr<Task> task
+      (new DetectIpTileTask<ImageT, DetectImageT, DetectorT>
+       (image, detect_image, detector, tiles[i], i,
+        tile_points.empty() ? points_per_tile : tile_points[i], nodata,
+        build_descriptors, writer));
+    queue.add_task(task);
+  }
+  queue.join_all();
+  writer.finish(ip);
+}
+
+/// Builds the descriptors of a portion of the interest points
+template <class ImageT>
+class DescribeIpTask: public vw::Task, private boost::noncopyable {
+  ImageT const& m_image;
+  vw::ip::InterestPointList & m_ip;
+public:
+  DescribeIpTask(ImageT const& image, vw::ip::InterestPointList & ip):
+    m_image(image), m_ip(ip) {}
+  void operator()() {
+    vw::ip::SGradDescriptorGenerator descriptor;
+    describe_interest_points(m_image, descriptor, m_ip);
+  }
+};
+
+/// Build the descriptors of the integral method with multiple threads.
+/// The points are split into a list per job, and put back together in
+/// the same order after all the jobs finish.
+template <class ImageT>
+void describe_ip_in_parallel(vw::ImageViewBase<ImageT> const& image,
+                             vw::ip::InterestPointList & ip) {
+  using namespace vw;
+
+  size_t num_threads = vw_settings().default_num_threads();
+  size_t num_jobs = std::min(ip.size(), 4 * num_threads);
+  if (num_jobs <= 1) {
+    ip::SGradDescriptorGenerator descriptor;
+    describe_interest_points(image.impl(), descriptor, ip);
+    return;
+  }
+
+  // Move the points to the lists of the jobs, without copying them
+  std::vector<ip::InterestPointList> job_ip(num_jobs);
+  size_t num_ip = ip.size();
+  for (size_t job = 0; job < num_jobs; job++) {
+    size_t len = num_ip / num_jobs + (job < num_ip % num_jobs ? 1 : 0);
+    ip::InterestPointList::iterator end = ip.begin();
+    std::advance(end, len);
+    job_ip[job].splice(job_ip[job].end(), ip, ip.begin(), end);
+  }
+
+  FifoWorkQueue queue(num_threads);
+  for (size_t job = 0; job < num_jobs; job++) {
+    boost::shared_ptr<Task> task(new DescribeIpTask<ImageT>(image.impl(), job_ip[job]));
+    queue.add_task(task);
+  }
+  queue.join_all();
+
+  for (size_t job = 0; job < num_jobs; job++)
+    ip.splice(ip.end(), job_ip[job]);
+}
+
 template <class Image1T>
 void detect_ip(vw::ip::InterestPointList& ip,
 	       vw::ImageViewBase<Image1T> const& image,
@@ -410,24 +724,6 @@ void detect_ip(vw::ip::InterestPointList& ip,
   using namespace vw;
   ip.clear();
 
-  // If the images are cropped, redo the ip
-  // TODO(oalexan1): This won't handle well the case when the input
-  // images changed on disk. 
-  bool crop_left  = (stereo_settings().left_image_crop_win  != BBox2i(0, 0, 0, 0));
-  bool crop_right = (stereo_settings().right_image_crop_win != BBox2i(0, 0, 0, 0));
-  bool rebuild = crop_left || crop_right;
-  
-  // If a valid file_path was provided, just try to read in the IP's from that file.
-  if ((file_path != "") && (boost::filesystem::exists(file_path)) && !rebuild) {
-    vw_out() << "\t    Reading interest points from file: " << file_path << std::endl;
-    ip = ip::read_binary_ip_file_list(file_path);
-    vw_out() << "\t    Found interest points: " << ip.size() << std::endl;
-    return;
-  }
-  
-  Stopwatch sw;
-  sw.start();
-
   // Automatically determine how many ip we need. Can be overridden below
   // either by --ip-per-image or --ip-per-tile (the latter takes priority).
   double tile_size = 1024.0;
@@ -446,9 +742,81 @@ void detect_ip(vw::ip::InterestPointList& ip,
   if (ip_per_tile != 0)
     points_per_tile = ip_per_tile;
 
+  // A hash of the detection options and of pixels on a grid over the
+  // image, to tell if interest points found before can be reused.
+  std::string key;
+  {
+    std::ostringstream os;
+    os.precision(17);
+    os << "method " << stereo_settings().ip_matching_method
+       << " ip_per_tile " << points_per_tile
+       << " scales " << stereo_settings().num_scales
+       << " normalize " << stereo_settings().skip_image_normalization
+       << ' ' << stereo_settings().ip_normalize_tiles
+       << " nodata " << nodata << ' ' << stereo_settings().ip_nodata_radius
+       << " adaptive " << stereo_settings().adaptive_ip_per_tile
+       << " size " << box.width() << ' ' << box.height() << " pixels";
+    const int NUM_SAMPLES = 32;
+    for (int r = 0; r < NUM_SAMPLES && !box.empty(); r++) {
+      for (int c = 0; c < NUM_SAMPLES; c++) {
+        int col = (box.width()  - 1) * c / (NUM_SAMPLES - 1);
+        int row = (box.height() - 1) * r / (NUM_SAMPLES - 1);
+        os << ' ' << double(image.impl()(col, row));
+      }
+    }
+    key = ip_detection_key(os.str());
+  }
+
+  // If a valid file_path was provided, just try to read in the IP's from that file.
+  // If it was written with a key, that must match. Files without a key
+  // are from before keys were added. Those are not trusted if the images
+  // are cropped, as the ip may be for the full images.
+  bool crop_left  = (stereo_settings().left_image_crop_win  != BBox2i(0, 0, 0, 0));
+  bool crop_right = (stereo_settings().right_image_crop_win != BBox2i(0, 0, 0, 0));
+  bool rebuild = crop_left || crop_right;
+  if ((file_path != "") && (boost::filesystem::exists(file_path)) &&
+      ip_key_matches(file_path, key, !rebuild)) {
+    vw_out() << "\t    Reading interest points from file: " << file_path << std::endl;
+    ip = ip::read_binary_ip_file_list(file_path);
+    vw_out() << "\t    Found interest points: " << ip.size() << std::endl;
+    return;
+  }
+
+  // The ip may be in the cache shared with other runs
+  std::string cache_dir = stereo_settings().ip_cache_dir;
+  if (cache_dir != "" && read_ip_from_cache(cache_dir, key, ip)) {
+    if (file_path != "")
+      write_ip_with_key(file_path, key, ip);
+    return;
+  }
+  
+  Stopwatch sw;
+  sw.start();
+
   vw_out() << "\t    Using " << points_per_tile << " interest points per tile (1024^2 px).\n";
 
   const bool has_nodata = !boost::math::isnan(nodata);
+
+  // Large images are done tile by tile, with each tile written to disk
+  // as soon as it is done
+  const double MIN_TILES_FOR_STREAMING = 64;
+  bool adaptive = stereo_settings().adaptive_ip_per_tile;
+  bool stream_tiles = (number_tiles >= MIN_TILES_FOR_STREAMING || adaptive);
+  if (stream_tiles)
+    vw_out() << "\t    Detecting, describing, and saving IP tile by tile.\n";
+
+  // Give more points to the more textured tiles, and none to flat ones,
+  // for about the same total
+  std::vector<int> tile_points;
+  if (adaptive) {
+    std::vector<BBox2i> tiles = subdivide_bbox(image.impl(), tile_size, tile_size);
+    std::vector<double> texture;
+    tile_texture(image.impl(), nodata, tiles, texture);
+    allocate_ip_per_tile(texture, points_per_tile, tile_points);
+    int num_skipped = std::count(tile_points.begin(), tile_points.end(), 0);
+    vw_out() << "\t    Allotting interest points to tiles by texture. Skipping "
+             << num_skipped << " of " << tiles.size() << " tiles.\n";
+  }
   
   // Load the detection method from stereo_settings.
   // - This relies on a direct match in the enum integer value.
@@ -470,7 +838,14 @@ void detect_ip(vw::ip::InterestPointList& ip,
     // This detector can't handle a mask so if there is nodata just set those pixels to zero.
 
     vw_out() << "\t    Detecting IP\n";
-    if (!has_nodata)
+    if (stream_tiles && !has_nodata)
+      detect_ip_in_tiles(image.impl(), image.impl(), detector, tile_size, points_per_tile,
+                         nodata, true, file_path, ip, tile_points);
+    else if (stream_tiles)
+      detect_ip_in_tiles(image.impl(), apply_mask(create_mask_less_or_equal(image.impl(),nodata)),
+                         detector, tile_size, points_per_tile, nodata, true, file_path, ip,
+                         tile_points);
+    else if (!has_nodata)
       ip = detect_interest_points(image.impl(), detector, points_per_tile);
     else
       ip = detect_interest_points(apply_mask(create_mask_less_or_equal(image.impl(),nodata)), detector, points_per_tile);
@@ -498,7 +873,14 @@ void detect_ip(vw::ip::InterestPointList& ip,
     // These detectors do accept a mask so use one if applicable.
 
     vw_out() << "\t    Detecting IP\n";
-    if (!has_nodata)
+    if (stream_tiles && !has_nodata)
+      detect_ip_in_tiles(image.impl(), image.impl(), detector, tile_size, points_per_tile,
+                         nodata, false, file_path, ip, tile_points);
+    else if (stream_tiles)
+      detect_ip_in_tiles(image.impl(), create_mask_less_or_equal(image.impl(),nodata),
+                         detector, tile_size, points_per_tile, nodata, false, file_path, ip,
+                         tile_points);
+    else if (!has_nodata)
       ip = detect_interest_points(image.impl(), detector, points_per_tile);
     else
       ip = detect_interest_points(create_mask_less_or_equal(image.impl(),nodata), detector, points_per_tile);
@@ -508,7 +890,7 @@ void detect_ip(vw::ip::InterestPointList& ip,
   vw_out(DebugMessage,"asp") << "Detect interest points elapsed time: "
 			     << sw.elapsed_seconds() << " s." << std::endl;
 
-  if (!boost::math::isnan(nodata)) {
+  if (!boost::math::isnan(nodata) && !stream_tiles) {
     vw_out() << "\t    Removing IP near nodata with radius "
              << stereo_settings().ip_nodata_radius << std::endl;
     remove_ip_near_nodata(image.impl(), nodata, ip, stereo_settings().ip_nodata_radius);
@@ -516,14 +898,13 @@ void detect_ip(vw::ip::InterestPointList& ip,
 
   // For the two OpenCV options we already built the descriptors, so
   // only do this for the integral method.
-  if (detect_method == DETECT_IP_METHOD_INTEGRAL) {
+  if (detect_method == DETECT_IP_METHOD_INTEGRAL && !stream_tiles) {
     sw.start();
     vw_out() << "\t    Building descriptors" << std::endl;
-    ip::SGradDescriptorGenerator descriptor;
     if (!has_nodata)
-      describe_interest_points(image.impl(), descriptor, ip);
+      describe_ip_in_parallel(image.impl(), ip);
     else
-      describe_interest_points(apply_mask(create_mask_less_or_equal(image.impl(),nodata)), descriptor, ip);
+      describe_ip_in_parallel(apply_mask(create_mask_less_or_equal(image.impl(),nodata)), ip);
 
     vw_out(DebugMessage,"asp") << "Building descriptors elapsed time: "
                                << sw.elapsed_seconds() << " s." << std::endl;
@@ -531,11 +912,18 @@ void detect_ip(vw::ip::InterestPointList& ip,
 
   vw_out() << "\t    Found interest points: " << ip.size() << std::endl;
 
-  // If a file path was provided, record the IP to disk.
+  // If a file path was provided, record the IP to disk. When streaming,
+  // that was done already.
   if (file_path != "") {
     vw_out() << "\t    Recording interest points to file: " << file_path << std::endl;
-    ip::write_binary_ip_file(file_path, ip);
+    if (stream_tiles)
+      write_ip_key(file_path, key);
+    else
+      write_ip_with_key(file_path, key, ip);
   }
+
+  if (cache_dir != "")
+    write_ip_to_cache(cache_dir, key, ip);
 }
 
 template <class Image1T, class Image2T>
@@ -830,10 +1218,8 @@ void detect_match_ip(std::vector<vw::ip::InterestPoint>& matched_ip1,
 	    TerminalProgressCallback("asp", "\t   Matching: "));
   }
   else {
-    // For Hamming distance metrics
-    ip::InterestPointMatcher<ip::HammingMetric,ip::NullConstraint> matcher(th);
-    matcher(ip1_copy, ip2_copy, matched_ip1, matched_ip2,
-	    TerminalProgressCallback("asp", "\t   Matching: "));
+    // For Hamming distance metrics, on packed binary descriptors
+    match_binary_ip(ip1_copy, ip2_copy, th, matched_ip1, matched_ip2);
   }
 
   ip::remove_duplicates(matched_ip1, matched_ip2);
@@ -73,46 +73,46 @@ void filter_ip_by_disparity(double pct,    // for example, 90.0
 double calc_ip_coverage_fraction(std::vector<ip::InterestPoint> const& ip,
                                  vw::Vector2i const& image_size, int tile_size,
                                  int min_ip_per_tile) {
+  std::vector<char> keep; // keep all
+  return calc_ip_coverage_fraction(ip, keep, image_size, tile_size, min_ip_per_tile);
+}
+
+double calc_ip_coverage_fraction(std::vector<ip::InterestPoint> const& ip,
+                                 std::vector<char> const& keep,
+                                 vw::Vector2i const& image_size, int tile_size,
+                                 int min_ip_per_tile) {
 
   if (tile_size < 1)
     vw_throw(LogicErr() << "calc_ip_coverage_fraction: tile size is " << tile_size);
 
-  // Generate a grid of ROIs covering the entire image
-  BBox2i full_bbox(Vector2i(0,0), image_size);
-  bool include_partials = false;
-  std::vector<BBox2i> rois;
-  rois = subdivide_bbox(full_bbox, tile_size, tile_size, include_partials);
-  const size_t num_rois = rois.size();
-  if (num_rois == 0)
+  // The tiles fully inside the image. Partial tiles at the right and
+  // bottom edges are not counted.
+  int num_tile_cols = image_size[0] / tile_size;
+  int num_tile_rows = image_size[1] / tile_size;
+  if (num_tile_cols <= 0 || num_tile_rows <= 0)
     return 0; // Cannot have any coverage in the degenerate case!
-    
-  // Pack all IP into a list for speed
-  std::list<Vector2i> ip_list;
-  for (size_t i=0; i<ip.size(); ++i) {
-    ip_list.push_back(Vector2i(ip[i].x, ip[i].y));
+
+  // Count the ip in each tile, in one pass
+  std::vector<int> ip_in_tile(num_tile_cols * num_tile_rows, 0);
+  for (size_t i = 0; i < ip.size(); i++) {
+    if (!keep.empty() && !keep[i])
+      continue;
+    int x = ip[i].x, y = ip[i].y; // truncate, as done for the pixel
+    if (x < 0 || y < 0)
+      continue;
+    int col = x / tile_size, row = y / tile_size;
+    if (col >= num_tile_cols || row >= num_tile_rows)
+      continue;
+    ip_in_tile[row * num_tile_cols + col]++;
   }
-    
-  size_t num_filled_rois = 0;
-  for (size_t i=0; i<num_rois; ++i) { // Loop through ROIs
-    int ip_in_roi = 0;
-      
-    // Check if each point is in this ROI
-    std::list<Vector2i>::iterator iter;
-    for (iter=ip_list.begin(); iter!=ip_list.end(); ++iter) {
-        
-      // If the IP is in the ROI, remove it from the IP list so it
-      // does not get searched again.
-      if (rois[i].contains(*iter)) {
-        iter = ip_list.erase(iter);
-        ++ip_in_roi;
-        --iter;
-      }
-    } // End IP loop
-    if (ip_in_roi > min_ip_per_tile)
-      ++num_filled_rois;
-  }// End ROI loop
-
-  return static_cast<double>(num_filled_rois) / static_cast<double>(num_rois);
+
+  size_t num_filled_tiles = 0;
+  for (size_t t = 0; t < ip_in_tile.size(); t++) {
+    if (ip_in_tile[t] > min_ip_per_tile)
+      ++num_filled_tiles;
+  }
+
+  return static_cast<double>(num_filled_tiles) / static_cast<double>(ip_in_tile.size());
 }
   
 /// Apply alignment transform to ip. Not to be used with mapprojected images.
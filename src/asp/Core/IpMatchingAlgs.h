@@ -58,6 +58,13 @@ void filter_ip_by_disparity(double pct,    // for example, 90.0
 double calc_ip_coverage_fraction(std::vector<vw::ip::InterestPoint> const& ip,
                                  vw::Vector2i const& image_size, int tile_size=1024,
                                  int min_ip_per_tile=2);
+
+// As above, but count only the ip for which keep is nonzero. An empty
+// keep vector keeps all.
+double calc_ip_coverage_fraction(std::vector<vw::ip::InterestPoint> const& ip,
+                                 std::vector<char> const& keep,
+                                 vw::Vector2i const& image_size, int tile_size,
+                                 int min_ip_per_tile);
   
 /// Apply alignment transform to ip. Not to be used with mapprojected images.
 void align_ip(vw::TransformPtr const& tx_left,
@@ -20,6 +20,7 @@
 ///
 
 #include <vw/Math/Transform.h>
+#include <vw/Math/LinearAlgebra.h>
 #include <vw/Image/PixelMask.h>
 #include <vw/Image/Interpolation.h>
 
@@ -30,12 +31,18 @@
 #include <asp/Core/IpMatchingAlgs.h>         // Lightweight header
 #include <asp/Core/OpenCVUtils.h>
 #include <asp/Core/DisparityProcessing.h>
+#include <asp/Core/StereoPluginAbi.h>
+#include <asp/Core/RasterStats.h>
+
+#include <vw/Core/Thread.h>
+#include <vw/Image/Algorithms.h>
 
 #include <opencv2/calib3d/calib3d.hpp>
 #include <opencv2/imgcodecs.hpp>
 
 #include <boost/filesystem.hpp>
 #include <boost/dll.hpp>
+#include <cmath>
 #include <limits>
 #include <cctype>
 
@@ -333,6 +340,297 @@ namespace asp {
     
   }
 
+  // The size and modification time of a file, to tell if it changed.
+  // Empty if the file does not exist.
+  std::vector<double> file_signature(std::string const& file) {
+    if (!fs::exists(file))
+      return std::vector<double>();
+    return {double(fs::file_size(file)), double(fs::last_write_time(file))};
+  }
+
+  // The local alignment of a tile does not depend on the correlation
+  // algorithm, so it is saved in the tile directory and reused when
+  // correlation is redone with the same inputs, such as with other
+  // algorithms.
+  std::string local_alignment_file(ASPGlobalOptions const& opt) {
+    return opt.out_prefix + "-local-alignment.txt";
+  }
+
+  // What the local alignment of a tile depends on
+  void local_alignment_inputs(ASPGlobalOptions const & opt,
+                              std::string      const & left_unaligned_file,
+                              std::string      const & right_unaligned_file,
+                              int                      max_tile_size,
+                              double                   left_extra_factor,
+                              double                   right_extra_factor,
+                              BBox2i           const & tile_crop_win,
+                              RasterStats            & inputs) {
+    
+    StereoSettings const& s = stereo_settings();
+    inputs.clear();
+    inputs["tile_crop_win"] = {double(tile_crop_win.min().x()), double(tile_crop_win.min().y()),
+                               double(tile_crop_win.width()), double(tile_crop_win.height())};
+    inputs["tile_size"] = {double(max_tile_size), left_extra_factor, right_extra_factor};
+    inputs["alignment_params"] = {s.local_alignment_threshold,
+                                  double(s.alignment_num_ransac_iterations),
+                                  s.outlier_removal_params[0], s.outlier_removal_params[1],
+                                  double(s.disparity_range_expansion_percent),
+                                  s.max_disp_spread, double(s.seed_mode)};
+    inputs["ip_params"] = {double(s.ip_per_tile), double(s.ip_matching_method),
+                           s.epipolar_threshold, s.ip_inlier_factor, s.ip_uniqueness_thresh,
+                           s.ip_nodata_radius, double(s.adaptive_ip_per_tile),
+                           double(s.ip_num_ransac_iterations)};
+    
+    inputs["left_image"]  = file_signature(opt.out_prefix + "-L.tif");
+    inputs["right_image"] = file_signature(opt.out_prefix + "-R.tif");
+    inputs["left_align"]  = file_signature(opt.out_prefix + "-align-L.exr");
+    inputs["right_align"] = file_signature(opt.out_prefix + "-align-R.exr");
+    inputs["match_file"]  = file_signature(vw::ip::match_filename(opt.out_prefix,
+                                                                  left_unaligned_file,
+                                                                  right_unaligned_file));
+    if (s.seed_mode > 0)
+      inputs["d_sub"] = file_signature(opt.out_prefix + "-D_sub.tif");
+  }
+
+  // Read the saved local alignment of a tile, if it is for the current inputs
+  bool read_local_alignment(std::string const& file, RasterStats const& inputs,
+                            BBox2i         & right_trans_crop_win,
+                            Matrix<double> & left_local_mat,
+                            Matrix<double> & right_local_mat,
+                            Vector2i       & local_trans_aligned_size,
+                            int            & min_disp,
+                            int            & max_disp) {
+    
+    RasterStats stats;
+    if (!read_stats_file(file, stats))
+      return false;
+
+    for (auto it = inputs.begin(); it != inputs.end(); it++) {
+      auto stat = stats.find(it->first);
+      if (stat == stats.end() || stat->second != it->second)
+        return false;
+    }
+
+    std::vector<double> const& win   = stats["right_trans_crop_win"];
+    std::vector<double> const& left  = stats["left_local_mat"];
+    std::vector<double> const& right = stats["right_local_mat"];
+    std::vector<double> const& size  = stats["aligned_size"];
+    std::vector<double> const& range = stats["disp_range"];
+    if (win.size() != 4 || left.size() != 9 || right.size() != 9 ||
+        size.size() != 2 || range.size() != 2)
+      return false;
+    
+    right_trans_crop_win = BBox2i(win[0], win[1], win[2], win[3]);
+    left_local_mat.set_size(3, 3);
+    right_local_mat.set_size(3, 3);
+    for (int row = 0; row < 3; row++) {
+      for (int col = 0; col < 3; col++) {
+        left_local_mat(row, col)  = left[3 * row + col];
+        right_local_mat(row, col) = right[3 * row + col];
+      }
+    }
+    local_trans_aligned_size = Vector2i(size[0], size[1]);
+    min_disp = range[0];
+    max_disp = range[1];
+    
+    return true;
+  }
+
+  void write_local_alignment(std::string const& file, RasterStats const& inputs,
+                             BBox2i         const& right_trans_crop_win,
+                             Matrix<double> const& left_local_mat,
+                             Matrix<double> const& right_local_mat,
+                             Vector2i       const& local_trans_aligned_size,
+                             int min_disp, int max_disp) {
+    
+    RasterStats stats = inputs;
+    stats["right_trans_crop_win"] = {double(right_trans_crop_win.min().x()),
+                                     double(right_trans_crop_win.min().y()),
+                                     double(right_trans_crop_win.width()),
+                                     double(right_trans_crop_win.height())};
+    std::vector<double> & left  = stats["left_local_mat"];
+    std::vector<double> & right = stats["right_local_mat"];
+    for (int row = 0; row < 3; row++) {
+      for (int col = 0; col < 3; col++) {
+        left.push_back(left_local_mat(row, col));
+        right.push_back(right_local_mat(row, col));
+      }
+    }
+    stats["aligned_size"] = {double(local_trans_aligned_size.x()),
+                             double(local_trans_aligned_size.y())};
+    stats["disp_range"] = {double(min_disp), double(max_disp)};
+    
+    vw_out() << "Writing: " << file << "\n";
+    write_stats_file(file, stats);
+  }
+
+  // Find the local alignment of a tile from interest points, and the
+  // disparity search range of the locally aligned images
+  void find_local_alignment(ASPGlobalOptions        const & opt,
+                            std::string             const & left_unaligned_file,
+                            std::string             const & right_unaligned_file,
+                            vw::HomographyTransform const & left_global_trans,
+                            vw::HomographyTransform const & right_global_trans,
+                            DiskImageView<PixelGray<float>> const& left_globally_aligned_image,
+                            DiskImageView<PixelGray<float>> const& right_globally_aligned_image,
+                            float                           left_nodata_value,
+                            float                           right_nodata_value,
+                            int                             max_tile_size,
+                            double                          right_extra_factor,
+                            BBox2i                  const & left_trans_crop_win,
+                            vw::camera::CameraModel const * left_camera_model,
+                            vw::camera::CameraModel const * right_camera_model,
+                            vw::cartography::Datum  const & datum,
+                            // Outputs
+                            BBox2i                        & right_trans_crop_win,
+                            Matrix<double>                & left_local_mat,
+                            Matrix<double>                & right_local_mat,
+                            Vector2i                      & local_trans_aligned_size,
+                            int                           & min_disp,
+                            int                           & max_disp) {
+
+    // Estimate the region in the right image corresponding
+    // to left_trans_crop_win based on ip in the current box and
+    // also by creating ip from D_sub.
+    estimate_right_trans_crop_win(opt, left_unaligned_file, right_unaligned_file,
+                                  left_global_trans, right_global_trans,
+                                  right_globally_aligned_image,  
+                                  max_tile_size, right_extra_factor, left_trans_crop_win,
+                                  // Output
+                                  right_trans_crop_win);
+
+    // TODO(oalexan1): May want to increase here the number of ip per image,
+    // from the default of 5000 in InterestPointMatching.cc.
+    // But do not introduced hard-coded values.
+    
+    // Redo ip matching in the current tile. It should be more accurate after alignment
+    // and cropping.
+    std::vector<vw::ip::InterestPoint> left_local_ip, right_local_ip;
+    detect_match_ip(left_local_ip, right_local_ip,
+                    crop(left_globally_aligned_image, left_trans_crop_win),
+                    crop(right_globally_aligned_image, right_trans_crop_win), 
+                    stereo_settings().ip_per_tile,
+                    "", "", // do not save any results to disk  
+                    left_nodata_value, right_nodata_value,
+                    "" // do not save any match file to disk
+                    );
+
+    if (stereo_settings().local_alignment_debug) {
+      // These clips have global but not local alignment
+      vw::cartography::GeoReference georef;
+      bool has_georef = false, has_nodata = true;
+      float nan_nodata = std::numeric_limits<float>::quiet_NaN();
+
+      std::string left_crop = opt.out_prefix + "-" + "left-crop.tif";
+      vw_out() << "\t--> Writing: " << left_crop << "\n";
+      block_write_gdal_image(left_crop, crop(left_globally_aligned_image,
+                                             left_trans_crop_win),
+                             has_georef, georef,
+                             has_nodata, left_nodata_value, opt,
+                             TerminalProgressCallback("asp","\t  Left:  "));
+      
+      std::string right_crop = opt.out_prefix + "-" + "right-crop.tif";
+      vw_out() << "\t--> Writing: " << right_crop << "\n";
+      block_write_gdal_image(right_crop, crop(right_globally_aligned_image,
+                                             right_trans_crop_win),
+                             has_georef, georef,
+                             has_nodata, right_nodata_value, opt,
+                             TerminalProgressCallback("asp","\t  Right:  "));
+
+      std::string local_match_filename = vw::ip::match_filename(opt.out_prefix,
+                                                                left_crop, right_crop);
+      vw_out() << "Writing match file: " << local_match_filename << "\n";
+      vw::ip::write_binary_match_file(local_match_filename, left_local_ip, right_local_ip);
+    }
+
+    // Find the local alignment
+    // TODO(oalexan1): May want to do do an initial affine epipolar alignment
+    // based on d_sub and preexisting match points, with a bigger outlier factor,
+    // then do an initial rectification, then redo it as below. 
+    std::vector<size_t> ip_inlier_indices;
+    bool crop_to_shared_area = false;
+    local_trans_aligned_size =
+      affine_epipolar_rectification(left_trans_crop_win.size(), right_trans_crop_win.size(),
+                                    stereo_settings().local_alignment_threshold,
+                                    stereo_settings().alignment_num_ransac_iterations,
+                                    left_local_ip, right_local_ip,
+                                    crop_to_shared_area,
+                                    left_local_mat, right_local_mat, &ip_inlier_indices);
+
+    Vector2 outlier_removal_params = stereo_settings().outlier_removal_params;
+
+    // Filter outliers using cameras among the ip in the tile which have the global alignment
+    // applied to them. 
+    if (outlier_removal_params[0] < 100.0)
+      filter_local_ip_using_cameras(opt, outlier_removal_params,  
+                                    left_global_trans, right_global_trans,  
+                                    left_trans_crop_win, right_trans_crop_win,  
+                                    left_camera_model, right_camera_model, datum,
+                                    // These get modified
+                                    left_local_ip, right_local_ip, ip_inlier_indices);
+
+    // Apply the local alignment transform to ip in the tile
+    std::vector<vw::ip::InterestPoint> left_trans_local_ip;
+    std::vector<vw::ip::InterestPoint> right_trans_local_ip;
+    apply_transforms_to_ip(left_local_ip, right_local_ip, ip_inlier_indices,  
+                           left_local_mat, right_local_mat,  
+                           // Outputs
+                           left_trans_local_ip, right_trans_local_ip);
+
+    // Filter outliers among locally aligned ip, this can reduce the search range
+    bool quiet = false;
+    if (outlier_removal_params[0] < 100.0)
+      asp::filter_ip_by_disparity(outlier_removal_params[0], outlier_removal_params[1], quiet,
+                                  left_trans_local_ip, right_trans_local_ip);
+    
+    //  Find the disparity search range
+    BBox2 disp_range;
+    for (size_t it = 0; it < left_trans_local_ip.size(); it++) {
+      Vector2 left_pt (left_trans_local_ip [it].x, left_trans_local_ip [it].y);
+      Vector2 right_pt(right_trans_local_ip[it].x, right_trans_local_ip[it].y);
+      disp_range.grow(right_pt - left_pt);
+    }
+    
+    if (stereo_settings().local_alignment_debug) {
+      std::string local_aligned_match_filename
+        = vw::ip::match_filename(opt.out_prefix, left_tile, right_tile);
+      vw_out() << "Writing match file: " << local_aligned_match_filename << "\n";
+      vw::ip::write_binary_match_file(local_aligned_match_filename, left_trans_local_ip,
+                                      right_trans_local_ip);
+    }
+    
+    // Expand the disparity search range a bit
+    double disp_width = disp_range.width();
+    double disp_extra = disp_width * stereo_settings().disparity_range_expansion_percent / 100.0;
+    
+    min_disp = floor(disp_range.min().x() - disp_extra/2.0);
+    max_disp = ceil(disp_range.max().x()  + disp_extra/2.0);
+
+    // TODO(oalexan1): Make this into a function.
+    if (stereo_settings().max_disp_spread > 0) {
+      
+      vw_out() << "Min and max disparities before invoking the --max-disp-spread option: "
+               << min_disp << ' ' << max_disp << ".\n";
+      
+      std::vector<double> diff;
+      for (size_t it = 0; it < left_trans_local_ip.size(); it++) 
+        diff.push_back(right_trans_local_ip[it].x - left_trans_local_ip[it].x);
+      
+      if (diff.empty()) 
+        vw_throw(ArgumentErr() << "No interest points left.");
+      
+      std::sort(diff.begin(), diff.end());
+      double mid_x = diff[diff.size()/2]; // median
+      
+      double len = stereo_settings().max_disp_spread;
+      double half = len / 2.0;
+      min_disp = std::max(min_disp, (int)floor(mid_x - half));
+      max_disp = std::min(max_disp, (int)ceil (mid_x + half));
+
+      // The resulting range of disparities will be printed later.
+    }
+  }
+
   // Algorithm to perform local alignment. Approach:
   //  - Given the global interest points and the left crop window, find
   //    the right crop window.
@@ -364,7 +662,10 @@ namespace asp {
                        std::string                   & left_aligned_file,
                        std::string                   & right_aligned_file,
                        int                           & min_disp,
-                       int                           & max_disp) {
+                       int                           & max_disp,
+                       vw::ImageView<float>          * left_aligned_image,
+                       vw::ImageView<float>          * right_aligned_image,
+                       bool                            write_aligned_files) {
   
     // Read the unaligned images
     std::string left_unaligned_file = opt.in_file1;
@@ -417,58 +718,33 @@ namespace asp {
     vw::HomographyTransform left_global_trans(left_global_mat);
     vw::HomographyTransform right_global_trans(right_global_mat);
 
-    // Estimate the region in the right image corresponding
-    // to left_trans_crop_win based on ip in the current box and
-    // also by creating ip from D_sub.
-    estimate_right_trans_crop_win(opt, left_unaligned_file, right_unaligned_file,
-                                  left_global_trans, right_global_trans,
-                                  right_globally_aligned_image,  
-                                  max_tile_size, right_extra_factor, left_trans_crop_win,
-                                  // Output
-                                  right_trans_crop_win);
-
-    // TODO(oalexan1): May want to increase here the number of ip per image,
-    // from the default of 5000 in InterestPointMatching.cc.
-    // But do not introduced hard-coded values.
+    // Find the local alignment, unless it was found before for the same inputs
+    Vector2i local_trans_aligned_size;
+    RasterStats inputs;
+    local_alignment_inputs(opt, left_unaligned_file, right_unaligned_file, max_tile_size,
+                           left_extra_factor, right_extra_factor, tile_crop_win, inputs);
+    std::string alignment_file = local_alignment_file(opt);
     
-    // Redo ip matching in the current tile. It should be more accurate after alignment
-    // and cropping.
-    std::vector<vw::ip::InterestPoint> left_local_ip, right_local_ip;
-    detect_match_ip(left_local_ip, right_local_ip,
-                    crop(left_globally_aligned_image, left_trans_crop_win),
-                    crop(right_globally_aligned_image, right_trans_crop_win), 
-                    stereo_settings().ip_per_tile,
-                    "", "", // do not save any results to disk  
-                    left_nodata_value, right_nodata_value,
-                    "" // do not save any match file to disk
-                    );
-
-    if (stereo_settings().local_alignment_debug) {
-      // These clips have global but not local alignment
-      vw::cartography::GeoReference georef;
-      bool has_georef = false, has_nodata = true;
-      float nan_nodata = std::numeric_limits<float>::quiet_NaN();
-
-      std::string left_crop = opt.out_prefix + "-" + "left-crop.tif";
-      vw_out() << "\t--> Writing: " << left_crop << "\n";
-      block_write_gdal_image(left_crop, crop(left_globally_aligned_image,
-                                             left_trans_crop_win),
-                             has_georef, georef,
-                             has_nodata, left_nodata_value, opt,
-                             TerminalProgressCallback("asp","\t  Left:  "));
-      
-      std::string right_crop = opt.out_prefix + "-" + "right-crop.tif";
-      vw_out() << "\t--> Writing: " << right_crop << "\n";
-      block_write_gdal_image(right_crop, crop(right_globally_aligned_image,
-                                             right_trans_crop_win),
-                             has_georef, georef,
-                             has_nodata, right_nodata_value, opt,
-                             TerminalProgressCallback("asp","\t  Right:  "));
-
-      std::string local_match_filename = vw::ip::match_filename(opt.out_prefix,
-                                                                left_crop, right_crop);
-      vw_out() << "Writing match file: " << local_match_filename << "\n";
-      vw::ip::write_binary_match_file(local_match_filename, left_local_ip, right_local_ip);
+    // With debugging, the alignment is always redone, to write the
+    // intermediate files.
+    if (!stereo_settings().local_alignment_debug &&
+        read_local_alignment(alignment_file, inputs,
+                             right_trans_crop_win, left_local_mat, right_local_mat,
+                             local_trans_aligned_size, min_disp, max_disp)) {
+      vw_out() << "Read the local alignment from: " << alignment_file << "\n";
+    } else {
+      find_local_alignment(opt, left_unaligned_file, right_unaligned_file,
+                           left_global_trans, right_global_trans,
+                           left_globally_aligned_image, right_globally_aligned_image,
+                           left_nodata_value, right_nodata_value,
+                           max_tile_size, right_extra_factor, left_trans_crop_win,
+                           left_camera_model, right_camera_model, datum,
+                           // Outputs
+                           right_trans_crop_win, left_local_mat, right_local_mat,
+                           local_trans_aligned_size, min_disp, max_disp);
+      write_local_alignment(alignment_file, inputs,
+                            right_trans_crop_win, left_local_mat, right_local_mat,
+                            local_trans_aligned_size, min_disp, max_disp);
     }
 
     // The matrices which take care of the crop to the current tile
@@ -480,20 +756,6 @@ namespace asp {
     right_crop_mat(0, 2) = -right_trans_crop_win.min().x();
     right_crop_mat(1, 2) = -right_trans_crop_win.min().y();
 
-    // Find the local alignment
-    // TODO(oalexan1): May want to do do an initial affine epipolar alignment
-    // based on d_sub and preexisting match points, with a bigger outlier factor,
-    // then do an initial rectification, then redo it as below. 
-    std::vector<size_t> ip_inlier_indices;
-    bool crop_to_shared_area = false;
-    Vector2i local_trans_aligned_size =
-      affine_epipolar_rectification(left_trans_crop_win.size(), right_trans_crop_win.size(),
-                                    stereo_settings().local_alignment_threshold,
-                                    stereo_settings().alignment_num_ransac_iterations,
-                                    left_local_ip, right_local_ip,
-                                    crop_to_shared_area,
-                                    left_local_mat, right_local_mat, &ip_inlier_indices);
-
     // Combination of global alignment, crop to current tile, and local alignment
     Matrix<double> combined_left_mat  = left_local_mat * left_crop_mat * left_global_mat;
     Matrix<double> combined_right_mat = right_local_mat * right_crop_mat * right_global_mat;
@@ -598,98 +860,33 @@ namespace asp {
       right_trans_clip = apply_mask(create_mask(right_trans_clip, 0), 0); 
     }
     
+    // Pass the locally aligned images to the caller, if desired
+    if (left_aligned_image != NULL && right_aligned_image != NULL) {
+      *left_aligned_image  = left_trans_clip;
+      *right_aligned_image = right_trans_clip;
+    }
+    
     // Write the locally aligned images to disk
-    vw::cartography::GeoReference georef;
-    bool has_georef = false, has_aligned_nodata = write_nodata;
     std::string left_tile = "left-aligned-tile.tif";
     std::string right_tile = "right-aligned-tile.tif";
     left_aligned_file = opt.out_prefix + "-" + left_tile; 
-    vw_out() << "\t--> Writing: " << left_aligned_file << "\n";
-    block_write_gdal_image(left_aligned_file, left_trans_clip,
-                           has_georef, georef,
-                           has_aligned_nodata, nan_nodata, opt,
-                           TerminalProgressCallback("asp","\t  Left:  "));
     right_aligned_file = opt.out_prefix + "-" + right_tile;
-    vw_out() << "\t--> Writing: " << right_aligned_file << "\n";
-    block_write_gdal_image(right_aligned_file,
-                           right_trans_clip,
-                           has_georef, georef,
-                           has_aligned_nodata, nan_nodata, opt,
-                           TerminalProgressCallback("asp","\t  Right:  "));
-    
-    Vector2 outlier_removal_params = stereo_settings().outlier_removal_params;
-
-    // Filter outliers using cameras among the ip in the tile which have the global alignment
-    // applied to them. 
-    if (outlier_removal_params[0] < 100.0)
-      filter_local_ip_using_cameras(opt, outlier_removal_params,  
-                                    left_global_trans, right_global_trans,  
-                                    left_trans_crop_win, right_trans_crop_win,  
-                                    left_camera_model, right_camera_model, datum,
-                                    // These get modified
-                                    left_local_ip, right_local_ip, ip_inlier_indices);
-
-    // Apply the local alignment transform to ip in the tile
-    std::vector<vw::ip::InterestPoint> left_trans_local_ip;
-    std::vector<vw::ip::InterestPoint> right_trans_local_ip;
-    apply_transforms_to_ip(left_local_ip, right_local_ip, ip_inlier_indices,  
-                           left_local_mat, right_local_mat,  
-                           // Outputs
-                           left_trans_local_ip, right_trans_local_ip);
-
-    // Filter outliers among locally aligned ip, this can reduce the search range
-    bool quiet = false;
-    if (outlier_removal_params[0] < 100.0)
-      asp::filter_ip_by_disparity(outlier_removal_params[0], outlier_removal_params[1], quiet,
-                                  left_trans_local_ip, right_trans_local_ip);
-    
-    //  Find the disparity search range
-    BBox2 disp_range;
-    for (size_t it = 0; it < left_trans_local_ip.size(); it++) {
-      Vector2 left_pt (left_trans_local_ip [it].x, left_trans_local_ip [it].y);
-      Vector2 right_pt(right_trans_local_ip[it].x, right_trans_local_ip[it].y);
-      disp_range.grow(right_pt - left_pt);
-    }
-    
-    if (stereo_settings().local_alignment_debug) {
-      std::string local_aligned_match_filename
-        = vw::ip::match_filename(opt.out_prefix, left_tile, right_tile);
-      vw_out() << "Writing match file: " << local_aligned_match_filename << "\n";
-      vw::ip::write_binary_match_file(local_aligned_match_filename, left_trans_local_ip,
-                                      right_trans_local_ip);
+    if (write_aligned_files) {
+      vw::cartography::GeoReference georef;
+      bool has_georef = false, has_aligned_nodata = write_nodata;
+      vw_out() << "\t--> Writing: " << left_aligned_file << "\n";
+      block_write_gdal_image(left_aligned_file, left_trans_clip,
+                             has_georef, georef,
+                             has_aligned_nodata, nan_nodata, opt,
+                             TerminalProgressCallback("asp","\t  Left:  "));
+      vw_out() << "\t--> Writing: " << right_aligned_file << "\n";
+      block_write_gdal_image(right_aligned_file,
+                             right_trans_clip,
+                             has_georef, georef,
+                             has_aligned_nodata, nan_nodata, opt,
+                             TerminalProgressCallback("asp","\t  Right:  "));
     }
     
-    // Expand the disparity search range a bit
-    double disp_width = disp_range.width();
-    double disp_extra = disp_width * stereo_settings().disparity_range_expansion_percent / 100.0;
-    
-    min_disp = floor(disp_range.min().x() - disp_extra/2.0);
-    max_disp = ceil(disp_range.max().x()  + disp_extra/2.0);
-
-    // TODO(oalexan1): Make this into a function.
-    if (stereo_settings().max_disp_spread > 0) {
-      
-      vw_out() << "Min and max disparities before invoking the --max-disp-spread option: "
-               << min_disp << ' ' << max_disp << ".\n";
-      
-      std::vector<double> diff;
-      for (size_t it = 0; it < left_trans_local_ip.size(); it++) 
-        diff.push_back(right_trans_local_ip[it].x - left_trans_local_ip[it].x);
-      
-      if (diff.empty()) 
-        vw_throw(ArgumentErr() << "No interest points left.");
-      
-      std::sort(diff.begin(), diff.end());
-      double mid_x = diff[diff.size()/2]; // median
-      
-      double len = stereo_settings().max_disp_spread;
-      double half = len / 2.0;
-      min_disp = std::max(min_disp, (int)floor(mid_x - half));
-      max_disp = std::min(max_disp, (int)ceil (mid_x + half));
-
-      // The resulting range of disparities will be printed later.
-    }
-
     // TODO(oalexan1): If just small slivers of valid data
     // are left in the tiles without the padding, this tile better
     // be skipped.
@@ -810,6 +1007,96 @@ namespace asp {
   }
 #endif
   
+  // Bilinearly interpolate a masked image. The result is invalid if any
+  // of the four pixels used is invalid or out of bounds, as when
+  // interpolating with an invalid edge extension.
+  template <class PixelT>
+  bool interp_masked_pixel(ImageView<PixelMask<PixelT>> const& img, double x, double y,
+                           PixelT & val) {
+    int col = floor(x), row = floor(y);
+    if (col < 0 || row < 0 || col + 1 >= img.cols() || row + 1 >= img.rows())
+      return false;
+    PixelMask<PixelT> const& p00 = img(col,     row);
+    PixelMask<PixelT> const& p10 = img(col + 1, row);
+    PixelMask<PixelT> const& p01 = img(col,     row + 1);
+    PixelMask<PixelT> const& p11 = img(col + 1, row + 1);
+    if (!is_valid(p00) || !is_valid(p10) || !is_valid(p01) || !is_valid(p11))
+      return false;
+    double wx = x - col, wy = y - row;
+    val = (1.0 - wy) * ((1.0 - wx) * p00.child() + wx * p10.child())
+      + wy * ((1.0 - wx) * p01.child() + wx * p11.child());
+    return true;
+  }
+
+  // Apply a homography to a pixel
+  inline Vector2 apply_homography(Matrix<double> const& H, Vector2 const& pix) {
+    double w = H(2, 0) * pix.x() + H(2, 1) * pix.y() + H(2, 2);
+    return Vector2((H(0, 0) * pix.x() + H(0, 1) * pix.y() + H(0, 2)) / w,
+                   (H(1, 0) * pix.x() + H(1, 1) * pix.y() + H(1, 2)) / w);
+  }
+
+  // Visit the pixels of a tile row by row, and pass to the functor each
+  // pixel and where the alignment transform takes it. For a given row,
+  // the homography numerator and denominator are linear in the column,
+  // so they cost one multiply-add each per pixel.
+  template <class FuncT>
+  void for_each_aligned_pixel(int cols, int rows, Matrix<double> const& align_mat,
+                              FuncT & func) {
+    Matrix<double> const& H = align_mat;
+    for (int row = 0; row < rows; row++) {
+      double u0 = H(0, 1) * row + H(0, 2);
+      double v0 = H(1, 1) * row + H(1, 2);
+      double w0 = H(2, 1) * row + H(2, 2);
+      for (int col = 0; col < cols; col++) {
+        double w = H(2, 0) * col + w0;
+        func(col, row, Vector2((H(0, 0) * col + u0) / w, (H(1, 0) * col + v0) / w));
+      }
+    }
+  }
+
+  // Undo the alignment of a 2D disparity, at each pixel of the unaligned left tile
+  struct UnalignDisparity {
+    ImageView<PixelMask<Vector2f>> const& aligned_disp;
+    Matrix<double> right_unalign_mat;
+    Vector2 crop_offset;
+    ImageView<PixelMask<Vector2f>> & unaligned_disp;
+
+    UnalignDisparity(ImageView<PixelMask<Vector2f>> const& aligned_disp_in,
+                     vw::BBox2i const& left_crop_win, vw::BBox2i const& right_crop_win,
+                     Matrix<double> const& right_align_mat,
+                     ImageView<PixelMask<Vector2f>> & unaligned_disp_out):
+      aligned_disp(aligned_disp_in), right_unalign_mat(vw::math::inverse(right_align_mat)),
+      crop_offset(right_crop_win.min() - left_crop_win.min()),
+      unaligned_disp(unaligned_disp_out) {}
+
+    void operator()(int col, int row, Vector2 const& left_trans_pix) {
+      // TODO(oalexan1): Here bilinear interpolation is used. This will
+      // make the holes a little bigger where there is no data. Need
+      // to figure out if it is desired to fill holes.
+      Vector2f interp_disp;
+      if (!interp_masked_pixel(aligned_disp, left_trans_pix.x(), left_trans_pix.y(),
+                               interp_disp)) {
+        unaligned_disp(col, row) = PixelMask<Vector2f>();
+        unaligned_disp(col, row).invalidate();
+        return;
+      }
+
+      // Do the math with doubles rather than with floats, so cast
+      // Vector2f to Vector2.
+      Vector2 right_trans_pix = left_trans_pix + Vector2(interp_disp);
+
+      // Undo the transform
+      Vector2 right_pix = apply_homography(right_unalign_mat, right_trans_pix);
+
+      // Un-transformed disparity. Adjust for the fact that the two tiles
+      // before alignment were crops from larger images.
+      Vector2 disp_pix = right_pix - Vector2(col, row) + crop_offset;
+
+      unaligned_disp(col, row).child() = Vector2f(disp_pix.x(), disp_pix.y());
+      unaligned_disp(col, row).validate();
+    }
+  };
+
   // TODO(oalexan1): if left pix or right pix is invalid in the image,
   // the disparity must be invalid! Test with OpenCV SGBM, libelas, and mgm!
   // Also implement for unalign_2d_disparity.
@@ -826,56 +1113,22 @@ namespace asp {
                             // Output
                             vw::ImageView<vw::PixelMask<vw::Vector2f>> & unaligned_disp_2d) {
 
-    vw::HomographyTransform left_align_trans (left_align_mat);
-    vw::HomographyTransform right_align_trans(right_align_mat);
-
-    float nan_nodata = std::numeric_limits<float>::quiet_NaN(); // NaN value
-    PixelMask<float> nodata_mask = PixelMask<float>(); // invalid value for a PixelMask
-
-    ImageViewRef<PixelMask<float>> masked_aligned_disp_1d
-      = create_mask(aligned_disp_1d, nan_nodata);
-
-    // TODO(oalexan1): Here bilinear interpolation is used. This will
-    // make the holes a little bigger where there is no data. Need
-    // to figure out if it is desired to fill holes.
-    ImageViewRef<PixelMask<float>> interp_aligned_disp_1d
-      = interpolate(masked_aligned_disp_1d, BilinearInterpolation(),
-                    ValueEdgeExtension<PixelMask<float>>(nodata_mask));
-    
-    unaligned_disp_2d.set_size(left_crop_win.width(), left_crop_win.height());
-
-    for (int col = 0; col < unaligned_disp_2d.cols(); col++) {
-      for (int row = 0; row < unaligned_disp_2d.rows(); row++) {
-        Vector2 left_pix(col, row);
-        Vector2 left_trans_pix = left_align_trans.forward(left_pix);
-        PixelMask<float> interp_disp
-          = interp_aligned_disp_1d(left_trans_pix.x(), left_trans_pix.y());
-
-        if (!is_valid(interp_disp)) {
-          unaligned_disp_2d(col, row) = PixelMask<Vector2f>();
-          unaligned_disp_2d(col, row).invalidate();
-          continue;
-        }
-
-        // Since the disparity is 1D, the y value (row) is the same
-        // as for the input.
-        Vector2 right_trans_pix(left_trans_pix.x() + interp_disp.child(), left_trans_pix.y());
-
-        // Undo the transform
-        Vector2 right_pix = right_align_trans.reverse(right_trans_pix);
-
-        // Un-transformed disparity
-        Vector2 disp_pix = right_pix - left_pix;
-
-        // Adjust for the fact that the two tiles before alignment
-        // were crops from larger images
-        disp_pix += (right_crop_win.min() - left_crop_win.min());
-      
-        unaligned_disp_2d(col, row).child() = Vector2f(disp_pix.x(), disp_pix.y());
-        unaligned_disp_2d(col, row).validate();
-      }   
+    // Since the disparity is 1D, the y value (row) is the same as for the
+    // input, so it is the 2D disparity with a zero y component, which
+    // interpolates to zero exactly. NaN is no-data.
+    ImageView<float> disp_1d = aligned_disp_1d;
+    ImageView<PixelMask<Vector2f>> disp_2d(disp_1d.cols(), disp_1d.rows());
+    for (int row = 0; row < disp_1d.rows(); row++) {
+      for (int col = 0; col < disp_1d.cols(); col++) {
+        float d = disp_1d(col, row);
+        disp_2d(col, row) = PixelMask<Vector2f>(Vector2f(d, 0));
+        if (std::isnan(d))
+          disp_2d(col, row).invalidate();
+      }
     }
-  
+
+    unalign_2d_disparity(disp_2d, left_crop_win, right_crop_win,
+                         left_align_mat, right_align_mat, unaligned_disp_2d);
   }
 
   // Go from 2D disparity of images with affine epipolar alignment to the 2D
@@ -889,54 +1142,33 @@ namespace asp {
                             // Output
                             vw::ImageView<vw::PixelMask<vw::Vector2f>> & unaligned_disp_2d) {
     
-    vw::HomographyTransform left_align_trans (left_align_mat);
-    vw::HomographyTransform right_align_trans(right_align_mat);
-
-    PixelMask<vw::Vector2f> nodata_pix;
-    nodata_pix.invalidate();
-    
-    // TODO(oalexan1): Here bilinear interpolation is used. This will
-    // make the holes a little bigger where there is no data. Need
-    // to figure out if it is desired to fill holes.
-    ImageViewRef<vw::PixelMask<vw::Vector2f>> interp_aligned_disp_2d
-      = interpolate(aligned_disp_2d, BilinearInterpolation(),
-                    ValueEdgeExtension<PixelMask<vw::Vector2f>>(nodata_pix));
-    
     unaligned_disp_2d.set_size(left_crop_win.width(), left_crop_win.height());
+    UnalignDisparity unalign(aligned_disp_2d, left_crop_win, right_crop_win,
+                             right_align_mat, unaligned_disp_2d);
+    for_each_aligned_pixel(unaligned_disp_2d.cols(), unaligned_disp_2d.rows(),
+                           left_align_mat, unalign);
+  }
 
-    for (int col = 0; col < unaligned_disp_2d.cols(); col++) {
-      for (int row = 0; row < unaligned_disp_2d.rows(); row++) {
-        Vector2 left_pix(col, row);
-        Vector2 left_trans_pix = left_align_trans.forward(left_pix);
-        PixelMask<vw::Vector2f> interp_disp
-          = interp_aligned_disp_2d(left_trans_pix.x(), left_trans_pix.y());
-        
-        if (!is_valid(interp_disp)) {
-          unaligned_disp_2d(col, row) = PixelMask<Vector2f>();
-          unaligned_disp_2d(col, row).invalidate();
-          continue;
-        }
-
-        // Do the math with doubles rather than with floats, so cast
-        // Vector2f to Vector2.
-        Vector2 right_trans_pix = left_trans_pix + Vector2(interp_disp.child());
-
-        // Undo the transform
-        Vector2 right_pix = right_align_trans.reverse(right_trans_pix);
+  // Resample an image aligned with the left image at the pixels of the
+  // unaligned left tile
+  struct UnalignImage {
+    ImageView<PixelMask<float>> const& aligned_image;
+    ImageView<PixelMask<float>> & unaligned_image;
 
-        // Un-transformed disparity
-        Vector2 disp_pix = right_pix - left_pix;
+    UnalignImage(ImageView<PixelMask<float>> const& aligned_image_in,
+                 ImageView<PixelMask<float>> & unaligned_image_out):
+      aligned_image(aligned_image_in), unaligned_image(unaligned_image_out) {}
 
-        // Adjust for the fact that the two tiles before alignment
-        // were crops from larger images
-        disp_pix += (right_crop_win.min() - left_crop_win.min());
-      
-        unaligned_disp_2d(col, row).child() = Vector2f(disp_pix.x(), disp_pix.y());
-        unaligned_disp_2d(col, row).validate();
-      }   
+    void operator()(int col, int row, Vector2 const& left_trans_pix) {
+      float val = 0.0;
+      if (interp_masked_pixel(aligned_image, left_trans_pix.x(), left_trans_pix.y(), val)) {
+        unaligned_image(col, row) = PixelMask<float>(val);
+      } else {
+        unaligned_image(col, row) = PixelMask<float>();
+        unaligned_image(col, row).invalidate();
+      }
     }
-    
-  }
+  };
   
   // Given an image in one-to-one correspondence with an aligned left image,
   // find its corresponding version for the unaligned left image.
@@ -948,29 +1180,13 @@ namespace asp {
                             // Output
                             vw::ImageView<vw::PixelMask<float>> & unaligned_image) {
     
-    vw::HomographyTransform left_align_trans(left_align_mat);
-
-    PixelMask<float> nodata_pix;
-    nodata_pix.invalidate();
-    
     // TODO(oalexan1): Here bilinear interpolation is used. This will
     // make the holes a little bigger where there is no data. Need
     // to figure out if it is desired to fill holes.
-    ImageViewRef<vw::PixelMask<float>> interp_aligned_image
-      = interpolate(aligned_image, BilinearInterpolation(),
-                    ValueEdgeExtension<PixelMask<float>>(nodata_pix));
-    
     unaligned_image.set_size(left_crop_win.width(), left_crop_win.height());
-    for (int col = 0; col < unaligned_image.cols(); col++) {
-      for (int row = 0; row < unaligned_image.rows(); row++) {
-        Vector2 left_pix(col, row);
-        Vector2 left_trans_pix = left_align_trans.forward(left_pix);
-        PixelMask<float> interp_val
-          = interp_aligned_image(left_trans_pix.x(), left_trans_pix.y());
-        
-        unaligned_image(col, row) = interp_val;
-      }
-    }
+    UnalignImage unalign(aligned_image, unaligned_image);
+    for_each_aligned_pixel(unaligned_image.cols(), unaligned_image.rows(),
+                           left_align_mat, unalign);
   }
   
   // Read the list of external stereo programs (plugins) and extract
@@ -1039,6 +1255,105 @@ namespace asp {
     return;
   }
 
+  // If the plugin listed in the plugins list is a shared library
+  // implementing the interface in StereoPluginAbi.h, rather than an
+  // executable.
+  bool is_plugin_library(std::string const& plugin_path) {
+    std::string ext = boost::to_lower_copy(fs::path(plugin_path).extension().string());
+    return (ext == ".so" || ext == ".dylib");
+  }
+
+  // Load a stereo plugin library only once per process, and keep it loaded,
+  // as a tile may be processed in several calls.
+  vw::Mutex g_plugin_library_mutex;
+  std::map<std::string, boost::shared_ptr<boost::dll::shared_library>> g_plugin_libraries;
+  
+  boost::dll::shared_library & load_plugin_library(std::string const& plugin_path) {
+
+    vw::Mutex::Lock lock(g_plugin_library_mutex);
+    
+    auto it = g_plugin_libraries.find(plugin_path);
+    if (it != g_plugin_libraries.end()) 
+      return *(it->second);
+
+    if (!fs::exists(plugin_path))
+      vw_throw(ArgumentErr() << "Cannot find stereo plugin library: " << plugin_path << ".\n");
+    
+    vw_out() << "Loading stereo plugin library: " << plugin_path << std::endl;
+    boost::shared_ptr<boost::dll::shared_library> lib;
+    try {
+      lib.reset(new boost::dll::shared_library(plugin_path));
+    } catch (std::exception const& e) {
+      vw_throw(ArgumentErr() << "Could not load stereo plugin library: " << plugin_path
+               << ". Error: " << e.what() << "\n");
+    }
+    
+    if (!lib->has("asp_stereo_plugin_abi_version") || !lib->has("asp_stereo_plugin_run"))
+      vw_throw(ArgumentErr() << "The library " << plugin_path
+               << " does not implement the interface in StereoPluginAbi.h.\n");
+
+    int version = lib->get<int()>("asp_stereo_plugin_abi_version")();
+    if (version != ASP_STEREO_PLUGIN_ABI_VERSION)
+      vw_throw(ArgumentErr() << "The stereo plugin library " << plugin_path
+               << " was built with interface version " << version << " but version "
+               << ASP_STEREO_PLUGIN_ABI_VERSION << " is expected.\n");
+    
+    g_plugin_libraries[plugin_path] = lib;
+    return *lib;
+  }
+  
+  // Call a stereo plugin shared library in-process on the locally aligned
+  // images. The library is loaded on first use and kept loaded. 
+  void call_stereo_plugin_library(std::string const& plugin_path,
+                                  std::string const& options,
+                                  std::map<std::string, std::string> const& env_vars_map,
+                                  vw::ImageView<float> const& left_image,
+                                  vw::ImageView<float> const& right_image,
+                                  int min_disp, int max_disp,
+                                  // Output
+                                  vw::ImageView<float> & out_disp) {
+
+    if (left_image.cols() != right_image.cols() || left_image.rows() != right_image.rows())
+      vw_throw(ArgumentErr() << "Expecting the locally aligned images to have "
+               << "the same dimensions.\n");
+    
+    boost::dll::shared_library & lib = load_plugin_library(plugin_path);
+    
+    // Split the options at whitespace. The strings must persist while the
+    // plugin is running, as only pointers to them are passed in.
+    std::vector<std::string> opt_vec, env_vec;
+    std::istringstream is(options);
+    std::string val;
+    while (is >> val)
+      opt_vec.push_back(val);
+    for (auto it = env_vars_map.begin(); it != env_vars_map.end(); it++)
+      env_vec.push_back(it->first + "=" + it->second);
+    
+    std::vector<const char*> opt_ptrs, env_ptrs;
+    for (size_t it = 0; it < opt_vec.size(); it++)
+      opt_ptrs.push_back(opt_vec[it].c_str());
+    for (size_t it = 0; it < env_vec.size(); it++)
+      env_ptrs.push_back(env_vec[it].c_str());
+
+    // The output is set to invalid, in case the plugin does not touch some pixels
+    out_disp.set_size(left_image.cols(), left_image.rows());
+    vw::fill(out_disp, std::numeric_limits<float>::quiet_NaN());
+
+    // ImageView stores the pixels contiguously, row after row, which is
+    // what the plugin expects.
+    vw_out() << "Calling in-process stereo plugin: " << plugin_path << " " << options << "\n";
+    int ret = lib.get<int(int, const char * const *, int, const char * const *,
+                          const float *, const float *, int, int, int, int, float*)>
+      ("asp_stereo_plugin_run")(opt_ptrs.size(), opt_ptrs.data(),
+                                env_ptrs.size(), env_ptrs.data(), 
+                                left_image.data(), right_image.data(),
+                                left_image.cols(), left_image.rows(),
+                                min_disp, max_disp, out_disp.data());
+    if (ret != 0)
+      vw_throw(ArgumentErr() << "Stereo plugin " << plugin_path
+               << " failed with return code " << ret << ".\n");
+  }
+  
   // Given a string like "mgm -O 8 -s vfit", separate the name,
   // which is the first word, from the options, which is the rest.
   void parse_stereo_alg_name_and_opts(std::string const& stereo_alg,
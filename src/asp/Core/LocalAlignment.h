@@ -26,6 +26,9 @@
 #include <vw/Math/Matrix.h>
 #include <vw/Image/ImageViewRef.h>
 
+#include <map>
+#include <string>
+
 // Forward declarations
 namespace vw {
   namespace camera {
@@ -71,7 +74,12 @@ namespace asp {
                        std::string        & left_aligned_file,
                        std::string        & right_aligned_file,
                        int                & min_disp,
-                       int                & max_disp); 
+                       int                & max_disp,
+                       // If not null, keep here the aligned images as well. Then
+                       // they are written to disk only if write_aligned_files is true.
+                       vw::ImageView<float> * left_aligned_image = NULL,
+                       vw::ImageView<float> * right_aligned_image = NULL,
+                       bool write_aligned_files = true); 
   
   // Go from 1D disparity of images with affine epipolar alignment to the 2D
   // disparity by undoing the transforms that applied this alignment.
@@ -112,6 +120,22 @@ namespace asp {
   void parse_plugins_list(std::map<std::string, std::string> & plugins,
                           std::map<std::string, std::string> & plugin_libs);
 
+  // If the plugin listed in the plugins list is a shared library
+  // implementing the interface in StereoPluginAbi.h, rather than an
+  // executable.
+  bool is_plugin_library(std::string const& plugin_path);
+
+  // Call a stereo plugin shared library in-process on the locally aligned
+  // images. The library is loaded on first use and kept loaded. 
+  void call_stereo_plugin_library(std::string const& plugin_path,
+                                  std::string const& options,
+                                  std::map<std::string, std::string> const& env_vars_map,
+                                  vw::ImageView<float> const& left_image,
+                                  vw::ImageView<float> const& right_image,
+                                  int min_disp, int max_disp,
+                                  // Output
+                                  vw::ImageView<float> & out_disp);
+  
   // Given a string like "mgm -O 8 -s vfit", separate the name,
   // which is the first word, from the options, which is the rest.
   void parse_stereo_alg_name_and_opts(std::string const& stereo_alg,
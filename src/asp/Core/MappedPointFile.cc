@@ -0,0 +1,327 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file MappedPointFile.cc
+///
+
+#include <asp/Core/MappedPointFile.h>
+#include <vw/Core/Exception.h>
+#include <vw/FileIO/FileUtils.h>
+
+#include <boost/algorithm/string.hpp>
+
+#include <fstream>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace vw;
+
+namespace asp {
+
+bool is_ply(std::string const& file) {
+  return boost::iends_with(file, ".ply");
+}
+
+namespace {
+
+  // The layout of the points in a file, found from its header
+  struct PointLayout {
+    bool         mappable;    // binary, with x, y, z of the same float type
+    std::int64_t num_points;
+    size_t       header_size, stride, offsets[3];
+    bool         is_double;
+    PointLayout(): mappable(false), num_points(0), header_size(0), stride(0),
+                   is_double(false) {
+      offsets[0] = offsets[1] = offsets[2] = 0;
+    }
+  };
+
+  // The size of a PLY scalar type, or 0 if not known
+  size_t ply_type_size(std::string const& type) {
+    if (type == "char" || type == "uchar" || type == "int8" || type == "uint8")
+      return 1;
+    if (type == "short" || type == "ushort" || type == "int16" || type == "uint16")
+      return 2;
+    if (type == "int" || type == "uint" || type == "int32" || type == "uint32" ||
+        type == "float" || type == "float32")
+      return 4;
+    if (type == "double" || type == "float64")
+      return 8;
+    return 0;
+  }
+
+  // Record a field, and check that x, y, z have the same floating point type
+  void add_field(std::string const& file, std::string name, size_t size, bool is_float,
+                 size_t num, PointLayout & layout, int & num_xyz, int & xyz_size) {
+    boost::to_lower(name);
+    int k = (name == "x") ? 0 : (name == "y") ? 1 : (name == "z") ? 2 : -1;
+    if (k >= 0) {
+      if (!is_float || (size != 4 && size != 8) || num != 1)
+        vw_throw(ArgumentErr() << "The x, y, z fields must be floats or doubles in: "
+                 << file << ".\n");
+      if (xyz_size != 0 && int(size) != xyz_size)
+        vw_throw(ArgumentErr() << "The x, y, z fields must have the same type in: "
+                 << file << ".\n");
+      xyz_size = size;
+      layout.offsets[k] = layout.stride;
+      num_xyz++;
+    }
+    layout.stride += size * num;
+  }
+
+  // Parse the header of a PCD file
+  void parse_pcd_header(std::string const& file, std::istream & is, PointLayout & layout) {
+    std::vector<std::string> fields, sizes, types, counts;
+    std::int64_t width = 0, height = 0;
+    bool has_points = false;
+    std::string line, data_type;
+    while (std::getline(is, line)) {
+      std::istringstream ls(line);
+      std::string key;
+      if (!(ls >> key) || key[0] == '#')
+        continue;
+      boost::to_upper(key);
+      std::string val;
+      std::vector<std::string> vals;
+      while (ls >> val)
+        vals.push_back(val);
+      if      (key == "FIELDS") fields = vals;
+      else if (key == "SIZE")   sizes  = vals;
+      else if (key == "TYPE")   types  = vals;
+      else if (key == "COUNT")  counts = vals;
+      else if (key == "WIDTH"  && !vals.empty()) width  = atoll(vals[0].c_str());
+      else if (key == "HEIGHT" && !vals.empty()) height = atoll(vals[0].c_str());
+      else if (key == "POINTS" && !vals.empty()) {
+        layout.num_points = atoll(vals[0].c_str());
+        has_points = true;
+      } else if (key == "DATA" && !vals.empty()) {
+        data_type = boost::to_lower_copy(vals[0]);
+        break;
+      }
+    }
+    if (!has_points)
+      layout.num_points = width * height;
+    layout.header_size = is.tellg();
+
+    if (data_type != "binary")
+      return; // text or compressed data is not mapped
+
+    if (sizes.size() != fields.size() || types.size() != fields.size())
+      vw_throw(ArgumentErr() << "Inconsistent field descriptions in: " << file << ".\n");
+
+    int num_xyz = 0, xyz_size = 0;
+    for (size_t i = 0; i < fields.size(); i++) {
+      size_t num = (counts.size() == fields.size()) ? atoi(counts[i].c_str()) : 1;
+      add_field(file, fields[i], atoi(sizes[i].c_str()), boost::iequals(types[i], "F"),
+                num, layout, num_xyz, xyz_size);
+    }
+    if (num_xyz != 3)
+      vw_throw(ArgumentErr() << "Expecting x, y, z fields in: " << file << ".\n");
+    layout.is_double = (xyz_size == 8);
+    layout.mappable = true;
+  }
+
+  // Parse the header of a PLY file. The vertices must be the first element.
+  void parse_ply_header(std::string const& file, std::istream & is, PointLayout & layout) {
+    std::string line;
+    std::getline(is, line);
+    if (boost::trim_copy(line) != "ply")
+      vw_throw(ArgumentErr() << "Not a PLY file: " << file << ".\n");
+
+    bool binary = false, in_vertex = false, seen_element = false;
+    int num_xyz = 0, xyz_size = 0;
+    while (std::getline(is, line)) {
+      std::istringstream ls(line);
+      std::string key;
+      if (!(ls >> key))
+        continue;
+      if (key == "end_header")
+        break;
+      if (key == "format") {
+        std::string format;
+        ls >> format;
+        if (format == "binary_big_endian")
+          vw_throw(NoImplErr() << "Big-endian PLY files are not supported: " << file << ".\n");
+        binary = (format == "binary_little_endian");
+      } else if (key == "element") {
+        std::string name;
+        std::int64_t num = 0;
+        ls >> name >> num;
+        in_vertex = (!seen_element && name == "vertex");
+        if (in_vertex)
+          layout.num_points = num;
+        seen_element = true;
+      } else if (key == "property" && in_vertex) {
+        std::string type, name;
+        ls >> type >> name;
+        if (type == "list")
+          vw_throw(ArgumentErr() << "List properties of vertices are not supported in: "
+                   << file << ".\n");
+        size_t size = ply_type_size(type);
+        if (size == 0)
+          vw_throw(ArgumentErr() << "Unknown PLY type " << type << " in: " << file << ".\n");
+        add_field(file, name, size, type == "float" || type == "float32" ||
+                  type == "double" || type == "float64", 1, layout, num_xyz, xyz_size);
+      }
+    }
+    layout.header_size = is.tellg();
+
+    if (!binary)
+      return;
+    if (num_xyz != 3)
+      vw_throw(ArgumentErr() << "Expecting vertices with x, y, z as the first element in: "
+               << file << ".\n");
+    layout.is_double = (xyz_size == 8);
+    layout.mappable = true;
+  }
+
+  void read_layout(std::string const& file, PointLayout & layout) {
+    std::ifstream is(file.c_str(), std::ios::binary);
+    if (!is)
+      vw_throw(IOErr() << "Cannot open: " << file << ".\n");
+    if (is_ply(file))
+      parse_ply_header(file, is, layout);
+    else
+      parse_pcd_header(file, is, layout);
+    if (!is)
+      vw_throw(IOErr() << "Cannot read the header of: " << file << ".\n");
+  }
+
+} // end anonymous namespace
+
+bool MappedPointFile::is_mappable(std::string const& file) {
+  if (!is_ply(file) && !boost::iends_with(file, ".pcd"))
+    return false;
+  PointLayout layout;
+  read_layout(file, layout);
+  return layout.mappable;
+}
+
+MappedPointFile::MappedPointFile(std::string const& file):
+  m_file(file), m_fd(-1), m_data(NULL), m_size(0), m_points(NULL),
+  m_num_points(0), m_stride(0), m_is_double(false) {
+
+  PointLayout layout;
+  read_layout(file, layout);
+  if (!layout.mappable)
+    vw_throw(ArgumentErr() << "Only binary PCD and PLY files can be mapped: " << file << ".\n");
+  m_num_points = layout.num_points;
+  m_stride     = layout.stride;
+  m_is_double  = layout.is_double;
+  for (int k = 0; k < 3; k++)
+    m_offsets[k] = layout.offsets[k];
+
+  m_fd = ::open(file.c_str(), O_RDONLY);
+  if (m_fd < 0)
+    vw_throw(IOErr() << "Cannot open: " << file << ".\n");
+  struct stat st;
+  if (::fstat(m_fd, &st) != 0)
+    vw_throw(IOErr() << "Cannot get the size of: " << file << ".\n");
+  m_size = st.st_size;
+  if (layout.header_size + m_num_points * m_stride > m_size)
+    vw_throw(IOErr() << "The file is shorter than its header says: " << file << ".\n");
+
+  void * ptr = ::mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+  if (ptr == MAP_FAILED)
+    vw_throw(IOErr() << "Cannot map into memory: " << file << ".\n");
+  m_data = static_cast<const char*>(ptr);
+  m_points = m_data + layout.header_size;
+
+  // The points are read in order
+  ::madvise(ptr, m_size, MADV_SEQUENTIAL);
+}
+
+MappedPointFile::~MappedPointFile() {
+  if (m_data != NULL)
+    ::munmap(const_cast<char*>(m_data), m_size);
+  if (m_fd >= 0)
+    ::close(m_fd);
+}
+
+bool MappedPointFile::is_packed() const {
+  size_t size = m_is_double ? sizeof(double) : sizeof(float);
+  return m_stride == 3 * size && m_offsets[0] == 0 && m_offsets[1] == size &&
+    m_offsets[2] == 2 * size;
+}
+
+void write_binary_point_file(std::string const& file,
+                             std::vector<std::string> const& fields,
+                             std::vector<double> const& values, bool as_double) {
+  size_t num_fields = fields.size();
+  if (num_fields < 3 || values.size() % num_fields != 0)
+    vw_throw(ArgumentErr() << "Expecting x, y, z and a whole number of points when writing: "
+             << file << ".\n");
+  std::int64_t num_points = values.size() / num_fields;
+  size_t size = as_double ? sizeof(double) : sizeof(float);
+
+  std::ostringstream header;
+  if (is_ply(file)) {
+    header << "ply\nformat binary_little_endian 1.0\n"
+           << "element vertex " << num_points << "\n";
+    for (size_t i = 0; i < num_fields; i++)
+      header << "property " << (as_double ? "double " : "float ") << fields[i] << "\n";
+    header << "end_header\n";
+  } else {
+    header << "VERSION 0.7\nFIELDS";
+    for (size_t i = 0; i < num_fields; i++)
+      header << " " << fields[i];
+    header << "\nSIZE";
+    for (size_t i = 0; i < num_fields; i++)
+      header << " " << size;
+    header << "\nTYPE";
+    for (size_t i = 0; i < num_fields; i++)
+      header << " F";
+    header << "\nCOUNT";
+    for (size_t i = 0; i < num_fields; i++)
+      header << " 1";
+    header << "\nWIDTH " << num_points << "\nHEIGHT 1\nVIEWPOINT 0 0 0 1 0 0 0\n"
+           << "POINTS " << num_points << "\nDATA binary\n";
+  }
+
+  vw::create_out_dir(file);
+  std::ofstream os(file.c_str(), std::ios::binary);
+  if (!os)
+    vw_throw(IOErr() << "Cannot write: " << file << ".\n");
+  std::string header_str = header.str();
+  os.write(header_str.data(), header_str.size());
+
+  // Write in batches to not call write() for each value
+  const size_t batch = 1 << 16;
+  std::vector<char> buf;
+  for (size_t start = 0; start < values.size(); start += batch) {
+    size_t end = std::min(values.size(), start + batch);
+    buf.resize((end - start) * size);
+    for (size_t i = start; i < end; i++) {
+      if (as_double) {
+        double v = values[i];
+        std::memcpy(&buf[(i - start) * size], &v, size);
+      } else {
+        float v = values[i];
+        std::memcpy(&buf[(i - start) * size], &v, size);
+      }
+    }
+    os.write(&buf[0], buf.size());
+  }
+  if (!os)
+    vw_throw(IOErr() << "Failed to write: " << file << ".\n");
+}
+
+} // end namespace asp
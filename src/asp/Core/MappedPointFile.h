@@ -0,0 +1,98 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file MappedPointFile.h
+///
+/// Binary PCD and PLY point clouds, read by mapping the file into
+/// memory. The points are used in place, with no parsing and no copy.
+/// Writers for such files are also provided. Text PCD files are read
+/// with PcdReader instead.
+
+#ifndef __ASP_CORE_MAPPED_POINT_FILE_H__
+#define __ASP_CORE_MAPPED_POINT_FILE_H__
+
+#include <vw/Math/Vector.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  /// Return true if the file has the .ply extension
+  bool is_ply(std::string const& file);
+
+  class MappedPointFile: private boost::noncopyable {
+  public:
+    /// Map a binary PCD or PLY file. The x, y, z fields must all be
+    /// floats or all be doubles.
+    explicit MappedPointFile(std::string const& file);
+    ~MappedPointFile();
+
+    /// Return true if this is a binary PCD or PLY file of a kind
+    /// that can be mapped. Only the header is read.
+    static bool is_mappable(std::string const& file);
+
+    std::int64_t num_points() const { return m_num_points; }
+    bool is_double() const { return m_is_double; }
+
+    /// The records of the points, each of stride() bytes. If
+    /// is_packed(), the records have just x, y, z, so the data is one
+    /// array of 3 * num_points() floats or doubles.
+    char const* data() const { return m_points; }
+    size_t stride() const { return m_stride; }
+    bool is_packed() const;
+
+    vw::Vector3 point(std::int64_t i) const {
+      char const* rec = m_points + i * m_stride;
+      vw::Vector3 p;
+      if (m_is_double) {
+        double v;
+        for (int k = 0; k < 3; k++) { std::memcpy(&v, rec + m_offsets[k], sizeof(v)); p[k] = v; }
+      } else {
+        float v;
+        for (int k = 0; k < 3; k++) { std::memcpy(&v, rec + m_offsets[k], sizeof(v)); p[k] = v; }
+      }
+      return p;
+    }
+
+  private:
+    std::string  m_file;
+    int          m_fd;
+    char const*  m_data;     // the whole file
+    size_t       m_size;
+    char const*  m_points;   // past the header
+    std::int64_t m_num_points;
+    size_t       m_stride, m_offsets[3];
+    bool         m_is_double;
+  };
+
+  /// Write points to a binary PCD or PLY file, as given by the
+  /// extension. There are fields.size() values for each point, in
+  /// order, the first three being x, y, z. The values are stored as
+  /// floats, unless as_double is true.
+  void write_binary_point_file(std::string const& file,
+                               std::vector<std::string> const& fields,
+                               std::vector<double> const& values, bool as_double);
+
+} // end namespace asp
+
+#endif // __ASP_CORE_MAPPED_POINT_FILE_H__
@@ -0,0 +1,102 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file MappedTextFile.cc
+///
+
+#include <asp/Core/MappedTextFile.h>
+#include <vw/Core/Exception.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace vw;
+
+namespace asp {
+
+MappedTextFile::MappedTextFile(std::string const& file):
+  m_file(file), m_fd(-1), m_data(NULL), m_size(0) {
+
+  m_fd = ::open(file.c_str(), O_RDONLY);
+  if (m_fd < 0)
+    vw_throw(IOErr() << "Unable to open file: " << file << "\n");
+  struct stat st;
+  if (::fstat(m_fd, &st) != 0)
+    vw_throw(IOErr() << "Cannot get the size of: " << file << "\n");
+  m_size = st.st_size;
+  if (m_size == 0)
+    return; // cannot map an empty file
+
+  void * ptr = ::mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+  if (ptr == MAP_FAILED)
+    vw_throw(IOErr() << "Cannot map into memory: " << file << "\n");
+  m_data = static_cast<const char*>(ptr);
+
+  // Each chunk is read in order
+  ::madvise(ptr, m_size, MADV_SEQUENTIAL);
+}
+
+MappedTextFile::~MappedTextFile() {
+  if (m_data != NULL)
+    ::munmap(const_cast<char*>(m_data), m_size);
+  if (m_fd >= 0)
+    ::close(m_fd);
+}
+
+size_t MappedTextFile::read_line(size_t pos, std::string & line) const {
+  if (pos >= m_size) {
+    line.clear();
+    return m_size;
+  }
+  char const* begin = m_data + pos;
+  char const* end = static_cast<char const*>(std::memchr(begin, '\n', m_size - pos));
+  if (end == NULL) {
+    line.assign(begin, m_data + m_size);
+    return m_size;
+  }
+  line.assign(begin, end);
+  return (end - m_data) + 1;
+}
+
+void MappedTextFile::split_lines(size_t start, size_t chunk_size,
+                                 std::vector<size_t> & bounds) const {
+  bounds.clear();
+  start = std::min(start, m_size);
+  chunk_size = std::max(chunk_size, size_t(1));
+  bounds.push_back(start);
+  size_t pos = start;
+  while (pos < m_size) {
+    size_t next = pos + chunk_size;
+    if (next >= m_size) {
+      next = m_size;
+    } else {
+      // End the chunk right past the next newline
+      char const* nl = static_cast<char const*>(std::memchr(m_data + next, '\n',
+                                                            m_size - next));
+      next = (nl == NULL) ? m_size : (nl - m_data) + 1;
+    }
+    bounds.push_back(next);
+    pos = next;
+  }
+}
+
+} // end namespace asp
@@ -0,0 +1,127 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file MappedTextFile.h
+///
+/// A text file mapped into memory and split into chunks of whole lines,
+/// so that large CSV files can be parsed by several threads at once.
+/// A chunk starts right after a newline, so no line is split between
+/// two chunks, and the position of a line in the file identifies it.
+
+#ifndef __ASP_CORE_MAPPED_TEXT_FILE_H__
+#define __ASP_CORE_MAPPED_TEXT_FILE_H__
+
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <cstdint>
+#include <exception>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  class MappedTextFile: private boost::noncopyable {
+  public:
+    explicit MappedTextFile(std::string const& file);
+    ~MappedTextFile();
+
+    char const* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+    /// Set line to the line starting at pos, without its newline, as
+    /// with getline(). Return the position of the next line.
+    size_t read_line(size_t pos, std::string & line) const;
+
+    /// Split the bytes from start to the end of the file into chunks of
+    /// about chunk_size bytes, each ending right past a newline or at
+    /// the end of the file. Chunk i is from bounds[i] to bounds[i + 1].
+    void split_lines(size_t start, size_t chunk_size,
+                     std::vector<size_t> & bounds) const;
+
+  private:
+    std::string m_file;
+    int         m_fd;
+    char const* m_data;
+    size_t      m_size;
+  };
+
+  /// The size of the chunks of a text file parsed by each task
+  const size_t TEXT_CHUNK_SIZE = 16 * 1024 * 1024;
+
+  namespace detail {
+    // Call func(chunk, begin, end) for one chunk. An exception is kept
+    // so it can be thrown once all tasks are done.
+    template <class FuncT>
+    class TextChunkTask: public vw::Task, private boost::noncopyable {
+      FuncT & m_func;
+      int m_chunk;
+      size_t m_begin, m_end;
+      std::exception_ptr & m_error;
+    public:
+      TextChunkTask(FuncT & func, int chunk, size_t begin, size_t end,
+                    std::exception_ptr & error):
+        m_func(func), m_chunk(chunk), m_begin(begin), m_end(end), m_error(error) {}
+      void operator()() {
+        try {
+          m_func(m_chunk, m_begin, m_end);
+        } catch (...) {
+          m_error = std::current_exception();
+        }
+      }
+    };
+  }
+
+  /// Split the file from start to its end into chunks of whole lines,
+  /// and call func(chunk, begin, end) on each with the given number of
+  /// threads (0 means the default). The calls are concurrent. Return the
+  /// number of chunks. If any call throws, the exception from the
+  /// earliest chunk in the file is thrown after all the calls are done.
+  template <class FuncT>
+  int for_each_text_chunk(MappedTextFile const& file, size_t start, FuncT & func,
+                          int num_threads = 0, size_t chunk_size = TEXT_CHUNK_SIZE) {
+    std::vector<size_t> bounds;
+    file.split_lines(start, chunk_size, bounds);
+    int num_chunks = int(bounds.size()) - 1;
+    if (num_threads <= 0)
+      num_threads = vw::vw_settings().default_num_threads();
+
+    std::vector<std::exception_ptr> errors(num_chunks);
+    {
+      vw::FifoWorkQueue queue(num_threads);
+      for (int i = 0; i < num_chunks; i++) {
+        boost::shared_ptr<vw::Task> task
+          (new detail::TextChunkTask<FuncT>(func, i, bounds[i], bounds[i + 1], errors[i]));
+        queue.add_task(task);
+      }
+      queue.join_all();
+    }
+
+    for (int i = 0; i < num_chunks; i++) {
+      if (errors[i])
+        std::rethrow_exception(errors[i]);
+    }
+    return num_chunks;
+  }
+
+} // end namespace asp
+
+#endif // __ASP_CORE_MAPPED_TEXT_FILE_H__
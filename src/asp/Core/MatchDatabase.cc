@@ -0,0 +1,256 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file MatchDatabase.cc
+///
+
+#include <asp/Core/MatchDatabase.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace vw;
+
+namespace {
+
+  // Each record starts with this, followed by the size of the rest of it
+  const char MATCH_RECORD_MAGIC[] = "AMR1";
+  const int  MAGIC_LEN = 4;
+
+  template <class T>
+  void append_value(std::string & buf, T const& val) {
+    buf.append(reinterpret_cast<const char*>(&val), sizeof(T));
+  }
+
+  // Read a value at the given position and move past it. Throw if it
+  // would go past the end.
+  template <class T>
+  void read_value(const char * data, size_t size, size_t & pos, T & val) {
+    if (pos + sizeof(T) > size)
+      vw_throw(IOErr() << "Unexpected end of match database record.\n");
+    std::memcpy(&val, data + pos, sizeof(T));
+    pos += sizeof(T);
+  }
+
+  void append_ip(std::string & buf, ip::InterestPoint const& p) {
+    append_value(buf, float(p.x));
+    append_value(buf, float(p.y));
+    append_value(buf, std::int32_t(p.ix));
+    append_value(buf, std::int32_t(p.iy));
+    append_value(buf, float(p.orientation));
+    append_value(buf, float(p.scale));
+    append_value(buf, float(p.interest));
+    append_value(buf, std::uint8_t(p.polarity));
+    append_value(buf, std::uint32_t(p.octave));
+    append_value(buf, std::uint32_t(p.scale_lvl));
+    append_value(buf, std::uint32_t(p.descriptor.size()));
+    for (size_t k = 0; k < p.descriptor.size(); k++)
+      append_value(buf, float(p.descriptor[k]));
+  }
+
+  void read_ip(const char * data, size_t size, size_t & pos, ip::InterestPoint & p) {
+    float x, y, orientation, scale, interest;
+    std::int32_t ix, iy;
+    std::uint8_t polarity;
+    std::uint32_t octave, scale_lvl, desc_size;
+    read_value(data, size, pos, x);
+    read_value(data, size, pos, y);
+    read_value(data, size, pos, ix);
+    read_value(data, size, pos, iy);
+    read_value(data, size, pos, orientation);
+    read_value(data, size, pos, scale);
+    read_value(data, size, pos, interest);
+    read_value(data, size, pos, polarity);
+    read_value(data, size, pos, octave);
+    read_value(data, size, pos, scale_lvl);
+    read_value(data, size, pos, desc_size);
+    p = ip::InterestPoint(x, y, scale);
+    p.interest    = interest;
+    p.orientation = orientation;
+    p.polarity    = (polarity != 0);
+    p.octave      = octave;
+    p.scale_lvl   = scale_lvl;
+    p.ix = ix;
+    p.iy = iy;
+    p.descriptor.set_size(desc_size);
+    for (size_t k = 0; k < desc_size; k++)
+      read_value(data, size, pos, p.descriptor[k]);
+  }
+
+  void read_name(const char * data, size_t size, size_t & pos, std::string & name) {
+    std::uint32_t len = 0;
+    read_value(data, size, pos, len);
+    if (pos + len > size)
+      vw_throw(IOErr() << "Unexpected end of match database record.\n");
+    name = std::string(data + pos, len);
+    pos += len;
+  }
+
+} // end anonymous namespace
+
+namespace asp {
+
+MatchDatabase::MatchDatabase(std::string const& file):
+  m_file(file), m_fd(-1), m_data(NULL), m_size(0) {
+
+  m_fd = ::open(file.c_str(), O_RDONLY);
+  if (m_fd < 0)
+    return; // no matches yet
+
+  struct stat st;
+  if (::fstat(m_fd, &st) != 0)
+    vw_throw(IOErr() << "Cannot get the size of: " << file << ".\n");
+  m_size = st.st_size;
+  if (m_size == 0)
+    return;
+
+  void * ptr = ::mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+  if (ptr == MAP_FAILED)
+    vw_throw(IOErr() << "Cannot map into memory: " << file << ".\n");
+  m_data = static_cast<const char*>(ptr);
+
+  // Index the records. Only their headers and names are read.
+  size_t pos = 0;
+  while (pos < m_size) {
+    if (pos + MAGIC_LEN + sizeof(std::int64_t) > m_size ||
+        std::memcmp(m_data + pos, MATCH_RECORD_MAGIC, MAGIC_LEN) != 0) {
+      vw_out(WarningMessage) << "Ignoring invalid data at the end of: " << file << ".\n";
+      break;
+    }
+    size_t rec_pos = pos + MAGIC_LEN;
+    std::int64_t rec_size = 0;
+    read_value(m_data, m_size, rec_pos, rec_size);
+    if (rec_size < 0 || rec_pos + rec_size > m_size) {
+      // This can only be a record still being written, or one cut short
+      vw_out(WarningMessage) << "Ignoring an incomplete record at the end of: "
+                             << file << ".\n";
+      break;
+    }
+
+    size_t rec_end = rec_pos + rec_size;
+    std::string image1, image2;
+    Entry entry;
+    read_name(m_data, rec_end, rec_pos, image1);
+    read_name(m_data, rec_end, rec_pos, image2);
+    read_value(m_data, rec_end, rec_pos, entry.num_matches);
+    entry.offset = rec_pos;
+    m_index[std::make_pair(image1, image2)] = entry; // the last one wins
+
+    pos = rec_end;
+  }
+}
+
+MatchDatabase::~MatchDatabase() {
+  if (m_data != NULL)
+    ::munmap(const_cast<char*>(m_data), m_size);
+  if (m_fd >= 0)
+    ::close(m_fd);
+}
+
+bool MatchDatabase::has_pair(std::string const& image1, std::string const& image2) const {
+  return m_index.find(std::make_pair(image1, image2)) != m_index.end();
+}
+
+size_t MatchDatabase::num_matches(std::string const& image1, std::string const& image2) const {
+  auto it = m_index.find(std::make_pair(image1, image2));
+  if (it == m_index.end())
+    return 0;
+  return it->second.num_matches;
+}
+
+void MatchDatabase::pairs(std::vector<std::pair<std::string, std::string>> & pairs) const {
+  pairs.clear();
+  for (auto it = m_index.begin(); it != m_index.end(); it++)
+    pairs.push_back(it->first);
+}
+
+void MatchDatabase::read_pair(std::string const& image1, std::string const& image2,
+                              std::vector<ip::InterestPoint> & ip1,
+                              std::vector<ip::InterestPoint> & ip2) const {
+  auto it = m_index.find(std::make_pair(image1, image2));
+  if (it == m_index.end())
+    vw_throw(ArgumentErr() << "No matches for images " << image1 << " and " << image2
+             << " in: " << m_file << ".\n");
+
+  size_t num = it->second.num_matches;
+  size_t pos = it->second.offset;
+  ip1.resize(num);
+  ip2.resize(num);
+  for (size_t k = 0; k < num; k++)
+    read_ip(m_data, m_size, pos, ip1[k]);
+  for (size_t k = 0; k < num; k++)
+    read_ip(m_data, m_size, pos, ip2[k]);
+}
+
+void MatchDatabase::append_pair(std::string const& file,
+                                std::string const& image1, std::string const& image2,
+                                std::vector<ip::InterestPoint> const& ip1,
+                                std::vector<ip::InterestPoint> const& ip2) {
+  if (ip1.size() != ip2.size())
+    vw_throw(ArgumentErr() << "Expecting as many left as right interest points.\n");
+
+  // Make the whole record in memory, so that it can be written at once
+  std::string body;
+  append_value(body, std::uint32_t(image1.size()));
+  body += image1;
+  append_value(body, std::uint32_t(image2.size()));
+  body += image2;
+  append_value(body, std::int64_t(ip1.size()));
+  for (size_t k = 0; k < ip1.size(); k++)
+    append_ip(body, ip1[k]);
+  for (size_t k = 0; k < ip2.size(); k++)
+    append_ip(body, ip2[k]);
+
+  std::string record(MATCH_RECORD_MAGIC, MAGIC_LEN);
+  append_value(record, std::int64_t(body.size()));
+  record += body;
+
+  int fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd < 0)
+    vw_throw(IOErr() << "Cannot open for writing: " << file << ".\n");
+
+  // The lock keeps records of other processes from interleaving with
+  // this one if it takes more than one write.
+  if (::flock(fd, LOCK_EX) != 0) {
+    ::close(fd);
+    vw_throw(IOErr() << "Cannot lock: " << file << ".\n");
+  }
+  size_t done = 0;
+  while (done < record.size()) {
+    ssize_t count = ::write(fd, record.data() + done, record.size() - done);
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count <= 0) {
+      ::flock(fd, LOCK_UN);
+      ::close(fd);
+      vw_throw(IOErr() << "Failed writing to: " << file << ".\n");
+    }
+    done += count;
+  }
+  ::flock(fd, LOCK_UN);
+  ::close(fd);
+}
+
+} // end namespace asp
@@ -0,0 +1,86 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file MatchDatabase.h
+///
+/// A single file holding the interest point matches of many image pairs,
+/// to be used instead of one .match file per pair. The file is a sequence
+/// of records, each with the two image names and the matches. Records are
+/// only ever appended, each with one locked write, so many threads and
+/// processes can add to the same file at the same time. A reader maps the
+/// file into memory and indexes the records by image pair, reading only
+/// their headers. If a pair occurs more than once, the last record wins.
+
+#ifndef __ASP_CORE_MATCH_DATABASE_H__
+#define __ASP_CORE_MATCH_DATABASE_H__
+
+#include <vw/InterestPoint/InterestData.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace asp {
+
+  /// The extension of match database files
+  const std::string MATCH_DATABASE_EXT = ".matchdb";
+
+  class MatchDatabase: private boost::noncopyable {
+  public:
+
+    /// Map the file and index its records. A missing file is an empty database.
+    explicit MatchDatabase(std::string const& file);
+    ~MatchDatabase();
+
+    size_t num_pairs() const { return m_index.size(); }
+    bool has_pair(std::string const& image1, std::string const& image2) const;
+    size_t num_matches(std::string const& image1, std::string const& image2) const;
+
+    /// The image pairs, sorted by name
+    void pairs(std::vector<std::pair<std::string, std::string>> & pairs) const;
+
+    /// Read the matches of a pair. Throws if the pair is not present.
+    void read_pair(std::string const& image1, std::string const& image2,
+                   std::vector<vw::ip::InterestPoint> & ip1,
+                   std::vector<vw::ip::InterestPoint> & ip2) const;
+
+    /// Append the matches of a pair to the file, creating it if needed
+    static void append_pair(std::string const& file,
+                            std::string const& image1, std::string const& image2,
+                            std::vector<vw::ip::InterestPoint> const& ip1,
+                            std::vector<vw::ip::InterestPoint> const& ip2);
+
+  private:
+    struct Entry {
+      std::int64_t offset; // of the matches
+      std::int64_t num_matches;
+    };
+
+    std::string  m_file;
+    int          m_fd;
+    const char * m_data;
+    size_t       m_size;
+    std::map<std::pair<std::string, std::string>, Entry> m_index;
+  };
+
+} // end namespace asp
+
+#endif//__ASP_CORE_MATCH_DATABASE_H__
@@ -0,0 +1,129 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file MatchSet.cc
+///
+
+#include <asp/Core/MatchSet.h>
+#include <asp/Core/MatchDatabase.h>
+#include <asp/Core/IpMatchingAlgs.h>
+#include <vw/InterestPoint/Matcher.h>
+#include <vw/Math/Statistics.h>
+#include <vw/Core/Exception.h>
+
+using namespace vw;
+
+namespace asp {
+
+void MatchSet::read(std::string const& match_file) {
+  std::vector<ip::InterestPoint> ip1, ip2;
+  ip::read_binary_match_file(match_file, ip1, ip2);
+  set_matches(ip1, ip2);
+}
+
+void MatchSet::read(MatchDatabase const& db, std::string const& image1,
+                    std::string const& image2) {
+  std::vector<ip::InterestPoint> ip1, ip2;
+  db.read_pair(image1, image2, ip1, ip2);
+  set_matches(ip1, ip2);
+}
+
+void MatchSet::set_matches(std::vector<ip::InterestPoint> & ip1,
+                           std::vector<ip::InterestPoint> & ip2) {
+  if (ip1.size() != ip2.size())
+    vw_throw(ArgumentErr() << "MatchSet: The number of left and right interest points "
+             << "differ: " << ip1.size() << " vs " << ip2.size() << ".\n");
+  m_ip1.clear();
+  m_ip2.clear();
+  m_ip1.swap(ip1);
+  m_ip2.swap(ip2);
+  m_keep.assign(m_ip1.size(), 1);
+  m_num_kept = m_ip1.size();
+}
+
+MatchSet & MatchSet::filter_by_disparity(double pct, double factor) {
+
+  std::vector<double> dispx, dispy;
+  dispx.reserve(m_num_kept);
+  dispy.reserve(m_num_kept);
+  for (size_t it = 0; it < m_ip1.size(); it++) {
+    if (!m_keep[it])
+      continue;
+    dispx.push_back(m_ip2[it].x - m_ip1[it].x);
+    dispy.push_back(m_ip2[it].y - m_ip1[it].y);
+  }
+  if (dispx.empty())
+    return *this;
+
+  double pct_fraction = 1.0 - pct/100.0;
+  double bx, ex, by, ey;
+  vw::math::find_outlier_brackets(dispx, pct_fraction, factor, bx, ex);
+  vw::math::find_outlier_brackets(dispy, pct_fraction, factor, by, ey);
+
+  for (size_t it = 0; it < m_ip1.size(); it++) {
+    if (!m_keep[it])
+      continue;
+    double dx = m_ip2[it].x - m_ip1[it].x, dy = m_ip2[it].y - m_ip1[it].y;
+    if (dx < bx || dx > ex || dy < by || dy > ey) {
+      m_keep[it] = 0;
+      m_num_kept--;
+    }
+  }
+  return *this;
+}
+
+double MatchSet::coverage_fraction(vw::Vector2i const& image_size, int tile_size,
+                                   int min_ip_per_tile) const {
+  return calc_ip_coverage_fraction(m_ip2, m_keep, image_size, tile_size, min_ip_per_tile);
+}
+
+void MatchSet::get_matches(std::vector<ip::InterestPoint> & ip1,
+                           std::vector<ip::InterestPoint> & ip2) const {
+  ip1.clear();
+  ip2.clear();
+  ip1.reserve(m_num_kept);
+  ip2.reserve(m_num_kept);
+  for (size_t it = 0; it < m_ip1.size(); it++) {
+    if (!m_keep[it])
+      continue;
+    ip1.push_back(m_ip1[it]);
+    ip2.push_back(m_ip2[it]);
+  }
+}
+
+void MatchSet::write(std::string const& match_file) const {
+  if (m_num_kept == m_ip1.size()) {
+    ip::write_binary_match_file(match_file, m_ip1, m_ip2);
+    return;
+  }
+  std::vector<ip::InterestPoint> ip1, ip2;
+  get_matches(ip1, ip2);
+  ip::write_binary_match_file(match_file, ip1, ip2);
+}
+
+void MatchSet::append_to_database(std::string const& db_file, std::string const& image1,
+                                  std::string const& image2) const {
+  if (m_num_kept == m_ip1.size()) {
+    MatchDatabase::append_pair(db_file, image1, image2, m_ip1, m_ip2);
+    return;
+  }
+  std::vector<ip::InterestPoint> ip1, ip2;
+  get_matches(ip1, ip2);
+  MatchDatabase::append_pair(db_file, image1, image2, ip1, ip2);
+}
+
+} // end namespace asp
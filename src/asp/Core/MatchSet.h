@@ -0,0 +1,98 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file MatchSet.h
+///
+/// The interest point matches of one image pair, kept in memory so that
+/// several filters and statistics can be applied without writing and
+/// reading a match file in between. A filter only marks the matches it
+/// rejects, looking at the ones still kept, so the matches are copied
+/// once, when they are written or taken out.
+
+#ifndef __ASP_CORE_MATCH_SET_H__
+#define __ASP_CORE_MATCH_SET_H__
+
+#include <vw/InterestPoint/InterestData.h>
+#include <vw/Math/Vector.h>
+
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  class MatchDatabase;
+
+  class MatchSet {
+  public:
+    MatchSet(): m_num_kept(0) {}
+
+    /// Read from a .match file, or from a match database
+    void read(std::string const& match_file);
+    void read(MatchDatabase const& db, std::string const& image1, std::string const& image2);
+
+    /// Use these matches. The inputs are swapped in, so they are left empty.
+    void set_matches(std::vector<vw::ip::InterestPoint> & ip1,
+                     std::vector<vw::ip::InterestPoint> & ip2);
+
+    /// The number of matches still kept
+    size_t size() const { return m_num_kept; }
+
+    /// Reject the matches with disparity in x or y outside the 100 - pct
+    /// to pct percentile interval expanded by factor, as done by
+    /// filter_ip_by_disparity().
+    MatchSet & filter_by_disparity(double pct, double factor);
+
+    /// Reject the matches for which error_func(ip1, ip2) is more than
+    /// max_error, such as the distance from the epipolar line.
+    template <class ErrorFuncT>
+    MatchSet & filter_by_error(ErrorFuncT const& error_func, double max_error);
+
+    /// The fraction of tiles of the second image with more than
+    /// min_ip_per_tile matches, as found by calc_ip_coverage_fraction().
+    double coverage_fraction(vw::Vector2i const& image_size, int tile_size = 1024,
+                             int min_ip_per_tile = 2) const;
+
+    /// Write the kept matches to a .match file, or append them to a match database
+    void write(std::string const& match_file) const;
+    void append_to_database(std::string const& db_file,
+                            std::string const& image1, std::string const& image2) const;
+
+    /// Copy out the kept matches
+    void get_matches(std::vector<vw::ip::InterestPoint> & ip1,
+                     std::vector<vw::ip::InterestPoint> & ip2) const;
+
+  private:
+    std::vector<vw::ip::InterestPoint> m_ip1, m_ip2;
+    std::vector<char> m_keep;
+    size_t m_num_kept;
+  };
+
+  template <class ErrorFuncT>
+  MatchSet & MatchSet::filter_by_error(ErrorFuncT const& error_func, double max_error) {
+    for (size_t it = 0; it < m_ip1.size(); it++) {
+      if (m_keep[it] && !(error_func(m_ip1[it], m_ip2[it]) <= max_error)) {
+        m_keep[it] = 0;
+        m_num_kept--;
+      }
+    }
+    return *this;
+  }
+
+} // end namespace asp
+
+#endif//__ASP_CORE_MATCH_SET_H__
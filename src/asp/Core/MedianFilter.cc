@@ -39,3 +39,127 @@ uint8 find_median_in_histogram(Vector<int, CALC_PIXEL_NUM_VALS> histogram,
 
   return i;
 }
+
+namespace {
+
+  // Each bin of the coarse histograms covers this many of the fine ones
+  const int MEDIAN_COARSE_SHIFT = 4;
+  const int MEDIAN_NUM_COARSE = CALC_PIXEL_NUM_VALS >> MEDIAN_COARSE_SHIFT;
+
+  // Median filter the rows of a uint8 image in which the kernel starts
+  // in the given range
+  class MedianBandTask: public vw::Task, private boost::noncopyable {
+    ImageView<uint8> const& m_src;
+    int m_kernSize, m_beg, m_end;
+    ImageView<uint8> & m_result;
+
+    // Add to a histogram the difference of two others. The counts
+    // cannot go negative, so the wraparound of unsigned numbers in
+    // between does not matter. These loops are vectorized.
+    static void update(uint16 * hist, uint16 const* add, uint16 const* sub, int len) {
+      for (int i = 0; i < len; i++)
+        hist[i] += add[i] - sub[i];
+    }
+    static void add(uint16 * hist, uint16 const* other, int len) {
+      for (int i = 0; i < len; i++)
+        hist[i] += other[i];
+    }
+
+  public:
+    MedianBandTask(ImageView<uint8> const& src, int kernSize, int beg, int end,
+                   ImageView<uint8> & result):
+      m_src(src), m_kernSize(kernSize), m_beg(beg), m_end(end), m_result(result) {}
+
+    void operator()() {
+      int k = m_kernSize, cols = m_src.cols(), num_x = cols - k + 1;
+      int rank = k * k / 2; // the index of the median among the sorted values
+
+      // The fine and coarse histograms of each column, over the rows of the kernel
+      std::vector<uint16> col_fine(cols * CALC_PIXEL_NUM_VALS, 0);
+      std::vector<uint16> col_coarse(cols * MEDIAN_NUM_COARSE, 0);
+      for (int row = m_beg; row < m_beg + k; row++) {
+        for (int col = 0; col < cols; col++) {
+          uint8 v = m_src(col, row);
+          col_fine[col * CALC_PIXEL_NUM_VALS + v]++;
+          col_coarse[col * MEDIAN_NUM_COARSE + (v >> MEDIAN_COARSE_SHIFT)]++;
+        }
+      }
+
+      std::vector<uint16> fine(CALC_PIXEL_NUM_VALS), coarse(MEDIAN_NUM_COARSE);
+      for (int y = m_beg; y < m_end; y++) {
+
+        // Move the column histograms down by one row
+        if (y > m_beg) {
+          for (int col = 0; col < cols; col++) {
+            uint8 out = m_src(col, y - 1), in = m_src(col, y + k - 1);
+            col_fine[col * CALC_PIXEL_NUM_VALS + out]--;
+            col_fine[col * CALC_PIXEL_NUM_VALS + in]++;
+            col_coarse[col * MEDIAN_NUM_COARSE + (out >> MEDIAN_COARSE_SHIFT)]--;
+            col_coarse[col * MEDIAN_NUM_COARSE + (in  >> MEDIAN_COARSE_SHIFT)]++;
+          }
+        }
+
+        // The histogram of the kernel at the start of the row
+        std::fill(fine.begin(), fine.end(), 0);
+        std::fill(coarse.begin(), coarse.end(), 0);
+        for (int col = 0; col < k; col++) {
+          add(&fine[0],   &col_fine[col * CALC_PIXEL_NUM_VALS], CALC_PIXEL_NUM_VALS);
+          add(&coarse[0], &col_coarse[col * MEDIAN_NUM_COARSE], MEDIAN_NUM_COARSE);
+        }
+
+        for (int x = 0; x < num_x; x++) {
+          if (x > 0) {
+            update(&fine[0], &col_fine[(x + k - 1) * CALC_PIXEL_NUM_VALS],
+                   &col_fine[(x - 1) * CALC_PIXEL_NUM_VALS], CALC_PIXEL_NUM_VALS);
+            update(&coarse[0], &col_coarse[(x + k - 1) * MEDIAN_NUM_COARSE],
+                   &col_coarse[(x - 1) * MEDIAN_NUM_COARSE], MEDIAN_NUM_COARSE);
+          }
+
+          // Find the coarse bin having the median, then the fine one
+          int acc = 0, bin = 0;
+          while (acc + coarse[bin] <= rank) {
+            acc += coarse[bin];
+            bin++;
+          }
+          int val = bin << MEDIAN_COARSE_SHIFT;
+          while (acc + fine[val] <= rank) {
+            acc += fine[val];
+            val++;
+          }
+          m_result(x + k / 2, y + k / 2) = val;
+        }
+      }
+    }
+  };
+
+} // end anonymous namespace
+
+namespace vw {
+
+void median_filter_uint8(ImageView<uint8> const& src, int kernSize, int num_threads,
+                         ImageView<uint8> & result) {
+
+  // The counts in the kernel histograms must fit in 16 bits
+  if (kernSize < 1 || kernSize > 255)
+    vw_throw(ArgumentErr() << "The median filter kernel size must be between 1 and 255.\n");
+
+  result.set_size(src.cols(), src.rows());
+  fill(result, 0);
+  int num_y = src.rows() - kernSize + 1;
+  if (src.cols() < kernSize || num_y <= 0)
+    return;
+
+  // Each band builds its column histograms from scratch, so do not
+  // make the bands much smaller than the kernel
+  num_threads = std::max(1, num_threads);
+  int band = std::max(std::max(1, num_y / (4 * num_threads)), 4 * kernSize);
+  FifoWorkQueue queue(num_threads);
+  for (int beg = 0; beg < num_y; beg += band) {
+    boost::shared_ptr<MedianBandTask>
+      task(new MedianBandTask(src, kernSize, beg, std::min(beg + band, num_y), result));
+    queue.add_task(task);
+  }
+  queue.join_all();
+}
+
+} // end namespace vw
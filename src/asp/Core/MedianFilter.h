@@ -24,82 +24,138 @@
 
 #define CALC_PIXEL_NUM_VALS 256
 
+#include <vw/Core/Exception.h>
 #include <vw/Core/Functors.h>
 #include <vw/Core/FundamentalTypes.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Math/Vector.h>
 #include <vw/Math/BBox.h>
 #include <vw/Image/ImageView.h>
 #include <vw/Image/EdgeExtension.h>
 #include <vw/Image/PerPixelAccessorViews.h>
+#include <vw/Image/PixelTypeInfo.h>
+#include <vw/Image/Algorithms.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/PixelMath.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <algorithm>
+#include <vector>
 
 namespace vw {
 
   uint8 find_median_in_histogram(Vector<int, CALC_PIXEL_NUM_VALS> histogram,
                                  int kernSize);
 
+  /// Median filter a uint8 image with a square kernel, in time not
+  /// depending on the kernel size, per Perreault and Hebert, "Median
+  /// Filtering in Constant Time", 2007. A histogram is kept for each
+  /// column, and going right the kernel histogram gains a column and
+  /// loses one. The image is split into bands of rows, done in
+  /// parallel. Only pixels where the kernel fits in the image are
+  /// filtered, and the others are set to 0. The median of n values is
+  /// the one of index n/2 after sorting. The kernel size must be
+  /// between 1 and 255.
+  void median_filter_uint8(ImageView<uint8> const& src, int kernSize, int num_threads,
+                           ImageView<uint8> & result);
+
+  /// Median filter an image after rescaling each channel to uint8.
+  /// See median_filter_uint8().
   template<class ImageT>
   ImageView<typename ImageT::pixel_type> fast_median_filter(ImageViewBase<ImageT> const& img,  int kernSize) {
     typedef typename ImageT::pixel_type PixelT;
-
-    ImageView<uint8> src = pixel_cast_rescale<uint8>(img.impl());
-    ImageView<uint8> result(src.cols(), src.rows());
-
-    Vector<int, CALC_PIXEL_NUM_VALS> histogram;
-
-    // Seed histogram
-    for (int x = 0; x < kernSize; x++) {
-      for (int y = 0; y < kernSize; y++) {
-        histogram(src(x, y))++;
-      }
+    typedef typename PixelChannelType<PixelT>::type ChannelT;
+
+    ImageView<PixelT> src = img.impl();
+    ImageView<PixelT> result(src.cols(), src.rows());
+    ImageView<uint8> src_ch, result_ch;
+    for (int ch = 0; ch < int(PixelNumChannels<PixelT>::value); ch++) {
+      src_ch = channel_cast_rescale<uint8>(select_channel(src, ch));
+      median_filter_uint8(src_ch, kernSize, vw_settings().default_num_threads(), result_ch);
+      select_channel(result, ch) = channel_cast_rescale<ChannelT>(result_ch);
     }
 
-    bool goingRight = true;
-    int x = 0, y = 0;
-    //while (y <=src.rows() - kernSize) { //this was a bug
-    while (y < src.rows() - kernSize) {
-
-      result(x + kernSize / 2, y + kernSize / 2) = find_median_in_histogram(histogram, kernSize);
+    return result;
+  }
 
-      if (goingRight) {
-        if (x < src.cols() - kernSize) {
-          for (int i = 0; i < kernSize; i++) {
-            histogram(src(x, y + i))--;
-            histogram(src(x + kernSize, y + i))++;
-          }
-          x++;
+  /// Median filter a band of rows of an image, without quantizing the
+  /// values as median_filter_uint8() does
+  template<class PixelT>
+  class ExactMedianTask: public Task, private boost::noncopyable {
+    ImageView<PixelT> const& m_src;
+    int m_kernSize, m_beg, m_end;
+    ImageView<PixelT> & m_result;
 
-        }
-        else {
-          // Reached the right edge
-          for (int i = 0; i < kernSize; i++) {
-            histogram(src(x + i, y))--;
-            histogram(src(x + i, y + kernSize))++;
-          }
-          goingRight = false;
-          y++;
-        }
-      }
-      else {
-        if (x > 0) {
-          for (int i = 0; i < kernSize; i++) {
-            histogram(src(x - 1, y + i))++;
-            histogram(src(x + kernSize - 1, y + i))--;
-          }
-          x--;
-        }
-        else {
-          // Reached the left edge
-          for (int i = 0; i < kernSize; i++) {
-            histogram(src(x + i, y))--;
-            histogram(src(x + i, y + kernSize))++;
+  public:
+    ExactMedianTask(ImageView<PixelT> const& src, int kernSize, int beg, int end,
+                    ImageView<PixelT> & result):
+      m_src(src), m_kernSize(kernSize), m_beg(beg), m_end(end), m_result(result) {}
+
+    void operator()() {
+      int k = m_kernSize, n = k * k, num_x = m_src.cols() - k + 1;
+      std::vector<PixelT> vals(n);
+      for (int y = m_beg; y < m_end; y++) {
+        for (int x = 0; x < num_x; x++) {
+          int pos = 0;
+          for (int j = 0; j < k; j++) {
+            PixelT const* row = &m_src(x, y + j);
+            for (int i = 0; i < k; i++)
+              vals[pos++] = row[i];
           }
-          goingRight = true;
-          y++;
+          std::nth_element(vals.begin(), vals.begin() + n / 2, vals.end());
+          m_result(x + k / 2, y + k / 2) = vals[n / 2];
         }
       }
     }
+  };
+  
+  /// Median filter one channel, without quantizing it. See
+  /// exact_median_filter().
+  template<class ChannelT>
+  void exact_median_filter_channel(ImageView<ChannelT> const& src, int kernSize,
+                                   ImageView<ChannelT> & result) {
+    result.set_size(src.cols(), src.rows());
+    fill(result, ChannelT());
+    int num_y = src.rows() - kernSize + 1;
+    if (src.cols() < kernSize || num_y <= 0)
+      return;
+
+    int num_threads = std::max(1, vw_settings().default_num_threads());
+    int band = std::max(1, num_y / (4 * num_threads));
+    FifoWorkQueue queue(num_threads);
+    for (int beg = 0; beg < num_y; beg += band) {
+      boost::shared_ptr<ExactMedianTask<ChannelT>>
+        task(new ExactMedianTask<ChannelT>(src, kernSize, beg, std::min(beg + band, num_y),
+                                           result));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+  
+  /// As fast_median_filter(), but without quantizing the values to 8
+  /// bits, so the output has the same precision as the input, such as
+  /// uint16 or float. This takes time proportional to the kernel area
+  /// per pixel, rather than constant.
+  template<class ImageT>
+  ImageView<typename ImageT::pixel_type> exact_median_filter(ImageViewBase<ImageT> const& img,  int kernSize) {
+    typedef typename ImageT::pixel_type PixelT;
+    typedef typename PixelChannelType<PixelT>::type ChannelT;
+
+    if (kernSize < 1)
+      vw_throw(ArgumentErr() << "The median filter kernel size must be positive.\n");
+    
+    ImageView<PixelT> src = img.impl();
+    ImageView<PixelT> result(src.cols(), src.rows());
+    ImageView<ChannelT> src_ch, result_ch;
+    for (int ch = 0; ch < int(PixelNumChannels<PixelT>::value); ch++) {
+      src_ch = select_channel(src, ch);
+      exact_median_filter_channel(src_ch, kernSize, result_ch);
+      select_channel(result, ch) = result_ch;
+    }
 
-    return pixel_cast_rescale<PixelT>(result);
+    return result;
   }
 
   template<class PixelT>
@@ -0,0 +1,130 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file MemoryBudget.cc
+///
+
+#include <asp/Core/MemoryBudget.h>
+#include <asp/Core/ExitReport.h>
+#include <vw/Core/Log.h>
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace asp {
+
+namespace {
+  void report_memory_budget() {
+    MemoryBudget::instance().report();
+  }
+}
+
+MemoryBudget & MemoryBudget::instance() {
+  static MemoryBudget * budget
+    = report_at_exit(new MemoryBudget(), "Started the memory budget.", report_memory_budget);
+  return *budget;
+}
+
+MemoryBudget::MemoryBudget(): m_limit(0), m_used(0), m_high_water(0) {
+  char * ptr = getenv("ASP_MEMORY_LIMIT_MB");
+  if (ptr != NULL) {
+    double limit_mb = atof(ptr);
+    if (limit_mb > 0)
+      m_limit = std::uint64_t(limit_mb * 1024.0 * 1024.0);
+  }
+}
+
+void MemoryBudget::set_limit(std::uint64_t limit) {
+  vw::Mutex::Lock lock(m_mutex);
+  m_limit = limit;
+  m_released.notify_all();
+}
+
+std::uint64_t MemoryBudget::limit() {
+  vw::Mutex::Lock lock(m_mutex);
+  return m_limit;
+}
+
+void MemoryBudget::add_locked(std::string const& subsystem, std::uint64_t bytes) {
+  m_used += bytes;
+  m_high_water = std::max(m_high_water, m_used);
+  std::uint64_t & sub_used = m_sub_used[subsystem];
+  sub_used += bytes;
+  std::uint64_t & sub_high_water = m_sub_high_water[subsystem];
+  sub_high_water = std::max(sub_high_water, sub_used);
+}
+
+void MemoryBudget::acquire(std::string const& subsystem, std::uint64_t bytes) {
+  vw::Mutex::Lock lock(m_mutex);
+  while (m_limit > 0 && m_used > 0 && m_used + bytes > m_limit)
+    m_released.wait(lock);
+  add_locked(subsystem, bytes);
+}
+
+void MemoryBudget::add(std::string const& subsystem, std::uint64_t bytes) {
+  vw::Mutex::Lock lock(m_mutex);
+  add_locked(subsystem, bytes);
+}
+
+void MemoryBudget::release(std::string const& subsystem, std::uint64_t bytes) {
+  vw::Mutex::Lock lock(m_mutex);
+  std::uint64_t & sub_used = m_sub_used[subsystem];
+  bytes = std::min(bytes, sub_used);
+  sub_used -= bytes;
+  m_used   -= bytes;
+  m_released.notify_all();
+}
+
+void MemoryBudget::report() {
+  vw::Mutex::Lock lock(m_mutex);
+  if (m_sub_high_water.empty())
+    return;
+
+  // Show this only if asked for, or if there is a limit to compare with
+  vw::MessageLevel level = (m_limit > 0) ? vw::InfoMessage : vw::DebugMessage;
+  double mb = 1024.0 * 1024.0;
+  vw::vw_out(level, "asp") << "Memory high-water marks:\n";
+  for (auto it = m_sub_high_water.begin(); it != m_sub_high_water.end(); it++)
+    vw::vw_out(level, "asp") << "  " << it->first << ": " << it->second / mb << " MB\n";
+  vw::vw_out(level, "asp") << "  All: " << m_high_water / mb << " MB";
+  if (m_limit > 0)
+    vw::vw_out(level, "asp") << ", with a limit of " << m_limit / mb << " MB";
+  vw::vw_out(level, "asp") << "\n";
+}
+
+MemoryReservation::MemoryReservation(std::string const& subsystem, std::uint64_t bytes,
+                                     bool wait):
+  m_subsystem(subsystem), m_bytes(bytes) {
+  if (wait)
+    MemoryBudget::instance().acquire(m_subsystem, m_bytes);
+  else
+    MemoryBudget::instance().add(m_subsystem, m_bytes);
+}
+
+MemoryReservation::~MemoryReservation() {
+  MemoryBudget::instance().release(m_subsystem, m_bytes);
+}
+
+void MemoryReservation::resize(std::uint64_t bytes) {
+  if (bytes > m_bytes)
+    MemoryBudget::instance().add(m_subsystem, bytes - m_bytes);
+  else if (bytes < m_bytes)
+    MemoryBudget::instance().release(m_subsystem, m_bytes - bytes);
+  m_bytes = bytes;
+}
+
+} // End namespace asp
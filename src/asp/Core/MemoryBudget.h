@@ -0,0 +1,102 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file MemoryBudget.h
+///
+/// A process-wide budget for large in-memory buffers. Code which
+/// allocates them registers their size under the name of a subsystem.
+/// Tile tasks wait at their start until their buffers fit under the
+/// limit, so fewer tiles are processed at once when memory is short.
+/// The high-water mark of each subsystem is reported at exit.
+///
+/// The limit is read from the environment variable ASP_MEMORY_LIMIT_MB,
+/// and is unset by default. The VW cache, set with --cache-size-mb, is
+/// separate from it.
+
+#ifndef __ASP_CORE_MEMORY_BUDGET_H__
+#define __ASP_CORE_MEMORY_BUDGET_H__
+
+#include <vw/Core/Thread.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+namespace asp {
+
+  class MemoryBudget: private boost::noncopyable {
+  public:
+
+    /// The budget of this process
+    static MemoryBudget & instance();
+
+    /// The limit in bytes. If 0, nothing has to wait.
+    void set_limit(std::uint64_t limit);
+    std::uint64_t limit();
+
+    /// Wait until the given number of bytes fits under the limit, then
+    /// count them as used by the subsystem. If nothing else is in use,
+    /// do not wait, so that a request larger than the limit can proceed.
+    /// A thread must not wait while holding some bytes it needs to
+    /// release for the wait to end.
+    void acquire(std::string const& subsystem, std::uint64_t bytes);
+
+    /// Count the bytes as used, without waiting. For buffers which grow
+    /// while being filled. Further acquire() calls wait until they are
+    /// released.
+    void add(std::string const& subsystem, std::uint64_t bytes);
+
+    /// Stop counting the bytes, and let those waiting try again
+    void release(std::string const& subsystem, std::uint64_t bytes);
+
+    /// Print the high-water mark of each subsystem and of them all
+    void report();
+
+  private:
+    MemoryBudget();
+    void add_locked(std::string const& subsystem, std::uint64_t bytes);
+
+    vw::Mutex     m_mutex; // protects all below
+    vw::Condition m_released;
+    std::uint64_t m_limit, m_used, m_high_water;
+    std::map<std::string, std::uint64_t> m_sub_used, m_sub_high_water;
+  };
+
+  /// Bytes acquired from the budget at construction, and released on
+  /// destruction, so that they are released also if an exception is
+  /// thrown.
+  class MemoryReservation: private boost::noncopyable {
+  public:
+    /// If wait is false, just count the bytes, as MemoryBudget::add() does.
+    MemoryReservation(std::string const& subsystem, std::uint64_t bytes = 0,
+                      bool wait = true);
+    ~MemoryReservation();
+
+    /// Change the count to the new size, without waiting
+    void resize(std::uint64_t bytes);
+    std::uint64_t size() const { return m_bytes; }
+
+  private:
+    std::string m_subsystem;
+    std::uint64_t m_bytes;
+  };
+
+} // End namespace asp
+
+#endif//__ASP_CORE_MEMORY_BUDGET_H__
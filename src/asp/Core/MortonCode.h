@@ -0,0 +1,66 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file MortonCode.h
+///
+/// Morton codes, which interleave the bits of integer coordinates. Sorting
+/// points by these codes orders them along a Z-order curve, so points which
+/// are close in space tend to be close in the sorted order.
+
+#ifndef __ASP_CORE_MORTON_CODE_H__
+#define __ASP_CORE_MORTON_CODE_H__
+
+#include <cstdint>
+
+namespace asp {
+
+  /// Spread the bits of a 32-bit value to the even bits of a 64-bit value
+  inline std::uint64_t morton_spread_2d(std::uint32_t x) {
+    std::uint64_t v = x;
+    v = (v | (v << 16)) & 0x0000ffff0000ffffULL;
+    v = (v | (v <<  8)) & 0x00ff00ff00ff00ffULL;
+    v = (v | (v <<  4)) & 0x0f0f0f0f0f0f0f0fULL;
+    v = (v | (v <<  2)) & 0x3333333333333333ULL;
+    v = (v | (v <<  1)) & 0x5555555555555555ULL;
+    return v;
+  }
+
+  /// Spread the low 21 bits of a value to every third bit of a 64-bit value
+  inline std::uint64_t morton_spread_3d(std::uint32_t x) {
+    std::uint64_t v = x & 0x1fffff;
+    v = (v | (v << 32)) & 0x001f00000000ffffULL;
+    v = (v | (v << 16)) & 0x001f0000ff0000ffULL;
+    v = (v | (v <<  8)) & 0x100f00f00f00f00fULL;
+    v = (v | (v <<  4)) & 0x10c30c30c30c30c3ULL;
+    v = (v | (v <<  2)) & 0x1249249249249249ULL;
+    return v;
+  }
+
+  /// The 64-bit code of two 32-bit coordinates, with x in the even bits
+  inline std::uint64_t morton_code_2d(std::uint32_t x, std::uint32_t y) {
+    return morton_spread_2d(x) | (morton_spread_2d(y) << 1);
+  }
+
+  /// The 63-bit code of three coordinates, of which only the low 21 bits are used
+  inline std::uint64_t morton_code_3d(std::uint32_t x, std::uint32_t y, std::uint32_t z) {
+    return morton_spread_3d(x) | (morton_spread_3d(y) << 1) | (morton_spread_3d(z) << 2);
+  }
+
+} // end namespace asp
+
+#endif // __ASP_CORE_MORTON_CODE_H__
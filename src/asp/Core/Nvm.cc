@@ -16,12 +16,17 @@
 // __END_LICENSE__
 
 #include <asp/Core/Nvm.h>
+#include <asp/Core/MappedTextFile.h>
 #include <vw/Core/Exception.h>
 #include <vw/Core/Log.h>
+#include <vw/Core/Thread.h>
 #include <vw/FileIO/FileUtils.h>
 
+#include <algorithm>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 
 namespace asp {
 
@@ -35,8 +40,125 @@ void ReadNVM(std::string const& input_filename, nvmData & nvm) {
           &nvm.cid_to_cam_t_global);
 }
   
+namespace {
+
+  // The points on the lines of a chunk of an NVM file. The measures of
+  // point i are num_measures[i] consecutive entries of cids, fids, and
+  // keypoints, in order.
+  struct NvmChunk {
+    std::vector<Eigen::Vector3d> pid_to_xyz;
+    std::vector<int>             num_measures;
+    std::vector<int>             cids, fids;
+    std::vector<Eigen::Vector2d> keypoints;
+    bool                         has_bad_line; // parsing stopped at a bad line
+    NvmChunk(): has_bad_line(false) {}
+  };
+
+  // Parse a point line: x y z r g b num_measures, then for each measure:
+  // cid fid x y. Return false if it is not of this form.
+  bool parse_nvm_point(char const* line, NvmChunk & chunk) {
+    char * end = NULL;
+    Eigen::Vector3d xyz;
+    for (int i = 0; i < 3; i++) {
+      xyz[i] = strtod(line, &end);
+      if (end == line)
+        return false;
+      line = end;
+    }
+    for (int i = 0; i < 3; i++) { // the color, which is not used
+      strtol(line, &end, 10);
+      if (end == line)
+        return false;
+      line = end;
+    }
+    long num_measures = strtol(line, &end, 10);
+    if (end == line || num_measures < 0)
+      return false;
+    line = end;
+
+    size_t prev_size = chunk.cids.size();
+    for (long m = 0; m < num_measures; m++) {
+      long cid = strtol(line, &end, 10);
+      if (end == line) break;
+      line = end;
+      long fid = strtol(line, &end, 10);
+      if (end == line) break;
+      line = end;
+      Eigen::Vector2d pt;
+      pt[0] = strtod(line, &end);
+      if (end == line) break;
+      line = end;
+      pt[1] = strtod(line, &end);
+      if (end == line) break;
+      line = end;
+      chunk.cids.push_back(cid);
+      chunk.fids.push_back(fid);
+      chunk.keypoints.push_back(pt);
+    }
+
+    if (chunk.cids.size() != prev_size + size_t(num_measures)) {
+      // Undo the measures of this line
+      chunk.cids.resize(prev_size);
+      chunk.fids.resize(prev_size);
+      chunk.keypoints.resize(prev_size);
+      return false;
+    }
+
+    chunk.pid_to_xyz.push_back(xyz);
+    chunk.num_measures.push_back(num_measures);
+    return true;
+  }
+
+  // Parse the point lines of chunks of an NVM file. Called by several
+  // threads at once, each with its own chunk.
+  class NvmChunkParser {
+    MappedTextFile const& m_file;
+    std::map<int, NvmChunk> & m_chunks;
+    vw::Mutex m_mutex;
+  public:
+    NvmChunkParser(MappedTextFile const& file, std::map<int, NvmChunk> & chunks):
+      m_file(file), m_chunks(chunks) {}
+
+    void operator()(int chunk_id, size_t begin, size_t end) {
+      NvmChunk * chunk = NULL;
+      {
+        vw::Mutex::Lock lock(m_mutex);
+        chunk = &m_chunks[chunk_id];
+      }
+
+      std::string line;
+      size_t pos = begin;
+      while (pos < end) {
+        pos = m_file.read_line(pos, line);
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+          continue; // empty line
+        if (!parse_nvm_point(line.c_str(), *chunk)) {
+          // This is past the last point, or the file is bad. Which one
+          // it is will be known only when the chunks are put together.
+          chunk->has_bad_line = true;
+          break;
+        }
+      }
+    }
+  };
+
+  // Read the next line which is not empty, starting at pos. Return
+  // false if there is none.
+  bool read_nonempty_line(MappedTextFile const& file, size_t & pos, std::string & line) {
+    while (pos < file.size()) {
+      pos = file.read_line(pos, line);
+      if (line.find_first_not_of(" \t\r") != std::string::npos)
+        return true;
+    }
+    return false;
+  }
+
+} // end anonymous namespace
+
 // Reads the NVM control network format. The interest points may or may not
 // be shifted relative to optical center. The user is responsible for knowing that.
+// The file is mapped into memory, and the lines of the points, which
+// is most of it, are parsed in parallel.
 void ReadNVM(std::string const& input_filename,
              std::vector<Eigen::Matrix2Xd> * cid_to_keypoint_map,
              std::vector<std::string> * cid_to_filename,
@@ -44,9 +166,9 @@ void ReadNVM(std::string const& input_filename,
              std::vector<Eigen::Vector3d> * pid_to_xyz,
              std::vector<Eigen::Affine3d> * cid_to_cam_t_global) {
 
-  std::ifstream f(input_filename, std::ios::in);
-  std::string token;
-  std::getline(f, token);
+  MappedTextFile file(input_filename);
+  std::string token, line;
+  size_t pos = file.read_line(0, token);
   
   // Assert that we start with our NVM token
   if (token.compare(0, 6, "NVM_V3") != 0) {
@@ -54,8 +176,9 @@ void ReadNVM(std::string const& input_filename,
   }
 
   // Read the number of cameras
-  ptrdiff_t number_of_cid;
-  f >> number_of_cid;
+  ptrdiff_t number_of_cid = 0;
+  if (read_nonempty_line(file, pos, line))
+    std::istringstream(line) >> number_of_cid;
   if (number_of_cid < 1) {
     vw::vw_throw(vw::ArgumentErr() << "NVM file is missing cameras.");
   }
@@ -65,16 +188,19 @@ void ReadNVM(std::string const& input_filename,
   cid_to_filename->resize(number_of_cid);
   cid_to_cam_t_global->resize(number_of_cid);
   for (ptrdiff_t cid = 0; cid < number_of_cid; cid++) {
-    // Clear keypoints from map. We'll read these in shortly
-    cid_to_keypoint_map->at(cid).resize(Eigen::NoChange_t(), 2);
 
     // Read the line that contains camera information
     double focal, dist1, dist2;
     Eigen::Quaterniond q;
     Eigen::Vector3d c;
-    f >> token >> focal;
-    f >> q.w() >> q.x() >> q.y() >> q.z();
-    f >> c[0] >> c[1] >> c[2] >> dist1 >> dist2;
+    if (!read_nonempty_line(file, pos, line))
+      vw::vw_throw(vw::ArgumentErr() << "Unable to correctly read CID: " << cid);
+    std::istringstream is(line);
+    is >> token >> focal;
+    is >> q.w() >> q.x() >> q.y() >> q.z();
+    is >> c[0] >> c[1] >> c[2] >> dist1 >> dist2;
+    if (!is)
+      vw::vw_throw(vw::ArgumentErr() << "Unable to correctly read CID: " << cid);
     cid_to_filename->at(cid) = token;
 
     // Solve for t, which is part of the affine transform
@@ -84,38 +210,59 @@ void ReadNVM(std::string const& input_filename,
   }
 
   // Read the number of points
-  ptrdiff_t number_of_pid;
-  f >> number_of_pid;
+  ptrdiff_t number_of_pid = 0;
+  if (read_nonempty_line(file, pos, line))
+    std::istringstream(line) >> number_of_pid;
   if (number_of_pid < 1)
     vw::vw_throw(vw::ArgumentErr() << "The NVM file has no triangulated points.");
 
-  // Read the point
+  // Read the points, one per line
+  std::map<int, NvmChunk> chunks;
+  NvmChunkParser parser(file, chunks);
+  for_each_text_chunk(file, pos, parser);
+
+  // Put the chunks together. Find first how many keypoints each
+  // camera has, so that each keypoint matrix is allocated once.
+  std::vector<int> num_keypoints(number_of_cid, 2);
+  ptrdiff_t num_read = 0;
+  for (auto it = chunks.begin(); it != chunks.end() && num_read < number_of_pid; it++) {
+    NvmChunk const& chunk = it->second;
+    size_t m = 0;
+    for (size_t i = 0; i < chunk.pid_to_xyz.size() && num_read < number_of_pid; i++) {
+      for (int k = 0; k < chunk.num_measures[i]; k++, m++) {
+        int cid = chunk.cids[m], fid = chunk.fids[m];
+        if (cid < 0 || cid >= number_of_cid || fid < 0)
+          vw::vw_throw(vw::ArgumentErr() << "Unable to correctly read PID: " << num_read);
+        num_keypoints[cid] = std::max(num_keypoints[cid], fid + 1);
+      }
+      num_read++;
+    }
+    if (chunk.has_bad_line && num_read < number_of_pid)
+      vw::vw_throw(vw::ArgumentErr() << "Unable to correctly read PID: " << num_read);
+  }
+  if (num_read < number_of_pid)
+    vw::vw_throw(vw::ArgumentErr() << "Unable to correctly read PID: " << num_read);
+
+  for (ptrdiff_t cid = 0; cid < number_of_cid; cid++)
+    cid_to_keypoint_map->at(cid).setZero(Eigen::NoChange_t(), num_keypoints[cid]);
+
   pid_to_cid_fid->resize(number_of_pid);
   pid_to_xyz->resize(number_of_pid);
-  Eigen::Vector3d xyz;
-  Eigen::Vector3i color;
-  Eigen::Vector2d pt;
-  ptrdiff_t cid, fid;
-  for (ptrdiff_t pid = 0; pid < number_of_pid; pid++) {
-    pid_to_cid_fid->at(pid).clear();
-
-    ptrdiff_t number_of_measures;
-    f >> xyz[0] >> xyz[1] >> xyz[2] >>
-      color[0] >> color[1] >> color[2] >> number_of_measures;
-    pid_to_xyz->at(pid) = xyz;
-    for (ptrdiff_t m = 0; m < number_of_measures; m++) {
-      f >> cid >> fid >> pt[0] >> pt[1];
-
-      pid_to_cid_fid->at(pid)[cid] = fid;
-
-      if (cid_to_keypoint_map->at(cid).cols() <= fid) {
-        cid_to_keypoint_map->at(cid).conservativeResize(Eigen::NoChange_t(), fid + 1);
+  ptrdiff_t pid = 0;
+  for (auto it = chunks.begin(); it != chunks.end() && pid < number_of_pid; it++) {
+    NvmChunk const& chunk = it->second;
+    size_t m = 0;
+    for (size_t i = 0; i < chunk.pid_to_xyz.size() && pid < number_of_pid; i++) {
+      pid_to_xyz->at(pid) = chunk.pid_to_xyz[i];
+      std::map<int, int> & cid_fid = pid_to_cid_fid->at(pid);
+      cid_fid.clear();
+      for (int k = 0; k < chunk.num_measures[i]; k++, m++) {
+        int cid = chunk.cids[m], fid = chunk.fids[m];
+        cid_fid[cid] = fid;
+        cid_to_keypoint_map->at(cid).col(fid) = chunk.keypoints[m];
       }
-      cid_to_keypoint_map->at(cid).col(fid) = pt;
+      pid++;
     }
-
-    if (!f.good())
-      vw::vw_throw(vw::ArgumentErr() << "Unable to correctly read PID: " << pid);
   }
 }
 
@@ -34,12 +34,16 @@
 #include <vw/Image/Filter.h>
 #include <vw/Image/InpaintView.h>
 
+#include <asp/Core/MemoryBudget.h>
 #include <asp/Core/SoftwareRenderer.h>
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/Tracing.h>
 #include <boost/foreach.hpp>
 #include <boost/math/special_functions/next.hpp>
 #include <asp/Core/OrthoRasterizer.h>
 #include <valarray>
+#include <fstream>
+#include <cstdio>
 
 namespace asp{
 
@@ -78,6 +82,121 @@ namespace asp{
     of.close();
   }
 
+  // The point cloud index is a binary file with the bounding box of the
+  // cloud, the histogram of errors, and for each sub-block its box in the
+  // projected domain and in the cloud. It starts with a string describing
+  // the cloud and the options it was made with, and is reused only if that
+  // string is the same. The values are saved exactly, which matters as
+  // the boxes were grown with float_next().
+  const std::string PC_INDEX_MAGIC = "ASP_PC_INDEX_V1";
+
+  template <class T>
+  void write_binary(std::ofstream & ofs, T const& val) {
+    ofs.write(reinterpret_cast<const char*>(&val), sizeof(T));
+  }
+  template <class T>
+  bool read_binary(std::ifstream & ifs, T & val) {
+    return static_cast<bool>(ifs.read(reinterpret_cast<char*>(&val), sizeof(T)));
+  }
+  void write_binary_string(std::ofstream & ofs, std::string const& str) {
+    write_binary(ofs, vw::uint64(str.size()));
+    ofs.write(str.c_str(), str.size());
+  }
+  bool read_binary_string(std::ifstream & ifs, std::string & str) {
+    vw::uint64 len = 0;
+    if (!read_binary(ifs, len) || len > (1u << 24))
+      return false;
+    str.resize(len);
+    return len == 0 || static_cast<bool>(ifs.read(&str[0], len));
+  }
+  void write_binary_box(std::ofstream & ofs, BBox3 const& box) {
+    for (int i = 0; i < 3; i++) write_binary(ofs, box.min()[i]);
+    for (int i = 0; i < 3; i++) write_binary(ofs, box.max()[i]);
+  }
+  bool read_binary_box(std::ifstream & ifs, BBox3 & box) {
+    for (int i = 0; i < 3; i++) if (!read_binary(ifs, box.min()[i])) return false;
+    for (int i = 0; i < 3; i++) if (!read_binary(ifs, box.max()[i])) return false;
+    return true;
+  }
+
+  void write_pc_index(std::string const& file, std::string const& key,
+                      BBox3 const& bbox, std::vector<BBoxPair> const& boundaries,
+                      std::vector<double> const& errors_hist) {
+
+    // Write to a temporary file first, so that an interrupted run does
+    // not leave behind a truncated index.
+    std::string tmp_file = file + ".tmp";
+    std::ofstream ofs(tmp_file.c_str(), std::ios::binary);
+    if (!ofs.good())
+      vw_throw(IOErr() << "Cannot write: " << tmp_file << "\n");
+
+    write_binary_string(ofs, PC_INDEX_MAGIC);
+    write_binary_string(ofs, key);
+    write_binary_box(ofs, bbox);
+    write_binary(ofs, vw::uint64(errors_hist.size()));
+    for (size_t i = 0; i < errors_hist.size(); i++)
+      write_binary(ofs, errors_hist[i]);
+    write_binary(ofs, vw::uint64(boundaries.size()));
+    for (size_t i = 0; i < boundaries.size(); i++) {
+      write_binary_box(ofs, boundaries[i].first);
+      BBox2i const& b = boundaries[i].second;
+      write_binary(ofs, vw::int32(b.min().x())); write_binary(ofs, vw::int32(b.min().y()));
+      write_binary(ofs, vw::int32(b.max().x())); write_binary(ofs, vw::int32(b.max().y()));
+    }
+    ofs.close();
+    if (!ofs.good())
+      vw_throw(IOErr() << "Failed writing: " << tmp_file << "\n");
+
+    if (std::rename(tmp_file.c_str(), file.c_str()) != 0)
+      vw_throw(IOErr() << "Cannot rename: " << tmp_file << " to " << file << "\n");
+  }
+
+  // Return false if the index does not exist, is for a different key,
+  // or cannot be read. The outputs are touched only on success.
+  bool read_pc_index(std::string const& file, std::string const& key,
+                     BBox3 & bbox, std::vector<BBoxPair> & boundaries,
+                     std::vector<double> & errors_hist) {
+
+    std::ifstream ifs(file.c_str(), std::ios::binary);
+    if (!ifs.good())
+      return false;
+
+    std::string magic, file_key;
+    if (!read_binary_string(ifs, magic) || magic != PC_INDEX_MAGIC)
+      return false;
+    if (!read_binary_string(ifs, file_key) || file_key != key)
+      return false;
+
+    BBox3 local_bbox;
+    vw::uint64 hist_len = 0, num_boxes = 0;
+    if (!read_binary_box(ifs, local_bbox) || !read_binary(ifs, hist_len) ||
+        hist_len != errors_hist.size())
+      return false;
+    std::vector<double> local_hist(hist_len);
+    for (size_t i = 0; i < hist_len; i++)
+      if (!read_binary(ifs, local_hist[i]))
+        return false;
+
+    if (!read_binary(ifs, num_boxes))
+      return false;
+    std::vector<BBoxPair> local_boundaries;
+    for (vw::uint64 i = 0; i < num_boxes; i++) {
+      BBox3 box;
+      vw::int32 minx, miny, maxx, maxy;
+      if (!read_binary_box(ifs, box) ||
+          !read_binary(ifs, minx) || !read_binary(ifs, miny) ||
+          !read_binary(ifs, maxx) || !read_binary(ifs, maxy))
+        return false;
+      local_boundaries.push_back(BBoxPair(box, BBox2i(Vector2i(minx, miny),
+                                                      Vector2i(maxx, maxy))));
+    }
+
+    bbox        = local_bbox;
+    errors_hist = local_hist;
+    boundaries.swap(local_boundaries);
+    return true;
+  }
+
   // Task to parallelize the generation of bounding boxes for each block.
   class SubBlockBoundaryTask : public Task, private boost::noncopyable {
     ImageViewRef<Vector3> m_view;
@@ -403,6 +522,7 @@ namespace asp{
    std::string const& filter,
    double default_grid_size_multiplier,
    std::int64_t * num_invalid_pixels, vw::Mutex *count_mutex,
+   std::string const& pc_index_file, std::string const& pc_index_key,
    const ProgressCallback& progress):
     // Ensure all members are initiated, even if to temporary values
     m_point_image(point_image), m_texture(ImageView<float>(1,1)),
@@ -419,7 +539,8 @@ namespace asp{
     m_median_filter_params(median_filter_params), m_erode_len(erode_len),
     m_default_grid_size_multiplier(default_grid_size_multiplier),
     m_num_invalid_pixels(num_invalid_pixels),
-    m_count_mutex(count_mutex){
+    m_count_mutex(count_mutex),
+    m_counted_tiles(new std::set<std::vector<int32>>()) {
 
     *m_num_invalid_pixels = 0; // Init counter
     set_texture(texture.impl());
@@ -466,24 +587,52 @@ namespace asp{
     sub_block_size = std::min(ASP_MAX_SUBBLOCK_SIZE, sub_block_size);
     std::vector<BBox2i> blocks = subdivide_bbox(m_point_image, m_block_size, m_block_size);
 
-    // Find the bounding box of each subblock, stored in
-    // m_point_image_boundaries, together with other info by
-    // searching through the image.
-    FifoWorkQueue queue( vw_settings().default_num_threads() );
-    typedef SubBlockBoundaryTask task_type;
-    Mutex mutex;
-    float inc_amt = 1.0 / float(blocks.size());
-    for ( size_t i = 0; i < blocks.size(); i++ ) {
-      boost::shared_ptr<task_type>
-        task(new task_type(m_point_image, sub_block_size, blocks[i],
-                           m_bbox, m_point_image_boundaries,
-                           error_image, estim_max_error, estim_proj_box, errors_hist,
-                           max_valid_triangulation_error,
-                           mutex, progress, inc_amt));
-      queue.add_task(task);
+    // The index depends also on how the cloud is scanned
+    std::ostringstream os;
+    os.precision(17);
+    os << pc_index_key << "\n" << point_image.cols() << " " << point_image.rows() << " "
+       << m_block_size << " " << sub_block_size << " " << errors_hist.size() << " "
+       << estim_max_error << " " << estim_proj_box << " " << max_valid_triangulation_error;
+    std::string index_key = os.str();
+
+    bool have_index = false;
+    if (pc_index_file != "") {
+      have_index = read_pc_index(pc_index_file, index_key, m_bbox,
+                                 m_point_image_boundaries, errors_hist);
+      if (have_index)
+        vw_out() << "Read the point cloud index: " << pc_index_file << "\n";
+    }
+
+    if (!have_index) {
+      // Find the bounding box of each subblock, stored in
+      // m_point_image_boundaries, together with other info by
+      // searching through the image.
+      FifoWorkQueue queue( vw_settings().default_num_threads() );
+      typedef SubBlockBoundaryTask task_type;
+      Mutex mutex;
+      float inc_amt = 1.0 / float(blocks.size());
+      for ( size_t i = 0; i < blocks.size(); i++ ) {
+        boost::shared_ptr<task_type>
+          task(new task_type(m_point_image, sub_block_size, blocks[i],
+                             m_bbox, m_point_image_boundaries,
+                             error_image, estim_max_error, estim_proj_box, errors_hist,
+                             max_valid_triangulation_error,
+                             mutex, progress, inc_amt));
+        queue.add_task(task);
+      }
+      queue.join_all();
+      progress.report_finished();
+
+      if (pc_index_file != "" && !m_bbox.empty()) {
+        vw_out() << "Writing the point cloud index: " << pc_index_file << "\n";
+        try {
+          write_pc_index(pc_index_file, index_key, m_bbox,
+                         m_point_image_boundaries, errors_hist);
+        } catch (const std::exception& e) {
+          vw_out(WarningMessage) << e.what() << "\n";
+        }
+      }
     }
-    queue.join_all();
-    progress.report_finished();
 
     if ( m_bbox.empty() )
       vw_throw( ArgumentErr() << "OrthoRasterize: Input point cloud is empty!\n" );
@@ -644,27 +793,53 @@ namespace asp{
   /// \cond INTERNAL
   OrthoRasterizerView::prerasterize_type
   OrthoRasterizerView::prerasterize(BBox2i const& bbox) const {
+    TraceSpan span("ortho_rasterizer_tile", bbox);
+    std::vector<ImageViewRef<float>> textures(1, m_texture);
+    std::vector<ImageView<PixelGray<float>>> layers;
+    BBox2i layer_box = rasterize_layers(bbox, textures, layers);
+    return prerasterize_type(layers[0], layer_box);
+  }
+  /// \endcond
+
+  BBox2i OrthoRasterizerView::rasterize_layers
+  (BBox2i const& bbox, std::vector<ImageViewRef<float>> const& textures,
+   std::vector<ImageView<PixelGray<float>>> & layers) const {
+
+    size_t num_layers = textures.size();
+    VW_ASSERT(num_layers > 0,
+              ArgumentErr() << "Orthorasterizer: expecting at least one texture.\n");
+    for (size_t l = 0; l < num_layers; l++)
+      VW_ASSERT(textures[l].cols() == m_point_image.cols() &&
+                textures[l].rows() == m_point_image.rows(),
+                ArgumentErr() << "Orthorasterizer: rasterize_layers() failed."
+                << " Texture dimensions must match point image dimensions.");
 
     BBox2i bbox_1 = bbox;
     
     // bugfix, ensure we see enough beyond current tile
     bbox_1.expand((int)ceil(std::max(m_search_radius_factor, 5.0)));
 
+    // The returned layers must be cropped to this box
+    BBox2i layer_box(-bbox_1.min().x(), -bbox_1.min().y(), cols(), rows());
+
     // Used to find which polygons are actually in the draw space.
     BBox3 local_3d_bbox = pixel_to_point_bbox(bbox_1);
 
-    ImageView<float > render_buffer;
-    ImageView<double> d_buffer, weights;
+    // Wait until the buffers of this tile fit in the memory budget, so
+    // that fewer tiles are done at once if memory is short
+    std::uint64_t buffer_bytes = std::uint64_t(bbox_1.width()) * bbox_1.height() * num_layers
+      * (m_use_surface_sampling ? sizeof(float) : 2 * sizeof(double));
+    MemoryReservation reservation("point2dem tile buffers", buffer_bytes);
+
+    // Each layer has its own buffers. They are sized before the
+    // renderers and grids referring to them are created.
+    std::vector<ImageView<float>> render_buffers(num_layers);
+    std::vector<ImageView<double>> d_buffers(num_layers), weights(num_layers);
     if (m_use_surface_sampling){
-      render_buffer.set_size(bbox_1.width(), bbox_1.height());
+      for (size_t l = 0; l < num_layers; l++)
+        render_buffers[l].set_size(bbox_1.width(), bbox_1.height());
     }
 
-    // Setup a software renderer and the orthographic view matrix
-    vw::stereo::SoftwareRenderer renderer(bbox_1.width(), bbox_1.height(),
-                                          &render_buffer(0,0) );
-    renderer.Ortho2D(local_3d_bbox.min().x(), local_3d_bbox.max().x(),
-                     local_3d_bbox.min().y(), local_3d_bbox.max().y());
-
     // Given a DEM grid point, search for cloud points within the
     // circular region of radius equal to grid size. As such, a
     // given cloud point may contribute to multiple DEM points, but
@@ -676,14 +851,30 @@ namespace asp{
       search_radius = std::max(m_spacing, m_default_spacing);
     else
       search_radius = m_spacing*m_search_radius_factor;
-    asp::Point2Grid point2grid(bbox_1.width(),
+
+    // Set up a software renderer and the orthographic view matrix, or
+    // the binning engine, for each layer
+    std::vector<boost::shared_ptr<vw::stereo::SoftwareRenderer>> renderers(num_layers);
+    std::vector<boost::shared_ptr<asp::Point2Grid>> point2grids(num_layers);
+    for (size_t l = 0; l < num_layers; l++) {
+      if (m_use_surface_sampling) {
+        renderers[l] = boost::shared_ptr<vw::stereo::SoftwareRenderer>
+          (new vw::stereo::SoftwareRenderer(bbox_1.width(), bbox_1.height(),
+                                            &render_buffers[l](0,0)));
+        renderers[l]->Ortho2D(local_3d_bbox.min().x(), local_3d_bbox.max().x(),
+                              local_3d_bbox.min().y(), local_3d_bbox.max().y());
+      } else {
+        point2grids[l] = boost::shared_ptr<asp::Point2Grid>
+          (new asp::Point2Grid(bbox_1.width(),
                                bbox_1.height(),
-                               d_buffer, weights,
+                               d_buffers[l], weights[l],
                                local_3d_bbox.min().x(),
                                local_3d_bbox.min().y(),
                                m_spacing, m_default_spacing,
                                search_radius, m_sigma_factor,
-                               m_filter, m_percentile);
+                               m_filter, m_percentile));
+      }
+    }
     
     // Set up the default color value
     double min_val = 0.0;
@@ -696,16 +887,20 @@ namespace asp{
       min_val = m_default_value;
     }
 
-    std::valarray<float> vertices(10), intensities(5);
-
-    if (m_use_surface_sampling){
-      static const int NUM_COLOR_COMPONENTS  = 1;  // We only need gray scale
-      static const int NUM_VERTEX_COMPONENTS = 2; // DEMs are 2D
-      renderer.Clear(min_val);
-      renderer.SetVertexPointer(NUM_VERTEX_COMPONENTS, &vertices[0]);
-      renderer.SetColorPointer(NUM_COLOR_COMPONENTS, &intensities[0]);
-    }else{
-      point2grid.Clear(min_val);
+    // The vertices are shared by all layers, and the intensities differ
+    std::valarray<float> vertices(10);
+    std::vector<std::valarray<float>> intensities(num_layers, std::valarray<float>(5));
+
+    for (size_t l = 0; l < num_layers; l++) {
+      if (m_use_surface_sampling) {
+        static const int NUM_COLOR_COMPONENTS  = 1;  // We only need gray scale
+        static const int NUM_VERTEX_COMPONENTS = 2; // DEMs are 2D
+        renderers[l]->Clear(min_val);
+        renderers[l]->SetVertexPointer(NUM_VERTEX_COMPONENTS, &vertices[0]);
+        renderers[l]->SetColorPointer(NUM_COLOR_COMPONENTS, &intensities[l][0]);
+      } else {
+        point2grids[l]->Clear(min_val);
+      }
     }
 
     // For each block in the DEM space intersecting local_3d_bbox,
@@ -734,22 +929,20 @@ namespace asp{
 
     }
 
+    layers.resize(num_layers);
     if ( blocks_map.empty() ){
       // TODO: Don't include these pixels in the total?
-      { // Lock and update the total number of invalid pixels in this tile.
-        vw::Mutex::Lock lock(*m_count_mutex);
-        // Care here, convert to int64_t before multiplication, to avoid
-        // int32 overflow.
-        (*m_num_invalid_pixels) += std::int64_t(bbox.width())*std::int64_t(bbox.height());
-      }
+      // Care here, convert to int64_t before multiplication, to avoid
+      // int32 overflow.
+      count_invalid_pixels(bbox, std::int64_t(bbox.width())*std::int64_t(bbox.height()));
       
-      if (m_use_surface_sampling){
-        return prerasterize_type(render_buffer, BBox2i(-bbox_1.min().x(),
-                                                       -bbox_1.min().y(), cols(), rows()));
-      }else{
-        return prerasterize_type(d_buffer, BBox2i(-bbox_1.min().x(),
-                                                  -bbox_1.min().y(), cols(), rows()) );
+      for (size_t l = 0; l < num_layers; l++) {
+        if (m_use_surface_sampling)
+          layers[l] = render_buffers[l];
+        else
+          layers[l] = d_buffers[l];
       }
+      return layer_box;
     }
 
     // This is very important. When doing surface sampling, for each
@@ -778,7 +971,9 @@ namespace asp{
       // Crop back to the area of interest
       point_copy = crop(point_copy, block - biased_block.min());
 
-      ImageView<float> texture_copy = crop(m_texture, block );
+      std::vector<ImageView<float>> texture_copies(num_layers);
+      for (size_t l = 0; l < num_layers; l++)
+        texture_copies[l] = crop(textures[l], block);
 
       typedef ImageView<Vector3>::pixel_accessor PointAcc;
       PointAcc row_acc = point_copy.origin();
@@ -808,19 +1003,23 @@ namespace asp{
               vertices[8] = (*point_ul).x(); // UL
               vertices[9] = (*point_ul).y();
 
-              intensities[0] = texture_copy(col,  row);
-              intensities[1] = texture_copy(col,row+1);
-              intensities[2] = texture_copy(col+1,  row+1);
-              intensities[3] = texture_copy(col+1,row);
-              intensities[4] = texture_copy(col,row);
-
-              if (!boost::math::isnan((*point_ll).z())) {
-                // triangle 1 is: UL LL LR
-                renderer.DrawPolygon(0, 3);
-              }
-              if (!boost::math::isnan((*point_ur).z())) {
-                // triangle 2 is: LR, UR, UL
-                renderer.DrawPolygon(2, 3);
+              for (size_t l = 0; l < num_layers; l++) {
+                ImageView<float> const& texture_copy = texture_copies[l];
+                std::valarray<float> & layer_intensities = intensities[l];
+                layer_intensities[0] = texture_copy(col,  row);
+                layer_intensities[1] = texture_copy(col,row+1);
+                layer_intensities[2] = texture_copy(col+1,  row+1);
+                layer_intensities[3] = texture_copy(col+1,row);
+                layer_intensities[4] = texture_copy(col,row);
+
+                if (!boost::math::isnan((*point_ll).z())) {
+                  // triangle 1 is: UL LL LR
+                  renderers[l]->DrawPolygon(0, 3);
+                }
+                if (!boost::math::isnan((*point_ur).z())) {
+                  // triangle 2 is: LR, UR, UL
+                  renderers[l]->DrawPolygon(2, 3);
+                }
               }
             }
 
@@ -828,33 +1027,34 @@ namespace asp{
             // The new engine
             if ( !boost::math::isnan(point_copy(col, row).z()) &&
                  local_3d_bbox.contains(point_copy(col, row))){
-              point2grid.AddPoint(point_copy(col, row).x(),
-                                  point_copy(col, row).y(),
-                                  texture_copy(col,  row));
+              for (size_t l = 0; l < num_layers; l++)
+                point2grids[l]->AddPoint(point_copy(col, row).x(),
+                                         point_copy(col, row).y(),
+                                         texture_copies[l](col,  row));
             }
           }
           point_ul.next_col();
         } // End column loop
         row_acc.next_row();
       } // End row loop
-
     }
 
-    if (!m_use_surface_sampling)
-      point2grid.normalize();
-
     // The software renderer returns an image which will render
     // upside down in most image formats, so we correct that here.
     // We also introduce transparent pixels into the result where necessary.
     // TODO: Here can do flipping in place.
-    ImageView<PixelGray<float>> result;
-    if (m_use_surface_sampling)
-      result = flip_vertical(render_buffer);
-    else
-      result = flip_vertical(d_buffer);
+    for (size_t l = 0; l < num_layers; l++) {
+      if (m_use_surface_sampling) {
+        layers[l] = flip_vertical(render_buffers[l]);
+      } else {
+        point2grids[l]->normalize();
+        layers[l] = flip_vertical(d_buffers[l]);
+      }
+    }
 
     // Loop through result here and count up how many pixels have been
-    // changed from the default value.
+    // changed from the default value. All layers have the same coverage.
+    ImageView<PixelGray<float>> const& result = layers[0];
     std::int64_t num_unset = 0;
     for (int r=0; r<result.rows(); ++r) {
       for (int c=0; c<result.cols(); ++c) {
@@ -867,13 +1067,93 @@ namespace asp{
         }
       }
     }
-    { // Lock and update the total number of invalid pixels in this tile.
-      vw::Mutex::Lock lock(*m_count_mutex);
-      (*m_num_invalid_pixels) += num_unset;
+    count_invalid_pixels(bbox, num_unset);
+
+    return layer_box;
+  }
+
+  void OrthoRasterizerView::count_invalid_pixels(BBox2i const& bbox,
+                                                 std::int64_t num_invalid) const {
+    std::vector<int32> key(4);
+    key[0] = bbox.min().x(); key[1] = bbox.min().y();
+    key[2] = bbox.max().x(); key[3] = bbox.max().y();
+
+    // Lock and update the total number of invalid pixels
+    vw::Mutex::Lock lock(*m_count_mutex);
+    if (m_counted_tiles->insert(key).second)
+      (*m_num_invalid_pixels) += num_invalid;
+  }
+
+  void OrthoRasterizerView::reset_num_invalid_pixels() {
+    vw::Mutex::Lock lock(*m_count_mutex);
+    *m_num_invalid_pixels = 0;
+    m_counted_tiles->clear();
+  }
+
+  OrthoRasterizerLayers::OrthoRasterizerLayers
+  (OrthoRasterizerView const& rasterizer,
+   std::vector<ImageViewRef<float>> const& textures, int max_num_tiles):
+    m_rasterizer(rasterizer), m_textures(textures),
+    m_max_num_tiles(std::max(max_num_tiles, 1)) {}
+
+  ImageView<PixelGray<float>>
+  OrthoRasterizerLayers::fetch(size_t layer, BBox2i const& bbox, BBox2i & layer_box) {
+
+    std::vector<int32> key(4);
+    key[0] = bbox.min().x(); key[1] = bbox.min().y();
+    key[2] = bbox.max().x(); key[3] = bbox.max().y();
+
+    // Find the tile, or start it. Keep no more than the given number of
+    // tiles, so that the memory use is bounded even if some layers are
+    // fetched much later than others.
+    boost::shared_ptr<Tile> tile;
+    {
+      vw::Mutex::Lock lock(m_mutex);
+      TileMap::iterator it = m_tiles.find(key);
+      if (it != m_tiles.end()) {
+        tile = it->second;
+      } else {
+        tile = boost::shared_ptr<Tile>(new Tile);
+        tile->done = false;
+        tile->fetched.assign(m_textures.size(), false);
+        tile->num_fetched = 0;
+        m_tiles[key] = tile;
+        m_tile_order.push_back(key);
+        while ((int)m_tile_order.size() > m_max_num_tiles) {
+          m_tiles.erase(m_tile_order.front());
+          m_tile_order.pop_front();
+        }
+      }
+    }
+
+    // Rasterize all layers of the tile, unless another thread did it already
+    ImageView<PixelGray<float>> result;
+    bool all_fetched = false;
+    {
+      vw::Mutex::Lock lock(tile->mutex);
+      if (!tile->done) {
+        tile->layer_box = m_rasterizer.rasterize_layers(bbox, m_textures, tile->layers);
+        tile->done = true;
+      }
+      result    = tile->layers[layer];
+      layer_box = tile->layer_box;
+      if (!tile->fetched[layer]) {
+        tile->fetched[layer] = true;
+        tile->num_fetched++;
+      }
+      all_fetched = (tile->num_fetched == m_textures.size());
+    }
+
+    if (all_fetched) {
+      vw::Mutex::Lock lock(m_mutex);
+      TileMap::iterator it = m_tiles.find(key);
+      if (it != m_tiles.end() && it->second == tile) {
+        m_tiles.erase(it);
+        m_tile_order.remove(key);
+      }
     }
 
-    return prerasterize_type(result,
-                             BBox2i(-bbox_1.min().x(), -bbox_1.min().y(), cols(), rows()));
+    return result;
   }
 
   // Return the affine georeferencing transform.
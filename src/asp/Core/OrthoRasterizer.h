@@ -32,6 +32,12 @@
 #include <vw/Math/BBox.h>
 #include <asp/Core/Point2Grid.h>
 
+#include <boost/shared_ptr.hpp>
+
+#include <list>
+#include <map>
+#include <set>
+
 namespace asp{
 
   enum OutlierRemovalMethod {NO_OUTLIER_REMOVAL_METHOD, PERCENTILE_OUTLIER_METHOD,
@@ -71,6 +77,12 @@ namespace asp{
     double m_default_grid_size_multiplier;
     std::int64_t * m_num_invalid_pixels; ///< Keep a count of nodata output pixels, needs to be pointer due to VW weirdness.
     vw::Mutex  *m_count_mutex;        ///< A lock for m_num_invalid_pixels, needs to be pointer due to C++ weirdness.
+    /// The tiles already in m_num_invalid_pixels, as a tile may be rasterized
+    /// again if evicted from a cache. Shared by the copies of this view.
+    boost::shared_ptr<std::set<std::vector<int32>>> m_counted_tiles;
+
+    // Add the invalid pixels of this tile to the count, unless done before
+    void count_invalid_pixels(BBox2i const& bbox, std::int64_t num_invalid) const;
 
     // We could actually use a quadtree here .. but this should be a
     // good enough improvement.
@@ -89,6 +101,11 @@ namespace asp{
     typedef ProceduralPixelAccessor<OrthoRasterizerView> pixel_accessor;
 
     /// Constructor. Must call initialize_spacing before using the object!!!
+    /// If pc_index_file is not empty, the bounding boxes of the point
+    /// cloud sub-blocks and the histogram of errors are read from that
+    /// file if it was created for the same pc_index_key, which must
+    /// describe the input cloud and its projection, and otherwise they
+    /// are computed and saved to that file.
     OrthoRasterizerView(ImageViewRef<Vector3> point_image,
                         ImageViewRef<double > texture,
                         double  search_radius_factor,
@@ -109,6 +126,8 @@ namespace asp{
                         double  default_grid_size_multiplier,
                         std::int64_t * num_invalid_pixels,
                         vw::Mutex *count_mutex,
+                        std::string const& pc_index_file,
+                        std::string const& pc_index_key,
                         const ProgressCallback& progress);
 
     /// This must be called before the object can be used!
@@ -148,6 +167,17 @@ namespace asp{
     }
     /// \endcond
 
+    /// Rasterize each of the given textures over the given tile, reading
+    /// and filtering the point cloud only once. The textures must be
+    /// like for set_texture(). The returned box is what each of the
+    /// layers must be cropped to, as in prerasterize().
+    BBox2i rasterize_layers(BBox2i const& bbox,
+                            std::vector<ImageViewRef<float>> const& textures,
+                            std::vector<ImageView<PixelGray<float>>> & layers) const;
+
+    /// Start counting the invalid pixels anew, for another product
+    void reset_num_invalid_pixels();
+
     void set_use_alpha          (bool   val) { m_use_alpha       = val; }
     void set_use_minz_as_default(bool   val) { m_minz_as_default = val; }
     void set_default_value      (double val) { m_default_value   = val; }
@@ -193,6 +223,84 @@ namespace asp{
     
   };
 
+  /// Rasterize several textures over the same point cloud, such as the
+  /// heights, the orthoimage and the intersection error, in a single
+  /// pass. The first request for a tile of any of the layers rasterizes
+  /// that tile for all layers. The results are kept until each layer has
+  /// fetched them, so the layers should be written concurrently with the
+  /// same tiles. A tile evicted before that is rasterized again.
+  class OrthoRasterizerLayers {
+  public:
+    OrthoRasterizerLayers(OrthoRasterizerView const& rasterizer,
+                          std::vector<ImageViewRef<float>> const& textures,
+                          int max_num_tiles);
+
+    size_t num_layers() const { return m_textures.size(); }
+    OrthoRasterizerView const& rasterizer() const { return m_rasterizer; }
+
+    /// Return the given layer over the given tile, to be cropped to
+    /// layer_box, as in OrthoRasterizerView::prerasterize().
+    ImageView<PixelGray<float>> fetch(size_t layer, BBox2i const& bbox,
+                                      BBox2i & layer_box);
+
+  private:
+    struct Tile {
+      vw::Mutex mutex;
+      bool done;
+      std::vector<ImageView<PixelGray<float>>> layers;
+      BBox2i layer_box;
+      std::vector<bool> fetched;
+      size_t num_fetched;
+    };
+    typedef std::map<std::vector<int32>, boost::shared_ptr<Tile>> TileMap;
+
+    OrthoRasterizerView m_rasterizer;
+    std::vector<ImageViewRef<float>> m_textures;
+    int m_max_num_tiles;
+    vw::Mutex m_mutex;
+    TileMap m_tiles;
+    std::list<std::vector<int32>> m_tile_order; // oldest first
+  };
+
+  /// One layer of an OrthoRasterizerLayers object, as an image.
+  class OrthoRasterizerLayerView:
+    public ImageViewBase<OrthoRasterizerLayerView> {
+    boost::shared_ptr<OrthoRasterizerLayers> m_layers;
+    size_t m_layer;
+
+  public:
+    typedef PixelGray<float> pixel_type;
+    typedef const PixelGray<float> result_type;
+    typedef ProceduralPixelAccessor<OrthoRasterizerLayerView> pixel_accessor;
+
+    OrthoRasterizerLayerView(boost::shared_ptr<OrthoRasterizerLayers> layers,
+                             size_t layer): m_layers(layers), m_layer(layer) {}
+
+    inline int32 cols  () const { return m_layers->rasterizer().cols(); }
+    inline int32 rows  () const { return m_layers->rasterizer().rows(); }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this); }
+
+    inline result_type operator()( int /*i*/, int /*j*/, int /*p*/=0 ) const {
+      vw_throw(NoImplErr() << "OrthoRasterizerLayerView::operator() has not been implemented.");
+      return pixel_type();
+    }
+
+    /// \cond INTERNAL
+    typedef CropView<ImageView<pixel_type> > prerasterize_type;
+    prerasterize_type prerasterize( BBox2i const& bbox ) const {
+      BBox2i layer_box;
+      ImageView<pixel_type> layer = m_layers->fetch(m_layer, bbox, layer_box);
+      return prerasterize_type(layer, layer_box);
+    }
+
+    template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize(bbox), dest, bbox );
+    }
+    /// \endcond
+  };
+
   /// Snaps the coordinates of a BBox to a grid spacing
   template <size_t N>
   void snap_bbox(const double spacing, BBox<double, N> &bbox ) {
@@ -19,7 +19,14 @@
 
 #include <vw/Image/Statistics.h>
 #include <vw/Math/Statistics.h>
+#include <vw/Core/Settings.h>
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/Thread.h>
+#include <vw/Core/ThreadPool.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <algorithm>
 
 using namespace vw;
 
@@ -56,10 +63,88 @@ void estimate_inliers_bbox(double pct_factor_x, double pct_factor_y, double pct_
   inliers_bbox.grow(Vector3(ex, ey, ez));
 }
 
+// A sampled pixel of the cloud, with its triangulation error
+struct CloudSample {
+  vw::Vector3 point;
+  double error;
+};
+
+// Collect the samples from a band of rows of the sampling grid, and
+// report the progress once done.
+class CloudSampleTask: public vw::Task, private boost::noncopyable {
+  vw::ImageViewRef<vw::Vector3> const& m_proj_points;
+  vw::ImageViewRef<double> const& m_error_image;
+  int m_subsample_amt, m_beg_row, m_end_row;
+  std::vector<CloudSample> & m_samples;
+  vw::Mutex & m_mutex;
+  int & m_num_done;
+  int m_num_tasks;
+  vw::ProgressCallback const& m_progress;
+public:
+  CloudSampleTask(vw::ImageViewRef<vw::Vector3> const& proj_points,
+                  vw::ImageViewRef<double> const& error_image,
+                  int subsample_amt, int beg_row, int end_row,
+                  std::vector<CloudSample> & samples,
+                  vw::Mutex & mutex, int & num_done, int num_tasks,
+                  vw::ProgressCallback const& progress):
+    m_proj_points(proj_points), m_error_image(error_image),
+    m_subsample_amt(subsample_amt), m_beg_row(beg_row), m_end_row(end_row),
+    m_samples(samples), m_mutex(mutex), m_num_done(num_done),
+    m_num_tasks(num_tasks), m_progress(progress) {}
+
+  virtual void operator()() {
+    for (int row = m_beg_row; row < m_end_row; row += m_subsample_amt) {
+      for (int col = 0; col < m_proj_points.cols(); col += m_subsample_amt) {
+        CloudSample sample;
+        sample.point = m_proj_points(col, row);
+        sample.error = m_error_image(col, row);
+        m_samples.push_back(sample);
+      }
+    }
+    vw::Mutex::Lock lock(m_mutex);
+    m_num_done++;
+    m_progress.report_fractional_progress(m_num_done, m_num_tasks);
+  }
+};
+
+// Read the cloud and its error at every subsample_amt-th pixel in each
+// direction. Bands of rows are read in parallel, as the cloud is most
+// likely formed on the fly, and put together in order.
+void sample_cloud(vw::ImageViewRef<vw::Vector3> const& proj_points,
+                  vw::ImageViewRef<double> const& error_image,
+                  int subsample_amt, std::vector<CloudSample> & samples) {
+
+  const int SAMPLED_ROWS_PER_BAND = 4;
+  int band_rows = SAMPLED_ROWS_PER_BAND * subsample_amt;
+  int num_bands = (proj_points.rows() + band_rows - 1) / band_rows;
+
+  TerminalProgressCallback
+    progress("asp", "Bounding box and triangulation error range estimation: ");
+  progress.report_progress(0);
+  std::vector<std::vector<CloudSample>> band_samples(std::max(num_bands, 0));
+  vw::Mutex mutex;
+  int num_done = 0;
+  vw::FifoWorkQueue queue(vw_settings().default_num_threads());
+  for (int band = 0; band < num_bands; band++) {
+    int beg_row = band * band_rows;
+    int end_row = std::min(beg_row + band_rows, proj_points.rows());
+    boost::shared_ptr<CloudSampleTask>
+      task(new CloudSampleTask(proj_points, error_image, subsample_amt,
+                               beg_row, end_row, band_samples[band],
+                               mutex, num_done, num_bands, progress));
+    queue.add_task(task);
+  }
+  queue.join_all();
+  progress.report_finished();
+
+  samples.clear();
+  for (int band = 0; band < num_bands; band++)
+    samples.insert(samples.end(), band_samples[band].begin(), band_samples[band].end());
+}
+
 // Get a generous estimate of the bounding box of the current set
 // while excluding outliers
-void estimate_points_bdbox(vw::ImageViewRef<vw::Vector3> const& proj_points,
-                           vw::ImageViewRef<double> const& error_image,
+void estimate_points_bdbox(std::vector<CloudSample> const& samples,
                            vw::Vector2 const& remove_outliers_params,
                            double estim_max_error,
                            vw::BBox3 & inliers_bbox) {
@@ -68,22 +153,20 @@ void estimate_points_bdbox(vw::ImageViewRef<vw::Vector3> const& proj_points,
   // outliers, then estimate the box from the remaining points, etc.
   
   std::vector<double> x_vals, y_vals, z_vals;
-  for (int col = 0; col < proj_points.cols(); col++){
-    for (int row = 0; row < proj_points.rows(); row++){
+  for (size_t it = 0; it < samples.size(); it++) {
 
-      // Avoid points marked as not valid
-      Vector3 P = proj_points(col, row);
-      if (boost::math::isnan(P.z()))
-        continue;
+    // Avoid points marked as not valid
+    Vector3 const& P = samples[it].point;
+    if (boost::math::isnan(P.z()))
+      continue;
 
-      // Make use of the estimated error, if available
-      if (estim_max_error > 0 && error_image(col, row) > estim_max_error) 
-        continue;
+    // Make use of the estimated error, if available
+    if (estim_max_error > 0 && samples[it].error > estim_max_error) 
+      continue;
 
-      x_vals.push_back(P.x());
-      y_vals.push_back(P.y());
-      z_vals.push_back(P.z());
-    }
+    x_vals.push_back(P.x());
+    y_vals.push_back(P.y());
+    z_vals.push_back(P.z());
   }
 
   double pct_factor     = remove_outliers_params[0]/100.0; // e.g., 0.75
@@ -108,52 +191,38 @@ void estimate_points_bdbox(vw::ImageViewRef<vw::Vector3> const& proj_points,
   return;
 }
 
-// A class to pick some samples to estimate the range of values
-// of a given dataset
-class ErrorRangeEstimAccum: public ReturnFixedType<void> {
-  typedef double accum_type;
-  std::vector<accum_type> m_vals;
-public:
-  typedef accum_type value_type;
-  
-  ErrorRangeEstimAccum() { m_vals.clear(); }
-  
-  void operator()( accum_type const& value ) {
-    // Don't add zero errors, those most likely came from invalid points
-    if (value > 0)
-      m_vals.push_back(value);
-  }
-  
-  int size(){
-    return m_vals.size();
-  }
-  
-  value_type value(Vector2 const& remove_outliers_params){
-    VW_ASSERT(!m_vals.empty(), ArgumentErr() << "ErrorRangeEstimAccum: no valid samples");
-    
-    // How to pick a representative value for maximum error?  The
-    // maximum error itself may be no good, as it could be very
-    // huge, and then sampling the range of errors will be distorted
-    // by that.  The solution adopted here: Find a percentile of the
-    // range of errors, mulitply it by the outlier factor, and
-    // multiply by another factor to ensure we don't underestimate
-    // the maximum. This value may end up being larger than the
-    // largest error, but at least it is is not grossly huge
-    // if just a few of the errors are very large.
-    std::sort(m_vals.begin(), m_vals.end());
-    int    len    = m_vals.size();
-    double pct    = remove_outliers_params[0]/100.0; // e.g., 0.75
-    double factor = remove_outliers_params[1];
-    int    k      = std::min(len - 1, (int)(pct*len));
-    
-    // Care here with empty sets
-      if (k >= 0) 
-        return m_vals[k]*factor*4.0;
-      
-      return 0;
+// Pick a representative value for the maximum error from the samples.
+// Return false if there are no valid ones.
+bool estim_max_tri_error(std::vector<CloudSample> const& samples,
+                         vw::Vector2 const& remove_outliers_params,
+                         double & estim_max_error) {
+
+  // Don't use zero errors, those most likely came from invalid points
+  std::vector<double> vals;
+  for (size_t it = 0; it < samples.size(); it++) {
+    if (samples[it].error > 0)
+      vals.push_back(samples[it].error);
   }
-  
-};
+  if (vals.empty())
+    return false;
+
+  // How to pick a representative value for maximum error?  The
+  // maximum error itself may be no good, as it could be very
+  // huge, and then sampling the range of errors will be distorted
+  // by that.  The solution adopted here: Find a percentile of the
+  // range of errors, mulitply it by the outlier factor, and
+  // multiply by another factor to ensure we don't underestimate
+  // the maximum. This value may end up being larger than the
+  // largest error, but at least it is is not grossly huge
+  // if just a few of the errors are very large.
+  int    len    = vals.size();
+  double pct    = remove_outliers_params[0]/100.0; // e.g., 0.75
+  double factor = remove_outliers_params[1];
+  int    k      = std::max(std::min(len - 1, (int)(pct*len)), 0);
+  std::nth_element(vals.begin(), vals.begin() + k, vals.end());
+  estim_max_error = vals[k]*factor*4.0;
+  return true;
+}
   
 // Sample the image and get generous estimates (but without outliers)
 // of the maximum triangulation error and of the 3D box containing the
@@ -169,6 +238,7 @@ double estim_max_tri_error_and_proj_box(vw::ImageViewRef<vw::Vector3> const& pro
 
   // Start with a 256 (2^8) by 256 sampling of the cloud
   bool success = false;
+  std::vector<CloudSample> samples;
   for (int attempt = 8; attempt <= 18; attempt++){
     
     double sample = (1 << attempt);
@@ -178,25 +248,18 @@ double estim_max_tri_error_and_proj_box(vw::ImageViewRef<vw::Vector3> const& pro
     
     Stopwatch sw2;
     sw2.start();
-    PixelAccumulator<asp::ErrorRangeEstimAccum> error_accum;
-    for_each_pixel(subsample(error_image, subsample_amt),
-                   error_accum,
-                   TerminalProgressCallback
-                   ("asp","Bounding box and triangulation error range estimation: ") );
-    if (error_accum.size() > 0){
-      success = true;
-      estim_max_error = error_accum.value(remove_outliers_params);
-    }
-    sw2.stop();
 
-    asp::estimate_points_bdbox(subsample(proj_points, subsample_amt),
-                               subsample(error_image, subsample_amt),
-                               remove_outliers_params,  estim_max_error,
+    // Each pixel is read only once, for both estimates
+    sample_cloud(proj_points, error_image, subsample_amt, samples);
+    success = estim_max_tri_error(samples, remove_outliers_params, estim_max_error);
+
+    asp::estimate_points_bdbox(samples, remove_outliers_params, estim_max_error,
                                estim_proj_box);
     
     if (estim_proj_box.empty()) 
       success = false;
     
+    sw2.stop();
     vw_out(DebugMessage,"asp") << "Elapsed time: " << sw2.elapsed_seconds() << std::endl;
     if (success || subsample_amt == 1) break;
     vw_out() << "Estimation failed. Check if your cloud is valid. "
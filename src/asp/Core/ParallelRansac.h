@@ -0,0 +1,274 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file ParallelRansac.h
+///
+/// RANSAC with the interface of vw::math::RandomSampleConsensus, but with
+/// the iterations run in batches on multiple threads, and stopping early
+/// once enough iterations were done to find the best model with high
+/// confidence, given the fraction of inliers seen so far. The given
+/// number of iterations is the maximum. The random samples of each
+/// iteration depend only on its index, ties are broken by that index, and
+/// the batches have a fixed size, so the result does not depend on the
+/// number of threads. With one thread, no thread pool is made, so this can
+/// be called from a task which runs in parallel with others.
+///
+/// Scoring a model stops as soon as it cannot have more inliers than the
+/// best model of the earlier batches.
+
+#ifndef __ASP_CORE_PARALLEL_RANSAC_H__
+#define __ASP_CORE_PARALLEL_RANSAC_H__
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Math/RANSAC.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace asp {
+
+  template <class FittingFuncT, class ErrorFuncT>
+  class ParallelRansac {
+  public:
+    typedef typename FittingFuncT::result_type result_type;
+
+    ParallelRansac(FittingFuncT const& fitting_func, ErrorFuncT const& error_func,
+                   int num_iterations, double inlier_threshold,
+                   int min_num_output_inliers,
+                   bool reduce_min_num_output_inliers_if_no_fit = false,
+                   double confidence = 0.999, int num_threads = 0):
+      m_fitting_func(fitting_func), m_error_func(error_func),
+      m_num_iterations(num_iterations), m_inlier_threshold(inlier_threshold),
+      m_min_num_output_inliers(min_num_output_inliers),
+      m_reduce_min_num_output_inliers_if_no_fit(reduce_min_num_output_inliers_if_no_fit),
+      m_confidence(confidence),
+      m_num_threads(num_threads > 0 ? num_threads : vw::vw_settings().default_num_threads()) {}
+
+    /// Find the model which maps p1 to p2 with the most inliers
+    template <class ContainerT1, class ContainerT2>
+    result_type operator()(std::vector<ContainerT1> const& p1,
+                           std::vector<ContainerT2> const& p2) const;
+
+    /// The indices of the points which the model maps within the threshold
+    template <class ContainerT1, class ContainerT2>
+    std::vector<size_t> inlier_indices(result_type const& H,
+                                       std::vector<ContainerT1> const& p1,
+                                       std::vector<ContainerT2> const& p2) const {
+      std::vector<size_t> result;
+      for (size_t i = 0; i < p1.size(); i++)
+        if (m_error_func(H, p1[i], p2[i]) < m_inlier_threshold)
+          result.push_back(i);
+      return result;
+    }
+
+  private:
+
+    // The outcome of one or more iterations
+    struct Best {
+      int    num_inliers;
+      int    iteration;
+      result_type model;
+      Best(): num_inliers(-1), iteration(-1) {}
+      bool better_than(Best const& other) const {
+        return num_inliers > other.num_inliers ||
+          (num_inliers == other.num_inliers && iteration >= 0 &&
+           (other.iteration < 0 || iteration < other.iteration));
+      }
+    };
+
+    // Runs a range of iterations and keeps the best of them
+    template <class ContainerT1, class ContainerT2>
+    class IterationTask: public vw::Task, private boost::noncopyable {
+      ParallelRansac const& m_ransac;
+      std::vector<ContainerT1> const& m_p1;
+      std::vector<ContainerT2> const& m_p2;
+      int m_start, m_end, m_prev_best;
+      Best & m_best;
+    public:
+      IterationTask(ParallelRansac const& ransac,
+                    std::vector<ContainerT1> const& p1, std::vector<ContainerT2> const& p2,
+                    int start, int end, int prev_best, Best & best):
+        m_ransac(ransac), m_p1(p1), m_p2(p2), m_start(start), m_end(end),
+        m_prev_best(prev_best), m_best(best) {}
+
+      void operator()() {
+        size_t num_points = m_p1.size();
+        size_t num_samples = m_ransac.m_fitting_func.min_elements_needed_for_fit(m_p1[0]);
+        std::vector<ContainerT1> s1(num_samples);
+        std::vector<ContainerT2> s2(num_samples);
+        std::vector<size_t> indices(num_samples);
+        for (int it = m_start; it < m_end; it++) {
+
+          // Distinct random samples, depending only on the iteration
+          std::mt19937 gen(it + 1);
+          std::uniform_int_distribution<size_t> dist(0, num_points - 1);
+          for (size_t s = 0; s < num_samples; s++) {
+            size_t index;
+            do {
+              index = dist(gen);
+            } while (std::find(indices.begin(), indices.begin() + s, index)
+                     != indices.begin() + s);
+            indices[s] = index;
+            s1[s] = m_p1[index];
+            s2[s] = m_p2[index];
+          }
+
+          Best curr;
+          curr.iteration = it;
+          try {
+            curr.model = m_ransac.m_fitting_func(s1, s2);
+          } catch (...) {
+            continue; // A degenerate sample
+          }
+
+          // Stop scoring once the model cannot beat the best one so far
+          int bar = std::max(m_prev_best, m_best.num_inliers);
+          int num_inliers = 0;
+          for (size_t i = 0; i < num_points; i++) {
+            if (m_ransac.m_error_func(curr.model, m_p1[i], m_p2[i]) <
+                m_ransac.m_inlier_threshold)
+              num_inliers++;
+            if (num_inliers + int(num_points - i - 1) <= bar)
+              break;
+          }
+          curr.num_inliers = num_inliers;
+          if (curr.better_than(m_best))
+            m_best = curr;
+        }
+      }
+    };
+
+    FittingFuncT m_fitting_func;
+    ErrorFuncT   m_error_func;
+    int    m_num_iterations;
+    double m_inlier_threshold;
+    int    m_min_num_output_inliers;
+    bool   m_reduce_min_num_output_inliers_if_no_fit;
+    double m_confidence;
+    int    m_num_threads;
+  };
+
+  template <class FittingFuncT, class ErrorFuncT>
+  template <class ContainerT1, class ContainerT2>
+  typename ParallelRansac<FittingFuncT, ErrorFuncT>::result_type
+  ParallelRansac<FittingFuncT, ErrorFuncT>::operator()(std::vector<ContainerT1> const& p1,
+                                                       std::vector<ContainerT2> const& p2) const {
+    using namespace vw;
+
+    VW_ASSERT(p1.size() == p2.size(),
+              ArgumentErr() << "RANSAC Error. Data vectors are not the same size.\n");
+    if (p1.empty())
+      vw_throw(math::RANSACErr() << "RANSAC Error. Insufficient data.\n");
+    size_t num_samples = m_fitting_func.min_elements_needed_for_fit(p1[0]);
+    if (p1.size() < num_samples)
+      vw_throw(math::RANSACErr() << "RANSAC Error. Not enough potential matches for "
+               << "this fitting functor. " << p1.size() << "/" << num_samples << "\n");
+
+    // After each batch, the iterations needed are found anew from the
+    // fraction of inliers. The batch size must not depend on the number of
+    // threads, or neither would the iterations done and the model found.
+    const int batch_size = 64;
+    int num_needed = m_num_iterations;
+    Best best;
+    int done = 0;
+    while (done < std::min(num_needed, m_num_iterations)) {
+      int end = std::min(done + batch_size, m_num_iterations);
+      int num_jobs = std::min(m_num_threads, end - done);
+      std::vector<Best> job_best(num_jobs);
+      if (num_jobs == 1) {
+        IterationTask<ContainerT1, ContainerT2>(*this, p1, p2, done, end,
+                                                best.num_inliers, job_best[0])();
+      } else {
+        FifoWorkQueue queue(num_jobs);
+        for (int job = 0; job < num_jobs; job++) {
+          int start_it = done + (end - done) * job / num_jobs;
+          int end_it   = done + (end - done) * (job + 1) / num_jobs;
+          boost::shared_ptr<Task> task
+            (new IterationTask<ContainerT1, ContainerT2>(*this, p1, p2, start_it, end_it,
+                                                         best.num_inliers, job_best[job]));
+          queue.add_task(task);
+        }
+        queue.join_all();
+      }
+      for (int job = 0; job < num_jobs; job++)
+        if (job_best[job].better_than(best))
+          best = job_best[job];
+      done = end;
+
+      // The number of iterations to find, with the given confidence, a
+      // sample made only of inliers
+      double w = double(std::max(best.num_inliers, 0)) / p1.size();
+      double p_good = std::pow(w, double(num_samples));
+      if (p_good >= 1.0) {
+        num_needed = 0;
+      } else if (p_good > 0.0) {
+        double needed = std::log(1.0 - m_confidence) / std::log1p(-p_good);
+        num_needed = (needed < m_num_iterations) ? int(std::ceil(needed)) : m_num_iterations;
+      }
+    }
+
+    if (best.iteration < 0)
+      vw_throw(math::RANSACErr() << "RANSAC was unable to find a fit.\n");
+
+    // Refit on all inliers of the best model, and keep that if not worse
+    std::vector<size_t> indices = inlier_indices(best.model, p1, p2);
+    result_type model = best.model;
+    if (indices.size() >= num_samples) {
+      std::vector<ContainerT1> in1;
+      std::vector<ContainerT2> in2;
+      for (size_t i = 0; i < indices.size(); i++) {
+        in1.push_back(p1[indices[i]]);
+        in2.push_back(p2[indices[i]]);
+      }
+      try {
+        result_type refit = m_fitting_func(in1, in2, best.model);
+        std::vector<size_t> refit_indices = inlier_indices(refit, p1, p2);
+        if (refit_indices.size() >= indices.size()) {
+          model   = refit;
+          indices = refit_indices;
+        }
+      } catch (...) {}
+    }
+
+    int min_num_output_inliers = m_min_num_output_inliers;
+    if (m_reduce_min_num_output_inliers_if_no_fit) {
+      while (int(indices.size()) < min_num_output_inliers &&
+             min_num_output_inliers / 1.5 >= double(num_samples))
+        min_num_output_inliers = min_num_output_inliers / 1.5;
+    }
+    if (int(indices.size()) < min_num_output_inliers)
+      vw_throw(math::RANSACErr() << "RANSAC was unable to find a fit that matched the "
+               << "supplied data. Found " << indices.size() << " inliers, needed "
+               << min_num_output_inliers << ".\n");
+
+    vw_out(DebugMessage, "asp") << "RANSAC stopped after " << done << " of "
+                                << m_num_iterations << " iterations.\n";
+    return model;
+  }
+
+} // end namespace asp
+
+#endif // __ASP_CORE_PARALLEL_RANSAC_H__
@@ -24,11 +24,12 @@
 #include <asp/Core/Common.h>
 #include <asp/Core/PhotometricOutlier.h>
 
-#include <vw/Image/AlgorithmFunctions.h>
-#include <vw/Image/Algorithms.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/Thread.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Image/Filter.h>
-#include <vw/Image/Convolution.h>
 #include <vw/Image/EdgeExtension.h>
+#include <vw/Image/ImageViewRef.h>
 #include <vw/Image/Manipulation.h>
 #include <vw/Image/MaskViews.h>
 #include <vw/Image/Transform.h>
@@ -36,57 +37,262 @@
 #include <vw/Cartography/GeoReferenceUtils.h>
 #include <vw/Stereo/DisparityMap.h>
 
-namespace fs = boost::filesystem;
+#include <boost/noncopyable.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 
 using namespace vw;
 using namespace asp;
 
+namespace {
+
+  // The left image, and the right image projected into the perspective
+  // of the left one with the disparity
+  struct DustInputs {
+    DiskImageView<float> left;
+    DiskImageView<PixelMask<Vector2f>> disparity;
+    ImageViewRef<float> right_proj;
+
+    DustInputs(std::string const& prefix, std::string const& input_disparity):
+      left(prefix + "-L.tif"), disparity(input_disparity) {
+      DiskImageView<float> right(prefix + "-R.tif");
+      right_proj = transform(right, stereo::DisparityTransform(disparity),
+                             ZeroEdgeExtension());
+    }
+
+    // The projected right image and the absolute difference with the
+    // left image over the given box. The difference is zero where
+    // nothing was projected.
+    void difference(BBox2i const& box, ImageView<float> & proj,
+                    ImageView<float> & diff) const {
+      proj = crop(right_proj, box);
+      ImageView<float> left_tile = crop(left, box);
+      diff.set_size(box.width(), box.height());
+      for (int row = 0; row < box.height(); row++) {
+        for (int col = 0; col < box.width(); col++) {
+          float r = proj(col, row);
+          diff(col, row) = (r == 0) ? 0.0f : std::abs(left_tile(col, row) - r);
+        }
+      }
+    }
+  };
+
+  // A histogram of non-negative floats, binned by the upper 16 bits
+  // of their representation, so each bin spans under 1% of its values.
+  // Histograms of parts of an image add up to that of the image.
+  const int DIFF_HIST_BINS = 1 << 15;
+
+  int diff_bin(float val) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &val, sizeof(bits));
+    return int(bits >> 16);
+  }
+
+  float diff_bin_start(int bin) {
+    std::uint32_t bits = std::uint32_t(bin) << 16;
+    float val;
+    std::memcpy(&val, &bits, sizeof(val));
+    return val;
+  }
+
+  class DiffHistogramTask: public vw::Task, private boost::noncopyable {
+    DustInputs const& m_inputs;
+    BBox2i m_box;
+    vw::Mutex & m_mutex;
+    std::vector<std::int64_t> & m_hist;
+  public:
+    DiffHistogramTask(DustInputs const& inputs, BBox2i const& box,
+                      vw::Mutex & mutex, std::vector<std::int64_t> & hist):
+      m_inputs(inputs), m_box(box), m_mutex(mutex), m_hist(hist) {}
+
+    virtual void operator()() {
+      ImageView<float> proj, diff;
+      m_inputs.difference(m_box, proj, diff);
+      std::vector<std::int64_t> hist(DIFF_HIST_BINS, 0);
+      for (int row = 0; row < diff.rows(); row++) {
+        for (int col = 0; col < diff.cols(); col++) {
+          float val = diff(col, row);
+          if (val == val) // skip NaN
+            hist[diff_bin(val)]++;
+        }
+      }
+      vw::Mutex::Lock lock(m_mutex);
+      for (int bin = 0; bin < DIFF_HIST_BINS; bin++)
+        m_hist[bin] += hist[bin];
+    }
+  };
+
+  // The given quantile of the differences of the images, interpolated
+  // within the bin it falls in. The tiles are processed in parallel.
+  float difference_quantile(DustInputs const& inputs, double quantile) {
+
+    const int TILE_SIZE = 1024;
+    std::vector<BBox2i> boxes
+      = subdivide_bbox(inputs.right_proj, TILE_SIZE, TILE_SIZE);
+
+    std::vector<std::int64_t> hist(DIFF_HIST_BINS, 0);
+    vw::Mutex mutex;
+    vw::FifoWorkQueue queue(vw_settings().default_num_threads());
+    for (size_t it = 0; it < boxes.size(); it++) {
+      boost::shared_ptr<DiffHistogramTask>
+        task(new DiffHistogramTask(inputs, boxes[it], mutex, hist));
+      queue.add_task(task);
+    }
+    queue.join_all();
+
+    std::int64_t total = 0;
+    for (int bin = 0; bin < DIFF_HIST_BINS; bin++)
+      total += hist[bin];
+    double target = quantile * total, count = 0.0;
+    for (int bin = 0; bin < DIFF_HIST_BINS - 1; bin++) {
+      if (hist[bin] == 0 || count + hist[bin] < target) {
+        count += hist[bin];
+        continue;
+      }
+      double frac = (target - count) / hist[bin];
+      float beg = diff_bin_start(bin), end = diff_bin_start(bin + 1);
+      return beg + frac * (end - beg);
+    }
+    return 0.0f;
+  }
+
+  /// The disparity with the pixels near photometric outliers masked.
+  /// A pixel is an outlier if its difference exceeds the threshold. The
+  /// distances to the outliers, blurred, must exceed the kernel size.
+  /// Each tile is found from the images over the tile grown by a halo,
+  /// with the same result as when processing the whole image at once.
+  class DustMaskedDisparityView:
+    public ImageViewBase<DustMaskedDisparityView> {
+    DustInputs const& m_inputs;
+    float m_thresh;
+    int m_kernel_size, m_blur_halo, m_max_dist;
+    std::vector<float> m_kernel;
+
+  public:
+    typedef PixelMask<Vector2f> pixel_type;
+    typedef pixel_type result_type;
+    typedef ProceduralPixelAccessor<DustMaskedDisparityView> pixel_accessor;
+
+    DustMaskedDisparityView(DustInputs const& inputs, float thresh, int kernel_size):
+      m_inputs(inputs), m_thresh(thresh), m_kernel_size(kernel_size) {
+      generate_gaussian_kernel(m_kernel, kernel_size/3);
+      if (m_kernel.empty())
+        m_kernel.push_back(1.0f);
+      m_blur_halo = int(m_kernel.size()) / 2;
+
+      // The distances change by at most one per pixel, so, within the
+      // blur kernel, if one exceeds this, all blurred values there exceed
+      // the kernel size. Hence the distances can be capped at this, and
+      // found within this of where they are blurred.
+      m_max_dist = kernel_size + 4 * m_blur_halo + 1;
+    }
+
+    inline int32 cols  () const { return m_inputs.disparity.cols(); }
+    inline int32 rows  () const { return m_inputs.disparity.rows(); }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this); }
+
+    inline result_type operator()(int i, int j, int /*p*/ = 0) const {
+      return prerasterize(BBox2i(i, j, 1, 1))(i, j);
+    }
+
+    /// \cond INTERNAL
+    typedef CropView<ImageView<pixel_type>> prerasterize_type;
+    prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+      BBox2i image_box = bounding_box(m_inputs.disparity);
+      BBox2i blur_box = bbox;
+      blur_box.expand(m_blur_halo);
+      blur_box.crop(image_box);
+      BBox2i dist_box = blur_box;
+      dist_box.expand(m_max_dist);
+      dist_box.crop(image_box);
+
+      ImageView<float> proj, diff;
+      m_inputs.difference(dist_box, proj, diff);
+
+      // The city-block distance to the nearest outlier, at most
+      // m_max_dist. Outside the image counts as an outlier, and outside
+      // the box in the image as far away. Image edges are handled as
+      // by vw::grassfire().
+      int nc = dist_box.width(), nr = dist_box.height();
+      ImageView<int> dist(nc, nr);
+      int left   = (dist_box.min().x() == 0) ? 0 : m_max_dist;
+      int top    = (dist_box.min().y() == 0) ? 0 : m_max_dist;
+      int right  = (dist_box.max().x() == image_box.max().x()) ? 0 : m_max_dist;
+      int bottom = (dist_box.max().y() == image_box.max().y()) ? 0 : m_max_dist;
+      for (int row = 0; row < nr; row++) {
+        for (int col = 0; col < nc; col++) {
+          if (diff(col, row) > m_thresh) {
+            dist(col, row) = 0;
+            continue;
+          }
+          int d = std::min(col > 0 ? dist(col-1, row) : left,
+                           row > 0 ? dist(col, row-1) : top);
+          dist(col, row) = std::min(d + 1, m_max_dist);
+        }
+      }
+      for (int row = nr - 1; row >= 0; row--) {
+        for (int col = nc - 1; col >= 0; col--) {
+          int d = std::min(col < nc - 1 ? dist(col+1, row) : right,
+                           row < nr - 1 ? dist(col, row+1) : bottom);
+          dist(col, row) = std::min(dist(col, row), d + 1);
+        }
+      }
+
+      Vector2i blur_off = blur_box.min() - dist_box.min();
+      ImageView<float> grass(blur_box.width(), blur_box.height());
+      for (int row = 0; row < grass.rows(); row++) {
+        for (int col = 0; col < grass.cols(); col++)
+          grass(col, row) = dist(col + blur_off.x(), row + blur_off.y());
+      }
+      BBox2i tile_in_blur = bbox - blur_box.min();
+      ImageView<float> blurred
+        = crop(separable_convolution_filter(grass, m_kernel, m_kernel,
+                                            ConstantEdgeExtension()),
+               tile_in_blur);
+
+      ImageView<pixel_type> tile = crop(m_inputs.disparity, bbox);
+      Vector2i tile_off = bbox.min() - dist_box.min();
+      for (int row = 0; row < tile.rows(); row++) {
+        for (int col = 0; col < tile.cols(); col++) {
+          if (proj(col + tile_off.x(), row + tile_off.y()) == 0 ||
+              !(blurred(col, row) > m_kernel_size))
+            invalidate(tile(col, row));
+        }
+      }
+
+      return prerasterize_type(tile, BBox2i(-bbox.min().x(), -bbox.min().y(),
+                                            cols(), rows()));
+    }
+
+    template <class DestT> inline void rasterize(DestT const& dest, BBox2i const& bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+    /// \endcond
+  };
+
+} // end anonymous namespace
+
+// Both passes over the images are done tile by tile in parallel, with
+// no intermediate images. The first one finds the threshold from all
+// differences, and the second one writes the filtered disparity.
 void asp::photometric_outlier_rejection(vw::GdalWriteOptions const& opt,
                                         std::string const& prefix,
                                         std::string const& input_disparity,
                                         std::string & output_disparity,
                                         int kernel_size) {
-  // Projecting right into perspective of left
-  DiskImageView<PixelGray<float>> right_disk_image(prefix+"-R.tif");
-  DiskImageView<PixelMask<Vector2f>> disparity_disk_image( input_disparity );
-  stereo::DisparityTransform trans( disparity_disk_image );
-
-  std::string cache_dir = "/tmp"; // modify here to use a different cache dir if needed
-  if (!fs::is_directory(cache_dir)) {
-    vw_out() << "\nCreating cache directory: " << cache_dir << std::endl;
-    fs::create_directories(cache_dir);
-  }
-
-  DiskCacheImageView<PixelGray<float>>
-    right_proj( transform( right_disk_image, trans, ZeroEdgeExtension()),
-                "tif", TerminalProgressCallback("asp","Projecting R:"), cache_dir);
-
-  // Differencing Left and Projected Right
-  ImageViewRef<PixelMask<PixelGray<float32>>> right_mask =
-    create_mask(right_proj);
-  DiskImageView<PixelGray<float32>> left_image(prefix+"-L.tif");
-  DiskCacheImageView<PixelGray<float>>
-    diff( abs(apply_mask(copy_mask(left_image,right_mask))-right_proj),
-          "tif", TerminalProgressCallback("asp","\tDifference:"),
-          cache_dir);
-  ChannelAccumulator<math::CDFAccumulator<float32>> cdf;
-  cdf.resize(8000,2001);
-  for_each_pixel(diff, cdf);
-  float thresh = cdf.quantile(0.99985); // Pulling out last bin of CDF
-  vw_out() << "\t  Using threshold: " << thresh << "\n";
 
-  // Thresholding image and dilating
-  ImageView<PixelGray<float>> dust =
-    threshold(apply_mask(copy_mask(diff,right_mask)),thresh,1.0,0.0);
-  ImageView<PixelGray<float>> grass;
-  grassfire(dust,grass);
-  dust = gaussian_filter(grass,kernel_size/3);
+  DustInputs inputs(prefix, input_disparity);
 
-  ImageViewRef<PixelMask<Vector2f>> cleaned_disparity =
-    intersect_mask(disparity_disk_image,
-                   intersect_mask(create_mask(threshold(dust,kernel_size,0.0,1.0)),right_mask));
+  float thresh = difference_quantile(inputs, 0.99985); // the last bin of the CDF
+  vw_out() << "\t  Using threshold: " << thresh << "\n";
 
-  vw::cartography::block_write_gdal_image(prefix + "-FDust.tif",
-                          cleaned_disparity, opt,
+  output_disparity = prefix + "-FDust.tif";
+  vw::cartography::block_write_gdal_image(output_disparity,
+                          DustMaskedDisparityView(inputs, thresh, kernel_size), opt,
                           TerminalProgressCallback("asp", "Dust Removal:") );
 }
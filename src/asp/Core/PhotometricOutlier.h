@@ -31,6 +31,9 @@ namespace vw{
 }
 
 namespace asp {
+  /// Mask the disparity near where the left image and the right image
+  /// projected through the disparity differ the most. The result is
+  /// written to <prefix>-FDust.tif, whose name is returned.
   void photometric_outlier_rejection(vw::GdalWriteOptions const& opt,
                                       std::string const& prefix,
                                       std::string const& input_disparity,
@@ -40,8 +40,12 @@ Point2Grid::Point2Grid(int width, int height,
                        FilterType filter, double percentile):
   m_width(width), m_height(height),
   m_buffer(buffer), m_weights(weights),
+  m_vals_memory("point2dem gridded values", 0, false),
   m_x0(x0), m_y0(y0), m_grid_size(grid_size),
   m_radius(radius), m_filter(filter), m_percentile(percentile){
+
+  m_keep_vals = (m_filter == f_median || m_filter == f_stddev ||
+                 m_filter == f_nmad   || m_filter == f_percentile);
   
   if (m_grid_size <= 0)
     vw_throw( ArgumentErr() << "Point2Grid: Grid size must be > 0.\n" );
@@ -91,11 +95,8 @@ void Point2Grid::Clear(const float value) {
 
   // For these we need to keep all values (in fact, for stddev we could get away with less,
   // but it is not worth trying so hard).
-  if (m_filter == f_median || m_filter == f_stddev ||
-      m_filter == f_nmad   || m_filter == f_percentile) {
-    m_vals.set_size(m_width, m_height);
-  }
-  
+  m_val_cells.clear();
+  m_vals.clear();
 }
 
 void Point2Grid::AddPoint(double x, double y, double z){
@@ -152,7 +153,10 @@ void Point2Grid::AddPoint(double x, double y, double z){
         
       }else if (m_filter == f_stddev || m_filter == f_median ||
                 m_filter == f_nmad   || m_filter == f_percentile){
-        m_vals(ix, iy).push_back(z); // not strictly needed for stddev
+        m_val_cells.push_back(iy*m_buffer.cols() + ix); // not strictly needed for stddev
+        m_vals.push_back(z);
+        if (vals_bytes() > m_vals_memory.size())
+          m_vals_memory.resize(vals_bytes()); // the arena grew
       }
       
     }
@@ -161,6 +165,32 @@ void Point2Grid::AddPoint(double x, double y, double z){
 }
 
 void Point2Grid::normalize(){
+
+  // Group the kept values by cell with a counting sort. Afterwards the
+  // values for cell k are in m_vals[offsets[k]], ..., m_vals[offsets[k+1] - 1].
+  std::vector<size_t> offsets;
+  if (m_keep_vals) {
+    size_t num_cells = size_t(m_buffer.cols()) * size_t(m_buffer.rows());
+    offsets.assign(num_cells + 1, 0);
+    for (size_t it = 0; it < m_val_cells.size(); it++)
+      offsets[m_val_cells[it] + 1]++;
+    for (size_t k = 0; k < num_cells; k++)
+      offsets[k + 1] += offsets[k];
+
+    std::vector<size_t> pos(offsets.begin(), offsets.end() - 1);
+    std::vector<double> sorted_vals(m_vals.size());
+    m_vals_memory.resize(vals_bytes() + sorted_vals.capacity() * sizeof(double));
+    for (size_t it = 0; it < m_vals.size(); it++)
+      sorted_vals[pos[m_val_cells[it]]++] = m_vals[it];
+
+    // Release the unsorted arena right away
+    std::vector<vw::int32>().swap(m_val_cells);
+    m_vals.swap(sorted_vals);
+    std::vector<double>().swap(sorted_vals);
+    m_vals_memory.resize(vals_bytes());
+  }
+
+  std::vector<double> cell_vals; // reused for each cell
   for (int c = 0; c < m_buffer.cols(); c++){
     for (int r = 0; r < m_buffer.rows(); r++){
 
@@ -168,41 +198,52 @@ void Point2Grid::normalize(){
         if (m_weights(c, r) > 0)
           m_buffer (c, r) /= m_weights(c, r);
 
-      }else if (m_filter == f_count)
+      }else if (m_filter == f_count){
         m_buffer(c, r) = m_weights(c, r); // hence instead of no-data we will have always 0
+        continue;
+      }
+
+      if (!m_keep_vals)
+        continue;
+
+      size_t cell = size_t(r) * size_t(m_buffer.cols()) + size_t(c);
+      size_t beg = offsets[cell], end = offsets[cell + 1];
+      if (beg == end)
+        continue; // nothing to compute
 
-      else if (m_filter == f_stddev){
-        if (m_vals(c, r).empty())
-          continue; // nothing to compute
+      if (m_filter == f_stddev){
         vw::math::StdDevAccumulator<double> V;
-        for (size_t it = 0; it < m_vals(c, r).size(); it++) 
-          V(m_vals(c, r)[it]);
+        for (size_t it = beg; it < end; it++) 
+          V(m_vals[it]);
         m_buffer(c, r) = V.value();
       }
       
       else if (m_filter == f_median){
-        if (m_vals(c, r).empty())
-          continue; // nothing to compute
         vw::math::MedianAccumulator<double> V;
-        for (size_t it = 0; it < m_vals(c, r).size(); it++) 
-          V(m_vals(c, r)[it]);
+        for (size_t it = beg; it < end; it++) 
+          V(m_vals[it]);
         m_buffer(c, r) = V.value();
       }
 
       else if (m_filter == f_nmad){
-        if (m_vals(c, r).empty())
-          continue; // nothing to compute
-        m_buffer(c, r) = vw::math::destructive_nmad(m_vals(c, r));
+        cell_vals.assign(m_vals.begin() + beg, m_vals.begin() + end);
+        m_buffer(c, r) = vw::math::destructive_nmad(cell_vals);
       }
       
       else if (m_filter == f_percentile){
-        if (m_vals(c, r).empty())
-          continue; // nothing to compute
-        m_buffer(c, r) = vw::math::destructive_percentile(m_vals(c, r), m_percentile);
+        cell_vals.assign(m_vals.begin() + beg, m_vals.begin() + end);
+        m_buffer(c, r) = vw::math::destructive_percentile(cell_vals, m_percentile);
       }
       
     }
   }
+
+  std::vector<double>().swap(m_vals);
+  m_vals_memory.resize(0);
+}
+
+std::uint64_t Point2Grid::vals_bytes() const {
+  return m_vals.capacity() * sizeof(double) + m_val_cells.capacity() * sizeof(vw::int32);
 }
   
 } // end namespace asp
@@ -23,6 +23,9 @@
 #define __VW_POINT2GRID_H__
 
 #include <vw/Image/ImageView.h>
+#include <asp/Core/MemoryBudget.h>
+
+#include <vector>
 
 namespace asp {
 
@@ -33,7 +36,7 @@ namespace asp {
   /// Given a set of xyz points, create an xy grid. For every node in the
   /// grid, combine all points within given radius of the grid point and
   /// calculate a single z value at the grid point.
-  class Point2Grid {
+  class Point2Grid: private boost::noncopyable {
 
   public:
     Point2Grid(int width, int height,
@@ -51,7 +54,14 @@ namespace asp {
     int m_width, m_height; // DEM dimensions
     vw::ImageView<double> & m_buffer;
     vw::ImageView<double> & m_weights;
-    vw::ImageView< std::vector<double> > m_vals; // when need to keep all individual values
+    // When all individual values need to be kept, they are appended to
+    // one arena, together with the index of the grid cell they belong
+    // to, and grouped by cell only in normalize(). A vector for each
+    // cell would take several times more memory on dense lidar tiles.
+    bool m_keep_vals;
+    std::vector<vw::int32> m_val_cells;
+    std::vector<double>    m_vals;
+    MemoryReservation      m_vals_memory; // counts the arena in the memory budget
     double     m_x0, m_y0; // lower-left corner
     double     m_grid_size;  // spacing between output DEM pixels
     double     m_radius;   // how far to search for cloud points
@@ -60,6 +70,8 @@ namespace asp {
     FilterType m_filter;
     double     m_percentile; // The actual value of the percentile to use if in that mode
 
+    // The bytes taken by the arena
+    std::uint64_t vals_bytes() const;
   };
 
 }
@@ -0,0 +1,104 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file PointSampler.cc
+///
+
+#include <asp/Core/PointSampler.h>
+
+#include <algorithm>
+#include <limits>
+
+namespace asp {
+
+namespace {
+  // Order by key, so the heap has the largest key on top
+  bool key_less(PointSampler::Point const& a, PointSampler::Point const& b) {
+    return PointSampler::key(a.index) < PointSampler::key(b.index);
+  }
+  bool index_less(PointSampler::Point const& a, PointSampler::Point const& b) {
+    return a.index < b.index;
+  }
+}
+
+PointSampler::PointSampler(std::int64_t max_num_points):
+  m_max_num_points(std::max(max_num_points, std::int64_t(0))),
+  m_threshold(std::numeric_limits<std::uint64_t>::max()) {
+  if (m_max_num_points == 0)
+    m_threshold = 0;
+}
+
+// The splitmix64 finalizer. Each step is invertible.
+std::uint64_t PointSampler::key(std::uint64_t index) {
+  std::uint64_t z = index + 0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+void PointSampler::add_locked(Point const& p) {
+  if (key(p.index) >= m_threshold.load())
+    return;
+
+  if (std::int64_t(m_points.size()) < m_max_num_points) {
+    m_points.push_back(p);
+    if (std::int64_t(m_points.size()) == m_max_num_points) {
+      std::make_heap(m_points.begin(), m_points.end(), key_less);
+      m_threshold = key(m_points.front().index);
+    }
+    return;
+  }
+
+  // Full. Replace the point with the largest key.
+  std::pop_heap(m_points.begin(), m_points.end(), key_less);
+  m_points.back() = p;
+  std::push_heap(m_points.begin(), m_points.end(), key_less);
+  m_threshold = key(m_points.front().index);
+}
+
+void PointSampler::add(std::uint64_t index, vw::Vector3 const& xyz, double lon) {
+  Point p;
+  p.index = index;
+  p.xyz   = xyz;
+  p.lon   = lon;
+  vw::Mutex::Lock lock(m_mutex);
+  add_locked(p);
+}
+
+void PointSampler::add(std::vector<Point> & points) {
+  {
+    vw::Mutex::Lock lock(m_mutex);
+    for (size_t i = 0; i < points.size(); i++)
+      add_locked(points[i]);
+  }
+  points.clear();
+}
+
+std::int64_t PointSampler::size() const {
+  vw::Mutex::Lock lock(m_mutex);
+  return m_points.size();
+}
+
+void PointSampler::get(std::vector<Point> & points) {
+  vw::Mutex::Lock lock(m_mutex);
+  points.clear();
+  points.swap(m_points);
+  std::sort(points.begin(), points.end(), index_less);
+  m_threshold = (m_max_num_points == 0) ? 0 : std::numeric_limits<std::uint64_t>::max();
+}
+
+} // end namespace asp
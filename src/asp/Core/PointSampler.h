@@ -0,0 +1,84 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file PointSampler.h
+///
+/// A uniform random sample of at most a given number of points, taken
+/// in one pass as a point cloud is read. Each point gets a pseudo-random
+/// key from its index in the file, and the points with the smallest keys
+/// are kept. So the sample does not depend on the order in which the
+/// points arrive or on how many threads add them, and a point whose key
+/// is not below the threshold can be skipped before it is even parsed.
+/// Memory is proportional to the sample size, not to the file size.
+
+#ifndef __ASP_CORE_POINT_SAMPLER_H__
+#define __ASP_CORE_POINT_SAMPLER_H__
+
+#include <vw/Core/Thread.h>
+#include <vw/Math/Vector.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace asp {
+
+  class PointSampler: private boost::noncopyable {
+  public:
+
+    struct Point {
+      std::uint64_t index; // position in the file, which gives the key
+      vw::Vector3   xyz;
+      double        lon;   // as it was in the file, if known
+    };
+
+    /// Keep at most this many points. Zero or less keeps none.
+    explicit PointSampler(std::int64_t max_num_points);
+
+    /// A hash of the index, which is a bijection, so no two points tie
+    static std::uint64_t key(std::uint64_t index);
+
+    /// A point whose key is not below this cannot enter the sample.
+    /// It only decreases, so a stale value is still safe to use.
+    std::uint64_t threshold() const { return m_threshold.load(); }
+
+    /// Add a point. Thread-safe.
+    void add(std::uint64_t index, vw::Vector3 const& xyz, double lon = 0.0);
+
+    /// Add a batch of points under just one lock, and clear it. Thread-safe.
+    void add(std::vector<Point> & points);
+
+    std::int64_t size() const;
+
+    /// Move out the sampled points, sorted by index, so in file order
+    void get(std::vector<Point> & points);
+
+  private:
+    void add_locked(Point const& p);
+
+    std::int64_t m_max_num_points;
+    std::vector<Point> m_points; // a max-heap by key once full
+    std::atomic<std::uint64_t> m_threshold;
+    mutable vw::Mutex m_mutex;
+  };
+
+} // end namespace asp
+
+#endif // __ASP_CORE_POINT_SAMPLER_H__
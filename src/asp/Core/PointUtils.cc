@@ -25,11 +25,19 @@
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/MappedTextFile.h>
 #include <vw/Cartography/Chipper.h>
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/Thread.h>
 #include <boost/math/special_functions/fpclassify.hpp>
 #include <boost/math/special_functions/next.hpp>
 
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <list>
+#include <map>
+
 using namespace vw;
 using namespace vw::cartography;
 using namespace pdal::filters;
@@ -127,6 +135,34 @@ namespace asp{
       return m_curr_point;
     }
 
+    virtual bool has_raw_records() const { return true; }
+
+    // Read the next line, without parsing it, except for the first
+    // line, which is skipped if it is a header.
+    virtual bool ReadNextRawRecord(std::string & record){
+      while (1){
+        if (!static_cast<bool>(getline(*m_ifs, record, '\n')))
+          return false; // reached end of file
+        if (!m_is_first_line)
+          return true;
+        bool success = false;
+        m_csv_conv.parse_csv_line(m_is_first_line, success, record);
+        if (success)
+          return true;
+      }
+    }
+
+    virtual bool RawRecordToPoint(std::string const& record, GeoReference const& georef,
+                                  Vector3 & point) const {
+      bool is_first_line = false, success = false;
+      asp::CsvConv::CsvRecord vals = m_csv_conv.parse_csv_line(is_first_line, success, record);
+      if (!success)
+        return false;
+      bool return_point_height = true; // as in ReadNextPoint()
+      point = m_csv_conv.csv_to_cartesian_or_point_height(vals, georef, return_point_height);
+      return true;
+    }
+
     virtual ~CsvReader(){
       delete m_ifs;
       m_ifs = NULL;
@@ -280,16 +316,40 @@ namespace asp{
 
 
 
+  MappedPointReader::MappedPointReader(std::string const& file):
+    m_file(new MappedPointFile(file)), m_index(-1) {
+    // The points are in Cartesian coordinates, as for PCD files
+    m_has_georef = false;
+    m_num_points = m_file->num_points();
+  }
+
+  bool MappedPointReader::ReadNextPoint(){
+    if (m_index + 1 >= m_num_points)
+      return false;
+    m_index++;
+    return true;
+  }
+
+  Vector3 MappedPointReader::GetPoint(){
+    return m_file->point(m_index);
+  }
+
   std::int64_t pcd_file_size(std::string const& file) {
+    if (MappedPointFile::is_mappable(file))
+      return MappedPointFile(file).num_points();
+    if (!is_pcd(file))
+      vw_throw(ArgumentErr() << "Only binary PLY files are supported: " << file << "\n");
     PcdReader reader(file);
     return reader.m_num_points;
   }
 
 
   /// Create a point cloud image from a las file. The image will be
-  /// created block by block, when it needs to be written to disk. It is
-  /// important that the writer invoking this image be single-threaded,
-  /// as we read from the las file sequentially.
+  /// created block by block, when it needs to be written to disk. The
+  /// input file is read sequentially, so each block gets the next chunk
+  /// of points. Only the reading is serialized. Parsing and projecting
+  /// CSV lines, and binning the points with the chipper, are done in
+  /// parallel for all blocks being written.
   template <class ImageT>
   class LasOrCsvToTif_Class : public ImageViewBase< LasOrCsvToTif_Class<ImageT> > {
 
@@ -298,6 +358,7 @@ namespace asp{
     asp::BaseReader * m_reader;
     int m_rows, m_cols; // These are pixel sizes, not tile counts.
     int m_block_size;
+    boost::shared_ptr<vw::Mutex> m_read_mutex; // shared by copies of this view
 
   public:
 
@@ -306,7 +367,7 @@ namespace asp{
     typedef ProceduralPixelAccessor<LasOrCsvToTif_Class> pixel_accessor;
 
     LasOrCsvToTif_Class(asp::BaseReader * reader, int num_rows, int tile_len, int block_size):
-      m_reader(reader), m_block_size(block_size){
+      m_reader(reader), m_block_size(block_size), m_read_mutex(new vw::Mutex){
 
       std::int64_t num_points = m_reader->m_num_points;
       int num_row_tiles = std::max(1, (int)ceil(double(num_rows)/tile_len));
@@ -340,22 +401,43 @@ namespace asp{
                 ArgumentErr() << "LasOrCsvToTif_Class: Expecting the number of rows "
                               << "to be a multiple of the block size.\n");
 
+      // Each thread uses its own copy of the georef
+      GeoReference georef = m_reader->m_georef;
+
       // Read the specified number of points from the file
       std::int64_t max_num_pts_to_read = num_cols * num_rows;
       std::int64_t count = 0;
       PointBuffer in;
-      while (m_reader->ReadNextPoint()){
-        in.push_back(m_reader->GetPoint());
-        count++;
-        if (count >= max_num_pts_to_read)
-          break;
+      if (m_reader->has_raw_records()) {
+        std::vector<std::string> records;
+        {
+          vw::Mutex::Lock lock(*m_read_mutex);
+          std::string record;
+          while (count < max_num_pts_to_read && m_reader->ReadNextRawRecord(record)){
+            records.push_back(record);
+            count++;
+          }
+        }
+        Vector3 point;
+        for (size_t it = 0; it < records.size(); it++) {
+          if (m_reader->RawRecordToPoint(records[it], georef, point))
+            in.push_back(point);
+        }
+      } else {
+        vw::Mutex::Lock lock(*m_read_mutex);
+        while (m_reader->ReadNextPoint()){
+          in.push_back(m_reader->GetPoint());
+          count++;
+          if (count >= max_num_pts_to_read)
+            break;
+        }
       }
 
       // Take the points just read, and put them in groups by spatial
       // location, so that later point2dem does not need to read every
       // input point when writing a given tile, but only certain groups.
       ImageView<Vector3> Img;
-      Chipper(in, m_block_size, m_reader->m_has_georef, m_reader->m_georef,
+      Chipper(in, m_block_size, m_reader->m_has_georef, georef,
               num_cols, num_rows, Img);
 
       VW_ASSERT(num_cols == Img.cols() && num_rows == Img.rows(),
@@ -547,6 +629,7 @@ asp::CsvConv::CsvRecord asp::CsvConv::parse_csv_line(bool & is_first_line, bool
   const int bufSize = 2048;
   char temp[bufSize];
   strncpy(temp, line.c_str(), bufSize);
+  temp[bufSize - 1] = '\0';
 
   std::string sep = asp::csv_separator();
 
@@ -564,12 +647,14 @@ asp::CsvConv::CsvRecord asp::CsvConv::parse_csv_line(bool & is_first_line, bool
     return values;
   }
 
+  // Use strtok_r(), as lines may be parsed by several threads at once
   char * ptr = temp;
+  char * saveptr = NULL;
   while(1){
 
     col_index++; // Increment the column counter
-    const char* token = strtok(ptr, sep.c_str());  // Split line on seperator char
-    ptr = NULL; // After the first call, strtok expects a null pointer as input.
+    const char* token = strtok_r(ptr, sep.c_str(), &saveptr);  // Split line on seperator char
+    ptr = NULL; // After the first call, strtok_r expects a null pointer as input.
     if (token == NULL) break; // no more tokens
     if (num_values_read >= this->num_targets) break; // read enough values
 
@@ -581,9 +666,9 @@ asp::CsvConv::CsvRecord asp::CsvConv::parse_csv_line(bool & is_first_line, bool
       values.file = token;
     else {
       // Parse the floating point value from the token
-      double val;
-      int flag = sscanf(token, "%lg", &val);
-      if (flag == 0){ // Handle parsing failure
+      char * end = NULL;
+      double val = strtod(token, &end);
+      if (end == token){ // Handle parsing failure
         success = false;
         break;
       }
@@ -609,28 +694,65 @@ asp::CsvConv::CsvRecord asp::CsvConv::parse_csv_line(bool & is_first_line, bool
 }
 
 
+namespace {
+
+  // Parse the lines of chunks of a CSV file, each chunk by its own thread
+  class CsvChunkReader {
+    asp::MappedTextFile const& m_file;
+    asp::CsvConv const& m_csv_conv;
+    std::map<int, std::vector<asp::CsvConv::CsvRecord>> m_records; // by chunk
+    vw::Mutex m_mutex;
+  public:
+    CsvChunkReader(asp::MappedTextFile const& file, asp::CsvConv const& csv_conv):
+      m_file(file), m_csv_conv(csv_conv) {}
+
+    void operator()(int chunk, size_t begin, size_t end) {
+      std::vector<asp::CsvConv::CsvRecord> records;
+      std::string line;
+      bool success = false, first_line = false;
+      size_t pos = begin;
+      while (pos < end) {
+        pos = m_file.read_line(pos, line);
+        asp::CsvConv::CsvRecord record = m_csv_conv.parse_csv_line(first_line, success, line);
+        if (success)
+          records.push_back(record);
+      }
+      vw::Mutex::Lock lock(m_mutex);
+      m_records[chunk].swap(records);
+    }
+
+    // Append the records, in the order of the lines in the file
+    void get(std::list<asp::CsvConv::CsvRecord> & output_list) const {
+      for (auto it = m_records.begin(); it != m_records.end(); it++)
+        output_list.insert(output_list.end(), it->second.begin(), it->second.end());
+    }
+  };
+
+}
+
 size_t asp::CsvConv::read_csv_file(std::string    const & file_path,
 				   std::list<CsvRecord> & output_list) const {
   // Clear output object
   output_list.clear();
 
-  // Open input file
-  std::ifstream file( file_path.c_str() );
-  if (!file)
-    vw_throw(vw::IOErr() << "Unable to open file \"" << file_path << "\"");
+  // Map the input file into memory
+  asp::MappedTextFile file(file_path);
 
-  // Read through all the lines of the input file, parse each line, and build the output list.
+  // Parse the first line on its own, as it may be the header. The
+  // other lines are parsed in parallel.
   bool success;
   bool first_line = true;
   std::string line = "";
-  while ( std::getline(file, line, '\n') ){
+  size_t pos = file.read_line(0, line);
+  if (file.size() > 0) {
     CsvRecord new_record = asp::CsvConv::parse_csv_line(first_line, success, line);
     if (success)
       output_list.push_back(new_record);
-    first_line = false;
   }
 
-  file.close();
+  CsvChunkReader reader(file, *this);
+  asp::for_each_text_chunk(file, pos, reader);
+  reader.get(output_list);
 
   return output_list.size();
 }
@@ -872,7 +994,12 @@ void asp::las_or_csv_to_tif(std::string const& in_file,
     reader_ptr = boost::shared_ptr<asp::CsvReader>
       (new asp::CsvReader(in_file, csv_conv, csv_georef));
 
-  }else if (asp::is_pcd(in_file)){ // PCD
+  }else if (asp::MappedPointFile::is_mappable(in_file)){ // binary PCD or PLY
+
+    reader_ptr = boost::shared_ptr<asp::MappedPointReader>
+      (new asp::MappedPointReader(in_file));
+
+  }else if (asp::is_pcd(in_file)){ // text PCD
 
     reader_ptr = boost::shared_ptr<asp::PcdReader>( new asp::PcdReader(in_file) );
 
@@ -889,8 +1016,11 @@ void asp::las_or_csv_to_tif(std::string const& in_file,
     = asp::LasOrCsvToTif_Class<ImageView<Vector3>>(reader_ptr.get(), num_rows,
                                                      TILE_LEN, block_size);
 
-  // Must use a thread only, as we read the input file serially.
-  vw::cartography::write_gdal_image(out_file, Img, *opt, TerminalProgressCallback("asp", "\t--> ") );
+  // The input file is read serially, but the rest of the work for each
+  // tile is done in parallel. Each thread needs memory for a tile of
+  // TILE_LEN x TILE_LEN points.
+  vw::cartography::block_write_gdal_image(out_file, Img, *opt,
+                                          TerminalProgressCallback("asp", "\t--> "));
 
   // Restore the original tile size
   opt->raster_tile_size = original_tile_size;
@@ -938,6 +1068,18 @@ bool asp::georef_from_pc_files(std::vector<std::string> const& files,
   for (int i = 0; i < (int)files.size(); i++){
     GeoReference local_georef;
 
+    // Chunked point clouds store the georef as WKT
+    if (asp::is_chunked_point_cloud(files[i])) {
+      asp::ChunkedPointCloudInfo info;
+      asp::read_chunked_point_cloud_info(files[i], info);
+      if (!info.wkt.empty()) {
+        local_georef.set_wkt(info.wkt);
+        georef = local_georef;
+        return true;
+      }
+      continue;
+    }
+
     // Sometimes ASP PC files can have georef, written there by stereo
     try {
       if (!is_las(files[i]) && read_georeference(local_georef, files[i])){
@@ -972,7 +1114,7 @@ bool asp::is_pcd(std::string const& file){
 }
 
 bool asp::is_las_or_csv_or_pcd(std::string const& file){
-  return asp::is_las(file) || is_csv(file);
+  return asp::is_las(file) || is_csv(file) || is_pcd(file) || is_ply(file);
 }
 
 bool asp::read_user_datum(double semi_major, double semi_minor,
@@ -1040,20 +1182,34 @@ bool asp::is_valid_csv_line(std::string const& line){
   return (!only_spaces) && (!line.empty()) && (line[0] != '#');
 }
 
-std::int64_t asp::csv_file_size(std::string const& file){
-
-  std::ifstream fh(file.c_str());
-  if (!fh)
-    vw_throw( vw::IOErr() << "Unable to open file \"" << file << "\"" );
+namespace {
+  // Count the valid lines in chunks of a CSV file, in parallel
+  class CsvLineCounter {
+    asp::MappedTextFile const& m_file;
+    std::atomic<std::int64_t> m_count;
+  public:
+    CsvLineCounter(asp::MappedTextFile const& file): m_file(file), m_count(0) {}
+    void operator()(int chunk, size_t begin, size_t end) {
+      std::int64_t count = 0;
+      std::string line;
+      size_t pos = begin;
+      while (pos < end) {
+        pos = m_file.read_line(pos, line);
+        if (asp::is_valid_csv_line(line))
+          count++;
+      }
+      m_count += count;
+    }
+    std::int64_t count() const { return m_count.load(); }
+  };
+}
 
-  std::int64_t num_total_points = 0;
-  std::string line;
-  while (getline(fh, line, '\n')){
-    if (!asp::is_valid_csv_line(line)) continue;
-    num_total_points++;
-  }
+std::int64_t asp::csv_file_size(std::string const& file){
 
-  return num_total_points;
+  asp::MappedTextFile text(file);
+  CsvLineCounter counter(text);
+  asp::for_each_text_chunk(text, 0, counter);
+  return counter.count();
 }
 
 // Peek at the first valid line in a file to find how many columns it has
@@ -1146,6 +1302,54 @@ vw::BBox3 asp::pointcloud_bbox(vw::ImageViewRef<vw::Vector3> const& point_image,
   return result;
 }
 
+// The longitude of the points in a convex set not meeting the z axis is
+// extreme at its vertices. The geodetic latitude grows with z, and its
+// magnitude goes down with the distance r from the z axis, so it is
+// extreme at the extremes of z and r.
+vw::BBox2 asp::cartesian_box_to_lonlat_box(vw::BBox3 const& xyz_box,
+                                           vw::cartography::Datum const& datum) {
+
+  vw::BBox2 lonlat_box;
+  Vector3 lo = xyz_box.min(), hi = xyz_box.max();
+  bool on_axis = (lo.x() <= 0 && hi.x() >= 0 && lo.y() <= 0 && hi.y() >= 0);
+  if (on_axis && lo.z() <= 0 && hi.z() >= 0)
+    return vw::BBox2(Vector2(-180.0, -90.0), Vector2(180.0, 90.0)); // has the origin
+
+  double lon_min = -180.0, lon_max = 180.0;
+  if (!on_axis) {
+    // Past the antimeridian, use longitudes in [0, 360)
+    bool wrap = (hi.x() < 0 && lo.y() <= 0 && hi.y() >= 0);
+    lon_min = std::numeric_limits<double>::max();
+    lon_max = -lon_min;
+    for (int i = 0; i < 4; i++) {
+      double x = (i % 2 == 0) ? lo.x() : hi.x();
+      double y = (i / 2 == 0) ? lo.y() : hi.y();
+      double lon = atan2(y, x) * 180.0 / M_PI;
+      if (wrap && lon < 0)
+        lon += 360.0;
+      lon_min = std::min(lon_min, lon);
+      lon_max = std::max(lon_max, lon);
+    }
+  }
+
+  // The nearest and farthest points of the xy rectangle from the z axis
+  double nx = std::max(lo.x(), std::min(0.0, hi.x()));
+  double ny = std::max(lo.y(), std::min(0.0, hi.y()));
+  double r_min = sqrt(nx*nx + ny*ny);
+  double r_max = sqrt(std::max(lo.x()*lo.x(), hi.x()*hi.x()) +
+                      std::max(lo.y()*lo.y(), hi.y()*hi.y()));
+  double lat_min = std::numeric_limits<double>::max(), lat_max = -lat_min;
+  for (int i = 0; i < 4; i++) {
+    double r = (i % 2 == 0) ? r_min : r_max;
+    double z = (i / 2 == 0) ? lo.z() : hi.z();
+    double lat = datum.cartesian_to_geodetic(Vector3(r, 0, z))[1];
+    lat_min = std::min(lat_min, lat);
+    lat_max = std::max(lat_max, lat);
+  }
+
+  return vw::BBox2(Vector2(lon_min, lat_min), Vector2(lon_max, lat_max));
+}
+
 // Find the average longitude for a given point image with lon, lat, height values
 double asp::find_avg_lon(ImageViewRef<Vector3> const& point_image){
 
@@ -1175,9 +1379,16 @@ std::string asp::get_cloud_type(std::string const& file_name){
     return "CSV";
   if (asp::is_las(file_name))
     return "LAS";
+  if (asp::is_pcd(file_name))
+    return "PCD";
+  if (asp::is_ply(file_name))
+    return "PLY";
 
   // Note that any tif, ntf, and cub file with one channel with georeference be
   // interpreted as a DEM.
+  if (asp::is_chunked_point_cloud(file_name))
+    return "PC";
+
   int nc = vw::get_num_channels(file_name);
 
   vw::cartography::GeoReference geo;
@@ -1192,6 +1403,16 @@ std::string asp::get_cloud_type(std::string const& file_name){
 }
 
 
+// The number of channels in a point cloud or image
+int asp::num_channels(std::string const& file_name){
+  if (asp::is_chunked_point_cloud(file_name)) {
+    asp::ChunkedPointCloudInfo info;
+    asp::read_chunked_point_cloud_info(file_name, info);
+    return info.num_channels;
+  }
+  return vw::get_num_channels(file_name);
+}
+
 // Find the number of channels in the point clouds.
 // If the point clouds have inconsistent number of channels,
 // return the minimum of 3 and the minimum number of channels.
@@ -1201,10 +1422,10 @@ int asp::num_channels(std::vector<std::string> const& pc_files){
 
   VW_ASSERT(pc_files.size() >= 1, ArgumentErr() << "Expecting at least one file.\n");
 
-  int num_channels0 = get_num_channels(pc_files[0]);
+  int num_channels0 = asp::num_channels(pc_files[0]);
   int min_num_channels = num_channels0;
   for (int i = 1; i < (int)pc_files.size(); i++){
-    int num_channels = get_num_channels(pc_files[i]);
+    int num_channels = asp::num_channels(pc_files[i]);
     min_num_channels = std::min(min_num_channels, num_channels);
     if (num_channels != num_channels0)
       min_num_channels = std::min(min_num_channels, 3);
@@ -33,6 +33,8 @@
 #include <vw/FileIO/DiskImageUtils.h>
 
 #include <asp/Core/Common.h>
+#include <asp/Core/ChunkedPointCloud.h>
+#include <asp/Core/MappedPointFile.h>
 
 namespace vw{
   namespace cartography{
@@ -172,7 +174,7 @@ namespace asp {
   bool is_las              (std::string const& file); ///< Return true if this is a LAS file
   bool is_csv              (std::string const& file); ///< Return true if this is a CSV file
   bool is_pcd              (std::string const& file); ///< Return true if this is a PCD file
-  bool is_las_or_csv_or_pcd(std::string const& file); ///< Return true if this file is LAS or CSV or PCD format
+  bool is_las_or_csv_or_pcd(std::string const& file); ///< Return true if this file is LAS or CSV or PCD or PLY format
 
 
   /// Builds a GeoReference from a LAS file
@@ -210,7 +212,7 @@ namespace asp {
   /// Returns the number of points contained in a CSV file
   std::int64_t csv_file_size(std::string const& file);
 
-  /// Returns the number of points contained in a PCD file
+  /// Returns the number of points contained in a PCD or PLY file
   std::int64_t pcd_file_size(std::string const& file);
 
   // Peek at the first valid line in a file to find how many columns it has
@@ -223,8 +225,14 @@ namespace asp {
   /// Given a point cloud with n channels, return the first m channels.
   /// We must have 1 <= m <= n <= 6.
   /// If the image was written by subtracting a shift, put that shift back.
+  /// Both PC.tif files and chunked point clouds (.apc) are supported.
+  /// For the latter, the chunks rejected by the filter are not read,
+  /// and their points are invalid. PC.tif files have no such index, and
+  /// the filter is not used for them.
   template<int m>
-  vw::ImageViewRef< vw::Vector<double, m> > read_asp_point_cloud(std::string const& filename);
+  vw::ImageViewRef< vw::Vector<double, m> >
+  read_asp_point_cloud(std::string const& filename,
+                       asp::ChunkFilter const& filter = asp::ChunkFilter());
 
   /// Hide these functions from external users
   namespace point_utils_private {
@@ -235,23 +243,27 @@ namespace asp {
     /// Read a texture file
     template<class PixelT>
     typename boost::enable_if<boost::is_same<PixelT, vw::PixelGray<float> >, vw::ImageViewRef<PixelT> >::type
-    read_point_cloud_compatible_file(std::string const& file){
+    read_point_cloud_compatible_file(std::string const& file,
+                                     asp::ChunkFilter const& /*filter*/){
       return vw::DiskImageView<PixelT>(file);
     }
     /// Read a point cloud file
     template<class PixelT>
     typename boost::disable_if<boost::is_same<PixelT, vw::PixelGray<float>>, vw::ImageViewRef<PixelT> >::type
-    read_point_cloud_compatible_file(std::string const& file){
-      return asp::read_asp_point_cloud< vw::math::VectorSize<PixelT>::value >(file);
+    read_point_cloud_compatible_file(std::string const& file,
+                                     asp::ChunkFilter const& filter){
+      return asp::read_asp_point_cloud< vw::math::VectorSize<PixelT>::value >(file, filter);
     }
 
   } // end namespace point_utils_private
 
   /// Read multiple image files pack them into a single patchwork tiled image.
   /// - Relies on the vw::mosaic::ImageComposite class.
+  /// - The filter is passed to read_asp_point_cloud() for each cloud.
   template<class PixelT>
   inline vw::ImageViewRef<PixelT>
-  form_point_cloud_composite(std::vector<std::string> const & files, int spacing=0);
+  form_point_cloud_composite(std::vector<std::string> const & files, int spacing=0,
+                             asp::ChunkFilter const& filter = asp::ChunkFilter());
 
   // Apply an offset to the points in the PointImage
   class PointOffsetFunc : public vw::UnaryReturnSameType {
@@ -321,6 +333,12 @@ namespace asp {
   vw::BBox3 pointcloud_bbox(vw::ImageViewRef<vw::Vector3> const& point_image,
                             bool is_geodetic);
 
+  /// A lon-lat box, in degrees, which contains the lon and lat of all
+  /// the points in the given box of cartesian points. The longitudes
+  /// may go past 180 if the box straddles the antimeridian.
+  vw::BBox2 cartesian_box_to_lonlat_box(vw::BBox3 const& xyz_box,
+                                        vw::cartography::Datum const& datum);
+
 
   // Classes to read points from CSV and LAS files one point at a
   // time. We basically implement an interface for CSV files
@@ -333,6 +351,24 @@ namespace asp {
     
     virtual bool        ReadNextPoint() = 0;
     virtual vw::Vector3 GetPoint() = 0;
+
+    /// Readers for which converting a record to a point is expensive,
+    /// such as for CSV files, where each line needs to be parsed and
+    /// projected, can read the raw records serially with
+    /// ReadNextRawRecord(), and convert them later with RawRecordToPoint(),
+    /// which must be thread-safe.
+    virtual bool has_raw_records() const { return false; }
+    virtual bool ReadNextRawRecord(std::string & record) {
+      vw::vw_throw(vw::NoImplErr() << "BaseReader: Raw records are not supported.\n");
+      return false;
+    }
+    virtual bool RawRecordToPoint(std::string const& record,
+                                  vw::cartography::GeoReference const& georef,
+                                  vw::Vector3 & point) const {
+      vw::vw_throw(vw::NoImplErr() << "BaseReader: Raw records are not supported.\n");
+      return false;
+    }
+
     virtual ~BaseReader(){}
   };
  
@@ -361,11 +397,29 @@ namespace asp {
     virtual ~PcdReader();
   }; // End class PcdReader
 
+ /// Reader for binary .pcd and .ply files, which are mapped into memory,
+ /// so reading a point just copies its coordinates.
+ class MappedPointReader: public BaseReader{
+  private:
+    boost::shared_ptr<MappedPointFile> m_file;
+    std::int64_t m_index;
+
+  public:
+    MappedPointReader(std::string const& file);
+    virtual bool ReadNextPoint();
+    virtual vw::Vector3 GetPoint();
+  }; // End class MappedPointReader
+
 //===================================================================================
 // Template function definitions
 
 template<int m>
-vw::ImageViewRef< vw::Vector<double, m> > read_asp_point_cloud(std::string const& filename){
+vw::ImageViewRef< vw::Vector<double, m> >
+read_asp_point_cloud(std::string const& filename, asp::ChunkFilter const& filter){
+
+  // The chunked reader puts back the shift itself
+  if (asp::is_chunked_point_cloud(filename))
+    return asp::ChunkedPointCloudView<m>(filename, filter);
 
   vw::Vector3 shift;
   std::string shift_str;
@@ -389,7 +443,8 @@ vw::ImageViewRef< vw::Vector<double, m> > read_asp_point_cloud(std::string const
 /// Read given files and form an image composite.
 template<class PixelT>
 vw::ImageViewRef<PixelT> form_point_cloud_composite(std::vector<std::string> const & files,
-                                                    int spacing){
+                                                    int spacing,
+                                                    asp::ChunkFilter const& filter){
 
   VW_ASSERT(files.size() >= 1, vw::ArgumentErr() << "Expecting at least one file.\n");
 
@@ -399,7 +454,7 @@ vw::ImageViewRef<PixelT> form_point_cloud_composite(std::vector<std::string> con
   for (int i = 0; i < (int)files.size(); i++){
 
     vw::ImageViewRef<PixelT> I
-      = point_utils_private::read_point_cloud_compatible_file<PixelT>(files[i]);
+      = point_utils_private::read_point_cloud_compatible_file<PixelT>(files[i], filter);
 
     // We will stack the images in the composite side by side. Images which
     // are wider than tall will be transposed.
@@ -426,6 +481,11 @@ double find_avg_lon(vw::ImageViewRef<vw::Vector3> const& point_image);
 
 std::string get_cloud_type(std::string const& file_name);
   
+// The number of channels in a point cloud or image. Unlike
+// vw::get_num_channels(), this works for chunked point clouds too.
+int num_channels(std::string const& file_name);
+
+
 // Find the number of channels in the point clouds.
 // If the point clouds have inconsistent number of channels,
 // return the minimum of 3 and the minimum number of channels.
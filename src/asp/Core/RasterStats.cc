@@ -0,0 +1,135 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file RasterStats.cc
+///
+
+#include <asp/Core/RasterStats.h>
+#include <vw/Core/Log.h>
+
+#include <boost/filesystem.hpp>
+
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <unistd.h>
+
+namespace fs = boost::filesystem;
+
+namespace asp {
+
+// These identify the version of the raster the stats are for
+const std::string RASTER_SIZE = "raster_size";
+const std::string RASTER_TIME = "raster_time";
+
+std::string raster_stats_file(std::string const& raster) {
+  fs::path p(raster);
+  return (p.parent_path() / (p.stem().string() + "-stats.txt")).string();
+}
+
+bool read_stats_file(std::string const& stats_file, RasterStats & stats) {
+
+  stats.clear();
+  if (!fs::exists(stats_file))
+    return false;
+
+  std::ifstream ifs(stats_file.c_str());
+  std::string line;
+  while (std::getline(ifs, line)) {
+    std::istringstream is(line);
+    std::string name;
+    if (!(is >> name))
+      continue;
+    std::vector<double> vals;
+    double val = 0.0;
+    while (is >> val)
+      vals.push_back(val);
+    stats[name] = vals;
+  }
+
+  return true;
+}
+
+bool write_stats_file(std::string const& stats_file, RasterStats const& stats) {
+
+  // Write to a temporary file first, so a reader never sees a partial file
+  std::ostringstream tmp;
+  tmp << stats_file << ".tmp" << getpid();
+  std::ofstream ofs(tmp.str().c_str());
+  ofs << std::setprecision(17);
+  for (auto it = stats.begin(); it != stats.end(); it++) {
+    ofs << it->first;
+    for (size_t val_it = 0; val_it < it->second.size(); val_it++)
+      ofs << ' ' << it->second[val_it];
+    ofs << "\n";
+  }
+  ofs.close();
+  if (!ofs) {
+    vw::vw_out(vw::WarningMessage) << "Could not write: " << stats_file << "\n";
+    fs::remove(tmp.str());
+    return false;
+  }
+
+  fs::rename(tmp.str(), stats_file);
+  return true;
+}
+
+bool read_raster_stats(std::string const& raster, RasterStats & stats) {
+
+  stats.clear();
+  if (!fs::exists(raster) || !read_stats_file(raster_stats_file(raster), stats))
+    return false;
+
+  // The stats must be for the current raster
+  bool fresh
+    = (stats[RASTER_SIZE].size() == 1 &&
+       stats[RASTER_SIZE][0] == double(fs::file_size(raster)) &&
+       stats[RASTER_TIME].size() == 1 &&
+       stats[RASTER_TIME][0] == double(fs::last_write_time(raster)));
+  stats.erase(RASTER_SIZE);
+  stats.erase(RASTER_TIME);
+  if (!fresh) {
+    stats.clear();
+    return false;
+  }
+
+  return true;
+}
+
+void write_raster_stats(std::string const& raster, RasterStats const& stats) {
+  RasterStats out_stats = stats;
+  out_stats[RASTER_SIZE] = {double(fs::file_size(raster))};
+  out_stats[RASTER_TIME] = {double(fs::last_write_time(raster))};
+  write_stats_file(raster_stats_file(raster), out_stats);
+}
+
+void DisparityStats::add(vw::BBox2 const& range, std::int64_t num_valid) {
+  vw::Mutex::Lock lock(m_mutex);
+  if (num_valid == 0)
+    return;
+  m_range.grow(range);
+  m_num_valid += num_valid;
+}
+
+void DisparityStats::save(RasterStats & stats) const {
+  if (m_num_valid == 0)
+    return;
+  stats[DISPARITY_RANGE] = {m_range.min().x(), m_range.min().y(),
+                            m_range.max().x(), m_range.max().y()};
+}
+
+} // End namespace asp
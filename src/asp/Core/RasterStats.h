@@ -0,0 +1,147 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file RasterStats.h
+///
+/// Statistics of a raster saved next to it, as <raster>-stats.txt, so
+/// that tools which need them do not have to make a full pass over the
+/// raster. The stats file records the size and modification time of the
+/// raster, and is ignored once the raster changes.
+
+#ifndef __ASP_CORE_RASTER_STATS_H__
+#define __ASP_CORE_RASTER_STATS_H__
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Thread.h>
+#include <vw/Math/BBox.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/PixelMask.h>
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  /// Each named statistic has one or more values
+  typedef std::map<std::string, std::vector<double>> RasterStats;
+
+  /// Read a file of named stats, with a name and its values on each
+  /// line. Return false if the file does not exist.
+  bool read_stats_file(std::string const& stats_file, RasterStats & stats);
+
+  /// Write a file of named stats. It is written to a temporary file
+  /// first, so a reader never sees a partial file. Return false on failure.
+  bool write_stats_file(std::string const& stats_file, RasterStats const& stats);
+
+  /// The stats file of a raster. Must be synced with parallel_stereo.
+  std::string raster_stats_file(std::string const& raster);
+
+  /// Read the stats of a raster. Return false if there are none, or if
+  /// the raster changed after they were written.
+  bool read_raster_stats(std::string const& raster, RasterStats & stats);
+
+  /// Write the stats of a raster. To be called after the raster was closed.
+  void write_raster_stats(std::string const& raster, RasterStats const& stats);
+
+  /// The name of the statistic holding the range of valid disparities,
+  /// as min_x min_y max_x max_y. Must be synced with parallel_stereo.
+  const std::string DISPARITY_RANGE = "disparity_range";
+
+  /// Accumulate the range and count of the valid pixels of a disparity
+  /// over tiles done in parallel.
+  class DisparityStats {
+  public:
+    DisparityStats(): m_num_valid(0) {}
+
+    void add(vw::BBox2 const& range, std::int64_t num_valid);
+
+    /// Add the results to the stats of a raster. Nothing is added if
+    /// no pixel was valid.
+    void save(RasterStats & stats) const;
+
+  private:
+    vw::BBox2 m_range;
+    std::int64_t m_num_valid;
+    vw::Mutex m_mutex;
+  };
+
+  /// An image view which passes the tiles of a disparity through, as
+  /// they are written, and adds them to DisparityStats.
+  template <class ImageT>
+  class DisparityStatsView: public vw::ImageViewBase<DisparityStatsView<ImageT>> {
+    ImageT m_child;
+    DisparityStats & m_stats;
+
+  public:
+    typedef typename ImageT::pixel_type pixel_type;
+    typedef pixel_type result_type;
+    typedef vw::ProceduralPixelAccessor<DisparityStatsView> pixel_accessor;
+
+    DisparityStatsView(ImageT const& child, DisparityStats & stats):
+      m_child(child), m_stats(stats) {}
+
+    inline vw::int32 cols  () const { return m_child.cols(); }
+    inline vw::int32 rows  () const { return m_child.rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+    inline pixel_type operator()(double/*i*/, double/*j*/, vw::int32/*p*/ = 0) const {
+      vw::vw_throw(vw::NoImplErr() << "DisparityStatsView::operator()(...) is not implemented");
+      return pixel_type();
+    }
+
+    typedef vw::CropView<vw::ImageView<pixel_type>> prerasterize_type;
+    inline prerasterize_type prerasterize(vw::BBox2i const& bbox) const {
+
+      vw::ImageView<pixel_type> tile = vw::crop(m_child, bbox);
+
+      vw::BBox2 range;
+      std::int64_t num_valid = 0;
+      for (int row = 0; row < tile.rows(); row++) {
+        for (int col = 0; col < tile.cols(); col++) {
+          pixel_type const& pix = tile(col, row);
+          if (!is_valid(pix))
+            continue;
+          range.grow(vw::Vector2(pix.child()[0], pix.child()[1]));
+          num_valid++;
+        }
+      }
+      m_stats.add(range, num_valid);
+
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, vw::BBox2i bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+  template <class ImageT>
+  DisparityStatsView<ImageT>
+  disparity_stats_view(vw::ImageViewBase<ImageT> const& image, DisparityStats & stats) {
+    return DisparityStatsView<ImageT>(image.impl(), stats);
+  }
+
+} // End namespace asp
+
+#endif//__ASP_CORE_RASTER_STATS_H__
@@ -0,0 +1,332 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file SharedBlockCache.cc
+///
+
+#include <asp/Core/SharedBlockCache.h>
+#include <asp/Core/ExitReport.h>
+#include <asp/Core/Hash.h>
+#include <asp/Core/Tracing.h>
+
+#include <vw/Core/Log.h>
+#include <vw/Image/PixelTypeInfo.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+namespace fs = boost::filesystem;
+
+namespace asp {
+
+namespace {
+
+  // Check the total size when the blocks written since the last check
+  // pass this fraction of the limit
+  const double EVICT_CHECK_FRACTION = 1.0 / 16.0;
+
+  // After removing blocks, the rest take at most this fraction of the limit
+  const double EVICT_TARGET_FRACTION = 0.9;
+
+  // Temporary files this old are left from processes which were killed
+  const double STALE_TMP_SECONDS = 3600.0;
+
+  void report_block_cache() {
+    SharedBlockCache::instance().report();
+  }
+
+  // A block file found when evicting
+  struct CachedBlock {
+    std::time_t   time;
+    std::uint64_t size;
+    fs::path      path;
+    bool operator<(CachedBlock const& b) const { return time < b.time; }
+  };
+
+  // The formats GDAL reads and which are worth caching, as they are
+  // usually compressed or tiled
+  bool is_cacheable_image(std::string const& filename) {
+    std::string ext = boost::algorithm::to_lower_copy(fs::path(filename).extension().string());
+    return ext == ".tif" || ext == ".tiff" || ext == ".ntf" || ext == ".jp2";
+  }
+}
+
+SharedBlockCache & SharedBlockCache::instance() {
+  static SharedBlockCache * cache = report_at_exit(new SharedBlockCache(),
+                                                   "Started the shared block cache.",
+                                                   report_block_cache);
+  return *cache;
+}
+
+SharedBlockCache::SharedBlockCache():
+  m_limit(std::uint64_t(4096) * 1024 * 1024),
+  m_since_evict(0), m_hits(0), m_misses(0), m_num_tmp(0) {
+
+  char * ptr = getenv("ASP_BLOCK_CACHE_SIZE_MB");
+  if (ptr != NULL) {
+    double limit_mb = atof(ptr);
+    if (limit_mb > 0)
+      m_limit = std::uint64_t(limit_mb * 1024.0 * 1024.0);
+  }
+
+  ptr = getenv("ASP_BLOCK_CACHE_DIR");
+  if (ptr == NULL || std::string(ptr).empty())
+    return;
+
+  boost::system::error_code ec;
+  fs::create_directories(ptr, ec);
+  if (!fs::is_directory(ptr, ec)) {
+    vw::vw_out(vw::WarningMessage) << "Cannot create the block cache directory: "
+                                   << ptr << ". Not using it.\n";
+    return;
+  }
+  m_dir = ptr;
+}
+
+std::uint64_t SharedBlockCache::max_block_size() {
+  return std::uint64_t(64) * 1024 * 1024;
+}
+
+// Spread the blocks over subdirectories, to keep each small
+std::string SharedBlockCache::block_file(std::string const& key) const {
+  return m_dir + "/" + key.substr(0, 2) + "/" + key + ".blk";
+}
+
+bool SharedBlockCache::get(std::string const& key, char * data, std::uint64_t size) {
+
+  std::string file = block_file(key);
+  bool found = false;
+  {
+    std::ifstream ifs(file.c_str(), std::ios::binary);
+    if (ifs) {
+      ifs.seekg(0, std::ios::end);
+      if (ifs && std::uint64_t(ifs.tellg()) == size) {
+        ifs.seekg(0, std::ios::beg);
+        ifs.read(data, size);
+        found = (ifs && std::uint64_t(ifs.gcount()) == size);
+      }
+    }
+  }
+
+  // Mark the block as recently used. If another process removed it
+  // meanwhile, the pixels were read already, as removing a file
+  // leaves it readable by those who opened it.
+  if (found) {
+    boost::system::error_code ec;
+    fs::last_write_time(file, std::time(NULL), ec);
+  }
+
+  vw::Mutex::Lock lock(m_mutex);
+  if (found)
+    m_hits++;
+  else
+    m_misses++;
+  return found;
+}
+
+void SharedBlockCache::put(std::string const& key, char const* data, std::uint64_t size) {
+
+  if (!enabled() || size > max_block_size())
+    return;
+
+  std::uint64_t num_tmp = 0;
+  {
+    vw::Mutex::Lock lock(m_mutex);
+    num_tmp = m_num_tmp++;
+  }
+
+  std::string file = block_file(key);
+  std::ostringstream os;
+  os << file << ".tmp" << getpid() << "_" << num_tmp;
+  std::string tmp_file = os.str();
+
+  boost::system::error_code ec;
+  fs::create_directories(fs::path(file).parent_path(), ec);
+
+  bool success = false;
+  {
+    std::ofstream ofs(tmp_file.c_str(), std::ios::binary);
+    if (ofs) {
+      ofs.write(data, size);
+      ofs.close();
+      success = bool(ofs);
+    }
+  }
+
+  // If another process wrote this block meanwhile, this replaces it
+  // with the same pixels
+  if (success) {
+    fs::rename(tmp_file, file, ec);
+    success = !ec;
+  }
+  if (!success) {
+    fs::remove(tmp_file, ec);
+    return;
+  }
+
+  bool check = false;
+  {
+    vw::Mutex::Lock lock(m_mutex);
+    m_since_evict += size;
+    if (m_since_evict >= EVICT_CHECK_FRACTION * m_limit) {
+      m_since_evict = 0;
+      check = true;
+    }
+  }
+  if (check)
+    evict();
+}
+
+// Several processes may evict at once. Then a block may be removed by
+// one after another found it, which is harmless.
+void SharedBlockCache::evict() {
+
+  std::vector<CachedBlock> blocks;
+  std::uint64_t total = 0;
+  std::time_t now = std::time(NULL);
+
+  boost::system::error_code ec;
+  fs::recursive_directory_iterator it(m_dir, ec), end;
+  for (; !ec && it != end; it.increment(ec)) {
+    boost::system::error_code ec2;
+    fs::path path = it->path();
+    if (!fs::is_regular_file(path, ec2))
+      continue;
+
+    CachedBlock block;
+    block.path = path;
+    block.time = fs::last_write_time(path, ec2);
+    block.size = fs::file_size(path, ec2);
+    if (ec2)
+      continue;
+
+    // Blocks being written are not counted, but those left by killed
+    // processes are removed
+    if (path.filename().string().find(".tmp") != std::string::npos) {
+      if (std::difftime(now, block.time) > STALE_TMP_SECONDS)
+        fs::remove(path, ec2);
+      continue;
+    }
+
+    blocks.push_back(block);
+    total += block.size;
+  }
+
+  if (total <= m_limit)
+    return;
+
+  std::sort(blocks.begin(), blocks.end());
+  std::uint64_t target = std::uint64_t(EVICT_TARGET_FRACTION * m_limit);
+  size_t num_removed = 0;
+  for (size_t i = 0; i < blocks.size() && total > target; i++) {
+    boost::system::error_code ec2;
+    fs::remove(blocks[i].path, ec2);
+    total -= blocks[i].size;
+    num_removed++;
+  }
+
+  vw::vw_out(vw::DebugMessage, "asp") << "Removed " << num_removed
+                                      << " least recently used blocks from the "
+                                      << "shared block cache.\n";
+}
+
+void SharedBlockCache::report() {
+  vw::Mutex::Lock lock(m_mutex);
+  if (m_hits + m_misses == 0)
+    return;
+  vw::vw_out(vw::DebugMessage, "asp") << "Shared block cache: " << m_hits << " hits, "
+                                      << m_misses << " misses.\n";
+}
+
+CachedDiskImageResource::CachedDiskImageResource(std::string const& filename):
+  vw::DiskImageResourceGDAL(filename) {
+
+  // An image not on disk, such as one read by GDAL over the network,
+  // is not cached
+  boost::system::error_code ec;
+  fs::path path = fs::absolute(filename);
+  std::uint64_t size = fs::file_size(path, ec);
+  if (ec)
+    return;
+  std::time_t time = fs::last_write_time(path, ec);
+  if (ec)
+    return;
+
+  std::ostringstream os;
+  os << path.string() << ' ' << size << ' ' << time;
+  m_signature = os.str();
+}
+
+void CachedDiskImageResource::read(vw::ImageBuffer const& dest, vw::BBox2i const& bbox) const {
+
+  TraceSpan span("read_block", bbox, "io");
+  SharedBlockCache & cache = SharedBlockCache::instance();
+  vw::ImageFormat fmt = format();
+  std::uint64_t pixel_size = std::uint64_t(vw::num_channels(fmt.pixel_format)) *
+    vw::channel_size(fmt.channel_type);
+  std::uint64_t size = pixel_size * std::uint64_t(bbox.width()) *
+    std::uint64_t(bbox.height()) * std::uint64_t(fmt.planes);
+
+  if (m_signature.empty() || !cache.enabled() || size == 0 ||
+      size > SharedBlockCache::max_block_size()) {
+    vw::DiskImageResourceGDAL::read(dest, bbox);
+    return;
+  }
+
+  std::ostringstream os;
+  os << m_signature << ' ' << bbox.min().x() << ' ' << bbox.min().y() << ' '
+     << bbox.width() << ' ' << bbox.height() << ' ' << int(fmt.pixel_format) << ' '
+     << int(fmt.channel_type) << ' ' << fmt.planes;
+  std::string key = asp::hash_to_hex(asp::hash_string(os.str()));
+
+  // The pixels of the block as stored in the file, which is what is cached
+  std::vector<char> data(size);
+  vw::ImageBuffer src;
+  src.data = &data[0];
+  src.format = fmt;
+  src.format.cols = bbox.width();
+  src.format.rows = bbox.height();
+  src.cstride = pixel_size;
+  src.rstride = pixel_size * bbox.width();
+  src.pstride = pixel_size * bbox.width() * bbox.height();
+
+  if (!cache.get(key, &data[0], size)) {
+    vw::DiskImageResourceGDAL::read(src, bbox);
+    cache.put(key, &data[0], size);
+  }
+
+  vw::convert(dest, src, m_rescale);
+}
+
+boost::shared_ptr<vw::DiskImageResource> cached_image_resource(std::string const& filename) {
+  // This resource also traces the reads of blocks
+  if ((SharedBlockCache::instance().enabled() || tracing_enabled()) &&
+      is_cacheable_image(filename))
+    return boost::shared_ptr<vw::DiskImageResource>(new CachedDiskImageResource(filename));
+  return boost::shared_ptr<vw::DiskImageResource>(vw::DiskImageResourcePtr(filename));
+}
+
+} // end namespace asp
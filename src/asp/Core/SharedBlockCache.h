@@ -0,0 +1,111 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file SharedBlockCache.h
+///
+/// A cache of decoded image blocks, kept in a directory on a local disk
+/// and shared by all ASP processes on a node. The tile processes of
+/// parallel_stereo and mapproject read overlapping blocks of the same
+/// compressed inputs, and without this cache each decompresses them
+/// again. With it, a block is decoded once, and the other processes
+/// read its raw pixels.
+///
+/// Each block is one file, named by a hash of the image path, size and
+/// modification time, the block, and the pixel format, so a block of an
+/// image which changed is never used. The modification times of the
+/// block files, updated on each use, serve as the LRU index. When the
+/// blocks a process wrote since its last check pass a fraction of the
+/// limit, it removes the least recently used blocks until the total is
+/// under the limit. Blocks are written to a temporary file which is
+/// then renamed, so no process sees a partial block.
+///
+/// The cache is off unless the environment variable ASP_BLOCK_CACHE_DIR
+/// is set. Its size is set with ASP_BLOCK_CACHE_SIZE_MB, with a default
+/// of 4096. The directory should be on a local disk, not shared among
+/// nodes.
+
+#ifndef __ASP_CORE_SHARED_BLOCK_CACHE_H__
+#define __ASP_CORE_SHARED_BLOCK_CACHE_H__
+
+#include <vw/Core/Thread.h>
+#include <vw/FileIO/DiskImageResourceGDAL.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <cstdint>
+#include <string>
+
+namespace asp {
+
+  class SharedBlockCache: private boost::noncopyable {
+  public:
+
+    /// The cache of this process, set up from the environment
+    static SharedBlockCache & instance();
+
+    bool enabled() const { return !m_dir.empty(); }
+
+    /// Read the block with this key into the given bytes, and mark it
+    /// as used. Return false if it is not in the cache or has another size.
+    bool get(std::string const& key, char * data, std::uint64_t size);
+
+    /// Add a block. If that fails, such as when the disk is full, the
+    /// block is not cached, which is not an error.
+    void put(std::string const& key, char const* data, std::uint64_t size);
+
+    /// Blocks larger than this are not cached
+    static std::uint64_t max_block_size();
+
+    /// Print the number of hits and misses
+    void report();
+
+  private:
+    SharedBlockCache();
+    std::string block_file(std::string const& key) const;
+
+    // Remove the least recently used blocks if over the limit
+    void evict();
+
+    std::string   m_dir;
+    std::uint64_t m_limit;
+
+    vw::Mutex     m_mutex; // protects all below
+    std::uint64_t m_since_evict, m_hits, m_misses, m_num_tmp;
+  };
+
+  /// A GDAL image whose blocks are read via the shared block cache
+  class CachedDiskImageResource: public vw::DiskImageResourceGDAL {
+  public:
+    explicit CachedDiskImageResource(std::string const& filename);
+    virtual ~CachedDiskImageResource() {}
+
+    virtual void read(vw::ImageBuffer const& dest, vw::BBox2i const& bbox) const;
+
+  private:
+    std::string m_signature; // the path, size, and time of the file; empty if not cacheable
+  };
+
+  /// Open an image for reading, as vw::DiskImageResourcePtr() does. If
+  /// the shared block cache is enabled and GDAL reads this image, its
+  /// blocks are read via the cache. With tracing on, the block reads
+  /// are traced.
+  boost::shared_ptr<vw::DiskImageResource> cached_image_resource(std::string const& filename);
+
+} // end namespace asp
+
+#endif // __ASP_CORE_SHARED_BLOCK_CACHE_H__
@@ -0,0 +1,112 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file StageReport.cc
+///
+
+#include <asp/Core/StageReport.h>
+#include <vw/Core/Log.h>
+#include <vw/Core/Exception.h>
+#include <vw/Core/Settings.h>
+
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+namespace asp {
+
+ResourceUsage::ResourceUsage():
+  wall_time_sec(0), cpu_time_sec(0), peak_rss_mb(0), bytes_read(-1),
+  bytes_written(-1) {}
+
+void ResourceUsage::measure() {
+
+  wall_time_sec = 1.0e-6 * std::chrono::duration_cast<std::chrono::microseconds>
+    (std::chrono::steady_clock::now().time_since_epoch()).count();
+
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    cpu_time_sec = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+      1.0e-6 * (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+#ifdef __APPLE__
+    peak_rss_mb = usage.ru_maxrss / (1024.0 * 1024.0); // in bytes
+#else
+    peak_rss_mb = usage.ru_maxrss / 1024.0; // in kilobytes
+#endif
+  }
+
+  // This exists only on Linux
+  bytes_read = -1;
+  bytes_written = -1;
+  std::ifstream ifs("/proc/self/io");
+  std::string key;
+  double val;
+  while (ifs >> key >> val) {
+    if (key == "rchar:")
+      bytes_read = val;
+    else if (key == "wchar:")
+      bytes_written = val;
+  }
+}
+
+StageReport::StageReport(std::string const& stage): m_stage(stage) {
+  m_start.measure();
+}
+
+std::string StageReport::file_name(std::string const& out_prefix) const {
+  return out_prefix + "-" + m_stage + "-report.json";
+}
+
+void StageReport::save(std::string const& out_prefix, vw::BBox2i const& tile) const {
+
+  ResourceUsage end;
+  end.measure();
+
+  double bytes_read = -1, bytes_written = -1;
+  if (m_start.bytes_read >= 0 && end.bytes_read >= 0)
+    bytes_read = end.bytes_read - m_start.bytes_read;
+  if (m_start.bytes_written >= 0 && end.bytes_written >= 0)
+    bytes_written = end.bytes_written - m_start.bytes_written;
+
+  // Write by hand, the format is simple enough
+  std::ostringstream os;
+  os.precision(10);
+  os << "{\n"
+     << "  \"stage\": \"" << m_stage << "\",\n"
+     << "  \"tile\": [" << tile.min().x() << ", " << tile.min().y() << ", "
+     << tile.width() << ", " << tile.height() << "],\n"
+     << "  \"threads\": " << vw::vw_settings().default_num_threads() << ",\n"
+     << "  \"wall_time_sec\": " << end.wall_time_sec - m_start.wall_time_sec << ",\n"
+     << "  \"cpu_time_sec\": "  << end.cpu_time_sec  - m_start.cpu_time_sec << ",\n"
+     << "  \"peak_rss_mb\": "   << end.peak_rss_mb << ",\n"
+     << "  \"bytes_read\": "    << bytes_read << ",\n"
+     << "  \"bytes_written\": " << bytes_written << "\n"
+     << "}\n";
+
+  std::string report_file = file_name(out_prefix);
+  std::ofstream ofs(report_file.c_str());
+  if (!ofs.good())
+    vw::vw_throw(vw::IOErr() << "Cannot write: " << report_file << "\n");
+  ofs << os.str();
+  ofs.close();
+  vw::vw_out() << "Wrote: " << report_file << "\n";
+}
+
+} // End namespace asp
@@ -0,0 +1,65 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file StageReport.h
+///
+/// Measure the resources used by a stereo stage, and save them as a small
+/// JSON file, so that they can be collected over all tiles of a run.
+
+#ifndef __ASP_CORE_STAGE_REPORT_H__
+#define __ASP_CORE_STAGE_REPORT_H__
+
+#include <vw/Math/BBox.h>
+#include <vw/Core/FundamentalTypes.h>
+
+#include <string>
+
+namespace asp {
+
+  /// The resources used by this process so far. The I/O counts are the
+  /// bytes passed through read and write calls, including those served
+  /// from the page cache. Values which cannot be found on this platform
+  /// are set to -1.
+  struct ResourceUsage {
+    double wall_time_sec, cpu_time_sec, peak_rss_mb;
+    double bytes_read, bytes_written;
+    ResourceUsage();
+    /// Fill in the current values
+    void measure();
+  };
+
+  /// Start measuring at construction. The peak memory is for the whole
+  /// process, the rest are differences from the construction time.
+  class StageReport {
+  public:
+    StageReport(std::string const& stage);
+
+    /// The name of the report file for given output prefix
+    std::string file_name(std::string const& out_prefix) const;
+
+    /// Write the report to file_name(out_prefix). The tile is the region
+    /// which was processed, and is empty if it is the full image.
+    void save(std::string const& out_prefix, vw::BBox2i const& tile) const;
+
+  private:
+    std::string m_stage;
+    ResourceUsage m_start;
+  };
+
+} // End namespace asp
+
+#endif//__ASP_CORE_STAGE_REPORT_H__
@@ -0,0 +1,60 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file StereoPluginAbi.h
+///
+/// The C interface an external stereo algorithm implements to be called by
+/// stereo_corr in-process, as a shared library, rather than as an executable.
+/// Such a library is listed in plugins/stereo/plugin_list.txt in place of
+/// the executable. The images are passed as in-memory buffers, so no
+/// temporary files are written and no process is started for each tile.
+///
+/// This header must not depend on anything else from ASP or VW, so that
+/// plugins can be built without these.
+
+#ifndef __ASP_CORE_STEREO_PLUGIN_ABI_H__
+#define __ASP_CORE_STEREO_PLUGIN_ABI_H__
+
+/// Increment this when the signature of the functions below changes.
+#define ASP_STEREO_PLUGIN_ABI_VERSION 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  /// Return the value of ASP_STEREO_PLUGIN_ABI_VERSION the plugin was
+  /// built with. ASP refuses to call a plugin with a different version.
+  int asp_stereo_plugin_abi_version();
+
+  /// Find the horizontal disparity from the left to the right locally
+  /// aligned image. Both images are row-major, of size cols x rows, with
+  /// NaN as no-data. The options are the same as for the executable
+  /// version of the plugin, split at whitespace, such as {"-O", "8"}. The
+  /// environment variables are given as "NAME=VALUE". The output
+  /// disparity is allocated by the caller with cols x rows elements, and
+  /// must be set to NaN where it is invalid. Return 0 on success.
+  int asp_stereo_plugin_run(int num_options, const char * const * options,
+                            int num_env_vars, const char * const * env_vars,
+                            const float * left_image, const float * right_image,
+                            int cols, int rows, int min_disp, int max_disp,
+                            float * disparity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif//__ASP_CORE_STEREO_PLUGIN_ABI_H__
@@ -19,14 +19,20 @@
 /// \file StereoSettings.cc
 ///
 #include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <unistd.h>
 
 #include <vw/Core/RunOnce.h>
 #include <vw/Core/Log.h>
 
 #include <asp/Core/Common.h>
+#include <asp/Core/Hash.h>
 #include <asp/Core/StereoSettings.h>
 #include <asp/Core/PointUtils.h>
 
+#include <boost/filesystem.hpp>
+
 namespace po = boost::program_options;
 using namespace vw;
 
@@ -97,6 +103,9 @@ namespace asp {
     enable_correct_atmospheric_refraction = false;
     
     default_corr_timeout = 900; // in seconds
+
+    // Set by tools which match several image pairs at once
+    ip_num_ransac_threads = 0;
     
     nodata_value = g_nan_val;
   }
@@ -136,6 +145,10 @@ namespace asp {
        "Min percentage distance between closest and second closest IP descriptors, a larger value allows more IP matches.")
       ("ip-nodata-radius",          po::value(&global.ip_nodata_radius)->default_value(4),
        "Remove IP near nodata with this radius, in pixels.")
+      ("ip-cache-dir",              po::value(&global.ip_cache_dir)->default_value(""),
+       "Save detected interest points in this directory, named by a hash of the image and detection options, and reuse them when both match, across runs and tools.")
+      ("adaptive-ip-per-tile",      po::bool_switch(&global.adaptive_ip_per_tile)->default_value(false)->implicit_value(true),
+       "Share the interest points among the image tiles in proportion with their texture, for about the same total, and skip flat tiles.")
       ("ip-triangulation-max-error", po::value(&global.ip_triangulation_max_error)->default_value(-1),
        "When matching IP, filter out any pairs with a triangulation error higher than this.")
       ("ip-num-ransac-iterations", po::value(&global.ip_num_ransac_iterations)->default_value(100),
@@ -191,6 +204,12 @@ namespace asp {
        "Turn on atmospheric refraction correction for Optical Bar and non-ISIS linescan cameras. This option impairs the convergence of bundle adjustment.")
       ("dg-use-csm", po::bool_switch(&global.dg_use_csm)->default_value(false)->implicit_value(true),
        "Use the CSM model with DigitalGlobe linescan cameras (-t dg). No corrections are done for velocity aberration or atmospheric refraction.")
+      ("dense-ephemeris-tables", po::bool_switch(&global.dense_ephemeris_tables)->default_value(false)->implicit_value(true),
+       "Sample the positions and orientations of DigitalGlobe (without --dg-use-csm) and PeruSat cameras at fine time steps when loading them, and look them up from this table. This makes these cameras faster. A table is not used if it differs from the camera by more than 0.01 pixels.")
+      ("isis-camera-pool", po::bool_switch(&global.isis_camera_pool)->default_value(false)->implicit_value(true),
+       "Give each thread its own ISIS camera, opened from the same cube, so that ISIS cameras can be used with multiple threads. This uses more memory. The cubes must have been spiceinit-ed with the SPICE data attached (the default).")
+      ("mmap-aligned-images", po::bool_switch(&global.mmap_aligned_images)->default_value(false)->implicit_value(true),
+       "Write L.tif and R.tif uncompressed and tiled, and have all later stages read them via memory mapping. Then the processes on a machine share the same pages in the operating system cache rather than each decompressing its own copy. This uses more disk space. Must be set for all stages.")
 
       // For bathymetry correction
       ("left-bathy-mask", po::value(&global.left_bathy_mask),
@@ -217,6 +236,8 @@ namespace asp {
                      "Correlation seed strategy. [0 None, 1 Use low-res disparity from stereo, 2 Use low-res disparity from provided DEM (see disparity-estimation-dem), 3 Use low-res disparity produced by sparse_disp (in development)]")
       ("min-num-ip",             po::value(&global.min_num_ip)->default_value(30),
                      "The minimum number of interest points which must be found to estimate the search range.")
+      ("guided-ip-matching",     po::bool_switch(&global.guided_ip_matching)->default_value(false)->implicit_value(true),
+                     "With --corr-seed-mode 1, estimate the search range from interest points matched in the low-resolution images, then match the full-resolution interest points only near where the low-resolution disparity predicts them.")
       ("corr-sub-seed-percent",  po::value(&global.seed_percent_pad)->default_value(0.25),
                      "Expand the search range by this factor when computing the low-resolution disparity.")
       ("cost-mode",              po::value(&global.cost_mode)->default_value(2),
@@ -263,10 +284,12 @@ namespace asp {
                      "DEM to use in estimating the low-resolution disparity (when corr-seed-mode is 2).")
       ("disparity-estimation-dem-error", po::value(&global.disparity_estimation_dem_error)->default_value(0.0),
                      "Error (in meters) of the disparity estimation DEM.")
+      ("dem-disparity-cache-dir", po::value(&global.dem_disparity_cache_dir)->default_value(""),
+                     "Save the low-resolution disparity found from a DEM (when corr-seed-mode is 2) in this directory, named by a hash of the DEM, cameras, and alignment, and reuse it when all match, across runs.")
       ("corr-timeout",           po::value(&global.corr_timeout)->default_value(global.default_corr_timeout),
                      "Correlation timeout for an image tile, in seconds.")
       ("stereo-algorithm",       po::value(&global.stereo_algorithm)->default_value("asp_bm"),
-                     "Stereo algorithm to use. Options: asp_bm, asp_sgm, asp_mgm, asp_final_mgm, mgm (original author implementation), opencv_sgbm, libelas, msmw, msmw2, and opencv_bm.")
+                     "Stereo algorithm to use. Options: asp_bm, asp_sgm, asp_mgm, asp_final_mgm, mgm (original author implementation), opencv_sgbm, libelas, msmw, msmw2, opencv_bm, asp_fast_bm, and asp_fast_sgm.")
       ("corr-blob-filter",       po::value(&global.corr_blob_filter_area)->default_value(0),
                      "Filter blobs this size or less in correlation pyramid step.")
       ("corr-tile-size",         po::value(&global.corr_tile_size_ovr)->default_value(ASPGlobalOptions::corr_tile_size()),
@@ -279,6 +302,8 @@ namespace asp {
        "Keep correlation memory usage (per tile) close to this limit.  Important for SGM/MGM.")
       ("correlator-mode", po::bool_switch(&global.correlator_mode)->default_value(false)->implicit_value(true),
        "Function as an image correlator only (including with subpixel refinement). Assume no cameras, aligned input images, and stop before triangulation, so at filtered disparity.")
+      ("checkpoint-corr-tiles", po::bool_switch(&global.checkpoint_corr_tiles)->default_value(false)->implicit_value(true),
+       "Save each finished tile of the full-resolution disparity to <output prefix>-D-checkpoint/ and record it in a manifest. If the run is interrupted, rerunning with this option computes only the missing tiles. The checkpoint is deleted once D.tif is written.")
 
       ("stereo-debug",   po::bool_switch(&global.stereo_debug)->default_value(false)->implicit_value(true),
                      "Write stereo debug images and output.")
@@ -369,7 +394,9 @@ namespace asp {
       ("casp-go-param-file", po::value(&global.casp_go_param_file)->default_value(""),
        "The parameter file to use with Gotcha (and in the future other CASP-GO functionality) when invoking the 'gotcha-disparity-refinement' option. The default is to use the file 'share/CASP-GO_params.xml' shipped with ASP.")
       ("mask-flatfield",      po::bool_switch(&global.mask_flatfield)->default_value(false)->implicit_value(true),
-                              "Mask dust found on the sensor or film. (For use with Apollo Metric Cameras only.)");
+                              "Mask dust found on the sensor or film. (For use with Apollo Metric Cameras only.)")
+      ("fuse-refinement-filtering", po::bool_switch(&global.fuse_refinement_filtering)->default_value(false)->implicit_value(true),
+                              "Do not write the refined disparity RD.tif. Instead, refine each tile in memory during filtering, and write only F.tif. With parallel_stereo the refinement is then done by a single stereo_fltr process, not on the nodes. Cannot be used with --mask-flatfield or --enable-fill-holes, or with an SGM subpixel mode when the disparity is blended from tiles.");
 
     po::options_description backwards_compat_options("Aliased backwards compatibility options");
     // Do not add default values here. They may override the values set
@@ -395,9 +422,12 @@ namespace asp {
             "If positive, points with triangulation error larger than this will be removed from the cloud. Measured in meters.")
       ("bundle-adjust-prefix", po::value(&global.bundle_adjust_prefix),
        "Use the camera adjustments obtained by previously running bundle_adjust with this output prefix.")
+      ("camera-cache-dir", po::value(&global.camera_cache_dir)->default_value(""),
+       "Keep in this directory the states of the CSM camera models loaded from ISD files, so that the later stereo steps and tiles load those directly, without loading the CSM plugins. The default is <output prefix>-camera-cache. Set to NONE to not keep them.")
       ("unalign-disparity",                 po::bool_switch(&global.unalign_disparity)->default_value(false)->implicit_value(true),
        "Take the computed disparity, and compute the disparity between unaligned images.")
       ("num-matches-from-disparity", po::value(&global.num_matches_from_disparity)->default_value(0), "Create a match file with this many points uniformly sampled from the stereo disparity. The matches are between original images (that is, before any alignment or map-projection). See also num-matches-from-disp-triplets.")
+      ("matches-from-disp-samples-per-bin", po::value(&global.matches_from_disp_samples_per_bin)->default_value(1), "With --num-matches-from-disparity, the disparity is split into as many bins as matches, and the match in each bin is at its center. If this is more than 1, try up to this many pseudo-random pixels in each bin, starting with the center, and keep the first with a valid disparity. Then bins whose center has no valid disparity can have matches too.")
       ("num-matches-from-disp-triplets", po::value(&global.num_matches_from_disp_triplets)->default_value(0), "Create a match file with this many points uniformly sampled from the stereo disparity, while making sure that if there are more than two images, a set of ground features are represented by matches in at least three of them. The matches are between original images (that is, before any alignment or map-projection). The file name is <output prefix>-disp-<left image>__<right image>.match.")
       ("image-lines-per-piecewise-adjustment", po::value(&global.image_lines_per_piecewise_adjustment)->default_value(0), "A positive value, e.g., 1000, will turn on using piecewise camera adjustments to help reduce jitter effects. Use one adjustment per this many image lines.")
       ("piecewise-adjustment-percentiles",     po::value(&global.piecewise_adjustment_percentiles)->default_value(Vector2(5, 95), "5 95"), "A narrower range will place the piecewise adjustments for jitter correction closer together and further from the first and last lines in the image.")
@@ -406,6 +436,8 @@ namespace asp {
       ("piecewise-adjustment-camera-weight", po::value(&global.piecewise_adjustment_camera_weight)->default_value(1.0), "The weight to use for the sum of squares of adjustments component of the cost function. Increasing this value will constrain the adjustments to be smaller.")
       ("point-cloud-rounding-error",        po::value(&global.point_cloud_rounding_error)->default_value(0.0),
                                             "How much to round the output point cloud values, in meters (more rounding means less precision but potentially smaller size on disk). The inverse of a power of 2 is suggested. Default: 1/2^10 for Earth and proportionally less for smaller bodies.")
+      ("compact-point-cloud",               po::bool_switch(&global.compact_point_cloud)->default_value(false)->implicit_value(true),
+                                            "Write the point cloud with the floating point predictor and ZSTD compression (or DEFLATE, if GDAL has no ZSTD). This makes it several times smaller, as its values are rounded.")
       ("save-double-precision-point-cloud", po::bool_switch(&global.save_double_precision_point_cloud)->default_value(false)->implicit_value(true),
                                             "Save the final point cloud in double precision rather than bringing the points closer to origin and saving as float (marginally more precision at twice the storage).")
       ("compute-point-cloud-center-only",   po::bool_switch(&global.compute_point_cloud_center_only)->default_value(false)->implicit_value(true),
@@ -420,6 +452,18 @@ namespace asp {
        "Skip computing the piecewise adjustments for jitter, they should have been done by now.")
       ("use-least-squares",                 po::bool_switch(&global.use_least_squares)->default_value(false)->implicit_value(true),
        "Use rigorous least squares triangulation process. This is slow for ISIS processes.")      
+      ("triangulation-ray-spacing", po::value(&global.triangulation_ray_spacing)->default_value(16),
+       "Find the camera rays exactly only on a lattice of camera pixels this far apart in each tile, and interpolate them in between. Parts of a tile where this is not accurate enough use the exact rays. Set to 0 to find each ray exactly. Used only with two images and no bathymetry or least squares.")
+      ("triangulation-ray-max-error", po::value(&global.triangulation_ray_max_error)->default_value(0.05),
+       "The largest distance between a point triangulated with interpolated rays and with exact rays, as a fraction of the ground size of a pixel. Checked at one pixel per lattice cell of the tile.")
+      ("triangulation-max-views",           po::value(&global.triangulation_max_views)->default_value(0),
+       "With more than two images, triangulate each tile from at most this many of them, counting the left image. The views with the most valid disparities and the largest convergence angles in the tile are kept. Set to 0 to use all views. A view with no valid disparity in a tile is always skipped for it.")
+      ("direct-dem",                        po::bool_switch(&global.direct_dem)->default_value(false)->implicit_value(true),
+       "Grid the triangulated points straight into <output prefix>-DEM.tif, as point2dem would with its default options, instead of writing the point cloud <output prefix>-PC.tif. Does not work with parallel_stereo.")
+      ("direct-dem-spacing",                po::value(&global.direct_dem_spacing)->default_value(0.0),
+       "The grid size of the DEM made with --direct-dem, in the units of its projection. If not set, it is found from the point cloud, as in point2dem.")
+      ("direct-dem-srs",                    po::value(&global.direct_dem_srs)->default_value(""),
+       "The projection of the DEM made with --direct-dem, as a PROJ or WKT string. If not set, use the georeference of the left image, as point2dem would for the point cloud.")
       ;
   }
 
@@ -455,6 +499,16 @@ namespace asp {
        "Delete any subsampled and other files created by the GUI when exiting.")
       ("create-image-pyramids-only",   po::bool_switch(&global.create_image_pyramids_only)->default_value(false)->implicit_value(true),
        "Without starting the GUI, build multi-resolution pyramids for the inputs, to be able to load them fast later.")
+      ("pyramid-cache-dir", po::value(&global.pyramid_cache_dir)->default_value(""),
+       "Build the multi-resolution pyramids of the input images in this directory, rather than next to the images, and reuse them when the same images are opened again. An image which changed gets new pyramids.")
+      ("lazy-load",   po::bool_switch(&global.lazy_load)->default_value(false)->implicit_value(true),
+       "Read only the size and georeference of the images on startup, and open the pyramid of an image when it is first in view. Useful with a large number of images.")
+      ("max-open-images", po::value(&global.max_open_images)->default_value(50),
+       "With --lazy-load, keep open the pyramids of at most this many images, closing first the ones which were in view least recently. The images in view are always open.")
+      ("render-stats",   po::bool_switch(&global.render_stats)->default_value(false)->implicit_value(true),
+       "Print for each redraw how long it took, which pyramid levels were used, the image tiles found in the cache and those missing, the data read, and the tiles waiting to be read. Useful to find why the display is slow.")
+      ("remote-cache-size-mb", po::value(&global.remote_cache_size_mb)->default_value(256),
+       "For images read over HTTP or S3, keep in memory up to this many megabytes of the blocks already read, so panning back over them does not fetch them again.")
       ("pairwise-matches",   po::bool_switch(&global.pairwise_matches)->default_value(false)->implicit_value(true), "Show images side-by-side. If just two of them are selected, load their corresponding match file, determined by the output prefix. Also accessible from the menu.")
       ("pairwise-clean-matches",   po::bool_switch(&global.pairwise_clean_matches)->default_value(false)->implicit_value(true), "Same as --pairwise-matches, but use *-clean.match files.")
       ("nvm", po::value(&global.nvm)->default_value(""),
@@ -480,7 +534,11 @@ namespace asp {
     StereoSettings& global = stereo_settings();
     (*this).add_options()
       ("tile-at-location", po::value(&global.tile_at_loc)->default_value(""),
-       "Find the tile in the current parallel_stereo run which generated the DEM portion having this lon-lat-height location. Specify as a string in quotes: 'lon lat height'. Use this option with stereo_parse and the rest of options used in parallel_stereo, including cameras, output prefix, etc. (except for those needed for tiling and parallelization). This does not work with mapprojected images.");
+       "Find the tile in the current parallel_stereo run which generated the DEM portion having this lon-lat-height location. Specify as a string in quotes: 'lon lat height'. Use this option with stereo_parse and the rest of options used in parallel_stereo, including cameras, output prefix, etc. (except for those needed for tiling and parallelization). This does not work with mapprojected images.")
+      ("tile-cost-file", po::value(&global.tile_cost_file)->default_value(""),
+       "Estimate the relative full-resolution correlation cost of each tile of a parallel_stereo run, based on D_sub, and save it to this file, with one line per tile having its index and cost. The tiles have the size given by --job-size-w and --job-size-h. This is used by parallel_stereo to start the most expensive tiles first.")
+      ("tile-hash-file", po::value(&global.tile_hash_file)->default_value(""),
+       "For each tile of a parallel_stereo run, find a hash of the data in L.tif, R.tif, and D_sub which its correlation depends on, and save these to this file, one line per tile. The tiles have the size given by --job-size-w and --job-size-h. This is used by parallel_stereo --incremental.");
   }
 
   // Options for parallel_stereo. These are not used by the stereo
@@ -521,6 +579,8 @@ namespace asp {
     StereoSettings& global = stereo_settings();
     (*this).add_options()
       ("trans-crop-win", po::value(&global.trans_crop_win)->default_value(BBox2i(0, 0, 0, 0), "xoff yoff xsize ysize"), "Left image crop window in respect to L.tif. This is an internal option. [default: use the entire image].")
+      ("tile-mosaic", po::value(&global.tile_mosaic)->default_value(""),
+       "Write the output of this tile, in the region given by --trans-crop-win, into this tiled GeoTIFF, making it if needed, and delete the output of the tile. This is an internal option, set by parallel_stereo --assemble-tiles.")
       ("attach-georeference-to-lowres-disparity", po::bool_switch(&global.attach_georeference_to_lowres_disparity)->default_value(false)->implicit_value(true),
        "If input images are georeferenced, make D_sub and D_sub_spread georeferenced.");
   }
@@ -536,7 +596,16 @@ namespace asp {
        "Usually the program can select this automatically by the file extension, "
        "except for XML cameras. See the doc for options.")
       ("stereo-file,s", po::value(&opt.stereo_default_filename)->default_value("./stereo.default"),
-       "Explicitly specify the stereo.default file to use.");
+       "Explicitly specify the stereo.default file to use.")
+      ("stage-report", po::bool_switch(&opt.stage_report)->default_value(false)->implicit_value(true),
+       "Save the wall and CPU time, peak memory, and bytes read and written "
+       "for each stage, as <output prefix>-<stage>-report.json. For parallel_stereo, "
+       "these are merged over all tiles into <output prefix>-stage-report.json.")
+      ("settings-snapshot", po::value(&opt.settings_snapshot)->default_value(""),
+       "Read the stereo.default options from this file, written by stereo_parse "
+       "with the same option, rather than parsing stereo.default. Used by "
+       "parallel_stereo for the processes of each tile. If the file is missing or "
+       "stereo.default changed since, stereo.default is parsed as usual.");
   }
   
   po::options_description
@@ -693,4 +762,213 @@ namespace asp {
 
     return parse_asp_config_file(strm, desc, allow_unregistered);
   }
+
+namespace {
+
+  // A hash of the contents and name of a stereo.default file. A missing
+  // file hashes as an empty one, as it is parsed as such.
+  std::uint64_t stereo_default_hash(std::string const& stereo_default_file) {
+    std::ifstream ifs(stereo_default_file.c_str(), std::ios::binary);
+    std::ostringstream os;
+    if (ifs)
+      os << ifs.rdbuf();
+    return asp::hash_string(os.str() + "\n" + stereo_default_file);
+  }
+
+  // Write an option value as a type tag followed by the value, on one
+  // line, except for a list of strings, which has one per line. Return
+  // false for types not used by the stereo options.
+  bool write_snapshot_value(std::ostream & os, boost::any const& v) {
+    if (v.type() == typeid(bool)) {
+      os << "bool " << boost::any_cast<bool>(v);
+    } else if (v.type() == typeid(int)) {
+      os << "int " << boost::any_cast<int>(v);
+    } else if (v.type() == typeid(vw::uint16)) {
+      os << "uint16 " << boost::any_cast<vw::uint16>(v);
+    } else if (v.type() == typeid(size_t)) {
+      os << "size_t " << boost::any_cast<size_t>(v);
+    } else if (v.type() == typeid(float)) {
+      os << "float " << std::setprecision(9) << boost::any_cast<float>(v);
+    } else if (v.type() == typeid(double)) {
+      os << "double " << std::setprecision(17) << boost::any_cast<double>(v);
+    } else if (v.type() == typeid(vw::Vector2i)) {
+      vw::Vector2i u = boost::any_cast<vw::Vector2i>(v);
+      os << "Vector2i " << u[0] << " " << u[1];
+    } else if (v.type() == typeid(vw::Vector2)) {
+      vw::Vector2 u = boost::any_cast<vw::Vector2>(v);
+      os << "Vector2 " << std::setprecision(17) << u[0] << " " << u[1];
+    } else if (v.type() == typeid(vw::BBox2i)) {
+      vw::BBox2i b = boost::any_cast<vw::BBox2i>(v);
+      os << "BBox2i " << b.min().x() << " " << b.min().y() << " "
+         << b.max().x() << " " << b.max().y();
+    } else if (v.type() == typeid(vw::BBox2)) {
+      vw::BBox2 b = boost::any_cast<vw::BBox2>(v);
+      os << "BBox2 " << std::setprecision(17) << b.min().x() << " " << b.min().y() << " "
+         << b.max().x() << " " << b.max().y();
+    } else if (v.type() == typeid(std::string)) {
+      std::string const& u = boost::any_cast<std::string const&>(v);
+      if (u.find('\n') != std::string::npos)
+        return false;
+      os << "string " << u;
+    } else if (v.type() == typeid(std::vector<std::string>)) {
+      std::vector<std::string> const& u = boost::any_cast<std::vector<std::string> const&>(v);
+      os << "strings " << u.size();
+      for (size_t it = 0; it < u.size(); it++) {
+        if (u[it].find('\n') != std::string::npos)
+          return false;
+        os << "\n" << u[it];
+      }
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  // The inverse of write_snapshot_value(), with the tag already read
+  bool read_snapshot_value(std::istream & is, std::string const& tag, boost::any & v) {
+    if (tag == "string" || tag == "strings") {
+      std::string line;
+      if (is.peek() == ' ')
+        is.get();
+      if (!std::getline(is, line))
+        return false;
+      if (tag == "string") {
+        v = line;
+        return true;
+      }
+      std::istringstream ls(line);
+      size_t num = 0;
+      if (!(ls >> num))
+        return false;
+      std::vector<std::string> u(num);
+      for (size_t it = 0; it < num; it++) {
+        if (!std::getline(is, u[it]))
+          return false;
+      }
+      v = u;
+      return true;
+    }
+
+    std::string line;
+    if (!std::getline(is, line))
+      return false;
+    std::istringstream ls(line);
+    if (tag == "bool") {
+      bool u; if (!(ls >> u)) return false; v = u;
+    } else if (tag == "int") {
+      int u; if (!(ls >> u)) return false; v = u;
+    } else if (tag == "uint16") {
+      vw::uint16 u; if (!(ls >> u)) return false; v = u;
+    } else if (tag == "size_t") {
+      size_t u; if (!(ls >> u)) return false; v = u;
+    } else if (tag == "float") {
+      float u; if (!(ls >> u)) return false; v = u;
+    } else if (tag == "double") {
+      double u; if (!(ls >> u)) return false; v = u;
+    } else if (tag == "Vector2i") {
+      vw::Vector2i u; if (!(ls >> u[0] >> u[1])) return false; v = u;
+    } else if (tag == "Vector2") {
+      vw::Vector2 u; if (!(ls >> u[0] >> u[1])) return false; v = u;
+    } else if (tag == "BBox2i") {
+      vw::Vector2i a, b;
+      if (!(ls >> a[0] >> a[1] >> b[0] >> b[1])) return false;
+      v = vw::BBox2i(a, b);
+    } else if (tag == "BBox2") {
+      vw::Vector2 a, b;
+      if (!(ls >> a[0] >> a[1] >> b[0] >> b[1])) return false;
+      v = vw::BBox2(a, b);
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+} // end anonymous namespace
+
+  void write_settings_snapshot(std::string const& snapshot_file,
+                               std::string const& stereo_default_file,
+                               po::variables_map const& cfg_vm) {
+    namespace fs = boost::filesystem;
+
+    std::ostringstream os;
+    os << "stereo_default_hash " << stereo_default_hash(stereo_default_file) << "\n";
+    for (po::variables_map::const_iterator it = cfg_vm.begin(); it != cfg_vm.end(); it++) {
+      if (it->second.defaulted() || it->second.empty())
+        continue;
+      os << it->first << " ";
+      if (!write_snapshot_value(os, it->second.value())) {
+        vw_out(WarningMessage) << "Cannot save the value of option " << it->first
+                               << " to the settings snapshot. Not writing: "
+                               << snapshot_file << "\n";
+        return;
+      }
+      os << "\n";
+    }
+
+    // Other processes may read it meanwhile, so write it in full first
+    std::ostringstream tmp;
+    tmp << snapshot_file << "-tmp" << getpid();
+    std::string tmp_file = tmp.str();
+    try {
+      vw::create_out_dir(snapshot_file);
+      std::ofstream ofs(tmp_file.c_str());
+      ofs << os.str();
+      ofs.close();
+      if (!ofs)
+        vw_throw(IOErr() << "Cannot write: " << tmp_file << "\n");
+      fs::rename(tmp_file, snapshot_file);
+    } catch (std::exception const& e) {
+      // The snapshot only saves time, so do not fail the run
+      vw_out(WarningMessage) << "Could not write the settings snapshot: "
+                             << e.what() << "\n";
+    }
+  }
+
+  bool load_settings_snapshot(std::string const& snapshot_file,
+                              std::string const& stereo_default_file,
+                              po::options_description const& desc,
+                              po::variables_map & vm) {
+
+    std::ifstream ifs(snapshot_file.c_str());
+    if (!ifs)
+      return false;
+
+    std::string key;
+    std::uint64_t hash = 0;
+    if (!(ifs >> key >> hash) || key != "stereo_default_hash" ||
+        hash != stereo_default_hash(stereo_default_file))
+      return false;
+
+    // Read all values before changing anything
+    std::vector<std::pair<std::string, boost::any>> values;
+    std::string name, tag;
+    while (ifs >> name >> tag) {
+      boost::any v;
+      if (!read_snapshot_value(ifs, tag, v))
+        return false;
+      // Options for other programs, such as the positional ones of
+      // multiview stereo, do not apply here.
+      if (desc.find_nothrow(name, false) == NULL)
+        continue;
+      values.push_back(std::make_pair(name, v));
+    }
+
+    for (size_t it = 0; it < values.size(); it++) {
+      std::string const& opt_name = values[it].first;
+      po::variables_map::iterator vm_it = vm.find(opt_name);
+      if (vm_it != vm.end() && !vm_it->second.defaulted())
+        continue; // set on the command line
+
+      // The variables map runs notifiers only for the values it stored
+      // itself, so set the bound variable here.
+      boost::any const& v = values[it].second;
+      if (vm_it != vm.end())
+        vm.erase(vm_it);
+      vm.insert(std::make_pair(opt_name, po::variable_value(v, false)));
+      desc.find(opt_name, false).semantic()->notify(v);
+    }
+
+    return true;
+  }
+
 } // end namespace asp
@@ -45,6 +45,8 @@ namespace asp {
     boost::shared_ptr<asp::StereoSession> session; // Used to extract cameras
     // Output
     std::string out_prefix;
+    bool stage_report; // Save the resources used by each stage to a JSON file
+    std::string settings_snapshot; // Options from stereo.default, already parsed
     
     // Constants
     static int   corr_tile_size() { return 1024; } // Tile size for correlation
@@ -100,6 +102,7 @@ namespace asp {
     std::string bathy_plane, output_cloud_type;
     double refraction_index;
     
+    bool   mmap_aligned_images;             /// Write L.tif and R.tif uncompressed, read via mmap
     bool   force_use_entire_range;          /// Use entire dynamic range of image
     bool   individually_normalize;          /// If > 1, normalize the images
                                             ///         individually with their
@@ -114,8 +117,11 @@ namespace asp {
     double ip_inlier_factor;                /// General scaling factor for IP finding, a larger value allows more IPs to match.
     double ip_uniqueness_thresh;            /// Min percentage distance between closest and second closest IP descriptors.
     double ip_nodata_radius;                /// Remove IP near nodata with this radius, in pixels.
+    std::string ip_cache_dir;               ///< Share detected IP across runs and tools in this directory.
+    bool   adaptive_ip_per_tile;            ///< Give more IP to the more textured tiles.
     double ip_triangulation_max_error;      ///< Remove IP matches with triangulation error higher than this.
     int    ip_num_ransac_iterations;        ///< How many ransac iterations to do in ip matching.
+    int    ip_num_ransac_threads;           ///< Threads for ip matching RANSAC. 0 means all.
     bool   disable_tri_filtering;           ///< Turn of tri-ip filtering.
     
     int num_scales;                         /// How many scales to use if detecting interest points with OBALoG. If not specified, 8 will be used. 
@@ -148,6 +154,8 @@ namespace asp {
     int disparity_range_expansion_percent; ///< Expand the estimated disparity range by this percentage before computing the stereo correlation with local alignment
 
     bool dg_use_csm; // Use the CSM camera model with Digital Globe images.
+    bool dense_ephemeris_tables; // Look up linescan camera positions and poses from a table
+    bool isis_camera_pool; // Open one ISIS camera per thread, to use several threads
     
     // Correlation options
     
@@ -165,6 +173,7 @@ namespace asp {
                                       //     (in development)
 
     int   min_num_ip;                 ///< Minimum number of IP's needed for search range estimation.
+    bool  guided_ip_matching;         ///< Find the search range from low-res ip, match full-res ip using D_sub
 
     float seed_percent_pad;           ///< Pad amound towards the IP found
     vw::uint16 cost_mode;             // 0 = absolute difference
@@ -188,6 +197,7 @@ namespace asp {
     bool skip_low_res_disparity_comp;
     std::string disparity_estimation_dem;     // DEM to use in estimating the low-resolution disparity
     double disparity_estimation_dem_error; // Error (in meters) of the disparity estimation DEM
+    std::string dem_disparity_cache_dir;   // Share the low-res disparity from a DEM across runs
     int    corr_timeout;              // Correlation timeout for a tile, in seconds
     int default_corr_timeout;         // Will be used to adjust corr_timeout
     std::string stereo_algorithm;     // See StereoSettings.cc for the possible values.
@@ -197,6 +207,7 @@ namespace asp {
     vw::Vector2i sgm_search_buffer;   // Search padding in SGM around previous pyramid level disparity value.
     size_t corr_memory_limit_mb;      // Correlation memory limit, only important for SGM/MGM.
     bool   correlator_mode;           // Use the correlation logic only (including subpixel rfne). 
+    bool   checkpoint_corr_tiles;     // Save finished D.tif tiles and reuse them on a rerun
     bool   stereo_debug;              // Write stereo debug images and messages
     bool   local_alignment_debug;     // Debug local alignment
 
@@ -242,6 +253,7 @@ namespace asp {
     int   disp_smooth_size;           // Adaptive disparity smoothing size
     float disp_smooth_texture;        // Adaptive disparity smoothing max texture value    
     bool  gotcha_disparity_refinement;
+    bool  fuse_refinement_filtering;  // Refine in memory during filtering, with no RD.tif
     std::string casp_go_param_file;
 
     // Triangulation options
@@ -249,9 +261,11 @@ namespace asp {
     float  near_universe_radius;      // Radius of the universe in meters
     float  far_universe_radius;       // Radius of the universe in meters
     std::string bundle_adjust_prefix; // Use the camera adjustments obtained by previously running bundle_adjust with the output prefix specified here.
+    std::string camera_cache_dir; // Where to keep the states of CSM cameras loaded from ISD files
 
     // Pull this many matches from the stereo disparity
     int num_matches_from_disparity, num_matches_from_disp_triplets;
+    int matches_from_disp_samples_per_bin; // try this many pixels per bin for the above
     
     // piecewise adjustments
     int image_lines_per_piecewise_adjustment;
@@ -267,8 +281,15 @@ namespace asp {
     double min_triangulation_angle;           // min angle for valid triangulation
     double max_valid_triangulation_error;
     bool   use_least_squares;                 // Use a more rigorous triangulation
+    int    triangulation_ray_spacing;         // Interpolate the rays between lattice nodes
+    double triangulation_ray_max_error;       // Tolerance, in ground pixels, for interpolated rays
+    int    triangulation_max_views;           // Per tile, with multiview
+    bool   direct_dem;                        // Grid the points into a DEM, with no point cloud
+    double direct_dem_spacing;
+    std::string direct_dem_srs;
     bool   save_double_precision_point_cloud; // Save final point cloud in double precision rather than bringing the points closer to origin and saving as float (marginally more precision at 2x the storage).
     double point_cloud_rounding_error;        // How much to round the output point cloud values
+    bool   compact_point_cloud;               // Use a predictor and fast codec for the point cloud
     bool   compute_point_cloud_center_only;   // Only compute the center of triangulated point cloud and exit.
     bool   skip_point_cloud_center_comp;
     bool   unalign_disparity;                 // Compute disparity between unaligned images
@@ -284,6 +305,11 @@ namespace asp {
     std::string match_file, gcp_file, dem_file, csv_datum, csv_format_str, csv_proj4, nvm;
     bool delete_temporary_files_on_exit;
     bool create_image_pyramids_only, hide_all;
+    std::string pyramid_cache_dir;
+    bool lazy_load;
+    int max_open_images;
+    int remote_cache_size_mb;
+    bool render_stats;
     bool pairwise_matches, pairwise_clean_matches;
     std::vector<std::string> vwip_files;
     vw::BBox2 zoom_proj_win;
@@ -292,6 +318,8 @@ namespace asp {
     
     // stereo_parse options
     std::string tile_at_loc;
+    std::string tile_cost_file;
+    std::string tile_hash_file;
 
     // Options for parallel_stereo. These are not used, but accept
     // them quietly so that when stereo_gui or stereo_parse is invoked
@@ -301,6 +329,7 @@ namespace asp {
     
     // Undocumented options. We don't want these exposed to the user.
     vw::BBox2i trans_crop_win;        // Left image crop window in respect to L.tif.
+    std::string tile_mosaic;          // Write the output of a tile into this mosaic.
     bool attach_georeference_to_lowres_disparity;
 
     // Internal variable, to ensure we always initialize this class before using it
@@ -340,6 +369,24 @@ namespace asp {
                          const boost::program_options::options_description&,
                          bool allow_unregistered = false );
 
+  /// Save the options which were set in the stereo.default file, that
+  /// is, the non-defaulted entries of a variables map filled only from
+  /// it, together with a hash of that file. Warn and write nothing if
+  /// an option has a type which cannot be saved.
+  void write_settings_snapshot(std::string const& snapshot_file,
+                               std::string const& stereo_default_file,
+                               boost::program_options::variables_map const& cfg_vm);
+
+  /// Instead of parsing the stereo.default file, set the options from
+  /// a snapshot of it. As when storing parsed options, those which
+  /// were set on the command line are kept. Return false, and change
+  /// nothing, if the snapshot is missing, cannot be read, or was made
+  /// from a different stereo.default file.
+  bool load_settings_snapshot(std::string const& snapshot_file,
+                              std::string const& stereo_default_file,
+                              boost::program_options::options_description const& desc,
+                              boost::program_options::variables_map & vm);
+
 }
 
 #endif//__ASP_CORE_STEREO_SETTINGS_H__
@@ -16,6 +16,7 @@
 // __END_LICENSE__
 
 #include <vw/Core/System.h>
+#include <vw/Core/Thread.h>
 #include <vw/Core/ThreadPool.h>
 #include <vw/Image/MaskViews.h>
 #include <boost/foreach.hpp>
@@ -25,6 +26,44 @@
 
 namespace asp {
 
+  /// The index of the first of n pixels which differs from the mask
+  /// value, or n if there is none. Pixels are compared in chunks
+  /// without branching, which the compiler can vectorize, so long runs
+  /// of nodata, such as the borders of satellite images, are skipped fast.
+  template <class PixelT>
+  vw::int32 first_valid_pixel(PixelT const* pix, vw::int32 n, PixelT const& mask_value) {
+    const vw::int32 CHUNK = 32;
+    vw::int32 i = 0;
+    for ( ; i + CHUNK <= n; i += CHUNK ) {
+      bool all_masked = true;
+      for ( vw::int32 k = 0; k < CHUNK; k++ )
+        all_masked &= (pix[i + k] == mask_value);
+      if ( !all_masked )
+        break;
+    }
+    while ( i < n && pix[i] == mask_value )
+      i++;
+    return i;
+  }
+
+  /// The index of the last of n pixels which differs from the mask
+  /// value, or -1 if there is none.
+  template <class PixelT>
+  vw::int32 last_valid_pixel(PixelT const* pix, vw::int32 n, PixelT const& mask_value) {
+    const vw::int32 CHUNK = 32;
+    vw::int32 i = n;
+    for ( ; i - CHUNK >= 0; i -= CHUNK ) {
+      bool all_masked = true;
+      for ( vw::int32 k = 1; k <= CHUNK; k++ )
+        all_masked &= (pix[i - k] == mask_value);
+      if ( !all_masked )
+        break;
+    }
+    while ( i > 0 && pix[i - 1] == mask_value )
+      i--;
+    return i - 1;
+  }
+
   /// Quick way to check which pixels are inside the valid input mask??
   template <class ViewT>
   class ThreadedEdgeMaskView : public vw::ImageViewBase<ThreadedEdgeMaskView<ViewT> > {
@@ -51,19 +90,16 @@ namespace asp {
       typedef boost::shared_array<vw::int32> SharedArray;
       SharedArray g_left, g_right, g_top, g_bottom;
       Array       m_left, m_right, m_top, m_bottom;
-      // This how much we increment after we test a pixel. Set to 1 if
-      // you wish to test every pixel.
-      const vw::int32 STEP_SIZE;
+      vw::Mutex & m_mutex; // protects the global arrays
     public:
       EdgeMaskTask(ViewT const& view,
                    typename ViewT::pixel_type mask_value,
-                   vw::int32 search_step,
                    vw::BBox2i bbox, SharedArray left, SharedArray right,
-                   SharedArray top, SharedArray bottom ) :
+                   SharedArray top, SharedArray bottom, vw::Mutex & mutex) :
         m_view(view), m_mask_value(mask_value), m_bbox(bbox), 
         g_left(left), g_right(right), g_top(top), g_bottom(bottom), 
         m_left( m_bbox.height() ), m_right( m_bbox.height() ), 
-        m_top( m_bbox.width() ), m_bottom( m_bbox.width() ), STEP_SIZE(search_step) {
+        m_top( m_bbox.width() ), m_bottom( m_bbox.width() ), m_mutex(mutex) {
 
         std::fill( m_left.begin  (), m_left.end  (), -1 );
         std::fill( m_right.begin (), m_right.end (), -1 );
@@ -73,66 +109,64 @@ namespace asp {
 
       void operator()() {
         using namespace vw;
+        typedef typename ViewT::pixel_type PixelT;
 
         // Rasterizing local tile
-        ImageView<typename ViewT::pixel_type> copy( crop(m_view, m_bbox ) );
+        ImageView<PixelT> copy( crop(m_view, m_bbox ) );
+        int32 cols = copy.cols(), rows = copy.rows();
 
         { // Detecting Edges
-          // Search left and right side
-          for ( int32 j = 0; j < copy.rows(); ++j ) { // Loop up through the rows in the local tile
-            int32 i = 0;
-            while ( i < copy.cols() && copy(i,j) == m_mask_value ) // Move from left to right in row by STEP_SIZE
-              i += STEP_SIZE;                                      //    until we hit an invalid pixel
-            if ( i > 0 ) i -= STEP_SIZE;                           // Walk back one step if we are not at col 0
-            while ( i < copy.cols() && copy(i,j) == m_mask_value ) // Now do the same thing but in steps of 1
-              ++i;
-            if ( i > 0 ) --i;
-            // Early exit condition if entire row was nodata
-            if ( i == copy.cols() -1 )
-              continue; // We're keeping left and right as -1
-            m_left[j] = i;                                         // Now we have the left-most valid column in the row
-
-            i = copy.cols() - 1;                                   // Do the same thing going right to left
-            while ( i >= 0 && copy(i,j) == m_mask_value )
-              i -= STEP_SIZE;
-            if ( i < copy.cols() - 1 )
-              i += STEP_SIZE;
-            while ( i >= 0 && copy(i,j) == m_mask_value )
-              --i;
-            if ( i < copy.cols() - 1 )
-              ++i;
-            m_right[j] = i;
+          // The edges are one pixel outside the outermost valid ones,
+          // but within the tile.
+
+          // Search left and right side of each row
+          for ( int32 j = 0; j < rows; ++j ) {
+            PixelT const* row = &copy(0, j);
+            int32 first = first_valid_pixel(row, cols, m_mask_value);
+            if ( first == cols )
+              continue; // Entire row was nodata, keeping left and right as -1
+            m_left [j] = std::max(first - 1, 0);
+            m_right[j] = std::min(last_valid_pixel(row, cols, m_mask_value) + 1, cols - 1);
           }
-                                                                   // Now find the first valid rows from the bottom
-          for ( int32 i = 0; i < copy.cols(); ++i ) {
-            int32 j = 0;
-            while ( j < copy.rows() && copy(i,j) == m_mask_value )
-              j += STEP_SIZE;
-            if ( j > 0 )
-              j -= STEP_SIZE;
-            while ( j < copy.rows() && copy(i,j) == m_mask_value )
-              ++j;
-            if ( j > 0 )
-              --j;
-            // Early exit condition if entire column was nodata
-            if ( j == copy.rows() - 1 )
-              continue; // We're keeping top and bottom as -1
-            m_top[i] = j;
-
-            j = copy.rows()-1;                                     // And the first valid rows from the top
-            while ( j >= 0 && copy(i,j) == m_mask_value )
-              j -= STEP_SIZE;
-            if ( j < copy.rows()-1 )
-              j += STEP_SIZE;
-            while ( j >= 0 && copy(i,j) == m_mask_value )
-              --j;
-            if ( j < copy.rows()-1 )
-              ++j;
-            m_bottom[i] = j;
+
+          // Find the first and last valid rows of each column. The
+          // rows are contiguous, so scan whole rows, starting from the
+          // top and then from the bottom, until each column has a
+          // valid pixel. Rows of nodata are skipped in chunks.
+          Array first_row(cols, -1), last_row(cols, -1);
+          int32 num_found = 0;
+          for ( int32 j = 0; j < rows && num_found < cols; ++j ) {
+            PixelT const* row = &copy(0, j);
+            for ( int32 i = first_valid_pixel(row, cols, m_mask_value); i < cols; ++i ) {
+              if ( first_row[i] == -1 && !(row[i] == m_mask_value) ) {
+                first_row[i] = j;
+                num_found++;
+              }
+            }
+          }
+          // Columns with no valid pixels do not have a last row either
+          int32 num_valid_cols = num_found;
+          num_found = 0;
+          for ( int32 j = rows - 1; j >= 0 && num_found < num_valid_cols; --j ) {
+            PixelT const* row = &copy(0, j);
+            for ( int32 i = first_valid_pixel(row, cols, m_mask_value); i < cols; ++i ) {
+              if ( last_row[i] == -1 && !(row[i] == m_mask_value) ) {
+                last_row[i] = j;
+                num_found++;
+              }
+            }
+          }
+
+          for ( int32 i = 0; i < cols; ++i ) {
+            if ( first_row[i] == -1 )
+              continue; // Entire column was nodata, keeping top and bottom as -1
+            m_top   [i] = std::max(first_row[i] - 1, 0);
+            m_bottom[i] = std::min(last_row[i] + 1, rows - 1);
           }
         }
 
         { // Merging result back into global perspective
+          Mutex::Lock lock(m_mutex);
           int32 l = 0;
           for ( int32 j = m_bbox.min()[1];                      // Loop through rows
                 j < m_bbox.max()[1]; j++ ) {
@@ -215,25 +249,16 @@ namespace asp {
 
       // Calculating edges in parallel
       FifoWorkQueue queue( vw_settings().default_num_threads() );
+      Mutex mutex;
 
       std::vector<BBox2i> bboxes = subdivide_bbox( m_view, block_size, block_size );
 
-      // Figure out an ideal search step size. Smaller means we're
-      // more likely to catch small features. Bigger step size means
-      // will move a lot faster.
-      int32 search_step = norm_2(Vector2i(m_view.cols(),m_view.rows())) / 500;
-      if (search_step < 1 )
-        search_step = 1;
-      if ( search_step > 10 ) 
-        search_step = 10;
-      VW_OUT(DebugMessage, "threadededgemask") << "Setting search step to "
-                                               << search_step << std::endl;
-
       // Find the outermost valid pixel coming in from each line/direction.
       BOOST_FOREACH( BBox2i const& box, bboxes ) {
         VW_OUT(DebugMessage, "threadededgemask") << "Created EdgeMaskTask for " << box << std::endl;
-        boost::shared_ptr<EdgeMaskTask> task(new EdgeMaskTask(m_view, mask_value, search_step, box, 
-                                                              m_left, m_right, m_top, m_bottom ) );
+        boost::shared_ptr<EdgeMaskTask> task(new EdgeMaskTask(m_view, mask_value, box, 
+                                                              m_left, m_right, m_top, m_bottom,
+                                                              mutex));
         queue.add_task(task);
       }
       queue.join_all(); // Wait for all tasks to complete
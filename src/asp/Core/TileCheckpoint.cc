@@ -0,0 +1,100 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file TileCheckpoint.cc
+///
+
+#include <asp/Core/TileCheckpoint.h>
+#include <vw/Core/Log.h>
+#include <vw/Core/Exception.h>
+
+#include <boost/filesystem.hpp>
+
+#include <fstream>
+#include <sstream>
+
+namespace fs = boost::filesystem;
+
+namespace asp {
+
+TileCheckpoint::TileCheckpoint(std::string const& checkpoint_dir):
+  m_dir(checkpoint_dir), m_num_reused(0) {
+
+  m_manifest = m_dir + "/manifest.txt";
+
+  if (!fs::exists(m_dir))
+    fs::create_directories(m_dir);
+
+  // Read the tiles finished in a previous run. The manifest is appended
+  // to only after a tile file is closed, so a truncated last line is
+  // the only possible damage. Such a line is skipped.
+  std::ifstream ifs(m_manifest.c_str());
+  std::string line;
+  while (std::getline(ifs, line)) {
+    std::istringstream is(line);
+    int minx, miny, width, height;
+    if (!(is >> minx >> miny >> width >> height))
+      continue;
+    vw::BBox2i box(minx, miny, width, height);
+    if (!fs::exists(tile_file(box)))
+      continue;
+    m_done.insert(tile_name(box));
+  }
+  m_num_reused = m_done.size();
+
+  if (m_num_reused > 0)
+    vw::vw_out() << "Found " << m_num_reused << " finished tile(s) in: " << m_dir << "\n";
+}
+
+std::string TileCheckpoint::tile_name(vw::BBox2i const& box) {
+  std::ostringstream os;
+  os << "tile-" << box.min().x() << "_" << box.min().y() << "_"
+     << box.width() << "_" << box.height();
+  return os.str();
+}
+
+std::string TileCheckpoint::tile_file(vw::BBox2i const& box) const {
+  return m_dir + "/" + tile_name(box) + ".tif";
+}
+
+bool TileCheckpoint::has_tile(vw::BBox2i const& box) const {
+  vw::Mutex::Lock lock(m_mutex);
+  return m_done.find(tile_name(box)) != m_done.end();
+}
+
+void TileCheckpoint::record_tile(vw::BBox2i const& box) {
+  vw::Mutex::Lock lock(m_mutex);
+
+  // Open and close the manifest for each tile so that it is flushed to
+  // disk right away, in case the process is killed.
+  std::ofstream ofs(m_manifest.c_str(), std::ios::app);
+  if (!ofs.good())
+    vw::vw_throw(vw::IOErr() << "Cannot write to: " << m_manifest << "\n");
+  ofs << box.min().x() << " " << box.min().y() << " "
+      << box.width() << " " << box.height() << "\n";
+  ofs.close();
+
+  m_done.insert(tile_name(box));
+}
+
+void TileCheckpoint::remove() {
+  vw::Mutex::Lock lock(m_mutex);
+  fs::remove_all(m_dir);
+  m_done.clear();
+}
+
+} // End namespace asp
@@ -0,0 +1,146 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file TileCheckpoint.h
+///
+/// Record the tiles of an output raster as they get finished, so that an
+/// interrupted run can be resumed by computing only the missing tiles.
+
+#ifndef __ASP_CORE_TILE_CHECKPOINT_H__
+#define __ASP_CORE_TILE_CHECKPOINT_H__
+
+#include <vw/Core/Thread.h>
+#include <vw/Math/BBox.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <vw/FileIO/GdalWriteOptions.h>
+#include <vw/Cartography/GeoReferenceUtils.h>
+
+#include <set>
+#include <string>
+
+namespace asp {
+
+  /// Each finished tile is saved as its own file in a checkpoint
+  /// directory. Its bounding box is appended to a manifest only after
+  /// the tile file was closed, so the manifest never lists a tile that
+  /// was not fully written.
+  class TileCheckpoint {
+  public:
+    /// Create the checkpoint directory if missing, and read the manifest
+    /// left by a previous run, if any.
+    TileCheckpoint(std::string const& checkpoint_dir);
+
+    /// If this tile was finished in a previous run. Only tiles with exactly
+    /// the same bounding box are reused.
+    bool has_tile(vw::BBox2i const& box) const;
+
+    /// The file storing the pixels of a given tile
+    std::string tile_file(vw::BBox2i const& box) const;
+
+    /// Append a tile to the manifest. Thread-safe.
+    void record_tile(vw::BBox2i const& box);
+
+    /// How many tiles were found in the manifest at startup
+    int num_reused() const { return m_num_reused; }
+
+    /// Wipe the checkpoint directory. To be called once the full output
+    /// raster was written successfully.
+    void remove();
+
+  private:
+    std::string m_dir, m_manifest;
+    std::set<std::string> m_done; // tile names, as produced by tile_name()
+    int m_num_reused;
+    mutable vw::Mutex m_mutex;
+
+    static std::string tile_name(vw::BBox2i const& box);
+  };
+
+  /// An image view which, for each tile it is asked to rasterize, either
+  /// reads that tile from the checkpoint directory, if it was finished
+  /// before, or computes it and saves it there. Only crops and per-pixel
+  /// views may sit between this and the final write, so that each tile it
+  /// sees is a write block, offset by the crop origin. The tile names
+  /// depend on that origin, so a resumed run must use the same crop.
+  template <class ImageT>
+  class CheckpointedView: public vw::ImageViewBase<CheckpointedView<ImageT>> {
+    ImageT m_child;
+    TileCheckpoint & m_checkpoint;
+    vw::GdalWriteOptions const& m_opt;
+
+  public:
+    typedef typename ImageT::pixel_type pixel_type;
+    typedef pixel_type result_type;
+    typedef vw::ProceduralPixelAccessor<CheckpointedView> pixel_accessor;
+
+    CheckpointedView(ImageT const& child, TileCheckpoint & checkpoint,
+                     vw::GdalWriteOptions const& opt):
+      m_child(child), m_checkpoint(checkpoint), m_opt(opt) {}
+
+    inline vw::int32 cols  () const { return m_child.cols(); }
+    inline vw::int32 rows  () const { return m_child.rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+    inline pixel_type operator()(double/*i*/, double/*j*/, vw::int32/*p*/ = 0) const {
+      vw::vw_throw(vw::NoImplErr() << "CheckpointedView::operator()(...) is not implemented");
+      return pixel_type();
+    }
+
+    typedef vw::CropView<vw::ImageView<pixel_type>> prerasterize_type;
+    inline prerasterize_type prerasterize(vw::BBox2i const& bbox) const {
+
+      std::string file = m_checkpoint.tile_file(bbox);
+      vw::ImageView<pixel_type> tile;
+
+      if (m_checkpoint.has_tile(bbox)) {
+        vw::DiskImageView<pixel_type> disk_tile(file);
+        if (disk_tile.cols() == bbox.width() && disk_tile.rows() == bbox.height()) {
+          tile = disk_tile;
+          return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+        }
+        vw::vw_out(vw::WarningMessage) << "Checkpointed tile " << file
+                                       << " has unexpected size. Recomputing it.\n";
+      }
+
+      tile = vw::crop(m_child, bbox);
+      vw::cartography::write_gdal_image(file, tile, m_opt);
+      m_checkpoint.record_tile(bbox);
+
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+
+    template <class DestT>
+    inline void rasterize(DestT const& dest, vw::BBox2i bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+  template <class ImageT>
+  CheckpointedView<ImageT>
+  checkpointed_view(vw::ImageViewBase<ImageT> const& image, TileCheckpoint & checkpoint,
+                    vw::GdalWriteOptions const& opt) {
+    return CheckpointedView<ImageT>(image.impl(), checkpoint, opt);
+  }
+
+} // End namespace asp
+
+#endif//__ASP_CORE_TILE_CHECKPOINT_H__
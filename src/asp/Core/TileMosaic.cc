@@ -0,0 +1,265 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file TileMosaic.cc
+///
+
+#include <asp/Core/TileMosaic.h>
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <vw/Core/ProgressCallback.h>
+
+#include <boost/filesystem.hpp>
+
+#include <gdal.h>
+#include <cpl_string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace fs = boost::filesystem;
+
+using namespace vw;
+
+namespace asp {
+
+// How long to wait for the tile which makes the mosaic, in seconds
+const int MOSAIC_WAIT_SECONDS = 3600;
+
+// Make the mosaic, with all its blocks written, so that their offsets
+// in the file are known and do not change.
+void make_mosaic(GDALDatasetH tile, std::string const& ref_file,
+                 std::string const& mosaic_file) {
+
+  GDALDatasetH ref = GDALOpen(ref_file.c_str(), GA_ReadOnly);
+  if (ref == NULL)
+    vw_throw(IOErr() << "Cannot open: " << ref_file << ".\n");
+  int cols = GDALGetRasterXSize(ref), rows = GDALGetRasterYSize(ref);
+  double geo_transform[6];
+  bool has_georef = (GDALGetGeoTransform(ref, geo_transform) == CE_None);
+  std::string wkt;
+  if (GDALGetProjectionRef(ref) != NULL)
+    wkt = GDALGetProjectionRef(ref);
+  GDALClose(ref);
+
+  int num_bands = GDALGetRasterCount(tile);
+  GDALDataType data_type = GDALGetRasterDataType(GDALGetRasterBand(tile, 1));
+
+  GDALDriverH driver = GDALGetDriverByName("GTiff");
+  if (driver == NULL)
+    vw_throw(IOErr() << "The GDAL GTiff driver is not available.\n");
+  std::ostringstream block_size;
+  block_size << MOSAIC_BLOCK_SIZE;
+  char ** options = NULL;
+  options = CSLSetNameValue(options, "TILED",      "YES");
+  options = CSLSetNameValue(options, "BLOCKXSIZE", block_size.str().c_str());
+  options = CSLSetNameValue(options, "BLOCKYSIZE", block_size.str().c_str());
+  options = CSLSetNameValue(options, "INTERLEAVE", "PIXEL");
+  options = CSLSetNameValue(options, "COMPRESS",   "NONE");
+  options = CSLSetNameValue(options, "SPARSE_OK",  "FALSE");
+  options = CSLSetNameValue(options, "ENDIANNESS", "NATIVE");
+  options = CSLSetNameValue(options, "BIGTIFF",    "IF_SAFER");
+
+  // Make it under another name, so that the tiles waiting for it see
+  // it only when complete
+  std::string tmp_file = mosaic_file + ".tmp.tif";
+  vw_out() << "Writing: " << mosaic_file << "\n";
+  GDALDatasetH mosaic = GDALCreate(driver, tmp_file.c_str(), cols, rows, num_bands,
+                                   data_type, options);
+  CSLDestroy(options);
+  if (mosaic == NULL)
+    vw_throw(IOErr() << "Cannot create: " << tmp_file << ".\n");
+
+  if (has_georef) {
+    GDALSetGeoTransform(mosaic, geo_transform);
+    GDALSetProjection(mosaic, wkt.c_str());
+  }
+  // Such as the point cloud offset
+  GDALSetMetadata(mosaic, GDALGetMetadata(tile, NULL), NULL);
+  for (int b = 1; b <= num_bands; b++) {
+    int has_nodata = 0;
+    double nodata = GDALGetRasterNoDataValue(GDALGetRasterBand(tile, b), &has_nodata);
+    if (has_nodata)
+      GDALSetRasterNoDataValue(GDALGetRasterBand(mosaic, b), nodata);
+  }
+  GDALClose(mosaic); // this writes the blocks
+
+  fs::rename(tmp_file, mosaic_file);
+}
+
+// Make the mosaic if no other tile made it, or wait for the one
+// making it.
+void make_or_wait_for_mosaic(GDALDatasetH tile, std::string const& ref_file,
+                             std::string const& mosaic_file) {
+
+  if (fs::exists(mosaic_file))
+    return;
+
+  // Creating a directory is atomic, also across nodes sharing the
+  // file system, so only one tile makes the mosaic
+  std::string lock_dir = mosaic_file + "-lock";
+  bool is_maker = false;
+  try {
+    is_maker = fs::create_directory(lock_dir);
+  } catch (...) {}
+
+  if (is_maker) {
+    try {
+      make_mosaic(tile, ref_file, mosaic_file);
+    } catch (...) {
+      boost::system::error_code ec;
+      fs::remove(lock_dir, ec); // let the others know
+      throw;
+    }
+    return;
+  }
+
+  for (int count = 0; count < MOSAIC_WAIT_SECONDS; count++) {
+    if (fs::exists(mosaic_file))
+      return;
+    if (!fs::exists(lock_dir))
+      vw_throw(IOErr() << "Failed to make: " << mosaic_file << ".\n");
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+  }
+  vw_throw(IOErr() << "Timed out waiting for: " << mosaic_file << ".\n");
+}
+
+void add_tile_to_mosaic(std::string const& tile_file, BBox2i const& box,
+                        std::string const& ref_file, std::string const& mosaic_file,
+                        bool keep_tile) {
+
+  GDALAllRegister();
+
+  GDALDatasetH tile = GDALOpen(tile_file.c_str(), GA_ReadOnly);
+  if (tile == NULL)
+    vw_throw(IOErr() << "Cannot open: " << tile_file << ".\n");
+  int num_bands = GDALGetRasterCount(tile);
+  if (num_bands <= 0) {
+    GDALClose(tile);
+    vw_throw(ArgumentErr() << "No bands in: " << tile_file << ".\n");
+  }
+  GDALDataType data_type = GDALGetRasterDataType(GDALGetRasterBand(tile, 1));
+  if (GDALGetRasterXSize(tile) != box.width() || GDALGetRasterYSize(tile) != box.height()) {
+    GDALClose(tile);
+    vw_throw(ArgumentErr() << "The size of " << tile_file << " is not the size of "
+             << "the region " << box << " it is for.\n");
+  }
+
+  try {
+    make_or_wait_for_mosaic(tile, ref_file, mosaic_file);
+  } catch (...) {
+    GDALClose(tile);
+    throw;
+  }
+
+  // Find the offsets in the file of the blocks of this tile
+  GDALDatasetH mosaic = GDALOpen(mosaic_file.c_str(), GA_ReadOnly);
+  if (mosaic == NULL) {
+    GDALClose(tile);
+    vw_throw(IOErr() << "Cannot open: " << mosaic_file << ".\n");
+  }
+  GDALRasterBandH band = GDALGetRasterBand(mosaic, 1);
+  int cols = GDALGetRasterXSize(mosaic), rows = GDALGetRasterYSize(mosaic);
+  int block_cols = 0, block_rows = 0;
+  GDALGetBlockSize(band, &block_cols, &block_rows);
+  std::string error;
+  if (GDALGetRasterCount(mosaic) != num_bands || GDALGetRasterDataType(band) != data_type)
+    error = "The bands of " + tile_file + " do not agree with those of " + mosaic_file + ".";
+  else if (block_cols != MOSAIC_BLOCK_SIZE || block_rows != MOSAIC_BLOCK_SIZE)
+    error = "Unexpected block size for " + mosaic_file + ".";
+  else if (box.min().x() < 0 || box.min().y() < 0 ||
+           box.max().x() > cols || box.max().y() > rows ||
+           box.min().x() % MOSAIC_BLOCK_SIZE != 0 || box.min().y() % MOSAIC_BLOCK_SIZE != 0 ||
+           (box.max().x() % MOSAIC_BLOCK_SIZE != 0 && box.max().x() != cols) ||
+           (box.max().y() % MOSAIC_BLOCK_SIZE != 0 && box.max().y() != rows))
+    error = "The tile " + tile_file + " is not aligned with the blocks of " + mosaic_file + ".";
+
+  int B = MOSAIC_BLOCK_SIZE;
+  int bx0 = box.min().x() / B, by0 = box.min().y() / B;
+  int nbx = (box.width() + B - 1) / B, nby = (box.height() + B - 1) / B;
+  std::vector<std::int64_t> offsets(nbx * nby, 0);
+  for (int by = 0; by < nby && error.empty(); by++) {
+    for (int bx = 0; bx < nbx; bx++) {
+      std::ostringstream key;
+      key << "BLOCK_OFFSET_" << bx0 + bx << "_" << by0 + by;
+      const char * val = GDALGetMetadataItem(band, key.str().c_str(), "TIFF");
+      if (val == NULL || atoll(val) <= 0) {
+        error = "Cannot find the offset of block " + key.str() + " in " + mosaic_file + ".";
+        break;
+      }
+      offsets[by * nbx + bx] = atoll(val);
+    }
+  }
+  GDALClose(mosaic);
+  if (!error.empty()) {
+    GDALClose(tile);
+    vw_throw(ArgumentErr() << error << "\n");
+  }
+
+  // Write the blocks in place. The header is not changed, so other
+  // tiles can write their own blocks meanwhile.
+  vw_out() << "Writing " << tile_file << " into: " << mosaic_file << "\n";
+  std::fstream out(mosaic_file.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+  if (!out.good()) {
+    GDALClose(tile);
+    vw_throw(IOErr() << "Cannot open for update: " << mosaic_file << ".\n");
+  }
+  int band_bytes = GDALGetDataTypeSize(data_type) / 8;
+  int pixel_bytes = num_bands * band_bytes;
+  std::vector<unsigned char> buf(B * B * pixel_bytes);
+  TerminalProgressCallback tpc("asp", "\t--> Mosaic: ");
+  for (int by = 0; by < nby && error.empty(); by++) {
+    for (int bx = 0; bx < nbx; bx++) {
+      // The pixels of the block in the tile. Those past the image
+      // edges, in the last blocks, are left as zero.
+      BBox2i block(bx * B, by * B, B, B);
+      block.crop(BBox2i(0, 0, box.width(), box.height()));
+      std::fill(buf.begin(), buf.end(), 0);
+      if (GDALDatasetRasterIO(tile, GF_Read, block.min().x(), block.min().y(),
+                              block.width(), block.height(), &buf[0],
+                              block.width(), block.height(), data_type, num_bands, NULL,
+                              pixel_bytes, B * pixel_bytes, band_bytes) != CE_None) {
+        error = "Failed to read " + tile_file + ".";
+        break;
+      }
+      out.seekp(offsets[by * nbx + bx]);
+      out.write(reinterpret_cast<const char*>(&buf[0]), buf.size());
+      if (!out.good()) {
+        error = "Failed to write " + mosaic_file + ".";
+        break;
+      }
+      tpc.report_fractional_progress(by * nbx + bx + 1, nbx * nby);
+    }
+  }
+  out.close();
+  GDALClose(tile);
+  if (!error.empty())
+    vw_throw(IOErr() << error << "\n");
+  tpc.report_finished();
+
+  if (!keep_tile)
+    fs::remove(tile_file);
+}
+
+} // end namespace asp
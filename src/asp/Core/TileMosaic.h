@@ -0,0 +1,51 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file TileMosaic.h
+///
+/// Assemble the outputs of parallel_stereo tiles into one tiled GeoTIFF,
+/// rather than gluing them with a VRT. The mosaic is made by the first
+/// tile to finish, uncompressed and with all its blocks allocated, so
+/// that each tile after it can write its blocks in place. The tiles are
+/// aligned with the blocks, so no two tiles write to the same block,
+/// and the header of the mosaic is never modified once made.
+
+#ifndef __ASP_CORE_TILE_MOSAIC_H__
+#define __ASP_CORE_TILE_MOSAIC_H__
+
+#include <vw/Math/BBox.h>
+
+#include <string>
+
+namespace asp {
+
+  /// The block size of the mosaic. The tiles must start at multiples
+  /// of it. Must be kept in sync with parallel_stereo.
+  const int MOSAIC_BLOCK_SIZE = 256;
+
+  /// Write the image in tile_file, which has the pixels of the given
+  /// box of the left aligned image ref_file (L.tif), into mosaic_file, at
+  /// that box. Make the mosaic first if no tile did so yet, with the size
+  /// and georeference of ref_file and the pixel type, no-data value, and
+  /// metadata of tile_file. Then delete tile_file, unless keep_tile is set.
+  void add_tile_to_mosaic(std::string const& tile_file, vw::BBox2i const& box,
+                          std::string const& ref_file, std::string const& mosaic_file,
+                          bool keep_tile = false);
+
+} // end namespace asp
+
+#endif // __ASP_CORE_TILE_MOSAIC_H__
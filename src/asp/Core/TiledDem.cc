@@ -0,0 +1,145 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file TiledDem.cc
+///
+
+#include <asp/Core/TiledDem.h>
+
+#include <vw/Core/Exception.h>
+#include <vw/FileIO/DiskImageResourceGDAL.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/Manipulation.h>
+
+#include <cmath>
+#include <limits>
+
+namespace asp {
+
+void TiledDem::load(std::string const& dem_file, int tile_size) {
+  vw::cartography::GeoReference georef;
+  if (!vw::cartography::read_georeference(georef, dem_file))
+    vw::vw_throw(vw::ArgumentErr() << "DEM: " << dem_file
+                 << " does not have a georeference.\n");
+
+  double nodata = std::numeric_limits<double>::quiet_NaN();
+  {
+    boost::shared_ptr<vw::DiskImageResource> rsrc(new vw::DiskImageResourceGDAL(dem_file));
+    if (rsrc->has_nodata_read())
+      nodata = rsrc->nodata_read();
+  }
+
+  set(vw::DiskImageView<float>(dem_file), nodata, georef, tile_size);
+}
+
+void TiledDem::set(vw::ImageViewRef<float> const& dem, double nodata,
+                   vw::cartography::GeoReference const& georef, int tile_size) {
+  if (tile_size < 2)
+    vw::vw_throw(vw::ArgumentErr() << "The DEM tile size must be at least 2.\n");
+
+  m_dem       = dem;
+  m_nodata    = nodata;
+  m_georef    = georef;
+  m_cols      = dem.cols();
+  m_rows      = dem.rows();
+  m_tile_size = tile_size;
+  m_tile_cols = (m_cols + tile_size - 1) / tile_size;
+  int tile_rows = (m_rows + tile_size - 1) / tile_size;
+
+  size_t num_tiles = size_t(m_tile_cols) * tile_rows;
+  m_tiles.assign(num_tiles, boost::shared_ptr<std::vector<float>>());
+  m_tile_flags.reset(new std::once_flag[num_tiles]);
+}
+
+float const* TiledDem::tile(int tile_col, int tile_row) const {
+  size_t index = size_t(tile_row) * m_tile_cols + tile_col;
+  std::call_once(m_tile_flags[index], [&]() {
+      vw::BBox2i box(tile_col * m_tile_size, tile_row * m_tile_size,
+                     m_tile_size, m_tile_size);
+      box.crop(vw::bounding_box(m_dem));
+      vw::ImageView<float> pixels = vw::crop(m_dem, box);
+
+      // Pad with NaN past the edges of the DEM
+      boost::shared_ptr<std::vector<float>>
+        values(new std::vector<float>(size_t(m_tile_size) * m_tile_size,
+                                      std::numeric_limits<float>::quiet_NaN()));
+      for (int r = 0; r < pixels.rows(); r++) {
+        for (int c = 0; c < pixels.cols(); c++) {
+          float v = pixels(c, r);
+          if (v != m_nodata && std::isfinite(v))
+            (*values)[size_t(r) * m_tile_size + c] = v;
+        }
+      }
+      m_tiles[index] = values;
+    });
+  return &(*m_tiles[index])[0];
+}
+
+float TiledDem::pixel(int col, int row) const {
+  int tc = col / m_tile_size, tr = row / m_tile_size;
+  return tile(tc, tr)[size_t(row - tr * m_tile_size) * m_tile_size + (col - tc * m_tile_size)];
+}
+
+bool TiledDem::interpolate(double col, double row, double & height) const {
+  // This also fails for NaN
+  if (!(col >= 0.0 && row >= 0.0 && col < m_cols - 1 && row < m_rows - 1))
+    return false;
+
+  int c0 = int(col), r0 = int(row);
+  double wc = col - c0, wr = row - r0;
+  double v00, v01, v10, v11;
+  int tc = c0 / m_tile_size, tr = r0 / m_tile_size;
+  int lc = c0 - tc * m_tile_size, lr = r0 - tr * m_tile_size;
+  if (lc + 1 < m_tile_size && lr + 1 < m_tile_size) {
+    // All four neighbors are in one tile
+    float const* p = tile(tc, tr) + size_t(lr) * m_tile_size + lc;
+    v00 = p[0];
+    v01 = p[1];
+    v10 = p[m_tile_size];
+    v11 = p[m_tile_size + 1];
+  } else {
+    v00 = pixel(c0,     r0);
+    v01 = pixel(c0 + 1, r0);
+    v10 = pixel(c0,     r0 + 1);
+    v11 = pixel(c0 + 1, r0 + 1);
+  }
+
+  // Any invalid neighbor, even with zero weight, makes the result NaN
+  height = (1.0 - wr) * ((1.0 - wc) * v00 + wc * v01) + wr * ((1.0 - wc) * v10 + wc * v11);
+  return height == height;
+}
+
+bool TiledDem::height_at_lonlat(vw::Vector2 const& lonlat, double & height) const {
+  vw::Vector2 pix;
+  try {
+    pix = m_georef.lonlat_to_pixel(lonlat);
+  } catch (...) {
+    return false;
+  }
+  return interpolate(pix[0], pix[1], height);
+}
+
+void TiledDem::interpolate(std::vector<vw::Vector2> const& pixels,
+                           std::vector<double> & heights, std::vector<char> & valid) const {
+  heights.resize(pixels.size());
+  valid.resize(pixels.size());
+  for (size_t i = 0; i < pixels.size(); i++)
+    valid[i] = interpolate(pixels[i][0], pixels[i][1], heights[i]);
+}
+
+} // end namespace asp
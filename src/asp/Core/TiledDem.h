@@ -0,0 +1,91 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file TiledDem.h
+///
+/// A DEM kept in memory as square tiles of floats, for fast bilinear
+/// interpolation at many points, such as when finding the distance from
+/// each point of a cloud to a reference DEM. A tile is read from the
+/// image the first time a point falls in it, so only the part of the
+/// DEM which is used takes memory. No-data pixels are stored as NaN, so
+/// a lookup has no mask and no bounds checks beyond finding the tile.
+/// Tiles are loaded in a thread-safe way, so a TiledDem may be shared
+/// by threads once made.
+
+#ifndef __ASP_CORE_TILED_DEM_H__
+#define __ASP_CORE_TILED_DEM_H__
+
+#include <vw/Cartography/GeoReference.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Math/Vector.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+  class TiledDem: private boost::noncopyable {
+  public:
+    TiledDem(): m_cols(0), m_rows(0), m_tile_size(0), m_tile_cols(0) {}
+
+    /// Use the DEM in the given file, with its georeference and nodata value
+    void load(std::string const& dem_file, int tile_size = 256);
+
+    /// Use a DEM image. Pixels equal to nodata or not finite are invalid.
+    void set(vw::ImageViewRef<float> const& dem, double nodata,
+             vw::cartography::GeoReference const& georef, int tile_size = 256);
+
+    bool empty() const { return m_cols == 0; }
+    int cols() const { return m_cols; }
+    int rows() const { return m_rows; }
+    vw::cartography::GeoReference const& georef() const { return m_georef; }
+
+    /// The height at a pixel, interpolated bilinearly. Return false
+    /// unless the four neighbors are inside the DEM and valid, so the
+    /// pixel must be in [0, cols - 1) x [0, rows - 1).
+    bool interpolate(double col, double row, double & height) const;
+
+    /// The height at a longitude and latitude
+    bool height_at_lonlat(vw::Vector2 const& lonlat, double & height) const;
+
+    /// Interpolate at many pixels. valid[i] is false where interpolate() fails.
+    void interpolate(std::vector<vw::Vector2> const& pixels,
+                     std::vector<double> & heights, std::vector<char> & valid) const;
+
+  private:
+    float const* tile(int tile_col, int tile_row) const;
+    float pixel(int col, int row) const;
+
+    vw::ImageViewRef<float> m_dem;
+    float m_nodata;
+    vw::cartography::GeoReference m_georef;
+    int m_cols, m_rows, m_tile_size, m_tile_cols;
+
+    // Filled the first time they are needed
+    mutable std::vector<boost::shared_ptr<std::vector<float>>> m_tiles;
+    mutable std::unique_ptr<std::once_flag[]> m_tile_flags;
+  };
+
+} // end namespace asp
+
+#endif // __ASP_CORE_TILED_DEM_H__
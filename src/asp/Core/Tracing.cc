@@ -0,0 +1,272 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file Tracing.cc
+///
+
+#include <asp/Core/Tracing.h>
+#include <asp/Core/ExitReport.h>
+
+#include <vw/Core/Log.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace asp {
+
+namespace {
+
+  // A merged span takes in a call starting at most this many
+  // microseconds after it ended
+  const std::int64_t MERGE_GAP_US = 50;
+
+  // Beyond this many spans on a thread, the rest are only counted
+  const size_t MAX_EVENTS_PER_THREAD = 4000000;
+
+  struct TraceEvent {
+    char const*  name;
+    char const*  category;
+    std::int64_t start, duration; // in microseconds
+    std::int64_t num_calls;       // positive only for merged spans
+    vw::BBox2i   box;
+  };
+
+  // The spans of a thread. The lock is only taken by the thread and
+  // at exit, so it is not contended.
+  struct ThreadEvents {
+    int                     tid;
+    std::mutex              mutex;
+    std::vector<TraceEvent> events;
+    std::uint64_t           num_dropped;
+    ThreadEvents(int id): tid(id), num_dropped(0) {}
+  };
+
+  class Tracer {
+  public:
+    static Tracer & instance();
+
+    bool enabled() const { return m_enabled; }
+
+    // Microseconds since the epoch, so the traces of several processes
+    // line up, measured with a monotonic clock
+    std::int64_t now() const {
+      return m_origin_us + std::chrono::duration_cast<std::chrono::microseconds>
+        (std::chrono::steady_clock::now() - m_origin).count();
+    }
+
+    void add(TraceEvent const& event, bool merge);
+    void write();
+
+  private:
+    Tracer();
+    ThreadEvents & thread_events();
+
+    bool m_enabled;
+    std::string m_file;
+    std::chrono::steady_clock::time_point m_origin;
+    std::int64_t m_origin_us;
+
+    std::mutex m_mutex; // protects the list below
+    std::vector<ThreadEvents*> m_threads; // never deleted, as used at exit
+  };
+
+  void write_trace() {
+    Tracer::instance().write();
+  }
+
+  Tracer * create_tracer(Tracer * tracer) {
+    if (!tracer->enabled())
+      return tracer;
+    return report_at_exit(tracer, "Started tracing.", write_trace);
+  }
+
+  Tracer & Tracer::instance() {
+    static Tracer * tracer = create_tracer(new Tracer());
+    return *tracer;
+  }
+
+  Tracer::Tracer(): m_enabled(false), m_origin(std::chrono::steady_clock::now()) {
+    m_origin_us = std::chrono::duration_cast<std::chrono::microseconds>
+      (std::chrono::system_clock::now().time_since_epoch()).count();
+
+    char * ptr = getenv("ASP_TRACE_FILE");
+    if (ptr == NULL || std::string(ptr).empty())
+      return;
+    m_file = ptr;
+    boost::algorithm::replace_all(m_file, "%p", boost::lexical_cast<std::string>(getpid()));
+    m_enabled = true;
+  }
+
+  ThreadEvents & Tracer::thread_events() {
+    thread_local ThreadEvents * events = NULL;
+    if (events == NULL) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      events = new ThreadEvents(int(m_threads.size()) + 1);
+      m_threads.push_back(events);
+    }
+    return *events;
+  }
+
+  void Tracer::add(TraceEvent const& event, bool merge) {
+    ThreadEvents & te = thread_events();
+    std::lock_guard<std::mutex> lock(te.mutex);
+
+    if (merge && !te.events.empty()) {
+      TraceEvent & prev = te.events.back();
+      if (prev.num_calls > 0 && prev.name == event.name &&
+          event.start - (prev.start + prev.duration) <= MERGE_GAP_US) {
+        prev.duration = event.start + event.duration - prev.start;
+        prev.num_calls++;
+        return;
+      }
+    }
+
+    if (te.events.size() >= MAX_EVENTS_PER_THREAD) {
+      te.num_dropped++;
+      return;
+    }
+    te.events.push_back(event);
+    if (merge)
+      te.events.back().num_calls = 1;
+  }
+
+  // Names are normally literals, but be careful anyway
+  std::string json_str(char const* str) {
+    std::string out = "\"";
+    for (char const* c = str; *c != '\0'; c++) {
+      if (*c == '"' || *c == '\\')
+        out += '\\';
+      if ((unsigned char)(*c) >= 0x20)
+        out += *c;
+    }
+    return out + "\"";
+  }
+
+  void Tracer::write() {
+    std::string tmp_file = m_file + ".tmp" + boost::lexical_cast<std::string>(getpid());
+    std::ofstream ofs(tmp_file.c_str());
+    if (!ofs) {
+      vw::vw_out(vw::WarningMessage) << "Cannot write the trace: " << m_file << "\n";
+      return;
+    }
+
+    int pid = getpid();
+    std::uint64_t num_events = 0, num_dropped = 0;
+    bool first = true;
+    ofs << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t t = 0; t < m_threads.size(); t++) {
+      ThreadEvents & te = *m_threads[t];
+      std::lock_guard<std::mutex> thread_lock(te.mutex);
+
+      ofs << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": "
+          << pid << ", \"tid\": " << te.tid << ", \"args\": {\"name\": \"thread "
+          << te.tid << "\"}}";
+      first = false;
+
+      for (size_t i = 0; i < te.events.size(); i++) {
+        TraceEvent const& e = te.events[i];
+        ofs << ",\n{\"name\": " << json_str(e.name) << ", \"cat\": " << json_str(e.category)
+            << ", \"ph\": \"X\", \"ts\": " << e.start << ", \"dur\": " << e.duration
+            << ", \"pid\": " << pid << ", \"tid\": " << te.tid;
+        bool has_box = !e.box.empty();
+        if (has_box || e.num_calls > 0) {
+          ofs << ", \"args\": {";
+          if (has_box)
+            ofs << "\"box\": \"" << e.box.min().x() << " " << e.box.min().y() << " "
+                << e.box.width() << " " << e.box.height() << "\"";
+          if (e.num_calls > 0)
+            ofs << (has_box ? ", " : "") << "\"calls\": " << e.num_calls;
+          ofs << "}";
+        }
+        ofs << "}";
+      }
+      num_events  += te.events.size();
+      num_dropped += te.num_dropped;
+    }
+    ofs << "\n]}\n";
+    ofs.close();
+
+    if (!ofs || std::rename(tmp_file.c_str(), m_file.c_str()) != 0) {
+      vw::vw_out(vw::WarningMessage) << "Cannot write the trace: " << m_file << "\n";
+      std::remove(tmp_file.c_str());
+      return;
+    }
+
+    vw::vw_out(vw::DebugMessage, "asp") << "Wrote " << num_events << " spans to: " << m_file
+                                        << "\n";
+    if (num_dropped > 0)
+      vw::vw_out(vw::WarningMessage) << "Dropped " << num_dropped
+                                     << " spans, as there were too many.\n";
+  }
+
+} // end anonymous namespace
+
+bool tracing_enabled() {
+  return Tracer::instance().enabled();
+}
+
+TraceSpan::TraceSpan(char const* name, char const* category):
+  m_name(name), m_category(category), m_start(-1), m_merge(false) {
+  Tracer & tracer = Tracer::instance();
+  if (tracer.enabled())
+    m_start = tracer.now();
+}
+
+TraceSpan::TraceSpan(char const* name, vw::BBox2i const& box, char const* category):
+  m_name(name), m_category(category), m_start(-1), m_merge(false) {
+  Tracer & tracer = Tracer::instance();
+  if (tracer.enabled()) {
+    m_box = box;
+    m_start = tracer.now();
+  }
+}
+
+TraceSpan::TraceSpan(char const* name, Merge, char const* category):
+  m_name(name), m_category(category), m_start(-1), m_merge(true) {
+  Tracer & tracer = Tracer::instance();
+  if (tracer.enabled())
+    m_start = tracer.now();
+}
+
+TraceSpan::~TraceSpan() {
+  if (m_start < 0)
+    return;
+  Tracer & tracer = Tracer::instance();
+  TraceEvent event;
+  event.name      = m_name;
+  event.category  = m_category;
+  event.start     = m_start;
+  event.duration  = tracer.now() - m_start;
+  event.num_calls = 0;
+  event.box       = m_box;
+  tracer.add(event, m_merge);
+}
+
+} // end namespace asp
@@ -0,0 +1,78 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file Tracing.h
+///
+/// Lightweight tracing of where the time goes, per thread. A TraceSpan
+/// records when it was made and when it went out of scope. The spans
+/// are kept in a buffer for each thread, so threads do not wait for
+/// each other, and are written at exit in the Chrome trace format,
+/// which can be viewed with https://ui.perfetto.dev or
+/// chrome://tracing. This shows whether tiles wait for reading, for
+/// locks, or compute.
+///
+/// Tracing is off unless the environment variable ASP_TRACE_FILE is
+/// set to the file to write. Any "%p" in it is replaced with the
+/// process id, so the processes of a parallel run write separate
+/// files. When off, a span costs a check of a flag.
+///
+/// Calls that are very many and short, such as projecting points into
+/// cameras, are traced with merged spans. A call which starts soon
+/// after the previous one of the same name on the same thread ended
+/// extends that span rather than making a new one, and the span counts
+/// its calls.
+
+#ifndef __ASP_CORE_TRACING_H__
+#define __ASP_CORE_TRACING_H__
+
+#include <vw/Math/BBox.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <cstdint>
+
+namespace asp {
+
+  /// True if ASP_TRACE_FILE is set
+  bool tracing_enabled();
+
+  class TraceSpan: private boost::noncopyable {
+  public:
+    /// The name and category must be string literals, or otherwise
+    /// outlive the process, as only the pointers are kept.
+    explicit TraceSpan(char const* name, char const* category = "asp");
+
+    /// A span for processing an image region, which is saved with it
+    TraceSpan(char const* name, vw::BBox2i const& box, char const* category = "asp");
+
+    /// Merge consecutive calls on a thread into one span
+    enum Merge {MERGE};
+    TraceSpan(char const* name, Merge, char const* category = "asp");
+
+    ~TraceSpan();
+
+  private:
+    char const*  m_name;
+    char const*  m_category;
+    std::int64_t m_start; // in microseconds; negative when not tracing
+    vw::BBox2i   m_box;
+    bool         m_merge;
+  };
+
+} // end namespace asp
+
+#endif // __ASP_CORE_TRACING_H__
@@ -0,0 +1,128 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/BlockMatching.h>
+
+using namespace vw;
+using namespace asp;
+
+// Make a textured image, and a copy shifted to the right by a
+// non-integer amount. Each cost must recover the shift.
+TEST( BlockMatching, RecoverShift ) {
+
+  int cols = 200, rows = 120;
+  double shift = 7.3;
+  ImageView<float> left(cols, rows), right(cols, rows);
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+      left(col, row)  = 0.5 + 0.25 * sin(0.37 * col) * cos(0.21 * row)
+        + 0.2 * sin(0.005 * col * row + 0.9 * row);
+      double x = col - shift;
+      right(col, row) = 0.5 + 0.25 * sin(0.37 * x) * cos(0.21 * row)
+        + 0.2 * sin(0.005 * x * row + 0.9 * row);
+    }
+  }
+
+  for (int cost = BM_COST_ABSOLUTE_DIFFERENCE; cost <= BM_COST_CENSUS; cost++) {
+    ImageView<float> disp;
+    double lr_threshold = 1.0;
+    block_match_1d(left, right, 0, 15, 9, BlockMatchCost(cost), lr_threshold, disp);
+    ASSERT_EQ(cols, disp.cols());
+    ASSERT_EQ(rows, disp.rows());
+
+    int num_valid = 0;
+    double mean_err = 0.0;
+    for (int row = 0; row < rows; row++) {
+      for (int col = 0; col < cols; col++) {
+        if (std::isnan(disp(col, row)))
+          continue;
+        num_valid++;
+        mean_err += std::abs(disp(col, row) - shift);
+      }
+    }
+    EXPECT_GT(num_valid, cols * rows / 2);
+    mean_err /= std::max(num_valid, 1);
+    EXPECT_LT(mean_err, 0.2);
+  }
+}
+
+// Semi-global matching must recover the same shift
+TEST( BlockMatching, SgmRecoverShift ) {
+
+  int cols = 200, rows = 120;
+  double shift = 7.3;
+  ImageView<float> left(cols, rows), right(cols, rows);
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+      left(col, row)  = 0.5 + 0.25 * sin(0.37 * col) * cos(0.21 * row)
+        + 0.2 * sin(0.005 * col * row + 0.9 * row);
+      double x = col - shift;
+      right(col, row) = 0.5 + 0.25 * sin(0.37 * x) * cos(0.21 * row)
+        + 0.2 * sin(0.005 * x * row + 0.9 * row);
+    }
+  }
+
+  for (int cost = BM_COST_ABSOLUTE_DIFFERENCE; cost <= BM_COST_CENSUS; cost++) {
+    ImageView<float> disp;
+    double lr_threshold = 1.0, memory_limit_mb = 100.0;
+    bool subpixel = true;
+    sgm_1d(left, right, 0, 15, 5, BlockMatchCost(cost), 32, 128, subpixel,
+           lr_threshold, memory_limit_mb, disp);
+    ASSERT_EQ(cols, disp.cols());
+    ASSERT_EQ(rows, disp.rows());
+
+    int num_valid = 0;
+    double mean_err = 0.0;
+    for (int row = 0; row < rows; row++) {
+      for (int col = 0; col < cols; col++) {
+        if (std::isnan(disp(col, row)))
+          continue;
+        num_valid++;
+        mean_err += std::abs(disp(col, row) - shift);
+      }
+    }
+    EXPECT_GT(num_valid, cols * rows / 2);
+    mean_err /= std::max(num_valid, 1);
+    EXPECT_LT(mean_err, 0.2);
+  }
+
+  // Too little memory
+  ImageView<float> disp;
+  EXPECT_THROW(sgm_1d(left, right, 0, 15, 5, BM_COST_CENSUS, 32, 128, true, 1.0, 0.1, disp),
+               ArgumentErr);
+}
+
+// No-data in the left image must result in no-data in the disparity
+TEST( BlockMatching, NoData ) {
+  int cols = 50, rows = 40;
+  ImageView<float> left(cols, rows), right(cols, rows);
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+      left(col, row) = right(col, row) = sin(0.3 * col) + cos(0.4 * row);
+    }
+  }
+  left(25, 20) = std::numeric_limits<float>::quiet_NaN();
+
+  ImageView<float> disp;
+  block_match_1d(left, right, -2, 2, 5, BM_COST_NCC, -1, disp);
+  EXPECT_TRUE(std::isnan(disp(25, 20)));
+  EXPECT_TRUE(std::isnan(disp(27, 22)));
+  EXPECT_TRUE(std::isnan(disp(0, 0)));
+  EXPECT_NEAR(0.0, disp(10, 10), 0.5);
+}
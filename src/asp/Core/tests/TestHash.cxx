@@ -0,0 +1,73 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/Hash.h>
+
+#include <fstream>
+
+using namespace vw;
+
+TEST( Hash, KnownValues ) {
+  // Published FNV-1a 64-bit test values
+  EXPECT_EQ(0xcbf29ce484222325ULL, asp::hash_string(""));
+  EXPECT_EQ(0xaf63dc4c8601ec8cULL, asp::hash_string("a"));
+  EXPECT_EQ("af63dc4c8601ec8c", asp::hash_to_hex(asp::hash_string("a")));
+  EXPECT_EQ("00000000000000ff", asp::hash_to_hex(255));
+
+  // Hashing in pieces is the same as at once
+  std::uint64_t hash = asp::HASH_START;
+  asp::hash_bytes("ab", 2, hash);
+  asp::hash_bytes("c", 1, hash);
+  EXPECT_EQ(asp::hash_string("abc"), hash);
+
+  UnlinkName file("hash_test.txt");
+  {
+    std::ofstream ofs(file.c_str());
+    ofs << "abc";
+  }
+  std::uint64_t file_hash = 0;
+  EXPECT_TRUE(asp::hash_file(file, file_hash));
+  EXPECT_EQ(asp::hash_string("abc"), file_hash);
+  EXPECT_FALSE(asp::hash_file("no_such_file.txt", file_hash));
+}
+
+TEST( Hash, ImageBox ) {
+  // Taller than a band of rows, so it is read in pieces
+  ImageView<float> image(30, 600);
+  for (int col = 0; col < image.cols(); col++)
+    for (int row = 0; row < image.rows(); row++)
+      image(col, row) = col + 0.5 * row;
+
+  BBox2i box(3, 5, 20, 550);
+  std::uint64_t hash = asp::HASH_START;
+  asp::hash_image_box(image, box, hash);
+
+  ImageView<float> pixels = crop(image, box);
+  std::uint64_t expected = asp::HASH_START;
+  std::int32_t vals[4] = {3, 5, 20, 550};
+  asp::hash_bytes(vals, sizeof(vals), expected);
+  asp::hash_bytes(&pixels(0, 0), sizeof(float) * pixels.cols() * pixels.rows(), expected);
+  EXPECT_EQ(expected, hash);
+
+  // A change in one pixel changes the hash
+  image(10, 400) += 1.0;
+  std::uint64_t hash2 = asp::HASH_START;
+  asp::hash_image_box(image, box, hash2);
+  EXPECT_NE(hash, hash2);
+}
@@ -0,0 +1,71 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/PixelMask.h>
+#include <asp/Core/ImageNormalization.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+using namespace vw;
+
+TEST(ImageNormalization, BlockSampledStats) {
+
+  ImageView<PixelMask<float>> img(97, 213);
+  srand(7);
+  for (int row = 0; row < img.rows(); row++) {
+    for (int col = 0; col < img.cols(); col++) {
+      img(col, row) = PixelMask<float>(float(rand() % 1000) / 10.0);
+      if (rand() % 10 == 0)
+        img(col, row).invalidate();
+    }
+  }
+
+  // The valid sampled values, the brute force way
+  int scale = 3;
+  std::vector<float> vals;
+  for (int row = 0; row < img.rows(); row += scale)
+    for (int col = 0; col < img.cols(); col += scale)
+      if (is_valid(img(col, row)))
+        vals.push_back(img(col, row).child());
+
+  double mean = 0.0, var = 0.0;
+  for (size_t i = 0; i < vals.size(); i++)
+    mean += vals[i];
+  mean /= vals.size();
+  for (size_t i = 0; i < vals.size(); i++)
+    var += (vals[i] - mean) * (vals[i] - mean);
+  var /= vals.size();
+  std::sort(vals.begin(), vals.end());
+
+  asp::Vector6f stats1 = asp::block_sampled_stats(img, scale, 1);
+  EXPECT_EQ(stats1[0], vals.front());
+  EXPECT_EQ(stats1[1], vals.back());
+  EXPECT_NEAR(stats1[2], mean, 1e-4);
+  EXPECT_NEAR(stats1[3], std::sqrt(var), 1e-4);
+  EXPECT_EQ(stats1[4], vals[size_t(std::round(0.02 * (vals.size() - 1)))]);
+  EXPECT_EQ(stats1[5], vals[size_t(std::round(0.98 * (vals.size() - 1)))]);
+
+  // The same for any number of threads
+  asp::Vector6f stats5 = asp::block_sampled_stats(img, scale, 5);
+  for (int i = 0; i < 6; i++)
+    EXPECT_EQ(stats1[i], stats5[i]);
+}
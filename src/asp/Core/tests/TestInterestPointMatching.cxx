@@ -18,6 +18,7 @@
 
 #include <test/Helpers.h>
 #include <asp/Core/InterestPointMatching.h>
+#include <asp/Core/ParallelRansac.h>
 #include <vw/Camera/PinholeModel.h>
 #include <vw/Camera/LensDistortion.h>
 #include <vw/Cartography/CameraBBox.h>
@@ -68,3 +69,105 @@ TEST( InterestPointMatching, DatumIntersection ) {
   }
 
 }
+
+TEST( InterestPointMatching, BinaryDescriptors ) {
+
+  // Random 32-byte descriptors, as ORB makes, and copies of them with a
+  // few bits flipped, in reverse order.
+  const int num_ip = 50, len = 32;
+  srand(0);
+  std::vector<ip::InterestPoint> ip1(num_ip), ip2(num_ip);
+  for (int i = 0; i < num_ip; i++) {
+    ip1[i].x = i;
+    ip1[i].descriptor.set_size(len);
+    for (int j = 0; j < len; j++)
+      ip1[i].descriptor[j] = rand() % 256;
+    ip2[num_ip - 1 - i] = ip1[i];
+    ip2[num_ip - 1 - i].x = 1000 + i;
+    int byte = rand() % len;
+    ip2[num_ip - 1 - i].descriptor[byte]
+      = static_cast<unsigned char>(ip1[i].descriptor[byte]) ^ 5;
+  }
+
+  BinaryDescriptors desc1(ip1), desc2(ip2);
+  ASSERT_EQ(num_ip, int(desc1.size()));
+  EXPECT_EQ(4u, desc1.num_words());
+  EXPECT_EQ(0u, desc1.distance(3, desc1, 3));
+  EXPECT_EQ(2u, desc1.distance(3, desc2, num_ip - 1 - 3));
+
+  std::vector<ip::InterestPoint> matched_ip1, matched_ip2;
+  match_binary_ip(ip1, ip2, 0.8, matched_ip1, matched_ip2);
+  ASSERT_EQ(num_ip, int(matched_ip1.size()));
+  for (size_t i = 0; i < matched_ip1.size(); i++)
+    EXPECT_EQ(matched_ip1[i].x + 1000, matched_ip2[i].x);
+}
+
+TEST( InterestPointMatching, ParallelRansac ) {
+
+  // Points related by a homography, with every fourth one an outlier
+  Matrix3x3 H(1.1, 0.05, 20,
+              -0.02, 0.95, -10,
+              1e-5, 2e-5, 1);
+  std::vector<Vector3> p1, p2;
+  srand(0);
+  for (int i = 0; i < 200; i++) {
+    Vector3 p(rand() % 1000, rand() % 1000, 1);
+    Vector3 q = H * p;
+    q /= q[2];
+    if (i % 4 == 0)
+      q += Vector3(50 + rand() % 100, 50 + rand() % 100, 0);
+    p1.push_back(p);
+    p2.push_back(q);
+  }
+
+  ParallelRansac<math::HomographyFittingFunctor, math::InterestPointErrorMetric>
+    ransac(math::HomographyFittingFunctor(), math::InterestPointErrorMetric(),
+           1000, 1.0, p1.size() / 2);
+  Matrix<double> fit = ransac(p1, p2);
+  std::vector<size_t> inliers = ransac.inlier_indices(fit, p1, p2);
+  EXPECT_EQ(150u, inliers.size());
+  for (size_t i = 0; i < inliers.size(); i++)
+    EXPECT_NE(0u, inliers[i] % 4);
+  EXPECT_NEAR(0.0, norm_frobenius(fit / fit(2, 2) - H), 1e-6);
+
+  // The same model with any number of threads
+  for (int num_threads = 1; num_threads <= 4; num_threads += 3) {
+    ParallelRansac<math::HomographyFittingFunctor, math::InterestPointErrorMetric>
+      ransac2(math::HomographyFittingFunctor(), math::InterestPointErrorMetric(),
+              1000, 1.0, p1.size() / 2, false, 0.999, num_threads);
+    EXPECT_EQ(0.0, norm_frobenius(ransac2(p1, p2) - fit));
+  }
+}
+
+TEST( InterestPointMatching, AdaptiveIpPerTile ) {
+
+  // A flat tile, a noisy one, and one with nodata on its left half
+  ImageView<float> image(96, 32);
+  for (int row = 0; row < image.rows(); row++) {
+    for (int col = 0; col < image.cols(); col++) {
+      if (col < 32)
+        image(col, row) = 5.0;
+      else if (col < 64)
+        image(col, row) = ((col + 3 * row) % 7) * 1.0;
+      else
+        image(col, row) = (col < 80) ? -1.0 : ((col + 3 * row) % 7) * 1.0;
+    }
+  }
+  std::vector<BBox2i> tiles = subdivide_bbox(image, 32, 32);
+  ASSERT_EQ(3u, tiles.size());
+  std::vector<double> texture;
+  tile_texture(image, 0.0, tiles, texture);
+  EXPECT_EQ(0.0, texture[0]);
+  EXPECT_GT(texture[1], texture[2]);
+  EXPECT_GT(texture[2], 0.0);
+
+  std::vector<int> tile_points;
+  allocate_ip_per_tile(texture, 100, tile_points);
+  EXPECT_EQ(0, tile_points[0]);
+  EXPECT_GT(tile_points[1], tile_points[2]);
+  EXPECT_NEAR(300, tile_points[1] + tile_points[2], 2);
+
+  // With no texture at all, all tiles get the same
+  allocate_ip_per_tile(std::vector<double>(3, 0.0), 100, tile_points);
+  EXPECT_EQ(std::vector<int>(3, 100), tile_points);
+}
@@ -0,0 +1,68 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/MappedPointFile.h>
+
+using namespace vw;
+
+void check_round_trip(std::string const& file, bool as_double) {
+  UnlinkName name(file);
+
+  // Each point has x, y, z and an intensity, so the records are not packed
+  std::vector<std::string> fields;
+  fields.push_back("x");
+  fields.push_back("y");
+  fields.push_back("z");
+  fields.push_back("intensity");
+  std::vector<double> values;
+  int num_points = 70000; // more than one write batch
+  for (int i = 0; i < num_points; i++) {
+    values.push_back(0.5 * i);
+    values.push_back(-0.25 * i);
+    values.push_back(i % 17);
+    values.push_back(3.0);
+  }
+  asp::write_binary_point_file(name, fields, values, as_double);
+
+  ASSERT_TRUE(asp::MappedPointFile::is_mappable(name));
+  asp::MappedPointFile cloud(name);
+  ASSERT_EQ(num_points, cloud.num_points());
+  EXPECT_EQ(as_double, cloud.is_double());
+  EXPECT_FALSE(cloud.is_packed());
+  for (int i = 0; i < num_points; i += 997) {
+    Vector3 p = cloud.point(i);
+    EXPECT_EQ(0.5 * i,  p[0]);
+    EXPECT_EQ(-0.25 * i, p[1]);
+    EXPECT_EQ(i % 17,   p[2]);
+  }
+}
+
+TEST(MappedPointFile, PcdRoundTrip) {
+  check_round_trip("mapped_test.pcd", false);
+  check_round_trip("mapped_test.pcd", true);
+}
+
+TEST(MappedPointFile, PlyRoundTrip) {
+  check_round_trip("mapped_test.ply", false);
+  check_round_trip("mapped_test.ply", true);
+}
+
+TEST(MappedPointFile, TextPcdIsNotMapped) {
+  EXPECT_FALSE(asp::MappedPointFile::is_mappable("sample_ascii.pcd"));
+}
@@ -0,0 +1,70 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/MappedTextFile.h>
+
+#include <atomic>
+#include <fstream>
+
+// Count the lines in chunks, and check that each chunk has whole lines
+struct LineCounter {
+  asp::MappedTextFile const& file;
+  std::atomic<int> num_lines, num_bad_chunks;
+  LineCounter(asp::MappedTextFile const& f): file(f), num_lines(0), num_bad_chunks(0) {}
+  void operator()(int chunk, size_t begin, size_t end) {
+    if (begin > 0 && file.data()[begin - 1] != '\n')
+      num_bad_chunks++;
+    std::string line;
+    for (size_t pos = begin; pos < end; num_lines++)
+      pos = file.read_line(pos, line);
+  }
+};
+
+TEST(MappedTextFile, SplitAtLines) {
+  UnlinkName name("mapped_text.csv");
+  {
+    std::ofstream ofs(name.c_str());
+    ofs << "# header\n";
+    for (int i = 0; i < 1000; i++)
+      ofs << i << "," << 2 * i << "," << 0.5 * i << "\n";
+    ofs << "last line, no newline";
+  }
+
+  asp::MappedTextFile file(name);
+  std::string line;
+  size_t pos = file.read_line(0, line);
+  EXPECT_EQ("# header", line);
+  EXPECT_EQ(9u, pos);
+
+  std::vector<size_t> bounds;
+  file.split_lines(pos, 100, bounds);
+  ASSERT_GT(bounds.size(), 10u);
+  EXPECT_EQ(pos, bounds.front());
+  EXPECT_EQ(file.size(), bounds.back());
+  for (size_t i = 1; i + 1 < bounds.size(); i++) {
+    EXPECT_LT(bounds[i - 1], bounds[i]);
+    EXPECT_EQ('\n', file.data()[bounds[i] - 1]);
+  }
+
+  LineCounter counter(file);
+  int num_threads = 4;
+  EXPECT_EQ(int(bounds.size()) - 1, asp::for_each_text_chunk(file, pos, counter, num_threads, 100));
+  EXPECT_EQ(1001, counter.num_lines.load());
+  EXPECT_EQ(0, counter.num_bad_chunks.load());
+}
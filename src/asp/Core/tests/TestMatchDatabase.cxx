@@ -0,0 +1,87 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/MatchDatabase.h>
+
+#include <fstream>
+
+using namespace vw;
+
+TEST(MatchDatabase, AppendAndRead) {
+
+  UnlinkName file("test.matchdb");
+
+  // A missing file is an empty database
+  {
+    asp::MatchDatabase db(file);
+    EXPECT_EQ(0u, db.num_pairs());
+  }
+
+  std::vector<ip::InterestPoint> ip1, ip2;
+  for (int k = 0; k < 5; k++) {
+    ip::InterestPoint p1(k + 0.5, 2.0 * k, 1.5), p2(3.0 * k, k - 0.25, 2.5);
+    p1.descriptor.set_size(3);
+    for (int d = 0; d < 3; d++)
+      p1.descriptor[d] = k + 0.1 * d;
+    ip1.push_back(p1);
+    ip2.push_back(p2);
+  }
+
+  asp::MatchDatabase::append_pair(file, "a.tif", "b.tif", ip1, ip2);
+  asp::MatchDatabase::append_pair(file, "a.tif", "c.tif", ip2, ip1);
+
+  // A newer record of the same pair replaces the older one
+  std::vector<ip::InterestPoint> few1(ip1.begin(), ip1.begin() + 2),
+    few2(ip2.begin(), ip2.begin() + 2);
+  asp::MatchDatabase::append_pair(file, "a.tif", "c.tif", few1, few2);
+
+  // A record cut short, as if still being written, is ignored
+  {
+    std::ofstream ofs(file.c_str(), std::ios::binary | std::ios::app);
+    ofs << "AMR1";
+  }
+
+  asp::MatchDatabase db(file);
+  EXPECT_EQ(2u, db.num_pairs());
+  EXPECT_TRUE(db.has_pair("a.tif", "b.tif"));
+  EXPECT_FALSE(db.has_pair("b.tif", "a.tif"));
+  EXPECT_EQ(2u, db.num_matches("a.tif", "c.tif"));
+
+  std::vector<ip::InterestPoint> out1, out2;
+  db.read_pair("a.tif", "b.tif", out1, out2);
+  ASSERT_EQ(ip1.size(), out1.size());
+  ASSERT_EQ(ip2.size(), out2.size());
+  for (size_t k = 0; k < ip1.size(); k++) {
+    EXPECT_EQ(ip1[k].x, out1[k].x);
+    EXPECT_EQ(ip1[k].y, out1[k].y);
+    EXPECT_EQ(ip1[k].scale, out1[k].scale);
+    EXPECT_EQ(ip2[k].x, out2[k].x);
+    EXPECT_EQ(ip2[k].y, out2[k].y);
+    ASSERT_EQ(ip1[k].descriptor.size(), out1[k].descriptor.size());
+    for (size_t d = 0; d < ip1[k].descriptor.size(); d++)
+      EXPECT_EQ(ip1[k].descriptor[d], out1[k].descriptor[d]);
+  }
+
+  db.read_pair("a.tif", "c.tif", out1, out2);
+  ASSERT_EQ(2u, out1.size());
+  EXPECT_EQ(few1[1].x, out1[1].x);
+  EXPECT_EQ(few2[1].y, out2[1].y);
+
+  EXPECT_THROW(db.read_pair("b.tif", "c.tif", out1, out2), vw::ArgumentErr);
+}
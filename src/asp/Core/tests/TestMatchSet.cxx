@@ -0,0 +1,69 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/MatchSet.h>
+#include <asp/Core/IpMatchingAlgs.h>
+#include <vw/InterestPoint/Matcher.h>
+
+#include <cmath>
+
+using namespace vw;
+
+TEST(MatchSet, ChainedFilters) {
+
+  // Matches on a grid with a constant shift, and two outliers
+  std::vector<ip::InterestPoint> ip1, ip2;
+  for (int r = 0; r < 10; r++) {
+    for (int c = 0; c < 10; c++) {
+      ip1.push_back(ip::InterestPoint(c * 200.0 + 10, r * 200.0 + 10));
+      ip2.push_back(ip::InterestPoint(c * 200.0 + 15, r * 200.0 + 12));
+    }
+  }
+  ip2[3].x  += 500;
+  ip2[71].y -= 400;
+  std::vector<ip::InterestPoint> all1 = ip1, all2 = ip2;
+
+  asp::MatchSet matches;
+  matches.set_matches(ip1, ip2);
+  EXPECT_EQ(100u, matches.size());
+  EXPECT_TRUE(ip1.empty());
+
+  // The coverage agrees with calc_ip_coverage_fraction()
+  Vector2i image_size(2000, 2000);
+  EXPECT_NEAR(asp::calc_ip_coverage_fraction(all2, image_size, 500, 2),
+              matches.coverage_fraction(image_size, 500, 2), 1e-12);
+
+  // Filters are applied to the matches left by the previous ones
+  matches.filter_by_disparity(90.0, 3.0);
+  EXPECT_EQ(98u, matches.size());
+  matches.filter_by_error([](ip::InterestPoint const& p1, ip::InterestPoint const& p2) {
+      return std::abs(p1.x - 1010.0); // keep one column
+    }, 0.5);
+  EXPECT_EQ(10u, matches.size());
+
+  UnlinkName file("test.match");
+  matches.write(file);
+  std::vector<ip::InterestPoint> out1, out2;
+  ip::read_binary_match_file(file, out1, out2);
+  ASSERT_EQ(10u, out1.size());
+  for (size_t i = 0; i < out1.size(); i++) {
+    EXPECT_EQ(1010.0, out1[i].x);
+    EXPECT_EQ(5.0, out2[i].x - out1[i].x);
+  }
+}
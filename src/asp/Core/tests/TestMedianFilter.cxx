@@ -0,0 +1,80 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+#include <vw/Image/ImageView.h>
+#include <asp/Core/MedianFilter.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+using namespace vw;
+
+namespace {
+  // The median of the kernel at each pixel where it fits, by sorting
+  template<class PixelT>
+  ImageView<PixelT> brute_force_median(ImageView<PixelT> const& img, int k) {
+    ImageView<PixelT> result(img.cols(), img.rows());
+    fill(result, PixelT());
+    for (int y = 0; y + k <= img.rows(); y++) {
+      for (int x = 0; x + k <= img.cols(); x++) {
+        std::vector<PixelT> vals;
+        for (int j = 0; j < k; j++)
+          for (int i = 0; i < k; i++)
+            vals.push_back(img(x + i, y + j));
+        std::sort(vals.begin(), vals.end());
+        result(x + k / 2, y + k / 2) = vals[k * k / 2];
+      }
+    }
+    return result;
+  }
+}
+
+TEST( MedianFilter, uint8 ) {
+  srand(7);
+  ImageView<uint8> img(37, 53);
+  for (int col = 0; col < img.cols(); col++)
+    for (int row = 0; row < img.rows(); row++)
+      img(col, row) = rand() % 256;
+
+  for (int k = 1; k <= 9; k += 2) {
+    ImageView<uint8> result;
+    median_filter_uint8(img, k, 4, result);
+    EXPECT_EQ(brute_force_median(img, k), result);
+  }
+
+  // An even kernel, and one as large as the image
+  ImageView<uint8> result;
+  median_filter_uint8(img, 4, 1, result);
+  EXPECT_EQ(brute_force_median(img, 4), result);
+  median_filter_uint8(img, 37, 2, result);
+  EXPECT_EQ(brute_force_median(img, 37), result);
+}
+
+TEST( MedianFilter, exact ) {
+  srand(11);
+  ImageView<float> img(41, 29);
+  for (int col = 0; col < img.cols(); col++)
+    for (int row = 0; row < img.rows(); row++)
+      img(col, row) = 1000.0 * rand() / RAND_MAX;
+
+  for (int k = 1; k <= 7; k += 2) {
+    ImageView<float> result = exact_median_filter(img, k);
+    EXPECT_EQ(brute_force_median(img, k), result);
+  }
+}
@@ -0,0 +1,48 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/MortonCode.h>
+
+// Interleave the bits one at a time
+std::uint64_t naive_morton(std::uint32_t const* x, int dim, int bits) {
+  std::uint64_t code = 0;
+  for (int b = 0; b < bits; b++)
+    for (int d = 0; d < dim; d++)
+      code |= std::uint64_t((x[d] >> b) & 1) << (b * dim + d);
+  return code;
+}
+
+TEST(MortonCode, MatchesBitByBit) {
+  std::uint32_t vals[] = {0u, 1u, 2u, 5u, 1023u, 0x12345u, 0x1fffffu, 0xabcdef12u, 0xffffffffu};
+  int n = sizeof(vals) / sizeof(vals[0]);
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      std::uint32_t xy[] = {vals[i], vals[j]};
+      EXPECT_EQ(naive_morton(xy, 2, 32), asp::morton_code_2d(xy[0], xy[1]));
+
+      std::uint32_t xyz[] = {vals[i] & 0x1fffffu, vals[j] & 0x1fffffu, vals[(i + j) % n] & 0x1fffffu};
+      EXPECT_EQ(naive_morton(xyz, 3, 21), asp::morton_code_3d(vals[i], vals[j], vals[(i + j) % n]));
+    }
+  }
+
+  // Neighbors in a 2x2 cell come in Z order
+  EXPECT_LT(asp::morton_code_2d(0, 0), asp::morton_code_2d(1, 0));
+  EXPECT_LT(asp::morton_code_2d(1, 0), asp::morton_code_2d(0, 1));
+  EXPECT_LT(asp::morton_code_2d(0, 1), asp::morton_code_2d(1, 1));
+}
@@ -0,0 +1,69 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+#include <asp/Core/Nvm.h>
+
+#include <fstream>
+
+TEST(Nvm, WriteAndRead) {
+  UnlinkName name("test.nvm");
+
+  asp::nvmData nvm;
+  int num_cid = 3, num_fid = 5;
+  for (int cid = 0; cid < num_cid; cid++) {
+    nvm.cid_to_filename.push_back("image" + std::to_string(cid) + ".tif");
+    Eigen::Affine3d t = Eigen::Affine3d::Identity();
+    t.linear() = Eigen::AngleAxisd(0.1 * cid, Eigen::Vector3d::UnitZ()).toRotationMatrix();
+    t.translation() = Eigen::Vector3d(cid, 2.0 * cid, -1.0);
+    nvm.cid_to_cam_t_global.push_back(t);
+    Eigen::Matrix2Xd keypoints(2, num_fid);
+    for (int fid = 0; fid < num_fid; fid++)
+      keypoints.col(fid) = Eigen::Vector2d(10.5 * fid + cid, -3.25 * fid);
+    nvm.cid_to_keypoint_map.push_back(keypoints);
+  }
+  for (int pid = 0; pid < num_fid; pid++) {
+    std::map<int, int> cid_fid;
+    for (int cid = 0; cid < num_cid; cid++)
+      cid_fid[cid] = (pid + cid) % num_fid;
+    nvm.pid_to_cid_fid.push_back(cid_fid);
+    nvm.pid_to_xyz.push_back(Eigen::Vector3d(pid, -pid, 0.5 * pid));
+  }
+  std::vector<double> focal_lengths(num_cid, 1.0);
+  asp::WriteNVM(nvm.cid_to_keypoint_map, nvm.cid_to_filename, focal_lengths,
+                nvm.pid_to_cid_fid, nvm.pid_to_xyz, nvm.cid_to_cam_t_global, name);
+
+  // A model terminator, as other tools write, is not read as a point
+  {
+    std::ofstream ofs(name.c_str(), std::ios::app);
+    ofs << "\n0\n";
+  }
+
+  asp::nvmData nvm2;
+  asp::ReadNVM(name, nvm2);
+  ASSERT_EQ(nvm.cid_to_filename.size(), nvm2.cid_to_filename.size());
+  ASSERT_EQ(nvm.pid_to_xyz.size(), nvm2.pid_to_xyz.size());
+  for (int cid = 0; cid < num_cid; cid++) {
+    EXPECT_EQ(nvm.cid_to_filename[cid], nvm2.cid_to_filename[cid]);
+    EXPECT_TRUE(nvm.cid_to_cam_t_global[cid].isApprox(nvm2.cid_to_cam_t_global[cid], 1e-12));
+    EXPECT_TRUE(nvm.cid_to_keypoint_map[cid].isApprox(nvm2.cid_to_keypoint_map[cid]));
+  }
+  for (int pid = 0; pid < num_fid; pid++) {
+    EXPECT_TRUE(nvm.pid_to_cid_fid[pid] == nvm2.pid_to_cid_fid[pid]);
+    EXPECT_TRUE(nvm.pid_to_xyz[pid].isApprox(nvm2.pid_to_xyz[pid]));
+  }
+}
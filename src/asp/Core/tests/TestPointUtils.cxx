@@ -18,6 +18,7 @@
 
 #include <test/Helpers.h>
 #include <asp/Core/PointUtils.h>
+#include <vw/Cartography/Datum.h>
 
 using namespace vw;
 using namespace asp;
@@ -152,3 +153,83 @@ TEST( PointUtils, PcdReader ) {
 }
 
 
+// Write a cloud as chunks and read it back. Both the chunks stored as
+// floats and those stored as doubles must be recovered exactly.
+TEST( PointUtils, ChunkedPointCloud ) {
+
+  Vector3 shift(-2.4e6, -4.6e6, 3.5e6);
+  ImageView<Vector4> cloud(300, 200);
+  for (int col = 0; col < cloud.cols(); col++) {
+    for (int row = 0; row < cloud.rows(); row++) {
+      if ((col + row) % 5 == 0 || col > 280)
+        continue; // invalid
+      // Points in the second column of chunks are not exact as floats
+      double frac = (col < 256) ? (col + 1) / 64.0 : 1.0 / (col + row + 3);
+      cloud(col, row) = Vector4(shift[0] + frac, shift[1] - row, shift[2] + col, 0.25 * row);
+    }
+  }
+
+  UnlinkName file("chunked.apc");
+  asp::write_chunked_point_cloud(file, cloud, shift, "", 256, 2,
+                                 ProgressCallback::dummy_instance());
+
+  EXPECT_TRUE(asp::is_chunked_point_cloud(file));
+  EXPECT_EQ(4, asp::num_channels(file));
+  asp::ChunkedPointCloudInfo info;
+  asp::read_chunked_point_cloud_info(file, info);
+  ASSERT_EQ(2u, info.chunks.size());
+  EXPECT_FALSE(info.chunks[0].is_double);
+  EXPECT_TRUE(info.chunks[1].is_double);
+
+  ImageView<Vector4> out = asp::read_asp_point_cloud<4>(file);
+  ASSERT_EQ(cloud.cols(), out.cols());
+  ASSERT_EQ(cloud.rows(), out.rows());
+  for (int col = 0; col < cloud.cols(); col++) {
+    for (int row = 0; row < cloud.rows(); row++) {
+      Vector4 p = cloud(col, row);
+      if (p != Vector4())
+        for (int k = 0; k < 3; k++) p[k] = (p[k] - shift[k]) + shift[k];
+      for (int k = 0; k < 4; k++)
+        EXPECT_EQ(p[k], out(col, row)[k]);
+    }
+  }
+
+  // The index has the box of the points of each chunk. A filter which
+  // rejects the second chunk makes its points invalid.
+  EXPECT_NEAR(shift[2], info.chunks[0].point_box.min()[2], 1e-6);
+  EXPECT_NEAR(shift[2] + 255, info.chunks[0].point_box.max()[2], 1e-6);
+  double mid = shift[2] + 256;
+  asp::ChunkFilter filter = [mid](BBox3 const& box) { return box.max()[2] < mid; };
+  ImageView<Vector4> part = asp::read_asp_point_cloud<4>(file, filter);
+  EXPECT_EQ(out(10, 11), part(10, 11));
+  EXPECT_EQ(Vector4(), part(260, 11));
+}
+
+TEST( PointUtils, CartesianBoxToLonLatBox ) {
+
+  cartography::Datum datum("WGS84");
+  Vector3 llh(179.99, 45.0, 100.0);
+  Vector3 xyz = datum.geodetic_to_cartesian(llh);
+  BBox3 xyz_box(xyz - Vector3(50, 50, 50), xyz + Vector3(50, 50, 50));
+  BBox2 lonlat_box = asp::cartesian_box_to_lonlat_box(xyz_box, datum);
+
+  // The box straddles the antimeridian, so the longitudes go past 180.
+  // It must contain the points in the box, but not be much bigger.
+  EXPECT_LT(lonlat_box.width(), 0.01);
+  EXPECT_LT(lonlat_box.height(), 0.01);
+  for (int i = 0; i < 8; i++) {
+    Vector3 p = xyz_box.min() + Vector3(1, 1, 1); // just inside the corners
+    for (int k = 0; k < 3; k++)
+      if (i & (1 << k)) p[k] = xyz_box.max()[k] - 1;
+    Vector3 q = datum.cartesian_to_geodetic(p);
+    if (q[0] < 0)
+      q[0] += 360.0;
+    EXPECT_TRUE(lonlat_box.contains(subvector(q, 0, 2)));
+  }
+
+  // A box with the origin has all lon and lat
+  BBox2 all = asp::cartesian_box_to_lonlat_box(BBox3(Vector3(-1, -1, -1),
+                                                     Vector3(1, 1, 1)), datum);
+  EXPECT_EQ(360.0, all.width());
+  EXPECT_EQ(180.0, all.height());
+}
@@ -0,0 +1,72 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/SharedBlockCache.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <vw/FileIO/DiskImageUtils.h>
+#include <vw/Image/ImageView.h>
+
+#include <boost/filesystem.hpp>
+
+#include <cstdlib>
+
+using namespace vw;
+
+TEST(SharedBlockCache, ReadViaCache) {
+
+  // The cache is set up from the environment when first used
+  std::string cache_dir = "shared_block_cache_test";
+  setenv("ASP_BLOCK_CACHE_DIR", cache_dir.c_str(), 1);
+  asp::SharedBlockCache & cache = asp::SharedBlockCache::instance();
+  ASSERT_TRUE(cache.enabled());
+
+  // A block is found only with its size
+  std::vector<char> bytes(100), out(100, 0);
+  for (size_t i = 0; i < bytes.size(); i++)
+    bytes[i] = char(i);
+  cache.put("00abcdef", &bytes[0], bytes.size());
+  EXPECT_FALSE(cache.get("00abcdef", &out[0], 99));
+  EXPECT_FALSE(cache.get("00fedcba", &out[0], 100));
+  ASSERT_TRUE(cache.get("00abcdef", &out[0], 100));
+  EXPECT_TRUE(bytes == out);
+
+  // Reading an image twice, the second time from the cache, gives
+  // its pixels, also when converting them to another type
+  UnlinkName name("shared_block_cache.tif");
+  ImageView<float> image(37, 29);
+  for (int r = 0; r < image.rows(); r++)
+    for (int c = 0; c < image.cols(); c++)
+      image(c, r) = 0.5 * c - 2.0 * r;
+  write_image(name, image);
+
+  for (int pass = 0; pass < 2; pass++) {
+    ImageView<float> copy = DiskImageView<float>(asp::cached_image_resource(name));
+    ImageView<double> dcopy = DiskImageView<double>(asp::cached_image_resource(name));
+    ASSERT_EQ(image.cols(), copy.cols());
+    ASSERT_EQ(image.rows(), copy.rows());
+    for (int r = 0; r < image.rows(); r++) {
+      for (int c = 0; c < image.cols(); c++) {
+        EXPECT_EQ(image(c, r), copy(c, r));
+        EXPECT_EQ(image(c, r), dcopy(c, r));
+      }
+    }
+  }
+
+  boost::filesystem::remove_all(cache_dir);
+}
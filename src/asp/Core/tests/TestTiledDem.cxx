@@ -0,0 +1,71 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/TiledDem.h>
+#include <vw/Image/ImageView.h>
+
+using namespace vw;
+
+TEST(TiledDem, BilinearAcrossTiles) {
+
+  // A plane, so bilinear interpolation is exact, with one no-data pixel
+  const float nodata = -32768;
+  ImageView<float> image(23, 17);
+  for (int r = 0; r < image.rows(); r++)
+    for (int c = 0; c < image.cols(); c++)
+      image(c, r) = 2.0 * c - 3.0 * r + 100.0;
+  image(10, 10) = nodata;
+
+  vw::cartography::GeoReference georef;
+  asp::TiledDem dem;
+  dem.set(image, nodata, georef, 5); // small tiles, so lookups cross them
+  EXPECT_EQ(23, dem.cols());
+  EXPECT_EQ(17, dem.rows());
+
+  double h = 0.0;
+  // The steps never land on a whole pixel near the no-data one
+  for (int i = 0; 0.05 + 0.7 * i < 16.0; i++) {
+    double r = 0.05 + 0.7 * i;
+    for (int j = 0; 0.13 + 0.37 * j < 22.0; j++) {
+      double c = 0.13 + 0.37 * j;
+      bool near_nodata = (c > 9.0 && c < 11.0 && r > 9.0 && r < 11.0);
+      ASSERT_EQ(!near_nodata, dem.interpolate(c, r, h)) << c << ' ' << r;
+      if (!near_nodata)
+        EXPECT_NEAR(2.0 * c - 3.0 * r + 100.0, h, 1e-4);
+    }
+  }
+
+  // The last column and row have no neighbors to the right and below
+  EXPECT_TRUE(dem.interpolate(21.5, 15.5, h));
+  EXPECT_FALSE(dem.interpolate(22.0, 3.0, h));
+  EXPECT_FALSE(dem.interpolate(3.0, 16.0, h));
+  EXPECT_FALSE(dem.interpolate(-0.1, 3.0, h));
+
+  // The batch version agrees
+  std::vector<Vector2> pixels;
+  pixels.push_back(Vector2(4.5, 4.5));
+  pixels.push_back(Vector2(10.0, 9.5));
+  std::vector<double> heights;
+  std::vector<char> valid;
+  dem.interpolate(pixels, heights, valid);
+  ASSERT_EQ(2u, valid.size());
+  EXPECT_TRUE(valid[0]);
+  EXPECT_NEAR(2.0 * 4.5 - 3.0 * 4.5 + 100.0, heights[0], 1e-4);
+  EXPECT_FALSE(valid[1]);
+}
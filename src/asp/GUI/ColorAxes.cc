@@ -181,6 +181,8 @@ public:
   ColorAxesData(imageData & image): m_image(image) {
     // TODO(oalexan1): Need to handle georeferences.
 
+    // With --lazy-load the pyramid may not be open yet
+    image.img.load();
     vw::mosaic::DiskImagePyramid<double> & img = image.img.m_img_ch1_double;
     
     if (img.planes() != 1) {
@@ -212,6 +214,8 @@ public:
   // and extent just enough for the job, or a little higher res and bigger.
   void prepareClip(double x0, double y0, double x1, double y1, QSize const& imageSize) {
 
+    m_image.img.load(); // in case it was closed meanwhile
+
     // Note that y0 and y1 are normally flipped
     int beg_x = floor(std::min(x0, x1)), end_x = ceil(std::max(x0, x1));
     int beg_y = floor(std::min(y0, y1)), end_y = ceil(std::max(y0, y1));
@@ -247,6 +251,7 @@ public:
     if (m_sub_scale <= 0) 
       vw::vw_throw(vw::ArgumentErr() << "Programmer error. Not ready yet to render the image.\n");
     
+    m_image.img.load();
     vw::mosaic::DiskImagePyramid<double> const& img = m_image.img.m_img_ch1_double;
 
     // Return pixels at the appropriate level of resolution
@@ -19,6 +19,7 @@
 
 #include <QtWidgets>
 
+#include <atomic>
 #include <string>
 #include <vector>
 
@@ -37,23 +38,25 @@ TemporaryFiles& temporary_files() {
   temporary_files_once.run( init_temporary_files);
   return *temporary_files_ptr;
 }
+
+// Used to tell apart the images which were read, such as for caching
+std::atomic<int> g_next_image_id(0);
   
 DiskImagePyramidMultiChannel::DiskImagePyramidMultiChannel(std::string const& image_file,
                              vw::GdalWriteOptions const& opt,
-                             int top_image_max_pix, int subsample):
-  m_opt(opt), m_num_channels(0), m_rows(0), m_cols(0), m_type(UNINIT) {
+                             int top_image_max_pix, int subsample, bool lazy):
+  m_opt(opt), m_image_file(image_file), m_num_channels(0), m_rows(0), m_cols(0),
+  m_type(UNINIT), m_id(g_next_image_id++), m_loaded(false) {
   
   if (image_file == "") return;
 
-  boost::shared_ptr<DiskImageResource> image_rsrc = vw::DiskImageResourcePtr(image_file);
-  ImageFormat image_fmt = image_rsrc->format();
-  
-  // Redirect to the correctly typed function to perform the actual map projection.
-  // - Must correspond to the type of the input image.
-  // Instantiate the correct DiskImagePyramid then record information including
-  //  the list of temporary files it created.
+  // Find the type of the image from its header, without reading pixels
   try {
+    boost::shared_ptr<DiskImageResource> image_rsrc = vw::DiskImageResourcePtr(image_file);
+    ImageFormat image_fmt = image_rsrc->format();
     m_num_channels = get_num_channels(image_file);
+    m_rows = image_rsrc->rows();
+    m_cols = image_rsrc->cols();
 
     if (m_num_channels > 1 && image_fmt.channel_type != VW_CHANNEL_UINT8) {
       vw_out() << "File " << image_file << " has more than one band, and the "
@@ -63,39 +66,16 @@ DiskImagePyramidMultiChannel::DiskImagePyramidMultiChannel(std::string const& im
     
     if (m_num_channels == 1 || image_fmt.channel_type != VW_CHANNEL_UINT8) {
       // Single channel image with float pixels.
-      m_img_ch1_double = vw::mosaic::DiskImagePyramid<double>(image_file, m_opt);
-      m_rows = m_img_ch1_double.rows();
-      m_cols = m_img_ch1_double.cols();
       m_type = CH1_DOUBLE;
-      temporary_files().files.insert(m_img_ch1_double.get_temporary_files().begin(), 
-                                     m_img_ch1_double.get_temporary_files().end());
     }else if (m_num_channels == 2){
       // uint8 image with an alpha channel.
-      m_img_ch2_uint8 = vw::mosaic::DiskImagePyramid<Vector<vw::uint8, 2>>(image_file, m_opt);
-      m_num_channels = 2; // we read only 1 channel
-      m_rows = m_img_ch2_uint8.rows();
-      m_cols = m_img_ch2_uint8.cols();
       m_type = CH2_UINT8;
-      temporary_files().files.insert(m_img_ch2_uint8.get_temporary_files().begin(), 
-                                     m_img_ch2_uint8.get_temporary_files().end());
     } else if (m_num_channels == 3){
       // RGB image with three uint8 channels.
-      m_img_ch3_uint8 = vw::mosaic::DiskImagePyramid<Vector<vw::uint8, 3>>(image_file, m_opt);
-      m_num_channels = 3;
-      m_rows = m_img_ch3_uint8.rows();
-      m_cols = m_img_ch3_uint8.cols();
       m_type = CH3_UINT8;
-      temporary_files().files.insert(m_img_ch3_uint8.get_temporary_files().begin(), 
-                                     m_img_ch3_uint8.get_temporary_files().end());
     } else if (m_num_channels == 4){
       // RGB image with three uint8 channels and an alpha channel
-      m_img_ch4_uint8 = vw::mosaic::DiskImagePyramid<Vector<vw::uint8, 4>>(image_file, m_opt);
-      m_num_channels = 4;
-      m_rows = m_img_ch4_uint8.rows();
-      m_cols = m_img_ch4_uint8.cols();
       m_type = CH4_UINT8;
-      temporary_files().files.insert(m_img_ch4_uint8.get_temporary_files().begin(), 
-                                     m_img_ch4_uint8.get_temporary_files().end());
     }else{
       vw_throw(ArgumentErr() << "Unsupported image with " << m_num_channels << " bands.\n");
     }
@@ -103,9 +83,57 @@ DiskImagePyramidMultiChannel::DiskImagePyramidMultiChannel(std::string const& im
       popUp(e.what());
       return;
   }
+
+  if (!lazy)
+    load();
+}
+
+void DiskImagePyramidMultiChannel::load() const {
+
+  if (m_loaded || m_type == UNINIT)
+    return;
+  
+  // Instantiate the correct DiskImagePyramid then record information including
+  //  the list of temporary files it created. This builds the pyramid
+  // if not done already.
+  try {
+    if (m_type == CH1_DOUBLE) {
+      m_img_ch1_double = vw::mosaic::DiskImagePyramid<double>(m_image_file, m_opt);
+      temporary_files().insert(m_img_ch1_double.get_temporary_files().begin(), 
+                               m_img_ch1_double.get_temporary_files().end());
+    }else if (m_type == CH2_UINT8){
+      m_img_ch2_uint8 = vw::mosaic::DiskImagePyramid<Vector<vw::uint8, 2>>(m_image_file, m_opt);
+      temporary_files().insert(m_img_ch2_uint8.get_temporary_files().begin(), 
+                               m_img_ch2_uint8.get_temporary_files().end());
+    } else if (m_type == CH3_UINT8){
+      m_img_ch3_uint8 = vw::mosaic::DiskImagePyramid<Vector<vw::uint8, 3>>(m_image_file, m_opt);
+      temporary_files().insert(m_img_ch3_uint8.get_temporary_files().begin(), 
+                               m_img_ch3_uint8.get_temporary_files().end());
+    } else {
+      m_img_ch4_uint8 = vw::mosaic::DiskImagePyramid<Vector<vw::uint8, 4>>(m_image_file, m_opt);
+      temporary_files().insert(m_img_ch4_uint8.get_temporary_files().begin(), 
+                               m_img_ch4_uint8.get_temporary_files().end());
+    }
+  } catch (const Exception& e) {
+      // Do not try again at each redraw
+      m_type = UNINIT;
+      popUp(e.what());
+      return;
+  }
+
+  m_loaded = true;
+}
+
+void DiskImagePyramidMultiChannel::unload() {
+  m_img_ch1_double = vw::mosaic::DiskImagePyramid<double>();
+  m_img_ch2_uint8  = vw::mosaic::DiskImagePyramid<Vector<vw::uint8, 2>>();
+  m_img_ch3_uint8  = vw::mosaic::DiskImagePyramid<Vector<vw::uint8, 3>>();
+  m_img_ch4_uint8  = vw::mosaic::DiskImagePyramid<Vector<vw::uint8, 4>>();
+  m_loaded = false;
 }
 
 double DiskImagePyramidMultiChannel::get_nodata_val() const {
+  load();
   
   // Extract the clip, then convert it from VW format to QImage format.
   if (m_type == CH1_DOUBLE) {
@@ -123,7 +151,10 @@ double DiskImagePyramidMultiChannel::get_nodata_val() const {
   
 void DiskImagePyramidMultiChannel::get_image_clip(double scale_in, vw::BBox2i region_in,
                   bool highlight_nodata,
-                  QImage & qimg, double & scale_out, vw::BBox2i & region_out) const{
+                  QImage & qimg, double & scale_out, vw::BBox2i & region_out,
+                  bool local_stretch) const{
+
+  load();
 
   bool scale_pixels = (m_type == CH1_DOUBLE);
   vw::Vector2 approx_bounds;
@@ -147,7 +178,7 @@ void DiskImagePyramidMultiChannel::get_image_clip(double scale_in, vw::BBox2i re
     //Stopwatch sw2;
     //sw2.start();
     formQimage(highlight_nodata, scale_pixels, m_img_ch1_double.get_nodata_val(), approx_bounds,
-               clip, qimg);
+               clip, qimg, local_stretch);
     //sw2.stop();
     //vw_out() << "Render time sw2 (seconds): " << sw2.elapsed_seconds() << std::endl;
   } else if (m_type == CH2_UINT8) {
@@ -203,7 +234,61 @@ void DiskImagePyramidMultiChannel::get_image_clip(double scale_in, vw::BBox2i re
   }
 }
 
+void DiskImagePyramidMultiChannel::get_raw_clip(double scale_in, vw::BBox2i region_in,
+                                                vw::ImageView<double> & clip,
+                                                double & scale_out,
+                                                vw::BBox2i & region_out) const {
+  load();
+  if (m_type != CH1_DOUBLE)
+    vw_throw(ArgumentErr() << "Expecting a single-channel image.\n");
+
+  m_img_ch1_double.get_image_clip(scale_in, region_in, clip, scale_out, region_out);
+}
+
+vw::Vector2 DiskImagePyramidMultiChannel::get_approx_bounds() const {
+  load();
+  if (m_type != CH1_DOUBLE)
+    vw_throw(ArgumentErr() << "Expecting a single-channel image.\n");
+
+  return m_img_ch1_double.get_approx_bounds();
+}
+
+int DiskImagePyramidMultiChannel::num_levels() const {
+  load();
+  if (m_type == CH1_DOUBLE) {
+    return m_img_ch1_double.pyramid().size();
+  } else if (m_type == CH2_UINT8) {
+    return m_img_ch2_uint8.pyramid().size();
+  } else if (m_type == CH3_UINT8) {
+    return m_img_ch3_uint8.pyramid().size();
+  } else if (m_type == CH4_UINT8) {
+    return m_img_ch4_uint8.pyramid().size();
+  }else{
+    vw_throw(ArgumentErr() << "Unsupported image with " << m_num_channels << " bands\n");
+  }
+}
+
+vw::Vector2i DiskImagePyramidMultiChannel::level_size(int level) const {
+  if (level < 0 || level >= num_levels())
+    vw_throw(ArgumentErr() << "Pyramid level out of range: " << level << ".\n");
+  
+  if (m_type == CH1_DOUBLE) {
+    return vw::Vector2i(m_img_ch1_double.pyramid()[level].cols(),
+                        m_img_ch1_double.pyramid()[level].rows());
+  } else if (m_type == CH2_UINT8) {
+    return vw::Vector2i(m_img_ch2_uint8.pyramid()[level].cols(),
+                        m_img_ch2_uint8.pyramid()[level].rows());
+  } else if (m_type == CH3_UINT8) {
+    return vw::Vector2i(m_img_ch3_uint8.pyramid()[level].cols(),
+                        m_img_ch3_uint8.pyramid()[level].rows());
+  } else {
+    return vw::Vector2i(m_img_ch4_uint8.pyramid()[level].cols(),
+                        m_img_ch4_uint8.pyramid()[level].rows());
+  }
+}
+
 std::string DiskImagePyramidMultiChannel::get_value_as_str(int32 x, int32 y) const {
+  load();
 
   // Below we cast from Vector<uint8> to Vector<double>, as the former
   // refuses to print well.
@@ -224,6 +309,7 @@ std::string DiskImagePyramidMultiChannel::get_value_as_str(int32 x, int32 y) con
 }
   
 double DiskImagePyramidMultiChannel::get_value_as_double(int32 x, int32 y) const {
+  load();
   if (m_type == CH1_DOUBLE) {
     return m_img_ch1_double.bottom()(x, y, 0);
   }else if (m_type == CH2_UINT8){
@@ -234,4 +320,18 @@ double DiskImagePyramidMultiChannel::get_value_as_double(int32 x, int32 y) const
   return 0;
 }
 
+double DiskImagePyramidMultiChannel::get_value_as_double(int level, int32 x, int32 y) const {
+  if (level < 0 || level >= num_levels())
+    vw_throw(ArgumentErr() << "Pyramid level out of range: " << level << ".\n");
+
+  if (m_type == CH1_DOUBLE) {
+    return m_img_ch1_double.pyramid()[level](x, y, 0);
+  }else if (m_type == CH2_UINT8){
+    return m_img_ch2_uint8.pyramid()[level](x, y, 0)[0];
+  }else{
+    vw_throw(ArgumentErr() << "Unsupported image with " << m_num_channels << " bands\n");
+  }
+  return 0;
+}
+
 }} // namespace vw::gui
@@ -61,6 +61,15 @@ namespace vw { namespace gui {
   /// A global structure to hold all the temporary files we have created
   struct TemporaryFiles {
     std::set<std::string> files;
+
+    /// Add files. Thread-safe, as images may be read in parallel.
+    template<class IterT>
+    void insert(IterT beg, IterT end) {
+      vw::Mutex::Lock lock(mutex);
+      files.insert(beg, end);
+    }
+  private:
+    vw::Mutex mutex;
   };
   /// Access the global list of temporary files
   TemporaryFiles& temporary_files();
@@ -74,11 +83,17 @@ namespace vw { namespace gui {
   typename boost::enable_if<boost::is_same<PixelT,double>, void>::type
   formQimage(bool highlight_nodata, bool scale_pixels, double nodata_val,
              vw::Vector2 const& approx_bounds,
-             ImageView<PixelT> const& clip, QImage & qimg){
+             ImageView<PixelT> const& clip, QImage & qimg,
+             bool local_stretch = true){
 
     double min_val = std::numeric_limits<double>::max();
     double max_val = -std::numeric_limits<double>::max();
-    if (scale_pixels) {
+    if (scale_pixels && !local_stretch && approx_bounds[0] < approx_bounds[1]) {
+      // Use the same stretch for all clips, so that tiles drawn
+      // next to each other agree.
+      min_val = approx_bounds[0];
+      max_val = approx_bounds[1];
+    } else if (scale_pixels) {
       // No multi-threading here since we modify shared values
       for (int col = 0; col < clip.cols(); col++){
         for (int row = 0; row < clip.rows(); row++){
@@ -185,35 +200,70 @@ namespace vw { namespace gui {
   // TODO: Add the case when multi-channel images also have float or double pixels
   struct DiskImagePyramidMultiChannel {
     vw::GdalWriteOptions m_opt;
-    vw::mosaic::DiskImagePyramid<double>               m_img_ch1_double;
-    vw::mosaic::DiskImagePyramid<Vector<vw::uint8, 2>> m_img_ch2_uint8;
-    vw::mosaic::DiskImagePyramid<Vector<vw::uint8, 3>> m_img_ch3_uint8;
-    vw::mosaic::DiskImagePyramid<Vector<vw::uint8, 4>> m_img_ch4_uint8;
+    std::string m_image_file;
+    // The pyramids are made on first use, if lazy, so these are mutable
+    mutable vw::mosaic::DiskImagePyramid<double>               m_img_ch1_double;
+    mutable vw::mosaic::DiskImagePyramid<Vector<vw::uint8, 2>> m_img_ch2_uint8;
+    mutable vw::mosaic::DiskImagePyramid<Vector<vw::uint8, 3>> m_img_ch3_uint8;
+    mutable vw::mosaic::DiskImagePyramid<Vector<vw::uint8, 4>> m_img_ch4_uint8;
     int m_num_channels;
     int m_rows, m_cols;
-    ImgType m_type; // keeps track of which of the above images we use
+    mutable ImgType m_type; // keeps track of which of the above images we use
+    int m_id; // different for each image read, but shared by copies
+    mutable bool m_loaded;
 
-    // Constructor
+    // Constructor. If lazy, read only the image size and type, and make
+    // the pyramid when the pixels are first needed.
     DiskImagePyramidMultiChannel(std::string const& image_file = "",
                                  vw::GdalWriteOptions const&
                                  opt = vw::GdalWriteOptions(),
                                  int top_image_max_pix = 1000*1000,
-                                 int subsample = 2);
+                                 int subsample = 2, bool lazy = false);
+
+    /// Make the pyramid if not done yet. All functions reading
+    /// pixels call this. Not thread-safe.
+    void load() const;
+
+    /// Close the pyramid and its files. It is made again when needed.
+    void unload();
+
+    bool loaded() const { return m_loaded; }
 
     // This function will return a QImage to be shown on screen.
     // How we create it, depends on the type of image we want to display.
+    // Without local_stretch, single-channel images are stretched with
+    // the bounds of the whole image, rather than those of the clip.
     void get_image_clip(double scale_in, vw::BBox2i region_in, bool highlight_nodata,
-                        QImage & qimg, double & scale_out, vw::BBox2i & region_out) const;
+                        QImage & qimg, double & scale_out, vw::BBox2i & region_out,
+                        bool local_stretch = true) const;
     double get_nodata_val() const;
+
+    /// The raw pixels of a clip of a single-channel image, for rendering
+    /// them in other ways, such as hillshading.
+    void get_raw_clip(double scale_in, vw::BBox2i region_in,
+                      vw::ImageView<double> & clip, double & scale_out,
+                      vw::BBox2i & region_out) const;
+
+    /// Approximate bounds of the pixels of a single-channel image
+    vw::Vector2 get_approx_bounds() const;
     
     int32 cols  () const { return m_cols;  }
     int32 rows  () const { return m_rows;  }
     int32 planes() const { return m_num_channels; }
 
+    /// The number of pyramid levels. Level l is subsampled by 2^l.
+    int num_levels() const;
+
+    /// The dimensions of a pyramid level
+    vw::Vector2i level_size(int level) const;
+
     /// Return the element at this location (at the lowest level) cast to double.
     /// - Only works for single channel pyramids!
     double get_value_as_double( int32 x, int32 y) const;
 
+    /// The same, at the given pyramid level, in the pixels of that level
+    double get_value_as_double(int level, int32 x, int32 y) const;
+
     // Return value as string
     std::string get_value_as_str( int32 x, int32 y) const;
   };
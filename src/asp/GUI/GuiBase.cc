@@ -16,6 +16,7 @@
 // __END_LICENSE__
 
 #include <asp/GUI/GuiBase.h>
+#include <vw/Core/Log.h>
 #include <QtWidgets>
 #include <string>
 
@@ -25,6 +26,10 @@ using namespace vw::gui;
 namespace vw { namespace gui {
 
 void popUp(std::string const& msg){
+  if (qApp == NULL || QThread::currentThread() != qApp->thread()) {
+    vw_out(WarningMessage) << msg << "\n";
+    return;
+  }
   QMessageBox msgBox;
   msgBox.setText(msg.c_str());
   msgBox.exec();
@@ -27,6 +27,8 @@
 
 namespace vw { namespace gui {
 
+  /// Show a message. If not in the GUI thread, such as when images are
+  /// read in parallel, or if there is no GUI, print it instead.
   void popUp(std::string const& msg);
   
 }} // namespace vw::gui
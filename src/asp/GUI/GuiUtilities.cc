@@ -20,25 +20,34 @@
 // shapefile logic, or DiskImagePyramid read from GuiUtilities.h.
 // These may need to be moved to separate files.
 
+#include <algorithm>
 #include <string>
 #include <vector>
+#include <iomanip>
+#include <sstream>
+#include <cmath>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/noncopyable.hpp>
 #include <QPolygon>
 #include <QtGui>
 #include <QtWidgets>
 #include <ogrsf_frmts.h>
+#include <cpl_conv.h>
 
 // For contours
 #include <opencv2/imgproc.hpp>
 
 #include <vw/Image/Algorithms.h>
 #include <vw/Cartography/GeoTransform.h>
-#include <vw/Cartography/Hillshade.h>
 #include <vw/Core/RunOnce.h>
 #include <vw/BundleAdjustment/ControlNetworkLoader.h>
 #include <vw/InterestPoint/Matcher.h> // Needed for vw::ip::match_filename
 #include <vw/Geometry/dPoly.h>
 #include <vw/Cartography/shapeFile.h>
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
 
 #include <asp/GUI/GuiUtilities.h>
 #include <asp/Core/StereoSettings.h>
@@ -111,65 +120,119 @@ QRect bbox2qrect(BBox2 const& B){
                round(B.width()), round(B.height()));
 }
 
-bool write_hillshade(vw::GdalWriteOptions const& opt,
-                     bool have_gui,
-                     double azimuth, double elevation,
-                     std::string const& input_file,
-                     std::string      & output_file) {
+bool sample_profile(DiskImagePyramidMultiChannel const& img,
+                    std::vector<vw::Vector2> const& vertices, int level,
+                    std::function<bool()> const& canceled,
+                    std::vector<double> & valsX, std::vector<double> & valsY) {
 
-  // Sanity check: Must have a georeference
-  cartography::GeoReference georef;
-  bool has_georef = vw::cartography::read_georeference(georef, input_file);
-  if (!has_georef) {
-    popUp("No georeference present in: " + input_file + ".");
-    return false;
+  valsX.clear(); valsY.clear();
+  double nodata_val = img.get_nodata_val();
+  vw::Vector2i size = img.level_size(level);
+  double scale = double(std::int64_t(1) << level);
+
+  int count = 0;
+  int num_pts = vertices.size();
+  for (int pt_iter = 0; pt_iter < num_pts; pt_iter++) {
+
+    // Nothing to do if we are at the last point, unless
+    // there is only one point.
+    if (num_pts > 1 && pt_iter == num_pts - 1) continue;
+
+    vw::Vector2 begP = vertices[pt_iter] / scale;
+    vw::Vector2 endP = (num_pts == 1) ? begP : vertices[pt_iter + 1] / scale;
+
+    int begX = begP.x(),   begY = begP.y();
+    int endX = endP.x(),   endY = endP.y();
+    int seg_len = std::abs(begX - endX) + std::abs(begY - endY);
+    if (seg_len == 0) seg_len = 1; // ensure it is never empty
+    for (int p = 0; p <= seg_len; p++) {
+
+      if (p % 1000 == 0 && canceled())
+        return false;
+
+      double t = double(p)/seg_len;
+      int x = round( begX + t*(endX - begX) );
+      int y = round( begY + t*(endY - begY) );
+      bool is_in = (x >= 0 && x <= size.x() - 1 &&
+                    y >= 0 && y <= size.y() - 1);
+      if (!is_in)
+        continue;
+
+      double pixel_val = img.get_value_as_double(level, x, y);
+      if (pixel_val == nodata_val)
+        pixel_val = std::numeric_limits<double>::quiet_NaN();
+      valsX.push_back(count * scale);
+      valsY.push_back(pixel_val);
+      count++;
+    }
+  }
+
+  return true;
+}
+
+int profile_level(DiskImagePyramidMultiChannel const& img, double length,
+                  double max_samples) {
+  int level = 0;
+  while (level + 1 < img.num_levels() && length / double(std::int64_t(1) << level) > max_samples)
+    level++;
+  return level;
+}
+
+std::string remote_image_path(std::string const& file) {
+  if (boost::starts_with(file, "http://") || boost::starts_with(file, "https://"))
+    return "/vsicurl/" + file;
+  if (boost::starts_with(file, "s3://"))
+    return "/vsis3/" + file.substr(std::string("s3://").size());
+  return file;
+}
+
+bool is_remote_image(std::string const& file) {
+  return (boost::starts_with(file, "/vsicurl/") || boost::starts_with(file, "/vsis3/"));
+}
+
+void configure_remote_reads(int cache_size_mb) {
+  if (cache_size_mb < 0)
+    vw_throw(ArgumentErr() << "The remote cache size must be non-negative.\n");
+
+  std::ostringstream os;
+  os << std::int64_t(cache_size_mb) * 1024 * 1024;
+  std::map<std::string, std::string> options;
+  options["CPL_VSIL_CURL_CACHE_SIZE"]            = os.str(); // blocks of all files
+  options["VSI_CACHE"]                           = "TRUE";
+  options["VSI_CACHE_SIZE"]                      = os.str(); // per file
+  options["GDAL_HTTP_MERGE_CONSECUTIVE_RANGES"]  = "YES";
+  options["GDAL_DISABLE_READDIR_ON_OPEN"]        = "EMPTY_DIR";
+  for (auto it = options.begin(); it != options.end(); it++) {
+    if (CPLGetConfigOption(it->first.c_str(), NULL) == NULL)
+      CPLSetConfigOption(it->first.c_str(), it->second.c_str());
   }
+}
 
-  double scale       = 0.0;
-  double blur_sigma  = std::numeric_limits<double>::quiet_NaN();
-  double nodata_val  = std::numeric_limits<double>::quiet_NaN();
-  vw::read_nodata_val(input_file, nodata_val);
-  std::ostringstream oss;
-  oss << "_hillshade_a" << azimuth << "_e" << elevation << ".tif"; 
-  std::string suffix = oss.str();
+double meters_per_pixel(vw::cartography::GeoReference const& georef,
+                        double cols, double rows) {
 
-  output_file = vw::mosaic::filename_from_suffix1(input_file, suffix);
-  bool align_light_to_georef = false;
+  // Measure the ground distance to the neighbors of the center pixel
+  vw::Vector2 pix(cols/2.0, rows/2.0);
+  vw::cartography::Datum const& datum = georef.datum();
+  double dist = 0.0;
   try {
-    DiskImageView<float> input(input_file);
-    // TODO(oalexan1): Factor out repeated logic below.
-    try {
-      bool will_write = vw::mosaic::overwrite_if_no_good(input_file, output_file,
-                                             input.cols(), input.rows());
-      if (will_write) {
-        vw_out() << "Writing: " << output_file << std::endl;
-        vw::cartography::do_multitype_hillshade(input_file, output_file, azimuth, elevation, scale,
-                                                nodata_val, blur_sigma, align_light_to_georef);
-      }
-    } catch(...) {
-      // Failed to write, presumably because we have no write access.
-      // Write the file in the current dir.
-      vw_out() << "Failed to write: " << output_file << "\n";
-      output_file = vw::mosaic::filename_from_suffix2(input_file, suffix);
-      bool will_write = vw::mosaic::overwrite_if_no_good(input_file, output_file,
-                                             input.cols(), input.rows());
-      if (will_write) {
-        vw_out() << "Writing: " << output_file << std::endl;
-        vw::cartography::do_multitype_hillshade(input_file,  output_file,
-                                                azimuth, elevation, scale,
-                                                nodata_val, blur_sigma,
-                                                align_light_to_georef);
-      }
+    vw::Vector2 lonlat = georef.pixel_to_lonlat(pix);
+    vw::Vector3 P = datum.geodetic_to_cartesian(vw::Vector3(lonlat[0], lonlat[1], 0.0));
+    for (int it = 0; it < 2; it++) {
+      vw::Vector2 nbr = pix;
+      nbr[it] += 1.0;
+      lonlat = georef.pixel_to_lonlat(nbr);
+      vw::Vector3 Q = datum.geodetic_to_cartesian(vw::Vector3(lonlat[0], lonlat[1], 0.0));
+      dist += norm_2(Q - P) / 2.0;
     }
-  } catch (const Exception& e) {
-    if (!have_gui) 
-      vw_out() << e.what() << "\n";
-    else
-      popUp(e.what());
-    return false;
+  } catch (...) {
+    return 1.0;
   }
-  
-  return true;
+
+  if (!(dist > 0.0) || std::isinf(dist))
+    return 1.0;
+
+  return dist;
 }
 
 // TODO(oalexan1): The 0.5 bias may be the wrong thing to do. Need to test
@@ -341,6 +404,159 @@ void findClosestPolyEdge(// inputs
   return;
 }
 
+std::size_t polyHash(std::vector<vw::geometry::dPoly> const& polyVec) {
+  std::size_t hash = 0;
+  for (size_t s = 0; s < polyVec.size(); s++) {
+    vw::geometry::dPoly const& poly = polyVec[s];
+    int numPolys = poly.get_numPolys();
+    int totalNumVerts = poly.get_totalNumVerts();
+    boost::hash_combine(hash, numPolys);
+    boost::hash_combine(hash, totalNumVerts);
+    boost::hash_range(hash, poly.get_numVerts(), poly.get_numVerts() + numPolys);
+    boost::hash_range(hash, poly.get_xv(), poly.get_xv() + totalNumVerts);
+    boost::hash_range(hash, poly.get_yv(), poly.get_yv() + totalNumVerts);
+  }
+  return hash;
+}
+
+void polyBoxes(vw::geometry::dPoly const& poly, std::vector<vw::BBox2> & boxes) {
+  const double * xv       = poly.get_xv();
+  const double * yv       = poly.get_yv();
+  const int    * numVerts = poly.get_numVerts();
+  int numPolys            = poly.get_numPolys();
+
+  boxes.resize(numPolys);
+  int start = 0;
+  for (int pIter = 0; pIter < numPolys; pIter++) {
+    if (pIter > 0) start += numVerts[pIter - 1];
+    boxes[pIter] = vw::BBox2();
+    for (int vIter = 0; vIter < numVerts[pIter]; vIter++)
+      boxes[pIter].grow(vw::Vector2(xv[start + vIter], yv[start + vIter]));
+  }
+}
+
+void polysInBox(vw::geometry::dPoly const& poly, std::vector<vw::BBox2> const& boxes,
+                vw::BBox2 const& box, vw::geometry::dPoly & out) {
+  const double * xv       = poly.get_xv();
+  const double * yv       = poly.get_yv();
+  const int    * numVerts = poly.get_numVerts();
+  int numPolys            = poly.get_numPolys();
+  const std::vector<char>        & isPolyClosed = poly.get_isPolyClosed();
+  const std::vector<std::string> & colors       = poly.get_colors();
+  const std::vector<std::string> & layers       = poly.get_layers();
+
+  if (int(boxes.size()) != numPolys)
+    vw_throw(ArgumentErr() << "Expecting one bounding box per polygon.\n");
+
+  out.reset();
+  int start = 0;
+  for (int pIter = 0; pIter < numPolys; pIter++) {
+    if (pIter > 0) start += numVerts[pIter - 1];
+
+    // Boxes of single points are empty, so compare the corners
+    vw::BBox2 const& B = boxes[pIter];
+    if (B.min().x() > box.max().x() || B.max().x() < box.min().x() ||
+        B.min().y() > box.max().y() || B.max().y() < box.min().y())
+      continue;
+
+    out.appendPolygon(numVerts[pIter], xv + start, yv + start,
+                      isPolyClosed[pIter], colors[pIter], layers[pIter]);
+  }
+}
+
+void simplifyPoly(vw::geometry::dPoly const& poly, double tol, vw::geometry::dPoly & out) {
+  const double * xv       = poly.get_xv();
+  const double * yv       = poly.get_yv();
+  const int    * numVerts = poly.get_numVerts();
+  int numPolys            = poly.get_numPolys();
+  const std::vector<char>        & isPolyClosed = poly.get_isPolyClosed();
+  const std::vector<std::string> & colors       = poly.get_colors();
+  const std::vector<std::string> & layers       = poly.get_layers();
+
+  out.reset();
+  int start = 0;
+  std::vector<char> keep;
+  std::vector<std::pair<int, int>> ranges;
+  std::vector<double> out_xv, out_yv;
+  for (int pIter = 0; pIter < numPolys; pIter++) {
+    if (pIter > 0) start += numVerts[pIter - 1];
+    int pSize = numVerts[pIter];
+    const double * x = xv + start;
+    const double * y = yv + start;
+    if (pSize <= 0) {
+      out.appendPolygon(0, x, y, isPolyClosed[pIter], colors[pIter], layers[pIter]);
+      continue;
+    }
+
+    keep.assign(pSize, 0);
+    keep[0] = 1;
+    keep[pSize - 1] = 1;
+    ranges.clear();
+    if (isPolyClosed[pIter] && pSize > 3) {
+      // Split a closed polygon at the vertex farthest from the first
+      // one, so it does not shrink to a segment
+      int far_index = 0;
+      double far_dist = -1.0;
+      for (int vIter = 1; vIter < pSize; vIter++) {
+        double d = (x[vIter] - x[0]) * (x[vIter] - x[0]) + (y[vIter] - y[0]) * (y[vIter] - y[0]);
+        if (d > far_dist) {
+          far_dist = d;
+          far_index = vIter;
+        }
+      }
+      keep[far_index] = 1;
+      ranges.push_back(std::make_pair(0, far_index));
+      ranges.push_back(std::make_pair(far_index, pSize - 1));
+    } else if (pSize > 2) {
+      ranges.push_back(std::make_pair(0, pSize - 1));
+    }
+
+    // Douglas-Peucker, with a stack rather than recursion, as the
+    // polygons can be very long
+    while (!ranges.empty()) {
+      int beg = ranges.back().first, end = ranges.back().second;
+      ranges.pop_back();
+      if (end - beg < 2)
+        continue;
+
+      double dx = x[end] - x[beg], dy = y[end] - y[beg];
+      double len = sqrt(dx * dx + dy * dy);
+      int max_index = -1;
+      double max_dist = tol;
+      for (int vIter = beg + 1; vIter < end; vIter++) {
+        double d;
+        if (len > 0.0)
+          d = std::abs(dy * (x[vIter] - x[beg]) - dx * (y[vIter] - y[beg])) / len;
+        else
+          d = sqrt((x[vIter] - x[beg]) * (x[vIter] - x[beg]) +
+                   (y[vIter] - y[beg]) * (y[vIter] - y[beg]));
+        if (d > max_dist) {
+          max_dist = d;
+          max_index = vIter;
+        }
+      }
+
+      if (max_index < 0)
+        continue; // all vertices in between are within tolerance
+
+      keep[max_index] = 1;
+      ranges.push_back(std::make_pair(beg, max_index));
+      ranges.push_back(std::make_pair(max_index, end));
+    }
+
+    out_xv.clear();
+    out_yv.clear();
+    for (int vIter = 0; vIter < pSize; vIter++) {
+      if (!keep[vIter])
+        continue;
+      out_xv.push_back(x[vIter]);
+      out_yv.push_back(y[vIter]);
+    }
+    out.appendPolygon(out_xv.size(), vw::geometry::vecPtr(out_xv), vw::geometry::vecPtr(out_yv),
+                      isPolyClosed[pIter], colors[pIter], layers[pIter]);
+  }
+}
+
 // Return true if the extension is .csv or .txt
 bool hasCsv(std::string const& fileName) {
   std::string ext = get_extension(fileName);
@@ -576,30 +792,126 @@ void imageData::read(std::string const& name_in, vw::GdalWriteOptions const& opt
     }
     
   }else{
-    // Read an image
+    // Read an image. With --lazy-load, read only its size and
+    // georeference, and make the pyramid when the image is in view.
     int top_image_max_pix = 1000*1000;
     int subsample = 4;
+    bool lazy = (asp::stereo_settings().lazy_load &&
+                 !asp::stereo_settings().create_image_pyramids_only);
     has_georef = vw::cartography::read_georeference(georef, name_in);
 
     if (display_mode == REGULAR_VIEW) {
-      img = DiskImagePyramidMultiChannel(name, m_opt, top_image_max_pix, subsample);
+      img = DiskImagePyramidMultiChannel(pyramid_cache_name(name), m_opt,
+                                         top_image_max_pix, subsample, lazy);
       image_bbox = BBox2(0, 0, img.cols(), img.rows());
     } else if (display_mode == HILLSHADED_VIEW) {
       hillshaded_img = DiskImagePyramidMultiChannel(hillshaded_name, m_opt,
-                                                    top_image_max_pix, subsample);
+                                                    top_image_max_pix, subsample, lazy);
       image_bbox = BBox2(0, 0, hillshaded_img.cols(), hillshaded_img.rows());
     } else if (display_mode == THRESHOLDED_VIEW) {
       thresholded_img = DiskImagePyramidMultiChannel(thresholded_name, m_opt,
-                                                     top_image_max_pix, subsample);
+                                                     top_image_max_pix, subsample, lazy);
       image_bbox = BBox2(0, 0, thresholded_img.cols(), thresholded_img.rows());
     } else if (display_mode == COLORIZED_VIEW) {
       colorized_img = DiskImagePyramidMultiChannel(colorized_name, m_opt,
-                                                     top_image_max_pix, subsample);
+                                                     top_image_max_pix, subsample, lazy);
       image_bbox = BBox2(0, 0, colorized_img.cols(), colorized_img.rows());
     }
   }
 }
 
+void imageData::unload() {
+  img.unload();
+  hillshaded_img.unload();
+  thresholded_img.unload();
+  colorized_img.unload();
+}
+
+std::string pyramid_cache_name(std::string const& image_file) {
+
+  // A remote image cannot be linked to. Its pyramid levels are built
+  // in the current directory.
+  std::string cache_dir = asp::stereo_settings().pyramid_cache_dir;
+  if (cache_dir == "" || is_remote_image(image_file))
+    return image_file;
+
+  try {
+    fs::path image_path = fs::canonical(image_file);
+    std::size_t key = 0;
+    boost::hash_combine(key, image_path.string());
+    boost::hash_combine(key, std::uintmax_t(fs::file_size(image_path)));
+    boost::hash_combine(key, std::int64_t(fs::last_write_time(image_path)));
+    std::ostringstream os;
+    os << std::hex << std::setw(16) << std::setfill('0') << key;
+
+    fs::path dir = fs::path(cache_dir) / os.str();
+    fs::create_directories(dir);
+    fs::path link = dir / image_path.filename();
+    if (!fs::is_symlink(link))
+      fs::create_symlink(image_path, link);
+    return link.string();
+  } catch (std::exception const& e) {
+    vw_out(WarningMessage) << "Cannot use the pyramid cache for " << image_file
+                           << ": " << e.what() << "\n";
+  }
+
+  return image_file;
+}
+
+namespace {
+
+  class ReadImageTask: public vw::Task, private boost::noncopyable {
+    std::string const& m_file;
+    vw::GdalWriteOptions const& m_opt;
+    std::map<std::string, std::string> const& m_properties;
+    imageData & m_image;
+    std::string & m_error;
+  public:
+    ReadImageTask(std::string const& file, vw::GdalWriteOptions const& opt,
+                  std::map<std::string, std::string> const& properties,
+                  imageData & image, std::string & error):
+      m_file(file), m_opt(opt), m_properties(properties), m_image(image), m_error(error) {}
+
+    void operator()() {
+      try {
+        m_image.read(m_file, m_opt, REGULAR_VIEW, m_properties);
+      } catch (std::exception const& e) {
+        m_error = e.what();
+      }
+    }
+  };
+
+}
+
+void read_images_in_parallel(std::vector<std::string> const& files,
+                             vw::GdalWriteOptions const& opt,
+                             std::vector<std::map<std::string, std::string>> const& properties,
+                             std::vector<imageData> & images) {
+
+  if (properties.size() != files.size())
+    vw_throw(ArgumentErr() << "Expecting as many sets of properties as files.\n");
+
+  images.resize(files.size());
+  std::vector<std::string> errors(files.size());
+
+  // Building a pyramid uses several threads already, so read only a
+  // few images at a time.
+  int num_threads = std::max(1, vw::vw_settings().default_num_threads() / 4);
+  num_threads = std::min(num_threads, std::max(int(files.size()), 1));
+  vw::FifoWorkQueue queue(num_threads);
+  for (size_t i = 0; i < files.size(); i++) {
+    boost::shared_ptr<vw::Task>
+      task(new ReadImageTask(files[i], opt, properties[i], images[i], errors[i]));
+    queue.add_task(task);
+  }
+  queue.join_all();
+
+  for (size_t i = 0; i < errors.size(); i++) {
+    if (errors[i] != "")
+      vw_throw(ArgumentErr() << errors[i]);
+  }
+}
+
 vw::Vector2 QPoint2Vec(QPoint const& qpt) {
   return vw::Vector2(qpt.x(), qpt.y());
 }
@@ -620,12 +932,84 @@ void PointList::push_back(std::list<vw::Vector2> pts) {
 //========================
 // Functions for MatchList
 
+void PointGrid::build(std::vector<vw::Vector2> const& points) {
+  m_points = points;
+  m_box = vw::BBox2();
+  for (size_t it = 0; it < points.size(); it++)
+    m_box.grow(points[it]);
+
+  m_cols = 0;
+  m_rows = 0;
+  m_cell_start.clear();
+  m_point_ids.clear();
+  if (points.empty())
+    return;
+
+  // About 4 points per cell, and not too many cells for degenerate boxes
+  double area = std::max(m_box.width() * m_box.height(), 1.0);
+  m_cell_size = std::max(sqrt(4.0 * area / points.size()), 1.0);
+  m_cols = std::min(int(m_box.width()  / m_cell_size) + 1, 4096);
+  m_rows = std::min(int(m_box.height() / m_cell_size) + 1, 4096);
+  m_cell_size = std::max(m_box.width()  / m_cols, m_box.height() / m_rows) * (1.0 + 1e-10);
+  if (m_cell_size <= 0.0)
+    m_cell_size = 1.0;
+
+  // Count the points in each cell, then store them in cell order
+  std::vector<size_t> cells(points.size());
+  m_cell_start.assign(size_t(m_cols) * m_rows + 1, 0);
+  for (size_t it = 0; it < points.size(); it++) {
+    int col = std::min(int((points[it].x() - m_box.min().x()) / m_cell_size), m_cols - 1);
+    int row = std::min(int((points[it].y() - m_box.min().y()) / m_cell_size), m_rows - 1);
+    cells[it] = size_t(row) * m_cols + col;
+    m_cell_start[cells[it] + 1]++;
+  }
+  for (size_t cell = 1; cell < m_cell_start.size(); cell++)
+    m_cell_start[cell] += m_cell_start[cell - 1];
+
+  std::vector<size_t> pos(m_cell_start.begin(), m_cell_start.end() - 1);
+  m_point_ids.resize(points.size());
+  for (size_t it = 0; it < points.size(); it++)
+    m_point_ids[pos[cells[it]]++] = it;
+}
+
+void PointGrid::query(vw::BBox2 const& box, std::vector<size_t> & indices) const {
+  if (m_points.empty() || box.empty())
+    return;
+
+  // Work with doubles, as the box can be huge
+  double min_col = floor((box.min().x() - m_box.min().x()) / m_cell_size);
+  double min_row = floor((box.min().y() - m_box.min().y()) / m_cell_size);
+  double max_col = floor((box.max().x() - m_box.min().x()) / m_cell_size);
+  double max_row = floor((box.max().y() - m_box.min().y()) / m_cell_size);
+  if (max_col < 0 || max_row < 0 || min_col >= m_cols || min_row >= m_rows)
+    return;
+  int beg_col = std::max(int(min_col), 0), end_col = std::min(int(max_col), m_cols - 1);
+  int beg_row = std::max(int(min_row), 0), end_row = std::min(int(max_row), m_rows - 1);
+
+  size_t start = indices.size();
+  for (int row = beg_row; row <= end_row; row++) {
+    for (int col = beg_col; col <= end_col; col++) {
+      size_t cell = size_t(row) * m_cols + col;
+      for (size_t it = m_cell_start[cell]; it < m_cell_start[cell + 1]; it++) {
+        vw::Vector2 const& P = m_points[m_point_ids[it]];
+        if (P.x() >= box.min().x() && P.x() <= box.max().x() &&
+            P.y() >= box.min().y() && P.y() <= box.max().y())
+          indices.push_back(m_point_ids[it]);
+      }
+    }
+  }
+
+  // Draw in the original order, so that later points are on top
+  std::sort(indices.begin() + start, indices.end());
+}
+
 void MatchList::throwIfNoPoint(size_t image, size_t point) const {
   if ((image >= m_matches.size()) || (point >= m_matches[image].size()))
     vw_throw(ArgumentErr() << "IP " << image << ", " << point << " does not exist!\n");
 }
 
 void MatchList::resize(size_t num_images) {
+  m_version++;
   m_matches.clear();
   m_valid_matches.clear();
   m_matches.resize(num_images);
@@ -661,6 +1045,7 @@ bool MatchList::addPoint(size_t image, vw::ip::InterestPoint const &pt, bool val
 
   m_matches[image].push_back(pt);
   m_valid_matches[image].push_back(true);
+  m_version++;
   return true;
 }
 
@@ -700,6 +1085,7 @@ void MatchList::setPointValid(size_t image, size_t point, bool newValue) {
 
 void MatchList::setPointPosition(size_t image, size_t point, float x, float y) {
   throwIfNoPoint(image, point);
+  m_version++;
   m_matches[image][point].x = x;
   m_matches[image][point].y = y;
 }
@@ -730,6 +1116,7 @@ void MatchList::deletePointsForImage(size_t image) {
 
   m_matches.erase      (m_matches.begin()       + image);
   m_valid_matches.erase(m_valid_matches.begin() + image);
+  m_version++;
 }
 
 bool MatchList::deletePointAcrossImages(size_t point) {
@@ -750,6 +1137,7 @@ bool MatchList::deletePointAcrossImages(size_t point) {
     m_matches[vec_iter].erase(m_matches[vec_iter].begin() + point);
     m_valid_matches[vec_iter].erase(m_valid_matches[vec_iter].begin() + point);
   }
+  m_version++;
   return true;
 }
 
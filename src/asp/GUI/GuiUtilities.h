@@ -59,6 +59,7 @@
 #include <vector>
 #include <list>
 #include <set>
+#include <functional>
 
 class QMouseEvent;
 class QWheelEvent;
@@ -139,10 +140,28 @@ namespace vw { namespace gui {
               std::map<std::string, std::string> const& properties =
               std::map<std::string, std::string>());
 
+    /// Close the pyramids of the image. They are opened again when needed.
+    void unload();
+
     bool isPoly() const { return asp::has_shp_extension(name); }
     bool isCsv()  const { return vw::gui::hasCsv(name); }
   };
 
+  /// The name under which to build the pyramid of an image. With
+  /// --pyramid-cache-dir, this is a link to the image in a directory of
+  /// that cache, so the pyramid is written there and found again the next
+  /// time the image is opened. The directory name is a hash of the path,
+  /// size, and modification time of the image, so an image which changed
+  /// gets a new pyramid. Otherwise, or on failure, return the image itself.
+  std::string pyramid_cache_name(std::string const& image_file);
+
+  /// Read the given files in parallel, as building the pyramids of many
+  /// large images takes most of the time before the GUI can be shown.
+  void read_images_in_parallel(std::vector<std::string> const& files,
+                               vw::GdalWriteOptions const& opt,
+                               std::vector<std::map<std::string, std::string>> const& properties,
+                               std::vector<imageData> & images);
+
   /// Convert a QRect object to a BBox2 object.
   inline BBox2 qrect2bbox(QRect const& R){
     return BBox2(Vector2(R.left(), R.top()), Vector2(R.right(), R.bottom()));
@@ -151,12 +170,39 @@ namespace vw { namespace gui {
   /// Convert a BBox2 object to a QRect object.
   QRect bbox2qrect(BBox2 const& B);
 
-  /// Save a hillshaded file
-  bool write_hillshade(vw::GdalWriteOptions const& opt,
-                       bool have_gui,
-                       double azimuth, double elevation,
-                       std::string const& input_file,
-                       std::string      & output_file);
+  /// Sample the image along a polygonal line with vertices in full
+  /// resolution pixels, from the given pyramid level. The samples
+  /// are 2^level pixels apart, and valsX has the distance along the line
+  /// in full resolution pixels. No-data values become NaN. Return false
+  /// if canceled, which is checked every so often.
+  bool sample_profile(DiskImagePyramidMultiChannel const& img,
+                      std::vector<vw::Vector2> const& vertices, int level,
+                      std::function<bool()> const& canceled,
+                      std::vector<double> & valsX, std::vector<double> & valsY);
+
+  /// The finest pyramid level at which a profile of this length, in
+  /// full resolution pixels, has at most this many samples
+  int profile_level(DiskImagePyramidMultiChannel const& img, double length,
+                    double max_samples);
+
+  /// Map an http://, https://, or s3:// URL to the GDAL virtual file
+  /// system path which reads it with range requests, such as
+  /// /vsicurl/https://host/image.tif. Other names are returned as they are.
+  std::string remote_image_path(std::string const& file);
+
+  /// Return true if the image is read over the network by GDAL
+  bool is_remote_image(std::string const& file);
+
+  /// Make GDAL cache in memory the blocks of remote images which were
+  /// read, and not probe for sidecar files. Options the user set in the
+  /// environment are kept.
+  void configure_remote_reads(int cache_size_mb);
+
+  /// The ground distance between adjacent pixels of a georeferenced
+  /// image, in meters, measured at its center. Used for hillshading.
+  /// Return 1 if it cannot be found.
+  double meters_per_pixel(vw::cartography::GeoReference const& georef,
+                          double cols, double rows);
 
   // Given an image, and an input file name, modify the filename using
   // a prefix. Write the image to that filename. If that fails, create
@@ -193,6 +239,21 @@ namespace vw { namespace gui {
 			   int & vertIndexInCurrPoly,
 			   double & minX, double & minY,
 			   double & minDist);
+
+  // A hash of the vertices of the polygons, to tell when they changed
+  std::size_t polyHash(std::vector<vw::geometry::dPoly> const& polyVec);
+
+  // The bounding box of each polygon
+  void polyBoxes(vw::geometry::dPoly const& poly, std::vector<vw::BBox2> & boxes);
+
+  // Keep the polygons whose bounding boxes intersect the given box
+  void polysInBox(vw::geometry::dPoly const& poly, std::vector<vw::BBox2> const& boxes,
+                  vw::BBox2 const& box, vw::geometry::dPoly & out);
+
+  // Simplify each polygon with the Douglas-Peucker algorithm, so that
+  // no vertex moves by more than the tolerance. Polygons are never
+  // removed, so their bounding boxes still apply.
+  void simplifyPoly(vw::geometry::dPoly const& poly, double tol, vw::geometry::dPoly & out);
   
   // This will tweak the georeference so that point_to_pixel() is the identity.
   bool read_georef_from_shapefile(vw::cartography::GeoReference & georef,
@@ -230,6 +291,28 @@ namespace vw { namespace gui {
     void push_back(std::list<vw::Vector2> pts);
   };
 
+  /// A uniform grid over a set of points, to quickly find those in a box,
+  /// such as the interest points in view when there are very many of them.
+  class PointGrid {
+  public:
+    PointGrid(): m_cell_size(1.0), m_cols(0), m_rows(0) {}
+
+    /// Make the grid. Cells are sized to hold a few points each on average.
+    void build(std::vector<vw::Vector2> const& points);
+
+    /// Append the indices of the points in the box, in increasing order.
+    void query(vw::BBox2 const& box, std::vector<size_t> & indices) const;
+
+    std::vector<vw::Vector2> const& points() const { return m_points; }
+
+  private:
+    vw::BBox2 m_box;
+    double m_cell_size;
+    int m_cols, m_rows;
+    std::vector<vw::Vector2> m_points;
+    std::vector<size_t> m_cell_start, m_point_ids; // the points of each cell
+  };
+
   /// Helper class to keep track of all the matching interest points
   /// - Each image must have the same number of interest points
   ///   but in some situations some of the points can be flagged as invalid.
@@ -302,6 +385,12 @@ namespace vw { namespace gui {
                           std::vector<std::string> const& imageNames,
                           std::string const& match_file="") const;
 
+    /// Changes each time points are added, moved, or removed, so that
+    /// anything made from them knows when to be made again.
+    size_t version() const { return m_version; }
+
+    MatchList(): m_version(0) {}
+
   private:
 
     /// Throw an exception if the specified point does not exist.
@@ -319,6 +408,8 @@ namespace vw { namespace gui {
     /// Stay synced with m_matches, set to false if that match is not 
     std::vector<std::vector<bool>> m_valid_matches;
 
+    size_t m_version;
+
   }; // End class MatchList
 
   // For each pairs if image indices, store the match file and interest points.
@@ -329,6 +420,11 @@ namespace vw { namespace gui {
 
     // We will copy here only the ip that need to be shown for the moment
     std::vector<std::vector<vw::ip::InterestPoint>> ip_to_show;
+
+    // Increment when ip_to_show changes
+    size_t version;
+
+    pairwiseMatchList(): version(0) {}
   };
 
 template<class PixelT>
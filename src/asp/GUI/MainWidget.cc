@@ -26,9 +26,12 @@
 #include <asp/GUI/chooseFilesDlg.h>
 #include <asp/Core/StereoSettings.h>
 
+#include <boost/noncopyable.hpp>
+
 #include <vw/Math/EulerAngles.h>
 #include <vw/Image/Algorithms.h>
 #include <vw/Core/RunOnce.h>
+#include <vw/Core/Settings.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
 #include <vw/Cartography/GeoTransform.h>
 #include <vw/Cartography/shapeFile.h>
@@ -40,6 +43,8 @@
 #include <QtGui>
 #include <QtWidgets>
 
+#include <iomanip>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -48,6 +53,36 @@ using namespace vw::cartography;
 
 namespace vw { namespace gui {
 
+  namespace {
+
+    // Sample a profile at a finer pyramid level than done right away.
+    // Give up if the profile changed meanwhile.
+    class ProfileTask: public vw::Task, private boost::noncopyable {
+      MainWidget & m_widget;
+      DiskImagePyramidMultiChannel m_img;
+      std::vector<Vector2> m_vertices;
+      int m_level, m_gen;
+    public:
+      ProfileTask(MainWidget & widget, DiskImagePyramidMultiChannel const& img,
+                  std::vector<Vector2> const& vertices, int level, int gen):
+        m_widget(widget), m_img(img), m_vertices(vertices), m_level(level), m_gen(gen) {}
+
+      void operator()() {
+        std::vector<double> valsX, valsY;
+        MainWidget & widget = m_widget;
+        int gen = m_gen;
+        auto canceled = [&widget, gen]() { return !widget.isCurrentProfile(gen); };
+        try {
+          if (sample_profile(m_img, m_vertices, m_level, canceled, valsX, valsY))
+            m_widget.setRefinedProfile(m_gen, valsX, valsY);
+        } catch (std::exception const& e) {
+          vw_out(WarningMessage) << "Could not sample the profile: " << e.what() << "\n";
+        }
+      }
+    };
+
+  }
+
   // --------------------------------------------------------------
   //               MainWidget Public Methods
   // --------------------------------------------------------------
@@ -253,6 +288,23 @@ namespace vw { namespace gui {
     m_profileMode     = false;
     m_profilePlot     = NULL;
     m_world_box       = BBox2();
+
+    // The tiles arrive in worker threads, so the redraw must be queued
+    // to happen in the GUI thread.
+    m_tileRefreshPending = false;
+    m_ipGridSource = -1;
+    m_ipGridVersion = 0;
+
+    // Profiles are refined in the background, one at a time
+    m_profileGen = 0;
+    m_refinedGen = -1;
+    m_profileQueue = boost::shared_ptr<vw::FifoWorkQueue>(new vw::FifoWorkQueue(1));
+    connect(this, SIGNAL(profileRefined()), this, SLOT(showRefinedProfile()),
+            Qt::QueuedConnection);
+    m_tileCache = boost::shared_ptr<TileCache>
+      (new TileCache(vw::vw_settings().default_num_threads()));
+    connect(m_tileCache.get(), SIGNAL(tileArrived()), this, SLOT(tileArrived()),
+            Qt::QueuedConnection);
     
     m_mousePrsX = 0;
     m_mousePrsY = 0;
@@ -414,6 +466,9 @@ namespace vw { namespace gui {
   } // End constructor
 
   MainWidget::~MainWidget() {
+    // Cancel refining the profile and wait for it
+    m_profileGen++;
+    m_profileQueue->join_all();
   }
 
   bool MainWidget::eventFilter(QObject *obj, QEvent *E){
@@ -720,19 +775,13 @@ void MainWidget::showFilesChosenByUser(int rowClicked, int columnClicked){
       return;
     }
 
-    // Create the thresholded images and save them to disk. We have to do it each
-    // time as perhaps the image threshold changed.
+    // The thresholded images are formed in memory when drawn, so
+    // changing the threshold only needs a redraw.
     for (int image_iter = m_beg_image_id; image_iter < m_end_image_id; image_iter++) {
-      std::string input_file = m_images[image_iter].name;
 
       if (m_images[image_iter].isPoly() || m_images[image_iter].isCsv())
         continue;
       
-      double nodata_val = -std::numeric_limits<double>::max();
-      vw::read_nodata_val(input_file, nodata_val);
-      // Do not use max(nodata_val, thresh) as sometimes nodata_val can be larger than data
-      nodata_val = m_thresh;
-
       int num_channels = m_images[image_iter].img.planes();
       
       if (num_channels != 1) {
@@ -742,24 +791,6 @@ void MainWidget::showFilesChosenByUser(int rowClicked, int columnClicked){
       }
 
       m_images[image_iter].m_display_mode = THRESHOLDED_VIEW;
-      
-      ImageViewRef<double> thresh_image
-        = apply_mask(create_mask_less_or_equal(DiskImageView<double>(input_file),
-                                               nodata_val), nodata_val);
-
-      // TODO(oalexan1): Need to do something like in write_hillshade()
-      // so that we don't have to always re-write the thresholded image.
-      std::string suffix = "_thresh.tif";
-      bool has_nodata = true;
-      std::string thresholded_file
-        = write_in_orig_or_curr_dir(m_opt,
-                                    thresh_image, input_file, suffix,
-                                    m_images[image_iter].has_georef, m_images[image_iter].georef,
-                                    has_nodata, nodata_val);
-
-      // Read it back right away
-      m_images[image_iter].read(thresholded_file, m_opt, THRESHOLDED_VIEW);
-      temporary_files().files.insert(thresholded_file);
     }
 
     // We may not want to refresh the pixmap right away if we are going to
@@ -772,8 +803,8 @@ void MainWidget::showFilesChosenByUser(int rowClicked, int columnClicked){
 
     int num_images = m_images.size();
 
-    // Create the hillshaded images and save them to disk. We have to do
-    // it each time as perhaps the hillshade parameters changed.
+    // Check which images can be hillshaded. That is done in memory when
+    // they are drawn, so changing the hillshade parameters only needs a redraw.
     for (int image_iter = m_beg_image_id; image_iter < m_end_image_id; image_iter++) {
 
       if (m_images[image_iter].m_display_mode != HILLSHADED_VIEW)
@@ -796,7 +827,6 @@ void MainWidget::showFilesChosenByUser(int rowClicked, int columnClicked){
         return;
       }
 
-      std::string input_file = m_images[image_iter].name;
       int num_channels = m_images[image_iter].img.planes();
       if (num_channels != 1) {
         // Turn off hillshade mode for all images which don't support it,
@@ -814,24 +844,6 @@ void MainWidget::showFilesChosenByUser(int rowClicked, int columnClicked){
         popUp("Hill-shading makes sense only for single-channel images.");
         continue;
       }
-
-      // Save the hillshaded images to disk (unless it already exists)
-      std::string hillshaded_file;
-      bool have_gui = true;
-      bool success = write_hillshade(m_opt,
-                                     have_gui,
-                                     m_hillshade_azimuth,
-                                     m_hillshade_elevation,
-                                     input_file, hillshaded_file);
-
-      if (!success) {
-        m_images[image_iter].m_display_mode = REGULAR_VIEW;
-        return;
-      }
-
-      vw_out() << "Reading: " << hillshaded_file << std::endl;
-      m_images[image_iter].read(hillshaded_file, m_opt, HILLSHADED_VIEW);
-      temporary_files().files.insert(hillshaded_file);
     }
   }
 
@@ -1092,6 +1104,14 @@ void MainWidget::showFilesChosenByUser(int rowClicked, int columnClicked){
     Stopwatch sw1;
     sw1.start();
 
+    // Tiles requested for earlier views and not needed for this one
+    // will not be read
+    m_tileCache->begin_view();
+
+    std::set<int> in_view; // the images with open pyramids in this view
+    std::set<int> levels; // the pyramid levels used, for --render-stats
+    double load_seconds = 0.0; // opening or building pyramids
+
     // Loop through input images
     // - These images get drawn in the same
     for (int j = m_beg_image_id; j < m_end_image_id; j++) {
@@ -1102,7 +1122,7 @@ void MainWidget::showFilesChosenByUser(int rowClicked, int columnClicked){
       int i = m_filesOrder[j]; // image index
 
       // Don't show files the user wants hidden
-      if (m_chooseFiles && m_chooseFiles->isHidden(m_images[i].name))
+      if (m_hiddenImages.find(i) != m_hiddenImages.end())
         continue;
 
       // The portion of the image in the current view. 
@@ -1165,21 +1185,43 @@ void MainWidget::showFilesChosenByUser(int rowClicked, int columnClicked){
       //Stopwatch sw3;
       //sw3.start();
       
+      // Hillshading and thresholding are done by the tile cache, from
+      // the pixels of the original image
+      RenderOptions render;
       if (m_images[i].m_display_mode == THRESHOLDED_VIEW) {
-        m_images[i].thresholded_img.get_image_clip(scale, image_box,
-                                                   highlight_nodata,
-                                                   qimg, scale_out, region_out);
-      }else if (m_images[i].m_display_mode == HILLSHADED_VIEW){
-        m_images[i].hillshaded_img.get_image_clip(scale, image_box,
-                                                  highlight_nodata,
-                                                  qimg, scale_out, region_out);
-      }else{
-        // Original images
-        m_images[i].img.get_image_clip(scale, image_box,
-                                       highlight_nodata,
-                                       qimg, scale_out, region_out);
+        render.mode = RenderOptions::THRESHOLD;
+        render.threshold = m_thresh;
+      } else if (m_images[i].m_display_mode == HILLSHADED_VIEW) {
+        render.mode = RenderOptions::HILLSHADE;
+        render.azimuth = m_hillshade_azimuth;
+        render.elevation = m_hillshade_elevation;
+        render.meters_per_pixel = meters_per_pixel(m_images[i].georef,
+                                                   m_images[i].img.cols(),
+                                                   m_images[i].img.rows());
+      }
+      DiskImagePyramidMultiChannel const* pyramid = &m_images[i].img;
+
+      // With --lazy-load, this opens the pyramid the first time the
+      // image is in view
+      Stopwatch sw_load;
+      sw_load.start();
+      pyramid->load();
+      sw_load.stop();
+      load_seconds += sw_load.elapsed_seconds();
+      if (!pyramid->loaded())
+        continue;
+      if (asp::stereo_settings().lazy_load) {
+        m_openImages.remove(i);
+        m_openImages.push_front(i);
+        in_view.insert(i);
       }
 
+      // Use the tiles read so far. The missing ones are read in the
+      // background, and the view is redrawn when they arrive.
+      m_tileCache->get_image_clip(*pyramid, render, scale, image_box, highlight_nodata,
+                                  qimg, scale_out, region_out);
+      levels.insert(int(round(log2(scale_out))));
+
       //sw3.stop();
       //vw_out() << "Render time 3 (seconds): " << sw3.elapsed_seconds() << std::endl;
 
@@ -1274,8 +1316,33 @@ void MainWidget::showFilesChosenByUser(int rowClicked, int columnClicked){
 
     } // End loop through input images
 
+    // Close the pyramids of the images which were in view least
+    // recently, to not run out of memory and file descriptors
+    while (int(m_openImages.size()) > asp::stereo_settings().max_open_images &&
+           in_view.find(m_openImages.back()) == in_view.end()) {
+      m_images[m_openImages.back()].unload();
+      m_openImages.pop_back();
+    }
+
     sw1.stop();
     //vw_out() << "Render time (seconds): " << sw1.elapsed_seconds() << std::endl;
+
+    if (asp::stereo_settings().render_stats) {
+      TileCache::Stats stats = m_tileCache->take_stats();
+      std::ostringstream os;
+      os << std::fixed << std::setprecision(3)
+         << "Render: " << sw1.elapsed_seconds() << " s"
+         << " (pyramids: " << load_seconds << " s, tiles in this thread: "
+         << stats.gui_read_seconds << " s), levels:";
+      for (auto it = levels.begin(); it != levels.end(); it++)
+        os << " " << *it;
+      os << ", tiles: " << stats.hits << " cached, " << stats.misses << " missing"
+         << ", since last redraw: " << stats.tiles_formed << " tiles, "
+         << stats.bytes_read / (1024.0 * 1024.0) << " MB, "
+         << stats.read_seconds << " s reading"
+         << ", queued: " << stats.queue_depth << "\n";
+      vw_out() << os.str();
+    }
     
     return;
   } // End function drawImage()
@@ -1309,33 +1376,74 @@ void MainWidget::showFilesChosenByUser(int rowClicked, int columnClicked){
         = (m_matchlist.getNumPoints(m_beg_image_id) > m_matchlist.getNumPoints(lastImage));
     }
 
-    std::vector<Vector2> ip_vec;
+    // The points to show. Put them on a grid if they changed.
+    int source = -1;
+    size_t version = 0;
+    std::vector<vw::ip::InterestPoint> const* ip_in_vec = NULL;
     if (asp::stereo_settings().view_matches) {
-      for (size_t ip_iter = 0; ip_iter < m_matchlist.getNumPoints(m_beg_image_id); ip_iter++) {
-        // Generate the pixel coord of the point
-        Vector2 pt = m_matchlist.getPointCoord(m_beg_image_id, ip_iter);
-        ip_vec.push_back(pt);
-      }
+      source = 0;
+      version = m_matchlist.version();
     } else if (asp::stereo_settings().pairwise_matches &&
                m_beg_image_id < m_pairwiseMatches.ip_to_show.size()) {
       // Had to check if ip_to_show was initialized by now
-      auto & ip_in_vec = m_pairwiseMatches.ip_to_show[m_beg_image_id]; // alias
-      for (size_t ip_iter = 0; ip_iter < ip_in_vec.size(); ip_iter++) {
-        ip_vec.push_back(Vector2(ip_in_vec[ip_iter].x, ip_in_vec[ip_iter].y));
-      }
+      source = 1;
+      version = m_pairwiseMatches.version;
+      ip_in_vec = &m_pairwiseMatches.ip_to_show[m_beg_image_id];
     } else if (asp::stereo_settings().pairwise_clean_matches &&
                m_beg_image_id < m_pairwiseCleanMatches.ip_to_show.size()) {
-      // Had to check if ip_to_show was initialized by now
-      auto & ip_in_vec = m_pairwiseCleanMatches.ip_to_show[m_beg_image_id]; // alias
-      for (size_t ip_iter = 0; ip_iter < ip_in_vec.size(); ip_iter++) {
-        ip_vec.push_back(Vector2(ip_in_vec[ip_iter].x, ip_in_vec[ip_iter].y));
+      source = 2;
+      version = m_pairwiseCleanMatches.version;
+      ip_in_vec = &m_pairwiseCleanMatches.ip_to_show[m_beg_image_id];
+    }
+    if (source < 0)
+      return;
+
+    if (source != m_ipGridSource || version != m_ipGridVersion) {
+      std::vector<Vector2> ip_vec;
+      if (source == 0) {
+        for (size_t ip_iter = 0; ip_iter < m_matchlist.getNumPoints(m_beg_image_id); ip_iter++)
+          ip_vec.push_back(m_matchlist.getPointCoord(m_beg_image_id, ip_iter));
+      } else {
+        for (size_t ip_iter = 0; ip_iter < ip_in_vec->size(); ip_iter++)
+          ip_vec.push_back(Vector2((*ip_in_vec)[ip_iter].x, (*ip_in_vec)[ip_iter].y));
       }
+      m_ipGrid.build(ip_vec);
+      m_ipGridSource = source;
+      m_ipGridVersion = version;
     }
 
-    // Iterate over interest points
-    for (size_t ip_iter = 0; ip_iter < ip_vec.size(); ip_iter++) {
+    // Find the points in view. The pixel box of the view may be
+    // approximate for georeferenced images, so grow it a little.
+    // Each point is checked exactly below.
+    std::vector<size_t> ip_ids;
+    BBox2 view_box;
+    try {
+      view_box = MainWidget::world2image(screen2world(BBox2(0, 0, m_window_width,
+                                                            m_window_height)),
+                                         m_base_image_id);
+    } catch (...) {
+      view_box = BBox2();
+    }
+    if (view_box.empty()) {
+      for (size_t it = 0; it < m_ipGrid.points().size(); it++)
+        ip_ids.push_back(it);
+    } else {
+      view_box.expand(0.05 * std::max(view_box.width(), view_box.height()) + 1.0);
+      m_ipGrid.query(view_box, ip_ids);
+    }
+
+    // When zoomed out, many points land on the same few screen pixels.
+    // Draw only one point of each color per small screen cell, and
+    // add all of them to a path per color, which is drawn at once. Points
+    // being added or edited are always drawn.
+    int cell = 2;
+    int cell_cols = m_window_width / cell + 1, cell_rows = m_window_height / cell + 1;
+    std::vector<char> occupied(size_t(cell_cols) * cell_rows, 0);
+    QPainterPath valid_path, invalid_path, add_path, move_path;
+    for (size_t it = 0; it < ip_ids.size(); it++) {
+      size_t ip_iter = ip_ids[it];
       // Generate the pixel coord of the point
-      Vector2 pt    = ip_vec[ip_iter];
+      Vector2 pt    = m_ipGrid.points()[ip_iter];
       Vector2 world = MainWidget::image2world(pt, m_base_image_id);
       Vector2 P     = world2screen(world);
 
@@ -1344,25 +1452,43 @@ void MainWidget::showFilesChosenByUser(int rowClicked, int columnClicked){
           P.y() < 0 || P.y() > m_window_height) {
         continue;
       }
-      
-      paint->setPen(ipColor); // The default IP color
 
-      if (asp::stereo_settings().view_matches) {
-        if (!m_matchlist.isPointValid(m_beg_image_id, ip_iter))
-          paint->setPen(ipInvalidColor);
+      QPoint Q(P.x(), P.y());
+      QPainterPath * path = &valid_path; // the default IP color
+      char flag = 1;
+      if (source == 0) {
+        if (!m_matchlist.isPointValid(m_beg_image_id, ip_iter)) {
+          path = &invalid_path;
+          flag = 2;
+        }
 
         // Highlighting the last point
-        if (highlight_last && (ip_iter == m_matchlist.getNumPoints(m_beg_image_id)-1)) 
-          paint->setPen(ipAddHighlightColor);
-        
-        if (static_cast<int>(ip_iter) == m_editMatchPointVecIndex)
-          paint->setPen(ipMoveHighlightColor);
+        if (highlight_last && (ip_iter == m_matchlist.getNumPoints(m_beg_image_id)-1)) {
+          add_path.addEllipse(Q, 2, 2);
+          continue;
+        }
+        if (static_cast<int>(ip_iter) == m_editMatchPointVecIndex) {
+          move_path.addEllipse(Q, 2, 2);
+          continue;
+        }
       }
-      
-      QPoint Q(P.x(), P.y());
-      paint->drawEllipse(Q, 2, 2); // Draw the point
+
+      char & cell_flags = occupied[size_t(Q.y() / cell) * cell_cols + Q.x() / cell];
+      if (cell_flags & flag)
+        continue; // a point of this color is already drawn here
+      cell_flags |= flag;
+      path->addEllipse(Q, 2, 2); // Draw the point
 
     } // End loop through points
+
+    paint->setPen(ipColor);
+    paint->drawPath(valid_path);
+    paint->setPen(ipInvalidColor);
+    paint->drawPath(invalid_path);
+    paint->setPen(ipAddHighlightColor);
+    paint->drawPath(add_path);
+    paint->setPen(ipMoveHighlightColor);
+    paint->drawPath(move_path);
   } // End function drawInterestPoints
   
   // Draw irregular xyz data to be plotted at (x, y) location with z giving
@@ -1453,12 +1579,18 @@ void MainWidget::showFilesChosenByUser(int rowClicked, int columnClicked){
   }
 
   void MainWidget::zoomToRegion(vw::BBox2 const& region){
+    if (!setView(region))
+      return;
+    refreshPixmap();
+  }
+
+  bool MainWidget::setView(vw::BBox2 const& region){
     if (region.empty()) {
       popUp("Cannot zoom to empty region.");
-      return;
+      return false;
     }
     m_current_view = expand_box_to_keep_aspect_ratio(region);
-    refreshPixmap();
+    return true;
   }
 
   // --------------------------------------------------------------
@@ -1485,11 +1617,33 @@ void MainWidget::showFilesChosenByUser(int rowClicked, int columnClicked){
       return;
     }
 
-    m_pixmap = QPixmap(size());
-    m_pixmap.fill(m_backgroundColor);
+    QImage image;
+    prepareView();
+    renderView(image);
+    showView(image);
+
+    return;
+  }
+
+  void MainWidget::prepareView() {
+    m_viewSize = size();
+    m_viewPen  = QPen(palette().color(foregroundRole()));
+    m_viewFont = font();
+
+    m_hiddenImages.clear();
+    for (int j = m_beg_image_id; j < m_end_image_id; j++) {
+      if (m_chooseFiles && m_chooseFiles->isHidden(m_images[j].name))
+        m_hiddenImages.insert(j);
+    }
+  }
+
+  void MainWidget::renderView(QImage & image) {
+    image = QImage(m_viewSize, QImage::Format_ARGB32_Premultiplied);
+    image.fill(m_backgroundColor);
 
-    QPainter paint(&m_pixmap);
-    paint.initFrom(this);
+    QPainter paint(&image);
+    paint.setPen(m_viewPen);
+    paint.setFont(m_viewFont);
 
     MainWidget::drawImage(&paint);
 
@@ -1498,11 +1652,32 @@ void MainWidget::showFilesChosenByUser(int rowClicked, int columnClicked){
     if (asp::stereo_settings().pairwise_matches ||
         asp::stereo_settings().pairwise_clean_matches)
       drawInterestPoints(&paint);
+  }
+
+  void MainWidget::showView(QImage const& image) {
+    m_pixmap = QPixmap::fromImage(image);
 
     // Invokes MainWidget::PaintEvent().
     update();
+  }
 
-    return;
+  // Many tiles may arrive in quick succession, so wait a little and
+  // redraw once for all of them.
+  void MainWidget::tileArrived() {
+    if (m_tileRefreshPending)
+      return;
+    m_tileRefreshPending = true;
+    QTimer::singleShot(50, this, SLOT(refreshFromTiles()));
+  }
+
+  void MainWidget::refreshFromTiles() {
+    m_tileRefreshPending = false;
+
+    // This is not a change of view, so the other widgets need not follow
+    bool can_emit = m_can_emit_zoom_all_signal;
+    m_can_emit_zoom_all_signal = false;
+    refreshPixmap();
+    m_can_emit_zoom_all_signal = can_emit;
   }
 
   void MainWidget::paintEvent(QPaintEvent * /* event */) {
@@ -1597,11 +1772,14 @@ void MainWidget::showFilesChosenByUser(int rowClicked, int columnClicked){
       }
 
       // Let polyVec be the polygons for the current image, or,
-      // at the end, the polygon we are in the middle of drawing
-      // TODO(oalexan1): How to avoid a deep copy?
+      // at the end, the polygon we are in the middle of drawing.
+      // Those of the image are already in world coordinates.
       std::vector<vw::geometry::dPoly> polyVec;
       if (!currDrawnPoly) {
-        polyVec = m_images[image_it].polyVec; // deep copy
+        // Vertices which are shown must all be there
+        bool fullRes = (m_showIndices->isChecked() ||
+                        (m_polyEditMode && m_moveVertex->isChecked()));
+        worldPolysInView(image_it, fullRes, polyVec);
       } else {
           if (m_currPolyX.empty() || !m_polyEditMode)
             continue;
@@ -1630,19 +1808,21 @@ void MainWidget::showFilesChosenByUser(int rowClicked, int columnClicked){
       // Plot the polygon being drawn now, and pre-existing polygons
       for (size_t polyIter = 0; polyIter < polyVec.size(); polyIter++){
       
-        vw::geometry::dPoly poly = polyVec[polyIter]; // make a deep copy
+        vw::geometry::dPoly & poly = polyVec[polyIter]; // alias
 
         // Convert to world units
-        int            numVerts  = poly.get_totalNumVerts();
-        double *             xv  = poly.get_xv();
-        double *             yv  = poly.get_yv();
-        for (int vIter = 0; vIter < numVerts; vIter++){
+        if (currDrawnPoly) {
+          int            numVerts  = poly.get_totalNumVerts();
+          double *             xv  = poly.get_xv();
+          double *             yv  = poly.get_yv();
+          for (int vIter = 0; vIter < numVerts; vIter++){
 
-          Vector2 P;
-          P = projpoint2world(Vector2(xv[vIter], yv[vIter]), image_it);
+            Vector2 P;
+            P = projpoint2world(Vector2(xv[vIter], yv[vIter]), image_it);
 
-          xv[vIter] = P.x();
-          yv[vIter] = P.y();
+            xv[vIter] = P.x();
+            yv[vIter] = P.y();
+          }
         }
 
         if (m_polyEditMode && m_moveVertex->isChecked()) {
@@ -1700,53 +1880,67 @@ void MainWidget::showFilesChosenByUser(int rowClicked, int columnClicked){
       m_profilePlot = new ProfilePlotter(this);
 
     int imgInd = m_beg_image_id; // just one image is present
-    double nodata_val = images[imgInd].img.get_nodata_val();
-    
-    m_valsX.clear(); m_valsY.clear();
-    int count = 0;
-    
-    int num_pts = profileX.size();
-    for (int pt_iter = 0; pt_iter < num_pts; pt_iter++) {
-
-      // Nothing to do if we are at the last point, unless
-      // there is only one point.
-      if (num_pts > 1 && pt_iter == num_pts - 1) continue;
-	
-      Vector2 begP = MainWidget::world2image(Vector2(profileX[pt_iter], profileY[pt_iter]),
-                                             imgInd);
-
-      Vector2 endP;
-      if (num_pts == 1)
-        endP = begP; // only one point is present
-      else
-        endP = MainWidget::world2image(Vector2(profileX[pt_iter+1], profileY[pt_iter+1]), imgInd);
-      
-      int begX = begP.x(),   begY = begP.y();
-      int endX = endP.x(),   endY = endP.y();
-      int seg_len = std::abs(begX - endX) + std::abs(begY - endY);
-      if (seg_len == 0) seg_len = 1; // ensure it is never empty
-      for (int p = 0; p <= seg_len; p++) {
-        double t = double(p)/seg_len;
-        int x = round( begX + t*(endX - begX) );
-        int y = round( begY + t*(endY - begY) );
-        bool is_in = (x >= 0 && x <= images[imgInd].img.cols()-1 &&
-                      y >= 0 && y <= images[imgInd].img.rows()-1 );
-        if (!is_in)
-          continue;
-
-        double pixel_val = images[imgInd].img.get_value_as_double(x, y);
-
-        // TODO: Deal with this NAN
-        if (pixel_val == nodata_val)
-          pixel_val = std::numeric_limits<double>::quiet_NaN();
-        m_valsX.push_back(count);
-        m_valsY.push_back(pixel_val);
-        count++;
-      }
+    DiskImagePyramidMultiChannel const& img = images[imgInd].img; // alias
+
+    // The vertices in image pixels, and the length of the line
+    std::vector<Vector2> vertices;
+    double length = 0.0;
+    for (size_t pt_iter = 0; pt_iter < profileX.size(); pt_iter++) {
+      vertices.push_back(MainWidget::world2image(Vector2(profileX[pt_iter],
+                                                         profileY[pt_iter]), imgInd));
+      if (pt_iter > 0)
+        length += std::abs(vertices[pt_iter].x() - vertices[pt_iter - 1].x()) +
+          std::abs(vertices[pt_iter].y() - vertices[pt_iter - 1].y());
+    }
+
+    // Any refinement of an earlier profile is no longer wanted
+    int gen = ++m_profileGen;
+
+    // Sample right away from a pyramid level coarse enough to be fast,
+    // and from a finer one in the background, if needed
+    int coarse_level = profile_level(img, length, 2000);
+    int fine_level   = profile_level(img, length, 100000);
+    auto never_canceled = []() { return false; };
+    sample_profile(img, vertices, coarse_level, never_canceled, m_valsX, m_valsY);
+    showProfile(profileX.size() == 1);
+
+    if (fine_level < coarse_level) {
+      boost::shared_ptr<vw::Task>
+        task(new ProfileTask(*this, img, vertices, fine_level, gen));
+      m_profileQueue->add_task(task);
+    }
+  }
+
+  void MainWidget::setRefinedProfile(int gen, std::vector<double> const& valsX,
+                                     std::vector<double> const& valsY) {
+    {
+      vw::Mutex::Lock lock(m_profileMutex);
+      if (gen != m_profileGen)
+        return;
+      m_refinedGen = gen;
+      m_refinedX = valsX;
+      m_refinedY = valsY;
+    }
+    emit profileRefined(); // received in the GUI thread
+  }
 
+  void MainWidget::showRefinedProfile() {
+    bool singlePoint = false;
+    {
+      vw::Mutex::Lock lock(m_profileMutex);
+      if (m_refinedGen != m_profileGen || m_profilePlot == NULL)
+        return; // the profile changed meanwhile
+      m_valsX.swap(m_refinedX);
+      m_valsY.swap(m_refinedY);
+      m_refinedGen = -1;
+      singlePoint = (m_profileX.size() == 1);
     }
+    showProfile(singlePoint);
+  }
 
-    if (num_pts == 1) {
+  void MainWidget::showProfile(bool singlePoint) {
+
+    if (singlePoint) {
       // Just one point, really
       m_valsX.resize(1);
       m_valsY.resize(1);
@@ -1776,7 +1970,7 @@ void MainWidget::showFilesChosenByUser(int rowClicked, int columnClicked){
       }
 
       // Plot a point as a fat dot
-      if (num_pts == 1)  {
+      if (singlePoint)  {
         curve->setStyle(QwtPlotCurve::Dots);
       }
       
@@ -1803,6 +1997,7 @@ void MainWidget::showFilesChosenByUser(int rowClicked, int columnClicked){
       // Clean up any profiling related info
       m_profileX.clear();
       m_profileY.clear();
+      m_profileGen++; // cancel refining it
 
       // Close the window. 
       if (m_profilePlot != NULL) {
@@ -2488,6 +2683,71 @@ void MainWidget::showFilesChosenByUser(int rowClicked, int columnClicked){
     return;
   }
   
+  void MainWidget::worldPolysInView(int image_it, bool fullRes,
+                                    std::vector<vw::geometry::dPoly> & polyVec) {
+
+    polyVec.clear();
+    std::vector<vw::geometry::dPoly> const& imagePolys = m_images[image_it].polyVec; // alias
+
+    // Convert to world units, if not done yet for these polygons
+    std::size_t hash = polyHash(imagePolys);
+    auto it = m_worldPolys.find(image_it);
+    if (it == m_worldPolys.end() || it->second.hash != hash) {
+      WorldPolys & world = m_worldPolys[image_it];
+      world.hash = hash;
+      world.polys = imagePolys; // deep copy
+      world.simplified.clear();
+      world.boxes.resize(world.polys.size());
+      vw::BBox2 all;
+      for (size_t polyIter = 0; polyIter < world.polys.size(); polyIter++) {
+        vw::geometry::dPoly & poly = world.polys[polyIter]; // alias
+        int      numVerts = poly.get_totalNumVerts();
+        double * xv       = poly.get_xv();
+        double * yv       = poly.get_yv();
+        for (int vIter = 0; vIter < numVerts; vIter++){
+          Vector2 P = projpoint2world(Vector2(xv[vIter], yv[vIter]), image_it);
+          xv[vIter] = P.x();
+          yv[vIter] = P.y();
+          all.grow(P);
+        }
+        polyBoxes(poly, world.boxes[polyIter]);
+      }
+
+      // Fine enough that level 0 is never needed in practice
+      world.unit = std::max(all.width(), all.height()) * 1.0e-7;
+      it = m_worldPolys.find(image_it);
+    }
+    WorldPolys & world = it->second; // alias
+
+    // Skip polygons out of view, with a margin for thick lines
+    double pixelSize = std::max(m_current_view.width()/m_window_width,
+                                m_current_view.height()/m_window_height);
+    BBox2 view = screen2world(BBox2(0, 0, m_window_width, m_window_height));
+    view.expand(4 * pixelSize * std::max(m_lineWidth, 1));
+
+    // Simplify polygons by at most half a pixel on screen
+    std::vector<vw::geometry::dPoly> const* polys = &world.polys;
+    if (!fullRes && world.unit > 0.0 && pixelSize > 0.0) {
+      int level = int(floor(log2(0.5 * pixelSize / world.unit)));
+      if (level >= 0) {
+        auto level_it = world.simplified.find(level);
+        if (level_it == world.simplified.end()) {
+          std::vector<vw::geometry::dPoly> & simplified = world.simplified[level]; // alias
+          simplified.resize(world.polys.size());
+          double tol = world.unit * pow(2.0, level);
+          for (size_t polyIter = 0; polyIter < world.polys.size(); polyIter++)
+            simplifyPoly(world.polys[polyIter], tol, simplified[polyIter]);
+          level_it = world.simplified.find(level);
+        }
+        polys = &level_it->second;
+      }
+    }
+
+    polyVec.resize(polys->size());
+    for (size_t polyIter = 0; polyIter < polys->size(); polyIter++)
+      polysInBox((*polys)[polyIter], world.boxes[polyIter], view, polyVec[polyIter]);
+  }
+
   void MainWidget::plotDPoly(bool plotPoints, bool plotEdges,
                              bool plotFilled, bool showIndices,
                              int lineWidth,
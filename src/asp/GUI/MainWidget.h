@@ -26,7 +26,9 @@
 #include <string>
 #include <vector>
 #include <list>
+#include <map>
 #include <set>
+#include <atomic>
 
 #include <boost/filesystem/path.hpp>
 #include <boost/filesystem.hpp>
@@ -36,6 +38,9 @@
 // Qt
 #include <QWidget>
 #include <QPoint>
+#include <QImage>
+#include <QPen>
+#include <QFont>
 
 // Qwt
 #include <qwt_plot.h>
@@ -46,6 +51,7 @@
 
 // Vision Workbench
 #include <vw/Core/Thread.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Core/Log.h>
 #include <vw/Image/ImageResource.h>
 #include <vw/Image/ImageViewRef.h>
@@ -63,6 +69,7 @@
 // ASP
 #include <asp/Core/Common.h>
 #include <asp/GUI/GuiUtilities.h>
+#include <asp/GUI/TileCache.h>
 
 class QMouseEvent;
 class QWheelEvent;
@@ -148,6 +155,27 @@ namespace vw { namespace gui {
     void  setZoomAllToSameRegion(bool zoom_all_to_same_region);
     vw::BBox2 current_view();
     void  zoomToRegion (vw::BBox2 const& region);
+
+    /// If the profile with this generation is still the one shown
+    bool isCurrentProfile(int gen) const { return gen == m_profileGen; }
+
+    /// Pass the profile sampled in the background, to be shown if
+    /// still current. Can be called from any thread.
+    void setRefinedProfile(int gen, std::vector<double> const& valsX,
+                           std::vector<double> const& valsY);
+
+    /// Set the view to the region, without drawing it. Return false if
+    /// the region is empty.
+    bool setView(vw::BBox2 const& region);
+
+    /// Drawing the view is done in three steps, so that several widgets
+    /// can draw at the same time. First read from the widgets what is
+    /// needed, in the GUI thread. Then draw the view into an image, which
+    /// can be done in any thread, as long as no two threads draw the
+    /// same widget. Last, show the image, in the GUI thread.
+    void prepareView();
+    void renderView(QImage & image);
+    void showView(QImage const& image);
     void  setHillshadeMode(bool hillshade_mode);
     BBox2 firstImagePixelBox() const;
     BBox2 firstImageWorldBox(vw::BBox2 const& image_box) const;
@@ -164,6 +192,7 @@ signals:
     void uncheckProfileModeCheckbox ();
     void uncheckPolyEditModeCheckbox();
     void zoomAllToSameRegionSignal  (int);
+    void profileRefined             (); // emitted from a worker thread
 
 public slots:
     void sizeToFit();
@@ -200,6 +229,9 @@ public slots:
     void insertVertex           (); ///< Insert an intermediate vertex at right-click
     void mergePolys             (); ///< Merge existing polygons
     void saveScreenshot         (); ///< Save a screenshot of the current imagery
+    void tileArrived            (); ///< Schedule a redraw when an image tile was read
+    void refreshFromTiles       (); ///< Redraw with the image tiles read so far
+    void showRefinedProfile     (); ///< Show the profile sampled in the background
 
   protected:
 
@@ -292,10 +324,58 @@ public slots:
     std::vector<double> m_valsX, m_valsY;    // index and pixel value
     ProfilePlotter * m_profilePlot;          // the profile window
 
+    // Each new profile has a new generation. A profile sampled in the
+    // background is shown only if its generation is still current.
+    void showProfile(bool singlePoint);
+    std::atomic<int> m_profileGen;
+    vw::Mutex m_profileMutex; // protects the refined profile
+    int m_refinedGen;
+    std::vector<double> m_refinedX, m_refinedY;
+    boost::shared_ptr<vw::FifoWorkQueue> m_profileQueue;
+
     // Use double buffering: draw to a pixmap first, refresh it only
     // if really necessary, and display it when paintEvent is called.
     QPixmap m_pixmap;
 
+    // Image tiles read in the background. Until all tiles in view have
+    // arrived, the view is redrawn as they do.
+    boost::shared_ptr<TileCache> m_tileCache;
+    bool m_tileRefreshPending;
+
+    // The polygons of an image in world coordinates, with the bounding
+    // box of each polygon, made again when the polygons change. Versions
+    // simplified for when zoomed out are made when first needed, with
+    // the tolerance growing by a factor of 2 per level.
+    struct WorldPolys {
+      std::size_t hash;
+      double unit; // the tolerance at level 0
+      std::vector<vw::geometry::dPoly> polys;
+      std::vector<std::vector<vw::BBox2>> boxes;
+      std::map<int, std::vector<vw::geometry::dPoly>> simplified;
+    };
+    std::map<int, WorldPolys> m_worldPolys;
+
+    // The polygons of an image in world coordinates which are in view,
+    // simplified as much as invisible at this zoom, unless at full resolution
+    void worldPolysInView(int image_it, bool fullRes,
+                          std::vector<vw::geometry::dPoly> & polyVec);
+
+    // What renderView() reads from the widgets
+    QSize         m_viewSize;
+    QPen          m_viewPen;
+    QFont         m_viewFont;
+    std::set<int> m_hiddenImages;
+
+    // The interest points shown in this widget, on a grid, so that only
+    // those in view are drawn. Made again when the points change.
+    PointGrid m_ipGrid;
+    int       m_ipGridSource; // which set of points is on the grid, or -1
+    size_t    m_ipGridVersion;
+
+    // With --lazy-load, the images whose pyramids are open, the most
+    // recently in view first
+    std::list<int> m_openImages;
+
     std::string m_polyColor;
     std::map<int, std::string> m_perImagePolyColor;
     int m_lineWidth;
@@ -40,7 +40,10 @@ using namespace vw::gui;
 #include <vw/Image/PixelMask.h>
 #include <vw/InterestPoint/InterestData.h>
 #include <vw/InterestPoint/Matcher.h> // Needed for vw::ip::match_filename
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
 #include <boost/filesystem/path.hpp>
+#include <boost/noncopyable.hpp>
 
 #include <sstream>
 namespace po = boost::program_options;
@@ -103,6 +106,11 @@ bool MainWindow::sanityChecks(int num_images) {
     return false;
   }
 
+  if (stereo_settings().lazy_load && stereo_settings().max_open_images < 1) {
+    popUp("The value of --max-open-images must be positive.");
+    return false;
+  }
+
   if (stereo_settings().match_file != "" &&
       stereo_settings().gcp_file   != "" &&
       !stereo_settings().vwip_files.empty()) {
@@ -259,16 +267,19 @@ MainWindow::MainWindow(vw::GdalWriteOptions const& opt,
     m_image_files.push_back(local_images[i]);
   }
 
-  m_images.resize(m_image_files.size());
-
   std::vector<int> propertyIndices;
   lookupProperyIndices(properties, m_image_files, propertyIndices);
+  std::vector<std::map<std::string, std::string>> file_properties;
+  for (size_t i = 0; i < m_image_files.size(); i++)
+    file_properties.push_back(properties[propertyIndices[i]]);
+
+  // Building the pyramids of many images is slow, so do it in parallel
+  read_images_in_parallel(m_image_files, m_opt, file_properties, m_images);
 
   bool has_georef = true;
 
   for (size_t i = 0; i < m_image_files.size(); i++) {
 
-    m_images[i].read(m_image_files[i], m_opt, REGULAR_VIEW, properties[propertyIndices[i]]);
     // Above we read the image in regular mode. If plan to display hillshade,
     // for now set the flag for that, and the hillshaded image will be created
     // and set later. (Something more straightforward could be done.)
@@ -1272,6 +1283,8 @@ void MainWindow::viewPairwiseMatchesOrCleanMatches() {
     // Ensure no stray matches from before are shown
     m_pairwiseMatches.ip_to_show.clear();
     m_pairwiseCleanMatches.ip_to_show.clear();
+    m_pairwiseMatches.version++;
+    m_pairwiseCleanMatches.version++;
     return;
   }
   
@@ -1347,6 +1360,7 @@ void MainWindow::viewPairwiseMatchesOrCleanMatches() {
   // later in MainWidget::viewMatches() we plot the intended matches.
   pairwiseMatches->ip_to_show.clear();
   pairwiseMatches->ip_to_show.resize(m_images.size());
+  pairwiseMatches->version++;
   
   // Handles to where we want these loaded. Note that these are aliases.
   std::vector<vw::ip::InterestPoint> & left_ip = pairwiseMatches->matches[index_pair].first;
@@ -1371,6 +1385,7 @@ void MainWindow::viewPairwiseMatchesOrCleanMatches() {
   // These will be read when interest points are drawn
   pairwiseMatches->ip_to_show[left_index] = left_ip;
   pairwiseMatches->ip_to_show[right_index] = right_ip;
+  pairwiseMatches->version++;
   
   // Call viewMatches() in each widget. There things will be sorted out
   // based on stereo_settings().
@@ -1861,6 +1876,28 @@ void MainWindow::setZoomAllToSameRegion() {
 // Zoom all widgets to the same region which comes from widget with given id.
 // There is no need to re-create any layouts now, as nothing changes
 // except the fact that we zoom.
+namespace {
+
+  // Draw the view of one widget into an image
+  class RenderViewTask: public vw::Task, private boost::noncopyable {
+    MainWidget * m_widget;
+    QImage & m_image;
+    std::string & m_error;
+  public:
+    RenderViewTask(MainWidget * widget, QImage & image, std::string & error):
+      m_widget(widget), m_image(image), m_error(error) {}
+
+    void operator()() {
+      try {
+        m_widget->renderView(m_image);
+      } catch (std::exception const& e) {
+        m_error = e.what();
+      }
+    }
+  };
+
+}
+
 void MainWindow::zoomAllToSameRegionAction(int widget_id){
   int num_widgets = m_widgets.size();
   if (widget_id < 0 || widget_id >= num_widgets) {
@@ -1871,12 +1908,34 @@ void MainWindow::zoomAllToSameRegionAction(int widget_id){
   if (!mw(m_widgets[widget_id])) return;
 
   vw::BBox2 region = mw(m_widgets[widget_id])->current_view();
+  std::vector<MainWidget*> widgets;
   for (size_t i = 0; i < m_widgets.size(); i++) {
-    if (mw(m_widgets[i])) {
-      mw(m_widgets[i])->zoomToRegion(region);
+    if (mw(m_widgets[i]) && mw(m_widgets[i])->setView(region))
+      widgets.push_back(mw(m_widgets[i]));
+  }
+
+  // Draw all widgets at the same time, then show them. Drawing a
+  // widget is mostly single-threaded, so use a thread per widget.
+  for (size_t i = 0; i < widgets.size(); i++)
+    widgets[i]->prepareView();
+
+  std::vector<QImage> images(widgets.size());
+  std::vector<std::string> errors(widgets.size());
+  int num_threads = std::min(int(widgets.size()), vw::vw_settings().default_num_threads());
+  {
+    vw::FifoWorkQueue queue(std::max(num_threads, 1));
+    for (size_t i = 0; i < widgets.size(); i++) {
+      boost::shared_ptr<vw::Task> task(new RenderViewTask(widgets[i], images[i], errors[i]));
+      queue.add_task(task);
     }
+    queue.join_all();
+  }
+
+  for (size_t i = 0; i < widgets.size(); i++) {
+    if (errors[i] != "")
+      popUp(errors[i]);
+    widgets[i]->showView(images[i]);
   }
-  
 }
 
 void MainWindow::viewNextImage() {
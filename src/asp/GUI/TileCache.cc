@@ -0,0 +1,482 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2006-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file TileCache.cc
+///
+
+#include <asp/GUI/TileCache.h>
+
+#include <vw/Core/Log.h>
+#include <vw/Core/Stopwatch.h>
+
+#include <QPainter>
+
+#include <boost/noncopyable.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <tuple>
+
+namespace vw { namespace gui {
+
+namespace {
+
+  // Read one tile in a worker thread. Keep a copy of the image, as
+  // the caller's may be replaced while the task waits in the queue.
+  class TileTask: public vw::Task, private boost::noncopyable {
+    TileCache & m_cache;
+    DiskImagePyramidMultiChannel m_img;
+    RenderOptions m_render;
+    int m_level, m_col, m_row;
+    bool m_highlight_nodata;
+  public:
+    TileTask(TileCache & cache, DiskImagePyramidMultiChannel const& img,
+             RenderOptions const& render,
+             int level, int col, int row, bool highlight_nodata):
+      m_cache(cache), m_img(img), m_render(render), m_level(level), m_col(col), m_row(row),
+      m_highlight_nodata(highlight_nodata) {}
+
+    void operator()() {
+      m_cache.fetch_tile(m_img, m_render, m_level, m_col, m_row, m_highlight_nodata, true);
+    }
+  };
+
+  // Levels are subsampled by 2 each
+  double level_scale(int level) {
+    return double(std::int64_t(1) << level);
+  }
+
+  // If there are too many tiles, evict the one used least recently,
+  // unless it is used by the current view, as otherwise the tiles in
+  // view would be read over and over.
+  template<class MapT>
+  void evict_least_recent(MapT & tiles, int max_num_tiles, std::int64_t view) {
+    if (int(tiles.size()) <= max_num_tiles)
+      return;
+
+    auto oldest = tiles.begin();
+    for (auto it = tiles.begin(); it != tiles.end(); it++) {
+      if (it->second.last_view < oldest->second.last_view)
+        oldest = it;
+    }
+
+    if (oldest->second.last_view < view)
+      tiles.erase(oldest);
+  }
+
+}
+
+bool TileCache::TileKey::operator<(TileKey const& k) const {
+  return std::tie(image_id, level, col, row, highlight_nodata, render.mode,
+                  render.azimuth, render.elevation, render.meters_per_pixel,
+                  render.threshold) <
+    std::tie(k.image_id, k.level, k.col, k.row, k.highlight_nodata, k.render.mode,
+             k.render.azimuth, k.render.elevation, k.render.meters_per_pixel,
+             k.render.threshold);
+}
+
+TileCache::TileCache(int num_threads, int tile_size, int max_num_tiles):
+  m_tile_size(tile_size), m_max_num_tiles(max_num_tiles), m_view(0),
+  m_queue(new vw::FifoWorkQueue(std::max(num_threads, 1))) {}
+
+TileCache::~TileCache() {
+  begin_view(); // this cancels all queued requests
+  m_queue->join_all();
+}
+
+TileCache::Stats TileCache::take_stats() {
+  vw::Mutex::Lock lock(m_mutex);
+  Stats stats = m_stats;
+  stats.queue_depth = m_pending.size();
+  m_stats = Stats();
+  return stats;
+}
+
+void TileCache::begin_view() {
+  vw::Mutex::Lock lock(m_mutex);
+  m_view++;
+}
+
+TileCache::TileKey TileCache::make_key(DiskImagePyramidMultiChannel const& img,
+                                       RenderOptions const& render,
+                                       int level, int col, int row,
+                                       bool highlight_nodata) const {
+  TileKey key;
+  key.image_id = img.m_id;
+  key.level = level;
+  key.col = col;
+  key.row = row;
+  key.highlight_nodata = highlight_nodata;
+
+  // Keep only the options which are used, so that changing the others
+  // does not form the tiles again
+  key.render.mode = render.mode;
+  if (render.mode == RenderOptions::HILLSHADE) {
+    key.render.azimuth = render.azimuth;
+    key.render.elevation = render.elevation;
+    key.render.meters_per_pixel = render.meters_per_pixel;
+  } else if (render.mode == RenderOptions::THRESHOLD) {
+    key.render.threshold = render.threshold;
+  }
+
+  return key;
+}
+
+TileCache::TileKey TileCache::raw_key(TileKey const& key) const {
+  TileKey raw = key;
+  raw.highlight_nodata = false;
+  raw.render = RenderOptions();
+  return raw;
+}
+
+vw::BBox2i TileCache::tile_box(DiskImagePyramidMultiChannel const& img, int level,
+                               int col, int row) const {
+  vw::Vector2i size = img.level_size(level);
+  vw::BBox2i box(col * m_tile_size, row * m_tile_size, m_tile_size, m_tile_size);
+  box.crop(vw::BBox2i(0, 0, size.x(), size.y()));
+  return box;
+}
+
+std::vector<TileCache::TileKey>
+TileCache::tiles_for_clip(DiskImagePyramidMultiChannel const& img,
+                          RenderOptions const& render,
+                          bool highlight_nodata, int level,
+                          double clip_scale, vw::BBox2i const& clip_region) const {
+
+  // The clip region in the pixels of this level
+  double f = clip_scale / level_scale(level);
+  vw::Vector2i size = img.level_size(level);
+  int min_x = std::max(int(floor(clip_region.min().x() * f)), 0);
+  int min_y = std::max(int(floor(clip_region.min().y() * f)), 0);
+  int max_x = std::min(int(ceil(clip_region.max().x() * f)), size.x());
+  int max_y = std::min(int(ceil(clip_region.max().y() * f)), size.y());
+
+  std::vector<TileKey> keys;
+  if (min_x >= max_x || min_y >= max_y)
+    return keys;
+
+  for (int row = min_y / m_tile_size; row <= (max_y - 1) / m_tile_size; row++) {
+    for (int col = min_x / m_tile_size; col <= (max_x - 1) / m_tile_size; col++)
+      keys.push_back(make_key(img, render, level, col, row, highlight_nodata));
+  }
+  return keys;
+}
+
+std::vector<TileCache::TileKey>
+TileCache::find_tiles(std::vector<TileKey> const& keys, std::vector<Tile> & tiles) {
+  std::vector<TileKey> missing;
+  vw::Mutex::Lock lock(m_mutex);
+  for (size_t it = 0; it < keys.size(); it++) {
+    auto tile = m_tiles.find(keys[it]);
+    if (tile == m_tiles.end()) {
+      missing.push_back(keys[it]);
+      continue;
+    }
+    tile->second.last_view = m_view;
+    tiles.push_back(tile->second); // the pixels are shared, not copied
+  }
+  return missing;
+}
+
+bool TileCache::find_raw_tile(TileKey const& key, RawTile & raw) {
+  vw::Mutex::Lock lock(m_mutex);
+  auto it = m_raw_tiles.find(raw_key(key));
+  if (it == m_raw_tiles.end())
+    return false;
+  it->second.last_view = m_view;
+  raw = it->second; // shallow copy
+  return true;
+}
+
+void TileCache::request_tile(DiskImagePyramidMultiChannel const& img, TileKey const& key) {
+  {
+    vw::Mutex::Lock lock(m_mutex);
+    if (m_tiles.find(key) != m_tiles.end())
+      return; // arrived in the meantime
+
+    auto it = m_pending.find(key);
+    if (it != m_pending.end()) {
+      it->second = m_view; // still wanted
+      return;
+    }
+    m_pending[key] = m_view;
+  }
+
+  boost::shared_ptr<vw::Task>
+    task(new TileTask(*this, img, key.render, key.level, key.col, key.row,
+                      key.highlight_nodata));
+  m_queue->add_task(task);
+}
+
+void TileCache::add_tile(TileKey const& key, Tile & tile) {
+  tile.last_view = m_view;
+  m_tiles[key] = tile;
+  evict_least_recent(m_tiles, m_max_num_tiles, m_view);
+}
+
+void TileCache::add_raw_tile(TileKey const& key, RawTile & raw) {
+  raw.last_view = m_view;
+  m_raw_tiles[key] = raw;
+  evict_least_recent(m_raw_tiles, m_max_num_tiles, m_view);
+}
+
+void TileCache::render_raw_tile(RawTile const& raw, vw::BBox2i const& box,
+                                TileKey const& key, Tile & tile) const {
+
+  tile.scale = raw.scale;
+  tile.region = box;
+  tile.region.crop(raw.region);
+  tile.qimg = QImage(tile.region.width(), tile.region.height(),
+                     QImage::Format_ARGB32_Premultiplied);
+
+  RenderOptions const& render = key.render;
+  ImageView<double> const& pixels = raw.pixels;
+  int off_x = raw.region.min().x(), off_y = raw.region.min().y();
+  auto is_valid = [&](double v) {
+    if (v == raw.nodata_val || std::isnan(v))
+      return false;
+    return (render.mode != RenderOptions::THRESHOLD || v > render.threshold);
+  };
+  QRgb invalid_color = key.highlight_nodata ? qRgb(255, 0, 0) : QColor(0, 0, 0, 0).rgba();
+
+  // Stretch thresholded images as all others, with the bounds of the whole
+  // image, if known
+  double min_val = raw.approx_bounds[0], max_val = raw.approx_bounds[1];
+  if (render.mode == RenderOptions::THRESHOLD && !(min_val < max_val)) {
+    min_val = std::numeric_limits<double>::max();
+    max_val = -min_val;
+    for (int row = 0; row < pixels.rows(); row++) {
+      for (int col = 0; col < pixels.cols(); col++) {
+        if (!is_valid(pixels(col, row)))
+          continue;
+        min_val = std::min(min_val, pixels(col, row));
+        max_val = std::max(max_val, pixels(col, row));
+      }
+    }
+    if (min_val >= max_val)
+      max_val = min_val + 1.0; // a safety measure
+  }
+
+  // The light direction. The azimuth is measured counter-clockwise from
+  // the image x axis, and y goes down in the image.
+  double a = render.azimuth * M_PI / 180.0, e = render.elevation * M_PI / 180.0;
+  vw::Vector3 light(cos(a) * cos(e), sin(a) * cos(e), sin(e));
+  double spacing = render.meters_per_pixel * raw.scale;
+
+  for (int row = tile.region.min().y(); row < tile.region.max().y(); row++) {
+    for (int col = tile.region.min().x(); col < tile.region.max().x(); col++) {
+
+      int c = col - off_x, r = row - off_y;
+      double h = pixels(c, r);
+      QRgb color = invalid_color;
+      if (is_valid(h)) {
+        double v = 0.0;
+        if (render.mode == RenderOptions::THRESHOLD) {
+          v = round(255.0 * (std::max(h, min_val) - min_val) / (max_val - min_val));
+        } else {
+          // Central differences, or one-sided ones next to invalid pixels
+          double hl = h, hr = h, hu = h, hd = h;
+          int nx = 0, ny = 0;
+          if (c > 0 && is_valid(pixels(c - 1, r))) { hl = pixels(c - 1, r); nx++; }
+          if (c + 1 < pixels.cols() && is_valid(pixels(c + 1, r))) { hr = pixels(c + 1, r); nx++; }
+          if (r > 0 && is_valid(pixels(c, r - 1))) { hu = pixels(c, r - 1); ny++; }
+          if (r + 1 < pixels.rows() && is_valid(pixels(c, r + 1))) { hd = pixels(c, r + 1); ny++; }
+          double dx = (nx > 0) ? (hr - hl) / (nx * spacing) : 0.0;
+          double dy = (ny > 0) ? (hu - hd) / (ny * spacing) : 0.0; // y points up
+          vw::Vector3 normal(-dx, -dy, 1.0);
+          v = 255.0 * std::max(0.0, dot_prod(normal, light) / norm_2(normal));
+        }
+        v = std::min(std::max(0.0, v), 255.0);
+        color = QColor(v, v, v, 255).rgba();
+      }
+      tile.qimg.setPixel(col - tile.region.min().x(), row - tile.region.min().y(), color);
+    }
+  }
+}
+
+void TileCache::form_tile(DiskImagePyramidMultiChannel const& img, TileKey const& key,
+                          Tile & tile) {
+
+  vw::BBox2i box = tile_box(img, key.level, key.col, key.row);
+  std::int64_t s = std::int64_t(1) << key.level;
+
+  if (key.render.mode == RenderOptions::PIXELS) {
+    // Use the same stretch for all tiles
+    img.get_image_clip(level_scale(key.level), vw::BBox2i(box.min() * s, box.max() * s),
+                       key.highlight_nodata, tile.qimg, tile.scale, tile.region,
+                       false);
+    return;
+  }
+
+  RawTile raw;
+  if (!find_raw_tile(key, raw)) {
+    vw::Vector2i size = img.level_size(key.level);
+    vw::BBox2i wide = box;
+    wide.expand(1);
+    wide.crop(vw::BBox2i(0, 0, size.x(), size.y()));
+    img.get_raw_clip(level_scale(key.level), vw::BBox2i(wide.min() * s, wide.max() * s),
+                     raw.pixels, raw.scale, raw.region);
+    raw.nodata_val = img.get_nodata_val();
+    raw.approx_bounds = img.get_approx_bounds();
+
+    vw::Mutex::Lock lock(m_mutex);
+    add_raw_tile(raw_key(key), raw);
+  }
+
+  render_raw_tile(raw, box, key, tile);
+}
+
+void TileCache::fetch_tile(DiskImagePyramidMultiChannel const& img,
+                           RenderOptions const& render, int level,
+                           int tile_col, int tile_row, bool highlight_nodata,
+                           bool in_worker) {
+  TileKey key = make_key(img, render, level, tile_col, tile_row, highlight_nodata);
+
+  if (in_worker) {
+    vw::Mutex::Lock lock(m_mutex);
+    auto it = m_pending.find(key);
+    if (it != m_pending.end() && it->second != m_view) {
+      // Not wanted by the current view
+      m_pending.erase(it);
+      return;
+    }
+  }
+
+  Tile tile;
+  vw::Stopwatch sw;
+  sw.start();
+  try {
+    form_tile(img, key, tile);
+  } catch (std::exception const& e) {
+    // Keep the empty tile, so it is not read again
+    vw_out(WarningMessage) << "Could not read an image tile: " << e.what() << "\n";
+    tile.qimg = QImage();
+    tile.scale = level_scale(level);
+    tile.region = vw::BBox2i();
+  }
+
+  sw.stop();
+
+  {
+    vw::Mutex::Lock lock(m_mutex);
+    m_pending.erase(key);
+    add_tile(key, tile);
+
+    // Single-channel pixels are read as double, others as bytes
+    int bytes_per_pixel = (img.planes() == 1) ? sizeof(double) : img.planes();
+    m_stats.tiles_formed++;
+    m_stats.bytes_read += std::int64_t(tile.region.width()) * tile.region.height() *
+      bytes_per_pixel;
+    m_stats.read_seconds += sw.elapsed_seconds();
+    if (!in_worker)
+      m_stats.gui_read_seconds += sw.elapsed_seconds();
+  }
+
+  if (in_worker)
+    emit tileArrived();
+}
+
+bool TileCache::get_image_clip(DiskImagePyramidMultiChannel const& img,
+                               RenderOptions const& render,
+                               double scale_in, vw::BBox2i const& region_in,
+                               bool highlight_nodata,
+                               QImage & qimg, double & scale_out, vw::BBox2i & region_out) {
+
+  // The finest level which is coarse enough for this scale
+  int num_levels = img.num_levels();
+  int level = 0;
+  while (level + 1 < num_levels && level_scale(level + 1) <= scale_in)
+    level++;
+
+  scale_out = level_scale(level);
+  vw::Vector2i size = img.level_size(level);
+  region_out = vw::BBox2i(vw::Vector2i(floor(region_in.min().x() / scale_out),
+                                       floor(region_in.min().y() / scale_out)),
+                          vw::Vector2i(ceil(region_in.max().x() / scale_out),
+                                       ceil(region_in.max().y() / scale_out)));
+  region_out.crop(vw::BBox2i(0, 0, size.x(), size.y()));
+  if (region_out.empty()) {
+    qimg = QImage();
+    return true;
+  }
+
+  qimg = QImage(region_out.width(), region_out.height(), QImage::Format_ARGB32_Premultiplied);
+  qimg.fill(Qt::transparent);
+
+  // Paint from coarse to fine, so finer tiles replace coarser ones.
+  // The coarsest level is small and is read here if missing, so that
+  // something is always shown. So are the tiles which need only be
+  // formed from cached raw pixels.
+  std::vector<Tile> tiles;
+  std::vector<TileKey> missing
+    = find_tiles(tiles_for_clip(img, render, highlight_nodata, level, scale_out, region_out),
+                 tiles);
+  std::vector<TileKey> formed;
+  for (size_t it = 0; it < missing.size(); it++) {
+    RawTile raw;
+    if (level == num_levels - 1 ||
+        (render.mode != RenderOptions::PIXELS && find_raw_tile(missing[it], raw))) {
+      fetch_tile(img, render, level, missing[it].col, missing[it].row, highlight_nodata, false);
+      formed.push_back(missing[it]);
+    } else {
+      request_tile(img, missing[it]);
+    }
+  }
+  bool complete = (formed.size() == missing.size());
+  {
+    vw::Mutex::Lock lock(m_mutex);
+    m_stats.hits   += tiles.size();
+    m_stats.misses += missing.size();
+  }
+
+  if (!complete) {
+    std::vector<Tile> fine_tiles;
+    fine_tiles.swap(tiles);
+    for (int l = num_levels - 1; l > level; l--) {
+      std::vector<TileKey> keys
+        = tiles_for_clip(img, render, highlight_nodata, l, scale_out, region_out);
+      std::vector<TileKey> coarse_missing = find_tiles(keys, tiles);
+      if (l == num_levels - 1 && !coarse_missing.empty()) {
+        for (size_t it = 0; it < coarse_missing.size(); it++)
+          fetch_tile(img, render, l, coarse_missing[it].col, coarse_missing[it].row,
+                     highlight_nodata, false);
+        find_tiles(coarse_missing, tiles);
+      }
+    }
+    tiles.insert(tiles.end(), fine_tiles.begin(), fine_tiles.end());
+  }
+  find_tiles(formed, tiles);
+
+  QPainter paint(&qimg);
+  paint.setCompositionMode(QPainter::CompositionMode_Source);
+  for (size_t it = 0; it < tiles.size(); it++) {
+    Tile const& tile = tiles[it];
+    if (tile.qimg.isNull())
+      continue;
+    double f = tile.scale / scale_out;
+    QRectF rect(tile.region.min().x() * f - region_out.min().x(),
+                tile.region.min().y() * f - region_out.min().y(),
+                tile.region.width() * f, tile.region.height() * f);
+    paint.drawImage(rect, tile.qimg);
+  }
+
+  return complete;
+}
+
+}} // namespace vw::gui
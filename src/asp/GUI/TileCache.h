@@ -0,0 +1,200 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2006-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file TileCache.h
+///
+/// A cache of image tiles at all pyramid levels, to be shown on screen.
+/// Tiles which are not in the cache are read by worker threads, and
+/// meanwhile their area is drawn from coarser levels, so that panning
+/// and zooming over large images does not block the GUI. The coarsest
+/// level is small and is read right away, so something is always shown.
+///
+/// Single-channel images can also be hillshaded or thresholded. That is
+/// done in memory from the raw pixels of the tiles, which are cached as
+/// well, so changing the light direction or the threshold redraws the
+/// view without reading the image again or writing any files.
+///
+#ifndef __STEREO_GUI_TILE_CACHE_H__
+#define __STEREO_GUI_TILE_CACHE_H__
+
+#include <asp/GUI/DiskImagePyramidMultiChannel.h>
+
+// Qt
+#include <QObject>
+#include <QImage>
+
+// Vision Workbench
+#include <vw/Core/Thread.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Math/BBox.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace vw { namespace gui {
+
+  /// How to form the pixels to show from those of an image
+  struct RenderOptions {
+    enum Mode {PIXELS, HILLSHADE, THRESHOLD};
+    Mode mode;
+    double azimuth, elevation; // in degrees, for hillshading
+    double meters_per_pixel;   // at full resolution, for hillshading
+    double threshold;          // pixels at most this become no-data, for thresholding
+    RenderOptions(): mode(PIXELS), azimuth(0.0), elevation(0.0),
+                     meters_per_pixel(1.0), threshold(0.0) {}
+  };
+
+  class TileCache: public QObject {
+    Q_OBJECT
+
+  public:
+    TileCache(int num_threads, int tile_size = 256, int max_num_tiles = 512);
+
+    // Cancel what is queued and wait for the tiles being read
+    virtual ~TileCache();
+
+    /// Start drawing a new view. Tiles requested for earlier views
+    /// and not requested again since are not read, unless already
+    /// being read.
+    void begin_view();
+
+    /// Form the clip of the image at the given scale, as
+    /// DiskImagePyramidMultiChannel::get_image_clip() does, from the
+    /// tiles in the cache. Request the missing ones, and fill their area
+    /// from coarser levels. A hillshaded or thresholded tile is formed
+    /// right away if its raw pixels are cached. Return true if no tile
+    /// was missing.
+    bool get_image_clip(DiskImagePyramidMultiChannel const& img,
+                        RenderOptions const& render,
+                        double scale_in, vw::BBox2i const& region_in,
+                        bool highlight_nodata,
+                        QImage & qimg, double & scale_out, vw::BBox2i & region_out);
+
+    /// What the cache did, for --render-stats
+    struct Stats {
+      std::int64_t hits, misses; // tiles at the level of each view
+      std::int64_t tiles_formed;
+      std::int64_t bytes_read;   // the decoded pixels of the tiles formed
+      double read_seconds;        // forming tiles, over all threads
+      double gui_read_seconds;    // of which in the GUI thread
+      int queue_depth;            // tiles requested and not formed yet
+      Stats(): hits(0), misses(0), tiles_formed(0), bytes_read(0),
+               read_seconds(0.0), gui_read_seconds(0.0), queue_depth(0) {}
+    };
+
+    /// Return what was done since the last call, and start counting anew
+    Stats take_stats();
+
+    /// Form a tile in the current thread and add it to the cache. In a
+    /// worker thread, skip it if its request was canceled, and emit
+    /// tileArrived() when done.
+    void fetch_tile(DiskImagePyramidMultiChannel const& img,
+                    RenderOptions const& render, int level,
+                    int tile_col, int tile_row, bool highlight_nodata,
+                    bool in_worker);
+
+  signals:
+    /// Emitted from a worker thread when a tile was added
+    void tileArrived();
+
+  private:
+
+    struct TileKey {
+      int image_id, level, col, row;
+      bool highlight_nodata;
+      RenderOptions render;
+      bool operator<(TileKey const& k) const;
+    };
+
+    struct Tile {
+      QImage qimg;       // null if the tile could not be read
+      double scale;      // the scale of the level it came from
+      vw::BBox2i region; // the pixels of that level it covers
+      std::int64_t last_view; // the last view which used it
+    };
+
+    // The pixels of a single-channel image, with a margin of one
+    // pixel for hillshading
+    struct RawTile {
+      vw::ImageView<double> pixels;
+      double scale;
+      vw::BBox2i region;
+      double nodata_val;
+      vw::Vector2 approx_bounds;
+      std::int64_t last_view;
+    };
+
+    TileKey make_key(DiskImagePyramidMultiChannel const& img, RenderOptions const& render,
+                     int level, int col, int row, bool highlight_nodata) const;
+
+    // The raw pixels are the same for all ways of rendering them
+    TileKey raw_key(TileKey const& key) const;
+
+    // The pixels of a tile at its level
+    vw::BBox2i tile_box(DiskImagePyramidMultiChannel const& img, int level,
+                        int col, int row) const;
+
+    // The tiles of a level which overlap a clip at the given scale
+    std::vector<TileKey> tiles_for_clip(DiskImagePyramidMultiChannel const& img,
+                                        RenderOptions const& render,
+                                        bool highlight_nodata, int level,
+                                        double clip_scale,
+                                        vw::BBox2i const& clip_region) const;
+
+    // Find the given tiles in the cache. Return the missing ones.
+    std::vector<TileKey> find_tiles(std::vector<TileKey> const& keys,
+                                    std::vector<Tile> & tiles);
+
+    // Find the raw pixels of a tile in the cache
+    bool find_raw_tile(TileKey const& key, RawTile & raw);
+
+    void request_tile(DiskImagePyramidMultiChannel const& img, TileKey const& key);
+
+    // Form a tile from the image, or from its raw pixels if hillshading
+    // or thresholding. Throws on failure.
+    void form_tile(DiskImagePyramidMultiChannel const& img, TileKey const& key,
+                   Tile & tile);
+
+    // Hillshade or threshold the raw pixels of a tile
+    void render_raw_tile(RawTile const& raw, vw::BBox2i const& box,
+                         TileKey const& key, Tile & tile) const;
+
+    // Add a tile, and evict the least recently used one if too many,
+    // as long as it is not used by the current view. The mutex must be held.
+    void add_tile(TileKey const& key, Tile & tile);
+    void add_raw_tile(TileKey const& key, RawTile & raw);
+
+    int m_tile_size, m_max_num_tiles;
+
+    vw::Mutex m_mutex; // protects the members below
+    std::map<TileKey, Tile> m_tiles;
+    std::map<TileKey, RawTile> m_raw_tiles;
+    std::map<TileKey, std::int64_t> m_pending; // the view which last requested each
+    std::int64_t m_view;
+    Stats m_stats;
+
+    boost::shared_ptr<vw::FifoWorkQueue> m_queue;
+  };
+
+}} // namespace vw::gui
+
+#endif  // __STEREO_GUI_TILE_CACHE_H__
@@ -17,6 +17,13 @@
 
 #include <asp/Gotcha/ALSC.h>
 
+#include <vw/Core/ThreadPool.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <algorithm>
+
 using namespace std;
 using namespace cv;
 
@@ -52,16 +59,27 @@ ALSC::ALSC(Mat imgL, Mat imgR, CALSCParam paramALSC){
     nSystemMatrixRows = nRowPatch*nColPatch; //4 * nRadius * nRadius + 1 + 4 * nRadius;
     emA = Eigen::MatrixXf(nSystemMatrixRows,nParam);
     emB = Eigen::VectorXf(nSystemMatrixRows);
-
-    pfGx.resize(nRowPatch);
-    for (int i = 0; i < nRowPatch; i++) {
-        pfGx[i].resize(nColPatch);
-    }
-
-    pfGy.resize(nRowPatch);
-    for (int i = 0; i < nRowPatch; i++) {
-        pfGy[i].resize(nColPatch);
+    emAT = Eigen::MatrixXf(nParam,nSystemMatrixRows);
+    emAS = Eigen::MatrixXf(nParam,nParam);
+    emS = Eigen::VectorXf(nParam);
+    emErrors = Eigen::VectorXf(nSystemMatrixRows);
+
+    matGx = Eigen::MatrixXf::Zero(nRowPatch,nColPatch);
+    matGy = Eigen::MatrixXf::Zero(nRowPatch,nColPatch);
+
+    // The patches are stored column by column, and the system matrix
+    // rows follow the same order, so that it can be filled with whole
+    // columns at a time.
+    vecOffX = Eigen::VectorXf(nSystemMatrixRows);
+    vecOffY = Eigen::VectorXf(nSystemMatrixRows);
+    for (int x = 0; x < nColPatch; x++) {
+        for (int y = 0; y < nRowPatch; y++) {
+            vecOffX(x*nRowPatch + y) = x - nPatchRadius;
+            vecOffY(x*nRowPatch + y) = y - nPatchRadius;
+        }
     }
+    if (nParam == 7)
+        emA.col(6).setOnes();
 
 }
 
@@ -144,50 +162,33 @@ bool ALSC::doMatching(Point2f ptStartL, Point2f ptStartR, CTiePt& tp, const floa
         getGradientX(matPatchR);
         getGradientY(matPatchR);
 
-        // make a system matrix A for LMS
-        int count = 0;
-        for (int y = 0; y < nRowPatch; y++) {
-
-            int yOffset = y - nPatchRadius;
-
-            for (int x = 0; x < nColPatch; x++) {
-
-                int xOffset = x - nPatchRadius;
-
-                float fVal = pfGx[y][x];
-                emA(count,0) = fVal;
-                emA(count,1) = fVal * xOffset;
-                emA(count,2) = fVal * yOffset;
+        // make a system matrix A for LMS, a column at a time. The last
+        // column, for the intensity offset, is constant.
+        Eigen::Map<const Eigen::VectorXf> vecGx(matGx.data(), nSystemMatrixRows);
+        Eigen::Map<const Eigen::VectorXf> vecGy(matGy.data(), nSystemMatrixRows);
+        emA.col(0) = vecGx;
+        emA.col(1) = vecGx.cwiseProduct(vecOffX);
+        emA.col(2) = vecGx.cwiseProduct(vecOffY);
+        emA.col(3) = vecGy;
+        emA.col(4) = vecGy.cwiseProduct(vecOffX);
+        emA.col(5) = vecGy.cwiseProduct(vecOffY);
 
-                fVal = pfGy[y][x];
-                emA(count,3) = fVal;
-                emA(count,4) = fVal * xOffset;
-                emA(count,5) = fVal * yOffset;
-
-                if (nParam == 7) {
-                    emA(count,6)  = 1;
-                }
-
-                emB(count) = matPatchL(y, x) - matPatchR(y, x);
-                count++;
-            }
-        }
+        emB = Eigen::Map<const Eigen::VectorXf>(matPatchL.data(), nSystemMatrixRows)
+            - Eigen::Map<const Eigen::VectorXf>(matPatchR.data(), nSystemMatrixRows);
 
         // get LMS solution
-        Eigen::VectorXf emS(nParam);
-        Eigen::MatrixXf emAS(nParam,nParam);
 
         /* Don't explicitly calculate the inverse!  Use Cholesky decomposition instead. */
-        Eigen::MatrixXf emAT = emA.transpose();
-        emAS = (emAT*emA);
+        emAT = emA.transpose();
+        emAS.noalias() = emAT*emA;
         emS = emAS.llt().solve(emAT*emB);
 
         if (m_paramALSC.m_bIntOffset)
             fIntOffNew = emS(6);
 
         // error computation
-        Eigen::VectorXf emErrors(nSystemMatrixRows);
-        emErrors = (emA * emS) - emB;
+        emErrors.noalias() = emA * emS;
+        emErrors -= emB;
 
         // Compute the standard deviation of residual errors
         double dTotElelement = nSystemMatrixRows; //nRowPatch *nColPatch; //2 * nRadius + 1; //dTotElelement *= dTotElelement;
@@ -307,11 +308,8 @@ void ALSC::getGradientX(Eigen::Ref<Eigen::MatrixXf> matSrc) {
     int nW = matSrc.cols();
     int nH = matSrc.rows();
 
-    for (int y = 1; y < nH - 1; y++) {
-        for (int x = 1; x < nW - 1; x++) {
-            pfGx.at(y).at(x) = matSrc(y, x+1) - matSrc(y, x);
-        }
-    }
+    // forward differences, leaving the border at zero
+    matGx.block(1, 1, nH-2, nW-2) = matSrc.block(1, 2, nH-2, nW-2) - matSrc.block(1, 1, nH-2, nW-2);
 
     return;
 }
@@ -321,11 +319,7 @@ void ALSC::getGradientY(Eigen::Ref<Eigen::MatrixXf> matSrc) {
     int nW = matSrc.cols();
     int nH = matSrc.rows();
 
-    for (int y = 1; y < nH - 1; y++) {
-        for (int x = 1; x < nW - 1; x++) {
-            pfGy.at(y).at(x) = matSrc(y+1, x) - matSrc(y, x);
-        }
-    }
+    matGy.block(1, 1, nH-2, nW-2) = matSrc.block(2, 1, nH-2, nW-2) - matSrc.block(1, 1, nH-2, nW-2);
 
     return;
 }
@@ -382,7 +376,45 @@ void ALSC::distortPatch(const Mat& matImg, const Point2f ptCentre, const float*
             pptUpdated[3] = Point2f(ptCentre.x + initX + nW-1, ptCentre.y + initY + nH-1);
         }
     }else{
-        /* Otherwise interpolate */
+        /* The corners of the distorted patch. As the map is affine, they bound it. */
+        Point2f pptCorners[4];
+        affineTransform(initX, initY, ptCentre, pfAff, &dNewX, &dNewY);
+        pptCorners[0] = Point2f(dNewX, dNewY);
+        affineTransform(initX, initY+nH-1, ptCentre, pfAff, &dNewX, &dNewY);
+        pptCorners[1] = Point2f(dNewX, dNewY);
+        affineTransform(initX+nW-1, initY+nH-1, ptCentre, pfAff, &dNewX, &dNewY);
+        pptCorners[2] = Point2f(dNewX, dNewY);
+        affineTransform(initX+nW-1, initY, ptCentre, pfAff, &dNewX, &dNewY);
+        pptCorners[3] = Point2f(dNewX, dNewY);
+
+        if (isPatchInside(matImg, pptCorners)){
+            /* The usual case. No pixel needs a bounds check, and the bilinear weights
+               work for integer positions too, so the loop has no branches. */
+            for (j = 0; j < nH; j++) {
+                for (i = 0; i < nW; i++) {
+                    affineTransform(initX+i, initY+j, ptCentre, pfAff, &dNewX, &dNewY);
+
+                    int x1 = (int) dNewX; // the positions are not negative
+                    int y1 = (int) dNewY;
+                    double fx = dNewX - x1;
+                    double fy = dNewY - y1;
+
+                    const unsigned char* pRow1 = matImg.ptr<unsigned char>(y1) + x1;
+                    const unsigned char* pRow2 = matImg.ptr<unsigned char>(y1+1) + x1;
+
+                    matImgPatch(j,i) = (pRow1[0] * (1.0 - fx) + pRow1[1] * fx) * (1.0 - fy)
+                                     + (pRow2[0] * (1.0 - fx) + pRow2[1] * fx) * fy;
+                }
+            }
+
+            if (pptUpdated != NULL){
+                for (int k = 0; k < 4; k++)
+                    pptUpdated[k] = pptCorners[k];
+            }
+            return;
+        }
+
+        /* Otherwise interpolate with bounds checks */
         for (j = 0; j < nH; j++) {
                 for (i = 0; i < nW; i++) {
                     /* Perform the affine transform on the points */
@@ -409,6 +441,18 @@ void ALSC::distortPatch(const Mat& matImg, const Point2f ptCentre, const float*
     return;
 }
 
+bool ALSC::isPatchInside(const Mat& matImg, const Point2f* pptCorners){
+    // Each pixel and its right and lower neighbours must be in the image.
+    // Keep a pixel of margin, so that rounding in the positions of the
+    // pixels between the corners does not matter.
+    for (int k = 0; k < 4; k++){
+        if (pptCorners[k].x < 0 || pptCorners[k].x >= matImg.cols - 2 ||
+            pptCorners[k].y < 0 || pptCorners[k].y >= matImg.rows - 2)
+            return false;
+    }
+    return true;
+}
+
 float ALSC::interpolate(double dNewX, double dNewY, const Mat &matImg){
     int x1, x2, y2, y1;
     float val1, val2, val3, val4;
@@ -557,14 +601,64 @@ float ALSCF32::interpolate(double dNewX, double dNewY, const Mat &matImg){
 }
 
 // this function for the feature refinement
-void ALSC::performALSC(const vector<CTiePt> *pvecTpts, const float* pfAffStart){
+namespace {
+
+  // Match a range of tie points with a copy of a matcher
+  class ALSCTask: public vw::Task, private boost::noncopyable {
+    ALSC m_alsc;
+    std::vector<CTiePt> m_vecTpts;
+    const float* m_pfAffStart;
+  public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    ALSCTask(ALSC const& alsc, std::vector<CTiePt>::const_iterator begin,
+             std::vector<CTiePt>::const_iterator end, const float* pfAffStart):
+      m_alsc(alsc), m_vecTpts(begin, end), m_pfAffStart(pfAffStart) {}
+    virtual void operator()() { m_alsc.performALSC(&m_vecTpts, m_pfAffStart); }
+    ALSC & alsc() { return m_alsc; }
+  };
+
+}
+
+void ALSC::performALSC(const vector<CTiePt> *pvecTpts, const float* pfAffStart, int nThreads){
 
-    //////////////////////////////////////////////////
-    // Start processing for each seed point
-    //////////////////////////////////////////////////
     int nLength = pvecTpts->size();
     m_pvecRefTP.clear();   // clear result buffer
     m_vecPassList.clear(); // clear pass index
+
+    // Not worth the threads for the few neighbours of a seed
+    const int nMinPerThread = 256;
+    nThreads = std::min(nThreads, nLength / nMinPerThread);
+    if (nThreads > 1) {
+        // Split the tie points in contiguous ranges, and put the results
+        // back together in order, so that they are as without threads.
+        std::vector<boost::shared_ptr<ALSCTask>> tasks;
+        std::vector<int> vecBegin;
+        {
+            vw::FifoWorkQueue queue(nThreads);
+            for (int t = 0; t < nThreads; t++) {
+                int nBegin = (long)nLength * t / nThreads;
+                int nEnd = (long)nLength * (t + 1) / nThreads;
+                boost::shared_ptr<ALSCTask> task(new ALSCTask(*this, pvecTpts->begin() + nBegin,
+                                                              pvecTpts->begin() + nEnd, pfAffStart));
+                tasks.push_back(task);
+                vecBegin.push_back(nBegin);
+                queue.add_task(task);
+            }
+            queue.join_all();
+        }
+        for (size_t t = 0; t < tasks.size(); t++) {
+            const vector<CTiePt>* pvecRes = tasks[t]->alsc().getRefinedTps();
+            m_pvecRefTP.insert(m_pvecRefTP.end(), pvecRes->begin(), pvecRes->end());
+            vector<int> vecPass = tasks[t]->alsc().getPassList();
+            for (size_t i = 0; i < vecPass.size(); i++)
+                m_vecPassList.push_back(vecPass[i] + vecBegin[t]);
+        }
+        return;
+    }
+
+    //////////////////////////////////////////////////
+    // Start processing for each seed point
+    //////////////////////////////////////////////////
     for (int i = 0; i < nLength; i++) {
         // get a seed point
         Point2f ptStartL, ptStartR;
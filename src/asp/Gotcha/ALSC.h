@@ -39,8 +39,10 @@ public:
     ALSC();
     ALSC(cv::Mat imgL, cv::Mat imgR, CALSCParam paramALSC);
 
-    void performALSC(const std::vector<CTiePt>* pvecTpts , const float* pfAffStart = NULL);   // Nb. it is normally used for TC refinement (i.e., verification)
-                                                                                         // pfAffStart might be needed if ALSC resumes from the previous TP results
+    void performALSC(const std::vector<CTiePt>* pvecTpts , const float* pfAffStart = NULL,   // Nb. it is normally used for TC refinement (i.e., verification)
+                     int nThreads = 1);                                                  // pfAffStart might be needed if ALSC resumes from the previous TP results
+                                                                                         // With more than one thread, the tie points are split among copies of this
+                                                                                         // matcher. The results are the same, and in the same order.
     void getRefinedTps(std::vector<CTiePt>& vecRefTP) const {vecRefTP = m_pvecRefTP;}
     const std::vector<CTiePt>* getRefinedTps() {return &m_pvecRefTP;} // the result which passes the ALSC test
     std::vector<int> getPassList() {return m_vecPassList;}
@@ -52,6 +54,7 @@ private:
     void getGradientX(Eigen::Ref<Eigen::MatrixXf> matSrc);
     void getGradientY(Eigen::Ref<Eigen::MatrixXf> matSrc);
     void distortPatch(const cv::Mat& matImg, const cv::Point2f ptCentre, const float* pfAff, Eigen::Ref<Eigen::MatrixXf> matImgPatch, cv::Point2f* pptUpdated = NULL);
+    bool isPatchInside(const cv::Mat& matImg, const cv::Point2f* pptCorners);
     bool doMatching(cv::Point2f ptStartL, cv::Point2f ptStartR, CTiePt& tp, const float* pfAffInt = NULL);
     void affineTransform(double x, double y, const cv::Point2f ptCentre, const float *pfAff, double *dNewX, double *dNewY);
     float interpolate(double dNewX, double dNewY, const cv::Mat &matImg);
@@ -74,8 +77,12 @@ private:
     int nColPatch;
     int nSystemMatrixRows;
 
-    std::vector<std::vector<float> > pfGx;
-    std::vector<std::vector<float> > pfGy;
+    Eigen::MatrixXf matGx; // gradients of the right patch, zero on the patch border
+    Eigen::MatrixXf matGy;
+
+    // pixel offsets from the patch centre, in the order of the rows of the system matrix
+    Eigen::VectorXf vecOffX;
+    Eigen::VectorXf vecOffY;
 
     Eigen::MatrixXf matPatchL;
     Eigen::MatrixXf matPatchR;
@@ -85,6 +92,12 @@ private:
     Eigen::MatrixXf emA;
     Eigen::VectorXf emB;
 
+    // work buffers for solving it, kept to avoid allocating them on each iteration
+    Eigen::MatrixXf emAT;
+    Eigen::MatrixXf emAS;
+    Eigen::VectorXf emS;
+    Eigen::VectorXf emErrors;
+
     int nParam;
 
     // outputs:
@@ -28,28 +28,45 @@ using namespace std;
 
 namespace gotcha {
   
-// Convert a float image from ASP format to an OpenCV float image
-// and vice-versa. Note that ASP stores an image as col, row.
-  
-void aspMatToCvMat(vw::ImageView<float> const& in, cv::Mat & out) {
-  out = cv::Mat::zeros(in.rows(), in.cols(), CV_32F);
-  for (int row = 0; row < out.rows; row++) {
-    for (int col = 0; col < out.cols; col++) {
-      out.at<float>(row, col) = in(col, row);
-    }
-  }
+// Make an OpenCV float image which shares the memory of an ASP
+// image. Both store the pixels row after row, so no copy is needed.
+// Note that ASP indexes an image as col, row.
+cv::Mat wrapAspMat(vw::ImageView<float> & img) {
+  return cv::Mat(img.rows(), img.cols(), CV_32F, img.data());
 }
 
-void cvMatToAspMat(cv::Mat const& in, vw::ImageView<float> & out) {
-  out.set_size(in.cols, in.rows); 
-  for (int row = 0; row < in.rows; row++) {
-    for (int col = 0; col < in.cols; col++) {
-      out(col, row) = in.at<float>(row, col);
-    }
-  }
+CDensifyParam readGotchaParams(std::string const& strMetaFile) {
+
+  FileStorage fs(strMetaFile, FileStorage::READ);
+  if (!fs.isOpened())
+    vw_throw(ArgumentErr() << "Cannot read CASP-GO parameter file: " << strMetaFile);
+  FileNode tl = fs["sGotchaParam"];
+
+  // read GOTCHA param
+  CDensifyParam paramDense;
+  paramDense.m_nProcType = 0;
+  paramDense.m_paramGotcha.m_fDiffCoef = 0.05;
+  paramDense.m_paramGotcha.m_fDiffThr = 0.1;
+  paramDense.m_paramGotcha.m_nDiffIter = 5;
+  //paramDense.m_paramGotcha.m_nMinTile = (int)tl["nMinTile"];
+  paramDense.m_paramGotcha.m_nNeiType = (int)tl["nNeiType"];
+
+  paramDense.m_paramGotcha.m_paramALSC.m_bIntOffset = (int)tl["bIntOffset"];
+  paramDense.m_paramGotcha.m_paramALSC.m_bWeighting = (int)tl["bWeight"];
+  paramDense.m_paramGotcha.m_paramALSC.m_fAffThr = (float)tl["fAff"];
+  paramDense.m_paramGotcha.m_paramALSC.m_fDriftThr = (float)tl["fDrift"];
+  paramDense.m_paramGotcha.m_paramALSC.m_fEigThr = (float)tl["fMaxEigenValue"];
+  paramDense.m_paramGotcha.m_paramALSC.m_nMaxIter = (int)tl["nALSCIteration"];
+  paramDense.m_paramGotcha.m_paramALSC.m_nPatch = (int)tl["nALSCKernel"];
+
+  // Optional, as older parameter files do not have it
+  if (!tl["bParallelGrowth"].empty())
+    paramDense.m_paramGotcha.m_bParallelGrowth = (int)tl["bParallelGrowth"];
+
+  return paramDense;
 }
   
-CBatchProc::CBatchProc(std::string          const & strMetaFile,
+CBatchProc::CBatchProc(CDensifyParam        const & paramDense,
                        vw::ImageView<float> const & imgL,
                        vw::ImageView<float> const & imgR, 
                        vw::ImageView<float> const & input_dispX,
@@ -62,7 +79,7 @@ CBatchProc::CBatchProc(std::string          const & strMetaFile,
     vw_throw(ArgumentErr() << "Not all inputs have the same dimensions.");
   
   // initialize
-  m_strMetaFile = strMetaFile;
+  m_paramDense = paramDense;
   
 #if 0
   m_strImgL = strLeftImagePath;
@@ -72,11 +89,15 @@ CBatchProc::CBatchProc(std::string          const & strMetaFile,
   m_strOutPath = strOutputPrefix;
 #endif
   
-  // Convert the inputs to cv::Mat, which is what Gotcha prefers
-  aspMatToCvMat(imgL, m_imgL);
-  aspMatToCvMat(imgR, m_imgR);
-  aspMatToCvMat(input_dispX, m_input_dispX);
-  aspMatToCvMat(input_dispY, m_input_dispY);
+  // Wrap the inputs as cv::Mat, which is what Gotcha prefers
+  m_vwImgL  = imgL;
+  m_vwImgR  = imgR;
+  m_vwDispX = input_dispX;
+  m_vwDispY = input_dispY;
+  m_imgL        = wrapAspMat(m_vwImgL);
+  m_imgR        = wrapAspMat(m_vwImgR);
+  m_input_dispX = wrapAspMat(m_vwDispX);
+  m_input_dispY = wrapAspMat(m_vwDispY);
   
   if (!validateProjParam()){
     std::cerr << "ERROR: The project input files cannot be validated" << std::endl;
@@ -469,27 +490,9 @@ void CBatchProc::refinement(std::vector<CTiePt> const& vecTPs,
                             vw::ImageView<float> & output_dispX,
                             vw::ImageView<float> & output_dispY) {
   //std::cout << "Gotcha densification based on existing disparity map:" << std::endl;
-  FileStorage fs(m_strMetaFile, FileStorage::READ);
-  FileNode tl = fs["sGotchaParam"];
-
-  // read GOTCHA param
-  CDensifyParam paramDense;
-  paramDense.m_nProcType = 0;
-  paramDense.m_paramGotcha.m_fDiffCoef = 0.05;
-  paramDense.m_paramGotcha.m_fDiffThr = 0.1;
-  paramDense.m_paramGotcha.m_nDiffIter = 5;
-  //paramDense.m_paramGotcha.m_nMinTile = (int)tl["nMinTile"];
+  CDensifyParam paramDense = m_paramDense;
   //Mat matDummy = imread(m_strImgL, CV_LOAD_IMAGE_ANYDEPTH);
   paramDense.m_paramGotcha.m_nMinTile = m_imgL.cols + m_imgL.rows;
-  paramDense.m_paramGotcha.m_nNeiType = (int)tl["nNeiType"];
-
-  paramDense.m_paramGotcha.m_paramALSC.m_bIntOffset = (int)tl["bIntOffset"];
-  paramDense.m_paramGotcha.m_paramALSC.m_bWeighting = (int)tl["bWeight"];
-  paramDense.m_paramGotcha.m_paramALSC.m_fAffThr = (float)tl["fAff"];
-  paramDense.m_paramGotcha.m_paramALSC.m_fDriftThr = (float)tl["fDrift"];
-  paramDense.m_paramGotcha.m_paramALSC.m_fEigThr = (float)tl["fMaxEigenValue"];
-  paramDense.m_paramGotcha.m_paramALSC.m_nMaxIter = (int)tl["nALSCIteration"];
-  paramDense.m_paramGotcha.m_paramALSC.m_nPatch = (int)tl["nALSCKernel"];
 
 #if 0
   string strBase = m_strOutPath;
@@ -514,15 +517,17 @@ void CBatchProc::refinement(std::vector<CTiePt> const& vecTPs,
   CDensify densify(paramDense, vecTPs, m_imgL, m_imgR, m_input_dispX, m_input_dispY, m_Mask);
   //std::cout << "CASP-GO INFO: performing Gotcha densification" << std::endl;
 
-  cv::Mat cv_output_dispX, cv_output_dispY;
+  // Gotcha writes the results directly to the memory of the outputs
+  output_dispX.set_size(m_imgL.cols, m_imgL.rows);
+  output_dispY.set_size(m_imgL.cols, m_imgL.rows);
+  cv::Mat cv_output_dispX = wrapAspMat(output_dispX);
+  cv::Mat cv_output_dispY = wrapAspMat(output_dispY);
+  cv_output_dispX.setTo(0.0);
+  cv_output_dispY.setTo(0.0);
   int nErrCode = densify.performDensitification(cv_output_dispX, cv_output_dispY);
   if (nErrCode != CDensifyParam::NO_ERR){
     std::cerr << "Warning: Processing error on densifying operation (ERROR CODE: " << nErrCode << " )" << std::endl;
   }
-
-  // Export the data to ASP
-  cvMatToAspMat(cv_output_dispX, output_dispX);
-  cvMatToAspMat(cv_output_dispY, output_dispY);
 }
 
 Point3f CBatchProc::rotate(Point3f ptIn, Mat matQ, bool bInverse){
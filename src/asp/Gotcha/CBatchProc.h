@@ -27,6 +27,8 @@
 #include <opencv2/imgproc/imgproc.hpp>
 
 #include <asp/Gotcha/CTiePt.h>
+#include <asp/Gotcha/CDensifyParam.h>
+#include <asp/Core/Tracing.h>
 
 #include <iostream>
 #include <fstream>
@@ -35,9 +37,15 @@
 
 namespace gotcha {
 
+// Read the Gotcha parameters from a CASP-GO parameter file. This is
+// done once, and the result is shared by all tiles.
+CDensifyParam readGotchaParams(std::string const& strMetaFile);
+
 class CBatchProc {
 public:
-  CBatchProc(std::string          const & strMetaFile,
+  // The inputs are not copied. Gotcha works on cv::Mat headers pointing
+  // to their memory, and may modify the input disparities.
+  CBatchProc(CDensifyParam        const & paramDense,
              vw::ImageView<float> const & imgL,
              vw::ImageView<float> const & imgR, 
              vw::ImageView<float> const & input_dispX,
@@ -65,7 +73,7 @@ protected:
                   vw::ImageView<float> & output_dispY);
 
 protected:
-  std::string m_strMetaFile;   // file path to the Metadata file
+  CDensifyParam m_paramDense;
 #if 0
   std::string m_strImgL;
   std::string m_strImgR;
@@ -76,6 +84,11 @@ protected:
   std::string m_strOutPath;    // a user-supplied file path for the output directory
 #endif
   
+  // Shallow copies of the inputs, to keep their memory alive while
+  // the cv::Mat headers below point to it.
+  vw::ImageView<float> m_vwImgL, m_vwImgR;
+  vw::ImageView<float> m_vwDispX, m_vwDispY;
+
   cv::Mat m_imgL, m_imgR;
   cv::Mat m_input_dispX, m_input_dispY;
   cv::Mat m_Mask;
@@ -86,7 +99,7 @@ class GotchaPerBlockView: public vw::ImageViewBase<GotchaPerBlockView>{
   vw::ImageViewRef<vw::PixelMask<vw::Vector2f>> m_input_disp;
   vw::ImageViewRef<float> m_left_img, m_right_img;
   int m_padding;
-  std::string m_casp_go_param_file;
+  CDensifyParam m_param;
   
   typedef vw::PixelMask<vw::Vector2f> PixelT;
 
@@ -94,9 +107,12 @@ public:
   GotchaPerBlockView(vw::ImageViewRef<vw::PixelMask<vw::Vector2f>> input_disp,
                      vw::ImageViewRef<float> left_img,
                      vw::ImageViewRef<float> right_img,
-                     int padding, std::string const& casp_go_param_file):
+                     int padding, std::string const& casp_go_param_file,
+                     int num_threads_per_tile):
     m_input_disp(input_disp), m_left_img(left_img), m_right_img(right_img),
-    m_padding(padding), m_casp_go_param_file(casp_go_param_file){}
+    m_padding(padding), m_param(readGotchaParams(casp_go_param_file)){
+    m_param.m_paramGotcha.m_nThreads = num_threads_per_tile;
+  }
   
   typedef PixelT pixel_type;
   typedef PixelT result_type;
@@ -116,6 +132,7 @@ public:
   typedef vw::CropView<vw::ImageView<pixel_type>> prerasterize_type;
   inline prerasterize_type prerasterize(vw::BBox2i const& bbox) const {
 
+    asp::TraceSpan span("gotcha_tile", bbox);
     // Need to see a bit more of the input image to avoid tiling artifacts
     vw::BBox2i biased_box = bbox;
     biased_box.expand(m_padding);
@@ -124,12 +141,12 @@ public:
     // Run Gotcha on the expanded and cropped tile.
     // TODO(oalexan1): Verify that it assumes a value of 0 for invalid disparities
     vw::ImageView<result_type> cropped_disp = crop(m_input_disp, biased_box);
+    vw::ImageView<float> left_img = crop(m_left_img, biased_box);
+    vw::ImageView<float> right_img = crop(m_right_img, biased_box);
+    vw::ImageView<float> input_dispX = vw::select_channel(cropped_disp, 0);
+    vw::ImageView<float> input_dispY = vw::select_channel(cropped_disp, 1);
     vw::ImageView<float> output_dispX, output_dispY;
-    CBatchProc batchProc(m_casp_go_param_file,
-                         crop(m_left_img, biased_box), 
-                         crop(m_right_img, biased_box), 
-                         vw::select_channel(cropped_disp, 0),
-                         vw::select_channel(cropped_disp, 1));
+    CBatchProc batchProc(m_param, left_img, right_img, input_dispX, input_dispY);
     batchProc.doBatchProcessing(output_dispX, output_dispY);
     
     // Integrate back the processed bands.
@@ -146,11 +163,16 @@ public:
   }
 };
 
+// The tiles are refined in parallel. When there are fewer tiles than
+// threads, set num_threads_per_tile to have the refinement of each
+// tile use several threads as well.
 GotchaPerBlockView gotcha_refine(vw::ImageViewRef<vw::PixelMask<vw::Vector2f>> input_disp,
                                  vw::ImageViewRef<float> left_img,
                                  vw::ImageViewRef<float> right_img,
-                                 int padding, std::string const& casp_go_param_file){
-  return GotchaPerBlockView(input_disp, left_img, right_img, padding, casp_go_param_file);
+                                 int padding, std::string const& casp_go_param_file,
+                                 int num_threads_per_tile = 1){
+  return GotchaPerBlockView(input_disp, left_img, right_img, padding, casp_go_param_file,
+                            num_threads_per_tile);
 }
 
 } // end namespace gotcha
@@ -18,7 +18,14 @@
 #include <asp/Gotcha/CDensify.h>
 #include <asp/Gotcha/ALSC.h>
 
+#include <vw/Core/ThreadPool.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <deque>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <cmath>
 
@@ -177,6 +184,13 @@ int CDensify::performDensitification(cv::Mat & output_dispX, cv::Mat & output_di
 vector<CTiePt> CDensify::getIntToFloatSeed(vector<CTiePt>& vecTPSrc) {
     vector<CTiePt> vecRes;
 
+    // The four integer seeds around each float seed are validated with
+    // a single ALSC call for all of them, which can use several threads.
+    // vecGroup[i] is where the seeds of vecTPSrc[i] start in vectpSeeds,
+    // or -1 if it is an integer seed already.
+    vector<CTiePt> vectpSeeds;
+    vector<int> vecGroup;
+
     int nLen =  vecTPSrc.size();
     for (int i = 0; i < nLen; i++){
         //get four neighbours
@@ -188,7 +202,7 @@ vector<CTiePt> CDensify::getIntToFloatSeed(vector<CTiePt>& vecTPSrc) {
         dX = floor(ptL.x) - ptL.x;
         dY = floor(ptL.y) - ptL.y;
         if (dX == 0 && dY == 0){
-            vecRes.push_back(tp);
+            vecGroup.push_back(-1);
             continue;
         }
 
@@ -199,8 +213,8 @@ vector<CTiePt> CDensify::getIntToFloatSeed(vector<CTiePt>& vecTPSrc) {
         /////////////////////////////////////////////////////
         // collect 4 integer seed and validate
         /////////////////////////////////////////////////////
+        vecGroup.push_back(vectpSeeds.size());
         CTiePt tpTemp = tp;
-        vector<CTiePt> vectpSeeds;
         // pt1 (top-left)
         tpTemp.m_ptL = ptIntL;
         tpTemp.m_ptR = ptIntR;
@@ -219,18 +233,31 @@ vector<CTiePt> CDensify::getIntToFloatSeed(vector<CTiePt>& vecTPSrc) {
         tpTemp.m_ptL = ptIntL + Point2f(1, 1);
         tpTemp.m_ptR = ptIntR + Point2f(1, 1);
         vectpSeeds.push_back(tpTemp);
+    }
 
-        //apply ALSC to collect as new seed
+    //apply ALSC to collect as new seed
+    vector<CTiePt> vecRefined;
+    vector<int> vecPass;
+    if (!vectpSeeds.empty()){
         ALSC alsc(m_imgL, m_imgR,  m_paramDense.m_paramGotcha.m_paramALSC);
-        alsc.performALSC(&vectpSeeds);
-        vectpSeeds.clear();
-        alsc.getRefinedTps(vectpSeeds); // hard-copy
+        alsc.performALSC(&vectpSeeds, NULL, m_paramDense.m_paramGotcha.m_nThreads);
+        alsc.getRefinedTps(vecRefined); // hard-copy
+        vecPass = alsc.getPassList();
+    }
 
-        for (int j = 0; j < (int)vectpSeeds.size(); j++){
-            CTiePt tpRef = vectpSeeds.at(j);
+    // Put together the results in the order of the input seeds
+    int nPass = 0;
+    for (int i = 0; i < nLen; i++){
+        if (vecGroup[i] < 0){
+            vecRes.push_back(vecTPSrc.at(i));
+            continue;
+        }
+        while (nPass < (int)vecPass.size() && vecPass[nPass] < vecGroup[i] + 4){
+            CTiePt tpRef = vecRefined.at(nPass);
             if (tpRef.m_fSimVal != CTiePt::NOT_DEF){
                 vecRes.push_back(tpRef);
             }
+            nPass++;
         }
     }
 
@@ -357,8 +384,12 @@ bool CDensify::saveResult(cv::Mat & output_dispX, cv::Mat & output_dispY){
     
     //cout << "Writing results..." << endl;
 
-    output_dispX = Mat::ones(m_matDisMapX.size(), CV_32FC1)*0.0;
-    output_dispY = Mat::ones(m_matDisMapY.size(), CV_32FC1)*0.0;
+    // If the outputs already have the right size and type, as when they
+    // wrap the memory of the caller's images, they are filled in place.
+    output_dispX.create(m_matDisMapX.size(), CV_32FC1);
+    output_dispY.create(m_matDisMapY.size(), CV_32FC1);
+    output_dispX.setTo(0.0);
+    output_dispY.setTo(0.0);
 
     for (int i =0; i<output_dispX.rows; i++){
         for (int j=0; j<output_dispX.cols; j++){
@@ -671,7 +702,7 @@ void CDensify::removeOutsideImage(vector<CTiePt>& vecNeiTp, const Rect_<float> r
 
 }
 
-void CDensify::removePtInLUT(vector<CTiePt>& vecNeiTp, const vector<bool>& pLUT, const int nWidth){
+void CDensify::removePtInLUT(vector<CTiePt>& vecNeiTp, const vector<unsigned char>& pLUT, const int nWidth){
     vector<CTiePt>::iterator iter;
 
     for (iter = vecNeiTp.begin(); iter < vecNeiTp.end(); ){        
@@ -751,13 +782,8 @@ bool CDensify::doGotcha(const Mat& matImgL, const Mat& matImgR, vector<CTiePt>&
     // cout << "CASP-GO INFO: initialising pixel LUT" << endl;
 
     // IMARS bool pLUT[szImgL.area()]; // if true it indicates the pixel has already processed
-    vector<bool> pLUT; //IMARS
-
-    // initialise
-    for (int i = 0; i< szImgL.area(); i++){
-        bool bpLUT = false; //IMARS
-        pLUT.push_back(bpLUT); //IMARS
-    } //IMARS
+    // Not a vector<bool>, so that sub-blocks can be grown in parallel
+    vector<unsigned char> pLUT(szImgL.area(), false); //IMARS
 
     vector< Rect_<float> > vecRectTiles;
     vecRectTiles.push_back(Rect(0., 0., matImgL.cols, matImgL.rows));
@@ -768,7 +794,7 @@ bool CDensify::doGotcha(const Mat& matImgL, const Mat& matImgR, vector<CTiePt>&
     if (paramGotcha.m_bNeedInitALSC){
         // cout << "CASP-GO INFO: Running initial ALSC refinement" << endl;
         ALSC alsc(matImgL, matImgR, paramGotcha.m_paramALSC);
-        alsc.performALSC(&vectpSeeds);
+        alsc.performALSC(&vectpSeeds, NULL, paramGotcha.m_nThreads);
         vectpSeeds.clear();
         alsc.getRefinedTps(vectpSeeds); // hard-copy
     }
@@ -804,6 +830,13 @@ bool CDensify::doGotcha(const Mat& matImgL, const Mat& matImgR, vector<CTiePt>&
     vectpAdded.clear();
     //cout << "CASP-GO INFO: Desifying disparity... ..." << endl;
 
+    // The diffused neighbours of a point are found from the similarity
+    // map around it, which could then be written by another thread.
+    if (paramGotcha.m_nThreads > 1 && paramGotcha.m_bParallelGrowth &&
+        paramGotcha.m_nNeiType != CGOTCHAParam::NEI_DIFF)
+        return doParallelGotcha(matImgL, matImgR, vectpSeeds, paramGotcha, vectpAdded,
+                                matSimMap, pLUT);
+
     for (int i = 0 ; i < (int)vecRectTiles.size(); i++){
           vector<CTiePt> vecRes;
           bRes = bRes && doTileGotcha(matImgL, matImgR, vectpSeeds, paramGotcha, vecRes, vecRectTiles.at(i), matSimMap, pLUT);
@@ -821,9 +854,9 @@ bool CDensify::doGotcha(const Mat& matImgL, const Mat& matImgR, vector<CTiePt>&
 bool CDensify::doTileGotcha(const Mat& matImgL, const Mat& matImgR, const
                             vector<CTiePt>& vectpSeeds,
                             const CGOTCHAParam& paramGotcha, vector<CTiePt>& vectpAdded,
-                            const Rect_<float> rectTileL, Mat& matSimMap, vector<bool>& pLUT){
+                            const Rect_<float> rectTileL, Mat& matSimMap, vector<unsigned char>& pLUT){
 
-    vector<CTiePt> vectpSeedTPs; //= vectpSeeds;                // need this hard copy for sorting
+    deque<CTiePt> vectpSeedTPs; //= vectpSeeds;                // need this hard copy for sorting
 
     Size szImgL(matImgL.cols, matImgL.rows);
     Rect_<float> rectImgR (0, 0, matImgR.cols, matImgR.rows);
@@ -840,6 +873,8 @@ bool CDensify::doTileGotcha(const Mat& matImgL, const Mat& matImgR, const
     }
     //std::cout << "Reading mask: " << paramGotcha.m_strMask << std::endl;
     //Mat Mask = imread(paramGotcha.m_strMask, CV_LOAD_IMAGE_ANYDEPTH);
+#if 0
+    // The gap size is only needed for the progress messages, which are hidden
     Mat imgL = matImgL;
     Mat imgR = matImgR;
     imgL.convertTo(imgL, CV_8UC1);
@@ -853,6 +888,7 @@ bool CDensify::doTileGotcha(const Mat& matImgL, const Mat& matImgR, const
                 nGapSize+=1;
         }
     }
+#endif
 
     //sort(vectpSeedTPs.begin(), vectpSeedTPs.end(), compareTP); // sorted in ascending order
     /////////////////////////////////////////////////////////////////////
@@ -863,12 +899,17 @@ bool CDensify::doTileGotcha(const Mat& matImgL, const Mat& matImgR, const
       cout << "[--------------------]  0% OF THE GAP AREA HAS BEEN DENSIFIED\r" << std::flush;
 #endif
       
+    // The same matcher is used for all seeds, so that its work buffers
+    // are allocated once per tile rather than once per seed. It keeps
+    // no state from one call to performALSC() to the next.
+    ALSC alsc(matImgL, matImgR, paramGotcha.m_paramALSC);
+
     while (vectpSeedTPs.size() > 0) {
         // get a point from seed
-        CTiePt tp = vectpSeedTPs.at(0);
+        CTiePt tp = vectpSeedTPs.front();
 
 //        mvectpAdded.push_back(tp);
-        vectpSeedTPs.erase(vectpSeedTPs.begin());
+        vectpSeedTPs.pop_front();
         vector<CTiePt> vecNeiTp;        
         getNeighbour(tp, vecNeiTp, paramGotcha.m_nNeiType, matSimMap);
         removeOutsideImage(vecNeiTp, rectTileL, rectImgR);
@@ -883,8 +924,6 @@ bool CDensify::doTileGotcha(const Mat& matImgL, const Mat& matImgR, const
             pfData[4] = tp.m_ptOffset.x;
             pfData[5] = tp.m_ptOffset.y;
 
-            ALSC alsc(matImgL, matImgR, paramGotcha.m_paramALSC);
-
             alsc.performALSC(&vecNeiTp, (float*) pfData);
             const vector<CTiePt>* pvecRefTPtemp = alsc.getRefinedTps();
 
@@ -962,6 +1001,91 @@ bool CDensify::doTileGotcha(const Mat& matImgL, const Mat& matImgR, const
     return true;
 }
 
+namespace {
+
+  // Run a function in a thread of a work queue
+  class FunctionTask: public vw::Task, private boost::noncopyable {
+    std::function<void()> m_fun;
+  public:
+    FunctionTask(std::function<void()> const& fun): m_fun(fun) {}
+    virtual void operator()() { m_fun(); }
+  };
+
+  // If a point can grow out of its sub-block
+  bool isNextToBorder(Point2f const& pt, Rect_<float> const& rect){
+    return !rect.contains(pt + Point2f(-1, -1)) || !rect.contains(pt + Point2f(1, 1));
+  }
+
+}
+
+bool CDensify::doParallelGotcha(const Mat& matImgL, const Mat& matImgR,
+                                const vector<CTiePt>& vectpSeeds,
+                                const CGOTCHAParam& paramGotcha, vector<CTiePt>& vectpAdded,
+                                Mat& matSimMap, vector<unsigned char>& pLUT){
+
+    // Make several sub-blocks per thread, so that the threads which
+    // finish theirs early take on the rest, as the seeds are rarely
+    // spread evenly. Do not make them too small for the matching patch.
+    int nThreads = paramGotcha.m_nThreads;
+    int nMinSize = 4 * paramGotcha.m_paramALSC.m_nPatch + 2;
+    vector< Rect_<float> > vecBlocks;
+    vecBlocks.push_back(Rect_<float>(0, 0, matImgL.cols, matImgL.rows));
+    while ((int)vecBlocks.size() < 4 * nThreads &&
+           vecBlocks[0].width / 2 >= nMinSize && vecBlocks[0].height / 2 >= nMinSize){
+        vector< Rect_<float> > vecChildren;
+        for (size_t b = 0; b < vecBlocks.size(); b++)
+            breakIntoSubRect(vecBlocks[b], vecChildren);
+        vecBlocks.swap(vecChildren);
+    }
+
+    // The sub-blocks do not overlap and growth stays within each, so
+    // each pixel of the LUT and similarity map is written by one thread.
+    int nBlocks = vecBlocks.size();
+    vector< vector<CTiePt> > vecBlockAdded(nBlocks);
+    vector<char> vecBlockRes(nBlocks, true);
+    {
+        vw::FifoWorkQueue queue(nThreads);
+        for (int b = 0; b < nBlocks; b++){
+            std::function<void()> fun = [&, b](){
+                vecBlockRes[b] = doTileGotcha(matImgL, matImgR, vectpSeeds, paramGotcha,
+                                              vecBlockAdded[b], vecBlocks[b], matSimMap, pLUT);
+            };
+            queue.add_task(boost::shared_ptr<vw::Task>(new FunctionTask(fun)));
+        }
+        queue.join_all();
+    }
+
+    bool bRes = true;
+    vector<CTiePt> vecBorderTPs;
+    for (int b = 0; b < nBlocks; b++){
+        bRes = bRes && vecBlockRes[b];
+        vectpAdded.insert(vectpAdded.end(), vecBlockAdded[b].begin(), vecBlockAdded[b].end());
+        for (size_t i = 0; i < vecBlockAdded[b].size(); i++){
+            if (isNextToBorder(vecBlockAdded[b][i].m_ptL, vecBlocks[b]))
+                vecBorderTPs.push_back(vecBlockAdded[b][i]);
+        }
+    }
+    for (size_t i = 0; i < vectpSeeds.size(); i++){
+        for (int b = 0; b < nBlocks; b++){
+            if (vecBlocks[b].contains(vectpSeeds[i].m_ptL)){
+                if (isNextToBorder(vectpSeeds[i].m_ptL, vecBlocks[b]))
+                    vecBorderTPs.push_back(vectpSeeds[i]);
+                break;
+            }
+        }
+    }
+
+    // Continue growing from the points at the borders over the whole
+    // tile. The pixels already matched are skipped, so this only fills
+    // what the sub-blocks could not reach from their own seeds.
+    vector<CTiePt> vecRes;
+    bRes = bRes && doTileGotcha(matImgL, matImgR, vecBorderTPs, paramGotcha, vecRes,
+                                Rect_<float>(0, 0, matImgL.cols, matImgL.rows), matSimMap, pLUT);
+    vectpAdded.insert(vectpAdded.end(), vecRes.begin(), vecRes.end());
+
+    return bRes;
+}
+
 bool CDensify::doPGotcha(int nNeiType){
 
     // pyramid construction
@@ -974,7 +1098,7 @@ bool CDensify::doPGotcha(int nNeiType){
     vector<CTiePt> vecOrgSeedClone = getIntToFloatSeed(m_vecTPs);
     if (m_paramDense.m_paramGotcha.m_bNeedInitALSC){
         ALSC alsc(m_imgL, m_imgR, m_paramDense.m_paramGotcha.m_paramALSC);
-        alsc.performALSC(&vecOrgSeedClone);
+        alsc.performALSC(&vecOrgSeedClone, NULL, m_paramDense.m_paramGotcha.m_nThreads);
         vecOrgSeedClone.clear();
         alsc.getRefinedTps(vecOrgSeedClone); // hard-copy
     }
@@ -49,6 +49,7 @@
 // This is work in progess.
 
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/FileIO/DiskImageView.h>
 #include <vw/Cartography/Datum.h>
 #include <vw/Cartography/GeoReference.h>
@@ -61,6 +62,7 @@
 #include <limits>
 #include <cstring>
 #include <ctime>
+#include <map>
 
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
@@ -161,7 +163,105 @@ double parse_time(std::string& time_str){
   return double(timeSinceEpoch) + (sec - int(sec)); // add back the fractional part
 }
 
-  
+// The CSV points are grouped by the block of the DEM they fall in, so
+// each block is read once, and the blocks are processed in parallel.
+const int CSV_FILTER_BLOCK_SIZE = 512;
+
+// Keep the CSV points in a block of the DEM whose height is close
+// enough to the DEM, and find their projected coordinates
+class CsvFilterTask: public vw::Task, private boost::noncopyable {
+  DiskImageView<double> const& m_dem;
+  double m_dem_nodata, m_max_height_diff;
+  GeoReference const& m_dem_georef;
+  std::vector<Vector3> const& m_csv_llh;
+  std::vector<Vector2> const& m_csv_pix;
+  std::vector<int> const& m_indices; // the points in this block
+  BBox2i m_block;
+  std::vector<Vector3> & m_points;
+  std::vector<char> & m_keep;
+
+public:
+  CsvFilterTask(DiskImageView<double> const& dem, double dem_nodata, double max_height_diff,
+                GeoReference const& dem_georef, std::vector<Vector3> const& csv_llh,
+                std::vector<Vector2> const& csv_pix, std::vector<int> const& indices,
+                BBox2i const& block, std::vector<Vector3> & points, std::vector<char> & keep):
+    m_dem(dem), m_dem_nodata(dem_nodata), m_max_height_diff(max_height_diff),
+    m_dem_georef(dem_georef), m_csv_llh(csv_llh), m_csv_pix(csv_pix), m_indices(indices),
+    m_block(block), m_points(points), m_keep(keep) {}
+
+  void operator()() {
+    // Bicubic interpolation needs two more pixels on each side. At the
+    // DEM boundary the edge extension is the same as for the whole DEM.
+    BBox2i box = m_block;
+    box.expand(2);
+    box.crop(bounding_box(m_dem));
+    ImageView<double> dem_crop = crop(m_dem, box);
+    ImageViewRef< PixelMask<double> > interp_dem
+      = interpolate(create_mask(dem_crop, m_dem_nodata),
+                    BicubicInterpolation(), ConstantEdgeExtension());
+
+    // Object used to do geodetic_to_point
+    GeodeticToPoint G2P(m_dem_georef);
+
+    for (size_t i = 0; i < m_indices.size(); i++) {
+      int it = m_indices[i];
+      Vector2 pix = m_csv_pix[it] - box.min();
+      PixelMask<double> dem_ht = interp_dem(pix[0], pix[1]);
+      if (!is_valid(dem_ht))
+        continue;
+
+      Vector3 llh = m_csv_llh[it];
+      double diff = llh[2] - dem_ht.child();
+      if (std::abs(diff) > m_max_height_diff)
+        continue;
+
+      m_points[it] = G2P(llh); // geodetic to point
+      m_keep[it] = 1;
+    }
+  }
+};
+
+// Filter the CSV points in parallel. Each point is kept or not, in the input order.
+void filter_csv_points(DiskImageView<double> const& dem, double dem_nodata,
+                       double max_height_diff, GeoReference const& dem_georef,
+                       std::vector<Vector3> const& csv_llh,
+                       std::vector<Vector3> & points, std::vector<char> & keep) {
+
+  points.assign(csv_llh.size(), Vector3());
+  keep.assign(csv_llh.size(), 0);
+
+  // Group the points in range by DEM block
+  std::vector<Vector2> csv_pix(csv_llh.size());
+  std::map<std::pair<int, int>, std::vector<int>> blocks;
+  for (int it = 0; it < int(csv_llh.size()); it++) {
+    Vector2 ll  = subvector(csv_llh[it], 0, 2);
+    Vector2 pix = dem_georef.lonlat_to_pixel(ll);
+    csv_pix[it] = pix;
+
+    // Check for out of range
+    bool out_of_range = (pix[0] < 0 || pix[0] > dem.cols() - 1 ||
+                         pix[1] < 0 || pix[1] > dem.rows() - 1);
+    if (out_of_range) continue;
+
+    std::pair<int, int> block(int(pix[0]) / CSV_FILTER_BLOCK_SIZE,
+                              int(pix[1]) / CSV_FILTER_BLOCK_SIZE);
+    blocks[block].push_back(it);
+  }
+
+  FifoWorkQueue queue(vw_settings().default_num_threads());
+  for (auto it = blocks.begin(); it != blocks.end(); it++) {
+    BBox2i block(it->first.first * CSV_FILTER_BLOCK_SIZE,
+                 it->first.second * CSV_FILTER_BLOCK_SIZE,
+                 CSV_FILTER_BLOCK_SIZE, CSV_FILTER_BLOCK_SIZE);
+    block.crop(bounding_box(dem));
+    boost::shared_ptr<CsvFilterTask>
+      task(new CsvFilterTask(dem, dem_nodata, max_height_diff, dem_georef, csv_llh,
+                             csv_pix, it->second, block, points, keep));
+    queue.add_task(task);
+  }
+  queue.join_all();
+}
+
 int main(int argc, char *argv[]) {
 
   Options opt;
@@ -229,14 +329,6 @@ int main(int argc, char *argv[]) {
       }
     }
 
-    // We will interpolate into the DEM to find the difference
-    ImageViewRef< PixelMask<double> > interp_dem
-      = interpolate(create_mask(dem, dem_nodata),
-		    BicubicInterpolation(), ConstantEdgeExtension());
-
-    // Object used to do geodetic_to_point
-    GeodeticToPoint G2P(dem_georef);
-
     // If two time stamps differ by more than this, we declare them in
     // different groups.
     //double spacing = 60;
@@ -260,30 +352,20 @@ int main(int argc, char *argv[]) {
       //std::ofstream bf("tmp_before.txt");
       //bf.precision(18);
       
+      // Compare the CSV points with the DEM
+      std::vector<Vector3> points;
+      std::vector<char> keep;
+      filter_csv_points(dem, dem_nodata, opt.max_height_diff, dem_georef,
+                        csv_llh, points, keep);
+
       vw_out() << "Saving the values in the projected coordiante system to: "
 	       << opt.projected_point_file << std::endl;
       for (int it = 0; it < int(csv_llh.size()); it++) {
-      
-	Vector3 llh = csv_llh[it];
-	Vector2 ll  = subvector(llh, 0, 2);
-	Vector2 pix = dem_georef.lonlat_to_pixel(ll);
-      
-	// Check for out of range
-	bool out_of_range = (pix[0] < 0 || pix[0] > dem.cols() - 1 ||
-			     pix[1] < 0 || pix[1] > dem.rows() - 1);
-
-	if (out_of_range) continue;
-	
-	PixelMask<double> dem_ht = interp_dem(pix[0], pix[1]);
-	if (!is_valid(dem_ht))
-	  continue;
-	
-	double diff = llh[2] - dem_ht.child();
-	
-	if (std::abs(diff) > opt.max_height_diff)
+
+	if (!keep[it])
 	  continue;
 
-	Vector3 point = G2P(llh); // geodetic to point
+	Vector3 point = points[it];
 	phandle << point[0] << ' ' << point[1] << ' ' << point[2] << std::endl;
 
 #if 0
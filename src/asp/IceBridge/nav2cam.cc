@@ -50,6 +50,9 @@
 #include <vw/Math/Matrix.h>
 #include <vw/Camera/PinholeModel.h>
 #include <vw/Camera/Extrinsics.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
+#include <algorithm>
 #include <ctime>
 #include <stdlib.h>
 
@@ -311,10 +314,12 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 
 
 /**
-  Class which loads an Icebridge nav file in chunks and provides an interpolator
-   for each chunk.
+  The samples of an Icebridge nav file, loaded once and sorted by time, so
+  that the samples around any time are found with a binary search. That
+  makes the frames independent of each other, so they can be processed
+  concurrently.
 */
-class ScrollingNavInterpolator {
+class NavTable {
 public:
 
   // TODO: Is the rotation interpolation method ok?  It is the only
@@ -322,154 +327,70 @@ public:
   typedef vw::camera::LagrangianInterpolationVarTime PosInterpType;
   typedef vw::camera::LagrangianInterpolationVarTime RotInterpType;
 
-  // Open the file
-  ScrollingNavInterpolator(std::string const& path, Datum const& datum_in)
-    : m_datum(datum_in) {
-    m_input_stream.open(path.c_str());
-    
-    // Load the nav file in chunks of this size
-    const size_t INTERPOLATE_CHUNK_LENGTH  = 10000;
-    const size_t INTERPOLATE_CHUNK_OVERLAP = 1000; // Overlap between chunks
-    m_chunk_length  = INTERPOLATE_CHUNK_LENGTH;
-    m_chunk_overlap = INTERPOLATE_CHUNK_OVERLAP;
-    
-    // Init vectors to a fixed size
-    m_time_vector.resize(INTERPOLATE_CHUNK_LENGTH);
-    m_loc_vector.resize (INTERPOLATE_CHUNK_LENGTH);
-    m_rot_vector.resize (INTERPOLATE_CHUNK_LENGTH);
-    
-    m_first_chunk = true;
-  }
-  
-  ~ScrollingNavInterpolator() {
-    m_input_stream.close();
+  /// Read and parse all lines of the file
+  void load(std::string const& path, Datum const& datum) {
+    std::ifstream input_stream(path.c_str());
+    if (!input_stream)
+      vw_throw(IOErr() << "Cannot open: " << path << "\n");
+
+    std::string line;
+    while (getline(input_stream, line)) {
+      double time, lat, lon, alt, roll, pitch, heading;
+      scan_line(line, time, lat, lon, alt, roll, pitch, heading);
+      if (!m_time_vector.empty() && time < m_time_vector.back())
+        vw_throw(ArgumentErr() << "The nav file is not sorted by time, at line: " << line << "\n");
+      m_time_vector.push_back(time);
+      m_loc_vector.push_back(datum.geodetic_to_cartesian(Vector3(lon, lat, alt)));
+      m_rot_vector.push_back(Vector3(roll, pitch, heading));
+    }
   }
 
-  /// Set up the next interpolator
-  /// - Returns false if the end of the file was reached
-  bool load_next_chunk(boost::shared_ptr<PosInterpType> &pos_interpolator_ptr,
-                       boost::shared_ptr<PosInterpType> &rot_interpolator_ptr) {
+  size_t size() const { return m_time_vector.size(); }
 
-    if (m_input_stream.bad())
-      return false;
-  
-    size_t index = 0;
-    
-    if (!m_first_chunk) {
-      // Copy N values from the end of the vectors to the beginning
-      const size_t end_index = m_chunk_length - m_chunk_overlap;
-      for (index=0; index<m_chunk_overlap; ++index) {
-        m_time_vector[index] = m_time_vector[end_index+index];
-        m_loc_vector [index] = m_loc_vector [end_index+index];
-        m_rot_vector [index] = m_rot_vector [end_index+index];
-      }
-    }
-    else
-      m_first_chunk = false;
-    
-    // Populate rest of the vectors by reading from the file
-    double  time;
-    Vector3 loc, angles;
-    while (read_next_line(time, loc, angles)){
-      m_time_vector[index] = time;
-      m_loc_vector [index] = loc;
-      m_rot_vector [index] = angles;
-      ++index;
-      if (index == m_chunk_length)
-        break;
-    }
+  /// If there are samples at least margin seconds before and after this time
+  bool covers(double time, double margin) const {
+    return !m_time_vector.empty() &&
+      time >= m_time_vector.front() + margin && time <= m_time_vector.back() - margin;
+  }
+
+  /// Set up interpolators using the samples within margin seconds of the
+  /// given time. The interpolation only uses a few samples around each
+  /// time, so this gives the same result as using all of them.
+  void make_interpolators(double time, double margin,
+                          boost::shared_ptr<PosInterpType> &pos_interpolator_ptr,
+                          boost::shared_ptr<RotInterpType> &rot_interpolator_ptr) const {
+    size_t beg = std::lower_bound(m_time_vector.begin(), m_time_vector.end(),
+                                  time - margin) - m_time_vector.begin();
+    size_t end = std::upper_bound(m_time_vector.begin(), m_time_vector.end(),
+                                  time + margin) - m_time_vector.begin();
+    std::vector<double > times(m_time_vector.begin() + beg, m_time_vector.begin() + end);
+    std::vector<Vector3> locs (m_loc_vector.begin()  + beg, m_loc_vector.begin()  + end);
+    std::vector<Vector3> rots (m_rot_vector.begin()  + beg, m_rot_vector.begin()  + end);
     
-    // If we hit the end of the file just return false, hopefully no camera
-    //  data is right at the end of the file!
-    if (index < m_chunk_length)
-      return false;
-  
-    // Set up the interpolator
     const int INTERP_RADIUS = 4;  
-    pos_interpolator_ptr = boost::shared_ptr<PosInterpType>(
-          new PosInterpType(m_loc_vector, m_time_vector, INTERP_RADIUS));
-    rot_interpolator_ptr = boost::shared_ptr<RotInterpType>(
-          new RotInterpType(m_rot_vector, m_time_vector, INTERP_RADIUS));
-              
-    return true;
-  }
-  
-  /// Return the time boundaries of the current interpolator
-  void get_time_boundaries(double &start, double &end) const {
-    start = m_time_vector.front();
-    end   = m_time_vector.back ();
+    pos_interpolator_ptr.reset(new PosInterpType(locs, times, INTERP_RADIUS));
+    rot_interpolator_ptr.reset(new RotInterpType(rots, times, INTERP_RADIUS));
   }
 
-  /// Load a target location vector.
-  void set_target_locs(std::vector<Vector3> const& target_locs) {
-    m_target_loc_vector = target_locs;
-    m_target_distance_vector.resize(m_target_loc_vector.size());
-    m_target_time_vector.resize    (m_target_loc_vector.size());
-    for (size_t i=0; i<m_target_distance_vector.size(); ++i) {
-      m_target_distance_vector[i] = 999999999;
-      m_target_time_vector    [i] = -1;
+  /// Find the time of the sample closest to the given location
+  void closest_sample(Vector3 const& target_loc, double &time, double &distance) const {
+    time     = -1;
+    distance = 999999999;
+    for (size_t i = 0; i < m_loc_vector.size(); i++) {
+      double d = norm_2(m_loc_vector[i] - target_loc);
+      if (d < distance) {
+        distance = d;
+        time     = m_time_vector[i];
+      }
     }
   }
-  /// Get target location vector closest times.
-  void get_target_times(std::vector<double> &target_time_vector,
-                        std::vector<double> &target_distance_vector) const {
-    target_time_vector     = m_target_time_vector;
-    target_distance_vector = m_target_distance_vector;
-  }
 
 private:
-
-  bool                 m_first_chunk;
-  const Datum          m_datum;
   std::vector<double > m_time_vector;
   std::vector<Vector3> m_loc_vector;
   std::vector<Vector3> m_rot_vector;
-  size_t               m_chunk_length;
-  size_t               m_chunk_overlap;
-  std::ifstream        m_input_stream;
-  
-  /// Search for these locations in the entire file!
-  std::vector<Vector3> m_target_loc_vector;
-  std::vector<double > m_target_distance_vector;
-  std::vector<double > m_target_time_vector;
-
-
-  /// Read and parse the next line in the file
-  bool read_next_line(double &time, Vector3& loc, Vector3& rot) {
-    // Try to read the line
-    std::string line;
-    if (!getline(m_input_stream, line))
-      return false;
-
-    // Parse the line
-    double lat, lon, alt, roll, pitch, heading;
-    scan_line(line, time, lat, lon, alt, roll, pitch, heading);
-    Vector3 llh(lon, lat, alt);
-    loc = m_datum.geodetic_to_cartesian(llh);
-    rot[0] = roll;
-    rot[1] = pitch;
-    rot[2] = heading;
-    
-    // Compare this position to target locations if they exist.
-    if (!m_target_loc_vector.empty())
-      update_target_locs(loc, time);
-    
-    return true;
-  }
-  
-  /// Check if this location is the best match to any target locations.
-  void update_target_locs(Vector3 loc, double time) {
-    // For each target, record the time and distance if this is the best match.
-    for (size_t i=0; i<m_target_loc_vector.size(); ++i) {
-      double distance = norm_2(loc - m_target_loc_vector[i]);
-      if (distance < m_target_distance_vector[i]) {
-        m_target_distance_vector[i] = distance;
-        m_target_time_vector    [i] = time;
-      }
-    } // End loop through targets
-  }
 
-}; // End class ScrollingNavInterpolator
+}; // End class NavTable
 
 
 /// Pretty-print a rotation matrix.
@@ -486,10 +407,10 @@ void print_matrix(Matrix3x3 const& m) {
 /// Helper function to write out the camera model once we have the position and pose.
 /// - This also adds the important row-direction flip from the camera to the image.
 void write_output_camera(Vector3 const& center, Matrix3x3 const& pose,
-                         std::string const& input_cam, 
+                         PinholeModel const& input_cam, 
                          std::string const& output_camera) {
                          
-  // Load the reference pinhole model, update it, and write it out to disk.
+  // Copy the reference pinhole model, update it, and write it out to disk.
   PinholeModel camera_model(input_cam);
   camera_model.set_camera_center(center);
   camera_model.set_camera_pose(pose);
@@ -513,6 +434,187 @@ void write_output_camera(Vector3 const& center, Matrix3x3 const& pose,
   camera_model.write(output_camera);
 }
 
+/// Interpolate the nav data at the time of a frame and write its camera.
+/// Returns false if the camera could not be found.
+bool nav_to_camera(Options const& opt, NavTable const& nav, Datum const& datum_wgs84,
+                   PinholeModel const& input_model, double ortho_time,
+                   std::string const& orthoimage_path, std::string const& output_camera_path) {
+
+  const double POSE_TIME_DELTA     = 0.1; // Look this far ahead/behind to determine direction
+  const double CHUNK_TIME_BOUNDARY = 1.0; // Require this much interpolation time
+  
+  if (!nav.covers(ortho_time, CHUNK_TIME_BOUNDARY)) {
+    vw_out() << "Cannot interpolate position for file " << orthoimage_path
+             << ", it is out of the time range of the nav file.\n";
+    return false;
+  }
+  
+  // Try to interpolate this ortho position
+  boost::shared_ptr<NavTable::PosInterpType> pos_interpolator_ptr;
+  boost::shared_ptr<NavTable::RotInterpType> rot_interpolator_ptr;
+  Vector3 gcc_interp, rot_interp, gcc_interp_forward, gcc_interp_backward;
+  try{
+    nav.make_interpolators(ortho_time, CHUNK_TIME_BOUNDARY,
+                           pos_interpolator_ptr, rot_interpolator_ptr);
+    gcc_interp = pos_interpolator_ptr->operator()(ortho_time);
+    rot_interp = rot_interpolator_ptr->operator()(ortho_time);
+
+    // Get a point ahead of and behind the frame location
+    gcc_interp_forward  = pos_interpolator_ptr->operator()(ortho_time+POSE_TIME_DELTA);
+    gcc_interp_backward = pos_interpolator_ptr->operator()(ortho_time-POSE_TIME_DELTA);
+  } catch(...){
+    vw_out() << "Failed to interpolate position for file " << orthoimage_path << std::endl;
+    return false;
+  }
+  Vector3 llh_interp = datum_wgs84.cartesian_to_geodetic(gcc_interp);
+      
+  double roll    = rot_interp[0];
+  double pitch   = rot_interp[1];
+      
+  // Now estimate the rotation information
+
+  /*
+    For some reason the heading interpolated from the navigation data is about 30 degrees
+    off from what is expected by looking at the flight path.  The roll and pitch values are
+    consistent with what is stored in the Icebridge-provided ortho files (the heading is not 
+    provided).  What has proven to work the best so far is to estimate the camera pose 
+    including the heading just by using the flight path, and then to apply the pitch and roll
+    to that matrix.  The best order to apply the pitch and roll has been determined by seeing 
+    which one map-projects closest to the lidar data.
+  */
+      
+  if (gcc_interp_forward == gcc_interp_backward) {
+    vw_out() << "Failed to estimate pose for file " << orthoimage_path << std::endl;
+    return false;
+  }
+      
+  // From these points get two flight direction vectors and take the mean.
+  Vector3 dir1 = gcc_interp_forward - gcc_interp;
+  Vector3 dir2 = gcc_interp - gcc_interp_backward;
+  Vector3 xDir = (dir1 + dir2) / 2.0;
+     
+  // The Z vector is straight down from the camera to the ground.
+  Vector3 llh_ground = llh_interp;
+  llh_ground[2] = 0;
+  Vector3 gcc_ground = datum_wgs84.geodetic_to_cartesian(llh_ground);
+  Vector3 zDir = gcc_ground - gcc_interp;
+      
+  // Normalize the vectors
+  xDir = xDir / norm_2(xDir);
+  zDir = zDir / norm_2(zDir);
+      
+  // The Y vector is the cross product of the two established vectors
+  Vector3 yDir = cross_prod(zDir, xDir);
+
+  // Hack to allow testing of whether rotation is applied before axis change.
+  // - The rotations appear to take affect BEFORE the camera mounting (ie they are aircraft rotations)
+  // - Once we are satisfied this is always true, remove the option not to do this.
+  if (opt.camera_mounting > 0) {
+    Matrix3x3 rotation_matrix_gcc(xDir[0], yDir[0], zDir[0],
+                                  xDir[1], yDir[1], zDir[1],
+                                  xDir[2], yDir[2], zDir[2]);
+    Matrix3x3 M_roll  = get_rotation_matrix_roll (roll);
+    Matrix3x3 M_pitch = get_rotation_matrix_pitch(pitch);
+    Matrix3x3 M       = rotation_matrix_gcc*M_pitch*M_roll; // Pre-apply rotation.
+    xDir  = Vector3(M(0,0), M(1,0), M(2,0)); // Restore axes
+    yDir  = Vector3(M(0,1), M(1,1), M(2,1));
+    zDir  = Vector3(M(0,2), M(1,2), M(2,2));
+    roll  = 0; // Set to zero so that these rotations are not applied twice
+    pitch = 0;
+  }
+
+  // Account for the camera mounting direction relative to aircraft motion.
+  Vector3 vTemp;
+  switch(abs(opt.camera_mounting)) {
+  case 1: // Left forwards
+    xDir = xDir * -1.0;
+    yDir = yDir * -1.0;
+    break;
+  case 2: // Top forwards
+    vTemp = xDir;
+    xDir = -1.0*yDir;
+    yDir = vTemp;
+    break;
+  case 3: // Bottom forwards
+    vTemp = xDir;
+    xDir = yDir;
+    yDir = -1.0*vTemp;
+    break;
+  default: break; // Right forwards, the default.
+  }
+      
+  // Pack into a rotation matrix
+  Matrix3x3 rotation_matrix_gcc(xDir[0], yDir[0], zDir[0],
+                                xDir[1], yDir[1], zDir[1],
+                                xDir[2], yDir[2], zDir[2]);
+      
+  Matrix3x3 M_roll  = get_rotation_matrix_roll (roll);
+  Matrix3x3 M_pitch = get_rotation_matrix_pitch(pitch);
+
+  // Without documentation it is very difficult to determine
+  // which of these rotation orders is correct!
+  // - Could be neither since the yaw rotation is already baked in.
+  //Matrix3x3 M1 = M_pitch*M_roll*rotation_matrix_gcc; // <-- off
+  //Matrix3x3 M2 = M_roll*M_pitch*rotation_matrix_gcc; // <-- off
+  Matrix3x3 M3 = rotation_matrix_gcc*M_pitch*M_roll; // <-- Best
+  //Matrix3x3 M4 = rotation_matrix_gcc*M_roll*M_pitch; // <-- Ok
+
+  write_output_camera(gcc_interp, M3, input_model, output_camera_path);
+  return true;
+}
+
+/// Write the cameras of a range of frames
+class NavToCameraTask: public vw::Task, private boost::noncopyable {
+  Options      const& m_opt;
+  NavTable     const& m_nav;
+  Datum        const& m_datum;
+  PinholeModel const& m_input_model;
+  std::vector<double> const& m_ortho_times;
+  size_t m_beg, m_end;
+  std::vector<unsigned char> & m_success;
+public:
+  NavToCameraTask(Options const& opt, NavTable const& nav, Datum const& datum,
+                  PinholeModel const& input_model, std::vector<double> const& ortho_times,
+                  size_t beg, size_t end, std::vector<unsigned char> & success):
+    m_opt(opt), m_nav(nav), m_datum(datum), m_input_model(input_model),
+    m_ortho_times(ortho_times), m_beg(beg), m_end(end), m_success(success) {}
+
+  void operator()() {
+    const boost::filesystem::path output_dir(m_opt.output_folder);
+    for (size_t it = m_beg; it < m_end; it++) {
+      boost::filesystem::path output_camera_path = output_dir / m_opt.camera_files[it];
+      try {
+        m_success[it] = nav_to_camera(m_opt, m_nav, m_datum, m_input_model,
+                                      m_ortho_times[it], m_opt.image_files[it],
+                                      output_camera_path.string());
+      } catch (const std::exception& e) {
+        vw_out() << "Failed to write camera for file " << m_opt.image_files[it]
+                 << ": " << e.what() << std::endl;
+      }
+    }
+  }
+};
+
+/// Find the nav samples closest to a range of target locations
+class ClosestSampleTask: public vw::Task, private boost::noncopyable {
+  NavTable const& m_nav;
+  std::vector<Vector3> const& m_target_locs;
+  size_t m_beg, m_end;
+  std::vector<double> & m_matched_times;
+  std::vector<double> & m_best_distances;
+public:
+  ClosestSampleTask(NavTable const& nav, std::vector<Vector3> const& target_locs,
+                    size_t beg, size_t end,
+                    std::vector<double> & matched_times, std::vector<double> & best_distances):
+    m_nav(nav), m_target_locs(target_locs), m_beg(beg), m_end(end),
+    m_matched_times(matched_times), m_best_distances(best_distances) {}
+
+  void operator()() {
+    for (size_t it = m_beg; it < m_end; it++)
+      m_nav.closest_sample(m_target_locs[it], m_matched_times[it], m_best_distances[it]);
+  }
+};
+
 // ================================================================================
 
 int main(int argc, char* argv[]) {
@@ -531,20 +633,22 @@ int main(int argc, char* argv[]) {
     char* temp = (char*)TZ_UTC.c_str();
     putenv(temp);
 
-
-    // Print progress every N files
-    const size_t PRINT_INTERVAL = 200;
+    int num_threads = opt.num_threads;
+    if (num_threads <= 0)
+      num_threads = vw_settings().default_num_threads();
   
     const boost::filesystem::path output_dir(opt.output_folder);
   
-    // Initialize the nav interpolator
-    std::cout << "Opening input stream: " << opt.nav_file << std::endl;
-    ScrollingNavInterpolator interpLoader(opt.nav_file, datum_wgs84);
+    // Load the nav file
+    std::cout << "Reading: " << opt.nav_file << std::endl;
+    NavTable nav;
+    nav.load(opt.nav_file, datum_wgs84);
+    std::cout << "Read " << nav.size() << " nav samples.\n";
 
-    // Load target camera positions if desired
-    std::vector<Vector3> target_locations;
-    std::vector<double > target_times;
     if (opt.detect_offset) {
+      // Load target camera positions
+      std::vector<Vector3> target_locations;
+      std::vector<double > target_times;
       std::cout << "Reading target locations...\n";
       const size_t num_targets = opt.camera_files.size();
       target_locations.reserve(num_targets);
@@ -559,361 +663,69 @@ int main(int argc, char* argv[]) {
         } catch(...) {
         } // Just skip cameras that we can't read in.
       }
-      interpLoader.set_target_locs(target_locations);
       std::cout << "Done loading " << target_locations.size() << " target locations.\n";
-    } // End target loading condition
-
-    boost::shared_ptr<ScrollingNavInterpolator::PosInterpType> pos_interpolator_ptr;
-    boost::shared_ptr<ScrollingNavInterpolator::RotInterpType> rot_interpolator_ptr;
-    double start, end;
-  
-    const double POSE_TIME_DELTA     = 0.1; // Look this far ahead/behind to determine direction
-    const double CHUNK_TIME_BOUNDARY = 1.0; // Require this much interpolation time
-    size_t file_index = 0;
-    const size_t num_files = opt.image_files.size();
-
-    // Keep loading chunks until the nav data catches up with the images
-    double ortho_time=0;
-    while (interpLoader.load_next_chunk(pos_interpolator_ptr, rot_interpolator_ptr)) {
-
-      // Get the time boundaries of the current chunk
-      interpLoader.get_time_boundaries(start, end);  
-
-      //std::cout << "Time range: " << start << " ---- " << end << std::endl;
-
-      // When detecting offsets all we want to do is loop through the nav file.
-      if (opt.detect_offset)
-        continue;
-
-      // Loop through ortho files until we need to advance the nav chunk
-      while (file_index < num_files) {
 
-        // Get the next input and output paths
-        std::string             orthoimage_path = opt.image_files [file_index];
-        boost::filesystem::path camera_file(opt.camera_files[file_index]);
-        boost::filesystem::path output_camera_path = output_dir / camera_file;
-      
-        // Get time for this frame
-        if (ortho_time == 0) {
-          ortho_time = gps_seconds(orthoimage_path) - opt.time_offset;
-          //vw_out() << orthoimage_path << " -> gps_time = " << ortho_time << std::endl;
-        }
-
-        // If this ortho is too far ahead in time, move on to the next nav chunk.
-        if (ortho_time > end - CHUNK_TIME_BOUNDARY)
-          break; // Don't advance file_index
-
-        // If this ortho is too early in time, move on to the next ortho file.
-        if (ortho_time < start + CHUNK_TIME_BOUNDARY) {
-          vw_out() << "Too early to interpolate position for file " << orthoimage_path << std::endl;
-          ++file_index;
-          ortho_time = 0;
-          continue;
-        }
-
-        // Try to interpolate this ortho position
-        Vector3 gcc_interp, rot_interp;
-        try{
-          gcc_interp = pos_interpolator_ptr->operator()(ortho_time);
-          rot_interp = rot_interpolator_ptr->operator()(ortho_time);
-        } catch(...){
-          vw_out() << "Failed to interpolate position for file " << orthoimage_path << std::endl;
-          ++file_index;
-          ortho_time = 0;
-          continue;
-        }
-        Vector3 llh_interp = datum_wgs84.cartesian_to_geodetic(gcc_interp);
-      
-        double roll    = rot_interp[0];
-        double pitch   = rot_interp[1];
-        //double heading = rot_interp[2];
-        //vw_out() << "For file " << orthoimage_path << " computed LLH " << llh_interp << std::endl;
-        //vw_out() << "Roll    = " << roll    <<" = "<< roll*180/3.14159<< std::endl;
-        //vw_out() << "Pitch   = " << pitch   <<" = "<< pitch*180/3.14159<< std::endl;
-        //vw_out() << "Heading = " << heading << std::endl;
-
-        //std::cout << "Ortho time  = " << ortho_time << std::endl;
-        //vw_out() << "llh = " << llh_interp << std::endl;
-      
-        // Now estimate the rotation information
-
-        /*
-          For some reason the heading interpolated from the navigation data is about 30 degrees
-          off from what is expected by looking at the flight path.  The roll and pitch values are
-          consistent with what is stored in the Icebridge-provided ortho files (the heading is not 
-          provided).  What has proven to work the best so far is to estimate the camera pose 
-          including the heading just by using the flight path, and then to apply the pitch and roll
-          to that matrix.  The best order to apply the pitch and roll has been determined by seeing 
-          which one map-projects closest to the lidar data.
-        */
-      
-        // Get a point ahead of and behind the frame location
-        Vector3 gcc_interp_forward  = pos_interpolator_ptr->operator()(ortho_time+POSE_TIME_DELTA);
-        Vector3 gcc_interp_backward = pos_interpolator_ptr->operator()(ortho_time-POSE_TIME_DELTA);
-      
-        if (gcc_interp_forward == gcc_interp_backward) {
-          vw_out() << "Failed to estimate pose for file " << orthoimage_path << std::endl;
-          ++file_index;
-          ortho_time = 0;
-          continue;
-        }
-      
-        // From these points get two flight direction vectors and take the mean.
-        Vector3 dir1 = gcc_interp_forward - gcc_interp;
-        Vector3 dir2 = gcc_interp - gcc_interp_backward;
-        Vector3 xDir = (dir1 + dir2) / 2.0;
-     
-        // The Z vector is straight down from the camera to the ground.
-        Vector3 llh_ground = llh_interp;
-        llh_ground[2] = 0;
-        Vector3 gcc_ground = datum_wgs84.geodetic_to_cartesian(llh_ground);
-        Vector3 zDir = gcc_ground - gcc_interp;
-      
-        // Normalize the vectors
-        xDir = xDir / norm_2(xDir);
-        zDir = zDir / norm_2(zDir);
-      
-        // The Y vector is the cross product of the two established vectors
-        Vector3 yDir = cross_prod(zDir, xDir);
-
-        // Hack to allow testing of whether rotation is applied before axis change.
-        // - The rotations appear to take affect BEFORE the camera mounting (ie they are aircraft rotations)
-        // - Once we are satisfied this is always true, remove the option not to do this.
-        if (opt.camera_mounting > 0) {
-          Matrix3x3 rotation_matrix_gcc(xDir[0], yDir[0], zDir[0],
-                                        xDir[1], yDir[1], zDir[1],
-                                        xDir[2], yDir[2], zDir[2]);
-          Matrix3x3 M_roll  = get_rotation_matrix_roll (roll);
-          Matrix3x3 M_pitch = get_rotation_matrix_pitch(pitch);
-          Matrix3x3 M       = rotation_matrix_gcc*M_pitch*M_roll; // Pre-apply rotation.
-          xDir  = Vector3(M(0,0), M(1,0), M(2,0)); // Restore axes
-          yDir  = Vector3(M(0,1), M(1,1), M(2,1));
-          zDir  = Vector3(M(0,2), M(1,2), M(2,2));
-          roll  = 0; // Set to zero so that these rotations are not applied twice
-          pitch = 0;
-        }
-
-        // Account for the camera mounting direction relative to aircraft motion.
-        Vector3 vTemp;
-        switch(abs(opt.camera_mounting)) {
-        case 1: // Left forwards
-          xDir = xDir * -1.0;
-          yDir = yDir * -1.0;
-          break;
-        case 2: // Top forwards
-          vTemp = xDir;
-          xDir = -1.0*yDir;
-          yDir = vTemp;
-          break;
-        case 3: // Bottom forwards
-          vTemp = xDir;
-          xDir = yDir;
-          yDir = -1.0*vTemp;
-          break;
-        default: break; // Right forwards, the default.
+      // Find the closest nav sample to each target
+      std::cout << "Getting target results...\n";
+      std::vector<double> matched_times(target_locations.size()),
+        best_distances(target_locations.size());
+      {
+        size_t chunk = target_locations.size() / (8 * num_threads) + 1;
+        FifoWorkQueue queue(num_threads);
+        for (size_t beg = 0; beg < target_locations.size(); beg += chunk) {
+          boost::shared_ptr<ClosestSampleTask>
+            task(new ClosestSampleTask(nav, target_locations, beg,
+                                       std::min(beg + chunk, target_locations.size()),
+                                       matched_times, best_distances));
+          queue.add_task(task);
         }
+        queue.join_all();
+      }
       
-        // Pack into a rotation matrix
-        Matrix3x3 rotation_matrix_gcc(xDir[0], yDir[0], zDir[0],
-                                      xDir[1], yDir[1], zDir[1],
-                                      xDir[2], yDir[2], zDir[2]);
-      
-        // TODO: ENU or NED?
-        //Matrix3x3 ned_matrix = datum_wgs84.lonlat_to_ned_matrix(Vector2(llh_interp[0], llh_interp[1]));
-        //Matrix3x3 enu_matrix(ned_matrix(0,1), ned_matrix(0,0), -ned_matrix(0,2),
-        //                     ned_matrix(1,1), ned_matrix(1,0), -ned_matrix(1,2),
-        //                     ned_matrix(2,1), ned_matrix(2,0), -ned_matrix(2,2));
-
-        //Vector3 north(ned_matrix(0,0), ned_matrix(1,0), ned_matrix(2,0));
-        //double angle = acos(dot_prod(xDir, north) / (norm_2(north)*norm_2(xDir)));
-      
-        //std::cout << "Nav, est, diff, cam: " << heading <<", "<< angle << ", "<< fabs(heading)-angle << ", " << camera_file <<  std::endl;
-
-
-        //std::cout << "gcc = " << gcc_interp << std::endl;
-        //std::cout << "xDir = " << xDir << std::endl;
-        //std::cout << "yDir = " << yDir << std::endl;
-        //std::cout << "zDir = " << zDir << std::endl;
-      
-        //std::cout << std::endl << "Estimate based matrix " << std::endl;
-        //print_matrix(rotation_matrix_gcc);
-      
-        // TODO: Clean all this up once we are satisfied with it!
-      
-        Matrix3x3 M_roll  = get_rotation_matrix_roll (roll);
-        Matrix3x3 M_pitch = get_rotation_matrix_pitch(pitch);
-
-        //std::cout << "M_roll, M_pitch:\n";
-        //print_matrix(M_roll ); std::cout << std::endl;
-        //print_matrix(M_pitch); std::cout << std::endl;
-      
-        // Without documentation it is very difficult to determine
-        // which of these rotation orders is correct!
-        // - Could be neither since the yaw rotation is already baked in.
-        //Matrix3x3 M1 = M_pitch*M_roll*rotation_matrix_gcc; // <-- off
-        //Matrix3x3 M2 = M_roll*M_pitch*rotation_matrix_gcc; // <-- off
-        Matrix3x3 M3 = rotation_matrix_gcc*M_pitch*M_roll; // <-- Best
-        //Matrix3x3 M4 = rotation_matrix_gcc*M_roll*M_pitch; // <-- Ok
-      
-        //std::cout << "Modified matrices:\n";
-        //print_matrix(M1); std::cout << std::endl;
-        //print_matrix(M2); std::cout << std::endl;
-        //print_matrix(M3); std::cout << std::endl;
-        //print_matrix(M4); std::cout << std::endl;
-
-        //std::string var_path = output_camera_path.string() + "_";
-        //write_output_camera(gcc_interp, rotation_matrix_gcc, opt.input_cam, var_path + "M0.tsai");
-        //write_output_camera(gcc_interp, M1, opt.input_cam, var_path + "M1.tsai");
-        //write_output_camera(gcc_interp, M2, opt.input_cam, var_path + "M2.tsai");
-        //write_output_camera(gcc_interp, M3, opt.input_cam, var_path + "M3.tsai");
-        //write_output_camera(gcc_interp, M4, opt.input_cam, var_path + "batch_06420_06421_2M4.tsai");
-
-        write_output_camera(gcc_interp, M3,
-                            opt.input_cam, output_camera_path.string());
-
-        //std::cout << std::endl << "NED matrix " << std::endl;
-        //print_matrix(ned_matrix);
-
-        //std::cout << std::endl << "ENU matrix " << std::endl;
-        //std::cout << enu_matrix << std::endl << std::endl;
-        /*
-          double yaw = -3.14159 / 2;
-          Matrix3x3 My90 = get_rotation_matrix_yaw(yaw);
-      
-          for (int p=0; p<0; ++p) {
-          Matrix3x3 rotation_matrix_gcc_2 = get_look_rotation_matrix(heading, pitch, roll, p);
-
-
-          std::cout << std::endl << "Angle based matrix " << p << std::endl;
-          std::cout << ned_matrix * rotation_matrix_gcc_2 << std::endl;
-
-          //std::cout << std::endl << "Angle based matrix 90 1" << p << std::endl;
-          //std::cout << My90*(ned_matrix * rotation_matrix_gcc_2) << std::endl;
-        
-          std::cout << std::endl << "Angle based matrix 90 2 " << p << std::endl;
-          std::cout << (ned_matrix * rotation_matrix_gcc_2)*My90 << std::endl;  
-        
-        
-          std::cout << std::endl << "Angle based matrix ALT" << p << std::endl;
-          std::cout << rotation_matrix_gcc_2*ned_matrix << std::endl;
-        
-          //std::cout << std::endl << "Angle based matrix ALT 90 1" << p << std::endl;
-          //std::cout << My90*(rotation_matrix_gcc_2*ned_matrix) << std::endl;
-        
-          std::cout << std::endl << "Angle based matrix ALT 90 2 " << p << std::endl;
-          std::cout << (rotation_matrix_gcc_2*ned_matrix)*My90 << std::endl;        
-
-          std::cout << "------------\n";
-
-
-          std::cout << std::endl << "Angle based matrix " << p << std::endl;
-          std::cout << enu_matrix * rotation_matrix_gcc_2 << std::endl;
-
-          //std::cout << std::endl << "Angle based matrix 90 1" << p << std::endl;
-          //std::cout << My90*(enu_matrix * rotation_matrix_gcc_2) << std::endl;
-        
-          std::cout << std::endl << "Angle based matrix 90 2" << p << std::endl;
-          std::cout << (enu_matrix * rotation_matrix_gcc_2)*My90 << std::endl;  
-        
-        
-          std::cout << std::endl << "Angle based matrix ALT" << p << std::endl;
-          std::cout << rotation_matrix_gcc_2*enu_matrix << std::endl;
-        
-          //std::cout << std::endl << "Angle based matrix ALT 90 1" << p << std::endl;
-          //std::cout << My90*(rotation_matrix_gcc_2*enu_matrix) << std::endl;
-        
-          std::cout << std::endl << "Angle based matrix ALT 90 2" << p << std::endl;
-          std::cout << (rotation_matrix_gcc_2*enu_matrix)*My90 << std::endl;        
-
-        
-          }
-          std::cout << std::endl << std::endl;
-        */
-        //write_output_camera(gcc_interp, rotation_matrix_gcc,
-        //                    opt.input_cam, output_camera_path.string());
-
-
-        // Update progress
-        if (file_index % PRINT_INTERVAL == 0)
-          vw_out() << file_index << " files processed.\n";
-
-        ++file_index;
-        ortho_time = 0;
-
-      } // End loop through ortho files
-    
-    } // End loop through nav batches
-  
-    vw_out() << "Finished looping through the nav file.\n";
-    /*
-    
-    // TODO: The camera position needs to be interpolated from the several nearest lines!
-    
-    Vector3 xyz;
-    Quat rot, look, ned;
-    
-    // Try out different rotation orders
-    for (int rot_order = 5; rot_order <= 5; rot_order++) {
-    
-    // Process the navigation information from this line
-    parse_camera_pose(curr_line, xyz, look, ned, 
-    lon, lat, alt, roll, pitch, heading, rot_order);
-
-    vw_out() << "Got GCC coord: " << xyz << std::endl;
-
-    // This is highly confusing, but apparently we need to keep
-    // the original longitude when computing the ned matrix that
-    // transforms from the coordinate system with orgin at the
-    // center of the Earth to the North-East-Down coordinate
-    // system that was obtained from the starting image, rather
-    // than modifying it as we move over new points over the Earth surface.
-    if (lon0 == BIG_NUMBER){
-    // First value for these variables.
-    lon0 = lon;
-    }
-    //ned = Quat(datum_wgs84.lonlat_to_ned_matrix(Vector2(lon0, lat)));
-
-    Quat rotation_matrix_gcc = inverse(ned)*inverse(look);
-      
-    // Update the input pinhole model and write it out to disk.
-    input_pinhole_model.set_camera_center(xyz);
-    input_pinhole_model.set_camera_pose(rotation_matrix_gcc);
-    vw_out() << "Writing: " << output_camera_path << std::endl;
-    input_pinhole_model.write(output_camera_path);
-      
-    } // End rot_order loop
-  
-    // Update progress
-    if (i % PRINT_INTERVAL == 0)
-    vw_out() << i << " files completed.\n";
-    
-    } // End loop through input files
-  
-    */
-  
-    if (opt.detect_offset) {
-      std::cout << "Getting target results...\n";
       // Compute the mean difference between the target camera time and the matched time
       //  and print the results.
-      std::vector<double> matched_times, best_distances;
-      interpLoader.get_target_times(matched_times, best_distances);
-      const size_t num_targets = target_times.size();
       double mean_offset = 0, mean_dist = 0;
-      for (size_t i=0; i<num_targets; ++i) {
+      for (size_t i=0; i<target_times.size(); ++i) {
         double diff = matched_times[i] - target_times[i];
         mean_offset += diff;
         mean_dist   += best_distances[i];
         std::cout << "Offset: " << diff << ", dist = " << best_distances[i]
                   << ", time = " << matched_times[i] << std::endl;
       }
-      mean_offset /= static_cast<double>(num_targets);
-      mean_dist   /= static_cast<double>(num_targets);
+      mean_offset /= static_cast<double>(target_times.size());
+      mean_dist   /= static_cast<double>(target_times.size());
       std::cout << "Computed mean nav time offset: " << mean_offset << std::endl;
       std::cout << "Computed mean nav distance   : " << mean_dist   << std::endl;
+      return 0;
     }
+
+    // Find the frame times here, as gps_seconds() is not thread-safe
+    const size_t num_files = opt.image_files.size();
+    std::vector<double> ortho_times(num_files);
+    for (size_t it = 0; it < num_files; it++)
+      ortho_times[it] = gps_seconds(opt.image_files[it]) - opt.time_offset;
+
+    // Load the intrinsics once for all frames
+    PinholeModel input_model(opt.input_cam);
+    
+    // Write the cameras in parallel
+    std::vector<unsigned char> success(num_files, 0);
+    {
+      size_t chunk = num_files / (8 * num_threads) + 1;
+      FifoWorkQueue queue(num_threads);
+      for (size_t beg = 0; beg < num_files; beg += chunk) {
+        boost::shared_ptr<NavToCameraTask>
+          task(new NavToCameraTask(opt, nav, datum_wgs84, input_model, ortho_times,
+                                   beg, std::min(beg + chunk, num_files), success));
+        queue.add_task(task);
+      }
+      queue.join_all();
+    }
+
+    size_t num_written = std::count(success.begin(), success.end(), 1);
+    vw_out() << "Wrote " << num_written << " out of " << num_files << " cameras.\n";
   
   } ASP_STANDARD_CATCHES;
 
   return 0;
 }
-  
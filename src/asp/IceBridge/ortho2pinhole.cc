@@ -25,15 +25,27 @@
 // opt.reference_dem, we assume for now that the image is mapprojected
 // onto the datum. Save on output a gcp file, that may be used to further
 // refine the camera using bundle_adjust.
+//
+// With --frame-list, process many frames in one run. The reference DEM
+// is opened once, and the portion of it read for a frame is kept and
+// reused by the next frames falling within it, as consecutive
+// IceBridge frames overlap heavily. With --frame-threads, several
+// frames are processed at the same time.
 #include <asp/Core/Macros.h>
 #include <asp/Sessions/StereoSession.h>
 #include <asp/Sessions/StereoSessionFactory.h>
 #include <asp/Core/StereoSettings.h>
 #include <asp/Core/PointUtils.h>
 #include <asp/Core/InterestPointMatching.h>
+#include <asp/Core/ImageOverviews.h>
 #include <vw/Camera/PinholeModel.h>
+#include <vw/Core/Thread.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Cartography/GeoTransform.h>
 #include <boost/core/null_deleter.hpp>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
 
 
 // Turn off warnings from eigen
@@ -70,16 +82,35 @@ typedef boost::scoped_ptr<asp::StereoSession> SessionPtr;
 
 
 struct Options : public vw::GdalWriteOptions {
-  std::string raw_image, ortho_image, input_cam, output_cam, reference_dem, camera_estimate;
+  std::string raw_image, ortho_image, input_cam, output_cam, reference_dem, camera_estimate,
+    frame_list;
   double camera_height, orthoimage_height, ip_inlier_factor, max_translation;
-  int    ip_per_tile, ip_detect_method, min_ip;
+  int    ip_per_tile, ip_detect_method, min_ip, pyramid_levels, frame_threads;
   bool   individually_normalize, keep_match_file, write_gcp_file, skip_image_normalization, 
     show_error, short_circuit, crop_reference_dem;
 
   // Make sure all values are initialized, even though they will be
   // over-written later.
   Options(): camera_height(-1), orthoimage_height(0), ip_per_tile(0),
-             ip_detect_method(0), individually_normalize(false), keep_match_file(false){}
+             ip_detect_method(0), pyramid_levels(0), frame_threads(1),
+             individually_normalize(false), keep_match_file(false){}
+};
+
+// The stereo session and its interest point matching use the global
+// stereo settings, which are adjusted per frame, so frames processed
+// at the same time take turns doing those.
+vw::Mutex g_session_mutex;
+
+/// The reference DEM, opened once for all frames, and the last portion
+/// of it which was read into memory.
+struct RefDemCache {
+  boost::shared_ptr< DiskImageView<float> > dem;
+  vw::cartography::GeoReference georef;
+  float nodata;
+  BBox2i crop_box;
+  ImageView<float> crop;
+  vw::Mutex mutex; // Frames processed at the same time share the cache
+  RefDemCache(): nodata(-std::numeric_limits<float>::max()) {}
 };
 
 /// Record a set of IP results as ground control points
@@ -282,24 +313,29 @@ int solve_for_cam_adjust(boost::shared_ptr<PinholeModel> camera_model,
 /// Load the DEM and adjust some options depending on DEM statistics.
 void load_reference_dem(Options &opt, boost::shared_ptr<DiskImageResource> const& rsrc_ortho,
                         vw::cartography::GeoReference const& ortho_georef,
+                        RefDemCache &cache,
                         ImageViewRef< PixelMask<float> > &dem,
                         vw::cartography::GeoReference &dem_georef,
                         bool &elevation_change_present) {
 
-  // Set up the DEM if it was provided.
-  float dem_nodata = -std::numeric_limits<float>::max();
+  vw::Mutex::Lock lock(cache.mutex);
 
-  bool is_good = vw::cartography::read_georeference(dem_georef, opt.reference_dem);
-  if (!is_good) {
-    vw_throw(ArgumentErr() << "Error: Cannot read georeference from: "
-                           << opt.reference_dem << ".\n");
-  }
+  // Open the DEM, unless done for an earlier frame
+  if (!cache.dem) {
+    bool is_good = vw::cartography::read_georeference(cache.georef, opt.reference_dem);
+    if (!is_good) {
+      vw_throw(ArgumentErr() << "Error: Cannot read georeference from: "
+                             << opt.reference_dem << ".\n");
+    }
 
-  {
     // Read the no-data
     DiskImageResourceGDAL rsrc(opt.reference_dem);
-    if (rsrc.has_nodata_read()) dem_nodata = rsrc.nodata_read();
+    if (rsrc.has_nodata_read()) cache.nodata = rsrc.nodata_read();
+
+    cache.dem.reset(new DiskImageView<float>(opt.reference_dem));
   }
+  float dem_nodata = cache.nodata;
+  dem_georef = cache.georef;
 
 
   bool crop_is_success = false;
@@ -310,8 +346,7 @@ void load_reference_dem(Options &opt, boost::shared_ptr<DiskImageResource> const
     DiskImageView<float> tmp_ortho(rsrc_ortho);
     BBox2 ortho_bbox = bounding_box(tmp_ortho);
 
-    DiskImageView<float> tmp_dem(opt.reference_dem);
-    BBox2 dem_bbox = bounding_box(tmp_dem);
+    BBox2 dem_bbox = bounding_box(*cache.dem);
     
     // The GeoTransform will hide the messy details of conversions
     vw::cartography::GeoTransform geotrans(dem_georef, ortho_georef, dem_bbox, ortho_bbox);
@@ -329,11 +364,23 @@ void load_reference_dem(Options &opt, boost::shared_ptr<DiskImageResource> const
       
       crop_box.expand(200); // TODO: Need to think more here
       crop_box.crop(dem_bbox);
+      BBox2i needed_box = crop_box;
       
-      if (!crop_box.empty()) {
-        ImageView<float> cropped_dem = crop(DiskImageView<float>(opt.reference_dem), crop_box);
-        dem = create_mask(cropped_dem, dem_nodata);
-        dem_georef = crop(dem_georef, crop_box);
+      if (!needed_box.empty()) {
+        if (cache.crop_box.empty() || !cache.crop_box.contains(needed_box)) {
+          // When processing many frames, read a larger area, so that
+          // the next frames can use it as well.
+          BBox2i read_box = needed_box;
+          if (opt.frame_list != "")
+            read_box.expand(std::max(needed_box.width(), needed_box.height()));
+          read_box.crop(bounding_box(*cache.dem));
+          ImageView<float> cropped_dem = crop(*cache.dem, read_box);
+          cache.crop     = cropped_dem;
+          cache.crop_box = read_box;
+        }
+        dem = create_mask(crop(cache.crop, needed_box - cache.crop_box.min()),
+                          dem_nodata);
+        dem_georef = crop(cache.georef, needed_box);
         crop_is_success = true;
       }
     }
@@ -343,7 +390,7 @@ void load_reference_dem(Options &opt, boost::shared_ptr<DiskImageResource> const
   
   // Default behavior  
   if (!crop_is_success)
-    dem = create_mask(DiskImageView<float>(opt.reference_dem), dem_nodata);
+    dem = create_mask(*cache.dem, dem_nodata);
 
   
   // Get an estimate of the elevation range in the input image
@@ -398,28 +445,116 @@ void load_reference_dem(Options &opt, boost::shared_ptr<DiskImageResource> const
   
 } // End load_reference_dem
 
+/// Match interest points between overviews of the raw image and the
+/// orthoimage at the coarsest pyramid level, keep those consistent with
+/// a homography, and refine them at each finer level with local
+/// correlation. The overviews are saved next to the images, so later
+/// attempts for the same frame, with other options, reuse them.
+void find_ip_pyramid(Options const& opt, float nodata1, float nodata2,
+                     double inlier_threshold, std::string const& match_filename) {
+
+  int level = opt.pyramid_levels;
+  vw_out() << "Matching interest points at pyramid level " << level << ".\n";
+  
+  // The coarsest level is small, so it can be kept in memory
+  ImageView< PixelMask<float> > coarse1
+    = asp::image_overview(opt.raw_image,   nodata1, level, opt);
+  ImageView< PixelMask<float> > coarse2
+    = asp::image_overview(opt.ortho_image, nodata2, level, opt);
+  std::vector<vw::ip::InterestPoint> ip1, ip2;
+  asp::detect_match_ip(ip1, ip2, apply_mask(coarse1, nodata1), apply_mask(coarse2, nodata2),
+                       opt.ip_per_tile,
+                       "", "", // Do not read ip from disk
+                       nodata1, nodata2, "");
+
+  // The same inlier threshold as for matching at full resolution, but in
+  // pixels of the coarsest level
+  if (inlier_threshold <= 0)
+    inlier_threshold = round(opt.ip_inlier_factor*150.0);
+  int coarse_threshold = std::max(1, int(round(inlier_threshold / (1 << level))));
+  std::vector<vw::ip::InterestPoint> raw_ip, ortho_ip;
+  asp::filter_ip_homog(ip1, ip2, raw_ip, ortho_ip, coarse_threshold);
+
+  // Going to a finer level doubles the pixel coordinates. The orthoimage
+  // pixel is rounded, and the raw image one moved by as much, then refined.
+  const int    HALF_PATCH = 7, SEARCH_RADIUS = 4;
+  const double MIN_NCC    = 0.6;
+  while (level > 0 && !raw_ip.empty()) {
+    level--;
+    ImageViewRef< PixelMask<double> > img1
+      = pixel_cast< PixelMask<double> >(asp::image_overview(opt.raw_image,   nodata1, level, opt));
+    ImageViewRef< PixelMask<double> > img2
+      = pixel_cast< PixelMask<double> >(asp::image_overview(opt.ortho_image, nodata2, level, opt));
+    std::vector<vw::ip::InterestPoint> fine_raw_ip, fine_ortho_ip;
+    for (size_t it = 0; it < raw_ip.size(); it++) {
+      Vector2  ortho_pix = 2.0 * Vector2(ortho_ip[it].x, ortho_ip[it].y);
+      Vector2i pix2(round(ortho_pix[0]), round(ortho_pix[1]));
+      Vector2  pred1 = 2.0 * Vector2(raw_ip[it].x, raw_ip[it].y) + (Vector2(pix2) - ortho_pix);
+      Vector2  pix1;
+      if (!asp::refine_match(img1, img2, pix2, pred1, HALF_PATCH, SEARCH_RADIUS, MIN_NCC, pix1))
+        continue;
+      fine_raw_ip.push_back  (vw::ip::InterestPoint(pix1.x(), pix1.y()));
+      fine_ortho_ip.push_back(vw::ip::InterestPoint(pix2.x(), pix2.y()));
+    }
+    vw_out() << "Refined " << fine_raw_ip.size() << " / " << raw_ip.size()
+             << " matches at pyramid level " << level << ".\n";
+    raw_ip   = fine_raw_ip;
+    ortho_ip = fine_ortho_ip;
+  }
+
+  if (raw_ip.empty())
+    vw_throw(ArgumentErr() << "No matches could be found or refined. Try using fewer pyramid levels.\n");
+    
+  vw_out() << "Writing: " << match_filename << std::endl;
+  ip::write_binary_match_file(match_filename, raw_ip, ortho_ip);
+}
+
+/// Load the camera and find the interest point matches. The matching
+/// uses the given inlier threshold, if positive, rather than the default.
 void load_camera_and_find_ip(Options const& opt, 
                              boost::shared_ptr<DiskImageResource> const& rsrc_raw,
                              boost::shared_ptr<DiskImageResource> const& rsrc_ortho,
                              std::string const& match_filename,
+                             double inlier_threshold,
                              boost::shared_ptr<CameraModel> &cam) {
 
   std::string out_prefix = "tmp-prefix";
   std::string stereo_session = "pinhole";
   float nodata1, nodata2;
-  SessionPtr session(asp::StereoSessionFactory::create(stereo_session, opt,
-                                                       opt.raw_image, opt.ortho_image,
-                                                       opt.input_cam, opt.input_cam,
-                                                       out_prefix));
   asp::get_nodata_values(rsrc_raw, rsrc_ortho, nodata1, nodata2);
-  
-  cam = session->camera_model(opt.raw_image, opt.input_cam);
+
+  SessionPtr session;
+  {
+    vw::Mutex::Lock lock(g_session_mutex);
+    session.reset(asp::StereoSessionFactory::create(stereo_session, opt,
+                                                    opt.raw_image, opt.ortho_image,
+                                                    opt.input_cam, opt.input_cam,
+                                                    out_prefix));
+    cam = session->camera_model(opt.raw_image, opt.input_cam);
+  }
   
   // Skip IP finding if the match file exists since the code will re-use it anyways.
   if (boost::filesystem::exists(match_filename)) {
     vw_out() << "Using existing match filename " << match_filename << std::endl;
     return;
   }
+
+  if (opt.pyramid_levels > 0) {
+    // This does not use the session, so other frames can go on
+    try {
+      find_ip_pyramid(opt, nodata1, nodata2, inlier_threshold, match_filename);
+    } catch ( const std::exception& e ){
+      vw_throw( ArgumentErr()
+                << "Could not find interest points between images "
+                << opt.raw_image << " and " << opt.ortho_image << "\n" << e.what() << "\n");
+    }
+    return;
+  }
+
+  vw::Mutex::Lock lock(g_session_mutex);
+  double epipolar_threshold = asp::stereo_settings().epipolar_threshold;
+  if (inlier_threshold > 0)
+    asp::stereo_settings().epipolar_threshold = inlier_threshold;
   
   try{
     // IP matching may not succeed for all pairs
@@ -442,10 +577,12 @@ void load_camera_and_find_ip(Options const& opt,
                          match_filename, "", ""
                         );
   } catch ( const std::exception& e ){
+    asp::stereo_settings().epipolar_threshold = epipolar_threshold;
     vw_throw( ArgumentErr()
               << "Could not find interest points between images "
               << opt.raw_image << " and " << opt.ortho_image << "\n" << e.what() << "\n");
   } //End try/catch
+  asp::stereo_settings().epipolar_threshold = epipolar_threshold;
  
 } // End load_camera_and_find_ip
 
@@ -637,7 +774,7 @@ double refine_camera_with_dem_pts(Options const& opt,
 
 
 // Primary task-solving function.
-void ortho2pinhole(Options & opt){
+void ortho2pinhole(Options & opt, RefDemCache & dem_cache){
 
   // Input image handles
   boost::shared_ptr<DiskImageResource>
@@ -660,16 +797,18 @@ void ortho2pinhole(Options & opt){
   bool has_ref_dem = (opt.reference_dem != "");
   bool elevation_change_present = false;
   if (has_ref_dem) {
-    load_reference_dem(opt, rsrc_ortho, ortho_georef, dem, dem_georef, elevation_change_present);
+    load_reference_dem(opt, rsrc_ortho, ortho_georef, dem_cache, dem, dem_georef,
+                       elevation_change_present);
   }
   
 
   // When significant elevation change is present, the homography IP filter is not
   //  accurate and we need to compensate by relaxing our inlier threshold.
   const double ELEVATION_INLIER_SCALE = 10;
+  double inlier_threshold = -1; // Use the default
   if (elevation_change_present) {
     // TODO: Decouple threshold from other params!
-    asp::stereo_settings().epipolar_threshold = 150*asp::stereo_settings().ip_inlier_factor * ELEVATION_INLIER_SCALE;
+    inlier_threshold = 150*asp::stereo_settings().ip_inlier_factor * ELEVATION_INLIER_SCALE;
     //asp::stereo_settings().ip_inlier_factor *= ELEVATION_INLIER_SCALE;
     
     vw_out() << "Due to elevation change, increasing ip_inlier_factor to " 
@@ -679,7 +818,7 @@ void ortho2pinhole(Options & opt){
   // Load camera and find IP
   std::string match_filename = opt.output_cam + ".match";
   boost::shared_ptr<CameraModel> cam;
-  load_camera_and_find_ip(opt, rsrc_raw, rsrc_ortho, match_filename, cam);
+  load_camera_and_find_ip(opt, rsrc_raw, rsrc_ortho, match_filename, inlier_threshold, cam);
 
   // The ortho image file must have the height of the camera above the ground.
   // This can be over-written from the command line.
@@ -908,6 +1047,17 @@ std::string handle_rgb_input(std::string const& input_path, Options const& opt)
 
 }
 
+void check_camera_estimate(Options const& opt) {
+  if (opt.camera_estimate != "") {
+    if (!boost::filesystem::exists(opt.camera_estimate)) {
+      vw_throw( ArgumentErr() << "Estimated camera file " << opt.camera_estimate << " does not exist!\n");
+    }    
+  }
+
+  if (opt.short_circuit && opt.camera_estimate == "")
+    vw_throw( ArgumentErr() << "Estimated camera file is required with the short-circuit option.\n");
+}
+
 void handle_arguments( int argc, char *argv[], Options& opt ) {
   po::options_description general_options("");
   general_options.add_options()
@@ -942,7 +1092,13 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("reference-dem",             po::value(&opt.reference_dem)->default_value(""),
      "If provided, extract from this DEM the heights above the ground rather than assuming the value in --orthoimage-height.")
     ("crop-reference-dem", po::bool_switch(&opt.crop_reference_dem)->default_value(false)->implicit_value(true),
-     "Crop the reference DEM to a generous area to make it faster to load.");
+     "Crop the reference DEM to a generous area to make it faster to load.")
+    ("frame-list", po::value(&opt.frame_list)->default_value(""),
+     "Process many frames in one run, sharing the reference DEM among them. Each line of this file must have the raw image, orthoimage, input camera, output camera, and optionally the camera estimate, separated by spaces. Then no images or cameras are passed on the command line, and --camera-estimate is ignored.")
+    ("frame-threads", po::value(&opt.frame_threads)->default_value(1),
+     "With --frame-list, process this many frames at the same time.")
+    ("pyramid-levels", po::value(&opt.pyramid_levels)->default_value(0),
+     "If positive, find interest point matches only at this level of a pyramid of the images, with each level having half the resolution of the one before it, and refine them at each finer level with local correlation. The coarser levels are saved next to each image and reused by later runs.");
 
   general_options.add( vw::GdalWriteOptionsDescription(opt) );
   
@@ -959,7 +1115,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   positional_desc.add("input-cam",  1);
   positional_desc.add("output-cam", 1);
 
-  std::string usage("<raw image> <ortho image> <input pinhole cam> <output pinhole cam> [options]");
+  std::string usage("<raw image> <ortho image> <input pinhole cam> <output pinhole cam> [options]\n"
+                    "or: --frame-list <file> [options]");
   bool allow_unregistered = false;
   std::vector<std::string> unregistered;
   po::variables_map vm =
@@ -972,6 +1129,23 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   asp::stereo_settings().individually_normalize   = opt.individually_normalize;
   asp::stereo_settings().skip_image_normalization = opt.skip_image_normalization;
   asp::stereo_settings().ip_inlier_factor         = opt.ip_inlier_factor;
+
+  if (opt.pyramid_levels < 0)
+    vw_throw( ArgumentErr() << "The number of pyramid levels must be non-negative.\n");
+  if (opt.frame_threads < 1)
+    vw_throw( ArgumentErr() << "The number of frame threads must be positive.\n");
+
+  if (opt.frame_list != "") {
+    if (!opt.raw_image.empty())
+      vw_throw( ArgumentErr() << "Images and cameras cannot be passed on the command line "
+                              << "together with --frame-list.\n" << usage << general_options );
+    if (!boost::filesystem::exists(opt.frame_list))
+      vw_throw( ArgumentErr() << "Frame list " << opt.frame_list << " does not exist!\n");
+
+    // The output directories are created per frame. Log next to the list.
+    asp::log_to_file(argc, argv, "", opt.frame_list);
+    return;
+  }
   
   if ( opt.raw_image.empty() )
     vw_throw( ArgumentErr() << "Missing input raw image.\n" << usage << general_options );
@@ -985,14 +1159,7 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   if ( opt.output_cam.empty() )
     vw_throw( ArgumentErr() << "Missing output pinhole camera.\n" << usage << general_options );
 
-  if (opt.camera_estimate != "") {
-    if (!boost::filesystem::exists(opt.camera_estimate)) {
-      vw_throw( ArgumentErr() << "Estimated camera file " << opt.camera_estimate << " does not exist!\n");
-    }    
-  }
-
-  if (opt.short_circuit && opt.camera_estimate == "")
-    vw_throw( ArgumentErr() << "Estimated camera file is required with the short-circuit option.\n");
+  check_camera_estimate(opt);
 
   // Create the output directory
   vw::create_out_dir(opt.output_cam);
@@ -1002,6 +1169,112 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   
 }
 
+/// Copy the input intrinisc parameters to the camera estimate, without
+/// using the orthoimage.
+void short_circuit_camera(Options const& opt) {
+  vw_out() << "Creating camera without using ortho image.\n";
+  
+  // Load input camera files
+  vw_out() << "Loading: " << opt.input_cam << std::endl;
+  PinholeModel input_cam(opt.input_cam);
+  vw_out() << "Loading: " << opt.camera_estimate << std::endl;
+  PinholeModel est_cam(opt.camera_estimate);
+    
+  // Copy camera position and pose from estimate camera to input camera
+  input_cam.set_camera_center(est_cam.camera_center());
+  input_cam.set_camera_pose  (est_cam.camera_pose  ());
+    
+  // Write to output camera
+  vw_out() << "Writing: " << opt.output_cam << std::endl;
+  input_cam.write(opt.output_cam);
+}
+
+/// Find the camera of one frame. Options which ortho2pinhole() adjusts
+/// based on the frame are passed by value, so they do not carry over to
+/// the next frame.
+void process_frame(Options opt, RefDemCache & dem_cache) {
+  if (opt.short_circuit) {
+    short_circuit_camera(opt);
+    return;
+  }
+  
+  opt.raw_image   = handle_rgb_input(opt.raw_image,   opt);
+  opt.ortho_image = handle_rgb_input(opt.ortho_image, opt);
+  
+  ortho2pinhole(opt, dem_cache);
+}
+
+/// Read the frames to process with --frame-list. Each inherits the
+/// command-line options.
+void read_frame_list(Options const& opt, std::vector<Options> & frames) {
+  frames.clear();
+  std::ifstream ifs(opt.frame_list.c_str());
+  if (!ifs)
+    vw_throw(IOErr() << "Cannot open: " << opt.frame_list << "\n");
+  
+  std::string line;
+  while (std::getline(ifs, line)) {
+    std::istringstream is(line);
+    Options frame = opt;
+    if (!(is >> frame.raw_image))
+      continue; // Empty line
+    if (!(is >> frame.ortho_image >> frame.input_cam >> frame.output_cam))
+      vw_throw(ArgumentErr() << "Expecting at least four entries on line: " << line << "\n");
+    if (!(is >> frame.camera_estimate))
+      frame.camera_estimate = "";
+    frames.push_back(frame);
+  }
+}
+
+/// Process a frame from the list. A frame which fails does not stop
+/// the others.
+class FrameTask: public vw::Task, private boost::noncopyable {
+  Options const& m_frame;
+  RefDemCache  & m_dem_cache;
+  unsigned char& m_failed;
+public:
+  FrameTask(Options const& frame, RefDemCache & dem_cache, unsigned char & failed):
+    m_frame(frame), m_dem_cache(dem_cache), m_failed(failed) {}
+
+  void operator()() {
+    vw_out() << "Frame: " << m_frame.raw_image << std::endl;
+    try {
+      check_camera_estimate(m_frame);
+      vw::create_out_dir(m_frame.output_cam);
+      process_frame(m_frame, m_dem_cache);
+    } catch (const std::exception& e) {
+      vw_out() << "Failed to process frame " << m_frame.raw_image << ":\n" << e.what() << "\n";
+      m_failed = 1;
+    }
+  }
+};
+
+/// Process all frames in the list, with --frame-threads of them at the
+/// same time. They are started in order, so that the frames processed
+/// together are close, and can share the portion of the DEM in memory.
+void process_frame_list(Options const& opt) {
+  
+  std::vector<Options> frames;
+  read_frame_list(opt, frames);
+  vw_out() << "Processing " << frames.size() << " frames.\n";
+
+  RefDemCache dem_cache;
+  std::vector<unsigned char> failed(frames.size(), 0);
+  {
+    FifoWorkQueue queue(opt.frame_threads);
+    for (size_t it = 0; it < frames.size(); it++) {
+      boost::shared_ptr<FrameTask> task(new FrameTask(frames[it], dem_cache, failed[it]));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+
+  int num_failed = std::count(failed.begin(), failed.end(), 1);
+  if (num_failed > 0)
+    vw_throw(ArgumentErr() << "Failed to process " << num_failed << " out of "
+                           << frames.size() << " frames.\n");
+}
+
 // ================================================================================
 
 int main(int argc, char* argv[]) {
@@ -1009,30 +1282,13 @@ int main(int argc, char* argv[]) {
   Options opt;
   try {
     handle_arguments( argc, argv, opt );
-   
-    if (opt.short_circuit) {
-      vw_out() << "Creating camera without using ortho image.\n";
-  
-      // Load input camera files
-      vw_out() << "Loading: " << opt.input_cam << std::endl;
-      PinholeModel input_cam(opt.input_cam);
-      vw_out() << "Loading: " << opt.camera_estimate << std::endl;
-      PinholeModel est_cam(opt.camera_estimate);
-    
-      // Copy camera position and pose from estimate camera to input camera
-      input_cam.set_camera_center(est_cam.camera_center());
-      input_cam.set_camera_pose  (est_cam.camera_pose  ());
-    
-      // Write to output camera
-      vw_out() << "Writing: " << opt.output_cam << std::endl;
-      input_cam.write(opt.output_cam);
-      return 0;
+
+    if (opt.frame_list != "") {
+      process_frame_list(opt);
+    } else {
+      RefDemCache dem_cache;
+      process_frame(opt, dem_cache);
     }
-  
-    opt.raw_image   = handle_rgb_input(opt.raw_image,   opt);
-    opt.ortho_image = handle_rgb_input(opt.ortho_image, opt);
-  
-    ortho2pinhole(opt);
   } ASP_STANDARD_CATCHES;
   return 0;
 }
@@ -0,0 +1,86 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file IsisCameraModel.cc
+///
+
+#include <asp/IsisIO/IsisCameraModel.h>
+#include <asp/Core/StereoSettings.h>
+
+#include <atomic>
+#include <map>
+
+namespace vw {
+namespace camera {
+
+namespace {
+
+  // ISIS and SPICE keep global state while a cube is opened, so cameras
+  // are opened one at a time, whatever model they are for.
+  std::mutex g_isis_open_mutex;
+
+  // Used to tell pools apart, even if one is at the address of an old one
+  std::atomic<std::uint64_t> g_next_pool_id(0);
+
+  // For each pool the current thread used, its camera in that pool. A
+  // pool's id is never reused, so entries for pools which are gone are
+  // harmless.
+  std::map<std::uint64_t, asp::isis::IsisInterface*> & thread_cameras() {
+    thread_local std::map<std::uint64_t, asp::isis::IsisInterface*> cameras;
+    return cameras;
+  }
+
+  asp::isis::IsisInterface* open_isis_camera(std::string const& cube_filename) {
+    std::lock_guard<std::mutex> lock(g_isis_open_mutex);
+    return asp::isis::IsisInterface::open(cube_filename);
+  }
+}
+
+IsisCameraModel::IsisCameraModel(std::string cube_filename):
+  m_interface(open_isis_camera(cube_filename)) {
+
+  if (asp::stereo_settings().isis_camera_pool) {
+    m_pool.reset(new CameraPool);
+    m_pool->cube_filename = cube_filename;
+    m_pool->owner         = std::this_thread::get_id();
+    m_pool->id            = g_next_pool_id++;
+  }
+}
+
+asp::isis::IsisInterface const& IsisCameraModel::thread_interface() const {
+
+  if (m_pool.get() == NULL || std::this_thread::get_id() == m_pool->owner)
+    return *m_interface;
+
+  std::map<std::uint64_t, asp::isis::IsisInterface*> & cameras = thread_cameras();
+  auto it = cameras.find(m_pool->id);
+  if (it != cameras.end())
+    return *it->second;
+
+  // First use by this thread. The pool owns the camera, so it lives as
+  // long as this model.
+  boost::shared_ptr<asp::isis::IsisInterface> camera(open_isis_camera(m_pool->cube_filename));
+  {
+    std::lock_guard<std::mutex> lock(m_pool->mutex);
+    m_pool->cameras.push_back(camera);
+  }
+  cameras[m_pool->id] = camera.get();
+  return *camera;
+}
+
+}} // end namespace vw::camera
@@ -31,19 +31,31 @@
 // ASP
 #include <asp/IsisIO/IsisInterface.h>
 
+#include <boost/shared_ptr.hpp>
+
+#include <mutex>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
 namespace vw {
 namespace camera {
 
   // This is largely just a shortened reimplementation of ISIS's
   // Camera.cpp.
+  //
+  // An ISIS camera keeps state between calls, so it cannot be used by
+  // several threads at once. With --isis-camera-pool, each thread which
+  // uses this model gets its own ISIS camera, opened from the same cube
+  // the first time that thread needs it. Otherwise all calls go to one
+  // camera, and the caller must use only one thread.
   class IsisCameraModel : public CameraModel {
 
   public:
     //------------------------------------------------------------------
     // Constructors / Destructors
     //------------------------------------------------------------------
-    IsisCameraModel(std::string cube_filename) :
-      m_interface(asp::isis::IsisInterface::open( cube_filename )) {}
+    IsisCameraModel(std::string cube_filename);
     virtual std::string type() const { return "Isis"; }
 
     //------------------------------------------------------------------
@@ -54,61 +66,77 @@ namespace camera {
     //  image plane.  Returns a pixel location (col, row) where the
     //  point appears in the image.
     virtual Vector2 point_to_pixel(Vector3 const& point) const {
-      return m_interface->point_to_pixel( point ); }
+      return thread_interface().point_to_pixel( point ); }
 
     // Returns a (normalized) pointing vector from the camera center
     //  through the position of the pixel 'pix' on the image plane.
     virtual Vector3 pixel_to_vector (Vector2 const& pix) const {
-      return m_interface->pixel_to_vector( pix ); }
+      return thread_interface().pixel_to_vector( pix ); }
 
 
     // Returns the position of the focal point of the camera
     virtual Vector3 camera_center(Vector2 const& pix = Vector2() ) const {
-      return m_interface->camera_center( pix ); }
+      return thread_interface().camera_center( pix ); }
 
     // Pose is a rotation which moves a vector in camera coordinates
     // into world coordinates.
     virtual Quat camera_pose(Vector2 const& pix = Vector2() ) const {
-      return m_interface->camera_pose( pix ); }
+      return thread_interface().camera_pose( pix ); }
 
     // Returns the number of lines is the ISIS cube
-    int lines() const { return m_interface->lines(); }
+    int lines() const { return thread_interface().lines(); }
 
     // Returns the number of samples in the ISIS cube
-    int samples() const{ return m_interface->samples(); }
+    int samples() const{ return thread_interface().samples(); }
 
     // Returns the serial number of the ISIS cube
     std::string serial_number() const {
-      return m_interface->serial_number(); }
+      return thread_interface().serial_number(); }
 
     // Returns the ephemeris time for a pixel
     double ephemeris_time( Vector2 const& pix = Vector2() ) const {
-      return m_interface->ephemeris_time( pix );
+      return thread_interface().ephemeris_time( pix );
     }
 
     // Sun position in the target frame's inertial frame
     Vector3 sun_position( Vector2 const& pix = Vector2() ) const {
-      return m_interface->sun_position( pix );
+      return thread_interface().sun_position( pix );
     }
 
     // The three main radii that make up the spheroid. Z is out the polar region
     Vector3 target_radii() const {
-      return m_interface->target_radii();
+      return thread_interface().target_radii();
     }
 
     // The spheroid name
     std::string target_name() const {
-      return m_interface->target_name();
+      return thread_interface().target_name();
     }
 
     // The datum
     vw::cartography::Datum get_datum(bool use_sphere_for_non_earth) const {
-      return m_interface->get_datum(use_sphere_for_non_earth);
+      return thread_interface().get_datum(use_sphere_for_non_earth);
     }
     
+    // If each thread gets its own ISIS camera
+    bool uses_camera_pool() const { return m_pool.get() != NULL; }
+
   protected:
     boost::shared_ptr<asp::isis::IsisInterface> m_interface;
 
+    // The cameras of the threads other than the one which made this model
+    struct CameraPool {
+      std::string cube_filename;
+      std::thread::id owner; // the thread using m_interface
+      std::uint64_t id;      // unique for each pool, even after it is gone
+      std::mutex mutex;
+      std::vector<boost::shared_ptr<asp::isis::IsisInterface>> cameras;
+    };
+    boost::shared_ptr<CameraPool> m_pool;
+
+    // The ISIS camera to be used by the current thread
+    asp::isis::IsisInterface const& thread_interface() const;
+
     friend std::ostream& operator<<( std::ostream&, IsisCameraModel const& );
   };
 
@@ -29,6 +29,7 @@
 #include <vw/Camera/OpticalBarModel.h>
 
 #include <asp/Core/Common.h>
+#include <asp/Core/Hash.h>
 #include <asp/Core/StereoSettings.h>
 #include <asp/IsisIO/Equation.h>
 #include <asp/IsisIO/IsisCameraModel.h>
@@ -44,15 +45,65 @@
 
 #include <xercesc/util/PlatformUtils.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/filesystem.hpp>
 
 #include <map>
 #include <utility>
 #include <string>
 #include <ostream>
 #include <limits>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
 
 namespace asp {
 
+// If the model state for this ISD file was saved in state_dir, by
+// this or another process, load it. Else load the ISD and save its
+// state there. The state is keyed by a hash of the ISD, so a changed
+// ISD is loaded anew.
+void load_csm_model_via_state(std::string const& path, std::string const& state_dir,
+                              asp::CsmModel & cam) {
+
+  std::uint64_t hash = 0;
+  if (!asp::hash_file(path, hash)) {
+    cam.load_model(path); // this will produce the error message
+    return;
+  }
+  std::string state_file = state_dir + "/" + boost::filesystem::path(path).stem().string()
+    + "-" + asp::hash_to_hex(hash) + ".json";
+
+  if (boost::filesystem::exists(state_file)) {
+    try {
+      cam.load_model(state_file);
+      return;
+    } catch (std::exception const& e) {
+      vw::vw_out(vw::WarningMessage) << "Ignoring camera model state: " << state_file
+                                     << ". " << e.what() << "\n";
+    }
+  }
+
+  cam.load_model(path);
+
+  // Write it under another name first, so that no other process reads
+  // it partially written. It is fine if this fails.
+  std::ostringstream tmp;
+  tmp << state_file << ".tmp" << getpid();
+  try {
+    boost::filesystem::create_directories(state_dir);
+    {
+      std::ofstream ofs(tmp.str().c_str());
+      ofs << cam.m_gm_model->getModelState();
+      if (!ofs)
+        vw::vw_throw(vw::IOErr() << "Failed to write: " << tmp.str() << "\n");
+    }
+    boost::filesystem::rename(tmp.str(), state_file);
+  } catch (...) {
+    boost::system::error_code ec;
+    boost::filesystem::remove(tmp.str(), ec);
+  }
+}
+
 CameraModelLoader::CameraModelLoader() {
   xercesc::XMLPlatformUtils::Initialize();
 }
@@ -128,7 +179,7 @@ CameraModelLoader::load_isis_camera_model(std::string const& path) const {
   
   std::string ext = vw::get_extension(path);
   if (asp::CsmModel::file_has_isd_extension(path)) // Community Sensor Model
-    return CameraModelPtr(new asp::CsmModel(path));
+    return load_csm_camera_model(path);
   else // Should be a .cub extension.
     return CameraModelPtr(new vw::camera::IsisCameraModel(path));
 #endif
@@ -149,7 +200,10 @@ boost::shared_ptr<vw::camera::CameraModel>
 CameraModelLoader::load_csm_camera_model(std::string const& path) const {
   // Use the class method, then pack in a base class pointer.
   boost::shared_ptr<asp::CsmModel> cam_ptr(new asp::CsmModel());
-  cam_ptr->load_model(path);
+  if (m_csm_state_dir.empty())
+    cam_ptr->load_model(path);
+  else
+    load_csm_model_via_state(path, m_csm_state_dir, *cam_ptr);
   return CameraModelPtr(cam_ptr);
 }
 
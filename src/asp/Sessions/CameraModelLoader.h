@@ -50,6 +50,15 @@ namespace asp {
     CameraModelPtr load_ASTER_camera_model      (std::string const& path) const;
     CameraModelPtr load_optical_bar_camera_model(std::string const& path) const;
     CameraModelPtr load_csm_camera_model        (std::string const& path) const;
+
+    /// Keep in this directory the model states of the CSM cameras
+    /// loaded from ISD files, and load them from there afterwards, also
+    /// in other processes. That does not need the CSM plugins, so it is
+    /// much faster. An empty directory turns this off.
+    void set_csm_state_dir(std::string const& dir) { m_csm_state_dir = dir; }
+
+  private:
+    std::string m_csm_state_dir;
   }; // End class CameraModelLoader
 
   
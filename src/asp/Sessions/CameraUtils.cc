@@ -27,6 +27,10 @@
 #include <vw/Camera/PinholeModel.h>
 #include <vw/Camera/CameraUtilities.h>
 #include <vw/InterestPoint/InterestData.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Core/Settings.h>
+
+#include <boost/noncopyable.hpp>
 
 #include <string>
 #include <iostream>
@@ -37,6 +41,73 @@ using namespace vw;
 
 namespace asp {
 
+namespace {
+
+  // Load one camera. Errors are kept, to be reported by the caller, 
+  // rather than thrown in a worker thread.
+  class CameraLoadTask: public vw::Task, private boost::noncopyable {
+    std::string const& m_image_file;
+    std::string const& m_camera_file;
+    std::string const& m_out_prefix;
+    vw::GdalWriteOptions const& m_opt;
+    std::string m_stereo_session;
+    boost::shared_ptr<vw::camera::CameraModel> & m_camera_model;
+    std::string & m_error;
+  public:
+    CameraLoadTask(std::string const& image_file, std::string const& camera_file,
+                   std::string const& out_prefix, vw::GdalWriteOptions const& opt,
+                   std::string const& stereo_session,
+                   boost::shared_ptr<vw::camera::CameraModel> & camera_model,
+                   std::string & error):
+      m_image_file(image_file), m_camera_file(camera_file), m_out_prefix(out_prefix),
+      m_opt(opt), m_stereo_session(stereo_session), m_camera_model(camera_model),
+      m_error(error) {}
+
+    void operator()() {
+      try {
+        SessionPtr session
+          (asp::StereoSessionFactory::create(m_stereo_session, m_opt,
+                                             m_image_file, m_image_file,
+                                             m_camera_file, m_camera_file,
+                                             m_out_prefix));
+        m_camera_model = session->camera_model(m_image_file, m_camera_file);
+      } catch (std::exception const& e) {
+        m_error = e.what();
+      }
+    }
+  };
+
+  // Load the cameras starting at the given index, using several threads
+  void load_cameras_in_parallel(std::vector<std::string> const& image_files,
+                                std::vector<std::string> const& camera_files,
+                                std::string const& out_prefix, 
+                                vw::GdalWriteOptions const& opt,
+                                std::string const& stereo_session,
+                                size_t beg, int num_threads,
+                                std::vector<boost::shared_ptr<vw::camera::CameraModel>>
+                                & camera_models) {
+
+    vw_out() << "Loading " << image_files.size() - beg << " cameras using "
+             << num_threads << " threads.\n";
+    std::vector<std::string> errors(image_files.size());
+    vw::FifoWorkQueue queue(num_threads);
+    for (size_t i = beg; i < image_files.size(); i++) {
+      boost::shared_ptr<CameraLoadTask>
+        task(new CameraLoadTask(image_files[i], camera_files[i], out_prefix, opt,
+                                stereo_session, camera_models[i], errors[i]));
+      queue.add_task(task);
+    }
+    queue.join_all();
+
+    for (size_t i = beg; i < image_files.size(); i++) {
+      if (errors[i] != "")
+        vw_throw(ArgumentErr() << "Failed to load the camera for " << image_files[i]
+                 << " and " << camera_files[i] << ": " << errors[i]);
+    }
+  }
+
+} // end anonymous namespace
+
 // Load cameras from given image and camera files
 void load_cameras(std::vector<std::string> const& image_files,
                   std::vector<std::string> const& camera_files,
@@ -54,30 +125,43 @@ void load_cameras(std::vector<std::string> const& image_files,
   
   if (image_files.size() != camera_files.size()) 
     vw_throw(ArgumentErr() << "Expecting as many images as cameras.\n");  
-  
+
+  camera_models.resize(image_files.size());
   for (size_t i = 0; i < image_files.size(); i++) {
-    vw_out(DebugMessage,"asp") << "Loading: " << image_files [i] << ' '
-                               << camera_files[i] << "\n";
+
+    // Once the first camera is loaded, the session name is known and the
+    // CSM plugins are initialized. Loading CSM cameras, which are often
+    // in the thousands, then does not share state, so do the rest at once.
+    if (i == 1 && stereo_session == "csm" && image_files.size() > 2) {
+      int num_threads = (opt.num_threads > 0) ? opt.num_threads
+                                              : vw_settings().default_num_threads();
+      load_cameras_in_parallel(image_files, camera_files, out_prefix, opt,
+                               stereo_session, 1, num_threads, camera_models);
+    }
     
-    // The same camera is double-loaded into the same session instance.
-    // TODO: One day replace this with a simpler camera model loader class.
-    // But note that this call also refines the stereo session name.
-    SessionPtr session
-      (asp::StereoSessionFactory::create(stereo_session, opt,
-                                         image_files [i], image_files [i],
-                                         camera_files[i], camera_files[i],
-                                         out_prefix));
+    if (camera_models[i].get() == NULL) {
+      vw_out(DebugMessage,"asp") << "Loading: " << image_files [i] << ' '
+                                 << camera_files[i] << "\n";
     
-    camera_models.push_back(session->camera_model(image_files [i],
-                                                  camera_files[i]));
+      // The same camera is double-loaded into the same session instance.
+      // TODO: One day replace this with a simpler camera model loader class.
+      // But note that this call also refines the stereo session name.
+      SessionPtr session
+        (asp::StereoSessionFactory::create(stereo_session, opt,
+                                           image_files [i], image_files [i],
+                                           camera_files[i], camera_files[i],
+                                           out_prefix));
     
-    // This is necessary to avoid a crash with ISIS cameras which is single-threaded
-    if (!session->supports_multi_threading())
-      single_threaded_cameras = true;
+      camera_models[i] = session->camera_model(image_files [i], camera_files[i]);
+    
+      // This is necessary to avoid a crash with ISIS cameras which is single-threaded
+      if (!session->supports_multi_threading())
+        single_threaded_cameras = true;
+    }
     
     if (approximate_pinhole_intrinsics) {
       boost::shared_ptr<vw::camera::PinholeModel> pinhole_ptr = 
-        boost::dynamic_pointer_cast<vw::camera::PinholeModel>(camera_models.back());
+        boost::dynamic_pointer_cast<vw::camera::PinholeModel>(camera_models[i]);
       // Replace lens distortion with fast approximation
       vw::camera::update_pinhole_for_fast_point2pixel<vw::camera::TsaiLensDistortion>
         (*(pinhole_ptr.get()), file_image_size(image_files[i]));
@@ -19,6 +19,7 @@
 ///
 #include <vw/Core/Exception.h>
 #include <vw/Core/Log.h>
+#include <vw/Core/Thread.h>
 #include <vw/Math/Vector.h>
 #include <vw/Math/Functors.h>
 #include <vw/Math/Geometry.h>
@@ -42,6 +43,7 @@
 #include <utility>
 #include <string>
 #include <ostream>
+#include <sstream>
 #include <limits>
 
 using namespace vw;
@@ -49,6 +51,20 @@ using namespace vw::cartography;
 
 namespace asp {
 
+  namespace {
+    // The cameras shared by the sessions of this process, if enabled
+    bool g_share_camera_models = false;
+    vw::Mutex g_shared_camera_mutex;
+    std::map<std::string, boost::shared_ptr<vw::camera::CameraModel>> g_shared_camera_models;
+  }
+
+  void StereoSession::share_camera_models(bool share) {
+    vw::Mutex::Lock lock(g_shared_camera_mutex);
+    g_share_camera_models = share;
+    if (!share)
+      g_shared_camera_models.clear();
+  }
+
   // Pass over all the string variables we use
   void StereoSession::initialize(vw::GdalWriteOptions const& options,
                                  std::string const& left_image_file,
@@ -64,6 +80,12 @@ namespace asp {
     m_right_camera_file = right_camera_file;
     m_out_prefix        = out_prefix;
     m_input_dem         = input_dem;
+
+    // The stereo tools set the default for this
+    std::string cache_dir = stereo_settings().camera_cache_dir;
+    if (cache_dir == "NONE")
+      cache_dir = "";
+    m_camera_loader.set_csm_state_dir(cache_dir);
     
     // Do any other initialization steps needed
     init_disk_transform();
@@ -210,22 +232,45 @@ StereoSession::camera_model(std::string const& image_file, std::string const& ca
   if (map_it != m_camera_model.end()) 
     return map_it->second;
 
-  // Sometime when we do many attempts at loading cameras we don't want to print
-  // this message. 
-  if (!quiet) 
-    vw_out() << "Loading camera model: " << image_file << ' ' << camera_file << "\n";
-
   // Retrieve the pixel offset (if any) to cropped images
   vw::Vector2 pixel_offset = camera_pixel_offset(m_input_dem,
                                                  m_left_image_file,
                                                  m_right_image_file,
                                                  image_file);
   
+  // See if another session of this process loaded this camera. The
+  // options other than the crop window and output prefix are the same
+  // for all of them, so the camera depends only on what is below.
+  std::ostringstream os;
+  os.precision(17);
+  os << name() << '\n' << image_file << '\n' << camera_file << '\n'
+     << pixel_offset << '\n' << stereo_settings().bundle_adjust_prefix;
+  std::string shared_key = os.str();
+  {
+    vw::Mutex::Lock lock(g_shared_camera_mutex);
+    if (g_share_camera_models) {
+      auto shared_it = g_shared_camera_models.find(shared_key);
+      if (shared_it != g_shared_camera_models.end()) {
+        m_camera_model[image_cam_pair] = shared_it->second;
+        return shared_it->second;
+      }
+    }
+  }
+
+  // Sometime when we do many attempts at loading cameras we don't want to print
+  // this message. 
+  if (!quiet) 
+    vw_out() << "Loading camera model: " << image_file << ' ' << camera_file << "\n";
+
   if (camera_file == "") // No camera file provided, use the image file.
     m_camera_model[image_cam_pair] = load_camera_model(image_file, image_file, pixel_offset);
   else // Camera file provided
     m_camera_model[image_cam_pair] = load_camera_model(image_file, camera_file, pixel_offset);
 
+  vw::Mutex::Lock lock(g_shared_camera_mutex);
+  if (g_share_camera_models)
+    g_shared_camera_models[shared_key] = m_camera_model[image_cam_pair];
+
   return m_camera_model[image_cam_pair];
 }
 
@@ -472,6 +517,13 @@ shared_preprocessing_hook(vw::GdalWriteOptions & options,
   options = this->m_options;
   options.gdal_options["PREDICTOR"] = "1";
 
+  // Uncompressed tiled images can be memory-mapped when read. See
+  // parse_multiview().
+  if (stereo_settings().mmap_aligned_images) {
+    options.gdal_options["COMPRESS"] = "NONE";
+    options.gdal_options.erase("PREDICTOR");
+  }
+
   // Read the georef if available in the input images
   has_left_georef  = read_georeference(left_georef,  left_input_file);
   has_right_georef = read_georeference(right_georef, right_input_file);
@@ -22,6 +22,7 @@
 #ifndef __STEREO_SESSION_H__
 #define __STEREO_SESSION_H__
 
+#include <vw/Core/Settings.h>
 #include <vw/Image/ImageViewBase.h>
 #include <vw/Image/ImageViewRef.h>
 #include <vw/Image/Transform.h>
@@ -89,6 +90,10 @@ namespace asp {
                  std::string const& camera_file = "",
                  bool quiet = false);
 
+    /// Let all sessions in this process share the cameras they load, as
+    /// when a process runs a stereo stage for many tiles of one run.
+    static void share_camera_models(bool share);
+
     /// Method to help determine what session we actually have
     virtual std::string name() const = 0;
 
@@ -109,7 +114,18 @@ namespace asp {
                      vw::camera::CameraModel* cam2,
                      std::string const& match_filename,
                      std::string const left_ip_file = "",
-                     std::string const right_ip_file = "");
+                     std::string const right_ip_file = "",
+                     bool reuse_ip_files = false);
+
+    /// Detect interest points in one image and save them to ip_file,
+    /// to be passed later to ip_matching() with reuse_ip_files set.
+    /// This is only correct when the interest points do not depend on
+    /// the other image of a pair, so without rough homography, and
+    /// with the integral detector or individual normalization.
+    static void detect_ip_for_image(std::string const& image_file,
+                                    Vector6f    const& stats,
+                                    int ip_per_tile, float nodata,
+                                    std::string const& ip_file);
 
     /// Compute the min, max, mean, and standard deviation of an image object and write them to a log.
     /// - "tag" is only used to make the log messages more descriptive.
@@ -321,27 +337,43 @@ Vector6f StereoSession::gather_stats(vw::ImageViewBase<ViewT> const& view_base,
   ViewT image = view_base.impl();
 
   const bool use_cache = ((prefix != "") && (image_path != ""));
-  std::string cache_path = "";
+  std::string cache_path = "", sidecar_path = "";
   if (use_cache) {
+    // A sidecar next to the image, such as image-stats.tif for
+    // image.tif, is shared by all tools and runs which use this image.
+    sidecar_path = fs::change_extension(image_path, "").string() + "-stats.tif";
     if (image_path.find(prefix) == 0) {
       // If the image is, for example, run/run-L.tif,
       // then cache_path = run/run-L-stats.tif.
-      cache_path =  fs::change_extension(image_path, "").string() + "-stats.tif";
+      cache_path = sidecar_path;
     }else {
       // If the image is left_image.tif, 
       // then cache_path = run/run-left_image.tif
       cache_path = prefix + '-' + fs::path(image_path).stem().string() + "-stats.tif";
     }
   }
-  
+
   // Check if this stats file was computed after any image modifications.
+  // Else, a sidecar written by another tool will do.
+  std::string read_path = "";
   if ((use_cache && asp::is_latest_timestamp(cache_path, image_path)) ||
-      (stereo_settings().force_reuse_match_files && fs::exists(cache_path))) {
-    vw_out(InfoMessage) << "\t--> Reading statistics from file " + cache_path << std::endl;
+      (stereo_settings().force_reuse_match_files && fs::exists(cache_path)))
+    read_path = cache_path;
+  else if (use_cache && asp::is_latest_timestamp(sidecar_path, image_path))
+    read_path = sidecar_path;
+
+  if (read_path != "") {
+    vw_out(InfoMessage) << "\t--> Reading statistics from file " + read_path << std::endl;
     Vector<float32> stats;
-    read_vector(stats, cache_path); // Just fetch the stats from the file on disk.
+    read_vector(stats, read_path); // Just fetch the stats from the file on disk.
     result = stats;
 
+    // Save a copy with this prefix, as other tools look for it there
+    if (read_path != cache_path) {
+      vw_out() << "\t    Writing stats file: " << cache_path << std::endl;
+      write_vector(cache_path, stats);
+    }
+
   } else { // Compute the results
 
     // Compute statistics at a reduced resolution
@@ -351,30 +383,25 @@ Vector6f StereoSession::gather_stats(vw::ImageViewBase<ViewT> const& view_base,
 
     vw_out(InfoMessage) << "Using downsample scale: " << stat_scale << std::endl;
 
-    ChannelAccumulator<vw::math::CDFAccumulator<float> > accumulator;
-    for_each_pixel( subsample( edge_extend(image, ConstantEdgeExtension()),
-                              stat_scale ),
-                    accumulator );
-
-    // Compute the CDF in parallel.
-    // -> Turned off because it makes the unit tests non-deterministic.
-    //Vector2i block_size(256,256);
-    //int buffer_size = 100000; // TODO: If this gets too large the CDFAccumulator class fails!
-    //vw::math::CDFAccumulator<float> accumulator(buffer_size);
-    //block_cdf_computation(image, accumulator, stat_scale, block_size);
-
-    result[0] = accumulator.quantile(0); // Min
-    result[1] = accumulator.quantile(1); // Max
-    result[2] = accumulator.approximate_mean();
-    result[3] = accumulator.approximate_stddev();
-    result[4] = accumulator.quantile(0.02); // Percentile values
-    result[5] = accumulator.quantile(0.98);
+    // Sample bands of the image in parallel. The statistics are merged
+    // in a fixed order, so they do not depend on the number of threads.
+    result = block_sampled_stats(image, stat_scale, vw_settings().default_num_threads());
 
     // Cache the results to disk
     if (use_cache) {
       vw_out() << "\t    Writing stats file: " << cache_path << std::endl;
       Vector<float32> stats = result;  // cast
       write_vector(cache_path, stats);
+
+      // The image directory may not be writable, then just skip the sidecar
+      if (sidecar_path != cache_path) {
+        try {
+          write_vector(sidecar_path, stats);
+        } catch (const std::exception& e) {
+          vw_out(DebugMessage) << "Could not write " << sidecar_path << ": "
+                               << e.what() << std::endl;
+        }
+      }
     }
 
   } // Done computing the results
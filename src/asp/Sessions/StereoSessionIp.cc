@@ -62,7 +62,8 @@ bool StereoSession::ip_matching(std::string const& input_file1,
                                 vw::camera::CameraModel* cam2,
                                 std::string const& match_filename,
                                 std::string const  left_ip_file,
-                                std::string const  right_ip_file) {
+                                std::string const  right_ip_file,
+                                bool reuse_ip_files) {
 
   vw_out() << "\t--> Matching interest points in StereoSession.\n";
 
@@ -87,10 +88,11 @@ bool StereoSession::ip_matching(std::string const& input_file1,
     return true;
   }
 
-  // If having to rebuild then wipe the old data
-  if (boost::filesystem::exists(left_ip_file)) 
+  // If having to rebuild then wipe the old data, unless the ip files
+  // were just made, to be shared among pairs.
+  if (!reuse_ip_files && boost::filesystem::exists(left_ip_file)) 
     boost::filesystem::remove(left_ip_file);
-  if (boost::filesystem::exists(right_ip_file)) 
+  if (!reuse_ip_files && boost::filesystem::exists(right_ip_file)) 
     boost::filesystem::remove(right_ip_file);
   if (boost::filesystem::exists(match_filename)) {
     vw_out() << "Removing old match file: " << match_filename << "\n";
@@ -229,6 +231,34 @@ bool StereoSession::ip_matching(std::string const& input_file1,
   return inlier;
 } // End function ip_matching()
 
+// Find the interest points of one image, as ip_matching() would, and save them
+void StereoSession::detect_ip_for_image(std::string const& image_file,
+                                        Vector6f    const& stats,
+                                        int ip_per_tile, float nodata,
+                                        std::string const& ip_file) {
+
+  DiskImageView<float> image(image_file);
+  ImageViewRef<float> image_norm = image, dummy_norm = image;
+  if ((stereo_settings().ip_matching_method != DETECT_IP_METHOD_INTEGRAL) &&
+      (stats[0] != stats[1])) {
+    // With individual normalization, the other image does not matter
+    bool do_not_exceed_min_max = false;
+    asp::normalize_images(stereo_settings().force_use_entire_range,
+                          true, // individually normalize
+                          true, // Use percentile based stretch for ip matching
+                          do_not_exceed_min_max,
+                          stats, stats, image_norm, dummy_norm);
+  }
+
+  // The file is read if present, so make sure it is redone
+  if (boost::filesystem::exists(ip_file))
+    boost::filesystem::remove(ip_file);
+  vw::create_out_dir(ip_file);
+
+  vw::ip::InterestPointList ip;
+  detect_ip(ip, image_norm, ip_per_tile, ip_file, nodata);
+}
+
 // This logic is used in a handful of places  
 std::string StereoSession::stereo_match_filename(std::string const& left_cropped_file,
                                                  std::string const& right_cropped_file,
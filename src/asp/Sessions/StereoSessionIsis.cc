@@ -483,7 +483,8 @@ void StereoSessionIsis::preprocessing_hook(bool adjust_left_image_size,
 }
 
 bool StereoSessionIsis::supports_multi_threading () const {
-  return false;
+  // ISIS cameras are not thread-safe, unless each thread gets its own
+  return asp::stereo_settings().isis_camera_pool;
 }
   
 // Only used with mask_flatfield option?
@@ -22,10 +22,11 @@
 #include <asp/SpiceIO/TabulatedDataReader.h>
 #include <boost/algorithm/string.hpp>
 #include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
 
-using namespace std;
+#include <fstream>
 
-#define LINE_MAXSIZE 4096
+using namespace std;
 
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
 /*               TabulatedDataReader Class Methods               */
@@ -39,45 +40,52 @@ namespace spice {
                                             const std::string &delimeters = ",") {
     m_delimeters = delimeters;
 
-    m_file.open(filename.c_str());
-    if ( !m_file.is_open() ) {
+    std::ifstream file(filename.c_str());
+    if ( !file.is_open() ) {
       throw vw::IOErr() << "Failed to open tabulated data record: " << filename << ".";
     }
+
+    std::string line;
+    while (std::getline(file, line))
+      m_lines.push_back(line);
+    m_fields.resize(m_lines.size());
   }
 
 
   // Returns 1 on success, 0 on failure
   int TabulatedDataReader::find_line_with_text(std::string query,
                                                std::vector<std::string> &result) {
-    // Reset file pointer to the top of the file
-    m_file.seekg(0);
-
-    int found = 0;
-    char line[LINE_MAXSIZE];
-
-    // Read through the lines until the search returns a match
-    while ( !found && !m_file.eof() ) {
-      m_file.getline(line, LINE_MAXSIZE);
-
-      // If the text is found, cut up this line using the delimeters
-      // and return true.
-      if(boost::find_first(line, query)) {
-        string str_line(line);
-        cout << str_line << endl;
-        boost::split( result, str_line, boost::is_any_of(m_delimeters) );
-        vector<string>::iterator iter = result.begin();
-
-        //      unsigned int c = 0;
-        for (iter = result.begin(); iter != result.end(); iter++) {
-          boost::trim(*iter);
-          //      cout << c << ":   " << *iter << "\n";
-          //      c++;
+
+    // Search through the lines until one has the text, unless this
+    // query was seen before
+    std::map<std::string, int>::const_iterator it = m_found.find(query);
+    int found_line = -1;
+    if (it != m_found.end()) {
+      found_line = it->second;
+    } else {
+      for (size_t i = 0; i < m_lines.size(); i++) {
+        if (boost::find_first(m_lines[i], query)) {
+          found_line = i;
+          break;
         }
-        found = 1;
       }
+      m_found[query] = found_line;
+    }
+
+    if (found_line < 0)
+      return 0;
+
+    // Cut up this line using the delimeters, the first time it is found
+    std::vector<std::string> & fields = m_fields[found_line];
+    if (fields.empty()) {
+      vw::vw_out(vw::DebugMessage, "asp") << m_lines[found_line] << "\n";
+      boost::split( fields, m_lines[found_line], boost::is_any_of(m_delimeters) );
+      for (vector<string>::iterator iter = fields.begin(); iter != fields.end(); iter++)
+        boost::trim(*iter);
     }
+    result = fields;
 
-    return found;
+    return 1;
   }
 
 }} //end namespace asp::spice
@@ -19,24 +19,28 @@
 /// \file TabulatedDataReader.h
 ///
 
+#include <map>
 #include <string>
 #include <vector>
-#include <iostream>
-#include <fstream>
 
 namespace asp {
 namespace spice {
 
+  /// Reads a text file of tabulated data once, and keeps its lines
+  /// in memory. Each line is split into fields the first time it is
+  /// found, and the line a query finds is remembered, so repeated
+  /// queries do not search or split again.
   class TabulatedDataReader {
   public:
     /* Constructor / Destructor */
     TabulatedDataReader( const std::string &filename, const std::string &delimeters);
     ~TabulatedDataReader() { close(); }
 
+    /// Free the lines read from the file
     void close() {
-      if (m_file.is_open()) {
-        m_file.close();
-      }
+      m_lines.clear();
+      m_fields.clear();
+      m_found.clear();
     }
 
     /* Accessors */
@@ -46,7 +50,9 @@ namespace spice {
   private:
     std::string m_delimeters;
 
-    std::ifstream m_file;
+    std::vector<std::string> m_lines;
+    std::vector<std::vector<std::string>> m_fields; // empty until the line is split
+    std::map<std::string, int> m_found; // the line found by each query, or -1
   };
 
 }} // end namespace asp::spice
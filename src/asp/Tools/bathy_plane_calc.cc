@@ -32,7 +32,6 @@
 #include <vw/Camera/CameraModel.h>
 #include <vw/Cartography/CameraBBox.h>
 #include <vw/Core/ThreadPool.h>
-#include <vw/Math/RandomSet.h>
 
 #include <Eigen/Dense>
 
@@ -41,6 +40,7 @@
 #include <iterator>
 #include <iostream>
 #include <vector>
+#include <map>
 
 using namespace vw;
 using namespace vw::cartography;
@@ -100,41 +100,22 @@ void find_projection(// Inputs
   }
 }
 
-// This is not used for now, it could be used to make the logic
-// of processing mask boundary points multi-threaded.
+// Find the mask boundary pixels in a tile of the mask, that is, the
+// pixels above threshold which have neighbors not above threshold.
+// Each task writes only to its own output vector, so no locking is needed.
 class MaskBoundaryTask : public vw::Task, private boost::noncopyable {
-  vw::BBox2i m_bbox; // Region of image we're working in
-
-  ImageViewRef<float>                   m_mask;
-  float                                 m_mask_nodata_val;
-  boost::shared_ptr<CameraModel>        m_camera_model;
-  vw::cartography::GeoReference         m_shape_georef;
-  vw::cartography::GeoReference         m_dem_georef;
-  ImageViewRef<PixelMask<float>>        m_masked_dem;
-  
-  // Note how all of these are aliases
-  Mutex                        & m_mutex;
-  std::vector<Eigen::Vector3d> & m_point_vec;
-  std::vector<vw::Vector3>     & m_llh_vec;
-  std::vector<vw::Vector2>     & m_used_vertices;
+  vw::BBox2i                  m_bbox; // Region of image we're working in
+  ImageViewRef<float>         m_mask;
+  float                       m_mask_nodata_val;
+  std::vector<vw::Vector2i> & m_boundary_pixels;
   
 public:
-  MaskBoundaryTask(vw::BBox2i                            bbox,
-                   ImageViewRef<float>                   mask,
-                   float                                 mask_nodata_val,
-                   boost::shared_ptr<CameraModel>        camera_model,
-                   vw::cartography::GeoReference const & shape_georef,
-                   vw::cartography::GeoReference const & dem_georef,
-                   ImageViewRef<PixelMask<float>>        masked_dem,
-                   Mutex                               & mutex,
-                   std::vector<Eigen::Vector3d>        & point_vec,
-                   std::vector<vw::Vector3>            & llh_vec,
-                   std::vector<vw::Vector2>            & used_vertices):
+  MaskBoundaryTask(vw::BBox2i                  bbox,
+                   ImageViewRef<float>         mask,
+                   float                       mask_nodata_val,
+                   std::vector<vw::Vector2i> & boundary_pixels):
     m_bbox(bbox), m_mask(mask), m_mask_nodata_val(mask_nodata_val),
-    m_camera_model(camera_model), m_shape_georef(shape_georef),
-    m_dem_georef(dem_georef), m_masked_dem(masked_dem),
-    m_mutex(mutex), m_point_vec(point_vec),
-    m_llh_vec(llh_vec), m_used_vertices(used_vertices) {}
+    m_boundary_pixels(boundary_pixels) {}
   
   void operator()() {
 
@@ -146,8 +127,11 @@ public:
     // Make a local copy of the tile
     ImageView<float> mask_tile = crop(m_mask, extra_box);
 
-    for (int col = 0; col < mask_tile.cols(); col++) {
-      for (int row = 0; row < mask_tile.rows(); row++) {
+    // Only work on pixels in the current box (the bigger box is
+    // needed to be able to examine neighbors).
+    BBox2i box = m_bbox - extra_box.min();
+    for (int row = box.min().y(); row < box.max().y(); row++) {
+      for (int col = box.min().x(); col < box.max().x(); col++) {
 
         // Look at pixels above threshold which have neighbors <= threshold
         if (mask_tile(col, row) <= m_mask_nodata_val) 
@@ -172,69 +156,17 @@ public:
           }
         }
           
-        if (!border_pix) 
-          continue;
-
-        // Create the pixel in the full image coordinates
-        Vector2 pix = Vector2(col, row) + extra_box.min();
-
-        // Only work on pixels in the current box (earlier had a
-        // bigger box to be able to examine neighbors).
-        if (!m_bbox.contains(pix))
-          continue;
-        
-        // The ray going to the ground
-        // Here we assume that the camera model is thread-safe, which is
-        // true for all cameras except ISIS, and this code will be used
-        // on Earth only.
-        Vector3 cam_ctr = m_camera_model->camera_center(pix);
-        Vector3 cam_dir = m_camera_model->pixel_to_vector(pix);
-
-        // Intersect the ray going from the given camera pixel with a DEM.
-        bool treat_nodata_as_zero = false;
-        bool has_intersection = false;
-        double height_error_tol = 0.001; // in meters
-        double max_abs_tol = 1e-14;
-        double max_rel_tol = 1e-14;
-        int num_max_iter = 100;
-        Vector3 xyz_guess(0, 0, 0);
-        Vector3 xyz = vw::cartography::camera_pixel_to_dem_xyz
-          (cam_ctr, cam_dir, m_masked_dem,
-           m_dem_georef, treat_nodata_as_zero,
-           has_intersection, height_error_tol, max_abs_tol, max_rel_tol, 
-           num_max_iter, xyz_guess);
-          
-        if (!has_intersection) 
-          continue;
-
-        Vector3 llh = m_dem_georef.datum().cartesian_to_geodetic(xyz);
-
-        Eigen::Vector3d eigen_xyz;
-        for (size_t coord = 0; coord < 3; coord++) 
-          eigen_xyz[coord] = xyz[coord];
-
-        // TODO(oalexan1): This is fragile due to the 360 degree
-        // uncertainty in latitude
-        Vector2 proj_pt = m_shape_georef.lonlat_to_point(Vector2(llh[0], llh[1]));
-
-        {
-          // Need to make sure to lock the shared resource
-          Mutex::Lock lock(m_mutex);
-          m_point_vec.push_back(eigen_xyz);
-          m_used_vertices.push_back(proj_pt);
-          m_llh_vec.push_back(llh);
-        }
+        if (border_pix) 
+          m_boundary_pixels.push_back(Vector2i(col, row) + extra_box.min());
       }
-      
     }
-    
   }
   
 };
 
 // Find the mask boundary (points where the points in the mask have
 // neighbors not in the mask), shoot points from there onto the DEM,
-// and return the obtained points.
+// and return the obtained points, at most num_samples of them.
 void find_points_at_mask_boundary(ImageViewRef<float> mask,
                                   float mask_nodata_val,
                                   boost::shared_ptr<CameraModel> camera_model,
@@ -251,134 +183,95 @@ void find_points_at_mask_boundary(ImageViewRef<float> mask,
   llh_vec.clear();
   used_vertices.clear();
 
-#if 0
-
-  // For some reason parallel processing is slower than serial processing.
-  // Likely it is because the DEM is shared. Need extra heuristics to cut
-  // that one as appropriate for each task.
-  
-  // Subdivide the box for parallel processing
+  // Find the boundary pixels, with the mask tiles processed in
+  // parallel. This part is cheap, unlike intersecting with the DEM,
+  // which is done below only for as many pixels as needed.
+  vw_out() << "Finding the mask boundary.\n";
   int block_size = vw::vw_settings().default_tile_size();
-  FifoWorkQueue queue(vw_settings().default_num_threads());
   std::vector<BBox2i> bboxes = subdivide_bbox(mask, block_size, block_size);
-  
-  for (size_t it = 0; it < bboxes.size(); it++) {
-    std::cout << "Box is " << bboxes[it] << std::endl;
+  std::vector<std::vector<vw::Vector2i>> tile_pixels(bboxes.size());
+  {
+    FifoWorkQueue queue(vw_settings().default_num_threads());
+    for (size_t it = 0; it < bboxes.size(); it++) {
+      boost::shared_ptr<MaskBoundaryTask>
+        task(new MaskBoundaryTask(bboxes[it], mask, mask_nodata_val, tile_pixels[it]));
+      queue.add_task(task);
+    }
+    queue.join_all();
   }
-
-  Mutex mutex;
-  for (size_t it = 0; it < bboxes.size(); it++) {
-    boost::shared_ptr<MaskBoundaryTask>
-      task(new MaskBoundaryTask(bboxes[it],  mask, mask_nodata_val, camera_model,
-                                shape_georef, dem_georef, masked_dem, mutex,
-                                point_vec, llh_vec, used_vertices));
-    queue.add_task(task);
+  std::vector<vw::Vector2i> boundary_pixels;
+  for (size_t it = 0; it < tile_pixels.size(); it++)
+    boundary_pixels.insert(boundary_pixels.end(), tile_pixels[it].begin(),
+                           tile_pixels[it].end());
+
+  // Visit the boundary pixels in random order and stop once enough
+  // of them intersect the DEM. That is the same as intersecting all
+  // of them and picking a random subset of those that intersect.
+  int num_pix = boundary_pixels.size();
+  std::vector<int> order(num_pix);
+  for (int it = 0; it < num_pix; it++)
+    order[it] = it;
+  if (num_pix > num_samples) {
+    vw_out() << "Found " << num_pix << " pixels at mask boundary, but only "
+             << num_samples << " samples are desired. Picking a random subset "
+             << "of this size.\n";
+    std::mt19937 gen(0); // the same subset each time
+    std::shuffle(order.begin(), order.end(), gen);
   }
-  
-  queue.join_all();
-  
-#else
-
-  // Let the mask boundary be the mask pixels whose value
-  // is above threshold and which border pixels whose values
-  // is not above threshold.
 
   vw_out() << "Processing points at mask boundary.\n";
   vw::TerminalProgressCallback tpc("asp", "\t--> ");
-  double inc_amount = 1.0 / mask.cols();
+  double inc_amount = 1.0 / std::max(std::min(num_pix, num_samples), 1);
   tpc.report_progress(0);
 
-  for (int col = 0; col < mask.cols(); col++) {
-    for (int row = 0; row < mask.rows(); row++) {
-
-      // Look at pixels above threshold which have neighbors <= threshold
-      if (mask(col, row) <= mask_nodata_val) 
-        continue;
-
-      // The four neighbors
-      int col_vals[4] = {-1, 0, 0, 1};
-      int row_vals[4] = {0, -1, 1, 0};
-          
-      bool border_pix = false;
-      for (int it = 0; it < 4; it++) {
-            
-        int icol = col + col_vals[it];
-        int irow = row + row_vals[it];
-
-        if (icol < 0 || irow < 0 || icol >= mask.cols() || irow >= mask.rows()) 
-          continue;
-            
-        if (mask(icol, irow) <= mask_nodata_val) {
-          border_pix = true;
-          break;
-        }
-      }
-          
-      if (!border_pix) 
-        continue;
-
-      // The ray going to the ground
-      Vector2 pix(col, row);
-      Vector3 cam_ctr = camera_model->camera_center(pix);
-      Vector3 cam_dir = camera_model->pixel_to_vector(pix);
-
-      // Intersect the ray going from the given camera pixel with a DEM.
-      bool treat_nodata_as_zero = false;
-      bool has_intersection = false;
-      double height_error_tol = 0.001; // in meters
-      double max_abs_tol = 1e-14;
-      double max_rel_tol = 1e-14;
-      int num_max_iter = 100;
-      Vector3 xyz_guess(0, 0, 0);
-      Vector3 xyz = vw::cartography::camera_pixel_to_dem_xyz
-        (cam_ctr, cam_dir, masked_dem,
-         dem_georef, treat_nodata_as_zero,
-         has_intersection, height_error_tol, max_abs_tol, max_rel_tol, 
-         num_max_iter, xyz_guess);
-          
-      if (!has_intersection) 
-        continue;
-
-      Vector3 llh = dem_georef.datum().cartesian_to_geodetic(xyz);
-
-      Eigen::Vector3d eigen_xyz;
-      for (size_t coord = 0; coord < 3; coord++) 
-        eigen_xyz[coord] = xyz[coord];
-
-      // TODO(oalexan1): This is fragile due to the 360 degree
-      // uncertainty in latitude
-      Vector2 proj_pt = shape_georef.lonlat_to_point(Vector2(llh[0], llh[1]));
+  // The points for the pixels which intersect the DEM, by pixel index
+  std::map<int, std::pair<Vector3, Vector3>> xyz_llh;
+  for (int it = 0; it < num_pix && int(xyz_llh.size()) < num_samples; it++) {
+
+    // The ray going to the ground
+    Vector2 pix = boundary_pixels[order[it]];
+    Vector3 cam_ctr = camera_model->camera_center(pix);
+    Vector3 cam_dir = camera_model->pixel_to_vector(pix);
+
+    // Intersect the ray going from the given camera pixel with a DEM.
+    bool treat_nodata_as_zero = false;
+    bool has_intersection = false;
+    double height_error_tol = 0.001; // in meters
+    double max_abs_tol = 1e-14;
+    double max_rel_tol = 1e-14;
+    int num_max_iter = 100;
+    Vector3 xyz_guess(0, 0, 0);
+    Vector3 xyz = vw::cartography::camera_pixel_to_dem_xyz
+      (cam_ctr, cam_dir, masked_dem,
+       dem_georef, treat_nodata_as_zero,
+       has_intersection, height_error_tol, max_abs_tol, max_rel_tol, 
+       num_max_iter, xyz_guess);
           
-      point_vec.push_back(eigen_xyz);
-      used_vertices.push_back(proj_pt);
-      llh_vec.push_back(llh);
-    }
+    if (!has_intersection) 
+      continue;
 
+    Vector3 llh = dem_georef.datum().cartesian_to_geodetic(xyz);
+    xyz_llh[order[it]] = std::make_pair(xyz, llh);
     tpc.report_incremental_progress(inc_amount);
   }
-
   tpc.report_finished();
-  
-#endif
-  
-  int num_pts = point_vec.size();
-  if (num_pts > num_samples) {
-    vw_out() << "Found " << num_pts << " samples at mask boundary, points but only "
-             << num_samples << " samples are desired. Picking a random subset "
-             << "of this size.\n";
 
-    // Select a subset
-    std::vector<int> w;
-    vw::math::pick_random_indices_in_range(num_pts, num_samples, w);
-    std::vector<Eigen::Vector3d> big_point_vec     = point_vec;     point_vec.clear();
-    std::vector<vw::Vector3>     big_llh_vec       = llh_vec;       llh_vec.clear();
-    std::vector<vw::Vector2>     big_used_vertices = used_vertices; used_vertices.clear();
-    for (size_t it = 0; it < w.size(); it++) {
-      int random_index = w[it];
-      point_vec.push_back(big_point_vec[random_index]);
-      llh_vec.push_back(big_llh_vec[random_index]);
-      used_vertices.push_back(big_used_vertices[random_index]);
-    }
+  // Keep the points in the order of the boundary pixels
+  for (auto it = xyz_llh.begin(); it != xyz_llh.end(); it++) {
+    Vector3 const& xyz = it->second.first;
+    Vector3 const& llh = it->second.second;
+
+    Eigen::Vector3d eigen_xyz;
+    for (size_t coord = 0; coord < 3; coord++) 
+      eigen_xyz[coord] = xyz[coord];
+
+    // TODO(oalexan1): This is fragile due to the 360 degree
+    // uncertainty in latitude
+    Vector2 proj_pt = shape_georef.lonlat_to_point(Vector2(llh[0], llh[1]));
+          
+    point_vec.push_back(eigen_xyz);
+    used_vertices.push_back(proj_pt);
+    llh_vec.push_back(llh);
   }
   
   return;
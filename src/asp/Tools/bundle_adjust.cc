@@ -23,6 +23,7 @@
 #include <vw/Camera/CameraUtilities.h>
 #include <vw/Core/CmdUtils.h>
 #include <vw/FileIO/MatrixIO.h>
+#include <vw/Core/ThreadPool.h>
 #include <asp/Core/Macros.h>
 #include <asp/Sessions/StereoSession.h>
 #include <asp/Sessions/StereoSessionFactory.h>
@@ -34,11 +35,18 @@
 #include <asp/Camera/CsmModel.h>
 #include <asp/Core/OutlierProcessing.h>
 #include <asp/Core/DataLoader.h>
+#include <asp/Core/MatchDatabase.h>
+#include <asp/Core/MatchSet.h>
+#include <asp/Core/Tracing.h>
 
 #include <vw/InterestPoint/Matcher.h>
 
 #include <xercesc/util/PlatformUtils.hpp>
 
+#include <algorithm>
+#include <deque>
+#include <limits>
+
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
@@ -65,37 +73,76 @@ void write_csm_output_file(Options const& opt, int icam,
   csm_model->saveTransformedState(csmFile, ecef_transform);
 }
 
-// Write the results to disk.
-void saveResults(Options const& opt, asp::BAParams const& param_storage) {
-  int num_cameras = opt.image_files.size();
+// How many threads can use the cameras at the same time
+int num_camera_threads(Options const& opt) {
+  if (opt.single_threaded_cameras)
+    return 1; // ISIS must be single threaded!
+  if (opt.num_threads > 0)
+    return opt.num_threads;
+  return vw_settings().default_num_threads();
+}
 
-  for (int icam = 0; icam < num_cameras; icam++){
+// How many threads to use for writing files and other post-solve reports.
+// These are mostly limited by disk access, so kept to --io-threads.
+int num_io_threads(Options const& opt) {
+  return std::max(1, std::min(opt.io_threads, num_camera_threads(opt)));
+}
 
-    switch(opt.camera_type) {
-    case BaCameraType_Pinhole:
-      write_pinhole_output_file(opt, icam, param_storage);
-      break;
-    case BaCameraType_OpticalBar:
-      write_optical_bar_output_file(opt, icam, param_storage);
-      break;
-    default:
-      std::string adjust_file = asp::bundle_adjust_file_name(opt.out_prefix,
-                                                             opt.image_files[icam],
-                                                             opt.camera_files[icam]);
-      vw_out() << "Writing: " << adjust_file << std::endl;
+// Write the optimized model of one camera to disk
+void saveCameraResult(Options const& opt, asp::BAParams const& param_storage, int icam) {
+  switch(opt.camera_type) {
+  case BaCameraType_Pinhole:
+    write_pinhole_output_file(opt, icam, param_storage);
+    break;
+  case BaCameraType_OpticalBar:
+    write_optical_bar_output_file(opt, icam, param_storage);
+    break;
+  default:
+    std::string adjust_file = asp::bundle_adjust_file_name(opt.out_prefix,
+                                                           opt.image_files[icam],
+                                                           opt.camera_files[icam]);
+    vw_out() << "Writing: " << adjust_file << std::endl;
       
-      CameraAdjustment cam_adjust(param_storage.get_camera_ptr(icam));
-      asp::write_adjustments(adjust_file, cam_adjust.position(), cam_adjust.pose());
+    CameraAdjustment cam_adjust(param_storage.get_camera_ptr(icam));
+    asp::write_adjustments(adjust_file, cam_adjust.position(), cam_adjust.pose());
+
+    // For CSM camera models export, in addition, the JSON state
+    // with the adjustment applied to it.
+    if (opt.stereo_session == "csm" || opt.stereo_session == "pleiades" ||
+        (opt.stereo_session == "dg" && asp::stereo_settings().dg_use_csm))
+      write_csm_output_file(opt, icam, adjust_file, param_storage);
+  }
+}
 
-      // For CSM camera models export, in addition, the JSON state
-      // with the adjustment applied to it.
-      if (opt.stereo_session == "csm" || opt.stereo_session == "pleiades" ||
-          (opt.stereo_session == "dg" && asp::stereo_settings().dg_use_csm))
-        write_csm_output_file(opt, icam, adjust_file, param_storage);
-    }
-    
-  } // End loop through cameras
-  
+// A task to write the optimized models of a range of cameras
+class SaveCamerasTask: public vw::Task, private boost::noncopyable {
+  Options              const& m_opt;
+  asp::BAParams        const& m_param_storage;
+  int m_begin, m_end;
+public:
+  SaveCamerasTask(Options const& opt, asp::BAParams const& param_storage,
+                  int begin, int end):
+    m_opt(opt), m_param_storage(param_storage), m_begin(begin), m_end(end) {}
+  void operator()() {
+    for (int icam = m_begin; icam < m_end; icam++)
+      saveCameraResult(m_opt, m_param_storage, icam);
+  }
+};
+
+// Write the results to disk. The cameras are written in parallel.
+void saveResults(Options const& opt, asp::BAParams const& param_storage) {
+  int num_cameras = opt.image_files.size();
+  int num_threads = num_io_threads(opt);
+  int chunk = std::max(1, num_cameras / (10 * num_threads));
+
+  FifoWorkQueue queue(num_threads);
+  for (int begin = 0; begin < num_cameras; begin += chunk) {
+    boost::shared_ptr<SaveCamerasTask>
+      task(new SaveCamerasTask(opt, param_storage, begin,
+                               std::min(begin + chunk, num_cameras)));
+    queue.add_task(task);
+  }
+  queue.join_all();
 }
 
 // A callback to invoke at each iteration if desiring to save the cameras
@@ -116,8 +163,8 @@ private:
   asp::BAParams const& m_param_storage;
 };
 
-/// Add error source for projecting a 3D point into the camera.
-void add_reprojection_residual_block(Vector2 const& observation, Vector2 const& pixel_sigma,
+/// Add error source for projecting a 3D point into the camera. Return the residual block.
+ceres::ResidualBlockId add_reprojection_residual_block(Vector2 const& observation, Vector2 const& pixel_sigma,
                                      int point_index, int camera_index, 
                                      asp::BAParams & param_storage,
                                      Options const& opt,
@@ -125,6 +172,7 @@ void add_reprojection_residual_block(Vector2 const& observation, Vector2 const&
 
   ceres::LossFunction* loss_function;
   loss_function = get_loss_function(opt);
+  ceres::ResidualBlockId residual_block = NULL;
 
   boost::shared_ptr<CameraModel> camera_model = opt.camera_models[camera_index];
 
@@ -132,11 +180,16 @@ void add_reprojection_residual_block(Vector2 const& observation, Vector2 const&
   double* point  = param_storage.get_point_ptr (point_index );
 
   if (opt.camera_type == BaCameraType_Other) {
-    // The generic camera case
-    boost::shared_ptr<CeresBundleModelBase> wrapper(new AdjustedCameraBundleModel(camera_model));
-      ceres::CostFunction* cost_function =
-        BaReprojectionError::Create(observation, pixel_sigma, wrapper);
-      problem.AddResidualBlock(cost_function, loss_function, point, camera);
+    // The generic camera case. For RPC and CSM cameras use the analytic
+    // Jacobians, which avoid many expensive calls to point_to_pixel.
+    ceres::CostFunction* cost_function
+      = BaAnalyticReprojectionError::Create(observation, pixel_sigma, camera_model,
+                                            point, camera);
+    if (cost_function == NULL) {
+      boost::shared_ptr<CeresBundleModelBase> wrapper(new AdjustedCameraBundleModel(camera_model));
+      cost_function = BaReprojectionError::Create(observation, pixel_sigma, wrapper);
+    }
+    residual_block = problem.AddResidualBlock(cost_function, loss_function, point, camera);
 
   } else { // Pinhole and optical bar
 
@@ -166,8 +219,8 @@ void add_reprojection_residual_block(Vector2 const& observation, Vector2 const&
 
     ceres::CostFunction* cost_function =
       BaReprojectionError::Create(observation, pixel_sigma, wrapper);
-    problem.AddResidualBlock(cost_function, loss_function, point, camera, 
-                            center, focus, distortion);
+    residual_block = problem.AddResidualBlock(cost_function, loss_function, point, camera, 
+                                              center, focus, distortion);
 
     // Apply the residual limits
     size_t num_limits = opt.intrinsics_limits.size() / 2;
@@ -208,10 +261,12 @@ void add_reprojection_residual_block(Vector2 const& observation, Vector2 const&
   // Fix this camera if requested
   if (opt.fixed_cameras_indices.find(camera_index) != opt.fixed_cameras_indices.end()) 
     problem.SetParameterBlockConstant(param_storage.get_camera_ptr(camera_index));
+
+  return residual_block;
 }
 
-/// Add residual block for the error using reference xyz.
-void add_disparity_residual_block(Vector3 const& reference_xyz,
+/// Add residual block for the error using reference xyz. Return the residual block.
+ceres::ResidualBlockId add_disparity_residual_block(Vector3 const& reference_xyz,
                                   ImageViewRef<DispPixelT> const& interp_disp, 
                                   int left_cam_index, int right_cam_index,
                                   asp::BAParams & param_storage,
@@ -219,6 +274,7 @@ void add_disparity_residual_block(Vector3 const& reference_xyz,
                                   ceres::Problem & problem){
 
   ceres::LossFunction* loss_function = get_loss_function(opt);
+  ceres::ResidualBlockId residual_block = NULL;
 
   boost::shared_ptr<CameraModel> left_camera_model  = opt.camera_models[left_cam_index ];
   boost::shared_ptr<CameraModel> right_camera_model = opt.camera_models[right_cam_index];
@@ -239,7 +295,7 @@ void add_disparity_residual_block(Vector3 const& reference_xyz,
       BaDispXyzError::Create(reference_xyz, interp_disp, left_wrapper, right_wrapper,
                              inline_adjustments, opt.intrinisc_options);
 
-    problem.AddResidualBlock(cost_function, loss_function, residual_ptrs);
+    residual_block = problem.AddResidualBlock(cost_function, loss_function, residual_ptrs);
 
   } else { // Pinhole or optical bar
 
@@ -267,10 +323,11 @@ void add_disparity_residual_block(Vector3 const& reference_xyz,
     ceres::CostFunction* cost_function =
       BaDispXyzError::Create(reference_xyz, interp_disp, left_wrapper, right_wrapper,
                              inline_adjustments, opt.intrinisc_options);
-    problem.AddResidualBlock(cost_function, loss_function, residual_ptrs);
+    residual_block = problem.AddResidualBlock(cost_function, loss_function, residual_ptrs);
 
   }
-  
+
+  return residual_block;
 } // End function add_disparity_residual_block
 
 
@@ -286,6 +343,7 @@ void compute_residuals(bool apply_loss_function,
                        size_t num_tri_residuals,
                        std::vector<vw::Vector3> const& reference_vec,
                        ceres::Problem & problem,
+                       std::vector<ceres::ResidualBlockId> const& residual_blocks,
                        // Output
                        std::vector<double> & residuals) {
   // TODO: Associate residuals with cameras!
@@ -298,6 +356,10 @@ void compute_residuals(bool apply_loss_function,
   else
     eval_options.num_threads = opt.num_threads;
 
+  // Removing the residuals of outliers changes the order in the problem,
+  // so pass the residuals in the order they were added.
+  eval_options.residual_blocks = residual_blocks;
+
   problem.Evaluate(eval_options, &cost, &residuals, 0, 0);
   const size_t num_residuals = residuals.size();
   
@@ -319,7 +381,7 @@ void compute_residuals(bool apply_loss_function,
 }
 
 /// Compute residual map by averaging all the reprojection error at a given point
-void compute_mean_residuals_at_xyz(CRNJ & crn,
+void compute_mean_residuals_at_xyz(asp::BaObservations const& obs,
                                   std::vector<double> const& residuals,
                                   asp::BAParams const& param_storage,
                                   // outputs
@@ -332,31 +394,28 @@ void compute_mean_residuals_at_xyz(CRNJ & crn,
   // Observation residuals are stored at the beginning of the residual vector in the 
   //  same order they were originally added to Ceres.
   
+  // The observations are in the same order as the residuals
   size_t residual_index = 0;
-  // Double loop through cameras and crn entries will give us the correct order
-  for ( size_t icam = 0; icam < param_storage.num_cameras(); icam++ ) {
-    typedef CameraNode<JFeature>::const_iterator crn_iter;
-    for (crn_iter fiter = crn[icam].begin(); fiter != crn[icam].end(); fiter++){
+  for (size_t iobs = 0; iobs < obs.size(); iobs++) {
 
-      // The index of the 3D point
-      int ipt = (**fiter).m_point_id;
+    // The index of the 3D point
+    int ipt = obs.point_index[iobs];
 
-      if (param_storage.get_point_outlier(ipt))
-        continue; // skip outliers
+    if (param_storage.get_point_outlier(ipt))
+      continue; // skip outliers
 
-      // Get the residual error for this observation
-      double errorX         = residuals[residual_index  ];
-      double errorY         = residuals[residual_index+1];
-      // TODO(oalexan1): Use norm_2 below rather than average. This may
-      // change the regressions.
-      double residual_error = (fabs(errorX) + fabs(errorY)) / 2;
-      residual_index += PIXEL_SIZE;
+    // Get the residual error for this observation
+    double errorX         = residuals[residual_index  ];
+    double errorY         = residuals[residual_index+1];
+    // TODO(oalexan1): Use norm_2 below rather than average. This may
+    // change the regressions.
+    double residual_error = (fabs(errorX) + fabs(errorY)) / 2;
+    residual_index += PIXEL_SIZE;
 
-      // Update information for this point
-      num_point_observations[ipt] += 1;
-      mean_residuals        [ipt] += residual_error;
-    }
-  } // End double loop through all the observations
+    // Update information for this point
+    num_point_observations[ipt] += 1;
+    mean_residuals        [ipt] += residual_error;
+  } // End loop through all the observations
 
   // Do the averaging
   for (size_t i = 0; i < param_storage.num_points(); i++) {
@@ -443,13 +502,14 @@ void write_residual_logs(std::string const& residual_prefix, bool apply_loss_fun
                          size_t num_gcp_or_dem_residuals,
                          size_t num_tri_residuals,
                          std::vector<vw::Vector3> const& reference_vec,
-                         ControlNetwork const& cnet, CRNJ & crn, 
-                         ceres::Problem &problem) {
+                         ControlNetwork const& cnet, asp::BaObservations const& obs,
+                         ceres::Problem &problem,
+                         std::vector<ceres::ResidualBlockId> const& residual_blocks) {
   
   std::vector<double> residuals;
   compute_residuals(apply_loss_function, opt, param_storage,
                     cam_residual_counts, num_gcp_or_dem_residuals, num_tri_residuals,
-                    reference_vec, problem,
+                    reference_vec, problem, residual_blocks,
                     // Output
                     residuals);
     
@@ -610,7 +670,7 @@ void write_residual_logs(std::string const& residual_prefix, bool apply_loss_fun
   std::string map_prefix = residual_prefix + "_pointmap";
   std::vector<double> mean_residuals;
   std::vector<int> num_point_observations;
-  compute_mean_residuals_at_xyz(crn,  residuals,  param_storage,
+  compute_mean_residuals_at_xyz(obs,  residuals,  param_storage,
                                 mean_residuals, num_point_observations);
 
   write_residual_map(map_prefix, mean_residuals, num_point_observations,
@@ -627,19 +687,19 @@ void write_residual_logs(std::string const& residual_prefix, bool apply_loss_fun
 
 /// Add to the outliers based on the large residuals
 int add_to_outliers(ControlNetwork & cnet,
-                    CRNJ & crn,
+                    asp::BaObservations const& obs,
                     asp::BAParams & param_storage,
                     Options const& opt,
                     std::vector<size_t> const& cam_residual_counts,
                     size_t num_gcp_or_dem_residuals,
                     size_t num_tri_residuals,
                     std::vector<vw::Vector3> const& reference_vec, 
-                    ceres::Problem &problem) {
+                    ceres::Problem &problem,
+                    std::vector<ceres::ResidualBlockId> const& residual_blocks) {
 
   vw_out() << "Removing pixel outliers in preparation for another solver attempt.\n";
 
   const size_t num_points  = param_storage.num_points();
-  const size_t num_cameras = param_storage.num_cameras();
   
   // Compute the reprojection error. Hence we should not add the contribution
   // of the loss function.
@@ -648,13 +708,14 @@ int add_to_outliers(ControlNetwork & cnet,
   compute_residuals(apply_loss_function,  
                     opt, param_storage,  cam_residual_counts,  
                     num_gcp_or_dem_residuals, num_tri_residuals, reference_vec, problem,
+                    residual_blocks,
                     // output
                     residuals);
 
   // Compute the mean residual at each xyz, and how many times that residual is seen
   std::vector<double> mean_residuals;
   std::vector<int   > num_point_observations;
-  compute_mean_residuals_at_xyz(crn,  residuals,  param_storage,
+  compute_mean_residuals_at_xyz(obs,  residuals,  param_storage,
                                 // outputs
                                 mean_residuals, num_point_observations);
 
@@ -663,31 +724,27 @@ int add_to_outliers(ControlNetwork & cnet,
   // non-outliers so far to be able to remove new outliers.  Need to
   // follow the same logic as when residuals were formed. And also ignore GCP.
   std::vector<double> actual_residuals;
-  std::set<int> was_added;
-  for ( size_t icam = 0; icam < num_cameras; icam++ ) {
-    typedef CameraNode<JFeature>::const_iterator crn_iter;
-    for ( crn_iter fiter = crn[icam].begin(); fiter != crn[icam].end(); fiter++ ){
+  std::vector<bool> was_added(num_points, false);
+  for (size_t iobs = 0; iobs < obs.size(); iobs++) {
 
-      // The index of the 3D point
-      int ipt = (**fiter).m_point_id;
+    // The index of the 3D point
+    int ipt = obs.point_index[iobs];
 
-      // skip existing outliers
-      if (param_storage.get_point_outlier(ipt))
-        continue; 
+    // skip existing outliers
+    if (param_storage.get_point_outlier(ipt))
+      continue; 
 
-      // Skip gcp, those are never outliers no matter what.
-      if (cnet[ipt].type() == ControlPoint::GroundControlPoint)
-        continue;
+    // Skip gcp, those are never outliers no matter what.
+    if (cnet[ipt].type() == ControlPoint::GroundControlPoint)
+      continue;
 
-      // We already encountered this residual in the previous camera
-      if (was_added.find(ipt) != was_added.end()) 
-        continue;
+    // We already encountered this residual in the previous camera
+    if (was_added[ipt])
+      continue;
       
-      was_added.insert(ipt);
-      actual_residuals.push_back(mean_residuals[ipt]);
-      //vw_out() << "XYZ residual " << ipt << " = " << mean_residuals[ipt] << std::endl;
-    }
-  } // End double loop through all the observations
+    was_added[ipt] = true;
+    actual_residuals.push_back(mean_residuals[ipt]);
+  } // End loop through all the observations
 
   double pct      = 1.0 - opt.remove_outliers_params[0]/100.0;
   double factor   = opt.remove_outliers_params[1];
@@ -710,30 +767,25 @@ int add_to_outliers(ControlNetwork & cnet,
   // TODO(oalexan1): This removes a 3D point altogether if any reprojection
   // errors for it are big. Need to only remove bad reprojection errors
   // and keep a 3D point if it is left with at least two reprojection residuals.
-  int num_outliers_by_reprojection = 0, total = 0;
-  for ( size_t icam = 0; icam < num_cameras; icam++ ) {
-    typedef CameraNode<JFeature>::const_iterator crn_iter;
-    for ( crn_iter fiter = crn[icam].begin(); fiter != crn[icam].end(); fiter++ ){
+  int num_outliers_by_reprojection = 0, total = obs.size();
+  for (size_t iobs = 0; iobs < obs.size(); iobs++) {
 
-      // The index of the 3D point
-      int ipt = (**fiter).m_point_id;
+    // The index of the 3D point
+    int ipt = obs.point_index[iobs];
 
-      total++;
-      
-      // skip existing outliers
-      if (param_storage.get_point_outlier(ipt))
-        continue; 
+    // skip existing outliers
+    if (param_storage.get_point_outlier(ipt))
+      continue; 
 
-      // Skip gcp
-      if (cnet[ipt].type() == ControlPoint::GroundControlPoint)
-        continue;
+    // Skip gcp
+    if (cnet[ipt].type() == ControlPoint::GroundControlPoint)
+      continue;
 
-      if (mean_residuals[ipt] > e) {
-        param_storage.set_point_outlier(ipt, true);
-        num_outliers_by_reprojection++;
-      }
+    if (mean_residuals[ipt] > e) {
+      param_storage.set_point_outlier(ipt, true);
+      num_outliers_by_reprojection++;
     }
-  } // End double loop through all the observations
+  } // End loop through all the observations
   vw_out() << "Removed " << num_outliers_by_reprojection << " outliers out of "
            << total << " by reprojection error. Ratio: "
            << double(num_outliers_by_reprojection) / double(total) <<".\n";
@@ -908,29 +960,513 @@ void initial_filter_by_proj_win(Options             & opt,
   }
 }
 
-int do_ba_ceres_one_pass(Options             & opt,
-                         CRNJ                & crn,
-                         bool                  first_pass,
-                         asp::BAParams      & param_storage, 
-                         asp::BAParams const& orig_parameters,
-                         bool                & convergence_reached,
-                         double              & final_cost) {
+// The GPU solves need Ceres 2.2 or later, built with CUDA. Sparse ones
+// need Ceres 2.3 or later, built with cuDSS.
+#if (CERES_VERSION_MAJOR > 2) || (CERES_VERSION_MAJOR == 2 && CERES_VERSION_MINOR >= 2)
+#define ASP_CERES_HAVE_CUDA_DENSE 1
+#endif
+#if (CERES_VERSION_MAJOR > 2) || (CERES_VERSION_MAJOR == 2 && CERES_VERSION_MINOR >= 3)
+#define ASP_CERES_HAVE_CUDA_SPARSE 1
+#endif
+
+// With the cuda backend, the dense Schur complement is solved on the GPU
+// for up to this many cameras, if no GPU sparse solver is available.
+// This is far more than is practical for dense solves on the CPU.
+const int MAX_CUDA_DENSE_SCHUR_CAMERAS = 1000;
+
+bool cuda_dense_solver_available() {
+#ifdef ASP_CERES_HAVE_CUDA_DENSE
+  return ceres::IsDenseLinearAlgebraLibraryTypeAvailable(ceres::CUDA);
+#else
+  return false;
+#endif
+}
+
+bool cuda_sparse_solver_available() {
+#ifdef ASP_CERES_HAVE_CUDA_SPARSE
+  return ceres::IsSparseLinearAlgebraLibraryTypeAvailable(ceres::CUDA_SPARSE);
+#else
+  return false;
+#endif
+}
+
+/// Set the solver options according to the recommendations in the Ceres
+/// solving FAQs, for a problem with this many cameras.
+void set_solver_options(Options const& opt, int num_cameras, int num_threads,
+                        ceres::Solver::Options & options) {
+  options.gradient_tolerance  = 1e-16;
+  options.function_tolerance  = 1e-16;
+  options.parameter_tolerance = opt.parameter_tolerance; // default is 1e-8
 
-  ceres::Problem problem;
+  options.max_num_iterations                = opt.num_iterations;
+  options.max_num_consecutive_invalid_steps = std::max(5, opt.num_iterations/5); // try hard
+  options.minimizer_progress_to_stdout      = true;
+  options.num_threads                       = num_threads;
+
+  options.linear_solver_type = ceres::SPARSE_SCHUR;
+  if (num_cameras < 100)
+    options.linear_solver_type = ceres::DENSE_SCHUR;
+  if (num_cameras > 3500) {
+    // This is supposed to help with speed in a certain size range
+    options.use_explicit_schur_complement = true; 
+    options.linear_solver_type  = ceres::ITERATIVE_SCHUR;
+    options.preconditioner_type = ceres::SCHUR_JACOBI;
+  }
+  if (num_cameras > 7000)
+    options.use_explicit_schur_complement = false; // Only matters with ITERATIVE_SCHUR
+
+  // Solve the camera-camera Schur system on the GPU. The iterative
+  // solver has no GPU version, so it is replaced when a GPU solver can
+  // take the problem.
+  if (opt.solver_backend == "cuda") {
+    if (cuda_sparse_solver_available() && num_cameras >= 100) {
+#ifdef ASP_CERES_HAVE_CUDA_SPARSE
+      options.linear_solver_type = ceres::SPARSE_SCHUR;
+      options.sparse_linear_algebra_library_type = ceres::CUDA_SPARSE;
+#endif
+    } else if (cuda_dense_solver_available() &&
+               num_cameras <= MAX_CUDA_DENSE_SCHUR_CAMERAS) {
+#ifdef ASP_CERES_HAVE_CUDA_DENSE
+      options.linear_solver_type = ceres::DENSE_SCHUR;
+      options.dense_linear_algebra_library_type = ceres::CUDA;
+#endif
+    }
+  }
+}
+
+/// Group the cameras into clusters with nearby footprints, using k-means
+/// on the mean of the triangulated points seen by each camera. Cameras
+/// which see no points get the cluster -1.
+void cluster_cameras_by_footprint(asp::BAParams & param_storage,
+                                  asp::BaObservations const& obs,
+                                  int num_clusters, std::vector<int> & cam_cluster) {
+
+  int num_cameras = param_storage.num_cameras();
+  std::vector<Vector3> centroids(num_cameras);
+  std::vector<int> valid_cams;
+  for (int icam = 0; icam < num_cameras; icam++) {
+    int count = 0;
+    for (size_t iobs = obs.cam_begin[icam]; iobs < obs.cam_begin[icam + 1]; iobs++) {
+      int ipt = obs.point_index[iobs];
+      if (param_storage.get_point_outlier(ipt))
+        continue;
+      double * point = param_storage.get_point_ptr(ipt);
+      centroids[icam] += Vector3(point[0], point[1], point[2]);
+      count++;
+    }
+    if (count > 0) {
+      centroids[icam] /= count;
+      valid_cams.push_back(icam);
+    }
+  }
+
+  cam_cluster.assign(num_cameras, -1);
+  num_clusters = std::min(num_clusters, int(valid_cams.size()));
+  if (num_clusters <= 0)
+    return;
+
+  // Start with centers far from each other, for repeatable results
+  std::vector<Vector3> centers(1, centroids[valid_cams[0]]);
+  std::vector<double> dist(valid_cams.size(), std::numeric_limits<double>::max());
+  while (int(centers.size()) < num_clusters) {
+    int best = 0;
+    for (size_t it = 0; it < valid_cams.size(); it++) {
+      dist[it] = std::min(dist[it], norm_2(centroids[valid_cams[it]] - centers.back()));
+      if (dist[it] > dist[best])
+        best = it;
+    }
+    centers.push_back(centroids[valid_cams[best]]);
+  }
+
+  const int num_iter = 20;
+  for (int iter = 0; iter < num_iter; iter++) {
+    bool changed = false;
+    for (size_t it = 0; it < valid_cams.size(); it++) {
+      int icam = valid_cams[it], best = 0;
+      for (int k = 1; k < num_clusters; k++) {
+        if (norm_2(centroids[icam] - centers[k]) < norm_2(centroids[icam] - centers[best]))
+          best = k;
+      }
+      if (cam_cluster[icam] != best)
+        changed = true;
+      cam_cluster[icam] = best;
+    }
+    if (!changed)
+      break;
+
+    std::vector<Vector3> sums(num_clusters);
+    std::vector<int> counts(num_clusters, 0);
+    for (size_t it = 0; it < valid_cams.size(); it++) {
+      int icam = valid_cams[it];
+      sums[cam_cluster[icam]] += centroids[icam];
+      counts[cam_cluster[icam]]++;
+    }
+    for (int k = 0; k < num_clusters; k++) {
+      if (counts[k] > 0)
+        centers[k] = sums[k]/counts[k];
+    }
+  }
+}
+
+/// Make a problem with those residual blocks of a given problem which
+/// touch any of the given parameter blocks. The parameters are read from
+/// and written to the memory passed in. Only the blocks in the given set
+/// and not constant in the full problem will float. The cost and loss
+/// functions are shared with the full problem, which owns them.
+void make_sub_problem(ceres::Problem & full_problem,
+                      std::vector<ceres::ResidualBlockId> const& residual_blocks,
+                      std::set<double*> const& float_blocks,
+                      std::map<double*, double*> const& memory,
+                      ceres::Problem & sub_problem) {
+
+  std::vector<double*> full_params, sub_params;
+  for (size_t it = 0; it < residual_blocks.size(); it++) {
+    full_problem.GetParameterBlocksForResidualBlock(residual_blocks[it], &full_params);
+    bool use = false;
+    for (size_t b = 0; b < full_params.size(); b++) {
+      if (float_blocks.find(full_params[b]) != float_blocks.end())
+        use = true;
+    }
+    if (!use)
+      continue;
+
+    sub_params.resize(full_params.size());
+    for (size_t b = 0; b < full_params.size(); b++) {
+      auto mem = memory.find(full_params[b]);
+      sub_params[b] = (mem == memory.end()) ? full_params[b] : mem->second;
+    }
+
+    ceres::CostFunction * cost_function = const_cast<ceres::CostFunction*>
+      (full_problem.GetCostFunctionForResidualBlock(residual_blocks[it]));
+    ceres::LossFunction * loss_function = const_cast<ceres::LossFunction*>
+      (full_problem.GetLossFunctionForResidualBlock(residual_blocks[it]));
+    sub_problem.AddResidualBlock(cost_function, loss_function, sub_params);
+
+    for (size_t b = 0; b < full_params.size(); b++) {
+      if (float_blocks.find(full_params[b]) == float_blocks.end() ||
+          full_problem.IsParameterBlockConstant(full_params[b]))
+        sub_problem.SetParameterBlockConstant(sub_params[b]);
+    }
+  }
+}
+
+/// Optimize the cameras of one cluster and the points they see, with
+/// copies of all the parameters involved. The cameras of other clusters
+/// which see the same points are in the problem but are held fixed.
+class SubmapSolveTask: public vw::Task, private boost::noncopyable {
+  Options const& m_opt;
+  ceres::Problem & m_full_problem;
+  std::vector<ceres::ResidualBlockId> const& m_residual_blocks;
+  std::set<double*> m_float_blocks;
+  int m_num_cameras; // floated
+  std::map<double*, std::vector<double>> & m_values; // in-out
+  bool & m_convergence_reached;
+
+public:
+  SubmapSolveTask(Options const& opt, ceres::Problem & full_problem,
+                  std::vector<ceres::ResidualBlockId> const& residual_blocks,
+                  std::set<double*> const& float_blocks, int num_cameras,
+                  std::map<double*, std::vector<double>> & values,
+                  bool & convergence_reached):
+    m_opt(opt), m_full_problem(full_problem), m_residual_blocks(residual_blocks),
+    m_float_blocks(float_blocks), m_num_cameras(num_cameras), m_values(values),
+    m_convergence_reached(convergence_reached) {}
+
+  void operator()() {
+    std::map<double*, double*> memory;
+    for (auto it = m_values.begin(); it != m_values.end(); it++)
+      memory[it->first] = &(it->second[0]);
+
+    ceres::Problem::Options problem_options;
+    problem_options.cost_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    problem_options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    ceres::Problem sub_problem(problem_options);
+    make_sub_problem(m_full_problem, m_residual_blocks, m_float_blocks, memory, sub_problem);
+
+    // Many of these run at the same time, so each uses one thread
+    ceres::Solver::Options options;
+    set_solver_options(m_opt, m_num_cameras, 1, options);
+    options.minimizer_progress_to_stdout = false;
+    ceres::Solver::Summary summary;
+    {
+      asp::TraceSpan span("ceres_solve", "solver");
+      ceres::Solve(options, &sub_problem, &summary);
+    }
+    m_convergence_reached = (summary.termination_type != ceres::NO_CONVERGENCE);
+  }
+};
+
+/// Solve the problem by splitting the cameras into clusters with nearby
+/// footprints. The submaps formed by each cluster, the points it sees,
+/// and the fixed cameras of other clusters seeing those points, are
+/// solved in parallel. Then the points seen by more than one cluster,
+/// and the cameras seeing them, are refined together with a reduced
+/// solve over all their residuals. Return true if all solves converged.
+bool solve_partitioned(Options const& opt, asp::BaObservations const& obs,
+                       asp::BAParams & param_storage,
+                       ceres::Problem & problem) {
+
+  int num_cameras = param_storage.num_cameras();
+  int num_points  = param_storage.num_points();
+  std::vector<int> cam_cluster;
+  cluster_cameras_by_footprint(param_storage, obs, opt.num_partitions, cam_cluster);
+  int num_clusters = 0;
+  for (int icam = 0; icam < num_cameras; icam++)
+    num_clusters = std::max(num_clusters, cam_cluster[icam] + 1);
+
+  // The clusters whose cameras see each point
+  std::vector<std::set<int>> point_clusters(num_points);
+  for (size_t iobs = 0; iobs < obs.size(); iobs++) {
+    int icam = obs.cam_index[iobs], ipt = obs.point_index[iobs];
+    if (cam_cluster[icam] >= 0 && !param_storage.get_point_outlier(ipt))
+      point_clusters[ipt].insert(cam_cluster[icam]);
+  }
+
+  std::vector<ceres::ResidualBlockId> residual_blocks;
+  problem.GetResidualBlocks(&residual_blocks);
+
+  // The blocks to float in each submap
+  std::vector<std::set<double*>> float_blocks(num_clusters);
+  for (int icam = 0; icam < num_cameras; icam++) {
+    if (cam_cluster[icam] >= 0)
+      float_blocks[cam_cluster[icam]].insert(param_storage.get_camera_ptr(icam));
+  }
+  std::set<double*> separator_blocks;
+  int num_separator_points = 0;
+  for (int ipt = 0; ipt < num_points; ipt++) {
+    for (auto k = point_clusters[ipt].begin(); k != point_clusters[ipt].end(); k++)
+      float_blocks[*k].insert(param_storage.get_point_ptr(ipt));
+    if (point_clusters[ipt].size() > 1) {
+      separator_blocks.insert(param_storage.get_point_ptr(ipt));
+      num_separator_points++;
+    }
+  }
+
+  // Copy the parameters each submap needs before any of them is solved
+  std::vector<std::map<double*, std::vector<double>>> values(num_clusters);
+  std::vector<double*> params;
+  for (size_t it = 0; it < residual_blocks.size(); it++) {
+    problem.GetParameterBlocksForResidualBlock(residual_blocks[it], &params);
+    for (int k = 0; k < num_clusters; k++) {
+      bool use = false;
+      for (size_t b = 0; b < params.size(); b++) {
+        if (float_blocks[k].find(params[b]) != float_blocks[k].end())
+          use = true;
+      }
+      if (!use)
+        continue;
+      for (size_t b = 0; b < params.size(); b++) {
+        if (values[k].find(params[b]) == values[k].end()) {
+          int size = problem.ParameterBlockSize(params[b]);
+          values[k][params[b]] = std::vector<double>(params[b], params[b] + size);
+        }
+      }
+    }
+  }
+
+  vw_out() << "Solving " << num_clusters << " submaps, with "
+           << num_separator_points << " points shared among them.\n";
+  std::deque<bool> convergence(num_clusters, true); // not a vector, to take references
+  {
+    vw::FifoWorkQueue queue(std::max(1, opt.num_threads));
+    for (int k = 0; k < num_clusters; k++) {
+      int num_cluster_cams = std::count(cam_cluster.begin(), cam_cluster.end(), k);
+      boost::shared_ptr<SubmapSolveTask>
+        task(new SubmapSolveTask(opt, problem, residual_blocks, float_blocks[k],
+                                 num_cluster_cams, values[k], convergence[k]));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+
+  // Put back the cameras of each cluster, and the points seen by one
+  // cluster only. The points seen by several clusters get the mean.
+  for (int icam = 0; icam < num_cameras; icam++) {
+    int k = cam_cluster[icam];
+    if (k < 0)
+      continue;
+    double * camera = param_storage.get_camera_ptr(icam);
+    auto it = values[k].find(camera);
+    if (it != values[k].end())
+      std::copy(it->second.begin(), it->second.end(), camera);
+  }
+  for (int ipt = 0; ipt < num_points; ipt++) {
+    double * point = param_storage.get_point_ptr(ipt);
+    if (point_clusters[ipt].empty() ||
+        values[*point_clusters[ipt].begin()].count(point) == 0)
+      continue; // not in the problem
+    Vector3 sum;
+    for (auto k = point_clusters[ipt].begin(); k != point_clusters[ipt].end(); k++) {
+      std::vector<double> const& v = values[*k][point];
+      sum += Vector3(v[0], v[1], v[2]);
+    }
+    sum /= point_clusters[ipt].size();
+    for (int p = 0; p < 3; p++)
+      point[p] = sum[p];
+  }
+  values.clear();
+
+  // The reduced global solve, over the shared points and the cameras seeing them
+  std::set<int> separator_cams;
+  for (size_t iobs = 0; iobs < obs.size(); iobs++) {
+    if (point_clusters[obs.point_index[iobs]].size() > 1)
+      separator_cams.insert(obs.cam_index[iobs]);
+  }
+  for (auto it = separator_cams.begin(); it != separator_cams.end(); it++)
+    separator_blocks.insert(param_storage.get_camera_ptr(*it));
+
+  bool convergence_reached = true;
+  for (int k = 0; k < num_clusters; k++)
+    convergence_reached = convergence_reached && convergence[k];
+
+  if (num_separator_points > 0) {
+    vw_out() << "Refining " << num_separator_points << " shared points and "
+             << separator_cams.size() << " cameras seeing them.\n";
+    ceres::Problem::Options problem_options;
+    problem_options.cost_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    problem_options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    ceres::Problem sub_problem(problem_options);
+    std::map<double*, double*> memory; // use the parameters in place
+    make_sub_problem(problem, residual_blocks, separator_blocks, memory, sub_problem);
+
+    ceres::Solver::Options options;
+    set_solver_options(opt, separator_cams.size(), opt.num_threads, options);
+    ceres::Solver::Summary summary;
+    {
+      asp::TraceSpan span("ceres_solve", "solver");
+      ceres::Solve(options, &sub_problem, &summary);
+    }
+    vw_out() << summary.BriefReport() << "\n";
+    if (summary.termination_type == ceres::NO_CONVERGENCE)
+      convergence_reached = false;
+  }
+
+  return convergence_reached;
+}
+
+/// The kinds of residuals, as the residual logs need to tell them apart
+enum BaResidualType {BA_PIXEL_RESIDUAL, BA_GCP_OR_DEM_RESIDUAL, BA_TRI_RESIDUAL,
+                     BA_OTHER_RESIDUAL};
+
+/// The Ceres problem of a bundle adjustment pass, kept for the next
+/// passes, with its residual blocks in the order they were added, which
+/// is the order the residual logs expect.
+struct BaProblemState {
+  boost::shared_ptr<ceres::Problem> problem;
+  boost::shared_ptr<ceres::ParameterBlockOrdering> ordering; // points first
+  std::vector<ceres::ResidualBlockId> residual_blocks;
+  std::vector<int> residual_types, residual_cams, residual_points; // -1 if none
+  int num_gcp;
+
+  // For the reference terrain residuals, which refer to the disparities
+  std::vector<vw::Vector3> reference_vec;
+  std::vector<ImageView<DispPixelT>> disp_vec;
+  std::vector<ImageViewRef<DispPixelT>> interp_disp; 
+
+  BaProblemState(): num_gcp(0) {}
+
+  /// Start a new problem. Fast removal makes removing outliers cheap.
+  void reset() {
+    ceres::Problem::Options problem_options;
+    problem_options.enable_fast_removal = true;
+    problem.reset(new ceres::Problem(problem_options));
+    ordering.reset(new ceres::ParameterBlockOrdering);
+    residual_blocks.clear();
+    residual_types.clear();
+    residual_cams.clear();
+    residual_points.clear();
+    num_gcp = 0;
+    reference_vec.clear();
+    interp_disp.clear();
+    disp_vec.clear();
+  }
+
+  void add(ceres::ResidualBlockId id, int type, int icam, int ipt) {
+    residual_blocks.push_back(id);
+    residual_types.push_back(type);
+    residual_cams.push_back(icam);
+    residual_points.push_back(ipt);
+  }
+
+  /// Put the points in the first elimination group, and the cameras and
+  /// intrinsics in the second one.
+  void make_ordering(asp::BAParams & param_storage) {
+    ordering.reset(new ceres::ParameterBlockOrdering);
+    std::vector<double*> blocks;
+    problem->GetParameterBlocks(&blocks);
+    std::vector<double> const& points = param_storage.get_point_vector();
+    for (size_t it = 0; it < blocks.size(); it++) {
+      bool is_point = (!points.empty() && blocks[it] >= &points[0] &&
+                       blocks[it] < &points[0] + points.size());
+      ordering->AddElementToGroup(blocks[it], is_point ? 0 : 1);
+    }
+  }
+
+  /// The counts of residuals the residual logs need
+  void count_residuals(int num_cameras, std::vector<size_t> & cam_residual_counts,
+                       size_t & num_gcp_or_dem_residuals, size_t & num_tri_residuals) const {
+    cam_residual_counts.assign(num_cameras, 0);
+    num_gcp_or_dem_residuals = 0;
+    num_tri_residuals = 0;
+    for (size_t it = 0; it < residual_types.size(); it++) {
+      if (residual_types[it] == BA_PIXEL_RESIDUAL)
+        cam_residual_counts[residual_cams[it]]++;
+      else if (residual_types[it] == BA_GCP_OR_DEM_RESIDUAL)
+        num_gcp_or_dem_residuals++;
+      else if (residual_types[it] == BA_TRI_RESIDUAL)
+        num_tri_residuals++;
+    }
+  }
+
+  /// Remove the points which became outliers, and with them all the
+  /// residuals which depend on them. The rest of the problem is kept.
+  void remove_outliers(asp::BAParams & param_storage) {
+    int num_removed = 0;
+    for (int ipt = 0; ipt < param_storage.num_points(); ipt++) {
+      double * point = param_storage.get_point_ptr(ipt);
+      if (param_storage.get_point_outlier(ipt) && problem->HasParameterBlock(point)) {
+        problem->RemoveParameterBlock(point);
+        ordering->Remove(point);
+        num_removed++;
+      }
+    }
+
+    size_t count = 0;
+    for (size_t it = 0; it < residual_blocks.size(); it++) {
+      int ipt = residual_points[it];
+      if (ipt >= 0 && param_storage.get_point_outlier(ipt))
+        continue;
+      residual_blocks[count] = residual_blocks[it];
+      residual_types [count] = residual_types[it];
+      residual_cams  [count] = residual_cams[it];
+      residual_points[count] = ipt;
+      count++;
+    }
+    residual_blocks.resize(count);
+    residual_types.resize(count);
+    residual_cams.resize(count);
+    residual_points.resize(count);
+
+    vw_out() << "Reusing the problem from the previous pass, without the "
+             << num_removed << " points which became outliers.\n";
+  }
+};
+
+/// Make the Ceres problem for bundle adjustment
+void build_ba_problem(Options             & opt,
+                      CRNJ                & crn,
+                      asp::BAParams       & param_storage,
+                      asp::BaObservations const& obs,
+                      asp::BAParams const & orig_parameters,
+                      BaProblemState      & state) {
+
+  state.reset();
+  ceres::Problem & problem = *state.problem;
 
   ControlNetwork & cnet = *opt.cnet;
   const int num_cameras = param_storage.num_cameras();
   const int num_points  = param_storage.num_points();
 
-  if ((int)crn.size() != num_cameras) 
-    vw_throw(ArgumentErr() << "Book-keeping error, the size of CameraRelationNetwork "
-             << "must equal the number of images.\n");
- 
-  convergence_reached = true;
-
-  if (opt.proj_win != BBox2(0, 0, 0, 0) && (!opt.proj_str.empty()))
-    initial_filter_by_proj_win(opt, param_storage, cnet);
-  
   // How many times an xyz point shows up in the problem
   std::vector<int> count_map(num_points);
   for (int i = 0; i < num_points; i++) {
@@ -979,14 +1515,14 @@ int do_ba_ceres_one_pass(Options             & opt,
   // - Reduce error by making pixel projection consistent with observations.
   
   // Add the various cost functions the solver will optimize over.
-  std::vector<size_t> cam_residual_counts(num_cameras);
-  typedef CameraNode<JFeature>::iterator crn_iter;
+  if (obs.num_cameras() != num_cameras) 
+    vw_throw(ArgumentErr() << "Book-keeping error, the observations must be "
+             << "for all the images.\n");
   for (int icam = 0; icam < num_cameras; icam++) { // Camera loop
-    cam_residual_counts[icam] = 0;
-    for (crn_iter fiter = crn[icam].begin(); fiter != crn[icam].end(); fiter++) { // IP loop
+    for (size_t iobs = obs.cam_begin[icam]; iobs < obs.cam_begin[icam + 1]; iobs++) { // IP loop
 
       // The index of the 3D point this IP is for.
-      int ipt = (**fiter).m_point_id;
+      int ipt = obs.point_index[iobs];
       if (param_storage.get_point_outlier(ipt))
         continue; // skip outliers
 
@@ -1035,12 +1571,8 @@ int do_ba_ceres_one_pass(Options             & opt,
 
       // The observed value for the projection of point with index ipt into
       // the camera with index icam.
-      Vector2 observation = (**fiter).m_location;
-      Vector2 pixel_sigma = (**fiter).m_scale;
-
-      // This is a bugfix
-      if (pixel_sigma != pixel_sigma) // nan check
-        pixel_sigma = Vector2(1, 1);
+      Vector2 observation = obs.pixel_at(iobs);
+      Vector2 pixel_sigma = obs.sigma_at(iobs);
 
       double p = opt.overlap_exponent;
       if (p > 0 && count_map[ipt] > 2) {
@@ -1051,16 +1583,15 @@ int do_ba_ceres_one_pass(Options             & opt,
       }
 
       // Call function to add the appropriate Ceres residual block.
-      add_reprojection_residual_block(observation, pixel_sigma, ipt, icam,
-                                      param_storage, opt, problem);
-      cam_residual_counts[icam] += 1; // Track the number of residual blocks for each camera
+      state.add(add_reprojection_residual_block(observation, pixel_sigma, ipt, icam,
+                                                param_storage, opt, problem),
+                BA_PIXEL_RESIDUAL, icam, ipt);
       
     } // end iterating over points
   } // end iterating over cameras
 
   // Add ground control points or points based on a DEM constraint
   // Error goes up as GCP's move from their input positions.
-  int num_gcp = 0, num_gcp_or_dem_residuals = 0;
   for (int ipt = 0; ipt < num_points; ipt++) {
     if (cnet[ipt].type() != ControlPoint::GroundControlPoint &&
         cnet[ipt].type() != ControlPoint::PointFromDem)
@@ -1070,7 +1601,7 @@ int do_ba_ceres_one_pass(Options             & opt,
       continue; // skip outliers
     
     if (cnet[ipt].type() == ControlPoint::GroundControlPoint)
-      num_gcp++;
+      state.num_gcp++;
 
     Vector3 observation = cnet[ipt].position();
     Vector3 xyz_sigma   = cnet[ipt].sigma();
@@ -1102,9 +1633,8 @@ int do_ba_ceres_one_pass(Options             & opt,
       loss_function = new ceres::TrivialLoss();
     }
     double * point  = param_storage.get_point_ptr(ipt);
-    problem.AddResidualBlock(cost_function, loss_function, point);
-
-    num_gcp_or_dem_residuals++;
+    state.add(problem.AddResidualBlock(cost_function, loss_function, point),
+              BA_GCP_OR_DEM_RESIDUAL, -1, ipt);
 
     if (opt.fix_gcp_xyz) 
       problem.SetParameterBlockConstant(point);
@@ -1123,7 +1653,8 @@ int do_ba_ceres_one_pass(Options             & opt,
       ceres::LossFunction* loss_function = new ceres::TrivialLoss();
 
       double * camera  = param_storage.get_camera_ptr(icam);
-      problem.AddResidualBlock(cost_function, loss_function, camera);
+      state.add(problem.AddResidualBlock(cost_function, loss_function, camera),
+                BA_OTHER_RESIDUAL, icam, -1);
     } // End loop through cameras.
   }
 
@@ -1137,7 +1668,8 @@ int do_ba_ceres_one_pass(Options             & opt,
         = RotTransError::Create(orig_cam_ptr, opt.rotation_weight, opt.translation_weight);
       ceres::LossFunction* loss_function = new ceres::TrivialLoss();
       double * camera  = param_storage.get_camera_ptr(icam);
-      problem.AddResidualBlock(cost_function, loss_function, camera);
+      state.add(problem.AddResidualBlock(cost_function, loss_function, camera),
+                BA_OTHER_RESIDUAL, icam, -1);
     }
   }
 
@@ -1151,9 +1683,6 @@ int do_ba_ceres_one_pass(Options             & opt,
   // option --unalign-disparity. If there are n images,
   // there must be n-1 disparities, from each image to the next.
   // The doc has more info in the bundle_adjust chapter.
-  std::vector<ImageView<DispPixelT>> disp_vec;
-  std::vector<ImageViewRef<DispPixelT>> interp_disp; 
-  std::vector<vw::Vector3> reference_vec;
   if (opt.reference_terrain != "") {
     // TODO: Pass these properly
     g_max_disp_error           = opt.max_disp_error;
@@ -1170,7 +1699,7 @@ int do_ba_ceres_one_pass(Options             & opt,
                          geo,       // may change
                          input_reference_vec); // output
 
-    if (load_reference_disparities(opt.disparity_list, disp_vec, interp_disp) != num_cameras-1)
+    if (load_reference_disparities(opt.disparity_list, state.disp_vec, state.interp_disp) != num_cameras-1)
       vw_throw(ArgumentErr() << "Expecting one less disparity than there are cameras.\n");
     
     std::vector<vw::BBox2i> image_boxes;
@@ -1185,7 +1714,7 @@ int do_ba_ceres_one_pass(Options             & opt,
     tpc.report_progress(0);
     double inc_amount = 1.0/double(input_reference_vec.size());
 
-    reference_vec.clear();
+    state.reference_vec.clear();
     for (size_t data_col = 0; data_col < input_reference_vec.size(); data_col++) {
 
       vw::Vector3 reference_xyz = input_reference_vec[data_col];
@@ -1220,10 +1749,10 @@ int do_ba_ceres_one_pass(Options             & opt,
         if ( (left_pred != left_pred) || (right_pred != right_pred) )
           continue; // nan check
 
-        if (!interp_disp[icam].pixel_in_bounds(left_pred))
+        if (!state.interp_disp[icam].pixel_in_bounds(left_pred))
           continue; // Interp check
 
-        DispPixelT dispPix = interp_disp[icam](left_pred[0], left_pred[1]);
+        DispPixelT dispPix = state.interp_disp[icam](left_pred[0], left_pred[1]);
         if (!is_valid(dispPix))
           continue;
 
@@ -1242,21 +1771,21 @@ int do_ba_ceres_one_pass(Options             & opt,
           continue;
         }
 
-        reference_vec.push_back(reference_xyz); // only the used reference points are stored here
+        state.reference_vec.push_back(reference_xyz); // only the used reference points are stored here
 
         // Call function to select the appropriate Ceres residual block to add.
-        add_disparity_residual_block(reference_xyz, interp_disp[icam],
-                                     icam, icam+1, // left icam and right icam
-                                     param_storage, opt, problem);
+        state.add(add_disparity_residual_block(reference_xyz, state.interp_disp[icam],
+                                               icam, icam+1, // left icam and right icam
+                                               param_storage, opt, problem),
+                  BA_OTHER_RESIDUAL, icam, -1);
       }
       tpc.report_incremental_progress(inc_amount);
     }
     
     tpc.report_finished();
-    vw_out() << "Found " << reference_vec.size() << " reference points in range.\n";
+    vw_out() << "Found " << state.reference_vec.size() << " reference points in range.\n";
   } // End of reference terrain block
 
-  int num_tri_residuals = 0;
   if (opt.tri_weight > 0) {
     // Add triangulation weight to make each triangulated point not move too far
     for (int ipt = 0; ipt < num_points; ipt++) {
@@ -1276,11 +1805,53 @@ int do_ba_ceres_one_pass(Options             & opt,
 
       ceres::CostFunction* cost_function = XYZError::Create(observation, xyz_sigma);
       ceres::LossFunction* loss_function = get_loss_function(opt, opt.tri_robust_threshold);
-      problem.AddResidualBlock(cost_function, loss_function, point);
-
-      num_tri_residuals++;
+      state.add(problem.AddResidualBlock(cost_function, loss_function, point),
+                BA_TRI_RESIDUAL, -1, ipt);
     } // End loop through xyz
   } // end adding a triangulation constraint
+
+  state.make_ordering(param_storage);
+} // End function build_ba_problem
+
+int do_ba_ceres_one_pass(Options             & opt,
+                         CRNJ                & crn,
+                         asp::BaObservations const& obs,
+                         bool                  first_pass,
+                         asp::BAParams      & param_storage, 
+                         asp::BAParams const& orig_parameters,
+                         BaProblemState      & state,
+                         bool                & convergence_reached,
+                         double              & final_cost) {
+
+  ControlNetwork & cnet = *opt.cnet;
+  const int num_cameras = param_storage.num_cameras();
+  const int num_points  = param_storage.num_points();
+
+  if ((int)crn.size() != num_cameras) 
+    vw_throw(ArgumentErr() << "Book-keeping error, the size of CameraRelationNetwork "
+             << "must equal the number of images.\n");
+ 
+  convergence_reached = true;
+
+  if (opt.proj_win != BBox2(0, 0, 0, 0) && (!opt.proj_str.empty()))
+    initial_filter_by_proj_win(opt, param_storage, cnet);
+
+  // Reuse the problem of the previous pass, without the residuals of the
+  // points which became outliers since. With a DEM the points are reset
+  // from it on each pass, so then the problem is made anew.
+  bool have_dem = (!opt.heights_from_dem.empty() || !opt.ref_dem.empty());
+  if (state.problem.get() != NULL && !have_dem)
+    state.remove_outliers(param_storage);
+  else
+    build_ba_problem(opt, crn, param_storage, obs, orig_parameters, state);
+
+  ceres::Problem & problem = *state.problem;
+  std::vector<size_t> cam_residual_counts;
+  size_t num_gcp_or_dem_residuals = 0, num_tri_residuals = 0;
+  state.count_residuals(num_cameras, cam_residual_counts, num_gcp_or_dem_residuals,
+                        num_tri_residuals);
+  std::vector<vw::Vector3> const& reference_vec = state.reference_vec;
+  int num_gcp = state.num_gcp;
   
   const size_t MIN_KML_POINTS = 50;
   size_t kmlPointSkip = 30;
@@ -1305,7 +1876,7 @@ int do_ba_ceres_one_pass(Options             & opt,
     bool apply_loss_function = false;
     write_residual_logs(residual_prefix, apply_loss_function, opt, param_storage, 
                         cam_residual_counts, num_gcp_or_dem_residuals, num_tri_residuals,
-                        reference_vec, cnet, crn, problem);
+                        reference_vec, cnet, obs, problem, state.residual_blocks);
     
     param_storage.record_points_to_kml(point_kml_path, opt.datum, 
                          kmlPointSkip, "initial_points",
@@ -1314,18 +1885,14 @@ int do_ba_ceres_one_pass(Options             & opt,
 
   // Solve the problem
   ceres::Solver::Options options;
-  options.gradient_tolerance  = 1e-16;
-  options.function_tolerance  = 1e-16;
-  options.parameter_tolerance = opt.parameter_tolerance; // default is 1e-8
-
-  options.max_num_iterations                = opt.num_iterations;
-  options.max_num_consecutive_invalid_steps = std::max(5, opt.num_iterations/5); // try hard
-  options.minimizer_progress_to_stdout      = true;
-
+  int num_threads = opt.num_threads;
   if (opt.single_threaded_cameras)
-    options.num_threads = 1;
-  else
-    options.num_threads = opt.num_threads;
+    num_threads = 1;
+  set_solver_options(opt, num_cameras, num_threads, options);
+
+  // The points are eliminated first. Give the ordering found when the
+  // problem was made, rather than having the solver find it each pass.
+  options.linear_solver_ordering.reset(new ceres::ParameterBlockOrdering(*state.ordering));
 
   // Use a callback function at every iteration, if desired to save the intermediate results
   BaCallback callback(opt, param_storage);
@@ -1334,19 +1901,6 @@ int do_ba_ceres_one_pass(Options             & opt,
     options.update_state_every_iteration = true;
   }
 
-  // Set solver options according to the recommendations in the Ceres solving FAQs
-  options.linear_solver_type = ceres::SPARSE_SCHUR;
-  if (num_cameras < 100)
-    options.linear_solver_type = ceres::DENSE_SCHUR;
-  if (num_cameras > 3500) {
-    // This is supposed to help with speed in a certain size range
-    options.use_explicit_schur_complement = true; 
-    options.linear_solver_type  = ceres::ITERATIVE_SCHUR;
-    options.preconditioner_type = ceres::SCHUR_JACOBI;
-  }
-  if (num_cameras > 7000)
-    options.use_explicit_schur_complement = false; // Only matters with ITERATIVE_SCHUR
-
   //options.ordering_type = ceres::SCHUR;
   //options.eta = 1e-3; // FLAGS_eta;
   //options->max_solver_time_in_seconds = FLAGS_max_solver_time;
@@ -1356,14 +1910,26 @@ int do_ba_ceres_one_pass(Options             & opt,
   //}
 
   vw_out() << "Starting the Ceres optimizer." << std::endl;
-  ceres::Solver::Summary summary;
-  ceres::Solve(options, &problem, &summary);
-  final_cost = summary.final_cost;
-  vw_out() << summary.FullReport() << "\n";
-  if (summary.termination_type == ceres::NO_CONVERGENCE){
+  if (opt.num_partitions > 1) {
+    convergence_reached = solve_partitioned(opt, obs, param_storage, problem);
+    ceres::Problem::EvaluateOptions eval_options;
+    eval_options.num_threads = num_threads;
+    problem.Evaluate(eval_options, &final_cost, NULL, NULL, NULL);
+    vw_out() << "Final cost: " << final_cost << "\n";
+  } else {
+    ceres::Solver::Summary summary;
+    {
+      asp::TraceSpan span("ceres_solve", "solver");
+      ceres::Solve(options, &problem, &summary);
+    }
+    final_cost = summary.final_cost;
+    vw_out() << summary.FullReport() << "\n";
+    if (summary.termination_type == ceres::NO_CONVERGENCE)
+      convergence_reached = false;
+  }
+  if (!convergence_reached) {
     // Print a clarifying message, so the user does not think that the algorithm failed.
     vw_out() << "Found a valid solution, but did not reach the actual minimum." << std::endl;
-    convergence_reached = false;
   }
 
   // Write the condition files after each pass, as we never know which pass will be the last
@@ -1373,7 +1939,7 @@ int do_ba_ceres_one_pass(Options             & opt,
   bool apply_loss_function = false;
   write_residual_logs(residual_prefix, apply_loss_function, opt, param_storage, cam_residual_counts,
                       num_gcp_or_dem_residuals, num_tri_residuals,
-                      reference_vec, cnet, crn, problem);
+                      reference_vec, cnet, obs, problem, state.residual_blocks);
   
   std::string point_kml_path = opt.out_prefix + "-final_points.kml";
   std::string url = "http://maps.google.com/mapfiles/kml/shapes/placemark_circle_highlight.png";
@@ -1388,10 +1954,10 @@ int do_ba_ceres_one_pass(Options             & opt,
   // Outlier filtering
   bool remove_outliers = (opt.num_ba_passes > 1);
   if (remove_outliers)
-      add_to_outliers(cnet, crn,
+      add_to_outliers(cnet, obs,
                       param_storage,   // in-out
                       opt, cam_residual_counts, num_gcp_or_dem_residuals,
-                      num_tri_residuals, reference_vec, problem);
+                      num_tri_residuals, reference_vec, problem, state.residual_blocks);
 
   // Find the cameras with the latest adjustments. Note that we do not modify
   // opt.camera_models, but make copies as needed.
@@ -1406,21 +1972,25 @@ int do_ba_ceres_one_pass(Options             & opt,
   std::vector<vw::Vector<double, 4>> mapprojPoints; // all points, not just stats
   std::vector<asp::MatchPairStats> convAngles, mapprojOffsets;
   std::vector<std::vector<double>> mapprojOffsetsPerCam;
-  outliers.clear(); 
+  std::set<int> outliers;
   for (int i = 0; i < param_storage.num_points(); i++)
     if (param_storage.get_point_outlier(i))
       outliers.insert(i); // update this based on param_storage
+  bool save_pair_stats = !opt.skip_pair_stats;
   asp::matchFilesProcessing(cnet,
                             asp::BaBaseOptions(opt), // note the slicing
                             optimized_cams, remove_outliers, outliers,
+                            save_pair_stats, num_camera_threads(opt),
                             convAngles, 
                             opt.mapproj_dem,
                             mapprojPoints, mapprojOffsets, mapprojOffsetsPerCam);
   
-  std::string conv_angles_file = opt.out_prefix + "-convergence_angles.txt";
-  asp::saveConvergenceAngles(conv_angles_file, convAngles, opt.image_files);
+  if (save_pair_stats) {
+    std::string conv_angles_file = opt.out_prefix + "-convergence_angles.txt";
+    asp::saveConvergenceAngles(conv_angles_file, convAngles, opt.image_files);
+  }
 
-  if (!opt.mapproj_dem.empty()) {
+  if (!opt.mapproj_dem.empty() && save_pair_stats) {
     std::string mapproj_offsets_stats_file = opt.out_prefix + "-mapproj_match_offset_stats.txt";
     std::string mapproj_offsets_file = opt.out_prefix + "-mapproj_match_offsets.txt";
  
@@ -1440,6 +2010,39 @@ int do_ba_ceres_one_pass(Options             & opt,
   return 0;
 } // End function do_ba_ceres_one_pass
 
+// Build the control network from the matches, and triangulate its points
+// with multiple threads. Return false if no points were found.
+bool build_triangulated_cnet(Options const& opt,
+                             std::vector<asp::CameraModelPtr> const& camera_models,
+                             ControlNetwork & cnet) {
+  double min_angle = opt.min_triangulation_angle*(M_PI/180.0);
+  if (!opt.match_database.empty())
+    return asp::buildControlNetworkFromDb(opt.match_database, camera_models,
+                                          opt.image_files, opt.match_files,
+                                          opt.min_matches, min_angle,
+                                          opt.forced_triangulation_distance,
+                                          opt.max_pairwise_matches,
+                                          num_camera_threads(opt), cnet);
+
+  // The points are triangulated below, not one at a time when loaded
+  bool triangulate_control_points = false;
+  bool success = vw::ba::build_control_network(triangulate_control_points,
+                                               cnet, camera_models,
+                                               opt.image_files,
+                                               opt.match_files,
+                                               opt.min_matches,
+                                               min_angle,
+                                               opt.forced_triangulation_distance,
+                                               opt.max_pairwise_matches);
+  if (!success)
+    return false;
+
+  asp::triangulateControlNetwork(cnet, camera_models, min_angle,
+                                 opt.forced_triangulation_distance,
+                                 num_camera_threads(opt));
+  return (cnet.size() > 0);
+}
+
 /// Use Ceres to do bundle adjustment.
 void do_ba_ceres(Options & opt, std::vector<Vector3> const& estimated_camera_gcc){
 
@@ -1450,15 +2053,7 @@ void do_ba_ceres(Options & opt, std::vector<Vector3> const& estimated_camera_gcc
   int num_gcp = 0;
   ControlNetwork & cnet = *(opt.cnet.get()); // alias
   if (!opt.apply_initial_transform_only) {
-    bool triangulate_control_points = true;
-    bool success = vw::ba::build_control_network(triangulate_control_points,
-                                                 cnet, opt.camera_models,
-                                                 opt.image_files,
-                                                 opt.match_files,
-                                                 opt.min_matches,
-                                                 opt.min_triangulation_angle*(M_PI/180.0),
-                                                 opt.forced_triangulation_distance,
-                                                 opt.max_pairwise_matches);
+    bool success = build_triangulated_cnet(opt, opt.camera_models, cnet);
     if (!success) {
       vw_out() << "Failed to build a control network. Consider removing "
                << "all .vwip and .match files and increasing "
@@ -1506,7 +2101,8 @@ void do_ba_ceres(Options & opt, std::vector<Vector3> const& estimated_camera_gcc
     // Issue a warning if the GCPs are far away from the camera coordinates.
     // Do it only if the cameras did not change, as otherwise the cnet is outdated.
     if (!cameras_changed) 
-      check_gcp_dists(opt.camera_models, opt.cnet, opt.forced_triangulation_distance);
+      check_gcp_dists(opt.camera_models, opt.cnet, opt.forced_triangulation_distance,
+                      num_camera_threads(opt));
   }
   
   int num_points = cnet.size();
@@ -1570,20 +2166,13 @@ void do_ba_ceres(Options & opt, std::vector<Vector3> const& estimated_camera_gcc
     /*bool success = */
     // Building the control network below may fail if there are only GCP,
     // but we will continue nevertheless.
-    bool triangulate_control_points = true;
-    vw::ba::build_control_network(triangulate_control_points,
-                                  cnet, new_cam_models,
-                                  opt.image_files,
-                                  opt.match_files,
-                                  opt.min_matches,
-                                  opt.min_triangulation_angle*(M_PI/180.0),
-                                  opt.forced_triangulation_distance,
-                                  opt.max_pairwise_matches);
+    build_triangulated_cnet(opt, new_cam_models, cnet);
     
     // Restore the rest of the cnet object
     num_gcp = vw::ba::add_ground_control_points(cnet, opt.gcp_files, opt.datum);
     
-    check_gcp_dists(new_cam_models, opt.cnet, opt.forced_triangulation_distance);
+    check_gcp_dists(new_cam_models, opt.cnet, opt.forced_triangulation_distance,
+                    num_camera_threads(opt));
     
     // Must update the number of points after the control network is recomputed
     num_points = cnet.size();
@@ -1601,10 +2190,14 @@ void do_ba_ceres(Options & opt, std::vector<Vector3> const& estimated_camera_gcc
   // TODO(oalexan1): Is it possible to avoid using CRNs?
   CRNJ crn;
   crn.from_cnet(cnet);
+  asp::BaObservations obs;
+  obs.build(crn);
 
   if (opt.num_ba_passes <= 0)
     vw_throw(ArgumentErr() << "Error: Expecting at least one bundle adjust pass.\n");
   
+  // The problem is kept across passes, and only the outliers are removed
+  BaProblemState state;
   double final_cost;
   for (int pass = 0; pass < opt.num_ba_passes; pass++) {
 
@@ -1615,8 +2208,8 @@ void do_ba_ceres(Options & opt, std::vector<Vector3> const& estimated_camera_gcc
 
     bool first_pass = (pass == 0);
     bool convergence_reached = true; // will change
-    do_ba_ceres_one_pass(opt, crn, first_pass,
-                         param_storage, orig_parameters,
+    do_ba_ceres_one_pass(opt, crn, obs, first_pass,
+                         param_storage, orig_parameters, state,
                          convergence_reached, final_cost);
     
     int num_points_remaining = num_points - param_storage.get_num_outliers();
@@ -1652,8 +2245,9 @@ void do_ba_ceres(Options & opt, std::vector<Vector3> const& estimated_camera_gcc
     // Do another pass of bundle adjustment.
     bool first_pass = true; // this needs more thinking
     bool convergence_reached = true;
-    do_ba_ceres_one_pass(opt, crn, first_pass,
-                         param_storage, orig_parameters,
+    BaProblemState rand_state; // the parameters were changed, so start anew
+    do_ba_ceres_one_pass(opt, crn, obs, first_pass,
+                         param_storage, orig_parameters, rand_state,
                          convergence_reached, final_cost);
     
     // Record the parameters of the best result.
@@ -1768,7 +2362,7 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     ("camera-positions",    po::value(&opt.camera_position_file)->default_value(""),
      "Specify a csv file path containing the estimated positions of the input cameras.  Only used with the inline-adjustments option.")
     ("init-camera-using-gcp",  po::bool_switch(&opt.init_camera_using_gcp)->default_value(false)->implicit_value(true),
-     "Given an image, a pinhole camera lacking correct position and orientation, and a GCP file, find the pinhole camera with given intrinsics most consistent with the GCP.")
+     "Given images, pinhole cameras lacking correct position and orientation, and GCP files, find each pinhole camera with given intrinsics most consistent with the GCP seen in its image. Each image must have at least 4 GCP. The cameras are found in parallel.")
     ("transform-cameras-with-shared-gcp",  po::bool_switch(&opt.transform_cameras_with_shared_gcp)->default_value(false)->implicit_value(true),
     "Given at least 3 GCP, with each seen in at least 2 images, "
     "find the triangulated positions based on pixels values in the GCP, "
@@ -1854,6 +2448,8 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "A higher factor will result in more interest points, but perhaps also more outliers. This is used only with homography alignment, such as for the pinhole session.")
     ("ip-uniqueness-threshold", po::value(&opt.ip_uniqueness_thresh)->default_value(0.8),
      "A higher threshold will result in more interest points, but perhaps less unique ones.")
+    ("matching-threads", po::value(&opt.matching_threads)->default_value(0),
+     "How many image pairs to match at the same time. If 0, use the value of --threads. Only one pair is matched at a time with cameras which are not thread-safe, such as ISIS ones, or with --ip-debug-images.")
     ("ip-side-filter-percent",  po::value(&opt.ip_edge_buffer_percent)->default_value(-1),
      "Remove matched IPs this percentage from the image left/right sides.")
     ("normalize-ip-tiles", 
@@ -1877,7 +2473,8 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Determine which camera images overlap by finding the lon-lat bounding boxes "
      "of their footprints given the specified DEM, expanding them by a given percentage, "
      "and see if those intersect. A higher percentage should be used when there is more "
-     "uncertainty about the input camera poses. Example: 'dem.tif 15'.")
+     "uncertainty about the input camera poses. Example: 'dem.tif 15'. If only the "
+     "percentage is given, find the footprints on the datum.")
     ("auto-overlap-buffer",  po::value(&opt.auto_overlap_buffer)->default_value(-1.0),
      "Try to automatically determine which images overlap. Used only if "
      "this option is explicitly set. Only supports Worldview style XML "
@@ -1920,8 +2517,16 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "How many interest points to detect in each 1024^2 image tile (default: automatic determination).")
     ("ip-per-image",              po::value(&opt.ip_per_image)->default_value(0),
      "How many interest points to detect in each image (default: automatic determination). It is overridden by --ip-per-tile if provided.")
+    ("ip-cache-dir",              po::value(&opt.ip_cache_dir)->default_value(""),
+     "Save detected interest points in this directory, named by a hash of the image and detection options, and reuse them when both match, across runs and tools.")
+    ("adaptive-ip-per-tile",      po::bool_switch(&opt.adaptive_ip_per_tile)->default_value(false)->implicit_value(true),
+     "Share the interest points among the image tiles in proportion with their texture, for about the same total, and skip flat tiles.")
     ("num-passes",           po::value(&opt.num_ba_passes)->default_value(2),
      "How many passes of bundle adjustment to do, with given number of iterations in each pass. For more than one pass, outliers will be removed between passes using --remove-outliers-params, and re-optimization will take place. Residual files and a copy of the match files with the outliers removed (*-clean.match) will be written to disk.")
+    ("num-partitions",       po::value(&opt.num_partitions)->default_value(0),
+     "Split the cameras into this many clusters with nearby footprints. Solve the problems for the clusters in parallel, with the cameras of other clusters seeing the same points held fixed, then refine the points seen by several clusters and the cameras seeing them. This uses much less memory and time than one solve for very large camera blocks. The default is to not split the cameras.")
+    ("solver-backend",       po::value(&opt.solver_backend)->default_value("cpu"),
+     "Where to solve the linear systems for the cameras. Options: cpu, cuda. With cuda, the camera-camera Schur complement is solved on the GPU, with a sparse solver if available, and otherwise with a dense one for up to 1000 cameras. This needs Ceres 2.2 or later built with CUDA support.")
     ("num-random-passes",           po::value(&opt.num_random_passes)->default_value(0),
      "After performing the normal bundle adjustment passes, do this many more passes using the same matches but adding random offsets to the initial parameter values with the goal of avoiding local minima that the optimizer may be getting stuck in.")
     ("remove-outliers-params", 
@@ -1936,6 +2541,8 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Use the match files from this prefix instead of the current output prefix. This implies --skip-matching.")
     ("clean-match-files-prefix",  po::value(&opt.clean_match_files_prefix)->default_value(""),
      "Use as input match files the *-clean.match files from this prefix. This implies --skip-matching.")
+    ("match-database",  po::value(&opt.match_database)->default_value(""),
+     "Keep the interest point matches of all image pairs in this single file, rather than in one .match file per pair. Pairs already in it are not matched again, and new matches, or matches from --match-files-prefix or --clean-match-files-prefix, are added to it. Many processes can add to it at the same time. The clean matches are saved to <output prefix>-clean-matches.matchdb.")
     ("enable-rough-homography",
      po::bool_switch(&opt.enable_rough_homography)->default_value(false)->implicit_value(true),
      "Enable the step of performing datum-based rough homography for interest point matching. This is best used with reasonably reliable input cameras and a wide footprint on the ground.")
@@ -1972,6 +2579,10 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Turn on atmospheric refraction correction for Optical Bar and non-ISIS linescan cameras. This option impairs the convergence of bundle adjustment.")
     ("dg-use-csm", po::bool_switch(&opt.dg_use_csm)->default_value(false)->implicit_value(true),
      "Use the CSM model with DigitalGlobe linescan cameras (-t dg). No corrections are done for velocity aberration or atmospheric refraction.")
+    ("dense-ephemeris-tables", po::bool_switch(&opt.dense_ephemeris_tables)->default_value(false)->implicit_value(true),
+     "Sample the positions and orientations of DigitalGlobe (without --dg-use-csm) and PeruSat cameras at fine time steps when loading them, and look them up from this table. This makes these cameras faster. A table is not used if it differs from the camera by more than 0.01 pixels.")
+    ("isis-camera-pool", po::bool_switch(&opt.isis_camera_pool)->default_value(false)->implicit_value(true),
+     "Give each thread its own ISIS camera, opened from the same cube, so that ISIS cameras can be used with multiple threads. This uses more memory. The cubes must have been spiceinit-ed with the SPICE data attached (the default).")
     ("mapprojected-data",  po::value(&opt.mapprojected_data)->default_value(""),
      "Given map-projected versions of the input images and the DEM they "
      "were mapprojected onto, create interest point matches among the  "
@@ -1980,6 +2591,10 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "reused. Specify the mapprojected images and the DEM as a string in  "
      "quotes, separated by spaces. An example is in the documentation.")
     
+    ("skip-pair-stats", po::bool_switch(&opt.skip_pair_stats)->default_value(false)->implicit_value(true),
+     "Do not compute the convergence angles and the offsets of mapprojected matches (with --mapproj-dem) for each image pair after each pass. These can take a long time for many image pairs. Clean match files are still written.")
+    ("io-threads", po::value(&opt.io_threads)->default_value(8),
+     "The most threads to use for writing the optimized cameras. It is not more than --threads.")
     ("save-cnet-as-csv", po::bool_switch(&opt.save_cnet_as_csv)->default_value(false)->implicit_value(true),
      "Save the control network containing all interest points in the format used by ground control points, so it can be inspected.")
     ("gcp-from-mapprojected-images", po::value(&opt.gcp_from_mapprojected)->default_value(""),
@@ -2211,6 +2826,20 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     vw_throw( ArgumentErr() << "Solving for intrinsic parameters is only supported with "
               << "pinhole and optical bar cameras.\n");
 
+  if (opt.num_partitions > 1 && opt.solve_intrinsics)
+    vw_throw( ArgumentErr() << "Cannot solve for intrinsics with --num-partitions.\n");
+
+  if (opt.num_partitions > 1 && opt.save_intermediate_cameras)
+    vw_throw( ArgumentErr() << "Cannot save intermediate cameras with --num-partitions.\n");
+
+  if (opt.solver_backend != "cpu" && opt.solver_backend != "cuda")
+    vw_throw( ArgumentErr() << "Unknown value for --solver-backend: "
+              << opt.solver_backend << ".\n");
+  if (opt.solver_backend == "cuda" && !cuda_dense_solver_available() &&
+      !cuda_sparse_solver_available())
+    vw_throw( ArgumentErr() << "The cuda solver backend is not available, as this "
+              << "build of Ceres does not support CUDA.\n");
+
   if ((opt.camera_type!=BaCameraType_Pinhole) && opt.approximate_pinhole_intrinsics)
     vw_throw( ArgumentErr() << "Cannot approximate intrinsics unless using pinhole cameras.\n");
 
@@ -2473,12 +3102,16 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
   return;
 }
 
-// A wrapper around ip matching. Can also work with NULL cameras.
+// A wrapper around ip matching. Can also work with NULL cameras.  If
+// the ip files are given, they have the interest points of each image,
+// found beforehand with detect_ip_once().
 void ba_match_ip(Options & opt, SessionPtr session, 
                  std::string const& image1_path,  std::string const& image2_path,
                  std::string const& camera1_path, std::string const& camera2_path,
                  vw::camera::CameraModel* cam1,   vw::camera::CameraModel* cam2,
-                 std::string const& match_filename) {
+                 std::string const& match_filename,
+                 std::string const& cached_ip_file1 = "",
+                 std::string const& cached_ip_file2 = "") {
   
   boost::shared_ptr<DiskImageResource>
     rsrc1(vw::DiskImageResourcePtr(image1_path)),
@@ -2511,7 +3144,11 @@ void ba_match_ip(Options & opt, SessionPtr session,
   // they must be saved in a subdirectory for each match pair, as
   // .vwip files change depending on the pair.
   std::string ip_file1 = "", ip_file2 = "";
-  if (opt.save_vwip) {
+  bool reuse_ip_files = (!cached_ip_file1.empty() && !cached_ip_file2.empty());
+  if (reuse_ip_files) {
+    ip_file1 = cached_ip_file1;
+    ip_file2 = cached_ip_file2;
+  } else if (opt.save_vwip) {
       // parallel_bundle_adjust should have set vwip_prefix, but not bundle_adjust itself
     if (opt.vwip_prefix == "")
       opt.vwip_prefix = opt.out_prefix; 
@@ -2526,7 +3163,45 @@ void ba_match_ip(Options & opt, SessionPtr session,
   session->ip_matching(image1_path, image2_path,
                        Vector2(masked_image1.cols(), masked_image1.rows()),
                        image1_stats, image2_stats, opt.ip_per_tile,
-                       nodata1, nodata2, cam1, cam2, match_filename, ip_file1, ip_file2);
+                       nodata1, nodata2, cam1, cam2, match_filename, ip_file1, ip_file2,
+                       reuse_ip_files);
+}
+
+// If the interest points of an image are the same for every pair it
+// is in, so they can be found only once per image. Not done with
+// --save-vwip, which keeps its own per-pair files. Cropping is not
+// supported by bundle_adjust, but is checked for as detect_ip() does.
+bool can_detect_ip_once(Options const& opt) {
+  return (opt.mapprojected_data == "" && !opt.enable_rough_homography && !opt.save_vwip &&
+          (opt.ip_detect_method == 0 || opt.individually_normalize) && // 0 is integral
+          asp::stereo_settings().left_image_crop_win  == BBox2i(0, 0, 0, 0) &&
+          asp::stereo_settings().right_image_crop_win == BBox2i(0, 0, 0, 0));
+}
+
+// Where the interest points of an image found once are kept. Each
+// instance of parallel_bundle_adjust has its own files.
+std::string cached_ip_file(Options const& opt, std::string const& image_path) {
+  return ip::ip_filename(opt.out_prefix + "-ip-cache/" + vw::stringify(opt.instance_index),
+                         image_path);
+}
+
+// Find the interest points of each of the given images, to be shared by
+// all pairs with that image.
+void detect_ip_once(Options const& opt, std::set<int> const& images) {
+  for (auto it = images.begin(); it != images.end(); it++) {
+    std::string const& image_path = opt.image_files[*it];
+    vw_out() << "Detecting interest points in: " << image_path << "\n";
+    boost::shared_ptr<DiskImageResource> rsrc(vw::DiskImageResourcePtr(image_path));
+    float nodata, dummy;
+    asp::get_nodata_values(rsrc, rsrc, nodata, dummy);
+    DiskImageView<float> image_view(rsrc);
+    ImageViewRef< PixelMask<float> > masked_image
+      = create_mask_less_or_equal(image_view, nodata);
+    vw::Vector<vw::float32,6> stats
+      = asp::StereoSession::gather_stats(masked_image, image_path, opt.out_prefix, image_path);
+    asp::StereoSession::detect_ip_for_image(image_path, stats, opt.ip_per_tile, nodata,
+                                            cached_ip_file(opt, image_path));
+  }
 }
 
 //==================================================================================
@@ -2743,6 +3418,98 @@ void create_gcp_from_mapprojected_images(Options const& opt){
 
 // End map projection functions
 
+// Move the matches of a pair of images from a .match file to the match
+// database. The file is removed if asked, so that the matches are not
+// kept twice. The matches are passed in if already read from the file.
+void add_to_match_database(Options const& opt, int i, int j,
+                           std::string const& match_file, bool remove_file,
+                           asp::MatchSet const* matches = NULL) {
+  if (opt.match_database.empty() || !boost::filesystem::exists(match_file))
+    return;
+  asp::MatchSet file_matches;
+  if (matches == NULL) {
+    file_matches.read(match_file);
+    matches = &file_matches;
+  }
+  matches->append_to_database(opt.match_database, opt.image_files[i], opt.image_files[j]);
+  if (remove_file)
+    boost::filesystem::remove(match_file);
+}
+
+// Find the matches of one pair of images. This may not always succeed.
+void match_image_pair(Options & opt, SessionPtr session, int i, int j,
+                      std::string const& match_file,
+                      std::string const& ip_file1, std::string const& ip_file2,
+                      std::vector<std::string> const& map_files,
+                      vw::cartography::GeoReference const& dem_georef,
+                      ImageViewRef<PixelMask<double>> & interp_dem) {
+
+  std::string const& image1_path  = opt.image_files[i];  // alias
+  std::string const& image2_path  = opt.image_files[j];  // alias
+  std::string const& camera1_path = opt.camera_files[i]; // alias
+  std::string const& camera2_path = opt.camera_files[j]; // alias
+
+  try{
+
+    if (opt.mapprojected_data == "") 
+      ba_match_ip(opt, session, image1_path, image2_path,
+                  camera1_path, camera2_path,
+                  opt.camera_models[i].get(),
+                  opt.camera_models[j].get(),
+                  match_file, ip_file1, ip_file2);
+
+    else
+      matches_from_mapproj_images(i, j, opt, session, map_files, dem_georef, interp_dem,  
+                                  match_file);
+
+    // Compute the coverage fraction. The matches are read once, also
+    // for adding them to the database.
+    asp::MatchSet matches;
+    matches.read(match_file);
+    boost::shared_ptr<DiskImageResource> rsrc1(vw::DiskImageResourcePtr(image1_path));
+    int right_ip_width = rsrc1->cols() *
+                          static_cast<double>(100-opt.ip_edge_buffer_percent)/100.0;
+    Vector2i ip_size(right_ip_width, rsrc1->rows());
+    double ip_coverage = matches.coverage_fraction(ip_size);
+    vw_out() << "IP coverage fraction = " << ip_coverage << std::endl;
+
+    bool remove_file = true;
+    add_to_match_database(opt, i, j, match_file, remove_file, &matches);
+  } catch (const std::exception& e){
+    vw_out() << "Could not find interest points between images "
+              << opt.image_files[i] << " and " << opt.image_files[j] << std::endl;
+    vw_out(WarningMessage) << e.what() << std::endl;
+  } //End try/catch
+}
+
+// A task to match one pair of images, so that many pairs can be
+// matched at the same time.
+class MatchPairTask: public vw::Task, private boost::noncopyable {
+  Options                             & m_opt;      // alias
+  SessionPtr                            m_session;
+  int                                   m_i, m_j;
+  std::string                           m_match_file, m_ip_file1, m_ip_file2;
+  std::vector<std::string>      const & m_map_files;  // alias
+  vw::cartography::GeoReference const & m_dem_georef; // alias
+  ImageViewRef<PixelMask<double>>     & m_interp_dem; // alias
+
+public:
+  MatchPairTask(Options & opt, SessionPtr session, int i, int j,
+                std::string const& match_file,
+                std::string const& ip_file1, std::string const& ip_file2,
+                std::vector<std::string> const& map_files,
+                vw::cartography::GeoReference const& dem_georef,
+                ImageViewRef<PixelMask<double>> & interp_dem):
+    m_opt(opt), m_session(session), m_i(i), m_j(j), m_match_file(match_file),
+    m_ip_file1(ip_file1), m_ip_file2(ip_file2), m_map_files(map_files),
+    m_dem_georef(dem_georef), m_interp_dem(interp_dem) {}
+
+  void operator()() {
+    match_image_pair(m_opt, m_session, m_i, m_j, m_match_file, m_ip_file1, m_ip_file2,
+                     m_map_files, m_dem_georef, m_interp_dem);
+  }
+};
+
 int main(int argc, char* argv[]) {
 
   Options opt;
@@ -2762,9 +3529,20 @@ int main(int argc, char* argv[]) {
     std::string dem_file_for_overlap;
     double pct_for_overlap = -1.0;
     if (opt.auto_overlap_params != "") {
+      // Either 'dem.tif 15', or just '15', for footprints on the datum
+      std::vector<std::string> tokens;
       std::istringstream is(opt.auto_overlap_params);
-      if (!(is >> dem_file_for_overlap >> pct_for_overlap)) 
+      std::string token;
+      while (is >> token)
+        tokens.push_back(token);
+      if (tokens.size() == 2)
+        dem_file_for_overlap = tokens[0];
+      std::istringstream is2(tokens.empty() ? "" : tokens.back());
+      if ((tokens.size() != 1 && tokens.size() != 2) || !(is2 >> pct_for_overlap)) 
         vw_throw(ArgumentErr() << "Could not parse correctly option --auto-overlap-params.\n");
+      if (dem_file_for_overlap.empty() && opt.datum.name() == asp::UNSPECIFIED_DATUM)
+        vw_throw(ArgumentErr() << "Finding the footprints of the cameras on the datum "
+                 << "with --auto-overlap-params needs the datum to be set.\n");
     }
 
     // For when we make matches based on mapprojected images. Read mapprojected
@@ -2839,7 +3617,7 @@ int main(int argc, char* argv[]) {
 
       // Compute and cache the camera footprint bbox
       if (opt.auto_overlap_params != "")
-        asp::camera_bbox_with_cache(dem_file_for_overlap,
+        asp::camera_bbox_with_cache(dem_file_for_overlap, opt.datum,
                                     opt.image_files[index], // use the original image
                                     opt.camera_models[index],  
                                     opt.out_prefix);
@@ -2858,7 +3636,8 @@ int main(int argc, char* argv[]) {
     if (opt.auto_overlap_params != "") {
       opt.have_overlap_list = true;
       asp::build_overlap_list_based_on_dem(opt.out_prefix,  
-                                           dem_file_for_overlap, pct_for_overlap,
+                                           dem_file_for_overlap, opt.datum,
+                                           pct_for_overlap,
                                            opt.image_files, opt.camera_models,
                                            // output
                                            opt.overlap_list);
@@ -2918,6 +3697,12 @@ int main(int argc, char* argv[]) {
     bool external_matches = (!opt.clean_match_files_prefix.empty() ||
                              !opt.match_files_prefix.empty());
     std::set<std::string> existing_files;
+    boost::shared_ptr<asp::MatchDatabase> match_db;
+    if (!opt.match_database.empty()) {
+      match_db.reset(new asp::MatchDatabase(opt.match_database));
+      vw_out() << "Found " << match_db->num_pairs() << " image pairs in: "
+               << opt.match_database << "\n";
+    }
     if (external_matches) {
       std::string prefix = asp::match_file_prefix(opt.clean_match_files_prefix,
                                                   opt.match_files_prefix,  
@@ -2926,7 +3711,11 @@ int main(int argc, char* argv[]) {
       asp::listExistingMatchFiles(prefix, existing_files);
     }
     
-    // Process the selected pairs
+    // Find the pairs which need matching, and set up their sessions.
+    // The matching itself happens further down.
+    std::vector<std::pair<int,int>> pairs_to_match;
+    std::vector<std::string> match_files_to_make;
+    std::vector<SessionPtr> pair_sessions;
     for (size_t k = 0; k < this_instance_pairs.size(); k++) {
 
       if (opt.apply_initial_transform_only)
@@ -2945,6 +3734,13 @@ int main(int argc, char* argv[]) {
         = asp::match_filename(opt.clean_match_files_prefix, opt.match_files_prefix,  
                               opt.out_prefix, image1_path, image2_path);
 
+      // With a match database, a pair in it needs no more work. The match
+      // file name is kept only to record that the pair has matches.
+      if (match_db && match_db->has_pair(image1_path, image2_path)) {
+        opt.match_files[std::make_pair(i, j)] = match_file;
+        continue;
+      }
+
       // The external match file does not exist, don't try to load it
       if (external_matches && existing_files.find(match_file) == existing_files.end())
         continue;
@@ -2968,53 +3764,77 @@ int main(int argc, char* argv[]) {
       
       if (!inputs_changed) {
         vw_out() << "\t--> Using cached match file: " << match_file << "\n";
+        // External matches are copied to the database, local ones moved
+        add_to_match_database(opt, i, j, match_file, !external_matches);
         continue;
       }
 
-      // Read no-data
       boost::shared_ptr<DiskImageResource>
         rsrc1(vw::DiskImageResourcePtr(image1_path)),
         rsrc2(vw::DiskImageResourcePtr(image2_path));
       if ((rsrc1->channels() > 1) || (rsrc2->channels() > 1))
         vw_throw(ArgumentErr() << "Error: Input images can only have a single channel!\n\n");
-      float nodata1, nodata2;
-      asp::get_nodata_values(rsrc1, rsrc2, nodata1, nodata2);
       
-      // Set up the stereo session
+      // Set up the stereo session. This is not thread-safe, as the
+      // session name may change.
       SessionPtr session(asp::StereoSessionFactory::create(opt.stereo_session, // may change
                                                            opt, image1_path,  image2_path,
                                                            camera1_path, camera2_path,
                                                            opt.out_prefix));
+      pairs_to_match.push_back(std::make_pair(i, j));
+      match_files_to_make.push_back(match_file);
+      pair_sessions.push_back(session);
+    } // End loop through all input image pairs
 
+    // Detect the interest points once per image rather than once per
+    // pair, if they do not depend on the pair.
+    bool ip_once = (can_detect_ip_once(opt) && !pairs_to_match.empty());
+    std::set<int> ip_once_images;
+    if (ip_once) {
+      std::set<int> & images = ip_once_images; // alias
+      for (size_t k = 0; k < pairs_to_match.size(); k++) {
+        images.insert(pairs_to_match[k].first);
+        images.insert(pairs_to_match[k].second);
+      }
+      detect_ip_once(opt, images);
+    }
 
-      // Find matches between image pairs. This may not always succeed.
-      try{
-
-        if (opt.mapprojected_data == "") 
-          ba_match_ip(opt, session, image1_path, image2_path,
-                      camera1_path, camera2_path,
-                      opt.camera_models[i].get(),
-                      opt.camera_models[j].get(),
-                      match_file);
-
-        else
-          matches_from_mapproj_images(i, j, opt, session, map_files, dem_georef, interp_dem,  
-                                      match_file);
-
-        // Compute the coverage fraction
-        std::vector<ip::InterestPoint> ip1, ip2;
-        ip::read_binary_match_file(match_file, ip1, ip2);
-        int right_ip_width = rsrc1->cols() *
-                              static_cast<double>(100-opt.ip_edge_buffer_percent)/100.0;
-        Vector2i ip_size(right_ip_width, rsrc1->rows());
-        double ip_coverage = asp::calc_ip_coverage_fraction(ip2, ip_size);
-        vw_out() << "IP coverage fraction = " << ip_coverage << std::endl;
-      } catch (const std::exception& e){
-        vw_out() << "Could not find interest points between images "
-                  << opt.image_files[i] << " and " << opt.image_files[j] << std::endl;
-        vw_out(WarningMessage) << e.what() << std::endl;
-      } //End try/catch
-    } // End loop through all input image pairs
+    // Match the pairs, several at a time if the cameras allow
+    int num_match_threads = opt.matching_threads;
+    if (num_match_threads <= 0)
+      num_match_threads = (opt.num_threads > 0) ? opt.num_threads
+                                                : vw_settings().default_num_threads();
+    if (opt.ip_debug_images || opt.mapprojected_data != "" ||
+        (!pair_sessions.empty() && !pair_sessions[0]->supports_multi_threading()))
+      num_match_threads = 1; // fixed debug file names, shared DEM, or ISIS
+    if (opt.save_vwip && opt.vwip_prefix == "")
+      opt.vwip_prefix = opt.out_prefix; // set here, not by each task
+    if (num_match_threads > 1 && pairs_to_match.size() > 1) {
+      vw_out() << "Matching " << pairs_to_match.size() << " image pairs using "
+               << num_match_threads << " threads.\n";
+      // Split the threads among the pairs, rather than the RANSAC of each
+      // pair using all of them
+      asp::stereo_settings().ip_num_ransac_threads
+        = std::max(1, int(vw_settings().default_num_threads()) / num_match_threads);
+    }
+    FifoWorkQueue match_queue(num_match_threads);
+    for (size_t k = 0; k < pairs_to_match.size(); k++) {
+      int i = pairs_to_match[k].first, j = pairs_to_match[k].second;
+      std::string ip_file1, ip_file2;
+      if (ip_once) {
+        ip_file1 = cached_ip_file(opt, opt.image_files[i]);
+        ip_file2 = cached_ip_file(opt, opt.image_files[j]);
+      }
+      boost::shared_ptr<MatchPairTask>
+        task(new MatchPairTask(opt, pair_sessions[k], i, j, match_files_to_make[k],
+                               ip_file1, ip_file2, map_files, dem_georef, interp_dem));
+      match_queue.add_task(task);
+    }
+    match_queue.join_all();
+
+    // The interest points found once per image are not needed anymore
+    for (auto it = ip_once_images.begin(); it != ip_once_images.end(); it++)
+      boost::filesystem::remove(cached_ip_file(opt, opt.image_files[*it]));
 
     if (opt.stop_after_matching){
       vw_out() << "Quitting after matches computation.\n";
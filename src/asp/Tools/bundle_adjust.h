@@ -57,8 +57,8 @@ struct Options: public asp::BaBaseOptions {
   std::string cnet_file, vwip_prefix,
     cost_function, mapprojected_data, gcp_from_mapprojected,
     image_list, camera_list, mapprojected_data_list,
-    fixed_image_list;
-  int ip_per_tile, ip_per_image, ip_edge_buffer_percent;
+    fixed_image_list, ip_cache_dir;
+  int ip_per_tile, ip_per_image, ip_edge_buffer_percent, matching_threads;
   double forced_triangulation_distance, overlap_exponent, ip_triangulation_max_error;
   int    instance_count, instance_index, num_random_passes, ip_num_ransac_iterations;
   bool   save_intermediate_cameras, approximate_pinhole_intrinsics,
@@ -66,13 +66,14 @@ struct Options: public asp::BaBaseOptions {
     transform_cameras_with_shared_gcp, transform_cameras_using_gcp,
     fix_gcp_xyz, solve_intrinsics,
     ip_normalize_tiles, ip_debug_images, stop_after_stats, stop_after_matching,
-    skip_matching, match_first_to_last, apply_initial_transform_only, save_vwip;
+    skip_matching, match_first_to_last, apply_initial_transform_only, save_vwip,
+    adaptive_ip_per_tile;
   BACameraType camera_type;
   std::string datum_str, camera_position_file, initial_transform_file,
     csv_format_str, csv_proj4_str, reference_terrain, disparity_list,
-    proj_str;
+    proj_str, solver_backend;
   double semi_major, semi_minor, position_filter_dist;
-  int    num_ba_passes, max_num_reference_points;
+  int    num_ba_passes, max_num_reference_points, num_partitions, io_threads;
   std::string remove_outliers_params_str;
   std::vector<double> intrinsics_limits;
   boost::shared_ptr<vw::ba::ControlNetwork> cnet;
@@ -84,8 +85,9 @@ struct Options: public asp::BaBaseOptions {
     reference_terrain_weight, auto_overlap_buffer;
   bool   skip_rough_homography, enable_rough_homography, disable_tri_filtering,
     enable_tri_filtering, no_datum, individually_normalize, use_llh_error,
-    force_reuse_match_files, save_cnet_as_csv,
-    enable_correct_velocity_aberration, enable_correct_atmospheric_refraction, dg_use_csm;
+    force_reuse_match_files, save_cnet_as_csv, skip_pair_stats,
+    enable_correct_velocity_aberration, enable_correct_atmospheric_refraction, dg_use_csm,
+    dense_ephemeris_tables, isis_camera_pool;
   vw::Vector2 elevation_limit;   // Expected range of elevation to limit results to.
   vw::BBox2 lon_lat_limit;       // Limit the triangulated interest points to this lonlat range
   vw::BBox2 proj_win; // Limit input triangulated points to this projwin
@@ -99,16 +101,17 @@ struct Options: public asp::BaBaseOptions {
   
   // Make sure all values are initialized, even though they will be
   // over-written later.
-  Options(): ip_per_tile(0), ip_per_image(0), 
+  Options(): ip_per_tile(0), ip_per_image(0), matching_threads(0),
              forced_triangulation_distance(-1), overlap_exponent(0), 
               save_intermediate_cameras(false),
              fix_gcp_xyz(false), solve_intrinsics(false), camera_type(BaCameraType_Other),
              semi_major(0), semi_minor(0), position_filter_dist(-1),
-             num_ba_passes(2), max_num_reference_points(-1),
+             num_ba_passes(2), max_num_reference_points(-1), num_partitions(0), io_threads(8),
              datum(vw::cartography::Datum(asp::UNSPECIFIED_DATUM, "User Specified Spheroid",
                                           "Reference Meridian", 1, 1, 0)),
              ip_detect_method(0), num_scales(-1), skip_rough_homography(false),
-             individually_normalize(false), use_llh_error(false), force_reuse_match_files(false){}
+             individually_normalize(false), use_llh_error(false), force_reuse_match_files(false),
+             skip_pair_stats(false){}
 
   /// Duplicate info to asp settings where it needs to go.
   void copy_to_asp_settings() const{
@@ -123,7 +126,11 @@ struct Options: public asp::BaBaseOptions {
     asp::stereo_settings().enable_correct_velocity_aberration
       = enable_correct_velocity_aberration;
     asp::stereo_settings().dg_use_csm = dg_use_csm;
+    asp::stereo_settings().dense_ephemeris_tables = dense_ephemeris_tables;
+    asp::stereo_settings().isis_camera_pool = isis_camera_pool;
     asp::stereo_settings().ip_per_image = ip_per_image;
+    asp::stereo_settings().ip_cache_dir = ip_cache_dir;
+    asp::stereo_settings().adaptive_ip_per_tile = adaptive_ip_per_tile;
 
     // Note that by default rough homography and tri filtering are disabled
     // as input cameras may be too inaccurate for that.
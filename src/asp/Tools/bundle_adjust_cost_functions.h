@@ -27,6 +27,9 @@
 #include <asp/Core/Macros.h>
 #include <asp/Core/StereoSettings.h>
 #include <vw/Camera/OpticalBarModel.h>
+#include <asp/Camera/RPCModel.h>
+#include <asp/Camera/CsmModel.h>
+#include <csm/RasterGM.h>
 
 
 // Turn off warnings from eigen
@@ -434,6 +437,195 @@ private:
 
 }; // End class BaReprojectionError
 
+
+/// The same residual as BaReprojectionError with an AdjustedCameraBundleModel,
+/// but with the Jacobians found from the derivatives of the underlying camera
+/// at the adjusted point. RPC cameras have these in closed form, and CSM
+/// cameras provide them with one call, so the expensive point_to_pixel
+/// is invoked once per evaluation rather than for each parameter. Only
+/// the derivative of the rotation itself, which needs no camera calls,
+/// is found with differences.
+class BaAnalyticReprojectionError: public ceres::SizedCostFunction<2, 3, 6> {
+public:
+  BaAnalyticReprojectionError(Vector2 const& observation, Vector2 const& pixel_sigma,
+                              boost::shared_ptr<CameraModel> camera):
+    m_observation(observation), m_pixel_sigma(pixel_sigma), m_camera(camera) {
+    m_rpc_model = dynamic_cast<asp::RPCModel*>(camera.get());
+    m_csm_model = dynamic_cast<asp::CsmModel*>(camera.get());
+    // As in AdjustedCameraModel, the rotation is around this point
+    m_rotation_center = camera->camera_center(Vector2());
+  }
+
+  /// If the analytic Jacobians are available for this camera
+  static bool is_supported(boost::shared_ptr<CameraModel> camera) {
+    return dynamic_cast<asp::RPCModel*>(camera.get()) != NULL ||
+      dynamic_cast<asp::CsmModel*>(camera.get()) != NULL;
+  }
+
+  virtual bool Evaluate(double const* const* parameters, double* residuals,
+                        double** jacobians) const {
+
+    try {
+      Vector3 point(parameters[0][0], parameters[0][1], parameters[0][2]);
+      Vector3 adj_point = adjusted_point(point, parameters[1]);
+
+      Vector2 pixel;
+      Matrix<double, 2, 3> J;
+      bool find_jacobian = (jacobians != NULL);
+      project(adj_point, find_jacobian, pixel, J);
+      for (int r = 0; r < 2; r++)
+        residuals[r] = (pixel[r] - m_observation[r])/m_pixel_sigma[r];
+
+      if (!find_jacobian)
+        return true;
+
+      // The adjusted point is R^{-1} (point - center - translation) + center
+      CameraAdjustment correction(parameters[1]);
+      Matrix<double, 2, 3> JR = J * inverse(correction.pose()).rotation_matrix();
+      if (jacobians[0] != NULL) {
+        for (int r = 0; r < 2; r++)
+          for (int c = 0; c < 3; c++)
+            jacobians[0][3*r + c] = JR(r, c)/m_pixel_sigma[r];
+      }
+
+      if (jacobians[1] != NULL) {
+        // Translation
+        for (int r = 0; r < 2; r++)
+          for (int c = 0; c < 3; c++)
+            jacobians[1][6*r + c] = -JR(r, c)/m_pixel_sigma[r];
+
+        // Rotation, by central differences of the rotated point only
+        double h = 1e-7;
+        for (int c = 0; c < 3; c++) {
+          double pose[6];
+          for (int k = 0; k < 6; k++)
+            pose[k] = parameters[1][k];
+          pose[3 + c] = parameters[1][3 + c] + h;
+          Vector3 plus  = adjusted_point(point, pose);
+          pose[3 + c] = parameters[1][3 + c] - h;
+          Vector3 minus = adjusted_point(point, pose);
+          Vector2 d = J * ((plus - minus)/(2.0*h));
+          for (int r = 0; r < 2; r++)
+            jacobians[1][6*r + 3 + c] = d[r]/m_pixel_sigma[r];
+        }
+      }
+
+    } catch (std::exception const& e) {
+      Mutex::Lock lock( g_ba_mutex );
+      g_ba_num_errors++;
+      if (g_ba_num_errors < 100) {
+        vw_out(ErrorMessage) << e.what() << std::endl;
+      }else if (g_ba_num_errors == 100) {
+        vw_out() << "Will print no more error messages about "
+                 << "failing to compute residuals.\n";
+      }
+
+      residuals[0] = g_big_pixel_value;
+      residuals[1] = g_big_pixel_value;
+      return false;
+    }
+    return true;
+  }
+
+  // Factory to hide the construction of the CostFunction object from the
+  // client code. Returns NULL if the camera is not supported, or if the
+  // adjusted point here does not agree with AdjustedCameraModel, so that
+  // the caller can fall back to numeric differentiation.
+  static ceres::CostFunction* Create(Vector2 const& observation,
+                                     Vector2 const& pixel_sigma,
+                                     boost::shared_ptr<CameraModel> camera,
+                                     double const* point, double const* pose) {
+    if (!is_supported(camera))
+      return NULL;
+
+    BaAnalyticReprojectionError * cost_function
+      = new BaAnalyticReprojectionError(observation, pixel_sigma, camera);
+    bool agrees = false;
+    try {
+      CameraAdjustment correction(pose);
+      vw::camera::AdjustedCameraModel adj_cam(camera, correction.position(),
+                                              correction.pose());
+      Vector3 xyz(point[0], point[1], point[2]);
+      Vector2 expected = adj_cam.point_to_pixel(xyz);
+      Vector2 pixel = camera->point_to_pixel(cost_function->adjusted_point(xyz, pose));
+      agrees = (norm_2(pixel - expected) <= 1e-6);
+    } catch (std::exception const& e) {
+      // Let the general cost function handle this point
+    }
+
+    if (!agrees) {
+      delete cost_function;
+      return NULL;
+    }
+    return cost_function;
+  }
+
+private:
+
+  /// Apply the adjustment to a point, as AdjustedCameraModel does
+  Vector3 adjusted_point(Vector3 const& point, double const* pose) const {
+    CameraAdjustment correction(pose);
+    Vector3 offset = point - m_rotation_center - correction.position();
+    return inverse(correction.pose()).rotate(offset) + m_rotation_center;
+  }
+
+  /// The pixel in the underlying camera, and optionally its Jacobian
+  /// with respect to the ECEF point
+  void project(Vector3 const& xyz, bool find_jacobian,
+               Vector2 & pixel, Matrix<double, 2, 3> & J) const {
+
+    if (m_rpc_model != NULL) {
+      vw::cartography::Datum const& datum = m_rpc_model->datum();
+      Vector3 llh = datum.cartesian_to_geodetic(xyz);
+      pixel = m_rpc_model->geodetic_to_pixel(llh);
+      if (!find_jacobian)
+        return;
+
+      // The derivative of the lon and lat (in degrees) and height with
+      // respect to the ECEF point, from the radii of curvature.
+      double lon = llh[0] * M_PI/180.0, lat = llh[1] * M_PI/180.0, h = llh[2];
+      double a = datum.semi_major_axis(), b = datum.semi_minor_axis();
+      double e2 = 1.0 - (b*b)/(a*a);
+      double s = sin(lat), w = 1.0 - e2*s*s;
+      double N = a/sqrt(w), M = a*(1.0 - e2)/(w*sqrt(w));
+      Vector3 east (-sin(lon), cos(lon), 0.0);
+      Vector3 north(-s*cos(lon), -s*sin(lon), cos(lat));
+      Vector3 up   (cos(lat)*cos(lon), cos(lat)*sin(lon), s);
+      Matrix3x3 D;
+      for (int c = 0; c < 3; c++) {
+        D(0, c) = (180.0/M_PI) * east[c]/((N + h)*cos(lat));
+        D(1, c) = (180.0/M_PI) * north[c]/(M + h);
+        D(2, c) = up[c];
+      }
+      J = m_rpc_model->geodetic_to_pixel_Jacobian(llh) * D;
+      return;
+    }
+
+    pixel = m_csm_model->point_to_pixel(xyz);
+    if (!find_jacobian)
+      return;
+
+    // The partials are of the line, then of the sample, while ASP
+    // pixels are the sample, then the line.
+    std::vector<double> partials
+      = m_csm_model->m_gm_model->computeGroundPartials(csm::EcefCoord(xyz[0], xyz[1], xyz[2]));
+    if (partials.size() != 6)
+      vw_throw(ArgumentErr() << "Expecting 6 ground partials from the CSM model.\n");
+    for (int c = 0; c < 3; c++) {
+      J(0, c) = partials[3 + c];
+      J(1, c) = partials[c];
+    }
+  }
+
+  Vector2 m_observation;     ///< The pixel observation for this camera/point pair.
+  Vector2 m_pixel_sigma;
+  Vector3 m_rotation_center;
+  boost::shared_ptr<CameraModel> m_camera;
+  asp::RPCModel * m_rpc_model; // one of these is set, and is owned by m_camera
+  asp::CsmModel * m_csm_model;
+
+}; // End class BaAnalyticReprojectionError
+
 /// A ceres cost function. Here we float two pinhole camera's
 /// intrinsic and extrinsic parameters. We take as input a reference
 /// xyz point and a disparity from left to right image. The
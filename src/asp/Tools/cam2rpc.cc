@@ -32,6 +32,9 @@
 #include <asp/Core/FileUtils.h>
 #include <asp/Camera/RPCModelGen.h>
 #include <asp/Core/PointUtils.h>
+#include <asp/Camera/BatchProjection.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Core/Settings.h>
 
 #include <limits>
 #include <cstring>
@@ -39,6 +42,7 @@
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/program_options.hpp>
+#include <boost/noncopyable.hpp>
 
 namespace fs = boost::filesystem;
 namespace po = boost::program_options;
@@ -48,6 +52,32 @@ using namespace vw::camera;
 using namespace std;
 using namespace vw::cartography;
 
+// Project into the camera the points of one column of the sampling grid
+class ProjectColumnTask: public vw::Task, private boost::noncopyable {
+  vw::camera::CameraModel const* m_cam;
+  std::vector<vw::Vector3> const& m_xyz;
+  std::vector<vw::Vector2> & m_pixels;
+  std::vector<unsigned char> & m_valid;
+  vw::TerminalProgressCallback & m_tpc;
+  double m_inc_amount;
+  vw::Mutex & m_progress_mutex;
+public:
+  ProjectColumnTask(vw::camera::CameraModel const* cam,
+                    std::vector<vw::Vector3> const& xyz,
+                    std::vector<vw::Vector2> & pixels,
+                    std::vector<unsigned char> & valid,
+                    vw::TerminalProgressCallback & tpc, double inc_amount,
+                    vw::Mutex & progress_mutex):
+    m_cam(cam), m_xyz(xyz), m_pixels(pixels), m_valid(valid), m_tpc(tpc),
+    m_inc_amount(inc_amount), m_progress_mutex(progress_mutex) {}
+
+  void operator()() {
+    asp::points_to_pixels(m_cam, m_xyz, m_pixels, m_valid);
+    vw::Mutex::Lock lock(m_progress_mutex);
+    m_tpc.report_incremental_progress(m_inc_amount);
+  }
+};
+
 struct Options : public vw::GdalWriteOptions {
   double penalty_weight;
   string image_file, camera_file, output_rpc, stereo_session, bundle_adjust_prefix,
@@ -265,13 +295,15 @@ int main( int argc, char *argv[] ) {
 
     vw_out() << "Projecting pixels into the camera to generate the RPC model.\n";
     vw::TerminalProgressCallback tpc("asp", "\t--> ");
-    double inc_amount = 1.0 / double(opt.num_samples);
-
 
     // Mask the input image
     ImageViewRef< PixelMask<float> > input_img
       = create_mask_less_or_equal(disk_view, opt.input_nodata_value);
 
+    // The points to project, grouped in columns, each of which will be
+    // projected by a separate thread.
+    std::vector< std::vector<Vector3> > col_llh, col_xyz;
+
     if (opt.dem_file.empty()) {
 
       vw_out() << "Using datum: " << opt.datum << std::endl;
@@ -281,8 +313,9 @@ int main( int argc, char *argv[] ) {
       double delta_lon = (ll.max()[0] - ll.min()[0])/double(opt.num_samples);
       double delta_lat = (ll.max()[1] - ll.min()[1])/double(opt.num_samples);
       double delta_ht  = (H[1] - H[0])/double(opt.num_samples);
-      tpc.report_progress(0);
       for (double lon = ll.min()[0]; lon <= ll.max()[0]; lon += delta_lon) {
+        col_llh.push_back(std::vector<Vector3>());
+        col_xyz.push_back(std::vector<Vector3>());
         for (double lat = ll.min()[1]; lat <= ll.max()[1]; lat += delta_lat) {
           for (double ht = H[0]; ht <= H[1]; ht += delta_ht) {
 
@@ -292,15 +325,10 @@ int main( int argc, char *argv[] ) {
             // Go back to llh. This is a bugfix for the 360 deg offset problem.
             llh = opt.datum.cartesian_to_geodetic(xyz);
 
-            Vector2 cam_pix = cam->point_to_pixel(xyz);
-            if (image_box.contains(cam_pix)) {
-              all_llh.push_back(llh);
-              all_pixels.push_back(cam_pix);
-            }
-
+            col_llh.back().push_back(llh);
+            col_xyz.back().push_back(xyz);
           }
         }
-        tpc.report_incremental_progress(inc_amount);
       }
 
     }else{
@@ -323,8 +351,9 @@ int main( int argc, char *argv[] ) {
       // coefficients.
       double delta_col = std::max(1.0, dem.cols()/double(opt.num_samples));
       double delta_row = std::max(1.0, dem.rows()/double(opt.num_samples));
-      tpc.report_progress(0);
       for (double dcol = 0; dcol < dem.cols(); dcol += delta_col) {
+        col_llh.push_back(std::vector<Vector3>());
+        col_xyz.push_back(std::vector<Vector3>());
         for (double drow = 0; drow < dem.rows(); drow += delta_row) {
           int col = dcol, row = drow; // cast to int
 
@@ -341,21 +370,44 @@ int main( int argc, char *argv[] ) {
           // Go back to llh. This is a bugfix for the 360 deg offset problem.
           llh = opt.datum.cartesian_to_geodetic(xyz);
 
-          Vector2 cam_pix;
-          try {
-            // the point_to_pixel function can be capricious
-            cam_pix = cam->point_to_pixel(xyz);
-          }catch(...){
-            continue;
-          }
+          col_llh.back().push_back(llh);
+          col_xyz.back().push_back(xyz);
+        }
+      }
+    }
 
-          if (image_box.contains(cam_pix) && is_valid(input_img(cam_pix[0], cam_pix[1]))) {
-            all_llh.push_back(llh);
-            all_pixels.push_back(cam_pix);
-          }
+    // Project the points into the camera, in parallel if the camera
+    // allows it. A point which fails to project is skipped.
+    int num_threads = 1;
+    if (session->supports_multi_threading())
+      num_threads = vw::vw_settings().default_num_threads();
+    std::vector< std::vector<Vector2> > col_pixels(col_xyz.size());
+    std::vector< std::vector<unsigned char> > col_valid(col_xyz.size());
+    {
+      tpc.report_progress(0);
+      vw::Mutex progress_mutex;
+      double inc_amount = 1.0 / std::max(1.0, double(col_xyz.size()));
+      vw::FifoWorkQueue queue(num_threads);
+      for (size_t c = 0; c < col_xyz.size(); c++) {
+        boost::shared_ptr<ProjectColumnTask>
+          task(new ProjectColumnTask(cam.get(), col_xyz[c], col_pixels[c], col_valid[c],
+                                     tpc, inc_amount, progress_mutex));
+        queue.add_task(task);
+      }
+      queue.join_all();
+    }
 
-        }
-        tpc.report_incremental_progress(inc_amount);
+    for (size_t c = 0; c < col_xyz.size(); c++) {
+      for (size_t i = 0; i < col_xyz[c].size(); i++) {
+        if (!col_valid[c][i])
+          continue;
+        Vector2 const& cam_pix = col_pixels[c][i];
+        if (!image_box.contains(cam_pix))
+          continue;
+        if (!opt.dem_file.empty() && !is_valid(input_img(cam_pix[0], cam_pix[1])))
+          continue;
+        all_llh.push_back(col_llh[c][i]);
+        all_pixels.push_back(cam_pix);
       }
     }
     tpc.report_finished();
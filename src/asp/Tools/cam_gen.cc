@@ -20,6 +20,7 @@
 
 #include <vw/FileIO/DiskImageView.h>
 #include <vw/Core/StringUtils.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Camera/PinholeModel.h>
 #include <vw/Camera/CameraUtilities.h>
 #include <vw/Cartography/Datum.h>
@@ -40,6 +41,7 @@
 
 #include <limits>
 #include <cstring>
+#include <fstream>
 
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
@@ -52,6 +54,77 @@ using namespace vw;
 using namespace vw::camera;
 using namespace vw::cartography;
 
+// The projection of a pinhole camera with no lens distortion, written out
+// so that it can be differentiated. A point is taken to the camera frame,
+// then to the (u, v, w) frame of the model, then projected.
+struct PinholeProjection {
+  Vector3 u, v, w;
+  double fu, fv, cu, cv, pitch;
+
+  Vector2 project(Vector3 const& q) const { // q is in the camera frame
+    Vector3 s(dot_prod(u, q), dot_prod(v, q), dot_prod(w, q));
+    return Vector2((fu * s[0] / s[2] + cu) / pitch, (fv * s[1] / s[2] + cv) / pitch);
+  }
+};
+
+// Write out the projection of a pinhole camera. Return false, so that
+// numerical differentiation is used instead, if the camera has lens
+// distortion, or if this does not reproduce its projection of the given points.
+bool pinhole_projection(PinholeModel const& cam, std::vector<Vector3> const& xyz,
+                        PinholeProjection & proj) {
+  try {
+    proj.fu = cam.focal_length()[0];
+    proj.fv = cam.focal_length()[1];
+    proj.cu = cam.point_offset()[0];
+    proj.cv = cam.point_offset()[1];
+    proj.pitch = cam.pixel_pitch();
+    cam.coordinate_frame(proj.u, proj.v, proj.w);
+
+    Matrix3x3 R = cam.camera_pose(Vector2()).rotation_matrix();
+    Vector3 ctr = cam.camera_center(Vector2());
+    for (size_t it = 0; it < xyz.size(); it++) {
+      Vector2 pix = cam.point_to_pixel(xyz[it]);
+      Vector2 proj_pix = proj.project(transpose(R) * (xyz[it] - ctr));
+      if (!(norm_2(pix - proj_pix) <= 1e-6 * (1.0 + norm_2(pix))))
+        return false;
+    }
+  } catch (...) {
+    return false;
+  }
+  return true;
+}
+
+bool pinhole_projection(OpticalBarModel const& cam, std::vector<Vector3> const& xyz,
+                        PinholeProjection & proj) {
+  return false;
+}
+
+inline Matrix3x3 skew(Vector3 const& a) {
+  Matrix3x3 M;
+  M(0, 1) = -a[2]; M(0, 2) =  a[1];
+  M(1, 0) =  a[2]; M(1, 2) = -a[0];
+  M(2, 0) = -a[1]; M(2, 1) =  a[0];
+  return M;
+}
+
+// The derivatives of the rotation matrix of an axis-angle vector a with
+// respect to its components, per Gallego and Yezzi, "A compact formula for
+// the derivative of a 3-D rotation in exponential coordinates", 2015.
+void rotation_derivatives(Vector3 const& a, Matrix3x3 const& R, Matrix3x3 dR[3]) {
+  double theta2 = dot_prod(a, a);
+  Matrix3x3 I;
+  I.set_identity();
+  for (int i = 0; i < 3; i++) {
+    Vector3 e;
+    e[i] = 1.0;
+    if (theta2 < 1e-16) {
+      dR[i] = skew(e);
+      continue;
+    }
+    dR[i] = (a[i] * skew(a) + skew(cross_prod(a, (I - R) * e))) * R / theta2;
+  }
+}
+
 // Solve for best fitting camera that projects given xyz locations at
 // given pixels. If cam_weight > 0, try to constrain the camera height
 // above datum at the value of cam_height.
@@ -64,6 +137,8 @@ class CameraSolveLMA_Ht: public vw::math::LeastSquaresModelBase<CameraSolveLMA_H
   double m_cam_height, m_cam_weight, m_cam_ctr_weight;
   vw::cartography::Datum m_datum;
   Vector3 m_input_cam_ctr;
+  bool m_analytic;
+  PinholeProjection m_proj;
   
 public:
 
@@ -79,7 +154,9 @@ public:
     m_xyz(xyz),
     m_camera_model(camera_model), 
     m_cam_height(cam_height), m_cam_weight(cam_weight), m_cam_ctr_weight(cam_ctr_weight),
-    m_datum(datum), m_input_cam_ctr(m_camera_model.camera_center(vw::Vector2())) {}
+    m_datum(datum), m_input_cam_ctr(m_camera_model.camera_center(vw::Vector2())) {
+    m_analytic = pinhole_projection(m_camera_model, m_xyz, m_proj);
+  }
 
   /// Given the camera, project xyz into it
   inline result_type operator()(domain_type const& C) const {
@@ -118,6 +195,70 @@ public:
     
     return result;
   }
+
+  /// The Jacobian of the above. It is found analytically for pinhole
+  /// cameras with no lens distortion, and numerically otherwise.
+  inline jacobian_type jacobian(domain_type const& C) const {
+
+    if (!m_analytic)
+      return vw::math::LeastSquaresModelBase<CameraSolveLMA_Ht<CAM>>::jacobian(C);
+
+    Vector3 ctr = subvector(C, 0, 3), axis_angle = subvector(C, 3, 3);
+    Matrix3x3 R = vw::math::axis_angle_to_quaternion(axis_angle).rotation_matrix();
+    Matrix3x3 dR[3];
+    rotation_derivatives(axis_angle, R, dR);
+
+    Matrix3x3 F; // the (u, v, w) frame, as rows
+    select_row(F, 0) = m_proj.u;
+    select_row(F, 1) = m_proj.v;
+    select_row(F, 2) = m_proj.w;
+    Matrix3x3 FRt = F * transpose(R);
+
+    int xyz_len = m_xyz.size();
+    int num_rows = 2 * xyz_len;
+    if (m_cam_weight > 0)
+      num_rows += 1;
+    else if (m_cam_ctr_weight > 0)
+      num_rows += 3;
+    jacobian_type J(num_rows, 6);
+
+    for (int i = 0; i < xyz_len; i++) {
+      Vector3 d = m_xyz[i] - ctr;
+      Vector3 s = FRt * d;
+
+      // The derivative of the pixel with respect to s
+      Matrix<double, 2, 3> dpix;
+      dpix(0, 0) = m_proj.fu / (s[2] * m_proj.pitch);
+      dpix(0, 2) = -m_proj.fu * s[0] / (s[2] * s[2] * m_proj.pitch);
+      dpix(1, 1) = m_proj.fv / (s[2] * m_proj.pitch);
+      dpix(1, 2) = -m_proj.fv * s[1] / (s[2] * s[2] * m_proj.pitch);
+
+      // With respect to the camera center, and then to the rotation
+      Matrix<double, 2, 3> dctr = -dpix * FRt;
+      for (int r = 0; r < 2; r++)
+        for (int c = 0; c < 3; c++)
+          J(2*i + r, c) = dctr(r, c);
+      for (int c = 0; c < 3; c++) {
+        Vector2 drot = dpix * (F * (transpose(dR[c]) * d));
+        J(2*i + 0, 3 + c) = drot[0];
+        J(2*i + 1, 3 + c) = drot[1];
+      }
+    }
+
+    if (m_cam_weight > 0) {
+      // The height above the datum changes along the geodetic normal
+      Vector3 llh = m_datum.cartesian_to_geodetic(ctr);
+      double lon = llh[0] * M_PI / 180.0, lat = llh[1] * M_PI / 180.0;
+      Vector3 normal(cos(lat) * cos(lon), cos(lat) * sin(lon), sin(lat));
+      for (int c = 0; c < 3; c++)
+        J(2*xyz_len, c) = m_cam_weight * normal[c];
+    } else if (m_cam_ctr_weight > 0) {
+      for (int it = 0; it < 3; it++)
+        J(2*xyz_len + it, it) = -m_cam_ctr_weight;
+    }
+
+    return J;
+  }
 }; // End class CameraSolveLMA_Ht
 
 /// Find the best camera that fits the current GCP
@@ -296,7 +437,8 @@ void parse_values(std::string list, std::vector<T> & values){
 struct Options : public vw::GdalWriteOptions {
   std::string image_file, camera_file, lon_lat_values_str, pixel_values_str, datum_str,
     reference_dem, frame_index, gcp_file, camera_type, sample_file, input_camera,
-    stereo_session, bundle_adjust_prefix, parsed_cam_ctr_str, parsed_cam_quat_str;
+    stereo_session, bundle_adjust_prefix, parsed_cam_ctr_str, parsed_cam_quat_str,
+    image_list;
   double focal_length, pixel_pitch, gcp_std, height_above_datum,
     cam_height, cam_weight, cam_ctr_weight;
   Vector2 optical_center;
@@ -357,7 +499,9 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     ("session-type,t",   po::value(&opt.stereo_session)->default_value(""),
      "Select the input camera model type. Normally this is auto-detected, but may need to be specified if the input camera model is in XML format. See the doc for options.")
     ("bundle-adjust-prefix", po::value(&opt.bundle_adjust_prefix),
-     "Use the camera adjustment obtained by previously running bundle_adjust when providing an input camera.");
+     "Use the camera adjustment obtained by previously running bundle_adjust when providing an input camera.")
+    ("image-list", po::value(&opt.image_list)->default_value(""),
+     "Create a camera for each image in this list, in parallel. Each line must have an image, the output camera file, and the longitudes and latitudes of the pixels in --pixel-values, or of the image corners, as for --lon-lat-values. The other options apply to all images.");
   
   general_options.add( vw::GdalWriteOptionsDescription(opt) );
 
@@ -376,6 +520,33 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
                             positional, positional_desc, usage,
                             allow_unregistered, unregistered);
 
+  if (!opt.image_list.empty()) {
+    // The images, cameras, and corners are in the list
+    if (!opt.image_file.empty() || !opt.camera_file.empty() ||
+        !opt.lon_lat_values_str.empty() || !opt.frame_index.empty() ||
+        !opt.input_camera.empty() || !opt.gcp_file.empty() ||
+        opt.parse_eci || opt.parse_ecef)
+      vw_throw(ArgumentErr() << "With --image-list, cannot set an image, an output camera, "
+               << "--lon-lat-values, --frame-index, --input-camera, --gcp-file, "
+               << "--parse-eci, or --parse-ecef.\n" << usage << general_options);
+    boost::to_lower(opt.camera_type);
+    if (opt.camera_type != "pinhole" && opt.camera_type != "opticalbar")
+      vw_throw( ArgumentErr() << "Only pinhole and opticalbar cameras are supported.\n");
+    if ((opt.camera_type == "opticalbar") && (opt.sample_file == ""))
+      vw_throw( ArgumentErr() << "opticalbar type must use a sample camera file.\n"
+                << usage << general_options );
+    if (opt.reference_dem.empty() && opt.datum_str.empty())
+      vw_throw( ArgumentErr() << "Must provide either a reference DEM or a datum.\n"
+                << usage << general_options );
+    if (opt.cam_weight > 0 && opt.cam_ctr_weight > 0)
+      vw::vw_throw(vw::ArgumentErr() << "Cannot enforce the camera center constraint and camera height constraint at the same time.\n");
+    if ( opt.sample_file == "" && (opt.focal_length <= 0 || opt.pixel_pitch <= 0))
+      vw_throw( ArgumentErr() << "Must provide positive focal length"
+                << "and pixel pitch values OR a sample file.\n");
+    parse_values<double>(opt.pixel_values_str, opt.pixel_values);
+    return;
+  }
+
   if ( opt.image_file.empty() )
     vw_throw( ArgumentErr() << "Missing the input image.\n"
               << usage << general_options );
@@ -961,6 +1132,193 @@ void extract_lon_lat_cam_ctr_from_camera(Options & opt,
   opt.pixel_values = good_pixel_values;
 }
 
+// Find the xyz coordinates of the given lon-lat points. The heights are
+// taken from cam_heights, if not empty, else from the DEM, if present and
+// valid there, else they are the height above datum.
+void lon_lat_to_xyz(std::vector<double> const& lon_lat_values,
+                    std::vector<double> const& cam_heights,
+                    double height_above_datum, bool has_dem, GeoReference const& geo,
+                    ImageViewRef<PixelMask<float>> const& interp_dem,
+                    vw::cartography::Datum const& datum,
+                    std::vector<Vector3> & llh_vec, std::vector<Vector3> & xyz_vec) {
+
+  llh_vec.clear();
+  xyz_vec.clear();
+  size_t num_lon_lat_pairs = lon_lat_values.size()/2;
+  for (size_t corner_it = 0; corner_it < num_lon_lat_pairs; corner_it++) {
+
+    // Get the height from the DEM if possible
+    Vector3 llh;
+    llh[0] = lon_lat_values[2*corner_it+0];
+    llh[1] = lon_lat_values[2*corner_it+1];
+
+    if (llh[1] < -90 || llh[1] > 90) 
+      vw_throw( ArgumentErr() << "Detected a latitude out of bounds. "
+                << "Perhaps the longitude and latitude are reversed?\n");
+
+    double height = height_above_datum; 
+    if (!cam_heights.empty()) {
+      height = cam_heights[corner_it]; // already computed
+    } else {
+      if (has_dem) {
+        bool success = false;
+        Vector2 pix = geo.lonlat_to_pixel(subvector(llh, 0, 2));
+        int len =  BilinearInterpolation::pixel_buffer;
+        if (pix[0] >= 0 && pix[0] <= interp_dem.cols() - 1 - len &&
+            pix[1] >= 0 && pix[1] <= interp_dem.rows() - 1 - len) {
+          PixelMask<float> masked_height = interp_dem(pix[0], pix[1]);
+          if (is_valid(masked_height)) {
+            height = masked_height.child();
+            success = true;
+          }
+        }
+        if (!success) 
+          vw_out() << "Could not determine a valid height value at lon-lat: "
+                   << llh[0] << ' ' << llh[1] << ". Will use a height of " << height << ".\n";
+      }
+    }
+      
+    llh[2] = height;
+    llh_vec.push_back(llh);
+    xyz_vec.push_back(datum.geodetic_to_cartesian(llh));
+  } // End loop through lon-lat pairs
+}
+
+// Form the camera for an image, fit it to the given points, and write it.
+// If no pixel values are given, use the image corners.
+void gen_camera(Options const& opt, std::string const& image_file,
+                std::string const& camera_file, std::vector<double> pixel_values,
+                std::vector<Vector3> const& xyz_vec,
+                Vector3 const& parsed_cam_ctr, Vector3 const& input_cam_ctr,
+                vw::cartography::Datum const& datum, bool verbose) {
+
+  // Form a camera based on info the user provided
+  boost::shared_ptr<CameraModel> out_cam;
+  DiskImageView<float> img(image_file);
+  int wid = img.cols(), hgt = img.rows();
+  if (wid <= 0 || hgt <= 0) 
+    vw_throw( ArgumentErr() << "Could not read an image with positive dimensions from: "
+              << image_file << ".\n");
+
+  if (pixel_values.empty())
+    pixel_values = {0.0, 0.0, (double)wid, 0.0, (double)wid, (double)hgt, 0.0, (double)hgt};
+
+  if (xyz_vec.size() < 3) 
+    vw_throw( ArgumentErr() << "Expecting at least three longitude-latitude pairs.\n");
+  if (2 * xyz_vec.size() != pixel_values.size())
+    vw_throw( ArgumentErr()
+              << "The number of lon-lat pairs must equal the number of pixel pairs.\n");
+
+  manufacture_cam(opt, wid, hgt, out_cam);
+
+  // Transform it and optionally refine it
+  fit_camera_to_xyz_ht(opt.parse_ecef, parsed_cam_ctr, input_cam_ctr,
+                       opt.camera_type, opt.refine_camera,  
+                       xyz_vec, pixel_values, 
+                       opt.cam_height, opt.cam_weight, opt.cam_ctr_weight, datum,
+                       verbose, out_cam);
+
+  if (verbose) {
+    Vector3 llh = datum.cartesian_to_geodetic(out_cam->camera_center(Vector2()));
+    vw_out() << "Output camera center lon, lat, and height above datum: " << llh << std::endl;
+    vw_out() << "Writing: " << camera_file << std::endl;
+  }
+  vw::create_out_dir(camera_file);
+  if (opt.camera_type == "opticalbar")
+    ((vw::camera::OpticalBarModel*)out_cam.get())->write(camera_file);
+  else
+    ((vw::camera::PinholeModel*)out_cam.get())->write(camera_file);
+}
+
+// An image in --image-list
+struct CamGenJob {
+  std::string image_file, camera_file;
+  std::vector<double> lon_lat_values;
+  std::string error; // set on failure
+};
+
+// Create the camera for one image in --image-list
+class CamGenTask: public vw::Task, private boost::noncopyable {
+  Options const& m_opt;
+  bool m_has_dem;
+  GeoReference const& m_geo;
+  ImageViewRef<PixelMask<float>> const& m_interp_dem;
+  vw::cartography::Datum const& m_datum;
+  CamGenJob & m_job;
+
+public:
+  CamGenTask(Options const& opt, bool has_dem, GeoReference const& geo,
+             ImageViewRef<PixelMask<float>> const& interp_dem,
+             vw::cartography::Datum const& datum, CamGenJob & job):
+    m_opt(opt), m_has_dem(has_dem), m_geo(geo), m_interp_dem(interp_dem),
+    m_datum(datum), m_job(job) {}
+
+  void operator()() {
+    try {
+      std::vector<double> cam_heights; // not known
+      std::vector<Vector3> llh_vec, xyz_vec;
+      lon_lat_to_xyz(m_job.lon_lat_values, cam_heights, m_opt.height_above_datum,
+                     m_has_dem, m_geo, m_interp_dem, m_datum, llh_vec, xyz_vec);
+      Vector3 parsed_cam_ctr(0, 0, 0), input_cam_ctr(0, 0, 0); // not known
+      bool verbose = false;
+      gen_camera(m_opt, m_job.image_file, m_job.camera_file, m_opt.pixel_values,
+                 xyz_vec, parsed_cam_ctr, input_cam_ctr, m_datum, verbose);
+    } catch (std::exception const& e) {
+      m_job.error = e.what();
+    }
+  }
+};
+
+// Create the cameras for the images in --image-list, in parallel
+void gen_cameras_from_list(Options const& opt, bool has_dem, GeoReference const& geo,
+                           ImageViewRef<PixelMask<float>> const& interp_dem,
+                           vw::cartography::Datum const& datum) {
+
+  std::vector<CamGenJob> jobs;
+  std::ifstream ifs(opt.image_list.c_str());
+  if (!ifs)
+    vw_throw(ArgumentErr() << "Could not read: " << opt.image_list << ".\n");
+  std::string line;
+  while (std::getline(ifs, line)) {
+    std::vector<std::string> vals;
+    parse_values<std::string>(line, vals);
+    if (vals.empty() || vals[0][0] == '#')
+      continue;
+
+    CamGenJob job;
+    job.image_file  = vals[0];
+    job.camera_file = vals.size() > 1 ? vals[1] : "";
+    if (get_extension(job.camera_file) != ".tsai")
+      vw_throw(ArgumentErr() << "Each line of --image-list must have an image, an output "
+               << "camera ending with .tsai, and the lon-lat values. Got: " << line << "\n");
+    for (size_t it = 2; it < vals.size(); it++)
+      job.lon_lat_values.push_back(atof(vals[it].c_str()));
+    jobs.push_back(job);
+  }
+
+  vw_out() << "Creating " << jobs.size() << " cameras.\n";
+  FifoWorkQueue queue(vw_settings().default_num_threads());
+  for (size_t it = 0; it < jobs.size(); it++) {
+    boost::shared_ptr<CamGenTask>
+      task(new CamGenTask(opt, has_dem, geo, interp_dem, datum, jobs[it]));
+    queue.add_task(task);
+  }
+  queue.join_all();
+
+  int num_failed = 0;
+  for (size_t it = 0; it < jobs.size(); it++) {
+    if (jobs[it].error.empty())
+      continue;
+    num_failed++;
+    vw_out(WarningMessage) << "Failed to create a camera for " << jobs[it].image_file
+                           << ": " << jobs[it].error << "\n";
+  }
+  if (num_failed > 0)
+    vw_throw(ArgumentErr() << "Failed to create " << num_failed << " out of "
+             << jobs.size() << " cameras.\n");
+  vw_out() << "Created " << jobs.size() << " cameras.\n";
+}
+
 int main(int argc, char * argv[]){
   
   Options opt;
@@ -996,6 +1354,11 @@ int main(int argc, char * argv[]){
       = interpolate(create_mask(dem, nodata_value),
 		    BilinearInterpolation(), ZeroEdgeExtension());
 
+    if (!opt.image_list.empty()) {
+      gen_cameras_from_list(opt, has_dem, geo, interp_dem, datum);
+      return 0;
+    }
+
     // If we have camera center in ECI or ECEF coordinates in km, convert
     // it to meters, then find the height above datum.
     Vector3 parsed_cam_ctr(0, 0, 0);
@@ -1061,65 +1424,21 @@ int main(int argc, char * argv[]){
 		<< "The number of lon-lat pairs must equal the number of pixel pairs.\n");
     }
 
-    size_t num_lon_lat_pairs = opt.lon_lat_values.size()/2;
-    
-    Vector2 pix;
-    Vector3 llh, xyz;
-    std::vector<Vector3> xyz_vec;
+    std::vector<Vector3> llh_vec, xyz_vec;
+    lon_lat_to_xyz(opt.lon_lat_values, cam_heights, opt.height_above_datum,
+                   has_dem, geo, interp_dem, datum, llh_vec, xyz_vec);
 
     // If to write a gcp file
     std::ostringstream gcp;
     gcp.precision(17);
     bool write_gcp = (opt.gcp_file != "");
-
-    // TODO(oalexan1): Make this into a function
-    for (size_t corner_it = 0; corner_it < num_lon_lat_pairs; corner_it++) {
-
-      // Get the height from the DEM if possible
-      llh[0] = opt.lon_lat_values[2*corner_it+0];
-      llh[1] = opt.lon_lat_values[2*corner_it+1];
-
-      if (llh[1] < -90 || llh[1] > 90) 
-        vw_throw( ArgumentErr() << "Detected a latitude out of bounds. "
-                  << "Perhaps the longitude and latitude are reversed?\n");
-
-      double height = opt.height_above_datum; 
-      if (opt.input_camera != ""){
-        height = cam_heights[corner_it]; // already computed
-      } else {
-        if (has_dem) {
-          bool success = false;
-          pix = geo.lonlat_to_pixel(subvector(llh, 0, 2));
-          int len =  BilinearInterpolation::pixel_buffer;
-          if (pix[0] >= 0 && pix[0] <= interp_dem.cols() - 1 - len &&
-              pix[1] >= 0 && pix[1] <= interp_dem.rows() - 1 - len) {
-            PixelMask<float> masked_height = interp_dem(pix[0], pix[1]);
-            if (is_valid(masked_height)) {
-              height = masked_height.child();
-              success = true;
-            }
-          }
-          if (!success) 
-            vw_out() << "Could not determine a valid height value at lon-lat: "
-                     << llh[0] << ' ' << llh[1] << ". Will use a height of " << height << ".\n";
-        }
-      }
-      
-      llh[2] = height;
-      //vw_out() << "Lon-lat-height for corner ("
-      //         << opt.pixel_values[2*corner_it] << ", " << opt.pixel_values[2*corner_it+1]
-      //         << ") is "
-      //         << llh[0] << ", " << llh[1] << ", " << llh[2] << std::endl;
-
-      xyz = datum.geodetic_to_cartesian(llh);
-      xyz_vec.push_back(xyz);
-
-      if (write_gcp)
-        gcp << corner_it << ' ' << llh[1] << ' ' << llh[0] << ' ' << llh[2] << ' '
-            << 1 << ' ' << 1 << ' ' << 1 << ' ' << opt.image_file << ' '
-            << opt.pixel_values[2*corner_it] << ' ' << opt.pixel_values[2*corner_it+1] << ' '
-            << opt.gcp_std << ' ' << opt.gcp_std << std::endl;
-    } // End loop through lon-lat pairs
+    for (size_t corner_it = 0; corner_it < llh_vec.size() && write_gcp; corner_it++) {
+      Vector3 const& llh = llh_vec[corner_it];
+      gcp << corner_it << ' ' << llh[1] << ' ' << llh[0] << ' ' << llh[2] << ' '
+          << 1 << ' ' << 1 << ' ' << 1 << ' ' << opt.image_file << ' '
+          << opt.pixel_values[2*corner_it] << ' ' << opt.pixel_values[2*corner_it+1] << ' '
+          << opt.gcp_std << ' ' << opt.gcp_std << std::endl;
+    }
 
     if (write_gcp) {
       vw_out() << "Writing: " << opt.gcp_file << std::endl;
@@ -1128,36 +1447,13 @@ int main(int argc, char * argv[]){
       fs.close();
     }
     
-    // Form a camera based on info the user provided
-    boost::shared_ptr<CameraModel> out_cam;
-    DiskImageView<float> img(opt.image_file);
-    int wid = img.cols(), hgt = img.rows();
-    if (wid <= 0 || hgt <= 0) 
-      vw_throw( ArgumentErr() << "Could not read an image with positive dimensions from: "
-		<< opt.image_file << ".\n");
-    manufacture_cam(opt, wid, hgt, out_cam);
-
-    // Transform it and optionally refine it
-    bool verbose = true;
-    fit_camera_to_xyz_ht(opt.parse_ecef, parsed_cam_ctr, input_cam_ctr,
-			 opt.camera_type, opt.refine_camera,  
-			 xyz_vec, opt.pixel_values, 
-			 opt.cam_height, opt.cam_weight, opt.cam_ctr_weight, datum,
-			 verbose, out_cam);
-    
     if ((opt.parse_eci || opt.parse_ecef) && opt.camera_type == "opticalbar") {
       vw_throw( ArgumentErr() << "Cannot parse ECI/ECEF data for an optical bar camera.\n");
     }
 
-    llh = datum.cartesian_to_geodetic(out_cam->camera_center(Vector2()));
-    vw_out() << "Output camera center lon, lat, and height above datum: " << llh << std::endl;
-    vw_out() << "Writing: " << opt.camera_file << std::endl;
-    if (opt.camera_type == "opticalbar")
-      ((vw::camera::OpticalBarModel*)out_cam.get())->write(opt.camera_file);
-    else {
-      ((vw::camera::PinholeModel*)out_cam.get())->write(opt.camera_file);
-    }
-
+    bool verbose = true;
+    gen_camera(opt, opt.image_file, opt.camera_file, opt.pixel_values, xyz_vec,
+               parsed_cam_ctr, input_cam_ctr, datum, verbose);
 
   } ASP_STANDARD_CATCHES;
     
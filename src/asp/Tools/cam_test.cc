@@ -25,6 +25,9 @@
 // using the cam1 camera and back-projecting the resulting points into
 // the cam2 camera, then doing this in reverse.
 
+// With lists of images and cameras, do this for each entry, with the
+// entries processed in parallel, and save a table of statistics.
+
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/StereoSettings.h>
@@ -34,6 +37,14 @@
 #include <vw/Core/Stopwatch.h>
 #include <asp/Camera/CsmModel.h>
 #include <asp/IsisIO/IsisCameraModel.h>
+#include <vw/Core/Thread.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Core/Settings.h>
+
+#include <boost/algorithm/string.hpp>
+
+#include <fstream>
+#include <iomanip>
 
 using namespace vw;
 using namespace vw::cartography;
@@ -42,8 +53,13 @@ namespace fs = boost::filesystem;
 
 typedef boost::scoped_ptr<asp::StereoSession> SessionPtr;
 
+// Sessions are created one at a time, as that may touch the global
+// settings. The cameras are then loaded in parallel.
+vw::Mutex g_session_mutex;
+
 struct Options : vw::GdalWriteOptions {
-  std::string image_file, cam1_file, cam2_file, session1, session2;
+  std::string image_file, cam1_file, cam2_file, session1, session2,
+    image_list, cam1_list, cam2_list, output_table;
   int sample_rate; // use one out of these many pixels
   double subpixel_offset, height_above_datum;
   bool enable_correct_velocity_aberration, enable_correct_atmospheric_refraction,
@@ -84,6 +100,16 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Use the CSM model with DigitalGlobe linescan cameras (-t dg). No corrections are done for velocity aberration or atmospheric refraction.")
     ("dg-vs-csm", po::bool_switch(&opt.dg_vs_csm)->default_value(false)->implicit_value(true),
      "Compare projecting into the camera without and with using the CSM model for Digital Globe.")
+    ("image-list", po::value(&opt.image_list)->default_value(""),
+     "Compare the cameras for each of the images in this file, one per line, "
+     "instead of for a single image. The images are processed in parallel.")
+    ("cam1-list", po::value(&opt.cam1_list)->default_value(""),
+     "The first cameras for the images in --image-list, one per line, in the same order.")
+    ("cam2-list", po::value(&opt.cam2_list)->default_value(""),
+     "The second cameras for the images in --image-list, one per line, in the same order.")
+    ("output-table", po::value(&opt.output_table)->default_value(""),
+     "With --image-list, save here a table with the number of samples and the median "
+     "and maximum of each difference, for each image.")
     ;  
   general_options.add(vw::GdalWriteOptionsDescription(opt));
   
@@ -100,8 +126,24 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
                             positional, positional_desc, usage,
                             allow_unregistered, unregistered);
 
-  if (opt.image_file == "" || opt.cam1_file == "" || opt.cam2_file == "")
+  bool use_lists = (opt.image_list != "" || opt.cam1_list != "" || opt.cam2_list != "");
+  if (use_lists) {
+    if (opt.image_list == "" || opt.cam1_list == "" || opt.cam2_list == "")
+      vw_throw(ArgumentErr() << "The options --image-list, --cam1-list, and --cam2-list "
+               << "must be used together.\n" << usage << general_options);
+    if (opt.image_file != "" || opt.cam1_file != "" || opt.cam2_file != "")
+      vw_throw(ArgumentErr() << "Cannot use --image, --cam1, or --cam2 with "
+               << "--image-list.\n" << usage << general_options);
+    if (opt.output_table == "")
+      vw_throw(ArgumentErr() << "The option --image-list needs --output-table.\n"
+               << usage << general_options);
+    // These change global settings, or print from each thread
+    if (opt.dg_vs_csm || opt.print_per_pixel_results)
+      vw_throw(ArgumentErr() << "The options --dg-vs-csm and --print-per-pixel-results "
+               << "cannot be used with --image-list.\n" << usage << general_options);
+  } else if (opt.image_file == "" || opt.cam1_file == "" || opt.cam2_file == "") {
     vw_throw(ArgumentErr() << "Not all inputs were specified.\n" << usage << general_options);
+  }
 
   if (opt.sample_rate <= 0)
     vw_throw(ArgumentErr() << "The sample rate must be positive.\n" << usage << general_options);
@@ -130,158 +172,312 @@ void print_diffs(std::string const& tag, std::vector<double> & diffs) {
   vw_out() << "Max:    " << diffs.back() << "\n";
 }
 
+// Load the two cameras for an image, and find the datum and the image size
+void load_cameras(Options const& opt, std::string const& image_file,
+                  std::string const& cam1_file, std::string const& cam2_file,
+                  boost::shared_ptr<vw::camera::CameraModel> & cam1_model,
+                  boost::shared_ptr<vw::camera::CameraModel> & cam2_model,
+                  vw::cartography::Datum & datum,
+                  std::string & session1, std::string & session2,
+                  int & image_cols, int & image_rows) {
+
+  Options local_opt = opt; // the factory may change things in it
+
+  // Load cam1
+  std::string out_prefix;
+  session1 = opt.session1;
+  SessionPtr cam1_session, cam2_session;
+  {
+    vw::Mutex::Lock lock(g_session_mutex);
+    cam1_session.reset(asp::StereoSessionFactory::create
+                       (session1, // may change
+                        local_opt,
+                        image_file, image_file,
+                        cam1_file, cam1_file,
+                        out_prefix));
+  }
+  cam1_model = cam1_session->camera_model(image_file, cam1_file);
+
+  // Auto-guess the datum
+  bool use_sphere_for_non_earth = true;
+  datum = cam1_session->get_datum(cam1_model.get(), use_sphere_for_non_earth);
+  
+  // Load cam2
+  session2 = opt.session2;
+  {
+    vw::Mutex::Lock lock(g_session_mutex);
+    cam2_session.reset(asp::StereoSessionFactory::create
+                       (session2, // may change
+                        local_opt,
+                        image_file, image_file,
+                        cam2_file, cam2_file,
+                        out_prefix));
+  }
+  cam2_model = cam2_session->camera_model(image_file, cam2_file);
+
+  if (session1 == session2 && (opt.session1 == "" || opt.session2 == "")) 
+    vw_throw(ArgumentErr() << "The session names for both cameras "
+             << "were guessed as: '" << session1 << "'. It is suggested that they be "
+             << "explicitly specified using --session1 and --session2.\n");
+  
+  // Find the input image dimensions
+  image_cols = 0;
+  image_rows = 0;
+  try {
+    DiskImageView<float> image(image_file);
+    image_cols = image.cols();
+    image_rows = image.rows();
+  } catch(const std::exception& e) {
+    // For CSM-to-CSM ground-to-image and image-to-ground comparisons only,
+    // the camera has the dimensions if the .cub image is missing.
+    asp::CsmModel * csm_model
+      = dynamic_cast<asp::CsmModel*>(vw::camera::unadjusted_model(cam1_model.get()));
+    if (csm_model != NULL) {
+      image_cols = csm_model->get_image_size()[0];
+      image_rows = csm_model->get_image_size()[1];
+    } else {
+      vw::vw_throw(ArgumentErr() << e.what());
+    }
+  }
+}
+
+// The differences between the two cameras at the sampled pixels
+struct CameraDiffs {
+  std::vector<double> ctr_diff, dir_diff, cam1_to_cam2_diff, cam2_to_cam1_diff, dg_vs_csm_diff;
+};
+
+// Iterate over the image and compare the cameras
+void compare_cameras(Options const& opt,
+                     vw::camera::CameraModel const* cam1_model,
+                     vw::camera::CameraModel const* cam2_model,
+                     vw::cartography::Datum const& datum,
+                     int image_cols, int image_rows,
+                     CameraDiffs & d) {
+
+  bool single_pix = !std::isnan(opt.single_pixel[0]) && !std::isnan(opt.single_pixel[1]);
+
+  double major_axis = datum.semi_major_axis() + opt.height_above_datum;
+  double minor_axis = datum.semi_minor_axis() + opt.height_above_datum;
+  for (int col = 0; col < image_cols; col += opt.sample_rate) {
+    for (int row = 0; row < image_rows; row += opt.sample_rate) {
+
+      Vector2 image_pix(col + opt.subpixel_offset, row + opt.subpixel_offset);
+
+      if (single_pix) 
+        image_pix = opt.single_pixel;
+
+      if (opt.print_per_pixel_results || single_pix)
+        vw_out() << "Pixel: " << image_pix << "\n";
+
+      Vector3 cam1_ctr = cam1_model->camera_center(image_pix);
+      Vector3 cam2_ctr = cam2_model->camera_center(image_pix);
+      d.ctr_diff.push_back(norm_2(cam1_ctr - cam2_ctr));
+
+      if (opt.print_per_pixel_results)
+        vw_out() << "Camera center diff: " << d.ctr_diff.back() << std::endl;
+      
+      Vector3 cam1_dir = cam1_model->pixel_to_vector(image_pix);
+      Vector3 cam2_dir = cam2_model->pixel_to_vector(image_pix);
+      d.dir_diff.push_back(norm_2(cam1_dir - cam2_dir));
+      
+      if (opt.print_per_pixel_results)
+        vw_out() << "Camera direction diff: " << d.dir_diff.back() << std::endl;
+      
+      // Shoot a ray from the cam1 camera, intersect it with the
+      // given height above datum, and project it back into the cam2
+      // camera.
+      Vector3 xyz = vw::cartography::datum_intersection(major_axis, minor_axis,
+                                                        cam1_ctr, cam1_dir);
+
+      Vector2 cam2_pix = cam2_model->point_to_pixel(xyz);
+      d.cam1_to_cam2_diff.push_back(norm_2(image_pix - cam2_pix));
+      
+      if (opt.print_per_pixel_results)
+        vw_out() << "cam1 to cam2 pixel diff: " << image_pix - cam2_pix << std::endl;
+
+      if (opt.dg_vs_csm) {
+        asp::stereo_settings().dg_use_csm = !asp::stereo_settings().dg_use_csm; 
+        Vector2 cam2_pix2 = cam2_model->point_to_pixel(xyz);
+        asp::stereo_settings().dg_use_csm = !asp::stereo_settings().dg_use_csm;
+        d.dg_vs_csm_diff.push_back(norm_2(cam2_pix - cam2_pix2));
+      }
+              
+      // Shoot a ray from the cam2 camera, intersect it with the
+      // given height above the datum, and project it back into the
+      // cam1 camera.
+      xyz = vw::cartography::datum_intersection(major_axis, minor_axis,
+                                                cam2_ctr, cam2_dir);
+      Vector2 cam1_pix = cam1_model->point_to_pixel(xyz);
+      d.cam2_to_cam1_diff.push_back(norm_2(image_pix - cam1_pix));
+      
+      if (opt.print_per_pixel_results)
+        vw_out() << "cam2 to cam1 pixel diff: " << image_pix - cam1_pix << "\n\n";
+
+      if (opt.dg_vs_csm) {
+        asp::stereo_settings().dg_use_csm = !asp::stereo_settings().dg_use_csm; 
+        Vector2 cam1_pix2 = cam1_model->point_to_pixel(xyz);
+        asp::stereo_settings().dg_use_csm = !asp::stereo_settings().dg_use_csm;
+        d.dg_vs_csm_diff.push_back(norm_2(cam1_pix - cam1_pix2));
+      }
+
+      if (single_pix) 
+        break;
+    }
+    
+    if (single_pix) 
+      break;
+  }
+}
+
+// The median and maximum of some diffs, for the table. Sorts them.
+void median_and_max(std::vector<double> & diffs, double & median, double & max) {
+  median = std::numeric_limits<double>::quiet_NaN();
+  max    = median;
+  if (diffs.empty())
+    return;
+  std::sort(diffs.begin(), diffs.end());
+  median = diffs[diffs.size()/2];
+  max    = diffs.back();
+}
+
+// Compare the cameras for one entry of the lists
+class CompareTask: public vw::Task, private boost::noncopyable {
+  Options const& m_opt;
+  std::string m_image_file, m_cam1_file, m_cam2_file;
+  CameraDiffs & m_diffs;
+  std::string & m_error;
+public:
+  CompareTask(Options const& opt, std::string const& image_file,
+              std::string const& cam1_file, std::string const& cam2_file,
+              CameraDiffs & diffs, std::string & error):
+    m_opt(opt), m_image_file(image_file), m_cam1_file(cam1_file),
+    m_cam2_file(cam2_file), m_diffs(diffs), m_error(error) {}
+
+  void operator()() {
+    try {
+      boost::shared_ptr<vw::camera::CameraModel> cam1_model, cam2_model;
+      vw::cartography::Datum datum;
+      std::string session1, session2;
+      int image_cols = 0, image_rows = 0;
+      load_cameras(m_opt, m_image_file, m_cam1_file, m_cam2_file,
+                   cam1_model, cam2_model, datum, session1, session2,
+                   image_cols, image_rows);
+      compare_cameras(m_opt, cam1_model.get(), cam2_model.get(), datum,
+                      image_cols, image_rows, m_diffs);
+    } catch (std::exception const& e) {
+      m_error = e.what();
+    }
+  }
+};
+
+// Compare the cameras for each image in the lists, and save a table
+// with the statistics. An entry which fails does not stop the others.
+void process_lists(Options const& opt) {
+
+  std::vector<std::string> images, cam1_files, cam2_files;
+  asp::read_list(opt.image_list, images);
+  asp::read_list(opt.cam1_list, cam1_files);
+  asp::read_list(opt.cam2_list, cam2_files);
+  if (images.size() != cam1_files.size() || images.size() != cam2_files.size())
+    vw_throw(ArgumentErr() << "The number of images and cameras in the lists differ.\n");
+
+  // ISIS cameras cannot be used from multiple threads
+  bool have_isis = (opt.session1 == "isis" || opt.session2 == "isis");
+  for (size_t it = 0; it < images.size(); it++) {
+    if (boost::iends_with(images[it], ".cub"))
+      have_isis = true;
+  }
+
+  size_t num = images.size();
+  std::vector<CameraDiffs> diffs(num);
+  std::vector<std::string> errors(num);
+  {
+    FifoWorkQueue queue(have_isis ? 1 : vw_settings().default_num_threads());
+    for (size_t it = 0; it < num; it++) {
+      boost::shared_ptr<CompareTask>
+        task(new CompareTask(opt, images[it], cam1_files[it], cam2_files[it],
+                             diffs[it], errors[it]));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+
+  vw::create_out_dir(opt.output_table);
+  std::ofstream ofs(opt.output_table.c_str());
+  if (!ofs.good())
+    vw_throw(IOErr() << "Cannot write: " << opt.output_table << "\n");
+  ofs << "# image cam1 cam2 num_samples dir_diff_median dir_diff_max "
+      << "ctr_diff_median ctr_diff_max cam1_to_cam2_median cam1_to_cam2_max "
+      << "cam2_to_cam1_median cam2_to_cam1_max\n";
+  ofs << std::setprecision(17);
+
+  int num_failed = 0;
+  for (size_t it = 0; it < num; it++) {
+    if (!errors[it].empty()) {
+      vw_out(WarningMessage) << "Failed to compare the cameras for " << images[it]
+                             << ": " << errors[it] << "\n";
+      num_failed++;
+      continue;
+    }
+    CameraDiffs & d = diffs[it];
+    std::vector<double> * all[4] = {&d.dir_diff, &d.ctr_diff,
+                                    &d.cam1_to_cam2_diff, &d.cam2_to_cam1_diff};
+    ofs << images[it] << ' ' << cam1_files[it] << ' ' << cam2_files[it]
+        << ' ' << d.ctr_diff.size();
+    for (int k = 0; k < 4; k++) {
+      double median = 0, max = 0;
+      median_and_max(*all[k], median, max);
+      ofs << ' ' << median << ' ' << max;
+    }
+    ofs << "\n";
+  }
+  ofs.close();
+
+  if (num_failed > 0)
+    vw_out() << "Failed for " << num_failed << " / " << num << " images.\n";
+  vw_out() << "Wrote: " << opt.output_table << "\n";
+}
+
 int main(int argc, char *argv[]) {
 
   Options opt;
   try {
     handle_arguments(argc, argv, opt);
 
-    // Load cam1
-    std::string out_prefix;
-    std::string default_session1 = opt.session1; // save it before it changes
-    SessionPtr cam1_session(asp::StereoSessionFactory::create
-                               (opt.session1, // may change
-                                opt,
-                                opt.image_file, opt.image_file,
-                                opt.cam1_file, opt.cam1_file,
-                                out_prefix));
-    boost::shared_ptr<vw::camera::CameraModel> cam1_model
-      = cam1_session->camera_model(opt.image_file, opt.cam1_file);
-
-    // Auto-guess the datum
-    bool use_sphere_for_non_earth = true;
-    vw::cartography::Datum datum = cam1_session->get_datum(cam1_model.get(),
-                                                           use_sphere_for_non_earth);
-    vw_out() << "Datum: " << datum << std::endl;
-    
-    // Load cam2
-    std::string default_session2 = opt.session2; // save it before it changes
-    SessionPtr cam2_session(asp::StereoSessionFactory::create
-                           (opt.session2, // may change
-                            opt,
-                            opt.image_file, opt.image_file,
-                            opt.cam2_file, opt.cam2_file,
-                            out_prefix));
-    boost::shared_ptr<vw::camera::CameraModel> cam2_model
-      = cam2_session->camera_model(opt.image_file, opt.cam2_file);
-
-    if (opt.session1 == opt.session2 && (default_session1 == "" || default_session2 == "")) 
-      vw_throw(ArgumentErr() << "The session names for both cameras "
-               << "were guessed as: '" << opt.session1 << "'. It is suggested that they be "
-               << "explicitly specified using --session1 and --session2.\n");
-    
-    // Find the input image dimensions
-    int image_cols = 0, image_rows = 0;
-    try {
-      DiskImageView<float> image(opt.image_file);
-      image_cols = image.cols();
-      image_rows = image.rows();
-    } catch(const std::exception& e) {
-      // For CSM-to-CSM ground-to-image and image-to-ground comparisons only,
-      // the camera has the dimensions if the .cub image is missing.
-      asp::CsmModel * csm_model
-        = dynamic_cast<asp::CsmModel*>(vw::camera::unadjusted_model(cam1_model.get()));
-      if (csm_model != NULL) {
-        image_cols = csm_model->get_image_size()[0];
-        image_rows = csm_model->get_image_size()[1];
-      } else {
-        vw::vw_throw(ArgumentErr() << e.what());
-      }
+    if (opt.image_list != "") {
+      process_lists(opt);
+      return 0;
     }
 
+    boost::shared_ptr<vw::camera::CameraModel> cam1_model, cam2_model;
+    vw::cartography::Datum datum;
+    std::string session1, session2;
+    int image_cols = 0, image_rows = 0;
+    load_cameras(opt, opt.image_file, opt.cam1_file, opt.cam2_file,
+                 cam1_model, cam2_model, datum, session1, session2,
+                 image_cols, image_rows);
+    vw_out() << "Datum: " << datum << std::endl;
     vw_out() << "Image dimensions: " << image_cols << ' ' << image_rows << std::endl;
     
-    bool single_pix = !std::isnan(opt.single_pixel[0]) && !std::isnan(opt.single_pixel[1]);
-
     Stopwatch sw;
     sw.start();
     
-    double major_axis = datum.semi_major_axis() + opt.height_above_datum;
-    double minor_axis = datum.semi_minor_axis() + opt.height_above_datum;
-    // Iterate over the image
-    std::vector<double> ctr_diff, dir_diff, cam1_to_cam2_diff, cam2_to_cam1_diff, dg_vs_csm_diff;
-    for (int col = 0; col < image_cols; col += opt.sample_rate) {
-      for (int row = 0; row < image_rows; row += opt.sample_rate) {
-
-        Vector2 image_pix(col + opt.subpixel_offset, row + opt.subpixel_offset);
-
-        if (single_pix) 
-          image_pix = opt.single_pixel;
-
-        if (opt.print_per_pixel_results || single_pix)
-          vw_out() << "Pixel: " << image_pix << "\n";
-
-        Vector3 cam1_ctr = cam1_model->camera_center(image_pix);
-        Vector3 cam2_ctr = cam2_model->camera_center(image_pix);
-        ctr_diff.push_back(norm_2(cam1_ctr - cam2_ctr));
-
-        if (opt.print_per_pixel_results)
-          vw_out() << "Camera center diff: " << ctr_diff.back() << std::endl;
-        
-        Vector3 cam1_dir = cam1_model->pixel_to_vector(image_pix);
-        Vector3 cam2_dir = cam2_model->pixel_to_vector(image_pix);
-        dir_diff.push_back(norm_2(cam1_dir - cam2_dir));
-        
-        if (opt.print_per_pixel_results)
-          vw_out() << "Camera direction diff: " << dir_diff.back() << std::endl;
-        
-        // Shoot a ray from the cam1 camera, intersect it with the
-        // given height above datum, and project it back into the cam2
-        // camera.
-        Vector3 xyz = vw::cartography::datum_intersection(major_axis, minor_axis,
-                                                          cam1_ctr, cam1_dir);
-
-        Vector2 cam2_pix = cam2_model->point_to_pixel(xyz);
-        cam1_to_cam2_diff.push_back(norm_2(image_pix - cam2_pix));
-        
-        if (opt.print_per_pixel_results)
-          vw_out() << "cam1 to cam2 pixel diff: " << image_pix - cam2_pix << std::endl;
-
-        if (opt.dg_vs_csm) {
-          asp::stereo_settings().dg_use_csm = !asp::stereo_settings().dg_use_csm; 
-          Vector2 cam2_pix2 = cam2_model->point_to_pixel(xyz);
-          asp::stereo_settings().dg_use_csm = !asp::stereo_settings().dg_use_csm;
-          dg_vs_csm_diff.push_back(norm_2(cam2_pix - cam2_pix2));
-        }
-                
-        // Shoot a ray from the cam2 camera, intersect it with the
-        // given height above the datum, and project it back into the
-        // cam1 camera.
-        xyz = vw::cartography::datum_intersection(major_axis, minor_axis,
-                                                  cam2_ctr, cam2_dir);
-        Vector2 cam1_pix = cam1_model->point_to_pixel(xyz);
-        cam2_to_cam1_diff.push_back(norm_2(image_pix - cam1_pix));
-        
-        if (opt.print_per_pixel_results)
-          vw_out() << "cam2 to cam1 pixel diff: " << image_pix - cam1_pix << "\n\n";
-
-        if (opt.dg_vs_csm) {
-          asp::stereo_settings().dg_use_csm = !asp::stereo_settings().dg_use_csm; 
-          Vector2 cam1_pix2 = cam1_model->point_to_pixel(xyz);
-          asp::stereo_settings().dg_use_csm = !asp::stereo_settings().dg_use_csm;
-          dg_vs_csm_diff.push_back(norm_2(cam1_pix - cam1_pix2));
-        }
-
-        if (single_pix) 
-          break;
-      }
-      
-      if (single_pix) 
-        break;
-    }
+    CameraDiffs d;
+    compare_cameras(opt, cam1_model.get(), cam2_model.get(), datum,
+                    image_cols, image_rows, d);
 
     sw.stop();
-    vw_out() << "Number of samples used: " << ctr_diff.size() << "\n";
+    vw_out() << "Number of samples used: " << d.ctr_diff.size() << "\n";
     
-    print_diffs("cam1 to cam2 camera direction diff norm", dir_diff);
-    print_diffs("cam1 to cam2 camera center diff (meters)", ctr_diff);
-    print_diffs("cam1 to cam2 pixel diff", cam1_to_cam2_diff);
-    print_diffs("cam2 to cam1 pixel diff", cam2_to_cam1_diff);
+    print_diffs("cam1 to cam2 camera direction diff norm", d.dir_diff);
+    print_diffs("cam1 to cam2 camera center diff (meters)", d.ctr_diff);
+    print_diffs("cam1 to cam2 pixel diff", d.cam1_to_cam2_diff);
+    print_diffs("cam2 to cam1 pixel diff", d.cam2_to_cam1_diff);
     if (opt.dg_vs_csm)
-    print_diffs("dg vs csm pixel diff", dg_vs_csm_diff);
+    print_diffs("dg vs csm pixel diff", d.dg_vs_csm_diff);
 
     double elapsed_sec = sw.elapsed_seconds();
-    vw_out() << "\nElapsed time per sample: " << 1e+6 * elapsed_sec/ctr_diff.size()
+    vw_out() << "\nElapsed time per sample: " << 1e+6 * elapsed_sec/d.ctr_diff.size()
              << " milliseconds.\n";
 
     if (elapsed_sec < 5)
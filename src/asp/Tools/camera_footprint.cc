@@ -17,7 +17,8 @@
 
 
 /// Compute the footprint of a camera on a DEM/datum, print it, and optionally
-///  write a KML file.
+///  write a KML file. Can also do that for a list of cameras, with the
+///  DEM loaded once and the cameras processed in parallel.
 
 #include <asp/Sessions/StereoSessionFactory.h>
 #include <vw/FileIO/DiskImageView.h>
@@ -27,6 +28,8 @@
 #include <vw/Cartography/GeoReference.h>
 #include <vw/Cartography/CameraBBox.h>
 #include <vw/FileIO/KML.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Core/Settings.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/FileUtils.h>
@@ -49,7 +52,8 @@ using namespace vw::cartography;
 
 struct Options : public vw::GdalWriteOptions {
   string image_file, camera_file, stereo_session, bundle_adjust_prefix,
-         datum_str, dem_file, target_srs_string, output_kml;
+         datum_str, dem_file, target_srs_string, output_kml,
+         image_list, camera_list;
   bool quick;
   //BBox2i image_crop_box;
 };
@@ -72,7 +76,13 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     //("image-crop-box", po::value(&opt.image_crop_box)->default_value(BBox2i(0,0,0,0), "0 0 0 0"),
     // "The output image and RPC model should not exceed this box, specified in input image pixels as minx miny widx widy.")
     ("dem-file",   po::value(&opt.dem_file)->default_value(""),
-     "Instead of using a longitude-latitude-height box, sample the surface of this DEM.");
+     "Instead of using a longitude-latitude-height box, sample the surface of this DEM.")
+    ("image-list", po::value(&opt.image_list)->default_value(""),
+     "Find the footprints of many cameras. This file has the images, one per line. "
+     "The DEM is loaded once and the cameras are processed in parallel. The footprints "
+     "are printed, and all are saved to the file given by --output-kml, if set.")
+    ("camera-list", po::value(&opt.camera_list)->default_value(""),
+     "The cameras for the images in --image-list, one per line, in the same order.");
 
   general_options.add( vw::GdalWriteOptionsDescription(opt) );
 
@@ -94,11 +104,16 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
 			    allow_unregistered, unregistered);
 
   
-  if ( opt.image_file.empty() )
+  if (!opt.image_list.empty() || !opt.camera_list.empty()) {
+    if (opt.image_list.empty() || opt.camera_list.empty())
+      vw_throw(ArgumentErr() << "The options --image-list and --camera-list "
+               << "must be used together.\n" << usage << general_options);
+    if (!opt.image_file.empty() || !opt.camera_file.empty())
+      vw_throw(ArgumentErr() << "Cannot specify both an image and camera and "
+               << "--image-list.\n" << usage << general_options);
+  } else if ( opt.image_file.empty() ) {
     vw_throw( ArgumentErr() << "Missing input image.\n" << usage << general_options );
-
-  if (boost::iends_with(opt.image_file, ".cub") && opt.stereo_session == "" )
-    opt.stereo_session = "isis";
+  }
 
   // Need this to be able to load adjusted camera models. That will happen
   // in the stereo session.
@@ -117,6 +132,226 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
   //}
 }
 
+// Load a camera model, with the session guessed from the files
+// unless set.
+boost::shared_ptr<CameraModel> load_camera(Options const& opt,
+                                           std::string const& image_file,
+                                           std::string const& camera_file,
+                                           std::string & session_name) {
+  session_name = opt.stereo_session;
+  if (boost::iends_with(image_file, ".cub") && session_name == "")
+    session_name = "isis";
+
+  Options local_opt = opt; // the factory may change things in it
+  typedef boost::scoped_ptr<asp::StereoSession> SessionPtr;
+  SessionPtr session(asp::StereoSessionFactory::create
+                     (session_name, // may change inside
+                      local_opt,
+                      image_file,  image_file,
+                      camera_file, camera_file,
+                      "",
+                      "",
+                      false) ); // Do not allow promotion from normal to map projected session
+
+  if (camera_file.empty())
+    vw_throw( ArgumentErr() << "Missing input camera.\n" );
+
+  return session->camera_model(image_file, camera_file);
+}
+
+// The georeference of the footprints, from the DEM, if present, or
+// else from the datum or projection given by the user.
+void find_target_georef(Options const& opt,
+                        ImageViewRef< PixelMask<double> > & dem,
+                        GeoReference & target_georef) {
+
+  if (opt.dem_file.empty()) { // No DEM available, intersect with the datum.
+
+    // Initialize the georef/datum
+    bool have_user_datum = (opt.datum_str != "");
+    cartography::Datum datum(opt.datum_str);
+    target_georef = GeoReference(datum);
+    bool have_input_georef = false;
+    asp::set_srs_string(opt.target_srs_string, have_user_datum, datum,
+                        have_input_georef, target_georef);
+    
+  } else { // DEM provided, intersect with it.
+
+    // Load the DEM
+    float dem_nodata_val = -std::numeric_limits<float>::max(); 
+    vw::read_nodata_val(opt.dem_file, dem_nodata_val);
+    dem = create_mask
+      (channel_cast<double>(DiskImageView<float>(opt.dem_file)), dem_nodata_val);
+      
+    if (!read_georeference(target_georef, opt.dem_file)) // return box in this projection
+      vw_throw( ArgumentErr() << "Missing georef.\n");
+  }
+
+  vw_out() << "Using georef: " << target_georef << std::endl;
+}
+
+// Compute the footprint of a camera. The corners are returned as
+// longitude, latitude, and height.
+void compute_footprint(Options const& opt,
+                       boost::shared_ptr<CameraModel> cam,
+                       vw::Vector2i const& image_size,
+                       ImageViewRef< PixelMask<double> > const& dem,
+                       GeoReference const& target_georef,
+                       BBox2 & footprint_bbox, float & mean_gsd,
+                       std::vector<Vector3> & coords) {
+  mean_gsd = 0;
+  coords.clear();
+  if (opt.dem_file.empty()) { // No DEM available, intersect with the datum.
+    std::vector<Vector2> coords2;
+    footprint_bbox = camera_bbox(target_georef, cam, image_size[0], image_size[1],
+                                 mean_gsd, &coords2);
+    for (size_t i=0; i<coords2.size(); ++i) {
+      Vector3 proj_coord(coords2[i][0], coords2[i][1], 0.0);
+      coords.push_back(target_georef.point_to_geodetic(proj_coord));
+    }
+  } else { // DEM provided, intersect with it.
+    footprint_bbox = camera_bbox(dem, target_georef, target_georef, cam,
+                                 image_size[0], image_size[1], mean_gsd, opt.quick, &coords);
+    for (size_t i=0; i<coords.size(); ++i)
+      coords[i] = target_georef.datum().cartesian_to_geodetic(coords[i]);
+  }
+}
+
+// Save footprints to a KML file, as lines with the given names
+void write_footprint_kml(std::string const& output_kml,
+                         std::vector<std::string> const& names,
+                         std::vector<std::vector<Vector3>> const& coords) {
+
+  KMLFile kml(output_kml, "footprint");
+
+  // Style listing
+
+  // Placemark Style
+  const bool HIDE_LABELS = true;
+  kml.append_style( "dot", "", 1.2,
+                    "http://maps.google.com/mapfiles/kml/shapes/placemark_circle.png", 
+                    HIDE_LABELS);
+  kml.append_style( "dot_highlight", "", 1.4,
+                    "http://maps.google.com/mapfiles/kml/shapes/placemark_circle_highlight.png");
+  kml.append_stylemap( "placemark", "dot",
+                       "dot_highlight" ); 
+
+  for (size_t it = 0; it < coords.size(); it++) {
+    if (!coords[it].empty())
+      kml.append_line(coords[it], names[it], "placemark");
+  }
+  vw_out() << "Writing: " << output_kml << std::endl; 
+  kml.close_kml();
+}
+
+// Compute the footprint of one camera of a list
+class FootprintTask: public vw::Task, private boost::noncopyable {
+  Options const& m_opt;
+  boost::shared_ptr<CameraModel> m_cam;
+  vw::Vector2i m_image_size;
+  ImageViewRef< PixelMask<double> > const& m_dem;
+  GeoReference const& m_target_georef;
+  BBox2 & m_footprint_bbox;
+  float & m_mean_gsd;
+  std::vector<Vector3> & m_coords;
+  std::string & m_error;
+public:
+  FootprintTask(Options const& opt, boost::shared_ptr<CameraModel> cam,
+                vw::Vector2i const& image_size,
+                ImageViewRef< PixelMask<double> > const& dem,
+                GeoReference const& target_georef,
+                BBox2 & footprint_bbox, float & mean_gsd,
+                std::vector<Vector3> & coords, std::string & error):
+    m_opt(opt), m_cam(cam), m_image_size(image_size), m_dem(dem),
+    m_target_georef(target_georef), m_footprint_bbox(footprint_bbox),
+    m_mean_gsd(mean_gsd), m_coords(coords), m_error(error) {}
+
+  void operator()() {
+    try {
+      compute_footprint(m_opt, m_cam, m_image_size, m_dem, m_target_georef,
+                        m_footprint_bbox, m_mean_gsd, m_coords);
+    } catch (std::exception const& e) {
+      m_error = e.what();
+    }
+  }
+};
+
+// Find the footprints of a list of cameras. Load the cameras in
+// batches, then process each batch in parallel. A camera which fails
+// does not stop the others.
+void process_camera_list(Options const& opt) {
+
+  std::vector<std::string> images, cameras;
+  asp::read_list(opt.image_list, images);
+  asp::read_list(opt.camera_list, cameras);
+  if (images.size() != cameras.size())
+    vw_throw(ArgumentErr() << "The number of images and cameras in the lists differ.\n");
+
+  ImageViewRef< PixelMask<double> > dem;
+  GeoReference target_georef;
+  find_target_georef(opt, dem, target_georef);
+
+  size_t num = images.size();
+  std::vector<BBox2> footprint_bboxes(num);
+  std::vector<float> mean_gsds(num, 0);
+  std::vector<std::vector<Vector3>> coords(num);
+  std::vector<std::string> errors(num);
+
+  int num_threads = vw_settings().default_num_threads();
+  size_t batch_size = 4 * std::max(num_threads, 1);
+  for (size_t beg = 0; beg < num; beg += batch_size) {
+    size_t end = std::min(num, beg + batch_size);
+
+    // Load the cameras of this batch
+    std::vector<boost::shared_ptr<CameraModel>> cams(end - beg);
+    std::vector<vw::Vector2i> image_sizes(end - beg);
+    bool have_isis = false;
+    for (size_t it = beg; it < end; it++) {
+      try {
+        std::string session_name;
+        cams[it - beg] = load_camera(opt, images[it], cameras[it], session_name);
+        image_sizes[it - beg] = vw::file_image_size(images[it]);
+        if (session_name == "isis")
+          have_isis = true;
+      } catch (std::exception const& e) {
+        errors[it] = e.what();
+      }
+    }
+
+    // ISIS cameras cannot be used from multiple threads
+    FifoWorkQueue queue(have_isis ? 1 : num_threads);
+    for (size_t it = beg; it < end; it++) {
+      if (!errors[it].empty())
+        continue;
+      boost::shared_ptr<FootprintTask>
+        task(new FootprintTask(opt, cams[it - beg], image_sizes[it - beg], dem,
+                               target_georef, footprint_bboxes[it], mean_gsds[it],
+                               coords[it], errors[it]));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+
+  // Print out the results
+  int num_failed = 0;
+  for (size_t it = 0; it < num; it++) {
+    if (!errors[it].empty()) {
+      vw_out(WarningMessage) << "Failed to compute the footprint for " << images[it]
+                             << ": " << errors[it] << "\n";
+      coords[it].clear();
+      num_failed++;
+      continue;
+    }
+    vw_out() << images[it] << " footprint: " << footprint_bboxes[it]
+             << " mean gsd: " << mean_gsds[it] << std::endl;
+  }
+  if (num_failed > 0)
+    vw_out() << "Failed for " << num_failed << " / " << num << " cameras.\n";
+
+  if (opt.output_kml != "")
+    write_footprint_kml(opt.output_kml, images, coords);
+}
+
 int main( int argc, char *argv[] ) {
 
   Options opt;
@@ -124,25 +359,14 @@ int main( int argc, char *argv[] ) {
 
     handle_arguments(argc, argv, opt);
 
-    typedef boost::scoped_ptr<asp::StereoSession> SessionPtr;
-    SessionPtr session(asp::StereoSessionFactory::create
-		       (opt.stereo_session, // may change inside
-                        opt,
-                        opt.image_file,  opt.image_file,
-                        opt.camera_file, opt.camera_file,
-                        "",
-                        "",
-                        false) ); // Do not allow promotion from normal to map projected session
-
-    if ( opt.camera_file.empty() )
-      vw_throw( ArgumentErr() << "Missing input camera.\n" );
-
-   
-    boost::shared_ptr<CameraModel> cam = session->camera_model(opt.image_file, opt.camera_file);
+    if (!opt.image_list.empty()) {
+      process_camera_list(opt);
+      return 0;
+    }
 
-    // The input nodata value
-    float input_nodata_value = -std::numeric_limits<float>::max(); 
-    vw::read_nodata_val(opt.image_file, input_nodata_value);
+    std::string session_name;
+    boost::shared_ptr<CameraModel> cam = load_camera(opt, opt.image_file, opt.camera_file,
+                                                     session_name);
 
     // Just get the image size
     vw::Vector2i image_size = vw::file_image_size(opt.image_file);
@@ -153,51 +377,15 @@ int main( int argc, char *argv[] ) {
     //      image_box.crop(opt.image_crop_box);
     
     // Perform the computation
-    
+    ImageViewRef< PixelMask<double> > dem;
     GeoReference target_georef;
+    find_target_georef(opt, dem, target_georef);
     
     BBox2 footprint_bbox;
     float mean_gsd=0;
     std::vector<Vector3> coords;
-    if (opt.dem_file.empty()) { // No DEM available, intersect with the datum.
-
-      // Initialize the georef/datum
-      bool have_user_datum = (opt.datum_str != "");
-      cartography::Datum datum(opt.datum_str);
-      target_georef = GeoReference(datum);
-      bool have_input_georef = false;
-      asp::set_srs_string(opt.target_srs_string, have_user_datum, datum,
-                          have_input_georef, target_georef);
-      vw_out() << "Using georef: " << target_georef << std::endl;
-
-      std::vector<Vector2> coords2;
-      footprint_bbox = camera_bbox(target_georef, cam, image_size[0], image_size[1],
-                                   mean_gsd, &coords2);
-      for (size_t i=0; i<coords2.size(); ++i) {
-        Vector3 proj_coord(coords2[i][0], coords2[i][1], 0.0);
-        coords.push_back(target_georef.point_to_geodetic(proj_coord));
-      }
-      
-    } else { // DEM provided, intersect with it.
-
-      // Load the DEM
-      float dem_nodata_val = -std::numeric_limits<float>::max(); 
-      vw::read_nodata_val(opt.dem_file, dem_nodata_val);
-      ImageViewRef< PixelMask<double> > dem = create_mask
-        (channel_cast<double>(DiskImageView<float>(opt.dem_file)), dem_nodata_val);
-      
-      GeoReference dem_georef;
-      if (!read_georeference(dem_georef, opt.dem_file))
-        vw_throw( ArgumentErr() << "Missing georef.\n");
-
-      target_georef = dem_georef; // return box in this projection
-      vw_out() << "Using georef: " << target_georef << std::endl;
-      
-      footprint_bbox = camera_bbox(dem, dem_georef, target_georef, cam,
-                                   image_size[0], image_size[1], mean_gsd, opt.quick, &coords);
-      for (size_t i=0; i<coords.size(); ++i)
-        coords[i] = target_georef.datum().cartesian_to_geodetic(coords[i]);
-    }
+    compute_footprint(opt, cam, image_size, dem, target_georef,
+                      footprint_bbox, mean_gsd, coords);
     
     // Print out the results    
     vw_out() << "Computed footprint bounding box:\n" << footprint_bbox << std::endl;
@@ -207,23 +395,8 @@ int main( int argc, char *argv[] ) {
       return 0;
 
     // Create the KML file if specified by the user.
-    KMLFile kml(opt.output_kml, "footprint");
-
-    // Style listing
-
-    // Placemark Style
-    const bool HIDE_LABELS = true;
-    kml.append_style( "dot", "", 1.2,
-                      "http://maps.google.com/mapfiles/kml/shapes/placemark_circle.png", 
-                      HIDE_LABELS);
-    kml.append_style( "dot_highlight", "", 1.4,
-                      "http://maps.google.com/mapfiles/kml/shapes/placemark_circle_highlight.png");
-    kml.append_stylemap( "placemark", "dot",
-                         "dot_highlight" ); 
-    
-    kml.append_line(coords, "intersections", "placemark");
-    vw_out() << "Writing: " << opt.output_kml << std::endl; 
-    kml.close_kml();
+    write_footprint_kml(opt.output_kml, std::vector<std::string>(1, "intersections"),
+                        std::vector<std::vector<Vector3>>(1, coords));
     
   } ASP_STANDARD_CATCHES;
 
@@ -26,6 +26,7 @@
 #include <asp/Core/InterestPointMatching.h>
 #include <asp/Core/BundleAdjustUtils.h>
 #include <asp/Tools/ccd_adjust.h>
+#include <asp/Core/Tracing.h>
 
 // Turn off warnings from eigen
 #if defined(__GNUC__) || defined(__GNUG__)
@@ -303,7 +304,10 @@ void ccd_adjust(std::vector<std::string> const& image_files,
 
   // Solve the problem using Ceres
   ceres::Solver::Summary summary;
-  ceres::Solve(options, &problem, &summary);
+  {
+    asp::TraceSpan span("ceres_solve", "solver");
+    ceres::Solve(options, &problem, &summary);
+  }
   vw_out() << summary.FullReport() << "\n";
   if (summary.termination_type == ceres::NO_CONVERGENCE){
     // Print a clarifying message, so the user does not think that the algorithm failed.
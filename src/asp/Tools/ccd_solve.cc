@@ -96,6 +96,7 @@
 #include <asp/Sessions/StereoSession.h>
 #include <asp/Sessions/StereoSessionFactory.h>
 #include <asp/Camera/LinescanDGModel.h>
+#include <asp/Core/Tracing.h>
 #include <vw/Cartography/CameraBBox.h>
 #include <vw/InterestPoint/InterestData.h>
 #include <vw/Core/Stopwatch.h>
@@ -403,7 +404,10 @@ int main(int argc, char* argv[]) {
     
     vw_out() << "Solving the problem." << std::endl;
     ceres::Solver::Summary summary;
-    ceres::Solve(options, &problem, &summary);
+    {
+      asp::TraceSpan span("ceres_solve", "solver");
+      ceres::Solve(options, &problem, &summary);
+    }
     vw_out() << summary.FullReport() << "\n";
     if (summary.termination_type == ceres::NO_CONVERGENCE){
       // Print a clarifying message, so the user does not think that the algorithm failed.
@@ -0,0 +1,388 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file corr_bench.cc
+
+// Benchmark the correlators available in stereo_corr on synthetic
+// epipolar-aligned image pairs with known disparity, reporting the speed,
+// memory, and accuracy. The images are produced by a fixed random number
+// generator, so the numbers are comparable across runs and machines.
+
+#include <asp/Core/Macros.h>
+#include <asp/Core/Common.h>
+#include <asp/Core/BlockMatching.h>
+#include <asp/Core/StageReport.h>
+#include <vw/Stereo/CorrelationView.h>
+#include <vw/Core/Stopwatch.h>
+#include <vw/Core/Settings.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <random>
+
+namespace po = boost::program_options;
+using namespace vw;
+
+struct Options : vw::GdalWriteOptions {
+  int size, max_disp, repeat;
+  std::string families, algorithms, output_file;
+};
+
+void handle_arguments(int argc, char *argv[], Options& opt) {
+
+  po::options_description general_options("");
+  general_options.add_options()
+    ("size", po::value(&opt.size)->default_value(512),
+     "The width and height of the synthetic images.")
+    ("max-disparity", po::value(&opt.max_disp)->default_value(32),
+     "The search range is from 0 to this value. The true disparity "
+     "takes values in about the middle 80% of this range.")
+    ("families", po::value(&opt.families)->default_value("terrain slope texture"),
+     "The kinds of synthetic pairs to use. Options: terrain (smooth rolling relief), "
+     "slope (steep ramp), texture (smooth relief with image contrast fading to nearly "
+     "zero across the image). Specify as a list in quotes.")
+    ("algorithms", po::value(&opt.algorithms)
+     ->default_value("asp_bm asp_sgm asp_mgm asp_final_mgm asp_fast_bm asp_fast_sgm"),
+     "The correlators to run. Specify as a list in quotes.")
+    ("repeat", po::value(&opt.repeat)->default_value(1),
+     "Run each correlator this many times and report the shortest time.")
+    ("output-file", po::value(&opt.output_file)->default_value(""),
+     "Append the results to this CSV file, writing a header first if it is new.");
+
+  general_options.add(vw::GdalWriteOptionsDescription(opt));
+
+  po::options_description positional("");
+  po::positional_options_description positional_desc;
+
+  std::string usage("[options]");
+  bool allow_unregistered = false;
+  std::vector<std::string> unregistered;
+  po::variables_map vm =
+    asp::check_command_line(argc, argv, opt, general_options, general_options,
+                            positional, positional_desc, usage,
+                            allow_unregistered, unregistered);
+
+  if (opt.size < 64)
+    vw_throw(ArgumentErr() << "The image size must be at least 64.\n");
+  if (opt.max_disp < 4 || opt.max_disp > opt.size / 4)
+    vw_throw(ArgumentErr() << "The maximum disparity must be between 4 and "
+             << "a quarter of the image size.\n");
+  if (opt.repeat < 1)
+    vw_throw(ArgumentErr() << "The value of --repeat must be positive.\n");
+}
+
+// Band-limited noise with values in about [0, 1], from uniform noise
+// smoothed with a box filter applied twice in each direction.
+ImageView<float> smooth_noise(int cols, int rows, int radius, std::mt19937 & gen) {
+
+  std::uniform_real_distribution<float> dist(0.0, 1.0);
+  ImageView<float> img(cols, rows), tmp(cols, rows);
+  for (int row = 0; row < rows; row++)
+    for (int col = 0; col < cols; col++)
+      img(col, row) = dist(gen);
+
+  for (int pass = 0; pass < 2; pass++) {
+    for (int row = 0; row < rows; row++) {
+      for (int col = 0; col < cols; col++) {
+        double sum = 0; int count = 0;
+        for (int k = std::max(0, col - radius); k <= std::min(cols - 1, col + radius); k++) {
+          sum += img(k, row);
+          count++;
+        }
+        tmp(col, row) = sum / count;
+      }
+    }
+    for (int row = 0; row < rows; row++) {
+      for (int col = 0; col < cols; col++) {
+        double sum = 0; int count = 0;
+        for (int k = std::max(0, row - radius); k <= std::min(rows - 1, row + radius); k++) {
+          sum += tmp(col, k);
+          count++;
+        }
+        img(col, row) = sum / count;
+      }
+    }
+  }
+
+  // Stretch to [0, 1], as smoothing shrinks the range
+  float lo = std::numeric_limits<float>::max(), hi = -lo;
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+      lo = std::min(lo, img(col, row));
+      hi = std::max(hi, img(col, row));
+    }
+  }
+  for (int row = 0; row < rows; row++)
+    for (int col = 0; col < cols; col++)
+      img(col, row) = (img(col, row) - lo) / std::max(hi - lo, 1e-6f);
+
+  return img;
+}
+
+// Create a left image, a right image with NaN where it is not seen in the
+// left one, and the true disparity, so that left(col, row) equals
+// right(col + disp(col, row), row), up to noise.
+void make_pair(std::string const& family, int size, int max_disp,
+               ImageView<float> & left, ImageView<float> & right,
+               ImageView<float> & disp) {
+
+  std::mt19937 gen(1); // fixed seed, for reproducibility
+  left = smooth_noise(size, size, 1, gen);
+
+  // The disparity stays in [0.1, 0.9] * max_disp. Its derivative
+  // stays well below 1 in magnitude, so each row of the right image is
+  // a monotonic warp of the left image row.
+  double lo = 0.1 * max_disp, hi = 0.9 * max_disp;
+  disp.set_size(size, size);
+  if (family == "slope") {
+    for (int row = 0; row < size; row++)
+      for (int col = 0; col < size; col++)
+        disp(col, row) = lo + (hi - lo) * (0.7 * col + 0.3 * row) / double(size - 1);
+  } else if (family == "terrain" || family == "texture") {
+    ImageView<float> relief = smooth_noise(size, size, std::max(4, size / 16), gen);
+    for (int row = 0; row < size; row++)
+      for (int col = 0; col < size; col++)
+        disp(col, row) = lo + (hi - lo) * relief(col, row);
+  } else {
+    vw_throw(ArgumentErr() << "Unknown image family: " << family << ".\n");
+  }
+
+  // For the texture family, fade the image contrast from full on the left
+  // to 2% on the right, to see how the correlators handle weak texture.
+  if (family == "texture") {
+    for (int row = 0; row < size; row++) {
+      for (int col = 0; col < size; col++) {
+        double contrast = 1.0 - 0.98 * col / double(size - 1);
+        left(col, row) = 0.5 + contrast * (left(col, row) - 0.5);
+      }
+    }
+  }
+
+  // Invert the warp col -> col + disp(col, row) along each row, with
+  // linear interpolation.
+  float nan = std::numeric_limits<float>::quiet_NaN();
+  right.set_size(size, size);
+  for (int row = 0; row < size; row++) {
+    int col = 0;
+    for (int rcol = 0; rcol < size; rcol++) {
+      right(rcol, row) = nan;
+      while (col + 1 < size && col + 1 + disp(col + 1, row) <= rcol)
+        col++;
+      double x0 = col + disp(col, row);
+      if (col + 1 >= size || x0 > rcol)
+        continue;
+      double x1 = col + 1 + disp(col + 1, row);
+      double t = (rcol - x0) / (x1 - x0);
+      right(rcol, row) = (1.0 - t) * left(col, row) + t * left(col + 1, row);
+    }
+  }
+
+  // Add independent sensor noise to the two images. This is what makes
+  // locally weak texture hard to match.
+  std::normal_distribution<float> noise(0.0, 0.005);
+  for (int row = 0; row < size; row++) {
+    for (int col = 0; col < size; col++) {
+      left(col, row) += noise(gen);
+      if (!std::isnan(right(col, row)))
+        right(col, row) += noise(gen);
+    }
+  }
+}
+
+// Run a VW correlator with the same settings as stereo_corr uses for a
+// tile with local epipolar alignment and no seed.
+void run_vw_correlator(std::string const& alg_name,
+                       ImageView<float> const& left_in, ImageView<float> const& right_in,
+                       int max_disp, ImageView<float> & disp) {
+
+  ImageView<PixelGray<float>> left(left_in.cols(), left_in.rows()),
+    right(right_in.cols(), right_in.rows());
+  ImageView<uint8> left_mask(left.cols(), left.rows()), right_mask(right.cols(), right.rows());
+  for (int row = 0; row < left.rows(); row++) {
+    for (int col = 0; col < left.cols(); col++) {
+      bool lv = !std::isnan(left_in(col, row)), rv = !std::isnan(right_in(col, row));
+      left(col, row)  = lv ? left_in(col, row)  : 0.0;
+      right(col, row) = rv ? right_in(col, row) : 0.0;
+      left_mask(col, row)  = lv ? 255 : 0;
+      right_mask(col, row) = rv ? 255 : 0;
+    }
+  }
+
+  vw::stereo::CorrelationAlgorithm stereo_alg = vw::stereo::VW_CORRELATION_BM;
+  if (alg_name == "asp_sgm")
+    stereo_alg = vw::stereo::VW_CORRELATION_SGM;
+  else if (alg_name == "asp_mgm")
+    stereo_alg = vw::stereo::VW_CORRELATION_MGM;
+  else if (alg_name == "asp_final_mgm")
+    stereo_alg = vw::stereo::VW_CORRELATION_FINAL_MGM;
+  bool using_bm = (stereo_alg == vw::stereo::VW_CORRELATION_BM);
+
+  // The interval in y is [lower_limit, upper_limit), as in stereo_corr
+  BBox2i search_range(Vector2i(0, -1), Vector2i(max_disp, 2));
+  Vector2i kernel_size = using_bm ? Vector2i(21, 21) : Vector2i(5, 5);
+  stereo::CostFunctionType cost_mode
+    = using_bm ? stereo::CROSS_CORRELATION : stereo::TERNARY_CENSUS_TRANSFORM;
+  stereo::PrefilterModeType prefilter_mode
+    = using_bm ? stereo::PREFILTER_LOG : stereo::PREFILTER_NONE;
+  int corr_timeout = 0, collar_size = 0, blob_filter_area = 0, max_levels = 5;
+  int xcorr_threshold = 2, min_xcorr_level = 0;
+  const int rm_half_kernel = 5;
+  double seconds_per_op = 0.0, memory_limit_mb = 6000;
+  ImageView<PixelMask<float>> * lr_disp_diff = NULL;
+
+  ImageView<PixelMask<Vector2f>> disp_2d
+    = stereo::pyramid_correlate(left, right, left_mask, right_mask,
+                                prefilter_mode, 1.4, search_range,
+                                kernel_size, cost_mode, corr_timeout, seconds_per_op,
+                                xcorr_threshold, min_xcorr_level, rm_half_kernel,
+                                max_levels, stereo_alg, collar_size,
+                                SemiGlobalMatcher::SUBPIXEL_LC_BLEND, Vector2i(4, 4),
+                                memory_limit_mb, blob_filter_area, lr_disp_diff,
+                                Vector2i(0, 0), false);
+
+  float nan = std::numeric_limits<float>::quiet_NaN();
+  disp.set_size(disp_2d.cols(), disp_2d.rows());
+  for (int row = 0; row < disp.rows(); row++)
+    for (int col = 0; col < disp.cols(); col++)
+      disp(col, row) = is_valid(disp_2d(col, row)) ? disp_2d(col, row).child()[0] : nan;
+}
+
+void run_correlator(std::string const& alg_name,
+                    ImageView<float> const& left, ImageView<float> const& right,
+                    int max_disp, ImageView<float> & disp) {
+
+  // The native correlators use the stereo_corr defaults
+  if (alg_name == "asp_fast_bm")
+    asp::block_match_1d(left, right, 0, max_disp, 9, asp::BM_COST_NCC, 1.0, disp);
+  else if (alg_name == "asp_fast_sgm")
+    asp::sgm_1d(left, right, 0, max_disp, 5, asp::BM_COST_CENSUS, 32, 128,
+                true, 1.0, 6000, disp);
+  else if (alg_name == "asp_bm" || alg_name == "asp_sgm" ||
+           alg_name == "asp_mgm" || alg_name == "asp_final_mgm")
+    run_vw_correlator(alg_name, left, right, max_disp, disp);
+  else
+    vw_throw(ArgumentErr() << "Cannot benchmark the algorithm: " << alg_name
+             << ". External algorithms are run as separate programs and "
+             << "must be timed with stereo_corr.\n");
+}
+
+// Compare with the true disparity away from the image boundary, where
+// all correlators have the full window.
+void disparity_error(ImageView<float> const& disp, ImageView<float> const& truth,
+                     int margin, double & valid_frac, double & mean_err, double & bad_frac) {
+
+  double num = 0, num_valid = 0, num_bad = 0, sum = 0;
+  for (int row = margin; row < truth.rows() - margin; row++) {
+    for (int col = margin; col < truth.cols() - margin; col++) {
+      num++;
+      float d = disp(col, row);
+      if (std::isnan(d))
+        continue;
+      double err = std::abs(d - truth(col, row));
+      num_valid++;
+      sum += err;
+      if (err > 1.0)
+        num_bad++;
+    }
+  }
+
+  valid_frac = num > 0 ? num_valid / num : 0;
+  mean_err   = num_valid > 0 ? sum / num_valid : 0;
+  bad_frac   = num_valid > 0 ? num_bad / num_valid : 0;
+}
+
+int main(int argc, char *argv[]) {
+
+  Options opt;
+  try {
+    handle_arguments(argc, argv, opt);
+
+    std::vector<std::string> families, algorithms;
+    std::string families_str = opt.families, algorithms_str = opt.algorithms;
+    boost::trim(families_str);
+    boost::trim(algorithms_str);
+    boost::split(families, families_str, boost::is_any_of(" \t,"),
+                 boost::token_compress_on);
+    boost::split(algorithms, algorithms_str, boost::is_any_of(" \t,"),
+                 boost::token_compress_on);
+
+    std::ostringstream header, results;
+    header << "family,algorithm,cols,rows,max_disparity,threads,seconds,"
+           << "mpix_per_sec,mpix_disp_per_sec,peak_rss_mb,valid_frac,"
+           << "mean_abs_err,bad_frac\n";
+    vw_out() << header.str();
+
+    int threads = vw_settings().default_num_threads();
+    for (size_t f = 0; f < families.size(); f++) {
+
+      ImageView<float> left, right, truth;
+      make_pair(families[f], opt.size, opt.max_disp, left, right, truth);
+
+      for (size_t a = 0; a < algorithms.size(); a++) {
+
+        ImageView<float> disp;
+        double seconds = std::numeric_limits<double>::max();
+        for (int r = 0; r < opt.repeat; r++) {
+          Stopwatch sw;
+          sw.start();
+          run_correlator(algorithms[a], left, right, opt.max_disp, disp);
+          sw.stop();
+          seconds = std::min(seconds, sw.elapsed_seconds());
+        }
+
+        // The peak memory of the process so far. Run one algorithm at a
+        // time to find its own peak.
+        asp::ResourceUsage usage;
+        usage.measure();
+
+        double valid_frac = 0, mean_err = 0, bad_frac = 0;
+        int margin = 16;
+        disparity_error(disp, truth, margin, valid_frac, mean_err, bad_frac);
+
+        double mpix = double(opt.size) * double(opt.size) / 1.0e6;
+        std::ostringstream os;
+        os.precision(6);
+        os << families[f] << "," << algorithms[a] << "," << opt.size << ","
+           << opt.size << "," << opt.max_disp << "," << threads << ","
+           << seconds << "," << mpix / seconds << ","
+           << mpix * (opt.max_disp + 1) / seconds << ","
+           << usage.peak_rss_mb << "," << valid_frac << "," << mean_err << ","
+           << bad_frac << "\n";
+        vw_out() << os.str();
+        results << os.str();
+      }
+    }
+
+    if (!opt.output_file.empty()) {
+      bool is_new = !boost::filesystem::exists(opt.output_file);
+      std::ofstream ofs(opt.output_file.c_str(), std::ios::app);
+      if (!ofs.good())
+        vw_throw(IOErr() << "Cannot write: " << opt.output_file << "\n");
+      if (is_new)
+        ofs << header.str();
+      ofs << results.str();
+      vw_out() << "Wrote: " << opt.output_file << "\n";
+    }
+
+  } ASP_STANDARD_CATCHES;
+
+  return 0;
+}
@@ -18,14 +18,23 @@
 /// \file corr_eval.cc
 
 // Evaluate the quality of produced correlation using several metrics.
-// See CorrEval.h and this tool's manual for more info.
+// See this tool's manual for more info.
 
 #include <vw/Stereo/PreFilter.h>
-#include <vw/Stereo/CorrEval.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/EdgeExtension.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/PixelMask.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/StereoSettings.h>
 
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <vector>
+
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
@@ -62,6 +71,378 @@ prefilter_image_ref(ImageViewBase<ImageT> const& image,
 }
 }}
 
+// A summed-area table of an image. The sum of the image over any box
+// is then found with four lookups, no matter the size of the box.
+struct IntegralImage {
+  vw::BBox2i box; // the pixels it covers, in the coordinates of the full image
+  vw::ImageView<double> sums;
+
+  // Build it from a functor returning the value at a pixel of the full image
+  template <class FuncT>
+  void build(vw::BBox2i const& in_box, FuncT const& val) {
+    box = in_box;
+    sums.set_size(box.width() + 1, box.height() + 1);
+    for (int col = 0; col <= box.width(); col++)
+      sums(col, 0) = 0.0;
+    for (int row = 0; row < box.height(); row++) {
+      double row_sum = 0.0;
+      sums(0, row + 1) = 0.0;
+      for (int col = 0; col < box.width(); col++) {
+        row_sum += val(box.min().x() + col, box.min().y() + row);
+        sums(col + 1, row + 1) = sums(col + 1, row) + row_sum;
+      }
+    }
+  }
+
+  // The sum over the columns [begin_col, end_col) and rows [begin_row,
+  // end_row), which must be within the table.
+  double sum(int begin_col, int begin_row, int end_col, int end_row) const {
+    int c0 = begin_col - box.min().x(), c1 = end_col - box.min().x();
+    int r0 = begin_row - box.min().y(), r1 = end_row - box.min().y();
+    return sums(c1, r1) - sums(c0, r1) - sums(c1, r0) + sums(c0, r0);
+  }
+};
+
+// Evaluate the quality of the disparity at each pixel. Each tile forms
+// summed-area tables of the left and right images, their squares, and,
+// for bilinear interpolation, of the products of neighboring right
+// pixels, so the window sums cost O(1) per pixel. The sums of left
+// times right pixels depend on the disparity, so the pixels are grouped
+// by the integer part of it, and a table of the products is formed for
+// each group, over the windows of its pixels only. Pixels whose windows
+// have no-data or out-of-range values, or which are in groups too
+// scattered to be worth a table, are evaluated directly. Both ways give
+// the same result, up to floating point error.
+class CorrEvalView: public vw::ImageViewBase<CorrEvalView> {
+  vw::ImageViewRef<vw::PixelMask<float>>        m_left, m_right;
+  vw::ImageViewRef<vw::PixelMask<vw::Vector2f>> m_disp;
+  vw::Vector2i m_kernel_size;
+  std::string  m_metric;
+  int          m_sample_rate;
+  bool         m_round_to_int;
+
+  // A pixel at which to evaluate the metric, and where its disparity
+  // takes it in the right image. The weights are for bilinear
+  // interpolation.
+  struct Sample {
+    int col, row;      // in the tile
+    int right_col, right_row;
+    double wx, wy;
+    bool direct;       // if to evaluate it without the tables
+    double sum_lr;
+  };
+
+  // The value of a pixel of a crop, if valid and within the crop
+  static bool pixel_val(vw::ImageView<vw::PixelMask<float>> const& img,
+                        vw::BBox2i const& box, int col, int row, double & val) {
+    if (!box.contains(vw::Vector2i(col, row)))
+      return false;
+    vw::PixelMask<float> const& pix = img(col - box.min().x(), row - box.min().y());
+    if (!is_valid(pix))
+      return false;
+    val = pix.child();
+    return true;
+  }
+
+  // The right image value a sample sees at the given window offset
+  bool right_val(vw::ImageView<vw::PixelMask<float>> const& right,
+                 vw::BBox2i const& right_box, Sample const& s,
+                 int dx, int dy, double & val) const {
+    int col = s.right_col + dx, row = s.right_row + dy;
+    if (m_round_to_int)
+      return pixel_val(right, right_box, col, row, val);
+
+    double v00 = 0, v10 = 0, v01 = 0, v11 = 0;
+    if (!pixel_val(right, right_box, col,     row,     v00) ||
+        !pixel_val(right, right_box, col + 1, row,     v10) ||
+        !pixel_val(right, right_box, col,     row + 1, v01) ||
+        !pixel_val(right, right_box, col + 1, row + 1, v11))
+      return false;
+    val = (1.0 - s.wy) * ((1.0 - s.wx) * v00 + s.wx * v10)
+      + s.wy * ((1.0 - s.wx) * v01 + s.wx * v11);
+    return true;
+  }
+
+  // The metric from the sums over the n pixel pairs of a window
+  bool metric_val(double n, double sum_l, double sum_ll, double sum_r, double sum_rr,
+                  double sum_lr, float & val) const {
+    if (n <= 0)
+      return false;
+    if (m_metric == "ncc") {
+      double den = sum_ll * sum_rr;
+      if (den <= 0)
+        return false;
+      val = sum_lr / sqrt(den);
+      return true;
+    }
+    double var_l = std::max(sum_ll / n - (sum_l / n) * (sum_l / n), 0.0);
+    double var_r = std::max(sum_rr / n - (sum_r / n) * (sum_r / n), 0.0);
+    val = (sqrt(var_l) + sqrt(var_r)) / 2.0;
+    return true;
+  }
+
+  // Evaluate a sample by visiting each pixel of its window
+  bool direct_val(vw::ImageView<vw::PixelMask<float>> const& left,
+                  vw::BBox2i const& left_box,
+                  vw::ImageView<vw::PixelMask<float>> const& right,
+                  vw::BBox2i const& right_box, vw::Vector2i const& tile_corner,
+                  Sample const& s, float & val) const {
+    int hx = m_kernel_size[0] / 2, hy = m_kernel_size[1] / 2;
+    double n = 0, sum_l = 0, sum_ll = 0, sum_r = 0, sum_rr = 0, sum_lr = 0;
+    for (int dy = -hy; dy <= hy; dy++) {
+      for (int dx = -hx; dx <= hx; dx++) {
+        double l = 0, r = 0;
+        if (!pixel_val(left, left_box, tile_corner.x() + s.col + dx,
+                       tile_corner.y() + s.row + dy, l) ||
+            !right_val(right, right_box, s, dx, dy, r))
+          continue;
+        n++;
+        sum_l += l; sum_ll += l * l;
+        sum_r += r; sum_rr += r * r;
+        sum_lr += l * r;
+      }
+    }
+    return metric_val(n, sum_l, sum_ll, sum_r, sum_rr, sum_lr, val);
+  }
+
+public:
+
+  typedef vw::PixelMask<float> pixel_type;
+  typedef pixel_type result_type;
+  typedef vw::ProceduralPixelAccessor<CorrEvalView> pixel_accessor;
+
+  CorrEvalView(vw::ImageViewRef<vw::PixelMask<float>> const& left,
+               vw::ImageViewRef<vw::PixelMask<float>> const& right,
+               vw::ImageViewRef<vw::PixelMask<vw::Vector2f>> const& disp,
+               vw::Vector2i const& kernel_size, std::string const& metric,
+               int sample_rate, bool round_to_int):
+    m_left(left), m_right(right), m_disp(disp), m_kernel_size(kernel_size),
+    m_metric(metric), m_sample_rate(sample_rate), m_round_to_int(round_to_int) {}
+
+  inline vw::int32 cols  () const { return m_left.cols(); }
+  inline vw::int32 rows  () const { return m_left.rows(); }
+  inline vw::int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+  inline pixel_type operator()(double/*i*/, double/*j*/, vw::int32/*p*/ = 0) const {
+    vw::vw_throw(vw::NoImplErr() << "CorrEvalView::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef vw::CropView<vw::ImageView<pixel_type>> prerasterize_type;
+  inline prerasterize_type prerasterize(vw::BBox2i const& bbox) const {
+
+    using namespace vw;
+
+    ImageView<pixel_type> tile(bbox.width(), bbox.height()); // invalid by default
+    int hx = m_kernel_size[0] / 2, hy = m_kernel_size[1] / 2;
+    int extra = m_round_to_int ? 0 : 1; // bilinear interpolation needs one more pixel
+    double kernel_area = double(m_kernel_size[0]) * m_kernel_size[1];
+
+    // Find the samples, and the right image region their windows need
+    ImageView<PixelMask<Vector2f>> disp = crop(m_disp, bbox);
+    std::vector<Sample> samples;
+    BBox2i right_box;
+    for (int row = 0; row < bbox.height(); row++) {
+      if ((bbox.min().y() + row) % m_sample_rate != 0)
+        continue;
+      for (int col = 0; col < bbox.width(); col++) {
+        if ((bbox.min().x() + col) % m_sample_rate != 0 || !is_valid(disp(col, row)))
+          continue;
+        Sample s;
+        s.col = col;
+        s.row = row;
+        double x = bbox.min().x() + col + disp(col, row).child()[0];
+        double y = bbox.min().y() + row + disp(col, row).child()[1];
+        if (m_round_to_int) {
+          s.right_col = round(x);
+          s.right_row = round(y);
+          s.wx = s.wy = 0.0;
+        } else {
+          s.right_col = floor(x);
+          s.right_row = floor(y);
+          s.wx = x - s.right_col;
+          s.wy = y - s.right_row;
+        }
+        s.direct   = false;
+        s.sum_lr   = 0.0;
+        samples.push_back(s);
+        right_box.grow(BBox2i(s.right_col - hx, s.right_row - hy,
+                              m_kernel_size[0] + extra, m_kernel_size[1] + extra));
+      }
+    }
+    right_box.crop(bounding_box(m_right));
+    if (samples.empty() || right_box.empty())
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+
+    // Pixels out of range are invalid, as are no-data ones
+    BBox2i left_box = bbox;
+    left_box.expand(std::max(hx, hy));
+    ImageView<PixelMask<float>> left  = crop(edge_extend(m_left, ZeroEdgeExtension()),
+                                             left_box);
+    ImageView<PixelMask<float>> right = crop(m_right, right_box);
+
+    // The value at a pixel, and if it is valid, with invalid ones being
+    // zero so they do not contribute to sums
+    auto L = [&](int col, int row) -> double {
+      double v = 0.0;
+      return pixel_val(left, left_box, col, row, v) ? v : 0.0;
+    };
+    auto R = [&](int col, int row) -> double {
+      double v = 0.0;
+      return pixel_val(right, right_box, col, row, v) ? v : 0.0;
+    };
+    auto valid_L = [&](int col, int row) -> double {
+      double v = 0.0;
+      return pixel_val(left, left_box, col, row, v) ? 1.0 : 0.0;
+    };
+    auto valid_R = [&](int col, int row) -> double {
+      double v = 0.0;
+      return pixel_val(right, right_box, col, row, v) ? 1.0 : 0.0;
+    };
+
+    bool is_ncc = (m_metric == "ncc");
+    IntegralImage left_count, right_count, left_sum, left_sq, right_sum, right_sq;
+    left_count.build(left_box, valid_L);
+    right_count.build(right_box, valid_R);
+    left_sq.build(left_box,  [&](int c, int r) { return L(c, r) * L(c, r); });
+    right_sq.build(right_box, [&](int c, int r) { return R(c, r) * R(c, r); });
+    if (!is_ncc) {
+      left_sum.build(left_box, L);
+      right_sum.build(right_box, R);
+    }
+
+    // Products of right pixels with their neighbors to the right, below,
+    // below-right, and of the right neighbor with the one below, for the
+    // squares of interpolated values.
+    IntegralImage right_h, right_v, right_d, right_a;
+    if (!m_round_to_int) {
+      right_h.build(right_box, [&](int c, int r) { return R(c, r) * R(c + 1, r); });
+      right_v.build(right_box, [&](int c, int r) { return R(c, r) * R(c, r + 1); });
+      right_d.build(right_box, [&](int c, int r) { return R(c, r) * R(c + 1, r + 1); });
+      right_a.build(right_box, [&](int c, int r) { return R(c + 1, r) * R(c, r + 1); });
+    }
+
+    // Only samples whose windows are fully valid can use the tables
+    for (size_t i = 0; i < samples.size(); i++) {
+      Sample & s = samples[i];
+      int col = bbox.min().x() + s.col, row = bbox.min().y() + s.row;
+      BBox2i right_win(s.right_col - hx, s.right_row - hy,
+                       m_kernel_size[0] + extra, m_kernel_size[1] + extra);
+      s.direct = (left_count.sum(col - hx, row - hy, col + hx + 1, row + hy + 1) !=
+                  kernel_area ||
+                  !right_box.contains(right_win) ||
+                  right_count.sum(right_win.min().x(), right_win.min().y(),
+                                  right_win.max().x(), right_win.max().y()) !=
+                  double(right_win.width()) * right_win.height());
+    }
+
+    // The sums of left times right pixels, with each shift from left to right
+    // pixels having its own table. Each sample needs one shift, or four
+    // with bilinear interpolation.
+    if (is_ncc) {
+      typedef std::pair<int, int> Shift;
+      std::map<Shift, std::vector<std::pair<int, double>>> groups; // sample, weight
+      for (size_t i = 0; i < samples.size(); i++) {
+        Sample const& s = samples[i];
+        if (s.direct)
+          continue;
+        int dx = s.right_col - (bbox.min().x() + s.col);
+        int dy = s.right_row - (bbox.min().y() + s.row);
+        double w[4] = {(1.0 - s.wx) * (1.0 - s.wy), s.wx * (1.0 - s.wy),
+                       (1.0 - s.wx) * s.wy,         s.wx * s.wy};
+        for (int k = 0; k < 4; k++) {
+          if (k > 0 && m_round_to_int)
+            break;
+          if (w[k] != 0.0)
+            groups[Shift(dx + k % 2, dy + k / 2)].push_back(std::make_pair(int(i), w[k]));
+        }
+      }
+
+      for (auto it = groups.begin(); it != groups.end(); it++) {
+        int dx = it->first.first, dy = it->first.second;
+        std::vector<std::pair<int, double>> const& group = it->second;
+        BBox2i group_box;
+        for (size_t j = 0; j < group.size(); j++) {
+          Sample const& s = samples[group[j].first];
+          group_box.grow(BBox2i(bbox.min().x() + s.col - hx, bbox.min().y() + s.row - hy,
+                                m_kernel_size[0], m_kernel_size[1]));
+        }
+
+        // A table costs as much as its area, so if the pixels are too
+        // scattered, it is cheaper to visit their windows
+        if (double(group_box.width()) * group_box.height() > kernel_area * group.size()) {
+          for (size_t j = 0; j < group.size(); j++)
+            samples[group[j].first].direct = true;
+          continue;
+        }
+
+        IntegralImage cross;
+        cross.build(group_box, [&](int c, int r) { return L(c, r) * R(c + dx, r + dy); });
+        for (size_t j = 0; j < group.size(); j++) {
+          Sample & s = samples[group[j].first];
+          int col = bbox.min().x() + s.col, row = bbox.min().y() + s.row;
+          s.sum_lr += group[j].second
+            * cross.sum(col - hx, row - hy, col + hx + 1, row + hy + 1);
+        }
+      }
+    }
+
+    Vector2i tile_corner = bbox.min();
+    for (size_t i = 0; i < samples.size(); i++) {
+      Sample const& s = samples[i];
+      float val = 0.0;
+      bool success = false;
+      if (s.direct) {
+        success = direct_val(left, left_box, right, right_box, tile_corner, s, val);
+      } else {
+        int col = bbox.min().x() + s.col, row = bbox.min().y() + s.row;
+        int c0 = col - hx, r0 = row - hy, c1 = col + hx + 1, r1 = row + hy + 1;
+        int rc0 = s.right_col - hx, rr0 = s.right_row - hy;
+        int rc1 = s.right_col + hx + 1, rr1 = s.right_row + hy + 1;
+
+        // The window in the right image, moved by the given amount
+        auto right_win = [&](IntegralImage const& t, int dx, int dy) {
+          return t.sum(rc0 + dx, rr0 + dy, rc1 + dx, rr1 + dy);
+        };
+
+        double sum_l  = is_ncc ? 0.0 : left_sum.sum(c0, r0, c1, r1);
+        double sum_ll = left_sq.sum(c0, r0, c1, r1);
+        double sum_r = 0.0, sum_rr = 0.0;
+        if (m_round_to_int) {
+          if (!is_ncc)
+            sum_r = right_win(right_sum, 0, 0);
+          sum_rr = right_win(right_sq, 0, 0);
+        } else {
+          // The interpolated value is a weighted sum of four pixels, so its
+          // square is a weighted sum of their squares and pairwise products
+          double w00 = (1.0 - s.wx) * (1.0 - s.wy), w10 = s.wx * (1.0 - s.wy);
+          double w01 = (1.0 - s.wx) * s.wy,         w11 = s.wx * s.wy;
+          if (!is_ncc)
+            sum_r = w00 * right_win(right_sum, 0, 0) + w10 * right_win(right_sum, 1, 0)
+              +     w01 * right_win(right_sum, 0, 1) + w11 * right_win(right_sum, 1, 1);
+          sum_rr = w00 * w00 * right_win(right_sq, 0, 0) + w10 * w10 * right_win(right_sq, 1, 0)
+            +      w01 * w01 * right_win(right_sq, 0, 1) + w11 * w11 * right_win(right_sq, 1, 1)
+            + 2.0 * (w00 * w10 * right_win(right_h, 0, 0) + w01 * w11 * right_win(right_h, 0, 1)
+                     + w00 * w01 * right_win(right_v, 0, 0) + w10 * w11 * right_win(right_v, 1, 0)
+                     + w00 * w11 * right_win(right_d, 0, 0) + w10 * w01 * right_win(right_a, 0, 0));
+        }
+        success = metric_val(kernel_area, sum_l, sum_ll, sum_r, sum_rr, s.sum_lr, val);
+      }
+      if (success)
+        tile(s.col, s.row) = pixel_type(val);
+    }
+
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, vw::BBox2i const& bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
 void handle_arguments(int argc, char *argv[], Options& opt) {
   
   po::options_description general_options("");
@@ -116,6 +497,11 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     vw::vw_throw(vw::ArgumentErr() << "Invalid value provided for --metric.\n\n"
                  << usage << general_options);
 
+  if (opt.kernel_size[0] < 1 || opt.kernel_size[1] < 1 ||
+      opt.kernel_size[0] % 2 == 0 || opt.kernel_size[1] % 2 == 0)
+    vw::vw_throw(vw::ArgumentErr() << "The values of --kernel-size must be positive odd numbers.\n"
+                 << usage << general_options);
+
   if (opt.sample_rate < 1)
     vw::vw_throw(vw::ArgumentErr() << "The value of --sample-rate must be positive.\n"
                  << usage << general_options);
@@ -144,12 +530,9 @@ int main(int argc, char *argv[]) {
     vw_out() << "Left and right image no-data values: " << left_nodata << ' '
              << right_nodata << "\n";
     
-    // Use bigger tiles on output, should be faster that way given
-    // that we have to grab a big chunk of the right image for each
-    // tile.
-    //opt.raster_tile_size = Vector2i(asp::ASPGlobalOptions::corr_tile_size(), // 1024
-    //                                asp::ASPGlobalOptions::corr_tile_size());
-    // These should result in less memory being used
+    // Each tile keeps crops of the left and right images and several
+    // tables of sums of doubles over them, so keep tiles small, to use
+    // less memory. The tiles are processed in parallel.
     opt.raster_tile_size = Vector2i(asp::ASPGlobalOptions::rfne_tile_size(), // 256
                                     asp::ASPGlobalOptions::rfne_tile_size());
 
@@ -173,9 +556,9 @@ int main(int argc, char *argv[]) {
     vw_out() << "Writing: " << output_image << "\n";
     vw::cartography::block_write_gdal_image
       (output_image,
-       apply_mask(vw::stereo::corr_eval(masked_left, masked_right,
-                                        disp, opt.kernel_size, opt.metric,
-                                        opt.sample_rate, opt.round_to_int),
+       apply_mask(CorrEvalView(masked_left, masked_right,
+                               disp, opt.kernel_size, opt.metric,
+                               opt.sample_rate, opt.round_to_int),
                   left_nodata),
        has_left_georef, left_georef,
        has_nodata, left_nodata, opt,
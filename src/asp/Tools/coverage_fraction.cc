@@ -27,6 +27,7 @@
 #include <asp/Core/Common.h>
 #include <asp/Core/StereoSettings.h>
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/RasterStats.h>
 
 #include <vw/Core/StringUtils.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
@@ -159,6 +160,22 @@ int main( int argc, char *argv[] ) {
       return 0;
     }
 
+    // The counts for these inputs and cutoff may be known from an earlier run
+    std::vector<double> mask_stamp = {double(fs::file_size(lmask_file)),
+                                      double(fs::last_write_time(lmask_file))};
+    asp::RasterStats stats;
+    bool have_stats = asp::read_raster_stats(pc_file, stats);
+    std::int64_t num_masked = 0, num_invalid = 0;
+    bool cached = (have_stats &&
+                   stats["coverage_mask"] == mask_stamp &&
+                   stats["coverage_error_cutoff"] == std::vector<double>{opt.error_cutoff} &&
+                   stats["coverage_counts"].size() == 2);
+    if (cached) {
+      vw_out() << "Reading the pixel counts from: " << asp::raster_stats_file(pc_file) << "\n";
+      num_masked  = stats["coverage_counts"][0];
+      num_invalid = stats["coverage_counts"][1];
+    }
+
     // Each thread will process a block of this tile size.
     std::int64_t tile_size = asp::ASPGlobalOptions::tri_tile_size();
 
@@ -185,16 +202,25 @@ int main( int argc, char *argv[] ) {
       return 0;
     };
 
-    // Use BlockImageOperator to count invalid pixels in parallel threads.
-    ValidPixelCounterFunctor functor(opt.error_cutoff);
+    if (!cached) {
+      // Use BlockImageOperator to count invalid pixels in parallel threads.
+      ValidPixelCounterFunctor functor(opt.error_cutoff);
+
+      //write_image("debug.tif", masked_error_image);
 
-    //write_image("debug.tif", masked_error_image);
+      const Vector2i block_size(tile_size, tile_size);
+      block_op_cache(masked_error_image, functor, block_size);
 
-    const Vector2i block_size(tile_size, tile_size);
-    block_op_cache(masked_error_image, functor, block_size);
+      num_masked  = functor.get_masked_count();
+      num_invalid = functor.get_invalid_count();
+
+      // Any other stats of the point cloud are kept
+      stats["coverage_mask"] = mask_stamp;
+      stats["coverage_error_cutoff"] = std::vector<double>{opt.error_cutoff};
+      stats["coverage_counts"] = {double(num_masked), double(num_invalid)};
+      asp::write_raster_stats(pc_file, stats);
+    }
 
-    std::int64_t num_masked  = functor.get_masked_count();
-    std::int64_t num_invalid = functor.get_invalid_count();
     std::int64_t num_rows    = masked_error_image.rows();
     std::int64_t num_cols    = masked_error_image.cols();
     std::int64_t num_pixels  = num_rows * num_cols;
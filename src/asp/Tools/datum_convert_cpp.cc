@@ -27,6 +27,9 @@
 
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string/replace.hpp>
+
+#include <algorithm>
+#include <cmath>
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
@@ -53,6 +56,8 @@ class DatumConvertView : public ImageViewBase<DatumConvertView<ImageT> >
   double              m_nodata_val;
   bool                m_use_gcc_convert;
   bool                m_debug_mode;
+  int                 m_interp_spacing;
+  double              m_interp_tolerance;
   //ProjContext m_src_datum_proj, m_dst_datum_proj;
 
 public:
@@ -64,13 +69,21 @@ public:
   /// Image view which replaces each input elevation with the elevation
   ///  value of the same location in the output georeference system.
   /// - This view does not do any horizontal movement.
+  /// - The height change is found exactly on a grid with the given
+  ///   spacing in pixels, and interpolated in between, unless that is
+  ///   off by more than the tolerance (in meters) at the center of a
+  ///   grid cell. A spacing of at most 1 finds it exactly at each pixel.
   DatumConvertView(ImageT       const& input_dem,
                    GeoReference const& input_georef,
                    GeoReference const& output_georef,
                    double nodata_val,
-                   bool debug_mode=false):
+                   bool debug_mode=false,
+                   int interp_spacing=0,
+                   double interp_tolerance=0.0):
     m_input_dem(input_dem), m_input_georef(input_georef), m_output_georef(output_georef), 
-    m_tf(input_georef, output_georef), m_nodata_val(nodata_val), m_use_gcc_convert(false), m_debug_mode(debug_mode){//,
+    m_tf(input_georef, output_georef), m_nodata_val(nodata_val), m_use_gcc_convert(false),
+    m_debug_mode(debug_mode), m_interp_spacing(interp_spacing),
+    m_interp_tolerance(interp_tolerance) {//,
     //m_src_datum_proj(input_georef.overall_proj4_str ()), 
     //m_dst_datum_proj(output_georef.overall_proj4_str()) {
     
@@ -101,8 +114,12 @@ public:
     if ( m_input_dem(col, row) == m_nodata_val )
       return m_nodata_val;
 
-    // Compute the elevation in the output datum
-    double  current_height  = m_input_dem(col, row);
+    return output_height(col, row, m_input_dem(col, row));
+  }
+
+  /// The elevation in the output datum of the point at this pixel and height
+  double output_height(int col, int row, double current_height) const {
+
     Vector2 input_pixel(col, row);
     Vector2 input_lonlat    = m_input_georef.pixel_to_lonlat(input_pixel);
     Vector3 input_llh(input_lonlat[0], input_lonlat[1], current_height);
@@ -167,10 +184,115 @@ public:
   }
 
   /// \cond INTERNAL
-  typedef DatumConvertView<typename ImageT::prerasterize_type> prerasterize_type;
+  typedef CropView<ImageView<double>> prerasterize_type;
   inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
-    return prerasterize_type( m_input_dem.prerasterize(bbox), m_input_georef,
-                              m_output_georef, m_nodata_val, m_debug_mode);
+
+    // Only pixels in the image are read, even with edge extension
+    BBox2i box = bbox;
+    box.crop(bounding_box(m_input_dem));
+    ImageView<double> heights = crop(m_input_dem, box);
+    ImageView<double> tile(box.width(), box.height());
+    fill(tile, m_nodata_val);
+
+    int spacing = m_interp_spacing;
+    if (m_debug_mode || spacing <= 1) {
+      for (int row = 0; row < tile.rows(); row++)
+        for (int col = 0; col < tile.cols(); col++)
+          if (heights(col, row) != m_nodata_val)
+            tile(col, row) = output_height(col + box.min().x(), row + box.min().y(),
+                                           heights(col, row));
+      return prerasterize_type(tile, -box.min().x(), -box.min().y(), cols(), rows());
+    }
+
+    // Where the height is not known, the mean of the tile takes its place
+    double mean_height = 0.0;
+    int num_valid = 0;
+    for (int row = 0; row < heights.rows(); row++) {
+      for (int col = 0; col < heights.cols(); col++) {
+        if (heights(col, row) != m_nodata_val) {
+          mean_height += heights(col, row);
+          num_valid++;
+        }
+      }
+    }
+    if (num_valid == 0)
+      return prerasterize_type(tile, -box.min().x(), -box.min().y(), cols(), rows());
+    mean_height /= num_valid;
+
+    // Grid nodes, the last one on the last pixel
+    std::vector<int> node_cols, node_rows;
+    for (int col = 0; col < box.width() - 1; col += spacing)
+      node_cols.push_back(col);
+    node_cols.push_back(box.width() - 1);
+    for (int row = 0; row < box.height() - 1; row += spacing)
+      node_rows.push_back(row);
+    node_rows.push_back(box.height() - 1);
+
+    // The height change at the nodes
+    ImageView<double> node_change(node_cols.size(), node_rows.size());
+    for (int j = 0; j < node_change.rows(); j++) {
+      for (int i = 0; i < node_change.cols(); i++) {
+        int col = node_cols[i], row = node_rows[j];
+        double height = heights(col, row);
+        if (height == m_nodata_val)
+          height = mean_height;
+        node_change(i, j) = output_height(col + box.min().x(), row + box.min().y(), height)
+          - height;
+      }
+    }
+
+    // Interpolate in each cell, unless it is not accurate enough there
+    for (int j = 0; j + 1 < node_change.rows(); j++) {
+      int row0 = node_rows[j], row1 = node_rows[j + 1];
+      for (int i = 0; i + 1 < node_change.cols(); i++) {
+        int col0 = node_cols[i], col1 = node_cols[i + 1];
+
+        int last_col = (i + 2 == node_change.cols()) ? col1 : col1 - 1;
+        int last_row = (j + 2 == node_change.rows()) ? row1 : row1 - 1;
+
+        double c00 = node_change(i, j),     c10 = node_change(i + 1, j);
+        double c01 = node_change(i, j + 1), c11 = node_change(i + 1, j + 1);
+        double wx = 1.0 / std::max(col1 - col0, 1), wy = 1.0 / std::max(row1 - row0, 1);
+
+        // Check at the center of the cell
+        int mid_col = (col0 + col1) / 2, mid_row = (row0 + row1) / 2;
+        double mid_height = heights(mid_col, mid_row);
+        if (mid_height == m_nodata_val)
+          mid_height = mean_height;
+        double x = (mid_col - col0) * wx, y = (mid_row - row0) * wy;
+        double interp_change = (1 - y) * ((1 - x) * c00 + x * c10) + y * ((1 - x) * c01 + x * c11);
+        double exact_change = output_height(mid_col + box.min().x(), mid_row + box.min().y(),
+                                            mid_height) - mid_height;
+        bool exact = (std::abs(interp_change - exact_change) > m_interp_tolerance);
+
+        for (int row = row0; row <= last_row; row++) {
+          y = (row - row0) * wy;
+          for (int col = col0; col <= last_col; col++) {
+            double height = heights(col, row);
+            if (height == m_nodata_val)
+              continue;
+            if (exact) {
+              tile(col, row) = output_height(col + box.min().x(), row + box.min().y(), height);
+              continue;
+            }
+            x = (col - col0) * wx;
+            tile(col, row) = height + (1 - y) * ((1 - x) * c00 + x * c10)
+              + y * ((1 - x) * c01 + x * c11);
+          }
+        }
+      }
+    }
+
+    // A tile of one row or column has no cells
+    if (node_change.cols() == 1 || node_change.rows() == 1) {
+      for (int row = 0; row < tile.rows(); row++)
+        for (int col = 0; col < tile.cols(); col++)
+          if (heights(col, row) != m_nodata_val)
+            tile(col, row) = output_height(col + box.min().x(), row + box.min().y(),
+                                           heights(col, row));
+    }
+
+    return prerasterize_type(tile, -box.min().x(), -box.min().y(), cols(), rows());
   }
   template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
     vw::rasterize( prerasterize(bbox), dest, bbox );
@@ -185,8 +307,11 @@ datum_convert( ImageViewBase<ImageT> const& input_dem,
                GeoReference          const& input_georef,
                GeoReference          const& output_georef,
                double                       nodata_val,
-               bool                         debug_mode) {
-  return DatumConvertView<ImageT>(input_dem.impl(), input_georef, output_georef, nodata_val, debug_mode);
+               bool                         debug_mode,
+               int                          interp_spacing,
+               double                       interp_tolerance) {
+  return DatumConvertView<ImageT>(input_dem.impl(), input_georef, output_georef, nodata_val,
+                                  debug_mode, interp_spacing, interp_tolerance);
 }
 
 
@@ -219,13 +344,19 @@ BBox2 get_output_projected_bbox(GeoReference     const& input_georef,
 
   GeoTransform tf(input_georef, output_georef);
 
+  // Read the boundary rows and columns at once rather than pixel by pixel
+  ImageView<T> left_col  = crop(input_dem, BBox2i(0,          0, 1, num_rows));
+  ImageView<T> right_col = crop(input_dem, BBox2i(num_cols-1, 0, 1, num_rows));
+  ImageView<T> top_row   = crop(input_dem, BBox2i(0, 0,          num_cols, 1));
+  ImageView<T> bot_row   = crop(input_dem, BBox2i(0, num_rows-1, num_cols, 1));
+
   // Expand along sides
   BBox2 output_bbox;
   for (int r=0; r<num_rows; ++r) {
     Vector2 pixel_left (0,          r);
     Vector2 pixel_right(num_cols-1, r);
-    double height_left  = input_dem(pixel_left[0],  pixel_left[1]);
-    double height_right = input_dem(pixel_right[0], pixel_right[1]);
+    double height_left  = left_col (0, r);
+    double height_right = right_col(0, r);
 
     // Don't allow nodata elevation values to be used in computations.
     // - Would be more accurate to use a mean elevation or something 
@@ -241,8 +372,8 @@ BBox2 get_output_projected_bbox(GeoReference     const& input_georef,
   for (int c=1; c<num_cols-1; ++c) {
     Vector2 pixel_top(c, 0         );
     Vector2 pixel_bot(c, num_rows-1);
-    double height_top = input_dem(pixel_top[0], pixel_top[1]);
-    double height_bot = input_dem(pixel_bot[0], pixel_bot[1]);
+    double height_top = top_row(c, 0);
+    double height_bot = bot_row(c, 0);
 
     if (height_top <= nodata) height_top = 0;
     if (height_bot <= nodata) height_bot = 0;
@@ -256,7 +387,8 @@ BBox2 get_output_projected_bbox(GeoReference     const& input_georef,
 struct Options : vw::GdalWriteOptions {
   string input_dem, output_dem, output_datum, input_datum,
          target_srs_string, input_grid, output_info_string;
-  double nodata_value;
+  double nodata_value, interp_tolerance;
+  int    interp_spacing;
   bool   keep_bounds, use_double, debug_mode;
 };
 
@@ -275,6 +407,12 @@ void handle_arguments( int argc, char *argv[], Options& opt ){
      "Don't recompute the image boundary.  This can help reduce changes caused by interpolation.")
     ("nodata_value", po::value(&opt.nodata_value)->default_value(-32768),
      "The value of no-data pixels, unless specified in the DEM.")
+    ("interp-spacing", po::value(&opt.interp_spacing)->default_value(16),
+     "Find the height change exactly on a grid with this spacing, in pixels, and interpolate "
+     "it in between. Set to 1 to find it exactly at each pixel.")
+    ("interp-tolerance", po::value(&opt.interp_tolerance)->default_value(1e-4),
+     "If in a grid cell the interpolated height change is off by more than this, in meters, "
+     "find it exactly at each pixel of that cell instead. This is checked at the cell center.")
     ("debug-mode",  po::bool_switch(&opt.debug_mode)->default_value(false)->implicit_value(true),
      "Print conversion info for every pixel (to help verify output).")
     ("double", po::bool_switch(&opt.use_double)->default_value(false)->implicit_value(true),
@@ -308,6 +446,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ){
   if ( !opt.output_datum.empty() && !opt.target_srs_string.empty())
     vw_out(WarningMessage) << "Both the output datum and the PROJ.4 string were specified. The former takes precedence.\n";
 
+  if (opt.interp_tolerance < 0)
+    vw_throw( ArgumentErr() << "The value of --interp-tolerance must be non-negative.\n" );
+
   if (opt.debug_mode) {  // Debug output is unreadable with multiple threads.
     vw_out() << "Debug mode set, forcing thread count to 1.\n";
     opt.num_threads = 1;
@@ -461,10 +602,13 @@ void do_work(Options const& opt) {
   vw_out() << "Output georef:\n" << output_georef << std::endl;
 
   // Update the elevation values in the image to account for the new datum.
-  ImageViewRef<double> dem_new_heights = datum_convert(pixel_cast<double>(dem_img),
-                                                       dem_georef,
-                                                       output_working_georef,
-                                                       dem_nodata_val, opt.debug_mode);
+  // This is not wrapped in an ImageViewRef, so that the warping below
+  // asks for the heights a tile at a time.
+  auto dem_new_heights = datum_convert(pixel_cast<double>(dem_img),
+                                       dem_georef,
+                                       output_working_georef,
+                                       dem_nodata_val, opt.debug_mode,
+                                       opt.interp_spacing, opt.interp_tolerance);
 
   // Apply the horizontal warping to the image on account of the new datum.
   ImageViewRef<double> output_dem = apply_mask(geo_transform(create_mask(dem_new_heights,
@@ -56,37 +56,11 @@ class DemGeoidView : public ImageViewBase<DemGeoidView<ImageT> >
   double   m_correction;
   double   m_nodata_val;
 
-public:
-
-  typedef double pixel_type;
-  typedef double result_type;
-  typedef ProceduralPixelAccessor<DemGeoidView> pixel_accessor;
-
-
-  DemGeoidView(ImageT const& img, GeoReference const& georef,
-               bool is_egm2008, vector<double> const& egm2008_grid,
-               ImageViewRef<PixelMask<double> > const& geoid,
-               GeoReference const& geoid_georef, bool reverse_adjustment,
-               double correction, double nodata_val):
-    m_img(img), m_georef(georef),
-    m_is_egm2008(is_egm2008), m_egm2008_grid(egm2008_grid),
-    m_geoid(geoid), m_geoid_georef(geoid_georef),
-    m_reverse_adjustment(reverse_adjustment),
-    m_correction(correction),
-    m_nodata_val(nodata_val){}
-
-  inline int32 cols  () const { return m_img.cols(); }
-  inline int32 rows  () const { return m_img.rows(); }
-  inline int32 planes() const { return 1; }
+  // Find the geoid height at a DEM pixel, including the datum
+  // correction. Return false if the geoid has no data there.
+  bool find_geoid_height(Vector2 const& pix, double & geoid_height) const {
 
-  inline pixel_accessor origin() const { return pixel_accessor(*this); }
-
-  inline result_type operator()( size_t col, size_t row, size_t p=0 ) const {
-
-    if ( m_img(col, row, p) == m_nodata_val )
-      return m_nodata_val; // Skip invalid pixels
-
-    Vector2 lonlat = m_georef.pixel_to_lonlat(Vector2(col, row));
+    Vector2 lonlat = m_georef.pixel_to_lonlat(pix);
 
     // For testing (see the link to the reference web form belows).
     //lonlat[0] = -121;   lonlat[1] = 37;   // mainland US
@@ -111,9 +85,7 @@ public:
     while( lonlat[0] <   0.0  ) lonlat[0] += 360.0;
     while( lonlat[0] >= 360.0 ) lonlat[0] -= 360.0;
 
-
-
-    result_type geoid_height = 0.0;
+    geoid_height = 0.0;
     if (m_is_egm2008){
       int nr = m_geoid.rows(), 
           nc = m_geoid.cols();
@@ -122,32 +94,177 @@ public:
                            &lonlat[0], &lonlat[1], &geoid_height);
     }else{
       // Use our own interpolation into the geoid image
-      Vector2  pix = m_geoid_georef.lonlat_to_pixel(lonlat);
-      PixelMask<double> interp_val = m_geoid(pix[0], pix[1]);
+      Vector2  geoid_pix = m_geoid_georef.lonlat_to_pixel(lonlat);
+      PixelMask<double> interp_val = m_geoid(geoid_pix[0], geoid_pix[1]);
       if (!is_valid(interp_val))
-        return m_nodata_val;
+        return false;
       geoid_height = interp_val.child();
     }
 
     geoid_height += m_correction;
+    return true;
+  }
 
-    result_type height_above_ellipsoid = m_img(col, row, p);
-
-    // Compute height above the geoid
-    // - See the note in the main program about the formula below
+  // Compute height above the geoid
+  // - See the note in the main program about the formula below
+  double adjust(double height_above_ellipsoid, double geoid_height) const {
     if (m_reverse_adjustment)
       return height_above_ellipsoid + geoid_height;
     else
       return height_above_ellipsoid - geoid_height;
   }
 
+  // How many DEM pixels apart the geoid grid nodes in a tile can be. They
+  // are kept within 1/8 of a geoid pixel, so the error of bilinear
+  // interpolation is at most 1/512 of the second difference of the geoid
+  // over one of its pixels, which is well under a millimeter.
+  int grid_spacing(BBox2i const& bbox) const {
+    const int max_spacing = 64;
+    try {
+      Vector2 ctr = (bbox.min() + bbox.max()) / 2;
+      Vector2 g0  = m_geoid_georef.lonlat_to_pixel(m_georef.pixel_to_lonlat(ctr));
+      Vector2 gx  = m_geoid_georef.lonlat_to_pixel(m_georef.pixel_to_lonlat(ctr + Vector2(1, 0)));
+      Vector2 gy  = m_geoid_georef.lonlat_to_pixel(m_georef.pixel_to_lonlat(ctr + Vector2(0, 1)));
+      double step = std::max(norm_2(gx - g0), norm_2(gy - g0)); // geoid pixels per DEM pixel
+      if (!(step > 0.0))
+        return 1;
+      return std::max(1, std::min(max_spacing, int(floor(1.0 / (8.0 * step)))));
+    } catch (...) {
+      // Pixels outside the domain of the projection
+      return 1;
+    }
+  }
+
+  // The grid nodes along a tile dimension. The last one is at its last pixel.
+  static void grid_nodes(int len, int spacing, vector<int> & nodes) {
+    nodes.clear();
+    for (int i = 0; i < len - 1; i += spacing)
+      nodes.push_back(i);
+    nodes.push_back(std::max(len - 1, 0));
+  }
+
+  // For each pixel, the grid cell it is in, and the weight of the node after it
+  static void find_cells(vector<int> const& nodes, int len,
+                         vector<int> & cell, vector<double> & weight) {
+    int k = 0, num = nodes.size();
+    for (int i = 0; i < len; i++) {
+      while (k + 2 < num && nodes[k + 1] <= i)
+        k++;
+      cell[i] = k;
+      int width = (k + 1 < num) ? (nodes[k + 1] - nodes[k]) : 0;
+      weight[i] = (width > 0) ? double(i - nodes[k]) / width : 0.0;
+    }
+  }
+
+public:
+
+  typedef double pixel_type;
+  typedef double result_type;
+  typedef ProceduralPixelAccessor<DemGeoidView> pixel_accessor;
+
+
+  DemGeoidView(ImageT const& img, GeoReference const& georef,
+               bool is_egm2008, vector<double> const& egm2008_grid,
+               ImageViewRef<PixelMask<double> > const& geoid,
+               GeoReference const& geoid_georef, bool reverse_adjustment,
+               double correction, double nodata_val):
+    m_img(img), m_georef(georef),
+    m_is_egm2008(is_egm2008), m_egm2008_grid(egm2008_grid),
+    m_geoid(geoid), m_geoid_georef(geoid_georef),
+    m_reverse_adjustment(reverse_adjustment),
+    m_correction(correction),
+    m_nodata_val(nodata_val){}
+
+  inline int32 cols  () const { return m_img.cols(); }
+  inline int32 rows  () const { return m_img.rows(); }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor(*this); }
+
+  inline result_type operator()( size_t col, size_t row, size_t p=0 ) const {
+
+    if ( m_img(col, row, p) == m_nodata_val )
+      return m_nodata_val; // Skip invalid pixels
+
+    double geoid_height = 0.0;
+    if (!find_geoid_height(Vector2(col, row), geoid_height))
+      return m_nodata_val;
+
+    return adjust(m_img(col, row, p), geoid_height);
+  }
+
   /// \cond INTERNAL
-  typedef DemGeoidView<typename ImageT::prerasterize_type> prerasterize_type;
+  // The geoid is smooth, so in each tile it is found exactly only on a
+  // coarse grid of pixels, and bilinearly interpolated in between.
+  typedef CropView<ImageView<result_type> > prerasterize_type;
   inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
-    return prerasterize_type( m_img.prerasterize(bbox), m_georef,
-                              m_is_egm2008, m_egm2008_grid,
-                              m_geoid, m_geoid_georef, m_reverse_adjustment,
-                              m_correction, m_nodata_val );
+
+    ImageView<double> dem = crop(m_img, bbox);
+    ImageView<result_type> tile(bbox.width(), bbox.height());
+
+    int spacing = grid_spacing(bbox);
+    vector<int> node_cols, node_rows;
+    grid_nodes(bbox.width(),  spacing, node_cols);
+    grid_nodes(bbox.height(), spacing, node_rows);
+    int num_node_cols = node_cols.size(), num_node_rows = node_rows.size();
+
+    ImageView<double> nodes(num_node_cols, num_node_rows);
+    ImageView<uint8>  valid_nodes(num_node_cols, num_node_rows);
+    for (int r = 0; r < num_node_rows; r++) {
+      for (int c = 0; c < num_node_cols; c++) {
+        Vector2 pix(bbox.min().x() + node_cols[c], bbox.min().y() + node_rows[r]);
+        valid_nodes(c, r) = find_geoid_height(pix, nodes(c, r));
+      }
+    }
+
+    // For each pixel column, the grid cell it is in, and the weight of the
+    // node to the right of it
+    vector<int>    cell_col(bbox.width());
+    vector<double> wx(bbox.width());
+    find_cells(node_cols, bbox.width(), cell_col, wx);
+    vector<int>    cell_row(bbox.height());
+    vector<double> wy(bbox.height());
+    find_cells(node_rows, bbox.height(), cell_row, wy);
+
+    vector<double> row_nodes(num_node_cols);
+    vector<uint8>  valid_row_nodes(num_node_cols);
+    vector<double> heights(bbox.width());
+    vector<uint8>  valid_heights(bbox.width());
+    for (int row = 0; row < bbox.height(); row++) {
+
+      // Interpolate the grid vertically at this row
+      int r0 = cell_row[row], r1 = std::min(r0 + 1, num_node_rows - 1);
+      double w = wy[row];
+      for (int c = 0; c < num_node_cols; c++) {
+        row_nodes[c] = nodes(c, r0) + w * (nodes(c, r1) - nodes(c, r0));
+        valid_row_nodes[c] = valid_nodes(c, r0) && valid_nodes(c, r1);
+      }
+
+      // Then horizontally. Near where the geoid has no data, find it exactly.
+      for (int col = 0; col < bbox.width(); col++) {
+        int c0 = cell_col[col], c1 = std::min(c0 + 1, num_node_cols - 1);
+        heights[col] = row_nodes[c0] + wx[col] * (row_nodes[c1] - row_nodes[c0]);
+        valid_heights[col] = valid_row_nodes[c0] && valid_row_nodes[c1];
+      }
+
+      for (int col = 0; col < bbox.width(); col++) {
+        double val = dem(col, row);
+        if (val == m_nodata_val) {
+          tile(col, row) = m_nodata_val;
+          continue;
+        }
+        double geoid_height = heights[col];
+        if (!valid_heights[col] &&
+            !find_geoid_height(Vector2(bbox.min().x() + col, bbox.min().y() + row),
+                               geoid_height)) {
+          tile(col, row) = m_nodata_val;
+          continue;
+        }
+        tile(col, row) = adjust(val, geoid_height);
+      }
+    }
+
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
   }
   template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
     vw::rasterize( prerasterize(bbox), dest, bbox );
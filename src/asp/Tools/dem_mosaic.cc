@@ -40,6 +40,13 @@
 #include <time.h>
 #include <limits>
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <iterator>
+#include <map>
+#include <set>
+#include <thread>
 
 #include <vw/FileIO/DiskImageManager.h>
 #include <vw/Image/InpaintView.h>
@@ -48,6 +55,9 @@
 #include <vw/Cartography/GeoTransform.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/Hash.h>
+#include <asp/Core/MortonCode.h>
+#include <asp/Core/Tracing.h>
 
 
 #include <boost/math/special_functions/fpclassify.hpp>
@@ -55,12 +65,19 @@
 #include <boost/program_options.hpp>
 
 #include <boost/filesystem/convenience.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/geometry.hpp>
+#include <boost/geometry/index/rtree.hpp>
+
+#include <gdal.h>
 
 using namespace std;
 using namespace vw;
 using namespace vw::cartography;
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
+namespace bg = boost::geometry;
+namespace bgi = boost::geometry::index;
 
 // This tool casts all input DEMs to float. The processing is done in double
 // precision though. 
@@ -323,30 +340,36 @@ struct Options: vw::GdalWriteOptions {
   bool   has_out_nodata, force_projwin;
   double out_nodata_value;
   int    tile_size, tile_index, erode_len, priority_blending_len,
-         extra_crop_len, hole_fill_len, block_size, save_dem_weight;
+         extra_crop_len, hole_fill_len, block_size, save_dem_weight,
+         median_sketch_size;
   double weights_exp, weights_blur_sigma, dem_blur_sigma;
   double nodata_threshold;
   bool   first, last, min, max, block_max, mean, stddev, median, nmad,
     count, tap, save_index_map, use_centerline_weights,
-         first_dem_as_reference, propagate_nodata, no_border_blend;
+         first_dem_as_reference, propagate_nodata, no_border_blend, cog, update,
+         query_tiles, trend;
   std::set<int> tile_list;
+  std::string weights_cache_dir, dem_times_file;
+  std::vector<double> dem_times; // one per input DEM, for --trend
   BBox2 projwin;
   Options(): tr(0), geo_tile_size(0), has_out_nodata(false), force_projwin(false), tile_index(-1),
              erode_len(0), priority_blending_len(0), extra_crop_len(0),
-             hole_fill_len(0), block_size(0), save_dem_weight(-1), 
+             hole_fill_len(0), block_size(0), save_dem_weight(-1), median_sketch_size(0),
              weights_exp(0), weights_blur_sigma(0.0), dem_blur_sigma(0.0),
              nodata_threshold(std::numeric_limits<double>::quiet_NaN()),
              first(false), last(false), min(false), max(false), block_max(false),
              mean(false), stddev(false), median(false), nmad(false),
              count(false), save_index_map(false), tap(false),
-             use_centerline_weights(false), first_dem_as_reference(false), projwin(BBox2()) {}
+             use_centerline_weights(false), first_dem_as_reference(false), cog(false), update(false),
+             query_tiles(false), trend(false),
+             projwin(BBox2()) {}
 };
 
 /// Return the number of no-blending options selected.
 int no_blend(Options const& opt){
   return int(opt.first) + int(opt.last) + int(opt.min) + int(opt.max)
     + int(opt.mean) + int(opt.stddev) + int(opt.median)
-    + int(opt.nmad) + int(opt.count) + int(opt.block_max);
+    + int(opt.nmad) + int(opt.count) + int(opt.block_max) + int(opt.trend);
 }
 
 std::string tile_suffix(Options const& opt){
@@ -361,12 +384,508 @@ std::string tile_suffix(Options const& opt){
   if (opt.median) ans    = "-median";
   if (opt.nmad) ans      = "-nmad";
   if (opt.count) ans     = "-count";
+  if (opt.trend) ans     = "-trend";
   if (opt.save_index_map)       ans += "-index-map";
   if (opt.save_dem_weight >= 0) ans += "-weight-dem-index-" + stringify(opt.save_dem_weight);
 
   return ans;
 }
 
+// An R-tree of boxes, each with its index in the list of boxes. This way
+// finding the input DEMs overlapping an output tile, or the other way
+// around, does not need a scan over all of them.
+typedef bg::model::point<double, 2, bg::cs::cartesian> IndexPoint;
+typedef bg::model::box<IndexPoint>                     IndexBox;
+typedef std::pair<IndexBox, int>                       IndexValue;
+typedef bgi::rtree<IndexValue, bgi::rstar<16>>         BoxIndex;
+
+IndexBox to_index_box(BBox2 const& box) {
+  return IndexBox(IndexPoint(box.min().x(), box.min().y()),
+                  IndexPoint(box.max().x(), box.max().y()));
+}
+
+/// Build the index of the given boxes. Empty boxes are left out.
+void build_box_index(std::vector<BBox2> const& boxes, BoxIndex & index) {
+  std::vector<IndexValue> values;
+  for (size_t i = 0; i < boxes.size(); i++) {
+    if (!boxes[i].empty())
+      values.push_back(IndexValue(to_index_box(boxes[i]), i));
+  }
+  index = BoxIndex(values.begin(), values.end()); // bulk loading
+}
+
+/// The indices of the boxes which intersect or touch the given box, in
+/// increasing order, as blending depends on the order of the inputs.
+void query_box_index(BoxIndex const& index, BBox2 const& box, std::vector<int> & ids) {
+  std::vector<IndexValue> values;
+  index.query(bgi::intersects(to_index_box(box)), std::back_inserter(values));
+  ids.resize(values.size());
+  for (size_t i = 0; i < values.size(); i++)
+    ids[i] = values[i].second;
+  std::sort(ids.begin(), ids.end());
+}
+
+/// Invalidate the DEM values no more than --nodata-threshold, if that
+/// is set. Return the no-data value to use for this DEM.
+double apply_nodata_threshold(Options const& opt, double nodata_value,
+                              ImageView<PixelGrayA<double>> & dem) {
+  if (boost::math::isnan(opt.nodata_threshold))
+    return nodata_value;
+  nodata_value = opt.nodata_threshold;
+  for (int col = 0; col < dem.cols(); col++) {
+    for (int row = 0; row < dem.rows(); row++) {
+      if (dem(col, row)[0] <= nodata_value) {
+        dem(col, row)[0] = nodata_value;
+      }
+    }
+  }
+  return nodata_value;
+}
+
+/// Fill holes in the DEM and blur it, if requested
+void fill_and_blur_dem(Options const& opt, double nodata_value,
+                       ImageView<PixelGrayA<double>> & dem) {
+
+  if (opt.hole_fill_len > 0){
+    dem = apply_mask(vw::fill_holes_grass
+                     (create_mask(select_channel(dem, 0), nodata_value),
+                      opt.hole_fill_len),
+                     nodata_value);
+  }
+
+  // Fill-in no-data values a bit and blur. If just the blurring is used,
+  // it will choke on no-data values, leaving large holes around each,
+  // hence the need to fill a little.
+  if (opt.dem_blur_sigma > 0.0) {
+    int kernel_size = vw::compute_kernel_size(opt.dem_blur_sigma);
+    dem = apply_mask(gaussian_filter(fill_nodata_with_avg
+                                     (create_mask(select_channel(dem, 0), nodata_value),
+                                      kernel_size),
+                                     opt.dem_blur_sigma),
+                     nodata_value);
+  }
+}
+
+/// The blending weights of a region of a DEM. They grow from the DEM
+/// boundary, are capped at the bias, then eroded, blurred, and raised to
+/// a power, as set by the options.
+void compute_dem_weights(Options const& opt, int bias, bool use_priority_blend,
+                         double nodata_value, ImageView<PixelGrayA<double>> const& dem,
+                         ImageView<double> & local_wts) {
+  typedef PixelGrayA<double> DoubleGrayA;
+
+  // Compute linear weights
+  local_wts = grassfire(notnodata(select_channel(dem, 0), nodata_value),
+                        opt.no_border_blend);
+  if (opt.use_centerline_weights) {
+    // Erode based on grassfire weights, and then overwrite the grassfire
+    // weights with centerline weights
+    ImageView<DoubleGrayA> dem2 = copy(dem);
+    for (int col = 0; col < dem2.cols(); col++) {
+      for (int row = 0; row < dem2.rows(); row++) {
+        if (local_wts(col, row) <= opt.erode_len) {
+          dem2(col, row) = DoubleGrayA(nodata_value);
+        }
+      }
+    }
+    // TODO: Generalize this modification and move it to VW!!!
+    centerline_weights2
+            (create_mask_less_or_equal(select_channel(dem2, 0), nodata_value),
+             local_wts, -1.0);
+  } // End centerline weights case
+
+  // If we don't limit the weights from above, we will have tiling artifacts,
+  // as in different tiles the weights grow to different heights since
+  // they are cropped to different regions. For priority blending length,
+  // we'll do this process later, as the bbox is obtained differently in that case.
+  if (!use_priority_blend) {
+    for (int col = 0; col < local_wts.cols(); col++) {
+      for (int row = 0; row < local_wts.rows(); row++) {
+        local_wts(col, row) = std::min(local_wts(col, row), double(bias));
+      }
+    }
+  }
+
+  // Erode. We already did that if centerline weights are used.
+  if (!opt.use_centerline_weights){
+    int max_cutoff = max_pixel_value(local_wts);
+    int min_cutoff = opt.erode_len;
+    if (max_cutoff <= min_cutoff)
+      max_cutoff = min_cutoff + 1; // precaution
+    local_wts = clamp(local_wts - min_cutoff, 0.0, max_cutoff - min_cutoff);
+  }
+  
+  // Blur the weights. If priority blending length is on, we'll do the blur later,
+  // after weights from different DEMs are combined.
+  if (opt.weights_blur_sigma > 0 && !use_priority_blend)
+    blur_weights(local_wts, opt.weights_blur_sigma);
+
+  // Raise to the power. Note that when priority blending length is positive, we
+  // delay this process.
+  if (opt.weights_exp != 1 && !use_priority_blend) {
+    for (int col = 0; col < dem.cols(); col++){
+      for (int row = 0; row < dem.rows(); row++){
+        if (local_wts(col, row) > 0)
+          local_wts(col, row) = pow(local_wts(col, row), opt.weights_exp);
+      }
+    }
+  }
+}
+
+/// The blending weights of a whole DEM, as computed for each tile of
+/// the mosaic. Each block is processed with the same margin as a tile,
+/// so the weights, which are capped at the bias, come out the same.
+class DemWeightsView: public ImageViewBase<DemWeightsView>{
+  ImageViewRef<RealT> m_dem;
+  Options     const&  m_opt;   // alias
+  int                 m_bias;
+  double              m_nodata_value;
+
+public:
+  DemWeightsView(ImageViewRef<RealT> dem, Options const& opt, int bias,
+                 double nodata_value):
+    m_dem(dem), m_opt(opt), m_bias(bias), m_nodata_value(nodata_value) {}
+
+  typedef float      pixel_type;
+  typedef pixel_type result_type;
+  typedef ProceduralPixelAccessor<DemWeightsView> pixel_accessor;
+  inline int cols  () const { return m_dem.cols(); }
+  inline int rows  () const { return m_dem.rows(); }
+  inline int planes() const { return 1; }
+  inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+  inline pixel_type operator()(double/*i*/, double/*j*/, int/*p*/ = 0) const {
+    vw_throw(NoImplErr() << "DemWeightsView::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i bbox) const {
+
+    typedef PixelGrayA<double> DoubleGrayA;
+    BBox2i in_box = bbox;
+    in_box.expand(m_bias + BilinearInterpolation::pixel_buffer + 1);
+    in_box.crop(bounding_box(m_dem));
+
+    ImageView<DoubleGrayA> dem = crop(pixel_cast<double>(m_dem), in_box);
+    double nodata_value = apply_nodata_threshold(m_opt, m_nodata_value, dem);
+    fill_and_blur_dem(m_opt, nodata_value, dem);
+    ImageView<double> local_wts;
+    bool use_priority_blend = false;
+    compute_dem_weights(m_opt, m_bias, use_priority_blend, nodata_value, dem, local_wts);
+
+    ImageView<pixel_type> tile = pixel_cast<pixel_type>(crop(local_wts, bbox - in_box.min()));
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+}; // End class DemWeightsView
+
+/// If the weights of the input DEMs can be saved and reused
+bool can_cache_weights(Options const& opt) {
+  return !opt.weights_cache_dir.empty() && no_blend(opt) == 0 &&
+    !opt.use_centerline_weights && opt.priority_blending_len <= 0;
+}
+
+/// The file with the cached weights of a DEM. Its name has a hash of
+/// everything the weights depend on, so a stale file is never used.
+std::string weights_cache_file(Options const& opt, int bias, double nodata_value,
+                               std::string const& dem_file) {
+
+  std::ostringstream os;
+  os.precision(17);
+  os << fs::absolute(dem_file).string() << " " << fs::file_size(dem_file) << " "
+     << fs::last_write_time(dem_file) << " " << bias << " " << opt.erode_len << " "
+     << opt.weights_blur_sigma << " " << opt.weights_exp << " " << opt.hole_fill_len << " "
+     << opt.dem_blur_sigma << " " << opt.nodata_threshold << " " << nodata_value << " "
+     << opt.no_border_blend;
+
+  return opt.weights_cache_dir + "/" + fs::path(dem_file).stem().string() + "-"
+    + asp::hash_to_hex(asp::hash_string(os.str())) + ".tif";
+}
+
+/// Compute and save the weights of the given DEM, unless already cached.
+/// Use blocks of the same size as the mosaic tiles, as the overhead of
+/// the margin is the same.
+void write_weights_cache(Options const& opt, int bias, int block_size, double nodata_value,
+                         std::string const& dem_file, std::string const& cache_file) {
+
+  if (fs::exists(cache_file))
+    return;
+
+  // Write to a temporary file first, so that an interrupted run
+  // does not leave behind an incomplete cache file.
+  std::string tmp_file = cache_file + ".tmp" + stringify(getpid()) + ".tif";
+  vw_out() << "Writing: " << cache_file << std::endl;
+  DiskImageView<RealT> dem(dem_file);
+  GeoReference georef = read_georef(dem_file);
+  bool has_georef = true, has_nodata = false; // weights may be negative
+  vw::GdalWriteOptions write_opt = opt;
+  write_opt.raster_tile_size = Vector2i(block_size, block_size);
+  block_write_gdal_image(tmp_file, DemWeightsView(dem, opt, bias, nodata_value),
+                         has_georef, georef, has_nodata, 0, write_opt,
+                         TerminalProgressCallback("asp", "	--> "));
+  fs::rename(tmp_file, cache_file);
+}
+
+/// A summary of bounded size of the values at each pixel of a tile, used
+/// for --median and --nmad with --median-sketch-size. Up to that many
+/// values per pixel are kept. When a pixel has more, the two neighboring
+/// values (in sorted order) with the smallest total weight are replaced by
+/// their weighted mean, as for the centroids of a t-digest. This keeps
+/// the weights balanced across the range, so the median is well resolved,
+/// and the memory does not grow with the number of overlapping DEMs. The
+/// median and NMAD are exact for pixels with no more values than the
+/// sketch size, and approximate otherwise.
+class QuantileSketch {
+public:
+  QuantileSketch(int num_pixels, int size):
+    m_size(size), m_samples(size_t(num_pixels) * size),
+    m_count(num_pixels, 0), m_merged(num_pixels, 0) {}
+
+  void add(int pixel, double val) {
+    Sample * samples = &m_samples[size_t(pixel) * m_size];
+    std::uint16_t & count = m_count[pixel];
+    if (count == m_size) {
+      // Replace the two neighbors with the smallest total weight by
+      // their weighted mean
+      std::sort(samples, samples + count);
+      int best = 0;
+      for (int i = 1; i + 1 < count; i++) {
+        if (samples[i].weight + samples[i + 1].weight <
+            samples[best].weight + samples[best + 1].weight)
+          best = i;
+      }
+      Sample & a = samples[best];
+      Sample const& b = samples[best + 1];
+      double w = double(a.weight) + double(b.weight);
+      a.val    = (double(a.val) * a.weight + double(b.val) * b.weight) / w;
+      a.weight = a.weight + b.weight;
+      for (int i = best + 1; i + 1 < count; i++)
+        samples[i] = samples[i + 1];
+      count--;
+      m_merged[pixel]++;
+    }
+    samples[count].val    = val;
+    samples[count].weight = 1;
+    count++;
+  }
+
+  /// Return false if the pixel has no values
+  bool median(int pixel, double & val, std::vector<double> & work) const {
+    if (m_count[pixel] == 0)
+      return false;
+    if (m_merged[pixel] == 0) {
+      copy_values(pixel, work);
+      val = math::destructive_median(work);
+      return true;
+    }
+    std::vector<Sample> samples(begin(pixel), begin(pixel) + m_count[pixel]);
+    val = weighted_median(samples);
+    return true;
+  }
+
+  /// Return false if the pixel has no values
+  bool nmad(int pixel, double & val, std::vector<double> & work) const {
+    if (m_count[pixel] == 0)
+      return false;
+    if (m_merged[pixel] == 0) {
+      copy_values(pixel, work);
+      val = math::destructive_nmad(work);
+      return true;
+    }
+    std::vector<Sample> samples(begin(pixel), begin(pixel) + m_count[pixel]);
+    double med = weighted_median(samples);
+    for (size_t i = 0; i < samples.size(); i++)
+      samples[i].val = std::abs(samples[i].val - med);
+    val = 1.4826 * weighted_median(samples);
+    return true;
+  }
+
+private:
+  // The DEMs are read as float, so that is enough for the values
+  struct Sample {
+    float         val;
+    std::uint32_t weight;
+    bool operator<(Sample const& rhs) const { return val < rhs.val; }
+  };
+
+  const Sample * begin(int pixel) const { return &m_samples[size_t(pixel) * m_size]; }
+
+  void copy_values(int pixel, std::vector<double> & work) const {
+    const Sample * samples = begin(pixel);
+    work.resize(m_count[pixel]);
+    for (int i = 0; i < m_count[pixel]; i++)
+      work[i] = samples[i].val;
+  }
+
+  // The value at half the total weight. If that falls between two
+  // samples, return their average, as for the usual median.
+  static double weighted_median(std::vector<Sample> & samples) {
+    std::sort(samples.begin(), samples.end());
+    double total = 0;
+    for (size_t i = 0; i < samples.size(); i++)
+      total += samples[i].weight;
+    double sum = 0;
+    for (size_t i = 0; i < samples.size(); i++) {
+      sum += samples[i].weight;
+      if (sum == total / 2.0 && i + 1 < samples.size())
+        return (double(samples[i].val) + double(samples[i + 1].val)) / 2.0;
+      if (sum > total / 2.0)
+        return samples[i].val;
+    }
+    return samples.back().val;
+  }
+
+  int m_size;
+  std::vector<Sample>        m_samples; // m_size per pixel
+  std::vector<std::uint16_t> m_count;   // how many samples each pixel has
+  std::vector<std::uint32_t> m_merged;  // how many merges were done for a pixel
+};
+
+/// The input DEM pixels of the output pixels in a box, from the exact
+/// transform at the nodes of a coarse lattice, and bilinear
+/// interpolation in between. That is much cheaper than a PROJ call per
+/// pixel when the input and output projections differ. Each cell is
+/// checked against the exact transform at its center and edge
+/// midpoints, where the error of bilinear interpolation is largest,
+/// and cells where it is more than the tolerance use the exact
+/// transform. When the projections are the same, the transform is
+/// affine, and the lattice is exact.
+class ReprojectionLattice {
+public:
+  ReprojectionLattice(GeoTransform const& geotrans, BBox2i const& box,
+                      int spacing, double tol):
+    m_geotrans(geotrans), m_box(box), m_spacing(spacing),
+    m_num_x((box.width()  + spacing - 1)/spacing),
+    m_num_y((box.height() + spacing - 1)/spacing) {
+
+    m_nodes.resize((m_num_x + 1)*(m_num_y + 1));
+    for (int j = 0; j <= m_num_y; j++) {
+      for (int i = 0; i <= m_num_x; i++)
+        m_nodes[j*(m_num_x + 1) + i] = exact(i*m_spacing, j*m_spacing);
+    }
+
+    // The points where the error is checked, as fractions of a cell
+    const double check[][2] = {{0.5, 0.5}, {0.5, 0.0}, {0.0, 0.5}, {0.5, 1.0}, {1.0, 0.5}};
+    m_exact.resize(m_num_x*m_num_y, 0);
+    for (int j = 0; j < m_num_y; j++) {
+      for (int i = 0; i < m_num_x; i++) {
+        for (size_t k = 0; k < sizeof(check)/sizeof(check[0]); k++) {
+          double c = (i + check[k][0])*m_spacing, r = (j + check[k][1])*m_spacing;
+          Vector2 diff = interp(i, j, check[k][0], check[k][1]) - exact(c, r);
+          if (!(norm_2(diff) <= tol)) { // also catches NaN
+            m_exact[j*m_num_x + i] = 1;
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  /// The input pixel for the output pixel (c, r), relative to the box corner
+  Vector2 reverse(int c, int r) const {
+    int i = c/m_spacing, j = r/m_spacing;
+    if (m_exact[j*m_num_x + i])
+      return exact(c, r);
+    return interp(i, j, double(c - i*m_spacing)/m_spacing, double(r - j*m_spacing)/m_spacing);
+  }
+
+private:
+  Vector2 exact(double c, double r) const {
+    return m_geotrans.reverse(Vector2(c + m_box.min().x(), r + m_box.min().y()));
+  }
+
+  Vector2 interp(int i, int j, double fx, double fy) const {
+    int n = m_num_x + 1;
+    Vector2 const& p00 = m_nodes[j*n + i];
+    Vector2 const& p10 = m_nodes[j*n + i + 1];
+    Vector2 const& p01 = m_nodes[(j + 1)*n + i];
+    Vector2 const& p11 = m_nodes[(j + 1)*n + i + 1];
+    return (1.0 - fy)*((1.0 - fx)*p00 + fx*p10) + fy*((1.0 - fx)*p01 + fx*p11);
+  }
+
+  GeoTransform const& m_geotrans; // alias
+  BBox2i m_box;
+  int m_spacing, m_num_x, m_num_y;
+  std::vector<Vector2> m_nodes;   // row-major
+  std::vector<std::uint8_t> m_exact; // per cell, row-major
+};
+
+// The spacing, in output pixels, of the lattice above, and how far, in
+// input pixels, the interpolated locations may be from the exact ones.
+const int    g_lattice_spacing = 32;
+const double g_lattice_tol     = 1e-3;
+
+// The bands of the --trend output
+enum TrendBand {TREND_RATE = 0, TREND_INTERCEPT, TREND_RMS, TREND_COUNT, NUM_TREND_BANDS};
+typedef Vector<RealT, NUM_TREND_BANDS> TrendPixel;
+
+/// Fit z = intercept + rate * t with iteratively reweighted least
+/// squares and Huber weights, so that a few blunders among the DEMs
+/// do not pull the line. The residual scale is found from the median
+/// absolute residual. The RMS is of the residuals of all samples.
+/// Return false if there are fewer than two distinct times.
+bool robust_linear_fit(std::vector<double> const& t, std::vector<double> const& z,
+                       std::vector<double> & w, std::vector<double> & work,
+                       double & rate, double & intercept, double & rms) {
+
+  const int    num_iter = 10;
+  const double huber_k  = 1.345; // in units of the residual scale
+  int n = t.size();
+  rate = 0.0; intercept = 0.0; rms = 0.0;
+  w.assign(n, 1.0);
+  work.resize(n);
+
+  for (int iter = 0; iter < num_iter; iter++) {
+
+    // Weighted least squares, centered at the weighted mean time
+    double sw = 0.0, st = 0.0, sz = 0.0;
+    for (int i = 0; i < n; i++) {
+      sw += w[i];
+      st += w[i]*t[i];
+      sz += w[i]*z[i];
+    }
+    double tm = st/sw, zm = sz/sw, stt = 0.0, stz = 0.0;
+    for (int i = 0; i < n; i++) {
+      double dt = t[i] - tm;
+      stt += w[i]*dt*dt;
+      stz += w[i]*dt*(z[i] - zm);
+    }
+    if (stt <= 0.0)
+      return false;
+
+    double prev_rate = rate, prev_intercept = intercept;
+    rate      = stz/stt;
+    intercept = zm - rate*tm;
+    if (n == 2 ||
+        (iter > 0 && std::abs(rate - prev_rate) <= 1e-8*(1.0 + std::abs(rate)) &&
+         std::abs(intercept - prev_intercept) <= 1e-8*(1.0 + std::abs(intercept))))
+      break;
+
+    for (int i = 0; i < n; i++)
+      work[i] = std::abs(z[i] - intercept - rate*t[i]);
+    double k = huber_k * 1.4826 * math::destructive_median(work);
+    if (k <= 0.0)
+      break; // most samples are on the line
+    for (int i = 0; i < n; i++) {
+      double r = std::abs(z[i] - intercept - rate*t[i]);
+      w[i] = (r <= k) ? 1.0 : k/r;
+    }
+  }
+
+  for (int i = 0; i < n; i++) {
+    double r = z[i] - intercept - rate*t[i];
+    rms += r*r;
+  }
+  rms = sqrt(rms/n);
+
+  return true;
+}
+
 /// Class that does the actual image processing work
 class DemMosaicView: public ImageViewBase<DemMosaicView>{
   int m_cols, m_rows, m_bias;
@@ -376,6 +895,8 @@ class DemMosaicView: public ImageViewBase<DemMosaicView>{
   GeoReference                   m_out_georef;
   vector<double>          const& m_nodata_values;    // alias
   vector<BBox2i>          const& m_dem_pixel_bboxes; // alias
+  BoxIndex                const& m_dem_index;        // alias, footprints in output pixels
+  DiskImageManager<RealT>      * m_weightMgr;        // cached weights, if not NULL
   long long int                & m_num_valid_pixels; // alias, to populate on output
   vw::Mutex                    & m_count_mutex;      // alias, a lock for m_num_valid_pixels
 
@@ -387,12 +908,15 @@ public:
                 GeoReference           const& out_georef,
                 vector<double>         const& nodata_values,
                 vector<BBox2i>         const& dem_pixel_bboxes,
+                BoxIndex               const& dem_index,
+                DiskImageManager<RealT>     * weightMgr,
                 long long int               & num_valid_pixels,
                 vw::Mutex                   & count_mutex):
     m_cols(cols), m_rows(rows), m_bias(bias), m_opt(opt),
     m_imgMgr(imgMgr), m_georefs(georefs),
     m_out_georef(out_georef), m_nodata_values(nodata_values),
-    m_dem_pixel_bboxes(dem_pixel_bboxes), m_num_valid_pixels(num_valid_pixels),
+    m_dem_pixel_bboxes(dem_pixel_bboxes), m_dem_index(dem_index),
+    m_weightMgr(weightMgr), m_num_valid_pixels(num_valid_pixels),
     m_count_mutex(count_mutex) {
 
     // How many valid pixels we will have
@@ -446,6 +970,25 @@ public:
 
   typedef CropView<ImageView<pixel_type> > prerasterize_type;
   inline prerasterize_type prerasterize(BBox2i bbox) const {
+    asp::TraceSpan span("dem_mosaic_tile", bbox);
+    // So far we operated on doubles, here we cast to RealT.
+    ImageView<double> tile = compute_tile(bbox, NULL);
+    // Return the tile we created with fake borders to make it look
+    // the size of the entire output image.
+    return prerasterize_type(pixel_cast<RealT>(tile),
+                             -bbox.min().x(), -bbox.min().y(),
+                             cols(), rows());
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+
+  /// Mosaic the given box. The box is grown if the work needs
+  /// padding. With --trend, the returned tile has the count of samples,
+  /// and the fitted bands are saved in 'trend', if not NULL.
+  ImageView<double> compute_tile(BBox2i & bbox, ImageView<TrendPixel> * trend) const {
 
     BBox2i orig_box = bbox;
 
@@ -458,6 +1001,11 @@ public:
     if (use_priority_blend)
       bbox.expand(m_bias + BilinearInterpolation::pixel_buffer + 1);
 
+    // The input DEMs which may overlap with this tile. The footprints
+    // are grown enough that the others are certain to be skipped below.
+    std::vector<int> dem_ids;
+    query_box_index(m_dem_index, BBox2(bbox), dem_ids);
+
     // We will do all computations in double precision, regardless
     // of the precision of the inputs, for increased accuracy.
     // - The image data buffers are initialized here
@@ -474,8 +1022,12 @@ public:
     // - Used for median, nmad, and stddev calculation.
     std::vector< ImageView<double> > tile_vec, weight_vec;
     std::vector< std::string > dem_vec;
-    if (m_opt.median || m_opt.nmad) // Store each input separately
-      tile_vec.reserve(m_imgMgr.size());
+    std::vector<double> time_vec; // the time of each of tile_vec, for --trend
+    bool use_sketch = ((m_opt.median || m_opt.nmad) && m_opt.median_sketch_size > 0);
+    QuantileSketch sketch(use_sketch ? bbox.width() * bbox.height() : 0,
+                          m_opt.median_sketch_size);
+    if (((m_opt.median || m_opt.nmad) && !use_sketch) || m_opt.trend) // Store each input separately
+      tile_vec.reserve(dem_ids.size());
     if (m_opt.stddev) { // Need one working image
       tile_vec.push_back(ImageView<double>(bbox.width(), bbox.height()));
       // Each pixel starts at zero, nodata is handled later
@@ -483,8 +1035,8 @@ public:
       fill(tile,        0.0);
     }
     if (use_priority_blend) { // Store each weight separately
-      tile_vec.reserve  (m_imgMgr.size());
-      weight_vec.reserve(m_imgMgr.size());
+      tile_vec.reserve  (dem_ids.size());
+      weight_vec.reserve(dem_ids.size());
     }
 
     // This will ensure that pixels from earlier images are
@@ -523,8 +1075,9 @@ public:
     ImageView<double> first_dem;
     ImageView<double> local_wts_orig;
 
-    // Loop through all input DEMs
-    for (int dem_iter = 0; dem_iter < (int)m_imgMgr.size(); dem_iter++) {
+    // Loop through the input DEMs overlapping with this tile
+    for (size_t id_iter = 0; id_iter < dem_ids.size(); id_iter++) {
+      int dem_iter = dem_ids[id_iter];
 
       // Load the information for this DEM
       GeoReference georef        = m_georefs         [dem_iter];
@@ -551,7 +1104,8 @@ public:
       if (in_box.width() <= 1 || in_box.height() <= 1)
         continue; // No overlap with this tile, skip to the next DEM.
 
-      if (m_opt.median || m_opt.nmad || use_priority_blend || m_opt.block_max){
+      if (m_opt.median || m_opt.nmad || use_priority_blend || m_opt.block_max ||
+          m_opt.trend){
         // Must use a blank tile each time
         fill(tile, m_opt.out_nodata_value);
         fill(weights, 0.0);
@@ -572,17 +1126,7 @@ public:
 
       // If the nodata_threshold is specified, all values no more than this
       // will be invalidated.
-      double nodata_value = m_nodata_values[dem_iter];
-      if (!boost::math::isnan(m_opt.nodata_threshold)) {
-        nodata_value = m_opt.nodata_threshold;
-        for (int col = 0; col < dem.cols(); col++) {
-          for (int row = 0; row < dem.rows(); row++) {
-            if (dem(col, row)[0] <= nodata_value) {
-              dem(col, row)[0] = nodata_value;
-            }
-          }
-        }
-      }
+      double nodata_value = apply_nodata_threshold(m_opt, m_nodata_values[dem_iter], dem);
 
       if (m_opt.first_dem_as_reference && dem_iter == 0) {
         //TODO: Should be a function!
@@ -596,27 +1140,10 @@ public:
         }
       }
 
-      // Fill holes. This happens here, in the expanded tile, to
+      // Fill holes and blur. This happens here, in the expanded tile, to
       // ensure we catch holes which are partially outside the tile
       // being processed.
-      if (m_opt.hole_fill_len > 0){
-        dem = apply_mask(vw::fill_holes_grass
-                         (create_mask(select_channel(dem, 0), nodata_value),
-                          m_opt.hole_fill_len),
-                         nodata_value);
-      }
-
-      // Fill-in no-data values a bit and blur. If just the blurring is used,
-      // it will choke on no-data values, leaving large holes around each,
-      // hence the need to fill a little.
-      if (m_opt.dem_blur_sigma > 0.0) {
-        int kernel_size = vw::compute_kernel_size(m_opt.dem_blur_sigma);
-        dem = apply_mask(gaussian_filter(fill_nodata_with_avg
-                                         (create_mask(select_channel(dem, 0), nodata_value),
-                                          kernel_size),
-                                         m_opt.dem_blur_sigma),
-                         nodata_value);
-      }
+      fill_and_blur_dem(m_opt, nodata_value, dem);
       
       // Mark the handle to the image as not in use, though we still
       // keep that image file open, for increased performance, unless
@@ -628,63 +1155,15 @@ public:
         continue;
       }
 
-      // Compute linear weights
-      ImageView<double> local_wts = grassfire(notnodata(select_channel(dem, 0), nodata_value),
-                                              m_opt.no_border_blend);
-      local_wts_orig = local_wts;
-      if (m_opt.use_centerline_weights) {
-        // Erode based on grassfire weights, and then overwrite the grassfire
-        // weights with centerline weights
-        ImageView<DoubleGrayA> dem2 = copy(dem);
-        for (int col = 0; col < dem2.cols(); col++) {
-          for (int row = 0; row < dem2.rows(); row++) {
-            if (local_wts(col, row) <= m_opt.erode_len) {
-              dem2(col, row) = DoubleGrayA(nodata_value);
-            }
-          }
-        }
-        // TODO: Generalize this modification and move it to VW!!!
-        centerline_weights2
-                (create_mask_less_or_equal(select_channel(dem2, 0), nodata_value),
-                 local_wts, -1.0);
-      } // End centerline weights case
-
-      // If we don't limit the weights from above, we will have tiling artifacts,
-      // as in different tiles the weights grow to different heights since
-      // they are cropped to different regions. For priority blending length,
-      // we'll do this process later, as the bbox is obtained differently in that case.
-      if (!use_priority_blend) {
-        for (int col = 0; col < local_wts.cols(); col++) {
-          for (int row = 0; row < local_wts.rows(); row++) {
-            local_wts(col, row) = std::min(local_wts(col, row), double(m_bias));
-          }
-        }
-      }
-
-      // Erode. We already did that if centerline weights are used.
-      if (!m_opt.use_centerline_weights){
-        int max_cutoff = max_pixel_value(local_wts);
-        int min_cutoff = m_opt.erode_len;
-        if (max_cutoff <= min_cutoff)
-          max_cutoff = min_cutoff + 1; // precaution
-        local_wts = clamp(local_wts - min_cutoff, 0.0, max_cutoff - min_cutoff);
-      }
-      
-      // Blur the weights. If priority blending length is on, we'll do the blur later,
-      // after weights from different DEMs are combined.
-      if (m_opt.weights_blur_sigma > 0 && !use_priority_blend)
-        blur_weights(local_wts, m_opt.weights_blur_sigma);
-
-      // Raise to the power. Note that when priority blending length is positive, we
-      // delay this process.
-      if (m_opt.weights_exp != 1 && !use_priority_blend) {
-        for (int col = 0; col < dem.cols(); col++){
-          for (int row = 0; row < dem.rows(); row++){
-            if (local_wts(col, row) > 0)
-              local_wts(col, row) = pow(local_wts(col, row), m_opt.weights_exp);
-          }
-        }
+      // Compute the weights, or read them from the cache
+      ImageView<double> local_wts;
+      if (m_weightMgr != NULL) {
+        local_wts = crop(pixel_cast<double>(m_weightMgr->get_handle(dem_iter, bbox)), in_box);
+        m_weightMgr->release(dem_iter);
+      } else {
+        compute_dem_weights(m_opt, m_bias, use_priority_blend, nodata_value, dem, local_wts);
       }
+      local_wts_orig = local_wts;
 
 #if 0
       // Dump the weights
@@ -711,14 +1190,15 @@ public:
       ImageViewRef<DoubleGrayA> interp_dem
         = interpolate(dem, BilinearInterpolation(), ConstantEdgeExtension());
 
+      // The input pixel of each output pixel
+      ReprojectionLattice lattice(geotrans, bbox, g_lattice_spacing, g_lattice_tol);
+
       // Loop through each output pixel
       for (int c = 0; c < bbox.width(); c++){
         for (int r = 0; r < bbox.height(); r++){
 
-          // Coordinates in the output mosaic
-          Vector2 out_pix(c +  bbox.min().x(), r +  bbox.min().y());
           // Coordinate in this input DEM
-          Vector2 in_pix = geotrans.reverse(out_pix);
+          Vector2 in_pix = lattice.reverse(c, r);
 
           // Input DEM pixel relative to loaded bbox
           double x = in_pix[0] - in_box.min().x();
@@ -800,7 +1280,7 @@ public:
           // Initialize the tile if not done already.
           // Init to zero not needed with some types.
           if (!m_opt.stddev && !m_opt.median && !m_opt.nmad && !m_opt.min && !m_opt.max &&
-              !use_priority_blend){
+              !m_opt.trend && !use_priority_blend){
             if (is_nodata){
               tile   (c, r) = 0;
               weights(c, r) = 0.0;
@@ -812,7 +1292,7 @@ public:
                m_opt.last                                     ||
                (m_opt.min && (val < tile(c, r) || is_nodata)) ||
                (m_opt.max && (val > tile(c, r) || is_nodata)) ||
-               m_opt.median || m_opt.nmad || 
+               m_opt.median || m_opt.nmad || m_opt.trend ||
                use_priority_blend   || m_opt.block_max){
             // --> Conditions where we replace the current value
             tile   (c, r) = val;
@@ -860,10 +1340,20 @@ public:
 
       // For the median option, keep a copy of the output tile for each input DEM!
       // Also do it for max per block.
-      // - This will be memory intensive. 
-      if (m_opt.median || m_opt.nmad || m_opt.block_max) {
+      // - This will be memory intensive, unless the sketch is used.
+      if (use_sketch) {
+        for (int r = 0; r < bbox.height(); r++) {
+          for (int c = 0; c < bbox.width(); c++) {
+            if (tile(c, r) != m_opt.out_nodata_value)
+              sketch.add(r * bbox.width() + c, tile(c, r));
+          }
+        }
+      } else if (m_opt.median || m_opt.nmad || m_opt.block_max) {
         tile_vec.push_back(copy(tile));
         dem_vec.push_back(dem_name);
+      } else if (m_opt.trend) {
+        tile_vec.push_back(copy(tile));
+        time_vec.push_back(m_opt.dem_times[dem_iter]);
       }
       
       // For priority blending, need also to keep all tiles, but also the weights
@@ -906,8 +1396,25 @@ public:
       } // End col loop
     } // End stddev case
 
+    // For the median and nmad operations with the sketch. The index map
+    // is not supported in this mode.
+    if (use_sketch) {
+      fill(tile, m_opt.out_nodata_value);
+      vector<double> work;
+      for (int r = 0; r < bbox.height(); r++){
+        for (int c = 0; c < bbox.width(); c++){
+          double val = 0.0;
+          int pixel = r * bbox.width() + c;
+          bool has_val = m_opt.median ? sketch.median(pixel, val, work)
+                                      : sketch.nmad  (pixel, val, work);
+          if (has_val)
+            tile(c, r) = val;
+        }
+      }
+    }
+
     // For the median and nmad operations
-    if (m_opt.median || m_opt.nmad){
+    if ((m_opt.median || m_opt.nmad) && !use_sketch){
       // Init output pixels to nodata
       fill(tile, m_opt.out_nodata_value);
       vector<double> vals, vals_all(tile_vec.size());
@@ -954,6 +1461,41 @@ public:
       } // End col loop
     } // End median/nmad case
 
+    // Fit a line to the heights over time at each pixel. The tile gets
+    // the number of samples.
+    if (m_opt.trend) {
+      fill(tile, m_opt.out_nodata_value);
+      ImageView<TrendPixel> trend_local;
+      ImageView<TrendPixel> & trend_ref = (trend != NULL) ? *trend : trend_local;
+      trend_ref.set_size(bbox.width(), bbox.height());
+      fill(trend_ref, TrendPixel(m_opt.out_nodata_value, m_opt.out_nodata_value,
+                                 m_opt.out_nodata_value, m_opt.out_nodata_value));
+      std::vector<double> times, vals, w, work;
+      for (int r = 0; r < bbox.height(); r++){
+        for (int c = 0; c < bbox.width(); c++){
+          times.clear();
+          vals.clear();
+          for (size_t i = 0; i < tile_vec.size(); i++){
+            double this_val = tile_vec[i](c, r);
+            if (this_val == m_opt.out_nodata_value)
+              continue;
+            times.push_back(time_vec[i]);
+            vals.push_back(this_val);
+          }
+          if (vals.empty())
+            continue;
+          tile(c, r) = vals.size();
+          trend_ref(c, r)[TREND_COUNT] = vals.size();
+          double rate = 0.0, intercept = 0.0, rms = 0.0;
+          if (!robust_linear_fit(times, vals, w, work, rate, intercept, rms))
+            continue;
+          trend_ref(c, r)[TREND_RATE]      = rate;
+          trend_ref(c, r)[TREND_INTERCEPT] = intercept;
+          trend_ref(c, r)[TREND_RMS]       = rms;
+        }
+      }
+    } // End trend case
+
     // For max per block, find the sum of values in each DEM
     if (m_opt.block_max) {
       fill(tile, m_opt.out_nodata_value);
@@ -1137,19 +1679,44 @@ public:
       }
     }
 
-    // Return the tile we created with fake borders to make it look
-    // the size of the entire output image. So far we operated
-    // on doubles, here we cast to RealT.
-    return prerasterize_type(pixel_cast<RealT>(tile),
-                             -bbox.min().x(), -bbox.min().y(),
-                             cols(), rows());
+    return tile;
+  }
+}; // End class DemMosaicView
+
+/// The bands of --trend, from the same pass over the input DEMs as
+/// the per-pixel sample counts of DemMosaicView.
+class DemTrendView: public ImageViewBase<DemTrendView>{
+  DemMosaicView m_mosaic;
+
+public:
+  DemTrendView(DemMosaicView const& mosaic): m_mosaic(mosaic) {}
+
+  // Boilerplate
+  typedef TrendPixel pixel_type;
+  typedef pixel_type result_type;
+  typedef ProceduralPixelAccessor<DemTrendView> pixel_accessor;
+  inline int cols  () const { return m_mosaic.cols(); }
+  inline int rows  () const { return m_mosaic.rows(); }
+  inline int planes() const { return 1; }
+  inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+  inline pixel_type operator()(double/*i*/, double/*j*/, int/*p*/ = 0) const {
+    vw_throw(NoImplErr() << "DemTrendView::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i bbox) const {
+    ImageView<pixel_type> trend;
+    m_mosaic.compute_tile(bbox, &trend);
+    return prerasterize_type(trend, -bbox.min().x(), -bbox.min().y(), cols(), rows());
   }
 
   template <class DestT>
   inline void rasterize(DestT const& dest, BBox2i bbox) const {
     vw::rasterize(prerasterize(bbox), dest, bbox);
   }
-}; // End class DemMosaicView
+}; // End class DemTrendView
 
 
 /// Find the bounding box of all DEMs in the projected space.
@@ -1259,6 +1826,8 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "The index of the tile to save (starting from zero). When this program is invoked, it will print out how many tiles are there. Default: save all tiles.")
     ("tile-list",      po::value(&opt.tile_list_str)->default_value(""),
      "List of tile indices (in quotes) to save. A tile index starts from 0.")
+    ("query-tiles", po::bool_switch(&opt.query_tiles)->default_value(false),
+     "Print the number of tiles and, for each tile, the total area in output pixels of the input DEMs overlapping with it, then quit. This is used by parallel_dem_mosaic to split the work.")
     ("erode-length",    po::value<int>(&opt.erode_len)->default_value(0),
 	   "Erode the DEM by this many pixels at boundary.")
     ("priority-blending-length", po::value<int>(&opt.priority_blending_len)->default_value(0),
@@ -1297,8 +1866,14 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
 	   "Find the median DEM value (this can be memory-intensive, fewer threads are suggested).")
     ("nmad",  po::bool_switch(&opt.nmad)->default_value(false),
 	   "Find the normalized median absolute deviation DEM value (this can be memory-intensive, fewer threads are suggested).")
+    ("median-sketch-size", po::value<int>(&opt.median_sketch_size)->default_value(0),
+     "With --median or --nmad, keep at most this many values per pixel, so that memory use does not grow with the number of overlapping DEMs. The result is exact for pixels with no more values than this, and approximate otherwise. If 0, keep all values.")
     ("count",   po::bool_switch(&opt.count)->default_value(false),
      "Each pixel is set to the number of valid DEM heights at that pixel.")
+    ("trend", po::bool_switch(&opt.trend)->default_value(false),
+     "Fit a line to the heights over time at each pixel, with robust weights. Write the rate, intercept, residual RMS, and count of samples as the bands of one output. Needs --dem-times.")
+    ("dem-times", po::value(&opt.dem_times_file)->default_value(""),
+     "A file with the time of each input DEM, in the same order as the inputs, such as the decimal year. The rate is per unit of time, and the intercept is at time 0.")
     ("block-max", po::bool_switch(&opt.block_max)->default_value(false),
      "For each block of size --block-size, keep the DEM with the largest sum of values in the block.")
     ("georef-tile-size",    po::value<double>(&opt.geo_tile_size),
@@ -1306,6 +1881,12 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     ("output-nodata-value", po::value<double>(&opt.out_nodata_value),
      "No-data value to use on output. Default: use the one from the first DEM to be mosaicked.")
     ("ot",  po::value(&opt.output_type)->default_value("Float32"), "Output data type. Supported types: Byte, UInt16, Int16, UInt32, Int32, Float32. If the output type is a kind of integer, values are rounded and then clamped to the limits of that type.")
+    ("cog", po::bool_switch(&opt.cog)->default_value(false),
+     "Write the output as a Cloud Optimized GeoTIFF, with overviews. This needs GDAL 3.1 or later.")
+    ("weights-cache-dir", po::value(&opt.weights_cache_dir)->default_value(""),
+     "Save the blending weights of each input DEM in this directory, and reuse them in later runs with the same DEM and weight options. Not used with --use-centerline-weights or --priority-blending-length.")
+    ("update", po::bool_switch(&opt.update)->default_value(false),
+     "Update an existing mosaic, given with -o, in place. Only the blocks which overlap with DEMs that were added, removed, or modified since the mosaic was made are recomputed. The inputs are the full list of DEMs, and the options must be the same as before.")
     ("weights-blur-sigma", po::value<double>(&opt.weights_blur_sigma)->default_value(5.0),
      "The standard deviation of the Gaussian used to blur the weights. Higher value results in smoother weights and blending. Set to 0 to not use blurring.")
     ("weights-exponent",   po::value<double>(&opt.weights_exp)->default_value(2.0),
@@ -1379,7 +1960,8 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
   int noblend = no_blend(opt);
   if (noblend > 1)
     vw_throw(ArgumentErr() << "At most one of the options --first, --last, "
-         << "--min, --max, -mean, --stddev, --median, --nmad, --count can be specified.\n"
+         << "--min, --max, -mean, --stddev, --median, --nmad, --count, --block-max, "
+         << "--trend can be specified.\n"
          << usage << general_options);
 
   if (opt.geo_tile_size < 0)
@@ -1410,11 +1992,58 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
                            << "--first, --last, --min, --max, --median, --nmad is invoked.\n"
                            << usage << general_options);
 
+  if (opt.update) {
+    if (!boost::iends_with(opt.out_prefix, ".tif"))
+      vw_throw(ArgumentErr() << "The option --update needs an output file ending in .tif.\n"
+                             << usage << general_options);
+    if (opt.cog || opt.save_index_map || opt.save_dem_weight >= 0 ||
+        opt.tile_index >= 0 || !opt.tile_list_str.empty())
+      vw_throw(ArgumentErr() << "The option --update cannot be used with --cog, "
+               << "--save-index-map, --save-dem-weight, --tile-index, or --tile-list.\n"
+               << usage << general_options);
+    if (!fs::exists(opt.out_prefix) || !fs::exists(sidecar_file(opt.out_prefix)))
+      vw_throw(ArgumentErr() << "Cannot update: " << opt.out_prefix
+               << ", as it or its sidecar " << sidecar_file(opt.out_prefix)
+               << " does not exist.\n");
+  }
+
+  if (opt.median_sketch_size < 0 || opt.median_sketch_size == 1 ||
+      opt.median_sketch_size > std::numeric_limits<std::uint16_t>::max())
+    vw_throw(ArgumentErr() << "The value of --median-sketch-size must be 0 or between 2 and "
+                           << std::numeric_limits<std::uint16_t>::max() << ".\n"
+                           << usage << general_options);
+
+  if (opt.median_sketch_size > 0 && !opt.median && !opt.nmad)
+    vw_throw(ArgumentErr() << "The option --median-sketch-size needs --median or --nmad.\n"
+                           << usage << general_options);
+
+  if (opt.median_sketch_size > 0 && opt.save_index_map)
+    vw_throw(ArgumentErr() << "Cannot save an index map with --median-sketch-size.\n"
+                           << usage << general_options);
+
+  if (!opt.weights_cache_dir.empty() && !can_cache_weights(opt)) {
+    vw_out(WarningMessage) << "Ignoring --weights-cache-dir, as the weights are not "
+                           << "cached with --use-centerline-weights, "
+                           << "--priority-blending-length, or when not blending.\n";
+    opt.weights_cache_dir = "";
+  }
+
   if (opt.save_dem_weight >= 0 && opt.save_index_map)
     vw_throw(ArgumentErr()
        << "Cannot save both the index map and the DEM weights at the same time.\n"
        << usage << general_options);
 
+  if (opt.trend != !opt.dem_times_file.empty())
+    vw_throw(ArgumentErr() << "The options --trend and --dem-times must be used together.\n"
+                           << usage << general_options);
+
+  if (opt.trend && (opt.update || opt.first_dem_as_reference ||
+                    opt.this_dem_as_reference != "" || opt.output_type != "Float32"))
+    vw_throw(ArgumentErr() << "The option --trend cannot be used with --update, "
+             << "--first-dem-as-reference, --this-dem-as-reference, or an output "
+             << "type other than Float32.\n"
+             << usage << general_options);
+
   // For compatibility with the GDAL tools, allow the min and max to be reversed.
   if (opt.projwin != BBox2()) {
     if (opt.projwin.min().x() > opt.projwin.max().x())
@@ -1475,6 +2104,19 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     opt.dem_files.insert(opt.dem_files.begin(), opt.this_dem_as_reference);
   }
   
+  if (opt.trend) {
+    ifstream is(opt.dem_times_file.c_str());
+    if (!is.good())
+      vw_throw(ArgumentErr() << "Could not read: " << opt.dem_times_file << ".\n");
+    double val = 0.0;
+    while (is >> val)
+      opt.dem_times.push_back(val);
+    if (opt.dem_times.size() != opt.dem_files.size())
+      vw_throw(ArgumentErr() << "Expecting " << opt.dem_files.size() << " times in "
+               << opt.dem_times_file << ", one per input DEM, but got "
+               << opt.dem_times.size() << ".\n");
+  }
+
   if (int(opt.dem_files.size()) <= opt.save_dem_weight) {
     vw_throw(ArgumentErr() << "Cannot save weights for given index as it is out of bounds.\n"
 	     << usage << general_options);
@@ -1526,6 +2168,239 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
   
 } // End function handle_arguments
 
+/// The sidecar of a mosaic written to a single file. It records the
+/// options and the input DEMs the mosaic was made with, so that it can
+/// be updated later with --update.
+std::string sidecar_file(std::string const& mosaic_file) {
+  return fs::path(mosaic_file).replace_extension(".dem_mosaic.txt").string();
+}
+
+/// The options which affect the values of the mosaic. An update is
+/// possible only if these did not change.
+std::string mosaic_signature(Options const& opt) {
+  std::ostringstream os;
+  os.precision(17);
+  os << "mode=" << tile_suffix(opt)
+     << " erode-length=" << opt.erode_len
+     << " priority-blending-length=" << opt.priority_blending_len
+     << " extra-crop-length=" << opt.extra_crop_len
+     << " hole-fill-length=" << opt.hole_fill_len
+     << " weights-exponent=" << opt.weights_exp
+     << " weights-blur-sigma=" << opt.weights_blur_sigma
+     << " dem-blur-sigma=" << opt.dem_blur_sigma
+     << " nodata-threshold=" << opt.nodata_threshold
+     << " output-nodata-value=" << opt.out_nodata_value
+     << " use-centerline-weights=" << opt.use_centerline_weights
+     << " first-dem-as-reference=" << opt.first_dem_as_reference
+     << " this-dem-as-reference=" << opt.this_dem_as_reference
+     << " propagate-nodata=" << opt.propagate_nodata
+     << " no-border-blend=" << opt.no_border_blend
+     << " median-sketch-size=" << opt.median_sketch_size
+     << " ot=" << opt.output_type;
+  return os.str();
+}
+
+/// An input DEM as recorded in the sidecar. The footprint is in the
+/// pixels of the mosaic, grown by how far the DEM affects the output.
+struct SidecarEntry {
+  std::string    file;
+  std::uintmax_t size;
+  std::time_t    mtime;
+  BBox2          footprint;
+  SidecarEntry(): size(0), mtime(0) {}
+};
+
+SidecarEntry make_sidecar_entry(std::string const& file, BBox2 const& footprint) {
+  SidecarEntry entry;
+  entry.file      = file;
+  entry.size      = fs::file_size(file);
+  entry.mtime     = fs::last_write_time(file);
+  entry.footprint = footprint;
+  return entry;
+}
+
+void write_sidecar(std::string const& file, std::string const& signature,
+                   std::vector<SidecarEntry> const& entries) {
+  vw_out() << "Writing: " << file << std::endl;
+  std::ofstream ofs(file.c_str());
+  ofs.precision(17);
+  ofs << "# dem_mosaic sidecar, version 1\n";
+  ofs << "options " << signature << "\n";
+  for (size_t i = 0; i < entries.size(); i++) {
+    SidecarEntry const& e = entries[i];
+    ofs << "dem " << e.size << ' ' << e.mtime << ' '
+        << e.footprint.min().x() << ' ' << e.footprint.min().y() << ' '
+        << e.footprint.max().x() << ' ' << e.footprint.max().y() << ' '
+        << e.file << "\n";
+  }
+  if (!ofs.good())
+    vw_throw(IOErr() << "Failed writing: " << file << ".\n");
+}
+
+void read_sidecar(std::string const& file, std::string & signature,
+                  std::vector<SidecarEntry> & entries) {
+  signature.clear();
+  entries.clear();
+  std::ifstream ifs(file.c_str());
+  if (!ifs.good())
+    vw_throw(ArgumentErr() << "Cannot read the sidecar: " << file << ". "
+             << "It is written when a mosaic is saved to a single file.\n");
+  std::string line;
+  while (std::getline(ifs, line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+    std::istringstream is(line);
+    std::string key;
+    is >> key;
+    if (key == "options") {
+      std::getline(is >> std::ws, signature);
+    } else if (key == "dem") {
+      SidecarEntry e;
+      double x0, y0, x1, y1;
+      if (!(is >> e.size >> e.mtime >> x0 >> y0 >> x1 >> y1))
+        vw_throw(IOErr() << "Invalid line in " << file << ": " << line << "\n");
+      std::getline(is >> std::ws, e.file);
+      e.footprint = BBox2(Vector2(x0, y0), Vector2(x1, y1));
+      entries.push_back(e);
+    } else {
+      vw_throw(IOErr() << "Invalid line in " << file << ": " << line << "\n");
+    }
+  }
+}
+
+/// Find the regions of the mosaic, in its pixels, which must be
+/// recomputed given the DEMs in the sidecar and the current ones. These
+/// are the footprints of the DEMs which were added, removed, or modified
+/// on disk. If the relative order of the other DEMs changed, which may
+/// change the result, the DEMs past the first such change are included.
+void find_changed_regions(std::vector<SidecarEntry> const& old_entries,
+                          std::vector<SidecarEntry> const& new_entries,
+                          std::vector<BBox2> & regions) {
+  regions.clear();
+  std::map<std::string, int> old_pos, new_pos;
+  for (size_t i = 0; i < old_entries.size(); i++)
+    old_pos[old_entries[i].file] = i;
+  for (size_t i = 0; i < new_entries.size(); i++)
+    new_pos[new_entries[i].file] = i;
+
+  // Removed DEMs
+  for (size_t i = 0; i < old_entries.size(); i++) {
+    if (new_pos.find(old_entries[i].file) == new_pos.end())
+      regions.push_back(old_entries[i].footprint);
+  }
+
+  // The DEMs in both lists, in the old and new order
+  std::vector<std::string> old_common, new_common;
+  for (size_t i = 0; i < old_entries.size(); i++)
+    if (new_pos.find(old_entries[i].file) != new_pos.end())
+      old_common.push_back(old_entries[i].file);
+  for (size_t i = 0; i < new_entries.size(); i++)
+    if (old_pos.find(new_entries[i].file) != old_pos.end())
+      new_common.push_back(new_entries[i].file);
+  size_t first_reordered = 0;
+  while (first_reordered < new_common.size() &&
+         new_common[first_reordered] == old_common[first_reordered])
+    first_reordered++;
+  std::set<std::string> reordered(new_common.begin() + first_reordered, new_common.end());
+
+  // Added, modified, and reordered DEMs
+  for (size_t i = 0; i < new_entries.size(); i++) {
+    SidecarEntry const& e = new_entries[i];
+    auto it = old_pos.find(e.file);
+    if (it == old_pos.end()) {
+      regions.push_back(e.footprint);
+      continue;
+    }
+    SidecarEntry const& o = old_entries[it->second];
+    if (o.size != e.size || o.mtime != e.mtime || reordered.count(e.file) > 0) {
+      regions.push_back(e.footprint);
+      regions.push_back(o.footprint);
+    }
+  }
+}
+
+/// Recompute the blocks of an existing mosaic which intersect the given
+/// regions and write them in place, in parallel.
+void update_mosaic_in_place(std::string const& mosaic_file,
+                            ImageViewRef<RealT> const& mosaic,
+                            std::vector<BBox2> const& regions,
+                            int num_threads) {
+
+  GDALDatasetH dataset = GDALOpen(mosaic_file.c_str(), GA_Update);
+  if (dataset == NULL)
+    vw_throw(IOErr() << "Cannot open for update: " << mosaic_file << ".\n");
+  GDALRasterBandH band = GDALGetRasterBand(dataset, 1);
+  int block_cols = 0, block_rows = 0;
+  GDALGetBlockSize(band, &block_cols, &block_rows);
+  if (GDALGetRasterXSize(dataset) != mosaic.cols() ||
+      GDALGetRasterYSize(dataset) != mosaic.rows() || block_cols <= 0 || block_rows <= 0) {
+    GDALClose(dataset);
+    vw_throw(ArgumentErr() << "Unexpected size or block size for: " << mosaic_file << ".\n");
+  }
+
+  // The blocks to redo, in the block layout of the file, so that each
+  // block on disk is rewritten once.
+  std::set<std::pair<int, int>> block_set;
+  BBox2i image_box(0, 0, mosaic.cols(), mosaic.rows());
+  for (size_t i = 0; i < regions.size(); i++) {
+    if (regions[i].empty())
+      continue;
+    BBox2i box = grow_bbox_to_int(regions[i]);
+    box.crop(image_box);
+    if (box.empty())
+      continue;
+    for (int by = box.min().y() / block_rows; by <= (box.max().y() - 1) / block_rows; by++)
+      for (int bx = box.min().x() / block_cols; bx <= (box.max().x() - 1) / block_cols; bx++)
+        block_set.insert(std::make_pair(by, bx));
+  }
+  std::vector<std::pair<int, int>> blocks(block_set.begin(), block_set.end());
+  int num_blocks_x = (mosaic.cols() + block_cols - 1) / block_cols;
+  int num_blocks_y = (mosaic.rows() + block_rows - 1) / block_rows;
+  vw_out() << "Updating " << blocks.size() << " out of " << num_blocks_x * num_blocks_y
+           << " blocks of: " << mosaic_file << std::endl;
+
+  TerminalProgressCallback tpc("asp", "\t--> ");
+  std::atomic<size_t> next_block(0);
+  size_t num_done = 0;
+  vw::Mutex write_mutex;
+  std::string error;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; t++) {
+    threads.push_back(std::thread([&]() {
+      while (true) {
+        size_t b = next_block++;
+        if (b >= blocks.size())
+          break;
+        BBox2i block(blocks[b].second * block_cols, blocks[b].first * block_rows,
+                     block_cols, block_rows);
+        block.crop(image_box);
+        ImageView<RealT> img;
+        try {
+          img = crop(mosaic, block);
+        } catch (std::exception const& e) {
+          vw::Mutex::Lock lock(write_mutex);
+          error = e.what();
+          break;
+        }
+        vw::Mutex::Lock lock(write_mutex);
+        if (GDALRasterIO(band, GF_Write, block.min().x(), block.min().y(),
+                         block.width(), block.height(), &img(0, 0),
+                         block.width(), block.height(), GDT_Float32, 0, 0) != CE_None)
+          error = "Failed writing to: " + mosaic_file + ".";
+        num_done++;
+        tpc.report_fractional_progress(num_done, blocks.size());
+      }
+    }));
+  }
+  for (size_t t = 0; t < threads.size(); t++)
+    threads[t].join();
+  tpc.report_finished();
+
+  GDALClose(dataset);
+  if (error != "")
+    vw_throw(IOErr() << error << "\n");
+}
+
 int main(int argc, char *argv[]) {
 
   Options opt;
@@ -1557,6 +2432,18 @@ int main(int argc, char *argv[]) {
 
     vw_out() << "Using output no-data value: " << opt.out_nodata_value << endl;
 
+    // Check early if an update is possible
+    std::vector<SidecarEntry> old_entries;
+    if (opt.update) {
+      std::string old_signature;
+      read_sidecar(sidecar_file(opt.out_prefix), old_signature, old_entries);
+      if (old_signature != mosaic_signature(opt))
+        vw_throw(ArgumentErr() << "Cannot update: " << opt.out_prefix
+                 << ", as it was made with different options:\n"
+                 << old_signature << "\nvs\n" << mosaic_signature(opt) << "\n"
+                 << "Recreate the mosaic without --update.\n");
+    }
+
     // Form the mosaic georef. The georef of the first DEM is used as
     // initial guess unless user wants to change the resolution and projection.
     if (opt.target_srs_string != "")
@@ -1684,6 +2571,23 @@ int main(int argc, char *argv[]) {
     int cols = (int)round(end_pix[0]); // end_pix is the last pix in the image
     int rows = (int)round(end_pix[1]);
 
+    if (opt.update) {
+      // Keep the grid of the existing mosaic. Parts of the new DEMs
+      // outside of it are not used.
+      GeoReference old_georef = read_georef(opt.out_prefix);
+      if (old_georef.overall_proj4_str() != mosaic_georef.overall_proj4_str())
+        vw_throw(ArgumentErr() << "Cannot update: " << opt.out_prefix
+                 << ", as its projection differs from the one for the current inputs. "
+                 << "Recreate the mosaic without --update.\n");
+      DiskImageView<RealT> old_mosaic(opt.out_prefix);
+      if (old_mosaic.cols() != cols || old_mosaic.rows() != rows)
+        vw_out(WarningMessage) << "The extent of the current inputs differs from the one of "
+                               << opt.out_prefix << ". Keeping the latter.\n";
+      mosaic_georef = old_georef;
+      cols = old_mosaic.cols();
+      rows = old_mosaic.rows();
+    }
+
     // Form the mosaic and write it to disk
     vw_out()<< "The size of the mosaic is " << cols << " x " << rows << " pixels.\n";
     vw_out()<< "The output georeference is\n" << mosaic_georef << std::endl;
@@ -1762,25 +2666,38 @@ int main(int argc, char *argv[]) {
     DiskImageManager<RealT> imgMgr;
 
     BBox2i output_dem_box = BBox2i(0, 0, cols, rows); // output DEM box
-    
+
+    // The tiles in projected coordinates, and an index of them
+    std::vector<BBox2> tile_proj_bboxes;
+    for (int tile_id = start_tile; tile_id < end_tile; tile_id++)
+      tile_proj_bboxes.push_back(mosaic_georef.pixel_to_point_bbox
+                                 (tile_pixel_bboxes[tile_id - start_tile]));
+    BoxIndex tile_box_index;
+    build_box_index(tile_proj_bboxes, tile_box_index);
+
+    // The footprint of each loaded DEM in the output pixels. It is grown
+    // by the extra amount each DEM is read beyond a tile, in the pixels of
+    // that DEM, then by some more, as the transform is not linear.
+    std::vector<BBox2> loaded_dem_footprints;
+    int footprint_pad = bias + BilinearInterpolation::pixel_buffer + 2;
+
     // Loop through all DEMs
+    std::vector<int> tile_ids;
     for (int dem_iter = 0; dem_iter < (int)opt.dem_files.size(); dem_iter++){
 
       // Get the DEM bounding box that we previously computed (output projected coords)
       BBox2 dem_bbox = dem_proj_bboxes[dem_iter];
 
-      // Go through each of the tile bounding boxes and see they intersect this DEM
+      // Go through each of the tiles overlapping this DEM and see if one is needed
       bool use_this_dem = false;
-      for (int tile_id = start_tile; tile_id < end_tile; tile_id++){
+      query_box_index(tile_box_index, dem_bbox, tile_ids);
+      for (size_t it = 0; it < tile_ids.size(); it++){
+        int tile_id = start_tile + tile_ids[it];
 
         if (!opt.tile_list.empty() && opt.tile_list.find(tile_id) == opt.tile_list.end()) 
           continue;
         
-        // Get tile bbox in pixels, then convert it to projected coords.
-        BBox2i tile_pixel_box = tile_pixel_bboxes[tile_id - start_tile];
-        BBox2  tile_proj_box  = mosaic_georef.pixel_to_point_bbox(tile_pixel_box);
-
-        if (tile_proj_box.intersects(dem_bbox)) {
+        if (tile_proj_bboxes[tile_ids[it]].intersects(dem_bbox)) {
           use_this_dem = true;
           break;
         }
@@ -1798,6 +2715,20 @@ int main(int argc, char *argv[]) {
       BBox2 curr_box = geotrans.forward_bbox(dem_pixel_box);
       curr_box.crop(output_dem_box);
 
+      BBox2 footprint;
+      try {
+        BBox2i padded_box = dem_pixel_box;
+        padded_box.expand(footprint_pad);
+        footprint = geotrans.forward_bbox(padded_box);
+        footprint.expand(footprint_pad);
+      } catch (...) {
+        // The padded box could go past where the projection is defined.
+        // Then always consider this DEM.
+        footprint = BBox2(output_dem_box);
+      }
+      if (footprint.empty())
+        footprint = BBox2(output_dem_box);
+
       // This is a fix for GDAL crashing when there are too many open
       // file handles. In such situation, just selectively close the
       // handles furthest from the current location.
@@ -1827,8 +2758,82 @@ int main(int argc, char *argv[]) {
       nodata_values.push_back(curr_nodata_value);
       georefs.push_back(georef);
       loaded_dem_pixel_bboxes.push_back(dem_pixel_box);
+      loaded_dem_footprints.push_back(footprint);
     } // End loop through DEM files
 
+    BoxIndex dem_index;
+    build_box_index(loaded_dem_footprints, dem_index);
+
+    if (opt.query_tiles) {
+      // How much work each tile is, measured by the area of the DEMs overlapping it
+      std::vector<double> tile_costs(num_tiles, 0.0);
+      std::vector<int> dem_ids;
+      for (int tile_id = start_tile; tile_id < end_tile; tile_id++) {
+        BBox2 tile_box = tile_pixel_bboxes[tile_id - start_tile];
+        query_box_index(dem_index, tile_box, dem_ids);
+        for (size_t it = 0; it < dem_ids.size(); it++) {
+          BBox2 box = loaded_dem_footprints[dem_ids[it]];
+          box.crop(tile_box);
+          if (!box.empty())
+            tile_costs[tile_id] += box.width() * box.height();
+        }
+      }
+      vw_out() << "num_tiles_x, " << num_tiles_x << std::endl;
+      vw_out() << "num_tiles_y, " << num_tiles_y << std::endl;
+      vw_out() << "tile_costs";
+      for (int tile_id = 0; tile_id < num_tiles; tile_id++)
+        vw_out() << ", " << tile_costs[tile_id];
+      vw_out() << std::endl;
+      return 0;
+    }
+
+    // Open the cached weights of the loaded DEMs, computing those missing
+    DiskImageManager<RealT> weightMgr;
+    DiskImageManager<RealT> * weightMgrPtr = NULL;
+    if (can_cache_weights(opt)) {
+      fs::create_directories(opt.weights_cache_dir);
+      for (size_t i = 0; i < loaded_dems.size(); i++) {
+        std::string cache_file = weights_cache_file(opt, bias, nodata_values[i],
+                                                    loaded_dems[i]);
+        write_weights_cache(opt, bias, block_size, nodata_values[i], loaded_dems[i],
+                            cache_file);
+        weightMgr.add_file_handle_not_thread_safe(cache_file, loaded_dem_footprints[i]);
+      }
+      weightMgrPtr = &weightMgr;
+    }
+
+    if (opt.update) {
+      std::vector<SidecarEntry> new_entries;
+      for (size_t i = 0; i < loaded_dems.size(); i++)
+        new_entries.push_back(make_sidecar_entry(loaded_dems[i], loaded_dem_footprints[i]));
+      std::vector<BBox2> regions;
+      find_changed_regions(old_entries, new_entries, regions);
+
+      long long int num_valid_pixels = 0;
+      vw::Mutex count_mutex;
+      ImageViewRef<RealT> mosaic
+        = DemMosaicView(cols, rows, bias, opt, imgMgr, georefs, mosaic_georef,
+                        nodata_values, loaded_dem_pixel_bboxes, dem_index,
+                        weightMgrPtr, num_valid_pixels, count_mutex);
+      int num_threads = opt.num_threads;
+      if (num_threads <= 0)
+        num_threads = vw_settings().default_num_threads();
+      update_mosaic_in_place(opt.out_prefix, mosaic, regions, num_threads);
+      write_sidecar(sidecar_file(opt.out_prefix), mosaic_signature(opt), new_entries);
+      return 0;
+    }
+
+    // Produce the tiles in Morton order, rather than row by row. Tiles
+    // close along this curve are close on the ground, so the input DEMs
+    // needed by one tile are likely still open and cached for the next.
+    std::vector<std::pair<std::uint64_t, int>> tile_order;
+    for (int tile_id = start_tile; tile_id < end_tile; tile_id++){
+      int tile_index_y = tile_id / num_tiles_x;
+      int tile_index_x = tile_id - tile_index_y*num_tiles_x;
+      tile_order.push_back(std::make_pair(asp::morton_code_2d(tile_index_x, tile_index_y), tile_id));
+    }
+    std::sort(tile_order.begin(), tile_order.end());
+
     // If there are 17 tiles, let them be tile-00, ..., tile-16.
     int num_digits = 1;
     int tens = 10;
@@ -1838,7 +2843,8 @@ int main(int argc, char *argv[]) {
     }
     
     // Time to generate each of the output tiles
-    for (int tile_id = start_tile; tile_id < end_tile; tile_id++){
+    for (size_t order_iter = 0; order_iter < tile_order.size(); order_iter++){
+      int tile_id = tile_order[order_iter].second;
 
       if (!opt.tile_list.empty() && opt.tile_list.find(tile_id) == opt.tile_list.end()) 
         continue;
@@ -1860,13 +2866,12 @@ int main(int argc, char *argv[]) {
       long long int num_valid_pixels; // Will be populated when saving to disk
       vw::Mutex count_mutex; // to lock when updating num_valid_pixels
 
-      ImageViewRef<RealT> out_dem
-        = crop(DemMosaicView(cols, rows, bias, opt,
-                             imgMgr, georefs,
-                             mosaic_georef, nodata_values,
-                             loaded_dem_pixel_bboxes,
-                             num_valid_pixels, count_mutex),
-               tile_box);
+      DemMosaicView mosaic(cols, rows, bias, opt,
+                           imgMgr, georefs,
+                           mosaic_georef, nodata_values,
+                           loaded_dem_pixel_bboxes, dem_index,
+                           weightMgrPtr, num_valid_pixels, count_mutex);
+      ImageViewRef<RealT> out_dem = crop(mosaic, tile_box);
       GeoReference crop_georef = crop(mosaic_georef, tile_box.min().x(),
 				      tile_box.min().y());
 
@@ -1875,40 +2880,45 @@ int main(int argc, char *argv[]) {
       vw_out() << "Writing: " << dem_tile << std::endl;
       bool has_georef = true, has_nodata = true;
       TerminalProgressCallback tpc("asp", "\t--> ");
-      if (opt.output_type == "Float32") 
+      if (opt.trend) // all bands in one pass, the type was checked to be Float32
+        asp::save_with_temp_big_blocks(block_size, dem_tile,
+                                       crop(DemTrendView(mosaic), tile_box),
+                                       has_georef, crop_georef,
+                                       has_nodata, opt.out_nodata_value, opt, tpc, opt.cog);
+      else if (opt.output_type == "Float32") 
         asp::save_with_temp_big_blocks(block_size, dem_tile, out_dem,
                                        has_georef, crop_georef,
-                                       has_nodata, opt.out_nodata_value, opt, tpc);
+                                       has_nodata, opt.out_nodata_value, opt, tpc, opt.cog);
       else if (opt.output_type == "Byte") 
         asp::save_with_temp_big_blocks(block_size, dem_tile,
 				       per_pixel_filter(out_dem, RoundAndClamp<uint8, RealT>()),
                                        has_georef, crop_georef,
                                        has_nodata, vw::round_and_clamp<uint8>(opt.out_nodata_value),
-                                       opt, tpc);
+                                       opt, tpc, opt.cog);
       else if (opt.output_type == "UInt16") 
         asp::save_with_temp_big_blocks(block_size, dem_tile,
 				       per_pixel_filter(out_dem, RoundAndClamp<uint16, RealT>()),
                                        has_georef, crop_georef,
                                        has_nodata, vw::round_and_clamp<uint16>(opt.out_nodata_value),
-                                       opt, tpc);
+                                       opt, tpc, opt.cog);
       else if (opt.output_type == "Int16") 
         asp::save_with_temp_big_blocks(block_size, dem_tile,
 				       per_pixel_filter(out_dem, RoundAndClamp<int16, RealT>()),
                                        has_georef, crop_georef,
                                        has_nodata, vw::round_and_clamp<int16>(opt.out_nodata_value),
-                                       opt, tpc);
+                                       opt, tpc, opt.cog);
       else if (opt.output_type == "UInt32") 
         asp::save_with_temp_big_blocks(block_size, dem_tile,
 				       per_pixel_filter(out_dem, RoundAndClamp<uint32, RealT>()),
                                        has_georef, crop_georef,
                                        has_nodata, vw::round_and_clamp<uint32>(opt.out_nodata_value),
-                                       opt, tpc);
+                                       opt, tpc, opt.cog);
       else if (opt.output_type == "Int32") 
         asp::save_with_temp_big_blocks(block_size, dem_tile,
 				       per_pixel_filter(out_dem, RoundAndClamp<int32, RealT>()),
                                        has_georef, crop_georef,
                                        has_nodata, vw::round_and_clamp<int32>(opt.out_nodata_value),
-                                       opt, tpc);
+                                       opt, tpc, opt.cog);
       else
         vw_throw(NoImplErr() << "Unsupported output type: " << opt.output_type << ".\n");
 
@@ -1917,6 +2927,12 @@ int main(int argc, char *argv[]) {
       if (num_valid_pixels == 0) {
         vw_out() << "Removing tile with no valid pixels: " << dem_tile << std::endl;
         boost::filesystem::remove(dem_tile);
+      } else if (write_to_precise_file && !opt.cog) {
+        // Record what went into the mosaic, for --update
+        std::vector<SidecarEntry> entries;
+        for (size_t i = 0; i < loaded_dems.size(); i++)
+          entries.push_back(make_sidecar_entry(loaded_dems[i], loaded_dem_footprints[i]));
+        write_sidecar(sidecar_file(dem_tile), mosaic_signature(opt), entries);
       }
       
     } // End loop through tiles
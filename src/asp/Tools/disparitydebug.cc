@@ -34,6 +34,7 @@
 #include <vw/Image/Filter.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/RasterStats.h>
 using namespace vw;
 using namespace vw::stereo;
 
@@ -246,10 +247,22 @@ void process_disparity(Options& opt) {
   if (has_georef)
     georef = crop(georef, roiToUse);
 
+  // Use the disparity range saved by stereo_corr for the full image, if
+  // present and current.
+  asp::RasterStats stats;
+  if (opt.normalization_range == BBox2(0,0,0,0) && opt.roi == BBox2(0,0,0,0) &&
+      asp::read_raster_stats(opt.input_file_name, stats) &&
+      stats[asp::DISPARITY_RANGE].size() == 4) {
+    std::vector<double> const& range = stats[asp::DISPARITY_RANGE];
+    vw_out() << "\t--> Reading disparity range from: "
+             << asp::raster_stats_file(opt.input_file_name) << "\n";
+    opt.normalization_range = BBox2(Vector2(range[0], range[1]), Vector2(range[2], range[3]));
+  }
+
   // Compute intensity display range if not passed in. For this purpose
   // subsample the image.
-  vw_out() << "\t--> Computing disparity range.\n";
   if (opt.normalization_range == BBox2(0,0,0,0)) {
+    vw_out() << "\t--> Computing disparity range.\n";
     float subsample_amt =
       float(roiToUse.height())*float(roiToUse.width()) / (1000.f * 1000.f);
     subsample_amt = std::max(subsample_amt, 1.0f);
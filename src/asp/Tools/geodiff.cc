@@ -17,10 +17,16 @@
 
 
 #include <asp/Core/PointUtils.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Math/Statistics.h>
 #include <vw/FileIO/DiskImageView.h>
 #include <vw/Cartography/GeoTransform.h>
 #include <vw/Cartography/PointImageManipulation.h>
 
+#include <algorithm>
+#include <cstdint>
+#include <map>
+
 
 using std::endl;
 using std::string;
@@ -56,12 +62,214 @@ public:
 };
 
 struct Options : vw::GdalWriteOptions {
-  string dem1_file, dem2_file, output_prefix, csv_format_str, csv_proj4_str;
-  double nodata_value;
+  string dem1_file, dem2_file, output_prefix, csv_format_str, csv_proj4_str,
+    percentiles_str;
+  double nodata_value, histogram_bin_size;
+  std::vector<double> percentiles;
+
+  bool use_float, use_absolute, stats, stats_only;
+};
+
+/// Statistics of the differences, accumulated from blocks which may be
+/// processed in parallel. The count, min, max, mean, and standard
+/// deviation are exact. The median, NMAD, and percentiles are found from
+/// a histogram, so they are accurate to the bin size, unless all values
+/// are kept, which is done for CSV files.
+class DiffStats {
+public:
+  DiffStats(double bin_size, bool keep_values):
+    m_bin_size(bin_size), m_keep_values(keep_values), m_count(0),
+    m_min(std::numeric_limits<double>::max()), m_max(-m_min), m_sum(0.0), m_sum2(0.0) {}
+
+  /// Add a set of values. They get sorted.
+  void add(std::vector<double> & vals) {
+
+    std::sort(vals.begin(), vals.end());
+
+    // Find the histogram of this block, then merge it in
+    std::vector<std::pair<std::int64_t, std::uint64_t>> hist;
+    double sum = 0.0, sum2 = 0.0;
+    for (size_t it = 0; it < vals.size(); it++) {
+      sum  += vals[it];
+      sum2 += vals[it] * vals[it];
+      std::int64_t bin = bin_index(vals[it]);
+      if (hist.empty() || hist.back().first != bin)
+        hist.push_back(std::make_pair(bin, 0));
+      hist.back().second++;
+    }
+
+    Mutex::Lock lock(m_mutex);
+    if (vals.empty())
+      return;
+    m_count += vals.size();
+    m_min  = std::min(m_min, vals.front());
+    m_max  = std::max(m_max, vals.back());
+    m_sum  += sum;
+    m_sum2 += sum2;
+    for (size_t it = 0; it < hist.size(); it++)
+      m_hist[hist[it].first] += hist[it].second;
+    if (m_keep_values)
+      m_vals.insert(m_vals.end(), vals.begin(), vals.end());
+  }
+
+  std::uint64_t count() const { return m_count; }
+  double min() const { return m_count > 0 ? m_min : 0.0; }
+  double max() const { return m_count > 0 ? m_max : 0.0; }
+  double mean() const { return m_count > 0 ? m_sum / m_count : 0.0; }
+  double stddev() const {
+    if (m_count == 0)
+      return 0.0;
+    double var = m_sum2 / m_count - mean() * mean();
+    return std::sqrt(std::max(var, 0.0)); // just in case, for numerical noise
+  }
+
+  /// The value below which the given percent of the values are
+  double percentile(double percent) {
+    if (m_count == 0)
+      return 0.0;
+    std::uint64_t target = std::min(m_count - 1, std::uint64_t(percent / 100.0 * m_count));
+    if (m_keep_values) {
+      std::nth_element(m_vals.begin(), m_vals.begin() + target, m_vals.end());
+      return m_vals[target];
+    }
+    std::uint64_t sum = 0;
+    for (auto it = m_hist.begin(); it != m_hist.end(); it++) {
+      sum += it->second;
+      if (sum > target)
+        return std::max(m_min, std::min(m_max, bin_center(it->first)));
+    }
+    return m_max;
+  }
+
+  double median() { return percentile(50.0); }
+
+  /// The normalized median absolute deviation from the median
+  double nmad() {
+    if (m_count == 0)
+      return 0.0;
+    double med = median();
+    if (m_keep_values) {
+      std::vector<double> devs(m_vals.size());
+      for (size_t it = 0; it < m_vals.size(); it++)
+        devs[it] = std::abs(m_vals[it] - med);
+      return 1.4826 * vw::math::destructive_median(devs);
+    }
+    std::vector<std::pair<double, std::uint64_t>> devs;
+    for (auto it = m_hist.begin(); it != m_hist.end(); it++)
+      devs.push_back(std::make_pair(std::abs(bin_center(it->first) - med), it->second));
+    std::sort(devs.begin(), devs.end());
+    std::uint64_t sum = 0, target = (m_count - 1) / 2;
+    for (size_t it = 0; it < devs.size(); it++) {
+      sum += devs[it].second;
+      if (sum > target)
+        return 1.4826 * devs[it].first;
+    }
+    return 0.0;
+  }
+
+  /// Write the histogram, as bin center and count
+  void write_histogram(std::string const& file) const {
+    vw_out() << "Writing: " << file << "\n";
+    std::ofstream ofs(file.c_str());
+    ofs.precision(16);
+    ofs << "# bin center (m), count, bin size: " << m_bin_size << "\n";
+    for (auto it = m_hist.begin(); it != m_hist.end(); it++)
+      ofs << bin_center(it->first) << "," << it->second << "\n";
+  }
 
-  bool use_float, use_absolute;
+private:
+  std::int64_t bin_index(double val) const { return std::int64_t(std::floor(val / m_bin_size)); }
+  double bin_center(std::int64_t bin) const { return (bin + 0.5) * m_bin_size; }
+
+  double m_bin_size;
+  bool m_keep_values;
+  std::uint64_t m_count;
+  double m_min, m_max, m_sum, m_sum2;
+  std::map<std::int64_t, std::uint64_t> m_hist;
+  std::vector<double> m_vals;
+  Mutex m_mutex;
 };
 
+/// Print the statistics, with each line starting with the given prefix
+void print_stats(DiffStats & stats, std::vector<double> const& percentiles,
+                 std::string const& prefix, std::ostream & os) {
+  os << prefix << "Number of differences: " << stats.count()  << std::endl;
+  os << prefix << "Max difference:       " << stats.max()     << " meters" << std::endl;
+  os << prefix << "Min difference:       " << stats.min()     << " meters" << std::endl;
+  os << prefix << "Mean difference:      " << stats.mean()    << " meters" << std::endl;
+  os << prefix << "StdDev of difference: " << stats.stddev()  << " meters" << std::endl;
+  os << prefix << "Median difference:    " << stats.median()  << " meters" << std::endl;
+  os << prefix << "NMAD of difference:   " << stats.nmad()    << " meters" << std::endl;
+  for (size_t it = 0; it < percentiles.size(); it++)
+    os << prefix << percentiles[it] << "th percentile: " << stats.percentile(percentiles[it])
+       << " meters" << std::endl;
+}
+
+/// Pass through the valid values of an image, adding them to the statistics
+class DiffStatsView: public ImageViewBase<DiffStatsView> {
+  ImageViewRef<double> m_diff;
+  double               m_nodata_value;
+  DiffStats          & m_stats; // alias
+
+public:
+  DiffStatsView(ImageViewRef<double> diff, double nodata_value, DiffStats & stats):
+    m_diff(diff), m_nodata_value(nodata_value), m_stats(stats) {}
+
+  typedef double pixel_type;
+  typedef double result_type;
+  typedef ProceduralPixelAccessor<DiffStatsView> pixel_accessor;
+
+  inline int32 cols  () const { return m_diff.cols(); }
+  inline int32 rows  () const { return m_diff.rows(); }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+  inline result_type operator()(double/*i*/, double/*j*/, int32/*p*/ = 0) const {
+    vw_throw(NoImplErr() << "DiffStatsView::operator()(...) is not implemented");
+    return result_type();
+  }
+
+  typedef CropView<ImageView<result_type>> prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+    ImageView<result_type> tile = crop(m_diff, bbox);
+    std::vector<double> vals;
+    for (int row = 0; row < tile.rows(); row++) {
+      for (int col = 0; col < tile.cols(); col++) {
+        if (tile(col, row) != m_nodata_value && !std::isnan(tile(col, row)))
+          vals.push_back(tile(col, row));
+      }
+    }
+    m_stats.add(vals);
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
+/// Compute the statistics of one block of an image, when not writing it
+class DiffStatsTask: public Task {
+  DiffStatsView m_view;
+  BBox2i        m_bbox;
+public:
+  DiffStatsTask(DiffStatsView const& view, BBox2i const& bbox): m_view(view), m_bbox(bbox) {}
+  void operator()() { m_view.prerasterize(m_bbox); }
+};
+
+/// Save the statistics of the differences
+void save_stats(Options const& opt, DiffStats & stats) {
+  print_stats(stats, opt.percentiles, "", vw_out());
+  std::string stats_file = opt.output_prefix + "-diff-stats.txt";
+  vw_out() << "Writing: " << stats_file << "\n";
+  std::ofstream ofs(stats_file.c_str());
+  ofs.precision(16);
+  print_stats(stats, opt.percentiles, "", ofs);
+  stats.write_histogram(opt.output_prefix + "-diff-histogram.csv");
+}
+
 void handle_arguments(int argc, char *argv[], Options& opt) {
   po::options_description general_options("");
   general_options.add_options()
@@ -75,7 +283,15 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Output the absolute difference as opposed to just the difference.")
     ("csv-format",     po::value(&opt.csv_format_str)->default_value(""),
      asp::csv_opt_caption().c_str())
-    ("csv-proj4",      po::value(&opt.csv_proj4_str)->default_value(""), "The PROJ.4 string to use to interpret the entries in input CSV file. If not specified, it will be borrowed from the DEM.");
+    ("csv-proj4",      po::value(&opt.csv_proj4_str)->default_value(""), "The PROJ.4 string to use to interpret the entries in input CSV file. If not specified, it will be borrowed from the DEM.")
+    ("stats",          po::bool_switch(&opt.stats)->default_value(false),
+     "Compute the statistics of the difference of two DEMs while it is written, and save them and the histogram. This is always done for a CSV file.")
+    ("stats-only",     po::bool_switch(&opt.stats_only)->default_value(false),
+     "Compute and save the statistics, but not the difference itself.")
+    ("percentiles",    po::value(&opt.percentiles_str)->default_value("5 25 75 95"),
+     "The percentiles of the difference to find, in quotes.")
+    ("histogram-bin-size", po::value(&opt.histogram_bin_size)->default_value(0.01),
+     "The bin size of the histogram of the difference of two DEMs, in meters. The median, NMAD, and percentiles are accurate to this.");
   general_options.add(vw::GdalWriteOptionsDescription(opt));
 
   po::options_description positional("");
@@ -99,6 +315,20 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     vw_throw(ArgumentErr() << "Requires <dem1> and <dem2> in order to proceed.\n\n"
              << usage << general_options);
 
+  if (opt.stats_only)
+    opt.stats = true;
+
+  if (opt.histogram_bin_size <= 0)
+    vw_throw(ArgumentErr() << "The histogram bin size must be positive.\n");
+
+  std::istringstream is(opt.percentiles_str);
+  double percent = 0;
+  while (is >> percent) {
+    if (percent < 0 || percent > 100)
+      vw_throw(ArgumentErr() << "The percentiles must be between 0 and 100.\n");
+    opt.percentiles.push_back(percent);
+  }
+
   if (opt.output_prefix.empty()) {
     opt.output_prefix = fs::basename(opt.dem1_file) + "__" + fs::basename(opt.dem2_file);
   }
@@ -188,7 +418,32 @@ void dem2dem_diff(Options& opt){
   }
     
   GeoReference crop_georef = crop(dem1_georef, crop_box);
-    
+
+  DiffStats stats(opt.histogram_bin_size, false);
+  if (opt.stats_only) {
+    // Visit each block once, in parallel, without saving the difference
+    vw_out() << "Computing the statistics of the difference.\n";
+    int num_threads = opt.num_threads;
+    if (num_threads <= 0)
+      num_threads = vw_settings().default_num_threads();
+    FifoWorkQueue queue(num_threads);
+    std::vector<BBox2i> bboxes = subdivide_bbox(difference, opt.raster_tile_size[0],
+                                                opt.raster_tile_size[1]);
+    for (size_t it = 0; it < bboxes.size(); it++) {
+      boost::shared_ptr<DiffStatsTask>
+        task(new DiffStatsTask(DiffStatsView(difference, opt.nodata_value, stats),
+                               bboxes[it]));
+      queue.add_task(task);
+    }
+    queue.join_all();
+    save_stats(opt, stats);
+    return;
+  }
+
+  // Otherwise accumulate the statistics as the blocks are written
+  if (opt.stats)
+    difference = DiffStatsView(difference, opt.nodata_value, stats);
+
   std::string output_file = opt.output_prefix + "-diff.tif";
   vw_out() << "Writing difference file: " << output_file << "\n";
     
@@ -210,8 +465,70 @@ void dem2dem_diff(Options& opt){
     block_write_image(*rsrc, difference,
                       TerminalProgressCallback("asp", "\t--> Differencing: "));
   }
+
+  if (opt.stats)
+    save_stats(opt, stats);
 }
 
+/// Find the difference between a DEM and the CSV points which fall in
+/// one block of it. The block is read once, with a one-pixel margin for
+/// interpolation.
+class CsvDiffTask: public Task {
+  ImageViewRef<double> m_dem;
+  double m_dem_nodata;
+  int m_block_size, m_num_block_cols;
+  bool m_reverse, m_use_absolute;
+  std::vector<Vector3> const& m_csv_llh; // alias
+  std::vector<Vector2> const& m_csv_pix; // alias
+  std::vector<std::pair<std::int64_t, size_t>> const& m_block_order; // alias
+  size_t m_beg, m_end;
+  std::vector<double> & m_diffs; // alias
+  std::vector<uint8>  & m_valid; // alias
+
+public:
+  CsvDiffTask(ImageViewRef<double> dem, double dem_nodata, int block_size, int num_block_cols,
+              bool reverse, bool use_absolute,
+              std::vector<Vector3> const& csv_llh, std::vector<Vector2> const& csv_pix,
+              std::vector<std::pair<std::int64_t, size_t>> const& block_order,
+              size_t beg, size_t end, std::vector<double> & diffs, std::vector<uint8> & valid):
+    m_dem(dem), m_dem_nodata(dem_nodata), m_block_size(block_size),
+    m_num_block_cols(num_block_cols), m_reverse(reverse), m_use_absolute(use_absolute),
+    m_csv_llh(csv_llh), m_csv_pix(csv_pix), m_block_order(block_order),
+    m_beg(beg), m_end(end), m_diffs(diffs), m_valid(valid) {}
+
+  void operator()() {
+
+    std::int64_t block = m_block_order[m_beg].first;
+    int block_col = block % m_num_block_cols, block_row = block / m_num_block_cols;
+    BBox2i box(block_col * m_block_size, block_row * m_block_size,
+               m_block_size + 1, m_block_size + 1);
+    box.crop(bounding_box(m_dem));
+
+    // Past the DEM edge the values are extended, as when interpolating
+    // into the whole DEM.
+    ImageView<PixelMask<double>> dem_block = crop(create_mask(m_dem, m_dem_nodata), box);
+    InterpolationView<EdgeExtensionView<ImageView<PixelMask<double>>, ConstantEdgeExtension>,
+                      BilinearInterpolation>
+      interp_dem = interpolate(dem_block, BilinearInterpolation(), ConstantEdgeExtension());
+
+    for (size_t it = m_beg; it < m_end; it++) {
+      size_t id = m_block_order[it].second;
+      Vector2 pix = m_csv_pix[id] - box.min();
+      PixelMask<double> dem_ht = interp_dem(pix[0], pix[1]);
+      if (!is_valid(dem_ht))
+        continue;
+
+      double diff = dem_ht.child() - m_csv_llh[id][2];
+      if (m_reverse)
+        diff *= -1;
+      if (m_use_absolute)
+        diff = std::abs(diff);
+      m_diffs[id] = diff;
+      m_valid[id] = 1;
+    }
+  }
+};
+
 // From a DEM, subtract a csv file. Reverse the sign is 'reverse' is true.
 void dem2csv_diff(Options & opt, std::string const& dem_file,
                   std::string const & csv_file, bool reverse){
@@ -272,67 +589,64 @@ void dem2csv_diff(Options & opt, std::string const& dem_file,
     csv_llh.push_back(llh);
   }
 
-  // We will interpolate into the DEM to find the difference
-  ImageViewRef<PixelMask<double>> interp_dem
-    = interpolate(create_mask(dem, dem_nodata),
-		  BilinearInterpolation(), ConstantEdgeExtension());
-
-  // Save the diffs
-  int    count     = 0;
-  double diff_min  = std::numeric_limits<double>::max();
-  double diff_max  = -diff_min;
-  double diff_mean = 0.0;
-  double diff_std  = 0.0;
-
-  std::vector<Vector3> csv_diff;
-  std::vector<double> csv_errs;
+  // Find where the points are in the DEM, and sort them by the DEM
+  // block they fall in, so that each block is read only once.
+  const int block_size = 256;
+  int num_block_cols = (dem.cols() + block_size - 1) / block_size;
+  std::vector<Vector2> csv_pix(csv_llh.size());
+  std::vector<std::pair<std::int64_t, size_t>> block_order;
   for (size_t it = 0; it < csv_llh.size(); it++) {
-
     Vector3 llh = csv_llh[it];
-    Vector2 ll  = subvector(llh, 0, 2);
-    Vector2 pix = dem_georef.lonlat_to_pixel(ll);
-    
+    Vector2 pix = dem_georef.lonlat_to_pixel(subvector(llh, 0, 2));
+    csv_pix[it] = pix;
+
     // Check for out of range
     if (pix[0] < 0 || pix[0] > dem.cols() - 1) continue;
     if (pix[1] < 0 || pix[1] > dem.rows() - 1) continue;
-    PixelMask<double> dem_ht = interp_dem(pix[0], pix[1]);
-    if (!is_valid(dem_ht))
-      continue;
-
-    double diff = dem_ht.child() - llh[2];
-    if (reverse) 
-      diff *= -1;
-    if (opt.use_absolute)
-      diff = std::abs(diff);
-
-    if (diff > diff_max) diff_max = diff;
-    if (diff < diff_min) diff_min = diff;
-
-    diff_mean += diff;
-    diff_std  += diff*diff;
-    count     += 1;
-    csv_diff.push_back(Vector3(ll[0], ll[1], diff));
-    csv_errs.push_back(diff);
+    std::int64_t block = std::int64_t(pix[1] / block_size) * num_block_cols
+      + std::int64_t(pix[0] / block_size);
+    block_order.push_back(std::make_pair(block, it));
   }
+  std::sort(block_order.begin(), block_order.end());
+
+  // Interpolate into the DEM to find the difference, one batch of points
+  // per DEM block, with the batches processed in parallel
+  std::vector<double> csv_errs_all(csv_llh.size(), 0.0);
+  std::vector<uint8> csv_valid(csv_llh.size(), 0);
+  FifoWorkQueue queue(vw_settings().default_num_threads());
+  size_t beg = 0;
+  while (beg < block_order.size()) {
+    size_t end = beg;
+    while (end < block_order.size() && block_order[end].first == block_order[beg].first)
+      end++;
+    boost::shared_ptr<CsvDiffTask>
+      task(new CsvDiffTask(dem, dem_nodata, block_size, num_block_cols, reverse,
+                           opt.use_absolute, csv_llh, csv_pix, block_order, beg, end,
+                           csv_errs_all, csv_valid));
+    queue.add_task(task);
+    beg = end;
+  }
+  queue.join_all();
 
-  if (count > 0) {
-    diff_mean /= count;
-    diff_std = diff_std/count - diff_mean*diff_mean;
-    if (diff_std < 0)
-      diff_std = 0; // just in case, for numerical noise
-    diff_std = std::sqrt(diff_std);
+  // Save the diffs, in the order of the input points
+  std::vector<Vector3> csv_diff;
+  std::vector<double> csv_errs;
+  for (size_t it = 0; it < csv_llh.size(); it++) {
+    if (!csv_valid[it])
+      continue;
+    csv_diff.push_back(Vector3(csv_llh[it][0], csv_llh[it][1], csv_errs_all[it]));
+    csv_errs.push_back(csv_errs_all[it]);
   }
 
-  double diff_median = 0.0;
-  std::sort(csv_errs.begin(), csv_errs.end());
-  if (csv_errs.size() > 0) 
-    diff_median = csv_errs[csv_errs.size()/2];
+  bool keep_values = true; // all values are in memory anyway
+  DiffStats stats(opt.histogram_bin_size, keep_values);
+  stats.add(csv_errs);
+  print_stats(stats, opt.percentiles, "", vw_out());
 
-  vw_out() << "Max difference:       " << diff_max    << " meters" << std::endl;
-  vw_out() << "Min difference:       " << diff_min    << " meters" << std::endl;
-  vw_out() << "Mean difference:      " << diff_mean   << " meters" << std::endl;
-  vw_out() << "StdDev of difference: " << diff_std    << " meters" << std::endl;
-  vw_out() << "Median difference:    " << diff_median << " meters" << std::endl;
+  if (opt.stats_only) {
+    save_stats(opt, stats);
+    return;
+  }
 
   std::string output_file = opt.output_prefix + "-diff.csv";
   vw_out() << "Writing difference file: " << output_file << "\n";
@@ -340,11 +654,7 @@ void dem2csv_diff(Options & opt, std::string const& dem_file,
   outfile.precision(16);
   outfile << "# longitude,latitude, height diff (m)" << std::endl;
   outfile << "# " << dem_georef.datum() << std::endl; // dem's datum
-  outfile << "# Max difference:       " << diff_max    << " meters" << std::endl;
-  outfile << "# Min difference:       " << diff_min    << " meters" << std::endl;
-  outfile << "# Mean difference:      " << diff_mean   << " meters" << std::endl;
-  outfile << "# StdDev of difference: " << diff_std    << " meters" << std::endl;
-  outfile << "# Median difference:    " << diff_median << " meters" << std::endl;
+  print_stats(stats, opt.percentiles, "# ", outfile);
   for (size_t it = 0; it < csv_diff.size(); it++) {
     Vector3 diff = csv_diff[it];
     outfile << diff[0] << "," << diff[1] << "," << diff[2] << std::endl;
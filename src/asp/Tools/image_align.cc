@@ -19,12 +19,16 @@
 ///
 /// Tool for aligning a second image to a first image.
 
+#include <vw/Core/ThreadPool.h>
 #include <vw/FileIO/DiskImageUtils.h>
+#include <vw/Image/AntiAliasing.h>
+#include <vw/Image/BlockRasterize.h>
 #include <vw/Image/Manipulation.h>
 #include <vw/Image/PixelTypeInfo.h>
 #include <vw/FileIO/MatrixIO.h>
 
 #include <asp/Core/Common.h>
+#include <asp/Core/ImageOverviews.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/InterestPointMatching.h>
 
@@ -37,11 +41,12 @@ struct Options: vw::GdalWriteOptions {
     input_transform, disparity_params;
   bool has_input_nodata_value, has_output_nodata_value;
   double input_nodata_value, output_nodata_value, inlier_threshold;
-  int ip_per_image, num_ransac_iterations, output_data_type;
+  int ip_per_image, num_ransac_iterations, output_data_type, pyramid_levels;
   Options(): has_input_nodata_value(false), has_output_nodata_value(false),
              input_nodata_value (std::numeric_limits<double>::quiet_NaN()),
              output_nodata_value(std::numeric_limits<double>::quiet_NaN()),
-             ip_per_image(0), num_ransac_iterations(0.0), inlier_threshold(0){}
+             ip_per_image(0), num_ransac_iterations(0.0), inlier_threshold(0),
+             pyramid_levels(0){}
 };
 
 
@@ -184,26 +189,19 @@ Matrix<double> do_ransac(std::vector<Vector3> const& ransac_ip1,
   }
 }
     
-/// Compute a matrix transform between images, searching for IP in
-///  the specified regions.
-Matrix<double>
-calc_alignment_transform(std::string const& image_file1,
-                         std::string const& image_file2,
-                         std::vector<ip::InterestPoint> &matched_ip1,
-                         std::vector<ip::InterestPoint> &matched_ip2,
-                         Options const& opt) {
-  
-  // Convert to 3D points with the third coordinate being 1, obtaining
-  // homogeneous coordinates.
-  std::vector<Vector3> ransac_ip1 = iplist_to_vectorlist(matched_ip1);
-  std::vector<Vector3> ransac_ip2 = iplist_to_vectorlist(matched_ip2);
+/// Find the transform from the second image to the first one with
+/// RANSAC, and the indices of the inliers.
+Matrix<double> fit_transform(std::vector<Vector3> const& ransac_ip1,
+                             std::vector<Vector3> const& ransac_ip2,
+                             Options const& opt,
+                             // Output
+                             std::vector<size_t> & indices) {
 
   // RANSAC parameters.
   const int    min_num_output_inliers = ransac_ip1.size()/2;
   const bool   reduce_num_inliers_if_no_fit = true;
 
   Matrix<double> tf;
-  std::vector<size_t> indices;
   if (opt.alignment_transform == "translation") {
     tf = do_ransac<vw::math::TranslationFittingFunctor>
       (ransac_ip1, ransac_ip2, opt, min_num_output_inliers,
@@ -228,6 +226,205 @@ calc_alignment_transform(std::string const& image_file1,
     vw_throw(ArgumentErr() << "Unknown alignment transform: "
              << opt.alignment_transform << ".\n");
   }
+
+  return tf;
+}
+
+/// An image at the given level of a pyramid, with the no-data pixels
+/// masked. Each level has half the resolution of the one before it.
+/// The coarser levels are the overviews kept next to the image, which
+/// are made if missing, and are shared by the tools using them.
+ImageViewRef<PixelMask<double>> pyramid_level(std::string const& image_file,
+                                              ImageViewRef<double> image,
+                                              double nodata, int level,
+                                              Options const& opt) {
+  if (level <= 0)
+    return create_mask(image, nodata);
+  return pixel_cast<PixelMask<double>>(asp::image_overview(image_file, nodata, level, opt));
+}
+
+/// Apply a 3x3 transform to a pixel, in homogeneous coordinates
+Vector2 apply_tf(Matrix<double> const& tf, Vector2 const& pix) {
+  Vector3 q = tf * Vector3(pix[0], pix[1], 1.0);
+  return Vector2(q[0], q[1]) / q[2];
+}
+
+/// Refine the matches for a range of samples
+class RefineMatchesTask: public vw::Task, private boost::noncopyable {
+  ImageViewRef<PixelMask<double>> const& m_img1;
+  ImageViewRef<PixelMask<double>> const& m_img2;
+  std::vector<Vector2i> const& m_pix2;
+  std::vector<Vector2>  const& m_pred1;
+  int m_half_patch, m_search_radius;
+  double m_min_ncc;
+  size_t m_beg, m_end;
+  std::vector<Vector2> & m_pix1;
+  std::vector<unsigned char> & m_found;
+public:
+  RefineMatchesTask(ImageViewRef<PixelMask<double>> const& img1,
+                    ImageViewRef<PixelMask<double>> const& img2,
+                    std::vector<Vector2i> const& pix2, std::vector<Vector2> const& pred1,
+                    int half_patch, int search_radius, double min_ncc,
+                    size_t beg, size_t end,
+                    std::vector<Vector2> & pix1, std::vector<unsigned char> & found):
+    m_img1(img1), m_img2(img2), m_pix2(pix2), m_pred1(pred1),
+    m_half_patch(half_patch), m_search_radius(search_radius), m_min_ncc(min_ncc),
+    m_beg(beg), m_end(end), m_pix1(pix1), m_found(found) {}
+
+  void operator()() {
+    for (size_t it = m_beg; it < m_end; it++)
+      m_found[it] = asp::refine_match(m_img1, m_img2, m_pix2[it], m_pred1[it],
+                                           m_half_patch, m_search_radius, m_min_ncc, m_pix1[it]);
+  }
+};
+
+/// Match interest points at the coarsest level of a pyramid of the
+/// images, and fit a transform. At each finer level, predict with it
+/// where samples on a grid of the second image are in the first one,
+/// refine the predictions with local correlation, and fit the
+/// transform again. Return the matches at full resolution.
+void find_matches_pyramid(std::string const& image_file1, std::string const& image_file2,
+                          ImageViewRef<double> image1, ImageViewRef<double> image2,
+                          double nodata1, double nodata2,
+                          std::vector<ip::InterestPoint> &matched_ip1,
+                          std::vector<ip::InterestPoint> &matched_ip2,
+                          Options const& opt) {
+
+  matched_ip1.clear();
+  matched_ip2.clear();
+
+  int num_threads = vw_settings().default_num_threads();
+  int level = opt.pyramid_levels;
+  vw_out() << "Matching interest points between: " << image_file1 << " and "
+           << image_file2 << " at pyramid level " << level << ".\n";
+
+  // The coarsest level is small, so it can be kept in memory
+  ImageView<PixelMask<double>> coarse1
+    = block_rasterize(pyramid_level(image_file1, image1, nodata1, level, opt),
+                      Vector2i(256, 256), num_threads);
+  ImageView<PixelMask<double>> coarse2
+    = block_rasterize(pyramid_level(image_file2, image2, nodata2, level, opt),
+                      Vector2i(256, 256), num_threads);
+
+  int ip_per_tile = 0;
+  asp::stereo_settings().ip_per_image = opt.ip_per_image;
+  std::vector<ip::InterestPoint> ip1, ip2;
+  asp::detect_match_ip(ip1, ip2,
+                       vw::pixel_cast<float>(apply_mask(coarse1, nodata1)),
+                       vw::pixel_cast<float>(apply_mask(coarse2, nodata2)),
+                       ip_per_tile,
+                       "", "", // Do not read ip from disk
+                       nodata1, nodata2, "");
+  if (ip1.empty())
+    vw_throw(ArgumentErr() << "No interest point matches were found at pyramid level "
+             << level << ". Try using fewer levels.\n");
+
+  std::vector<size_t> indices;
+  Matrix<double> tf = fit_transform(iplist_to_vectorlist(ip1), iplist_to_vectorlist(ip2),
+                                    opt, indices);
+
+  // How many samples to refine at each level, and how
+  int num_samples = (opt.ip_per_image > 0) ? opt.ip_per_image : 5000;
+  int half_patch = 7, search_radius = 4;
+  double min_ncc = 0.6;
+  
+  // Going to a finer level doubles the pixel coordinates
+  Matrix<double> up = vw::math::identity_matrix(3);
+  up(0, 0) = 2.0; up(1, 1) = 2.0;
+  Matrix<double> down = vw::math::identity_matrix(3);
+  down(0, 0) = 0.5; down(1, 1) = 0.5;
+  
+  std::vector<Vector2i> pix2;
+  std::vector<Vector2>  pred1, pix1;
+  std::vector<unsigned char> found;
+  while (level > 0) {
+    level--;
+    tf = up * tf * down;
+
+    ImageViewRef<PixelMask<double>> img1
+      = pyramid_level(image_file1, image1, nodata1, level, opt);
+    ImageViewRef<PixelMask<double>> img2
+      = pyramid_level(image_file2, image2, nodata2, level, opt);
+
+    // Samples on a grid, whose predicted locations are in the first image
+    double area = double(img2.cols()) * double(img2.rows());
+    int spacing = std::max(int(round(sqrt(area / num_samples))), 1);
+    pix2.clear();
+    pred1.clear();
+    for (int row = 0; row < img2.rows(); row += spacing) {
+      for (int col = 0; col < img2.cols(); col += spacing) {
+        Vector2 pred = apply_tf(tf, Vector2(col, row));
+        if (pred[0] < 0 || pred[1] < 0 || pred[0] > img1.cols() - 1 ||
+            pred[1] > img1.rows() - 1)
+          continue;
+        pix2.push_back(Vector2i(col, row));
+        pred1.push_back(pred);
+      }
+    }
+
+    // Refine them in parallel
+    pix1.assign(pix2.size(), Vector2());
+    found.assign(pix2.size(), 0);
+    {
+      size_t chunk = std::max(size_t(1), pix2.size() / (8 * std::max(num_threads, 1)) + 1);
+      FifoWorkQueue queue(std::max(num_threads, 1));
+      for (size_t beg = 0; beg < pix2.size(); beg += chunk) {
+        boost::shared_ptr<RefineMatchesTask>
+          task(new RefineMatchesTask(img1, img2, pix2, pred1, half_patch, search_radius,
+                                     min_ncc, beg, std::min(beg + chunk, pix2.size()),
+                                     pix1, found));
+        queue.add_task(task);
+      }
+      queue.join_all();
+    }
+
+    ip1.clear();
+    ip2.clear();
+    for (size_t it = 0; it < pix2.size(); it++) {
+      if (!found[it])
+        continue;
+      ip1.push_back(vw::ip::InterestPoint(pix1[it].x(), pix1[it].y()));
+      ip2.push_back(vw::ip::InterestPoint(pix2[it].x(), pix2[it].y()));
+    }
+    vw_out() << "Refined " << ip1.size() << " / " << pix2.size()
+             << " matches at pyramid level " << level << ".\n";
+    if (ip1.empty())
+      vw_throw(ArgumentErr() << "No matches could be refined at pyramid level "
+               << level << ". Try using fewer levels.\n");
+
+    // The transform at full resolution is found by the caller
+    if (level > 0)
+      tf = fit_transform(iplist_to_vectorlist(ip1), iplist_to_vectorlist(ip2),
+                         opt, indices);
+  }
+
+  matched_ip1 = ip1;
+  matched_ip2 = ip2;
+
+  if (opt.output_prefix != "") {
+    // Write a match file for debugging
+    std::string match_file = ip::match_filename(opt.output_prefix, image_file1, image_file2);
+    vw_out() << "Writing matches to: " << match_file << std::endl;
+    ip::write_binary_match_file(match_file, matched_ip1, matched_ip2);
+  }
+}
+
+/// Compute a matrix transform between images, searching for IP in
+///  the specified regions.
+Matrix<double>
+calc_alignment_transform(std::string const& image_file1,
+                         std::string const& image_file2,
+                         std::vector<ip::InterestPoint> &matched_ip1,
+                         std::vector<ip::InterestPoint> &matched_ip2,
+                         Options const& opt) {
+  
+  // Convert to 3D points with the third coordinate being 1, obtaining
+  // homogeneous coordinates.
+  std::vector<Vector3> ransac_ip1 = iplist_to_vectorlist(matched_ip1);
+  std::vector<Vector3> ransac_ip2 = iplist_to_vectorlist(matched_ip2);
+
+  std::vector<size_t> indices;
+  Matrix<double> tf = fit_transform(ransac_ip1, ransac_ip2, opt, indices);
     
   // Keeping only inliers
   std::vector<ip::InterestPoint> inlier_ip1, inlier_ip2;
@@ -278,7 +475,9 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     ("input-transform", po::value(&opt.input_transform)->default_value(""),
      "Instead of computing an alignment transform, read and apply the one from this file. Must be stored as a 3x3 matrix.")
     ("disparity-params", po::value(&opt.disparity_params)->default_value(""),
-     "Find the alignment transform by using, instead of interest points, a disparity, such as produced by 'parallel_stereo --correlator-mode'. Specify as a string in quotes, in the format: 'disparity.tif num_samples'.");
+     "Find the alignment transform by using, instead of interest points, a disparity, such as produced by 'parallel_stereo --correlator-mode'. Specify as a string in quotes, in the format: 'disparity.tif num_samples'.")
+    ("pyramid-levels", po::value(&opt.pyramid_levels)->default_value(0),
+     "If positive, find interest point matches only at this level of a pyramid of the images, with each level having half the resolution of the one before it. Refine the matches at each finer level with local correlation near where the alignment transform predicts them. This is much faster for large images.");
     
   po::options_description positional("");
   positional.add_options()
@@ -306,6 +505,12 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
   if (opt.output_image.empty())
     vw_throw(ArgumentErr() << "Missing output image name.\n" << usage << general_options);
 
+  if (opt.pyramid_levels < 0)
+    vw_throw(ArgumentErr() << "The number of pyramid levels must be non-negative.\n");
+  
+  if (opt.pyramid_levels > 0 && opt.disparity_params != "")
+    vw_throw(ArgumentErr() << "Cannot use both --pyramid-levels and --disparity-params.\n");
+  
   if (opt.alignment_transform != "translation" && opt.alignment_transform != "rigid" &&
       opt.alignment_transform != "similarity" && opt.alignment_transform != "affine" &&
       opt.alignment_transform != "homography") {
@@ -432,7 +637,10 @@ int main(int argc, char *argv[]) {
     Matrix<double> tf;
     if (opt.input_transform.empty()) {
       std::vector<ip::InterestPoint> matched_ip1, matched_ip2;
-      if (opt.disparity_params == "")
+      if (opt.disparity_params == "" && opt.pyramid_levels > 0)
+        find_matches_pyramid(image_file1, image_file2, image1, image2,  
+                             nodata1, nodata2, matched_ip1, matched_ip2, opt);
+      else if (opt.disparity_params == "")
         find_matches(image_file1, image_file2, image1, image2,  
                      nodata1, nodata2, matched_ip1, matched_ip2, opt);
       else
@@ -40,6 +40,7 @@
 #include <asp/Core/Macros.h>
 
 #include <vector>
+#include <algorithm>
 
 #include <boost/program_options.hpp>
 #include <boost/spirit/include/qi.hpp>
@@ -123,27 +124,6 @@ void tab(int indent) {
     std::cout << ' ';
 }
 
-// TODO: Are there pixel functions for these?
-template <typename T>
-T manual_min(const std::vector<T> &vec) {
-
-  T minVal = vec[0];
-  for (size_t i=1; i<vec.size(); ++i)
-    if (vec[i] < minVal)
-      minVal = vec[i];
-  return minVal;
-}
-template <typename T>
-T manual_max(const std::vector<T> &vec) {
-
-  T maxVal = vec[0];
-  for (size_t i=1; i<vec.size(); ++i)
-    if (vec[i] > maxVal)
-      maxVal = vec[i];
-  return maxVal;
-}
-
-
 // This type represents an operation performed on one or more inputs.
 struct calc_operation {
 
@@ -207,55 +187,6 @@ struct calc_operation {
       std::vector<calc_operation> temp = inputs[0].inputs;
       inputs = temp;
     }
-
-
-    /// Apply the operation tree to the input parameters and return a result
-    template <typename T>
-    T applyOperation(const std::vector<T> &params) const {
-      // Get the results from each input node.
-      // - This is a recursive call.
-      const size_t numInputs = inputs.size();
-      std::vector<T> inputResults(numInputs);
-      for (size_t i=0; i<numInputs; ++i)
-        inputResults[i] = inputs[i].applyOperation(params);
-
-      // Now perform the operation for this node
-      switch(opType) {
-        // Unary
-        case OP_number:   return T(value);
-        case OP_variable: if (varName >= static_cast<int>(params.size()))
-          vw_throw(ArgumentErr()
-                   << "Unrecognized variable input. Note that the first variable is var_0.\n");
-          return params[varName];
-        if (numInputs < 1)
-          vw_throw(LogicErr() << "Insufficient inputs for this operation.\n");
-        case OP_negate:   return T(-1 * inputResults[0]);
-        case OP_abs:      return T(std::abs(inputResults[0])); // regular abs casts to integer.
-        case OP_sign:     return T(boost::math::sign(inputResults[0]));
-
-        // Binary
-        if (numInputs < 2)
-          vw_throw(LogicErr() << "Insufficient inputs for this operation.\n");
-        case OP_add:      return (inputResults[0] + inputResults[1]);
-        case OP_subtract: return (inputResults[0] - inputResults[1]);
-        case OP_divide:   return (inputResults[0] / inputResults[1]);
-        case OP_multiply: return (inputResults[0] * inputResults[1]);
-        case OP_power:    return (pow(inputResults[0], inputResults[1]));
-
-        // Multi
-        case OP_min:      return manual_min(inputResults); // TODO: Do these functions exist?
-        case OP_max:      return manual_max(inputResults);
-
-        case OP_lt:   return (inputResults[0] <  inputResults[1]) ? inputResults[2] : inputResults[3];
-        case OP_gt:   return (inputResults[0] >  inputResults[1]) ? inputResults[2] : inputResults[3];
-        case OP_lte:  return (inputResults[0] <= inputResults[1]) ? inputResults[2] : inputResults[3];
-        case OP_gte:  return (inputResults[0] >= inputResults[1]) ? inputResults[2] : inputResults[3];
-        case OP_eq:   return (inputResults[0] == inputResults[1]) ? inputResults[2] : inputResults[3];
-
-        default:
-          vw_throw(LogicErr() << "Unexpected operation type.\n");
-      }
-    }
 };
 
 
@@ -367,7 +298,157 @@ struct calc_grammar : b_s::qi::grammar<ITER, calc_operation(), b_s::ascii::space
 
 }; // End struct calc_grammar
 
-/// Image view class which applies the calc_operation tree to each pixel location.
+//================================================================================
+// - Evaluating the operations tree over rows of pixels
+
+/// The operations tree compiled to a list of instructions. Each one
+/// acts on a whole row of values at once, in tight loops the compiler
+/// can vectorize, rather than the tree being walked for each pixel.
+/// The values are kept in registers, each a buffer of one row. The
+/// inputs of a node are computed into consecutive registers, and its
+/// result overwrites the first of them, so the number of registers is
+/// only the depth of the tree.
+class CalcProgram {
+public:
+
+  CalcProgram(): m_num_regs(0) {}
+
+  /// Compile the tree. The variables must be less than num_vars.
+  void compile(calc_operation const& tree, int num_vars) {
+    m_code.clear();
+    m_num_regs = 0;
+    compile_node(tree, num_vars, 0);
+  }
+
+  int num_regs() const { return m_num_regs; }
+
+  /// Evaluate for num values. The values of variable v are at vars[v].
+  /// The registers must have room for num_regs() * num values.
+  /// The result is in the first register.
+  void run(std::vector<const double*> const& vars, int num, double * regs) const {
+    for (size_t it = 0; it < m_code.size(); it++) {
+      Instr const& ins = m_code[it];
+      double * out = regs + size_t(ins.reg) * num;
+      const double * a = out;
+      const double * b = out + num;
+      const double * c = out + 2 * num;
+      const double * d = out + 3 * num;
+      switch (ins.op) {
+        case OP_number:
+          for (int k = 0; k < num; k++) out[k] = ins.value;
+          break;
+        case OP_variable:
+          std::copy(vars[ins.var], vars[ins.var] + num, out);
+          break;
+        case OP_negate:
+          for (int k = 0; k < num; k++) out[k] = -1 * a[k];
+          break;
+        case OP_abs:
+          for (int k = 0; k < num; k++) out[k] = std::abs(a[k]);
+          break;
+        case OP_sign:
+          for (int k = 0; k < num; k++) out[k] = boost::math::sign(a[k]);
+          break;
+        case OP_add:
+          for (int k = 0; k < num; k++) out[k] = a[k] + b[k];
+          break;
+        case OP_subtract:
+          for (int k = 0; k < num; k++) out[k] = a[k] - b[k];
+          break;
+        case OP_divide:
+          for (int k = 0; k < num; k++) out[k] = a[k] / b[k];
+          break;
+        case OP_multiply:
+          for (int k = 0; k < num; k++) out[k] = a[k] * b[k];
+          break;
+        case OP_power:
+          for (int k = 0; k < num; k++) out[k] = pow(a[k], b[k]);
+          break;
+        case OP_min:
+          for (int i = 1; i < ins.num_inputs; i++) {
+            const double * u = out + size_t(i) * num;
+            for (int k = 0; k < num; k++) if (u[k] < out[k]) out[k] = u[k];
+          }
+          break;
+        case OP_max:
+          for (int i = 1; i < ins.num_inputs; i++) {
+            const double * u = out + size_t(i) * num;
+            for (int k = 0; k < num; k++) if (u[k] > out[k]) out[k] = u[k];
+          }
+          break;
+        case OP_lt:
+          for (int k = 0; k < num; k++) out[k] = (a[k] <  b[k]) ? c[k] : d[k];
+          break;
+        case OP_gt:
+          for (int k = 0; k < num; k++) out[k] = (a[k] >  b[k]) ? c[k] : d[k];
+          break;
+        case OP_lte:
+          for (int k = 0; k < num; k++) out[k] = (a[k] <= b[k]) ? c[k] : d[k];
+          break;
+        case OP_gte:
+          for (int k = 0; k < num; k++) out[k] = (a[k] >= b[k]) ? c[k] : d[k];
+          break;
+        case OP_eq:
+          for (int k = 0; k < num; k++) out[k] = (a[k] == b[k]) ? c[k] : d[k];
+          break;
+        default:
+          vw_throw(LogicErr() << "Unexpected operation type.\n");
+      }
+    }
+  }
+
+private:
+
+  struct Instr {
+    OperationType op;
+    int reg;        // where the inputs are and the result goes
+    int num_inputs;
+    double value;   // for OP_number
+    int var;        // for OP_variable
+  };
+
+  void compile_node(calc_operation const& node, int num_vars, int reg) {
+    int num_inputs = node.inputs.size();
+    int min_inputs = 0;
+    switch (node.opType) {
+      case OP_number: break;
+      case OP_variable:
+        if (node.varName < 0 || node.varName >= num_vars)
+          vw_throw(ArgumentErr()
+                   << "Unrecognized variable input. Note that the first variable is var_0.\n");
+        break;
+      case OP_negate: case OP_abs: case OP_sign: case OP_min: case OP_max:
+        min_inputs = 1; break;
+      case OP_add: case OP_subtract: case OP_divide: case OP_multiply: case OP_power:
+        min_inputs = 2; break;
+      case OP_lt: case OP_gt: case OP_lte: case OP_gte: case OP_eq:
+        min_inputs = 4; break;
+      default:
+        vw_throw(LogicErr() << "Unexpected operation type.\n");
+    }
+    if (num_inputs < min_inputs)
+      vw_throw(ArgumentErr() << "Insufficient inputs for operation "
+               << getTagName(node.opType) << ".\n");
+
+    for (int i = 0; i < num_inputs; i++)
+      compile_node(node.inputs[i], num_vars, reg + i);
+
+    Instr ins;
+    ins.op         = node.opType;
+    ins.reg        = reg;
+    ins.num_inputs = num_inputs;
+    ins.value      = node.value;
+    ins.var        = node.varName;
+    m_code.push_back(ins);
+    m_num_regs = std::max(m_num_regs, reg + std::max(num_inputs, 1));
+  }
+
+  std::vector<Instr> m_code;
+  int m_num_regs;
+};
+
+/// Image view class which applies the calc_operation tree to each pixel location,
+/// a row of a tile at a time.
 template <class ImageT, typename OutputPixelT>
 class ImageCalcView : public ImageViewBase<ImageCalcView<ImageT, OutputPixelT> > {
 
@@ -381,7 +462,7 @@ private: // Variables
   std::vector<bool> m_has_nodata_vec;
   std::vector<double> m_nodata_vec; // nodata is always double
   double              m_output_nodata;
-  calc_operation m_operation_tree;
+  CalcProgram m_program;
   int m_num_rows;
   int m_num_cols;
   int m_num_channels;
@@ -395,8 +476,7 @@ public: // Functions
                 double outputNodata,
                 calc_operation const& operation_tree):
     m_image_vec(imageVec),   m_has_nodata_vec(has_nodata_vec),
-    m_nodata_vec(nodata_vec), m_output_nodata(outputNodata),
-    m_operation_tree(operation_tree) {
+    m_nodata_vec(nodata_vec), m_output_nodata(outputNodata) {
     const size_t numImages = imageVec.size();
     VW_ASSERT((numImages > 0), ArgumentErr()
               << "ImageCalcView: One or more images required.");
@@ -416,6 +496,8 @@ public: // Functions
         vw_throw(ArgumentErr()
                  << "Error: Input images must all have the same size and number of channels.");
     }
+
+    m_program.compile(operation_tree, numImages);
   }
 
   inline int32 cols  () const { return m_num_cols; }
@@ -438,52 +520,55 @@ public: // Functions
     // Set up the output image tile
     ImageView<result_type> tile(bbox.width(), bbox.height());
 
-    // TODO: Left to right processing.
-
-    // Set up for pixel calculations
+    // Set up for row calculations
     const size_t num_images = m_image_vec.size();
-    std::vector<input_pixel_type> input_pixels(num_images);
-    std::vector<double>           input_doubles(num_images);
+    const int num_cols = bbox.width();
 
     // Rasterize all the input images at this particular tile
     std::vector<ImageView<input_pixel_type> > input_tiles(num_images);
     for (size_t i=0; i<num_images; ++i)
       input_tiles[i] = crop(m_image_vec[i], bbox);
 
-    // Loop through each output pixel and compute each output value
-    for (int c = 0; c < bbox.width(); c++) {
-      for (int r = 0; r < bbox.height(); r++) {
-        // Fetch all the input pixels for this location
-        bool isNodata = false;
-        for (size_t i=0; i<num_images; ++i) {
-          input_pixels[i] = (input_tiles[i])(c,r);
+    // The values of each variable for a row, and the registers
+    std::vector<double> var_buf(num_images * num_cols);
+    std::vector<const double*> vars(num_images);
+    for (size_t i=0; i<num_images; ++i)
+      vars[i] = &var_buf[i * num_cols];
+    std::vector<double> regs(size_t(m_program.num_regs()) * num_cols);
+    std::vector<char> is_nodata(num_cols);
 
-          // If any of the input pixels are nodata, the output is nodata.
-          if (m_has_nodata_vec[i] && (m_nodata_vec[i] == input_pixels[i])) {
-            isNodata = true;
+    for (int r = 0; r < bbox.height(); r++) {
+
+      // If any of the input pixels are nodata, the output is nodata.
+      for (int c = 0; c < num_cols; c++) {
+        is_nodata[c] = false;
+        for (size_t i=0; i<num_images; ++i) {
+          if (m_has_nodata_vec[i] && (m_nodata_vec[i] == input_tiles[i](c, r))) {
+            is_nodata[c] = true;
             break;
           }
-        } // End image loop
-
-        if (isNodata) { // Output is nodata, move on to the next pixel
-          tile(c, r) = m_output_nodata;
-          continue;
         }
+      }
 
-        for (int chan=0; chan<m_num_channels; ++chan) {
-          for (size_t i=0; i<num_images; ++i) {
-            input_doubles[i] = input_pixels[i][chan];
-          } // End image loop
-
-          // Apply the operation tree to this pixel and store in the output pixel
-          // TODO(oalexan1): Should we round too, if output is int?
-          double newVal = m_operation_tree.applyOperation<double>(input_doubles);
-          tile(c, r, chan) = clamp_and_cast<output_channel_type>(newVal);
+      for (int chan=0; chan<m_num_channels; ++chan) {
+        for (size_t i=0; i<num_images; ++i) {
+          double * row = &var_buf[i * num_cols];
+          for (int c = 0; c < num_cols; c++)
+            row[c] = input_tiles[i](c, r)[chan];
+        }
 
-        } // End channel loop
+        // Apply the operation tree to this row and store in the output pixels
+        // TODO(oalexan1): Should we round too, if output is int?
+        m_program.run(vars, num_cols, &regs[0]);
+        for (int c = 0; c < num_cols; c++) {
+          if (is_nodata[c])
+            tile(c, r) = m_output_nodata;
+          else
+            tile(c, r, chan) = clamp_and_cast<output_channel_type>(regs[c]);
+        }
+      } // End channel loop
 
-      } // End row loop
-    } // End column loop
+    } // End row loop
 
   // Return the tile we created with fake borders to make it look the
   // size of the entire output image
@@ -379,127 +379,127 @@ public:
     return result_type();
   }
 
+  /// Transform the given region of the output image from input image i,
+  /// with bilinear interpolation. The needed part of the input is read
+  /// in memory once. The transforms are affine, so the input location of
+  /// each output pixel is found exactly from the location of the first
+  /// pixel and the steps along a row and a column, with no per-pixel call
+  /// to the transform.
+  void transform_section(size_t i, BBox2i const& out_box, ImageView<T> & out) const {
+
+    out.set_size(out_box.width(), out_box.height());
+    fill(out, T()); // invalid
+
+    if (dynamic_cast<AffineTransform*>(m_transforms[i].get()) == NULL)
+      vw_throw(NoImplErr() << "Only affine transforms are supported.\n");
+    vw::Transform const& tx = *m_transforms[i];
+
+    BBox2i input_bbox = tx.reverse_bbox(out_box);
+    input_bbox.expand(BilinearInterpolation::pixel_buffer + 1);
+    input_bbox.crop(bounding_box(m_images[i]));
+    if (input_bbox.empty())
+      return;
+
+    ImageView<T> input = crop(m_images[i], input_bbox);
+    InterpolationView<EdgeExtensionView<ImageView<T>, ZeroEdgeExtension>, BilinearInterpolation>
+      interp_input = interpolate(input, BilinearInterpolation(), ZeroEdgeExtension());
+
+    Vector2 p0 = tx.reverse(Vector2(out_box.min())) - Vector2(input_bbox.min());
+    Vector2 dx = tx.reverse(Vector2(out_box.min()) + Vector2(1, 0))
+      - Vector2(input_bbox.min()) - p0;
+    Vector2 dy = tx.reverse(Vector2(out_box.min()) + Vector2(0, 1))
+      - Vector2(input_bbox.min()) - p0;
+
+    for (int r = 0; r < out.rows(); r++) {
+      Vector2 row_start = p0 + double(r)*dy;
+      for (int c = 0; c < out.cols(); c++) {
+        Vector2 p = row_start + double(c)*dx;
+        // Away from the loaded region all is invalid, as with zero edge extension
+        if (p[0] < -1 || p[1] < -1 || p[0] > input.cols() || p[1] > input.rows())
+          continue;
+        out(c, r) = interp_input(p[0], p[1]);
+      }
+    }
+  }
+
   typedef CropView<ImageView<result_type> > prerasterize_type;
   inline prerasterize_type prerasterize(BBox2i const& bbox) const {
 
-    // Initialize the output tile
+    // Initialize the output tile. The sums of weighted values are
+    // accumulated in it, and normalized at the end. Track which output
+    // pixels got any valid input pixel, even with zero weight.
     ImageView<result_type> tile   (bbox.width(), bbox.height());
     ImageView<float      > weights(bbox.width(), bbox.height());
-    fill(tile,    m_output_nodata_value);
+    ImageView<uint8      > covered(bbox.width(), bbox.height());
+    fill(tile,    0);
     fill(weights, 0);
+    fill(covered, 0);
 
     // Loop through the intersecting input images and paste them in
     //  to the output image.
     for (size_t i=0; i<m_images.size(); ++i) {
 
-      //std::cout << "i = " << i << std::endl;
-      //std::cout << "bbox = " << bbox << std::endl;
-      //std::cout << "m_bboxes[i] = " << m_bboxes[i] << std::endl;
-
       // Get the intersection (if any) of this image with the current bbox.
-      if (!m_bboxes[i].intersects(bbox)) {
-        //std::cout << "Skipping\n";
+      if (!m_bboxes[i].intersects(bbox))
         continue;
-      }
       BBox2i intersect = m_bboxes[i];
       intersect.crop(bbox);
 
-      typedef ImageView<T> ImageT;
-      typedef InterpolationView<ImageT, BilinearInterpolation> InterpT;
-      
-      // Find the required section of the input image.
-      //BBox2f temp_bbox = compute_transformed_bbox_fast(intersect, inv_trans);
-      BBox2i temp_bbox = m_transforms[i]->reverse_bbox(intersect);
-      temp_bbox.expand(BilinearInterpolation::pixel_buffer);
-      BBox2i input_bbox = temp_bbox;
-      input_bbox.crop(bounding_box(m_images[i]));
-      
       BBox2i tile_bbox = intersect - bbox.min(); // ROI of this input in the output tile
 
-      //std::cout << "intersect = " << intersect << std::endl;
-      //std::cout << "intersect.max() = " << intersect.max() << std::endl;
-      //std::cout << "input_bbox = " << input_bbox << std::endl;
-      //std::cout << "tile_bbox = " << tile_bbox << std::endl;
-
-      // TODO: Clean up
-      AffineTransform* temp = dynamic_cast<AffineTransform*>(m_transforms[i].get());
-
       // --> Requires loading a larger section of the input image,
       //     calling grassfire on it, and then extracting out the section we need.
 
       /// This sets the extra area we work with to improve the blending weights.
       BBox2i expanded_intersect = intersect;
       expanded_intersect.expand(m_blend_radius);
-      
-      // Get the cropped piece of the transformed input image that we need
-      ImageView<T> trans_input = crop(transform(m_images[i], *temp,
-                                                ZeroEdgeExtension(),
-                                                BilinearInterpolation()),
-                                      expanded_intersect);
+
+      // Get the transformed input image over the expanded region
+      ImageView<T> trans_input;
+      transform_section(i, expanded_intersect, trans_input);
+
       ImageView<double> input_weights;
       //  = grassfire(notnodata(apply_mask(trans_input,0), 0));
       bool fill_holes  = false; // Don't fill holes
       bool min_weights = true;  // This option works better with the applied cutoffs
       centerline_weights(trans_input, input_weights, BBox2i(), fill_holes, min_weights);
-      
+
       double dist = std::min(intersect.height(), intersect.width()) / 2.0;
       double denom = dist + m_blend_radius;
-      
-      double cutoff = (m_blend_radius/denom);//*(dist/denom);
-      //std::cout << "dist = " << dist << std::endl;
-      //std::cout << "cutoff = " << cutoff << std::endl;
-      
-      for (int r=0; r<input_weights.rows(); ++r) {
-        for (int c=0; c<input_weights.cols(); ++c) {
-          if (input_weights(c,r) > cutoff)
-            input_weights(c,r) = cutoff;
-        }
-      }
-      //std::string fix = "_"+num2str(i)+"_"+num2str(bbox.min()[0])+"_"+num2str(bbox.min()[1])+".tif";
-      //write_image("input"+fix, apply_mask(trans_input,0));
-      //write_image("weights"+fix, input_weights);
-      //write_image("weights_crop"+fix, crop(input_weights, BBox2i(m_blend_radius,m_blend_radius, intersect.width(), intersect.height())));
+      double cutoff = (m_blend_radius/denom);
 
-      // Copy that piece to the output tile, applying the mask.
+      // Add that piece to the output tile, with the weights capped at
+      // the cutoff. The inner loop runs along contiguous rows of all
+      // images, and has only selects, so it can be vectorized.
       for (int r=0; r<intersect.height(); ++r) {
+        T      const* in_ptr  = &trans_input  (m_blend_radius, r+m_blend_radius);
+        double const* wt_ptr  = &input_weights(m_blend_radius, r+m_blend_radius);
+        float       * out_ptr = &tile   (tile_bbox.min()[0], r+tile_bbox.min()[1]);
+        float       * sum_ptr = &weights(tile_bbox.min()[0], r+tile_bbox.min()[1]);
+        uint8       * cov_ptr = &covered(tile_bbox.min()[0], r+tile_bbox.min()[1]);
         for (int c=0; c<intersect.width(); ++c) {
-
-          double weight = input_weights(c+m_blend_radius,r+m_blend_radius);
-          //if (weight > cutoff)
-          //  weight = cutoff;
-          
-          T pixel = trans_input(c+m_blend_radius,r+m_blend_radius);
-          if (is_valid(pixel)) {
-            float value = remove_mask(pixel);
-            int o_c = c+tile_bbox.min()[0];
-            int o_r = r+tile_bbox.min()[1];
-            if (weights(o_c, o_r) == 0)
-              tile(o_c, o_r) = value * weight;
-            else
-              tile(o_c, o_r) += value * weight;
-            weights(o_c, o_r) += weight;
-          }
+          // Invalid values may be NaN, so they must not be multiplied by 0
+          bool  valid  = is_valid(in_ptr[c]);
+          float value  = valid ? float(remove_mask(in_ptr[c])) : 0.0f;
+          float weight = valid ? float(std::min(wt_ptr[c], cutoff)) : 0.0f;
+          out_ptr[c] += weight * value;
+          sum_ptr[c] += weight;
+          cov_ptr[c] |= uint8(valid);
         }
       } // End loop through tile intersection
 
-      //std::cout << "input finished\n";
     } // End loop through input images
 
-    //std::string fix = "_"+num2str(bbox.min()[0])+"_"+num2str(bbox.min()[1])+".tif";
-    //write_image("tile"+fix, tile);
-    //write_image("tile_weights"+fix, weights);
-    
     // Normalize output by the weight.
-    for (int c = 0; c < bbox.width(); c++){
-      for (int r = 0; r < bbox.height(); r++){
-        if ( weights(c, r) > 0 )
+    for (int r = 0; r < bbox.height(); r++){
+      for (int c = 0; c < bbox.width(); c++){
+        if (weights(c, r) > 0)
           tile(c, r) /= weights(c, r);
-      } // End row loop
-    } // End col loop
-    
-    //write_image("tile_norm"+fix, tile);
-    
-    //std::cout << "Tile finished\n";
+        else if (!covered(c, r))
+          tile(c, r) = m_output_nodata_value;
+      } // End col loop
+    } // End row loop
+
     return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(),
                              cols(), rows() );
   } // End function prerasterize
@@ -0,0 +1,338 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file ip_bench.cc
+
+// Benchmark interest point detection and matching on synthetic image
+// pairs seen by known pinhole cameras above the WGS84 ellipsoid. The
+// images are rendered from a fixed procedural ground texture, so the
+// numbers are comparable across runs and machines, and the cameras
+// give the true location of each match, from which the inlier ratio
+// is found.
+
+#include <asp/Core/Macros.h>
+#include <asp/Core/Common.h>
+#include <asp/Core/InterestPointMatching.h>
+#include <asp/Core/StereoSettings.h>
+#include <asp/Core/StageReport.h>
+#include <vw/Camera/PinholeModel.h>
+#include <vw/Cartography/CameraBBox.h>
+#include <vw/Core/Stopwatch.h>
+#include <vw/Core/Settings.h>
+#include <vw/InterestPoint/Matcher.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+#include <cmath>
+#include <fstream>
+#include <limits>
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+using namespace vw;
+
+struct Options : vw::GdalWriteOptions {
+  int size, ip_per_tile, repeat;
+  std::string families, detectors, output_file;
+};
+
+void handle_arguments(int argc, char *argv[], Options& opt) {
+
+  po::options_description general_options("");
+  general_options.add_options()
+    ("size", po::value(&opt.size)->default_value(1024),
+     "The width and height of the synthetic images.")
+    ("families", po::value(&opt.families)->default_value("shift rotated"),
+     "The kinds of synthetic pairs to use. Options: shift (the right camera is "
+     "displaced along the image rows), rotated (it is also rotated by 10 degrees "
+     "about its view axis). Specify as a list in quotes.")
+    ("detectors", po::value(&opt.detectors)->default_value("0 1 2"),
+     "The interest point detection methods to run, as for --ip-detect-method: "
+     "0 (OBAloG), 1 (SIFT), 2 (ORB). Specify as a list in quotes.")
+    ("ip-per-tile", po::value(&opt.ip_per_tile)->default_value(0),
+     "How many interest points to detect in each 1024^2 image tile "
+     "(default: automatic determination).")
+    ("repeat", po::value(&opt.repeat)->default_value(1),
+     "Run each stage this many times and report the shortest time.")
+    ("output-file", po::value(&opt.output_file)->default_value(""),
+     "Append the results to this CSV file, writing a header first if it is new.");
+
+  general_options.add(vw::GdalWriteOptionsDescription(opt));
+
+  po::options_description positional("");
+  po::positional_options_description positional_desc;
+
+  std::string usage("[options]");
+  bool allow_unregistered = false;
+  std::vector<std::string> unregistered;
+  po::variables_map vm =
+    asp::check_command_line(argc, argv, opt, general_options, general_options,
+                            positional, positional_desc, usage,
+                            allow_unregistered, unregistered);
+
+  if (opt.size < 256)
+    vw_throw(ArgumentErr() << "The image size must be at least 256.\n");
+  if (opt.repeat < 1)
+    vw_throw(ArgumentErr() << "The value of --repeat must be positive.\n");
+}
+
+// A value in [0, 1] for each node of the integer lattice
+double lattice_value(int i, int j) {
+  unsigned int h = static_cast<unsigned int>(i) * 374761393u
+    + static_cast<unsigned int>(j) * 668265263u;
+  h = (h ^ (h >> 13)) * 1274126177u;
+  h = h ^ (h >> 16);
+  return h / 4294967295.0;
+}
+
+// Smoothly interpolated lattice noise
+double value_noise(double x, double y) {
+  double fx = std::floor(x), fy = std::floor(y);
+  int i = fx, j = fy;
+  double u = x - fx, v = y - fy;
+  u = u * u * (3.0 - 2.0 * u);
+  v = v * v * (3.0 - 2.0 * v);
+  return (1 - v) * ((1 - u) * lattice_value(i, j)     + u * lattice_value(i + 1, j))
+    +         v  * ((1 - u) * lattice_value(i, j + 1) + u * lattice_value(i + 1, j + 1));
+}
+
+// The brightness of the ground at a point, from noise at a few scales, in meters
+float ground_texture(Vector3 const& xyz) {
+  double y = xyz[1], z = xyz[2];
+  return 0.5 * value_noise(y / 12.0, z / 12.0) + 0.3 * value_noise(y / 31.0, z / 31.0)
+    + 0.2 * value_noise(y / 83.0, z / 83.0);
+}
+
+// Two cameras 5 km above the equator, looking down. The right one is
+// displaced along the image rows by a fifth of the image, and for the
+// rotated family, also rotated about its view axis.
+void make_cameras(std::string const& family, int size,
+                  boost::shared_ptr<camera::PinholeModel> & cam1,
+                  boost::shared_ptr<camera::PinholeModel> & cam2) {
+
+  if (family != "shift" && family != "rotated")
+    vw_throw(ArgumentErr() << "Unknown family of image pairs: " << family << ".\n");
+
+  cartography::Datum datum("WGS84");
+  double height = 5000.0, focal = size;
+  Vector3 ctr1(datum.semi_major_axis() + height, 0, 0);
+  Vector3 ctr2 = ctr1 + Vector3(0, 0.2 * height, 0);
+
+  // Camera x goes to world y, y to -z, and z, the view direction, to -x
+  Matrix3x3 rot1(0, 0, -1,
+                 1, 0,  0,
+                 0, -1, 0);
+  Matrix3x3 rot2 = rot1;
+  if (family == "rotated") {
+    double a = 10.0 * M_PI / 180.0;
+    Matrix3x3 spin(std::cos(a), -std::sin(a), 0,
+                   std::sin(a),  std::cos(a), 0,
+                   0,            0,           1);
+    rot2 = rot1 * spin;
+  }
+
+  cam1.reset(new camera::PinholeModel(ctr1, rot1, focal, focal, size / 2.0, size / 2.0));
+  cam2.reset(new camera::PinholeModel(ctr2, rot2, focal, focal, size / 2.0, size / 2.0));
+}
+
+// Render the ground as seen by a camera
+ImageView<float> render(camera::CameraModel const* cam, cartography::Datum const& datum,
+                        int size) {
+  ImageView<float> image(size, size);
+  for (int row = 0; row < size; row++)
+    for (int col = 0; col < size; col++)
+      image(col, row) = ground_texture(cartography::datum_intersection
+                                       (datum, cam, Vector2(col, row)));
+  return image;
+}
+
+// The fraction of matches within 2 pixels of where the cameras put them
+double inlier_ratio(std::vector<ip::InterestPoint> const& ip1,
+                    std::vector<ip::InterestPoint> const& ip2,
+                    camera::CameraModel const* cam1, camera::CameraModel const* cam2,
+                    cartography::Datum const& datum) {
+  if (ip1.empty())
+    return 0.0;
+  const double INLIER_PIXELS = 2.0;
+  int num_inliers = 0;
+  for (size_t i = 0; i < ip1.size(); i++) {
+    Vector3 xyz = cartography::datum_intersection(datum, cam1, Vector2(ip1[i].x, ip1[i].y));
+    Vector2 pix = cam2->point_to_pixel(xyz);
+    if (norm_2(pix - Vector2(ip2[i].x, ip2[i].y)) <= INLIER_PIXELS)
+      num_inliers++;
+  }
+  return double(num_inliers) / ip1.size();
+}
+
+// What is recorded for each stage
+struct StageResult {
+  double seconds;
+  int num_ip, num_matches;
+  double inlier_ratio;
+  StageResult(): seconds(std::numeric_limits<double>::max()), num_ip(0), num_matches(0),
+                 inlier_ratio(0.0) {}
+};
+
+// Run one stage. Return false if it failed, such as for a detector
+// which VW was built without.
+bool run_stage(std::string const& stage, Options const& opt, std::string const& tmp_dir,
+               ImageView<float> const& left, ImageView<float> const& right,
+               camera::PinholeModel * cam1, camera::PinholeModel * cam2,
+               cartography::Datum const& datum, StageResult & result) {
+
+  double nodata = std::numeric_limits<double>::quiet_NaN();
+  double epipolar_threshold   = asp::stereo_settings().epipolar_threshold;
+  double uniqueness_threshold = asp::stereo_settings().ip_uniqueness_thresh;
+  bool single_threaded_camera = false;
+
+  // The detection for the epipolar matching, which is not timed
+  ip::InterestPointList ip1, ip2;
+  if (stage == "epipolar_ip_matching" &&
+      !asp::detect_ip_pair(ip1, ip2, left, right, opt.ip_per_tile, "", "", nodata, nodata))
+    return false;
+
+  for (int r = 0; r < opt.repeat; r++) {
+    std::vector<ip::InterestPoint> matched_ip1, matched_ip2;
+    ip::InterestPointList ip;
+    bool success = true;
+    Stopwatch sw;
+    sw.start();
+    if (stage == "detect_ip") {
+      asp::detect_ip(ip, left, opt.ip_per_tile, "", nodata);
+    } else if (stage == "detect_match_ip") {
+      asp::detect_match_ip(matched_ip1, matched_ip2, left, right, opt.ip_per_tile,
+                           "", "", nodata, nodata);
+    } else if (stage == "epipolar_ip_matching") {
+      success = asp::epipolar_ip_matching(single_threaded_camera, ip1, ip2, cam1, cam2,
+                                          left, right, datum, epipolar_threshold,
+                                          uniqueness_threshold, matched_ip1, matched_ip2,
+                                          nodata, nodata);
+    } else if (stage == "ip_matching_w_alignment") {
+      std::string match_file = tmp_dir + "/run-left__right.match";
+      success = asp::ip_matching_w_alignment(single_threaded_camera, cam1, cam2,
+                                             left, right, opt.ip_per_tile, datum, match_file,
+                                             epipolar_threshold, uniqueness_threshold,
+                                             "", nodata, nodata);
+      if (success)
+        ip::read_binary_match_file(match_file, matched_ip1, matched_ip2);
+    }
+    sw.stop();
+    if (!success)
+      return false;
+
+    result.seconds = std::min(result.seconds, sw.elapsed_seconds());
+    result.num_ip = (stage == "detect_ip") ? ip.size() : ip1.size();
+    result.num_matches = matched_ip1.size();
+    result.inlier_ratio = inlier_ratio(matched_ip1, matched_ip2, cam1, cam2, datum);
+  }
+
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+
+  Options opt;
+  try {
+    handle_arguments(argc, argv, opt);
+
+    std::vector<std::string> families, detectors;
+    std::string families_str = opt.families, detectors_str = opt.detectors;
+    boost::trim(families_str);
+    boost::trim(detectors_str);
+    boost::split(families, families_str, boost::is_any_of(" \t,"),
+                 boost::token_compress_on);
+    boost::split(detectors, detectors_str, boost::is_any_of(" \t,"),
+                 boost::token_compress_on);
+
+    std::vector<std::string> stages;
+    stages.push_back("detect_ip");
+    stages.push_back("detect_match_ip");
+    stages.push_back("epipolar_ip_matching");
+    stages.push_back("ip_matching_w_alignment");
+
+    // The matching functions may write files
+    std::string tmp_dir = (fs::temp_directory_path() /
+                           fs::unique_path("ip_bench-%%%%%%%%")).string();
+    fs::create_directories(tmp_dir);
+
+    std::ostringstream header, results;
+    header << "family,detector,stage,cols,rows,threads,seconds,num_ip,num_matches,"
+           << "inlier_ratio,peak_rss_mb\n";
+    vw_out() << header.str();
+
+    cartography::Datum datum("WGS84");
+    int threads = vw_settings().default_num_threads();
+    for (size_t f = 0; f < families.size(); f++) {
+
+      boost::shared_ptr<camera::PinholeModel> cam1, cam2;
+      make_cameras(families[f], opt.size, cam1, cam2);
+      ImageView<float> left  = render(cam1.get(), datum, opt.size);
+      ImageView<float> right = render(cam2.get(), datum, opt.size);
+
+      for (size_t d = 0; d < detectors.size(); d++) {
+        asp::stereo_settings().ip_matching_method = atoi(detectors[d].c_str());
+
+        for (size_t s = 0; s < stages.size(); s++) {
+          StageResult result;
+          bool success = false;
+          try {
+            success = run_stage(stages[s], opt, tmp_dir, left, right, cam1.get(), cam2.get(),
+                                datum, result);
+          } catch (std::exception const& e) {
+            vw_out(WarningMessage) << families[f] << " " << detectors[d] << " " << stages[s]
+                                   << ": " << e.what() << "\n";
+          }
+          if (!success) {
+            vw_out() << families[f] << "," << detectors[d] << "," << stages[s]
+                     << ",failed\n";
+            continue;
+          }
+
+          // The peak memory of the process so far
+          asp::ResourceUsage usage;
+          usage.measure();
+
+          std::ostringstream os;
+          os.precision(6);
+          os << families[f] << "," << detectors[d] << "," << stages[s] << ","
+             << opt.size << "," << opt.size << "," << threads << ","
+             << result.seconds << "," << result.num_ip << "," << result.num_matches << ","
+             << result.inlier_ratio << "," << usage.peak_rss_mb << "\n";
+          vw_out() << os.str();
+          results << os.str();
+        }
+      }
+    }
+
+    fs::remove_all(tmp_dir);
+
+    if (!opt.output_file.empty()) {
+      bool is_new = !fs::exists(opt.output_file);
+      std::ofstream ofs(opt.output_file.c_str(), std::ios::app);
+      if (!ofs.good())
+        vw_throw(IOErr() << "Cannot write: " << opt.output_file << "\n");
+      if (is_new)
+        ofs << header.str();
+      ofs << results.str();
+      vw_out() << "Wrote: " << opt.output_file << "\n";
+    }
+
+  } ASP_STANDARD_CATCHES;
+
+  return 0;
+}
@@ -29,6 +29,7 @@
 #include <asp/Core/InterestPointMatching.h>
 #include <asp/Core/BundleAdjustUtils.h>
 #include <asp/Tools/jitter_adjust.h>
+#include <asp/Core/Tracing.h>
 #include <vw/Core/Stopwatch.h>
 
 // Turn off warnings from eigen
@@ -789,7 +790,10 @@ void jitter_adjust(std::vector<std::string> const& image_files,
   options.update_state_every_iteration = true; // ensure we have the latest adjustments
 
   ceres::Solver::Summary summary;
-  ceres::Solve(options, &problem, &summary);
+  {
+    asp::TraceSpan span("ceres_solve", "solver");
+    ceres::Solve(options, &problem, &summary);
+  }
   vw_out() << summary.FullReport() << "\n";
   if (summary.termination_type == ceres::NO_CONVERGENCE){
     // Print a clarifying message, so the user does not think that the algorithm failed.
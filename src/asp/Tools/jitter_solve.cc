@@ -34,6 +34,7 @@
 #include <vw/BundleAdjustment/ControlNetwork.h>
 #include <vw/BundleAdjustment/ControlNetworkLoader.h>
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Cartography/CameraBBox.h>
 
 #include <asp/Sessions/StereoSessionFactory.h>
@@ -44,6 +45,7 @@
 #include <asp/Core/StereoSettings.h>
 #include <asp/Core/BundleAdjustUtils.h>
 #include <asp/Core/IpMatchingAlgs.h> // Lightweight header for matching algorithms
+#include <asp/Core/Tracing.h>
 
 #include <usgscsm/UsgsAstroLsSensorModel.h>
 #include <usgscsm/Utilities.h>
@@ -53,6 +55,9 @@
 #include <ceres/ceres.h>
 #include <ceres/loss_function.h>
 
+#include <algorithm>
+#include <set>
+
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
@@ -68,71 +73,135 @@ const int PIXEL_SIZE      = 2;
 
 const double g_big_pixel_value = 1000.0;  // don't make this too big
 
+void interpQuaternions(UsgsAstroLsSensorModel * ls_model, double time, double q[4]);
+void interpPositions(UsgsAstroLsSensorModel * ls_model, double time, double pos[3]);
+
 // An error function minimizing the error of projecting an xyz point
 // into a given camera pixel. The variables of optimization are a
 // portion of the position and quaternion variables affected by this.
-  
-struct pixelReprojectionError {
+//
+// The Jacobian is found without differentiating through the
+// iterative groundToImage() for each of these variables. The pixel
+// depends on them only through the position and quaternion
+// interpolated at the time of the pixel, each being a weighted sum
+// of them. To first order, how the time of the pixel changes does not
+// matter. So the derivative with respect to a position or quaternion
+// is its interpolation weight times the derivative with respect to
+// the interpolated one. That one is found by moving all positions or
+// all quaternions at once, which moves the interpolated one as much.
+// Moving all positions is the same as moving the point the opposite
+// way, which gives the derivative with respect to the point.
+class pixelReprojectionError: public ceres::CostFunction {
+public:
   pixelReprojectionError(vw::Vector2 const& observation, double weight,
                          UsgsAstroLsSensorModel* ls_model,
                          int begQuatIndex, int endQuatIndex, int begPosIndex, int endPosIndex):
     m_observation(observation), m_weight(weight),
     m_begQuatIndex(begQuatIndex), m_endQuatIndex(endQuatIndex),
     m_begPosIndex(begPosIndex),   m_endPosIndex(endPosIndex),
-    m_ls_model(ls_model){}
+    m_ls_model(ls_model){
 
-  // Call to work with ceres::DynamicCostFunction.
-  bool operator()(double const * const * parameters, double * residuals) const {
+    // The residual size is always the same.
+    set_num_residuals(PIXEL_SIZE);
 
-    try {
-      // Make a copy of the model, as we will update quaternion and position values
-      // that are being modified now. This may be expensive.
-      UsgsAstroLsSensorModel cam = *m_ls_model;
-
-      // Update the relevant quaternions in the local copy
-      int shift = 0;
-      for (int qi = m_begQuatIndex; qi < m_endQuatIndex; qi++) {
-        for (int coord = 0; coord < NUM_QUAT_PARAMS; coord++) {
-          cam.m_quaternions[NUM_QUAT_PARAMS * qi + coord]
-            = parameters[qi + shift - m_begQuatIndex][coord];
-        }
-      }
+    // Add a parameter block for each quaternion and each position
+    for (int it = begQuatIndex; it < endQuatIndex; it++)
+      mutable_parameter_block_sizes()->push_back(NUM_QUAT_PARAMS);
+    for (int it = begPosIndex; it < endPosIndex; it++)
+      mutable_parameter_block_sizes()->push_back(NUM_XYZ_PARAMS);
 
-      // Same for the positions. Note how we move forward in the parameters array,
-      // as this is after the quaternions
-      shift += (m_endQuatIndex - m_begQuatIndex);
-      for (int pi = m_begPosIndex; pi < m_endPosIndex; pi++) {
-        for (int coord = 0; coord < NUM_XYZ_PARAMS; coord++) {
-          cam.m_positions[NUM_XYZ_PARAMS * pi + coord]
-            = parameters[pi + shift - m_begPosIndex][coord];
-        }
-      }
+    // Add a parameter block for the xyz point
+    mutable_parameter_block_sizes()->push_back(NUM_XYZ_PARAMS);
+  }
 
-      // Move forward in the array of parameters, then recover the triangulated point
-      shift += (m_endPosIndex - m_begPosIndex);
-      csm::EcefCoord P;
-      P.x = parameters[shift][0];
-      P.y = parameters[shift][1];
-      P.z = parameters[shift][2];
+  virtual bool Evaluate(double const * const * parameters, double * residuals,
+                        double ** jacobians) const {
 
-      // Project in the camera with high precision. Do not use here
-      // anything lower than 1e-8, as the linescan model will then
-      // return junk.
-      double desired_precision = asp::DEFAULT_CSM_DESIRED_PRECISISON;
-      csm::ImageCoord imagePt = cam.groundToImage(P, desired_precision);
+    int numQuat = m_endQuatIndex - m_begQuatIndex;
+    int numPos  = m_endPosIndex - m_begPosIndex;
+    int numBlocks = numQuat + numPos + 1;
 
-      // Convert to what ASP expects
-      vw::Vector2 pix;
-      asp::fromCsmPixel(pix, imagePt);
+    // Make a copy of the model, as we will update quaternion and position values
+    // that are being modified now. This may be expensive.
+    UsgsAstroLsSensorModel cam = *m_ls_model;
 
-      residuals[0] = m_weight*(pix[0] - m_observation[0]);
-      residuals[1] = m_weight*(pix[1] - m_observation[1]);
-      
-    } catch (std::exception const& e) {
+    // Update the relevant quaternions in the local copy
+    for (int qi = m_begQuatIndex; qi < m_endQuatIndex; qi++) {
+      for (int coord = 0; coord < NUM_QUAT_PARAMS; coord++)
+        cam.m_quaternions[NUM_QUAT_PARAMS * qi + coord] = parameters[qi - m_begQuatIndex][coord];
+    }
+
+    // Same for the positions. Note how we move forward in the parameters array,
+    // as this is after the quaternions
+    for (int pi = m_begPosIndex; pi < m_endPosIndex; pi++) {
+      for (int coord = 0; coord < NUM_XYZ_PARAMS; coord++)
+        cam.m_positions[NUM_XYZ_PARAMS * pi + coord] = parameters[numQuat + pi - m_begPosIndex][coord];
+    }
+
+    // Move forward in the array of parameters, then recover the triangulated point
+    csm::EcefCoord P;
+    P.x = parameters[numQuat + numPos][0];
+    P.y = parameters[numQuat + numPos][1];
+    P.z = parameters[numQuat + numPos][2];
+
+    vw::Vector2 pix;
+    if (!project(cam, P, pix)) {
       residuals[0] = g_big_pixel_value;
       residuals[1] = g_big_pixel_value;
+      zeroJacobians(jacobians, numBlocks);
       return true; // accept the solution anyway
     }
+
+    residuals[0] = m_weight*(pix[0] - m_observation[0]);
+    residuals[1] = m_weight*(pix[1] - m_observation[1]);
+
+    if (jacobians == NULL)
+      return true;
+
+    // The derivatives of the pixel with respect to the interpolated quaternion
+    // and position, with the time of the pixel fixed, and the interpolation weights.
+    double dPixdQ[PIXEL_SIZE][NUM_QUAT_PARAMS], dPixdX[PIXEL_SIZE][NUM_XYZ_PARAMS];
+    std::vector<double> quatWeights, posWeights;
+    bool success = false;
+    try {
+      csm::ImageCoord imagePt;
+      asp::toCsmPixel(pix, imagePt);
+      double time = cam.getImageTime(imagePt);
+      interpWeights(cam, time, quatWeights, posWeights);
+      success = poseDerivatives(cam, P, quatWeights, posWeights, dPixdQ, dPixdX);
+    } catch (std::exception const& e) {
+      success = false;
+    }
+    if (!success) {
+      zeroJacobians(jacobians, numBlocks);
+      return true;
+    }
+
+    for (int qi = 0; qi < numQuat; qi++) {
+      if (jacobians[qi] == NULL)
+        continue;
+      for (int r = 0; r < PIXEL_SIZE; r++) {
+        for (int c = 0; c < NUM_QUAT_PARAMS; c++)
+          jacobians[qi][r * NUM_QUAT_PARAMS + c] = m_weight * quatWeights[qi] * dPixdQ[r][c];
+      }
+    }
+    for (int pi = 0; pi < numPos; pi++) {
+      double * jac = jacobians[numQuat + pi];
+      if (jac == NULL)
+        continue;
+      for (int r = 0; r < PIXEL_SIZE; r++) {
+        for (int c = 0; c < NUM_XYZ_PARAMS; c++)
+          jac[r * NUM_XYZ_PARAMS + c] = m_weight * posWeights[pi] * dPixdX[r][c];
+      }
+    }
+    double * jac = jacobians[numQuat + numPos];
+    if (jac != NULL) {
+      for (int r = 0; r < PIXEL_SIZE; r++) {
+        for (int c = 0; c < NUM_XYZ_PARAMS; c++)
+          jac[r * NUM_XYZ_PARAMS + c] = -m_weight * dPixdX[r][c];
+      }
+    }
+
     return true;
   }
 
@@ -141,35 +210,134 @@ struct pixelReprojectionError {
                                      UsgsAstroLsSensorModel* ls_model,
                                      int begQuatIndex, int endQuatIndex,
                                      int begPosIndex, int endPosIndex){
+    return new pixelReprojectionError(observation, weight, ls_model,
+                                      begQuatIndex, endQuatIndex,
+                                      begPosIndex, endPosIndex);
+  }
 
-    // TODO(oalexan1): Try using here the analytical cost function
-    ceres::DynamicNumericDiffCostFunction<pixelReprojectionError>* cost_function =
-      new ceres::DynamicNumericDiffCostFunction<pixelReprojectionError>
-      (new pixelReprojectionError(observation, weight, ls_model,
-                                  begQuatIndex, endQuatIndex,
-                                  begPosIndex, endPosIndex));
+private:
 
-    // The residual size is always the same.
-    cost_function->SetNumResiduals(PIXEL_SIZE);
+  // Project in the camera with high precision. Do not use here
+  // anything lower than 1e-8, as the linescan model will then
+  // return junk.
+  static bool project(UsgsAstroLsSensorModel const& cam, csm::EcefCoord const& P,
+                      vw::Vector2 & pix) {
+    try {
+      double desired_precision = asp::DEFAULT_CSM_DESIRED_PRECISISON;
+      csm::ImageCoord imagePt = cam.groundToImage(P, desired_precision);
+      // Convert to what ASP expects
+      asp::fromCsmPixel(pix, imagePt);
+    } catch (std::exception const& e) {
+      return false;
+    }
+    return true;
+  }
 
-    // Add a parameter block for each quaternion and each position
-    for (int it = begQuatIndex; it < endQuatIndex; it++)
-      cost_function->AddParameterBlock(NUM_QUAT_PARAMS);
-    for (int it = begPosIndex; it < endPosIndex; it++)
-      cost_function->AddParameterBlock(NUM_XYZ_PARAMS);
+  void zeroJacobians(double ** jacobians, int numBlocks) const {
+    if (jacobians == NULL)
+      return;
+    for (int b = 0; b < numBlocks; b++) {
+      if (jacobians[b] != NULL)
+        std::fill(jacobians[b], jacobians[b] + PIXEL_SIZE * parameter_block_sizes()[b], 0.0);
+    }
+  }
 
-    // Add a parameter block for the xyz point
-    cost_function->AddParameterBlock(NUM_XYZ_PARAMS);
-    
-    return cost_function;
+  // The weights of the quaternions and positions of this residual in
+  // interpolating them at the given time. Interpolation is linear in the
+  // values, so a weight is how much the interpolated value changes when
+  // a value changes by one.
+  void interpWeights(UsgsAstroLsSensorModel & cam, double time,
+                     std::vector<double> & quatWeights,
+                     std::vector<double> & posWeights) const {
+    double q0[NUM_QUAT_PARAMS], q[NUM_QUAT_PARAMS];
+    interpQuaternions(&cam, time, q0);
+    for (int qi = m_begQuatIndex; qi < m_endQuatIndex; qi++) {
+      double & val = cam.m_quaternions[NUM_QUAT_PARAMS * qi];
+      double orig = val;
+      val += 1.0;
+      interpQuaternions(&cam, time, q);
+      val = orig;
+      quatWeights.push_back(q[0] - q0[0]);
+    }
+    double x0[NUM_XYZ_PARAMS], x[NUM_XYZ_PARAMS];
+    interpPositions(&cam, time, x0);
+    for (int pi = m_begPosIndex; pi < m_endPosIndex; pi++) {
+      double & val = cam.m_positions[NUM_XYZ_PARAMS * pi];
+      double orig = val;
+      val += 1.0;
+      interpPositions(&cam, time, x);
+      val = orig;
+      posWeights.push_back(x[0] - x0[0]);
+    }
+  }
+
+  // Find the derivatives of the pixel with respect to the interpolated
+  // quaternion and position by central differences, moving all the
+  // quaternions or positions of this residual together. That moves the
+  // interpolated ones by the sum of their weights.
+  bool poseDerivatives(UsgsAstroLsSensorModel & cam, csm::EcefCoord const& P,
+                       std::vector<double> const& quatWeights,
+                       std::vector<double> const& posWeights,
+                       double dPixdQ[PIXEL_SIZE][NUM_QUAT_PARAMS],
+                       double dPixdX[PIXEL_SIZE][NUM_XYZ_PARAMS]) const {
+
+    double quatSum = 0.0, posSum = 0.0;
+    for (size_t it = 0; it < quatWeights.size(); it++)
+      quatSum += quatWeights[it];
+    for (size_t it = 0; it < posWeights.size(); it++)
+      posSum += posWeights[it];
+    if (quatSum == 0.0 || posSum == 0.0)
+      return false;
+
+    // The quaternions have unit norm and the positions are in meters
+    const double quatStep = 1e-7, posStep = 1e-2;
+
+    // Restore the values exactly after each move
+    std::vector<double> quats(cam.m_quaternions.begin() + NUM_QUAT_PARAMS * m_begQuatIndex,
+                              cam.m_quaternions.begin() + NUM_QUAT_PARAMS * m_endQuatIndex);
+    std::vector<double> positions(cam.m_positions.begin() + NUM_XYZ_PARAMS * m_begPosIndex,
+                                  cam.m_positions.begin() + NUM_XYZ_PARAMS * m_endPosIndex);
+
+    for (int c = 0; c < NUM_QUAT_PARAMS; c++) {
+      vw::Vector2 pix[2];
+      for (int side = 0; side < 2; side++) {
+        double step = (side == 0) ? quatStep : -quatStep;
+        for (int qi = m_begQuatIndex; qi < m_endQuatIndex; qi++)
+          cam.m_quaternions[NUM_QUAT_PARAMS * qi + c] += step;
+        bool success = project(cam, P, pix[side]);
+        std::copy(quats.begin(), quats.end(),
+                  cam.m_quaternions.begin() + NUM_QUAT_PARAMS * m_begQuatIndex);
+        if (!success)
+          return false;
+      }
+      for (int r = 0; r < PIXEL_SIZE; r++)
+        dPixdQ[r][c] = (pix[0][r] - pix[1][r]) / (2.0 * quatStep * quatSum);
+    }
+
+    for (int c = 0; c < NUM_XYZ_PARAMS; c++) {
+      vw::Vector2 pix[2];
+      for (int side = 0; side < 2; side++) {
+        double step = (side == 0) ? posStep : -posStep;
+        for (int pi = m_begPosIndex; pi < m_endPosIndex; pi++)
+          cam.m_positions[NUM_XYZ_PARAMS * pi + c] += step;
+        bool success = project(cam, P, pix[side]);
+        std::copy(positions.begin(), positions.end(),
+                  cam.m_positions.begin() + NUM_XYZ_PARAMS * m_begPosIndex);
+        if (!success)
+          return false;
+      }
+      for (int r = 0; r < PIXEL_SIZE; r++)
+        dPixdX[r][c] = (pix[0][r] - pix[1][r]) / (2.0 * posStep * posSum);
+    }
+
+    return true;
   }
 
-private:
   Vector2 m_observation; // The pixel observation for this camera/point pair
   double m_weight;
-  UsgsAstroLsSensorModel* m_ls_model;
   int m_begQuatIndex, m_endQuatIndex;
   int m_begPosIndex, m_endPosIndex;
+  UsgsAstroLsSensorModel* m_ls_model;
 }; // End class pixelReprojectionError
 
 /// A ceres cost function. The residual is the difference between the
@@ -294,6 +462,7 @@ struct Options: public asp::BaBaseOptions {
   double quat_norm_weight, anchor_weight;
   std::string anchor_dem;
   int num_anchor_points_extra_lines;
+  bool time_ordered_solver;
 };
     
 void handle_arguments(int argc, char *argv[], Options& opt) {
@@ -410,7 +579,12 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     ("quat-norm-weight", po::value(&opt.quat_norm_weight)->default_value(1.0),
      "How much weight to give to the constraint that the norm of each quaternion must be 1.")
     ("ip-side-filter-percent",  po::value(&opt.ip_edge_buffer_percent)->default_value(-1.0),
-     "Remove matched IPs this percentage from the image left/right sides.");
+     "Remove matched IPs this percentage from the image left/right sides.")
+    ("time-ordered-solver", po::bool_switch(&opt.time_ordered_solver)->default_value(false)->implicit_value(true),
+     "Solve with a sparse direct solver which eliminates the camera positions and "
+     "orientations in time order. Then the solver time grows only linearly with "
+     "the length of the image strip. Suggested when resampling the camera "
+     "poses finely for long strips.");
   
     general_options.add(vw::GdalWriteOptionsDescription(opt));
 
@@ -983,43 +1157,42 @@ void resampleModel(Options const& opt, UsgsAstroLsSensorModel * ls_model) {
   return;
 }
 
-// Calculate a set of anchor points uniformly distributed over the image
-// Will use opt.num_anchor_points_extra_lines.
-void calcAnchorPoints(Options                              const & opt,
-                      ImageViewRef<PixelMask<double>>              interp_acnhor_dem,
-                      vw::cartography::GeoReference         const& anchor_georef,
-                      std::vector<UsgsAstroLsSensorModel*> const & ls_models,
-                      // Append to these, they already have entries
-                      std::vector<std::vector<Vector2>>                    & pixel_vec,
-                      std::vector<std::vector<boost::shared_ptr<Vector3>>> & xyz_vec,
-                      std::vector<std::vector<double*>>                    & xyz_vec_ptr,
-                      std::vector<std::vector<double>>                     & weight_vec,
-                      std::vector<std::vector<int>>                        & isAnchor_vec) {
-
-  if (opt.num_anchor_points <= 0)
-    vw::vw_throw(vw::ArgumentErr() << "Expecting a positive number of anchor points.\n");
-
-  int extra = opt.num_anchor_points_extra_lines;
-    
-  int num_cams = ls_models.size();
-  for (int icam = 0; icam < num_cams; icam++) {
-
-    // Use int64 and double to avoid int32 overflow
-    std::int64_t numLines   = ls_models[icam]->m_nLines;
-    std::int64_t numSamples = ls_models[icam]->m_nSamples;
-    double area = double(numSamples) * double(numLines + 2 * extra);
-    double bin_len = sqrt(area/double(opt.num_anchor_points));
-    bin_len = std::max(bin_len, 1.0);
-    int lenx = ceil(double(numSamples) / bin_len); lenx = std::max(1, lenx);
-    int leny = ceil(double(numLines + 2 * extra) / bin_len); leny = std::max(1, leny);
+// An anchor point, before it is added to the problem
+struct AnchorPoint {
+  Vector2 pix;
+  Vector3 xyz;
+};
 
-    std::int64_t numAnchorPoints = 0;
-    for (int binx = 0; binx <= lenx; binx++) {
-      double posx = binx * bin_len;
-      for (int biny = 0; biny <= leny; biny++) {
-        double posy = biny * bin_len - extra;
+// Find the anchor points for a range of columns of the grid of bins
+// for one image. Each task keeps its own points, so the camera and the
+// DEM are only read from here.
+class AnchorPointTask: public vw::Task, private boost::noncopyable {
+  boost::shared_ptr<vw::camera::CameraModel> m_camera;
+  ImageViewRef<PixelMask<double>> const& m_interp_dem;
+  vw::cartography::GeoReference   const& m_georef;
+  double m_bin_len;
+  std::int64_t m_numLines, m_numSamples;
+  int m_extra, m_beg_binx, m_end_binx, m_leny;
+  std::vector<AnchorPoint> & m_points;
+public:
+  AnchorPointTask(boost::shared_ptr<vw::camera::CameraModel> camera,
+                  ImageViewRef<PixelMask<double>> const& interp_dem,
+                  vw::cartography::GeoReference const& georef,
+                  double bin_len, std::int64_t numLines, std::int64_t numSamples,
+                  int extra, int beg_binx, int end_binx, int leny,
+                  std::vector<AnchorPoint> & points):
+    m_camera(camera), m_interp_dem(interp_dem), m_georef(georef),
+    m_bin_len(bin_len), m_numLines(numLines), m_numSamples(numSamples),
+    m_extra(extra), m_beg_binx(beg_binx), m_end_binx(end_binx), m_leny(leny),
+    m_points(points) {}
+
+  void operator()() {
+    for (int binx = m_beg_binx; binx < m_end_binx; binx++) {
+      double posx = binx * m_bin_len;
+      for (int biny = 0; biny <= m_leny; biny++) {
+        double posy = biny * m_bin_len - m_extra;
         
-        if (posx > numSamples - 1 || posy < -extra || posy > numLines - 1 + extra) 
+        if (posx > m_numSamples - 1 || posy < -m_extra || posy > m_numLines - 1 + m_extra) 
           continue;
         
         Vector2 pix(posx, posy);
@@ -1033,9 +1206,8 @@ void calcAnchorPoints(Options                              const & opt,
         int num_max_iter        = 50;   // Using many iterations can be very slow
           
         Vector3 dem_xyz = vw::cartography::camera_pixel_to_dem_xyz
-          (opt.camera_models[icam]->camera_center(pix),
-           opt.camera_models[icam]->pixel_to_vector(pix),
-           interp_acnhor_dem, anchor_georef, treat_nodata_as_zero, has_intersection,
+          (m_camera->camera_center(pix), m_camera->pixel_to_vector(pix),
+           m_interp_dem, m_georef, treat_nodata_as_zero, has_intersection,
            height_error_tol, max_abs_tol, max_rel_tol, num_max_iter, xyz_guess);
 
         if (!has_intersection) 
@@ -1043,7 +1215,7 @@ void calcAnchorPoints(Options                              const & opt,
 
         Vector2 pix_out;
         try {
-          pix_out = opt.camera_models[icam]->point_to_pixel(dem_xyz);
+          pix_out = m_camera->point_to_pixel(dem_xyz);
         } catch (...) {
           continue;
         }
@@ -1051,22 +1223,97 @@ void calcAnchorPoints(Options                              const & opt,
         if (norm_2(pix - pix_out) > 10 * height_error_tol)
           continue; // this is likely a bad point
 
-        pixel_vec[icam].push_back(pix);
+        AnchorPoint pt;
+        pt.pix = pix;
+        pt.xyz = dem_xyz;
+        m_points.push_back(pt);
+      }
+    }
+  }
+};
+
+// Calculate a set of anchor points uniformly distributed over the image
+// Will use opt.num_anchor_points_extra_lines. The columns of bins of
+// all images are shared among the threads, and the points are appended
+// in the same order as if found serially.
+void calcAnchorPoints(Options                              const & opt,
+                      ImageViewRef<PixelMask<double>>              interp_acnhor_dem,
+                      vw::cartography::GeoReference         const& anchor_georef,
+                      std::vector<UsgsAstroLsSensorModel*> const & ls_models,
+                      // Append to these, they already have entries
+                      std::vector<std::vector<Vector2>>                    & pixel_vec,
+                      std::vector<std::vector<boost::shared_ptr<Vector3>>> & xyz_vec,
+                      std::vector<std::vector<double*>>                    & xyz_vec_ptr,
+                      std::vector<std::vector<double>>                     & weight_vec,
+                      std::vector<std::vector<int>>                        & isAnchor_vec) {
+
+  if (opt.num_anchor_points <= 0)
+    vw::vw_throw(vw::ArgumentErr() << "Expecting a positive number of anchor points.\n");
+
+  int extra = opt.num_anchor_points_extra_lines;
+
+  int num_threads = std::max(1, opt.num_threads);
+  if (opt.single_threaded_cameras)
+    num_threads = 1; // ISIS must be single threaded!
+
+  // The points for each chunk of each image
+  int num_cams = ls_models.size();
+  std::vector<std::vector<std::vector<AnchorPoint>>> points(num_cams);
+  {
+    vw::FifoWorkQueue queue(num_threads);
+    for (int icam = 0; icam < num_cams; icam++) {
+      
+      // Use int64 and double to avoid int32 overflow
+      std::int64_t numLines   = ls_models[icam]->m_nLines;
+      std::int64_t numSamples = ls_models[icam]->m_nSamples;
+      double area = double(numSamples) * double(numLines + 2 * extra);
+      double bin_len = sqrt(area/double(opt.num_anchor_points));
+      bin_len = std::max(bin_len, 1.0);
+      int lenx = ceil(double(numSamples) / bin_len); lenx = std::max(1, lenx);
+      int leny = ceil(double(numLines + 2 * extra) / bin_len); leny = std::max(1, leny);
+
+      // Several chunks per thread, to balance the load, as the
+      // rays may miss the DEM over parts of the image
+      int num_binx = lenx + 1;
+      int chunk = std::max(1, num_binx / (8 * num_threads));
+      int num_chunks = (num_binx + chunk - 1) / chunk;
+      points[icam].resize(num_chunks);
+      for (int ichunk = 0; ichunk < num_chunks; ichunk++) {
+        int beg_binx = ichunk * chunk;
+        int end_binx = std::min(beg_binx + chunk, num_binx);
+        boost::shared_ptr<AnchorPointTask>
+          task(new AnchorPointTask(opt.camera_models[icam], interp_acnhor_dem,
+                                   anchor_georef, bin_len, numLines, numSamples,
+                                   extra, beg_binx, end_binx, leny,
+                                   points[icam][ichunk]));
+        queue.add_task(task);
+      }
+    }
+    queue.join_all();
+  }
+
+  for (int icam = 0; icam < num_cams; icam++) {
+    std::int64_t numAnchorPoints = 0;
+    for (size_t ichunk = 0; ichunk < points[icam].size(); ichunk++) {
+      std::vector<AnchorPoint> const& chunk_points = points[icam][ichunk];
+      for (size_t ipt = 0; ipt < chunk_points.size(); ipt++) {
+        pixel_vec[icam].push_back(chunk_points[ipt].pix);
         weight_vec[icam].push_back(opt.anchor_weight);
         isAnchor_vec[icam].push_back(1);
 
         // Create a shared_ptr as we need a pointer per the api to use later
         xyz_vec[icam].push_back(boost::shared_ptr<Vector3>(new Vector3()));
         Vector3 & xyz = *xyz_vec[icam].back().get(); // alias to the element we just made
-        xyz = dem_xyz; // copy the value, but the pointer does not change
+        xyz = chunk_points[ipt].xyz; // copy the value, but the pointer does not change
         xyz_vec_ptr[icam].push_back(&xyz[0]); // keep the pointer to the first element
         numAnchorPoints++;
-      }   
+      }
     }
 
     vw_out() << std::endl;
     vw_out() << "Image file: " << opt.image_files[icam] << std::endl;
-    vw_out() << "Lines and samples: " << numLines << ' ' << numSamples << std::endl;
+    vw_out() << "Lines and samples: " << ls_models[icam]->m_nLines << ' '
+             << ls_models[icam]->m_nSamples << std::endl;
     vw_out() << "Num anchor points per image: " << numAnchorPoints     << std::endl;
   }   
 }
@@ -1329,6 +1576,51 @@ void addQuatNormRotationTranslationConstraints
   }
 }
   
+// Put the triangulated points in the first elimination group, and then
+// the positions and orientations of each camera, in time order, each
+// in its own group. A residual involves only the poses near a given
+// time, so in this order the camera matrix after eliminating the
+// points is banded, and factoring it takes time linear in its size.
+void setTimeOrdering(std::vector<UsgsAstroLsSensorModel*> const& ls_models,
+                     ceres::Problem & problem,
+                     ceres::ParameterBlockOrdering & ordering) {
+
+  std::set<double*> pose_blocks;
+  int group = 1;
+  for (size_t icam = 0; icam < ls_models.size(); icam++) {
+    UsgsAstroLsSensorModel * ls_model = ls_models[icam];
+    std::vector<std::pair<double, double*>> poses;
+
+    int numQuat = ls_model->m_quaternions.size() / NUM_QUAT_PARAMS;
+    for (int iq = 0; iq < numQuat; iq++) {
+      double * quat = &ls_model->m_quaternions[iq * NUM_QUAT_PARAMS];
+      if (problem.HasParameterBlock(quat))
+        poses.push_back(std::make_pair(ls_model->m_t0Quat + iq * ls_model->m_dtQuat, quat));
+    }
+    int numPos = ls_model->m_positions.size() / NUM_XYZ_PARAMS;
+    for (int ip = 0; ip < numPos; ip++) {
+      double * pos = &ls_model->m_positions[ip * NUM_XYZ_PARAMS];
+      if (problem.HasParameterBlock(pos))
+        poses.push_back(std::make_pair(ls_model->m_t0Ephem + ip * ls_model->m_dtEphem, pos));
+    }
+
+    std::stable_sort(poses.begin(), poses.end(),
+                     [](std::pair<double, double*> const& a,
+                        std::pair<double, double*> const& b) { return a.first < b.first; });
+    for (size_t it = 0; it < poses.size(); it++) {
+      ordering.AddElementToGroup(poses[it].second, group++);
+      pose_blocks.insert(poses[it].second);
+    }
+  }
+
+  std::vector<double*> blocks;
+  problem.GetParameterBlocks(&blocks);
+  for (size_t it = 0; it < blocks.size(); it++) {
+    if (pose_blocks.find(blocks[it]) == pose_blocks.end())
+      ordering.AddElementToGroup(blocks[it], 0);
+  }
+}
+  
 void run_jitter_solve(int argc, char* argv[]) {
 
   // Parse arguments and perform validation
@@ -1635,11 +1927,22 @@ void run_jitter_solve(int argc, char* argv[]) {
   options.linear_solver_type  = ceres::ITERATIVE_SCHUR;
   options.preconditioner_type = ceres::SCHUR_JACOBI;
   options.use_explicit_schur_complement = false; // Only matters with ITERATIVE_SCHUR
+
+  if (opt.time_ordered_solver) {
+    // The ordering is respected when factoring the reduced camera
+    // matrix with SuiteSparse
+    options.linear_solver_type = ceres::SPARSE_SCHUR;
+    options.linear_solver_ordering.reset(new ceres::ParameterBlockOrdering);
+    setTimeOrdering(ls_models, problem, *options.linear_solver_ordering);
+  }
   
   // Solve the problem
   vw_out() << "Starting the Ceres optimizer." << std::endl;
   ceres::Solver::Summary summary;
-  ceres::Solve(options, &problem, &summary);
+  {
+    asp::TraceSpan span("ceres_solve", "solver");
+    ceres::Solve(options, &problem, &summary);
+  }
   vw_out() << summary.FullReport() << "\n";
   if (summary.termination_type == ceres::NO_CONVERGENCE) 
     vw_out() << "Found a valid solution, but did not reach the actual minimum.\n";
@@ -27,13 +27,19 @@
 #include <vw/Cartography/PointImageManipulation.h>
 #include <vw/Cartography/CameraBBox.h>
 #include <vw/Camera/PinholeModel.h>
+#include <vw/Image/Algorithms.h>
 #include <vw/Image/Algorithms2.h>
 #include <vw/Image/Filter.h>
 
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/SharedBlockCache.h>
+#include <asp/Core/Tracing.h>
 #include <asp/Sessions/StereoSessionFactory.h>
 #include <asp/Core/StereoSettings.h>
+#include <asp/Camera/ApproxCameraModel.h>
+
+#include <gdal.h>
 
 using namespace vw;
 using namespace vw::cartography;
@@ -47,7 +53,8 @@ struct Options : vw::GdalWriteOptions {
   // Input
   std::string dem_file, image_file, camera_file, output_file, stereo_session,
     bundle_adjust_prefix;
-  bool isQuery, noGeoHeaderInfo, nearest_neighbor, parseOptions, dg_use_csm;
+  bool isQuery, noGeoHeaderInfo, nearest_neighbor, parseOptions, dg_use_csm,
+    dense_ephemeris_tables, isis_camera_pool, use_approx_camera, use_pixel_grid;
   bool multithreaded_model; // This is set based on the session type.
   bool enable_correct_velocity_aberration, enable_correct_atmospheric_refraction;
   
@@ -55,8 +62,11 @@ struct Options : vw::GdalWriteOptions {
   boost::shared_ptr<vw::camera::CameraModel> camera_model;
   
   // Settings
-  std::string target_srs_string, output_type, metadata;
-  double nodata_value, tr, mpp, ppd, datum_offset;
+  std::string target_srs_string, output_type, metadata, extra_band_images_str;
+  std::vector<std::string> extra_band_images;
+  double nodata_value, tr, mpp, ppd, datum_offset, approx_camera_max_error,
+    pixel_grid_max_error;
+  int pixel_grid_spacing;
   BBox2 target_projwin, target_pixelwin;
 };
 
@@ -102,6 +112,22 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
      "Turn on atmospheric refraction correction for Optical Bar and non-ISIS linescan cameras. This option impairs the convergence of bundle adjustment.")
     ("dg-use-csm", po::bool_switch(&opt.dg_use_csm)->default_value(false)->implicit_value(true),
      "Use the CSM model with DigitalGlobe linescan cameras (-t dg). No corrections are done for velocity aberration or atmospheric refraction.")
+    ("dense-ephemeris-tables", po::bool_switch(&opt.dense_ephemeris_tables)->default_value(false)->implicit_value(true),
+     "Sample the positions and orientations of DigitalGlobe (without --dg-use-csm) and PeruSat cameras at fine time steps when loading them, and look them up from this table. This makes these cameras faster. A table is not used if it differs from the camera by more than 0.01 pixels.")
+    ("isis-camera-pool", po::bool_switch(&opt.isis_camera_pool)->default_value(false)->implicit_value(true),
+     "Give each thread its own ISIS camera, opened from the same cube, so that ISIS cameras can be used with multiple threads. This uses more memory. The cubes must have been spiceinit-ed with the SPICE data attached (the default).")
+    ("use-approx-camera", po::bool_switch(&opt.use_approx_camera)->default_value(false)->implicit_value(true),
+     "Project into the camera with piecewise-linear fits to it over the DEM, refined until within --approx-camera-max-error of the camera. This is much faster for ISIS, CSM, and linescan cameras. Not used when projecting onto a datum.")
+    ("approx-camera-max-error", po::value(&opt.approx_camera_max_error)->default_value(0.05),
+     "The largest difference, in pixels, between the approximate camera from --use-approx-camera and the exact one.")
+    ("use-pixel-grid", po::bool_switch(&opt.use_pixel_grid)->default_value(false)->implicit_value(true),
+     "Find the camera pixel seen by an output pixel exactly only on a grid of output pixels in each tile, and interpolate bilinearly in between. Grid cells are split where the interpolation is further than --pixel-grid-max-error from the exact value at check points. This is much faster for linescan cameras and fine DEMs.")
+    ("pixel-grid-spacing", po::value(&opt.pixel_grid_spacing)->default_value(32),
+     "The spacing, in output pixels, of the grid from --use-pixel-grid, before any cells are split.")
+    ("pixel-grid-max-error", po::value(&opt.pixel_grid_max_error)->default_value(0.05),
+     "The largest difference, in camera pixels, allowed at the check points of a cell of the grid from --use-pixel-grid.")
+    ("extra-band-images", po::value(&opt.extra_band_images_str)->default_value(""),
+     "Also project these single-channel images, separated by spaces and in quotes, such as the other bands of a multispectral image. They must have the same size as the input image and be seen by the same camera. The output has one band for each image, the input image being the first. The DEM and the camera pixels are found once for all bands.")
     ("parse-options", po::bool_switch(&opt.parseOptions)->default_value(false),
      "Parse the options and print the results. Used by the mapproject script.")
     ;
@@ -161,6 +187,18 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     = opt.enable_correct_atmospheric_refraction;
   
   asp::stereo_settings().dg_use_csm = opt.dg_use_csm;
+  asp::stereo_settings().dense_ephemeris_tables = opt.dense_ephemeris_tables;
+  asp::stereo_settings().isis_camera_pool = opt.isis_camera_pool;
+
+  std::istringstream band_is(opt.extra_band_images_str);
+  std::string band_image;
+  while (band_is >> band_image)
+    opt.extra_band_images.push_back(band_image);
+
+  if (opt.pixel_grid_spacing < 2)
+    vw_throw(ArgumentErr() << "The value of --pixel-grid-spacing must be at least 2.\n");
+  if (opt.pixel_grid_max_error <= 0.0)
+    vw_throw(ArgumentErr() << "The value of --pixel-grid-max-error must be positive.\n");
   
   if (fs::path(opt.dem_file).extension() != "") {
     // A path to a real DEM file was provided, load it!
@@ -269,8 +307,12 @@ void write_parallel_cond(std::string              const& filename,
     // for how the image got mapprojected and is good to keep.
     Vector3 t(0, 0, 0);
     vw::Quaternion<double> q(1, 0, 0, 0);
+    vw::camera::CameraModel * cam = opt.camera_model.get();
+    asp::ApproxCameraModel * approx_cam = dynamic_cast<asp::ApproxCameraModel*>(cam);
+    if (approx_cam != NULL)
+      cam = approx_cam->exact_camera().get();
     vw::camera::AdjustedCameraModel * adj_cam
-      = dynamic_cast<vw::camera::AdjustedCameraModel*>(opt.camera_model.get());
+      = dynamic_cast<vw::camera::AdjustedCameraModel*>(cam);
     if (adj_cam != NULL) {
       q = adj_cam->rotation();
       t = adj_cam->translation();
@@ -306,6 +348,31 @@ void write_parallel_cond(std::string              const& filename,
 
 }
 
+/// Copy the RPC coefficients embedded in the input image, if any, to
+/// the output image. Stereo with -t rpc on mapprojected images needs
+/// them. When the mapproject script mosaics tiles, it does this itself.
+void copy_rpc_metadata(std::string const& image_file, std::string const& output_file) {
+
+  GDALAllRegister();
+  GDALDatasetH src = GDALOpen(image_file.c_str(), GA_ReadOnly);
+  if (src == NULL)
+    return; // Not a GDAL image, such as an ISIS cube with no RPC
+  char ** rpc = GDALGetMetadata(src, "RPC");
+  if (rpc == NULL || CSLCount(rpc) == 0) {
+    GDALClose(src);
+    return;
+  }
+
+  GDALDatasetH dst = GDALOpen(output_file.c_str(), GA_Update);
+  if (dst == NULL) {
+    GDALClose(src);
+    vw_throw(IOErr() << "Cannot open for update: " << output_file << ".\n");
+  }
+  GDALSetMetadata(dst, rpc, "RPC");
+  GDALClose(dst);
+  GDALClose(src);
+}
+
 /// Compute which camera pixel observes a DEM pixel.
 Vector2 demPixToCamPix(Vector2i const& dem_pixel,
                       boost::shared_ptr<camera::CameraModel> const& camera_model,
@@ -474,24 +541,230 @@ void calc_target_geom(// Inputs
 }
 
 
-/// Map project the image with a nodata value.  Used for single channel images.
-template <class ImagePixelT, class Map2CamTransT>
-void project_image_nodata(Options & opt,
+/// Wrap a transform from output pixels to camera pixels, such as
+/// Map2CamTrans, so that the exact transform is found only on a coarse
+/// grid of the pixels of each output tile. The camera pixels are
+/// interpolated bilinearly in between. A grid cell is split in four
+/// where the interpolation, at the middle of the cell and of its edges,
+/// is more than the given error away from the exact value, or where the
+/// cell is partly outside the camera image. Cells of one or two pixels
+/// on a side use the exact transform everywhere. A cell whose points
+/// are all outside the image is taken to be fully outside.
+template <class TransT>
+class PixelGridTrans: public vw::TransformBase<PixelGridTrans<TransT>> {
+  TransT  m_trans;
+  BBox2   m_image_box; // the camera pixels which can be sampled
+  int     m_spacing;
+  double  m_max_error;
+
+  // The camera pixels of the last output tile
+  mutable BBox2i                 m_cached_box;
+  mutable ImageView<Vector2>     m_cache;
+  mutable ImageView<uint8>       m_is_exact;
+
+  bool in_image(Vector2 const& pix) const {
+    return pix == pix && m_image_box.contains(pix); // this also fails for NaN
+  }
+
+  // The exact camera pixel at a pixel of the cached tile, found once
+  Vector2 exact(int col, int row) const {
+    if (!m_is_exact(col, row)) {
+      m_cache(col, row) = m_trans.reverse(Vector2(m_cached_box.min().x() + col,
+                                                  m_cached_box.min().y() + row));
+      m_is_exact(col, row) = 1;
+    }
+    return m_cache(col, row);
+  }
+
+  // Fill the cell with given corners, in cached tile pixels, inclusive
+  void fill_cell(int c0, int r0, int c1, int r1) const {
+
+    // Cells this small have only corners
+    if (c1 - c0 <= 1 && r1 - r0 <= 1) {
+      for (int r = r0; r <= r1; r++)
+        for (int c = c0; c <= c1; c++)
+          exact(c, r);
+      return;
+    }
+
+    Vector2 p00 = exact(c0, r0), p10 = exact(c1, r0);
+    Vector2 p01 = exact(c0, r1), p11 = exact(c1, r1);
+    double wc = 1.0 / std::max(c1 - c0, 1), wr = 1.0 / std::max(r1 - r0, 1);
+    int cm = (c0 + c1) / 2, rm = (r0 + r1) / 2;
+
+    // Check the corners, the middle, and the middles of the edges
+    int check_cols[] = {c0, c1, c0, c1, cm, cm, cm, c0, c1};
+    int check_rows[] = {r0, r0, r1, r1, rm, r0, r1, rm, rm};
+    int num_inside = 0;
+    bool good = true;
+    for (int i = 0; i < 9; i++) {
+      int c = check_cols[i], r = check_rows[i];
+      Vector2 pix = exact(c, r);
+      if (!in_image(pix)) {
+        good = false;
+        continue;
+      }
+      num_inside++;
+      double u = (c - c0) * wc, v = (r - r0) * wr;
+      Vector2 interp = (1 - v) * ((1 - u) * p00 + u * p10) + v * ((1 - u) * p01 + u * p11);
+      if (norm_2(interp - pix) > m_max_error)
+        good = false;
+    }
+
+    if (num_inside == 0) {
+      // Outside the image. Use a value from a corner, which is outside too.
+      for (int r = r0; r <= r1; r++)
+        for (int c = c0; c <= c1; c++)
+          if (!m_is_exact(c, r))
+            m_cache(c, r) = p00;
+      return;
+    }
+
+    if (good) {
+      for (int r = r0; r <= r1; r++) {
+        double v = (r - r0) * wr;
+        for (int c = c0; c <= c1; c++) {
+          if (m_is_exact(c, r))
+            continue;
+          double u = (c - c0) * wc;
+          m_cache(c, r) = (1 - v) * ((1 - u) * p00 + u * p10) + v * ((1 - u) * p01 + u * p11);
+        }
+      }
+      return;
+    }
+
+    // Split the cell along each side which is long enough. The parts share edges.
+    bool split_cols = (c1 - c0 > 1), split_rows = (r1 - r0 > 1);
+    if (split_cols && split_rows) {
+      fill_cell(c0, r0, cm, rm);
+      fill_cell(cm, r0, c1, rm);
+      fill_cell(c0, rm, cm, r1);
+      fill_cell(cm, rm, c1, r1);
+    } else if (split_cols) {
+      fill_cell(c0, r0, cm, r1);
+      fill_cell(cm, r0, c1, r1);
+    } else {
+      fill_cell(c0, r0, c1, rm);
+      fill_cell(c0, rm, c1, r1);
+    }
+  }
+
+public:
+  PixelGridTrans(TransT const& trans, Vector2i const& image_size,
+                 int spacing, double max_error):
+    m_trans(trans),
+    // Bicubic interpolation reads a little past a pixel
+    m_image_box(-1.0, -1.0, image_size.x() + 1.0, image_size.y() + 1.0),
+    m_spacing(std::max(spacing, 2)), m_max_error(max_error) {}
+
+  /// Find the camera pixels for a tile of output pixels
+  void cache_dependencies(BBox2i const& bbox) const {
+    if (m_cached_box == bbox && !bbox.empty())
+      return;
+    m_cached_box = bbox;
+    m_cache.set_size(bbox.width(), bbox.height());
+    m_is_exact.set_size(bbox.width(), bbox.height());
+    fill(m_is_exact, 0);
+    for (int r0 = 0; r0 < bbox.height(); r0 += m_spacing) {
+      int r1 = std::min(r0 + m_spacing, bbox.height() - 1);
+      for (int c0 = 0; c0 < bbox.width(); c0 += m_spacing) {
+        int c1 = std::min(c0 + m_spacing, bbox.width() - 1);
+        fill_cell(c0, r0, c1, r1);
+      }
+    }
+  }
+
+  Vector2 reverse(Vector2 const& p) const {
+    // Output pixels in the cached tile are looked up. Others are exact.
+    int col = int(p.x()) - m_cached_box.min().x(), row = int(p.y()) - m_cached_box.min().y();
+    if (p.x() == double(int(p.x())) && p.y() == double(int(p.y())) &&
+        col >= 0 && row >= 0 && col < m_cached_box.width() && row < m_cached_box.height())
+      return m_cache(col, row);
+    return m_trans.reverse(p);
+  }
+
+  /// The box of camera pixels seen by the output pixels in bbox
+  BBox2i reverse_bbox(BBox2i const& bbox) const {
+    cache_dependencies(bbox);
+    BBox2 box;
+    for (int r = 0; r < m_cache.rows(); r++) {
+      for (int c = 0; c < m_cache.cols(); c++) {
+        if (in_image(m_cache(c, r)))
+          box.grow(m_cache(c, r));
+      }
+    }
+    if (box.empty())
+      return BBox2i();
+    return grow_bbox_to_int(box);
+  }
+
+  Vector2 forward(Vector2 const& p) const {
+    return m_trans.forward(p);
+  }
+};
+
+/// Several images of the same size, such as the bands of a multispectral
+/// image taken by one camera, seen as the planes of one image. Projecting
+/// this image finds the camera pixels of each output tile once for all
+/// the bands.
+template <class PixelT>
+class BandStackView: public ImageViewBase<BandStackView<PixelT>> {
+  std::vector<ImageViewRef<PixelT>> m_bands;
+public:
+  typedef PixelT pixel_type;
+  typedef PixelT result_type;
+  typedef ProceduralPixelAccessor<BandStackView<PixelT>> pixel_accessor;
+
+  BandStackView(std::vector<ImageViewRef<PixelT>> const& bands): m_bands(bands) {
+    if (m_bands.empty())
+      vw_throw(ArgumentErr() << "No images to stack.\n");
+    for (size_t b = 1; b < m_bands.size(); b++) {
+      if (m_bands[b].cols() != m_bands[0].cols() || m_bands[b].rows() != m_bands[0].rows())
+        vw_throw(ArgumentErr() << "The band images must all have the same size.\n");
+    }
+  }
+
+  inline int32 cols  () const { return m_bands[0].cols(); }
+  inline int32 rows  () const { return m_bands[0].rows(); }
+  inline int32 planes() const { return m_bands.size(); }
+
+  inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+  inline pixel_type operator()(double i, double j, int32 p = 0) const {
+    return m_bands[p](i, j);
+  }
+
+  typedef CropView<ImageView<pixel_type>> prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+    asp::TraceSpan span("mapproject_tile", bbox);
+    BBox2i box = bbox;
+    box.crop(bounding_box(m_bands[0]));
+    ImageView<pixel_type> tile(box.width(), box.height(), planes());
+    for (int p = 0; p < planes(); p++) {
+      ImageView<pixel_type> band = crop(m_bands[p], box);
+      for (int r = 0; r < band.rows(); r++)
+        for (int c = 0; c < band.cols(); c++)
+          tile(c, r, p) = band(c, r);
+    }
+    return prerasterize_type(tile, -box.min().x(), -box.min().y(), cols(), rows());
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
+/// Map project an image whose nodata pixels are masked
+template <class ImageT, class Map2CamTransT>
+void project_masked_image(Options const& opt,
+                          ImageT const& input,
                           GeoReference const& croppedGeoRef,
                           Vector2i     const& virtual_image_size,
                           BBox2i       const& croppedImageBB,
                           Map2CamTransT const& transform) {
 
-    typedef PixelMask<ImagePixelT> ImageMaskPixelT;
-
-    // Create handle to input image to be projected on to the map
-    boost::shared_ptr<DiskImageResource> img_rsrc = 
-          vw::DiskImageResourcePtr(opt.image_file);   
-
-    // Update the nodata value from the input file if it is present.
-    if (img_rsrc->has_nodata_read()) 
-      opt.nodata_value = img_rsrc->nodata_read();
-
+    typedef typename ImageT::pixel_type ImageMaskPixelT;
     bool            has_img_nodata = true;
     ImageMaskPixelT nodata_mask    = ImageMaskPixelT(); // invalid value for a PixelMask
 
@@ -504,8 +777,7 @@ void project_image_nodata(Options & opt,
               apply_mask
               ( // Handle nodata
               transform_nodata( // Apply the output from Map2CamTrans
-                                create_mask(DiskImageView<ImagePixelT>(img_rsrc),
-                                            opt.nodata_value), // Handle nodata
+                                input,
                                 transform,
                                 virtual_image_size[0],
                                 virtual_image_size[1],
@@ -527,8 +799,7 @@ void project_image_nodata(Options & opt,
               apply_mask
               ( // Handle nodata
               transform_nodata( // Apply the output from Map2CamTrans
-                                create_mask(DiskImageView<ImagePixelT>(img_rsrc),
-                                            opt.nodata_value), // Handle nodata
+                                input,
                                 transform,
                                 virtual_image_size[0],
                                 virtual_image_size[1],
@@ -543,7 +814,52 @@ void project_image_nodata(Options & opt,
         TerminalProgressCallback("","")
         );
     }
+}
+
+/// Map project the image with a nodata value.  Used for single channel images.
+/// With --extra-band-images, those images follow as more bands, each
+/// masked with its own nodata value, or with the one of the input image
+/// if it has none.
+template <class ImagePixelT, class Map2CamTransT>
+void project_image_nodata(Options & opt,
+                          GeoReference const& croppedGeoRef,
+                          Vector2i     const& virtual_image_size,
+                          BBox2i       const& croppedImageBB,
+                          Map2CamTransT const& transform) {
 
+    typedef PixelMask<ImagePixelT> ImageMaskPixelT;
+
+    // Create handle to input image to be projected on to the map
+    boost::shared_ptr<DiskImageResource> img_rsrc = 
+          asp::cached_image_resource(opt.image_file);
+
+    // Update the nodata value from the input file if it is present.
+    if (img_rsrc->has_nodata_read()) 
+      opt.nodata_value = img_rsrc->nodata_read();
+
+    if (opt.extra_band_images.empty()) {
+      project_masked_image(opt,
+                           create_mask(DiskImageView<ImagePixelT>(img_rsrc),
+                                       opt.nodata_value), // Handle nodata
+                           croppedGeoRef, virtual_image_size, croppedImageBB, transform);
+      return;
+    }
+
+    std::vector<ImageViewRef<ImageMaskPixelT>> bands;
+    bands.push_back(create_mask(DiskImageView<ImagePixelT>(img_rsrc), opt.nodata_value));
+    for (size_t b = 0; b < opt.extra_band_images.size(); b++) {
+      std::string const& file = opt.extra_band_images[b];
+      boost::shared_ptr<DiskImageResource> rsrc = asp::cached_image_resource(file);
+      if (rsrc->channels() * rsrc->planes() != 1)
+        vw_throw(ArgumentErr() << "The band image " << file << " must have one channel.\n");
+      double nodata = opt.nodata_value;
+      if (rsrc->has_nodata_read())
+        nodata = rsrc->nodata_read();
+      bands.push_back(create_mask(DiskImageView<ImagePixelT>(rsrc), nodata));
+    }
+    vw_out() << "Projecting " << bands.size() << " bands with the same camera.\n";
+    project_masked_image(opt, BandStackView<ImageMaskPixelT>(bands),
+                         croppedGeoRef, virtual_image_size, croppedImageBB, transform);
 }
 
 /// Map project the image with an alpha channel.  Used for multi-channel images.
@@ -557,7 +873,7 @@ void project_image_alpha(Options & opt,
   
     // Create handle to input image to be projected on to the map
     boost::shared_ptr<DiskImageResource> img_rsrc = 
-          vw::DiskImageResourcePtr(opt.image_file);   
+          asp::cached_image_resource(opt.image_file);
 
     const bool        has_img_nodata    = false;
     const ImagePixelT transparent_pixel = ImagePixelT();
@@ -605,6 +921,44 @@ void project_image_alpha(Options & opt,
 
 }
 
+/// Project with the given transform, or with it sampled on a grid if
+/// --use-pixel-grid was set
+template <class ImagePixelT, class Map2CamTransT>
+void project_image_nodata_pick_grid(Options & opt,
+                                    GeoReference const& croppedGeoRef,
+                                    Vector2i     const& image_size,
+                                    Vector2i     const& virtual_image_size,
+                                    BBox2i       const& croppedImageBB,
+                                    Map2CamTransT const& transform) {
+  if (opt.use_pixel_grid)
+    project_image_nodata<ImagePixelT>(opt, croppedGeoRef, virtual_image_size, croppedImageBB,
+                                      PixelGridTrans<Map2CamTransT>
+                                      (transform, image_size, opt.pixel_grid_spacing,
+                                       opt.pixel_grid_max_error));
+  else
+    project_image_nodata<ImagePixelT>(opt, croppedGeoRef, virtual_image_size, croppedImageBB,
+                                      transform);
+}
+
+template <class ImagePixelT, class Map2CamTransT>
+void project_image_alpha_pick_grid(Options & opt,
+                                   GeoReference const& croppedGeoRef,
+                                   Vector2i     const& image_size,
+                                   Vector2i     const& virtual_image_size,
+                                   BBox2i       const& croppedImageBB,
+                                   boost::shared_ptr<camera::CameraModel> const& camera_model,
+                                   Map2CamTransT const& transform) {
+  if (opt.use_pixel_grid)
+    project_image_alpha<ImagePixelT>(opt, croppedGeoRef, virtual_image_size, croppedImageBB,
+                                     camera_model,
+                                     PixelGridTrans<Map2CamTransT>
+                                     (transform, image_size, opt.pixel_grid_spacing,
+                                      opt.pixel_grid_max_error));
+  else
+    project_image_alpha<ImagePixelT>(opt, croppedGeoRef, virtual_image_size, croppedImageBB,
+                                     camera_model, transform);
+}
+
 // The two "pick" functions below select between the Map2CamTrans and Datum2CamTrans
 // transform classes which will be passed to the image projection function.
 // - TODO: Is there a good reason for the transform classes to be CRTP instead of virtual?
@@ -621,7 +975,7 @@ void project_image_nodata_pick_transform(Options & opt,
   const bool        call_from_mapproject = true;
   if (fs::path(opt.dem_file).extension() != "") {
     // A DEM file was provided
-    return project_image_nodata<ImagePixelT>(opt, croppedGeoRef,
+    return project_image_nodata_pick_grid<ImagePixelT>(opt, croppedGeoRef, image_size,
                                              virtual_image_size, croppedImageBB,
                                              Map2CamTrans(// Converts coordinates in DEM
                                                           // georeference to camera pixels
@@ -631,7 +985,7 @@ void project_image_nodata_pick_transform(Options & opt,
                                                           opt.nearest_neighbor));
   } else {
     // A constant datum elevation was provided
-    return project_image_nodata<ImagePixelT>(opt, croppedGeoRef,
+    return project_image_nodata_pick_grid<ImagePixelT>(opt, croppedGeoRef, image_size,
                                              virtual_image_size, croppedImageBB,
                                              Datum2CamTrans
                                              (// Converts coordinates in DEM
@@ -657,7 +1011,7 @@ void project_image_alpha_pick_transform(Options & opt,
   const bool        call_from_mapproject = true;
   if (fs::path(opt.dem_file).extension() != "") {
     // A DEM file was provided
-    return project_image_alpha<ImagePixelT>(opt, croppedGeoRef,
+    return project_image_alpha_pick_grid<ImagePixelT>(opt, croppedGeoRef, image_size,
                                             virtual_image_size, croppedImageBB, camera_model, 
                                             Map2CamTrans(// Converts coordinates in DEM
                                                          // georeference to camera pixels
@@ -668,7 +1022,7 @@ void project_image_alpha_pick_transform(Options & opt,
                                             );
   } else {
     // A constant datum elevation was provided
-    return project_image_alpha<ImagePixelT>(opt, croppedGeoRef,
+    return project_image_alpha_pick_grid<ImagePixelT>(opt, croppedGeoRef, image_size,
                                             virtual_image_size, croppedImageBB, camera_model, 
                                             Datum2CamTrans(// Converts coordinates in DEM
                                                            // georeference to camera pixels
@@ -751,10 +1105,10 @@ int main(int argc, char* argv[]) {
         vw_throw( ArgumentErr() << "There is no georeference information in: "
                   << opt.dem_file << ".\n" );
 
-      boost::shared_ptr<DiskImageResource> dem_rsrc(DiskImageResourcePtr(opt.dem_file));
+      boost::shared_ptr<DiskImageResource> dem_rsrc = asp::cached_image_resource(opt.dem_file);
 
       // If we have a nodata value, create a mask.
-      DiskImageView<float> dem_disk_image(opt.dem_file);
+      DiskImageView<float> dem_disk_image(dem_rsrc);
       if (dem_rsrc->has_nodata_read()){
         dem = create_mask(dem_disk_image, dem_rsrc->nodata_read());
       }else{
@@ -861,6 +1215,9 @@ int main(int argc, char* argv[]) {
     vw_out() << "Output image size:\n";
     vw_out() << std::setprecision(17) << "(width: " << virtual_image_width
              << " height: " << virtual_image_height << ")" << std::endl;
+    // The mapproject script uses this to decide if it can let this
+    // program write the whole output with threads, instead of tiles.
+    vw_out() << "Multi-threaded camera model: " << int(opt.multithreaded_model) << std::endl;
 
     if (opt.isQuery){ // Quit before we do any image work
       vw_out() << "Query finished, exiting mapproject tool.\n";
@@ -875,6 +1232,37 @@ int main(int argc, char* argv[]) {
     if (pinhole_ptr)
       pinhole_ptr->set_do_point_to_pixel_check(false);
 
+    // Project into the camera with local linear fits to it. This is
+    // done after the bounding box above, which is found with the exact
+    // camera.
+    if (opt.use_approx_camera && datum_dem) {
+      vw_out(WarningMessage) << "Not using --use-approx-camera when projecting "
+                             << "onto a datum.\n";
+    } else if (opt.use_approx_camera) {
+      // Estimate the DEM height range from a subsampled DEM
+      int subsample_factor = std::max(1, std::max(dem.cols(), dem.rows()) / 1000);
+      ImageViewRef<DemPixelT> sub_dem = subsample(dem, subsample_factor);
+      double min_height = std::numeric_limits<double>::max();
+      double max_height = -min_height;
+      for (int row = 0; row < sub_dem.rows(); row++) {
+        for (int col = 0; col < sub_dem.cols(); col++) {
+          DemPixelT h = sub_dem(col, row);
+          if (!is_valid(h))
+            continue;
+          min_height = std::min(min_height, double(h.child()));
+          max_height = std::max(max_height, double(h.child()));
+        }
+      }
+      if (min_height > max_height)
+        vw_throw(ArgumentErr() << "No valid heights in: " << opt.dem_file << ".\n");
+      vw_out() << "Using an approximate camera for DEM heights from "
+               << min_height << " to " << max_height << " meters.\n";
+      opt.camera_model.reset(new asp::ApproxCameraModel(opt.camera_model, dem_georef,
+                                                        Vector2i(dem.cols(), dem.rows()),
+                                                        min_height, max_height,
+                                                        opt.approx_camera_max_error));
+    }
+
     // Determine the pixel type of the input image
     boost::shared_ptr<DiskImageResource> image_rsrc = vw::DiskImageResourcePtr(opt.image_file);
     ImageFormat image_fmt = image_rsrc->format();
@@ -887,6 +1275,10 @@ int main(int argc, char* argv[]) {
     // - Must correspond to the type of the input image.
     if (image_fmt.pixel_format == VW_PIXEL_RGB) {
 
+      if (!opt.extra_band_images.empty())
+        vw_throw(ArgumentErr() << "The option --extra-band-images can be used only with "
+                 << "single-channel images.\n");
+
       // We can't just use float for everything or the output will be cast
       //  into the -1 to 1 range which is probably not desired.
       // - Always use an alpha channel with RGB images.
@@ -934,6 +1326,11 @@ int main(int argc, char* argv[]) {
     } 
     // Done map projecting!
 
+    // When writing the whole output, rather than a tile of it, carry over the
+    // RPC model, if any.
+    if (opt.target_pixelwin == BBox2() && !opt.noGeoHeaderInfo)
+      copy_rpc_metadata(opt.image_file, opt.output_file);
+
   } ASP_STANDARD_CATCHES;
 
   return 0;
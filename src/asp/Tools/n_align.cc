@@ -37,6 +37,7 @@
 #include <Eigen/Geometry>
 
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/ThreadPool.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/PointUtils.h>
@@ -291,6 +292,69 @@ void SearchKDTree_double(KDTree_double* tree, const vw::Vector3& input,
   tree->knnSearch(query_mat, indices_mat, dists_mat, nn, flann::SearchParams(ONE_TWO_EIGHT));
 }
 
+// Find the nearest neighbor in a tree of each point in a range of a
+// cloud, searching for all of them at once.
+class NearestNeighborTask: public vw::Task, private boost::noncopyable {
+  KDTree_double * m_tree;
+  Eigen::MatrixXd const& m_T;
+  std::vector<vw::Vector3> const& m_cloud;
+  size_t m_beg, m_end;
+  std::vector<int> & m_matches;
+public:
+  NearestNeighborTask(KDTree_double * tree, Eigen::MatrixXd const& T,
+                      std::vector<vw::Vector3> const& cloud, size_t beg, size_t end,
+                      std::vector<int> & matches):
+    m_tree(tree), m_T(T), m_cloud(cloud), m_beg(beg), m_end(end), m_matches(matches) {}
+
+  void operator()() {
+    int rows = m_end - m_beg;
+    int dim = vw::Vector3().size();
+    if (rows <= 0)
+      return;
+    
+    std::vector<double> query(rows * dim);
+    for (int i = 0; i < rows; i++) {
+      vw::Vector3 const& p = m_cloud[m_beg + i];
+      for (int j = 0; j < dim; j++)
+        query[i * dim + j] = m_T(j, 0) * p[0] + m_T(j, 1) * p[1] + m_T(j, 2) * p[2] + m_T(j, 3);
+    }
+    flann::Matrix<double> query_mat(&query[0], rows, dim);
+
+    int nn = 1;
+    std::vector<int> indices(rows * nn, -1);
+    std::vector<double> dists(rows * nn);
+    flann::Matrix<int> indices_mat(&indices[0], rows, nn);
+    flann::Matrix<double> dists_mat(&dists[0], rows, nn);
+    m_tree->knnSearch(query_mat, indices_mat, dists_mat, nn, flann::SearchParams(ONE_TWO_EIGHT));
+
+    for (int i = 0; i < rows; i++) 
+      m_matches[m_beg + i] = indices[i];
+  }
+};
+
+// Find the nearest neighbor in a tree of each point of a cloud, in
+// parallel. The tree was built from a cloud which was moved since by a
+// rigid transform. Rather than rebuilding the tree, the points are
+// moved by the inverse of that transform, given as T, as distances do
+// not change. The index of a point which has no match is set to -1.
+void find_nearest_neighbors(KDTree_double * tree, Eigen::MatrixXd const& T,
+                            std::vector<vw::Vector3> const& cloud, int num_threads,
+                            std::vector<int> & matches) {
+  matches.assign(cloud.size(), -1);
+
+  // Several chunks per thread, but not too small, so the overhead stays low
+  num_threads = std::max(num_threads, 1);
+  size_t chunk = std::max(size_t(1000), cloud.size() / (4 * num_threads) + 1);
+  vw::FifoWorkQueue queue(num_threads);
+  for (size_t beg = 0; beg < cloud.size(); beg += chunk) {
+    boost::shared_ptr<NearestNeighborTask>
+      task(new NearestNeighborTask(tree, T, cloud, beg, std::min(beg + chunk, cloud.size()),
+                                   matches));
+    queue.add_task(task);
+  }
+  queue.join_all();
+}
+
 std::string transform_file(std::string const& out_prefix, int index){
   std::ostringstream os;
   os << out_prefix << "-transform-" << index << ".txt";
@@ -414,14 +478,19 @@ int main(int argc, char *argv[]){
         apply_transform_to_cloud(clouds[cloudIter], transVec[cloudIter]);
     }
     
-    // Build the trees
+    // Build the trees. They are not rebuilt when the clouds move. Instead,
+    // the transforms applied to each cloud since its tree was built
+    // are accumulated, and the queries are moved by their inverses.
     std::vector< boost::shared_ptr<KDTree_double> > Trees;
+    std::vector<Eigen::MatrixXd> treeTrans(numClouds);
     for (int it = 0; it < numClouds; it++) {
       boost::shared_ptr<KDTree_double>
         tree(new KDTree_double(flann::KDTreeSingleIndexParams(FIFTEEN)));
       BuildKDTree_double(clouds[it], tree.get());
       Trees.push_back(tree);
+      treeTrans[it] = Eigen::MatrixXd::Identity(4, 4);
     }
+    int num_threads = vw_settings().default_num_threads();
 
     std::string errCaption = std::string("Computing the error, defined as the mean of ") +
       "pairwise distances from each cloud to the centroid cloud.\n";
@@ -461,6 +530,11 @@ int main(int argc, char *argv[]){
       // This will record for each point in each cloud which point in
       // every other cloud is closest to it. This matrix will store the
       // indices of these points.
+      // The transforms from where the clouds are now to where their trees were built
+      std::vector<Eigen::MatrixXd> treeInv(numClouds);
+      for (int it = 0; it < numClouds; it++)
+        treeInv[it] = treeTrans[it].inverse();
+      
       std::vector<Eigen::VectorXd> CentroidPtsBelMod(numOfPoints);
       for (size_t row = 0; row < CentroidPtsBelMod.size(); row++) {
         CentroidPtsBelMod[row] = Eigen::VectorXd(numClouds);
@@ -488,25 +562,24 @@ int main(int argc, char *argv[]){
           int beg = modelSpan[j], end = modelSpan[j+1] - 1;
           for (int it = beg; it <= end; it++) spanJ.push_back(it);
         
-          std::vector<int> match, match2;
-          std::vector<double> dist;
+          std::vector<int> match;
           typedef std::set<std::pair<int, int>, CustomCompare> PairType;
 
           // For each point in cloud i, find a match in cloud j
           PairType Corr1;
+          find_nearest_neighbors(Trees[j].get(), treeInv[j], clouds[i], num_threads, match);
           for (size_t index_i = 0; index_i < clouds[i].size(); index_i++){
-            SearchKDTree_double(Trees[j].get(), clouds[i][index_i], match, dist, 1);
-            if (match.empty()) continue; // should not happen
-            int index_j = match[0];
+            int index_j = match[index_i];
+            if (index_j < 0) continue; // should not happen
             Corr1.insert(std::pair<int, int>(index_j, index_i));
           }
 
           // Now do it in reverse
           PairType Corr2;
+          find_nearest_neighbors(Trees[i].get(), treeInv[i], clouds[j], num_threads, match);
           for (size_t index_j = 0; index_j < clouds[j].size(); index_j++){
-            SearchKDTree_double(Trees[i].get(), clouds[j][index_j], match, dist, 1);
-            if (match.empty()) continue; // should not happen
-            int index_i = match[0];
+            int index_i = match[index_j];
+            if (index_i < 0) continue; // should not happen
             Corr2.insert(std::pair<int, int>(index_j, index_i));
           }
 
@@ -608,6 +681,7 @@ int main(int argc, char *argv[]){
 
         // Move the clouds to the new location for the next iteration
         apply_transform_to_cloud(clouds[cloudIter], currT);
+        treeTrans[cloudIter] = currT*treeTrans[cloudIter];
 
 	// Compute the error after the transform is applied
         for (int row = 0; row < CentroidPtsBelMod.size(); row++) {
@@ -20,13 +20,17 @@
 /// Tool for finding the Otsu image threshold
 /// https://en.wikipedia.org/wiki/Otsu%27s_method
 
+#include <algorithm>
+#include <cmath>
 #include <limits>
 
+#include <vw/Core/ThreadPool.h>
 #include <vw/FileIO/DiskImageUtils.h>
 #include <vw/Image/Statistics.h>
 
 #include <asp/Core/Common.h>
 #include <asp/Core/Macros.h>
+#include <asp/Core/RasterStats.h>
 
 namespace po = boost::program_options;
 
@@ -35,9 +39,9 @@ using namespace vw;
 struct Options: vw::GdalWriteOptions {
   std::vector<std::string> image_files;
   bool has_nodata_value;
-  std::int64_t num_samples, num_bins;
+  std::int64_t num_samples, num_bins, sample_stride;
   double nodata_value;
-  Options(): has_nodata_value(false), num_samples(-1),
+  Options(): has_nodata_value(false), num_samples(-1), sample_stride(0),
              nodata_value(std::numeric_limits<double>::quiet_NaN()){}
 };
 
@@ -49,6 +53,9 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     ("num-samples", po::value(&opt.num_samples)->default_value(-1),
      "The number of samples to pick from the image. If not specified, hence set to -1, "
      "the full image will be used.")
+    ("sample-stride", po::value(&opt.sample_stride)->default_value(0),
+     "If positive, use only every this many rows and columns of the image. Cannot be "
+     "used with --num-samples.")
     ("num-bins", po::value(&opt.num_bins)->default_value(256),
      "Number of bins to use for the histogram. A larger value is "
      "suggested if the image has outlying pixel values.")
@@ -75,11 +82,165 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
   if (opt.image_files.empty())
     vw_throw(ArgumentErr() << "No input images were specified.\n" << usage << general_options);
 
+  if (opt.num_samples > 0 && opt.sample_stride > 0)
+    vw_throw(ArgumentErr() << "Cannot use both --num-samples and --sample-stride.\n"
+             << usage << general_options);
+
   if (opt.num_bins <= 100) 
     vw_throw(ArgumentErr() << "At least 100 bins should be used, and ideally more.\n"
              << usage << general_options);
 }
 
+// The valid sampled pixels of an image, accumulated over tiles
+struct SampleStats {
+  double min_val, max_val;
+  std::int64_t num_valid;
+  std::vector<std::int64_t> hist;
+  vw::Mutex mutex;
+  SampleStats(): min_val(std::numeric_limits<double>::max()),
+                 max_val(-std::numeric_limits<double>::max()), num_valid(0) {}
+};
+
+// Find the range of the sampled pixels in a tile, or, if the range is
+// known, their histogram. Bin i is centered at min_val + i * bin_len,
+// as for vw::otsu_threshold().
+class SampleTask: public vw::Task, private boost::noncopyable {
+  ImageViewRef<PixelMask<float>> const& m_image;
+  std::vector<std::int64_t> const& m_cols; // sampled columns in the tile
+  std::vector<std::int64_t> const& m_rows;
+  size_t m_col_beg, m_col_end, m_row_beg, m_row_end;
+  bool m_find_hist;
+  SampleStats & m_stats;
+
+public:
+  SampleTask(ImageViewRef<PixelMask<float>> const& image,
+             std::vector<std::int64_t> const& cols, std::vector<std::int64_t> const& rows,
+             size_t col_beg, size_t col_end, size_t row_beg, size_t row_end,
+             bool find_hist, SampleStats & stats):
+    m_image(image), m_cols(cols), m_rows(rows),
+    m_col_beg(col_beg), m_col_end(col_end), m_row_beg(row_beg), m_row_end(row_end),
+    m_find_hist(find_hist), m_stats(stats) {}
+
+  void operator()() {
+
+    int min_col = m_cols[m_col_beg], min_row = m_rows[m_row_beg];
+    BBox2i box(min_col, min_row, m_cols[m_col_end - 1] - min_col + 1,
+               m_rows[m_row_end - 1] - min_row + 1);
+    ImageView<PixelMask<float>> tile = crop(m_image, box);
+
+    int num_bins = m_stats.hist.size();
+    double min_val = m_stats.min_val, max_val = m_stats.max_val;
+    double scale = (max_val > min_val) ? (num_bins - 1) / (max_val - min_val) : 0.0;
+
+    double local_min = std::numeric_limits<double>::max();
+    double local_max = -std::numeric_limits<double>::max();
+    std::int64_t local_num_valid = 0;
+    std::vector<std::int64_t> local_hist(m_find_hist ? num_bins : 0, 0);
+    for (size_t r = m_row_beg; r < m_row_end; r++) {
+      int row = m_rows[r] - min_row;
+      for (size_t c = m_col_beg; c < m_col_end; c++) {
+        PixelMask<float> const& pix = tile(m_cols[c] - min_col, row);
+        double val = pix.child();
+        if (!is_valid(pix) || std::isnan(val))
+          continue;
+        local_num_valid++;
+        if (!m_find_hist) {
+          local_min = std::min(local_min, val);
+          local_max = std::max(local_max, val);
+          continue;
+        }
+        int bin = round((val - min_val) * scale);
+        bin = std::max(0, std::min(num_bins - 1, bin));
+        local_hist[bin]++;
+      }
+    }
+
+    vw::Mutex::Lock lock(m_stats.mutex);
+    if (!m_find_hist) {
+      m_stats.min_val = std::min(m_stats.min_val, local_min);
+      m_stats.max_val = std::max(m_stats.max_val, local_max);
+      m_stats.num_valid += local_num_valid;
+      return;
+    }
+    for (int bin = 0; bin < num_bins; bin++)
+      m_stats.hist[bin] += local_hist[bin];
+  }
+};
+
+// Go over the sampled pixels in parallel, in tiles of the image
+void accumulate_samples(ImageViewRef<PixelMask<float>> const& image,
+                        std::vector<std::int64_t> const& cols,
+                        std::vector<std::int64_t> const& rows,
+                        bool find_hist, SampleStats & stats) {
+
+  const std::int64_t tile_len = 1024;
+  FifoWorkQueue queue(vw_settings().default_num_threads());
+  size_t row_beg = 0;
+  while (row_beg < rows.size()) {
+    size_t row_end = row_beg;
+    while (row_end < rows.size() && rows[row_end] < (rows[row_beg] / tile_len + 1) * tile_len)
+      row_end++;
+    size_t col_beg = 0;
+    while (col_beg < cols.size()) {
+      size_t col_end = col_beg;
+      while (col_end < cols.size() && cols[col_end] < (cols[col_beg] / tile_len + 1) * tile_len)
+        col_end++;
+      boost::shared_ptr<SampleTask>
+        task(new SampleTask(image, cols, rows, col_beg, col_end, row_beg, row_end,
+                            find_hist, stats));
+      queue.add_task(task);
+      col_beg = col_end;
+    }
+    row_beg = row_end;
+  }
+  queue.join_all();
+}
+
+// The positions of num_samples samples out of len, uniformly spread,
+// or every stride-th one, if the stride is positive
+std::vector<std::int64_t> sample_positions(std::int64_t len, std::int64_t num_samples,
+                                           std::int64_t stride) {
+  std::vector<std::int64_t> pos;
+  if (stride > 0) {
+    for (std::int64_t it = 0; it < len; it += stride)
+      pos.push_back(it);
+  } else {
+    for (std::int64_t it = 0; it < num_samples; it++)
+      pos.push_back(std::min(len - 1, (it * len) / num_samples));
+  }
+  return pos;
+}
+
+// The Otsu threshold, given a histogram with bin centers at
+// min_val + i * bin_len. It is the center of the last bin of the lower class.
+double otsu_from_histogram(std::vector<std::int64_t> const& hist,
+                           double min_val, double bin_len) {
+
+  double total = 0.0, total_sum = 0.0;
+  for (size_t bin = 0; bin < hist.size(); bin++) {
+    total     += hist[bin];
+    total_sum += double(bin) * hist[bin];
+  }
+
+  double best_var = -1.0, w0 = 0.0, sum0 = 0.0;
+  size_t best_bin = 0;
+  for (size_t bin = 0; bin + 1 < hist.size(); bin++) {
+    w0   += hist[bin];
+    sum0 += double(bin) * hist[bin];
+    double w1 = total - w0;
+    if (w0 == 0.0 || w1 == 0.0)
+      continue;
+    double diff = sum0 / w0 - (total_sum - sum0) / w1;
+    double var = w0 * w1 * diff * diff;
+    if (var > best_var) {
+      best_var = var;
+      best_bin = bin;
+    }
+  }
+
+  return min_val + best_bin * bin_len;
+}
+
 int main( int argc, char *argv[] ) {
 
   Options opt;
@@ -128,23 +289,63 @@ int main( int argc, char *argv[] ) {
       num_sample_cols = std::max(std::int64_t(1), num_sample_cols);
       num_sample_cols = std::min(num_cols, num_sample_cols);
       
+      if (opt.sample_stride > 0) {
+        num_sample_rows = (num_rows + opt.sample_stride - 1) / opt.sample_stride;
+        num_sample_cols = (num_cols + opt.sample_stride - 1) / opt.sample_stride;
+      }
+
       std::cout << "Number of image rows and columns: "
                 << num_rows << ", " << num_cols << "\n";
       std::cout << "Picking a uniform sample of dimensions "
                 << num_sample_rows << ", " << num_sample_cols << "\n";
       std::cout << "Number of bins in the histogram: " << opt.num_bins << std::endl;
-      std::cout << "It may take several minutes to find the answer.\n";
+
+      std::vector<std::int64_t> sample_rows
+        = sample_positions(num_rows, num_sample_rows, opt.sample_stride);
+      std::vector<std::int64_t> sample_cols
+        = sample_positions(num_cols, num_sample_cols, opt.sample_stride);
 
       // The mask creation can handle a NaN for the opt.nodata_value.
-      double threshold = vw::otsu_threshold(create_mask(image, opt.nodata_value),
-                                               num_sample_rows, num_sample_cols,
-                                               opt.num_bins);
+      ImageViewRef<PixelMask<float>> masked_image = create_mask(image, opt.nodata_value);
 
+      // The range of the sampled pixels may be known from an earlier run. The
+      // sampling and the nodata value must be the same. A NaN nodata value
+      // is recorded as a flag, as it cannot be read back.
+      bool nan_nodata = std::isnan(opt.nodata_value);
+      std::vector<double> sampling
+        = {double(num_sample_rows), double(num_sample_cols), double(opt.sample_stride),
+           double(nan_nodata), nan_nodata ? 0.0 : opt.nodata_value};
+      asp::RasterStats raster_stats;
+      SampleStats stats;
+      if (asp::read_raster_stats(image_file, raster_stats) &&
+          raster_stats["otsu_sampling"] == sampling &&
+          raster_stats["otsu_range"].size() == 3) {
+        std::cout << "Reading the range of the sampled pixels from: "
+                  << asp::raster_stats_file(image_file) << "\n";
+        stats.min_val   = raster_stats["otsu_range"][0];
+        stats.max_val   = raster_stats["otsu_range"][1];
+        stats.num_valid = raster_stats["otsu_range"][2];
+      } else {
+        accumulate_samples(masked_image, sample_cols, sample_rows, false, stats);
+        if (stats.num_valid > 0) {
+          // Any other stats of the image are kept
+          raster_stats["otsu_sampling"] = sampling;
+          raster_stats["otsu_range"] = {stats.min_val, stats.max_val, double(stats.num_valid)};
+          asp::write_raster_stats(image_file, raster_stats);
+        }
+      }
+
+      if (stats.num_valid == 0)
+        vw_throw(ArgumentErr() << "Found no valid pixels in: " << image_file << "\n");
+
+      double threshold = stats.min_val;
+      if (stats.max_val > stats.min_val) {
+        stats.hist.assign(opt.num_bins, 0);
+        accumulate_samples(masked_image, sample_cols, sample_rows, true, stats);
+        double bin_len = (stats.max_val - stats.min_val) / (opt.num_bins - 1);
+        threshold = otsu_from_histogram(stats.hist, stats.min_val, bin_len);
+      }
 
-      // A different implementation, which gives the same result
-      // if above the full image is sampled and 256 bins are used.
-      //double threshold2 = vw::otsu_threshold(create_mask(image, opt.nodata_value));
-      
       vw_out() << std::setprecision(16)
         << "Otsu threshold for image " << image_file << ": " << threshold << "\n";
     }
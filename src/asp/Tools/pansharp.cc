@@ -34,55 +34,33 @@ namespace fs = boost::filesystem;
 
 
 
-// TODO: Move these to vw/PixelType.h ??
-// - These don't follow the existing pixel color conventions!
-
-/// Convert an RGB pixel to a YCbCr pixel
-/// - So far this only works for unsigned char and unsigned short.
-template <typename T>
-T rgbToYCbCr(T const& rgb, double min_val, double max_val) {
-  // Convert
-  double mean_val = (min_val + max_val+1) / 2.0;
-  double temp[3];
-  temp[0] =            0.299   *rgb[0] + 0.587   *rgb[1] + 0.114   *rgb[2];
-  temp[1] = mean_val - 0.168736*rgb[0] - 0.331264*rgb[1] + 0.5     *rgb[2];
-  temp[2] = mean_val + 0.5     *rgb[0] - 0.418688*rgb[1] - 0.081312*rgb[2];
-  // Copy and constrain
-  T ycbcr;
-  for (int i=0; i<3; ++i)
-  {
-    ycbcr[i] = temp[i];
-    if (temp[i] < min_val) ycbcr[i] = min_val;
-    if (temp[i] > max_val) ycbcr[i] = max_val;
-  }
-  return ycbcr;
+/// Limit a value to the legal image range
+inline double clamp_to_range(double val, double min_val, double max_val) {
+  if (val < min_val) return min_val;
+  if (val > max_val) return max_val;
+  return val;
 }
 
-
-/// Converts a single YCbCr pixel to RGB
-/// - So far this only works for unsigned char and unsigned short.
-template <typename T>
-T ycbcrToRgb(T const& ycbcr, double min_val, double max_val) {
-  // Convert
-  double mean_val = (min_val + max_val+1) / 2.0;
-  double temp[3];
-  temp[0] = ycbcr[0]                                   + 1.402   * (ycbcr[2] - mean_val);
-  temp[1] = ycbcr[0] - 0.34414 * (ycbcr[1] - mean_val) - 0.71414 * (ycbcr[2] - mean_val);
-  temp[2] = ycbcr[0] + 1.772   * (ycbcr[1] - mean_val);
-
-  // Copy and constrain
-  T rgb;
-  for (int i=0; i<3; ++i)
-  {
-    rgb[i] = temp[i];
-    if (temp[i] < min_val) rgb[i] = min_val;
-    if (temp[i] > max_val) rgb[i] = max_val;
-  }
-  return rgb;
+/// Pansharpen one pixel. This converts the RGB values to YCbCr, with
+/// the chroma channels centered at the middle of the range, replaces
+/// the Y channel with the gray value, and converts back to RGB,
+/// clamping the values after each conversion. The Y channel of the
+/// color pixel is discarded, so it is not computed.
+inline void pansharp_pixel(double gray, double const rgb[3],
+                           double min_val, double max_val, double mean_val,
+                           double out[3]) {
+  double cb = clamp_to_range(mean_val - 0.168736*rgb[0] - 0.331264*rgb[1] + 0.5     *rgb[2],
+                             min_val, max_val);
+  double cr = clamp_to_range(mean_val + 0.5     *rgb[0] - 0.418688*rgb[1] - 0.081312*rgb[2],
+                             min_val, max_val);
+  out[0] = clamp_to_range(gray                             + 1.402   * (cr - mean_val),
+                          min_val, max_val);
+  out[1] = clamp_to_range(gray - 0.34414 * (cb - mean_val) - 0.71414 * (cr - mean_val),
+                          min_val, max_val);
+  out[2] = clamp_to_range(gray + 1.772   * (cb - mean_val),
+                          min_val, max_val);
 }
 
-
-
 /// Image view class which applies a pan sharp algorithm.
 /// - This takes a gray and an RGB image as input and generates an RGB image as output.
 /// - This operation is not particularly useful unless the gray image is higher
@@ -138,48 +116,42 @@ public: // Functions
   inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
 
 
-  /// Apply pansharp algorithm to a single pair of pixels.
-  /// - Any required interpolation etc. will have already happened by now.
-  template <class P1, class P2>
-  result_type convert_pixel(P1 const& gray_pixel, P2 const& color_pixel) const {
-    // Convert RGB to YCbCr
-    P2 temp = rgbToYCbCr(color_pixel, m_min_val, m_max_val);
-    result_type ycbcr_pixel(temp[0], temp[1], temp[2]); // Extra step breaks any type dependency from the inputs
-
-    // Replace Y channel with gray value
-    ycbcr_pixel[0] = gray_pixel[0];
-
-    // Convert YCbCr back to RGB
-    return ycbcrToRgb(ycbcr_pixel, m_min_val, m_max_val);
-  }
-
-
   typedef CropView<ImageView<result_type> > prerasterize_type;
   inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
 
     // Set up the output image tile
     ImageView<result_type> tile(bbox.width(), bbox.height());
 
-    // Loop through each output pixels and compute each output value
-    for (int c = 0; c < bbox.width(); c++) {
-      int source_c = c + bbox.min()[0];
-      for (int r = 0; r < bbox.height(); r++) {
-        int source_r = r + bbox.min()[1];
+    // Rasterize the inputs over the tile once. This resamples the color
+    // image into the gray image pixels for the whole tile, rather than
+    // for each pixel access, and twice per pixel, as before.
+    ImageView<typename ImageGrayT::pixel_type>  gray_tile  = crop(m_gray_image,  bbox);
+    ImageView<typename ImageColorT::pixel_type> color_tile = crop(m_color_image, bbox);
+
+    const double min_val  = m_min_val;
+    const double max_val  = m_max_val;
+    const double mean_val = (min_val + max_val + 1) / 2.0;
+
+    // Loop through each output pixel and compute each output value
+    for (int r = 0; r < bbox.height(); r++) {
+      for (int c = 0; c < bbox.width(); c++) {
+
+        typename ImageGrayT::pixel_type  const& gray_pixel  = gray_tile(c, r);
+        typename ImageColorT::pixel_type const& color_pixel = color_tile(c, r);
 
         // Check for a masked pixel
-        if ( !is_valid(m_gray_image (source_c, source_r)) ||
-             !is_valid(m_color_image(source_c, source_r))  ) {
+        if (!is_valid(gray_pixel) || !is_valid(color_pixel)) {
           tile(c, r) = m_output_nodata;
           continue;
         }
 
-        // Pass the two input pixels into the conversion function
-        //result_type output_pixel = convert_pixel(m_gray_image(source_c, r), m_color_image(source_c, r));
-        tile(c,r) = convert_pixel(m_gray_image (source_c, source_r),
-                                  m_color_image(source_c, source_r));
+        double rgb[3] = {double(color_pixel[0]), double(color_pixel[1]), double(color_pixel[2])};
+        double out[3];
+        pansharp_pixel(gray_pixel[0], rgb, min_val, max_val, mean_val, out);
+        tile(c, r) = result_type(out[0], out[1], out[2]);
 
-      } // End row loop
-    } // End column loop
+      } // End column loop
+    } // End row loop
 
     // Return the tile we created with fake borders to make it look the size of the entire output image
     return prerasterize_type(tile,
@@ -65,10 +65,14 @@
 #include <asp/Core/Macros.h>
 #include <asp/Core/PointUtils.h>
 #include <asp/Core/InterestPointMatching.h>
+#include <asp/Core/TiledDem.h>
 #include <asp/Tools/pc_align_utils.h>
+#include <asp/Core/Tracing.h>
 
 #include <limits>
 #include <cstring>
+#include <set>
+#include <sstream>
 #include <thread>
 #if !__APPLE__
 #include <omp.h>
@@ -96,10 +100,12 @@ struct Options : public vw::GdalWriteOptions {
   // Input
   string reference, source, init_transform_file, alignment_method, config_file,
     datum, csv_format_str, csv_proj4_str, match_file, hillshade_options,
-    ipfind_options, ipmatch_options, fgr_options;
+    ipfind_options, ipmatch_options, fgr_options, reference_cache, source_list;
+  std::vector<std::string> sources, source_prefixes; // more than one in batch mode
   Vector2 initial_transform_ransac_params;
   PointMatcher<RealT>::Matrix init_transform;
   int    num_iter,
+         hillshade_max_size,
          max_num_reference_points,
          max_num_source_points;
   double diff_translation_err,
@@ -172,9 +178,11 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
                                  "Initialize the alignment transform as the rotation with this angle (in degrees) around the axis going from the planet center to the centroid of the point cloud. If --initial-ned-translation is also specified, the translation gets applied after the rotation.")
 
     ("initial-transform-from-hillshading", po::value(&opt.hillshading_transform)->default_value(""), "If both input clouds are DEMs, find interest point matches among their hillshaded versions, and use them to compute an initial transform to apply to the source cloud before proceeding with alignment. Specify here the type of transform, as one of: 'similarity' (rotation + translation + scale), 'rigid' (rotation + translation) or 'translation'. See the options further down for tuning this.")
-    ("hillshade-options", po::value(&opt.hillshade_options)->default_value("--azimuth 300 --elevation 20 --align-to-georef"), "Options to pass to the hillshade program when computing the transform from hillshading.")
-    ("ipfind-options", po::value(&opt.ipfind_options)->default_value("--ip-per-image 1000000 --interest-operator sift --descriptor-generator sift"), "Options to pass to the ipfind program when computing the transform from hillshading.")
-    ("ipmatch-options", po::value(&opt.ipmatch_options)->default_value("--inlier-threshold 100 --ransac-iterations 10000 --ransac-constraint similarity"), "Options to pass to the ipmatch program when computing the transform from hillshading.")
+    ("hillshade-options", po::value(&opt.hillshade_options)->default_value("--azimuth 300 --elevation 20 --align-to-georef"), "The light azimuth and elevation, in degrees, for hillshading the DEMs when computing the transform from hillshading. These are given in the format of the hillshade program, whose other options are ignored.")
+    ("ipfind-options", po::value(&opt.ipfind_options)->default_value("--ip-per-image 1000000 --interest-operator sift --descriptor-generator sift"), "The number of interest points per image and the interest point operator (sift, orb, or any other value for the default) when computing the transform from hillshading, given in the format of the ipfind program, whose other options are ignored.")
+    ("ipmatch-options", po::value(&opt.ipmatch_options)->default_value("--inlier-threshold 100 --ransac-iterations 10000 --ransac-constraint similarity"), "Ignored. The interest point matches from hillshading are now filtered with RANSAC when the transform is found. See --initial-transform-ransac-params.")
+    ("hillshade-max-size", po::value(&opt.hillshade_max_size)->default_value(4096),
+     "When computing the transform from hillshading, average the DEMs over blocks of pixels so that the larger of the two hillshaded images has at most this many rows and columns, and both have about the same ground resolution.")
     ("match-file", po::value(&opt.match_file)->default_value(""), "Compute a translation + rotation + scale transform from the source to the reference point cloud using manually selected point correspondences from the reference to the source (obtained for example using stereo_gui). It may be desired to change --initial-transform-ransac-params if it rejects as outliers some manual matches.")
     ("initial-transform-ransac-params", po::value(&opt.initial_transform_ransac_params)->default_value(Vector2(10000, 1.0), "num_iter factor"),
      "When computing an initial transform based on hillshading, use "
@@ -185,6 +193,12 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("no-dem-distances",         po::bool_switch(&opt.dont_use_dem_distances)->default_value(false)->implicit_value(true),
                                  "For reference point clouds that are DEMs, don't take advantage of the fact that it is possible to interpolate into this DEM when finding the closest distance to it from a point in the source cloud and hence the error metrics.")
 
+    ("source-list",              po::value(&opt.source_list)->default_value(""),
+     "Align each of the source clouds/DEMs listed in this file, one per line, to the reference, which is loaded only once. The outputs for each source have the output prefix followed by a dash and the source name without extension. Then no source is given on the command line.")
+
+    ("reference-cache",          po::value(&opt.reference_cache)->default_value(""),
+     "Save a sample of the whole reference cloud, of at most max-num-reference-points, to this file, or, if it exists and was made with the same reference, number of points, and datum, use it instead of loading the reference. It is memory-mapped, and each run keeps only the points in its region.")
+
     ("config-file",              po::value(&opt.config_file)->default_value(""),
      "This is an advanced option. Read the alignment parameters from a configuration file, in the format expected by libpointmatcher, over-riding the command-line options.");
 
@@ -210,9 +224,44 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
                              positional, positional_desc, usage,
                              allow_unregistered, unregistered );
 
+  if (opt.source_list != "") {
+    if (!opt.source.empty())
+      vw_throw( ArgumentErr() << "Cannot give a source both on the command line "
+                << "and with --source-list.\n" << usage << general_options );
+    std::ifstream ifs(opt.source_list.c_str());
+    if (!ifs.good())
+      vw_throw( ArgumentErr() << "Cannot open: " << opt.source_list << ".\n" );
+    std::string line;
+    while (std::getline(ifs, line)) {
+      boost::algorithm::trim(line);
+      if (line.empty() || line[0] == '#')
+        continue;
+      opt.sources.push_back(line);
+    }
+    if (opt.sources.empty())
+      vw_throw( ArgumentErr() << "No sources were found in: " << opt.source_list << ".\n" );
+    opt.source = opt.sources[0];
+  } else {
+    opt.sources.push_back(opt.source);
+  }
+
   if ( opt.reference.empty() || opt.source.empty() )
     vw_throw( ArgumentErr() << "Missing input files.\n" << usage << general_options );
 
+  // The output prefix of each source. Make them unique if names repeat.
+  if (opt.sources.size() == 1) {
+    opt.source_prefixes.push_back(opt.out_prefix);
+  } else {
+    std::set<std::string> used;
+    for (size_t i = 0; i < opt.sources.size(); i++) {
+      std::string prefix = opt.out_prefix + "-" + fs::path(opt.sources[i]).stem().string();
+      if (used.find(prefix) != used.end())
+        prefix += "_" + vw::num_to_str(i);
+      used.insert(prefix);
+      opt.source_prefixes.push_back(prefix);
+    }
+  }
+
   if ( opt.out_prefix.empty() )
     vw_throw( ArgumentErr() << "Missing output prefix.\n" << usage << general_options );
 
@@ -249,6 +298,13 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
               << "Cannot specify an initial transform both from a file "
               << "and as a NED vector or rotation angle.\n");
 
+  if (opt.hillshade_max_size < 16)
+    vw_throw( ArgumentErr() << "The value of --hillshade-max-size must be at least 16.\n");
+
+  if (opt.sources.size() > 1 && (opt.hillshading_transform != "" || opt.match_file != ""))
+    vw_throw( ArgumentErr() << "An initial transform from hillshading or a match file "
+              << "is specific to one source, so it cannot be used with --source-list.\n");
+
   if ( (opt.hillshading_transform != "" || opt.match_file != "") &&
        (opt.initial_ned_translation != "" || opt.init_transform_file != "" ||
         opt.initial_rotation_angle != 0)) {
@@ -473,8 +529,7 @@ void save_errors(DP const& point_cloud,
 /// - If there is a problem computing the point error, a very large number is used as a flag.
 void calcErrorsWithDem(DP          const& point_cloud,
                        vw::Vector3 const& point_cloud_shift,
-                       vw::cartography::GeoReference        const& georef,
-                       vw::ImageViewRef< PixelMask<float> > const& dem,
+                       asp::TiledDem const& dem,
                        std::vector<double> &errors) {
 
   // Initialize output error storage
@@ -482,16 +537,17 @@ void calcErrorsWithDem(DP          const& point_cloud,
   errors.resize(num_pts);
 
   // Loop through every point in the point cloud
+  vw::cartography::Datum const& datum = dem.georef().datum();
   double dem_height_here;
   for (std::int64_t i = 0; i < num_pts; i++){
     // Extract and un-shift the point to get the real GCC coordinate
     Vector3 gcc_coord = get_cloud_gcc_coord(point_cloud, point_cloud_shift, i);
 
     // Convert from GDC to GCC
-    Vector3 llh = georef.datum().cartesian_to_geodetic(gcc_coord); // lon-lat-height
+    Vector3 llh = datum.cartesian_to_geodetic(gcc_coord); // lon-lat-height
 
     // Interpolate the point at this location
-    if (!interp_dem_height(dem, georef, llh, dem_height_here)) {
+    if (!dem.height_at_lonlat(subvector(llh, 0, 2), dem_height_here)) {
       // If we did not intersect the DEM, record a flag error value here.
       errors[i] = BIG_NUMBER;
     }
@@ -631,10 +687,8 @@ fgr_alignment(DP const & source_point_cloud, DP const & ref_point_cloud, Options
 // with the least squares method of finding the best transform between
 // clouds.
 struct PointToDemError {
-  PointToDemError(Vector3 const& point,
-		 ImageViewRef< PixelMask<float> > const& dem,
-		 cartography::GeoReference const& geo):
-    m_point(point), m_dem(dem), m_geo(geo){}
+  PointToDemError(Vector3 const& point, asp::TiledDem const& dem):
+    m_point(point), m_dem(dem){}
 
   template <typename F>
   bool operator()(const F* const transform, const F* const scale, F* residuals) const {
@@ -650,11 +704,11 @@ struct PointToDemError {
     Vector3 trans_point = scale[0]*rotation.rotate(m_point) + translation;
     
     // Convert from GDC to GCC
-    Vector3 llh = m_geo.datum().cartesian_to_geodetic(trans_point); // lon-lat-height
+    Vector3 llh = m_dem.georef().datum().cartesian_to_geodetic(trans_point); // lon-lat-height
 
     // Interpolate the point at this location
     double dem_height_here;
-    if (!interp_dem_height(m_dem, m_geo, llh, dem_height_here)) {
+    if (!m_dem.height_at_lonlat(subvector(llh, 0, 2), dem_height_here)) {
       // If we did not intersect the DEM, record a flag error value here.
       residuals[0] = F(0.0);
       return true;
@@ -666,25 +720,21 @@ struct PointToDemError {
   
   // Factory to hide the construction of the CostFunction object from
   // the client code.
-  static ceres::CostFunction* Create(Vector3 const& point,
-				     ImageViewRef< PixelMask<float> > const& dem,
-				     vw::cartography::GeoReference const& geo){
+  static ceres::CostFunction* Create(Vector3 const& point, asp::TiledDem const& dem){
     return (new ceres::NumericDiffCostFunction<PointToDemError,
 	    ceres::CENTRAL, 1, 6, 1>
-	    (new PointToDemError(point, dem, geo)));
+	    (new PointToDemError(point, dem)));
   }
 
   Vector3                                  m_point;
-  ImageViewRef< PixelMask<float> > const & m_dem;    // alias
-  cartography::GeoReference        const & m_geo;    // alias
+  asp::TiledDem const & m_dem; // alias
 };
 
 /// Compute alignment using least squares
 PointMatcher<RealT>::Matrix
 least_squares_alignment(DP const& source_point_cloud, // Should not be modified
 			vw::Vector3 const& point_cloud_shift,
-			vw::cartography::GeoReference        const& dem_georef,
-			vw::ImageViewRef< PixelMask<float> > const& dem_ref,
+			asp::TiledDem const& dem,
 			Options const& opt) {
 
   ceres::Problem problem;
@@ -704,7 +754,7 @@ least_squares_alignment(DP const& source_point_cloud, // Should not be modified
     Vector3 gcc_coord = get_cloud_gcc_coord(source_point_cloud, point_cloud_shift, i);
 
     ceres::CostFunction* cost_function =
-      PointToDemError::Create(gcc_coord, dem_ref, dem_georef);
+      PointToDemError::Create(gcc_coord, dem);
     ceres::LossFunction* loss_function = new ceres::CauchyLoss(0.5); // NULL;
     problem.AddResidualBlock(cost_function, loss_function, &transform[0], &scale);
     
@@ -725,7 +775,10 @@ least_squares_alignment(DP const& source_point_cloud, // Should not be modified
 
   // Solve the problem
   ceres::Solver::Summary summary;
-  ceres::Solve(options, &problem, &summary);
+  {
+    asp::TraceSpan span("ceres_solve", "solver");
+    ceres::Solve(options, &problem, &summary);
+  }
 
   vw_out() << summary.FullReport() << "\n" << std::endl;
 
@@ -813,8 +866,7 @@ double compute_registration_error(DP          const& ref_point_cloud,
                                   DP               & source_point_cloud, // Should not be modified
                                   PM::ICP          & pm_icp_object, // Must already be initialized
                                   vw::Vector3 const& shift,
-                                  vw::cartography::GeoReference        const& dem_georef,
-                                  vw::ImageViewRef< PixelMask<float> > const& dem_ref,
+                                  asp::TiledDem const& dem,
                                   Options const& opt,
                                   PointMatcher<RealT>::Matrix &error_matrix) {
   Stopwatch sw;
@@ -828,7 +880,7 @@ double compute_registration_error(DP          const& ref_point_cloud,
   if (opt.use_dem_distances()) {
     // Compute the distance from each point to the DEM
     std::vector<double> dem_errors;
-    calcErrorsWithDem(source_point_cloud, shift, dem_georef, dem_ref, dem_errors);
+    calcErrorsWithDem(source_point_cloud, shift, dem, dem_errors);
 
     // For each point use the lower of the two calculated errors.
     update_best_error(dem_errors, error_matrix);
@@ -847,8 +899,7 @@ void filter_source_cloud(DP          const& ref_point_cloud,
                          DP               & source_point_cloud,
                          PM::ICP          & pm_icp_object, // Must already be initialized
                          vw::Vector3 const& shift,
-                         vw::cartography::GeoReference        const& dem_georef,
-                         vw::ImageViewRef< PixelMask<float> > const& dem_ref,
+                         asp::TiledDem const& dem,
                          Options const& opt) {
 
   // Filter gross outliers
@@ -863,7 +914,7 @@ void filter_source_cloud(DP          const& ref_point_cloud,
     if (opt.use_dem_distances()) {
       // Compute the registration error using the best available means
       compute_registration_error(ref_point_cloud, source_point_cloud, pm_icp_object, shift,
-                                 dem_georef, dem_ref, opt, error_matrix);
+                                 dem, opt, error_matrix);
 
       filterPointsByError(source_point_cloud, error_matrix, opt.max_disp);
     } else { // LPM only method
@@ -908,10 +959,101 @@ std::string alignment_method_fallback(std::string const& alignment_method){
   return alignment_method;
 }
 
-// Hillshade the reference and source DEMs, and use them to find
-// interest point matches among the hillshaded images.  These will be
-// used later to find a rotation + translation + scale transform.
-std::string find_matches_from_hillshading(Options & opt, std::string const& curr_exec_path){
+// Find the value of the option with the given name, or its alias, in
+// a string of options meant for another program, such as "--azimuth 300".
+bool find_option_value(std::string const& options, std::string const& name,
+                       std::string const& alias, std::string & value) {
+  std::istringstream is(options);
+  std::string token;
+  while (is >> token) {
+    if (token == name || (alias != "" && token == alias))
+      return bool(is >> value);
+  }
+  return false;
+}
+
+// The size in meters of a DEM pixel in each direction, at the DEM center
+Vector2 dem_pixel_size(GeoReference const& geo, int cols, int rows) {
+  Vector2 pix(cols / 2, rows / 2);
+  Vector2 o  = geo.pixel_to_lonlat(pix);
+  Vector2 dx = geo.pixel_to_lonlat(pix + Vector2(1, 0));
+  Vector2 dy = geo.pixel_to_lonlat(pix + Vector2(0, 1));
+  Vector3 O  = geo.datum().geodetic_to_cartesian(Vector3(o[0],  o[1],  0));
+  Vector3 X  = geo.datum().geodetic_to_cartesian(Vector3(dx[0], dx[1], 0));
+  Vector3 Y  = geo.datum().geodetic_to_cartesian(Vector3(dy[0], dy[1], 0));
+  return Vector2(norm_2(X - O), norm_2(Y - O));
+}
+
+// Read a DEM averaged over blocks of factor x factor pixels, reading
+// one band of blocks at a time. A block with less than half of its
+// pixels valid is invalid, and stored as NaN.
+void read_reduced_dem(std::string const& dem_file, int factor, ImageView<float> & dem) {
+  DiskImageView<float> full(dem_file);
+  double nodata = -std::numeric_limits<double>::max();
+  vw::read_nodata_val(dem_file, nodata);
+
+  int cols = (full.cols() + factor - 1) / factor, rows = (full.rows() + factor - 1) / factor;
+  dem.set_size(cols, rows);
+  for (int row = 0; row < rows; row++) {
+    BBox2i box(0, row * factor, full.cols(), factor);
+    box.crop(bounding_box(full));
+    ImageView<float> band = crop(full, box);
+    for (int col = 0; col < cols; col++) {
+      double sum = 0.0;
+      int num_valid = 0, num_total = 0;
+      for (int r = 0; r < band.rows(); r++) {
+        for (int c = col * factor; c < std::min((col + 1) * factor, band.cols()); c++) {
+          num_total++;
+          float h = band(c, r);
+          if (h <= nodata || h != h)
+            continue;
+          sum += h;
+          num_valid++;
+        }
+      }
+      dem(col, row) = (2 * num_valid >= num_total && num_valid > 0) ?
+        sum / num_valid : std::numeric_limits<float>::quiet_NaN();
+    }
+  }
+}
+
+// Hillshade a north-up DEM with given pixel size in meters. The light
+// azimuth is measured clockwise from north. Pixels whose neighbors are
+// not all valid get the given nodata value.
+void hillshade_dem(ImageView<float> const& dem, Vector2 const& pixel_size,
+                   double azimuth, double elevation, float nodata,
+                   ImageView<float> & shade) {
+  double az = azimuth * M_PI / 180.0, el = elevation * M_PI / 180.0;
+  Vector3 light(sin(az) * cos(el), cos(az) * cos(el), sin(el));
+
+  shade.set_size(dem.cols(), dem.rows());
+  for (int row = 0; row < dem.rows(); row++) {
+    for (int col = 0; col < dem.cols(); col++) {
+      shade(col, row) = nodata;
+      if (col == 0 || row == 0 || col == dem.cols() - 1 || row == dem.rows() - 1)
+        continue;
+      double e = dem(col + 1, row), w = dem(col - 1, row);
+      double n = dem(col, row - 1), s = dem(col, row + 1);
+      if (e != e || w != w || n != n || s != s)
+        continue; // NaN
+      // The slope to the east and to the north, with rows going south
+      double gx = (e - w) / (2.0 * pixel_size[0]);
+      double gy = (n - s) / (2.0 * pixel_size[1]);
+      Vector3 normal(-gx, -gy, 1.0);
+      shade(col, row) = std::max(0.0, dot_prod(normal, light) / norm_2(normal));
+    }
+  }
+}
+
+// Hillshade the reference and source DEMs in memory, at a reduced
+// resolution, and find interest point matches among the hillshaded
+// images. These will be used later to find a rotation + translation +
+// scale transform. The matches are in the pixels of the full DEMs,
+// and are also saved, so they can be inspected and passed back with
+// --match-file.
+void find_matches_from_hillshading(Options const& opt,
+                                   std::vector<vw::ip::InterestPoint> & ref_ip,
+                                   std::vector<vw::ip::InterestPoint> & source_ip) {
 
   // First, this works only for DEMs
   if (asp::get_cloud_type(opt.reference) != "DEM" ||
@@ -921,55 +1063,89 @@ std::string find_matches_from_hillshading(Options & opt, std::string const& curr
               << "DEMs from the input point clouds. Then this transform can be used "
               << "with the original clouds.\n" );
 
-  // Find the needed executables
-  std::string hillshade_path = vw::program_path("hillshade", curr_exec_path);
-  std::string ipfind_path    = vw::program_path("ipfind",    curr_exec_path);
-  std::string ipmatch_path   = vw::program_path("ipmatch",   curr_exec_path);
-
-  // Hillshade the reference
-  std::string ref_hillshade = opt.out_prefix + "-reference_hillshade.tif";
-  std::string cmd = hillshade_path + " " + opt.hillshade_options + " "
-    + opt.reference + " -o " + ref_hillshade;
-  vw_out() << cmd << std::endl;
-  std::string ans = vw::exec_cmd(cmd.c_str());
-  vw_out() << ans << std::endl;
-  
-  // Hillshade the source
-  std::string source_hillshade = opt.out_prefix + "-source_hillshade.tif";
-  cmd = hillshade_path + " " + opt.hillshade_options + " "
-    + opt.source + " -o " + source_hillshade;
-  vw_out() << cmd << std::endl;
-  ans = vw::exec_cmd(cmd.c_str());
-  vw_out() << ans << std::endl;
-
-  // IP find
-  cmd = ipfind_path + " " + opt.ipfind_options + " " + ref_hillshade + " " + source_hillshade;
-  vw_out() << cmd << std::endl;
-  ans = vw::exec_cmd(cmd.c_str());
-  vw_out() << ans << std::endl;
-
-  // IP match
-  std::string ref_ip    = fs::path(ref_hillshade).replace_extension(".vwip").string();
-  std::string source_ip = fs::path(source_hillshade).replace_extension(".vwip").string();
-
-  cmd = ipmatch_path + " " + opt.ipmatch_options + " "
-    + ref_hillshade + " " + ref_ip + " " + source_hillshade + " " + source_ip + " -o "
-    + opt.out_prefix;
-  vw_out() << cmd << std::endl;
-  ans = vw::exec_cmd(cmd.c_str());
-  vw_out() << ans << std::endl;
-
-  // The name of the file where the matches are written to
-  std::string match_file = vw::ip::match_filename(opt.out_prefix, ref_hillshade, source_hillshade);
-  
-  return match_file;
+  std::string dem_files[2] = {opt.reference, opt.source};
+  GeoReference geos[2];
+  Vector2i dims[2];
+  Vector2 pixel_sizes[2];
+  for (int i = 0; i < 2; i++) {
+    if (!vw::cartography::read_georeference(geos[i], dem_files[i]))
+      vw_throw( ArgumentErr() << "The DEM " << dem_files[i] << " has no georeference.\n");
+    DiskImageView<float> dem(dem_files[i]);
+    dims[i] = Vector2i(dem.cols(), dem.rows());
+    pixel_sizes[i] = dem_pixel_size(geos[i], dem.cols(), dem.rows());
+  }
+
+  // Make both images have the same ground resolution, that of the DEM
+  // which must be reduced the most to fit in the maximum size.
+  double gsd = 0.0;
+  for (int i = 0; i < 2; i++) {
+    int factor = (std::max(dims[i][0], dims[i][1]) + opt.hillshade_max_size - 1)
+      / opt.hillshade_max_size;
+    gsd = std::max(gsd, factor * std::max(pixel_sizes[i][0], pixel_sizes[i][1]));
+  }
+
+  double azimuth = 300, elevation = 20;
+  std::string val;
+  if (find_option_value(opt.hillshade_options, "--azimuth", "-a", val))
+    azimuth = atof(val.c_str());
+  if (find_option_value(opt.hillshade_options, "--elevation", "-e", val))
+    elevation = atof(val.c_str());
+
+  const float nodata = -1.0; // hillshade values are in [0, 1]
+  ImageView<float> shades[2];
+  int factors[2];
+  for (int i = 0; i < 2; i++) {
+    double size = std::max(pixel_sizes[i][0], pixel_sizes[i][1]);
+    factors[i] = std::max(1, int(round(gsd / std::max(size, 1e-16))));
+    factors[i] = std::min(factors[i], std::max(dims[i][0], dims[i][1]));
+    vw_out() << "Hillshading " << dem_files[i] << " at 1/" << factors[i]
+             << " of its resolution.\n";
+    ImageView<float> dem;
+    read_reduced_dem(dem_files[i], factors[i], dem);
+    hillshade_dem(dem, pixel_sizes[i] * factors[i], azimuth, elevation, nodata, shades[i]);
+  }
+
+  // Use ip per image rather than ip per tile, as ipfind did
+  int ip_per_tile = 0;
+  if (find_option_value(opt.ipfind_options, "--ip-per-image", "", val))
+    asp::stereo_settings().ip_per_image = atoi(val.c_str());
+  if (find_option_value(opt.ipfind_options, "--interest-operator", "", val)) {
+    boost::to_lower(val);
+    if (val == "sift")
+      asp::stereo_settings().ip_matching_method = asp::DETECT_IP_METHOD_SIFT;
+    else if (val == "orb")
+      asp::stereo_settings().ip_matching_method = asp::DETECT_IP_METHOD_ORB;
+    else
+      asp::stereo_settings().ip_matching_method = asp::DETECT_IP_METHOD_INTEGRAL;
+  }
+
+  asp::detect_match_ip(ref_ip, source_ip, shades[0], shades[1], ip_per_tile,
+                       "", "", // Do not read ip from disk
+                       nodata, nodata);
+
+  // Go back to the pixels of the full DEMs, from the center of each block
+  std::vector<vw::ip::InterestPoint> * ips[2] = {&ref_ip, &source_ip};
+  for (int i = 0; i < 2; i++) {
+    for (size_t j = 0; j < ips[i]->size(); j++) {
+      vw::ip::InterestPoint & ip = (*ips[i])[j];
+      ip.x  = (ip.x + 0.5) * factors[i] - 0.5;
+      ip.y  = (ip.y + 0.5) * factors[i] - 0.5;
+      ip.ix = round(ip.x);
+      ip.iy = round(ip.y);
+    }
+  }
+
+  std::string match_file = vw::ip::match_filename(opt.out_prefix, opt.reference, opt.source);
+  vw_out() << "Writing: " << match_file << std::endl;
+  vw::ip::write_binary_match_file(match_file, ref_ip, source_ip);
 }
 
 // Compute an initial source to reference transform based on tie points (interest point matches).
 PointMatcher<RealT>::Matrix
 initial_transform_from_match_file(std::string const& ref_file,
                                   std::string const& source_file,
-                                  std::string const& match_file,
+                                  std::vector<vw::ip::InterestPoint> const& ref_ip,
+                                  std::vector<vw::ip::InterestPoint> const& source_ip,
                                   std::string const& hillshading_transform,
                                   Vector2 initial_transform_ransac_params){
   
@@ -977,10 +1153,6 @@ initial_transform_from_match_file(std::string const& ref_file,
       asp::get_cloud_type(source_file) != "DEM" )
     vw_throw( ArgumentErr() << "The alignment transform computation based on manually chosen point matches only works for DEMs. Use point2dem to first create DEMs from the input point clouds.\n" );
 
-  vector<vw::ip::InterestPoint> ref_ip, source_ip;
-  vw_out() << "Reading match file: " << match_file << "\n";
-  vw::ip::read_binary_match_file(match_file, ref_ip, source_ip);
-
   DiskImageView<float> ref(ref_file);
   vw::cartography::GeoReference ref_geo;
   bool has_ref_geo = vw::cartography::read_georeference(ref_geo, ref_file);
@@ -1065,6 +1237,21 @@ initial_transform_from_match_file(std::string const& ref_file,
   return globalT;
 }
 
+// The same, with the matches read from a file
+PointMatcher<RealT>::Matrix
+initial_transform_from_match_file(std::string const& ref_file,
+                                  std::string const& source_file,
+                                  std::string const& match_file,
+                                  std::string const& hillshading_transform,
+                                  Vector2 initial_transform_ransac_params){
+  vector<vw::ip::InterestPoint> ref_ip, source_ip;
+  vw_out() << "Reading match file: " << match_file << "\n";
+  vw::ip::read_binary_match_file(match_file, ref_ip, source_ip);
+  return initial_transform_from_match_file(ref_file, source_file, ref_ip, source_ip,
+                                           hillshading_transform,
+                                           initial_transform_ransac_params);
+}
+
 void apply_transform_to_cloud(PointMatcher<RealT>::Matrix const& T, DP & point_cloud){
   for (int col = 0; col < point_cloud.features.cols(); col++) {
     point_cloud.features.col(col) = T*point_cloud.features.col(col);
@@ -1162,6 +1349,243 @@ void adjust_and_intersect_ref_source_boxes(BBox2 & ref_box, BBox2 & source_box,
   adjust_lonlat_bbox(source, source_box);
 }
 
+/// Load a source cloud, align it to the reference, whose tree was
+/// built, and save the transform, errors, and any transformed clouds,
+/// with the output prefix in opt. The reference is only read.
+void align_source(Options const& opt, GeoReference const& geo, CsvConv const& csv_conv,
+                  BBox2 const& source_box, Vector3 shift,
+                  PointMatcher<RealT>::Matrix const& initT,
+                  DP const& ref_point_cloud, PM::ICP & icp,
+                  asp::TiledDem const& reference_dem) {
+
+  // Load the subsampled source point cloud. If the user wants
+  // to filter gross outliers in the source points based on
+  // max_disp, load a lot more points than asked, filter based on
+  // max_disp, then resample to the number desired by the user.
+  int num_source_pts = opt.max_num_source_points;
+  if (opt.max_disp > 0.0)
+    num_source_pts = max(num_source_pts, 50000000);
+  bool   calc_shift = false; // Use the same shift used for the reference point cloud
+  bool   is_lola_rdr_format = false;   // may get overwritten
+  double mean_source_longitude = 0.0;  // may get overwritten
+  Stopwatch sw2;
+  sw2.start();
+  DP source_point_cloud;
+  load_cloud(opt.source, num_source_pts, source_box, 
+             calc_shift, shift, geo, csv_conv, is_lola_rdr_format,
+             mean_source_longitude, opt.verbose, source_point_cloud);
+  sw2.stop();
+  if (opt.verbose)
+    vw_out() << "Loading the source point cloud took "
+             << sw2.elapsed_seconds() << " [s]" << endl;
+
+  double elapsed_time;
+
+  // Apply the initial guess transform to the source point cloud.
+  apply_transform_to_cloud(initT, source_point_cloud);
+  
+  PointMatcher<RealT>::Matrix beg_errors;
+  if (opt.max_disp > 0.0){
+    // Filter gross outliers
+    filter_source_cloud(ref_point_cloud, source_point_cloud, icp,
+                        shift, reference_dem, opt);
+  }
+  
+  random_pc_subsample(opt.max_num_source_points, source_point_cloud.features);
+  vw_out() << "Reducing number of source points to "
+           << source_point_cloud.features.cols() << endl;
+
+  // Write the point cloud to disk for debugging
+  //debug_save_point_cloud(ref_point_cloud, geo, shift, "ref.csv");
+  //dump_bin("ref.bin", ref_point_cloud);
+
+  // Make the libpointmatcher error message clearer
+  std::string libpointmatcher_error = "no point to minimize";
+  std::string pc_align_error = std::string
+    ("This likely means that the clouds are too far. Consider increasing the "
+     "--max-displacement value to something somewhat larger than the expected "
+     "length of the displacement that may be needed to align the clouds.\n");
+  
+  try {
+    elapsed_time = compute_registration_error(ref_point_cloud, source_point_cloud, icp,
+                                              shift, reference_dem,
+                                              opt, beg_errors);
+  } catch(std::exception const& e) {
+    std::string error = e.what();
+    if (error.find(libpointmatcher_error) != std::string::npos)
+      error += ".\n" + pc_align_error; // clarify the error
+    vw_throw(ArgumentErr() << error);
+  }
+  
+  calc_stats("Input", beg_errors);
+  if (opt.verbose)
+    vw_out() << "Initial error computation took " << elapsed_time << " [s]" << endl;
+
+  // Compute the transformation to align the source to reference.
+  Stopwatch sw4;
+  sw4.start();
+  PointMatcher<RealT>::Matrix Id = PointMatcher<RealT>::Matrix::Identity(DIM + 1, DIM + 1);
+  if (opt.config_file == ""){
+    // Read the options from the command line
+    icp.setParams(opt.out_prefix, opt.num_iter, opt.outlier_ratio,
+                  (2.0*M_PI/360.0)*opt.diff_rotation_err, // convert to radians
+                  opt.diff_translation_err, alignment_method_fallback(opt.alignment_method),
+                  false/*opt.verbose*/);
+  }else{
+    vw_out() << "Will read the options from: " << opt.config_file << endl;
+    ifstream ifs(opt.config_file.c_str());
+    if (!ifs.good())
+      vw_throw( ArgumentErr() << "Cannot open configuration file: "
+                << opt.config_file << "\n" );
+    icp.loadFromYaml(ifs);
+  }
+
+  // We bypass calling ICP if the user explicitely asks for 0 iterations.
+  PointMatcher<RealT>::Matrix T = Id;
+  if (opt.num_iter > 0){
+    if (opt.alignment_method == "fgr") {
+      T = fgr_alignment(source_point_cloud, ref_point_cloud, opt);
+    } else if (opt.alignment_method == "point-to-plane" ||
+               opt.alignment_method == "point-to-point" ||
+               opt.alignment_method == "similarity-point-to-point" ||
+               opt.alignment_method == "similarity-point-to-plane") {
+      // Use libpointmatcher
+      try {
+        T = icp(source_point_cloud, ref_point_cloud, Id, opt.compute_translation_only);
+      } catch(std::exception const& e) {
+        std::string error = e.what();
+        if (error.find(libpointmatcher_error) != std::string::npos)
+          error += ".\n" + pc_align_error; // clarify the error
+        vw_throw(ArgumentErr() << error);
+      }
+      
+      vw_out() << "Match ratio: "
+		 << icp.errorMinimizer->getWeightedPointUsedRatio() << endl;
+    }else if (opt.alignment_method == "least-squares" ||
+              opt.alignment_method == "similarity-least-squares"){
+      /// Compute alignment using least squares
+	T = least_squares_alignment(source_point_cloud, shift,
+				    reference_dem, opt);
+    }else
+      vw_throw( ArgumentErr() << "Unknown alignment method: " << opt.alignment_method);
+  }
+  sw4.stop();
+  if (opt.verbose)
+    vw_out() << "Alignment took " << sw4.elapsed_seconds() << " [s]" << endl;
+
+  // Transform the source to make it close to reference.
+  DP trans_source_point_cloud(source_point_cloud);
+  apply_transform_to_cloud(T, trans_source_point_cloud);
+
+  // Calculate by how much points move as result of T
+  double max_obtained_disp = calc_max_displacment(source_point_cloud, trans_source_point_cloud);
+  Vector3 source_ctr_vec, source_ctr_llh;
+  Vector3 trans_xyz, trans_ned, trans_llh;
+  vw::Matrix3x3 NED2ECEF;
+  calc_translation_vec(initT, source_point_cloud, trans_source_point_cloud, shift,
+			 geo.datum(), source_ctr_vec, source_ctr_llh,
+                       trans_xyz, trans_ned, trans_llh, NED2ECEF);
+
+  // For each point, compute the distance to the nearest reference point.
+  PointMatcher<RealT>::Matrix end_errors;
+  elapsed_time = compute_registration_error(ref_point_cloud, trans_source_point_cloud, icp,
+                                            shift, reference_dem, opt,
+					      end_errors);
+  calc_stats("Output", end_errors);
+  if (opt.verbose)
+    vw_out() << "Final error computation took " << elapsed_time << " [s]" << endl;
+
+  // We must apply to T the initial guess transform
+  PointMatcher<RealT>::Matrix combinedT = T*initT;
+
+  // Go back to the original coordinate system, undoing the shift
+  PointMatcher<RealT>::Matrix globalT = apply_shift(combinedT, -shift);
+
+  // Print statistics
+  vw_out() << std::setprecision(16)
+           << "Alignment transform (origin is planet center):" << endl << globalT << endl;
+  vw_out() << std::setprecision(8); // undo the higher precision
+
+  vw_out() << "Centroid of source points (Cartesian, meters): " << source_ctr_vec << std::endl;
+  // Swap lat and lon, as we want to print lat first
+  std::swap(source_ctr_llh[0], source_ctr_llh[1]);
+  vw_out() << "Centroid of source points (lat,lon,z): " << source_ctr_llh << std::endl;
+  vw_out() << std::endl;
+
+  vw_out() << "Translation vector (Cartesian, meters): " << trans_xyz << std::endl;
+  vw_out() << "Translation vector (North-East-Down, meters): "
+           << trans_ned << std::endl;
+  vw_out() << "Translation vector magnitude (meters): " << norm_2(trans_xyz)
+           << std::endl;
+  vw::vw_out() << "Maximum displacement of points between the source "
+               << "cloud with any initial transform applied to it and the "
+               << "source cloud after alignment to the reference: " 
+               << max_obtained_disp << " m" << std::endl;
+  if (opt.max_disp > 0 && opt.max_disp < max_obtained_disp) {
+    vw_out() << "Warning: The input --max-displacement value is smaller than the "
+             << "final observed displacement. It may be advised to increase the former "
+             << "and rerun the tool.\n";
+  }
+
+  // Swap lat and lon, as we want to print lat first
+  std::swap(trans_llh[0], trans_llh[1]);
+  vw_out() << "Translation vector (lat,lon,z): " << trans_llh << std::endl;
+  vw_out() << std::endl;
+
+  Matrix3x3 rot;
+  for (int r = 0; r < DIM; r++)
+    for (int c = 0; c < DIM; c++)
+      rot(r, c) = globalT(r, c);
+
+  double scale = pow(det(rot), 1.0/3.0);
+  for (int r = 0; r < DIM; r++)
+    for (int c = 0; c < DIM; c++)
+      rot(r, c) /= scale;
+
+  // Subtract one before printing the scale, to see a lot of digits of precision
+  vw_out() << "Transform scale - 1 = " << (scale-1.0) << std::endl;
+  
+  Matrix3x3 rot_NED = inverse(NED2ECEF) * rot * NED2ECEF;
+ 
+  Vector3 euler_angles = math::rotation_matrix_to_euler_xyz(rot) * 180/M_PI;
+  Vector3 euler_angles_NED = math::rotation_matrix_to_euler_xyz(rot_NED) * 180/M_PI;
+  Vector3 axis_angles = math::matrix_to_axis_angle(rot) * 180/M_PI;
+  vw_out() << "Euler angles (degrees): " << euler_angles  << endl;
+  vw_out() << "Euler angles (North-East-Down, degrees): " << euler_angles_NED  << endl;
+  vw_out() << "Axis of rotation and angle (degrees): "
+           << axis_angles/norm_2(axis_angles) << ' '
+           << norm_2(axis_angles) << endl;
+
+  
+  Stopwatch sw5;
+  sw5.start();
+  write_transforms(opt, globalT);
+
+  if (opt.save_trans_ref){
+    string trans_ref_prefix = opt.out_prefix + "-trans_reference";
+    save_trans_point_cloud(opt, opt.reference, trans_ref_prefix,
+                           geo, csv_conv, globalT.inverse());
+  }
+
+  if (opt.save_trans_source){
+    string trans_source_prefix = opt.out_prefix + "-trans_source";
+    save_trans_point_cloud(opt, opt.source, trans_source_prefix,
+                           geo, csv_conv, globalT);
+  }
+
+  save_errors(source_point_cloud, beg_errors,  opt.out_prefix + "-beg_errors.csv",
+              shift, geo, csv_conv, is_lola_rdr_format, mean_source_longitude);
+  save_errors(trans_source_point_cloud, end_errors,  opt.out_prefix + "-end_errors.csv",
+              shift, geo, csv_conv, is_lola_rdr_format, mean_source_longitude);
+
+  if (opt.verbose) vw_out() << "Writing: " << opt.out_prefix
+    + "-iterationInfo.csv" << std::endl;
+
+  sw5.stop();
+  if (opt.verbose) vw_out() << "Saving to disk took "
+                            << sw5.elapsed_seconds() << " [s]" << endl;
+}
+
 int main( int argc, char *argv[] ) {
 
   // Mandatory line for Eigen
@@ -1186,18 +1610,21 @@ int main( int argc, char *argv[] ) {
     GeoReference geo;
     std::vector<std::string> clouds;
     clouds.push_back(opt.reference);
-    clouds.push_back(opt.source);
+    clouds.insert(clouds.end(), opt.sources.begin(), opt.sources.end());
     read_georef(clouds, opt.datum, opt.csv_proj4_str,  
                 opt.semi_major_axis, opt.semi_minor_axis,  
                 opt.csv_format_str,  csv_conv, geo);
 
-    // Use hillshading to create a match file
-    if (opt.hillshading_transform != "" && opt.match_file == "")
-      opt.match_file = find_matches_from_hillshading(opt, argv[0]);
-    
-    // Create a transform based on a match file, either automatically generated, or
-    // user-made (normally with stereo_gui).
-    if (opt.match_file != "") {
+    // Create a transform based on matches among hillshaded DEMs, or from
+    // a user-made match file (normally with stereo_gui).
+    if (opt.hillshading_transform != "" && opt.match_file == "") {
+      std::vector<vw::ip::InterestPoint> ref_ip, source_ip;
+      find_matches_from_hillshading(opt, ref_ip, source_ip);
+      opt.init_transform = initial_transform_from_match_file(opt.reference, opt.source,
+                                                             ref_ip, source_ip,
+                                                             opt.hillshading_transform,
+                                                             opt.initial_transform_ransac_params);
+    } else if (opt.match_file != "") {
       if (opt.hillshading_transform == "") 
         opt.hillshading_transform = "similarity";
       opt.init_transform = initial_transform_from_match_file(opt.reference, opt.source,
@@ -1244,94 +1671,148 @@ int main( int argc, char *argv[] ) {
     vw_out() << "Computing the intersection of the bounding boxes "
              << "of the reference and source points using " 
              << num_sample_pts << " sample points.\n";
-    BBox2 ref_box, source_box, trans_ref_box, trans_source_box;
+    BBox2 ref_box, trans_ref_box;
+
+    // The reference points, and the shift which brings them near the
+    // origin. With a cache, the whole reference is sampled once, and
+    // its box is found from that sample.
+    Vector3 shift;
+    bool   calc_shift = true; // Shift points so the first point is (0,0,0)
+    bool   is_lola_rdr_format = false;   // may get overwritten
+    double mean_ref_longitude    = 0.0;  // may get overwritten
+    DP ref_point_cloud;
+    bool use_cache = !opt.reference_cache.empty();
+    if (use_cache) {
+      Stopwatch sw_cache;
+      sw_cache.start();
+      if (read_reference_cache(opt.reference_cache, opt.reference,
+                               opt.max_num_reference_points, geo.datum(), shift,
+                               is_lola_rdr_format, mean_ref_longitude, ref_point_cloud)) {
+        vw_out() << "Read " << ref_point_cloud.features.cols()
+                 << " reference points from: " << opt.reference_cache << "\n";
+      } else {
+        BBox2 whole_box;
+        load_cloud(opt.reference, opt.max_num_reference_points, whole_box,
+                   calc_shift, shift, geo, csv_conv, is_lola_rdr_format,
+                   mean_ref_longitude, opt.verbose, ref_point_cloud);
+        write_reference_cache(opt.reference_cache, opt.reference,
+                              opt.max_num_reference_points, geo.datum(), shift,
+                              is_lola_rdr_format, mean_ref_longitude, ref_point_cloud);
+        vw_out() << "Wrote the reference cache: " << opt.reference_cache << "\n";
+      }
+      sw_cache.stop();
+      if (opt.verbose)
+        vw_out() << "Preparing the reference cache took "
+                 << sw_cache.elapsed_seconds() << " [s]" << endl;
+    }
 
     PointMatcher<RealT>::Matrix inv_init_trans = opt.init_transform.inverse();
-    calc_extended_lonlat_bbox(geo, num_sample_pts, csv_conv,
-                              opt.reference, opt.max_disp, inv_init_trans,
-                              ref_box, trans_ref_box);
-    calc_extended_lonlat_bbox(geo, num_sample_pts, csv_conv,
-                              opt.source, opt.max_disp, opt.init_transform,
-                              source_box, trans_source_box);
-
-    // When boxes are huge, it is hard to do the optimization of intersecting
-    // them, as they may differ not by 0 or 360, but by 180. Better do nothing
-    // in that case. The solution may degrade a bit, as we may load points
-    // not in the intersection of the boxes, but at least it won't be wrong.
-    // In this case, there is a chance the boxes were computed wrong anyway.
-    if (ref_box.width() > 180.0 || source_box.width() > 180.0) {
-      vw_out() << "Warning: Your input point clouds are spread over more than half the planet. "
-               << "It is suggested that they be cropped, to get more accurate results. "
-               << "Giving up on estimating their bounding boxes and filtering outliers "
-               << "based on them.\n";
-      ref_box = BBox2();
-      source_box = BBox2();
+    if (use_cache) {
+      // Every few cached points, not shifted
+      std::int64_t num_cached = ref_point_cloud.features.cols();
+      std::int64_t step = std::max(std::int64_t(1),
+                                   (num_cached + num_sample_pts - 1) / num_sample_pts);
+      DP sample;
+      sample.featureLabels = form_labels<RealT>(DIM);
+      sample.features.resize(DIM + 1, (num_cached + step - 1) / step);
+      for (std::int64_t col = 0; col < sample.features.cols(); col++) {
+        sample.features.col(col) = ref_point_cloud.features.col(col * step);
+        for (int row = 0; row < DIM; row++)
+          sample.features(row, col) += shift[row];
+      }
+      calc_extended_lonlat_bbox(geo, sample, mean_ref_longitude, opt.max_disp,
+                                inv_init_trans, ref_box, trans_ref_box);
+    } else {
+      calc_extended_lonlat_bbox(geo, num_sample_pts, csv_conv,
+                                opt.reference, opt.max_disp, inv_init_trans,
+                                ref_box, trans_ref_box);
     }
-    
-    vw_out() << "Reference box: " << ref_box << std::endl;
-    vw_out() << "Source box:    " << source_box << std::endl;
-    
-    if (!ref_box.empty() && !source_box.empty()) {
-      adjust_and_intersect_ref_source_boxes(ref_box, trans_source_box, opt.reference, opt.source);
-      adjust_and_intersect_ref_source_boxes(trans_ref_box, source_box, opt.reference, opt.source);
+    // Intersect the box of each source with the one of the reference. The
+    // reference is loaded once, in the union of the intersections.
+    std::vector<BBox2> source_boxes(opt.sources.size());
+    BBox2 ref_load_box;
+    bool load_whole_ref = false;
+    for (size_t i = 0; i < opt.sources.size(); i++) {
+      BBox2 curr_ref_box = ref_box, curr_trans_ref_box = trans_ref_box;
+      BBox2 source_box, trans_source_box;
+      calc_extended_lonlat_bbox(geo, num_sample_pts, csv_conv,
+                                opt.sources[i], opt.max_disp, opt.init_transform,
+                                source_box, trans_source_box);
+
+      // When boxes are huge, it is hard to do the optimization of intersecting
+      // them, as they may differ not by 0 or 360, but by 180. Better do nothing
+      // in that case. The solution may degrade a bit, as we may load points
+      // not in the intersection of the boxes, but at least it won't be wrong.
+      // In this case, there is a chance the boxes were computed wrong anyway.
+      if (curr_ref_box.width() > 180.0 || source_box.width() > 180.0) {
+        vw_out() << "Warning: Your input point clouds are spread over more than half the planet. "
+                 << "It is suggested that they be cropped, to get more accurate results. "
+                 << "Giving up on estimating their bounding boxes and filtering outliers "
+                 << "based on them.\n";
+        curr_ref_box = BBox2();
+        source_box = BBox2();
+      }
+
+      if (opt.sources.size() > 1)
+        vw_out() << "Source: " << opt.sources[i] << std::endl;
+      vw_out() << "Reference box: " << curr_ref_box << std::endl;
+      vw_out() << "Source box:    " << source_box << std::endl;
+
+      if (!curr_ref_box.empty() && !source_box.empty()) {
+        adjust_and_intersect_ref_source_boxes(curr_ref_box, trans_source_box,
+                                              opt.reference, opt.sources[i]);
+        adjust_and_intersect_ref_source_boxes(curr_trans_ref_box, source_box,
+                                              opt.reference, opt.sources[i]);
+      }
+
+      vw_out() << "Intersection reference box:  " << curr_ref_box << std::endl;
+      vw_out() << "Intersection source    box:  " << source_box   << std::endl;
+
+      source_boxes[i] = source_box;
+      if (curr_ref_box.empty())
+        load_whole_ref = true;
+      else
+        ref_load_box.grow(curr_ref_box);
     }
-    
-    vw_out() << "Intersection reference box:  " << ref_box    << std::endl;
-    vw_out() << "Intersection source    box:  " << source_box << std::endl;
-    
+    if (load_whole_ref || ref_load_box.width() > 180.0)
+      ref_load_box = BBox2();
+    if (opt.sources.size() > 1)
+      vw_out() << "Reference box for all sources: " << ref_load_box << std::endl;
+
     sw0.stop();
     vw_out() << "Intersection of bounding boxes took " << sw0.elapsed_seconds() << " [s]" << endl;
 
-    // Load the point clouds. We will shift both point clouds by the
-    // centroid of the first one to bring them closer to origin.
-
-    // Load the subsampled reference point cloud.
-    Vector3 shift;
-    bool   calc_shift = true; // Shift points so the first point is (0,0,0)
-    bool   is_lola_rdr_format = false;   // may get overwritten
-    double mean_ref_longitude    = 0.0;  // may get overwritten
-    double mean_source_longitude = 0.0;  // may get overwritten
+    // Load the subsampled reference point cloud, or crop the cached one.
     Stopwatch sw1;
     sw1.start();
-    DP ref_point_cloud;
-    load_cloud(opt.reference, opt.max_num_reference_points, ref_box,
-               calc_shift, shift, geo, csv_conv, is_lola_rdr_format,
-               mean_ref_longitude, opt.verbose, ref_point_cloud);
+    if (use_cache) {
+      crop_to_lonlat_box(geo.datum(), shift, ref_load_box, ref_point_cloud);
+      if (ref_point_cloud.features.cols() == 0)
+        vw_throw(ArgumentErr() << "No cached reference points are in the box: "
+                 << ref_load_box << ".\n");
+      if (opt.verbose)
+        vw_out() << "Reference points in the box: "
+                 << ref_point_cloud.features.cols() << std::endl;
+    } else {
+      load_cloud(opt.reference, opt.max_num_reference_points, ref_load_box,
+                 calc_shift, shift, geo, csv_conv, is_lola_rdr_format,
+                 mean_ref_longitude, opt.verbose, ref_point_cloud);
+    }
     sw1.stop();
     if (opt.verbose)
       vw_out() << "Loading the reference point cloud took "
                << sw1.elapsed_seconds() << " [s]" << endl;
     //ref_point_cloud.save(outputBaseFile + "_ref.vtk");
 
-    // Load the subsampled source point cloud. If the user wants
-    // to filter gross outliers in the source points based on
-    // max_disp, load a lot more points than asked, filter based on
-    // max_disp, then resample to the number desired by the user.
-    int num_source_pts = opt.max_num_source_points;
-    if (opt.max_disp > 0.0)
-      num_source_pts = max(num_source_pts, 50000000);
-    calc_shift = false; // Use the same shift used for the reference point cloud
-    Stopwatch sw2;
-    sw2.start();
-    DP source_point_cloud;
-    load_cloud(opt.source, num_source_pts, source_box, 
-	      calc_shift, shift, geo, csv_conv, is_lola_rdr_format,
-	      mean_source_longitude, opt.verbose, source_point_cloud);
-    sw2.stop();
-    if (opt.verbose)
-      vw_out() << "Loading the source point cloud took "
-               << sw2.elapsed_seconds() << " [s]" << endl;
-
     // So far we shifted by first point in reference point cloud to reduce
-    // the magnitude of all loaded points. Now that we have loaded all
-    // points, shift one more time, to place the centroid of the
-    // reference at the origin.
+    // the magnitude of all loaded points. Shift one more time, to place
+    // the centroid of the reference at the origin. The sources are loaded
+    // later, with this shift.
     // Note: If this code is ever converting to using floats,
     // the operation below needs to be re-implemented to be accurate.
     int numRefPts = ref_point_cloud.features.cols();
     Eigen::VectorXd meanRef = ref_point_cloud.features.rowwise().sum() / numRefPts;
-    ref_point_cloud.features.topRows(DIM).colwise()    -= meanRef.head(DIM);
-    source_point_cloud.features.topRows(DIM).colwise() -= meanRef.head(DIM);
+    ref_point_cloud.features.topRows(DIM).colwise() -= meanRef.head(DIM);
     for (int row = 0; row < DIM; row++)
       shift[row] += meanRef(row); // Update the shift variable as well as the points
     if (opt.verbose)
@@ -1341,20 +1822,14 @@ int main( int argc, char *argv[] ) {
     PointMatcher<RealT>::Matrix initT = apply_shift(opt.init_transform, shift);
 
     // If the reference point cloud came from a DEM, also load the data in DEM format.
-    cartography::GeoReference dem_georef;
-    vw::ImageViewRef< PixelMask<float> > reference_dem_ref;
+    // Its tiles are read as the source points need them.
+    asp::TiledDem reference_dem;
     if (opt.use_dem_distances()) {
       vw_out() << "Loading reference as DEM." << endl;
-      // Load the dem, then wrap it inside an ImageViewRef object.
-      // - This is done because the actual DEM type cannot be created without being initialized.
-      InterpolationReadyDem reference_dem(load_interpolation_ready_dem(opt.reference, dem_georef));
-      reference_dem_ref.reset(reference_dem);
+      reference_dem.load(opt.reference);
     }
 
-    // Now all of the input data is loaded.
-
     // Filter the reference and initialize the reference tree
-    double elapsed_time;
     PM::ICP icp; // LibpointMatcher object
 
     Stopwatch sw3;
@@ -1367,210 +1842,35 @@ int main( int argc, char *argv[] ) {
     if (opt.verbose)
       vw_out() << "Reference point cloud processing took " << sw3.elapsed_seconds() << " [s]\n";
 
-    // Apply the initial guess transform to the source point cloud.
-    apply_transform_to_cloud(initT, source_point_cloud);
-    
-    PointMatcher<RealT>::Matrix beg_errors;
-    if (opt.max_disp > 0.0){
-      // Filter gross outliers
-      filter_source_cloud(ref_point_cloud, source_point_cloud, icp,
-                          shift, dem_georef, reference_dem_ref, opt);
-    }
-    
-    random_pc_subsample(opt.max_num_source_points, source_point_cloud.features);
-    vw_out() << "Reducing number of source points to "
-             << source_point_cloud.features.cols() << endl;
-
-    // Write the point cloud to disk for debugging
-    //debug_save_point_cloud(ref_point_cloud, geo, shift, "ref.csv");
-    //dump_bin("ref.bin", ref_point_cloud);
-
-    // Make the libpointmatcher error message clearer
-    std::string libpointmatcher_error = "no point to minimize";
-    std::string pc_align_error = std::string
-      ("This likely means that the clouds are too far. Consider increasing the "
-       "--max-displacement value to something somewhat larger than the expected "
-       "length of the displacement that may be needed to align the clouds.\n");
-    
-    try {
-      elapsed_time = compute_registration_error(ref_point_cloud, source_point_cloud, icp,
-                                                shift, dem_georef, reference_dem_ref,
-                                                opt, beg_errors);
-    } catch(std::exception const& e) {
-      std::string error = e.what();
-      if (error.find(libpointmatcher_error) != std::string::npos)
-        error += ".\n" + pc_align_error; // clarify the error
-      vw_throw(ArgumentErr() << error);
-    }
-    
-    calc_stats("Input", beg_errors);
-    if (opt.verbose)
-      vw_out() << "Initial error computation took " << elapsed_time << " [s]" << endl;
-
-    // Compute the transformation to align the source to reference.
-    Stopwatch sw4;
-    sw4.start();
-    PointMatcher<RealT>::Matrix Id = PointMatcher<RealT>::Matrix::Identity(DIM + 1, DIM + 1);
-    if (opt.config_file == ""){
-      // Read the options from the command line
-      icp.setParams(opt.out_prefix, opt.num_iter, opt.outlier_ratio,
-                    (2.0*M_PI/360.0)*opt.diff_rotation_err, // convert to radians
-                    opt.diff_translation_err, alignment_method_fallback(opt.alignment_method),
-                    false/*opt.verbose*/);
-    }else{
-      vw_out() << "Will read the options from: " << opt.config_file << endl;
-      ifstream ifs(opt.config_file.c_str());
-      if (!ifs.good())
-        vw_throw( ArgumentErr() << "Cannot open configuration file: "
-                  << opt.config_file << "\n" );
-      icp.loadFromYaml(ifs);
-    }
-
-    // We bypass calling ICP if the user explicitely asks for 0 iterations.
-    PointMatcher<RealT>::Matrix T = Id;
-    if (opt.num_iter > 0){
-      if (opt.alignment_method == "fgr") {
-        T = fgr_alignment(source_point_cloud, ref_point_cloud, opt);
-      } else if (opt.alignment_method == "point-to-plane" ||
-                 opt.alignment_method == "point-to-point" ||
-                 opt.alignment_method == "similarity-point-to-point" ||
-                 opt.alignment_method == "similarity-point-to-plane") {
-        // Use libpointmatcher
-        try {
-          T = icp(source_point_cloud, ref_point_cloud, Id, opt.compute_translation_only);
-        } catch(std::exception const& e) {
-          std::string error = e.what();
-          if (error.find(libpointmatcher_error) != std::string::npos)
-            error += ".\n" + pc_align_error; // clarify the error
-          vw_throw(ArgumentErr() << error);
-        }
-        
-        vw_out() << "Match ratio: "
-		 << icp.errorMinimizer->getWeightedPointUsedRatio() << endl;
-      }else if (opt.alignment_method == "least-squares" ||
-                opt.alignment_method == "similarity-least-squares"){
-        /// Compute alignment using least squares
-	T = least_squares_alignment(source_point_cloud, shift,
-				    dem_georef, reference_dem_ref, opt);
-      }else
-        vw_throw( ArgumentErr() << "Unknown alignment method: " << opt.alignment_method);
-    }
-    sw4.stop();
-    if (opt.verbose)
-      vw_out() << "Alignment took " << sw4.elapsed_seconds() << " [s]" << endl;
-
-    // Transform the source to make it close to reference.
-    DP trans_source_point_cloud(source_point_cloud);
-    apply_transform_to_cloud(T, trans_source_point_cloud);
-
-    // Calculate by how much points move as result of T
-    double max_obtained_disp = calc_max_displacment(source_point_cloud, trans_source_point_cloud);
-    Vector3 source_ctr_vec, source_ctr_llh;
-    Vector3 trans_xyz, trans_ned, trans_llh;
-    vw::Matrix3x3 NED2ECEF;
-    calc_translation_vec(initT, source_point_cloud, trans_source_point_cloud, shift,
-			 geo.datum(), source_ctr_vec, source_ctr_llh,
-                         trans_xyz, trans_ned, trans_llh, NED2ECEF);
-
-    // For each point, compute the distance to the nearest reference point.
-    PointMatcher<RealT>::Matrix end_errors;
-    elapsed_time = compute_registration_error(ref_point_cloud, trans_source_point_cloud, icp,
-                                              shift, dem_georef, reference_dem_ref, opt,
-					      end_errors);
-    calc_stats("Output", end_errors);
-    if (opt.verbose)
-      vw_out() << "Final error computation took " << elapsed_time << " [s]" << endl;
-
-    // We must apply to T the initial guess transform
-    PointMatcher<RealT>::Matrix combinedT = T*initT;
-
-    // Go back to the original coordinate system, undoing the shift
-    PointMatcher<RealT>::Matrix globalT = apply_shift(combinedT, -shift);
-
-    // Print statistics
-    vw_out() << std::setprecision(16)
-             << "Alignment transform (origin is planet center):" << endl << globalT << endl;
-    vw_out() << std::setprecision(8); // undo the higher precision
-
-    vw_out() << "Centroid of source points (Cartesian, meters): " << source_ctr_vec << std::endl;
-    // Swap lat and lon, as we want to print lat first
-    std::swap(source_ctr_llh[0], source_ctr_llh[1]);
-    vw_out() << "Centroid of source points (lat,lon,z): " << source_ctr_llh << std::endl;
-    vw_out() << std::endl;
-
-    vw_out() << "Translation vector (Cartesian, meters): " << trans_xyz << std::endl;
-    vw_out() << "Translation vector (North-East-Down, meters): "
-             << trans_ned << std::endl;
-    vw_out() << "Translation vector magnitude (meters): " << norm_2(trans_xyz)
-             << std::endl;
-    vw::vw_out() << "Maximum displacement of points between the source "
-                 << "cloud with any initial transform applied to it and the "
-                 << "source cloud after alignment to the reference: " 
-                 << max_obtained_disp << " m" << std::endl;
-    if (opt.max_disp > 0 && opt.max_disp < max_obtained_disp) {
-      vw_out() << "Warning: The input --max-displacement value is smaller than the "
-               << "final observed displacement. It may be advised to increase the former "
-               << "and rerun the tool.\n";
+    // Align each source. In batch mode, each has its own output prefix,
+    // and a failure is reported without stopping the others.
+    if (opt.sources.size() == 1) {
+      align_source(opt, geo, csv_conv, source_boxes[0], shift, initT,
+                   ref_point_cloud, icp, reference_dem);
+      return 0;
     }
 
-    // Swap lat and lon, as we want to print lat first
-    std::swap(trans_llh[0], trans_llh[1]);
-    vw_out() << "Translation vector (lat,lon,z): " << trans_llh << std::endl;
-    vw_out() << std::endl;
-
-    Matrix3x3 rot;
-    for (int r = 0; r < DIM; r++)
-      for (int c = 0; c < DIM; c++)
-        rot(r, c) = globalT(r, c);
-
-    double scale = pow(det(rot), 1.0/3.0);
-    for (int r = 0; r < DIM; r++)
-      for (int c = 0; c < DIM; c++)
-        rot(r, c) /= scale;
-
-    // Subtract one before printing the scale, to see a lot of digits of precision
-    vw_out() << "Transform scale - 1 = " << (scale-1.0) << std::endl;
-    
-    Matrix3x3 rot_NED = inverse(NED2ECEF) * rot * NED2ECEF;
-   
-    Vector3 euler_angles = math::rotation_matrix_to_euler_xyz(rot) * 180/M_PI;
-    Vector3 euler_angles_NED = math::rotation_matrix_to_euler_xyz(rot_NED) * 180/M_PI;
-    Vector3 axis_angles = math::matrix_to_axis_angle(rot) * 180/M_PI;
-    vw_out() << "Euler angles (degrees): " << euler_angles  << endl;
-    vw_out() << "Euler angles (North-East-Down, degrees): " << euler_angles_NED  << endl;
-    vw_out() << "Axis of rotation and angle (degrees): "
-             << axis_angles/norm_2(axis_angles) << ' '
-             << norm_2(axis_angles) << endl;
-
-    
-    Stopwatch sw5;
-    sw5.start();
-    write_transforms(opt, globalT);
-
-    if (opt.save_trans_ref){
-      string trans_ref_prefix = opt.out_prefix + "-trans_reference";
-      save_trans_point_cloud(opt, opt.reference, trans_ref_prefix,
-                             geo, csv_conv, globalT.inverse());
+    int num_failed = 0;
+    for (size_t i = 0; i < opt.sources.size(); i++) {
+      Options source_opt = opt;
+      source_opt.source     = opt.sources[i];
+      source_opt.out_prefix = opt.source_prefixes[i];
+      vw_out() << "\nAligning source " << i + 1 << " of " << opt.sources.size()
+               << ": " << source_opt.source << "\n";
+      try {
+        align_source(source_opt, geo, csv_conv, source_boxes[i], shift, initT,
+                     ref_point_cloud, icp, reference_dem);
+      } catch (std::exception const& e) {
+        vw_out() << "Failed to align " << source_opt.source << ": " << e.what() << "\n";
+        num_failed++;
+      }
     }
-
-    if (opt.save_trans_source){
-      string trans_source_prefix = opt.out_prefix + "-trans_source";
-      save_trans_point_cloud(opt, opt.source, trans_source_prefix,
-                             geo, csv_conv, globalT);
+    if (num_failed > 0) {
+      vw_out() << "Failed to align " << num_failed << " of "
+               << opt.sources.size() << " sources.\n";
+      return 1;
     }
 
-    save_errors(source_point_cloud, beg_errors,  opt.out_prefix + "-beg_errors.csv",
-                shift, geo, csv_conv, is_lola_rdr_format, mean_source_longitude);
-    save_errors(trans_source_point_cloud, end_errors,  opt.out_prefix + "-end_errors.csv",
-                shift, geo, csv_conv, is_lola_rdr_format, mean_source_longitude);
-
-    if (opt.verbose) vw_out() << "Writing: " << opt.out_prefix
-      + "-iterationInfo.csv" << std::endl;
-
-    sw5.stop();
-    if (opt.verbose) vw_out() << "Saving to disk took "
-                              << sw5.elapsed_seconds() << " [s]" << endl;
-
   } ASP_STANDARD_CATCHES;
 
   return 0;
@@ -58,6 +58,7 @@
 #include <asp/Core/Macros.h>
 #include <asp/Core/PointUtils.h>
 #include <asp/Core/EigenUtils.h>
+#include <asp/Core/FileUtils.h>
 #include <liblas/liblas.hpp>
 
 #include <limits>
@@ -126,6 +127,37 @@ void calc_extended_lonlat_bbox(vw::cartography::GeoReference const& geo,
                                PointMatcher<RealT>::Matrix const transform,
                                vw::BBox2 & out_box, 
                                vw::BBox2 & trans_out_box);
+
+/// The same, from points already loaded, and not shifted
+void calc_extended_lonlat_bbox(vw::cartography::GeoReference const& geo,
+                               DP const& points,
+                               double median_longitude,
+                               double max_disp,
+                               PointMatcher<RealT>::Matrix const transform,
+                               vw::BBox2 & out_box, 
+                               vw::BBox2 & trans_out_box);
+
+/// Keep only the points, which were shifted by the given vector, that
+/// fall in the lon-lat box, or in it shifted by 360 degrees.
+void crop_to_lonlat_box(vw::cartography::Datum const& datum, vw::Vector3 const& shift,
+                        vw::BBox2 const& lonlat_box, DP & points);
+
+/// A sample of the whole reference cloud, as loaded by pc_align, saved
+/// so later runs with the same reference can skip loading it. Return
+/// false if the cache does not exist, or was made from another
+/// reference, an older version of it, another number of points, or
+/// another datum. The points are memory-mapped and copied out.
+bool read_reference_cache(std::string const& cache_file, std::string const& reference,
+                          std::int64_t max_num_points, vw::cartography::Datum const& datum,
+                          vw::Vector3 & shift, bool & is_lola_rdr_format,
+                          double & median_longitude, DP & points);
+
+/// Save the reference cloud sample. It is written to a temporary file
+/// which is then renamed, so concurrent runs never see a partial cache.
+void write_reference_cache(std::string const& cache_file, std::string const& reference,
+                           std::int64_t max_num_points, vw::cartography::Datum const& datum,
+                           vw::Vector3 const& shift, bool is_lola_rdr_format,
+                           double median_longitude, DP const& points);
   
 /// Compute the mean value of an std::vector out to a length
 double calc_mean(std::vector<double> const& errs, int len);
@@ -219,27 +251,6 @@ void save_trans_point_cloud_n(vw::GdalWriteOptions const& opt,
                               opt, vw::TerminalProgressCallback("asp", "\t--> "));
 }
 
-
-//=======================================================================================
-// Stuff pulled up from point_to_dem_dist in the Tools repository.
-
-
-/// A type for interpolation from a masked DEM object.
-typedef vw::InterpolationView< vw::EdgeExtensionView< vw::ImageViewRef< vw::PixelMask<float> >,
-                                                      vw::ConstantEdgeExtension>,
-                               vw::BilinearInterpolation> InterpolationReadyDem;
-
-/// Get ready to interpolate points on a DEM existing on disk.
-InterpolationReadyDem load_interpolation_ready_dem(std::string                  const& dem_path,
-                                                   vw::cartography::GeoReference     & georef);
-
-/// Interpolates the DEM height at the input coordinate.
-/// - Returns false if the coordinate falls outside the valid DEM area.
-bool interp_dem_height(vw::ImageViewRef< vw::PixelMask<float> > const& dem,
-                       vw::cartography::GeoReference const & georef,
-                       vw::Vector3                   const & lonlat,
-                       double                              & dem_height);
-
 }
 
 #include <asp/Tools/pc_align_utils.tcc>
@@ -48,6 +48,14 @@
 
 #include <pointmatcher/PointMatcher.h>
 
+#include <boost/filesystem.hpp>
+
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace asp {
 
 template<typename T>
@@ -67,15 +75,14 @@ typename PointMatcher<T>::DataPoints::Labels form_labels(int dim){
   return labels;
 }
 
-std::int64_t load_las_aux(std::string const& file_name,
-                       std::int64_t num_points_to_load,
-                       vw::BBox2 const& lonlat_box,
-                       bool calc_shift,
-                       vw::Vector3 & shift,
-                       vw::cartography::GeoReference const& geo,
-                       bool verbose, DoubleMatrix & data){
-
-  data.conservativeResize(DIM+1, num_points_to_load);
+// Load a LAS file. The index of a point in the file decides if it is sampled.
+void load_las(std::string const& file_name,
+             std::int64_t num_points_to_load,
+             vw::BBox2 const& lonlat_box,
+             bool calc_shift,
+             vw::Vector3 & shift,
+             vw::cartography::GeoReference const& geo,
+             bool verbose, DoubleMatrix & data){
 
   vw::cartography::GeoReference las_georef;
   bool has_georef = georef_from_las(file_name, las_georef);
@@ -88,13 +95,8 @@ std::int64_t load_las_aux(std::string const& file_name,
   liblas::ReaderFactory f;
   liblas::Reader reader = f.CreateWithStream(ifs);
 
-  // We will randomly pick or not a point with probability load_ratio
+  PointSampler sampler(num_points_to_load);
   std::int64_t num_total_points = las_file_size(file_name);
-  double load_ratio
-    = (double)num_points_to_load/std::max(1.0, (double)num_total_points);
-
-  bool shift_was_calc = false;
-  std::int64_t points_count = 0;
 
   vw::TerminalProgressCallback tpc("asp", "\t--> ");
   std::int64_t hundred = 100;
@@ -102,13 +104,14 @@ std::int64_t load_las_aux(std::string const& file_name,
   double inc_amount = 1.0 / hundred;
   if (verbose) tpc.report_progress(0);
 
+  std::uint64_t index = 0;
   while (reader.ReadNextPoint()){
 
-    if (points_count >= num_points_to_load)
-      break;
+    if (verbose && index%spacing == 0) tpc.report_incremental_progress( inc_amount );
 
-    double r = (double)std::rand()/(double)RAND_MAX;
-    if (r > load_ratio)
+    // Skip the points which cannot be sampled before converting them
+    std::uint64_t curr_index = index++;
+    if (PointSampler::key(curr_index) >= sampler.threshold())
       continue;
 
     liblas::Point const& p = reader.GetPoint();
@@ -118,11 +121,6 @@ std::int64_t load_las_aux(std::string const& file_name,
       xyz = las_georef.datum().geodetic_to_cartesian(vw::Vector3(ll[0], ll[1], xyz[2]));
     }
 
-    if (calc_shift && !shift_was_calc){
-      shift = xyz;
-      shift_was_calc = true;
-    }
-
     // Skip points outside the given box
     if (!lonlat_box.empty()){
       vw::Vector3 llh = geo.datum().cartesian_to_geodetic(xyz);
@@ -130,48 +128,69 @@ std::int64_t load_las_aux(std::string const& file_name,
         continue;
     }
 
-    for (int row = 0; row < DIM; row++)
-      data(row, points_count) = xyz[row] - shift[row];
-    data(DIM, points_count) = 1;
-
-    if (verbose && points_count%spacing == 0) tpc.report_incremental_progress( inc_amount );
-
-    points_count++;
+    sampler.add(curr_index, xyz);
   }
 
   if (verbose) tpc.report_finished();
 
-  data.conservativeResize(Eigen::NoChange, points_count);
-
-  return num_total_points;
+  sampled_points_to_matrix(sampler, calc_shift, shift, data);
 }
 
-void load_las(std::string const& file_name,
-             std::int64_t num_points_to_load,
-             vw::BBox2 const& lonlat_box,
-             bool calc_shift,
-             vw::Vector3 & shift,
-             vw::cartography::GeoReference const& geo,
-             bool verbose, DoubleMatrix & data){
+// Load a PCD or PLY file, with ECEF points. Binary files are mapped into
+// memory, so the points which are not sampled are not even read.
+void load_pcd_or_ply(std::string const& file_name,
+                     std::int64_t num_points_to_load,
+                     vw::BBox2 const& lonlat_box,
+                     bool calc_shift,
+                     vw::Vector3 & shift,
+                     vw::cartography::GeoReference const& geo,
+                     bool verbose, DoubleMatrix & data){
+
+  boost::shared_ptr<MappedPointFile> mapped;
+  boost::shared_ptr<PcdReader> reader;
+  if (MappedPointFile::is_mappable(file_name))
+    mapped.reset(new MappedPointFile(file_name));
+  else if (is_pcd(file_name))
+    reader.reset(new PcdReader(file_name));
+  else
+    vw::vw_throw(vw::ArgumentErr() << "Only binary little-endian PLY files are supported: "
+                 << file_name << "\n");
+
+  PointSampler sampler(num_points_to_load);
+  std::int64_t num_total_points = pcd_file_size(file_name);
+
+  vw::TerminalProgressCallback tpc("asp", "\t--> ");
+  std::int64_t hundred = 100;
+  std::int64_t spacing = std::max(num_total_points/hundred, std::int64_t(1));
+  double inc_amount = 1.0 / hundred;
+  if (verbose) tpc.report_progress(0);
+
+  for (std::uint64_t index = 0; ; index++){
 
-  std::int64_t num_total_points = load_las_aux(file_name, num_points_to_load,
-                                          lonlat_box, calc_shift, shift,
-                                          geo, verbose, data);
-
-  int num_loaded_points = data.cols();
-  if (!lonlat_box.empty()                    &&
-      num_loaded_points < num_points_to_load &&
-      num_loaded_points < num_total_points){
-
-    // We loaded too few points. Try harder. Need some care here as to not run
-    // out of memory.
-    num_points_to_load = std::max(4*num_points_to_load, std::int64_t(10000000));
-    if (verbose)
-      vw::vw_out() << "Too few points were loaded. Trying again." << std::endl;
-    load_las_aux(file_name, num_points_to_load, lonlat_box,
-		 calc_shift, shift, geo, verbose, data);
+    if (mapped.get() != NULL && std::int64_t(index) >= mapped->num_points())
+      break;
+    if (reader.get() != NULL && !reader->ReadNextPoint())
+      break;
+
+    if (verbose && index%spacing == 0) tpc.report_incremental_progress( inc_amount );
+
+    if (PointSampler::key(index) >= sampler.threshold())
+      continue;
+
+    vw::Vector3 xyz = (mapped.get() != NULL) ? mapped->point(index) : reader->GetPoint();
+
+    if (!lonlat_box.empty()){
+      vw::Vector3 llh = geo.datum().cartesian_to_geodetic(xyz);
+      if ( !lonlat_box.contains(subvector(llh, 0, 2)))
+        continue;
+    }
+
+    sampler.add(index, xyz);
   }
 
+  if (verbose) tpc.report_finished();
+
+  sampled_points_to_matrix(sampler, calc_shift, shift, data);
 }
 
 // Load xyz points from disk into a matrix with 4 columns. Last column is just ones.
@@ -204,6 +223,9 @@ void load_cloud(std::string const& file_name,
   else if (file_type == "LAS")
     load_las(file_name, num_points_to_load, lonlat_box, calc_shift, shift,
 	     geo, verbose, data);
+  else if (file_type == "PCD" || file_type == "PLY")
+    load_pcd_or_ply(file_name, num_points_to_load, lonlat_box, calc_shift, shift,
+                    geo, verbose, data);
   else if (file_type == "CSV"){
     bool verbose = true;
     load_csv(file_name, num_points_to_load, lonlat_box, 
@@ -293,6 +315,25 @@ void calc_extended_lonlat_bbox(vw::cartography::GeoReference const& geo,
              calc_shift, shift, geo, csv_conv, is_lola_rdr_format,
              median_longitude, verbose, points);
 
+  calc_extended_lonlat_bbox(geo, points, median_longitude, max_disp, transform,
+                            out_box, trans_out_box);
+}
+
+// The same, from points already loaded, and not shifted
+void calc_extended_lonlat_bbox(vw::cartography::GeoReference const& geo,
+                               DP const& points,
+                               double median_longitude,
+                               double max_disp,
+                               PointMatcher<RealT>::Matrix const transform,
+                               vw::BBox2 & out_box, 
+                               vw::BBox2 & trans_out_box) {
+
+  out_box       = vw::BBox2();
+  trans_out_box = vw::BBox2();
+  if (max_disp < 0.0 || geo.datum().name() == UNSPECIFIED_DATUM ||
+      points.features.cols() == 0)
+    return;
+
   bool has_transform = (transform != PointMatcher<RealT>::Matrix::Identity(DIM + 1, DIM + 1));
 
   // For the first point, figure out how much shift in lonlat a small
@@ -357,6 +398,142 @@ void calc_extended_lonlat_bbox(vw::cartography::GeoReference const& geo,
   return;
 }
 
+// Keep only the points, which were shifted by the given vector, that
+// fall in the lon-lat box, or in it shifted by 360 degrees.
+void crop_to_lonlat_box(vw::cartography::Datum const& datum, vw::Vector3 const& shift,
+                        vw::BBox2 const& lonlat_box, DP & points) {
+  if (lonlat_box.empty())
+    return;
+
+  std::int64_t num_kept = 0;
+  for (std::int64_t col = 0; col < points.features.cols(); col++) {
+    vw::Vector3 xyz;
+    for (int row = 0; row < DIM; row++)
+      xyz[row] = points.features(row, col) + shift[row];
+    vw::Vector2 lonlat = subvector(datum.cartesian_to_geodetic(xyz), 0, 2);
+    if (!lonlat_box.contains(lonlat) &&
+        !lonlat_box.contains(lonlat + vw::Vector2(360, 0)) &&
+        !lonlat_box.contains(lonlat - vw::Vector2(360, 0)))
+      continue;
+    if (num_kept != col)
+      points.features.col(num_kept) = points.features.col(col);
+    num_kept++;
+  }
+  points.features.conservativeResize(Eigen::NoChange, num_kept);
+}
+
+const char REFERENCE_CACHE_MAGIC[] = "PC_ALIGN_REF_V1";
+const size_t REFERENCE_CACHE_MAGIC_LEN = sizeof(REFERENCE_CACHE_MAGIC);
+
+template <class T>
+void append_cache_value(std::string & buf, T const& val) {
+  buf.append(reinterpret_cast<const char*>(&val), sizeof(T));
+}
+
+template <class T>
+bool read_cache_value(const char * data, size_t size, size_t & pos, T & val) {
+  if (pos + sizeof(T) > size)
+    return false;
+  std::memcpy(&val, data + pos, sizeof(T));
+  pos += sizeof(T);
+  return true;
+}
+
+// The header of the reference cache, before the points
+std::string reference_cache_header(std::string const& reference,
+                                   std::int64_t max_num_points,
+                                   vw::cartography::Datum const& datum) {
+  std::string abs_reference = boost::filesystem::absolute(reference).string();
+  std::string buf(REFERENCE_CACHE_MAGIC, REFERENCE_CACHE_MAGIC_LEN);
+  append_cache_value(buf, std::uint32_t(abs_reference.size()));
+  buf += abs_reference;
+  append_cache_value(buf, max_num_points);
+  append_cache_value(buf, datum.semi_major_axis());
+  append_cache_value(buf, datum.semi_minor_axis());
+  return buf;
+}
+
+bool read_reference_cache(std::string const& cache_file, std::string const& reference,
+                          std::int64_t max_num_points, vw::cartography::Datum const& datum,
+                          vw::Vector3 & shift, bool & is_lola_rdr_format,
+                          double & median_longitude, DP & points) {
+
+  if (!is_latest_timestamp(cache_file, reference))
+    return false;
+
+  int fd = ::open(cache_file.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+    ::close(fd);
+    return false;
+  }
+  size_t size = st.st_size;
+  void * ptr = ::mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd); // the mapping stays valid
+  if (ptr == MAP_FAILED)
+    vw::vw_throw(vw::IOErr() << "Cannot map into memory: " << cache_file << ".\n");
+  const char * data = static_cast<const char*>(ptr);
+
+  std::string header = reference_cache_header(reference, max_num_points, datum);
+  bool success = (size >= header.size() &&
+                  std::memcmp(data, header.data(), header.size()) == 0);
+  size_t pos = header.size();
+  std::uint8_t lola = 0;
+  std::int64_t num_points = 0;
+  success = success &&
+    read_cache_value(data, size, pos, shift[0]) &&
+    read_cache_value(data, size, pos, shift[1]) &&
+    read_cache_value(data, size, pos, shift[2]) &&
+    read_cache_value(data, size, pos, lola) &&
+    read_cache_value(data, size, pos, median_longitude) &&
+    read_cache_value(data, size, pos, num_points) &&
+    num_points > 0 &&
+    size - pos == size_t(num_points) * (DIM + 1) * sizeof(RealT);
+
+  if (success) {
+    is_lola_rdr_format = (lola != 0);
+    points.featureLabels = form_labels<RealT>(DIM);
+    points.features.resize(DIM + 1, num_points);
+    std::memcpy(points.features.data(), data + pos, size - pos);
+  } else {
+    vw::vw_out() << "Ignoring the reference cache " << cache_file
+                 << ", as it was made with other inputs.\n";
+  }
+
+  ::munmap(ptr, size);
+  return success;
+}
+
+void write_reference_cache(std::string const& cache_file, std::string const& reference,
+                           std::int64_t max_num_points, vw::cartography::Datum const& datum,
+                           vw::Vector3 const& shift, bool is_lola_rdr_format,
+                           double median_longitude, DP const& points) {
+
+  std::string buf = reference_cache_header(reference, max_num_points, datum);
+  for (int row = 0; row < DIM; row++)
+    append_cache_value(buf, shift[row]);
+  append_cache_value(buf, std::uint8_t(is_lola_rdr_format));
+  append_cache_value(buf, median_longitude);
+  append_cache_value(buf, std::int64_t(points.features.cols()));
+
+  std::string tmp_file = cache_file + ".tmp" + vw::num_to_str(::getpid());
+  {
+    std::ofstream ofs(tmp_file.c_str(), std::ios::binary);
+    if (!ofs)
+      vw::vw_throw(vw::IOErr() << "Cannot write: " << tmp_file << ".\n");
+    ofs.write(buf.data(), buf.size());
+    ofs.write(reinterpret_cast<const char*>(points.features.data()),
+              points.features.size() * sizeof(RealT));
+    if (!ofs)
+      vw::vw_throw(vw::IOErr() << "Failed writing: " << tmp_file << ".\n");
+  }
+  if (std::rename(tmp_file.c_str(), cache_file.c_str()) != 0)
+    vw::vw_throw(vw::IOErr() << "Cannot rename " << tmp_file << " to "
+                 << cache_file << ".\n");
+}
+
 // Sometime the box we computed with cartesian_to_geodetic is offset
 // from the box computed with pixel_to_lonlat by 360 degrees.
 // Fix that.
@@ -532,7 +709,7 @@ void save_trans_point_cloud(vw::GdalWriteOptions const& opt,
   std::string output_file;
   if (file_type == "CSV")
     output_file = out_prefix + ".csv";
-  else if (file_type == "LAS")
+  else if (file_type == "LAS" || file_type == "PCD" || file_type == "PLY")
     output_file = out_prefix + boost::filesystem::path(input_file).extension().string();
   else
     output_file = out_prefix + ".tif";
@@ -627,6 +804,51 @@ void save_trans_point_cloud(vw::GdalWriteOptions const& opt,
     }
     tpc.report_finished();
 
+  }else if (file_type == "PCD" || file_type == "PLY"){
+
+    // Write a binary file with the transformed points, as doubles,
+    // so no precision is lost for ECEF coordinates
+    boost::shared_ptr<MappedPointFile> mapped;
+    boost::shared_ptr<PcdReader> reader;
+    std::int64_t num_total_points = pcd_file_size(input_file);
+    if (MappedPointFile::is_mappable(input_file))
+      mapped.reset(new MappedPointFile(input_file));
+    else
+      reader.reset(new PcdReader(input_file));
+
+    std::vector<double> values;
+    values.reserve(3 * num_total_points);
+    vw::TerminalProgressCallback tpc("asp", "\t--> ");
+    int hundred = 100;
+    std::int64_t spacing = std::max(num_total_points/hundred, std::int64_t(1));
+    double inc_amount = 1.0 / hundred;
+    for (std::int64_t count = 0; ; count++){
+      vw::Vector3 P;
+      if (mapped.get() != NULL){
+        if (count >= mapped->num_points())
+          break;
+        P = mapped->point(count);
+      }else{
+        if (!reader->ReadNextPoint())
+          break;
+        P = reader->GetPoint();
+      }
+
+      P = apply_transform(T, P);
+      for (int k = 0; k < 3; k++)
+        values.push_back(P[k]);
+
+      if (count%spacing == 0) tpc.report_incremental_progress( inc_amount );
+    }
+    tpc.report_finished();
+
+    std::vector<std::string> fields;
+    fields.push_back("x");
+    fields.push_back("y");
+    fields.push_back("z");
+    bool as_double = true;
+    write_binary_point_file(output_file, fields, values, as_double);
+
   }else if (file_type == "CSV"){
 
     // Write a CSV file in format consistent with the input CSV file.
@@ -706,58 +928,6 @@ void save_trans_point_cloud(vw::GdalWriteOptions const& opt,
   }
 } // end save_trans_point_cloud
 
-
-
-InterpolationReadyDem load_interpolation_ready_dem(std::string                  const& dem_path,
-                                                   vw::cartography::GeoReference     & georef) {
-  // Load the georeference from the DEM
-  bool has_georef = vw::cartography::read_georeference( georef, dem_path );
-  if (!has_georef)
-    vw::vw_throw(vw::ArgumentErr() << "DEM: " << dem_path << " does not have a georeference.\n");
-
-  // Set up file handle to the DEM and read the nodata value
-  vw::DiskImageView<float> dem(dem_path);
-  double nodata = std::numeric_limits<double>::quiet_NaN();
-  {
-    boost::shared_ptr<vw::DiskImageResource> dem_rsrc( new vw::DiskImageResourceGDAL(dem_path) );
-    if (dem_rsrc->has_nodata_read())
-      nodata = dem_rsrc->nodata_read();
-  }
-  
-  // Set up interpolation + mask view of the DEM
-  vw::ImageViewRef< vw::PixelMask<float> > masked_dem = create_mask(dem, nodata);
-  return InterpolationReadyDem(interpolate(masked_dem));
-}
-
-
-bool interp_dem_height(vw::ImageViewRef< vw::PixelMask<float> > const& dem,
-                       vw::cartography::GeoReference const & georef,
-                       vw::Vector3                   const & lonlat,
-                       double                              & dem_height) {
-  // Convert the lon/lat location into a pixel in the DEM.
-  vw::Vector2 pix;
-  try {
-    pix = georef.lonlat_to_pixel(subvector(lonlat, 0, 2));
-  }catch(...){
-    return false;
-  }
-  
-  double c = pix[0], r = pix[1];
-
-  // Quit if the pixel falls outside the DEM.
-  if (c < 0 || c >= dem.cols()-1 || // TODO: This ought to be an image class function
-      r < 0 || r >= dem.rows()-1 )
-    return false;
-
-  // Interpolate the DEM height at the pixel location
-  vw::PixelMask<float> v = dem(c, r);
-  if (!is_valid(v))
-    return false;
-
-  dem_height = v.child();
-  return true;
-}
-
 /// Try to read the georef/datum info, need it to read CSV files.
 void read_georef(std::vector<std::string> const& clouds,
                  std::string const& datum_str,
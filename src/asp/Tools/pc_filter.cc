@@ -39,6 +39,9 @@
 #include <vw/FileIO/DiskImageUtils.h>
 #include <vw/FileIO/MatrixIO.h>
 #include <vw/Image/DistanceFunction.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Image/PerPixelViews.h>
+#include <vw/Image/UtilityViews.h>
 #include <vw/Camera/PinholeModel.h>
 #include <vw/Cartography/GeoReference.h>
 
@@ -241,6 +244,243 @@ void estimate_surface_res(ImageView<Vector<double, 4>> const& point_image,
   }
 }
 
+// A filtered point, with the point and triangulation error in the
+// first four channels, then the output texture, then the weight
+typedef Vector<double, 6> FilteredPixel;
+
+// Filter the points in a tile, given in camera coordinates. The
+// results near the tile boundary are not accurate, so the tile must be
+// larger than the region of interest by the halo from filter_halo().
+void filter_tile(Options const& opt, ImageView<Vector<double, 4>> const& point_image,
+                 ImageView<float> const& texture, bool has_texture_nodata,
+                 float texture_nodata, vw::Matrix<double> const& cam2world,
+                 ImageView<FilteredPixel> & filtered) {
+
+  ImageView<float> weight(point_image.cols(), point_image.rows());
+  ImageView<float> out_texture(point_image.cols(), point_image.rows());
+  ImageView<Vector<double, 4>> clean_points(point_image.cols(), point_image.rows());
+  for (int col = 0; col < point_image.cols(); col++) {
+    for (int row = 0; row < point_image.rows(); row++) {
+      weight(col, row) = 0.0;
+      out_texture(col, row) = 0.0;
+      clean_points(col, row) = Vector<double, 4>();
+    }
+  }
+
+  ImageView<float> surface_res;
+  if (opt.reliable_surface_resolution > 0) 
+    estimate_surface_res(point_image, surface_res);
+
+  // Camera direction, in camera's coordinate system
+  Vector3 cam_dir(0.0, 0.0, 1.0);
+
+  for (int col = 0; col < point_image.cols(); col++) {
+    for (int row = 0; row < point_image.rows(); row++) {
+      
+      Vector<double, 4> const& P = point_image(col, row); // alias
+      if (subvector(P, 0, 3) == Vector3() ||
+          (has_texture_nodata && texture(col, row) == texture_nodata) ||
+          (opt.max_valid_triangulation_error > 0 && P[3] > opt.max_valid_triangulation_error)) {
+        continue; // outlier
+      }
+
+      // The first 3 coordinates of P
+      Vector3 Q = subvector(P, 0, 3);
+
+      if (opt.max_distance_from_camera > 0 &&
+          norm_2(Q) > opt.max_distance_from_camera) {
+        continue; // outlier
+      }
+      
+      // All points are given equal weight for now
+      double wt = 1.0;
+      if (opt.distance_from_camera_weight_power > 0) {
+        double dist = norm_2(Q);
+        if (dist == 0.0) 
+          continue; // outlier
+        
+        wt = 1.0 / pow(dist, opt.distance_from_camera_weight_power);
+      }
+
+      if (opt.max_camera_ray_to_surface_normal_angle > 0 ||
+          opt.max_camera_dir_to_surface_normal_angle > 0) {
+
+        // Find the surface normal
+        Vector3 N;
+        if (!surfaceNormal(point_image, col, row, N))
+          continue; // outlier
+          
+        if (opt.max_camera_ray_to_surface_normal_angle > 0) {
+          // Use abs as the normal can point in either direction
+          double prod = std::abs(dot_prod(Q, N) / norm_2(Q) / norm_2(N));
+          double angle = acos(prod) * (180.0 / M_PI);
+          if (std::isnan(angle) || std::isinf(angle) ||
+              angle > opt.max_camera_ray_to_surface_normal_angle)
+            continue; // something went wrong
+          
+        } else if (opt.max_camera_dir_to_surface_normal_angle > 0) {
+          double prod = std::abs(dot_prod(cam_dir, N) / norm_2(cam_dir) / norm_2(N));
+          double angle = acos(prod) * (180.0 / M_PI);
+          if (std::isnan(angle) || std::isinf(angle) ||
+              angle > opt.max_camera_dir_to_surface_normal_angle)
+            continue; // something went wrong
+        }
+      }
+      
+      if (opt.max_camera_dir_to_camera_ray_angle > 0) {
+
+        double prod = std::abs(dot_prod(Q, cam_dir)/ norm_2(Q) / norm_2(cam_dir));
+        double angle = acos(prod) * (180.0 / M_PI);
+        if (std::isnan(angle) || std::isinf(angle))
+          continue; // something went wrong
+        
+        if (angle > opt.max_camera_dir_to_camera_ray_angle) 
+          continue; // outlier
+      }
+      
+      // The input texture is usually between 0 and 1.
+      // TODO(oalexan1): What is the max color?
+      double t = 255.0 * texture(col, row);
+      if (t <= 0.0) t = 1.0;  // Ensure a positive value for the color
+
+      // Note how we add back the triangulation error
+      clean_points(col, row) = Vector<double, 4>(Q[0], Q[1], Q[2], P[3]);
+      out_texture(col, row) = t;
+      weight(col, row) = wt;
+    }
+  }
+
+  if (opt.blending_dist > 0 && opt.blending_power > 0) {
+    ImageView<int> mask(clean_points.cols(), clean_points.rows());
+    for (int col = 0; col < clean_points.cols(); col++) {
+      for (int row = 0; row < clean_points.rows(); row++) {
+        mask(col, row) = (subvector(clean_points(col, row), 0, 3) != Vector3());
+      }
+    }
+    ImageView<double> dist;
+    vw::bounded_dist(mask, opt.blending_dist, dist);
+    
+    // Adjust the weight by the normalized distance raised to given power
+    for (int col = 0; col < dist.cols(); col++) {
+      for (int row = 0; row < dist.rows(); row++) {
+        dist(col, row) = pow(dist(col, row) / opt.blending_dist, opt.blending_power);
+        weight(col, row) *= dist(col, row);
+      }
+    }
+
+  }
+
+  if (opt.reliable_surface_resolution > 0) {
+    for (int col = 0; col < weight.cols(); col++) {
+      for (int row = 0; row < weight.rows(); row++) {
+        if (weight(col, row) <= 0) 
+          continue;
+        
+        if (surface_res(col, row) <= 0) {
+          weight(col, row) = 0.0;
+          continue;
+        }
+
+        weight(col, row) *= exp(-surface_res(col, row) / opt.reliable_surface_resolution);
+      }
+    }
+  }
+  
+  if (!opt.transform_to_camera_coordinates)
+    applyAffineTransform(clean_points, cam2world); // convert back to world
+
+  filtered.set_size(point_image.cols(), point_image.rows());
+  for (int col = 0; col < filtered.cols(); col++) {
+    for (int row = 0; row < filtered.rows(); row++) {
+      subvector(filtered(col, row), 0, 4) = clean_points(col, row);
+      filtered(col, row)[4] = out_texture(col, row);
+      filtered(col, row)[5] = weight(col, row);
+    }
+  }
+}
+
+// How far beyond a tile the input must be read so that the results in
+// the tile are as if the whole cloud was filtered at once. The surface
+// normal and resolution use the immediate neighbors, and blending
+// looks as far as the blending distance at points which themselves
+// needed their neighbors to be validated.
+int filter_halo(Options const& opt) {
+  int halo = 2;
+  if (opt.blending_dist > 0 && opt.blending_power > 0)
+    halo += int(ceil(opt.blending_dist));
+  return halo;
+}
+
+// Filter the cloud tile by tile, with each tile read with a halo
+// around it, so only a few tiles are in memory at a time, and they
+// can be processed in parallel when the result is written.
+class PcFilterView: public ImageViewBase<PcFilterView> {
+  Options const& m_opt;
+  ImageViewRef<Vector<double, 4>> m_point_image;
+  ImageViewRef<float> m_texture;
+  bool m_has_texture_nodata;
+  float m_texture_nodata;
+  vw::Matrix<double> m_cam2world, m_world2cam;
+  int m_halo;
+public:
+  PcFilterView(Options const& opt, ImageViewRef<Vector<double, 4>> const& point_image,
+               ImageViewRef<float> const& texture, bool has_texture_nodata,
+               float texture_nodata, vw::Matrix<double> const& cam2world):
+    m_opt(opt), m_point_image(point_image), m_texture(texture),
+    m_has_texture_nodata(has_texture_nodata), m_texture_nodata(texture_nodata),
+    m_cam2world(cam2world), m_world2cam(inverse(cam2world)),
+    m_halo(filter_halo(opt)) {}
+
+  // Image View interface
+  typedef FilteredPixel pixel_type;
+  typedef pixel_type    result_type;
+  typedef ProceduralPixelAccessor<PcFilterView> pixel_accessor;
+
+  inline int32 cols  () const { return m_point_image.cols(); }
+  inline int32 rows  () const { return m_point_image.rows(); }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  inline pixel_type operator()( double /*i*/, double /*j*/, int32 /*p*/ = 0 ) const {
+    vw_throw(NoImplErr() << "PcFilterView::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+    BBox2i bbox2 = bbox;
+    bbox2.expand(m_halo);
+    bbox2.crop(bounding_box(m_point_image));
+    ImageView<Vector<double, 4>> point_tile = crop(m_point_image, bbox2);
+    ImageView<float> texture_tile = crop(m_texture, bbox2);
+
+    // Transform the cloud to camera coordinates (if world2cam is read)
+    applyAffineTransform(point_tile, m_world2cam);
+
+    ImageView<pixel_type> filtered;
+    filter_tile(m_opt, point_tile, texture_tile, m_has_texture_nodata, m_texture_nodata,
+                m_cam2world, filtered);
+
+    return prerasterize_type(filtered,
+                             -bbox2.min().x(), -bbox2.min().y(),
+                             cols(), rows() );
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
+// The point and triangulation error of a filtered pixel
+struct FilteredToCloud: public ReturnFixedType<Vector<double, 4>> {
+  Vector<double, 4> operator()(FilteredPixel const& p) const {
+    return subvector(p, 0, 4);
+  }
+};
+
 int main(int argc, char *argv[]) {
   Options opt;
   try {
@@ -257,12 +497,12 @@ int main(int argc, char *argv[]) {
     if (ext != ".tif" && ext != ".pcd" && ext != ".ply") 
       vw_throw(ArgumentErr() << "The output point cloud extension must be .tif, .pcd, or .ply.");
     
-    // Read the point cloud fully in memory, and remove any offset
-    ImageView<Vector<double, 4>> point_image = asp::read_asp_point_cloud<4>(opt.input_cloud);
+    // The cloud, with any offset removed. It is read tile by tile as it is filtered.
+    ImageViewRef<Vector<double, 4>> point_image = asp::read_asp_point_cloud<4>(opt.input_cloud);
     std::cout << "Read point cloud: " << opt.input_cloud << std::endl;
 
     // Load the texture or set it to 1
-    ImageView<float> texture;
+    ImageViewRef<float> texture;
     bool has_texture_nodata = false;
     float texture_nodata = -32768.0;
     if (opt.input_texture != "") {
@@ -273,12 +513,7 @@ int main(int argc, char *argv[]) {
         std::cout << "Read texture nodata value: " << texture_nodata << std::endl;
       }
     } else {
-      texture = ImageView<float>(point_image.cols(), point_image.rows());
-      for (int col = 0; col < texture.cols(); col++) {
-        for (int row = 0; row < texture.rows(); row++) {
-          texture(col, row) = 1.0;
-        }
-      }
+      texture = constant_view(float(1.0), point_image.cols(), point_image.rows());
     }
 
     // Sanity check
@@ -296,156 +531,30 @@ int main(int argc, char *argv[]) {
         cam2world(row, 3) = cam.camera_center()[row];
       vw_out() << "Camera-to-world transform: " << cam2world << "\n";
     }
-    vw::Matrix<double> world2cam = inverse(cam2world);
-
-    // Transform the cloud to camera coordinates (if world2cam is read)
-    applyAffineTransform(point_image, world2cam);
-
-    ImageView<float> weight(point_image.cols(), point_image.rows());
-    ImageView<float> out_texture(point_image.cols(), point_image.rows());
-    ImageView<Vector<double, 4>> clean_points(point_image.cols(), point_image.rows());
-    for (int col = 0; col < point_image.cols(); col++) {
-      for (int row = 0; row < point_image.rows(); row++) {
-        weight(col, row) = 0.0;
-        out_texture(col, row) = 0.0;
-        clean_points(col, row) = Vector<double, 4>();
-      }
-    }
-
-    ImageView<float> surface_res;
-    if (opt.reliable_surface_resolution > 0) 
-      estimate_surface_res(point_image, surface_res);
-
-    // Camera direction, in camera's coordinate system
-    Vector3 cam_dir(0.0, 0.0, 1.0);
 
-    for (int col = 0; col < point_image.cols(); col++) {
-      for (int row = 0; row < point_image.rows(); row++) {
-        
-        Vector<double, 4> const& P = point_image(col, row); // alias
-        if (subvector(P, 0, 3) == Vector3() ||
-            (has_texture_nodata && texture(col, row) == texture_nodata) ||
-            (opt.max_valid_triangulation_error > 0 && P[3] > opt.max_valid_triangulation_error)) {
-          continue; // outlier
-        }
-
-        // The first 3 coordinates of P
-        Vector3 Q = subvector(P, 0, 3);
-
-        if (opt.max_distance_from_camera > 0 &&
-            norm_2(Q) > opt.max_distance_from_camera) {
-          continue; // outlier
-        }
-        
-        // All points are given equal weight for now
-        double wt = 1.0;
-        if (opt.distance_from_camera_weight_power > 0) {
-          double dist = norm_2(Q);
-          if (dist == 0.0) 
-            continue; // outlier
-          
-          wt = 1.0 / pow(dist, opt.distance_from_camera_weight_power);
-        }
-
-        if (opt.max_camera_ray_to_surface_normal_angle > 0 ||
-            opt.max_camera_dir_to_surface_normal_angle > 0) {
-
-          // Find the surface normal
-          Vector3 N;
-          if (!surfaceNormal(point_image, col, row, N))
-            continue; // outlier
-            
-          if (opt.max_camera_ray_to_surface_normal_angle > 0) {
-            // Use abs as the normal can point in either direction
-            double prod = std::abs(dot_prod(Q, N) / norm_2(Q) / norm_2(N));
-            double angle = acos(prod) * (180.0 / M_PI);
-            if (std::isnan(angle) || std::isinf(angle) ||
-                angle > opt.max_camera_ray_to_surface_normal_angle)
-              continue; // something went wrong
-            
-          } else if (opt.max_camera_dir_to_surface_normal_angle > 0) {
-            double prod = std::abs(dot_prod(cam_dir, N) / norm_2(cam_dir) / norm_2(N));
-            double angle = acos(prod) * (180.0 / M_PI);
-            if (std::isnan(angle) || std::isinf(angle) ||
-                angle > opt.max_camera_dir_to_surface_normal_angle)
-              continue; // something went wrong
-          }
-        }
-        
-        if (opt.max_camera_dir_to_camera_ray_angle > 0) {
-
-          double prod = std::abs(dot_prod(Q, cam_dir)/ norm_2(Q) / norm_2(cam_dir));
-          double angle = acos(prod) * (180.0 / M_PI);
-          if (std::isnan(angle) || std::isinf(angle))
-            continue; // something went wrong
-          
-          if (angle > opt.max_camera_dir_to_camera_ray_angle) 
-            continue; // outlier
-        }
-        
-        // The input texture is usually between 0 and 1.
-        // TODO(oalexan1): What is the max color?
-        double t = 255.0 * texture(col, row);
-        if (t <= 0.0) t = 1.0;  // Ensure a positive value for the color
-
-        // Note how we add back the triangulation error
-        clean_points(col, row) = Vector<double, 4>(Q[0], Q[1], Q[2], P[3]);
-        out_texture(col, row) = t;
-        weight(col, row) = wt;
-      }
-    }
-
-    if (opt.blending_dist > 0 && opt.blending_power > 0) {
-      ImageView<int> mask(clean_points.cols(), clean_points.rows());
-      for (int col = 0; col < clean_points.cols(); col++) {
-        for (int row = 0; row < clean_points.rows(); row++) {
-          mask(col, row) = (subvector(clean_points(col, row), 0, 3) != Vector3());
-        }
-      }
-      ImageView<double> dist;
-      vw::bounded_dist(mask, opt.blending_dist, dist);
-      
-      // Adjust the weight by the normalized distance raised to given power
-      for (int col = 0; col < dist.cols(); col++) {
-        for (int row = 0; row < dist.rows(); row++) {
-          dist(col, row) = pow(dist(col, row) / opt.blending_dist, opt.blending_power);
-          weight(col, row) *= dist(col, row);
-        }
-      }
-
-    }
-
-    if (opt.reliable_surface_resolution > 0) {
-      for (int col = 0; col < weight.cols(); col++) {
-        for (int row = 0; row < weight.rows(); row++) {
-          if (weight(col, row) <= 0) 
-            continue;
-          
-          if (surface_res(col, row) <= 0) {
-            weight(col, row) = 0.0;
-            continue;
-          }
-
-          weight(col, row) *= exp(-surface_res(col, row) / opt.reliable_surface_resolution);
-        }
-      }
-    }
-    
-    if (!opt.transform_to_camera_coordinates)
-      applyAffineTransform(clean_points, cam2world); // convert back to world
+    ImageViewRef<FilteredPixel> filtered
+      = PcFilterView(opt, point_image, texture, has_texture_nodata, texture_nodata,
+                     cam2world);
     
     // Save as .tif, .pcd, or .pcl
     if (ext == ".tif") {
+      // Each tile is filtered on its own, in parallel, as it is written
       vw::cartography::GeoReference georef;
       bool has_georef = vw::cartography::read_georeference(georef, opt.input_cloud);
       bool has_nodata = false;
       double nodata = 0.0;
       vw_out() << "Writing: " << opt.output_cloud << "\n";
       vw::cartography::block_write_gdal_image
-        (opt.output_cloud, clean_points, has_georef, georef, has_nodata, nodata, opt,
+        (opt.output_cloud, per_pixel_filter(filtered, FilteredToCloud()),
+         has_georef, georef, has_nodata, nodata, opt,
          TerminalProgressCallback("asp", "\t--> Filter: "));
     } else {
-      asp::writeCloud(clean_points, out_texture, weight, opt.output_cloud);
+      // These formats are written in one go, so filter the whole cloud first
+      ImageView<FilteredPixel> all_filtered = filtered;
+      asp::writeCloud(per_pixel_filter(all_filtered, FilteredToCloud()),
+                      channel_cast<float>(select_channel(all_filtered, 4)),
+                      channel_cast<float>(select_channel(all_filtered, 5)),
+                      opt.output_cloud);
     }
 
     if (opt.output_weight != "") {
@@ -455,7 +564,8 @@ int main(int argc, char *argv[]) {
       double nodata = 0;
       vw_out() << "Writing weights: " << opt.output_weight << "\n";
       vw::cartography::block_write_gdal_image
-        (opt.output_weight, weight, has_georef, georef, has_nodata, nodata, opt,
+        (opt.output_weight, channel_cast<float>(select_channel(filtered, 5)),
+         has_georef, georef, has_nodata, nodata, opt,
        TerminalProgressCallback("asp", "\t--> Weight per point:"));
     }
     
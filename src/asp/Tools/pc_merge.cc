@@ -19,20 +19,32 @@
 /// \file pc_merge.cc
 ///
 /// A simple tool to merge multiple point cloud files into a single file. The clouds
-/// can have 1 channel (plain raster images) or 3 to 6 channels.
+/// can have 1 channel (plain raster images) or 3 to 6 channels. If the output
+/// file has the .apc extension, it is written as a chunked point cloud.
+/// With --spatial-sort, the points are instead sorted along a Z-order curve
+/// and laid out so that each block of the output holds nearby points.
 
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/MortonCode.h>
 #include <asp/Core/PointUtils.h>
 #include <asp/Core/OrthoRasterizer.h>
 
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Mosaic/ImageComposite.h>
 #include <vw/FileIO/DiskImageUtils.h>
 #include <vw/Cartography/PointImageManipulation.h>
 
+#include <boost/noncopyable.hpp>
+
+#include <algorithm>
+#include <cstdio>
 #include <limits>
 
+#include <fcntl.h>
+#include <unistd.h>
+
 using namespace vw;
 using namespace vw::cartography;
 namespace po = boost::program_options;
@@ -45,11 +57,12 @@ struct Options : vw::GdalWriteOptions {
 
   // Settings
   bool  write_double;  ///< If true, output file is double instead of float
+  bool  spatial_sort;  ///< If true, sort the points and place nearby points together
 
   // Output
   std::string out_file;
 
-  Options() : write_double(false) {}
+  Options() : write_double(false), spatial_sort(false) {}
 };
 
 
@@ -57,8 +70,10 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 
   po::options_description general_options("General Options");
   general_options.add_options()
-    ("output-file,o",  po::value(&opt.out_file)->default_value(""),        "Specify the output file.")
-    ("write-double,d", po::value(&opt.write_double)->default_value(false), "Write a double precision output file.");
+    ("output-file,o",  po::value(&opt.out_file)->default_value(""),        "Specify the output file. If it has the .apc extension, write a chunked point cloud, which is smaller and faster to read.")
+    ("write-double,d", po::value(&opt.write_double)->default_value(false), "Write a double precision output file.")
+    ("spatial-sort",   po::bool_switch(&opt.spatial_sort)->default_value(false),
+     "Sort the valid points along a Z-order (Morton) curve and write them row by row in a cloud with 256 columns, so that each 256 x 256 block of the output holds nearby points. Invalid points are dropped. The position of a point in its input cloud is not kept.");
 
   general_options.add( vw::GdalWriteOptionsDescription(opt) );
 
@@ -96,9 +111,9 @@ int check_num_channels(std::vector<std::string> const& pc_files){
   VW_ASSERT(pc_files.size() >= 1,
             ArgumentErr() << "Expecting at least one file.\n");
 
-  int target_num = get_num_channels(pc_files[0]);
+  int target_num = asp::num_channels(pc_files[0]);
   for (int i = 1; i < (int)pc_files.size(); ++i){
-    int num_channels = get_num_channels(pc_files[i]);
+    int num_channels = asp::num_channels(pc_files[i]);
     if (num_channels != target_num)
       vw_throw( ArgumentErr() << "Input point clouds must all have the same number of channels!.\n" );
   }
@@ -118,6 +133,15 @@ Vector3 determine_output_shift(std::vector<std::string> const& pc_files, Options
   double shift_count = 0;
   for (size_t i=0; i<pc_files.size(); ++i) {
     // Read in the shift from each cloud and accumulate them
+    if (asp::is_chunked_point_cloud(pc_files[i])) {
+      asp::ChunkedPointCloudInfo info;
+      asp::read_chunked_point_cloud_info(pc_files[i], info);
+      if (info.shift != Vector3()) {
+        shift += info.shift;
+        shift_count += 1.0;
+      }
+      continue;
+    }
     std::string shift_str;
     boost::shared_ptr<vw::DiskImageResource> rsrc( new vw::DiskImageResourceGDAL(pc_files[i]) );
     if (vw::cartography::read_header_string(*rsrc.get(), asp::ASP_POINT_OFFSET_TAG_STR, shift_str)){
@@ -136,12 +160,369 @@ Vector3 determine_output_shift(std::vector<std::string> const& pc_files, Options
 }
 
 
+// Spatial sorting of the merged cloud. The points are sorted by the Morton
+// code of their quantized coordinates. That is done out of core: the
+// points are first distributed into buckets, which are coarse cells of
+// the Morton curve, stored in temporary files, then each bucket is
+// sorted in memory, in parallel, and written at its place in one file.
+
+// The sorted cloud has this many columns, so each square block of this
+// size holds consecutive points
+const int SORTED_CLOUD_WIDTH = 256;
+
+// The input is read in tiles of this size
+const int SORT_TILE_SIZE = 256;
+
+// Use enough buckets so that each has about this many points
+const std::int64_t SORT_BUCKET_POINTS = 2000000;
+
+// Map points to the space in which they are sorted. With a datum the
+// sorting is by longitude and latitude, else by Cartesian coordinates.
+class SortSpace {
+  bool    m_use_datum;
+  Datum   m_datum;
+  BBox3   m_box;
+  int     m_dim, m_bits, m_levels;
+public:
+  SortSpace(bool use_datum, Datum const& datum):
+    m_use_datum(use_datum), m_datum(datum),
+    m_dim(use_datum ? 2 : 3), m_bits(use_datum ? 32 : 21), m_levels(0) {}
+
+  Vector3 to_space(Vector3 const& xyz) const {
+    if (!m_use_datum)
+      return xyz;
+    Vector3 llh = m_datum.cartesian_to_geodetic(xyz);
+    return Vector3(llh[0], llh[1], 0.0);
+  }
+
+  // Set the extent of the points, and pick the number of buckets. A
+  // surface fills only about 4^levels of the cells of the 3D curve too.
+  void set_box(BBox3 const& box, std::int64_t num_points) {
+    m_box = box;
+    int max_levels = (m_dim == 2) ? 4 : 3; // at most 256 or 512 files
+    m_levels = 0;
+    while (m_levels < max_levels &&
+           double(num_points) / pow(4.0, m_levels) > double(SORT_BUCKET_POINTS))
+      m_levels++;
+  }
+
+  int num_buckets() const { return 1 << (m_dim * m_levels); }
+
+  std::uint64_t code(Vector3 const& xyz) const {
+    Vector3 p = to_space(xyz);
+    double max_val = double((std::uint64_t(1) << m_bits) - 1);
+    std::uint32_t q[3] = {0, 0, 0};
+    for (int i = 0; i < m_dim; i++) {
+      double len = m_box.max()[i] - m_box.min()[i];
+      if (len <= 0.0)
+        continue;
+      double v = max_val * (p[i] - m_box.min()[i]) / len;
+      q[i] = std::uint32_t(std::max(0.0, std::min(v, max_val)));
+    }
+    if (m_dim == 2)
+      return asp::morton_code_2d(q[0], q[1]);
+    return asp::morton_code_3d(q[0], q[1], q[2]);
+  }
+
+  // The bucket is given by the leading bits of the code
+  int bucket(std::uint64_t code) const {
+    if (m_levels == 0)
+      return 0;
+    return int(code >> (m_dim * (m_bits - m_levels)));
+  }
+};
+
+template <class PixelT>
+bool is_valid_point(PixelT const& p) {
+  return subvector(p, 0, 3) != Vector3();
+}
+
+// Find the extent in the sorting space and the number of the valid points in a tile
+template <class PixelT>
+class SortBoxTask: public vw::Task, private boost::noncopyable {
+  ImageViewRef<PixelT> const& m_cloud;
+  BBox2i                      m_box;
+  SortSpace            const& m_space;
+  BBox3                     & m_space_box;
+  std::int64_t              & m_num_points;
+  vw::Mutex                 & m_mutex;
+public:
+  SortBoxTask(ImageViewRef<PixelT> const& cloud, BBox2i const& box, SortSpace const& space,
+              BBox3 & space_box, std::int64_t & num_points, vw::Mutex & mutex):
+    m_cloud(cloud), m_box(box), m_space(space), m_space_box(space_box),
+    m_num_points(num_points), m_mutex(mutex) {}
+
+  void operator()() {
+    ImageView<PixelT> tile = crop(m_cloud, m_box);
+    BBox3 box;
+    std::int64_t num = 0;
+    for (int row = 0; row < tile.rows(); row++) {
+      for (int col = 0; col < tile.cols(); col++) {
+        if (!is_valid_point(tile(col, row)))
+          continue;
+        box.grow(m_space.to_space(subvector(tile(col, row), 0, 3)));
+        num++;
+      }
+    }
+
+    vw::Mutex::Lock lock(m_mutex);
+    if (num > 0)
+      m_space_box.grow(box);
+    m_num_points += num;
+  }
+};
+
+// Append the valid points of a tile to the files of their buckets
+template <class PixelT>
+class SortBucketTask: public vw::Task, private boost::noncopyable {
+  ImageViewRef<PixelT>   const& m_cloud;
+  BBox2i                        m_box;
+  SortSpace              const& m_space;
+  std::vector<std::FILE*>     & m_files;
+  std::vector<std::int64_t>   & m_counts;
+  vw::Mutex                   & m_mutex;
+public:
+  SortBucketTask(ImageViewRef<PixelT> const& cloud, BBox2i const& box,
+                 SortSpace const& space, std::vector<std::FILE*> & files,
+                 std::vector<std::int64_t> & counts, vw::Mutex & mutex):
+    m_cloud(cloud), m_box(box), m_space(space), m_files(files),
+    m_counts(counts), m_mutex(mutex) {}
+
+  void operator()() {
+    ImageView<PixelT> tile = crop(m_cloud, m_box);
+    std::vector<std::vector<PixelT>> buckets(m_files.size());
+    for (int row = 0; row < tile.rows(); row++) {
+      for (int col = 0; col < tile.cols(); col++) {
+        PixelT const& p = tile(col, row);
+        if (!is_valid_point(p))
+          continue;
+        buckets[m_space.bucket(m_space.code(subvector(p, 0, 3)))].push_back(p);
+      }
+    }
+
+    vw::Mutex::Lock lock(m_mutex);
+    for (size_t b = 0; b < buckets.size(); b++) {
+      size_t num = buckets[b].size();
+      if (num == 0)
+        continue;
+      if (std::fwrite(&buckets[b][0], sizeof(PixelT), num, m_files[b]) != num)
+        vw_throw(IOErr() << "Failed to write the points of a temporary bucket file.\n");
+      m_counts[b] += num;
+    }
+  }
+};
+
+// Read a bucket, sort it, and write it in the sorted file, starting
+// with the point with the given index
+template <class PixelT>
+class SortBucketPointsTask: public vw::Task, private boost::noncopyable {
+  std::string      m_bucket_file;
+  std::int64_t     m_num_points, m_start;
+  SortSpace const& m_space;
+  int              m_fd;
+public:
+  SortBucketPointsTask(std::string const& bucket_file, std::int64_t num_points,
+                       std::int64_t start, SortSpace const& space, int fd):
+    m_bucket_file(bucket_file), m_num_points(num_points), m_start(start),
+    m_space(space), m_fd(fd) {}
+
+  void operator()() {
+    std::vector<PixelT> points(m_num_points);
+    std::FILE * fp = std::fopen(m_bucket_file.c_str(), "rb");
+    if (fp == NULL)
+      vw_throw(IOErr() << "Cannot read: " << m_bucket_file << "\n");
+    size_t num_read = std::fread(&points[0], sizeof(PixelT), points.size(), fp);
+    std::fclose(fp);
+    if (num_read != points.size())
+      vw_throw(IOErr() << "Failed to read the points in: " << m_bucket_file << "\n");
+    fs::remove(m_bucket_file);
+
+    std::vector<std::pair<std::uint64_t, std::int64_t>> codes(m_num_points);
+    for (std::int64_t i = 0; i < m_num_points; i++)
+      codes[i] = std::make_pair(m_space.code(subvector(points[i], 0, 3)), i);
+    std::sort(codes.begin(), codes.end());
+
+    std::vector<PixelT> sorted(m_num_points);
+    for (std::int64_t i = 0; i < m_num_points; i++)
+      sorted[i] = points[codes[i].second];
+    std::vector<PixelT>().swap(points);
+
+    char const* data = reinterpret_cast<char const*>(&sorted[0]);
+    std::int64_t num_bytes = m_num_points * sizeof(PixelT);
+    std::int64_t offset = m_start * sizeof(PixelT);
+    while (num_bytes > 0) {
+      ssize_t num_written = pwrite(m_fd, data, num_bytes, offset);
+      if (num_written <= 0)
+        vw_throw(IOErr() << "Failed to write the sorted points.\n");
+      data      += num_written;
+      offset    += num_written;
+      num_bytes -= num_written;
+    }
+  }
+};
+
+// A temporary file which is removed when done
+struct SortTempFile: private boost::noncopyable {
+  std::string name;
+  int fd;
+  SortTempFile(): fd(-1) {}
+  ~SortTempFile() {
+    if (fd >= 0) {
+      close(fd);
+      fs::remove(name);
+    }
+  }
+};
+
+// The sorted points, read from the sorted file, row by row. Pixels past
+// the last point are invalid.
+template <class PixelT>
+class SortedCloudView: public ImageViewBase<SortedCloudView<PixelT>> {
+  int          m_fd;
+  std::int64_t m_num_points;
+  int          m_cols, m_rows;
+public:
+  SortedCloudView(int fd, std::int64_t num_points):
+    m_fd(fd), m_num_points(num_points), m_cols(SORTED_CLOUD_WIDTH),
+    m_rows((num_points + SORTED_CLOUD_WIDTH - 1) / SORTED_CLOUD_WIDTH) {}
+
+  // Image View interface
+  typedef PixelT     pixel_type;
+  typedef pixel_type result_type;
+  typedef ProceduralPixelAccessor<SortedCloudView> pixel_accessor;
+
+  inline int32 cols  () const { return m_cols; }
+  inline int32 rows  () const { return m_rows; }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  inline pixel_type operator()( double /*i*/, double /*j*/, int32 /*p*/ = 0 ) const {
+    vw_throw(NoImplErr() << "SortedCloudView::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+    ImageView<pixel_type> tile(bbox.width(), bbox.height()); // zero, so invalid
+    for (int row = 0; row < bbox.height(); row++) {
+      std::int64_t beg = std::int64_t(bbox.min().y() + row) * m_cols + bbox.min().x();
+      std::int64_t end = std::min(beg + bbox.width(), m_num_points);
+      if (end <= beg)
+        break;
+      std::int64_t num_bytes = (end - beg) * sizeof(pixel_type);
+      ssize_t num_read = pread(m_fd, &tile(0, row), num_bytes, beg * sizeof(pixel_type));
+      if (num_read != num_bytes)
+        vw_throw(IOErr() << "Failed to read the sorted points.\n");
+    }
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
+// Sort the valid points of the cloud into a temporary file, and return
+// a view of them
+template <class PixelT>
+ImageViewRef<PixelT> spatially_sort(ImageViewRef<PixelT> const& cloud,
+                                   bool has_georef, GeoReference const& georef,
+                                   Options const& opt, SortTempFile & sorted_file) {
+  int num_threads = opt.num_threads;
+  if (num_threads <= 0)
+    num_threads = vw_settings().default_num_threads();
+
+  std::vector<BBox2i> tiles;
+  for (int row = 0; row < cloud.rows(); row += SORT_TILE_SIZE) {
+    for (int col = 0; col < cloud.cols(); col += SORT_TILE_SIZE) {
+      BBox2i tile(col, row, SORT_TILE_SIZE, SORT_TILE_SIZE);
+      tile.crop(bounding_box(cloud));
+      tiles.push_back(tile);
+    }
+  }
+
+  SortSpace space(has_georef, georef.datum());
+  vw::Mutex mutex;
+
+  vw_out() << "Finding the extent of the points.\n";
+  BBox3 space_box;
+  std::int64_t num_points = 0;
+  {
+    FifoWorkQueue queue(num_threads);
+    for (size_t i = 0; i < tiles.size(); i++) {
+      boost::shared_ptr<vw::Task> task(new SortBoxTask<PixelT>(cloud, tiles[i], space,
+                                                               space_box, num_points, mutex));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+  if (num_points == 0)
+    vw_throw(ArgumentErr() << "No valid points were found in the input clouds.\n");
+  space.set_box(space_box, num_points);
+
+  int num_buckets = space.num_buckets();
+  vw_out() << "Distributing " << num_points << " points into "
+           << num_buckets << " buckets.\n";
+  std::vector<std::string> bucket_files(num_buckets);
+  std::vector<std::FILE*> files(num_buckets, NULL);
+  std::vector<std::int64_t> counts(num_buckets, 0);
+  for (int b = 0; b < num_buckets; b++) {
+    bucket_files[b] = opt.out_file + "-sort-tmp-" + vw::num_to_str(b) + ".bin";
+    files[b] = std::fopen(bucket_files[b].c_str(), "wb");
+    if (files[b] == NULL)
+      vw_throw(IOErr() << "Cannot write: " << bucket_files[b] << "\n");
+  }
+  {
+    FifoWorkQueue queue(num_threads);
+    for (size_t i = 0; i < tiles.size(); i++) {
+      boost::shared_ptr<vw::Task> task(new SortBucketTask<PixelT>(cloud, tiles[i], space,
+                                                                  files, counts, mutex));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+  for (int b = 0; b < num_buckets; b++)
+    std::fclose(files[b]);
+
+  vw_out() << "Sorting the buckets.\n";
+  sorted_file.name = opt.out_file + "-sort-tmp.bin";
+  sorted_file.fd = open(sorted_file.name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (sorted_file.fd < 0)
+    vw_throw(IOErr() << "Cannot write: " << sorted_file.name << "\n");
+  {
+    FifoWorkQueue queue(num_threads);
+    std::int64_t start = 0;
+    for (int b = 0; b < num_buckets; b++) {
+      if (counts[b] == 0) {
+        fs::remove(bucket_files[b]);
+        continue;
+      }
+      boost::shared_ptr<vw::Task>
+        task(new SortBucketPointsTask<PixelT>(bucket_files[b], counts[b], start,
+                                              space, sorted_file.fd));
+      queue.add_task(task);
+      start += counts[b];
+    }
+    queue.join_all();
+  }
+
+  return SortedCloudView<PixelT>(sorted_file.fd, num_points);
+}
+
+
 // Do the actual work of loading, merging, and saving the point clouds
 
 // Case 1: Single-channel cloud.
 template <class PixelT>
 typename boost::enable_if<boost::is_same<PixelT, vw::PixelGray<float> >, void >::type
 do_work(Vector3 const& shift, Options const& opt) {
+  if (asp::is_chunked_point_cloud(opt.out_file))
+    vw_throw(ArgumentErr() << "Single-channel images cannot be saved as chunked point clouds.\n");
+  if (opt.spatial_sort)
+    vw_throw(ArgumentErr() << "Single-channel images cannot be spatially sorted.\n");
+
   // The spacing is selected to be compatible with the point2dem convention.
   const int spacing = ASP_MAX_SUBBLOCK_SIZE;
   ImageViewRef<PixelT> merged_cloud = asp::form_point_cloud_composite<PixelT>(opt.pointcloud_files, spacing);
@@ -173,17 +554,44 @@ do_work(Vector3 const& shift, Options const& opt) {
   for (size_t i = 0; i < opt.pointcloud_files.size(); i++){
     cartography::GeoReference local_georef;
 
+    if (asp::is_chunked_point_cloud(opt.pointcloud_files[i])) {
+      if (asp::georef_from_pc_files(std::vector<std::string>(1, opt.pointcloud_files[i]),
+                                    local_georef)) {
+        georef = local_georef;
+        has_georef = true;
+      }
+      continue;
+    }
+
     if (read_georeference(local_georef, opt.pointcloud_files[i])){
       georef = local_georef;
       has_georef = true;
     }
   }
 
+  // The georeference gives the datum for sorting by longitude and latitude
+  SortTempFile sorted_file;
+  if (opt.spatial_sort)
+    merged_cloud = spatially_sort(merged_cloud, has_georef, georef, opt, sorted_file);
+
   bool has_nodata = false;
   double nodata = -std::numeric_limits<float>::max(); // smallest float
 
   vw_out() << "Writing point cloud: " << opt.out_file << "\n";
 
+  if (asp::is_chunked_point_cloud(opt.out_file)) {
+    // This format is lossless, so the rounding error is not needed
+    int num_threads = opt.num_threads;
+    if (num_threads <= 0)
+      num_threads = vw_settings().default_num_threads();
+    const int chunk_size = 256;
+    asp::write_chunked_point_cloud(opt.out_file, merged_cloud, shift,
+                                   has_georef ? georef.get_wkt() : std::string(""),
+                                   chunk_size, num_threads,
+                                   TerminalProgressCallback("asp", "\t--> Merging: "));
+    return;
+  }
+
   // If shift != zero then this will cast the output data to type float.
   //  Otherwise it will keep its data type.
   double point_cloud_rounding_error = 0.0;
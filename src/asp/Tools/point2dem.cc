@@ -25,6 +25,7 @@
 #include <asp/Core/Common.h>
 #include <asp/Core/StereoSettings.h>
 #include <asp/Core/OutlierProcessing.h>
+#include <asp/Core/Point2Grid.h>
 
 #include <vw/Image/AntiAliasing.h>
 #include <vw/Image/InpaintView.h>
@@ -39,6 +40,12 @@
 #include <boost/math/special_functions/fpclassify.hpp>
 
 #include <limits>
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <thread>
+#include <set>
+#include <fstream>
 
 using namespace vw;
 using namespace vw::cartography;
@@ -79,6 +86,7 @@ struct Options : vw::GdalWriteOptions {
   std::string target_srs_string;
   BBox2       target_projwin;
   int         fsaa, dem_hole_fill_len, ortho_hole_fill_len, ortho_hole_fill_extra_len;
+  double      dem_hole_fill_mem_limit_mb;
   bool        remove_outliers_with_pct, use_tukey_outlier_removal;
   Vector2     remove_outliers_params;
   double      max_valid_triangulation_error;
@@ -89,6 +97,7 @@ struct Options : vw::GdalWriteOptions {
   bool        use_surface_sampling;
   bool        has_las_or_csv_or_pcd;
   Vector2i    max_output_size;
+  bool        reuse_pc_index, derive_coarser_dems, cog, plan;
 
   // Output
   std::string out_prefix, output_file_type;
@@ -98,11 +107,13 @@ struct Options : vw::GdalWriteOptions {
     nodata_value(-std::numeric_limits<float>::max()),
     semi_major(0), semi_minor(0), fsaa(1),
     dem_hole_fill_len(0), ortho_hole_fill_len(0), ortho_hole_fill_extra_len(0),
+    dem_hole_fill_mem_limit_mb(2048),
     remove_outliers_with_pct(true), use_tukey_outlier_removal(false),
     max_valid_triangulation_error(0),
     erode_len(0), search_radius_factor(0), sigma_factor(0),
     default_grid_size_multiplier(1.0), use_surface_sampling(false),
-    has_las_or_csv_or_pcd(false), max_output_size(9999999, 9999999){}
+    has_las_or_csv_or_pcd(false), max_output_size(9999999, 9999999),
+    reuse_pc_index(false), derive_coarser_dems(false), cog(false), plan(false){}
 };
 
 void parse_input_clouds_textures(std::vector<std::string> const& files,
@@ -148,7 +159,7 @@ void parse_input_clouds_textures(std::vector<std::string> const& files,
   // Separate the input point clouds from the textures
   opt.pointcloud_files.clear(); opt.texture_files.clear();
   for (int i = 0; i < num; i++){
-    if (asp::is_las_or_csv_or_pcd(files[i]) || get_num_channels(files[i]) >= 3)
+    if (asp::is_las_or_csv_or_pcd(files[i]) || asp::num_channels(files[i]) >= 3)
       opt.pointcloud_files.push_back(files[i]);
     else
       opt.texture_files.push_back(files[i]);
@@ -178,7 +189,7 @@ void parse_input_clouds_textures(std::vector<std::string> const& files,
       // Here we ignore that a point cloud file may have many channels.
       // We just want to verify that the cloud file and texture file
       // have the same number of rows and columns.
-      DiskImageView<float> cloud(opt.pointcloud_files[i]);
+      ImageViewRef<Vector3> cloud = asp::read_asp_point_cloud<3>(opt.pointcloud_files[i]);
       DiskImageView<float> texture(opt.texture_files[i]);
       if (cloud.cols() != texture.cols() || cloud.rows() != texture.rows()){
         vw_throw(ArgumentErr() << "Point cloud " << opt.pointcloud_files[i]
@@ -240,7 +251,7 @@ void las_or_csv_or_pcd_to_tifs(Options& opt, cartography::Datum const& datum,
   for (int i = 0; i < num_files; i++){
     if (asp::is_las_or_csv_or_pcd(opt.pointcloud_files[i]))
       continue;
-    DiskImageView<float> img(opt.pointcloud_files[i]);
+    ImageViewRef<Vector3> img = asp::read_asp_point_cloud<3>(opt.pointcloud_files[i]);
     // Record the max number of rows across all input tifs
     num_rows = std::max(num_rows, std::int64_t(img.rows())); 
   }
@@ -252,7 +263,8 @@ void las_or_csv_or_pcd_to_tifs(Options& opt, cartography::Datum const& datum,
       std::string file = opt.pointcloud_files[i];
       if (asp::is_las(file))  max_num_pts = std::max(max_num_pts, asp::las_file_size(file));
       if (asp::is_csv(file))  max_num_pts = std::max(max_num_pts, asp::csv_file_size(file));
-      if (asp::is_pcd(file))  max_num_pts = std::max(max_num_pts, asp::pcd_file_size(file)); // Note: PCD support needs to be tested!
+      if (asp::is_pcd(file) || asp::is_ply(file))
+        max_num_pts = std::max(max_num_pts, asp::pcd_file_size(file));
       // No need to check for other cases; At least one file must be las or csv or pcd!
     }
     num_rows = std::max(std::int64_t(1), (std::int64_t)ceil(sqrt(double(max_num_pts))));
@@ -379,8 +391,14 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
              "Write an orthoimage based on the texture files passed in as inputs (after the point clouds).")
     ("output-prefix,o",   po::value(&opt.out_prefix),                             "Specify the output prefix.")
     ("output-filetype,t", po::value(&opt.output_file_type)->default_value("tif"), "Specify the output file.")
+    ("cog",               po::bool_switch(&opt.cog)->default_value(false)->implicit_value(true),
+             "Write the outputs as Cloud Optimized GeoTIFF files, with overviews. This needs GDAL 3.1 or later.")
+    ("plan",              po::bool_switch(&opt.plan)->default_value(false)->implicit_value(true),
+             "Do not create a DEM. Estimate from a sample of the cloud the DEM size, the memory use, and the run-time, and suggest values for --threads and --tile-size.")
     ("errorimage",        po::bool_switch(&opt.do_error)->default_value(false),   "Write an additional image whose values represent the triangulation ray intersection error in meters (the closest distance between the rays emanating from the two cameras corresponding to the same point on the ground).")
     ("dem-hole-fill-len", po::value(&opt.dem_hole_fill_len)->default_value(0),    "Maximum dimensions of a hole in the output DEM to fill in, in pixels.")
+    ("dem-hole-fill-mem-limit-mb", po::value(&opt.dem_hole_fill_mem_limit_mb)->default_value(2048),
+            "Use no more than this much memory, in MB, when filling holes in the DEM. The tile size and number of threads for that are chosen accordingly.")
     ("orthoimage-hole-fill-len",      po::value(&opt.ortho_hole_fill_len)->default_value(0),
             "Maximum dimensions of a hole in the output orthoimage to fill in, in pixels.")
     ("orthoimage-hole-fill-extra-len",      po::value(&opt.ortho_hole_fill_extra_len)->default_value(0),
@@ -414,7 +432,11 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     ("use-surface-sampling", po::bool_switch(&opt.use_surface_sampling)->default_value(false),
      "Use the older algorithm, interpret the point cloud as a surface made up of triangles and interpolate into it (prone to aliasing).")
     ("fsaa",   po::value<int>(&opt.fsaa)->default_value(1),            "Oversampling amount to perform antialiasing (obsolete).")
-    ("no-dem", po::bool_switch(&opt.no_dem)->default_value(false), "Skip writing a DEM.");
+    ("no-dem", po::bool_switch(&opt.no_dem)->default_value(false), "Skip writing a DEM.")
+    ("derive-coarser-dems", po::bool_switch(&opt.derive_coarser_dems)->default_value(false)->implicit_value(true),
+     "When multiple DEM spacings are set, rasterize the cloud only at the finest one, and make the products at the coarser spacings by averaging the finest ones (or by their min or max, for these filters). Each coarser spacing must be an integer multiple of the finest one, or else it is rasterized as usual.")
+    ("reuse-pc-index", po::bool_switch(&opt.reuse_pc_index)->default_value(false)->implicit_value(true),
+     "Save the bounding boxes of the point cloud sub-blocks and the histogram of triangulation errors, which are found with a pass over the whole cloud, to <first cloud>-index.bin. A later run with the same clouds, projection, and outlier removal options will read them from there instead, even if the grid size differs. Not used with LAS, CSV, or PCD inputs.");
   
   general_options.add(manipulation_options);
   general_options.add(projection_options);
@@ -507,6 +529,10 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
 
   if (opt.dem_hole_fill_len < 0)
     vw_throw(ArgumentErr() << "The value of --dem-hole-fill-len must be non-negative.\n");
+  if (opt.cog && opt.output_file_type != "tif")
+    vw_throw(ArgumentErr() << "The option --cog needs the output file type to be tif.\n");
+  if (opt.dem_hole_fill_mem_limit_mb <= 0)
+    vw_throw(ArgumentErr() << "The value of --dem-hole-fill-mem-limit-mb must be positive.\n");
   if (opt.ortho_hole_fill_len < 0)
     vw_throw(ArgumentErr() << "The value of --orthoimage-hole-fill-len must be non-negative.\n");
   if (opt.ortho_hole_fill_extra_len < 0)
@@ -681,10 +707,22 @@ namespace asp{
                                                   ErrorToNED(georef));
   }
 
+  /// The name of the output file of given type, such as "DEM".
+  std::string output_file_name(Options const& opt, std::string const& imgName) {
+    // Append a tag if desired to compute the min, max, etc. Later on, in OrthoRasterizer
+    // we do a full validation of opt.filter.
+    std::string tag = "";
+    if (opt.filter != "weighted_average")
+      tag = "-" + opt.filter; 
+
+    return opt.out_prefix + tag + "-" + imgName + "." + opt.output_file_type;
+  }
+
   /// Write an image to disk while handling some common options.
   template<class ImageT>
   void save_image(Options& opt, ImageT img, GeoReference const& georef,
-                  int hole_fill_len, std::string const& imgName){
+                  int hole_fill_len, std::string const& imgName,
+                  bool show_progress = true){
 
 
     // When hole-filling is used, we need to look hole_fill_len beyond
@@ -699,21 +737,16 @@ namespace asp{
     int block_size = nextpow2(2.0*hole_fill_len);
     block_size = std::max(256, block_size);
 
-    // Append a tag if desired to compute the min, max, etc. Later on, in OrthoRasterizer
-    // we do a full validation of opt.filter.
-    std::string tag = "";
-    if (opt.filter != "weighted_average")
-      tag = "-" + opt.filter; 
-
-    std::string output_file = opt.out_prefix + tag + "-" + imgName
-      + "." + opt.output_file_type;
+    std::string output_file = output_file_name(opt, imgName);
     vw_out() << "Writing: " << output_file << "\n";
-    TerminalProgressCallback tpc("asp", imgName + ": ");
+    TerminalProgressCallback terminal_tpc("asp", imgName + ": ");
+    ProgressCallback const& tpc = show_progress ?
+      static_cast<ProgressCallback const&>(terminal_tpc) : ProgressCallback::dummy_instance();
     if (opt.output_file_type == "tif") {
       bool has_georef = true, has_nodata = true;
       asp::save_with_temp_big_blocks(block_size, output_file, img,
                                      has_georef, georef,
-                                     has_nodata, opt.nodata_value, opt, tpc);
+                                     has_nodata, opt.nodata_value, opt, tpc, opt.cog);
     }
     else
       vw::cartography::write_gdal_image(output_file, img, georef, opt, tpc);
@@ -828,32 +861,129 @@ namespace asp{
       (image.impl(), RoundImagePixelsSkipNoData<typename ImageT::pixel_type>(scale, nodata));
   }
 
-} // end namespace asp
+  /// Make a coarser grid from a finer one whose spacing is smaller by an
+  /// integer factor and whose grid points include those of the coarse
+  /// grid. Each coarse pixel combines the valid fine pixels within its
+  /// footprint. If the factor is even, the fine pixels on the footprint
+  /// boundary are shared with the neighbors, so they get half the weight
+  /// when averaging.
+  template <class PixelT>
+  class CoarsenGridView: public ImageViewBase< CoarsenGridView<PixelT> > {
+    ImageViewRef<PixelT> m_fine;
+    int      m_cols, m_rows;
+    Vector2i m_offset; // the fine pixel at coarse pixel (0, 0)
+    int      m_factor;
+    asp::FilterType m_filter; // f_weighted_average, f_mean, f_min, or f_max
+    double   m_nodata;
+
+    typedef typename CompoundChannelType<PixelT>::type channel_type;
+
+    bool is_nodata(PixelT const& p) const {
+      for (int c = 0; c < int(PixelNumChannels<PixelT>::value); c++)
+        if ((double)compound_select_channel<channel_type const&>(p, c) == m_nodata)
+          return true;
+      return false;
+    }
 
-void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
-                               Options& opt,
-                               cartography::GeoReference& georef,
-                               ImageViewRef<double> const& error_image,
-                               double estim_max_error,
-                               std::int64_t * num_invalid_pixels) {
+  public:
+    typedef PixelT pixel_type;
+    typedef PixelT result_type;
+    typedef ProceduralPixelAccessor<CoarsenGridView> pixel_accessor;
+
+    CoarsenGridView(ImageViewRef<PixelT> const& fine, int cols, int rows,
+                    Vector2i const& offset, int factor, asp::FilterType filter,
+                    double nodata):
+      m_fine(fine), m_cols(cols), m_rows(rows), m_offset(offset),
+      m_factor(factor), m_filter(filter), m_nodata(nodata) {}
+
+    inline int32 cols  () const { return m_cols; }
+    inline int32 rows  () const { return m_rows; }
+    inline int32 planes() const { return 1; }
 
-  vw_out() << "\t-- Starting DEM rasterization --\n";
-  vw_out() << "\t--> DEM spacing: " <<     rasterizer.spacing() << " pt/px\n";
-  vw_out() << "\t             or: " << 1.0/rasterizer.spacing() << " px/pt\n";
+    inline pixel_accessor origin() const { return pixel_accessor(*this); }
 
-  // TODO: Maybe put a warning or check here if the size is too big
+    inline result_type operator()(size_t i, size_t j, size_t p=0) const {
+      vw_throw(NoImplErr() << "CoarsenGridView::operator()(...) is not implemented.\n");
+      return result_type();
+    }
+
+    typedef CropView<ImageView<PixelT> > prerasterize_type;
+    inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+      int h = m_factor/2;
+      bool even = (m_factor % 2 == 0);
+      BBox2i fine_box(m_offset + m_factor*bbox.min() - Vector2i(h, h),
+                      m_offset + m_factor*(bbox.max() - Vector2i(1, 1)) + Vector2i(h + 1, h + 1));
+      fine_box.crop(bounding_box(m_fine));
+      ImageView<PixelT> fine;
+      if (!fine_box.empty())
+        fine = crop(m_fine, fine_box);
+
+      int num_channels = PixelNumChannels<PixelT>::value;
+      PixelT nodata_pix;
+      for (int c = 0; c < num_channels; c++)
+        compound_select_channel<channel_type&>(nodata_pix, c) = m_nodata;
+
+      ImageView<PixelT> tile(bbox.width(), bbox.height());
+      for (int col = 0; col < bbox.width(); col++) {
+        for (int row = 0; row < bbox.height(); row++) {
+          Vector2i center = m_offset + m_factor*(bbox.min() + Vector2i(col, row));
+          std::vector<double> sum(num_channels, 0.0);
+          double wt_sum = 0.0;
+          for (int dx = -h; dx <= h; dx++) {
+            for (int dy = -h; dy <= h; dy++) {
+              Vector2i pix = center + Vector2i(dx, dy);
+              if (!fine_box.contains(pix))
+                continue;
+              PixelT val = fine(pix.x() - fine_box.min().x(), pix.y() - fine_box.min().y());
+              if (is_nodata(val))
+                continue;
+              double wt = 1.0;
+              if (even && std::abs(dx) == h) wt *= 0.5;
+              if (even && std::abs(dy) == h) wt *= 0.5;
+              for (int c = 0; c < num_channels; c++) {
+                double v = compound_select_channel<channel_type const&>(val, c);
+                if (m_filter == asp::f_min)
+                  sum[c] = (wt_sum == 0) ? v : std::min(sum[c], v);
+                else if (m_filter == asp::f_max)
+                  sum[c] = (wt_sum == 0) ? v : std::max(sum[c], v);
+                else
+                  sum[c] += wt*v;
+              }
+              wt_sum += wt;
+            }
+          }
+
+          if (wt_sum == 0) {
+            tile(col, row) = nodata_pix;
+            continue;
+          }
+          for (int c = 0; c < num_channels; c++) {
+            double v = sum[c];
+            if (m_filter != asp::f_min && m_filter != asp::f_max)
+              v /= wt_sum;
+            compound_select_channel<channel_type&>(tile(col, row), c) = v;
+          }
+        }
+      }
+
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+
+    template <class DestT> inline void rasterize(DestT const& dest, BBox2i const& bbox) const {
+      vw::rasterize(prerasterize(bbox), dest, bbox);
+    }
+  };
+
+} // end namespace asp
+
+// Set the georef transform of the output DEM given the rasterizer spacing
+void set_dem_transform(asp::OrthoRasterizerView& rasterizer, Options const& opt,
+                       cartography::GeoReference& georef) {
 
   // Now we are ready to specify the affine transform.
   georef.set_transform(rasterizer.geo_transform());
 
-  // If the user requested FSAA, we temporarily increase the
-  // resolution, apply a blur, then resample to the original
-  // resolution. This results in a DEM with less antialiasing.  Note
-  // that the georef above is set with the spacing before resolution
-  // is increased, which will be the final spacing as well.
-  if (opt.fsaa > 1)
-    rasterizer.set_spacing(rasterizer.spacing() / double(opt.fsaa));
-
   // If the user specified the ULLR .. update the georeference
   // transform here. The generate_fsaa_raster will be responsible
   // for making sure we have the correct pixel crop.
@@ -873,6 +1003,266 @@ void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
     transform(1,2) -= 0.5 * transform(1,1);
     georef.set_transform(transform);
   }
+}
+
+// Write out a normalized version of the DEM (for debugging)
+void save_normalized_dem(asp::OrthoRasterizerView& rasterizer, Options& opt,
+                         cartography::GeoReference const& georef) {
+  int hole_fill_len = 0;
+  DiskImageView< PixelGray<float> > dem_image(opt.out_prefix + "-DEM." + opt.output_file_type);
+  asp::save_image(opt, apply_mask(channel_cast<uint8>
+                                  (normalize(create_mask(dem_image,opt.nodata_value),
+                                             rasterizer.bounding_box().min().z(),
+                                             rasterizer.bounding_box().max().z(),
+                                             0, 255))),
+                  georef, hole_fill_len, "DEM-normalized");
+}
+
+// Stop the program if it is going to create too large a DEM, this will cause a crash.
+void check_dem_size(Options const& opt, Vector2i const& dem_size) {
+  vw_out()<< "Creating output file that is " << dem_size << " px.\n";
+  if ((dem_size[0] > opt.max_output_size[0]) || (dem_size[1] > opt.max_output_size[1]))
+    vw_throw(ArgumentErr()
+              << "Requested DEM size is too large, max allowed output size is "
+              << opt.max_output_size << " pixels.\n");
+}
+
+// Fill the holes in the DEM already written to disk. That is done by
+// tiles, each read from the unfilled DEM together with a halo of
+// --dem-hole-fill-len pixels, so the halos overlapping neighboring tiles
+// are read from disk rather than rasterized from the cloud again. The
+// tile size and the number of threads are chosen so that the tiles in
+// memory at any time fit within --dem-hole-fill-mem-limit-mb.
+void fill_dem_holes(Options& opt, GeoReference const& georef) {
+
+  std::string dem_file = asp::output_file_name(opt, "DEM");
+  std::string unfilled_file
+    = fs::path(dem_file).replace_extension(".unfilled.tif").string();
+  fs::rename(dem_file, unfilled_file);
+
+  int hole_fill_len = opt.dem_hole_fill_len;
+  int num_threads = opt.num_threads;
+  if (num_threads <= 0)
+    num_threads = vw_settings().default_num_threads();
+
+  // The hole-filling keeps, per pixel of a tile with its halo, the
+  // masked input, the result, and its own scratch buffers. Make the
+  // tile as large as allowed, to reduce the overhead of the halo, but
+  // if even the smallest tile does not fit, use fewer threads.
+  const double bytes_per_pixel = 24.0;
+  const int min_tile_size = 256;
+  double budget = opt.dem_hole_fill_mem_limit_mb * 1024.0 * 1024.0;
+  double padded_min = double(min_tile_size + 2*hole_fill_len);
+  while (num_threads > 1 &&
+         num_threads * padded_min * padded_min * bytes_per_pixel > budget)
+    num_threads--;
+  int tile_size = int(sqrt(budget / (num_threads * bytes_per_pixel))) - 2*hole_fill_len;
+  tile_size = min_tile_size * std::max(1, tile_size / min_tile_size);
+  if (num_threads * padded_min * padded_min * bytes_per_pixel > budget)
+    vw_out(WarningMessage) << "Hole-filling with --dem-hole-fill-len " << hole_fill_len
+                           << " needs more memory than --dem-hole-fill-mem-limit-mb.\n";
+  vw_out() << "Filling DEM holes with tiles of size " << tile_size << " and "
+           << num_threads << " thread(s).\n";
+
+  DiskImageView<float> unfilled(unfilled_file);
+  ImageViewRef< PixelGray<float> > dem
+    = apply_mask(vw::fill_holes_grass(create_mask(unfilled, opt.nodata_value),
+                                      hole_fill_len),
+                 opt.nodata_value);
+
+  int orig_num_threads = opt.num_threads;
+  opt.num_threads = num_threads;
+  vw_out() << "Writing: " << dem_file << "\n";
+  TerminalProgressCallback tpc("asp", "DEM hole-fill: ");
+  if (opt.output_file_type == "tif") {
+    bool has_georef = true, has_nodata = true;
+    asp::save_with_temp_big_blocks(tile_size, dem_file, dem, has_georef, georef,
+                                   has_nodata, opt.nodata_value, opt, tpc, opt.cog);
+  } else {
+    vw::cartography::write_gdal_image(dem_file, dem, georef, opt, tpc);
+  }
+  opt.num_threads = orig_num_threads;
+
+  fs::remove(unfilled_file);
+}
+
+// Print the percentage of valid DEM pixels, and reset the count of invalid ones
+void report_valid_pixels(Options const& opt, Vector2i const& dem_size,
+                         asp::OrthoRasterizerView & rasterizer,
+                         std::int64_t * num_invalid_pixels) {
+
+  double num_invalid_pixelsD = *num_invalid_pixels;
+
+  // This is to compensate for the fact that for fsaa > 1 we use a
+  // finer rendering grid than the final one. Later a blur and a
+  // resampling to the original grid will happen, so the actual
+  // count is not as simple as what we do here, but this may be good
+  // enough since the fsaa option is not the default and may need
+  // wiping at some point.
+  if (opt.fsaa > 1)
+    num_invalid_pixelsD = num_invalid_pixelsD / double(opt.fsaa) / double(opt.fsaa);
+  
+  // Below we convert to double first and multiply later, to avoid
+  // 32-bit integer overflow.
+  double num_total_pixels = double(dem_size[0])*double(dem_size[1]);
+
+  double invalid_ratio = num_invalid_pixelsD / num_total_pixels;
+  vw_out() << "Percentage of valid pixels: " << 100.0*(1.0 - invalid_ratio) << "%\n";
+  rasterizer.reset_num_invalid_pixels();
+}
+
+// Write an image in its own thread. An exception is kept, to be
+// rethrown by the caller.
+template<class ImageT>
+void save_image_in_thread(Options * opt, ImageT img, GeoReference georef,
+                          std::string imgName, bool show_progress,
+                          std::exception_ptr * error) {
+  try {
+    asp::save_image(*opt, img, georef, 0, imgName, show_progress);
+  } catch (...) {
+    *error = std::current_exception();
+  }
+}
+
+// Rasterize the DEM, the intersection error, and the orthoimage in a
+// single pass over the point cloud, and write them concurrently, so that
+// each tile of the cloud is read and filtered only once for all of them.
+// The intersection error is rasterized if num_err_channels is 4 or 6.
+void write_fused_products(asp::OrthoRasterizerView& rasterizer, Options& opt,
+                          cartography::GeoReference const& georef,
+                          bool do_dem, int num_err_channels, bool do_drg,
+                          std::int64_t * num_invalid_pixels) {
+
+  vw_out() << "\t-- Rasterizing all products in one pass --\n";
+  Stopwatch sw;
+  sw.start();
+
+  std::vector<ImageViewRef<float>> textures;
+  int dem_layer = -1, err_layer = -1, drg_layer = -1;
+  if (do_dem) {
+    dem_layer = textures.size();
+    textures.push_back(channel_cast<float>(select_channel(rasterizer.get_point_image(), 2)));
+  }
+  if (num_err_channels == 4) {
+    err_layer = textures.size();
+    ImageViewRef<Vector4> point_disk_image
+      = asp::form_point_cloud_composite<Vector4>(opt.pointcloud_files, ASP_MAX_SUBBLOCK_SIZE);
+    textures.push_back(channel_cast<float>(select_channel(point_disk_image, 3)));
+  } else if (num_err_channels == 6) {
+    err_layer = textures.size();
+    ImageViewRef<Vector6> point_disk_image
+      = asp::form_point_cloud_composite<Vector6>(opt.pointcloud_files, ASP_MAX_SUBBLOCK_SIZE);
+    ImageViewRef<Vector3> ned_err = asp::error_to_NED(point_disk_image, georef);
+    for (int ch_index = 0; ch_index < 3; ch_index++)
+      textures.push_back(channel_cast<float>(select_channel(ned_err, ch_index)));
+  }
+  if (do_drg) {
+    drg_layer = textures.size();
+    ImageViewRef< PixelGray<float> > texture
+      = asp::form_point_cloud_composite< PixelGray<float> >
+      (opt.texture_files, ASP_MAX_SUBBLOCK_SIZE);
+    textures.push_back(channel_cast<float>(channels_to_planes(texture)));
+  }
+
+  // The writers are in lockstep, as they use the same tiles, so only a
+  // few tiles per thread need to be kept. A tile is dropped once all
+  // layers fetched it. If a writer falls behind by more than that, its
+  // tile is evicted and later rasterized again for it, which is slower
+  // but still correct.
+  int num_threads = opt.num_threads;
+  if (num_threads <= 0)
+    num_threads = vw_settings().default_num_threads();
+  boost::shared_ptr<asp::OrthoRasterizerLayers> layers
+    (new asp::OrthoRasterizerLayers(rasterizer, textures, 4*num_threads));
+
+  // Each writer gets its own copy of the options, as saving an image
+  // changes the block size in them, and a share of the threads, as each
+  // writer runs its own thread pool.
+  int num_writers = int(dem_layer >= 0) + int(err_layer >= 0) + int(drg_layer >= 0);
+  std::vector<Options> writer_opts(3, opt);
+  for (size_t i = 0; i < writer_opts.size(); i++)
+    writer_opts[i].num_threads = std::max(1, num_threads / std::max(1, num_writers));
+
+  std::vector<std::thread> writers;
+  std::vector<std::exception_ptr> errors(3);
+  bool show_progress = true; // only for the first product
+  if (dem_layer >= 0) {
+    ImageViewRef< PixelGray<float> > dem
+      = asp::round_image_pixels_skip_nodata(asp::OrthoRasterizerLayerView(layers, dem_layer),
+                                            opt.rounding_error, opt.nodata_value);
+    check_dem_size(opt, bounding_box(dem).size());
+    writers.push_back(std::thread(save_image_in_thread< ImageViewRef< PixelGray<float> > >,
+                                  &writer_opts[0], dem, georef, "DEM", show_progress,
+                                  &errors[0]));
+    show_progress = false;
+  }
+  if (num_err_channels == 4) {
+    ImageViewRef< PixelGray<float> > err
+      = asp::round_image_pixels_skip_nodata(asp::OrthoRasterizerLayerView(layers, err_layer),
+                                            opt.rounding_error, opt.nodata_value);
+    writers.push_back(std::thread(save_image_in_thread< ImageViewRef< PixelGray<float> > >,
+                                  &writer_opts[1], err, georef, "IntersectionErr", show_progress,
+                                  &errors[1]));
+    show_progress = false;
+  } else if (num_err_channels == 6) {
+    ImageViewRef<Vector3f> err = asp::round_image_pixels_skip_nodata
+      (asp::combine_channels(opt.nodata_value,
+                             asp::OrthoRasterizerLayerView(layers, err_layer),
+                             asp::OrthoRasterizerLayerView(layers, err_layer + 1),
+                             asp::OrthoRasterizerLayerView(layers, err_layer + 2)),
+       opt.rounding_error, opt.nodata_value);
+    writers.push_back(std::thread(save_image_in_thread< ImageViewRef<Vector3f> >,
+                                  &writer_opts[1], err, georef, "IntersectionErr", show_progress,
+                                  &errors[1]));
+    show_progress = false;
+  }
+  if (drg_layer >= 0) {
+    ImageViewRef< PixelGray<float> > drg = asp::OrthoRasterizerLayerView(layers, drg_layer);
+    writers.push_back(std::thread(save_image_in_thread< ImageViewRef< PixelGray<float> > >,
+                                  &writer_opts[2], drg, georef, "DRG", show_progress,
+                                  &errors[2]));
+  }
+
+  for (size_t i = 0; i < writers.size(); i++)
+    writers[i].join();
+  for (size_t i = 0; i < errors.size(); i++) {
+    if (errors[i])
+      std::rethrow_exception(errors[i]);
+  }
+
+  sw.stop();
+  vw_out(DebugMessage,"asp") << "Fused render time: " << sw.elapsed_seconds() << ".\n";
+
+  if (do_dem) {
+    report_valid_pixels(opt, Vector2i(rasterizer.cols(), rasterizer.rows()),
+                        rasterizer, num_invalid_pixels);
+    if (opt.dem_hole_fill_len > 0)
+      fill_dem_holes(opt, georef);
+  }
+}
+
+void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
+                               Options& opt,
+                               cartography::GeoReference& georef,
+                               ImageViewRef<double> const& error_image,
+                               double estim_max_error,
+                               std::int64_t * num_invalid_pixels) {
+
+  vw_out() << "\t-- Starting DEM rasterization --\n";
+  vw_out() << "\t--> DEM spacing: " <<     rasterizer.spacing() << " pt/px\n";
+  vw_out() << "\t             or: " << 1.0/rasterizer.spacing() << " px/pt\n";
+
+  // TODO: Maybe put a warning or check here if the size is too big
+
+  set_dem_transform(rasterizer, opt, georef);
+
+  // If the user requested FSAA, we temporarily increase the
+  // resolution, apply a blur, then resample to the original
+  // resolution. This results in a DEM with less antialiasing.  Note
+  // that the georef above is set with the spacing before resolution
+  // is increased, which will be the final spacing as well.
+  if (opt.fsaa > 1)
+    rasterizer.set_spacing(rasterizer.spacing() / double(opt.fsaa));
 
   // Do not round the DEM heights for small bodies
   if (georef.datum().semi_major_axis() <= asp::MIN_RADIUS_FOR_ROUNDING ||
@@ -883,62 +1273,54 @@ void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
   ImageViewRef<PixelGray<float>> rasterizer_fsaa
     = generate_fsaa_raster(rasterizer, opt);
 
+  // If more than one product is requested, and none of them needs to
+  // see beyond the current tile, make them all in one pass over the
+  // cloud. DEM holes are filled afterwards, from the written DEM.
+  // Filling holes in the orthoimage modifies the cloud, so then the
+  // orthoimage is made separately, at the end.
+  bool fused_dem = false, fused_err = false, fused_drg = false;
+  if (opt.fsaa <= 1) {
+    int num_err_channels = 0;
+    if (opt.do_error)
+      num_err_channels = asp::num_channels(opt.pointcloud_files);
+    bool do_dem = !opt.no_dem;
+    bool do_err = (num_err_channels == 4 || num_err_channels == 6);
+    bool do_drg = (opt.do_ortho && opt.ortho_hole_fill_len <= 0);
+    if (int(do_dem) + int(do_err) + int(do_drg) >= 2) {
+      write_fused_products(rasterizer, opt, georef, do_dem,
+                           do_err ? num_err_channels : 0, do_drg,
+                           num_invalid_pixels);
+      fused_dem = do_dem;
+      fused_err = do_err;
+      fused_drg = do_drg;
+    }
+  }
+
   // Write out the DEM. We've set the texture to be the height.
   Vector2 tile_size(vw_settings().default_tile_size(),
                     vw_settings().default_tile_size());
-  if (!opt.no_dem){
+  if (!opt.no_dem && !fused_dem){
     Stopwatch sw2;
     sw2.start();
     ImageViewRef< PixelGray<float> > dem
       = asp::round_image_pixels_skip_nodata(rasterizer_fsaa, opt.rounding_error,
                                             opt.nodata_value);
 
-    int hole_fill_len = opt.dem_hole_fill_len;
-    if (hole_fill_len > 0){
-      // Note that we first cache the tiles of the rasterized DEM, and
-      // fill holes later. This greatly improves the performance.
-      dem = apply_mask
-        (vw::fill_holes_grass(create_mask
-                               (block_cache(dem, tile_size, opt.num_threads),
-                                opt.nodata_value),
-                               hole_fill_len),
-         opt.nodata_value);
-    }
-
-    // Stop the program if it is going to create too large a DEM, this will cause a crash.
     Vector2i dem_size = bounding_box(dem).size();
-    vw_out()<< "Creating output file that is " << dem_size << " px.\n";
-    if ((dem_size[0] > opt.max_output_size[0]) || (dem_size[1] > opt.max_output_size[1]))
-      vw_throw(ArgumentErr()
-                << "Requested DEM size is too large, max allowed output size is "
-                << opt.max_output_size << " pixels.\n");
+    check_dem_size(opt, dem_size);
 
-    asp::save_image(opt, dem, georef, hole_fill_len, "DEM");
+    // Holes are filled after the DEM is written, by tiles
+    asp::save_image(opt, dem, georef, 0, "DEM");
+    if (opt.dem_hole_fill_len > 0)
+      fill_dem_holes(opt, georef);
     sw2.stop();
     vw_out(DebugMessage,"asp") << "DEM render time: " << sw2.elapsed_seconds() << ".\n";
 
-    double num_invalid_pixelsD = *num_invalid_pixels;
-
-    // This is to compensate for the fact that for fsaa > 1 we use a
-    // finer rendering grid than the final one. Later a blur and a
-    // resampling to the original grid will happen, so the actual
-    // count is not as simple as what we do here, but this may be good
-    // enough since the fsaa option is not the default and may need
-    // wiping at some point.
-    if (opt.fsaa > 1)
-      num_invalid_pixelsD = num_invalid_pixelsD / double(opt.fsaa) / double(opt.fsaa);
-    
-    // Below we convert to double first and multiply later, to avoid
-    // 32-bit integer overflow.
-    double num_total_pixels = double(dem_size[0])*double(dem_size[1]);
-
-    double invalid_ratio = num_invalid_pixelsD / num_total_pixels;
-    vw_out() << "Percentage of valid pixels: " << 100.0*(1.0 - invalid_ratio) << "%\n";
-    *num_invalid_pixels = 0; // Reset this count
+    report_valid_pixels(opt, dem_size, rasterizer, num_invalid_pixels);
   }
 
   // Write triangulation error image if requested
-  if (opt.do_error) {
+  if (opt.do_error && !fused_err) {
     int num_channels = asp::num_channels(opt.pointcloud_files);
 
     int hole_fill_len = 0;
@@ -981,21 +1363,13 @@ void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
   }
 
   // Write out a normalized version of the DEM, if requested (for debugging)
-  if (opt.do_normalize) {
-    int hole_fill_len = 0;
-    DiskImageView< PixelGray<float> > dem_image(opt.out_prefix + "-DEM." + opt.output_file_type);
-    asp::save_image(opt, apply_mask(channel_cast<uint8>
-                                    (normalize(create_mask(dem_image,opt.nodata_value),
-                                               rasterizer.bounding_box().min().z(),
-                                               rasterizer.bounding_box().max().z(),
-                                               0, 255))),
-                    georef, hole_fill_len, "DEM-normalized");
-  }
+  if (opt.do_normalize)
+    save_normalized_dem(rasterizer, opt, georef);
 
   // Write DRG if the user requested and provided a texture file.
   // This must be at the end, as we may be messing with the point
   // image in irreversible ways.
-  if (opt.do_ortho) {
+  if (opt.do_ortho && !fused_drg) {
     Stopwatch sw3;
     sw3.start();
     ImageViewRef< PixelGray<float> > texture
@@ -1075,6 +1449,355 @@ void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
 } // End do_software_rasterization
 
 
+// Make the DEM and the other products at the current rasterizer spacing
+// from the ones already written at a finer spacing, which is smaller by
+// the given integer factor, without rasterizing the cloud again.
+void derive_from_finer_products(asp::OrthoRasterizerView& rasterizer,
+                                Options& opt,
+                                cartography::GeoReference& georef,
+                                std::string const& fine_prefix,
+                                cartography::GeoReference const& fine_georef,
+                                int factor) {
+
+  vw_out() << "\t-- Deriving the DEM at spacing " << rasterizer.spacing()
+           << " from the one at spacing " << rasterizer.spacing()/factor << " --\n";
+
+  set_dem_transform(rasterizer, opt, georef);
+
+  // The fine pixel at the coarse pixel (0, 0). The grids are snapped to
+  // multiples of their spacings, or both start at the --t_projwin corner,
+  // so this is an integer up to floating point error.
+  Vector2 fine_pix = fine_georef.point_to_pixel(georef.pixel_to_point(Vector2(0, 0)));
+  Vector2i offset(round(fine_pix.x()), round(fine_pix.y()));
+  if (norm_2(fine_pix - Vector2(offset)) > 1e-3)
+    vw_throw(LogicErr() << "The DEM grid at spacing " << rasterizer.spacing()
+             << " does not contain the grid points at spacing "
+             << rasterizer.spacing()/factor << ".
+");
+
+  // Make the coarse transform exactly from the fine one, rather than from
+  // the rasterizer, so that every coarse pixel center is a fine pixel
+  // center. The PixelAsArea shift of half a pixel differs between the
+  // two grids, so it is removed first and applied again at the end.
+  Matrix3x3 fine_transform = fine_georef.transform();
+  Matrix3x3 transform = fine_transform;
+  double shift = 0.0;
+  if (fine_georef.pixel_interpretation() == cartography::GeoReference::PixelAsArea)
+    shift = 0.5;
+  for (int c = 0; c < 2; c++) {
+    double center = fine_transform(c, 2) + (offset[c] + shift) * fine_transform(c, c);
+    transform(c, c) = factor * fine_transform(c, c);
+    transform(c, 2) = center - shift * transform(c, c);
+  }
+  georef.set_transform(transform);
+
+  asp::FilterType filter = asp::f_weighted_average;
+  if (opt.filter == "min") filter = asp::f_min;
+  if (opt.filter == "max") filter = asp::f_max;
+
+  int cols = rasterizer.cols(), rows = rasterizer.rows();
+  if (cols > opt.max_output_size[0] || rows > opt.max_output_size[1])
+    vw_throw(ArgumentErr()
+             << "Requested DEM size is too large, max allowed output size is "
+             << opt.max_output_size << " pixels.\n");
+
+  std::string prefix = opt.out_prefix;
+  std::vector<std::string> products;
+  products.push_back("DEM");
+  if (opt.do_error) products.push_back("IntersectionErr");
+  if (opt.do_ortho) products.push_back("DRG");
+
+  int hole_fill_len = 0; // holes were filled in the finer products
+  for (size_t k = 0; k < products.size(); k++) {
+    opt.out_prefix = fine_prefix;
+    std::string fine_file = asp::output_file_name(opt, products[k]);
+    opt.out_prefix = prefix;
+    if (!fs::exists(fine_file))
+      continue; // for example, the error image may not have been written
+
+    // Do not round the DRG, as when it is rasterized
+    double rounding_error = (products[k] == "DRG") ? 0.0 : opt.rounding_error;
+    if (get_num_channels(fine_file) == 3) { // the error in NED coordinates
+      ImageViewRef<Vector3f> coarse
+        = asp::CoarsenGridView<Vector3f>(DiskImageView<Vector3f>(fine_file), cols, rows,
+                                         offset, factor, filter, opt.nodata_value);
+      asp::save_image(opt, asp::round_image_pixels_skip_nodata(coarse, rounding_error,
+                                                               opt.nodata_value),
+                      georef, hole_fill_len, products[k]);
+    } else {
+      ImageViewRef< PixelGray<float> > coarse
+        = asp::CoarsenGridView< PixelGray<float> >
+        (DiskImageView< PixelGray<float> >(fine_file), cols, rows, offset, factor,
+         filter, opt.nodata_value);
+      asp::save_image(opt, asp::round_image_pixels_skip_nodata(coarse, rounding_error,
+                                                               opt.nodata_value),
+                      georef, hole_fill_len, products[k]);
+    }
+  }
+
+  if (opt.do_normalize)
+    save_normalized_dem(rasterizer, opt, georef);
+}
+
+// Estimate the DEM size, memory use, and run-time from a few windows
+// of the projected cloud, without rasterizing it. The memory model
+// follows the rasterizer: each thread holds the point cloud blocks
+// under a DEM tile expanded by a margin, the gridding buffers, and for
+// the median and percentile filters every value added to every cell.
+void plan_rasterization(ImageViewRef<Vector3> const& proj_points, Options const& opt) {
+
+  int pc_cols = proj_points.cols(), pc_rows = proj_points.rows();
+  if (pc_cols <= 0 || pc_rows <= 0)
+    vw_throw(ArgumentErr() << "The point cloud is empty.\n");
+
+  // Read a grid of windows aligned with the tiles of the cloud, which
+  // stereo writes with a tile size of 256, including those at the image
+  // edges. Reading whole rows instead would decode almost every tile.
+  // In each window sample every step-th pixel, for about this many samples.
+  const int win_size = 256, max_wins_per_dim = 8;
+  const double max_num_samples = 250000.0;
+  std::vector<int> win_cols, win_rows;
+  for (int dim = 0; dim < 2; dim++) {
+    int len = (dim == 0) ? pc_cols : pc_rows;
+    int num_tiles = (len + win_size - 1) / win_size;
+    int num_wins = std::min(num_tiles, max_wins_per_dim);
+    std::vector<int> & starts = (dim == 0) ? win_cols : win_rows;
+    for (int k = 0; k < num_wins; k++) {
+      int tile = (num_wins == 1) ? 0 : int(round(double(k) * (num_tiles - 1) / (num_wins - 1)));
+      starts.push_back(tile * win_size);
+    }
+  }
+  double num_read = 0;
+  for (size_t i = 0; i < win_cols.size(); i++)
+    for (size_t j = 0; j < win_rows.size(); j++)
+      num_read += double(std::min(win_size, pc_cols - win_cols[i])) *
+        std::min(win_size, pc_rows - win_rows[j]);
+  int step = std::max(1, int(ceil(sqrt(num_read / max_num_samples))));
+
+  Stopwatch sw;
+  sw.start();
+  std::vector<ImageView<Vector3>> sampled_wins;
+  for (size_t j = 0; j < win_rows.size(); j++) {
+    for (size_t i = 0; i < win_cols.size(); i++) {
+      BBox2i win(win_cols[i], win_rows[j], std::min(win_size, pc_cols - win_cols[i]),
+                 std::min(win_size, pc_rows - win_rows[j]));
+      ImageView<Vector3> full_win = crop(proj_points, win);
+      ImageView<Vector3> sampled_win((win.width() + step - 1)/step,
+                                     (win.height() + step - 1)/step);
+      for (int row = 0; row < sampled_win.rows(); row++)
+        for (int col = 0; col < sampled_win.cols(); col++)
+          sampled_win(col, row) = full_win(col*step, row*step);
+      sampled_wins.push_back(sampled_win);
+    }
+  }
+  sw.stop();
+  // The projection time per cloud pixel. The windows were computed in full.
+  double read_time = sw.elapsed_seconds() / std::max(num_read, 1.0);
+
+  // The extent, valid fraction, and the size of a cloud pixel in
+  // projected units, measured between neighboring samples, as in the
+  // rasterizer, which takes the median. The extent is from the windows,
+  // so it is approximate.
+  BBox2 box;
+  std::vector<double> vx, vy;
+  double num_samples = 0, num_valid = 0;
+  for (size_t w = 0; w < sampled_wins.size(); w++) {
+    ImageView<Vector3> const& s = sampled_wins[w];
+    for (int r = 0; r < s.rows(); r++) {
+      for (int c = 0; c < s.cols(); c++) {
+        num_samples++;
+        Vector3 p = s(c, r);
+        if (boost::math::isnan(p.z()))
+          continue;
+        num_valid++;
+        box.grow(subvector(p, 0, 2));
+        if (c + 1 < s.cols() && r + 1 < s.rows()) {
+          Vector3 q1 = s(c + 1, r), q2 = s(c, r + 1);
+          if (boost::math::isnan(q1.z()) || boost::math::isnan(q2.z()))
+            continue;
+          BBox2 pix_box;
+          pix_box.grow(subvector(p, 0, 2));
+          pix_box.grow(subvector(q1, 0, 2));
+          pix_box.grow(subvector(q2, 0, 2));
+          vx.push_back(pix_box.width()/step);
+          vy.push_back(pix_box.height()/step);
+        }
+      }
+    }
+  }
+  if (num_valid == 0 || vx.empty())
+    vw_throw(ArgumentErr() << "Too few valid points were sampled to make a plan.\n");
+  std::sort(vx.begin(), vx.end());
+  std::sort(vy.begin(), vy.end());
+  double pc_spacing = std::max(vx[vx.size()/2], vy[vy.size()/2]);
+
+  if (opt.target_projwin != BBox2())
+    box.crop(opt.target_projwin);
+  double valid_fraction = num_valid/num_samples;
+  double num_pc_pixels = double(pc_cols) * double(pc_rows);
+
+  int tile_size = opt.raster_tile_size[0];
+  int margin = (int)ceil(std::max(opt.search_radius_factor, 5.0));
+  bool keep_vals = (opt.filter == "median" || opt.filter == "stddev" ||
+                    opt.filter == "nmad" || opt.filter.find("-pct") != std::string::npos);
+  int num_threads = opt.num_threads;
+  if (num_threads <= 0)
+    num_threads = vw_settings().default_num_threads();
+  double cache_bytes = double(vw_settings().system_cache_size());
+
+  // Bytes per DEM pixel of a tile with its margin: the gridding buffers
+  // and the result. Bytes per cloud pixel: the point and its copy, the
+  // texture, the error, and that the cloud blocks are snapped to a
+  // grid, so about twice as many are read as needed.
+  const double bytes_per_dem_pix = 2*sizeof(double) + 2*sizeof(float);
+  const double bytes_per_cloud_pix = 2.0 * (2*sizeof(Vector3) + sizeof(float) + sizeof(double));
+  const double bytes_per_val = sizeof(double) + sizeof(vw::int32);
+  double mb = 1024.0*1024.0;
+  std::vector<int> candidate_tile_sizes;
+  for (int t = tile_size; t >= 64; t /= 2)
+    candidate_tile_sizes.push_back(t);
+
+  // The available memory, if it can be found
+  double avail_bytes = 0;
+  std::ifstream meminfo("/proc/meminfo");
+  std::string key;
+  double val = 0;
+  std::string unit;
+  while (meminfo >> key >> val >> unit) {
+    if (key == "MemAvailable:") {
+      avail_bytes = val * 1024.0;
+      break;
+    }
+  }
+
+  vw_out() << "Plan, from " << num_samples << " samples of the cloud, in "
+           << sampled_wins.size() << " windows, one every " << step
+           << " pixels and rows:\n";
+  vw_out() << "  Valid points:           " << 100.0 * valid_fraction << "%\n";
+  vw_out() << "  Cloud pixel size:       " << pc_spacing << "\n";
+  vw_out() << "  Filter:                 " << opt.filter << "\n";
+
+  // Each DEM spacing makes its own DEM, so plan for each
+  for (size_t sp = 0; sp < opt.dem_spacing.size(); sp++) {
+
+    double spacing = opt.dem_spacing[sp];
+    if (spacing <= 0)
+      spacing = pc_spacing * opt.default_grid_size_multiplier;
+    double dem_cols = ceil(box.width()/spacing) + 1, dem_rows = ceil(box.height()/spacing) + 1;
+
+    // The DEM tiles which have samples. The windows miss most of the
+    // cloud, so this is only a lower bound. The estimate is from the
+    // ground area of the valid cloud pixels, which is about one cloud
+    // pixel size squared each.
+    std::set<std::pair<int, int>> tiles;
+    for (size_t w = 0; w < sampled_wins.size(); w++) {
+      ImageView<Vector3> const& s = sampled_wins[w];
+      for (int r = 0; r < s.rows(); r++) {
+        for (int c = 0; c < s.cols(); c++) {
+          Vector3 p = s(c, r);
+          if (boost::math::isnan(p.z()) || !box.contains(subvector(p, 0, 2)))
+            continue;
+          int tx = int((p.x() - box.min().x())/spacing) / tile_size;
+          int ty = int((box.max().y() - p.y())/spacing) / tile_size;
+          tiles.insert(std::make_pair(tx, ty));
+        }
+      }
+    }
+    double num_tiles = ceil(dem_cols/tile_size) * ceil(dem_rows/tile_size);
+    double tile_area = pow(tile_size * spacing, 2);
+    double est_tiles = valid_fraction * num_pc_pixels * pc_spacing * pc_spacing / tile_area;
+    est_tiles = std::min(num_tiles, std::max(double(tiles.size()), ceil(est_tiles)));
+
+    // The memory per thread. Each tile is expanded by a margin as in
+    // OrthoRasterizerView::prerasterize().
+    double search_radius = (opt.search_radius_factor <= 0.0) ?
+      std::max(spacing, pc_spacing) : spacing * opt.search_radius_factor;
+    double cells_per_point = std::max(1.0, M_PI * pow(search_radius/spacing, 2));
+    double pts_per_dem_pix = pow(spacing/pc_spacing, 2) * valid_fraction;
+    std::vector<double> per_thread_bytes;
+    for (size_t i = 0; i < candidate_tile_sizes.size(); i++) {
+      double padded = pow(candidate_tile_sizes[i] + 2.0*margin, 2);
+      double bytes = padded * (bytes_per_dem_pix + pts_per_dem_pix * bytes_per_cloud_pix);
+      if (keep_vals)
+        bytes += padded * pts_per_dem_pix * cells_per_point * 2 * bytes_per_val;
+      per_thread_bytes.push_back(bytes);
+    }
+    double peak_bytes = cache_bytes + num_threads * per_thread_bytes[0];
+
+    // The gridding time per point, measured by adding the sampled points
+    // to a grid, repeatedly, until enough time has been spent
+    int grid_width = std::min(dem_cols, 2048.0), grid_height = std::min(dem_rows, 2048.0);
+    ImageView<double> buffer, weights;
+    asp::Point2Grid grid(grid_width, grid_height, buffer, weights,
+                         box.min().x(), box.min().y(), spacing, pc_spacing, search_radius,
+                         opt.sigma_factor, keep_vals ? asp::f_median : asp::f_weighted_average,
+                         0.0);
+    grid.Clear(opt.nodata_value);
+    double num_added = 0;
+    Stopwatch sw2;
+    sw2.start();
+    while (num_added < 1e+6 && sw2.elapsed_seconds() < 2.0) {
+      for (size_t w = 0; w < sampled_wins.size(); w++) {
+        ImageView<Vector3> const& s = sampled_wins[w];
+        for (int r = 0; r < s.rows(); r++) {
+          for (int c = 0; c < s.cols(); c++) {
+            Vector3 p = s(c, r);
+            if (boost::math::isnan(p.z()))
+              continue;
+            // Map into the grid, so that each point has a full footprint
+            double x = box.min().x() + fmod(p.x() - box.min().x(), grid_width*spacing);
+            double y = box.min().y() + fmod(p.y() - box.min().y(), grid_height*spacing);
+            grid.AddPoint(x, y, p.z());
+            num_added++;
+          }
+        }
+      }
+      sw2.stop();
+      sw2.start();
+    }
+    grid.normalize();
+    sw2.stop();
+    double grid_time = sw2.elapsed_seconds() / std::max(num_added, 1.0);
+
+    // Each cloud pixel is projected once per DEM tile that it is under,
+    // with the margins, and each valid point is gridded the same number of times.
+    double overlap = pow((tile_size + 2.0*margin)/tile_size, 2);
+    double run_time = overlap * num_pc_pixels * (read_time + valid_fraction * grid_time)
+      / num_threads;
+
+    vw_out() << "  DEM spacing:            " << spacing << "\n";
+    vw_out() << "  DEM size:               " << dem_cols << " x " << dem_rows << " pixels\n";
+    vw_out() << "  Non-empty DEM tiles:    about " << est_tiles << " of " << num_tiles
+             << ", at least " << tiles.size() << ", with tiles of size " << tile_size << "\n";
+    vw_out() << "  Memory per thread:      " << per_thread_bytes[0]/mb << " MB\n";
+    vw_out() << "  Peak memory:            " << peak_bytes/mb << " MB, with "
+             << num_threads << " thread(s) and a cache of " << cache_bytes/mb << " MB\n";
+    vw_out() << "  Approximate run-time:   " << run_time << " seconds\n";
+
+    // Suggest the largest tile and the most threads which fit in the
+    // available memory
+    if (avail_bytes <= 0) {
+      vw_out() << "Could not find the available memory, so no settings are suggested.\n";
+      continue;
+    }
+    int max_threads = std::max(1, int(std::thread::hardware_concurrency()));
+    double usable_bytes = 0.8 * avail_bytes - cache_bytes;
+    for (size_t i = 0; i < candidate_tile_sizes.size(); i++) {
+      int threads = std::min(max_threads, int(usable_bytes / per_thread_bytes[i]));
+      if (threads >= std::min(max_threads, 4) || i + 1 == candidate_tile_sizes.size()) {
+        threads = std::max(threads, 1);
+        vw_out() << "  Available memory:       " << avail_bytes/mb << " MB\n";
+        vw_out() << "Suggested settings: --threads " << threads << " --tile-size "
+                 << candidate_tile_sizes[i] << " " << candidate_tile_sizes[i] << "\n";
+        if (usable_bytes < per_thread_bytes[i])
+          vw_out(WarningMessage) << "Even one thread may run out of memory. Consider "
+                                 << "a coarser spacing or a smaller --cache-size-mb.\n";
+        break;
+      }
+    }
+  }
+}
+
 // Wrapper for do_software_rasterization that goes through all spacing values
 void do_software_rasterization_multi_spacing(const ImageViewRef<Vector3>& proj_points,
                                              Options& opt,
@@ -1098,6 +1821,26 @@ void do_software_rasterization_multi_spacing(const ImageViewRef<Vector3>& proj_p
   //  the original rasterizer object otherwise for some reason.
   std::int64_t num_invalid_pixels = 0;
   
+  // The index of the point cloud sub-blocks can be saved and reused if
+  // the input clouds and the way they are projected are the same.
+  std::string pc_index_file, pc_index_key;
+  if (opt.reuse_pc_index && !opt.has_las_or_csv_or_pcd) {
+    pc_index_file = fs::path(opt.pointcloud_files[0]).replace_extension("").string()
+      + "-index.bin";
+    std::ostringstream os;
+    os.precision(17);
+    for (size_t i = 0; i < opt.pointcloud_files.size(); i++) {
+      std::string const& file = opt.pointcloud_files[i];
+      os << fs::absolute(file).string() << " " << fs::file_size(file) << " "
+         << fs::last_write_time(file) << "\n";
+    }
+    os << georef << "\n"
+       << opt.phi_rot << " " << opt.omega_rot << " " << opt.kappa_rot << " " << opt.rot_order
+       << " " << opt.lon_offset << " " << opt.lat_offset << " " << opt.height_offset << " "
+       << outlier_removal_method << " " << opt.remove_outliers_params;
+    pc_index_key = os.str();
+  }
+
   asp::OrthoRasterizerView
     rasterizer(proj_points.impl(), select_channel(proj_points.impl(),2),
                opt.search_radius_factor, opt.sigma_factor, opt.use_surface_sampling,
@@ -1108,6 +1851,7 @@ void do_software_rasterization_multi_spacing(const ImageViewRef<Vector3>& proj_p
                opt.median_filter_params, opt.erode_len, opt.has_las_or_csv_or_pcd,
                opt.filter, opt.default_grid_size_multiplier,
                &num_invalid_pixels, &count_mutex,
+               pc_index_file, pc_index_key,
                TerminalProgressCallback("asp","QuadTree: "));
 
   sw1.stop();
@@ -1120,8 +1864,37 @@ void do_software_rasterization_multi_spacing(const ImageViewRef<Vector3>& proj_p
 
   std::string base_out_prefix = opt.out_prefix;
 
+  // See if the products at coarser spacings can be made from the ones
+  // at the finest spacing. That is done by averaging, or with the min
+  // or max, so it works only for these filters. The resulting spacings
+  // are found first, as a spacing of 0 means it is computed automatically.
+  size_t num_spacings = opt.dem_spacing.size();
+  std::vector<double> spacings(num_spacings);
+  for (size_t i = 0; i < num_spacings; i++) {
+    rasterizer.initialize_spacing(opt.dem_spacing[i]);
+    spacings[i] = rasterizer.spacing();
+  }
+  bool derive = (opt.derive_coarser_dems && num_spacings > 1 && !opt.no_dem &&
+                 opt.fsaa <= 1 && !opt.use_surface_sampling && !opt.has_alpha &&
+                 (opt.filter == "weighted_average" || opt.filter == "mean" ||
+                  opt.filter == "min" || opt.filter == "max"));
+  if (opt.derive_coarser_dems && !derive)
+    vw_out(WarningMessage) << "Cannot use --derive-coarser-dems with the current options. "
+                           << "Will rasterize the cloud at each spacing.\n";
+
+  // Process the finest spacing first
+  std::vector<size_t> order(num_spacings);
+  for (size_t i = 0; i < num_spacings; i++)
+    order[i] = i;
+  size_t finest = std::min_element(spacings.begin(), spacings.end()) - spacings.begin();
+  if (derive)
+    std::swap(order[0], order[finest]);
+  std::string fine_prefix;
+  cartography::GeoReference fine_georef;
+
   // Call the function for each dem spacing
-  for (size_t i = 0; i < opt.dem_spacing.size(); i++) {
+  for (size_t it = 0; it < num_spacings; it++) {
+    size_t i = order[it];
     double this_spacing = opt.dem_spacing[i];
 
     // Required second init step for each spacing
@@ -1132,8 +1905,21 @@ void do_software_rasterization_multi_spacing(const ImageViewRef<Vector3>& proj_p
       opt.out_prefix = base_out_prefix;
     else // Write later iterations to a different path.
       opt.out_prefix = base_out_prefix + "_" + vw::num_to_str(i);
+
+    // The ratio of this spacing to the finest one
+    double ratio = spacings[i]/spacings[finest];
+    int factor = (int)round(ratio);
+    if (derive && it > 0 && factor > 1 && std::abs(ratio - factor) < 1e-6*ratio) {
+      derive_from_finer_products(rasterizer, opt, georef, fine_prefix, fine_georef, factor);
+      continue;
+    }
+
     do_software_rasterization(rasterizer, opt, georef, error_image,
                               estim_max_error, &num_invalid_pixels);
+    if (it == 0) {
+      fine_prefix = opt.out_prefix;
+      fine_georef = georef;
+    }
   } // End loop through spacings
 
   opt.out_prefix = base_out_prefix; // Restore the original value
@@ -1273,6 +2059,11 @@ int main(int argc, char *argv[]) {
                                       output_georef);
     }
 
+    if (opt.plan) {
+      plan_rasterization(proj_points, opt);
+      return 0;
+    }
+
     // TODO(oalexan1): The proj box estimation should happen even when
     // we don't have the intersection error, such as when reading a
     // las or csv file.
@@ -19,6 +19,8 @@
 /// \file point2las.cc
 ///
 
+#include <algorithm>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
 #include <string>
@@ -27,10 +29,12 @@
 
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/MortonCode.h>
 #include <asp/Core/PointUtils.h>
 
 #include <vw/Cartography/PointImageManipulation.h>
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Math/Statistics.h>
 
 using namespace vw;
@@ -246,11 +250,135 @@ void find_error_image_and_do_stats(Options& opt, ImageViewRef<double> & error_im
            << opt.max_valid_triangulation_error << "." << std::endl;
 }
 
+// Points are converted in square tiles of the cloud, in parallel, and
+// written in order. Each wave of tiles is converted while the previous
+// one is written, so memory stays bounded by two waves.
+const int LAS_TILE_SIZE = 256;
+
+// The points of one tile of the cloud, ready to write
+struct LasTile {
+  std::vector<Vector3>       points;
+  std::vector<std::uint16_t> intensities; // empty unless saving errors
+  long long int              num_total;   // valid points, before removing outliers
+  std::string                error;       // set if the conversion failed
+  LasTile(): num_total(0) {}
+};
+
+// Sort the points of a tile along a Z-order (Morton) curve in x and y,
+// so nearby points are stored near each other in the file
+void morton_sort(LasTile & tile) {
+  size_t num = tile.points.size();
+  if (num < 2)
+    return;
+
+  BBox2 box;
+  for (size_t i = 0; i < num; i++)
+    box.grow(subvector(tile.points[i], 0, 2));
+  double dx = std::max(box.width(),  1e-16);
+  double dy = std::max(box.height(), 1e-16);
+
+  std::vector<std::pair<std::uint64_t, size_t>> codes(num);
+  for (size_t i = 0; i < num; i++) {
+    std::uint32_t x = std::uint32_t(65535.0 * (tile.points[i][0] - box.min().x()) / dx);
+    std::uint32_t y = std::uint32_t(65535.0 * (tile.points[i][1] - box.min().y()) / dy);
+    codes[i] = std::make_pair(asp::morton_code_2d(x, y), i);
+  }
+  std::sort(codes.begin(), codes.end());
+
+  std::vector<Vector3> points(num);
+  std::vector<std::uint16_t> intensities(tile.intensities.size());
+  for (size_t i = 0; i < num; i++) {
+    points[i] = tile.points[codes[i].second];
+    if (!intensities.empty())
+      intensities[i] = tile.intensities[codes[i].second];
+  }
+  tile.points.swap(points);
+  tile.intensities.swap(intensities);
+}
+
+// Convert the points of a tile of the cloud, removing invalid points and outliers
+class LasTileTask: public vw::Task, private boost::noncopyable {
+  Options const&               m_opt;
+  ImageViewRef<Vector3> const& m_point_image;
+  ImageViewRef<double>  const& m_error_image;
+  bool                         m_is_geodetic;
+  BBox2i                       m_box;
+  LasTile                    & m_tile;
+public:
+  LasTileTask(Options const& opt, ImageViewRef<Vector3> const& point_image,
+              ImageViewRef<double> const& error_image, bool is_geodetic,
+              BBox2i const& box, LasTile & tile):
+    m_opt(opt), m_point_image(point_image), m_error_image(error_image),
+    m_is_geodetic(is_geodetic), m_box(box), m_tile(tile) {}
+
+  void operator()() {
+    try {
+      bool have_errors = (m_error_image.cols() > 0 && m_error_image.rows() > 0);
+      ImageView<Vector3> points = crop(m_point_image, m_box);
+      ImageView<double> errors;
+      if (have_errors)
+        errors = crop(m_error_image, m_box);
+
+      for (int row = 0; row < points.rows(); row++) {
+        for (int col = 0; col < points.cols(); col++) {
+
+          Vector3 point = points(col, row);
+
+          // Skip no-data points
+          bool is_good = ( (!m_is_geodetic && point != vw::Vector3()) ||
+                           (m_is_geodetic  && !boost::math::isnan(point.z())) );
+          if (!is_good) continue;
+
+          m_tile.num_total++;
+
+          double error = have_errors ? errors(col, row) : 0.0;
+          if (m_opt.max_valid_triangulation_error > 0.0 &&
+              error > m_opt.max_valid_triangulation_error)
+            continue;
+
+          m_tile.points.push_back(point);
+
+          if (m_opt.triangulation_error_factor > 0.0) {
+            // Scale the triangulation error, clamp it, and save it as
+            // uint16.  The LAS 1.2 format has no fields (apart from the
+            // taken already x, y, and z) with 32-bit values, so uint16
+            // is all one can do.
+            double scaled_error = m_opt.triangulation_error_factor * error;
+            scaled_error = round(scaled_error);
+            scaled_error = std::max(scaled_error, 0.0); // should not be necessary
+            scaled_error = std::min(scaled_error,
+                                    double(std::numeric_limits<std::uint16_t>::max()));
+            m_tile.intensities.push_back(std::uint16_t(scaled_error));
+          }
+        }
+      }
+
+      morton_sort(m_tile);
+    } catch (std::exception const& e) {
+      m_tile.error = e.what();
+    }
+  }
+};
+
+// Start converting the given tiles on worker threads
+boost::shared_ptr<FifoWorkQueue>
+start_tiles(Options const& opt, ImageViewRef<Vector3> const& point_image,
+            ImageViewRef<double> const& error_image, bool is_geodetic,
+            std::vector<BBox2i> const& boxes, size_t beg, size_t end,
+            std::vector<LasTile> & tiles) {
+  tiles.clear();
+  tiles.resize(end - beg);
+  boost::shared_ptr<FifoWorkQueue>
+    queue(new FifoWorkQueue(vw_settings().default_num_threads()));
+  for (size_t i = beg; i < end; i++) {
+    boost::shared_ptr<vw::Task> task(new LasTileTask(opt, point_image, error_image,
+                                                     is_geodetic, boxes[i], tiles[i - beg]));
+    queue->add_task(task);
+  }
+  return queue;
+}
+
 int main( int argc, char *argv[] ) {
-  
-  // TODO(oalexan1): need to understand what is the optimal strategy
-  // for traversing the input point cloud file to minimize the reading
-  // time.
 
   Options opt;
   try {
@@ -334,51 +462,70 @@ int main( int argc, char *argv[] ) {
     ofs.open(lasFile.c_str(), std::ios::out | std::ios::binary);
     liblas::Writer writer(ofs, header);
 
+    // The tiles, row by row, alternating direction, so consecutive
+    // tiles are neighbors
+    std::vector<BBox2i> boxes;
+    int num_tile_cols = (point_image.cols() + LAS_TILE_SIZE - 1) / LAS_TILE_SIZE;
+    int num_tile_rows = (point_image.rows() + LAS_TILE_SIZE - 1) / LAS_TILE_SIZE;
+    for (int tr = 0; tr < num_tile_rows; tr++) {
+      for (int i = 0; i < num_tile_cols; i++) {
+        int tc = (tr % 2 == 0) ? i : num_tile_cols - 1 - i;
+        BBox2i box(tc * LAS_TILE_SIZE, tr * LAS_TILE_SIZE, LAS_TILE_SIZE, LAS_TILE_SIZE);
+        box.crop(bounding_box(point_image));
+        boxes.push_back(box);
+      }
+    }
+
     TerminalProgressCallback tpc("asp", "\t--> ");
     long long int num_total_points = 0;
     long long int num_kept_points = 0;
-    
-    for (int row = 0; row < point_image.rows(); row++){
-      tpc.report_fractional_progress(row, point_image.rows());
-      for (int col = 0; col < point_image.cols(); col++){
-
-        Vector3 point = point_image(col, row);
-
-        // Skip no-data points
-        bool is_good = ( (!is_geodetic && point != vw::Vector3()) ||
-                         (is_geodetic  && !boost::math::isnan(point.z())) );
-        if (!is_good) continue;
 
-        num_total_points++;
-        
-        if (opt.max_valid_triangulation_error > 0.0 &&
-            error_image(col, row) > opt.max_valid_triangulation_error) 
-          continue;
+    size_t wave_size = std::max(4 * vw_settings().default_num_threads(), 1);
+    std::vector<LasTile> curr_tiles, next_tiles;
+    boost::shared_ptr<FifoWorkQueue> next_queue
+      = start_tiles(opt, point_image, error_image, is_geodetic, boxes,
+                    0, std::min(wave_size, boxes.size()), next_tiles);
+    for (size_t beg = 0; beg < boxes.size(); beg += wave_size) {
+
+      next_queue->join_all();
+      curr_tiles.swap(next_tiles);
+
+      // Convert the next wave while this one is written
+      size_t next_beg = beg + wave_size;
+      if (next_beg < boxes.size())
+        next_queue = start_tiles(opt, point_image, error_image, is_geodetic, boxes,
+                                 next_beg, std::min(next_beg + wave_size, boxes.size()),
+                                 next_tiles);
+
+      for (size_t i = 0; i < curr_tiles.size(); i++) {
+        LasTile & tile = curr_tiles[i];
+        if (!tile.error.empty()) {
+          next_queue->join_all(); // the workers must not outlive the tiles
+          vw_throw(ArgumentErr() << "Failed to convert the points in box "
+                   << boxes[beg + i] << ": " << tile.error << "\n");
+        }
 
-        num_kept_points++;
+        num_total_points += tile.num_total;
+        num_kept_points  += tile.points.size();
 #if 0
         // For comparison later with las2txt.
         std::cout.precision(16);
-        std::cout << "\npoint " << point[0] << ' ' << point[1] << ' '
-                  << point[2] << std::endl;
+        for (size_t p = 0; p < tile.points.size(); p++)
+          std::cout << "\npoint " << tile.points[p][0] << ' ' << tile.points[p][1] << ' '
+                    << tile.points[p][2] << std::endl;
 #endif
-
-        liblas::Point las_point(&header);
-        las_point.SetCoordinates(point[0], point[1], point[2]);
-
-        if (opt.triangulation_error_factor > 0.0) {
-          // Scale the triangulation error, clamp it, and save it as
-          // uint16.  The LAS 1.2 format has no fields (apart from the
-          // taken already x, y, and z) with 32-bit values, so uint16
-          // is all one can do.
-          double scaled_error = opt.triangulation_error_factor * error_image(col, row);
-          scaled_error = round(scaled_error);
-          scaled_error = std::max(scaled_error, 0.0); // should not be necessary
-          scaled_error = std::min(scaled_error, double(std::numeric_limits<std::uint16_t>::max()));
-          las_point.SetIntensity(std::uint16_t(scaled_error));
+        for (size_t p = 0; p < tile.points.size(); p++) {
+          liblas::Point las_point(&header);
+          las_point.SetCoordinates(tile.points[p][0], tile.points[p][1], tile.points[p][2]);
+          if (!tile.intensities.empty())
+            las_point.SetIntensity(tile.intensities[p]);
+          writer.WritePoint(las_point);
         }
-          
-        writer.WritePoint(las_point);
+
+        // Free the memory as soon as possible
+        std::vector<Vector3>().swap(tile.points);
+        std::vector<std::uint16_t>().swap(tile.intensities);
+        tpc.report_fractional_progress(beg + i + 1, boxes.size());
       }
     }
     tpc.report_finished();
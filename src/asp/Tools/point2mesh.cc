@@ -26,6 +26,13 @@
 #include <stddef.h>
 #include <math.h>
 #include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
+
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
 
 #include <vw/Image/Transform.h>
 #include <vw/Cartography/PointImageManipulation.h>
@@ -45,7 +52,7 @@ struct Options : vw::GdalWriteOptions {
   std::string pointcloud_filename, texture_file_name;
 
   // Settings
-  int point_cloud_step_size, texture_step_size, precision;
+  int point_cloud_step_size, texture_step_size, precision, obj_chunk_rows;
   bool center;
 
   // Output
@@ -97,113 +104,227 @@ inline bool is_valid_pt(Vector3 const& P) {
   return true;
 }
 
-// Add a given vertex to the .obj file unless already present
-inline void add_vertex(Vector3 const& V, std::pair<int, int> const& pix,
-                       int cloud_cols, int cloud_rows,
-                       std::ofstream & ofs,
-                       std::map<std::pair<int, int>, int> & pix_to_vertex,
-                       int & vertex_count) {
-  if (pix_to_vertex.find(pix) == pix_to_vertex.end()) {
-    ofs << "v " << V[0] << " " << V[1] << " " << V[2] << '\n';
+// Write the vertices and faces of a mesh as they are formed. Vertices
+// are numbered in the order they are added, starting from 0.
+class MeshWriter {
+public:
+  virtual ~MeshWriter() {}
+  virtual void add_vertex(Vector3 const& V, Vector2 const& uv) = 0;
+  virtual void add_face(std::uint32_t i0, std::uint32_t i1, std::uint32_t i2) = 0;
+  virtual void finish() = 0;
+};
 
-    double u = double(pix.first)/cloud_cols;
-    
-    // TODO(oalexan1). Study this. The second option looks more accurate.
-    // In the second option the lower-left pixel (0, cloud_rows - 1)
-    // gets mapped to (u, v) = (0, 0). This seems correct per:
-    // https://computergraphics.stackexchange.com/questions/9339/convert-image-pixel-dimensions-to-uv
-    // In some places on the net I even saw a subpixel shift of (0.5, 0.5)
-    // which makes things even more complicated.
-#if 0
-    double v = double(pix.second)/cloud_rows;
-    ofs << "vt " << u  << ' ' << 1.0 - v << std::endl;
-#else
-    double v = double(cloud_rows - 1 - pix.second)/cloud_rows;
-    ofs << "vt " << u  << ' ' << v << std::endl;
-#endif
-    
-    pix_to_vertex[pix] = vertex_count;
-    vertex_count++;
+// Text OBJ, with texture coordinates, and indices starting from 1
+class ObjWriter: public MeshWriter {
+  std::ofstream m_ofs;
+public:
+  ObjWriter(std::string const& mesh_file, std::string const& output_prefix_no_dir,
+            int precision) {
+    std::cout << "Writing: " << mesh_file << std::endl;
+    m_ofs.open(mesh_file.c_str());
+    if (!m_ofs)
+      vw_throw(IOErr() << "Could not open for writing: " << mesh_file << "\n");
+    m_ofs.precision(precision);
+    m_ofs << "mtllib " << output_prefix_no_dir << ".mtl\n";
   }
-}
+  virtual void add_vertex(Vector3 const& V, Vector2 const& uv) {
+    m_ofs << "v " << V[0] << " " << V[1] << " " << V[2] << '\n';
+    m_ofs << "vt " << uv[0] << ' ' << uv[1] << '\n';
+  }
+  virtual void add_face(std::uint32_t i0, std::uint32_t i1, std::uint32_t i2) {
+    i0++; i1++; i2++; // The obj spec calls for the starting vertex to have index 1.
+    m_ofs << "f "
+          << i0 << "/" << i0 << " "
+          << i1 << "/" << i1 << " "
+          << i2 << "/" << i2 << '\n';
+  }
+  virtual void finish() {
+    m_ofs.close();
+  }
+};
 
-void save_mesh(std::string const& output_prefix,
-               std::string const& output_prefix_no_dir,
-               ImageViewRef<Vector3> point_cloud,
-               Vector3 C, int precision) {
+// Binary PLY. The header needs the number of vertices and faces, so these
+// are streamed to temporary files first, which are then appended to it.
+class PlyWriter: public MeshWriter {
+  std::string m_mesh_file, m_texture_file, m_vertex_file, m_face_file;
+  std::ofstream m_vertices, m_faces;
+  std::uint64_t m_num_vertices, m_num_faces;
+public:
+  PlyWriter(std::string const& mesh_file, std::string const& texture_file):
+    m_mesh_file(mesh_file), m_texture_file(texture_file),
+    m_num_vertices(0), m_num_faces(0) {
+    std::cout << "Writing: " << mesh_file << std::endl;
+    m_vertex_file = mesh_file + ".vertices.tmp";
+    m_face_file   = mesh_file + ".faces.tmp";
+    m_vertices.open(m_vertex_file.c_str(), std::ios::binary);
+    m_faces.open(m_face_file.c_str(), std::ios::binary);
+    if (!m_vertices || !m_faces)
+      vw_throw(IOErr() << "Could not open for writing: " << m_vertex_file
+               << " and " << m_face_file << "\n");
+  }
+  virtual void add_vertex(Vector3 const& V, Vector2 const& uv) {
+    double xyz[3] = {V[0], V[1], V[2]};
+    float  st[2]  = {float(uv[0]), float(uv[1])};
+    m_vertices.write((char const*)xyz, sizeof(xyz));
+    m_vertices.write((char const*)st,  sizeof(st));
+    m_num_vertices++;
+  }
+  virtual void add_face(std::uint32_t i0, std::uint32_t i1, std::uint32_t i2) {
+    std::uint8_t  len = 3;
+    std::uint32_t ids[3] = {i0, i1, i2};
+    m_faces.write((char const*)&len, sizeof(len));
+    m_faces.write((char const*)ids,  sizeof(ids));
+    m_num_faces++;
+  }
+  virtual void finish() {
+    m_vertices.close();
+    m_faces.close();
+
+    const std::uint16_t one = 1;
+    bool little_endian = (*(std::uint8_t const*)&one == 1);
+
+    std::ofstream ofs(m_mesh_file.c_str(), std::ios::binary);
+    ofs << "ply\n"
+        << "format " << (little_endian ? "binary_little_endian" : "binary_big_endian")
+        << " 1.0\n"
+        << "comment TextureFile " << m_texture_file << "\n"
+        << "element vertex " << m_num_vertices << "\n"
+        << "property double x\nproperty double y\nproperty double z\n"
+        << "property float s\nproperty float t\n"
+        << "element face " << m_num_faces << "\n"
+        << "property list uchar uint vertex_indices\n"
+        << "end_header\n";
+    {
+      std::ifstream vertices(m_vertex_file.c_str(), std::ios::binary);
+      if (m_num_vertices > 0)
+        ofs << vertices.rdbuf();
+      std::ifstream faces(m_face_file.c_str(), std::ios::binary);
+      if (m_num_faces > 0)
+        ofs << faces.rdbuf();
+    }
+    ofs.close();
+    if (!ofs)
+      vw_throw(IOErr() << "Could not write: " << m_mesh_file << "\n");
 
-  std::string mesh_file = output_prefix + ".obj";
-  std::cout << "Writing: " << mesh_file << std::endl;
-  std::ofstream ofs(mesh_file.c_str());
-  ofs.precision(precision);
-  ofs << "mtllib " << output_prefix_no_dir << ".mtl\n";
+    boost::filesystem::remove(m_vertex_file);
+    boost::filesystem::remove(m_face_file);
+  }
+};
 
-  // Some constants for the calculation in here
+// Mesh the cloud between the given pixel rows, inclusive. The cloud is
+// read in strips of rows, and the vertices of a row are numbered as they
+// are first used, so only the vertex indices of two rows are kept.
+void mesh_rows(ImageViewRef<Vector3> point_cloud, Vector3 const& C,
+               int beg_row, int end_row,
+               MeshWriter & writer, TerminalProgressCallback & progress) {
+
+  const int strip_rows = 256;
   int cloud_cols = point_cloud.cols();
   int cloud_rows = point_cloud.rows();
-  
-  TerminalProgressCallback vertex_progress("asp", "\tVertices:   ");
-  double vertex_progress_mult = 1.0/double(std::max(cloud_cols - 1, 1));
 
-  // Make sure we we save a vertex only once even if we encounter it
-  // multiple times.
-  std::map<std::pair<int, int>, int> pix_to_vertex;
-    
-  std::vector<Vector3i> faces;
-  int vertex_count = 1; // The obj spec calls for the starting vertex to have index 1.
-  for (int col = 0; col < cloud_cols - 1; col++) {
-    vertex_progress.report_progress(col*vertex_progress_mult);
-    
-    for (int row = 0; row < cloud_rows - 1; row++) {
-      // We have a square that needs to be split into two triangles.
-      // Here the image is viewed as having the origin on the upper-left,
-      // the column axis going right, and the row axis going down.
-      std::pair<int, int> pix_ul = std::make_pair(col,     row);
-      std::pair<int, int> pix_ur = std::make_pair(col + 1, row);
-      std::pair<int, int> pix_ll = std::make_pair(col,     row + 1);
-      std::pair<int, int> pix_lr = std::make_pair(col + 1, row + 1);
-      Vector3 UL = point_cloud(pix_ul.first, pix_ul.second);
-      Vector3 UR = point_cloud(pix_ur.first, pix_ur.second);
-      Vector3 LL = point_cloud(pix_ll.first, pix_ll.second);
-      Vector3 LR = point_cloud(pix_lr.first, pix_lr.second);
-
-      if (is_valid_pt(UL) && is_valid_pt(LL) && is_valid_pt(UR)) {
-
-        add_vertex(UL - C, pix_ul, cloud_cols, cloud_rows, ofs, pix_to_vertex, vertex_count);
-        add_vertex(LL - C, pix_ll, cloud_cols, cloud_rows, ofs, pix_to_vertex, vertex_count);
-        add_vertex(UR - C, pix_ur, cloud_cols, cloud_rows, ofs, pix_to_vertex, vertex_count);
-
-        Vector3 face(pix_to_vertex[pix_ul], pix_to_vertex[pix_ll], pix_to_vertex[pix_ur]);
-        faces.push_back(face);
+  // The texture coordinates of a pixel.
+  // TODO(oalexan1). Study this. The second option looks more accurate.
+  // In the second option the lower-left pixel (0, cloud_rows - 1)
+  // gets mapped to (u, v) = (0, 0). This seems correct per:
+  // https://computergraphics.stackexchange.com/questions/9339/convert-image-pixel-dimensions-to-uv
+  // In some places on the net I even saw a subpixel shift of (0.5, 0.5)
+  // which makes things even more complicated. The first option was:
+  // u = col/cloud_cols, v = 1 - row/cloud_rows.
+  auto uv = [cloud_cols, cloud_rows](int col, int row) {
+    return Vector2(double(col)/cloud_cols, double(cloud_rows - 1 - row)/cloud_rows);
+  };
+
+  // The vertex index of each pixel in the upper and lower rows of the
+  // current cells, or -1 if not added yet
+  std::vector<std::int64_t> upper(cloud_cols, -1), lower(cloud_cols, -1);
+  std::int64_t vertex_count = 0;
+  auto vertex = [&](std::vector<std::int64_t> & ids, int col, int row, Vector3 const& P) {
+    if (ids[col] < 0) {
+      if (vertex_count > std::int64_t(std::numeric_limits<std::uint32_t>::max()))
+        vw_throw(ArgumentErr() << "Too many vertices for one mesh. Use a larger "
+                 << "--point-cloud-step-size, or --obj-chunk-rows.\n");
+      writer.add_vertex(P - C, uv(col, row));
+      ids[col] = vertex_count++;
+    }
+    return std::uint32_t(ids[col]);
+  };
+
+  double progress_mult = 1.0/double(std::max(cloud_rows - 1, 1));
+  for (int strip_beg = beg_row; strip_beg < end_row; strip_beg += strip_rows) {
+
+    // A strip includes the first row of the next one, so its cells are complete
+    int strip_end = std::min(strip_beg + strip_rows, end_row);
+    ImageView<Vector3> strip = crop(point_cloud, BBox2i(0, strip_beg, cloud_cols,
+                                                        strip_end - strip_beg + 1));
+
+    for (int row = strip_beg; row < strip_end; row++) {
+      progress.report_progress(row*progress_mult);
+      int r = row - strip_beg;
+
+      for (int col = 0; col < cloud_cols - 1; col++) {
+        // We have a square that needs to be split into two triangles.
+        // Here the image is viewed as having the origin on the upper-left,
+        // the column axis going right, and the row axis going down.
+        Vector3 UL = strip(col,     r);
+        Vector3 UR = strip(col + 1, r);
+        Vector3 LL = strip(col,     r + 1);
+        Vector3 LR = strip(col + 1, r + 1);
+
+        if (is_valid_pt(UL) && is_valid_pt(LL) && is_valid_pt(UR)) {
+          std::uint32_t ul = vertex(upper, col,     row,     UL);
+          std::uint32_t ll = vertex(lower, col,     row + 1, LL);
+          std::uint32_t ur = vertex(upper, col + 1, row,     UR);
+          writer.add_face(ul, ll, ur);
+        }
+
+        if (is_valid_pt(UR) && is_valid_pt(LL) && is_valid_pt(LR)) {
+          std::uint32_t ur = vertex(upper, col + 1, row,     UR);
+          std::uint32_t ll = vertex(lower, col,     row + 1, LL);
+          std::uint32_t lr = vertex(lower, col + 1, row + 1, LR);
+          writer.add_face(ur, ll, lr);
+        }
       }
-      
-      if (is_valid_pt(UR) && is_valid_pt(LL) && is_valid_pt(LR)) {
 
-        add_vertex(UR - C, pix_ur, cloud_cols, cloud_rows, ofs, pix_to_vertex, vertex_count);
-        add_vertex(LL - C, pix_ll, cloud_cols, cloud_rows, ofs, pix_to_vertex, vertex_count);
-        add_vertex(LR - C, pix_lr, cloud_cols, cloud_rows, ofs, pix_to_vertex, vertex_count);
-
-        Vector3 face(pix_to_vertex[pix_ur], pix_to_vertex[pix_ll], pix_to_vertex[pix_lr]);
-        faces.push_back(face);
-      }
-      
+      // The lower row of these cells is the upper row of the next ones
+      upper.swap(lower);
+      std::fill(lower.begin(), lower.end(), -1);
     }
   }
-  vertex_progress.report_finished();
-
-  TerminalProgressCallback face_progress("asp", "\tFaces:   ");
-  double face_progress_mult = 1.0/double(std::max(faces.size(), size_t(1)));
-  for (size_t face_iter = 0; face_iter < faces.size(); face_iter++) {
-    face_progress.report_progress(face_iter*face_progress_mult);
-
-    Vector3 const& F = faces[face_iter]; // alias
-    ofs << "f "
-        << F[0] << "/" << F[0] << " "
-        << F[1] << "/" << F[1] << " "
-        << F[2] << "/" << F[2]
-        << std::endl;
+
+}
+
+void save_mesh(Options const& opt, std::string const& output_prefix_no_dir,
+               ImageViewRef<Vector3> point_cloud, Vector3 const& C) {
+
+  int cloud_rows = point_cloud.rows();
+  int last_row = std::max(cloud_rows - 1, 0);
+  TerminalProgressCallback progress("asp", "\tMesh:   ");
+
+  if (opt.output_file_type == "ply") {
+    PlyWriter writer(opt.output_prefix + ".ply", output_prefix_no_dir + ".png");
+    mesh_rows(point_cloud, C, 0, last_row, writer, progress);
+    writer.finish();
+  } else if (opt.obj_chunk_rows <= 0) {
+    ObjWriter writer(opt.output_prefix + ".obj", output_prefix_no_dir, opt.precision);
+    mesh_rows(point_cloud, C, 0, last_row, writer, progress);
+    writer.finish();
+  } else {
+    // Each chunk is a self-contained mesh. Neighboring chunks share a row
+    // of pixels, so they have no gap in between.
+    int chunk = 0;
+    for (int beg_row = 0; beg_row < last_row; beg_row += opt.obj_chunk_rows) {
+      std::ostringstream os;
+      os << opt.output_prefix << "-chunk" << std::setw(4) << std::setfill('0') << chunk
+         << ".obj";
+      ObjWriter writer(os.str(), output_prefix_no_dir, opt.precision);
+      mesh_rows(point_cloud, C, beg_row, std::min(beg_row + opt.obj_chunk_rows, last_row),
+                writer, progress);
+      writer.finish();
+      chunk++;
+    }
   }
-  face_progress.report_finished();
+
+  progress.report_finished();
 }
 
 void handle_arguments( int argc, char *argv[], Options& opt ) {
@@ -218,7 +339,12 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("center", po::bool_switch(&opt.center)->default_value(false),
      "Let the origin be the midpoint of the bounding box of the cloud. Use this option if you are experiencing numerical precision issues.")
     ("precision", po::value(&opt.precision)->default_value(17),
-     "How many digits of precision to save.");
+     "How many digits of precision to save.")
+    ("output-file-type", po::value(&opt.output_file_type)->default_value("obj"),
+     "The mesh format. Options: obj (text), ply (binary).")
+    ("obj-chunk-rows", po::value(&opt.obj_chunk_rows)->default_value(0),
+     "If positive, split the OBJ mesh into files, each covering this many rows of the "
+     "subsampled cloud, named <output prefix>-chunkNNNN.obj.");
   
   general_options.add( vw::GdalWriteOptionsDescription(opt) );
 
@@ -256,6 +382,14 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     vw_throw(ArgumentErr() << "Precision must be positive.\n"
              << usage << general_options);
 
+  boost::to_lower(opt.output_file_type);
+  if (opt.output_file_type != "obj" && opt.output_file_type != "ply")
+    vw_throw(ArgumentErr() << "Unknown mesh format: " << opt.output_file_type << ".\n"
+             << usage << general_options);
+  if (opt.output_file_type == "ply" && opt.obj_chunk_rows > 0)
+    vw_throw(ArgumentErr() << "The option --obj-chunk-rows is only for the obj format.\n"
+             << usage << general_options);
+
   // It is useful to have this to make the p
   if (opt.point_cloud_step_size % opt.texture_step_size != 0) 
     vw_throw(ArgumentErr() << "--point-cloud-step-size must be a multiple "
@@ -332,12 +466,12 @@ int main(int argc, char *argv[]){
     boost::filesystem::path p(opt.output_prefix);
     std::string output_prefix_no_dir = p.filename().string();
   
-    save_mesh(opt.output_prefix, output_prefix_no_dir,
-              point_cloud, C, opt.precision);
+    save_mesh(opt, output_prefix_no_dir, point_cloud, C);
     
     save_texture(opt.output_prefix, texture_image);
     
-    save_mtl(opt.output_prefix, output_prefix_no_dir);
+    if (opt.output_file_type == "obj")
+      save_mtl(opt.output_prefix, output_prefix_no_dir);
     
   } ASP_STANDARD_CATCHES;
 
@@ -83,20 +83,24 @@
 #include <vw/Image/DistanceFunction.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/ThreadPool.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
 #include <vw/Core/CmdUtils.h>
 #include <asp/Sessions/StereoSessionFactory.h>
 #include <asp/IsisIO/IsisCameraModel.h>
 #include <asp/Camera/CsmModel.h>
+#include <asp/Camera/BatchProjection.h>
 #include <asp/Core/BundleAdjustUtils.h>
 #include <asp/Core/StereoSettings.h>
 #include <asp/Camera/RPCModelGen.h>
+#include <asp/Core/Tracing.h>
 #include <ceres/ceres.h>
 #include <ceres/loss_function.h>
 #include <iostream>
 #include <stdexcept>
 #include <string>
+#include <cstdint>
 #include<sys/types.h>
 
 #if defined(__GNUC__) || defined(__GNUG__)
@@ -1235,6 +1239,200 @@ void areInShadow(Vector3 & sunPos, ImageView<double> const& dem,
   }
 }
 
+// For the sweep below. Find, for a range of DEM columns, the height of
+// each grid point in a frame having the z axis pointing up at the DEM
+// center, minus its horizontal distance towards the Sun times the
+// tangent of the Sun elevation. A point is in shadow if and only if a
+// point closer to the Sun along the same line has a larger value.
+class ShadowHeightTask: public vw::Task, private boost::noncopyable {
+  ImageView<double>         const& m_dem;
+  cartography::GeoReference const& m_geo;
+  Vector3 m_ctr, m_up, m_sun_horiz;
+  double m_slope;
+  int m_beg_col, m_end_col;
+  ImageView<double> & m_height;
+public:
+  ShadowHeightTask(ImageView<double> const& dem, cartography::GeoReference const& geo,
+                   Vector3 const& ctr, Vector3 const& up, Vector3 const& sun_horiz,
+                   double slope, int beg_col, int end_col, ImageView<double> & height):
+    m_dem(dem), m_geo(geo), m_ctr(ctr), m_up(up), m_sun_horiz(sun_horiz),
+    m_slope(slope), m_beg_col(beg_col), m_end_col(end_col), m_height(height) {}
+  
+  void operator()() {
+    for (int col = m_beg_col; col < m_end_col; col++) {
+      for (int row = 0; row < m_dem.rows(); row++) {
+        Vector2 ll = m_geo.pixel_to_lonlat(Vector2(col, row));
+        Vector3 xyz = m_geo.datum().geodetic_to_cartesian(Vector3(ll[0], ll[1],
+                                                                  m_dem(col, row)));
+        Vector3 d = xyz - m_ctr;
+        m_height(col, row) = dot_prod(d, m_up) - m_slope * dot_prod(d, m_sun_horiz);
+      }
+    }
+  }
+};
+
+// Sweep a range of lines going away from the Sun, keeping the largest
+// value seen so far on each. Each step moves by one pixel along the
+// dominant axis and by a fraction of a pixel along the other one, so
+// every grid point is on exactly one line.
+class ShadowSweepTask: public vw::Task, private boost::noncopyable {
+  ImageView<double> const& m_height;
+  bool m_col_major;
+  int m_start, m_step;
+  double m_slope, m_beg_offset;
+  int m_beg_line, m_end_line;
+  ImageView<unsigned char> & m_mask;
+public:
+  ShadowSweepTask(ImageView<double> const& height, bool col_major, int start, int step,
+                  double slope, double beg_offset, int beg_line, int end_line,
+                  ImageView<unsigned char> & mask):
+    m_height(height), m_col_major(col_major), m_start(start), m_step(step), m_slope(slope),
+    m_beg_offset(beg_offset), m_beg_line(beg_line), m_end_line(end_line), m_mask(mask) {}
+  
+  void operator()() {
+    int len   = m_col_major ? m_height.cols() : m_height.rows();
+    int width = m_col_major ? m_height.rows() : m_height.cols();
+    for (int line = m_beg_line; line < m_end_line; line++) {
+      double max_height = -std::numeric_limits<double>::max();
+      for (int k = 0; k < len; k++) {
+        int u = m_start + k * m_step;
+        int v = (int)floor(m_beg_offset + line + k * m_slope + 0.5);
+        if (v < 0 || v >= width)
+          continue;
+        int col = m_col_major ? u : v;
+        int row = m_col_major ? v : u;
+        double h = m_height(col, row);
+        if (max_height > h)
+          m_mask(col, row) = 1;
+        max_height = std::max(max_height, h);
+      }
+    }
+  }
+};
+
+// Find the points on a DEM shadowed by other points of the DEM, for a
+// distant Sun, in a single pass over the DEM along the Sun direction,
+// rather than marching a ray from each point as isInShadow() does. 
+void computeShadowMask(Vector3 const& sunPos, ImageView<double> const& dem,
+                       cartography::GeoReference const& geo, int num_threads,
+                       ImageView<unsigned char> & mask) {
+
+  int cols = dem.cols(), rows = dem.rows();
+  mask.set_size(cols, rows);
+  fill(mask, 0);
+  if (cols < 2 || rows < 2)
+    return;
+
+  // The Sun direction at the DEM center, split into the vertical and
+  // horizontal components
+  Vector2 ctr_pix(cols/2, rows/2);
+  Vector2 ctr_ll = geo.pixel_to_lonlat(ctr_pix);
+  Vector3 ctr = geo.datum().geodetic_to_cartesian(Vector3(ctr_ll[0], ctr_ll[1],
+                                                          dem(cols/2, rows/2)));
+  Vector3 up = normalize(ctr);
+  Vector3 sun_dir = sunPos - ctr;
+  if (sun_dir == Vector3())
+    return;
+  sun_dir = normalize(sun_dir);
+  Vector3 sun_horiz = sun_dir - dot_prod(sun_dir, up) * up;
+  double horiz_len = norm_2(sun_horiz);
+  if (horiz_len < 1e-12)
+    return; // the Sun is overhead
+  sun_horiz /= horiz_len;
+  double slope = dot_prod(sun_dir, up) / horiz_len; // tangent of the Sun elevation
+
+  // The direction towards the Sun in DEM pixels
+  Vector2 nb_ll = geo.pixel_to_lonlat(ctr_pix + Vector2(1, 0));
+  Vector3 nb = geo.datum().geodetic_to_cartesian(Vector3(nb_ll[0], nb_ll[1],
+                                                         dem(cols/2, rows/2)));
+  double grid_len = norm_2(nb - ctr);
+  Vector3 sun_llh = geo.datum().cartesian_to_geodetic(ctr + grid_len * sun_horiz);
+  sun_llh[0] += 360.0*round((ctr_ll[0] - sun_llh[0])/360.0);
+  Vector2 pix_dir = geo.lonlat_to_pixel(Vector2(sun_llh[0], sun_llh[1])) - ctr_pix;
+  if (pix_dir == Vector2())
+    return;
+
+  if (num_threads <= 0)
+    num_threads = 1;
+  
+  ImageView<double> height(cols, rows);
+  {
+    int chunk = std::max(1, cols / (8 * num_threads));
+    FifoWorkQueue queue(num_threads);
+    for (int beg = 0; beg < cols; beg += chunk) {
+      boost::shared_ptr<ShadowHeightTask>
+        task(new ShadowHeightTask(dem, geo, ctr, up, sun_horiz, slope, beg,
+                                  std::min(beg + chunk, cols), height));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+
+  // Walk away from the Sun along the dominant axis
+  bool col_major = (std::abs(pix_dir[0]) >= std::abs(pix_dir[1]));
+  double a = col_major ? pix_dir[0] : pix_dir[1];
+  double b = col_major ? pix_dir[1] : pix_dir[0];
+  int len   = col_major ? cols : rows;
+  int width = col_major ? rows : cols;
+  int step  = (a > 0) ? -1 : 1;
+  int start = (a > 0) ? len - 1 : 0;
+  double line_slope = -b / std::abs(a);
+
+  // The lines must start far enough on either side to cover the DEM
+  double drift = (len - 1) * line_slope;
+  double beg_offset = std::min(0.0, -drift);
+  int num_lines = (int)ceil(std::max(double(width - 1), width - 1 - drift) - beg_offset) + 1;
+  {
+    int chunk = std::max(1, num_lines / (8 * num_threads));
+    FifoWorkQueue queue(num_threads);
+    for (int beg = 0; beg < num_lines; beg += chunk) {
+      boost::shared_ptr<ShadowSweepTask>
+        task(new ShadowSweepTask(height, col_major, start, step, line_slope, beg_offset,
+                                 beg, std::min(beg + chunk, num_lines), mask));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+}
+
+// A shadow mask for an image, found with computeShadowMask(), to be
+// reused until the heights or the Sun position change enough.
+struct ShadowCache {
+  ImageView<double> height; // the heights the mask was found for
+  ImageView<unsigned char> mask;
+  Vector3 sun_pos;
+
+  bool in_shadow(int col, int row) const {
+    return mask(col, row) != 0;
+  }
+};
+
+// Recompute the shadow mask if it was not found yet, or if the Sun
+// moved, or if any height changed by more than the given amount.
+// Return true if recomputed.
+bool updateShadowCache(Vector3 const& sunPos, ImageView<double> const& dem,
+                       cartography::GeoReference const& geo, int num_threads,
+                       double max_height_change, ShadowCache & cache) {
+
+  bool stale = (cache.mask.cols() != dem.cols() || cache.mask.rows() != dem.rows() ||
+                !(cache.sun_pos == sunPos));
+  for (int col = 0; col < dem.cols() && !stale; col++) {
+    for (int row = 0; row < dem.rows(); row++) {
+      if (std::abs(dem(col, row) - cache.height(col, row)) > max_height_change) {
+        stale = true;
+        break;
+      }
+    }
+  }
+  if (!stale)
+    return false;
+
+  computeShadowMask(sunPos, dem, geo, num_threads, cache.mask);
+  cache.height = copy(dem);
+  cache.sun_pos = sunPos;
+  return true;
+}
+
 struct Options : public vw::GdalWriteOptions {
   std::string input_dems_str, out_prefix, stereo_session, bundle_adjust_prefix;
   std::vector<std::string> input_dems, input_images, input_cameras;
@@ -1245,26 +1443,33 @@ struct Options : public vw::GdalWriteOptions {
   std::vector<double> model_coeffs_vec;
   std::vector<std::set<int>> skip_images;
   int max_iterations, max_coarse_iterations, reflectance_type, coarse_levels,
-    blending_dist, blending_power, min_blend_size, num_haze_coeffs;
+    blending_dist, blending_power, min_blend_size, num_haze_coeffs,
+    solver_tile_size, solver_tile_padding, solver_tile_passes,
+    multigrid_cycles, multigrid_smoothing_iterations, exposure_samples,
+    max_images_per_pixel, checkpoint_interval;
   bool float_albedo, float_exposure, float_cameras, float_all_cameras, model_shadows,
     save_computed_intensity_only, estimate_slope_errors, estimate_height_errors,
     compute_exposures_only,
     save_dem_with_nodata, use_approx_camera_models, use_approx_adjusted_camera_models,
     use_rpc_approximation, use_semi_approx,
-    crop_input_images, float_dem_at_boundary, boundary_fix, fix_dem, 
-    float_reflectance_model, float_sun_position, query, save_sparingly, float_haze;
+    crop_input_images, lean_memory, float_dem_at_boundary, boundary_fix, fix_dem, use_camera_lookup_tables,
+    fast_shadows, matrix_free_solver,
+    float_reflectance_model, float_sun_position, query, save_sparingly, float_haze, resume;
   double smoothness_weight, steepness_factor, curvature_in_shadow, curvature_in_shadow_weight,
     lit_curvature_dist, shadow_curvature_dist, gradient_weight,
     integrability_weight, smoothness_weight_pq, init_dem_height, nodata_val,
     initial_dem_constraint_weight, albedo_constraint_weight, camera_position_step_size,
     rpc_penalty_weight, rpc_max_error, unreliable_intensity_threshold, robust_threshold,
-    shadow_threshold;
+    shadow_threshold, camera_lookup_table_height_change, shadow_cache_height_change;
   vw::BBox2 crop_win;
   vw::Vector2 height_error_params;
   
   Options():max_iterations(0), max_coarse_iterations(0), reflectance_type(0),
             coarse_levels(0), blending_dist(0), blending_power(2),
             min_blend_size(0), num_haze_coeffs(0),
+            solver_tile_size(0), solver_tile_padding(0), solver_tile_passes(0),
+            multigrid_cycles(0), multigrid_smoothing_iterations(0), exposure_samples(0),
+            max_images_per_pixel(0), checkpoint_interval(0),
             float_albedo(false), float_exposure(false), float_cameras(false),
             float_all_cameras(false),
             model_shadows(false), 
@@ -1277,10 +1482,12 @@ struct Options : public vw::GdalWriteOptions {
             use_approx_adjusted_camera_models(false),
             use_rpc_approximation(false),
             use_semi_approx(false),
-            crop_input_images(false), 
+            crop_input_images(false), lean_memory(false),
             float_dem_at_boundary(false), boundary_fix(false), fix_dem(false),
+            use_camera_lookup_tables(false), fast_shadows(false),
+            matrix_free_solver(false),
             float_reflectance_model(false), float_sun_position(false),
-            query(false), save_sparingly(false), float_haze(false),
+            query(false), save_sparingly(false), float_haze(false), resume(false),
             smoothness_weight(0), steepness_factor(1.0),
             curvature_in_shadow(0), curvature_in_shadow_weight(0.0),
             lit_curvature_dist(0.0), shadow_curvature_dist(0.0),
@@ -1290,6 +1497,7 @@ struct Options : public vw::GdalWriteOptions {
             camera_position_step_size(1.0), rpc_penalty_weight(0.0),
             rpc_max_error(0.0),
             unreliable_intensity_threshold(0.0),
+            camera_lookup_table_height_change(0.0), shadow_cache_height_change(0.0),
             crop_win(BBox2i(0, 0, 0, 0)){}
 };
 
@@ -1737,6 +1945,138 @@ double ComputeReflectance(Vector3 const& cameraPosition,
   return input_img_reflectance;
 }
 
+// Many ground points lit by the same Sun, with their normals and the
+// camera centers they are seen from, stored as separate coordinate
+// arrays, so that the reflectance can be found for all of them with
+// loops simple enough to be vectorized by the compiler.
+struct ReflectanceBatch {
+  std::vector<double> px, py, pz; // ground points
+  std::vector<double> nx, ny, nz; // unit normals
+  std::vector<double> cx, cy, cz; // camera centers
+  std::vector<double> mu_0, mu, cos_alpha, reflectance;
+
+  size_t size() const { return px.size(); }
+  
+  void clear() {
+    px.clear(); py.clear(); pz.clear();
+    nx.clear(); ny.clear(); nz.clear();
+    cx.clear(); cy.clear(); cz.clear();
+  }
+  
+  void push_back(Vector3 const& xyz, Vector3 const& normal, Vector3 const& camera_center) {
+    px.push_back(xyz[0]);           py.push_back(xyz[1]);           pz.push_back(xyz[2]);
+    nx.push_back(normal[0]);        ny.push_back(normal[1]);        nz.push_back(normal[2]);
+    cx.push_back(camera_center[0]); cy.push_back(camera_center[1]); cz.push_back(camera_center[2]);
+  }
+};
+
+// Same as ComputeReflectance(), for all points in the batch. The
+// formulas are those of the functions for individual points, rewritten
+// to avoid calling acos() and tan() where possible.
+void computeReflectanceBatch(Vector3 const& sunPos,
+                             GlobalParams const& global_params,
+                             const double * reflectance_model_coeffs,
+                             ReflectanceBatch & batch) {
+
+  size_t num = batch.size();
+  batch.mu_0.resize(num);
+  batch.mu.resize(num);
+  batch.cos_alpha.resize(num);
+  batch.reflectance.resize(num);
+  if (num == 0)
+    return;
+
+  const double * px = &batch.px[0], * py = &batch.py[0], * pz = &batch.pz[0];
+  const double * nx = &batch.nx[0], * ny = &batch.ny[0], * nz = &batch.nz[0];
+  const double * cx = &batch.cx[0], * cy = &batch.cy[0], * cz = &batch.cz[0];
+  double * mu_0 = &batch.mu_0[0], * mu = &batch.mu[0], * cos_alpha = &batch.cos_alpha[0];
+  double * refl = &batch.reflectance[0];
+
+  // The cosines of the angles from the normal to the Sun and to the
+  // camera, and between the Sun and the camera
+  double sx = sunPos[0], sy = sunPos[1], sz = sunPos[2];
+  for (size_t i = 0; i < num; i++) {
+    double ux = sx - px[i], uy = sy - py[i], uz = sz - pz[i];
+    double su = 1.0/sqrt(ux*ux + uy*uy + uz*uz);
+    ux *= su; uy *= su; uz *= su;
+    double vx = cx[i] - px[i], vy = cy[i] - py[i], vz = cz[i] - pz[i];
+    double sv = 1.0/sqrt(vx*vx + vy*vy + vz*vz);
+    vx *= sv; vy *= sv; vz *= sv;
+    mu_0[i]      = ux*nx[i] + uy*ny[i] + uz*nz[i];
+    mu[i]        = vx*nx[i] + vy*ny[i] + vz*nz[i];
+    cos_alpha[i] = ux*vx + uy*vy + uz*vz;
+  }
+
+  switch (global_params.reflectanceType) {
+  case LAMBERT:
+    for (size_t i = 0; i < num; i++)
+      refl[i] = mu_0[i];
+    break;
+    
+  case LUNAR_LAMBERT: {
+    double O = reflectance_model_coeffs[0];
+    double A = reflectance_model_coeffs[1];
+    double B = reflectance_model_coeffs[2];
+    double C = reflectance_model_coeffs[3];
+    double c1 = global_params.phaseCoeffC1, c2 = global_params.phaseCoeffC2;
+    for (size_t i = 0; i < num; i++) {
+      double alpha = acos(cos_alpha[i]);
+      double d = alpha*180.0/M_PI;
+      double L = O + A*d + B*d*d + C*d*d*d;
+      double r = 2*L*mu_0[i]/(mu_0[i] + mu[i]) + (1-L)*mu_0[i];
+      r *= (exp(-c1*alpha) + c2);
+      refl[i] = (mu_0[i] + mu[i] == 0 || r != r) ? 0.0 : r;
+    }
+    break;
+  }
+    
+  case HAPKE: {
+    double omega = std::abs(reflectance_model_coeffs[0]);
+    double b     = std::abs(reflectance_model_coeffs[1]);
+    double c     = std::abs(reflectance_model_coeffs[2]);
+    double B0    = std::abs(reflectance_model_coeffs[3]);
+    double h     = std::abs(reflectance_model_coeffs[4]);
+    double J     = 1.0;
+    double s     = sqrt(1.0 - omega);
+    for (size_t i = 0; i < num; i++) {
+      double cos_g = cos_alpha[i];
+      // x^1.5 as x*sqrt(x), and tan(g/2) in terms of cos(g)
+      double t1 = 1.0 + 2.0*b*cos_g + b*b, t2 = 1.0 - 2.0*b*cos_g + b*b;
+      double Pg = (1.0 - c) * (1.0 - b*b) / (t1*sqrt(t1))
+        +         c         * (1.0 - b*b) / (t2*sqrt(t2));
+      double Bg = B0 / (1.0 + (1.0/h)*sqrt((1.0 - cos_g)/(1.0 + cos_g)));
+      double H_mu0 = (1.0 + 2*mu_0[i]) / (1.0 + 2*mu_0[i]*s);
+      double H_mu  = (1.0 + 2*mu[i]  ) / (1.0 + 2*mu[i]  *s);
+      refl[i] = (J*omega/4.0/M_PI) * (mu_0[i]/(mu_0[i] + mu[i]))
+        * ((1.0 + Bg)*Pg + H_mu0*H_mu - 1.0);
+    }
+    break;
+  }
+    
+  case CHARON: {
+    double A       = std::abs(reflectance_model_coeffs[0]);
+    double f_alpha = std::abs(reflectance_model_coeffs[1]);
+    for (size_t i = 0; i < num; i++) {
+      double r = f_alpha*A*mu_0[i] / (mu_0[i] + mu[i]) + (1.0 - A)*mu_0[i];
+      refl[i] = (mu_0[i] + mu[i] == 0 || r != r) ? 0.0 : r;
+    }
+    break;
+  }
+
+  default: {
+    // Use the function for individual points
+    ModelParams model_params;
+    model_params.sunPosition = sunPos;
+    for (size_t i = 0; i < num; i++) {
+      double phase_angle = 0.0;
+      refl[i] = ComputeReflectance(Vector3(cx[i], cy[i], cz[i]), Vector3(nx[i], ny[i], nz[i]),
+                                   Vector3(px[i], py[i], pz[i]), model_params,
+                                   global_params, phase_angle, reflectance_model_coeffs);
+    }
+  }
+  }
+}
+
 // Use this struct to keep track of height errors.
 struct HeightErrEstim {
 
@@ -1803,6 +2143,112 @@ struct SlopeErrEstim {
   double max_angle;
 };
 
+// Where each DEM grid point projects into an image, and the camera
+// center seen from there, tabulated at the initial heights, together
+// with the rate of change of the pixel as the height changes. Looking
+// these up is much cheaper than projecting into a linescan camera,
+// which needs an iterative solver. Valid only as long as the camera
+// does not change.
+struct CameraLookupTable {
+
+  // Heights changing by more than this will be projected into the camera
+  double max_height_change;
+  ImageView<double>  height;
+  ImageView<Vector2f> pixel, pixel_deriv; // NaN where the projection failed
+  ImageView<Vector3> camera_center;
+
+  CameraLookupTable(): max_height_change(0) {}
+
+  // Find the pixel and camera center for the given grid point and height.
+  // Return false if the camera must be used instead.
+  bool lookup(int col, int row, double h, Vector2 & pix, Vector3 & center) const {
+    if (col < 0 || row < 0 || col >= height.cols() || row >= height.rows())
+      return false;
+    double dh = h - height(col, row);
+    if (std::abs(dh) > max_height_change)
+      return false;
+    Vector2f const& p = pixel(col, row);
+    if (p[0] != p[0]) // NaN
+      return false;
+    pix = Vector2(p[0], p[1]) + dh * Vector2(pixel_deriv(col, row)[0],
+                                             pixel_deriv(col, row)[1]);
+    center = camera_center(col, row);
+    return true;
+  }
+};
+
+// Fill in the camera lookup table for a range of DEM columns
+class CameraLookupTableTask: public vw::Task, private boost::noncopyable {
+  ImageView<double>         const& m_dem;
+  cartography::GeoReference const& m_geo;
+  CameraModel               const* m_camera;
+  int m_beg_col, m_end_col;
+  CameraLookupTable & m_table;
+public:
+  CameraLookupTableTask(ImageView<double> const& dem, cartography::GeoReference const& geo,
+                        CameraModel const* camera, int beg_col, int end_col,
+                        CameraLookupTable & table):
+    m_dem(dem), m_geo(geo), m_camera(camera), m_beg_col(beg_col), m_end_col(end_col),
+    m_table(table) {}
+  
+  void operator()() {
+    // The height change to find the pixel derivative with
+    double dh = 1.0;
+    double nan = std::numeric_limits<float>::quiet_NaN();
+    int num_rows = m_dem.rows();
+    std::vector<Vector3> xyz1(num_rows), xyz2(num_rows);
+    std::vector<Vector2> pix1, pix2;
+    std::vector<unsigned char> valid1, valid2;
+    for (int col = m_beg_col; col < m_end_col; col++) {
+
+      // Project a whole column at once, so consecutive points can share work
+      for (int row = 0; row < num_rows; row++) {
+        Vector2 ll = m_geo.pixel_to_lonlat(Vector2(col, row));
+        double h = m_dem(col, row);
+        xyz1[row] = m_geo.datum().geodetic_to_cartesian(Vector3(ll[0], ll[1], h));
+        xyz2[row] = m_geo.datum().geodetic_to_cartesian(Vector3(ll[0], ll[1], h + dh));
+      }
+      asp::points_to_pixels(m_camera, xyz1, pix1, valid1);
+      asp::points_to_pixels(m_camera, xyz2, pix2, valid2);
+
+      for (int row = 0; row < num_rows; row++) {
+        m_table.pixel(col, row) = Vector2f(nan, nan);
+        if (!valid1[row] || !valid2[row])
+          continue;
+        try {
+          m_table.camera_center(col, row) = m_camera->camera_center(pix1[row]);
+          m_table.pixel_deriv(col, row) = (pix2[row] - pix1[row])/dh;
+          m_table.pixel(col, row) = pix1[row];
+        } catch(...) {}
+      }
+    }
+  }
+};
+
+void build_camera_lookup_table(ImageView<double> const& dem,
+                               cartography::GeoReference const& geo,
+                               CameraModel const* camera,
+                               double max_height_change, int num_threads,
+                               CameraLookupTable & table) {
+
+  table.max_height_change = max_height_change;
+  table.height = copy(dem);
+  table.pixel.set_size(dem.cols(), dem.rows());
+  table.pixel_deriv.set_size(dem.cols(), dem.rows());
+  table.camera_center.set_size(dem.cols(), dem.rows());
+
+  int num_tasks = std::max(1, std::min(dem.cols(), 8 * num_threads));
+  int cols_per_task = (dem.cols() + num_tasks - 1) / num_tasks;
+  FifoWorkQueue queue(std::max(num_threads, 1));
+  for (int beg_col = 0; beg_col < dem.cols(); beg_col += cols_per_task) {
+    int end_col = std::min(beg_col + cols_per_task, dem.cols());
+    boost::shared_ptr<CameraLookupTableTask>
+      task(new CameraLookupTableTask(dem, geo, camera, beg_col, end_col, table));
+    queue.add_task(task);
+  }
+  queue.join_all();
+}
+
 // Given the normal (slope) to the SfS DEM, find how different
 // a slope can be from this before the computed intensity
 // due to that slope is bigger than max_intensity_err.
@@ -2042,36 +2488,15 @@ void estimateHeightError(ImageView<double> const& dem,
   }
 }
 
-bool computeReflectanceAndIntensity(double left_h, double center_h, double right_h,
-                                    double bottom_h, double top_h,
-                                    bool use_pq, double p, double q, // dem partial derivatives
-                                    int col, int row,
-                                    ImageView<double>         const& dem,
-                                    cartography::GeoReference const& geo,
-                                    bool model_shadows,
-                                    double max_dem_height,
-                                    double gridx, double gridy,
-                                    ModelParams  const & model_params,
-                                    GlobalParams const & global_params,
-                                    BBox2i       const & crop_box,
-                                    MaskedImgT   const & image,
-                                    DoubleImgT   const & blend_weight,
-                                    CameraModel  const * camera,
-                                    double       const * scaled_sun_posn,
-                                    PixelMask<double>  & reflectance,
-                                    PixelMask<double>  & intensity,
-                                    double             & weight,
-                                    const double       * reflectance_model_coeffs,
-                                    SlopeErrEstim      * slopeErrEstim = NULL,
-                                    HeightErrEstim     * heightErrEstim = NULL) {
-
-  // Set output values
-  reflectance = 0.0; reflectance.invalidate();
-  intensity   = 0.0; intensity.invalidate();
-  weight      = 0.0;
-  
-  if (col >= dem.cols() - 1 || row >= dem.rows() - 1) return false;
-  if (crop_box.empty()) return false;
+// The ground point at a DEM grid point, and the normal there found with
+// the heights at the four neighbors
+void gridPointGeometry(double left_h, double center_h, double right_h,
+                       double bottom_h, double top_h,
+                       bool use_pq, double p, double q, // dem partial derivatives
+                       int col, int row,
+                       cartography::GeoReference const& geo,
+                       double gridx, double gridy,
+                       Vector3 & base, Vector3 & normal) {
 
   if (use_pq) {
     // p is defined as (right_h - left_h)/(2*gridx)
@@ -2087,7 +2512,7 @@ bool computeReflectanceAndIntensity(double left_h, double center_h, double right
   Vector2 lonlat = geo.pixel_to_lonlat(Vector2(col, row));
   double h = center_h;
   Vector3 lonlat3 = Vector3(lonlat(0), lonlat(1), h);
-  Vector3 base = geo.datum().geodetic_to_cartesian(lonlat3);
+  base = geo.datum().geodetic_to_cartesian(lonlat3);
 
   // The xyz position at the left grid point
   lonlat = geo.pixel_to_lonlat(Vector2(col-1, row));
@@ -2117,50 +2542,21 @@ bool computeReflectanceAndIntensity(double left_h, double center_h, double right
   Vector3 dx = right - left;
   Vector3 dy = bottom - top;
 
-  Vector3 normal = -normalize(cross_prod(dx, dy)); // so normal points up
-
-  ModelParams local_model_params = model_params;
-
-  // Update the sun position using the scaled sun position variable 
-  for (int it = 0; it < 3; it++) 
-    local_model_params.sunPosition[it] = scaled_sun_posn[it] * model_params.sunPosition[it]; 
-    
-  // Update the camera position for the given pixel (camera position
-  // is pixel-dependent for linescan cameras).
-  Vector2 pix;
-  Vector3 cameraPosition;
-  try {
-    pix = camera->point_to_pixel(base);
-    
-    // Need camera center only for Lunar Lambertian
-    if (global_params.reflectanceType != LAMBERT)
-      cameraPosition = camera->camera_center(pix);
-    
-  } catch(...){
-    reflectance = 0.0; reflectance.invalidate();
-    intensity   = 0.0; intensity.invalidate();
-    weight      = 0.0;
-    return false;
-  }
-  
-  double phase_angle = 0.0;
-  reflectance = ComputeReflectance(cameraPosition,
-                                   normal, base, local_model_params,
-                                   global_params, phase_angle,
-                                   reflectance_model_coeffs);
-  reflectance.validate();
+  normal = -normalize(cross_prod(dx, dy)); // so normal points up
+}
 
+// Interpolate the image and the blending weight at a pixel in the
+// full image. Return false if out of range or invalid.
+bool sampleImageAndWeight(Vector2 pix, BBox2i const& crop_box,
+                          MaskedImgT const& image, DoubleImgT const& blend_weight,
+                          PixelMask<double> & intensity, double & weight) {
 
   // Since our image is cropped
   pix -= crop_box.min();
 
   // Check for out of range
-  if (pix[0] < 0 || pix[0] >= image.cols()-1 || pix[1] < 0 || pix[1] >= image.rows()-1) {
-    reflectance = 0.0; reflectance.invalidate();
-    intensity   = 0.0; intensity.invalidate();
-    weight      = 0.0;
+  if (pix[0] < 0 || pix[0] >= image.cols()-1 || pix[1] < 0 || pix[1] >= image.rows()-1)
     return false;
-  }
 
   InterpolationView<EdgeExtensionView<MaskedImgT, ConstantEdgeExtension>, BilinearInterpolation>
     interp_image = interpolate(image, BilinearInterpolation(),
@@ -2175,19 +2571,96 @@ bool computeReflectanceAndIntensity(double left_h, double center_h, double right
   else
     weight = 1.0;
 
+  return is_valid(intensity);
+}
+
+bool computeReflectanceAndIntensity(double left_h, double center_h, double right_h,
+                                    double bottom_h, double top_h,
+                                    bool use_pq, double p, double q, // dem partial derivatives
+                                    int col, int row,
+                                    ImageView<double>         const& dem,
+                                    cartography::GeoReference const& geo,
+                                    bool model_shadows,
+                                    double max_dem_height,
+                                    double gridx, double gridy,
+                                    ModelParams  const & model_params,
+                                    GlobalParams const & global_params,
+                                    BBox2i       const & crop_box,
+                                    MaskedImgT   const & image,
+                                    DoubleImgT   const & blend_weight,
+                                    CameraModel  const * camera,
+                                    double       const * scaled_sun_posn,
+                                    PixelMask<double>  & reflectance,
+                                    PixelMask<double>  & intensity,
+                                    double             & weight,
+                                    const double       * reflectance_model_coeffs,
+                                    SlopeErrEstim      * slopeErrEstim = NULL,
+                                    HeightErrEstim     * heightErrEstim = NULL,
+                                    CameraLookupTable const* camera_table = NULL,
+                                    ShadowCache       const* shadow_cache = NULL) {
+
+  // Set output values
+  reflectance = 0.0; reflectance.invalidate();
+  intensity   = 0.0; intensity.invalidate();
+  weight      = 0.0;
+  
+  if (col >= dem.cols() - 1 || row >= dem.rows() - 1) return false;
+  if (crop_box.empty()) return false;
+
+  Vector3 base, normal;
+  gridPointGeometry(left_h, center_h, right_h, bottom_h, top_h, use_pq, p, q,
+                    col, row, geo, gridx, gridy, base, normal);
+
+  ModelParams local_model_params = model_params;
+
+  // Update the sun position using the scaled sun position variable 
+  for (int it = 0; it < 3; it++) 
+    local_model_params.sunPosition[it] = scaled_sun_posn[it] * model_params.sunPosition[it]; 
+    
+  // Update the camera position for the given pixel (camera position
+  // is pixel-dependent for linescan cameras).
+  Vector2 pix;
+  Vector3 cameraPosition;
+  try {
+    if (camera_table == NULL ||
+        !camera_table->lookup(col, row, center_h, pix, cameraPosition)) {
+      pix = camera->point_to_pixel(base);
+      
+      // Need camera center only for Lunar Lambertian
+      if (global_params.reflectanceType != LAMBERT)
+        cameraPosition = camera->camera_center(pix);
+    }
+  } catch(...){
+    reflectance = 0.0; reflectance.invalidate();
+    intensity   = 0.0; intensity.invalidate();
+    weight      = 0.0;
+    return false;
+  }
+  
   // Note that we allow negative reflectance. It will hopefully guide
   // the SfS solution the right way.
-  if (!is_valid(intensity)) {
+  if (!sampleImageAndWeight(pix, crop_box, image, blend_weight, intensity, weight)) {
     reflectance = 0.0; reflectance.invalidate();
     intensity   = 0.0; intensity.invalidate();
     weight      = 0.0;
     return false;
   }
 
+  double phase_angle = 0.0;
+  reflectance = ComputeReflectance(cameraPosition,
+                                   normal, base, local_model_params,
+                                   global_params, phase_angle,
+                                   reflectance_model_coeffs);
+  reflectance.validate();
+
   if (model_shadows) {
-    bool inShadow = isInShadow(col, row, local_model_params.sunPosition,
-                               dem, max_dem_height, gridx, gridy,
-                               geo);
+    bool inShadow = false;
+    if (shadow_cache != NULL)
+      inShadow = shadow_cache->in_shadow(col, row);
+    else
+      inShadow = isInShadow(col, row, local_model_params.sunPosition,
+                            dem, max_dem_height, gridx, gridy,
+                            geo);
 
     if (inShadow) {
       // The reflectance is valid, it is just zero
@@ -2265,7 +2738,8 @@ void computeReflectanceAndIntensity(ImageView<double> const& dem,
                                     ImageView< double            > & weight,
                                     const double  * reflectance_model_coeffs,
                                     SlopeErrEstim * slopeErrEstim = NULL,
-                                    HeightErrEstim * heightErrEstim = NULL) {
+                                    HeightErrEstim * heightErrEstim = NULL,
+                                    bool fast_shadows = false, int num_threads = 1) {
   
   // Update max_dem_height
   max_dem_height = -std::numeric_limits<double>::max();
@@ -2295,6 +2769,71 @@ void computeReflectanceAndIntensity(ImageView<double> const& dem,
   }
 
   bool use_pq = (pq.cols() > 0 && pq.rows() > 0);
+
+  if (slopeErrEstim == NULL && heightErrEstim == NULL) {
+    // Find the geometry and sample the image for a column of grid points
+    // at a time, then the reflectance for all of them at once.
+    if (crop_box.empty())
+      return;
+    Vector3 sunPos;
+    for (int it = 0; it < 3; it++) 
+      sunPos[it] = scaled_sun_posn[it] * model_params.sunPosition[it]; 
+    ImageView<unsigned char> shadow_mask;
+    if (model_shadows && fast_shadows)
+      computeShadowMask(sunPos, dem, geo, num_threads, shadow_mask);
+    ReflectanceBatch batch;
+    std::vector<int> batch_rows;
+    for (int col = 1; col < dem.cols() - 1; col += sample_col_rate) {
+      batch.clear();
+      batch_rows.clear();
+      for (int row = 1; row < dem.rows() - 1; row += sample_row_rate) {
+        double pval = 0, qval = 0;
+        if (use_pq) {
+          pval = pq(col, row)[0];
+          qval = pq(col, row)[1];
+        }
+        Vector3 base, normal;
+        gridPointGeometry(dem(col-1, row), dem(col, row), dem(col+1, row),
+                          dem(col, row+1), dem(col, row-1), use_pq, pval, qval,
+                          col, row, geo, gridx, gridy, base, normal);
+        Vector2 pix;
+        Vector3 cameraPosition;
+        try {
+          pix = camera->point_to_pixel(base);
+          if (global_params.reflectanceType != LAMBERT)
+            cameraPosition = camera->camera_center(pix);
+        } catch(...) {
+          continue;
+        }
+        PixelMask<double> meas_intensity;
+        double meas_weight = 0.0;
+        if (!sampleImageAndWeight(pix, crop_box, image, blend_weight,
+                                  meas_intensity, meas_weight))
+          continue;
+        intensity(col, row) = meas_intensity;
+        weight(col, row)    = meas_weight;
+        batch.push_back(base, normal, cameraPosition);
+        batch_rows.push_back(row);
+      }
+
+      computeReflectanceBatch(sunPos, global_params, reflectance_model_coeffs, batch);
+      
+      for (size_t it = 0; it < batch_rows.size(); it++) {
+        int row = batch_rows[it];
+        reflectance(col, row) = batch.reflectance[it];
+        bool inShadow = false;
+        if (model_shadows && fast_shadows)
+          inShadow = (shadow_mask(col, row) != 0);
+        else if (model_shadows)
+          inShadow = isInShadow(col, row, sunPos, dem, max_dem_height, gridx, gridy, geo);
+        if (inShadow)
+          reflectance(col, row) = 0; // valid, just zero
+        reflectance(col, row).validate();
+      }
+    }
+    return;
+  }
+  
   for (int col = 1; col < dem.cols() - 1; col += sample_col_rate) {
     for (int row = 1; row < dem.rows() - 1; row += sample_row_rate) {
       
@@ -2350,6 +2889,27 @@ void interp_image(ImageView<double> const& coarse_image, double scale,
   }
 }
 
+// Add to a fine image the change from start to end of the coarse image,
+// upsampled as in interp_image().
+void add_coarse_change(ImageView<double> const& coarse_end,
+                       ImageView<double> const& coarse_start,
+                       double scale, ImageView<double> & fine_image){
+
+  ImageView<double> change = copy(coarse_end);
+  for (int col = 0; col < change.cols(); col++) {
+    for (int row = 0; row < change.rows(); row++) {
+      change(col, row) -= coarse_start(col, row);
+    }
+  }
+  ImageView<double> fine_change(fine_image.cols(), fine_image.rows());
+  interp_image(change, scale, fine_change);
+  for (int col = 0; col < fine_image.cols(); col++) {
+    for (int row = 0; row < fine_image.rows(); row++) {
+      fine_image(col, row) += fine_change(col, row);
+    }
+  }
+}
+
 void save_exposures(std::string const& out_prefix,
                     std::vector<std::string> const& input_images,
                     std::vector<double> const& exposures){
@@ -2362,6 +2922,161 @@ void save_exposures(std::string const& out_prefix,
   exf.close();
 }
 
+void save_haze(std::string const& out_prefix,
+               std::vector<std::string> const& input_images,
+               std::vector< std::vector<double> > const& haze){
+  std::string haze_file = haze_file_name(out_prefix);
+  vw_out() << "Writing: " << haze_file << std::endl;
+  std::ofstream hzf(haze_file.c_str());
+  hzf.precision(18);
+  for (size_t image_iter = 0; image_iter < haze.size(); image_iter++) {
+    hzf << input_images[image_iter];
+    for (size_t hiter = 0; hiter < haze[image_iter].size(); hiter++) {
+      hzf << " " << haze[image_iter][hiter];
+    }
+    hzf << "\n";
+  }
+  hzf.close();
+}
+
+void save_model_coeffs(std::string const& out_prefix,
+                       const double * reflectance_model_coeffs){
+  std::string model_coeffs_file = model_coeffs_file_name(out_prefix);
+  vw_out() << "Writing: " << model_coeffs_file << std::endl;
+  std::ofstream mcf(model_coeffs_file.c_str());
+  mcf.precision(18);
+  for (size_t coeff_iter = 0; coeff_iter < g_num_model_coeffs; coeff_iter++){
+    mcf << reflectance_model_coeffs[coeff_iter] << " ";
+  }
+  mcf << "\n";
+  mcf.close();
+}
+
+std::string checkpoint_file_name(std::string const& prefix){
+  return prefix + "-checkpoint.bin";
+}
+
+// The floating state of sfs at an iteration, in one binary file, so that
+// an interrupted run can be resumed from it exactly. It is written to a
+// temporary file first, then renamed, so a run killed while writing it
+// leaves the previous checkpoint intact.
+const char SFS_CHECKPOINT_MAGIC[] = "SFSCKPT1";
+
+template <class T>
+void write_checkpoint_values(std::ofstream & ofs, const T * vals, size_t num) {
+  if (num > 0)
+    ofs.write(reinterpret_cast<const char*>(vals), num * sizeof(T));
+}
+
+template <class T>
+void read_checkpoint_values(std::ifstream & ifs, std::string const& file, T * vals, size_t num) {
+  if (num > 0)
+    ifs.read(reinterpret_cast<char*>(vals), num * sizeof(T));
+  if (!ifs)
+    vw_throw(IOErr() << "Unexpected end of checkpoint: " << file << ".\n");
+}
+
+void save_checkpoint(std::string const& out_prefix, int level, int iter,
+                     std::vector< ImageView<double> > const& dems,
+                     std::vector< ImageView<double> > const& albedos,
+                     std::vector<double> const& exposures,
+                     std::vector< std::vector<double> > const& haze,
+                     std::vector<double> const& adjustments,
+                     std::vector<double> const& scaled_sun_posns,
+                     const double * reflectance_model_coeffs) {
+
+  std::string file = checkpoint_file_name(out_prefix);
+  std::string tmp_file = file + ".tmp";
+  vw_out() << "Writing: " << file << std::endl;
+  {
+    std::ofstream ofs(tmp_file.c_str(), std::ios::binary);
+    if (!ofs)
+      vw_throw(IOErr() << "Cannot open for writing: " << tmp_file << ".\n");
+    ofs.write(SFS_CHECKPOINT_MAGIC, sizeof(SFS_CHECKPOINT_MAGIC) - 1);
+    std::int32_t header[3] = {level, iter, std::int32_t(dems.size())};
+    write_checkpoint_values(ofs, header, 3);
+    for (size_t dem_iter = 0; dem_iter < dems.size(); dem_iter++) {
+      std::int32_t dims[2] = {dems[dem_iter].cols(), dems[dem_iter].rows()};
+      write_checkpoint_values(ofs, dims, 2);
+      size_t num = size_t(dims[0]) * dims[1];
+      write_checkpoint_values(ofs, dems[dem_iter].data(), num);
+      write_checkpoint_values(ofs, albedos[dem_iter].data(), num);
+    }
+    std::int32_t num_images = exposures.size();
+    write_checkpoint_values(ofs, &num_images, 1);
+    write_checkpoint_values(ofs, exposures.data(), exposures.size());
+    for (size_t image_iter = 0; image_iter < haze.size(); image_iter++)
+      write_checkpoint_values(ofs, haze[image_iter].data(), g_max_num_haze_coeffs);
+    write_checkpoint_values(ofs, adjustments.data(), adjustments.size());
+    write_checkpoint_values(ofs, scaled_sun_posns.data(), scaled_sun_posns.size());
+    write_checkpoint_values(ofs, reflectance_model_coeffs, g_num_model_coeffs);
+    if (!ofs)
+      vw_throw(IOErr() << "Failed writing: " << tmp_file << ".\n");
+  }
+  fs::rename(tmp_file, file);
+}
+
+// Read a checkpoint written by save_checkpoint(). The DEMs and albedos
+// are read at the level the checkpoint is for. All sizes must agree
+// with those of the current run.
+void read_checkpoint(std::string const& file, int & level, int & iter,
+                     std::vector< std::vector< ImageView<double> > > & dems,
+                     std::vector< std::vector< ImageView<double> > > & albedos,
+                     std::vector<double> & exposures,
+                     std::vector< std::vector<double> > & haze,
+                     std::vector<double> & adjustments,
+                     std::vector<double> & scaled_sun_posns,
+                     double * reflectance_model_coeffs) {
+
+  std::ifstream ifs(file.c_str(), std::ios::binary);
+  if (!ifs)
+    vw_throw(IOErr() << "Cannot open: " << file << ".\n");
+  
+  std::string magic(sizeof(SFS_CHECKPOINT_MAGIC) - 1, ' ');
+  read_checkpoint_values(ifs, file, &magic[0], magic.size());
+  if (magic != SFS_CHECKPOINT_MAGIC)
+    vw_throw(IOErr() << "Not an sfs checkpoint: " << file << ".\n");
+  
+  std::int32_t header[3];
+  read_checkpoint_values(ifs, file, header, 3);
+  level = header[0];
+  iter  = header[1];
+  if (level < 0 || level >= int(dems.size()) || header[2] != int(dems[level].size()))
+    vw_throw(ArgumentErr() << "The checkpoint " << file << " does not agree with the "
+             << "number of coarseness levels or input DEMs.\n");
+
+  for (size_t dem_iter = 0; dem_iter < dems[level].size(); dem_iter++) {
+    ImageView<double> & dem = dems[level][dem_iter];
+    ImageView<double> & albedo = albedos[level][dem_iter];
+    std::int32_t dims[2];
+    read_checkpoint_values(ifs, file, dims, 2);
+    if (dims[0] != dem.cols() || dims[1] != dem.rows())
+      vw_throw(ArgumentErr() << "The checkpoint " << file << " has a DEM of size "
+               << dims[0] << " x " << dims[1] << ", while expecting "
+               << dem.cols() << " x " << dem.rows() << ".\n");
+    albedo.set_size(dem.cols(), dem.rows());
+    size_t num = size_t(dims[0]) * dims[1];
+    read_checkpoint_values(ifs, file, dem.data(), num);
+    read_checkpoint_values(ifs, file, albedo.data(), num);
+  }
+  
+  std::int32_t num_images = 0;
+  read_checkpoint_values(ifs, file, &num_images, 1);
+  if (num_images != int(exposures.size()) || num_images != int(haze.size()) ||
+      6 * num_images != int(adjustments.size()) ||
+      3 * num_images != int(scaled_sun_posns.size()))
+    vw_throw(ArgumentErr() << "The checkpoint " << file << " does not agree with the "
+             << "number of input images.\n");
+  read_checkpoint_values(ifs, file, exposures.data(), exposures.size());
+  for (size_t image_iter = 0; image_iter < haze.size(); image_iter++) {
+    haze[image_iter].resize(g_max_num_haze_coeffs);
+    read_checkpoint_values(ifs, file, haze[image_iter].data(), g_max_num_haze_coeffs);
+  }
+  read_checkpoint_values(ifs, file, adjustments.data(), adjustments.size());
+  read_checkpoint_values(ifs, file, scaled_sun_posns.data(), scaled_sun_posns.size());
+  read_checkpoint_values(ifs, file, reflectance_model_coeffs, g_num_model_coeffs);
+}
+
 // Find the sun azimuth and elevation at the lon-lat position of the
 // center of the DEM. The result can change depending on the DEM.
 void sun_angles(Options const& opt,
@@ -2436,6 +3151,7 @@ double                                       * g_gridx = NULL;
 double                                       * g_gridy = NULL;
 int                                            g_level = -1;
 bool                                           g_final_iter = false;
+int                                            g_start_iter = -1; // when resuming
 double                                       * g_reflectance_model_coeffs = NULL; 
 
 // When floating the camera position and orientation, multiply the
@@ -2455,35 +3171,20 @@ public:
     vw_out() << "Finished iteration: " << g_iter << std::endl;
     callTop();
 
+    if (g_opt->checkpoint_interval > 0 && !g_final_iter && g_iter > 0 &&
+        g_iter % g_opt->checkpoint_interval == 0)
+      save_checkpoint(g_opt->out_prefix, g_level, g_iter, *g_dem, *g_albedo,
+                      *g_exposures, *g_haze, *g_adjustments, *g_scaled_sun_posns,
+                      g_reflectance_model_coeffs);
+
     if (!g_opt->save_computed_intensity_only)
       save_exposures(g_opt->out_prefix, g_opt->input_images, *g_exposures);
 
-    if (g_opt->num_haze_coeffs > 0 && !g_opt->save_computed_intensity_only) {
-      std::string haze_file = haze_file_name(g_opt->out_prefix);
-      vw_out() << "Writing: " << haze_file << std::endl;
-      std::ofstream hzf(haze_file.c_str());
-      hzf.precision(18);
-      for (size_t image_iter = 0; image_iter < (*g_haze).size(); image_iter++) {
-        hzf << g_opt->input_images[image_iter];
-        for (size_t hiter = 0; hiter < (*g_haze)[image_iter].size(); hiter++) {
-          hzf << " " << (*g_haze)[image_iter][hiter];
-        }
-        hzf << "\n";
-      }
-      hzf.close();
-    }
+    if (g_opt->num_haze_coeffs > 0 && !g_opt->save_computed_intensity_only)
+      save_haze(g_opt->out_prefix, g_opt->input_images, *g_haze);
     
-    std::string model_coeffs_file = model_coeffs_file_name(g_opt->out_prefix);
-    if (!g_opt->save_computed_intensity_only) {
-      vw_out() << "Writing: " << model_coeffs_file << std::endl;
-      std::ofstream mcf(model_coeffs_file.c_str());
-      mcf.precision(18);
-      for (size_t coeff_iter = 0; coeff_iter < g_num_model_coeffs; coeff_iter++){
-        mcf << g_reflectance_model_coeffs[coeff_iter] << " ";
-      }
-      mcf << "\n";
-      mcf.close();
-    }
+    if (!g_opt->save_computed_intensity_only)
+      save_model_coeffs(g_opt->out_prefix, g_reflectance_model_coeffs);
     
     //vw_out() << "Model coefficients: "; 
     //for (size_t i = 0; i < g_num_model_coeffs; i++)
@@ -2643,7 +3344,8 @@ public:
                                        (*g_cameras)[dem_iter][image_iter].get(),
                                        &(*g_scaled_sun_posns)[3*image_iter],
                                        reflectance, intensity, blend_weight, 
-                                       g_reflectance_model_coeffs);
+                                       g_reflectance_model_coeffs, NULL, NULL,
+                                       g_opt->fast_shadows, g_opt->num_threads);
 
         // dem_nodata equals to dem if the image has valid pixels and no shadows
         if (g_opt->save_dem_with_nodata) {
@@ -2774,6 +3476,53 @@ public:
   }
 };
 
+// Update the shadow masks after each iteration, for the heights found so far
+class ShadowCacheCallback: public ceres::IterationCallback {
+public:
+  ShadowCacheCallback(Options const& opt,
+                      std::vector< ImageView<double> > const& dems,
+                      std::vector<GeoReference> const& geo,
+                      std::vector<ModelParams> const& model_params,
+                      std::vector<double> const& scaled_sun_posns,
+                      std::vector< std::vector<ShadowCache> > & caches):
+    m_opt(opt), m_dems(dems), m_geo(geo), m_model_params(model_params),
+    m_scaled_sun_posns(scaled_sun_posns), m_caches(caches) {}
+
+  void update() {
+    int num_updated = 0;
+    for (size_t dem_iter = 0; dem_iter < m_caches.size(); dem_iter++) {
+      for (size_t image_iter = 0; image_iter < m_caches[dem_iter].size(); image_iter++) {
+        if (m_opt.skip_images[dem_iter].find(image_iter) !=
+            m_opt.skip_images[dem_iter].end()) continue;
+        Vector3 sunPos;
+        for (int it = 0; it < 3; it++)
+          sunPos[it] = m_scaled_sun_posns[3*image_iter + it]
+            * m_model_params[image_iter].sunPosition[it];
+        if (updateShadowCache(sunPos, m_dems[dem_iter], m_geo[dem_iter], m_opt.num_threads,
+                              m_opt.shadow_cache_height_change,
+                              m_caches[dem_iter][image_iter]))
+          num_updated++;
+      }
+    }
+    if (num_updated > 0)
+      vw_out() << "Updated the shadows for " << num_updated << " image(s).\n";
+  }
+  
+  virtual ceres::CallbackReturnType operator()
+    (const ceres::IterationSummary& summary) {
+    update();
+    return ceres::SOLVER_CONTINUE;
+  }
+
+private:
+  Options                                 const& m_opt;
+  std::vector< ImageView<double> >        const& m_dems;
+  std::vector<GeoReference>               const& m_geo;
+  std::vector<ModelParams>                const& m_model_params;
+  std::vector<double>                     const& m_scaled_sun_posns;
+  std::vector< std::vector<ShadowCache> >      & m_caches;
+};
+
 // See SmoothnessError() for the definitions of bottom, top, etc.
 template <typename F, typename G>
 inline bool
@@ -2804,6 +3553,8 @@ calc_intensity_residual(const F* const exposure,
                         MaskedImgT                        const & m_image,          // alias
                         DoubleImgT                        const & m_blend_weight,   // alias
                         boost::shared_ptr<CameraModel>    const & m_camera,         // alias
+                        CameraLookupTable                 const * m_camera_table,   // may be NULL
+                        ShadowCache                       const * m_shadow_cache,   // may be NULL
                         F* residuals) {
   
   // Default residuals. Using here 0 rather than some big number tuned out to
@@ -2869,7 +3620,8 @@ calc_intensity_residual(const F* const exposure,
                                      m_model_params,  m_global_params,
                                      m_crop_box, m_image, m_blend_weight, camera,
                                      scaled_sun_posn,
-                                     reflectance, intensity, weight, reflectance_model_coeffs);
+                                     reflectance, intensity, weight, reflectance_model_coeffs,
+                                     NULL, NULL, m_camera_table, m_shadow_cache);
       
     if (g_opt->unreliable_intensity_threshold > 0){
       if (is_valid(intensity) && intensity.child() <= g_opt->unreliable_intensity_threshold &&
@@ -2913,7 +3665,9 @@ struct IntensityError {
                  MaskedImgT const& image,
                  DoubleImgT const& blend_weight,
                  double * scaled_sun_posn, 
-                 boost::shared_ptr<CameraModel> const& camera):
+                 boost::shared_ptr<CameraModel> const& camera,
+                 CameraLookupTable const* camera_table,
+                 ShadowCache const* shadow_cache):
     m_col(col), m_row(row), m_dem(dem), m_geo(geo),
     m_model_shadows(model_shadows),
     m_camera_position_step_size(camera_position_step_size),
@@ -2924,7 +3678,8 @@ struct IntensityError {
     m_crop_box(crop_box),
     m_image(image), m_blend_weight(blend_weight),
     m_scaled_sun_posn(scaled_sun_posn),
-    m_camera(camera) {}
+    m_camera(camera), m_camera_table(camera_table),
+    m_shadow_cache(shadow_cache) {}
 
   // See SmoothnessError() for the definitions of bottom, top, etc.
   template <typename F>
@@ -2965,6 +3720,8 @@ struct IntensityError {
                                    m_image,           // alias
                                    m_blend_weight,    // alias
                                    m_camera,          // alias
+                                   m_camera_table,    // may be NULL
+                                   m_shadow_cache,    // may be NULL
                                    residuals);
   }
 
@@ -2983,7 +3740,9 @@ struct IntensityError {
                                      MaskedImgT const& image,
                                      DoubleImgT const& blend_weight,
                                      double * scaled_sun_posn, 
-                                     boost::shared_ptr<CameraModel> const& camera){
+                                     boost::shared_ptr<CameraModel> const& camera,
+                                     CameraLookupTable const* camera_table,
+                                     ShadowCache const* shadow_cache){
     return (new ceres::NumericDiffCostFunction<IntensityError,
             ceres::CENTRAL, 1, 1, g_max_num_haze_coeffs, 1, 1, 1, 1, 1, 1, 6, g_num_model_coeffs>
             (new IntensityError(col, row, dem, geo,
@@ -2992,7 +3751,8 @@ struct IntensityError {
                                 max_dem_height,
                                 gridx, gridy,
                                 global_params, model_params,
-                                crop_box, image, blend_weight, scaled_sun_posn, camera)));
+                                crop_box, image, blend_weight, scaled_sun_posn, camera,
+                                camera_table, shadow_cache)));
   }
 
   int m_col, m_row;
@@ -3009,6 +3769,8 @@ struct IntensityError {
   DoubleImgT                        const & m_blend_weight;   // alias
   double                                  * m_scaled_sun_posn;   //  pointer
   boost::shared_ptr<CameraModel>    const & m_camera;         // alias
+  CameraLookupTable                 const * m_camera_table;   // may be NULL
+  ShadowCache                       const * m_shadow_cache;   // may be NULL
 };
 
 // A variation of the intensity error where only the DEM is floated
@@ -3031,7 +3793,9 @@ struct IntensityErrorFloatDemOnly {
                              MaskedImgT const& image,
                              DoubleImgT const& blend_weight,
                              double * scaled_sun_posn, 
-                             boost::shared_ptr<CameraModel> const& camera):
+                             boost::shared_ptr<CameraModel> const& camera,
+                             CameraLookupTable const* camera_table,
+                             ShadowCache const* shadow_cache):
     m_col(col), m_row(row), m_dem(dem),
     m_albedo(albedo), m_reflectance_model_coeffs(reflectance_model_coeffs),
     m_exposure(exposure), m_haze(haze), m_camera_adjustments(camera_adjustments),
@@ -3045,7 +3809,8 @@ struct IntensityErrorFloatDemOnly {
     m_crop_box(crop_box),
     m_image(image), m_blend_weight(blend_weight),
     m_scaled_sun_posn(scaled_sun_posn),
-    m_camera(camera) {}
+    m_camera(camera), m_camera_table(camera_table),
+    m_shadow_cache(shadow_cache) {}
 
   // See SmoothnessError() for the definitions of bottom, top, etc.
   template <typename F>
@@ -3079,6 +3844,8 @@ struct IntensityErrorFloatDemOnly {
                                    m_image,           // alias
                                    m_blend_weight,    // alias
                                    m_camera,          // alias
+                                   m_camera_table,    // may be NULL
+                                   m_shadow_cache,    // may be NULL
                                    residuals);
   }
 
@@ -3102,7 +3869,9 @@ struct IntensityErrorFloatDemOnly {
                                      MaskedImgT const& image,
                                      DoubleImgT const& blend_weight,
                                      double * scaled_sun_posn, 
-                                     boost::shared_ptr<CameraModel> const& camera){
+                                     boost::shared_ptr<CameraModel> const& camera,
+                                     CameraLookupTable const* camera_table,
+                                     ShadowCache const* shadow_cache){
     return (new ceres::NumericDiffCostFunction<IntensityErrorFloatDemOnly,
             ceres::CENTRAL, 1, 1, 1, 1, 1, 1>
             (new IntensityErrorFloatDemOnly(col, row, dem,
@@ -3114,7 +3883,8 @@ struct IntensityErrorFloatDemOnly {
                                             max_dem_height,
                                             gridx, gridy,
                                             global_params, model_params,
-                                            crop_box, image, blend_weight, scaled_sun_posn, camera)));
+                                            crop_box, image, blend_weight, scaled_sun_posn, camera,
+                                            camera_table, shadow_cache)));
   }
 
   int                                       m_col, m_row;
@@ -3136,6 +3906,8 @@ struct IntensityErrorFloatDemOnly {
   DoubleImgT                        const & m_blend_weight;   // alias
   double                                  * m_scaled_sun_posn;   // pointer
   boost::shared_ptr<CameraModel>    const & m_camera;         // alias
+  CameraLookupTable                 const * m_camera_table;   // may be NULL
+  ShadowCache                       const * m_shadow_cache;   // may be NULL
 };
 
 // A variation of IntensityError where albedo, dem, and model params are fixed.
@@ -3204,6 +3976,8 @@ struct IntensityErrorFixedMost {
                                    m_image,  // alias
                                    m_blend_weight,  // alias
                                    m_camera,  // alias
+                                   NULL,  // no camera lookup table
+                                   NULL,  // no shadow cache
                                    residuals);
   }
 
@@ -3267,7 +4041,9 @@ struct IntensityErrorPQ {
                    BBox2i const& crop_box,
                    MaskedImgT const& image,
                    DoubleImgT const& blend_weight,
-                   boost::shared_ptr<CameraModel> const& camera):
+                   boost::shared_ptr<CameraModel> const& camera,
+                   CameraLookupTable const* camera_table,
+                   ShadowCache const* shadow_cache):
     m_col(col), m_row(row), m_dem(dem), m_geo(geo),
     m_model_shadows(model_shadows),
     m_camera_position_step_size(camera_position_step_size),
@@ -3277,7 +4053,8 @@ struct IntensityErrorPQ {
     m_model_params(model_params),
     m_crop_box(crop_box),
     m_image(image), m_blend_weight(blend_weight),
-    m_camera(camera) {}
+    m_camera(camera), m_camera_table(camera_table),
+    m_shadow_cache(shadow_cache) {}
   
   // See SmoothnessError() for the definitions of bottom, top, etc.
   template <typename F>
@@ -3312,6 +4089,8 @@ struct IntensityErrorPQ {
                                    m_image,           // alias
                                    m_blend_weight,    // alias
                                    m_camera,          // alias
+                                   m_camera_table,    // may be NULL
+                                   m_shadow_cache,    // may be NULL
                                    residuals);
   }
 
@@ -3329,7 +4108,9 @@ struct IntensityErrorPQ {
                                      BBox2i const& crop_box,
                                      MaskedImgT const& image,
                                      DoubleImgT const& blend_weight,
-                                     boost::shared_ptr<CameraModel> const& camera){
+                                     boost::shared_ptr<CameraModel> const& camera,
+                                     CameraLookupTable const* camera_table,
+                                     ShadowCache const* shadow_cache){
     return (new ceres::NumericDiffCostFunction<IntensityErrorPQ,
             ceres::CENTRAL, 1, 1, g_max_num_haze_coeffs, 1, 2, 1, 6, 3, g_num_model_coeffs>
             (new IntensityErrorPQ(col, row, dem, geo,
@@ -3338,7 +4119,8 @@ struct IntensityErrorPQ {
                                   max_dem_height,
                                   gridx, gridy,
                                   global_params, model_params,
-                                  crop_box, image, blend_weight, camera)));
+                                  crop_box, image, blend_weight, camera,
+                                  camera_table, shadow_cache)));
   }
 
   int m_col, m_row;
@@ -3354,6 +4136,8 @@ struct IntensityErrorPQ {
   MaskedImgT                        const & m_image;          // alias
   DoubleImgT                        const & m_blend_weight;   // alias
   boost::shared_ptr<CameraModel>    const & m_camera;         // alias
+  CameraLookupTable                 const * m_camera_table;   // may be NULL
+  ShadowCache                       const * m_shadow_cache;   // may be NULL
 };
 
 // The smoothness error is the sum of squares of
@@ -3775,8 +4559,14 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Float the camera pose for each image, including the first one. Experimental. It is suggested to avoid this option.")
     ("model-shadows",   po::bool_switch(&opt.model_shadows)->default_value(false)->implicit_value(true),
      "Model the fact that some points on the DEM are in the shadow (occluded from the Sun).")
+    ("fast-shadows",   po::bool_switch(&opt.fast_shadows)->default_value(false)->implicit_value(true),
+     "When modeling shadows, find them for each image in one sweep over the DEM along the Sun direction, rather than by marching a ray towards the Sun from each grid point, and recompute them only once the heights change enough.")
+    ("shadow-cache-height-change", po::value(&opt.shadow_cache_height_change)->default_value(1.0),
+     "With --fast-shadows, recompute the shadows for an image after an iteration only if some height changed by more than this (in meters) since they were found.")
     ("compute-exposures-only",   po::bool_switch(&opt.compute_exposures_only)->default_value(false)->implicit_value(true),
      "Quit after saving the exposures. This should be done once for a big DEM, before using these for small sub-clips without recomputing them.")
+    ("exposure-samples", po::value(&opt.exposure_samples)->default_value(0),
+     "With --compute-exposures-only, if positive, estimate the exposures from about this many DEM grid points per image where it is lit, without setting up the rest of the problem. Also estimate the haze and reflectance model coefficients if floated.")
 
     ("save-computed-intensity-only",   po::bool_switch(&opt.save_computed_intensity_only)->default_value(false)->implicit_value(true),
      "Save the computed (simulated) image intensities for given DEM, "
@@ -3809,6 +4599,10 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Save a copy of the DEM while using a no-data value at a DEM grid point where all images show shadows. To be used if shadow thresholds are set.")
     ("use-approx-camera-models",   po::bool_switch(&opt.use_approx_camera_models)->default_value(false)->implicit_value(true),
      "Use approximate camera models for speed. Only with ISIS .cub cameras.")
+    ("use-camera-lookup-tables",   po::bool_switch(&opt.use_camera_lookup_tables)->default_value(false)->implicit_value(true),
+     "For each image, tabulate where the DEM grid points project into it, as well as how that changes with height, and use that instead of projecting into the camera at each iteration. Not used if the cameras are floated.")
+    ("camera-lookup-table-height-change", po::value(&opt.camera_lookup_table_height_change)->default_value(10.0),
+     "When using camera lookup tables, project into the camera a DEM grid point whose height changed by more than this (in meters) since the tables were made.")
     ("use-rpc-approximation",   po::bool_switch(&opt.use_rpc_approximation)->default_value(false)->implicit_value(true),
      "Use RPC approximations for the camera models instead of approximate tabulated camera models (invoke with --use-approx-camera-models). This is broken and should not be used.")
     ("rpc-penalty-weight", po::value(&opt.rpc_penalty_weight)->default_value(0.1),
@@ -3821,8 +4615,24 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Solve the problem on a grid coarser than the original by a factor of 2 to this power, then refine the solution on finer grids. It is suggested to not use this option.")
     ("max-coarse-iterations", po::value(&opt.max_coarse_iterations)->default_value(10),
      "How many iterations to do at levels of resolution coarser than the final result.")
+    ("multigrid-cycles", po::value(&opt.multigrid_cycles)->default_value(0),
+     "After solving from the coarsest to the finest level, do this many multigrid V-cycles over the levels set with --coarse-levels, to correct the errors of low frequency at the coarser levels.")
+    ("multigrid-smoothing-iterations", po::value(&opt.multigrid_smoothing_iterations)->default_value(5),
+     "In a multigrid V-cycle, do this many iterations at each level before going to the coarser level and after returning from it. At the coarsest level, do --max-coarse-iterations.")
+    ("lean-memory",   po::bool_switch(&opt.lean_memory)->default_value(false)->implicit_value(true),
+     "Use less memory. Keep the blending weights in single precision, and release the images and weights at each coarser level once done with it.")
+    ("max-images-per-pixel", po::value(&opt.max_images_per_pixel)->default_value(0),
+     "If positive, at each DEM grid point use only up to this many images, those which are lit there and have the highest product of computed reflectance and blending weight. This makes the problem smaller when many images overlap.")
     ("crop-input-images",   po::bool_switch(&opt.crop_input_images)->default_value(false)->implicit_value(true),
      "Crop the images to a region that was computed to be large enough, and keep them fully in memory, for speed.")
+    ("matrix-free-solver",   po::bool_switch(&opt.matrix_free_solver)->default_value(false)->implicit_value(true),
+     "Minimize the cost function with L-BFGS, using only its gradient, rather than with the Ceres least squares solver, which forms the Jacobian. This uses much less memory. The cameras, haze, reflectance model, and Sun positions must stay fixed. Only the final results are saved.")
+    ("solver-tile-size", po::value(&opt.solver_tile_size)->default_value(0),
+     "If positive, solve the problem over tiles of the DEM of this size, with padding, one at a time instead of for the whole DEM at once, and make several passes over the tiles, so that neighboring tiles come to agree. This needs much less memory.")
+    ("solver-tile-padding", po::value(&opt.solver_tile_padding)->default_value(50),
+     "When solving over tiles, let each tile extend over its neighbors by this many DEM pixels on each side.")
+    ("solver-tile-passes", po::value(&opt.solver_tile_passes)->default_value(3),
+     "When solving over tiles, make this many passes over all the tiles. Each tile at a pass is solved with --max-iterations iterations.")
     ("blending-dist", po::value(&opt.blending_dist)->default_value(0),
      "Give less weight to image pixels close to no-data or boundary values. Enabled only when crop-input-images is true, for performance reasons. Blend over this many pixels.")
     ("blending-power", po::value(&opt.blending_power)->default_value(2),
@@ -3884,6 +4694,10 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "--smoothness-weight. It is suggested to experiment with this "
      "with a value of 0.0001 - 0.01, while reducing the "
      "smoothness weight to a very small value.")
+    ("checkpoint-interval", po::value(&opt.checkpoint_interval)->default_value(0),
+     "If positive, write all the quantities being optimized to <output prefix>-checkpoint.bin every this many iterations, to be able to resume the run with --resume.")
+    ("resume",   po::bool_switch(&opt.resume)->default_value(false)->implicit_value(true),
+     "Resume from the checkpoint written with --checkpoint-interval with the same output prefix, at the level and iteration it was written for. The other options must be the same as for the run which wrote it.")
     ("save-sparingly",   po::bool_switch(&opt.save_sparingly)->default_value(false)->implicit_value(true),
      "Avoid saving any results except the adjustments and the DEM, as that's a lot of files.")
     ("camera-position-step-size", po::value(&opt.camera_position_step_size)->default_value(1.0),
@@ -3979,6 +4793,18 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
   if (opt.steepness_factor <= 0.0) 
     vw_throw(ArgumentErr() << "The steepness factor must be positive.\n");    
       
+  if (opt.checkpoint_interval < 0)
+    vw_throw(ArgumentErr() << "The checkpoint interval must be non-negative.\n");
+  if (opt.resume && opt.multigrid_cycles > 0)
+    vw_throw(ArgumentErr() << "Cannot resume with multigrid cycles.\n");
+  if (opt.checkpoint_interval > 0 && opt.matrix_free_solver)
+    vw_out(WarningMessage) << "No checkpoints are written with the matrix-free solver.\n";
+  
+  if (opt.max_images_per_pixel < 0)
+    vw_throw(ArgumentErr() << "The maximum number of images per pixel must be non-negative.\n");
+  if (opt.exposure_samples < 0)
+    vw_throw(ArgumentErr() << "The number of exposure samples must be non-negative.\n");
+  
   if (opt.compute_exposures_only){
     if (opt.use_approx_camera_models ||
         opt.use_approx_adjusted_camera_models ||
@@ -4007,6 +4833,52 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     vw_throw( ArgumentErr()
               << "Using cropped input images implies that the cameras are not floated.\n" );
 
+  if (opt.shadow_cache_height_change < 0.0)
+    vw_throw(ArgumentErr() << "The shadow cache height change must be non-negative.\n");
+  
+  if (opt.use_camera_lookup_tables && opt.float_cameras) {
+    vw_out(WarningMessage) << "Not using camera lookup tables, as the cameras are floated.\n";
+    opt.use_camera_lookup_tables = false;
+  }
+  if (opt.camera_lookup_table_height_change < 0.0)
+    vw_throw(ArgumentErr() << "The camera lookup table height change must be non-negative.\n");
+  
+  if (opt.matrix_free_solver) {
+    // These terms are not part of the cost function the matrix-free
+    // solver minimizes
+    if (opt.float_cameras || opt.float_haze || opt.float_reflectance_model ||
+        opt.float_sun_position)
+      vw_throw(ArgumentErr() << "The matrix-free solver does not allow floating the cameras, "
+               << "haze, reflectance model, or Sun positions.\n");
+    if (opt.integrability_weight > 0 || opt.curvature_in_shadow_weight > 0 ||
+        opt.gradient_weight > 0)
+      vw_throw(ArgumentErr() << "The matrix-free solver does not allow the integrability "
+               << "constraint, curvature in shadow, or gradient weight.\n");
+    if (opt.float_dem_at_boundary || opt.boundary_fix)
+      vw_throw(ArgumentErr() << "The matrix-free solver does not allow floating the DEM "
+               << "at the boundary or the boundary fix.\n");
+  }
+  
+  if (opt.solver_tile_size < 0)
+    vw_throw(ArgumentErr() << "The solver tile size must be non-negative.\n");
+  if (opt.solver_tile_size > 0) {
+    if (opt.solver_tile_padding < 1)
+      vw_throw(ArgumentErr() << "The solver tile padding must be positive.\n");
+    if (opt.solver_tile_passes < 1)
+      vw_throw(ArgumentErr() << "The number of solver tile passes must be positive.\n");
+    if (opt.input_dems.size() != 1)
+      vw_throw(ArgumentErr() << "Solving over tiles works with only one input DEM.\n");
+    // The tiles are solved independently, so quantities which are
+    // shared by all of them must stay fixed.
+    if (opt.float_cameras || opt.float_exposure || opt.float_haze ||
+        opt.float_reflectance_model || opt.float_sun_position)
+      vw_throw(ArgumentErr() << "Solving over tiles does not allow floating the cameras, "
+               << "exposures, haze, reflectance model, or Sun positions.\n");
+    if (opt.integrability_weight > 0 || opt.float_dem_at_boundary || opt.boundary_fix)
+      vw_throw(ArgumentErr() << "Solving over tiles does not allow the integrability "
+               << "constraint, floating the DEM at the boundary, or the boundary fix.\n");
+  }
+  
   // Create the output directory
   vw::create_out_dir(opt.out_prefix);
 
@@ -4226,6 +5098,12 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
   if (opt.coarse_levels < 0) {
     vw_throw(ArgumentErr() << "Expecting the number of levels to be non-negative.\n");
   }
+  if (opt.multigrid_cycles < 0 || opt.multigrid_smoothing_iterations < 0)
+    vw_throw(ArgumentErr() << "Expecting the number of multigrid cycles and smoothing "
+             << "iterations to be non-negative.\n");
+  if (opt.multigrid_cycles > 0 && opt.coarse_levels == 0)
+    vw_out(WarningMessage) << "Multigrid cycles need --coarse-levels to be positive. "
+                           << "Not doing them.\n";
 
   // Need this to be able to load adjusted camera models. That will happen
   // in the stereo session.
@@ -4296,17 +5174,547 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
       opt.crop_input_images = false;
       opt.use_semi_approx = false;
     }
-    
-    //if (opt.image_exposures_vec.empty())
-    //  vw_throw( ArgumentErr()
-    // << "Expecting the exposures to be computed and passed in.\n" );
-    
-    if (opt.num_haze_coeffs > 0 && opt.image_haze_vec.empty())
-      vw_throw( ArgumentErr()
-                << "Expecting the haze to be computed and passed in.\n" );
+    
+    //if (opt.image_exposures_vec.empty())
+    //  vw_throw( ArgumentErr()
+    // << "Expecting the exposures to be computed and passed in.\n" );
+    
+    if (opt.num_haze_coeffs > 0 && opt.image_haze_vec.empty())
+      vw_throw( ArgumentErr()
+                << "Expecting the haze to be computed and passed in.\n" );
+  }
+  
+  
+}
+
+// For each grid point of a DEM, find the images seeing it best, up to
+// max_images of them, to be the only ones giving intensity residuals
+// there. An image counts at a grid point only if it is lit there and
+// its intensity is valid, so not in shadow or saturated. The images
+// are ranked by the computed reflectance, which grows with the cosine
+// of the Sun incidence angle, times the blending weight. The result has
+// max_images layers, with -1 where there are fewer usable images.
+void selectImagesPerPixel(Options const& opt, int dem_iter,
+                          ImageView<double> const& dem,
+                          cartography::GeoReference const& geo,
+                          double & max_dem_height, // alias
+                          double gridx, double gridy,
+                          std::vector<ModelParams> const& model_params,
+                          GlobalParams const& global_params,
+                          std::vector<BBox2i>     const& crop_boxes,
+                          std::vector<MaskedImgT> const& masked_images,
+                          std::vector<DoubleImgT> const& blend_weights,
+                          std::vector<boost::shared_ptr<CameraModel> > const& cameras,
+                          std::vector<double> const& scaled_sun_posns,
+                          std::vector<double> const& reflectance_model_coeffs,
+                          int max_images,
+                          std::vector< ImageView<int> > & selected) {
+
+  int cols = dem.cols(), rows = dem.rows();
+  std::vector< ImageView<float> > scores(max_images);
+  selected.resize(max_images);
+  for (int k = 0; k < max_images; k++) {
+    scores[k].set_size(cols, rows);
+    selected[k].set_size(cols, rows);
+    for (int col = 0; col < cols; col++) {
+      for (int row = 0; row < rows; row++) {
+        scores[k](col, row) = -1.0;
+        selected[k](col, row) = -1;
+      }
+    }
+  }
+  
+  int num_images = opt.input_images.size();
+  for (int image_iter = 0; image_iter < num_images; image_iter++) {
+
+    if (opt.skip_images[dem_iter].find(image_iter) != opt.skip_images[dem_iter].end())
+      continue;
+
+    ImageView< PixelMask<double> > reflectance, intensity;
+    ImageView<double> weight;
+    ImageView<Vector2> pq; // not used
+    int sample_col_rate = 1, sample_row_rate = 1;
+    computeReflectanceAndIntensity(dem, pq, geo,
+                                   opt.model_shadows, max_dem_height,
+                                   gridx, gridy, sample_col_rate, sample_row_rate,
+                                   model_params[image_iter], global_params,
+                                   crop_boxes[image_iter], masked_images[image_iter],
+                                   blend_weights[image_iter],
+                                   cameras[image_iter].get(),
+                                   &scaled_sun_posns[3*image_iter],
+                                   reflectance, intensity, weight,
+                                   &reflectance_model_coeffs[0], NULL, NULL,
+                                   opt.fast_shadows, opt.num_threads);
+
+    // Keep the layers sorted by decreasing score
+    for (int col = 0; col < cols; col++) {
+      for (int row = 0; row < rows; row++) {
+        if (!is_valid(reflectance(col, row)) || !is_valid(intensity(col, row)))
+          continue;
+        float score = reflectance(col, row).child() * weight(col, row);
+        if (score <= 0 || score <= scores[max_images-1](col, row))
+          continue;
+        int k = max_images - 1;
+        while (k > 0 && scores[k-1](col, row) < score) {
+          scores[k](col, row)   = scores[k-1](col, row);
+          selected[k](col, row) = selected[k-1](col, row);
+          k--;
+        }
+        scores[k](col, row)   = score;
+        selected[k](col, row) = image_iter;
+      }
+    }
+  }
+}
+
+// If an image is among those selected at a grid point
+bool isSelectedImage(std::vector< ImageView<int> > const& selected,
+                     int col, int row, int image_iter) {
+  for (size_t k = 0; k < selected.size(); k++) {
+    if (selected[k](col, row) == image_iter)
+      return true;
+    if (selected[k](col, row) < 0)
+      break;
+  }
+  return false;
+}
+
+// The sfs cost function as a single function of all the heights, and
+// of the albedos and exposures if floated, for the matrix-free
+// solver. It has the same terms as the problem made in run_sfs_level(),
+// for the configuration with the cameras, haze, reflectance model, and
+// Sun positions fixed. The intensity terms are differentiated
+// numerically at each grid point, and the others analytically, with
+// nothing more than the gradient stored. The boundary heights are fixed,
+// so their gradient is zero.
+class SfsObjective: public ceres::FirstOrderFunction {
+public:
+  SfsObjective(Options const& opt,
+               std::vector<GeoReference> const& geo,
+               double smoothness_weight, double gridx, double gridy,
+               std::vector<double> const& max_dem_height,
+               std::vector< std::vector<BBox2i>     > const& crop_boxes,
+               std::vector< std::vector<MaskedImgT> > const& masked_images,
+               std::vector< std::vector<DoubleImgT> > const& blend_weights,
+               GlobalParams const& global_params,
+               std::vector<ModelParams> const & model_params,
+               std::vector< ImageView<double> > const& orig_dems, 
+               double initial_albedo,
+               std::vector< std::vector<CameraLookupTable> > const& camera_tables,
+               std::vector< std::vector<ShadowCache> > const& shadow_caches,
+               ShadowCacheCallback * shadow_callback, // may be NULL
+               std::vector< std::vector< ImageView<int> > > const& selected_images,
+               std::vector< std::vector<boost::shared_ptr<CameraModel> > > const& cameras,
+               std::vector< std::vector<double> > const& haze,
+               std::vector<double> const& scaled_sun_posns,
+               std::vector<double> const& adjustments,
+               std::vector<double> const& reflectance_model_coeffs,
+               std::vector< ImageView<double> > & dems,
+               std::vector< ImageView<double> > & albedos,
+               std::vector<double> & exposures):
+    m_opt(opt), m_geo(geo), m_smoothness_weight(smoothness_weight),
+    m_gridx(gridx), m_gridy(gridy), m_max_dem_height(max_dem_height),
+    m_crop_boxes(crop_boxes), m_masked_images(masked_images),
+    m_blend_weights(blend_weights), m_global_params(global_params),
+    m_model_params(model_params), m_orig_dems(orig_dems), m_initial_albedo(initial_albedo),
+    m_camera_tables(camera_tables), m_shadow_caches(shadow_caches),
+    m_shadow_callback(shadow_callback), m_selected_images(selected_images),
+    m_cameras(cameras), m_haze(haze),
+    m_scaled_sun_posns(scaled_sun_posns), m_adjustments(adjustments),
+    m_reflectance_model_coeffs(reflectance_model_coeffs),
+    m_dems(dems), m_albedos(albedos), m_exposures(exposures) {
+
+    // The heights of all DEMs go first, then the albedos, then the exposures
+    m_num_parameters = 0;
+    for (size_t dem_iter = 0; dem_iter < m_dems.size(); dem_iter++) {
+      m_dem_start.push_back(m_num_parameters);
+      m_num_parameters += m_dems[dem_iter].cols() * m_dems[dem_iter].rows();
+    }
+    for (size_t dem_iter = 0; dem_iter < m_dems.size(); dem_iter++) {
+      m_albedo_start.push_back(m_num_parameters);
+      if (m_opt.float_albedo)
+        m_num_parameters += m_dems[dem_iter].cols() * m_dems[dem_iter].rows();
+    }
+    m_exposure_start = m_num_parameters;
+    if (m_opt.float_exposure)
+      m_num_parameters += m_exposures.size();
+  }
+
+  virtual int NumParameters() const { return m_num_parameters; }
+
+  // Copy the quantities being solved for to a vector and back
+  void pack(std::vector<double> & x) const {
+    x.resize(m_num_parameters);
+    for (size_t dem_iter = 0; dem_iter < m_dems.size(); dem_iter++) {
+      int cols = m_dems[dem_iter].cols(), rows = m_dems[dem_iter].rows();
+      for (int col = 0; col < cols; col++) {
+        for (int row = 0; row < rows; row++) {
+          x[m_dem_start[dem_iter] + col*rows + row] = m_dems[dem_iter](col, row);
+          if (m_opt.float_albedo)
+            x[m_albedo_start[dem_iter] + col*rows + row] = m_albedos[dem_iter](col, row);
+        }
+      }
+    }
+    if (m_opt.float_exposure) {
+      for (size_t image_iter = 0; image_iter < m_exposures.size(); image_iter++)
+        x[m_exposure_start + image_iter] = m_exposures[image_iter];
+    }
+  }
+  void unpack(const double* x) const {
+    for (size_t dem_iter = 0; dem_iter < m_dems.size(); dem_iter++) {
+      int cols = m_dems[dem_iter].cols(), rows = m_dems[dem_iter].rows();
+      for (int col = 0; col < cols; col++) {
+        for (int row = 0; row < rows; row++) {
+          m_dems[dem_iter](col, row) = x[m_dem_start[dem_iter] + col*rows + row];
+          if (m_opt.float_albedo)
+            m_albedos[dem_iter](col, row) = x[m_albedo_start[dem_iter] + col*rows + row];
+        }
+      }
+    }
+    if (m_opt.float_exposure) {
+      for (size_t image_iter = 0; image_iter < m_exposures.size(); image_iter++)
+        m_exposures[image_iter] = x[m_exposure_start + image_iter];
+    }
+  }
+
+  virtual bool Evaluate(const double* parameters, double* cost, double* gradient) const;
+
+  // The part of the cost and gradient due to the grid points in the given
+  // columns of a DEM. The gradient is modified only for those columns and
+  // their immediate neighbors, and the exposure gradient is accumulated
+  // separately, so that blocks of columns not next to each other can be
+  // done in parallel.
+  void evaluate_columns(int dem_iter, int beg_col, int end_col, double * gradient,
+                        double & cost, std::vector<double> & exposure_gradient) const;
+
+private:
+
+  // The weighted intensity residual of an image at a grid point
+  double intensity_residual(int dem_iter, int image_iter, int col, int row,
+                            const double * heights, // left, center, right, bottom, top
+                            double albedo, double exposure) const {
+    CameraLookupTable const* camera_table = NULL;
+    if (m_opt.use_camera_lookup_tables)
+      camera_table = &m_camera_tables[dem_iter][image_iter];
+    ShadowCache const* shadow_cache = NULL;
+    if (m_shadow_callback != NULL)
+      shadow_cache = &m_shadow_caches[dem_iter][image_iter];
+    
+    bool use_pq = false;
+    const double * const pq = NULL;
+    double residual = 0.0;
+    calc_intensity_residual(&exposure, &m_haze[image_iter][0],
+                            &heights[0], &heights[1], &heights[2], &heights[3], &heights[4],
+                            use_pq, pq, &albedo,
+                            &m_adjustments[6*image_iter],
+                            &m_scaled_sun_posns[3*image_iter],
+                            &m_reflectance_model_coeffs[0],
+                            col, row, m_dems[dem_iter], m_geo[dem_iter],
+                            m_opt.model_shadows, m_opt.camera_position_step_size,
+                            m_max_dem_height[dem_iter], m_gridx, m_gridy,
+                            m_global_params, m_model_params[image_iter],
+                            m_crop_boxes[dem_iter][image_iter],
+                            m_masked_images[dem_iter][image_iter],
+                            m_blend_weights[dem_iter][image_iter],
+                            m_cameras[dem_iter][image_iter],
+                            camera_table, shadow_cache, &residual);
+    return residual;
+  }
+
+  // The step Ceres uses for central differences
+  static double diff_step(double val) {
+    double step = 1.0e-6 * std::abs(val);
+    if (step == 0.0)
+      step = 1.0e-6;
+    return step;
+  }
+  
+  Options                                 const& m_opt;
+  std::vector<GeoReference>               const& m_geo;
+  double                                         m_smoothness_weight, m_gridx, m_gridy;
+  std::vector<double>                     const& m_max_dem_height;
+  std::vector< std::vector<BBox2i>     >  const& m_crop_boxes;
+  std::vector< std::vector<MaskedImgT> >  const& m_masked_images;
+  std::vector< std::vector<DoubleImgT> >  const& m_blend_weights;
+  GlobalParams                            const& m_global_params;
+  std::vector<ModelParams>                const& m_model_params;
+  std::vector< ImageView<double> >        const& m_orig_dems;
+  double                                         m_initial_albedo;
+  std::vector< std::vector<CameraLookupTable> > const& m_camera_tables;
+  std::vector< std::vector<ShadowCache> > const& m_shadow_caches;
+  ShadowCacheCallback                          * m_shadow_callback;
+  std::vector< std::vector< ImageView<int> > > const& m_selected_images;
+  std::vector< std::vector<boost::shared_ptr<CameraModel> > > const& m_cameras;
+  std::vector< std::vector<double> >      const& m_haze;
+  std::vector<double>                     const& m_scaled_sun_posns;
+  std::vector<double>                     const& m_adjustments;
+  std::vector<double>                     const& m_reflectance_model_coeffs;
+  // These are overwritten with the point at which the cost is evaluated
+  std::vector< ImageView<double> >             & m_dems;
+  std::vector< ImageView<double> >             & m_albedos;
+  std::vector<double>                          & m_exposures;
+  int m_num_parameters, m_exposure_start;
+  std::vector<int> m_dem_start, m_albedo_start;
+};
+
+void SfsObjective::evaluate_columns(int dem_iter, int beg_col, int end_col, double * gradient,
+                                    double & cost, std::vector<double> & exposure_gradient) const {
+  
+  ImageView<double> const& dem = m_dems[dem_iter];
+  int cols = dem.cols(), rows = dem.rows();
+  int num_images = m_exposures.size();
+  bool float_heights = !m_opt.fix_dem;
+  
+  // The change in each height from its value at (col, row)
+  int dcol[5] = {-1, 0, 1, 0,  0}; // left, center, right, bottom, top
+  int drow[5] = { 0, 0, 0, 1, -1};
+
+  // Add to the gradient of a height, unless it is fixed
+  double * dem_grad = NULL;
+  if (gradient != NULL && float_heights)
+    dem_grad = gradient + m_dem_start[dem_iter];
+  
+  cost = 0.0;
+  exposure_gradient.assign(num_images, 0.0);
+  double b = m_opt.robust_threshold * m_opt.robust_threshold;
+  
+  for (int col = std::max(beg_col, 1); col < std::min(end_col, cols - 1); col++) {
+    for (int row = 1; row < rows - 1; row++) {
+
+      double heights[5];
+      for (int k = 0; k < 5; k++)
+        heights[k] = dem(col + dcol[k], row + drow[k]);
+      double albedo = m_albedos[dem_iter](col, row);
+      
+      // Intensity error for each image
+      for (int image_iter = 0; image_iter < num_images; image_iter++) {
+        
+        if (m_opt.skip_images[dem_iter].find(image_iter) != m_opt.skip_images[dem_iter].end())
+          continue;
+        if (m_opt.max_images_per_pixel > 0 &&
+            m_selected_images[dem_iter][0](col, row) >= 0 &&
+            !isSelectedImage(m_selected_images[dem_iter], col, row, image_iter))
+          continue;
+
+        double exposure = m_exposures[image_iter];
+        double r = intensity_residual(dem_iter, image_iter, col, row, heights,
+                                      albedo, exposure);
+        if (r == 0.0)
+          continue; // no contribution to the cost or its gradient
+        
+        // The Cauchy loss, as used by Ceres, is rho(s) = b*log(1 + s/b)
+        double s = r*r, scale = r;
+        if (m_opt.robust_threshold > 0) {
+          cost += 0.5 * b * log(1.0 + s/b);
+          scale = r / (1.0 + s/b);
+        } else {
+          cost += 0.5 * s;
+        }
+        
+        if (gradient == NULL) 
+          continue;
+        
+        if (dem_grad != NULL) {
+          for (int k = 0; k < 5; k++) {
+            int c = col + dcol[k], w = row + drow[k];
+            if (c == 0 || c == cols - 1 || w == 0 || w == rows - 1)
+              continue; // the boundary is fixed
+            double h = heights[k];
+            double step = diff_step(h);
+            heights[k] = h + step;
+            double rp = intensity_residual(dem_iter, image_iter, col, row, heights,
+                                           albedo, exposure);
+            heights[k] = h - step;
+            double rm = intensity_residual(dem_iter, image_iter, col, row, heights,
+                                           albedo, exposure);
+            heights[k] = h;
+            dem_grad[c*rows + w] += scale * (rp - rm) / (2.0 * step);
+          }
+        }
+
+        // The residual is linear in the albedo
+        if (m_opt.float_albedo) {
+          double r1 = intensity_residual(dem_iter, image_iter, col, row, heights,
+                                         albedo + 1.0, exposure);
+          gradient[m_albedo_start[dem_iter] + col*rows + row] += scale * (r1 - r);
+        }
+
+        if (m_opt.float_exposure) {
+          double step = diff_step(exposure);
+          double rp = intensity_residual(dem_iter, image_iter, col, row, heights,
+                                         albedo, exposure + step);
+          double rm = intensity_residual(dem_iter, image_iter, col, row, heights,
+                                         albedo, exposure - step);
+          exposure_gradient[image_iter] += scale * (rp - rm) / (2.0 * step);
+        }
+      }
+
+      // Smoothness penalty, as in SmoothnessError
+      double wxx = m_smoothness_weight/m_gridx/m_gridx;
+      double wxy = m_smoothness_weight/4.0/m_gridx/m_gridy;
+      double wyy = m_smoothness_weight/m_gridy/m_gridy;
+      double uxx = wxx * (dem(col-1, row) + dem(col+1, row) - 2*dem(col, row));
+      double uxy = wxy * (dem(col+1, row+1) + dem(col-1, row-1)
+                          - dem(col-1, row+1) - dem(col+1, row-1));
+      double uyy = wyy * (dem(col, row+1) + dem(col, row-1) - 2*dem(col, row));
+      cost += 0.5 * (uxx*uxx + 2*uxy*uxy + uyy*uyy); // u_xy is counted twice
+      
+      // Deviation from prescribed height constraint
+      double hc = (dem(col, row) - m_orig_dems[dem_iter](col, row))
+        * m_opt.initial_dem_constraint_weight;
+      if (m_opt.initial_dem_constraint_weight > 0)
+        cost += 0.5 * hc * hc;
+      
+      // Deviation from prescribed albedo
+      double ac = (albedo - m_initial_albedo) * m_opt.albedo_constraint_weight;
+      if (m_opt.float_albedo && m_opt.albedo_constraint_weight > 0) {
+        cost += 0.5 * ac * ac;
+        if (gradient != NULL)
+          gradient[m_albedo_start[dem_iter] + col*rows + row]
+            += ac * m_opt.albedo_constraint_weight;
+      }
+      
+      if (dem_grad == NULL)
+        continue;
+
+      // The derivatives of the smoothness and height change terms
+      // with respect to the heights around (col, row)
+      double terms[3][3]; // indexed by the column and row offsets plus one
+      for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+          terms[i][j] = 0.0;
+      terms[0][1] += uxx * wxx;
+      terms[2][1] += uxx * wxx;
+      terms[1][1] -= 2 * uxx * wxx;
+      terms[2][2] += 2 * uxy * wxy;
+      terms[0][0] += 2 * uxy * wxy;
+      terms[0][2] -= 2 * uxy * wxy;
+      terms[2][0] -= 2 * uxy * wxy;
+      terms[1][2] += uyy * wyy;
+      terms[1][0] += uyy * wyy;
+      terms[1][1] -= 2 * uyy * wyy;
+      if (m_opt.initial_dem_constraint_weight > 0)
+        terms[1][1] += hc * m_opt.initial_dem_constraint_weight;
+      
+      for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+          int c = col + i - 1, w = row + j - 1;
+          if (c == 0 || c == cols - 1 || w == 0 || w == rows - 1)
+            continue; // the boundary is fixed
+          dem_grad[c*rows + w] += terms[i][j];
+        }
+      }
+    }
+  }
+}
+
+// Evaluate the sfs cost function over a block of DEM columns
+class SfsObjectiveTask: public vw::Task, private boost::noncopyable {
+  SfsObjective const& m_objective;
+  int m_dem_iter, m_beg_col, m_end_col;
+  double * m_gradient;
+  double & m_cost;
+  std::vector<double> & m_exposure_gradient;
+public:
+  SfsObjectiveTask(SfsObjective const& objective, int dem_iter, int beg_col, int end_col,
+                   double * gradient, double & cost, std::vector<double> & exposure_gradient):
+    m_objective(objective), m_dem_iter(dem_iter), m_beg_col(beg_col), m_end_col(end_col),
+    m_gradient(gradient), m_cost(cost), m_exposure_gradient(exposure_gradient) {}
+  
+  void operator()() {
+    m_objective.evaluate_columns(m_dem_iter, m_beg_col, m_end_col, m_gradient,
+                                 m_cost, m_exposure_gradient);
+  }
+};
+
+bool SfsObjective::Evaluate(const double* parameters, double* cost, double* gradient) const {
+
+  // The intensity residuals read the heights from the DEMs
+  unpack(parameters);
+  if (m_shadow_callback != NULL)
+    m_shadow_callback->update();
+  
+  if (gradient != NULL) {
+    for (int it = 0; it < m_num_parameters; it++)
+      gradient[it] = 0.0;
+  }
+  
+  // A block of columns changes the gradient of the heights in it and
+  // its neighboring columns. Hence, with blocks being at least two
+  // columns wide, first do the even-numbered blocks in parallel, then
+  // the odd-numbered ones.
+  *cost = 0.0;
+  int num_threads = std::max(m_opt.num_threads, 1);
+  for (size_t dem_iter = 0; dem_iter < m_dems.size(); dem_iter++) {
+    int cols = m_dems[dem_iter].cols();
+    int cols_per_block = std::max(2, (cols + 8 * num_threads - 1) / (8 * num_threads));
+    int num_blocks = (cols + cols_per_block - 1) / cols_per_block;
+    std::vector<double> block_costs(num_blocks, 0.0);
+    std::vector< std::vector<double> > exposure_gradients(num_blocks);
+    for (int parity = 0; parity < 2; parity++) {
+      FifoWorkQueue queue(num_threads);
+      for (int block = parity; block < num_blocks; block += 2) {
+        int beg_col = block * cols_per_block;
+        int end_col = std::min(beg_col + cols_per_block, cols);
+        boost::shared_ptr<SfsObjectiveTask>
+          task(new SfsObjectiveTask(*this, dem_iter, beg_col, end_col, gradient,
+                                    block_costs[block], exposure_gradients[block]));
+        queue.add_task(task);
+      }
+      queue.join_all();
+    }
+
+    // Add up in a fixed order, so the result does not depend on the threads
+    for (int block = 0; block < num_blocks; block++) {
+      *cost += block_costs[block];
+      if (gradient == NULL || !m_opt.float_exposure)
+        continue;
+      for (size_t image_iter = 0; image_iter < exposure_gradients[block].size(); image_iter++)
+        gradient[m_exposure_start + image_iter] += exposure_gradients[block][image_iter];
+    }
   }
   
+  return true;
+}
+
+// Run sfs at a given coarseness level with L-BFGS on the cost function
+// in SfsObjective, rather than forming the Jacobian as Ceres does in
+// run_sfs_level(). Only the final results are saved.
+void run_sfs_level_matrix_free(int num_iterations, SfsObjective * objective,
+                               bool save_results) {
+
+  // The problem owns the objective
+  ceres::GradientProblem problem(objective);
+  std::vector<double> x;
+  objective->pack(x);
+  
+  ceres::GradientProblemSolver::Options options;
+  options.line_search_direction_type = ceres::LBFGS;
+  options.gradient_tolerance = 1e-16;
+  options.function_tolerance = 1e-16;
+  options.max_num_iterations = num_iterations;
+  options.minimizer_progress_to_stdout = true;
+
+  ceres::GradientProblemSolver::Summary summary;
+  if (options.max_num_iterations > 0 && !x.empty()) {
+    asp::TraceSpan span("ceres_solve", "solver");
+    ceres::Solve(options, problem, &x[0], &summary);
+  }
+
+  // The DEMs and other quantities have the values at the last point
+  // where the cost was evaluated. Use the solution instead.
+  if (!x.empty())
+    objective->unpack(&x[0]);
+
+  // Save the final results
+  if (save_results) {
+    g_final_iter = true;
+    SfsCallback callback;
+    ceres::IterationSummary callback_summary;
+    callback(callback_summary);
+  }
   
+  vw_out() << summary.FullReport() << "\n" << std::endl;
 }
 
 // Run sfs at a given coarseness level
@@ -4324,6 +5732,7 @@ void run_sfs_level(// Fixed inputs
                    double initial_albedo,
                    ImageView<int> const& lit_image_mask,
                    ImageView<double> const& curvature_in_shadow_weight,
+                   bool save_results,
                    // Quantities that will float
                    std::vector< ImageView<double> > & dems,
                    std::vector< ImageView<double> > & albedos,
@@ -4410,6 +5819,100 @@ void run_sfs_level(// Fixed inputs
     float_dem_only = false;
   }
   
+  if (opt.num_threads > 1 &&
+      opt.stereo_session == "isis"  &&
+      !opt.use_approx_camera_models &&
+      !opt.use_approx_adjusted_camera_models) {
+    vw_out() << "Using exact ISIS camera models. Can run with only a single thread.\n";
+    opt.num_threads = 1;
+  }
+
+  vw_out() << "Using: " << opt.num_threads << " thread(s).\n";
+
+  // Tabulate where the DEM grid points project into the images, if the
+  // cameras stay fixed, so that they need not be projected at each iteration
+  std::vector< std::vector<CameraLookupTable> > camera_tables(num_dems);
+  for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) {
+    camera_tables[dem_iter].resize(num_images);
+    if (!opt.use_camera_lookup_tables)
+      continue;
+    for (int image_iter = 0; image_iter < num_images; image_iter++) {
+      if (opt.skip_images[dem_iter].find(image_iter) != opt.skip_images[dem_iter].end())
+        continue;
+      build_camera_lookup_table(dems[dem_iter], geo[dem_iter],
+                                cameras[dem_iter][image_iter].get(),
+                                opt.camera_lookup_table_height_change, opt.num_threads,
+                                camera_tables[dem_iter][image_iter]);
+    }
+  }
+  
+  // Find the shadows in one sweep over the DEM for each image, and keep
+  // them until the heights change enough
+  bool use_shadow_caches = (opt.model_shadows && opt.fast_shadows);
+  std::vector< std::vector<ShadowCache> > shadow_caches(num_dems);
+  for (int dem_iter = 0; dem_iter < num_dems; dem_iter++)
+    shadow_caches[dem_iter].resize(num_images);
+  ShadowCacheCallback shadow_callback(opt, dems, geo, model_params, scaled_sun_posns,
+                                      shadow_caches);
+  if (use_shadow_caches)
+    shadow_callback.update();
+
+  // Find the images giving residuals at each grid point, if limited
+  std::vector< std::vector< ImageView<int> > > selected_images(num_dems);
+  if (opt.max_images_per_pixel > 0) {
+    for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) {
+      selectImagesPerPixel(opt, dem_iter, dems[dem_iter], geo[dem_iter],
+                           max_dem_height[dem_iter], gridx, gridy,
+                           model_params, global_params, crop_boxes[dem_iter],
+                           masked_images[dem_iter], blend_weights[dem_iter],
+                           cameras[dem_iter], scaled_sun_posns, reflectance_model_coeffs,
+                           opt.max_images_per_pixel, selected_images[dem_iter]);
+    }
+  }
+  std::vector<bool> image_has_residuals(num_images, false);
+  
+  // A bunch of global variables to use in the callback
+  g_dem            = &dems;
+  g_pq             = &pq;
+  g_albedo         = &albedos;
+  g_geo            = &geo;
+  g_global_params  = &global_params;
+  g_model_params   = &model_params;
+  g_crop_boxes     = &crop_boxes;
+  g_masked_images  = &masked_images;
+  g_blend_weights  = &blend_weights;
+  g_cameras        = &cameras;
+  g_iter           = g_start_iter; // reset the iterations for each level, unless resuming
+  g_start_iter     = -1;
+  g_final_iter     = false;
+
+  if (opt.matrix_free_solver) {
+    // As below, with one image and no constraints the albedo and
+    // exposure are under-determined
+    if (opt.initial_dem_constraint_weight <= 0 && num_used <= 1) {
+      if (opt.float_albedo && opt.albedo_constraint_weight <= 0) {
+        vw_out() << "No DEM or albedo constraint is used, and there is at most one "
+                 << "usable image. Fixing the albedo.\n";
+        opt.float_albedo = false;
+      }
+      if (opt.float_exposure) {
+        vw_out() << "No DEM constraint is used, and there is at most one "
+                 << "usable image. Fixing the exposure.\n";
+        opt.float_exposure = false;
+      }
+    }
+    
+    SfsObjective * objective
+      = new SfsObjective(opt, geo, smoothness_weight, gridx, gridy, max_dem_height,
+                         crop_boxes, masked_images, blend_weights, global_params,
+                         model_params, orig_dems, initial_albedo, camera_tables,
+                         shadow_caches, use_shadow_caches ? &shadow_callback : NULL,
+                         selected_images, cameras, haze, scaled_sun_posns, adjustments,
+                         reflectance_model_coeffs, dems, albedos, exposures);
+    run_sfs_level_matrix_free(num_iterations, objective, save_results);
+    return;
+  }
+  
   std::set<int> use_dem, use_albedo; // to avoid a crash in Ceres when a param is fixed but not set
   
   for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) {
@@ -4427,10 +5930,24 @@ void run_sfs_level(// Fixed inputs
           if (opt.skip_images[dem_iter].find(image_iter) != opt.skip_images[dem_iter].end()) {
             continue;
           }
+
+          // Where no image is usable, keep them all, as then there is
+          // nothing to choose from
+          if (opt.max_images_per_pixel > 0 && selected_images[dem_iter][0](col, row) >= 0 &&
+              !isSelectedImage(selected_images[dem_iter], col, row, image_iter))
+            continue;
+          image_has_residuals[image_iter] = true;
           
           ceres::LossFunction* loss_function_img = NULL;
           if (opt.robust_threshold > 0) 
             loss_function_img = new ceres::CauchyLoss(opt.robust_threshold);
+
+          CameraLookupTable const* camera_table = NULL;
+          if (opt.use_camera_lookup_tables)
+            camera_table = &camera_tables[dem_iter][image_iter];
+          ShadowCache const* shadow_cache = NULL;
+          if (use_shadow_caches)
+            shadow_cache = &shadow_caches[dem_iter][image_iter];
           
           if (float_dem_only) {
             ceres::CostFunction* cost_function_img =
@@ -4451,7 +5968,8 @@ void run_sfs_level(// Fixed inputs
                                                  masked_images[dem_iter][image_iter],
                                                  blend_weights[dem_iter][image_iter],
                                                  &scaled_sun_posns[3*image_iter], // sun positions
-                                                 cameras[dem_iter][image_iter]);
+                                                 cameras[dem_iter][image_iter],
+                                                 camera_table, shadow_cache);
             problem.AddResidualBlock(cost_function_img, loss_function_img,
                                      &dems[dem_iter](col-1, row),  // left
                                      &dems[dem_iter](col, row),    // center
@@ -4473,7 +5991,8 @@ void run_sfs_level(// Fixed inputs
                                      masked_images[dem_iter][image_iter],
                                      blend_weights[dem_iter][image_iter],
                                      &scaled_sun_posns[3*image_iter], // sun positions
-                                     cameras[dem_iter][image_iter]);
+                                     cameras[dem_iter][image_iter],
+                                     camera_table, shadow_cache);
             problem.AddResidualBlock(cost_function_img, loss_function_img,
                                      &exposures[image_iter],       // exposure
                                      &haze[image_iter][0],         // haze
@@ -4500,7 +6019,8 @@ void run_sfs_level(// Fixed inputs
                                        crop_boxes[dem_iter][image_iter],
                                        masked_images[dem_iter][image_iter],
                                        blend_weights[dem_iter][image_iter],
-                                       cameras[dem_iter][image_iter]);
+                                       cameras[dem_iter][image_iter],
+                                       camera_table, shadow_cache);
             problem.AddResidualBlock(cost_function_img, loss_function_img,
                                      &exposures[image_iter],          // exposure
                                      &haze[image_iter][0],            // haze
@@ -4670,6 +6190,14 @@ void run_sfs_level(// Fixed inputs
     
   } // end iterating over DEMs
 
+  // The parameters of images not selected anywhere are not in the problem
+  if (opt.max_images_per_pixel > 0) {
+    for (int image_iter = 0; image_iter < num_images; image_iter++) {
+      if (!image_has_residuals[image_iter])
+        use_image[image_iter] = false;
+    }
+  }
+  
   if (!float_dem_only) {
 
     // If floating the DEM only, none of the below parameters are even added to the problem,
@@ -4720,16 +6248,6 @@ void run_sfs_level(// Fixed inputs
     }
   }
   
-  if (opt.num_threads > 1 &&
-      opt.stereo_session == "isis"  &&
-      !opt.use_approx_camera_models &&
-      !opt.use_approx_adjusted_camera_models) {
-    vw_out() << "Using exact ISIS camera models. Can run with only a single thread.\n";
-    opt.num_threads = 1;
-  }
-
-  vw_out() << "Using: " << opt.num_threads << " thread(s).\n";
-
   ceres::Solver::Options options;
   options.gradient_tolerance = 1e-16;
   options.function_tolerance = 1e-16;
@@ -4738,42 +6256,256 @@ void run_sfs_level(// Fixed inputs
   options.num_threads = opt.num_threads;
   options.linear_solver_type = ceres::SPARSE_SCHUR;
 
-  // Use a callback function at every iteration
+  // Use a callback function at every iteration. When solving just a
+  // tile of the DEM there is nothing full to save.
   SfsCallback callback;
-  options.callbacks.push_back(&callback);
-  options.update_state_every_iteration = true;
-
-  // A bunch of global variables to use in the callback
-  g_dem            = &dems;
-  g_pq             = &pq;
-  g_albedo         = &albedos;
-  g_geo            = &geo;
-  g_global_params  = &global_params;
-  g_model_params   = &model_params;
-  g_crop_boxes     = &crop_boxes;
-  g_masked_images  = &masked_images;
-  g_blend_weights  = &blend_weights;
-  g_cameras        = &cameras;
-  g_iter           = -1; // reset the iterations for each level
-  g_final_iter     = false;
+  if (save_results) {
+    options.callbacks.push_back(&callback);
+    options.update_state_every_iteration = true;
+  }
+  if (use_shadow_caches) {
+    options.callbacks.push_back(&shadow_callback);
+    options.update_state_every_iteration = true;
+  }
 
   // Solve the problem if asked to do iterations. Otherwise
   // just keep the DEM at the initial guess, while saving
   // all the output data as if iterations happened.
   ceres::Solver::Summary summary;
-  if (options.max_num_iterations > 0)
+  if (options.max_num_iterations > 0) {
+    asp::TraceSpan span("ceres_solve", "solver");
     ceres::Solve(options, &problem, &summary);
+  }
 
   // Save the final results
-  g_final_iter = true;
-  ceres::IterationSummary callback_summary;
-  callback(callback_summary);
+  if (save_results) {
+    g_final_iter = true;
+    ceres::IterationSummary callback_summary;
+    callback(callback_summary);
+  }
   
   vw_out() << summary.FullReport() << "\n" << std::endl;
 
   // callTop();
 }
 
+// The region of an image seen by a DEM tile. Project a sample of the
+// tile grid points into the camera, and enlarge the result, as the
+// heights will change. The box is in the coordinates of the full image
+// and is contained in the given crop box.
+BBox2i tile_image_box(ImageView<double> const& dem, GeoReference const& geo,
+                      BBox2i const& tile_box, BBox2i const& crop_box,
+                      CameraModel * camera) {
+
+  // Sample about 50 rows and columns, including the last ones
+  int step = std::max(1, std::max(tile_box.width(), tile_box.height())/50);
+  std::vector<int> cols, rows;
+  for (int col = tile_box.min().x(); col < tile_box.max().x(); col += step)
+    cols.push_back(col);
+  if (cols.back() != tile_box.max().x() - 1)
+    cols.push_back(tile_box.max().x() - 1);
+  for (int row = tile_box.min().y(); row < tile_box.max().y(); row += step)
+    rows.push_back(row);
+  if (rows.back() != tile_box.max().y() - 1)
+    rows.push_back(tile_box.max().y() - 1);
+  
+  BBox2i image_box;
+  for (size_t i = 0; i < cols.size(); i++) {
+    for (size_t j = 0; j < rows.size(); j++) {
+      Vector2 ll = geo.pixel_to_lonlat(Vector2(cols[i], rows[j]));
+      Vector3 xyz = geo.datum().geodetic_to_cartesian
+        (Vector3(ll[0], ll[1], dem(cols[i], rows[j])));
+      try {
+        image_box.grow(camera->point_to_pixel(xyz));
+      } catch (...) {}
+    }
+  }
+  if (image_box.empty())
+    return image_box;
+
+  double extraFactor = 0.5;
+  double extrax = extraFactor * image_box.width();
+  double extray = extraFactor * image_box.height();
+  image_box.min() -= Vector2(extrax, extray);
+  image_box.max() += Vector2(extrax, extray);
+  image_box.crop(crop_box);
+
+  return image_box;
+}
+
+// Run sfs at a given coarseness level by iterating block-Jacobi style
+// over overlapping tiles of the DEM. Each tile is solved on its own,
+// with its outermost ring of heights fixed at the values found by the
+// neighboring tiles at the previous pass, and only the tile without
+// its padding is kept. Only the Ceres problem of the current tile and
+// the image regions it sees are in memory at any time.
+void run_sfs_level_tiled(// Fixed inputs
+                         int num_iterations, Options & opt,
+                         std::vector<GeoReference> const& geo,
+                         double smoothness_weight,
+                         double dem_nodata_val,
+                         std::vector< std::vector<BBox2i>     > const& crop_boxes,
+                         std::vector< std::vector<MaskedImgT> > const& masked_images,
+                         std::vector< std::vector<DoubleImgT> > const& blend_weights,
+                         GlobalParams const& global_params,
+                         std::vector<ModelParams> const & model_params,
+                         std::vector< ImageView<double> > const& orig_dems, 
+                         double initial_albedo,
+                         ImageView<int> const& lit_image_mask,
+                         ImageView<double> const& curvature_in_shadow_weight,
+                         // Quantities that will float
+                         std::vector< ImageView<double> > & dems,
+                         std::vector< ImageView<double> > & albedos,
+                         std::vector< std::vector<boost::shared_ptr<CameraModel> > > & cameras,
+                         std::vector<double> & exposures,
+                         std::vector< std::vector<double> > & haze,
+                         std::vector<double> & scaled_sun_posns,
+                         std::vector<double> & adjustments,
+                         std::vector<double> & reflectance_model_coeffs){
+
+  if (dems.size() != 1)
+    vw_throw(ArgumentErr() << "The tiled solver works with only one input DEM.\n");
+  
+  int num_images = opt.input_images.size();
+  int dem_iter   = 0;
+  int tile_size  = opt.solver_tile_size;
+  int padding    = opt.solver_tile_padding;
+  BBox2i dem_box = bounding_box(dems[dem_iter]);
+
+  std::vector<BBox2i> tiles;
+  for (int col = 0; col < dem_box.width(); col += tile_size) {
+    for (int row = 0; row < dem_box.height(); row += tile_size) {
+      BBox2i tile(col, row, tile_size, tile_size);
+      tile.crop(dem_box);
+      tiles.push_back(tile);
+    }
+  }
+  
+  for (int pass = 0; pass < opt.solver_tile_passes; pass++) {
+
+    // All tiles at this pass start from the same heights and albedo.
+    // The halo of each tile is the result of its neighbors at the
+    // previous pass.
+    ImageView<double> prev_dem = copy(dems[dem_iter]);
+    ImageView<double> prev_albedo = copy(albedos[dem_iter]);
+    
+    for (size_t tile_iter = 0; tile_iter < tiles.size(); tile_iter++) {
+
+      BBox2i tile = tiles[tile_iter];
+      BBox2i padded_tile = tile;
+      padded_tile.expand(padding);
+      padded_tile.crop(dem_box);
+      vw_out() << "Solver pass " << pass << ", tile " << tile_iter + 1
+               << " of " << tiles.size() << ": " << tile << std::endl;
+
+      // Ceres won't be happy with tiny tiles
+      if (padded_tile.width() < 3 || padded_tile.height() < 3)
+        continue;
+      
+      std::vector< ImageView<double> > tile_dems(1), tile_albedos(1), tile_orig_dems(1);
+      tile_dems[0]      = crop(prev_dem, padded_tile);
+      tile_albedos[0]   = crop(prev_albedo, padded_tile);
+      tile_orig_dems[0] = crop(orig_dems[dem_iter], padded_tile);
+      std::vector<GeoReference> tile_geo(1, crop(geo[dem_iter], padded_tile.min().x(),
+                                                 padded_tile.min().y()));
+
+      ImageView<int> tile_lit_image_mask;
+      if (lit_image_mask.cols() > 0)
+        tile_lit_image_mask = crop(lit_image_mask, padded_tile);
+      ImageView<double> tile_curvature_in_shadow_weight;
+      if (curvature_in_shadow_weight.cols() > 0)
+        tile_curvature_in_shadow_weight = crop(curvature_in_shadow_weight, padded_tile);
+      
+      // Read only the image regions this tile sees
+      Options tile_opt = opt;
+      std::vector< std::vector<BBox2i>     > tile_crop_boxes(1);
+      std::vector< std::vector<MaskedImgT> > tile_masked_images(1);
+      std::vector< std::vector<DoubleImgT> > tile_blend_weights(1);
+      tile_crop_boxes[0].resize(num_images);
+      tile_masked_images[0].resize(num_images);
+      tile_blend_weights[0].resize(num_images);
+      for (int image_iter = 0; image_iter < num_images; image_iter++) {
+        if (opt.skip_images[dem_iter].find(image_iter) != opt.skip_images[dem_iter].end())
+          continue;
+        
+        BBox2i crop_box = crop_boxes[dem_iter][image_iter];
+        BBox2i image_box = tile_image_box(prev_dem, geo[dem_iter], padded_tile, crop_box,
+                                          cameras[dem_iter][image_iter].get());
+        if (image_box.empty()) {
+          tile_opt.skip_images[dem_iter].insert(image_iter);
+          continue;
+        }
+
+        // The images are indexed from the corner of their crop boxes
+        BBox2i local_box(image_box.min() - crop_box.min(), image_box.max() - crop_box.min());
+        tile_crop_boxes[0][image_iter] = image_box;
+        ImageView< PixelMask<float> > tile_image
+          = crop(masked_images[dem_iter][image_iter], local_box);
+        tile_masked_images[0][image_iter] = tile_image;
+        if (blend_weights[dem_iter][image_iter].cols() > 0 &&
+            blend_weights[dem_iter][image_iter].rows() > 0) {
+          ImageView<double> tile_weight = crop(blend_weights[dem_iter][image_iter], local_box);
+          tile_blend_weights[0][image_iter] = tile_weight;
+        }
+      }
+      
+      // Fixing the outermost ring of the tile is what ties it to its
+      // neighbors
+      tile_opt.float_dem_at_boundary = false;
+      
+      bool save_results = false;
+      run_sfs_level(num_iterations, tile_opt, tile_geo, smoothness_weight,
+                    dem_nodata_val, tile_crop_boxes, tile_masked_images,
+                    tile_blend_weights, global_params, model_params,
+                    tile_orig_dems, initial_albedo, tile_lit_image_mask,
+                    tile_curvature_in_shadow_weight, save_results,
+                    tile_dems, tile_albedos, cameras, exposures, haze,
+                    scaled_sun_posns, adjustments, reflectance_model_coeffs);
+      opt.num_threads = tile_opt.num_threads; // may have been adjusted
+      
+      // Keep the tile without its padding
+      for (int col = tile.min().x(); col < tile.max().x(); col++) {
+        for (int row = tile.min().y(); row < tile.max().y(); row++) {
+          int c = col - padded_tile.min().x(), r = row - padded_tile.min().y();
+          dems[dem_iter](col, row) = tile_dems[0](c, r);
+          albedos[dem_iter](col, row) = tile_albedos[0](c, r);
+        }
+      }
+    } // end iterating over tiles
+
+    // Save the results for the full DEM. The callback uses the global
+    // variables, which now must refer to the full DEM rather than the
+    // last tile.
+    double gridx, gridy;
+    compute_grid_sizes_in_meters(dems[dem_iter], geo[dem_iter], dem_nodata_val, gridx, gridy);
+    std::vector<double> max_dem_height(1, -std::numeric_limits<double>::max());
+    if (opt.model_shadows) {
+      for (int col = 0; col < dems[dem_iter].cols(); col++) {
+        for (int row = 0; row < dems[dem_iter].rows(); row++)
+          max_dem_height[dem_iter] = std::max(max_dem_height[dem_iter],
+                                              dems[dem_iter](col, row));
+      }
+    }
+    std::vector< ImageView<Vector2> > pq(1); // not used, as integrability is not modeled
+    g_gridx          = &gridx;
+    g_gridy          = &gridy;
+    g_max_dem_height = &max_dem_height;
+    g_dem            = &dems;
+    g_pq             = &pq;
+    g_albedo         = &albedos;
+    g_geo            = &geo;
+    g_crop_boxes     = &crop_boxes;
+    g_masked_images  = &masked_images;
+    g_blend_weights  = &blend_weights;
+    g_cameras        = &cameras;
+    g_iter           = pass - 1;
+    g_final_iter     = (pass == opt.solver_tile_passes - 1);
+    SfsCallback callback;
+    ceres::IterationSummary callback_summary;
+    callback(callback_summary);
+  } // end iterating over passes
+}
+
 #if 0
 
 // Function for highlighting no-data
@@ -5005,6 +6737,225 @@ void setUpModelParams(GlobalParams & global_params, Options & opt) {
   }
 }
 
+// A DEM grid point seen lit in an image, for estimating the exposures
+struct ExposureSample {
+  Vector3 xyz, normal, camera_center;
+  double intensity;
+};
+
+// Discrepancy between the measured intensity at a sample and the one
+// computed with given exposure, haze, and reflectance model coefficients
+struct ExposureSampleError {
+  ExposureSampleError(ExposureSample const& sample, ModelParams const& model_params,
+                      GlobalParams const& global_params, double albedo):
+    m_sample(sample), m_model_params(model_params), m_global_params(global_params),
+    m_albedo(albedo) {}
+
+  bool operator()(const double* const exposure, const double* const haze,
+                  const double* const reflectance_model_coeffs, double* residuals) const {
+    double phase_angle = 0.0;
+    double reflectance = ComputeReflectance(m_sample.camera_center, m_sample.normal,
+                                            m_sample.xyz, m_model_params, m_global_params,
+                                            phase_angle, reflectance_model_coeffs);
+    residuals[0] = m_sample.intensity - m_albedo *
+      nonlin_reflectance(reflectance, exposure[0], g_opt->steepness_factor,
+                         haze, g_opt->num_haze_coeffs);
+    return true;
+  }
+
+  // Factory to hide the construction of the CostFunction object from
+  // the client code.
+  static ceres::CostFunction* Create(ExposureSample const& sample,
+                                     ModelParams const& model_params,
+                                     GlobalParams const& global_params, double albedo){
+    return (new ceres::NumericDiffCostFunction<ExposureSampleError,
+            ceres::CENTRAL, 1, 1, g_max_num_haze_coeffs, g_num_model_coeffs>
+            (new ExposureSampleError(sample, model_params, global_params, albedo)));
+  }
+
+  ExposureSample m_sample;
+  ModelParams  const& m_model_params;
+  GlobalParams const& m_global_params;
+  double m_albedo;
+};
+
+// Estimate the exposures, then the haze and reflectance model
+// coefficients if floated, from intensities sampled at a sparse set
+// of DEM grid points where the images are lit. Unlike the usual path,
+// the images are not cropped, masked at all grid points, or blended,
+// and no problem for the DEM is made. The exposure of each image is
+// found in closed form, as the least squares fit of the intensity to
+// the reflectance, from which a small problem having only the samples
+// is solved if there is more to float.
+void estimate_exposures_from_samples(Options & opt,
+                                     std::vector< ImageView<double> > const& dems,
+                                     std::vector<GeoReference> const& geos,
+                                     double dem_nodata_val,
+                                     std::vector<std::vector<boost::shared_ptr<CameraModel>>>
+                                     const& cameras,
+                                     std::vector<ModelParams> const& model_params,
+                                     GlobalParams const& global_params,
+                                     double initial_albedo) {
+
+  int num_dems   = dems.size();
+  int num_images = opt.input_images.size();
+
+  // The samples for each image, on all DEMs
+  std::vector< std::vector<ExposureSample> > samples(num_images);
+  std::vector<double> exposures(num_images, 0.0);
+  
+  for (int image_iter = 0; image_iter < num_images; image_iter++) {
+    
+    float img_nodata_val = -std::numeric_limits<float>::max();
+    std::string img_file = opt.input_images[image_iter];
+    vw::read_nodata_val(img_file, img_nodata_val);
+    float shadow_thresh = opt.shadow_threshold_vec[image_iter];
+    MaskedImgT image = create_pixel_range_mask2(DiskImageView<float>(img_file),
+                                                std::max(img_nodata_val, shadow_thresh),
+                                                opt.max_valid_image_vals_vec[image_iter]);
+    BBox2i image_box = bounding_box(image);
+    DoubleImgT no_weight; // all samples get the same weight
+    
+    std::vector<double> exposures_per_dem;
+    for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) {
+      
+      if (opt.skip_images[dem_iter].find(image_iter) != opt.skip_images[dem_iter].end())
+        continue;
+
+      ImageView<double> const& dem = dems[dem_iter];
+      double gridx, gridy;
+      compute_grid_sizes_in_meters(dem, geos[dem_iter], dem_nodata_val, gridx, gridy);
+      double max_dem_height = -std::numeric_limits<double>::max();
+      if (opt.model_shadows) {
+        for (int col = 0; col < dem.cols(); col++)
+          for (int row = 0; row < dem.rows(); row++)
+            max_dem_height = std::max(max_dem_height, dem(col, row));
+      }
+      
+      // A regular grid having about the desired number of samples
+      int step = std::max(1, (int)round(sqrt(double(dem.cols()) * dem.rows() /
+                                             opt.exposure_samples)));
+
+      Vector3 sunPos = model_params[image_iter].sunPosition;
+      ReflectanceBatch batch;
+      std::vector<double> intensities;
+      for (int col = 1; col < dem.cols() - 1; col += step) {
+        for (int row = 1; row < dem.rows() - 1; row += step) {
+          Vector3 base, normal;
+          bool use_pq = false;
+          gridPointGeometry(dem(col-1, row), dem(col, row), dem(col+1, row),
+                            dem(col, row+1), dem(col, row-1), use_pq, 0, 0,
+                            col, row, geos[dem_iter], gridx, gridy, base, normal);
+          Vector2 pix;
+          Vector3 cameraPosition;
+          try {
+            pix = cameras[dem_iter][image_iter]->point_to_pixel(base);
+            cameraPosition = cameras[dem_iter][image_iter]->camera_center(pix);
+          } catch(...) {
+            continue;
+          }
+          PixelMask<double> intensity;
+          double weight = 0.0;
+          if (!sampleImageAndWeight(pix, image_box, image, no_weight, intensity, weight))
+            continue;
+          if (opt.model_shadows &&
+              isInShadow(col, row, sunPos, dem, max_dem_height, gridx, gridy, geos[dem_iter]))
+            continue;
+          batch.push_back(base, normal, cameraPosition);
+          intensities.push_back(intensity.child());
+        }
+      }
+      
+      computeReflectanceBatch(sunPos, global_params, &opt.model_coeffs_vec[0], batch);
+
+      // Minimize the sum of (I - albedo*exposure/steepness*R)^2
+      double sum_ir = 0.0, sum_rr = 0.0;
+      for (size_t it = 0; it < batch.size(); it++) {
+        double refl = batch.reflectance[it];
+        if (refl <= 0)
+          continue; // not lit
+        sum_ir += intensities[it] * refl;
+        sum_rr += refl * refl;
+        ExposureSample sample;
+        sample.xyz           = Vector3(batch.px[it], batch.py[it], batch.pz[it]);
+        sample.normal        = Vector3(batch.nx[it], batch.ny[it], batch.nz[it]);
+        sample.camera_center = Vector3(batch.cx[it], batch.cy[it], batch.cz[it]);
+        sample.intensity     = intensities[it];
+        samples[image_iter].push_back(sample);
+      }
+      double exposure = 0.0;
+      if (sum_rr > 0)
+        exposure = opt.steepness_factor * sum_ir / sum_rr / initial_albedo;
+      vw_out() << "Local exposure for image " << image_iter << " and clip "
+               << dem_iter << ": " << exposure << std::endl;
+
+      double big = 1e+100; // There's no way image exposure can be bigger than this
+      if (0 < exposure && exposure < big)
+        exposures_per_dem.push_back(exposure);
+      else
+        vw_out() << "Skip image " << image_iter << " for clip " << dem_iter << std::endl;
+    }
+    
+    // Out the exposures for this image on all clips, pick the median
+    int len = exposures_per_dem.size();
+    if (len > 0) {
+      std::sort(exposures_per_dem.begin(), exposures_per_dem.end());
+      exposures[image_iter] = 0.5*(exposures_per_dem[(len-1)/2] + exposures_per_dem[len/2]);
+    } else {
+      samples[image_iter].clear();
+    }
+  }
+
+  // Initialize the haze as 0
+  if (opt.image_haze_vec.empty()) {
+    for (int image_iter = 0; image_iter < num_images; image_iter++)
+      opt.image_haze_vec.push_back(std::vector<double>(g_max_num_haze_coeffs, 0.0));
+  }
+  
+  if (opt.float_haze || opt.float_reflectance_model) {
+    ceres::Problem problem;
+    for (int image_iter = 0; image_iter < num_images; image_iter++) {
+      for (size_t it = 0; it < samples[image_iter].size(); it++) {
+        ceres::LossFunction* loss_function = NULL;
+        if (opt.robust_threshold > 0) 
+          loss_function = new ceres::CauchyLoss(opt.robust_threshold);
+        ceres::CostFunction* cost_function =
+          ExposureSampleError::Create(samples[image_iter][it], model_params[image_iter],
+                                      global_params, initial_albedo);
+        problem.AddResidualBlock(cost_function, loss_function,
+                                 &exposures[image_iter],
+                                 &opt.image_haze_vec[image_iter][0],
+                                 &opt.model_coeffs_vec[0]);
+      }
+      if (!samples[image_iter].empty() && !opt.float_haze)
+        problem.SetParameterBlockConstant(&opt.image_haze_vec[image_iter][0]);
+    }
+    if (problem.NumResidualBlocks() > 0) {
+      if (!opt.float_reflectance_model)
+        problem.SetParameterBlockConstant(&opt.model_coeffs_vec[0]);
+      
+      ceres::Solver::Options options;
+      options.max_num_iterations = std::max(opt.max_iterations, 1);
+      options.minimizer_progress_to_stdout = 1;
+      options.num_threads = opt.num_threads;
+      options.linear_solver_type = ceres::SPARSE_SCHUR;
+      ceres::Solver::Summary summary;
+      {
+        asp::TraceSpan span("ceres_solve", "solver");
+        ceres::Solve(options, &problem, &summary);
+      }
+      vw_out() << summary.FullReport() << "\n" << std::endl;
+    }
+  }
+
+  opt.image_exposures_vec = exposures;
+  for (int image_iter = 0; image_iter < num_images; image_iter++) {
+    vw_out() << "Image exposure for " << opt.input_images[image_iter] << ' '
+             << opt.image_exposures_vec[image_iter] << " estimated from "
+             << samples[image_iter].size() << " samples." << std::endl;
+  }
+}
+
 int main(int argc, char* argv[]) {
   
   Stopwatch sw_total;
@@ -5244,6 +7195,19 @@ int main(int argc, char* argv[]) {
       }
     }
     
+    // Estimate the exposures from a sparse set of samples and quit
+    if (opt.compute_exposures_only && opt.exposure_samples > 0) {
+      double initial_albedo = 1.0;
+      estimate_exposures_from_samples(opt, dems[0], geos[0], dem_nodata_val, cameras,
+                                      model_params, global_params, initial_albedo);
+      save_exposures(opt.out_prefix, opt.input_images, opt.image_exposures_vec);
+      if (opt.num_haze_coeffs > 0)
+        save_haze(opt.out_prefix, opt.input_images, opt.image_haze_vec);
+      if (opt.float_reflectance_model)
+        save_model_coeffs(opt.out_prefix, &opt.model_coeffs_vec[0]);
+      return 0;
+    }
+    
     // Prepare for working at multiple levels
     int factor = 2;
     std::vector<int> factors;
@@ -5541,11 +7505,19 @@ int main(int argc, char* argv[]) {
 
             // Compute blending weights only when cropping the
             // images. Otherwise the weights are too huge.
-            if (opt.blending_dist > 0)
-              blend_weights_vec[0][dem_iter][image_iter]
+            if (opt.blending_dist > 0) {
+              ImageView<double> weights
                 = comp_blending_weights(masked_images_vec[0][dem_iter][image_iter],
                                         opt.blending_dist, opt.blending_power,
                                         opt.min_blend_size);
+              if (opt.lean_memory) {
+                // Store in single precision, and convert when accessed
+                ImageView<float> float_weights = pixel_cast<float>(weights);
+                blend_weights_vec[0][dem_iter][image_iter] = pixel_cast<double>(float_weights);
+              } else {
+                blend_weights_vec[0][dem_iter][image_iter] = weights;
+              }
+            }
           }
         }else{
           masked_images_vec[0][dem_iter][image_iter]
@@ -5636,7 +7608,8 @@ int main(int argc, char* argv[]) {
                                        cameras[dem_iter][image_iter].get(),
                                        &scaled_sun_posns[3*image_iter],
                                        reflectance, intensity, weight,
-                                       &opt.model_coeffs_vec[0]);
+                                       &opt.model_coeffs_vec[0], NULL, NULL,
+                                       opt.fast_shadows, opt.num_threads);
         
         // TODO: Below is not the optimal way of finding the exposure!
         // Find it as the analytical minimum using calculus.
@@ -5767,7 +7740,8 @@ int main(int argc, char* argv[]) {
                                        &scaled_sun_posns[3*image_iter],
                                        reflectance, meas_intensity, weight,
                                        &opt.model_coeffs_vec[0],
-                                       slopeErrEstim.get(), heightErrEstim.get());
+                                       slopeErrEstim.get(), heightErrEstim.get(),
+                                       opt.fast_shadows, opt.num_threads);
 
         // Find the computed intensity.
         // TODO(oalexan1): Should one mark the no-data values rather than setting
@@ -6108,25 +8082,24 @@ int main(int argc, char* argv[]) {
                  Vector2i(tile_size, tile_size), sub_threads), dem_nodata_val),
                has_img_georef, img_georef, has_img_nodata, dem_nodata_val, opt, tpc);
 
-            ImageView<double> memory_weight = copy(DiskImageView<double>(sub_weight));
-            blend_weights_vec[level][dem_iter][image_iter] = memory_weight;
+            if (opt.lean_memory) {
+              ImageView<float> memory_weight = copy(DiskImageView<float>(sub_weight));
+              blend_weights_vec[level][dem_iter][image_iter] = pixel_cast<double>(memory_weight);
+            } else {
+              ImageView<double> memory_weight = copy(DiskImageView<double>(sub_weight));
+              blend_weights_vec[level][dem_iter][image_iter] = memory_weight;
+            }
           }
         
         }
       }
     }
     
-    // Start going from the coarsest to the finest level
-    for (int level = levels; level >= 0; level--) {
+    // Solve at a given level, starting from the current DEM and albedo there
+    auto solve_level = [&](int level, int num_iterations, bool save_results) {
 
       g_level = level;
 
-      int num_iterations;
-      if (level == 0)
-        num_iterations = opt.max_iterations;
-      else
-        num_iterations = opt.max_coarse_iterations;
-
       // Scale the cameras
       for (int image_iter = 0; image_iter < num_images; image_iter++) {
         for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) {
@@ -6144,20 +8117,88 @@ int main(int argc, char* argv[]) {
         }
       }
       
-      run_sfs_level(// Fixed inputs
-                    num_iterations, opt, geos[level],
-                    opt.smoothness_weight*factors[level]*factors[level],
-                    dem_nodata_val, crop_boxes[level],
-                    masked_images_vec[level], blend_weights_vec[level],
-                    global_params, model_params,
-                    orig_dems[level], initial_albedo,
-                    lit_image_mask, curvature_in_shadow_weight,
-                    // Quantities that will float
-                    dems[level], albedos[level], cameras,
-                    opt.image_exposures_vec,
-                    opt.image_haze_vec,
-                    scaled_sun_posns,
-                    adjustments, opt.model_coeffs_vec);
+      if (opt.solver_tile_size > 0)
+        run_sfs_level_tiled(// Fixed inputs
+                            num_iterations, opt, geos[level],
+                            opt.smoothness_weight*factors[level]*factors[level],
+                            dem_nodata_val, crop_boxes[level],
+                            masked_images_vec[level], blend_weights_vec[level],
+                            global_params, model_params,
+                            orig_dems[level], initial_albedo,
+                            lit_image_mask, curvature_in_shadow_weight,
+                            // Quantities that will float
+                            dems[level], albedos[level], cameras,
+                            opt.image_exposures_vec,
+                            opt.image_haze_vec,
+                            scaled_sun_posns,
+                            adjustments, opt.model_coeffs_vec);
+      else
+        run_sfs_level(// Fixed inputs
+                      num_iterations, opt, geos[level],
+                      opt.smoothness_weight*factors[level]*factors[level],
+                      dem_nodata_val, crop_boxes[level],
+                      masked_images_vec[level], blend_weights_vec[level],
+                      global_params, model_params,
+                      orig_dems[level], initial_albedo,
+                      lit_image_mask, curvature_in_shadow_weight,
+                      save_results,
+                      // Quantities that will float
+                      dems[level], albedos[level], cameras,
+                      opt.image_exposures_vec,
+                      opt.image_haze_vec,
+                      scaled_sun_posns,
+                      adjustments, opt.model_coeffs_vec);
+    };
+
+    // Subsample an image from a level to the next coarser one
+    auto restrict_image = [&](ImageView<double> const& fine) -> ImageView<double> {
+      return pixel_cast<double>(vw::resample_aa
+                                (pixel_cast< PixelMask<double> >(fine), sub_scale));
+    };
+    
+    // Continue from where a previous run was stopped
+    int start_level = levels, start_iter = 0;
+    if (opt.resume) {
+      std::string checkpoint_file = checkpoint_file_name(opt.out_prefix);
+      if (!fs::exists(checkpoint_file)) {
+        vw_out(WarningMessage) << "Cannot find: " << checkpoint_file
+                               << ". Starting from the beginning.\n";
+      } else {
+        vw_out() << "Reading: " << checkpoint_file << std::endl;
+        read_checkpoint(checkpoint_file, start_level, start_iter, dems, albedos,
+                        opt.image_exposures_vec, opt.image_haze_vec, adjustments,
+                        scaled_sun_posns, &opt.model_coeffs_vec[0]);
+        vw_out() << "Resuming at level " << start_level << " after iteration "
+                 << start_iter << ".\n";
+        // The first callback, before any iteration, will again be for start_iter
+        g_start_iter = start_iter - 1;
+      }
+    }
+    
+    // Start going from the coarsest to the finest level
+    for (int level = start_level; level >= 0; level--) {
+
+      int num_iterations;
+      if (level == 0)
+        num_iterations = opt.max_iterations;
+      else
+        num_iterations = opt.max_coarse_iterations;
+      // When solving over tiles the passes are done again instead
+      if (level == start_level && opt.solver_tile_size == 0)
+        num_iterations = std::max(num_iterations - start_iter, 0);
+
+      bool save_results = true;
+      solve_level(level, num_iterations, save_results);
+
+      // The images and weights at this level will not be needed again
+      if (opt.lean_memory && level > 0 && opt.multigrid_cycles == 0) {
+        for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) {
+          for (int image_iter = 0; image_iter < num_images; image_iter++) {
+            masked_images_vec[level][dem_iter][image_iter] = ImageView< PixelMask<float> >();
+            blend_weights_vec[level][dem_iter][image_iter] = ImageView<double>();
+          }
+        }
+      }
 
       // TODO: Study this. Discarding the coarse DEM and exposure so
       // keeping only the cameras seem to work better.
@@ -6174,6 +8215,63 @@ int main(int argc, char* argv[]) {
       
     }
 
+    // Multigrid V-cycles. Going down, do a few iterations at each level
+    // to remove the errors of high frequency there, then subsample the
+    // result to the next coarser level. Going up, add to each level the
+    // change the coarser level made to what it started with, upsampled,
+    // then do a few more iterations. The errors of low frequency, which
+    // the iterations at the finest level reduce only slowly, are then
+    // corrected at the coarser levels, where they are cheap to find.
+    // The subsampled images and weights made above are reused.
+    for (int cycle = 0; cycle < opt.multigrid_cycles && levels > 0; cycle++) {
+
+      vw_out() << "Multigrid cycle: " << cycle + 1 << "\n";
+
+      std::vector< std::vector< ImageView<double> > >
+        start_dems(levels+1), start_albedos(levels+1);
+      for (int level = 0; level < levels; level++) {
+        bool save_results = false;
+        solve_level(level, opt.multigrid_smoothing_iterations, save_results);
+        start_dems[level+1].resize(num_dems);
+        start_albedos[level+1].resize(num_dems);
+        for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) {
+          if (!opt.fix_dem) {
+            dems[level+1][dem_iter] = restrict_image(dems[level][dem_iter]);
+            start_dems[level+1][dem_iter] = copy(dems[level+1][dem_iter]);
+          }
+          if (opt.float_albedo) {
+            albedos[level+1][dem_iter] = restrict_image(albedos[level][dem_iter]);
+            start_albedos[level+1][dem_iter] = copy(albedos[level+1][dem_iter]);
+          }
+        }
+      }
+
+      for (int level = levels; level >= 0; level--) {
+
+        int num_iterations = opt.multigrid_smoothing_iterations;
+        if (level == levels)
+          num_iterations = opt.max_coarse_iterations;
+        // Save the results only at the finest level. The last cycle wins.
+        bool save_results = (level == 0);
+        solve_level(level, num_iterations, save_results);
+
+        if (level == 0)
+          break;
+        
+        // Correct the finer level
+        for (int dem_iter = 0; dem_iter < num_dems; dem_iter++) {
+          if (!opt.fix_dem) {
+            add_coarse_change(dems[level][dem_iter], start_dems[level][dem_iter], sub_scale,
+                              dems[level-1][dem_iter]);
+          }
+          if (opt.float_albedo) {
+            add_coarse_change(albedos[level][dem_iter], start_albedos[level][dem_iter], sub_scale,
+                              albedos[level-1][dem_iter]);
+          }
+        }
+      }
+    }
+
   } ASP_STANDARD_CATCHES;
   
   VW_OUT(DebugMessage, "asp") << "Number of times we used the global lock: "
@@ -74,6 +74,73 @@ struct Options: vw::GdalWriteOptions {
              shadow_blend_length(0.0), min_blend_size(0.0) {}
 };
 
+// The squared distance from each of n grid points to the nearest one
+// where f is 0 rather than a large value, or more generally, the lower
+// envelope of the parabolas (x - q)^2 + f(q). This is the linear time
+// algorithm of Felzenszwalb and Huttenlocher, "Distance Transforms of
+// Sampled Functions", 2012. The vectors v and z are work buffers.
+void sq_dist_1d(int n, double const* f, int f_stride, double * d, int d_stride,
+                std::vector<int> & v, std::vector<double> & z) {
+  v.resize(n);
+  z.resize(n + 1);
+  int k = 0;
+  v[0] = 0;
+  z[0] = -std::numeric_limits<double>::max();
+  z[1] =  std::numeric_limits<double>::max();
+  for (int q = 1; q < n; q++) {
+    // Drop the parabolas hidden by the new one
+    double fq = f[q * f_stride] + double(q) * q;
+    double s = 0.0;
+    while (1) {
+      int r = v[k];
+      s = (fq - (f[r * f_stride] + double(r) * r)) / (2.0 * (q - r));
+      if (s > z[k])
+        break;
+      k--;
+    }
+    k++;
+    v[k] = q;
+    z[k] = s;
+    z[k + 1] = std::numeric_limits<double>::max();
+  }
+  k = 0;
+  for (int q = 0; q < n; q++) {
+    while (z[k + 1] < q)
+      k++;
+    int r = v[k];
+    d[q * d_stride] = double(q - r) * (q - r) + f[r * f_stride];
+  }
+}
+
+// The Euclidean distance from each pixel to the nearest pixel where the
+// mask is nonzero, exact and in linear time, by doing the squared
+// distance transform along the columns and then along the rows. The
+// distance is very large if the mask is zero everywhere.
+ImageView<double> euclidean_dist(ImageView<unsigned char> const& mask) {
+  int cols = mask.cols(), rows = mask.rows();
+  double big = 1e+20; // not infinity, to not get NaN when subtracting
+  ImageView<double> f(cols, rows), d(cols, rows);
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++)
+      f(col, row) = mask(col, row) ? 0.0 : big;
+  }
+  if (cols == 0 || rows == 0)
+    return d;
+
+  std::vector<int> v;
+  std::vector<double> z;
+  for (int col = 0; col < cols; col++)
+    sq_dist_1d(rows, &f(col, 0), cols, &d(col, 0), cols, v, z);
+  for (int row = 0; row < rows; row++)
+    sq_dist_1d(cols, &d(0, row), 1, &f(0, row), 1, v, z);
+  
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++)
+      d(col, row) = sqrt(f(col, row));
+  }
+  return d;
+}
+
 // The workhorse of this code, do the blending
 class SfsBlendView: public ImageViewBase<SfsBlendView>{
   
@@ -159,6 +226,15 @@ public:
     // interface, given how lit_grass_dist and shadow_grass_dist are
     // defined as the negation of each other. The boundary is the set
     // of pixels where both of these are <= 1.
+    ImageView<unsigned char> bd_mask(sfs_dem_crop.cols(), sfs_dem_crop.rows());
+    for (int col = 0; col < sfs_dem_crop.cols(); col++) {
+      for (int row = 0; row < sfs_dem_crop.rows(); row++) 
+        bd_mask(col, row) = (lit_grass_dist(col, row) <= 1 && shadow_grass_dist(col, row) <= 1);
+    }
+
+    // The shortest Euclidean distance to the boundary, for all pixels at once
+    ImageView<double> bd_dist = euclidean_dist(bd_mask);
+    
     ImageView<float> dist_to_bd;
     dist_to_bd.set_size(sfs_dem_crop.cols(), sfs_dem_crop.rows());
     for (int col = 0; col < sfs_dem_crop.cols(); col++) {
@@ -177,45 +253,14 @@ public:
           continue;
         }
         
-        // Find the shortest Euclidean distance to the no-data region.
-        double max_dist = std::max(m_opt.lit_blend_length, m_opt.shadow_blend_length);
+        // Clamp the distance at the blending lengths
         double signed_dist = 0.0;
         if (lit_grass_dist(col, row) > 0) {
-          signed_dist = m_opt.lit_blend_length;
+          signed_dist = std::min(m_opt.lit_blend_length, bd_dist(col, row));
         } else if (shadow_grass_dist(col, row) > 0) {
-          signed_dist = -m_opt.shadow_blend_length;
+          signed_dist = -std::min(m_opt.shadow_blend_length, bd_dist(col, row));
         }
         
-        for (int col2 = std::max(0.0, col - max_dist);
-             col2 <= std::min(sfs_dem_crop.cols() - 1.0, col + max_dist);
-             col2++) {
-
-          // Estimate the range of rows for the circle with given radius
-          // at given col value.
-          double ht_val = ceil(sqrt(double(max_dist * max_dist) -
-                                    double((col - col2) * (col - col2))));
-          
-          for (int row2 = std::max(0.0, row - ht_val);
-               row2 <= std::min(sfs_dem_crop.rows() - 1.0, row + ht_val);
-               row2++) {
-
-            if (lit_grass_dist(col2, row2) > 1 || shadow_grass_dist(col2, row2) > 1) 
-              continue; // not at the boundary
-
-            // See if the current point is closer than anything so far
-            double curr_dist = sqrt( double(col - col2) * (col - col2) +
-                                     double(row - row2) * (row - row2) );
-            if (lit_grass_dist(col, row) > 0) {
-              if (curr_dist < signed_dist) 
-                signed_dist = curr_dist;
-            } else if (shadow_grass_dist(col, row) > 0) {
-              if (curr_dist < -signed_dist) 
-                signed_dist = -curr_dist;
-            }
-            
-          }
-        }
-
         // The closest we've got
         dist_to_bd(col, row) = signed_dist;
       }
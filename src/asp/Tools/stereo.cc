@@ -24,12 +24,20 @@
 #include <vw/Stereo/CostFunctions.h>
 #include <vw/Stereo/DisparityMap.h>
 #include <vw/FileIO/MatrixIO.h>
+#include <vw/Core/StringUtils.h>
 
 #include <asp/Tools/stereo.h>
 #include <asp/Camera/RPCModel.h>
 #include <asp/Core/Bathymetry.h>
+#include <asp/Core/LocalAlignment.h>
 #include <asp/Sessions/StereoSessionFactory.h>
 
+#include <cpl_conv.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
 // Can't do much about warnings in boost except to hide them
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
@@ -329,6 +337,8 @@ namespace asp {
                                                    allow_unregistered, unregistered);
 
     // Read the config file
+    std::string prog_name = extract_prog_name(argv[0]);
+    bool used_snapshot = false;
     try {
       po::options_description cfg_options;
       cfg_options.add(positional_options); // The user can specify the
@@ -338,12 +348,28 @@ namespace asp {
       cfg_options.add(generate_config_file_options(opt));
 
       // Append the options from the config file. Do not overwrite the
-      // options already set on the command line.
-      bool print_warnings = is_multiview; // print warnings just first time
-      po::store(parse_asp_config_file(print_warnings,
-                                      opt.stereo_default_filename,
-                                      cfg_options), vm);
-      po::notify(vm);
+      // options already set on the command line. The processes for
+      // tiles can load them instead from a snapshot made by stereo_parse.
+      bool is_parse = (prog_name.find("stereo_parse") != std::string::npos);
+      if (!opt.settings_snapshot.empty() && !is_parse)
+        used_snapshot = asp::load_settings_snapshot(opt.settings_snapshot,
+                                                    opt.stereo_default_filename,
+                                                    cfg_options, vm);
+      if (!used_snapshot) {
+        bool print_warnings = is_multiview; // print warnings just first time
+        po::parsed_options cfg_parsed = parse_asp_config_file(print_warnings,
+                                                              opt.stereo_default_filename,
+                                                              cfg_options);
+        po::store(cfg_parsed, vm);
+        po::notify(vm);
+
+        if (!opt.settings_snapshot.empty() && is_parse) {
+          po::variables_map cfg_vm;
+          po::store(cfg_parsed, cfg_vm);
+          asp::write_settings_snapshot(opt.settings_snapshot,
+                                       opt.stereo_default_filename, cfg_vm);
+        }
+      }
     } catch (po::error const& e) {
       vw::vw_throw(vw::ArgumentErr() << "Error parsing configuration file:\n" << e.what() << "\n");
     }
@@ -406,7 +432,6 @@ namespace asp {
 
     // Turn on logging to file, except for stereo_parse, as that one is called
     // all the time.
-    std::string prog_name = extract_prog_name(argv[0]);
     if (prog_name.find("stereo_parse") == std::string::npos) 
       asp::log_to_file(argc, argv, opt.stereo_default_filename, opt.out_prefix);
     
@@ -528,6 +553,8 @@ namespace asp {
     // - TODO: Move these somewhere easier to find!
     const int SGM_DEFAULT_SUBPIXEL_MODE        = 12; // Blend
     const int SGM_DEFAULT_COST_MODE            = 4;
+    const int FAST_SGM_DEFAULT_SUBPIXEL_MODE   = 11; // Parabola
+    const int FAST_SGM_DEFAULT_COST_MODE       = 3;
     const int SGM_DEFAULT_KERNELSIZE           = 5;
     const int SGM_DEFAULT_RM_CLEANUP_PASSES    = 0;
     const int SGM_DEFAULT_MEDIAN_FILTER_SIZE   = 3;
@@ -563,14 +590,22 @@ namespace asp {
       // ASP's block matching are intrinsically capable of.  if the
       // user however explicitly specifies, for example,
       // --subpixel-mode 3, that one will be used later on.
+      // ASP's fast SGM has no ternary census cost and fits only a
+      // parabola, so its defaults are the closest of what it supports.
+      std::string alg_name, alg_opts;
+      asp::parse_stereo_alg_name_and_opts(stereo_settings().stereo_algorithm,
+                                          alg_name, alg_opts);
+      bool fast_sgm = (alg_name == "asp_fast_sgm");
       if (vm["subpixel-mode"].defaulted()) 
-        stereo_settings().subpixel_mode = SGM_DEFAULT_SUBPIXEL_MODE;
+        stereo_settings().subpixel_mode
+          = fast_sgm ? FAST_SGM_DEFAULT_SUBPIXEL_MODE : SGM_DEFAULT_SUBPIXEL_MODE;
       else
         vw_out() << "Will refine the disparity using the ASP subpixel-mode: "
                  << stereo_settings().subpixel_mode << ".\n";
       
       if (vm["cost-mode"].defaulted())
-        stereo_settings().cost_mode = SGM_DEFAULT_COST_MODE;
+        stereo_settings().cost_mode
+          = fast_sgm ? FAST_SGM_DEFAULT_COST_MODE : SGM_DEFAULT_COST_MODE;
       if (vm["corr-kernel"].defaulted())
         stereo_settings().corr_kernel = Vector2i(SGM_DEFAULT_KERNELSIZE, SGM_DEFAULT_KERNELSIZE);
 
@@ -595,9 +630,21 @@ namespace asp {
                << "used only with alignment method local_epipolar.\n");
     }
 
+    // Let GDAL read uncompressed tiled images, such as L.tif and R.tif
+    // written with this option, by mapping them into memory. Then all
+    // processes on a machine share the page cache rather than reading
+    // the data into their own buffers. Compressed images are not affected.
+    if (stereo_settings().mmap_aligned_images)
+      CPLSetConfigOption("GTIFF_VIRTUAL_MEM_IO", "IF_ENOUGH_RAM");
+
     if (exit_early) 
       return;
     
+    // Let the later steps, also in other processes, load the CSM
+    // cameras from their saved states
+    if (stereo_settings().camera_cache_dir.empty())
+      stereo_settings().camera_cache_dir = opt.out_prefix + "-camera-cache";
+
     // The StereoSession call automatically determines the type of
     // object to create from the input parameters.
     opt.session.reset(asp::StereoSessionFactory::create(opt.stereo_session, // can change
@@ -612,10 +659,11 @@ namespace asp {
     // The last thing we do before we get started is to copy the
     // stereo.default settings over into the results directory so that
     // we have a record of the most recent stereo.default that was used
-    // with this data set.
-    asp::stereo_settings().write_copy(argc, argv,
-                                      opt.stereo_default_filename,
-                                      opt.out_prefix + "-stereo.default");
+    // with this data set. With a snapshot, stereo_parse already did.
+    if (!used_snapshot)
+      asp::stereo_settings().write_copy(argc, argv,
+                                        opt.stereo_default_filename,
+                                        opt.out_prefix + "-stereo.default");
   }
 
   // Register Session types
@@ -779,11 +827,50 @@ namespace asp {
                 << "with 2 preferred.\n");
     }
 
+    // ASP's fast SGM implements only some of the costs and subpixel modes
+    std::string alg_name, alg_opts;
+    asp::parse_stereo_alg_name_and_opts(stereo_settings().stereo_algorithm,
+                                        alg_name, alg_opts);
+    // These run on the CPU and find only a horizontal disparity, so they
+    // need the tiles to be aligned first
+    if ((alg_name == "asp_fast_bm" || alg_name == "asp_fast_sgm") &&
+        stereo_settings().alignment_method != "local_epipolar")
+      vw_throw(ArgumentErr() << "The " << alg_name << " algorithm finds only "
+               << "1D disparities, so it needs --alignment-method local_epipolar.\n");
+    if (alg_name == "asp_fast_sgm") {
+      if (stereo_settings().cost_mode == 4)
+        vw_throw(ArgumentErr() << "The asp_fast_sgm algorithm does not support "
+                 << "the ternary census transform. Use --cost-mode 0, 1, 2, or 3.\n");
+      int mode = stereo_settings().subpixel_mode;
+      if (mode == 8 || mode == 9 || mode == 10 || mode == 12)
+        vw_throw(ArgumentErr() << "The asp_fast_sgm algorithm supports only "
+                 << "--subpixel-mode 11 (parabola) or 7 (none) of the SGM subpixel "
+                 << "modes, and also the refinement modes 0 to 6.\n");
+    }
+
+    // With tiles and an SGM subpixel mode, the blending step already writes
+    // RD.tif and there is nothing left to refine in stereo_fltr.
+    if (stereo_settings().fuse_refinement_filtering && using_tiles &&
+        stereo_settings().subpixel_mode > 6)
+      vw_throw(ArgumentErr() << "The option --fuse-refinement-filtering cannot be used "
+               << "with --subpixel-mode " << stereo_settings().subpixel_mode
+               << " for this stereo algorithm or alignment method, as then there is "
+               << "no refinement step. Omit this option.\n");
+
     if (stereo_settings().min_triangulation_angle <= 0 &&
         stereo_settings().min_triangulation_angle != -1) {
       // This means the user modified it. Then it must be positive.
       vw_throw(ArgumentErr() << "The min triangulation angle must be positive.\n");
     }
+    if (stereo_settings().triangulation_ray_spacing < 0)
+      vw_throw(ArgumentErr() << "The value of --triangulation-ray-spacing must be non-negative.\n");
+    if (stereo_settings().triangulation_ray_max_error <= 0.0)
+      vw_throw(ArgumentErr() << "The value of --triangulation-ray-max-error must be positive.\n");
+    if (stereo_settings().triangulation_max_views < 0 ||
+        stereo_settings().triangulation_max_views == 1)
+      vw_throw(ArgumentErr() << "The value of --triangulation-max-views must be 0 or at least 2.\n");
+    if (stereo_settings().direct_dem_spacing < 0.0)
+      vw_throw(ArgumentErr() << "The value of --direct-dem-spacing must be non-negative.\n");
     if (stereo_settings().min_triangulation_angle == -1) {
       // This means that the user did not set it. Set it to 0.
       // Deep inside StereoModel.cc it will be overwritten with some
@@ -985,5 +1072,80 @@ namespace asp {
     // An external stereo algorithm
     return vw::stereo::VW_CORRELATION_OTHER;
   }
+
+  // The tile queue file has the output prefix of the run on the first
+  // line, and then a line per tile, as: id x y width height tile_prefix.
+  // A worker claims a tile by creating the directory <file>-claims/<id>,
+  // which succeeds for only one worker, even across machines. The
+  // session and cameras are loaded again for each tile, but the cameras
+  // are reused from the previous tiles, and so are the cached image
+  // blocks, which is what makes this faster than a process per tile.
+  bool run_tile_queue(int argc, char* argv[], StereoStageFunc run_stage) {
+
+    std::string queue_file;
+    vector<string> base_args;
+    for (int s = 0; s < argc; s++) {
+      if (std::string(argv[s]) == "--tile-queue" && s + 1 < argc) {
+        queue_file = argv[s+1];
+        s++;
+        continue;
+      }
+      base_args.push_back(argv[s]);
+    }
+    if (queue_file.empty())
+      return false;
+
+    std::ifstream ifs(queue_file.c_str());
+    std::string out_prefix;
+    if (!ifs || !std::getline(ifs, out_prefix))
+      vw_throw(ArgumentErr() << "Cannot read the tile queue: " << queue_file << ".\n");
+    vector<string>::iterator prefix_it
+      = std::find(base_args.begin(), base_args.end(), out_prefix);
+    if (prefix_it == base_args.end())
+      vw_throw(ArgumentErr() << "The output prefix " << out_prefix
+               << " from the tile queue is not among the arguments.\n");
+    int prefix_pos = prefix_it - base_args.begin();
+
+    std::string claims_dir = queue_file + "-claims";
+    fs::create_directories(claims_dir);
+    StereoSession::share_camera_models(true);
+
+    int num_done = 0, num_failed = 0;
+    std::string line;
+    while (std::getline(ifs, line)) {
+      std::istringstream is(line);
+      int id = -1;
+      std::string x, y, w, h, tile_prefix;
+      if (!(is >> id >> x >> y >> w >> h))
+        continue;
+      std::getline(is >> std::ws, tile_prefix);
+      if (!fs::create_directory(claims_dir + "/" + vw::num_to_str(id)))
+        continue; // another worker has it
+
+      vector<string> args = base_args;
+      args[prefix_pos] = tile_prefix;
+      args.push_back("--trans-crop-win");
+      args.push_back(x); args.push_back(y); args.push_back(w); args.push_back(h);
+      vector<char*> largv;
+      for (size_t t = 0; t < args.size(); t++)
+        largv.push_back((char*)args[t].c_str());
+      largv.push_back(NULL);
+
+      vw_out() << "Processing tile " << id << " with prefix: " << tile_prefix << "\n";
+      try {
+        run_stage(int(args.size()), &largv[0]);
+        num_done++;
+      } catch (std::exception const& e) {
+        vw_out(ErrorMessage) << "Failed to process tile " << id << ": " << e.what() << "\n";
+        num_failed++;
+      }
+    }
+
+    vw_out() << "This worker processed " << num_done << " tiles.\n";
+    if (num_failed > 0)
+      vw_throw(ArgumentErr() << "Failed to process " << num_failed << " tiles.\n");
+
+    return true;
+  }
   
 } // end namespace asp
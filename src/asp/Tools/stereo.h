@@ -96,6 +96,16 @@ namespace asp {
   // external algorithms will have to examine closer the algorithm
   // string. This function has a Python analog in parallel_stereo.
   vw::stereo::CorrelationAlgorithm stereo_alg_to_num(std::string alg);
+
+  /// A stereo stage invoked with given arguments, for one tile or for
+  /// the whole image.
+  typedef void (*StereoStageFunc)(int argc, char* argv[]);
+
+  /// If the arguments have --tile-queue <file>, as passed by
+  /// parallel_stereo --resident-workers, run the stage in this process
+  /// for each tile in that file which no other worker claimed, and
+  /// return true. Otherwise return false. Throws if any tile failed.
+  bool run_tile_queue(int argc, char* argv[], StereoStageFunc run_stage);
   
 } // end namespace vw
 
@@ -34,11 +34,13 @@
 // tiles which overlap with the inner area of the current tile, and
 // blend the results.
 
+#include <vw/Core/ThreadPool.h>
 #include <vw/Image/ImageMath.h>
 #include <vw/FileIO/DiskImageUtils.h>
 
 #include <vw/Stereo/DisparityMap.h>
 #include <asp/Tools/stereo.h>
+#include <asp/Core/StageReport.h>
 #include <boost/filesystem.hpp>
 
 using namespace vw;
@@ -84,8 +86,9 @@ BBox2i bbox_from_folder(std::string const& s, std::string const& in_file) {
   return BBox2i(x, y, width, height);
 }
 
-// Load an image and form its weights
-bool load_image_and_weights(std::string const& file_path,
+// Load an image, or only the given region of it if not empty, and form
+// its weights over what was loaded
+bool load_image_and_weights(std::string const& file_path, BBox2i const& region,
                             ImageView<MaskedPixType> & image, WeightsType & weights,
                             int & num_channels, bool & has_nodata, float& nodata_value) {
 
@@ -98,7 +101,10 @@ bool load_image_and_weights(std::string const& file_path,
   if (file_path == "")
     return false;
 
-  vw_out() << "Reading: " << file_path << std::endl;
+  vw_out() << "Reading: " << file_path;
+  if (!region.empty())
+    vw_out() << " in region: " << region;
+  vw_out() << std::endl;
 
   // Verify that the disparity has float pixels, as expected. Blending
   // is done either after algorithms which are not the old ASP block
@@ -123,14 +129,18 @@ bool load_image_and_weights(std::string const& file_path,
     }
   }
   
-  // Load the image from disk
+  // Load the image from disk. Only the blocks of the file which
+  // intersect the region are read.
+  BBox2i box = region;
+  if (box.empty())
+    box = BBox2i(0, 0, rsrc->cols(), rsrc->rows());
   if (num_channels == 3) {
     // Load a disparity
-    image = DiskImageView<MaskedPixType>(file_path);
+    image = crop(DiskImageView<MaskedPixType>(file_path), box);
   } else if (num_channels == 1) {
     // Load a float image with a nodata value, and create a disparity. It is simpler
     // to do it this way than to write some template-based logic.
-    ImageView<float> curr_image = DiskImageView<float>(file_path);
+    ImageView<float> curr_image = crop(DiskImageView<float>(file_path), box);
     image.set_size(curr_image.cols(), curr_image.rows());
     for (int col = 0; col < curr_image.cols(); col++) {
       for (int row = 0; row < curr_image.rows(); row++) {
@@ -321,6 +331,31 @@ bool invalid_image(ImageView<MaskedPixType> const& image) {
   return true;
 }
 
+/// Load a region of a neighboring tile and its weights
+class NeighborLoadTask: public Task {
+  std::string m_path;
+  BBox2i m_region;
+  ImageView<MaskedPixType> & m_image;        // alias
+  WeightsType              & m_weights;      // alias
+  int                      & m_num_channels; // alias
+  bool                     & m_has_nodata;   // alias
+  float                    & m_nodata_value; // alias
+  bool                     & m_loaded;       // alias
+public:
+  NeighborLoadTask(std::string const& path, BBox2i const& region,
+                   ImageView<MaskedPixType> & image, WeightsType & weights,
+                   int & num_channels, bool & has_nodata, float & nodata_value,
+                   bool & loaded):
+    m_path(path), m_region(region), m_image(image), m_weights(weights),
+    m_num_channels(num_channels), m_has_nodata(has_nodata), m_nodata_value(nodata_value),
+    m_loaded(loaded) {}
+
+  void operator()() {
+    m_loaded = load_image_and_weights(m_path, m_region, m_image, m_weights,
+                                      m_num_channels, m_has_nodata, m_nodata_value);
+  }
+};
+
 /// Blend the borders of the main tile using the neighboring
 /// tiles.
 /// While all the main tile and neighbor tiles have padding, we will save
@@ -354,54 +389,75 @@ ImageView<MaskedPixType> tile_blend(ASPGlobalOptions const& opt,
     }
   }
 
+  // The loaded tiles, their weights, and where they are in the full image
+  ImageView<MaskedPixType> images [NUM_NEIGHBORS + 1]; // the main tile is last
+  WeightsType              weights[NUM_NEIGHBORS + 1];
+  BBox2i                   boxes  [NUM_NEIGHBORS + 1];
+  bool                     loaded [NUM_NEIGHBORS + 1];
+  int   channels_vec[NUM_NEIGHBORS + 1];
+  bool  has_nodata_vec[NUM_NEIGHBORS + 1];
+  float nodata_vec[NUM_NEIGHBORS + 1];
+
+  // The main tile better exist
+  if (!load_image_and_weights(blend_opt.main_path, BBox2i(),
+                              images[NUM_NEIGHBORS], weights[NUM_NEIGHBORS],
+                              channels_vec[NUM_NEIGHBORS], has_nodata_vec[NUM_NEIGHBORS],
+                              nodata_vec[NUM_NEIGHBORS]))
+    vw_throw(ArgumentErr() << "stereo_blend: main tile is missing.");
+  boxes[NUM_NEIGHBORS]  = blend_opt.padded_main;
+  loaded[NUM_NEIGHBORS] = true;
+
+  // Since the image was loaded successfully, copy its other info
+  num_channels = channels_vec[NUM_NEIGHBORS];
+  has_nodata   = has_nodata_vec[NUM_NEIGHBORS];
+  nodata_value = nodata_vec[NUM_NEIGHBORS];
+
+  // If there are no valid pixels in the main tile without its padding,
+  // return an invalid blended tile.
+  if (invalid_image(crop(images[NUM_NEIGHBORS],
+                         blend_opt.main_roi - blend_opt.padded_main.min())))
+    return output_image;
+
+  // From each neighbor read only where it overlaps with the padded main
+  // tile. That is the strip which gets blended into the main tile, and
+  // as much again beyond the main tile, so that the weights, which are
+  // computed over what is read, decrease towards both ends of the strip.
+  // The neighbors are read in parallel.
+  FifoWorkQueue queue(vw_settings().default_num_threads());
+  for (int i = 0; i < NUM_NEIGHBORS; i++) {
+    loaded[i] = false;
+    if (blend_opt.neib_path[i] == "")
+      continue; // Nothing to blend
+    boxes[i] = blend_opt.padded_neib[i];
+    boxes[i].crop(blend_opt.padded_main);
+    if (boxes[i].empty())
+      continue;
+    boost::shared_ptr<NeighborLoadTask>
+      task(new NeighborLoadTask(blend_opt.neib_path[i], boxes[i] - blend_opt.padded_neib[i].min(),
+                                images[i], weights[i], channels_vec[i], has_nodata_vec[i],
+                                nodata_vec[i], loaded[i]));
+    queue.add_task(task);
+  }
+  queue.join_all();
+
   // Add the contribution from the main tile and neighboring tiles. Note
   // that i = -1 corresponds to the main tile.
   for (int i = -1; i < NUM_NEIGHBORS; i++) {
 
-    ImageView<MaskedPixType> image;
-    WeightsType weights;
-    BBox2i padded_box;
-    
-    if (i == -1) {
-      // Main tile
-      // The main tile better exist
-      int curr_num_channels = 1;
-      bool curr_has_nodata = false;
-      float curr_nodata_value = -32768.0;
-      bool ans = load_image_and_weights(blend_opt.main_path, image, weights,
-                                        curr_num_channels, curr_has_nodata, curr_nodata_value);
-      if (!ans) 
-        vw_throw(ArgumentErr() << "stereo_blend: main tile is missing.");
-
-      // Since the image was loaded successfully, copy its other info
-      num_channels = curr_num_channels;
-      has_nodata   = curr_has_nodata;
-      nodata_value = curr_nodata_value;
-
-      padded_box = blend_opt.padded_main;
-      
-      // If there are no valid pixels in the main tile without its padding,
-      // return an invalid blended tile.
-      if (invalid_image(crop(image, blend_opt.main_roi - blend_opt.padded_main.min())))
-        return output_image;
-      
-    } else {
-      // A neighboring tile
-      int curr_num_channels = 1;
-      bool curr_has_nodata = false;
-      float curr_nodata_value = -32768.0;
-      bool ans = load_image_and_weights(blend_opt.neib_path[i], image, weights,
-                                        curr_num_channels, curr_has_nodata, curr_nodata_value);
-      if (!ans)
-        continue; // Nothing to blend
+    int k = (i == -1) ? NUM_NEIGHBORS : i;
+    if (!loaded[k])
+      continue;
 
+    ImageView<MaskedPixType> const& image      = images[k];
+    WeightsType              const& weights_k  = weights[k];
+    BBox2i                   const& padded_box = boxes[k];
+
+    if (i != -1) {
       // Since the image was loaded successfully, copy its other info. Note we assume
       // all inputs are consistent.
-      num_channels = curr_num_channels;
-      has_nodata   = curr_has_nodata;
-      nodata_value = curr_nodata_value;
-
-      padded_box = blend_opt.padded_neib[i];
+      num_channels = channels_vec[k];
+      has_nodata   = has_nodata_vec[k];
+      nodata_value = nodata_vec[k];
     }
 
     // Do the blending, either with the main or neighboring tiles
@@ -419,12 +475,12 @@ ImageView<MaskedPixType> tile_blend(ASPGlobalOptions const& opt,
         if (!vw::bounding_box(image).contains(pix)) 
           continue;
 
-        if (!is_valid(image(pix[0], pix[1])) || weights(pix[0], pix[1]) <= 0.0) 
+        if (!is_valid(image(pix[0], pix[1])) || weights_k(pix[0], pix[1]) <= 0.0) 
           continue; // No useful info
 
         output_image(col, row).validate();
-        output_image(col, row)   += weights(pix[0], pix[1]) * image(pix[0], pix[1]);
-        output_weights(col, row) += weights(pix[0], pix[1]);
+        output_image(col, row)   += weights_k(pix[0], pix[1]) * image(pix[0], pix[1]);
+        output_weights(col, row) += weights_k(pix[0], pix[1]);
       }
     }
   }
@@ -501,6 +557,46 @@ void stereo_blending(ASPGlobalOptions const& opt, std::string const& in_file,
   }
 }
 
+// Run blending for the given arguments
+void run_blending(int argc, char* argv[]) {
+
+  bool verbose = false;
+  vector<ASPGlobalOptions> opt_vec;
+  string output_prefix;
+  asp::parse_multiview(argc, argv, SubpixelDescription(),
+                       verbose, output_prefix, opt_vec);
+  ASPGlobalOptions opt = opt_vec[0];
+  asp::StageReport report("blend");
+
+  // Subpixel refinement uses smaller tiles.
+  //---------------------------------------------------------
+  int ts = ASPGlobalOptions::rfne_tile_size();
+  opt.raster_tile_size = Vector2i(ts, ts);
+
+  // This tool is only intended to run as part of parallel_stereo, which
+  //  renames the normal -D.tif file to -Dnosym.tif.
+  std::string in_file =  "Dnosym.tif";
+
+  string out_file = "B.tif";
+  if (stereo_settings().subpixel_mode > 6){
+    // No further subpixel refinement, skip to the -RD output.
+    out_file = "RD.tif";
+  }
+  stereo_blending(opt, in_file, out_file);
+
+  // See if to also blend L-R disp differences
+  if (stereo_settings().save_lr_disp_diff) {
+    in_file  = "L-R-disp-diff.tif";
+    out_file = "L-R-disp-diff-blend.tif";
+    stereo_blending(opt, in_file, out_file);
+  }
+
+  if (opt.stage_report)
+    report.save(opt.out_prefix, stereo_settings().trans_crop_win);
+  
+  vw_out() << "\n[ " << current_posix_time_string() << " ] : BLENDING FINISHED\n";
+}
+
 int main(int argc, char* argv[]) {
 
   try {
@@ -509,37 +605,8 @@ int main(int argc, char* argv[]) {
 
     stereo_register_sessions();
 
-    bool verbose = false;
-    vector<ASPGlobalOptions> opt_vec;
-    string output_prefix;
-    asp::parse_multiview(argc, argv, SubpixelDescription(),
-                         verbose, output_prefix, opt_vec);
-    ASPGlobalOptions opt = opt_vec[0];
-
-    // Subpixel refinement uses smaller tiles.
-    //---------------------------------------------------------
-    int ts = ASPGlobalOptions::rfne_tile_size();
-    opt.raster_tile_size = Vector2i(ts, ts);
-
-    // This tool is only intended to run as part of parallel_stereo, which
-    //  renames the normal -D.tif file to -Dnosym.tif.
-    std::string in_file =  "Dnosym.tif";
-
-    string out_file = "B.tif";
-    if (stereo_settings().subpixel_mode > 6){
-      // No further subpixel refinement, skip to the -RD output.
-      out_file = "RD.tif";
-    }
-    stereo_blending(opt, in_file, out_file);
-
-    // See if to also blend L-R disp differences
-    if (stereo_settings().save_lr_disp_diff) {
-      in_file  = "L-R-disp-diff.tif";
-      out_file = "L-R-disp-diff-blend.tif";
-      stereo_blending(opt, in_file, out_file);
-    }
-    
-    vw_out() << "\n[ " << current_posix_time_string() << " ] : BLENDING FINISHED\n";
+    if (!asp::run_tile_queue(argc, argv, run_blending))
+      run_blending(argc, argv);
 
   } ASP_STANDARD_CATCHES;
 
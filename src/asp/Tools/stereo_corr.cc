@@ -25,11 +25,17 @@
 #include <vw/InterestPoint/Matcher.h>
 #include <vw/Stereo/Correlation.h>
 
+#include <asp/Core/BlockMatching.h>
 #include <asp/Core/DisparityProcessing.h>
 #include <asp/Core/DemDisparity.h>
 #include <asp/Core/InterestPointMatching.h>
 #include <asp/Core/IpMatchingAlgs.h>         // Lightweight header
 #include <asp/Core/LocalAlignment.h>
+#include <asp/Core/RasterStats.h>
+#include <asp/Core/SharedBlockCache.h>
+#include <asp/Core/Tracing.h>
+#include <asp/Core/TileCheckpoint.h>
+#include <asp/Core/StageReport.h>
 #include <asp/Sessions/StereoSession.h>
 #include <asp/Tools/stereo.h>
 
@@ -71,6 +77,29 @@ SemiGlobalMatcher::SgmSubpixelMode get_sgm_subpixel_mode() {
   };
 }
 
+/// The cost for the asp_fast_sgm algorithm, which has all but the ternary census
+asp::BlockMatchCost get_fast_sgm_cost_mode() {
+  switch(get_cost_mode_value()) {
+  case stereo::ABSOLUTE_DIFFERENCE: return asp::BM_COST_ABSOLUTE_DIFFERENCE;
+  case stereo::SQUARED_DIFFERENCE:  return asp::BM_COST_SQUARED_DIFFERENCE;
+  case stereo::CROSS_CORRELATION:   return asp::BM_COST_NCC;
+  case stereo::CENSUS_TRANSFORM:    return asp::BM_COST_CENSUS;
+  default:
+    vw_throw(ArgumentErr() << "The asp_fast_sgm algorithm does not support the value "
+             << stereo_settings().cost_mode << " for cost-mode.\n");
+  };
+}
+
+/// The asp_fast_sgm algorithm can fit only a parabola, and the refinement
+/// modes 0 to 6 are applied later. Other SGM subpixel modes are rejected
+/// rather than being replaced.
+void check_fast_sgm_subpixel_mode() {
+  SemiGlobalMatcher::SgmSubpixelMode mode = get_sgm_subpixel_mode();
+  if (mode != SemiGlobalMatcher::SUBPIXEL_NONE && mode != SemiGlobalMatcher::SUBPIXEL_PARABOLA)
+    vw_throw(ArgumentErr() << "The asp_fast_sgm algorithm does not support the value "
+             << stereo_settings().subpixel_mode << " for subpixel-mode.\n");
+}
+
 // Read the search range from D_sub, and scale it to the full image
 void read_search_range_from_D_sub(std::string const& d_sub_file, ASPGlobalOptions const& opt){
 
@@ -405,7 +434,9 @@ BBox2 get_search_range_from_ip_hists(vw::math::Histogram const& hist_x,
 /// Use existing interest points to compute a search range
 /// - This function could use improvement!
 /// - Should it be used in all cases?
-BBox2 approximate_search_range(ASPGlobalOptions & opt, std::string const& match_filename) {
+/// - If is_aligned, the matches are between L.tif and R.tif whatever the file name.
+BBox2 approximate_search_range(ASPGlobalOptions & opt, std::string const& match_filename,
+                               bool is_aligned = false) {
 
   vw_out() << "\t--> Using interest points to determine search window.\n";
   std::vector<ip::InterestPoint> in_left_ip, in_right_ip, matched_left_ip, matched_right_ip;
@@ -428,7 +459,7 @@ BBox2 approximate_search_range(ASPGlobalOptions & opt, std::string const& match_
   // TODO(oalexan1): Having this as a special case is annoying.
   // TODO(oalexan1): Wipe this!
   std::string aligned_match_file = vw::ip::match_filename(opt.out_prefix, "L.tif", "R.tif");
-  if (match_filename != aligned_match_file)
+  if (!is_aligned && match_filename != aligned_match_file)
     align_ip(opt.session->tx_left(), opt.session->tx_right(), in_left_ip, in_right_ip);
   
   // Camera models
@@ -590,6 +621,110 @@ BBox2 approximate_search_range(ASPGlobalOptions & opt, std::string const& match_
 } // End function approximate_search_range
 
 
+/// Match interest points between L_sub.tif and R_sub.tif, which is fast
+/// as these are small, scale them to L.tif and R.tif, and save them.
+/// Return the name of the saved match file. Used with --guided-ip-matching.
+std::string compute_lowres_ip(ASPGlobalOptions const& opt) {
+
+  std::string left_sub_file  = opt.out_prefix + "-L_sub.tif";
+  std::string right_sub_file = opt.out_prefix + "-R_sub.tif";
+  boost::shared_ptr<DiskImageResource> left_rsrc (DiskImageResourcePtr(left_sub_file)),
+    right_rsrc(DiskImageResourcePtr(right_sub_file));
+  float left_nodata_value  = std::numeric_limits<float>::quiet_NaN();
+  float right_nodata_value = std::numeric_limits<float>::quiet_NaN();
+  if (left_rsrc->has_nodata_read ()) left_nodata_value  = left_rsrc->nodata_read ();
+  if (right_rsrc->has_nodata_read()) right_nodata_value = right_rsrc->nodata_read();
+  DiskImageView<float> left_sub(left_rsrc), right_sub(right_rsrc);
+
+  DiskImageView<vw::uint8> Lmask(opt.out_prefix + "-lMask.tif"),
+    Rmask(opt.out_prefix + "-rMask.tif");
+  Vector2 left_scale (double(Lmask.cols()) / left_sub.cols(),
+                      double(Lmask.rows()) / left_sub.rows());
+  Vector2 right_scale(double(Rmask.cols()) / right_sub.cols(),
+                      double(Rmask.rows()) / right_sub.rows());
+
+  vw_out() << "\t    * Detecting interest points in the low-resolution images.\n";
+
+  // The same range as for the full images, in low-res pixels
+  double thresh_factor = stereo_settings().ip_inlier_factor;
+  double mean_scale = (left_scale[0] + left_scale[1] + right_scale[0] + right_scale[1]) / 4.0;
+  int inlier_threshold = std::max(10.0, 200*(15.0*thresh_factor) / mean_scale);
+  std::string sub_match_file = vw::ip::match_filename(opt.out_prefix, "L_sub.tif", "R_sub.tif");
+  bool success = asp::homography_ip_matching(left_sub, right_sub,
+                                             stereo_settings().ip_per_tile,
+                                             inlier_threshold, sub_match_file,
+                                             "", "", left_nodata_value, right_nodata_value);
+  if (!success)
+    vw_throw(ArgumentErr() << "Could not find interest points in the low-resolution images.\n");
+
+  std::vector<ip::InterestPoint> left_ip, right_ip;
+  ip::read_binary_match_file(sub_match_file, left_ip, right_ip);
+  for (size_t i = 0; i < left_ip.size(); i++) {
+    left_ip[i].x  *= left_scale[0];   left_ip[i].y  *= left_scale[1];
+    left_ip[i].ix  = round(left_ip[i].x);  left_ip[i].iy  = round(left_ip[i].y);
+    right_ip[i].x *= right_scale[0];  right_ip[i].y *= right_scale[1];
+    right_ip[i].ix = round(right_ip[i].x); right_ip[i].iy = round(right_ip[i].y);
+  }
+
+  std::string match_file = opt.out_prefix + "-L_sub__R_sub-scaled.match";
+  ip::write_binary_match_file(match_file, left_ip, right_ip);
+  return match_file;
+}
+
+/// With --guided-ip-matching, once D_sub exists, match the interest
+/// points of L.tif and R.tif only near where D_sub predicts them, and
+/// save these as the aligned match file.
+void guided_ip_matching(ASPGlobalOptions const& opt) {
+
+  std::string left_aligned_image_file  = opt.out_prefix + "-L.tif";
+  std::string right_aligned_image_file = opt.out_prefix + "-R.tif";
+  std::string aligned_match_file = vw::ip::match_filename(opt.out_prefix, "L.tif", "R.tif");
+  std::string sub_disp_file = opt.out_prefix + "-D_sub.tif";
+  std::vector<std::string> ref_list;
+  ref_list.push_back(sub_disp_file);
+  ref_list.push_back(left_aligned_image_file);
+  ref_list.push_back(right_aligned_image_file);
+  if (fs::exists(aligned_match_file) && is_latest_timestamp(aligned_match_file, ref_list)) {
+    vw_out() << "\t--> Using cached match file: " << aligned_match_file << "\n";
+    return;
+  }
+
+  ImageViewRef<PixelMask<Vector2f>> sub_disp;
+  Vector2 upsample_scale;
+  asp::load_D_sub_and_scale(opt, sub_disp_file, sub_disp, upsample_scale);
+
+  boost::shared_ptr<DiskImageResource> left_rsrc (DiskImageResourcePtr(left_aligned_image_file)),
+    right_rsrc(DiskImageResourcePtr(right_aligned_image_file));
+  float left_nodata_value  = std::numeric_limits<float>::quiet_NaN();
+  float right_nodata_value = std::numeric_limits<float>::quiet_NaN();
+  if (left_rsrc->has_nodata_read ()) left_nodata_value  = left_rsrc->nodata_read ();
+  if (right_rsrc->has_nodata_read()) right_nodata_value = right_rsrc->nodata_read();
+  ImageViewRef<float> left_image  = DiskImageView<float>(left_rsrc);
+  ImageViewRef<float> right_image = DiskImageView<float>(right_rsrc);
+
+  vw_out() << "\t--> Matching full-resolution interest points guided by: "
+           << sub_disp_file << "\n";
+  ip::InterestPointList ip1, ip2;
+  if (!asp::detect_ip_pair(ip1, ip2, left_image, right_image, stereo_settings().ip_per_tile,
+                           ip::ip_filename(opt.out_prefix, left_aligned_image_file),
+                           ip::ip_filename(opt.out_prefix, right_aligned_image_file),
+                           left_nodata_value, right_nodata_value))
+    vw_throw(ArgumentErr() << "Could not find interest points.\n");
+
+  // D_sub is good to a few low-res pixels, except where it was filled in
+  const double GUIDED_SEARCH_SUB_PIXELS = 4.0;
+  double search_radius = GUIDED_SEARCH_SUB_PIXELS * std::max(upsample_scale[0],
+                                                             upsample_scale[1]);
+  bool use_hamming = (stereo_settings().ip_matching_method == DETECT_IP_METHOD_ORB);
+  std::vector<ip::InterestPoint> matched_ip1, matched_ip2;
+  asp::disparity_guided_ip_matching(ip1, ip2, sub_disp, upsample_scale, search_radius,
+                                    stereo_settings().ip_uniqueness_thresh, use_hamming,
+                                    matched_ip1, matched_ip2);
+  vw_out() << "\t    * Found " << matched_ip1.size() << " matches.\n";
+
+  ip::write_binary_match_file(aligned_match_file, matched_ip1, matched_ip2);
+}
+
 /// The first step of correlation computation.
 void lowres_correlation(ASPGlobalOptions & opt) {
 
@@ -612,6 +747,12 @@ void lowres_correlation(ASPGlobalOptions & opt) {
     // Do nothing as we will compute the search range based on D_sub
   }else if (stereo_settings().seed_mode == 3){
     // Do nothing as low-res disparity (D_sub) is already provided by sparse_disp
+  } else if (stereo_settings().guided_ip_matching && stereo_settings().seed_mode == 1) {
+    // Only the low-res ip are needed for the search range. The full-res
+    // ones are matched once D_sub exists.
+    std::string match_filename = compute_lowres_ip(opt);
+    bool is_aligned = true;
+    stereo_settings().search_range = approximate_search_range(opt, match_filename, is_aligned);
   } else { // Regular seed mode
 
     // TODO(oalexan1): All ip matching should happen in stereo_pprc for consistency.
@@ -680,6 +821,9 @@ void lowres_correlation(ASPGlobalOptions & opt) {
     } else {
       vw_out() << "\t--> Using cached low-resolution disparity: " << sub_disp_file << "\n";
     }
+
+    if (stereo_settings().guided_ip_matching && stereo_settings().seed_mode == 1)
+      guided_ip_matching(opt);
   }
 
   vw_out() << "\n[ " << current_posix_time_string()
@@ -755,6 +899,7 @@ public:
   /// Does the work
   typedef CropView<ImageView<pixel_type>> prerasterize_type;
   inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+    asp::TraceSpan span("correlation_tile", bbox);
 
     vw::stereo::CorrelationAlgorithm stereo_alg
       = asp::stereo_alg_to_num(stereo_settings().stereo_algorithm);
@@ -898,10 +1043,11 @@ void stereo_correlation_2D(ASPGlobalOptions& opt) {
   std::string right_image_file = opt.out_prefix + "-R.tif";
   
   boost::shared_ptr<DiskImageResource>
-    left_rsrc (vw::DiskImageResourcePtr(left_image_file)),
-    right_rsrc(vw::DiskImageResourcePtr(right_image_file));
+    left_rsrc (asp::cached_image_resource(left_image_file)),
+    right_rsrc(asp::cached_image_resource(right_image_file));
 
-  // Load the normalized images.
+  // Load the normalized images. Neighboring tiles read some of the
+  // same blocks, which the shared block cache, if enabled, decodes once.
   DiskImageView<PixelGray<float>> left_disk_image(left_rsrc), right_disk_image(right_rsrc);
   
   DiskImageView<vw::uint8> Lmask(opt.out_prefix + "-lMask.tif"),
@@ -960,13 +1106,28 @@ void stereo_correlation_2D(ASPGlobalOptions& opt) {
   }
 
   // Set up the reference to the stereo disparity code
-  // - Processing is limited to left_trans_crop_win for use with parallel_stereo.
-  ImageViewRef<PixelMask<Vector2f>> fullres_disparity =
-    crop(SeededCorrelatorView(left_disk_image, right_disk_image, Lmask, Rmask,
-                              sub_disp, sub_disp_spread, kernel_size, 
-                              cost_mode, corr_timeout, seconds_per_op,
-                              region_ul, lr_disp_diff_ptr), 
-         left_trans_crop_win);
+  ImageViewRef<PixelMask<Vector2f>> seeded_disparity =
+    SeededCorrelatorView(left_disk_image, right_disk_image, Lmask, Rmask,
+                         sub_disp, sub_disp_spread, kernel_size, 
+                         cost_mode, corr_timeout, seconds_per_op,
+                         region_ul, lr_disp_diff_ptr);
+
+  // Reuse the tiles finished by an interrupted run. This wraps the
+  // uncropped view, so the tiles are keyed by their position in L.tif.
+  // Only the crop below and per-pixel views are applied on top of it,
+  // so each tile it sees is a block of D.tif.
+  boost::shared_ptr<asp::TileCheckpoint> checkpoint;
+  if (stereo_settings().checkpoint_corr_tiles) {
+    if (stereo_settings().save_lr_disp_diff)
+      vw_throw(ArgumentErr() << "Cannot use --checkpoint-corr-tiles together with "
+               << "--save-left-right-disparity-difference.\n");
+    checkpoint.reset(new asp::TileCheckpoint(opt.out_prefix + "-D-checkpoint"));
+    seeded_disparity = asp::checkpointed_view(seeded_disparity, *checkpoint, opt);
+  }
+  
+  // Processing is limited to left_trans_crop_win for use with parallel_stereo.
+  ImageViewRef<PixelMask<Vector2f>> fullres_disparity
+    = crop(seeded_disparity, left_trans_crop_win);
 
   // With SGM, we must do the entire image chunk as one
   // tile. Otherwise, if it gets done in smaller tiles, there will be
@@ -1014,6 +1175,10 @@ void stereo_correlation_2D(ASPGlobalOptions& opt) {
 
   std::string d_file = opt.out_prefix + "-D.tif";
   vw_out() << "Writing: " << d_file << "\n";
+
+  // Find the disparity range as the tiles are written, so that
+  // disparitydebug need not read D.tif for it.
+  asp::DisparityStats disp_stats;
   
   if (stereo_alg > vw::stereo::VW_CORRELATION_BM) {
     // SGM and external algorithms perform subpixel correlation in
@@ -1025,7 +1190,8 @@ void stereo_correlation_2D(ASPGlobalOptions& opt) {
     ImageView<PixelMask<Vector2f>> result = fullres_disparity;
     opt.raster_tile_size = Vector2i(ASPGlobalOptions::rfne_tile_size(), // small block size
                                     ASPGlobalOptions::rfne_tile_size());
-    vw::cartography::block_write_gdal_image(d_file, result,
+    vw::cartography::block_write_gdal_image(d_file,
+                                            asp::disparity_stats_view(result, disp_stats),
                                             has_left_georef, left_georef,
                                             has_nodata, nodata, opt,
                                             TerminalProgressCallback("asp", "\t--> Correlation :"));
@@ -1033,12 +1199,22 @@ void stereo_correlation_2D(ASPGlobalOptions& opt) {
   } else {
     // Otherwise cast back to integer results to save on storage space.
     vw::cartography::block_write_gdal_image(d_file, 
-                                            pixel_cast<PixelMask<Vector2i>>(fullres_disparity),
+                                            asp::disparity_stats_view
+                                            (pixel_cast<PixelMask<Vector2i>>(fullres_disparity),
+                                             disp_stats),
                                             has_left_georef, left_georef,
                                             has_nodata, nodata, opt,
                                             TerminalProgressCallback("asp", "\t--> Correlation :"));
   }
 
+  asp::RasterStats d_stats;
+  disp_stats.save(d_stats);
+  asp::write_raster_stats(d_file, d_stats);
+
+  // D.tif is complete, so the checkpoint is no longer needed
+  if (checkpoint)
+    checkpoint->remove();
+
   if (stereo_settings().save_lr_disp_diff) {
     bool has_lr_disp_nodata = true;
     float lr_disp_nodata = -32768.0;
@@ -1137,6 +1313,35 @@ void stereo_correlation_1D(ASPGlobalOptions& opt) {
     write_nodata = false; // To avoid warnings from the tif reader in msmw
   }
 
+  // See if the external algorithm is a shared library to be called
+  // in-process. Then the aligned images are kept in memory and are
+  // written to disk only for debugging.
+  vw::stereo::CorrelationAlgorithm stereo_alg
+    = asp::stereo_alg_to_num(stereo_settings().stereo_algorithm);
+  std::string plugin_path, plugin_lib;
+  bool in_process_plugin = false;
+  if (stereo_alg == vw::stereo::VW_CORRELATION_OTHER &&
+      alg_name != "opencv_bm" && alg_name != "opencv_sgbm" &&
+      alg_name != "asp_fast_bm" && alg_name != "asp_fast_sgm") {
+    // Read the list of plugins
+    std::map<std::string, std::string> plugins, plugin_libs;
+    asp::parse_plugins_list(plugins, plugin_libs);
+    
+    auto it1 = plugins.find(alg_name);
+    auto it2 = plugin_libs.find(alg_name);
+    if (it1 == plugins.end() || it2 == plugin_libs.end()) 
+      vw_throw(ArgumentErr() << "Could not lookup plugin: " << alg_name << ".\n");
+    
+    plugin_path = it1->second;
+    plugin_lib = it2->second;
+    in_process_plugin = asp::is_plugin_library(plugin_path);
+  }
+  // ASP's own algorithms also work on the images in memory
+  bool in_memory = (in_process_plugin || stereo_alg < vw::stereo::VW_CORRELATION_OTHER ||
+                    alg_name == "asp_fast_bm" || alg_name == "asp_fast_sgm");
+  vw::ImageView<float> left_aligned_image, right_aligned_image;
+  bool write_aligned_files = (!in_memory || stereo_settings().local_alignment_debug);
+  
   double left_extra_factor = 1.0, right_extra_factor = 1.0;
   bool success = false;
   std::string err_msg;
@@ -1171,7 +1376,9 @@ void stereo_correlation_1D(ASPGlobalOptions& opt) {
                       left_trans_crop_win, right_trans_crop_win,
                       left_local_mat, right_local_mat,
                       left_aligned_file, right_aligned_file,  
-                      min_disp, max_disp);
+                      min_disp, max_disp,
+                      &left_aligned_image, &right_aligned_image,
+                      write_aligned_files);
       success = true;
       break;
     } catch(std::exception const& e){
@@ -1199,19 +1406,18 @@ void stereo_correlation_1D(ASPGlobalOptions& opt) {
   }
   
   vw::ImageView<PixelMask<Vector2f>> unaligned_disp_2d;
-  vw::stereo::CorrelationAlgorithm stereo_alg
-    = asp::stereo_alg_to_num(stereo_settings().stereo_algorithm);
   
   if (stereo_alg < vw::stereo::VW_CORRELATION_OTHER) {
 
     // ASP algorithms
 
-    // Mask the locally alignment images which were written with NaN nodata.
+    // Mask the locally alignment images which have NaN nodata. Use the
+    // in-memory copies rather than reading back the files just written.
     float nan  = std::numeric_limits<float>::quiet_NaN();
     ImageView<PixelMask<PixelGray<float>>> left_image
-      = vw::create_mask(DiskImageView<PixelGray<float>>(left_aligned_file), nan);
+      = vw::create_mask(pixel_cast<PixelGray<float>>(left_aligned_image), nan);
     ImageView<PixelMask<PixelGray<float>>> right_image
-      = vw::create_mask(DiskImageView<PixelGray<float>>(right_aligned_file), nan);
+      = vw::create_mask(pixel_cast<PixelGray<float>>(right_aligned_image), nan);
     
     ImageView<vw::uint8> left_mask
       = channel_cast_rescale<vw::uint8>(select_channel(left_image, 1));
@@ -1333,6 +1539,13 @@ void stereo_correlation_1D(ASPGlobalOptions& opt) {
       default_opts = std::string("-block_size 21 -texture_thresh 10 -prefilter_cap 31 ") +
         "-uniqueness_ratio 15 -speckle_size 100 -speckle_range 32 -disp12_diff 1";
       
+    } else if (alg_name == "asp_fast_bm") {
+      default_opts = "-block_size 9 -cost_mode 2 -lr_threshold 1";
+      
+    } else if (alg_name == "asp_fast_sgm") {
+      // The cost and subpixel modes come from --cost-mode and --subpixel-mode
+      default_opts = "-block_size 5 -P1 32 -P2 128 -lr_threshold 1";
+      
     } else if (alg_name == "opencv_sgbm") {
       
       default_opts = std::string("-mode sgbm -block_size 3 -P1 8 -P2 32 -prefilter_cap 63 ") +
@@ -1421,19 +1634,52 @@ void stereo_correlation_1D(ASPGlobalOptions& opt) {
                              opt, aligned_disp_file,  
                              // Output
                              aligned_disp);
-    } else {
-
-      // Read the list of plugins
-      std::map<std::string, std::string> plugins, plugin_libs;
-      asp::parse_plugins_list(plugins, plugin_libs);
+    } else if (alg_name == "asp_fast_bm") {
+      // ASP's own block matching on the images in memory
+      asp::block_match_1d(left_aligned_image, right_aligned_image,
+                          min_disp, max_disp,
+                          atoi(option_map["-block_size"].c_str()),
+                          asp::BlockMatchCost(atoi(option_map["-cost_mode"].c_str())),
+                          atof(option_map["-lr_threshold"].c_str()),
+                          // Output
+                          aligned_disp);
+      
+    } else if (alg_name == "asp_fast_sgm") {
+      // ASP's own semi-global matching on the images in memory
+      if (option_map.find("-cost_mode") != option_map.end() ||
+          option_map.find("-subpixel") != option_map.end())
+        vw_throw(ArgumentErr() << "For asp_fast_sgm, set the cost and subpixel "
+                 << "modes with --cost-mode and --subpixel-mode.\n");
+      check_fast_sgm_subpixel_mode();
+      asp::sgm_1d(left_aligned_image, right_aligned_image,
+                  min_disp, max_disp,
+                  atoi(option_map["-block_size"].c_str()),
+                  get_fast_sgm_cost_mode(),
+                  atoi(option_map["-P1"].c_str()),
+                  atoi(option_map["-P2"].c_str()),
+                  get_sgm_subpixel_mode() == SemiGlobalMatcher::SUBPIXEL_PARABOLA,
+                  atof(option_map["-lr_threshold"].c_str()),
+                  stereo_settings().corr_memory_limit_mb,
+                  // Output
+                  aligned_disp);
+      
+    } else if (in_process_plugin) {
 
-      auto it1 = plugins.find(alg_name);
-      auto it2 = plugin_libs.find(alg_name);
-      if (it1 == plugins.end() || it2 == plugin_libs.end()) 
-        vw_throw(ArgumentErr() << "Could not lookup plugin: " << alg_name << ".\n");
+      // Call the plugin library on the images in memory. No timeout can be
+      // enforced here. If this fails, write an empty disparity.
+      try {
+        asp::call_stereo_plugin_library(plugin_path, options, env_vars_map, 
+                                        left_aligned_image, right_aligned_image,
+                                        min_disp, max_disp,
+                                        // Output
+                                        aligned_disp);
+      } catch(std::exception const& e){
+        vw_out() << e.what() << std::endl;
+        save_empty_disparity(opt, tile_crop_win, out_disp_file);
+        return;
+      }
       
-      std::string plugin_path = it1->second;
-      std::string plugin_lib = it2->second;
+    } else {
 
       // Set up the environemnt
       bp::environment e = boost::this_process::environment();
@@ -1510,10 +1756,9 @@ void stereo_correlation_1D(ASPGlobalOptions& opt) {
     }
 
     try {
-      // Sanity check. Temporarily load the left image.
-      DiskImageView<float> left_image(left_aligned_file);
-      if (aligned_disp.cols() != left_image.cols() || 
-          aligned_disp.rows() != left_image.rows() ) 
+      // Sanity check
+      if (aligned_disp.cols() != left_aligned_image.cols() || 
+          aligned_disp.rows() != left_aligned_image.rows() ) 
         vw_throw(ArgumentErr() << "Expecting that the 1D disparity " << aligned_disp_file
                  << " would have the same dimensions as the left image " << left_aligned_file
                  << ".\n");
@@ -1596,6 +1841,94 @@ void stereo_correlation_1D(ASPGlobalOptions& opt) {
 
 } // End function stereo_correlation_1D
 
+// Run correlation for the given arguments
+void run_correlation(int argc, char* argv[]) {
+
+  bool verbose = false;
+  std::vector<ASPGlobalOptions> opt_vec;
+  std::string output_prefix;
+  asp::parse_multiview(argc, argv, CorrelationDescription(),
+                       verbose, output_prefix, opt_vec);
+  ASPGlobalOptions opt = opt_vec[0];
+  asp::StageReport report(stereo_settings().compute_low_res_disparity_only ?
+                          "lowres_corr" : "corr");
+
+  // Leave the number of parallel block threads equal to the default unless we
+  //  are using SGM in which case only one block at a time should be processed.
+  // - Processing multiple blocks is possible, but it is better to use a larger blocks
+  //   with more threads applied to the single block.
+  // - Thread handling is still a little confusing because opt.num_threads is ONLY used
+  //   to control the number of parallel image blocks written at a time.  Everything else
+  //   reads directly from vw_settings().default_num_threads()
+  vw::stereo::CorrelationAlgorithm stereo_alg
+    = asp::stereo_alg_to_num(stereo_settings().stereo_algorithm);
+  bool using_sgm = (stereo_alg > vw::stereo::VW_CORRELATION_BM &&
+                    stereo_alg < vw::stereo::VW_CORRELATION_OTHER);
+  opt.num_threads = vw_settings().default_num_threads();
+  if (using_sgm)
+    opt.num_threads = 1;
+
+  if (stereo_alg != vw::stereo::VW_CORRELATION_BM) {
+    // SGM/MGM works best with no prefilter. That one is also turned
+    // off in CorrelationView.h.
+    vw_out() << "\t--> Using no pre-processing filter with stereo algorithm: "
+             << stereo_settings().stereo_algorithm << std::endl;
+    stereo_settings().pre_filter_mode = 0;
+  } else {
+    switch (stereo_settings().pre_filter_mode){
+    case 2:
+      vw_out() << "\t--> Using LOG pre-processing filter with "
+               << stereo_settings().slogW << " sigma blur.\n"; 
+    break;
+    case 1:
+      vw_out() << "\t--> Using subtracted mean pre-processing filter with "
+               << stereo_settings().slogW << " sigma blur.\n";
+      break;
+    default:
+      vw_out() << "\t--> Using NO pre-processing filter." << std::endl;
+    }
+  }
+
+  // Integer correlator requires large tiles
+  //---------------------------------------------------------
+  int ts = stereo_settings().corr_tile_size_ovr;
+
+  // GDAL block write sizes must be a multiple to 16 so if the input value is
+  //  not a multiple of 16 increase it until it is.
+  const int TILE_MULTIPLE = 16;
+  if (ts % TILE_MULTIPLE != 0)
+    ts = ((ts / TILE_MULTIPLE) + 1) * TILE_MULTIPLE;
+    
+  opt.raster_tile_size = Vector2i(ts, ts);
+
+  vw_out() << "\n[ " << current_posix_time_string() << " ] : Stage 1 --> CORRELATION\n";
+
+  if (stereo_settings().alignment_method == "local_epipolar") {
+    // Need to have the low-res 2D disparity to later guide the
+    // per-tile correlation. Use here the ASP MGM algorithm as the
+    // most reliable one, unless we do good old block-matching
+    if (stereo_settings().compute_low_res_disparity_only) {
+      if (stereo_settings().stereo_algorithm != "asp_bm")
+        stereo_settings().stereo_algorithm = "asp_mgm";
+      stereo_correlation_2D(opt);
+      if (opt.stage_report)
+        report.save(opt.out_prefix, BBox2i());
+      return;
+    }
+    // This will be invoked per-tile.
+    stereo_correlation_1D(opt);
+  } else {
+    // Do 2D correlation. The first time this is invoked it will
+    // compute the low-res disparity unless told not to.
+    stereo_correlation_2D(opt);
+  }
+
+  if (opt.stage_report)
+    report.save(opt.out_prefix, stereo_settings().trans_crop_win);
+
+  vw_out() << "\n[ " << current_posix_time_string() << " ] : CORRELATION FINISHED\n";
+}
+
 int main(int argc, char* argv[]) {
 
   try {
@@ -1603,83 +1936,9 @@ int main(int argc, char* argv[]) {
 
     stereo_register_sessions();
 
-    bool verbose = false;
-    std::vector<ASPGlobalOptions> opt_vec;
-    std::string output_prefix;
-    asp::parse_multiview(argc, argv, CorrelationDescription(),
-                         verbose, output_prefix, opt_vec);
-    ASPGlobalOptions opt = opt_vec[0];
-
-    // Leave the number of parallel block threads equal to the default unless we
-    //  are using SGM in which case only one block at a time should be processed.
-    // - Processing multiple blocks is possible, but it is better to use a larger blocks
-    //   with more threads applied to the single block.
-    // - Thread handling is still a little confusing because opt.num_threads is ONLY used
-    //   to control the number of parallel image blocks written at a time.  Everything else
-    //   reads directly from vw_settings().default_num_threads()
-    vw::stereo::CorrelationAlgorithm stereo_alg
-      = asp::stereo_alg_to_num(stereo_settings().stereo_algorithm);
-    bool using_sgm = (stereo_alg > vw::stereo::VW_CORRELATION_BM &&
-                      stereo_alg < vw::stereo::VW_CORRELATION_OTHER);
-    opt.num_threads = vw_settings().default_num_threads();
-    if (using_sgm)
-      opt.num_threads = 1;
-
-    if (stereo_alg != vw::stereo::VW_CORRELATION_BM) {
-      // SGM/MGM works best with no prefilter. That one is also turned
-      // off in CorrelationView.h.
-      vw_out() << "\t--> Using no pre-processing filter with stereo algorithm: "
-               << stereo_settings().stereo_algorithm << std::endl;
-      stereo_settings().pre_filter_mode = 0;
-    } else {
-      switch (stereo_settings().pre_filter_mode){
-      case 2:
-        vw_out() << "\t--> Using LOG pre-processing filter with "
-                 << stereo_settings().slogW << " sigma blur.\n"; 
-      break;
-      case 1:
-        vw_out() << "\t--> Using subtracted mean pre-processing filter with "
-                 << stereo_settings().slogW << " sigma blur.\n";
-        break;
-      default:
-        vw_out() << "\t--> Using NO pre-processing filter." << std::endl;
-      }
-    }
-
-    // Integer correlator requires large tiles
-    //---------------------------------------------------------
-    int ts = stereo_settings().corr_tile_size_ovr;
-
-    // GDAL block write sizes must be a multiple to 16 so if the input value is
-    //  not a multiple of 16 increase it until it is.
-    const int TILE_MULTIPLE = 16;
-    if (ts % TILE_MULTIPLE != 0)
-      ts = ((ts / TILE_MULTIPLE) + 1) * TILE_MULTIPLE;
-      
-    opt.raster_tile_size = Vector2i(ts, ts);
-
-    vw_out() << "\n[ " << current_posix_time_string() << " ] : Stage 1 --> CORRELATION\n";
-
-    if (stereo_settings().alignment_method == "local_epipolar") {
-      // Need to have the low-res 2D disparity to later guide the
-      // per-tile correlation. Use here the ASP MGM algorithm as the
-      // most reliable one, unless we do good old block-matching
-      if (stereo_settings().compute_low_res_disparity_only) {
-        if (stereo_settings().stereo_algorithm != "asp_bm")
-          stereo_settings().stereo_algorithm = "asp_mgm";
-        stereo_correlation_2D(opt);
-        return 0;
-      }
-      // This will be invoked per-tile.
-      stereo_correlation_1D(opt);
-    } else {
-      // Do 2D correlation. The first time this is invoked it will
-      // compute the low-res disparity unless told not to.
-      stereo_correlation_2D(opt);
-    }
+    if (!asp::run_tile_queue(argc, argv, run_correlation))
+      run_correlation(argc, argv);
 
-    vw_out() << "\n[ " << current_posix_time_string() << " ] : CORRELATION FINISHED\n";
-    
     xercesc::XMLPlatformUtils::Terminate();
   } ASP_STANDARD_CATCHES;
 
@@ -19,6 +19,7 @@
 /// \file stereo_fltr.cc
 ///
 #include <asp/Tools/stereo.h>
+#include <asp/Tools/stereo_refinement.h>
 
 #include <vw/Stereo/DisparityMap.h>
 #include <vw/Stereo/Algorithms.h>
@@ -28,6 +29,7 @@
 #include <vw/Image/InpaintView.h>
 
 #include <asp/Core/ThreadedEdgeMask.h>
+#include <asp/Core/StageReport.h>
 #include <asp/Sessions/StereoSession.h>
 #include <asp/Gotcha/CBatchProc.h>
 
@@ -231,9 +233,8 @@ struct MultipleDisparityCleanUp {
 };
 
 template <class ImageT>
-void write_good_pixel_and_filtered(ImageViewBase<ImageT> const& inputview,
-                                   ASPGlobalOptions const& opt) {
-  // Write Good Pixel Map
+void write_good_pixel_map(ImageViewBase<ImageT> const& inputview,
+                          ASPGlobalOptions const& opt) {
   // Sub-sampling so that the user can actually view it.
   double sub_scale = double( min( inputview.impl().cols(),
                                 inputview.impl().rows() ) ) / 2048.0;
@@ -270,6 +271,23 @@ void write_good_pixel_and_filtered(ImageViewBase<ImageT> const& inputview,
     ( goodPixelFile, goodPixelImage, has_left_georef, good_pixel_georef,
       has_nodata, nodata,
       opt, TerminalProgressCallback("asp", "\t--> Good pixel map: ") );
+}
+
+template <class ImageT>
+void write_good_pixel_and_filtered(ImageViewBase<ImageT> const& inputview,
+                                   ASPGlobalOptions const& opt) {
+
+  // Write Good Pixel Map. If the refinement is done on the fly, the input
+  // is expensive to compute, so this map is made from the output instead.
+  bool fused = stereo_settings().fuse_refinement_filtering;
+  if (!fused)
+    write_good_pixel_map(inputview, opt);
+
+  // Determine if we can attach geo information to the output image
+  cartography::GeoReference left_georef;
+  bool has_left_georef = read_georeference(left_georef,  opt.out_prefix + "-L.tif");
+  bool has_nodata = false;
+  double nodata = -32768.0;
 
   bool removeSmallBlobs = (stereo_settings().erode_max_size > 0);
 
@@ -339,23 +357,35 @@ void write_good_pixel_and_filtered(ImageViewBase<ImageT> const& inputview,
     }
 
   } // End no hole filling case
+
+  if (fused)
+    write_good_pixel_map(DiskImageView<typename ImageT::pixel_type>(outF), opt);
 } //end write_good_pixel_and_filtered
 
 void stereo_filtering(ASPGlobalOptions& opt) {
 
+  bool fused = stereo_settings().fuse_refinement_filtering;
+  if (fused && (stereo_settings().mask_flatfield || stereo_settings().enable_fill_holes))
+    vw_throw(ArgumentErr() << "The option --fuse-refinement-filtering cannot be used "
+             << "with --mask-flatfield or --enable-fill-holes.\n");
+  
   string post_correlation_fname;
-  opt.session->pre_filtering_hook(opt.out_prefix+"-RD.tif",
-                                  post_correlation_fname);
+  if (!fused)
+    opt.session->pre_filtering_hook(opt.out_prefix+"-RD.tif",
+                                    post_correlation_fname);
 
   try {
 
-    // Rasterize the results so far to a temporary file on disk.
-    // This file is deleted once we complete the second half of the
-    // disparity map filtering process.
-
-    // Apply filtering for high frequencies
-    typedef DiskImageView<PixelMask<Vector2f> > input_type;
-    input_type disparity_disk_image(post_correlation_fname);
+    // Either read RD.tif, or refine the disparity here, one tile at a
+    // time, as the filters below ask for it.
+    typedef ImageViewRef<PixelMask<Vector2f> > input_type;
+    input_type disparity_disk_image;
+    if (fused) {
+      vw_out() << "\t--> Refining the disparity in memory, with no RD.tif.\n";
+      disparity_disk_image = asp::refined_disparity_view(opt);
+    } else {
+      disparity_disk_image = DiskImageView<PixelMask<Vector2f> >(post_correlation_fname);
+    }
 
     // Applying additional clipping from the edge. We make new
     // mask files to avoid a weird and tricky segfault due to ownership issues.
@@ -488,11 +518,20 @@ void gotcha_disparity_refinement(ASPGlobalOptions& opt) {
   bool has_left_georef = read_georeference(left_georef, L_file);
   bool has_nodata = false;
   double nodata = -32768.0;
+
+  // If there are fewer tiles than threads, let each tile use the rest
+  int tile_size = opt.raster_tile_size[0];
+  int num_tiles = ((filtered_disparity.cols() + tile_size - 1) / tile_size) *
+                  ((filtered_disparity.rows() + tile_size - 1) / tile_size);
+  int num_threads_per_tile
+    = std::max(1, int(vw_settings().default_num_threads()) / std::max(num_tiles, 1));
+  
   vw_out() << "Writing Gotcha-refined disparity: " << disp_file << endl;
   block_write_gdal_image(disp_file,
                          gotcha::gotcha_refine(filtered_disparity,  
                                                left_image, right_image,
-                                               padding, stereo_settings().casp_go_param_file),
+                                               padding, stereo_settings().casp_go_param_file,
+                                               num_threads_per_tile),
                          has_left_georef, left_georef,
                          has_nodata, nodata, opt,
                          TerminalProgressCallback("asp","\t  Gotcha:  "));
@@ -522,6 +561,7 @@ int main(int argc, char* argv[]) {
     asp::parse_multiview(argc, argv, FilteringDescription(),
                          verbose, output_prefix, opt_vec);
     ASPGlobalOptions opt = opt_vec[0];
+    asp::StageReport report("fltr");
 
     // Internal Processes
     //---------------------------------------------------------
@@ -529,6 +569,9 @@ int main(int argc, char* argv[]) {
 
     if (stereo_settings().gotcha_disparity_refinement)
       gotcha_disparity_refinement(opt);
+
+    if (opt.stage_report)
+      report.save(opt.out_prefix, stereo_settings().trans_crop_win);
     
     vw_out() << "\n[ " << current_posix_time_string()
              << " ] : FILTERING FINISHED \n";
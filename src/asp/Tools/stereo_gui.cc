@@ -223,9 +223,12 @@ void readImages(std::vector<std::string> const& all_files,
   output_prefix = "";
   images.clear();
 
-  // Try to load each input file as a standalone image one at a time
+  // Try to load each input file as a standalone image one at a time.
+  // Images given as URLs are read over the network.
   for (size_t i = 0; i < all_files.size(); i++) {
-    std::string file = all_files[i];
+    std::string file = vw::gui::remote_image_path(all_files[i]);
+    if (vw::gui::is_remote_image(file))
+      vw::gui::configure_remote_reads(stereo_settings().remote_cache_size_mb);
     bool is_image = false;
     try {
       DiskImageView<float> tmp(file);
@@ -259,7 +262,9 @@ void readImages(std::vector<std::string> const& all_files,
         is_image = false;
       } else {
         vw_out() << "Not a valid image: " << file << ". ";
-        if (!fs::exists(file)) {
+        if (vw::gui::is_remote_image(file)) {
+          vw_out() << e.what() << "\n";
+        } else if (!fs::exists(file)) {
           vw_out() << "Using this as the output prefix.\n";
           output_prefix = file;
         } else {
@@ -297,24 +302,10 @@ int main(int argc, char** argv) {
 
     if (stereo_settings().create_image_pyramids_only) {
       // Just create the image pyramids and exit. 
-      for (size_t i = 0; i < images.size(); i++) {
-        vw::gui::imageData img;
-        img.read(images[i], opt);
-        if (stereo_settings().hillshade) {
-          // Create hillshaded images. 
-          std::string hillshaded_file;
-          bool have_gui = false; // so we don't use a pop up before the gui got started
-          bool success = vw::gui::write_hillshade(opt,
-                                                  have_gui,
-                                                  stereo_settings().hillshade_azimuth,
-                                                  stereo_settings().hillshade_elevation,
-                                                  images[i],
-                                                  // Output
-                                                  hillshaded_file);
-          if (success) // build the pyramids
-            img.read(hillshaded_file, opt, vw::gui::HILLSHADED_VIEW);
-        }
-      }
+      std::vector<vw::gui::imageData> img_data;
+      vw::gui::read_images_in_parallel(images, opt,
+                                       std::vector<std::map<std::string, std::string>>
+                                       (images.size()), img_data);
       return 0;
     }
 
@@ -21,6 +21,8 @@
 /// This program is to allow python access to stereo settings.
 
 #include <asp/Tools/stereo.h>
+#include <asp/Core/DisparityProcessing.h>
+#include <asp/Core/Hash.h>
 #include <vw/Stereo/DisparityMap.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
 #include <vw/Stereo/CorrelationView.h>
@@ -89,6 +91,173 @@ void find_tile_at_loc(std::string const& tile_at_loc, ASPGlobalOptions const& op
     vw_out() << "No tile found at location.\n"; 
 }
 
+// The tiles of a parallel_stereo run, in the order produced there
+std::vector<BBox2i> parallel_stereo_tiles(Vector2i const& image_size) {
+
+  int tile_w = stereo_settings().job_size_w, tile_h = stereo_settings().job_size_h;
+  if (tile_w <= 0 || tile_h <= 0)
+    vw_throw(ArgumentErr() << "The job size must be positive.\n");
+  int tiles_nx = (image_size.x() + tile_w - 1) / tile_w;
+  int tiles_ny = (image_size.y() + tile_h - 1) / tile_h;
+
+  std::vector<BBox2i> tiles;
+  for (int j = 0; j < tiles_ny; j++) {
+    for (int i = 0; i < tiles_nx; i++) {
+      tiles.push_back(BBox2i(i * tile_w, j * tile_h,
+                             std::min(tile_w, image_size.x() - i * tile_w),
+                             std::min(tile_h, image_size.y() - j * tile_h)));
+    }
+  }
+  return tiles;
+}
+
+// The region of D_sub corresponding to a full-resolution box. It is
+// non-empty unless the box is outside of D_sub.
+BBox2i sub_disp_box(BBox2i const& box, Vector2 const& upsample_scale,
+                    ImageView<PixelMask<Vector2f>> const& sub_disp) {
+  BBox2i sub_box(floor(box.min().x() / upsample_scale.x()),
+                 floor(box.min().y() / upsample_scale.y()), 0, 0);
+  sub_box.max() = Vector2i(ceil(box.max().x() / upsample_scale.x()),
+                           ceil(box.max().y() / upsample_scale.y()));
+  sub_box.max() = elem_max(sub_box.max(), sub_box.min() + Vector2i(1, 1));
+  sub_box.crop(bounding_box(sub_disp));
+  return sub_box;
+}
+
+// Estimate the full-resolution correlation cost of each tile of a
+// parallel_stereo run. The cost of a tile is the number of its pixels where
+// D_sub is valid, times the area of the search range over those, plus
+// the number of its pixels, which accounts for the per-pixel overhead.
+void write_tile_costs(std::string const& cost_file, ASPGlobalOptions const& opt) {
+
+  ImageViewRef<PixelMask<Vector2f>> sub_disp_ref;
+  Vector2 upsample_scale;
+  asp::load_D_sub_and_scale(opt, opt.out_prefix + "-D_sub.tif", sub_disp_ref,
+                            upsample_scale);
+  ImageView<PixelMask<Vector2f>> sub_disp = sub_disp_ref;
+
+  std::vector<BBox2i> tiles
+    = parallel_stereo_tiles(file_image_size(opt.out_prefix + "-L.tif"));
+
+  std::ofstream ofs(cost_file.c_str());
+  if (!ofs.good())
+    vw_throw(IOErr() << "Cannot write: " << cost_file << "\n");
+  ofs.precision(17);
+
+  for (size_t index = 0; index < tiles.size(); index++) {
+    BBox2i const& tile = tiles[index];
+    BBox2i sub_box = sub_disp_box(tile, upsample_scale, sub_disp);
+
+    double num_valid = 0;
+    BBox2f range;
+    for (int col = sub_box.min().x(); col < sub_box.max().x(); col++) {
+      for (int row = sub_box.min().y(); row < sub_box.max().y(); row++) {
+        if (!is_valid(sub_disp(col, row)))
+          continue;
+        num_valid++;
+        range.grow(sub_disp(col, row).child());
+      }
+    }
+
+    double num_pixels = double(tile.width()) * double(tile.height());
+    double cost = num_pixels;
+    if (num_valid > 0 && !sub_box.empty()) {
+      double valid_frac = num_valid / (double(sub_box.width()) * double(sub_box.height()));
+      double search_area = (range.width()  * upsample_scale.x() + 1.0) *
+                           (range.height() * upsample_scale.y() + 1.0);
+      cost += valid_frac * num_pixels * search_area;
+    }
+    ofs << index << " " << cost << "\n";
+  }
+
+  vw_out() << "Wrote: " << cost_file << "\n";
+}
+
+// Find a hash of all the data which full-resolution correlation of each
+// tile of a parallel_stereo run reads, that is, L.tif over the tile with
+// its collar, R.tif over that region shifted by the search range, and
+// D_sub over the tile. If the hash of a tile is the same as in a previous
+// run with the same options, its correlation need not be redone.
+void write_tile_hashes(std::string const& hash_file, ASPGlobalOptions const& opt) {
+
+  std::string left_file = opt.out_prefix + "-L.tif", right_file = opt.out_prefix + "-R.tif";
+  ImageViewRef<float> left = DiskImageView<float>(left_file);
+  ImageViewRef<float> right = DiskImageView<float>(right_file);
+
+  ImageView<PixelMask<Vector2f>> sub_disp;
+  Vector2 upsample_scale(1, 1);
+  std::string d_sub_file = opt.out_prefix + "-D_sub.tif";
+  if (fs::exists(d_sub_file)) {
+    ImageViewRef<PixelMask<Vector2f>> sub_disp_ref;
+    asp::load_D_sub_and_scale(opt, d_sub_file, sub_disp_ref, upsample_scale);
+    sub_disp = sub_disp_ref;
+  }
+
+  vw::stereo::CorrelationAlgorithm stereo_alg
+    = asp::stereo_alg_to_num(stereo_settings().stereo_algorithm);
+  bool using_tiles = (stereo_alg > vw::stereo::VW_CORRELATION_BM ||
+                      stereo_settings().alignment_method == "local_epipolar");
+  int collar_size = using_tiles ? stereo_settings().sgm_collar_size : 0;
+
+  std::vector<BBox2i> tiles = parallel_stereo_tiles(Vector2i(left.cols(), left.rows()));
+
+  std::ofstream ofs(hash_file.c_str());
+  if (!ofs.good())
+    vw_throw(IOErr() << "Cannot write: " << hash_file << "\n");
+
+  // The hash of all of R.tif, found only once, and only if some tile
+  // needs it
+  std::uint64_t full_right_hash = 0;
+  bool have_full_right_hash = false;
+
+  for (size_t index = 0; index < tiles.size(); index++) {
+
+    std::uint64_t hash = asp::HASH_START;
+
+    BBox2i left_box = tiles[index];
+    left_box.expand(collar_size);
+    left_box.crop(bounding_box(left));
+    asp::hash_image_box(left, left_box, hash);
+
+    // Without a valid D_sub, all of R.tif can be seen by any tile
+    BBox2i right_box = bounding_box(right);
+    BBox2i sub_box;
+    if (sub_disp.cols() > 0)
+      sub_box = sub_disp_box(left_box, upsample_scale, sub_disp);
+    BBox2f range;
+    for (int col = sub_box.min().x(); col < sub_box.max().x(); col++) {
+      for (int row = sub_box.min().y(); row < sub_box.max().y(); row++) {
+        if (!is_valid(sub_disp(col, row)))
+          continue;
+        range.grow(sub_disp(col, row).child());
+        asp::hash_bytes(&sub_disp(col, row).child()[0], 2 * sizeof(float), hash);
+      }
+    }
+    if (!range.empty()) {
+      right_box = left_box;
+      right_box.min() += Vector2i(floor(range.min().x() * upsample_scale.x()) - 1,
+                                  floor(range.min().y() * upsample_scale.y()) - 1);
+      right_box.max() += Vector2i(ceil(range.max().x() * upsample_scale.x()) + 1,
+                                  ceil(range.max().y() * upsample_scale.y()) + 1);
+      right_box.crop(bounding_box(right));
+    }
+    if (right_box == bounding_box(right)) {
+      if (!have_full_right_hash) {
+        full_right_hash = asp::HASH_START;
+        asp::hash_image_box(right, right_box, full_right_hash);
+        have_full_right_hash = true;
+      }
+      asp::hash_bytes(&full_right_hash, sizeof(full_right_hash), hash);
+    } else {
+      asp::hash_image_box(right, right_box, hash);
+    }
+
+    ofs << index << " " << std::hex << hash << std::dec << "\n";
+  }
+
+  vw_out() << "Wrote: " << hash_file << "\n";
+}
+
 int main(int argc, char* argv[]) {
 
   try {
@@ -110,6 +279,16 @@ int main(int argc, char* argv[]) {
       find_tile_at_loc(stereo_settings().tile_at_loc, opt);
       return 1;
     }
+
+    if (!stereo_settings().tile_cost_file.empty()) {
+      write_tile_costs(stereo_settings().tile_cost_file, opt);
+      return 0;
+    }
+
+    if (!stereo_settings().tile_hash_file.empty()) {
+      write_tile_hashes(stereo_settings().tile_hash_file, opt);
+      return 0;
+    }
     
     vw_out() << "in_file1,"        << opt.in_file1        << endl;
     vw_out() << "in_file2,"        << opt.in_file2        << endl;
@@ -203,6 +382,9 @@ int main(int argc, char* argv[]) {
     vw_out() << "save_lr_disp_diff," << stereo_settings().save_lr_disp_diff << std::endl;
 
     vw_out() << "correlator_mode," << stereo_settings().correlator_mode << endl;
+
+    vw_out() << "fuse_refinement_filtering," << stereo_settings().fuse_refinement_filtering
+             << endl;
     
     // This block of code should be in its own executable but I am
     // reluctant to create one just for it. This functionality will be
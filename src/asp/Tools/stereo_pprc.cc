@@ -31,6 +31,7 @@
 #include <vw/Math/Functors.h>
 #include <asp/Tools/stereo.h>
 #include <asp/Core/ThreadedEdgeMask.h>
+#include <asp/Core/StageReport.h>
 #include <asp/Sessions/StereoSession.h>
 #include <asp/Sessions/StereoSessionFactory.h>
 #include <xercesc/util/PlatformUtils.hpp>
@@ -595,6 +596,7 @@ int main(int argc, char* argv[]) {
     asp::parse_multiview(argc, argv, PreProcessingDescription(),
                          verbose, output_prefix, opt_vec);
     ASPGlobalOptions opt = opt_vec[0];
+    asp::StageReport report("pprc");
 
     vw_out() << "Using image files:  " << opt.in_file1  << ", " << opt.in_file2  << std::endl;
     if (opt.cam_file1 != "" || opt.cam_file2 != "") 
@@ -612,6 +614,9 @@ int main(int argc, char* argv[]) {
     stereo_preprocessing(adjust_left_image_size, opt);
 
     estimate_convergence_angle(opt);
+
+    if (opt.stage_report)
+      report.save(opt.out_prefix, stereo_settings().trans_crop_win);
     
     vw_out() << "\n[ " << current_posix_time_string() << " ] : PREPROCESSING FINISHED \n";
 
@@ -0,0 +1,38 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file stereo_refinement.h
+///
+
+#ifndef __ASP_TOOLS_STEREO_REFINEMENT_H__
+#define __ASP_TOOLS_STEREO_REFINEMENT_H__
+
+#include <asp/Tools/stereo.h>
+
+namespace asp {
+
+  /// Read L.tif, R.tif, and D.tif (or B.tif with --subpix-from-blend), and
+  /// return the refined disparity, cropped to the transformed crop window.
+  /// Nothing is computed until the result is rasterized, one tile at a
+  /// time. The options must outlive the result.
+  vw::ImageViewRef<vw::PixelMask<vw::Vector2f>>
+  refined_disparity_view(ASPGlobalOptions const& opt);
+
+} // end namespace asp
+
+#endif // __ASP_TOOLS_STEREO_REFINEMENT_H__
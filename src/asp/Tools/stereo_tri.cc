@@ -23,14 +23,24 @@
 #include <vw/Stereo/DisparityMap.h>
 #include <vw/Image/Filter.h>
 #include <vw/InterestPoint/Matcher.h>
+#include <vw/Image/BlockRasterize.h>
+#include <vw/Cartography/PointImageManipulation.h>
+#include <vw/Cartography/GeoReferenceUtils.h>
 
 #include <asp/Camera/RPCModel.h>
+#include <asp/Camera/BatchProjection.h>
 #include <asp/Core/DisparityProcessing.h>
 #include <asp/Core/Bathymetry.h>
 #include <asp/Tools/stereo.h>
 #include <asp/Tools/jitter_adjust.h>
 #include <asp/Tools/ccd_adjust.h>
 #include <asp/Core/IpMatchingAlgs.h>
+#include <asp/Core/StageReport.h>
+#include <asp/Core/Tracing.h>
+#include <asp/Core/TileMosaic.h>
+#include <asp/Core/OrthoRasterizer.h>
+#include <asp/Core/OutlierProcessing.h>
+#include <asp/Core/PointUtils.h>
 
 // We must have the implementations of all sessions for triangulation
 #include <asp/Sessions/StereoSessionFactory.h>
@@ -42,7 +52,9 @@
 #include <asp/Sessions/StereoSessionASTER.h>
 
 #include <xercesc/util/PlatformUtils.hpp>
+#include <gdal.h>
 #include <ctime>
+#include <random>
 
 using namespace vw;
 
@@ -50,13 +62,239 @@ namespace asp{
 
 enum OUTPUT_CLOUD_TYPE {FULL_CLOUD, BATHY_CLOUD, TOPO_CLOUD}; // all, below water, above water
 
+/// A stereo model which can also triangulate all the pixels of a tile at
+/// once, with two cameras and no least squares refinement. The rays of a
+/// camera are found exactly on a lattice of its pixels and interpolated
+/// in between, and the closest points of all ray pairs are found in one
+/// loop, with no per-pixel allocations or virtual calls. At one pixel
+/// per block of the tile the result is compared with exact rays, and
+/// blocks where they differ too much are redone exactly.
+class BatchStereoModel: public vw::stereo::StereoModel {
+public:
+  BatchStereoModel(std::vector<const vw::camera::CameraModel *> const& cameras,
+                   bool least_squares_refine, double angle_tol):
+    vw::stereo::StereoModel(cameras, least_squares_refine, angle_tol) {}
+
+  bool supports_batch() const {
+    return m_cameras.size() == 2 && !m_least_squares;
+  }
+
+  vw::camera::CameraModel const* camera(int i) const { return m_cameras[i]; }
+
+  /// The model for the left camera and the given other cameras only
+  BatchStereoModel select_cameras(std::vector<int> const& others) const {
+    std::vector<const vw::camera::CameraModel *> cameras(1, m_cameras[0]);
+    for (size_t i = 0; i < others.size(); i++)
+      cameras.push_back(m_cameras[others[i]]);
+    return BatchStereoModel(cameras, m_least_squares, m_angle_tol);
+  }
+
+  /// Triangulate the pixel pairs of a tile, given in raster order. A pair
+  /// with a NaN pixel is skipped. As for operator(), the point and error
+  /// are zero where triangulation fails. With zero ray spacing, all rays
+  /// are exact.
+  void triangulate_tile(std::vector<Vector2> const& pix0, std::vector<Vector2> const& pix1,
+                        Vector2i const& tile_size, int ray_spacing, double max_error,
+                        std::vector<Vector3> & points, std::vector<Vector3> & errors) const {
+
+    size_t num = pix0.size();
+    points.assign(num, Vector3());
+    errors.assign(num, Vector3());
+
+    std::vector<unsigned char> todo(num, 0), have(num, 0);
+    size_t num_todo = 0;
+    BBox2 box0, box1;
+    for (size_t k = 0; k < num; k++) {
+      if (!is_good_pixel(pix0[k]) || !is_good_pixel(pix1[k]))
+        continue;
+      todo[k] = 1;
+      num_todo++;
+      box0.grow(pix0[k]);
+      box1.grow(pix1[k]);
+    }
+    if (num_todo == 0)
+      return;
+
+    std::vector<Vector3> ctr0(num), dir0(num), ctr1(num), dir1(num);
+
+    // Interpolate the rays, unless a lattice would have more nodes than
+    // there are pixels to do, such as for a disparity with outliers.
+    RayLattice lattice0, lattice1;
+    bool use_lattice = (ray_spacing > 0 &&
+                        num_lattice_nodes(box0, ray_spacing) <= num_todo / 4 &&
+                        num_lattice_nodes(box1, ray_spacing) <= num_todo / 4);
+    if (use_lattice) {
+      lattice0.build(m_cameras[0], box0, ray_spacing);
+      lattice1.build(m_cameras[1], box1, ray_spacing);
+      for (size_t k = 0; k < num; k++)
+        have[k] = (todo[k] &&
+                   lattice0.ray(pix0[k], ctr0[k], dir0[k]) &&
+                   lattice1.ray(pix1[k], ctr1[k], dir1[k]));
+    }
+
+    std::vector<unsigned char> interpolated = have;
+
+    // Exact rays where they were not interpolated
+    std::vector<unsigned char> exact(num, 0);
+    for (size_t k = 0; k < num; k++)
+      exact[k] = (todo[k] && !have[k]);
+    exact_rays(pix0, pix1, exact, ctr0, dir0, ctr1, dir1, have);
+
+    std::vector<Vector3> dirs(2); // scratch space for the parallel rays check
+    for (size_t k = 0; k < num; k++)
+      if (have[k])
+        triangulate_rays(ctr0[k], dir0[k], ctr1[k], dir1[k], dirs, points[k], errors[k]);
+
+    if (!use_lattice)
+      return;
+
+    // In each block, compare with exact rays at the interpolated pixel
+    // closest to the block center. Redo the block exactly if the points
+    // are further apart than the given fraction of the ground size of a
+    // pixel, which is the angle of a pixel times the distance to the point.
+    int cols = tile_size[0], rows = tile_size[1];
+    std::fill(exact.begin(), exact.end(), 0);
+    bool redo = false;
+    for (int by = 0; by < rows; by += ray_spacing) {
+      for (int bx = 0; bx < cols; bx += ray_spacing) {
+        int ex = std::min(bx + ray_spacing, cols), ey = std::min(by + ray_spacing, rows);
+        double cx = 0.5 * (bx + ex - 1), cy = 0.5 * (by + ey - 1);
+        size_t best = num;
+        double best_dist = std::numeric_limits<double>::max();
+        for (int y = by; y < ey; y++) {
+          for (int x = bx; x < ex; x++) {
+            size_t k = size_t(y) * cols + x;
+            if (!interpolated[k])
+              continue;
+            double dist = (x - cx) * (x - cx) + (y - cy) * (y - cy);
+            if (dist < best_dist) {
+              best_dist = dist;
+              best = k;
+            }
+          }
+        }
+        if (best == num)
+          continue;
+
+        std::vector<Vector3> c0(1), d0(1), c1(1), d1(1);
+        std::vector<unsigned char> found(1, 0);
+        exact_rays(std::vector<Vector2>(1, pix0[best]), std::vector<Vector2>(1, pix1[best]),
+                   std::vector<unsigned char>(1, 1), c0, d0, c1, d1, found);
+        Vector3 exact_point, exact_error;
+        if (found[0])
+          triangulate_rays(c0[0], d0[0], c1[0], d1[0], dirs, exact_point, exact_error);
+
+        double pixel_size = lattice0.pixel_angle(pix0[best]) * norm_2(exact_point - c0[0]);
+        bool good = (found[0] && exact_point != Vector3() && points[best] != Vector3() &&
+                     norm_2(points[best] - exact_point) <= max_error * pixel_size);
+        if (good)
+          continue;
+
+        for (int y = by; y < ey; y++) {
+          for (int x = bx; x < ex; x++) {
+            size_t k = size_t(y) * cols + x;
+            if (interpolated[k])
+              exact[k] = 1;
+          }
+        }
+        redo = true;
+      }
+    }
+    if (!redo)
+      return;
+
+    for (size_t k = 0; k < num; k++) {
+      if (exact[k]) {
+        have[k] = 0;
+        points[k] = Vector3();
+        errors[k] = Vector3();
+      }
+    }
+    exact_rays(pix0, pix1, exact, ctr0, dir0, ctr1, dir1, have);
+    for (size_t k = 0; k < num; k++)
+      if (exact[k] && have[k])
+        triangulate_rays(ctr0[k], dir0[k], ctr1[k], dir1[k], dirs, points[k], errors[k]);
+  }
+
+private:
+
+  static bool is_good_pixel(Vector2 const& pix) {
+    return pix == pix && pix != camera::CameraModel::invalid_pixel(); // not NaN
+  }
+
+  static size_t num_lattice_nodes(BBox2 const& box, int spacing) {
+    return size_t(box.width() / spacing + 2) * size_t(box.height() / spacing + 2);
+  }
+
+  /// Find the exact rays for the pixel pairs flagged in 'which', a row of
+  /// pixels at a time, so linescan cameras reuse the pose. Set 'have' for
+  /// those where both rays were found.
+  void exact_rays(std::vector<Vector2> const& pix0, std::vector<Vector2> const& pix1,
+                  std::vector<unsigned char> const& which,
+                  std::vector<Vector3> & ctr0, std::vector<Vector3> & dir0,
+                  std::vector<Vector3> & ctr1, std::vector<Vector3> & dir1,
+                  std::vector<unsigned char> & have) const {
+    std::vector<size_t> index;
+    std::vector<Vector2> p0, p1;
+    for (size_t k = 0; k < which.size(); k++) {
+      if (!which[k])
+        continue;
+      index.push_back(k);
+      p0.push_back(pix0[k]);
+      p1.push_back(pix1[k]);
+    }
+    if (index.empty())
+      return;
+
+    std::vector<Vector3> c0, d0, c1, d1;
+    std::vector<unsigned char> v0, v1;
+    pixels_to_rays(m_cameras[0], p0, c0, d0, v0);
+    pixels_to_rays(m_cameras[1], p1, c1, d1, v1);
+    for (size_t i = 0; i < index.size(); i++) {
+      size_t k = index[i];
+      have[k] = (v0[i] && v1[i]);
+      ctr0[k] = c0[i]; dir0[k] = d0[i];
+      ctr1[k] = c1[i]; dir1[k] = d1[i];
+    }
+  }
+
+  /// The midpoint of the closest points of the two rays, and the vector
+  /// between those, as StereoModel finds for two rays. The dirs vector
+  /// must have two elements, and is passed in so it is not allocated
+  /// for each pixel.
+  void triangulate_rays(Vector3 const& ctr0, Vector3 const& dir0,
+                        Vector3 const& ctr1, Vector3 const& dir1,
+                        std::vector<Vector3> & dirs,
+                        Vector3 & point, Vector3 & error) const {
+    point = Vector3();
+    error = Vector3();
+
+    dirs[0] = dir0;
+    dirs[1] = dir1;
+    if (are_nearly_parallel(m_least_squares, m_angle_tol, dirs))
+      return;
+
+    Vector3 v01 = cross_prod(dir0, dir1);
+    Vector3 v0  = cross_prod(v01, dir0);
+    Vector3 v1  = cross_prod(v01, dir1);
+    Vector3 closest0 = ctr0 + (dot_prod(v1, ctr1 - ctr0) / dot_prod(v1, dir0)) * dir0;
+    Vector3 closest1 = ctr1 + (dot_prod(v0, ctr0 - ctr1) / dot_prod(v0, dir1)) * dir1;
+    error = closest0 - closest1;
+    point = 0.5 * (closest0 + closest1);
+
+    // Reflect points that fall behind one of the two cameras
+    if (dot_prod(point - ctr0, dir0) < 0 || dot_prod(point - ctr1, dir1) < 0)
+      point = -point + 2 * ctr0;
+  }
+};
+
 /// The main class for taking in a set of disparities and returning a
 /// point cloud via joint triangulation.
 class StereoTXAndErrorView:
   public ImageViewBase<StereoTXAndErrorView> {
   std::vector<DispImageType>    m_disparity_maps;
   std::vector<vw::TransformPtr> m_transforms; // e.g., map-projection or homography to undo
-  vw::stereo::StereoModel       m_stereo_model;
+  BatchStereoModel              m_stereo_model;
   asp::BathyStereoModel         m_bathy_model;
   bool                          m_is_map_projected;
   bool                          m_bathy_correct;
@@ -75,7 +313,7 @@ public:
   /// Constructor
   StereoTXAndErrorView(std::vector<DispImageType>    const& disparity_maps,
                        std::vector<vw::TransformPtr> const& transforms,
-                       vw::stereo::StereoModel       const& stereo_model,
+                       BatchStereoModel              const& stereo_model,
                        asp::BathyStereoModel         const& bathy_model,
                        bool is_map_projected,
                        bool bathy_correct, OUTPUT_CLOUD_TYPE cloud_type,
@@ -149,68 +387,273 @@ public:
 
     // Continue with bathymetry correction. Note how we assume no
     // multi-view stereo happens.
-    Vector2 lpix(i, j);
-    DPixelT disp = m_disparity_maps[0](i, j, p);
-    if (!is_valid(disp)) {
-      subvector(result, 0, 3) = Vector3(0, 0, 0);
-      subvector(result, 3, 3) = Vector3(0, 0, 0);
+    bool do_bathy = false;
+    if (!bathy_pixel(Vector2(i, j), m_disparity_maps[0](i, j, p), do_bathy))
       return result;
+
+    // Do the triangulation. The did_bathy variable may change. 
+    bool did_bathy = false;
+    Vector3 point = m_bathy_model(pixVec, errorVec, do_bathy, did_bathy);
+    bathy_result(point, errorVec, did_bathy, result);
+    return result; // Contains location and error vector
+  }
+  
+  typedef CropView<ImageView<pixel_type>> prerasterize_type;
+  inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
+
+    asp::TraceSpan span("triangulation_tile", bbox);
+    // Bring in memory what the tile needs, and with several
+    // disparities, keep only the views which help in this tile
+    StereoTXAndErrorView full_view = PreRasterHelper(bbox, m_transforms);
+    StereoTXAndErrorView tile_view = (!m_bathy_correct && m_disparity_maps.size() > 1) ?
+      full_view.select_views(bbox) : full_view;
+
+    // A tile with no water in the left mask needs no bathymetry
+    // correction, so it is done as without it, unless only the points
+    // under water are wanted.
+    if (m_bathy_correct && !tile_view.has_water(bbox)) {
+      if (m_cloud_type == BATHY_CLOUD)
+        return prerasterize_type(ImageView<pixel_type>(bbox.width(), bbox.height()),
+                                 -bbox.min().x(), -bbox.min().y(), cols(), rows());
+      tile_view.m_bathy_correct = false;
+    }
+
+    ImageView<pixel_type> tile(bbox.width(), bbox.height());
+    if (!tile_view.m_bathy_correct && tile_view.m_stereo_model.supports_batch()) {
+      tile_view.triangulate_tile(bbox, tile);
+    } else if (tile_view.m_bathy_correct && !m_bathy_model.least_squares()) {
+      tile_view.triangulate_bathy_tile(bbox, tile);
+    } else {
+      for (int row = 0; row < bbox.height(); row++)
+        for (int col = 0; col < bbox.width(); col++)
+          tile(col, row) = tile_view(bbox.min().x() + col, bbox.min().y() + row);
     }
 
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+  template <class DestT>
+  inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+
+private:
+
+  /// With several disparities, choose the views to triangulate a tile
+  /// from. A view with no valid disparity in the tile is dropped. If more
+  /// are left than --triangulation-max-views allows, the best ones are
+  /// kept, ranked by their number of valid disparities times the sine of
+  /// the median convergence angle with the left image, found at a sample
+  /// of the pixels. This must be called on the view made for this tile.
+  StereoTXAndErrorView select_views(BBox2i const& bbox) const {
+
+    int num_disp = m_disparity_maps.size();
+    int step = std::max(1, std::max(bbox.width(), bbox.height()) / 8);
+    std::vector<std::pair<double, int>> scores; // (-score, view), best first once sorted
+    for (int c = 0; c < num_disp; c++) {
+      std::int64_t num_valid = 0;
+      std::vector<ip::InterestPoint> left_ip, right_ip;
+      for (int row = 0; row < bbox.height(); row++) {
+        for (int col = 0; col < bbox.width(); col++) {
+          Vector2 pix(bbox.min().x() + col, bbox.min().y() + row);
+          DPixelT disp = m_disparity_maps[c](pix.x(), pix.y());
+          if (!is_valid(disp))
+            continue;
+          num_valid++;
+          if (row % step != 0 || col % step != 0)
+            continue;
+          Vector2 lpix, rpix;
+          try {
+            lpix = m_transforms[0]->reverse(pix);
+            rpix = m_transforms[c+1]->reverse(pix + stereo::DispHelper(disp));
+          } catch (...) {
+            continue;
+          }
+          left_ip.push_back(ip::InterestPoint(lpix.x(), lpix.y()));
+          right_ip.push_back(ip::InterestPoint(rpix.x(), rpix.y()));
+        }
+      }
+      if (num_valid == 0)
+        continue;
+
+      std::vector<double> angles;
+      asp::convergence_angles(m_stereo_model.camera(0), m_stereo_model.camera(c+1),
+                              left_ip, right_ip, angles);
+      double angle = angles.empty() ? 0.0 : angles[angles.size()/2];
+      scores.push_back(std::make_pair(-double(num_valid) * sin(angle * M_PI / 180.0), c));
+    }
+
+    std::sort(scores.begin(), scores.end());
+    int max_views = stereo_settings().triangulation_max_views;
+    if (max_views > 0 && int(scores.size()) > max_views - 1)
+      scores.resize(max_views - 1);
+    if (int(scores.size()) == num_disp)
+      return *this;
+
+    // Keep the views in their original order. With no valid disparity
+    // at all, one view is enough to produce the empty tile.
+    std::vector<int> views;
+    for (size_t i = 0; i < scores.size(); i++)
+      views.push_back(scores[i].second);
+    if (views.empty())
+      views.push_back(0);
+    std::sort(views.begin(), views.end());
+
+    std::vector<DispImageType> disparity_maps;
+    std::vector<vw::TransformPtr> transforms(1, m_transforms[0]);
+    std::vector<int> cameras;
+    for (size_t i = 0; i < views.size(); i++) {
+      disparity_maps.push_back(m_disparity_maps[views[i]]);
+      transforms.push_back(m_transforms[views[i] + 1]);
+      cameras.push_back(views[i] + 1);
+    }
+
+    return StereoTXAndErrorView(disparity_maps, transforms,
+                                m_stereo_model.select_cameras(cameras), m_bathy_model,
+                                m_is_map_projected, m_bathy_correct, m_cloud_type,
+                                m_left_aligned_bathy_mask, m_right_aligned_bathy_mask);
+  }
+
+  /// Whether the left mask has any water in the tile. This must be
+  /// called on the view made for this tile.
+  bool has_water(BBox2i const& bbox) const {
+    for (int row = bbox.min().y(); row < bbox.max().y(); row++)
+      for (int col = bbox.min().x(); col < bbox.max().x(); col++)
+        if (!is_valid(m_left_aligned_bathy_mask(col, row)))
+          return true;
+    return false;
+  }
+
+  /// For bathymetry, see if a left pixel and its disparity are worth
+  /// triangulating, given the cloud type, and if the rays go through
+  /// water in both images.
+  bool bathy_pixel(Vector2 const& lpix, DPixelT const& disp, bool & do_bathy) const {
+    do_bathy = false;
+    if (!is_valid(disp))
+      return false;
+
     // See if both the left and right matching pixels are in the aligned
     // bathymetry masks which means bathymetry correction should happen.
     Vector2 rpix = lpix + stereo::DispHelper(disp);
     Vector2 irpix(round(rpix.x()), round(rpix.y())); // integer version
 
     // Do bathy only when the mask is invalid (under water)
-    bool do_bathy = (!is_valid(m_left_aligned_bathy_mask(lpix.x(), lpix.y())) &&
+    do_bathy = (!is_valid(m_left_aligned_bathy_mask(lpix.x(), lpix.y())) &&
                 0 <= irpix.x() && irpix.x() < m_right_aligned_bathy_mask.cols() &&
                 0 <= irpix.y() && irpix.y() < m_right_aligned_bathy_mask.rows() &&
                 !is_valid(m_right_aligned_bathy_mask(irpix.x(), irpix.y())));
 
-    // See if we actually need to do anything
-    if ((m_cloud_type == BATHY_CLOUD && !do_bathy) ||
-        (m_cloud_type == TOPO_CLOUD && do_bathy)) {
-      // There is no point in continuing, as we won't get what is asked
-      subvector(result, 0, 3) = Vector3(0, 0, 0);
-      subvector(result, 3, 3) = Vector3(0, 0, 0);
-      return result;
-    }
-
-    // Do the triangulation. The did_bathy variable may change. 
-    bool did_bathy = false;
-    subvector(result, 0, 3) = m_bathy_model(pixVec, errorVec, do_bathy, did_bathy);
-    subvector(result, 3, 3) = errorVec;
+    // There is no point in continuing if we won't get what is asked
+    return !((m_cloud_type == BATHY_CLOUD && !do_bathy) ||
+             (m_cloud_type == TOPO_CLOUD && do_bathy));
+  }
 
+  /// The output for a point triangulated with bathymetry correction
+  void bathy_result(Vector3 const& point, Vector3 const& errorVec, bool did_bathy,
+                    pixel_type & result) const {
+    result = pixel_type();
+    
     // If we wanted to do bathy correction and it did not happen, or the opposite,
     // don't return the computed answer
     if ((m_cloud_type == BATHY_CLOUD && !did_bathy) ||
-        (m_cloud_type == TOPO_CLOUD && did_bathy)) {
-      subvector(result, 0, 3) = Vector3(0, 0, 0);
-      subvector(result, 3, 3) = Vector3(0, 0, 0);
-      return result;
-    }
+        (m_cloud_type == TOPO_CLOUD && did_bathy))
+      return;
 
     // Filter by triangulation error, if desired
     if (stereo_settings().max_valid_triangulation_error > 0.0 &&
-        norm_2(errorVec) > stereo_settings().max_valid_triangulation_error) {
-      result = pixel_type();
-      errorVec = Vector3();
-    }
-    
-    return result; // Contains location and error vector
-  }
-  
-  typedef StereoTXAndErrorView prerasterize_type;
-  inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
-    return PreRasterHelper(bbox, m_transforms);
+        norm_2(errorVec) > stereo_settings().max_valid_triangulation_error)
+      return;
+
+    subvector(result, 0, 3) = point;
+    subvector(result, 3, 3) = errorVec;
   }
-  template <class DestT>
-  inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
-    vw::rasterize(prerasterize(bbox), dest, bbox);
+
+  /// Triangulate a tile with bathymetry correction. The rays of the
+  /// pixels to triangulate are found for the whole tile at once, in
+  /// raster order, so linescan cameras find their pose once per line,
+  /// then they are bent and intersected. This must be called on the
+  /// view made for this tile.
+  void triangulate_bathy_tile(BBox2i const& bbox, ImageView<pixel_type> & tile) const {
+
+    std::vector<Vector2> pix0, pix1;
+    std::vector<int> cols, rows;
+    std::vector<char> do_bathy_vec;
+    for (int row = 0; row < bbox.height(); row++) {
+      for (int col = 0; col < bbox.width(); col++) {
+        tile(col, row) = pixel_type();
+        Vector2 pix(bbox.min().x() + col, bbox.min().y() + row);
+        DPixelT disp = m_disparity_maps[0](pix.x(), pix.y());
+        bool do_bathy = false;
+        if (!bathy_pixel(pix, disp, do_bathy))
+          continue;
+        pix0.push_back(m_transforms[0]->reverse(pix));
+        pix1.push_back(m_transforms[1]->reverse(pix + stereo::DispHelper(disp)));
+        cols.push_back(col);
+        rows.push_back(row);
+        do_bathy_vec.push_back(do_bathy);
+      }
+    }
+
+    std::vector<Vector3> ctr0, dir0, ctr1, dir1;
+    std::vector<unsigned char> valid0, valid1;
+    asp::pixels_to_rays(m_stereo_model.camera(0), pix0, ctr0, dir0, valid0);
+    asp::pixels_to_rays(m_stereo_model.camera(1), pix1, ctr1, dir1, valid1);
+
+    std::vector<Vector3> camDirs(2), camCtrs(2);
+    for (size_t k = 0; k < pix0.size(); k++) {
+      if (!valid0[k] || !valid1[k])
+        continue;
+      camDirs[0] = dir0[k]; camCtrs[0] = ctr0[k];
+      camDirs[1] = dir1[k]; camCtrs[1] = ctr1[k];
+      Vector3 errorVec;
+      bool did_bathy = false;
+      Vector3 point = m_bathy_model.triangulate_rays(camDirs, camCtrs, errorVec,
+                                                     do_bathy_vec[k], did_bathy);
+      bathy_result(point, errorVec, did_bathy, tile(cols[k], rows[k]));
+    }
   }
 
-private:
+  /// Triangulate all pixels of a tile together, with two images and no
+  /// bathymetry. This must be called on the view made for this tile.
+  void triangulate_tile(BBox2i const& bbox, ImageView<pixel_type> & tile) const {
+
+    int width = bbox.width(), height = bbox.height();
+    double nan = std::numeric_limits<double>::quiet_NaN();
+    std::vector<Vector2> pix0(size_t(width) * height, Vector2(nan, nan));
+    std::vector<Vector2> pix1(pix0.size(), Vector2(nan, nan));
+    for (int row = 0; row < height; row++) {
+      for (int col = 0; col < width; col++) {
+        // De-warp the pixels to the native camera coordinates. There is
+        // nothing to do without a disparity.
+        Vector2 pix(bbox.min().x() + col, bbox.min().y() + row);
+        DPixelT disp = m_disparity_maps[0](pix.x(), pix.y());
+        if (!is_valid(disp))
+          continue;
+        size_t k = size_t(row) * width + col;
+        pix0[k] = m_transforms[0]->reverse(pix);
+        pix1[k] = m_transforms[1]->reverse(pix + stereo::DispHelper(disp));
+      }
+    }
+
+    std::vector<Vector3> points, errors;
+    m_stereo_model.triangulate_tile(pix0, pix1, Vector2i(width, height),
+                                    stereo_settings().triangulation_ray_spacing,
+                                    stereo_settings().triangulation_ray_max_error,
+                                    points, errors);
+
+    double max_error = stereo_settings().max_valid_triangulation_error;
+    for (int row = 0; row < height; row++) {
+      for (int col = 0; col < width; col++) {
+        size_t k = size_t(row) * width + col;
+        pixel_type result;
+        // Filter by triangulation error, if desired
+        if (!(max_error > 0.0 && norm_2(errors[k]) > max_error)) {
+          subvector(result, 0, 3) = points[k];
+          subvector(result, 3, 3) = errors[k];
+        }
+        tile(col, row) = result;
+      }
+    }
+  }
 
   // Find the region associated with the right image that we need to bring in memory
   // based on the disparity 
@@ -224,7 +667,7 @@ private:
   
   /// RPC Map Transform needs to be explicitly copied and told to cache for performance.
   template <class T>
-  prerasterize_type PreRasterHelper(BBox2i const& bbox, std::vector<T> const& transforms) const {
+  StereoTXAndErrorView PreRasterHelper(BBox2i const& bbox, std::vector<T> const& transforms) const {
 
     ImageViewRef<PixelMask<float>> in_memory_left_aligned_bathy_mask;
     ImageViewRef<PixelMask<float>> in_memory_right_aligned_bathy_mask;
@@ -261,7 +704,7 @@ private:
         }
       }
 
-      return prerasterize_type(disparity_cropviews, transforms,
+      return StereoTXAndErrorView(disparity_cropviews, transforms,
                                m_stereo_model, m_bathy_model,
                                m_is_map_projected, m_bathy_correct, m_cloud_type,
                                in_memory_left_aligned_bathy_mask,
@@ -325,7 +768,7 @@ private:
       transforms_copy[p+1]->reverse_bbox(right_bbox);
     }
 
-    return prerasterize_type(disparity_cropviews, transforms_copy,
+    return StereoTXAndErrorView(disparity_cropviews, transforms_copy,
                              m_stereo_model, m_bathy_model,
                              m_is_map_projected, m_bathy_correct, m_cloud_type,
                              in_memory_left_aligned_bathy_mask, in_memory_right_aligned_bathy_mask);
@@ -336,7 +779,7 @@ private:
 StereoTXAndErrorView
 stereo_error_triangulate(std::vector<DispImageType> const& disparities,
                          std::vector<vw::TransformPtr>  const& transforms,
-                         vw::stereo::StereoModel        const& stereo_model,
+                         BatchStereoModel               const& stereo_model,
                          asp::BathyStereoModel          const& bathy_model,
                          bool is_map_projected,
                          bool bathy_correct,
@@ -370,6 +813,34 @@ inline point_and_error_norm( ImageViewBase<ImageT> const& image ) {
   return UnaryPerPixelView<ImageT, PointAndErrorNorm>(image.impl(), PointAndErrorNorm());
 }
 
+// The options to write the point cloud with. With --compact-point-cloud,
+// use the floating point predictor, which differences the bytes of
+// neighboring pixels along each row. The cloud values are multiples of
+// the rounding error, which is a power of 2, once the cloud center is
+// subtracted, so that leaves mostly zero bytes. These are compressed
+// with ZSTD if GDAL supports it, which is fast, else with DEFLATE.
+vw::GdalWriteOptions point_cloud_write_options(ASPGlobalOptions const& opt) {
+  vw::GdalWriteOptions write_opt = opt;
+  if (!stereo_settings().compact_point_cloud)
+    return write_opt;
+
+  std::string codec = "DEFLATE";
+  GDALAllRegister();
+  GDALDriverH driver = GDALGetDriverByName("GTiff");
+  if (driver != NULL) {
+    const char * creation_options
+      = GDALGetMetadataItem(driver, GDAL_DMD_CREATIONOPTIONLIST, NULL);
+    if (creation_options != NULL && std::string(creation_options).find("ZSTD") !=
+        std::string::npos)
+      codec = "ZSTD";
+  }
+  write_opt.gdal_options["COMPRESS"]  = codec;
+  write_opt.gdal_options["PREDICTOR"] = "3";
+  if (codec == "ZSTD")
+    write_opt.gdal_options["ZSTD_LEVEL"] = "1";
+  return write_opt;
+}
+
 template <class ImageT>
 void save_point_cloud(Vector3 const& shift, ImageT const& point_cloud,
                       std::string const& point_cloud_file,
@@ -381,6 +852,7 @@ void save_point_cloud(Vector3 const& shift, ImageT const& point_cloud,
 
   bool has_nodata = false;
   double nodata = -std::numeric_limits<float>::max(); // smallest float
+  vw::GdalWriteOptions write_opt = point_cloud_write_options(opt);
 
   if (opt.session->supports_multi_threading()){
     asp::block_write_approx_gdal_image
@@ -388,7 +860,7 @@ void save_point_cloud(Vector3 const& shift, ImageT const& point_cloud,
        stereo_settings().point_cloud_rounding_error,
        point_cloud,
        has_georef, georef, has_nodata, nodata,
-       opt, TerminalProgressCallback("asp", "\t--> Triangulating: "));
+       write_opt, TerminalProgressCallback("asp", "\t--> Triangulating: "));
   }else{
     // ISIS does not support multi-threading
     asp::write_approx_gdal_image
@@ -396,10 +868,81 @@ void save_point_cloud(Vector3 const& shift, ImageT const& point_cloud,
        stereo_settings().point_cloud_rounding_error,
        point_cloud,
        has_georef, georef, has_nodata, nodata,
-       opt, TerminalProgressCallback("asp", "\t--> Triangulating: "));
+       write_opt, TerminalProgressCallback("asp", "\t--> Triangulating: "));
   }
 }
 
+// Grid the triangulated points straight into a DEM, with the same
+// machinery and default settings as point2dem, so the point cloud is
+// never written to disk. Each tile of the cloud is triangulated once
+// and kept in the cache, as the rasterizer asks for it when finding the
+// extent of the cloud, and again for each DEM tile it overlaps.
+void save_direct_dem(ImageViewRef<Vector4> const& point_cloud,
+                     Vector3 const& cloud_center,
+                     std::string const& dem_file,
+                     ASPGlobalOptions const& opt) {
+
+  int ts = ASPGlobalOptions::tri_tile_size();
+  ImageViewRef<Vector4> cached_cloud
+    = block_cache(point_cloud, Vector2i(ts, ts), opt.num_threads);
+  ImageViewRef<Vector3> point_image = select_channels<3, 4, double>(cached_cloud, 0);
+  ImageViewRef<double>  error_image = select_channel(cached_cloud, 3);
+
+  // The projection of the cloud, as point2dem would use by default
+  cartography::GeoReference georef = opt.session->get_georef();
+  if (stereo_settings().direct_dem_srs != "")
+    asp::set_srs_string(stereo_settings().direct_dem_srs, false, cartography::Datum(),
+                        true, georef);
+
+  // As find_avg_lon(), but from the cloud center, to not triangulate a
+  // sample of the whole cloud just for that.
+  double avg_lon = (cloud_center.x() >= 0) ? 0 : 180;
+  if (georef.overall_proj4_str().find("+proj=aea") == std::string::npos)
+    georef.set_lon_center(avg_lon < 100);
+
+  ImageViewRef<Vector3> proj_points
+    = geodetic_to_point(asp::recenter_longitude(cartesian_to_geodetic(point_image, georef),
+                                                avg_lon),
+                        georef);
+
+  // Remove outliers as point2dem does by default
+  Vector2 remove_outliers_params(75.0, 3.0);
+  BBox3 estim_proj_box;
+  double estim_max_error
+    = asp::estim_max_tri_error_and_proj_box(proj_points, error_image,
+                                            remove_outliers_params, estim_proj_box);
+
+  vw::Mutex count_mutex;
+  std::int64_t num_invalid_pixels = 0;
+  double nodata = -std::numeric_limits<float>::max(); // smallest float
+  asp::OrthoRasterizerView
+    rasterizer(proj_points, select_channel(proj_points, 2),
+               0.0, 0.0, false, ts, BBox2(),
+               asp::PERCENTILE_OUTLIER_METHOD, remove_outliers_params,
+               error_image, estim_max_error, estim_proj_box, 0.0,
+               Vector2(), 0, false, "weighted_average", 1.0,
+               &num_invalid_pixels, &count_mutex, "", "",
+               TerminalProgressCallback("asp", "\t--> Triangulating: "));
+  rasterizer.set_use_minz_as_default(false);
+  rasterizer.set_default_value(nodata);
+  rasterizer.initialize_spacing(stereo_settings().direct_dem_spacing);
+
+  georef.set_transform(rasterizer.geo_transform());
+  if (georef.pixel_interpretation() == cartography::GeoReference::PixelAsArea) {
+    Matrix3x3 transform = georef.transform();
+    transform(0,2) -= 0.5 * transform(0,0);
+    transform(1,2) -= 0.5 * transform(1,1);
+    georef.set_transform(transform);
+  }
+
+  vw_out() << "Writing DEM: " << dem_file << "\n";
+  vw_out() << "\t--> DEM spacing: " << rasterizer.spacing() << "\n";
+  bool has_georef = true, has_nodata = true;
+  cartography::block_write_gdal_image(dem_file, rasterizer, has_georef, georef,
+                                      has_nodata, nodata, opt,
+                                      TerminalProgressCallback("asp", "\t--> Gridding: "));
+}
+
 // TODO(oalexan1): Move this to some low-level utils file  
 Vector3 find_approx_points_median(std::vector<Vector3> const& points){
 
@@ -487,6 +1030,82 @@ Vector3 find_point_cloud_center(Vector2i const& tile_size,
   return find_approx_points_median(points);
 }
 
+// Estimate the point cloud center by triangulating a sample of the
+// pixels of the low-resolution disparity D_sub, scaled to full
+// resolution. That is much less work than triangulating tiles of the
+// full-resolution disparity, and the sample covers the whole cloud.
+// Each pixel is picked at random in its cell of a grid, with a fixed
+// seed, so the result is repeatable. Use the first image pair. Return
+// false if D_sub does not exist or has too few valid pixels.
+bool find_point_cloud_center_from_D_sub(ASPGlobalOptions const& opt,
+                                        std::vector<vw::TransformPtr> const& transforms,
+                                        BatchStereoModel const& stereo_model,
+                                        Vector3 & center) {
+  center = Vector3();
+  std::string d_sub_file = opt.out_prefix + "-D_sub.tif";
+  if (!fs::exists(d_sub_file))
+    return false;
+
+  ImageView<PixelMask<Vector2f>> sub_disp;
+  Vector2 upsample_scale;
+  try {
+    ImageViewRef<PixelMask<Vector2f>> sub_disp_ref;
+    asp::load_D_sub_and_scale(opt, d_sub_file, sub_disp_ref, upsample_scale);
+    sub_disp = sub_disp_ref;
+  } catch (std::exception const& e) {
+    vw_out(WarningMessage) << e.what();
+    return false;
+  }
+
+  // The region to triangulate, in D_sub pixels
+  BBox2 crop_win = stereo_settings().trans_crop_win;
+  BBox2i sub_box(floor(crop_win.min().x() / upsample_scale.x()),
+                 floor(crop_win.min().y() / upsample_scale.y()),
+                 0, 0);
+  sub_box.max() = Vector2i(ceil(crop_win.max().x() / upsample_scale.x()),
+                           ceil(crop_win.max().y() / upsample_scale.y()));
+  sub_box.crop(bounding_box(sub_disp));
+  if (sub_box.empty())
+    return false;
+
+  std::vector<int> right_camera(1, 1);
+  BatchStereoModel model = stereo_model.select_cameras(right_camera);
+  std::vector<Vector2> pixVec(2);
+
+  const int grid_size = 64, min_num_points = 100;
+  double cell_w = std::max(1.0, sub_box.width()  / double(grid_size));
+  double cell_h = std::max(1.0, sub_box.height() / double(grid_size));
+  std::mt19937 gen(0);
+  std::uniform_real_distribution<double> dist(0.0, 1.0);
+  std::vector<Vector3> points;
+  for (double y = sub_box.min().y(); y < sub_box.max().y(); y += cell_h) {
+    for (double x = sub_box.min().x(); x < sub_box.max().x(); x += cell_w) {
+      int col = std::min(int(x + dist(gen) * cell_w), sub_box.max().x() - 1);
+      int row = std::min(int(y + dist(gen) * cell_h), sub_box.max().y() - 1);
+      PixelMask<Vector2f> disp = sub_disp(col, row);
+      if (!is_valid(disp))
+        continue;
+
+      Vector2 left_pix(col, row);
+      Vector2 right_pix = left_pix + disp.child();
+      try {
+        pixVec[0] = transforms[0]->reverse(elem_prod(left_pix,  upsample_scale));
+        pixVec[1] = transforms[1]->reverse(elem_prod(right_pix, upsample_scale));
+        Vector3 errorVec;
+        Vector3 xyz = model(pixVec, errorVec);
+        if (xyz != Vector3())
+          points.push_back(xyz);
+      } catch (...) {}
+    }
+  }
+
+  if ((int)points.size() < min_num_points)
+    return false;
+
+  center = find_approx_points_median(points);
+  return true;
+}
+
 // TODO(oalexan1): Move this to some low-level new util file
 bool read_point(std::string const& file, Vector3 & point){
   point = Vector3();
@@ -524,6 +1143,12 @@ void disp_or_matches_or_jitter_work(std::string const& output_prefix,
    
   ASPGlobalOptions opt = opt_vec[0];
   bool is_map_projected = opt.session->isMapProjected();
+
+  // Matches from disparity are found in parallel, unless the cameras
+  // do not support multi-threading
+  ASPGlobalOptions match_opt = opt;
+  if (!opt.session->supports_multi_threading())
+    match_opt.num_threads = 1;
     
   // Transforms to compensate for alignment
   vw::TransformPtr left_trans  = transforms[0];
@@ -550,13 +1175,13 @@ void disp_or_matches_or_jitter_work(std::string const& output_prefix,
       
   if (stereo_settings().num_matches_from_disparity > 0) {
     bool gen_triplets = false;
-    compute_matches_from_disp(opt, disparity_maps[0], left_trans, right_trans, match_file,
+    compute_matches_from_disp(match_opt, disparity_maps[0], left_trans, right_trans, match_file,
                               stereo_settings().num_matches_from_disparity,
                               gen_triplets, is_map_projected);
   }
   if (stereo_settings().num_matches_from_disp_triplets > 0) {
     bool gen_triplets = true;
-    compute_matches_from_disp(opt, disparity_maps[0], left_trans, right_trans, match_file,
+    compute_matches_from_disp(match_opt, disparity_maps[0], left_trans, right_trans, match_file,
                               stereo_settings().num_matches_from_disp_triplets,
                               gen_triplets, is_map_projected);
   }
@@ -569,16 +1194,12 @@ void disp_or_matches_or_jitter_work(std::string const& output_prefix,
     double max_num_matches = stereo_settings().num_matches_for_piecewise_adjustment;
         
     bool gen_triplets = false;
-    compute_matches_from_disp(opt, disparity_maps[0], left_trans, right_trans, match_file,
+    compute_matches_from_disp(match_opt, disparity_maps[0], left_trans, right_trans, match_file,
                               max_num_matches, gen_triplets, is_map_projected);
       
-    int num_threads = opt.num_threads;
-    if (!opt.session->supports_multi_threading()) 
-      num_threads = 1;
-        
     asp::jitter_adjust(image_files, camera_files, cameras,
                        output_prefix, opt.session->name(),
-                       match_file,  num_threads);
+                       match_file,  match_opt.num_threads);
     //asp::ccd_adjust(image_files, camera_files, cameras, output_prefix,
     //                match_file,  num_threads);
   }
@@ -713,8 +1334,7 @@ void stereo_triangulation(std::string const& output_prefix,
     // the regular stereo model and bathy stereo model can have
     // different interfaces and the former need not know about the
     // latter. Templates are avoided too.
-    vw::stereo::StereoModel stereo_model(camera_ptrs, stereo_settings().use_least_squares,
-                                         angle_tol);
+    BatchStereoModel stereo_model(camera_ptrs, stereo_settings().use_least_squares, angle_tol);
     asp::BathyStereoModel bathy_stereo_model(camera_ptrs, stereo_settings().use_least_squares,
                                              angle_tol);
     
@@ -767,13 +1387,24 @@ void stereo_triangulation(std::string const& output_prefix,
     bool crop_left  = (stereo_settings().left_image_crop_win  != BBox2i(0, 0, 0, 0));
     bool crop_right = (stereo_settings().right_image_crop_win != BBox2i(0, 0, 0, 0));
 
+    if (stereo_settings().direct_dem) {
+      if (stereo_settings().skip_point_cloud_center_comp)
+        vw_throw(ArgumentErr() << "The option --direct-dem does not work with "
+                 << "parallel_stereo. Use point2dem on the point cloud instead.\n");
+      if (!opt_vec[0].session->supports_multi_threading())
+        vw_throw(ArgumentErr() << "The option --direct-dem needs cameras which support "
+                 << "multi-threading. Use point2dem on the point cloud instead.\n");
+    }
+
     // Compute the point cloud center, unless done by now
     Vector3 cloud_center = Vector3();
     if (!stereo_settings().save_double_precision_point_cloud){
       std::string cloud_center_file = output_prefix + "-PC-center.txt";
       if (!read_point(cloud_center_file, cloud_center) || crop_left || crop_right){
         if (!stereo_settings().skip_point_cloud_center_comp) {
-          cloud_center = find_point_cloud_center(opt_vec[0].raster_tile_size, point_cloud);
+          if (!find_point_cloud_center_from_D_sub(opt_vec[0], transforms, stereo_model,
+                                                  cloud_center))
+            cloud_center = find_point_cloud_center(opt_vec[0].raster_tile_size, point_cloud);
           vw_out() << "Writing point cloud center: " << cloud_center_file << std::endl;
           write_point(cloud_center_file, cloud_center);
         }
@@ -790,7 +1421,13 @@ void stereo_triangulation(std::string const& output_prefix,
     // so force rasterization in that box only using crop().
     BBox2i cbox = stereo_settings().trans_crop_win;
     std::string point_cloud_file = output_prefix + "-PC.tif";
-    if (stereo_settings().compute_error_vector){
+    if (stereo_settings().direct_dem) {
+      // The center is needed only for the longitude range here
+      if (cloud_center == Vector3())
+        cloud_center = find_point_cloud_center(opt_vec[0].raster_tile_size, point_cloud);
+      ImageViewRef<Vector4> crop_pc = crop(point_and_error_norm(point_cloud), cbox);
+      save_direct_dem(crop_pc, cloud_center, output_prefix + "-DEM.tif", opt_vec[0]);
+    }else if (stereo_settings().compute_error_vector){
 
       if (num_cams > 2)
         vw_out(WarningMessage) << "For more than two cameras, the error "
@@ -804,6 +1441,12 @@ void stereo_triangulation(std::string const& output_prefix,
       save_point_cloud(cloud_center, crop_pc, point_cloud_file, opt_vec[0]);
     } // End if/else
 
+    // With parallel_stereo --assemble-tiles. There is no point cloud
+    // with --direct-dem.
+    if (!stereo_settings().tile_mosaic.empty() && !stereo_settings().direct_dem)
+      add_tile_to_mosaic(point_cloud_file, cbox, opt_vec[0].out_prefix + "-L.tif",
+                         stereo_settings().tile_mosaic);
+
     // Must print this at the end, as it contains statistics on the number of rejected points.
     vw_out() << "\t--> " << universe_radius_func;
 
@@ -816,6 +1459,51 @@ void stereo_triangulation(std::string const& output_prefix,
 
 } // End namespace asp
 
+// Run triangulation for the given arguments
+void run_triangulation(int argc, char* argv[]) {
+
+  // Unlike other stereo executables, triangulation can handle multiple images and cameras.
+  bool verbose = false;
+  std::vector<asp::ASPGlobalOptions> opt_vec;
+  std::string output_prefix;
+  asp::parse_multiview(argc, argv, asp::TriangulationDescription(),
+                       verbose, output_prefix, opt_vec);
+  asp::StageReport report("tri");
+
+  if (opt_vec.size() > 1){
+    // For multiview, turn on logging to file in the run directory
+    // in output_prefix, not just in individual subdirectories.
+    asp::log_to_file(argc, argv, opt_vec[0].stereo_default_filename,
+                     output_prefix);
+  }
+
+  // Keep only those stereo pairs for which filtered disparity exists
+  std::vector<asp::ASPGlobalOptions> opt_vec_new;
+  for (int p = 0; p < (int)opt_vec.size(); p++){
+    if (fs::exists(opt_vec[p].out_prefix+"-F.tif"))
+      opt_vec_new.push_back(opt_vec[p]);
+  }
+  opt_vec = opt_vec_new;
+  if (opt_vec.empty())
+    vw_throw( ArgumentErr() << "No valid F.tif files found.\n" );
+
+  // Triangulation uses small tiles.
+  //---------------------------------------------------------
+  int ts = asp::ASPGlobalOptions::tri_tile_size();
+  for (int s = 0; s < (int)opt_vec.size(); s++)
+    opt_vec[s].raster_tile_size = Vector2i(ts, ts);
+
+  // Internal Processes
+  //---------------------------------------------------------
+
+  asp::stereo_triangulation(output_prefix, opt_vec);
+
+  if (opt_vec[0].stage_report)
+    report.save(output_prefix, asp::stereo_settings().trans_crop_win);
+
+  vw_out() << "\n[ " << asp::current_posix_time_string() << " ] : TRIANGULATION FINISHED \n";
+}
+
 int main(int argc, char* argv[]) {
 
   if (asp::stereo_settings().correlator_mode) {
@@ -830,42 +1518,8 @@ int main(int argc, char* argv[]) {
 
     asp::stereo_register_sessions();
 
-    // Unlike other stereo executables, triangulation can handle multiple images and cameras.
-    bool verbose = false;
-    std::vector<asp::ASPGlobalOptions> opt_vec;
-    std::string output_prefix;
-    asp::parse_multiview(argc, argv, asp::TriangulationDescription(),
-                         verbose, output_prefix, opt_vec);
-
-    if (opt_vec.size() > 1){
-      // For multiview, turn on logging to file in the run directory
-      // in output_prefix, not just in individual subdirectories.
-      asp::log_to_file(argc, argv, opt_vec[0].stereo_default_filename,
-                       output_prefix);
-    }
-
-    // Keep only those stereo pairs for which filtered disparity exists
-    std::vector<asp::ASPGlobalOptions> opt_vec_new;
-    for (int p = 0; p < (int)opt_vec.size(); p++){
-      if (fs::exists(opt_vec[p].out_prefix+"-F.tif"))
-        opt_vec_new.push_back(opt_vec[p]);
-    }
-    opt_vec = opt_vec_new;
-    if (opt_vec.empty())
-      vw_throw( ArgumentErr() << "No valid F.tif files found.\n" );
-
-    // Triangulation uses small tiles.
-    //---------------------------------------------------------
-    int ts = asp::ASPGlobalOptions::tri_tile_size();
-    for (int s = 0; s < (int)opt_vec.size(); s++)
-      opt_vec[s].raster_tile_size = Vector2i(ts, ts);
-
-    // Internal Processes
-    //---------------------------------------------------------
-
-    asp::stereo_triangulation(output_prefix, opt_vec);
-
-    vw_out() << "\n[ " << asp::current_posix_time_string() << " ] : TRIANGULATION FINISHED \n";
+    if (!asp::run_tile_queue(argc, argv, run_triangulation))
+      run_triangulation(argc, argv);
 
     xercesc::XMLPlatformUtils::Terminate();
   } ASP_STANDARD_CATCHES;
@@ -21,7 +21,7 @@
 # functions do.
 
 from __future__ import print_function
-import sys, optparse, subprocess, re, os, time, glob
+import sys, optparse, subprocess, re, os, time, glob, hashlib
 import os.path as P
 
 # The path to the ASP python files.
@@ -35,7 +35,7 @@ sys.path.insert(0, libexecpath)
 from asp_system_utils import *
 from asp_alg_utils import *
 
-import asp_system_utils, asp_string_utils
+import asp_system_utils, asp_string_utils, asp_cmd_utils
 asp_system_utils.verify_python_version_is_supported()
 
 # For consistency with C++
@@ -297,6 +297,107 @@ def parse_corr_seed_mode(filename):
 
     return mode
 
+def file_hash(filename):
+    '''The SHA-256 hash of the contents of a file, or an empty string if
+    the file does not exist.'''
+    if filename is None or filename == '' or not os.path.isfile(filename):
+        return ''
+    h = hashlib.sha256()
+    with open(filename, 'rb') as f:
+        while True:
+            chunk = f.read(1 << 22)
+            if not chunk:
+                break
+            h.update(chunk)
+    return h.hexdigest()
+
+def signature(items):
+    '''Combine a list of strings into a single hash.'''
+    h = hashlib.sha256()
+    for item in items:
+        h.update(item.encode('utf-8'))
+        h.update(b'\n')
+    return h.hexdigest()
+
+def options_signature(args):
+    '''A hash of the stereo options, except for those which do not change
+    the results, such as the number of threads.'''
+    local_args = args[:] # deep copy
+    for (option, num) in [('--threads', 1), ('--processes', 1),
+                          ('--threads-multiprocess', 1), ('--stage-report', 0)]:
+        asp_cmd_utils.wipe_option(local_args, option, num)
+    return signature(local_args)
+
+def read_signatures(sig_file):
+    '''Read a file having on each line a key and a signature.'''
+    sigs = {}
+    if not os.path.exists(sig_file):
+        return sigs
+    with open(sig_file, 'r') as f:
+        for line in f:
+            vals = line.split()
+            if len(vals) == 2:
+                sigs[vals[0]] = vals[1]
+    return sigs
+
+def write_signatures(sig_file, sigs):
+    with open(sig_file, 'w') as f:
+        for key in sorted(sigs.keys()):
+            f.write(key + ' ' + sigs[key] + '\n')
+
+def touch_files(files):
+    '''Set the modification time of existing files to now, in the given
+    order, so that the checks by timestamp in the stereo executables
+    consider them up-to-date.'''
+    for f in files:
+        if os.path.isfile(f) and not os.path.islink(f):
+            os.utime(f, None)
+
+def merge_stage_reports(out_prefix):
+    '''Merge the JSON reports written with --stage-report by each stereo
+    executable, either for the full run or for each parallel_stereo tile,
+    into <out_prefix>-stage-report.json. Per stage, the times and bytes are
+    summed over the tiles, and the largest time and peak memory are kept.'''
+
+    import json
+    merged_file = out_prefix + '-stage-report.json'
+    files = glob.glob(out_prefix + '-*-report.json') + \
+            glob.glob(out_prefix + '-*/*-report.json')
+    files = sorted([f for f in files if f != merged_file])
+    if len(files) == 0:
+        return
+
+    reports = []
+    for f in files:
+        try:
+            with open(f, 'r') as fh:
+                report = json.load(fh)
+            report['file'] = f
+            reports.append(report)
+        except Exception as e:
+            print("Warning: Could not read: " + f + ". " + str(e))
+
+    stages = {}
+    for report in reports:
+        name = report['stage']
+        if name not in stages:
+            stages[name] = {'num_tiles': 0, 'wall_time_sec': 0.0, 'max_wall_time_sec': 0.0,
+                            'cpu_time_sec': 0.0, 'peak_rss_mb': 0.0, 'bytes_read': 0.0,
+                            'bytes_written': 0.0}
+        s = stages[name]
+        s['num_tiles'] += 1
+        s['wall_time_sec'] += report['wall_time_sec']
+        s['max_wall_time_sec'] = max(s['max_wall_time_sec'], report['wall_time_sec'])
+        s['cpu_time_sec'] += report['cpu_time_sec']
+        s['peak_rss_mb'] = max(s['peak_rss_mb'], report['peak_rss_mb'])
+        for key in ['bytes_read', 'bytes_written']:
+            if report[key] >= 0:
+                s[key] += report[key]
+
+    with open(merged_file, 'w') as fh:
+        json.dump({'stages': stages, 'tiles': reports}, fh, indent = 2)
+    print("Wrote: " + merged_file)
+
 def run_multiview(prog_name, args, extra_args, entry_point, stop_point,
                   verbose, settings):
 
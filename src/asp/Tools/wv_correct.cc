@@ -538,6 +538,56 @@ void get_offsets(int tdi, bool is_wv01, bool is_forward,
   }
 }
 
+// Shift each column of an image by its own subpixel amounts, using
+// bilinear interpolation with constant edge extension, as
+// interpolate() would. Pixel (col, row) of the tile is the value of the
+// image at (col + beg_col + shiftx[col], row + beg_row + shifty[col]).
+// The shifts are the same for all rows of a column, so the integer
+// offsets and the weights are found once per column, and then the tile
+// is formed a full row at a time, with a loop simple enough for the
+// compiler to vectorize.
+template <class PixelT>
+void shift_columns(ImageView<PixelT> const& img, int beg_col, int beg_row,
+                   std::vector<double> const& shiftx, std::vector<double> const& shifty,
+                   ImageView<PixelT> & tile) {
+
+  int cols = tile.cols(), rows = tile.rows();
+  int last_col = img.cols() - 1, last_row = img.rows() - 1;
+  VW_ASSERT(int(shiftx.size()) == cols && int(shifty.size()) == cols,
+            ArgumentErr() << "wv_correct: Expecting one shift per column.");
+  
+  // The columns to interpolate between, and the offsets of the rows
+  std::vector<int> col0(cols), col1(cols), row_off(cols);
+  std::vector<double> wx(cols), wy(cols);
+  for (int col = 0; col < cols; col++) {
+    double x = col + beg_col + shiftx[col];
+    int x0 = (int)floor(x);
+    wx[col] = x - x0;
+    col0[col] = std::min(std::max(x0, 0), last_col);
+    col1[col] = std::min(std::max(x0 + 1, 0), last_col);
+
+    double y = beg_row + shifty[col];
+    int y0 = (int)floor(y);
+    wy[col] = y - y0;
+    row_off[col] = y0;
+  }
+
+  PixelT const* data = &img(0, 0);
+  std::ptrdiff_t stride = img.cols();
+  for (int row = 0; row < rows; row++) {
+    PixelT * out = &tile(0, row);
+    for (int col = 0; col < cols; col++) {
+      int r0 = std::min(std::max(row + row_off[col],     0), last_row);
+      int r1 = std::min(std::max(row + row_off[col] + 1, 0), last_row);
+      PixelT const* p0 = data + r0 * stride;
+      PixelT const* p1 = data + r1 * stride;
+      double a = wx[col], b = wy[col];
+      out[col] = PixelT((1.0 - b) * ((1.0 - a) * p0[col0[col]] + a * p0[col1[col]]) +
+                        b         * ((1.0 - a) * p1[col0[col]] + a * p1[col1[col]]));
+    }
+  }
+}
+
 // Apply WorldView corrections to each vertical block as high as the image
 // corresponding to one CCD sensor.
 template <class ImageT>
@@ -547,6 +597,7 @@ class WVPerBlockCorrectView: public ImageViewBase<WVPerBlockCorrectView<ImageT>>
   bool m_is_wv01, m_is_forward;
   double m_pitch_ratio;
   std::vector<double> m_posx, m_ccdx, m_posy, m_ccdy;
+  std::vector<double> m_shiftx, m_shifty; // per column
   
   typedef typename ImageT::pixel_type PixelT;
 
@@ -567,6 +618,22 @@ public:
               m_posy.size() == m_ccdy.size(),
               ArgumentErr() << "wv_correct: Expecting the arrays of positions "
               << "and offsets to have the same sizes.");
+
+    // Accumulate the corrections up to each column, once for all tiles
+    m_shiftx.resize(m_img.cols(), 0.0);
+    m_shifty.resize(m_img.cols(), 0.0);
+    if (m_ccdx.size() > 0) {
+      for (int col = 0; col < m_img.cols(); col++) {
+        for (size_t t = 0; t < m_ccdx.size(); t++) {
+          if (m_posx[t] < col)
+            m_shiftx[col] -= m_ccdx[t];
+        }
+        for (size_t t = 0; t < m_ccdy.size(); t++) {
+          if (m_posy[t] < col)
+            m_shifty[col] -= m_ccdy[t];
+        }
+      }
+    }
   }
   
   typedef PixelT pixel_type;
@@ -596,37 +663,14 @@ public:
     biased_box.crop(bounding_box(m_img));
     
     ImageView<result_type> cropped_img = crop(m_img, biased_box);
-    InterpolationView<EdgeExtensionView< ImageView<result_type>,
-      ConstantEdgeExtension >, BilinearInterpolation> interp_img
-      = interpolate(cropped_img, BilinearInterpolation(),
-                    ConstantEdgeExtension());
 
+    std::vector<double> shiftx(m_shiftx.begin() + bbox.min().x(),
+                               m_shiftx.begin() + bbox.max().x());
+    std::vector<double> shifty(m_shifty.begin() + bbox.min().x(),
+                               m_shifty.begin() + bbox.max().x());
     ImageView<result_type> tile(bbox.width(), bbox.height());
-    for (int col = bbox.min().x(); col < bbox.max().x(); col++){
-
-      // Accumulate the corrections up to the current column
-      double valx = 0, valy = 0;
-      if (m_ccdx.size() > 0){
-        valx = 0.0;
-        for (size_t t = 0; t < m_ccdx.size(); t++){
-          if (m_posx[t] < col){
-            valx -= m_ccdx[t];
-          }
-        }
-        valy = 0.0;
-        for (size_t t = 0; t < m_ccdy.size(); t++){
-          if (m_posy[t] < col){
-            valy -= m_ccdy[t];
-          }
-        }
-      }
-      
-      for (int row = bbox.min().y(); row < bbox.max().y(); row++){
-        tile(col - bbox.min().x(), row - bbox.min().y() )
-          = interp_img(col - biased_box.min().x() + valx,
-                       row - biased_box.min().y() + valy);
-      }
-    }
+    shift_columns(cropped_img, bbox.min().x() - biased_box.min().x(),
+                  bbox.min().y() - biased_box.min().y(), shiftx, shifty, tile);
     
     return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(),
                              cols(), rows() );
@@ -703,22 +747,17 @@ public:
     biased_box.crop(bounding_box(m_img));
     
     ImageView<result_type> cropped_img = crop(m_img, biased_box);
-    InterpolationView<EdgeExtensionView< ImageView<result_type>,
-      ConstantEdgeExtension >, BilinearInterpolation> interp_img
-      = interpolate(cropped_img, BilinearInterpolation(),
-                    ConstantEdgeExtension());
-
-    
-    ImageView<result_type> tile(bbox.width(), bbox.height());
 
+    // Note that the same correction is used for an entire column
+    std::vector<double> shiftx(bbox.width()), shifty(bbox.width());
     for (int col = bbox.min().x(); col < bbox.max().x(); col++) {
-      for (int row = bbox.min().y(); row < bbox.max().y(); row++) {
-        // Note that the same correction is used for an entire column
-        tile(col - bbox.min().x(), row - bbox.min().y() )
-          = interp_img(col - biased_box.min().x() - m_dx[col],
-                       row - biased_box.min().y() - m_dy[col]);
-      }
+      shiftx[col - bbox.min().x()] = -m_dx[col];
+      shifty[col - bbox.min().x()] = -m_dy[col];
     }
+    
+    ImageView<result_type> tile(bbox.width(), bbox.height());
+    shift_columns(cropped_img, bbox.min().x() - biased_box.min().x(),
+                  bbox.min().y() - biased_box.min().y(), shiftx, shifty, tile);
 
     return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(),
                              cols(), rows() );